@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include "AllocationTracker.h"
+
+#if SFB_ALLOCATION_TRACKING_ENABLED
+
+#include <pthread.h>
+#include <malloc/malloc.h>
+#include <mach/mach.h>
+#include <mach/mach_error.h>
+#include <dispatch/dispatch.h>
+
+#include "Logger.h"
+
+namespace {
+
+	pthread_key_t sScopeKey;
+	std::atomic_bool sInstalled(false);
+
+	// The default zone's original functions
+	void * (*sMalloc)(malloc_zone_t *zone, size_t size) = nullptr;
+	void * (*sCalloc)(malloc_zone_t *zone, size_t count, size_t size) = nullptr;
+	void * (*sValloc)(malloc_zone_t *zone, size_t size) = nullptr;
+	void * (*sRealloc)(malloc_zone_t *zone, void *ptr, size_t size) = nullptr;
+	void * (*sMemalign)(malloc_zone_t *zone, size_t alignment, size_t size) = nullptr;
+
+}
+
+namespace SFB {
+	namespace AllocationTracker {
+
+		// Nothing here may allocate
+		void RecordAllocation(size_t size)
+		{
+			for(auto scope = static_cast<Scope *>(pthread_getspecific(sScopeKey)); scope; scope = scope->mPrevious) {
+				scope->mCounter.mAllocationCount.fetch_add(1, std::memory_order_relaxed);
+				scope->mCounter.mByteCount.fetch_add(size, std::memory_order_relaxed);
+			}
+		}
+
+	}
+}
+
+namespace {
+
+	void * TrackingMalloc(malloc_zone_t *zone, size_t size)
+	{
+		SFB::AllocationTracker::RecordAllocation(size);
+		return sMalloc(zone, size);
+	}
+
+	void * TrackingCalloc(malloc_zone_t *zone, size_t count, size_t size)
+	{
+		SFB::AllocationTracker::RecordAllocation(count * size);
+		return sCalloc(zone, count, size);
+	}
+
+	void * TrackingValloc(malloc_zone_t *zone, size_t size)
+	{
+		SFB::AllocationTracker::RecordAllocation(size);
+		return sValloc(zone, size);
+	}
+
+	void * TrackingRealloc(malloc_zone_t *zone, void *ptr, size_t size)
+	{
+		SFB::AllocationTracker::RecordAllocation(size);
+		return sRealloc(zone, ptr, size);
+	}
+
+	void * TrackingMemalign(malloc_zone_t *zone, size_t alignment, size_t size)
+	{
+		SFB::AllocationTracker::RecordAllocation(size);
+		return sMemalign(zone, alignment, size);
+	}
+
+}
+
+bool SFB::AllocationTracker::Install()
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		if(pthread_key_create(&sScopeKey, nullptr)) {
+			LOGGER_ERR("org.sbooth.AudioEngine.AllocationTracker", "pthread_key_create failed");
+			return;
+		}
+
+		// The zone structure may be read-only
+		malloc_zone_t *zone = malloc_default_zone();
+		kern_return_t result = vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(malloc_zone_t), 0, VM_PROT_READ | VM_PROT_WRITE);
+		if(KERN_SUCCESS != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.AllocationTracker", "vm_protect failed: " << mach_error_string(result));
+			return;
+		}
+
+		sMalloc = zone->malloc;
+		sCalloc = zone->calloc;
+		sValloc = zone->valloc;
+		sRealloc = zone->realloc;
+
+		zone->malloc = TrackingMalloc;
+		zone->calloc = TrackingCalloc;
+		zone->valloc = TrackingValloc;
+		zone->realloc = TrackingRealloc;
+
+		if(5 <= zone->version && zone->memalign) {
+			sMemalign = zone->memalign;
+			zone->memalign = TrackingMemalign;
+		}
+
+		vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(malloc_zone_t), 0, VM_PROT_READ);
+
+		sInstalled.store(true);
+
+		LOGGER_NOTICE("org.sbooth.AudioEngine.AllocationTracker", "Allocation tracking installed");
+	});
+
+	return sInstalled.load();
+}
+
+bool SFB::AllocationTracker::IsInstalled()
+{
+	return sInstalled.load(std::memory_order_relaxed);
+}
+
+SFB::AllocationTracker::Scope::Scope(Counter& counter)
+	: mCounter(counter), mPrevious(nullptr), mActive(sInstalled.load(std::memory_order_relaxed))
+{
+	if(mActive) {
+		mPrevious = static_cast<Scope *>(pthread_getspecific(sScopeKey));
+		pthread_setspecific(sScopeKey, this);
+	}
+}
+
+SFB::AllocationTracker::Scope::~Scope()
+{
+	if(mActive)
+		pthread_setspecific(sScopeKey, mPrevious);
+}
+
+#else
+
+bool SFB::AllocationTracker::Install()
+{
+	return false;
+}
+
+bool SFB::AllocationTracker::IsInstalled()
+{
+	return false;
+}
+
+#endif
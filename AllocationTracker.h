@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/*! @file AllocationTracker.h @brief Counting of heap allocations made by tagged threads */
+
+/*!
+ * @brief Whether allocation tracking is compiled
+ *
+ * Allocation tracking is enabled by default in debug builds and may be enabled in other builds by defining
+ * \c SFB_ALLOCATION_TRACKING_ENABLED to \c 1.  When disabled \c Scope does nothing and \c Install() fails.
+ */
+#ifndef SFB_ALLOCATION_TRACKING_ENABLED
+# if DEBUG
+#  define SFB_ALLOCATION_TRACKING_ENABLED 1
+# else
+#  define SFB_ALLOCATION_TRACKING_ENABLED 0
+# endif
+#endif
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*!
+	 * @brief The namespace containing allocation tracking functionality
+	 *
+	 * When installed, the default malloc zone's allocation functions are replaced with functions that count
+	 * allocations made while a \c Scope is active on the calling thread.  Scopes nest, and an allocation is counted
+	 * by every active scope on the thread.  Counting doesn't allocate or lock so scopes may be used on the
+	 * real-time thread.
+	 * @note Only allocations from the default malloc zone are counted
+	 */
+	namespace AllocationTracker {
+
+		/*! @brief Allocation counts */
+		struct Counter {
+			/*! @brief Create a new \c Counter with zero counts */
+			Counter()
+				: mAllocationCount(0), mByteCount(0)
+			{}
+
+			/*! @brief Set the counts to zero */
+			inline void Reset()
+			{
+				mAllocationCount.store(0, std::memory_order_relaxed);
+				mByteCount.store(0, std::memory_order_relaxed);
+			}
+
+			std::atomic_ullong	mAllocationCount;	/*!< The number of allocations */
+			std::atomic_ullong	mByteCount;			/*!< The number of bytes requested */
+		};
+
+		/*!
+		 * @brief Install the allocation hooks
+		 * @note The hooks can't be removed once installed
+		 * @return \c true if the hooks are installed, \c false otherwise
+		 */
+		bool Install();
+
+		/*! @brief Query whether the allocation hooks are installed */
+		bool IsInstalled();
+
+		/*! @brief Counts allocations made by the calling thread into a \c Counter for the scope's lifetime */
+		class Scope
+		{
+		public:
+#if SFB_ALLOCATION_TRACKING_ENABLED
+			/*! @brief Begin counting allocations made by this thread into \c counter */
+			explicit Scope(Counter& counter);
+
+			/*! @brief Stop counting allocations into the counter */
+			~Scope();
+#else
+			explicit Scope(Counter& /*counter*/)	{}
+#endif
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			Scope(const Scope& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			Scope& operator=(const Scope& rhs) = delete;
+
+			/*! @endcond */
+
+#if SFB_ALLOCATION_TRACKING_ENABLED
+		private:
+			friend void RecordAllocation(size_t size);
+
+			Counter&		mCounter;
+			Scope			*mPrevious;		// The enclosing scope on this thread, or nullptr
+			bool			mActive;
+#endif
+		};
+
+	}
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include <dispatch/dispatch.h>
+
+#include "AudioAnalysisGraph.h"
+#include "AudioBufferList.h"
+#include "AudioConverter.h"
+#include "CFErrorUtilities.h"
+#include "CFWrapper.h"
+#include "Logger.h"
+
+#define ANALYSIS_GRAPH_BLOCK_FRAMES 4096
+
+namespace {
+
+	// The non-interleaved float format used by the analyzers
+	AudioStreamBasicDescription GetAnalysisFormat(Float64 sampleRate, UInt32 channelCount)
+	{
+		AudioStreamBasicDescription format = {
+			.mFormatID				= kAudioFormatLinearPCM,
+			.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved,
+			.mReserved				= 0,
+			.mSampleRate			= sampleRate,
+			.mChannelsPerFrame		= channelCount,
+			.mBitsPerChannel		= 32,
+			.mBytesPerPacket		= 4,
+			.mBytesPerFrame			= 4,
+			.mFramesPerPacket		= 1
+		};
+
+		return format;
+	}
+
+	bool IsAnalysisFormat(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && format.IsNativeEndian() && (1 == format.mChannelsPerFrame || !format.IsInterleaved());
+	}
+
+	// A Decoder providing another decoder's audio in the analysis format
+	class ConvertingDecoder : public SFB::Audio::Decoder
+	{
+
+	public:
+
+		ConvertingDecoder(SFB::Audio::Decoder::unique_ptr decoder, const AudioStreamBasicDescription& format)
+			: mConverter(std::move(decoder), format), mCurrentFrame(0)
+		{
+			mConverter.SetBlockSize(ANALYSIS_GRAPH_BLOCK_FRAMES);
+		}
+
+	private:
+
+		// Source access
+		inline virtual CFURLRef _GetURL() const						{ return mConverter.GetDecoder().GetURL(); }
+		inline virtual SFB::InputSource& _GetInputSource() const	{ return mConverter.GetDecoder().GetInputSource(); }
+
+		// Audio access
+		virtual bool _Open(CFErrorRef *error)
+		{
+			if(!mConverter.Open(error))
+				return false;
+
+			mFormat = mConverter.GetFormat();
+			mChannelLayout = mConverter.GetDecoder().GetChannelLayout();
+			mSourceFormat = mConverter.GetDecoder().GetSourceFormat();
+
+			return true;
+		}
+
+		virtual bool _Close(CFErrorRef *error)						{ return mConverter.Close(error); }
+
+		// The native format of the source audio
+		virtual SFB::CFString _GetSourceFormatDescription() const	{ return SFB::CFString(mConverter.GetDecoder().CreateSourceFormatDescription()); }
+
+		virtual UInt32 _ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+		{
+			UInt32 framesConverted = mConverter.ConvertAudio(bufferList, frameCount);
+			mCurrentFrame += framesConverted;
+			return framesConverted;
+		}
+
+		// Source audio information
+		inline virtual SInt64 _GetTotalFrames() const				{ return mConverter.GetDecoder().GetTotalFrames(); }
+		inline virtual SInt64 _GetCurrentFrame() const				{ return mCurrentFrame; }
+
+		SFB::Audio::Converter	mConverter;
+		SInt64					mCurrentFrame;
+	};
+
+	// A block of decoded audio shared read-only by all analyzers
+	struct Block
+	{
+		SFB::Audio::BufferList	mBufferList;
+		UInt32					mFrameCount;
+		std::atomic_size_t		mPendingAnalyzers;		// The block is returned to the pool when this reaches zero
+	};
+
+	// The blocks available for decoding
+	class BlockPool
+	{
+
+	public:
+
+		bool Allocate(const SFB::Audio::AudioFormat& format, size_t blockCount)
+		{
+			for(size_t i = 0; i < blockCount; ++i) {
+				std::unique_ptr<Block> block(new Block);
+				if(!block->mBufferList.Allocate(format, ANALYSIS_GRAPH_BLOCK_FRAMES))
+					return false;
+
+				mAvailableBlocks.push_back(block.get());
+				mBlocks.push_back(std::move(block));
+			}
+
+			return true;
+		}
+
+		// Wait until a block is available
+		Block * Acquire()
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, [this] { return !mAvailableBlocks.empty(); });
+
+			auto block = mAvailableBlocks.back();
+			mAvailableBlocks.pop_back();
+			return block;
+		}
+
+		void Release(Block *block)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mAvailableBlocks.push_back(block);
+			}
+
+			mCondition.notify_one();
+		}
+
+	private:
+
+		std::vector<std::unique_ptr<Block>>		mBlocks;
+		std::vector<Block *>					mAvailableBlocks;
+		std::mutex								mMutex;
+		std::condition_variable					mCondition;
+	};
+
+	// An analyzer and the queue on which it analyzes audio
+	struct AnalyzerState
+	{
+		SFB::Audio::AnalysisTap		*mAnalyzer;
+		dispatch_queue_t			mQueue;
+		std::atomic_bool			mFinished;
+	};
+
+}
+
+SFB::Audio::AnalysisGraph::AnalysisGraph(size_t blockCount)
+	: mBlockCount(std::max(blockCount, (size_t)1))
+{}
+
+void SFB::Audio::AnalysisGraph::AddAnalyzer(AnalysisTap& analyzer)
+{
+	mAnalyzers.push_back(&analyzer);
+}
+
+bool SFB::Audio::AnalysisGraph::AnalyzeURL(CFURLRef url, CFErrorRef *error)
+{
+	if(nullptr == url)
+		return false;
+
+	auto decoder = Decoder::CreateForURL(url, error);
+	if(!decoder)
+		return false;
+
+	return AnalyzeDecoder(std::move(decoder), error);
+}
+
+bool SFB::Audio::AnalysisGraph::AnalyzeDecoder(Decoder::unique_ptr decoder, CFErrorRef *error)
+{
+	if(!decoder || mAnalyzers.empty())
+		return false;
+
+	if(!decoder->IsOpen() && !decoder->Open(error))
+		return false;
+
+	// The audio is converted once for all analyzers
+	AudioFormat decoderFormat = decoder->GetFormat();
+	if(!IsAnalysisFormat(decoderFormat)) {
+		decoder = Decoder::unique_ptr(new ConvertingDecoder(std::move(decoder), GetAnalysisFormat(decoderFormat.mSampleRate, decoderFormat.mChannelsPerFrame)));
+		if(!decoder->Open(error))
+			return false;
+	}
+
+	std::vector<std::unique_ptr<AnalyzerState>> analyzers;
+	for(auto analyzer : mAnalyzers) {
+		if(!analyzer->DecodingStarted(*decoder))
+			continue;
+
+		std::unique_ptr<AnalyzerState> state(new AnalyzerState);
+		state->mAnalyzer = analyzer;
+		state->mQueue = dispatch_queue_create("org.sbooth.AudioEngine.AnalysisGraph.Analyzer", DISPATCH_QUEUE_SERIAL);
+		state->mFinished = false;
+		analyzers.push_back(std::move(state));
+	}
+
+	if(analyzers.empty()) {
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” does not contain audio in a supported format."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("The file's audio could not be analyzed"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
+
+			*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::FileFormatNotSupportedError, description, decoder->GetURL(), failureReason, recoverySuggestion);
+		}
+
+		return false;
+	}
+
+	BlockPool pool;
+	bool allocated = pool.Allocate(decoder->GetFormat(), mBlockCount);
+	if(!allocated) {
+		LOGGER_ERR("org.sbooth.AudioEngine.AnalysisGraph", "Unable to allocate memory");
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+	}
+
+	bool complete = false;
+	while(allocated) {
+		if(std::all_of(analyzers.begin(), analyzers.end(), [](const std::unique_ptr<AnalyzerState>& state) { return (bool)state->mFinished; }))
+			break;
+
+		Block *block = pool.Acquire();
+		block->mBufferList.Reset();
+		block->mFrameCount = decoder->ReadAudio(block->mBufferList, ANALYSIS_GRAPH_BLOCK_FRAMES);
+		if(0 == block->mFrameCount) {
+			pool.Release(block);
+			complete = true;
+			break;
+		}
+
+		block->mPendingAnalyzers = analyzers.size();
+
+		BlockPool *blockPool = &pool;
+		for(const auto& state : analyzers) {
+			AnalyzerState *analyzerState = state.get();
+			dispatch_async(analyzerState->mQueue, ^{
+				if(!analyzerState->mFinished) {
+					analyzerState->mAnalyzer->AnalyzeAudio(block->mBufferList, block->mFrameCount);
+					if(analyzerState->mAnalyzer->IsFinished())
+						analyzerState->mFinished = true;
+				}
+
+				if(1 == block->mPendingAnalyzers.fetch_sub(1))
+					blockPool->Release(block);
+			});
+		}
+	}
+
+	// Wait for each analyzer to process its queued blocks before finishing it
+	for(const auto& state : analyzers) {
+		dispatch_sync(state->mQueue, ^{});
+		state->mAnalyzer->DecodingFinished(*decoder, complete && !state->mFinished);
+		dispatch_release(state->mQueue);
+	}
+
+	return allocated;
+}
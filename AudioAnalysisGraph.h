@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "AudioAnalysisTap.h"
+#include "AudioDecoder.h"
+
+/*! @file AudioAnalysisGraph.h @brief Analysis of one decode by several analyzers in parallel */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A graph feeding the audio of a single decode to several analyzers
+		 *
+		 * The decoder's audio is converted once to non-interleaved 32-bit floating point PCM at the decoder's sample
+		 * rate, the format used internally by the analyzers in \c SFBAudioEngine, and divided into blocks.  Each block
+		 * is shared read-only by all analyzers, which run concurrently on their own serial queues.  Decoding waits
+		 * when every block is still being analyzed, so memory use is bounded by the slowest analyzer.
+		 *
+		 * Decoding ends early once every analyzer reports \c AnalysisTap::IsFinished().  Analyzers that decline the
+		 * decoder in \c AnalysisTap::DecodingStarted() receive no audio.
+		 */
+		class AnalysisGraph
+		{
+
+		public:
+
+			/*! @brief The default number of blocks in flight */
+			static const size_t DefaultBlockCount = 8;
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*!
+			 * @brief Create a new \c AnalysisGraph
+			 * @param blockCount The maximum number of decoded blocks awaiting analysis
+			 */
+			AnalysisGraph(size_t blockCount = DefaultBlockCount);
+
+			/*! @brief Destroy this \c AnalysisGraph */
+			~AnalysisGraph() = default;
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			AnalysisGraph(const AnalysisGraph& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			AnalysisGraph& operator=(const AnalysisGraph& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			// ========================================
+			/*! @name Analyzers */
+			//@{
+
+			/*!
+			 * @brief Add an analyzer to the graph
+			 * @note The graph does not take ownership of \c analyzer, which must remain valid while audio is analyzed
+			 * @param analyzer The analyzer
+			 */
+			void AddAnalyzer(AnalysisTap& analyzer);
+
+			/*! @brief Remove all analyzers from the graph */
+			inline void RemoveAllAnalyzers()							{ mAnalyzers.clear(); }
+
+			/*! @brief Get the number of analyzers in the graph */
+			inline size_t GetAnalyzerCount() const						{ return mAnalyzers.size(); }
+
+			//@}
+
+
+			// ========================================
+			/*! @name Audio analysis */
+			//@{
+
+			/*!
+			 * @brief Analyze the given URL's audio with every analyzer, decoding it once
+			 * @param url The URL
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, false otherwise
+			 */
+			bool AnalyzeURL(CFURLRef url, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Analyze a decoder's audio with every analyzer
+			 * @param decoder The decoder, which need not be open
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, false otherwise
+			 */
+			bool AnalyzeDecoder(Decoder::unique_ptr decoder, CFErrorRef *error = nullptr);
+
+			//@}
+
+		private:
+
+			std::vector<AnalysisTap *>	mAnalyzers;
+			size_t						mBlockCount;
+		};
+
+	}
+}
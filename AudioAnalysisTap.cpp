@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include "AudioAnalysisTap.h"
+#include "AudioAnalysisGraph.h"
+
+bool SFB::Audio::AnalysisTap::AnalyzeURL(CFURLRef url, const std::vector<AnalysisTap *>& taps, CFErrorRef *error)
+{
+	AnalysisGraph graph;
+	for(auto tap : taps) {
+		if(tap)
+			graph.AddAnalyzer(*tap);
+	}
+
+	return graph.AnalyzeURL(url, error);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreAudio/CoreAudioTypes.h>
+
+/*! @file AudioAnalysisTap.h @brief Analysis of audio as it is decoded */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		class Decoder;
+
+		/*!
+		 * @brief An interface for analyzing audio as it is decoded
+		 *
+		 * A tap receives a single decoder's audio in the decoder's format before any conversion.  Its methods are
+		 * called on the decoding thread so should be fast enough not to starve playback.  Results should be
+		 * delivered from \c DecodingFinished(), after which the tap is destroyed.
+		 *
+		 * Several taps may analyze a file while it is decoded only once using \c AnalysisTap::AnalyzeURL().
+		 * @see Player::SetAnalysisTapBlock
+		 */
+		class AnalysisTap
+		{
+		public:
+
+			/*! @brief A \c std::unique_ptr for \c AnalysisTap objects */
+			using unique_ptr = std::unique_ptr<AnalysisTap>;
+
+			/*!
+			 * @brief Analyze the given URL's audio with several taps, decoding it once
+			 *
+			 * The taps analyze the audio concurrently using an \c AnalysisGraph.  Decoding ends early once every tap
+			 * reports it is finished.  Taps that decline the decoder in \c DecodingStarted() receive no audio.
+			 * @param url The URL
+			 * @param taps The taps
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, false otherwise
+			 */
+			static bool AnalyzeURL(CFURLRef url, const std::vector<AnalysisTap *>& taps, CFErrorRef *error = nullptr);
+
+			/*! @brief Destroy this \c AnalysisTap */
+			virtual ~AnalysisTap() = default;
+
+			/*!
+			 * @brief Called before the decoder's first audio is analyzed
+			 * @param decoder The decoder
+			 * @return \c true if the decoder's audio should be analyzed, \c false otherwise
+			 */
+			virtual bool DecodingStarted(const Decoder& decoder) = 0;
+
+			/*!
+			 * @brief Analyze decoded audio
+			 * @param bufferList The audio, in the decoder's format
+			 * @param frameCount The number of frames in \c bufferList
+			 */
+			virtual void AnalyzeAudio(const AudioBufferList *bufferList, UInt32 frameCount) = 0;
+
+			/*!
+			 * @brief Query whether this tap needs no more audio
+			 *
+			 * This is a hint allowing decoding to end early, for taps that analyze only part of the audio
+			 * @return \c true if further audio would be ignored, \c false otherwise
+			 */
+			inline virtual bool IsFinished() const		{ return false; }
+
+			/*!
+			 * @brief Called when the decoder's audio has been decoded
+			 * @param decoder The decoder
+			 * @param complete \c true if all of the decoder's audio was analyzed, \c false if seeking skipped some
+			 */
+			virtual void DecodingFinished(const Decoder& decoder, bool complete) = 0;
+		};
+
+	}
+}
@@ -3,10 +3,159 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <stdexcept>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/mman.h>
+#include <mach/mach.h>
 
 #include "AudioBufferList.h"
+#include "Logger.h"
+
+namespace {
+
+	// ========================================
+	// Pooled blocks are laid out as a BlockHeader followed by the AudioBufferList and then each buffer's data
+	// Each component begins on a cache line boundary
+	const size_t kBlockAlignment = 64;
+
+	// The maximum number of free blocks of each size retained for reuse
+	const size_t kMaximumCachedBlocksPerSize = 4;
+
+	struct BlockHeader {
+		size_t	mBlockSize;
+		bool	mLocked;
+	};
+
+	static_assert(sizeof(BlockHeader) <= kBlockAlignment, "BlockHeader must fit in one alignment unit");
+
+	inline size_t RoundUp(size_t value, size_t multiple)
+	{
+		return ((value + multiple - 1) / multiple) * multiple;
+	}
+
+	// ========================================
+	// A cache of page-aligned memory blocks, keyed by size
+	class BlockPool
+	{
+
+	public:
+
+		BlockPool()
+			: mLockMemory(false), mStatistics{}
+		{}
+
+		void * Acquire(size_t blockSize)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			void *block = nullptr;
+
+			auto iter = mFreeBlocks.find(blockSize);
+			if(iter != mFreeBlocks.end() && !iter->second.empty()) {
+				block = iter->second.back();
+				iter->second.pop_back();
+
+				mStatistics.mBytesCached -= blockSize;
+				++mStatistics.mHits;
+			}
+			else {
+				if(posix_memalign(&block, vm_page_size, blockSize))
+					return nullptr;
+
+				auto header = static_cast<BlockHeader *>(block);
+				header->mBlockSize = blockSize;
+				header->mLocked = false;
+
+				if(mLockMemory) {
+					if(mlock(block, blockSize))
+						LOGGER_NOTICE("org.sbooth.AudioEngine.BufferList", "mlock failed: " << strerror(errno));
+					else
+						header->mLocked = true;
+				}
+
+				++mStatistics.mMisses;
+			}
+
+			mStatistics.mBytesInUse += blockSize;
+			mStatistics.mBytesInUseHighWaterMark = std::max(mStatistics.mBytesInUseHighWaterMark, mStatistics.mBytesInUse);
+
+			return block;
+		}
+
+		void Release(void *block)
+		{
+			auto blockSize = static_cast<BlockHeader *>(block)->mBlockSize;
+
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			mStatistics.mBytesInUse -= blockSize;
+
+			auto& freeBlocks = mFreeBlocks[blockSize];
+			if(freeBlocks.size() < kMaximumCachedBlocksPerSize) {
+				freeBlocks.push_back(block);
+				mStatistics.mBytesCached += blockSize;
+			}
+			else
+				Free(block);
+		}
+
+		void Purge()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			for(auto& entry : mFreeBlocks) {
+				for(auto block : entry.second)
+					Free(block);
+			}
+
+			mFreeBlocks.clear();
+			mStatistics.mBytesCached = 0;
+		}
+
+		void SetLockMemory(bool lockMemory)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mLockMemory = lockMemory;
+		}
+
+		SFB::Audio::BufferList::PoolStatistics GetStatistics()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			return mStatistics;
+		}
+
+	private:
+
+		static void Free(void *block)
+		{
+			auto header = static_cast<BlockHeader *>(block);
+			if(header->mLocked)
+				munlock(block, header->mBlockSize);
+			free(block);
+		}
+
+		std::mutex											mMutex;
+		std::unordered_map<size_t, std::vector<void *>>		mFreeBlocks;
+		bool												mLockMemory;
+		SFB::Audio::BufferList::PoolStatistics				mStatistics;
+
+	};
+
+	// The pool is never destroyed so BufferList objects with static storage duration may safely outlive it
+	BlockPool& SharedBlockPool()
+	{
+		static BlockPool *sBlockPool = new BlockPool;
+		return *sBlockPool;
+	}
+
+}
 
 SFB::Audio::BufferList::BufferList()
 	: mBufferList(nullptr, nullptr), mCapacityFrames(0)
@@ -27,33 +176,33 @@ bool SFB::Audio::BufferList::Allocate(const AudioFormat& format, UInt32 capacity
 	UInt32 numBuffers = format.IsInterleaved() ? 1 : format.mChannelsPerFrame;
 	UInt32 channelsPerBuffer = format.IsInterleaved() ? format.mChannelsPerFrame : 1;
 
-	void *allocation = calloc(1, offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * numBuffers));
-	if(nullptr == allocation)
+	size_t bufferListSize = RoundUp(offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * numBuffers), kBlockAlignment);
+	size_t bufferSize = RoundUp(format.FrameCountToByteCount(capacityFrames), kBlockAlignment);
+
+	// Whole pages are allocated so blocks for similar capacities are interchangeable
+	size_t blockSize = RoundUp(kBlockAlignment + bufferListSize + (bufferSize * numBuffers), vm_page_size);
+
+	auto block = static_cast<uint8_t *>(SharedBlockPool().Acquire(blockSize));
+	if(nullptr == block)
 		return false;
 
-	// Use a custom deleter to ensure all allocations are freed
-	mBufferList = std::unique_ptr<AudioBufferList, void (*)(AudioBufferList *)>((AudioBufferList *)allocation, [](AudioBufferList *bufferList) {
-		if(nullptr != bufferList) {
-			for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex) {
-				if(nullptr != bufferList->mBuffers[bufferIndex].mData)
-					free(bufferList->mBuffers[bufferIndex].mData);
-			}
+	// Zero everything following the block header, as memory from the pool may have been used previously
+	memset(block + kBlockAlignment, 0, blockSize - kBlockAlignment);
 
-			free(bufferList);
-		}
+	// Use a custom deleter to return the block to the pool
+	mBufferList = std::unique_ptr<AudioBufferList, void (*)(AudioBufferList *)>((AudioBufferList *)(block + kBlockAlignment), [](AudioBufferList *bufferList) {
+		if(nullptr != bufferList)
+			SharedBlockPool().Release((uint8_t *)bufferList - kBlockAlignment);
 	});
 
 	mBufferList->mNumberBuffers = numBuffers;
 
+	uint8_t *data = block + kBlockAlignment + bufferListSize;
 	for(UInt32 bufferIndex = 0; bufferIndex < mBufferList->mNumberBuffers; ++bufferIndex) {
-		// If the allocation fails cleanup will be handled by the unique_ptr's deleter
-		void *data = calloc(1, format.FrameCountToByteCount(capacityFrames));
-		if(nullptr == data)
-			return false;
-
 		mBufferList->mBuffers[bufferIndex].mData = data;
 		mBufferList->mBuffers[bufferIndex].mDataByteSize = (UInt32)format.FrameCountToByteCount(capacityFrames);
 		mBufferList->mBuffers[bufferIndex].mNumberChannels = channelsPerBuffer;
+		data += bufferSize;
 	}
 
 	mFormat = format;
@@ -85,3 +234,18 @@ bool SFB::Audio::BufferList::Reset()
 
 	return true;
 }
+
+SFB::Audio::BufferList::PoolStatistics SFB::Audio::BufferList::GetPoolStatistics()
+{
+	return SharedBlockPool().GetStatistics();
+}
+
+void SFB::Audio::BufferList::SetPoolMemoryLocked(bool locked)
+{
+	SharedBlockPool().SetLockMemory(locked);
+}
+
+void SFB::Audio::BufferList::PurgePool()
+{
+	SharedBlockPool().Purge();
+}
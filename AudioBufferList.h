@@ -18,7 +18,13 @@ namespace SFB {
 	/*! @brief %Audio functionality */
 	namespace Audio {
 
-		/*! @brief A class wrapping a Core %Audio \c AudioBufferList */
+		/*!
+		 * @brief A class wrapping a Core %Audio \c AudioBufferList
+		 *
+		 * The memory for all \c BufferList objects is drawn from a shared pool.  Memory released by \c Deallocate()
+		 * is cached, keyed by the buffer layout and capacity, and reused by subsequent allocations of the same size.
+		 * Pooled memory is page-aligned and may optionally be wired using \c SetPoolMemoryLocked().
+		 */
 		class BufferList
 		{
 		public:
@@ -113,6 +119,34 @@ namespace SFB {
 
 			//@}
 
+
+			// ========================================
+			/*! @name Memory pool */
+			//@{
+
+			/*! @brief Usage statistics for the memory pool shared by all \c BufferList objects */
+			struct PoolStatistics {
+				UInt64	mHits;						/*!< The number of allocations satisfied by cached memory */
+				UInt64	mMisses;					/*!< The number of allocations requiring new memory */
+				size_t	mBytesInUse;				/*!< The number of bytes currently allocated to \c BufferList objects */
+				size_t	mBytesInUseHighWaterMark;	/*!< The largest value of \c mBytesInUse */
+				size_t	mBytesCached;				/*!< The number of bytes cached for reuse */
+			};
+
+			/*! @brief Get the memory pool's usage statistics */
+			static PoolStatistics GetPoolStatistics();
+
+			/*!
+			 * @brief Set whether newly allocated pool memory is locked into physical memory using \c mlock()
+			 * @note Locking memory prevents page faults when buffers are first touched on a real-time thread
+			 */
+			static void SetPoolMemoryLocked(bool locked);
+
+			/*! @brief Free all memory cached by the pool */
+			static void PurgePool();
+
+			//@}
+
 		private:
 
 			std::unique_ptr<AudioBufferList, void (*)(AudioBufferList *)> mBufferList;
@@ -182,6 +182,34 @@ bool SFB::Audio::ChannelLayout::MapToLayout(const ChannelLayout& outputLayout, s
 	return true;
 }
 
+bool SFB::Audio::ChannelLayout::MixToLayout(const ChannelLayout& outputLayout, std::vector<float>& mixMatrix) const
+{
+	// No valid matrix exists for empty/unknown layouts
+	if(!mChannelLayout || !outputLayout.mChannelLayout)
+		return false;
+
+	const AudioChannelLayout *layouts [] = {
+		GetACL(),
+		outputLayout.GetACL()
+	};
+
+	auto inputChannelCount = GetChannelCount();
+	auto outputChannelCount = outputLayout.GetChannelCount();
+	if(0 == inputChannelCount || 0 == outputChannelCount)
+		return false;
+
+	std::vector<Float32> rawMixMatrix(inputChannelCount * outputChannelCount);
+	UInt32 propertySize = (UInt32)(rawMixMatrix.size() * sizeof(Float32));
+	OSStatus result = AudioFormatGetProperty(kAudioFormatProperty_MatrixMixMap, sizeof(layouts), (void *)layouts, &propertySize, rawMixMatrix.data());
+
+	if(noErr != result || propertySize != rawMixMatrix.size() * sizeof(Float32))
+		return false;
+
+	mixMatrix.assign(rawMixMatrix.begin(), rawMixMatrix.end());
+
+	return true;
+}
+
 size_t SFB::Audio::ChannelLayout::GetACLSize() const
 {
 	if(!mChannelLayout)
@@ -110,6 +110,17 @@ namespace SFB {
 			 */
 			bool MapToLayout(const ChannelLayout& outputLayout, std::vector<SInt32>& channelMap) const;
 
+			/*!
+			 * @brief Create a mixing matrix for converting audio from this channel layout
+			 *
+			 * The matrix contains the gain applied to each input channel in each output channel, stored by input channel
+			 * so the gain from input channel \c i to output channel \c o is at index <tt>i * outputChannelCount + o</tt>.
+			 * @param outputLayout The output channel layout
+			 * @param mixMatrix A \c std::vector to receive the mixing matrix on success
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool MixToLayout(const ChannelLayout& outputLayout, std::vector<float>& mixMatrix) const;
+
 			//@}
 
 
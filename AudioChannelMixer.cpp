@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "AudioChannelMixer.h"
+#include "Logger.h"
+#include "SampleKernels.h"
+
+// Gains smaller than this are treated as silence
+#define MINIMUM_GAIN 1e-6f
+
+SFB::Audio::ChannelMixer::ChannelMixer()
+	: mInputChannelCount(0), mOutputChannelCount(0)
+{}
+
+bool SFB::Audio::ChannelMixer::SetLayouts(const ChannelLayout& inputLayout, const ChannelLayout& outputLayout)
+{
+	UInt32 inputChannelCount = (UInt32)inputLayout.GetChannelCount();
+	UInt32 outputChannelCount = (UInt32)outputLayout.GetChannelCount();
+	if(0 == inputChannelCount || 0 == outputChannelCount) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.ChannelMixer", "SetLayouts() called with invalid parameters");
+		return false;
+	}
+
+	std::vector<Term> terms;
+
+	std::vector<float> mixMatrix;
+	std::vector<SInt32> channelMap;
+	if(inputLayout.MixToLayout(outputLayout, mixMatrix)) {
+		for(UInt32 output = 0; output < outputChannelCount; ++output) {
+			for(UInt32 input = 0; input < inputChannelCount; ++input) {
+				float gain = mixMatrix[(input * outputChannelCount) + output];
+				if(MINIMUM_GAIN <= std::abs(gain))
+					terms.push_back({ input, output, gain });
+			}
+		}
+	}
+	// The channel map contains the input channel for each output channel, or -1 for silence
+	else if(inputLayout.MapToLayout(outputLayout, channelMap)) {
+		LOGGER_INFO("org.sbooth.AudioEngine.ChannelMixer", "Mixing between " << inputLayout << " and " << outputLayout << " not supported; mapping channels");
+		for(UInt32 output = 0; output < outputChannelCount; ++output) {
+			if(0 <= channelMap[output] && (UInt32)channelMap[output] < inputChannelCount)
+				terms.push_back({ (UInt32)channelMap[output], output, 1 });
+		}
+	}
+	else {
+		LOGGER_INFO("org.sbooth.AudioEngine.ChannelMixer", "Mapping between " << inputLayout << " and " << outputLayout << " not supported; copying channels in order");
+		for(UInt32 channel = 0; channel < std::min(inputChannelCount, outputChannelCount); ++channel)
+			terms.push_back({ channel, channel, 1 });
+	}
+
+	mTerms.swap(terms);
+	mInputChannelCount = inputChannelCount;
+	mOutputChannelCount = outputChannelCount;
+
+	return true;
+}
+
+bool SFB::Audio::ChannelMixer::IsIdentity() const
+{
+	if(mInputChannelCount != mOutputChannelCount || mTerms.size() != mOutputChannelCount)
+		return false;
+
+	for(const auto& term : mTerms) {
+		if(term.mInputChannel != term.mOutputChannel || 1 != term.mGain)
+			return false;
+	}
+
+	return true;
+}
+
+void SFB::Audio::ChannelMixer::Mix(const AudioBufferList *input, AudioBufferList *output, UInt32 outputFrameOffset, UInt32 frameCount) const
+{
+	const auto& kernels = SampleKernels::Get();
+	auto term = mTerms.begin();
+
+	for(UInt32 channel = 0; channel < mOutputChannelCount; ++channel) {
+		float *out = (float *)output->mBuffers[channel].mData + outputFrameOffset;
+		output->mBuffers[channel].mDataByteSize = (UInt32)((outputFrameOffset + frameCount) * sizeof(float));
+
+		// Output channels without contributions are silent
+		if(term == mTerms.end() || term->mOutputChannel != channel) {
+			memset(out, 0, frameCount * sizeof(float));
+			continue;
+		}
+
+		// The first contribution overwrites the output and subsequent ones are accumulated
+		const float *in = (const float *)input->mBuffers[term->mInputChannel].mData;
+		if(1 == term->mGain)
+			memcpy(out, in, frameCount * sizeof(float));
+		else
+			kernels.Scale(in, out, frameCount, term->mGain);
+
+		for(++term; term != mTerms.end() && term->mOutputChannel == channel; ++term) {
+			in = (const float *)input->mBuffers[term->mInputChannel].mData;
+			kernels.MultiplyAdd(in, out, frameCount, term->mGain);
+		}
+	}
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <CoreAudio/CoreAudioTypes.h>
+#include <vector>
+
+#include "AudioChannelLayout.h"
+
+/*! @file AudioChannelMixer.h @brief Channel remapping and mixing */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief Remaps or mixes audio from one channel layout to another
+		 *
+		 * The mixing matrix is computed once from the channel layouts and only its non-zero gains are retained, so
+		 * channel reordering costs one copy per output channel and a 5.1 to stereo downmix three multiply-adds per
+		 * output channel.  When Core %Audio can't mix between the layouts, channels are mapped by label or, failing
+		 * that, in order.
+		 * @note Only non-interleaved 32-bit floating point PCM is mixed
+		 */
+		class ChannelMixer
+		{
+		public:
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Create a new \c ChannelMixer passing no audio */
+			ChannelMixer();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			ChannelMixer(const ChannelMixer& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			ChannelMixer& operator=(const ChannelMixer& rhs) = delete;
+
+			/*! @endcond */
+
+			//@}
+
+
+			// ========================================
+			/*! @name Configuration */
+			//@{
+
+			/*!
+			 * @brief Compute the mixing matrix for the specified channel layouts
+			 * @param inputLayout The layout of the audio to be mixed
+			 * @param outputLayout The desired layout
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetLayouts(const ChannelLayout& inputLayout, const ChannelLayout& outputLayout);
+
+			/*! @brief Get the number of input channels */
+			inline UInt32 GetInputChannelCount() const				{ return mInputChannelCount; }
+
+			/*! @brief Get the number of output channels */
+			inline UInt32 GetOutputChannelCount() const				{ return mOutputChannelCount; }
+
+			/*! @brief Query whether each output channel is the input channel of the same index */
+			bool IsIdentity() const;
+
+			//@}
+
+
+			// ========================================
+			/*! @name Mixing */
+			//@{
+
+			/*!
+			 * @brief Mix audio
+			 * @note This method is safe to call from the real-time rendering thread
+			 * @param input The audio to mix, which must contain \c GetInputChannelCount() buffers
+			 * @param output A buffer to receive the mixed audio, which must contain \c GetOutputChannelCount() buffers
+			 * and may not share memory with \c input
+			 * @param outputFrameOffset The frame in \c output at which the mixed audio is written
+			 * @param frameCount The number of frames to mix
+			 */
+			void Mix(const AudioBufferList *input, AudioBufferList *output, UInt32 outputFrameOffset, UInt32 frameCount) const;
+
+			//@}
+
+		private:
+
+			// The gain applied to an input channel in an output channel
+			struct Term
+			{
+				UInt32	mInputChannel;
+				UInt32	mOutputChannel;
+				float	mGain;
+			};
+
+			std::vector<Term>		mTerms;					/*!< The non-zero gains, ordered by output channel */
+			UInt32					mInputChannelCount;
+			UInt32					mOutputChannelCount;
+		};
+
+	}
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <Accelerate/Accelerate.h>
+#include <mach/mach_time.h>
+
+#include "AudioClockBridge.h"
+#include "Logger.h"
+
+// ========================================
+// Rate measurement
+// A measurement spans between one and two windows so it follows slow changes in a device's clock
+#define RATE_ESTIMATOR_WINDOW_SECONDS			60.0
+#define RATE_ESTIMATOR_MINIMUM_SECONDS			2.0
+#define RATE_ESTIMATOR_DISCONTINUITY_FRAMES		1.0
+
+// ========================================
+// Conversion
+#define CLOCK_BRIDGE_INPUT_CAPACITY_FRAMES		8192
+#define CLOCK_BRIDGE_CUTOFF						0.9
+#define CLOCK_BRIDGE_MAXIMUM_DRIFT				0.01
+#define CLOCK_BRIDGE_MAXIMUM_CORRECTION			0.002
+#define CLOCK_BRIDGE_LAG_SMOOTHING_SECONDS		5.0
+#define CLOCK_BRIDGE_LAG_CORRECTION_SECONDS		30.0
+
+namespace {
+
+	bool IsBridgeableFormat(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && format.IsNativeEndian() && !format.IsInterleaved();
+	}
+
+	double ConvertHostTimeToSeconds(uint64_t hostTime)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (double)hostTime * sTimebaseInfo.numer / sTimebaseInfo.denom / NSEC_PER_SEC;
+	}
+
+	// The offset of the first tap from the frame preceding the output position
+	const size_t kTapOffset = SFB::Audio::ClockBridge::kTapCount / 2 - 1;
+
+}
+
+#pragma mark Rate Estimator
+
+SFB::Audio::ClockBridge::RateEstimator::RateEstimator()
+	: mResetPending(false), mSampleRate(0), mAnchorSampleTime(0), mAnchorHostTime(0), mNextAnchorSampleTime(0), mNextAnchorHostTime(0), mExpectedSampleTime(0)
+{}
+
+void SFB::Audio::ClockBridge::RateEstimator::Update(const AudioTimeStamp *timeStamp, UInt32 frameCount)
+{
+	if(mResetPending.exchange(false)) {
+		mSampleRate.store(0);
+		mAnchorHostTime = 0;
+	}
+
+	const UInt32 requiredFlags = kAudioTimeStampSampleTimeValid | kAudioTimeStampHostTimeValid;
+	if(nullptr == timeStamp || requiredFlags != (requiredFlags & timeStamp->mFlags))
+		return;
+
+	// A discontinuity, such as an overload or a reconfiguration of the device, restarts the measurement
+	// The previous measurement is retained until a new one is available
+	if(0 == mAnchorHostTime || RATE_ESTIMATOR_DISCONTINUITY_FRAMES < std::abs(timeStamp->mSampleTime - mExpectedSampleTime)) {
+		mAnchorSampleTime = mNextAnchorSampleTime = timeStamp->mSampleTime;
+		mAnchorHostTime = mNextAnchorHostTime = timeStamp->mHostTime;
+		mExpectedSampleTime = timeStamp->mSampleTime + frameCount;
+		return;
+	}
+
+	mExpectedSampleTime = timeStamp->mSampleTime + frameCount;
+
+	double elapsed = ConvertHostTimeToSeconds(timeStamp->mHostTime - mAnchorHostTime);
+	if(RATE_ESTIMATOR_MINIMUM_SECONDS <= elapsed)
+		mSampleRate.store((timeStamp->mSampleTime - mAnchorSampleTime) / elapsed);
+
+	if(RATE_ESTIMATOR_WINDOW_SECONDS <= ConvertHostTimeToSeconds(timeStamp->mHostTime - mNextAnchorHostTime)) {
+		mAnchorSampleTime = mNextAnchorSampleTime;
+		mAnchorHostTime = mNextAnchorHostTime;
+		mNextAnchorSampleTime = timeStamp->mSampleTime;
+		mNextAnchorHostTime = timeStamp->mHostTime;
+	}
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::ClockBridge::ClockBridge()
+	: mOutputSampleRate(0), mNominalRatio(1), mInputFrameCount(0), mPosition(0), mSmoothedLag(0), mConversionRatio(1)
+{}
+
+#pragma mark Configuration
+
+bool SFB::Audio::ClockBridge::Configure(const AudioFormat& inputFormat, Float64 outputSampleRate)
+{
+	if(!IsBridgeableFormat(inputFormat) || 0 >= inputFormat.mSampleRate || 0 >= outputSampleRate) {
+		LOGGER_ERR("org.sbooth.AudioEngine.ClockBridge", "Unable to bridge audio in format " << inputFormat << " to " << outputSampleRate << " Hz");
+		return false;
+	}
+
+	if(mInput.GetFormat() != inputFormat && !mInput.Allocate(inputFormat, CLOCK_BRIDGE_INPUT_CAPACITY_FRAMES)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.ClockBridge", "Unable to allocate input buffer");
+		return false;
+	}
+
+	if(inputFormat.mSampleRate != mInputFormat.mSampleRate || outputSampleRate != mOutputSampleRate || mCoefficients.empty()) {
+		mNominalRatio = inputFormat.mSampleRate / outputSampleRate;
+
+		// When downsampling the cutoff falls below the output's Nyquist frequency
+		double cutoff = CLOCK_BRIDGE_CUTOFF * std::min(1.0, 1 / mNominalRatio);
+		double halfWidth = kTapCount / 2;
+
+		// Blackman-windowed sinc, with one phase past the last so coefficients may be interpolated between phases
+		mCoefficients.resize((kPhaseCount + 1) * kTapCount);
+		mPhaseCoefficients.resize(kTapCount);
+
+		for(UInt32 phase = 0; phase <= kPhaseCount; ++phase) {
+			float *coefficients = mCoefficients.data() + phase * kTapCount;
+			double fraction = (double)phase / kPhaseCount;
+			double sum = 0;
+
+			for(UInt32 tap = 0; tap < kTapCount; ++tap) {
+				double x = (double)tap - kTapOffset - fraction;
+				double sinc = 0 == x ? 1 : std::sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+				double window = 0.42 + 0.5 * std::cos(M_PI * x / halfWidth) + 0.08 * std::cos(2 * M_PI * x / halfWidth);
+				coefficients[tap] = (float)(sinc * window);
+				sum += coefficients[tap];
+			}
+
+			// Unity gain at DC for every phase
+			float scale = (float)(1 / sum);
+			vDSP_vsmul(coefficients, 1, &scale, coefficients, 1, kTapCount);
+		}
+	}
+
+	mInputFormat = inputFormat;
+	mOutputSampleRate = outputSampleRate;
+
+	Reset();
+
+	return true;
+}
+
+void SFB::Audio::ClockBridge::Reset()
+{
+	// Silence precedes the first input frame for filtering
+	if(mInput) {
+		for(UInt32 i = 0; i < mInput->mNumberBuffers; ++i)
+			std::memset(mInput->mBuffers[i].mData, 0, kTapOffset * sizeof(float));
+	}
+
+	mInputFrameCount = kTapOffset;
+	mPosition = kTapOffset;
+	mSmoothedLag = 0;
+	mConversionRatio.store(mNominalRatio);
+	mRateEstimator.Reset();
+}
+
+#pragma mark Rendering
+
+UInt32 SFB::Audio::ClockBridge::Render(AudioBufferList *bufferList, UInt32 frameCount, const AudioTimeStamp *timeStamp, Float64 referenceSampleRate, size_t framesAvailable, size_t referenceFramesAvailable, InputCallback input, void *context)
+{
+	// Nothing in this method may allocate, lock, or log since it is called from a real-time rendering thread
+	mRateEstimator.Update(timeStamp, frameCount);
+
+	UInt32 channelCount = mCoefficients.empty() ? 0 : std::min(bufferList->mNumberBuffers, mInput->mNumberBuffers);
+	UInt32 framesRendered = 0;
+
+	if(0 < channelCount) {
+		// The ratio of the devices' measured clocks corrects for drift
+		double ratio = mNominalRatio;
+		Float64 outputSampleRate = mRateEstimator.GetSampleRate();
+		if(0 < referenceSampleRate && 0 < outputSampleRate) {
+			double drift = (referenceSampleRate / mInputFormat.mSampleRate) / (outputSampleRate / mOutputSampleRate);
+			if(CLOCK_BRIDGE_MAXIMUM_DRIFT > std::abs(drift - 1))
+				ratio *= drift;
+		}
+
+		// Any remaining difference in buffering is removed slowly.  The lag is positive when this device is behind the reference.
+		double lag = (double)framesAvailable + (mInputFrameCount - mPosition) - (double)referenceFramesAvailable;
+		double smoothing = std::min(1.0, frameCount / (mOutputSampleRate * CLOCK_BRIDGE_LAG_SMOOTHING_SECONDS));
+		mSmoothedLag += smoothing * (lag - mSmoothedLag);
+
+		double correction = mSmoothedLag / (mInputFormat.mSampleRate * CLOCK_BRIDGE_LAG_CORRECTION_SECONDS);
+		correction = std::max(-CLOCK_BRIDGE_MAXIMUM_CORRECTION, std::min(CLOCK_BRIDGE_MAXIMUM_CORRECTION, correction));
+		ratio *= 1 + correction;
+
+		mConversionRatio.store(ratio);
+
+		while(framesRendered < frameCount) {
+			// Read the input needed for the remaining frames, as capacity allows
+			size_t framesNeeded = std::min((size_t)(mPosition + ratio * (frameCount - framesRendered - 1)) + kTapCount / 2 + 1, (size_t)mInput.GetCapacityFrames());
+			if(framesNeeded > mInputFrameCount)
+				mInputFrameCount += input(context, mInput, mInputFrameCount, framesNeeded - mInputFrameCount);
+
+			UInt32 framesFiltered = 0;
+			while(framesRendered + framesFiltered < frameCount) {
+				size_t index = (size_t)mPosition;
+				if(index + kTapCount / 2 >= mInputFrameCount)
+					break;
+
+				// Interpolate the coefficients between the adjacent phases
+				double phase = (mPosition - index) * kPhaseCount;
+				UInt32 phaseIndex = std::min((UInt32)phase, kPhaseCount - 1);
+				float phaseFraction = (float)(phase - phaseIndex);
+				const float *coefficients = mCoefficients.data() + phaseIndex * kTapCount;
+				vDSP_vintb(coefficients, 1, coefficients + kTapCount, 1, &phaseFraction, mPhaseCoefficients.data(), 1, kTapCount);
+
+				for(UInt32 i = 0; i < channelCount; ++i) {
+					const float *samples = (const float *)mInput->mBuffers[i].mData + index - kTapOffset;
+					vDSP_dotpr(samples, 1, mPhaseCoefficients.data(), 1, (float *)bufferList->mBuffers[i].mData + framesRendered + framesFiltered, kTapCount);
+				}
+
+				++framesFiltered;
+				mPosition += ratio;
+			}
+
+			framesRendered += framesFiltered;
+
+			// Discard the input preceding the frames needed for filtering
+			size_t framesConsumed = std::min((size_t)mPosition, mInputFrameCount) - kTapOffset;
+			if(0 < framesConsumed) {
+				for(UInt32 i = 0; i < mInput->mNumberBuffers; ++i) {
+					float *samples = (float *)mInput->mBuffers[i].mData;
+					std::memmove(samples, samples + framesConsumed, (mInputFrameCount - framesConsumed) * sizeof(float));
+				}
+
+				mInputFrameCount -= framesConsumed;
+				mPosition -= framesConsumed;
+			}
+
+			// The input is exhausted
+			if(0 == framesFiltered)
+				break;
+		}
+	}
+
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+		if(i < channelCount)
+			std::memset((float *)bufferList->mBuffers[i].mData + framesRendered, 0, (frameCount - framesRendered) * sizeof(float));
+		else
+			std::memset(bufferList->mBuffers[i].mData, 0, frameCount * sizeof(float));
+		bufferList->mBuffers[i].mDataByteSize = (UInt32)(frameCount * sizeof(float));
+	}
+
+	return framesRendered;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <CoreAudio/CoreAudioTypes.h>
+#include <atomic>
+#include <vector>
+
+#include "AudioBufferList.h"
+#include "AudioFormat.h"
+
+/*! @file AudioClockBridge.h @brief Drift-compensating resampling between clock domains */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A resampler carrying audio consumed in one clock domain to a device in another
+		 *
+		 * Audio produced for a reference clock, such as the device of a player's output, is rendered for a device
+		 * whose clock drifts relative to it.  The actual sample rate of each device is measured from the host times
+		 * of its render cycles, and the conversion ratio is the ratio of the measured rates.  Any remaining offset in
+		 * the audio buffered for the two devices is removed by a slow adjustment of the ratio so the buffering
+		 * neither grows nor underruns.
+		 *
+		 * The conversion uses a windowed sinc polyphase filter whose coefficients are interpolated between phases,
+		 * so the ratio may be adjusted in arbitrarily small steps.
+		 * @note \c Render() is safe to call from the real-time rendering thread.  Only 32-bit floating point
+		 * non-interleaved PCM is resampled.
+		 */
+		class ClockBridge
+		{
+		public:
+
+			/*! @brief The number of filter taps, in input frames */
+			static const UInt32 kTapCount = 32;
+
+			/*! @brief The number of filter phases between input frames */
+			static const UInt32 kPhaseCount = 128;
+
+			/*!
+			 * @brief A function supplying input audio
+			 * @param context The context passed to \c Render()
+			 * @param bufferList A buffer to receive the audio
+			 * @param frameOffset The offset in frames into \c bufferList at which to write the audio
+			 * @param frameCount The maximum number of frames to supply
+			 * @return The number of frames supplied
+			 */
+			using InputCallback = size_t (*)(void *context, AudioBufferList *bufferList, size_t frameOffset, size_t frameCount);
+
+			/*!
+			 * @brief A measurement of a device's actual sample rate from the host times of its render cycles
+			 * @note \c Update() must be called on the device's rendering thread; the rate may be read on any thread
+			 */
+			class RateEstimator
+			{
+			public:
+
+				/*! @brief Create a new \c RateEstimator */
+				RateEstimator();
+
+				/*!
+				 * @brief Record a render cycle
+				 * @param timeStamp The output time of the first frame rendered, which must have valid sample and host times
+				 * @param frameCount The number of frames rendered
+				 */
+				void Update(const AudioTimeStamp *timeStamp, UInt32 frameCount);
+
+				/*!
+				 * @brief Discard the measurement
+				 * @note The reset is performed by the next call to \c Update()
+				 */
+				inline void Reset()								{ mResetPending.store(true); }
+
+				/*! @brief Get the measured sample rate, or \c 0 if not enough render cycles have been recorded */
+				inline Float64 GetSampleRate() const			{ return mSampleRate.load(); }
+
+			private:
+
+				std::atomic_bool		mResetPending;
+				std::atomic<Float64>	mSampleRate;
+
+				// Rendering thread state
+				Float64					mAnchorSampleTime;		/*!< The start of the measurement */
+				uint64_t				mAnchorHostTime;
+				Float64					mNextAnchorSampleTime;	/*!< The start of the following measurement */
+				uint64_t				mNextAnchorHostTime;
+				Float64					mExpectedSampleTime;	/*!< The sample time of the next cycle if contiguous */
+			};
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Create a new, unconfigured \c ClockBridge */
+			ClockBridge();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			ClockBridge(const ClockBridge& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			ClockBridge& operator=(const ClockBridge& rhs) = delete;
+
+			/*! @endcond */
+
+			//@}
+
+
+			// ========================================
+			/*! @name Configuration */
+			//@{
+
+			/*!
+			 * @brief Compute the filter and allocate buffers for a conversion and reset the bridge
+			 * @param inputFormat The format of the input audio, which must be non-interleaved 32-bit floating point PCM
+			 * @param outputSampleRate The nominal sample rate of the output device
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool Configure(const AudioFormat& inputFormat, Float64 outputSampleRate);
+
+			/*! @brief Discard the buffered input and the measured sample rates */
+			void Reset();
+
+			/*! @brief Get the ratio of input frames to output frames used for the most recent render cycle */
+			inline double GetConversionRatio() const			{ return mConversionRatio.load(); }
+
+			//@}
+
+
+			// ========================================
+			/*! @name Rendering */
+			//@{
+
+			/*!
+			 * @brief Render audio for the output device
+			 *
+			 * Frames that couldn't be rendered because \c input supplied too few are filled with silence.
+			 * @param bufferList A buffer to receive the audio
+			 * @param frameCount The number of frames to render
+			 * @param timeStamp The output time of the first frame in \c bufferList, or \c nullptr if unknown
+			 * @param referenceSampleRate The measured sample rate of the reference device, or \c 0 if unknown
+			 * @param framesAvailable The number of frames available from \c input
+			 * @param referenceFramesAvailable The number of frames buffered for the reference device
+			 * @param input The function supplying input audio
+			 * @param context The context passed to \c input
+			 * @return The number of frames rendered from input audio
+			 */
+			UInt32 Render(AudioBufferList *bufferList, UInt32 frameCount, const AudioTimeStamp *timeStamp, Float64 referenceSampleRate, size_t framesAvailable, size_t referenceFramesAvailable, InputCallback input, void *context);
+
+			//@}
+
+		private:
+
+			AudioFormat				mInputFormat;
+			Float64					mOutputSampleRate;
+			double					mNominalRatio;			/*!< Input frames per output frame at the nominal sample rates */
+			std::vector<float>		mCoefficients;			/*!< kPhaseCount + 1 phases of kTapCount coefficients */
+			std::vector<float>		mPhaseCoefficients;		/*!< The coefficients interpolated for an output frame */
+
+			// Rendering thread state
+			RateEstimator			mRateEstimator;			/*!< The output device's measured sample rate */
+			BufferList				mInput;					/*!< Input frames retained for filtering */
+			size_t					mInputFrameCount;
+			double					mPosition;				/*!< The input frame at which the next output frame is centered */
+			double					mSmoothedLag;			/*!< In input frames */
+			std::atomic<double>		mConversionRatio;
+		};
+
+	}
+}
@@ -8,8 +8,10 @@
 #include "AudioConverter.h"
 #include "AudioBufferList.h"
 #include "Logger.h"
+#include "Signposts.h"
 #include "CFWrapper.h"
 #include "CreateStringForOSType.h"
+#include "SampleKernels.h"
 
 #define BUFFER_SIZE_FRAMES 512u
 
@@ -29,9 +31,9 @@ public:
 	ConverterStateData(const ConverterStateData& rhs) = delete;
 	ConverterStateData& operator=(const ConverterStateData& rhs) = delete;
 
-	void AllocateBufferList(UInt32 capacityFrames)
+	bool AllocateBufferList(UInt32 capacityFrames)
 	{
-		mBufferList.Allocate(mDecoder.GetFormat(), capacityFrames);
+		return mBufferList.Allocate(mDecoder.GetFormat(), capacityFrames);
 	}
 
 	UInt32 ReadAudio(UInt32 frameCount)
@@ -44,6 +46,8 @@ public:
 
 	Decoder&		mDecoder;
 	BufferList		mBufferList;
+	BufferList		mResamplerInput;		// The decoder's audio converted to non-interleaved float for the resampler
+	BufferList		mResamplerOutput;		// The resampler's non-interleaved output, if the output is interleaved
 };
 
 namespace {
@@ -69,10 +73,148 @@ namespace {
 
 		return noErr;
 	}
+
+	// ========================================
+	// Native conversion of common linear PCM formats to float, bypassing AudioConverter
+
+	// The sample types supported by the native conversion path
+	enum class NativeSampleType {
+		None,
+		Int16,
+		Int24,
+		Int32,
+		Float32
+	};
+
+	// Determine the native sample type for a format, or NativeSampleType::None if the format isn't supported
+	NativeSampleType GetNativeSampleType(const SFB::Audio::AudioFormat& format)
+	{
+		if(kAudioFormatLinearPCM != format.mFormatID || 1 != format.mFramesPerPacket || !format.IsNativeEndian())
+			return NativeSampleType::None;
+
+		// Only packed samples without padding are supported
+		UInt32 bytesPerSample = format.mBytesPerFrame / (format.IsInterleaved() ? format.mChannelsPerFrame : 1);
+		if(0 == bytesPerSample || (bytesPerSample * 8) != format.mBitsPerChannel)
+			return NativeSampleType::None;
+
+		if(kAudioFormatFlagIsFloat & format.mFormatFlags)
+			return 32 == format.mBitsPerChannel ? NativeSampleType::Float32 : NativeSampleType::None;
+
+		if(!(kAudioFormatFlagIsSignedInteger & format.mFormatFlags))
+			return NativeSampleType::None;
+
+		switch(format.mBitsPerChannel) {
+			case 16:	return NativeSampleType::Int16;
+			case 24:	return NativeSampleType::Int24;
+			case 32:	return NativeSampleType::Int32;
+			default:	return NativeSampleType::None;
+		}
+	}
+
+	// Determine whether conversion between two formats only changes the sample type and/or interleaving
+	bool CanConvertNatively(const SFB::Audio::AudioFormat& inputFormat, const SFB::Audio::AudioFormat& outputFormat)
+	{
+		return inputFormat.mSampleRate == outputFormat.mSampleRate
+		&& inputFormat.mChannelsPerFrame == outputFormat.mChannelsPerFrame
+		&& NativeSampleType::None != GetNativeSampleType(inputFormat)
+		&& NativeSampleType::Float32 == GetNativeSampleType(outputFormat);
+	}
+
+	// Determine whether conversion between two formats may be performed by a Resampler
+	bool CanResample(const SFB::Audio::AudioFormat& inputFormat, const SFB::Audio::AudioFormat& outputFormat)
+	{
+		return inputFormat.mSampleRate != outputFormat.mSampleRate
+		&& inputFormat.mChannelsPerFrame == outputFormat.mChannelsPerFrame
+		&& NativeSampleType::None != GetNativeSampleType(inputFormat)
+		&& NativeSampleType::Float32 == GetNativeSampleType(outputFormat);
+	}
+
+	// The non-interleaved float format used by the Resampler
+	SFB::Audio::AudioFormat ResamplerFormat(Float64 sampleRate, UInt32 channelCount)
+	{
+		SFB::Audio::AudioFormat format;
+
+		format.mFormatID			= kAudioFormatLinearPCM;
+		format.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+
+		format.mSampleRate			= sampleRate;
+		format.mChannelsPerFrame	= channelCount;
+		format.mBitsPerChannel		= 32;
+
+		format.mBytesPerPacket		= format.mBitsPerChannel / 8;
+		format.mFramesPerPacket		= 1;
+		format.mBytesPerFrame		= format.mBytesPerPacket * format.mFramesPerPacket;
+
+		format.mReserved			= 0;
+
+		return format;
+	}
+
+	// Convert frameCount frames from input to float samples in output, beginning outputOffset frames into output
+	void ConvertNatively(const AudioBufferList *input, const SFB::Audio::AudioFormat& inputFormat, AudioBufferList *output, const SFB::Audio::AudioFormat& outputFormat, UInt32 outputOffset, UInt32 frameCount)
+	{
+		auto sampleType = GetNativeSampleType(inputFormat);
+		UInt32 channels = inputFormat.mChannelsPerFrame;
+
+		UInt32 inputBytesPerSample = inputFormat.mBitsPerChannel / 8;
+		UInt32 inputStride = inputFormat.IsInterleaved() ? channels : 1;
+		UInt32 outputStride = outputFormat.IsInterleaved() ? channels : 1;
+
+		// Map samples to [-1, 1)
+		float scale;
+		switch(sampleType) {
+			case NativeSampleType::Int16:	scale = 1.f / (1u << 15);	break;
+			case NativeSampleType::Int24:	scale = 1.f / (1u << 23);	break;
+			case NativeSampleType::Int32:	scale = 1.f / (1u << 31);	break;
+			default:						scale = 1.f;				break;
+		}
+
+		// Interleaved to interleaved is a single contiguous pass over every sample
+		UInt32 passCount = channels;
+		UInt32 sampleCount = frameCount;
+		if(inputFormat.IsInterleaved() && outputFormat.IsInterleaved()) {
+			passCount = 1;
+			sampleCount = frameCount * channels;
+			inputStride = 1;
+			outputStride = 1;
+		}
+
+		const auto& kernels = SFB::Audio::SampleKernels::Get();
+		for(UInt32 channel = 0; channel < passCount; ++channel) {
+			const uint8_t *src = inputFormat.IsInterleaved()
+				? (const uint8_t *)input->mBuffers[0].mData + (channel * inputBytesPerSample)
+				: (const uint8_t *)input->mBuffers[channel].mData;
+
+			float *dst = outputFormat.IsInterleaved()
+				? (float *)output->mBuffers[0].mData + (outputOffset * channels) + channel
+				: (float *)output->mBuffers[channel].mData + outputOffset;
+
+			switch(sampleType) {
+				case NativeSampleType::Int16:
+					kernels.ConvertInt16ToFloat((const int16_t *)src, inputStride, dst, outputStride, sampleCount, scale);
+					break;
+
+				case NativeSampleType::Int24:
+					kernels.ConvertInt24ToFloat(src, inputStride, dst, outputStride, sampleCount, scale);
+					break;
+
+				case NativeSampleType::Int32:
+					kernels.ConvertInt32ToFloat((const int32_t *)src, inputStride, dst, outputStride, sampleCount, scale);
+					break;
+
+				case NativeSampleType::Float32:
+					kernels.Copy((const float *)src, inputStride, dst, outputStride, sampleCount);
+					break;
+
+				case NativeSampleType::None:
+					break;
+			}
+		}
+	}
 }
 
 SFB::Audio::Converter::Converter(Decoder::unique_ptr decoder, const AudioStreamBasicDescription& format, ChannelLayout channelLayout)
-	: mFormat(format), mChannelLayout(std::move(channelLayout)), mDecoder(std::move(decoder)), mConverter(nullptr), mConverterState(nullptr), mIsOpen(false)
+	: mFormat(format), mChannelLayout(std::move(channelLayout)), mDecoder(std::move(decoder)), mConverter(nullptr), mConverterState(nullptr), mIsOpen(false), mBlockSize(BUFFER_SIZE_FRAMES), mSRCQuality(kAudioConverterQuality_High), mSRCComplexity(kAudioConverterSampleRateConverterComplexity_Normal), mSampleRateConverter(SampleRateConverter::AudioConverter), mResamplerQuality(Resampler::Quality::High), mResamplerThreadCount(1)
 {}
 
 SFB::Audio::Converter::~Converter()
@@ -95,20 +237,47 @@ bool SFB::Audio::Converter::Open(CFErrorRef *error)
 	}
 
 	AudioStreamBasicDescription inputFormat = mDecoder->GetFormat();
-	OSStatus result = AudioConverterNew(&inputFormat, &mFormat, &mConverter);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.AudioConverter", "AudioConverterNewfailed: " << result << "'" << SFB::StringForOSType((OSType)result) << "'");
+	OSStatus result = noErr;
+
+	// Sample rate conversion may be performed by a Resampler if requested
+	if(SampleRateConverter::Resampler == mSampleRateConverter && !mChannelLayout && CanResample(inputFormat, mFormat)) {
+		std::unique_ptr<Resampler> resampler(new Resampler);
+		if(resampler->Configure(inputFormat.mSampleRate, mFormat.mSampleRate, mFormat.mChannelsPerFrame, mResamplerQuality)) {
+			resampler->SetThreadCount(mResamplerThreadCount);
+			mResampler = std::move(resampler);
+		}
+		else
+			LOGGER_NOTICE("org.sbooth.AudioEngine.AudioConverter", "Resampler unavailable; using AudioConverter");
+	}
 
-		if(error)
-			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainOSStatus, result, nullptr);
+	// Conversions that don't require resampling or channel mapping are performed natively, without an AudioConverter
+	if(!mResampler && (mChannelLayout || !CanConvertNatively(inputFormat, mFormat))) {
+		result = AudioConverterNew(&inputFormat, &mFormat, &mConverter);
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.AudioConverter", "AudioConverterNewfailed: " << result << "'" << SFB::StringForOSType((OSType)result) << "'");
 
-		return false;
-	}
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainOSStatus, result, nullptr);
 
-	// TODO: Set kAudioConverterPropertyCalculateInputBufferSize
+			return false;
+		}
+	}
 
 	mConverterState = std::unique_ptr<ConverterStateData>(new ConverterStateData(*mDecoder));
-	mConverterState->AllocateBufferList(BUFFER_SIZE_FRAMES);
+
+	if(!ApplyConversionParameters()) {
+		mConverterState.reset();
+		mResampler.reset();
+		if(mConverter) {
+			AudioConverterDispose(mConverter);
+			mConverter = nullptr;
+		}
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
+		return false;
+	}
 
 	// Create the channel map
 	if(mChannelLayout) {
@@ -145,6 +314,7 @@ bool SFB::Audio::Converter::Close(CFErrorRef *error)
 	}
 
 	mConverterState.reset();
+	mResampler.reset();
 	mDecoder.reset();
 
 	if(mConverter) {
@@ -156,6 +326,135 @@ bool SFB::Audio::Converter::Close(CFErrorRef *error)
 	return true;
 }
 
+bool SFB::Audio::Converter::SetDecoder(Decoder::unique_ptr decoder, CFErrorRef *error)
+{
+	if(!decoder)
+		return false;
+
+	if(!IsOpen()) {
+		mDecoder = std::move(decoder);
+		return true;
+	}
+
+	// Open the decoder if necessary
+	if(!decoder->IsOpen() && !decoder->Open(error)) {
+		if(error)
+			LOGGER_ERR("org.sbooth.AudioEngine.AudioConverter", "Error opening decoder: " << error);
+
+		return false;
+	}
+
+	// A decoder with a different format requires a new converter
+	if(decoder->GetFormat() != mDecoder->GetFormat() || decoder->GetChannelLayout() != mDecoder->GetChannelLayout()) {
+		Close();
+		mDecoder = std::move(decoder);
+		return Open(error);
+	}
+
+	// Otherwise discard any audio buffered from the previous decoder and reuse the converter
+	if(!Reset())
+		LOGGER_NOTICE("org.sbooth.AudioEngine.AudioConverter", "Unable to reset converter for new decoder");
+
+	mConverterState.reset();
+	mDecoder = std::move(decoder);
+
+	mConverterState = std::unique_ptr<ConverterStateData>(new ConverterStateData(*mDecoder));
+	if(!ApplyConversionParameters()) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool SFB::Audio::Converter::SetBlockSize(UInt32 frameCount)
+{
+	if(0 == frameCount)
+		return false;
+
+	mBlockSize = frameCount;
+
+	if(IsOpen())
+		return ApplyConversionParameters();
+
+	return true;
+}
+
+bool SFB::Audio::Converter::SetSampleRateConverterQuality(UInt32 quality, UInt32 complexity)
+{
+	mSRCQuality = quality;
+	mSRCComplexity = complexity;
+
+	if(IsOpen())
+		return ApplyConversionParameters();
+
+	return true;
+}
+
+bool SFB::Audio::Converter::SetSampleRateConverter(SampleRateConverter converter, Resampler::Quality quality, size_t threadCount)
+{
+	if(IsOpen()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.AudioConverter", "SetSampleRateConverter() called on an open AudioConverter");
+		return false;
+	}
+
+	mSampleRateConverter = converter;
+	mResamplerQuality = quality;
+	mResamplerThreadCount = threadCount;
+
+	return true;
+}
+
+bool SFB::Audio::Converter::ApplyConversionParameters()
+{
+	// The resampler reads one block of input at a time and renders interleaved output one block at a time
+	if(mResampler) {
+		const auto& decoderFormat = mDecoder->GetFormat();
+		if(mBlockSize != mConverterState->mBufferList.GetCapacityFrames()) {
+			if(!mConverterState->AllocateBufferList(mBlockSize) || !mConverterState->mResamplerInput.Allocate(ResamplerFormat(decoderFormat.mSampleRate, decoderFormat.mChannelsPerFrame), mBlockSize))
+				return false;
+			if(AudioFormat(mFormat).IsInterleaved() && !mConverterState->mResamplerOutput.Allocate(ResamplerFormat(mFormat.mSampleRate, mFormat.mChannelsPerFrame), mBlockSize))
+				return false;
+		}
+		return true;
+	}
+
+	// Native conversion reads one block of input per block of output
+	if(!mConverter) {
+		if(mBlockSize != mConverterState->mBufferList.GetCapacityFrames())
+			return mConverterState->AllocateBufferList(mBlockSize);
+		return true;
+	}
+
+	// These properties only affect sample rate conversion so failures aren't fatal
+	OSStatus result = AudioConverterSetProperty(mConverter, kAudioConverterSampleRateConverterComplexity, sizeof(mSRCComplexity), &mSRCComplexity);
+	if(noErr != result)
+		LOGGER_NOTICE("org.sbooth.AudioEngine.AudioConverter", "AudioConverterSetProperty (kAudioConverterSampleRateConverterComplexity) failed: " << result);
+
+	result = AudioConverterSetProperty(mConverter, kAudioConverterSampleRateConverterQuality, sizeof(mSRCQuality), &mSRCQuality);
+	if(noErr != result)
+		LOGGER_NOTICE("org.sbooth.AudioEngine.AudioConverter", "AudioConverterSetProperty (kAudioConverterSampleRateConverterQuality) failed: " << result);
+
+	// Size the input buffer so a single read from the decoder supplies an entire block of output
+	UInt32 inputBufferSize = mBlockSize * mFormat.mBytesPerFrame;
+	UInt32 dataSize = sizeof(inputBufferSize);
+	result = AudioConverterGetProperty(mConverter, kAudioConverterPropertyCalculateInputBufferSize, &dataSize, &inputBufferSize);
+
+	UInt32 inputFrames = mBlockSize;
+	if(noErr == result && 0 < mDecoder->GetFormat().mBytesPerFrame)
+		inputFrames = std::max(1u, (UInt32)mDecoder->GetFormat().ByteCountToFrameCount(inputBufferSize));
+	else if(noErr != result)
+		LOGGER_NOTICE("org.sbooth.AudioEngine.AudioConverter", "AudioConverterGetProperty (kAudioConverterPropertyCalculateInputBufferSize) failed: " << result);
+
+	if(inputFrames != mConverterState->mBufferList.GetCapacityFrames())
+		return mConverterState->AllocateBufferList(inputFrames);
+
+	return true;
+}
+
 CFStringRef SFB::Audio::Converter::CreateFormatDescription() const
 {
 	if(!IsOpen())
@@ -200,10 +499,76 @@ UInt32 SFB::Audio::Converter::ConvertAudio(AudioBufferList *bufferList, UInt32 f
 	if(!IsOpen() || nullptr == bufferList || 0 == frameCount)
 		return 0;
 
+	SFB_SIGNPOST_INTERVAL_BEGIN("Converter::ConvertAudio", this, "%{public}@ %u frames", mDecoder->GetURL(), frameCount);
+
+	if(mResampler) {
+		AudioFormat outputFormat(mFormat);
+		AudioFormat resamplerInputFormat = ResamplerFormat(mDecoder->GetFormat().mSampleRate, mFormat.mChannelsPerFrame);
+		AudioFormat resamplerOutputFormat = ResamplerFormat(mFormat.mSampleRate, mFormat.mChannelsPerFrame);
+
+		// Render directly into non-interleaved output, feeding the resampler from the decoder as needed
+		UInt32 framesConverted = 0;
+		while(framesConverted < frameCount) {
+			UInt32 framesRendered;
+			if(outputFormat.IsInterleaved()) {
+				mConverterState->mResamplerOutput.Reset();
+				framesRendered = mResampler->Render(mConverterState->mResamplerOutput, 0, std::min(frameCount - framesConverted, mConverterState->mResamplerOutput.GetCapacityFrames()));
+				ConvertNatively(mConverterState->mResamplerOutput, resamplerOutputFormat, bufferList, outputFormat, framesConverted, framesRendered);
+			}
+			else
+				framesRendered = mResampler->Render(bufferList, framesConverted, frameCount - framesConverted);
+
+			framesConverted += framesRendered;
+			if(0 != framesRendered)
+				continue;
+
+			if(mResampler->IsFinished())
+				break;
+
+			UInt32 framesRead = mConverterState->ReadAudio(mBlockSize);
+			if(0 == framesRead) {
+				mResampler->Finish();
+				continue;
+			}
+
+			ConvertNatively(mConverterState->mBufferList, mDecoder->GetFormat(), mConverterState->mResamplerInput, resamplerInputFormat, 0, framesRead);
+			if(!mResampler->AppendInput(mConverterState->mResamplerInput, framesRead))
+				break;
+		}
+
+		for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
+			bufferList->mBuffers[bufferIndex].mDataByteSize = (UInt32)outputFormat.FrameCountToByteCount(framesConverted);
+
+		SFB_SIGNPOST_INTERVAL_END("Converter::ConvertAudio", this, "%u frames converted", framesConverted);
+		return framesConverted;
+	}
+
+	if(!mConverter) {
+		AudioFormat outputFormat(mFormat);
+
+		// Read from the decoder one block at a time, converting directly into bufferList
+		UInt32 framesConverted = 0;
+		while(framesConverted < frameCount) {
+			UInt32 framesRead = mConverterState->ReadAudio(frameCount - framesConverted);
+			if(0 == framesRead)
+				break;
+
+			ConvertNatively(mConverterState->mBufferList, mDecoder->GetFormat(), bufferList, outputFormat, framesConverted, framesRead);
+			framesConverted += framesRead;
+		}
+
+		for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
+			bufferList->mBuffers[bufferIndex].mDataByteSize = (UInt32)outputFormat.FrameCountToByteCount(framesConverted);
+
+		SFB_SIGNPOST_INTERVAL_END("Converter::ConvertAudio", this, "%u frames converted", framesConverted);
+		return framesConverted;
+	}
+
 	OSStatus result = AudioConverterFillComplexBuffer(mConverter, myAudioConverterComplexInputDataProc, mConverterState.get(), &frameCount, bufferList, nullptr);
 	if(noErr != result)
-		return 0;
+		frameCount = 0;
 
+	SFB_SIGNPOST_INTERVAL_END("Converter::ConvertAudio", this, "%u frames converted", frameCount);
 	return frameCount;
 }
 
@@ -212,6 +577,16 @@ bool SFB::Audio::Converter::Reset()
 	if(!IsOpen())
 		return false;
 
+	// Resampling restarts with the next frame read from the decoder
+	if(mResampler) {
+		mResampler->Reset();
+		return true;
+	}
+
+	// Native conversion is stateless
+	if(!mConverter)
+		return true;
+
 	OSStatus result = AudioConverterReset(mConverter);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.AudioConverter", "AudioConverterReset failed: " << result);
@@ -7,6 +7,7 @@
 
 #include <AudioToolbox/AudioToolbox.h>
 #include "AudioDecoder.h"
+#include "AudioResampler.h"
 
 /*! @file AudioConverter.h @brief Support for converting audio from one PCM format to another */
 
@@ -16,7 +17,16 @@ namespace SFB {
 	/*! @brief %Audio functionality */
 	namespace Audio {
 
-		/*! @brief A \c Converter converts the output of a \c Decoder to a different PCM format */
+		/*!
+		 * @brief A \c Converter converts the output of a \c Decoder to a different PCM format
+		 *
+		 * For offline conversion and analysis throughput may be improved by increasing the block size
+		 * using \c SetBlockSize().  A \c Converter may be reused for additional decoders using \c SetDecoder(),
+		 * which avoids re-creating the underlying converter when the decoders' formats match.
+		 *
+		 * Sample rate conversion is normally performed by an \c AudioConverter.  For conversions to floating point PCM
+		 * that only change the sample rate a \c Resampler may be used instead with \c SetSampleRateConverter().
+		 */
 		class Converter
 		{
 		public:
@@ -82,6 +92,69 @@ namespace SFB {
 			/*! @brief Get the \c Decoder feeding this converter */
 			inline const Decoder& GetDecoder() const					{ return *mDecoder; }
 
+			/*!
+			 * @brief Replace the \c Decoder feeding this converter
+			 *
+			 * If the converter is open \c decoder is opened if necessary.  When \c decoder produces the same format
+			 * and channel layout as the current decoder the conversion state is reset and reused; otherwise the converter
+			 * is closed and re-opened.
+			 * @note The \c Converter will take ownership of \c decoder
+			 * @param decoder The \c AudioDecoder providing the input
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetDecoder(Decoder::unique_ptr decoder, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Conversion parameters */
+			//@{
+
+			/*! @brief Get the number of frames the converter is prepared to produce per pass */
+			inline UInt32 GetBlockSize() const							{ return mBlockSize; }
+
+			/*!
+			 * @brief Set the number of frames the converter is prepared to produce per pass
+			 *
+			 * The decoder is read in chunks sized to produce \c frameCount frames of output.  The default is suited to real-time
+			 * use; larger values reduce the per-call overhead of offline conversion.
+			 * @note This method may be called before or after \c Open()
+			 * @param frameCount The desired block size in frames
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetBlockSize(UInt32 frameCount);
+
+			/*!
+			 * @brief Set the quality and complexity of sample rate conversion
+			 * @note This method may be called before or after \c Open()
+			 * @param quality The sample rate converter quality, for example \c kAudioConverterQuality_Max
+			 * @param complexity The sample rate converter complexity, for example \c kAudioConverterSampleRateConverterComplexity_Mastering
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetSampleRateConverterQuality(UInt32 quality, UInt32 complexity = kAudioConverterSampleRateConverterComplexity_Normal);
+
+			/*! @brief The implementations available for sample rate conversion */
+			enum class SampleRateConverter {
+				AudioConverter,		/*!< Core %Audio's \c AudioConverter; the default */
+				Resampler			/*!< \c SFB::Audio::Resampler, which is deterministic and may render using multiple threads */
+			};
+
+			/*!
+			 * @brief Set the implementation used for sample rate conversion
+			 *
+			 * A \c Resampler is only used when the output is 32-bit floating point PCM with the decoder's channels, the
+			 * input is linear PCM, no channel layout is specified, and both sample rates are integral.  Otherwise an
+			 * \c AudioConverter is used.
+			 * @note This method must be called before \c Open()
+			 * @param converter The sample rate converter
+			 * @param quality The \c Resampler quality
+			 * @param threadCount The number of threads used by the \c Resampler, or \c 0 for one thread per processor core
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetSampleRateConverter(SampleRateConverter converter, Resampler::Quality quality = Resampler::Quality::High, size_t threadCount = 1);
+
 			//@}
 
 
@@ -134,12 +207,23 @@ namespace SFB {
 			/*! @endcond */
 
 		private:
+
+			/*! @brief Set the conversion parameters on \c mConverter and allocate the input buffer */
+			bool ApplyConversionParameters();
+
 			AudioStreamBasicDescription			mFormat;			/*!< The format produced by this converter */
 			ChannelLayout						mChannelLayout;		/*!< The channel layout of the audio produced by this converter */
 			Decoder::unique_ptr					mDecoder;			/*!< The Decoder providing the audio */
 			AudioConverterRef					mConverter;			/*!< The actual object performing the conversion */
 			std::unique_ptr<ConverterStateData>	mConverterState;	/*!< Internal conversion state */
 			bool								mIsOpen;			/*!< Flag indicating if the mConverter is open */
+			UInt32								mBlockSize;			/*!< The number of frames produced per pass */
+			UInt32								mSRCQuality;		/*!< The sample rate converter quality */
+			UInt32								mSRCComplexity;		/*!< The sample rate converter complexity */
+			SampleRateConverter					mSampleRateConverter;	/*!< The preferred sample rate converter */
+			Resampler::Quality					mResamplerQuality;	/*!< The \c Resampler quality */
+			size_t								mResamplerThreadCount;	/*!< The number of threads used by the \c Resampler */
+			std::unique_ptr<Resampler>			mResampler;			/*!< The \c Resampler performing sample rate conversion, if used */
 		};
 
 	}
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "AudioEffectChain.h"
+#include "CreateStringForOSType.h"
+#include "Logger.h"
+
+namespace {
+
+	bool IsProcessableFormat(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && format.IsNativeEndian() && !format.IsInterleaved();
+	}
+
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::EffectChain::EffectChain()
+	: mEffectCount(0), mSampleTime(0), mInput(nullptr), mInputOffset(0)
+{}
+
+SFB::Audio::EffectChain::~EffectChain()
+{
+	RemoveAllEffects();
+}
+
+#pragma mark Effects
+
+bool SFB::Audio::EffectChain::AddEffect(OSType componentType, OSType subType, OSType manufacturer, UInt32 flags, UInt32 mask, AudioUnit *effectUnit)
+{
+	LOGGER_INFO("org.sbooth.AudioEngine.EffectChain", "Adding DSP: '" << SFB::StringForOSType(componentType) << "' '" << SFB::StringForOSType(subType) << "' '" << SFB::StringForOSType(manufacturer) << "'");
+
+	AudioComponentDescription componentDescription = {
+		.componentType = componentType,
+		.componentSubType = subType,
+		.componentManufacturer = manufacturer,
+		.componentFlags = flags,
+		.componentFlagsMask = mask
+	};
+
+	AudioComponent component = AudioComponentFindNext(nullptr, &componentDescription);
+	if(nullptr == component) {
+		LOGGER_ERR("org.sbooth.AudioEngine.EffectChain", "Unable to find AudioComponent");
+		return false;
+	}
+
+	AudioUnit unit = nullptr;
+	auto result = AudioComponentInstanceNew(component, &unit);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.EffectChain", "AudioComponentInstanceNew failed: " << result);
+		return false;
+	}
+
+	// The unit renders its input from the chain
+	AURenderCallbackStruct callback = { .inputProc = RenderCallback, .inputProcRefCon = this };
+	result = AudioUnitSetProperty(unit, kAudioUnitProperty_SetRenderCallback, kAudioUnitScope_Input, 0, &callback, sizeof(callback));
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.EffectChain", "AudioUnitSetProperty (kAudioUnitProperty_SetRenderCallback) failed: " << result);
+		AudioComponentInstanceDispose(unit);
+		return false;
+	}
+
+	UInt32 maximumFramesPerSlice = kMaximumFramesPerSlice;
+	result = AudioUnitSetProperty(unit, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, 0, &maximumFramesPerSlice, sizeof(maximumFramesPerSlice));
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.EffectChain", "AudioUnitSetProperty (kAudioUnitProperty_MaximumFramesPerSlice) failed: " << result);
+		AudioComponentInstanceDispose(unit);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Effect effect = { .mUnit = unit, .mConfigured = false };
+
+	// If audio has already been processed the effect is configured now to avoid doing so at the next call to Process()
+	if(IsProcessableFormat(mFormat) && !ConfigureEffect(effect)) {
+		AudioComponentInstanceDispose(unit);
+		return false;
+	}
+
+	mEffects.push_back(effect);
+	mEffectCount.store(mEffects.size());
+
+	if(effectUnit)
+		*effectUnit = unit;
+
+	return true;
+}
+
+bool SFB::Audio::EffectChain::RemoveEffect(AudioUnit effectUnit)
+{
+	if(nullptr == effectUnit)
+		return false;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	auto iter = std::find_if(mEffects.begin(), mEffects.end(), [effectUnit](const Effect& effect) { return effect.mUnit == effectUnit; });
+	if(iter == mEffects.end())
+		return false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.EffectChain", "Removing DSP: " << effectUnit);
+
+	if(iter->mConfigured)
+		AudioUnitUninitialize(iter->mUnit);
+	AudioComponentInstanceDispose(iter->mUnit);
+
+	mEffects.erase(iter);
+	mEffectCount.store(mEffects.size());
+
+	return true;
+}
+
+void SFB::Audio::EffectChain::RemoveAllEffects()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	for(auto& effect : mEffects) {
+		if(effect.mConfigured)
+			AudioUnitUninitialize(effect.mUnit);
+		AudioComponentInstanceDispose(effect.mUnit);
+	}
+
+	mEffects.clear();
+	mEffectCount.store(0);
+}
+
+Float64 SFB::Audio::EffectChain::GetLatency() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Float64 latency = 0;
+	for(const auto& effect : mEffects) {
+		Float64 effectLatency = 0;
+		UInt32 dataSize = sizeof(effectLatency);
+		if(noErr == AudioUnitGetProperty(effect.mUnit, kAudioUnitProperty_Latency, kAudioUnitScope_Global, 0, &effectLatency, &dataSize))
+			latency += effectLatency;
+	}
+
+	return latency;
+}
+
+#pragma mark Processing
+
+bool SFB::Audio::EffectChain::Process(AudioBufferList *bufferList, UInt32 frameCount, const AudioFormat& format)
+{
+	if(nullptr == bufferList || 0 == frameCount)
+		return false;
+
+	if(!IsProcessableFormat(format)) {
+		LOGGER_DEBUG("org.sbooth.AudioEngine.EffectChain", "Effects can't process audio in format " << format);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if(mEffects.empty())
+		return true;
+
+	// Reconfigure the effects when the format changes
+	if(format != mFormat) {
+		LOGGER_DEBUG("org.sbooth.AudioEngine.EffectChain", "Configuring effects for " << format);
+
+		if(!mScratchBufferList.Allocate(format, kMaximumFramesPerSlice)) {
+			LOGGER_ERR("org.sbooth.AudioEngine.EffectChain", "Unable to allocate scratch buffer");
+			mFormat = AudioFormat();
+			return false;
+		}
+
+		mFormat = format;
+		mSampleTime = 0;
+
+		for(auto& effect : mEffects) {
+			if(effect.mConfigured) {
+				AudioUnitUninitialize(effect.mUnit);
+				effect.mConfigured = false;
+			}
+			ConfigureEffect(effect);
+		}
+	}
+
+	for(UInt32 sliceOffset = 0; sliceOffset < frameCount; sliceOffset += kMaximumFramesPerSlice) {
+		UInt32 sliceFrames = std::min(frameCount - sliceOffset, kMaximumFramesPerSlice);
+		size_t sliceByteOffset = mFormat.FrameCountToByteCount(sliceOffset);
+		size_t sliceByteCount = mFormat.FrameCountToByteCount(sliceFrames);
+
+		AudioTimeStamp timeStamp = {};
+		timeStamp.mFlags = kAudioTimeStampSampleTimeValid;
+		timeStamp.mSampleTime = mSampleTime;
+
+		for(auto& effect : mEffects) {
+			// An effect that couldn't be configured is bypassed
+			if(!effect.mConfigured)
+				continue;
+
+			mInput = bufferList;
+			mInputOffset = sliceOffset;
+
+			mScratchBufferList.Reset();
+			for(UInt32 i = 0; i < mScratchBufferList->mNumberBuffers; ++i)
+				mScratchBufferList->mBuffers[i].mDataByteSize = (UInt32)sliceByteCount;
+
+			AudioUnitRenderActionFlags actionFlags = 0;
+			auto result = AudioUnitRender(effect.mUnit, &actionFlags, &timeStamp, 0, sliceFrames, mScratchBufferList);
+			if(noErr != result) {
+				LOGGER_ERR("org.sbooth.AudioEngine.EffectChain", "AudioUnitRender failed: " << result);
+				continue;
+			}
+
+			// The output of each effect is the input to the next
+			for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+				std::memcpy((uint8_t *)bufferList->mBuffers[i].mData + sliceByteOffset, mScratchBufferList->mBuffers[i].mData, sliceByteCount);
+		}
+
+		mSampleTime += sliceFrames;
+	}
+
+	mInput = nullptr;
+	mInputOffset = 0;
+
+	return true;
+}
+
+void SFB::Audio::EffectChain::Reset()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	for(auto& effect : mEffects) {
+		if(!effect.mConfigured)
+			continue;
+
+		auto result = AudioUnitReset(effect.mUnit, kAudioUnitScope_Global, 0);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.EffectChain", "AudioUnitReset failed: " << result);
+	}
+
+	mSampleTime = 0;
+}
+
+#pragma mark Internals
+
+bool SFB::Audio::EffectChain::ConfigureEffect(Effect& effect)
+{
+	auto result = AudioUnitSetProperty(effect.mUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &mFormat, sizeof(mFormat));
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.EffectChain", "AudioUnitSetProperty (kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input) failed: " << result);
+		return false;
+	}
+
+	result = AudioUnitSetProperty(effect.mUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 0, &mFormat, sizeof(mFormat));
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.EffectChain", "AudioUnitSetProperty (kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output) failed: " << result);
+		return false;
+	}
+
+	result = AudioUnitInitialize(effect.mUnit);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.EffectChain", "AudioUnitInitialize failed: " << result);
+		return false;
+	}
+
+	effect.mConfigured = true;
+	return true;
+}
+
+OSStatus SFB::Audio::EffectChain::RenderCallback(void *inRefCon, AudioUnitRenderActionFlags */*ioActionFlags*/, const AudioTimeStamp */*inTimeStamp*/, UInt32 /*inBusNumber*/, UInt32 inNumberFrames, AudioBufferList *ioData)
+{
+	auto chain = static_cast<EffectChain *>(inRefCon);
+	if(nullptr == chain->mInput)
+		return kAudioUnitErr_NoConnection;
+
+	size_t byteOffset = chain->mFormat.FrameCountToByteCount(chain->mInputOffset);
+	size_t byteCount = chain->mFormat.FrameCountToByteCount(inNumberFrames);
+
+	// The unit may provide its own buffers or accept the chain's
+	for(UInt32 i = 0; i < ioData->mNumberBuffers; ++i) {
+		uint8_t *input = (uint8_t *)chain->mInput->mBuffers[i].mData + byteOffset;
+		if(ioData->mBuffers[i].mData)
+			std::memcpy(ioData->mBuffers[i].mData, input, byteCount);
+		else
+			ioData->mBuffers[i].mData = input;
+		ioData->mBuffers[i].mDataByteSize = (UInt32)byteCount;
+	}
+
+	return noErr;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "AudioBufferList.h"
+#include "AudioFormat.h"
+
+/*! @file AudioEffectChain.h @brief A chain of \c AudioUnit effects rendered offline */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A chain of \c AudioUnit effects processing audio outside of an \c AUGraph
+		 *
+		 * Each effect is rendered offline with \c AudioUnitRender() using timestamps maintained by the chain,
+		 * so audio may be processed on any thread before it is buffered for output.  Effects may be added and
+		 * removed on any thread while audio is processed.
+		 * @note Only 32-bit floating point non-interleaved PCM is processed.
+		 */
+		class EffectChain
+		{
+		public:
+
+			/*! @brief The maximum number of frames passed to an effect in a single render */
+			static const UInt32 kMaximumFramesPerSlice = 4096;
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Create a new, empty \c EffectChain */
+			EffectChain();
+
+			/*! @brief Destroy the \c EffectChain and dispose of its effects */
+			~EffectChain();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			EffectChain(const EffectChain& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			EffectChain& operator=(const EffectChain& rhs) = delete;
+
+			/*! @endcond */
+
+			//@}
+
+
+			// ========================================
+			/*! @name Effects */
+			//@{
+
+			/*!
+			 * @brief Add an effect to the end of the chain
+			 * @param componentType The \c AudioComponent type, normally \c kAudioUnitType_Effect
+			 * @param subType The \c AudioComponent subtype
+			 * @param manufacturer The \c AudioComponent manufacturer
+			 * @param flags The \c AudioComponent flags
+			 * @param mask The \c AudioComponent mask
+			 * @param effectUnit An optional pointer to an \c AudioUnit to receive the effect
+			 * @return \c true on success, \c false otherwise
+			 * @see AudioComponentDescription
+			 */
+			bool AddEffect(OSType componentType, OSType subType, OSType manufacturer, UInt32 flags, UInt32 mask, AudioUnit *effectUnit = nullptr);
+
+			/*!
+			 * @brief Remove an effect from the chain and dispose of it
+			 * @param effectUnit The \c AudioUnit to remove
+			 * @return \c true on success, \c false if \c effectUnit is not in the chain
+			 */
+			bool RemoveEffect(AudioUnit effectUnit);
+
+			/*! @brief Remove and dispose of all effects */
+			void RemoveAllEffects();
+
+			/*! @brief Query whether the chain contains any effects */
+			inline bool IsEmpty() const								{ return 0 == mEffectCount.load(); }
+
+			/*! @brief Get the sum of the effects' latencies in seconds */
+			Float64 GetLatency() const;
+
+			//@}
+
+
+			// ========================================
+			/*! @name Processing */
+			//@{
+
+			/*!
+			 * @brief Process audio in place through each effect in order
+			 * @note The effects are reconfigured if \c format differs from the format of the previous call
+			 * @param bufferList The audio to process
+			 * @param frameCount The number of frames in \c bufferList
+			 * @param format The format of the audio in \c bufferList
+			 * @return \c true if the audio was processed, \c false otherwise
+			 */
+			bool Process(AudioBufferList *bufferList, UInt32 frameCount, const AudioFormat& format);
+
+			/*! @brief Discard the effects' internal state, such as delay lines and reverb tails, in preparation for discontiguous audio */
+			void Reset();
+
+			//@}
+
+		private:
+
+			struct Effect {
+				AudioUnit	mUnit;
+				bool		mConfigured;		/*!< Whether the unit is initialized for mFormat */
+			};
+
+			bool ConfigureEffect(Effect& effect);
+			static OSStatus RenderCallback(void *inRefCon, AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *inTimeStamp, UInt32 inBusNumber, UInt32 inNumberFrames, AudioBufferList *ioData);
+
+			mutable std::mutex			mMutex;					/*!< Protects the effects and their configuration */
+			std::vector<Effect>			mEffects;
+			std::atomic_size_t			mEffectCount;
+
+			AudioFormat					mFormat;				/*!< The format the effects are configured for */
+			BufferList					mScratchBufferList;		/*!< Receives the output of each effect */
+			Float64						mSampleTime;			/*!< The sample time of the next slice */
+
+			// The input for the effect being rendered
+			const AudioBufferList		*mInput;
+			UInt32						mInputOffset;			/*!< The offset of the slice in mInput, in frames */
+		};
+
+	}
+}
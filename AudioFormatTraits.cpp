@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include "AudioFormatTraits.h"
+#include "SampleKernels.h"
+
+namespace {
+
+	// ========================================
+	// Routines specialized by traits
+
+	/*! Return the number of buffers in \c bufferList described by \c Traits */
+	template <typename Traits>
+	inline UInt32 BufferCount(const AudioBufferList *bufferList)
+	{
+		return 0 != Traits::kBufferCount ? Traits::kBufferCount : bufferList->mNumberBuffers;
+	}
+
+	template <typename Traits>
+	size_t FrameCountToByteCount(const SFB::Audio::AudioFormat& /*format*/, size_t frameCount)
+	{
+		return Traits::FrameCountToByteCount(frameCount);
+	}
+
+	template <typename Traits>
+	void Store(const SFB::Audio::AudioFormat& /*format*/, uint8_t * const *buffers, size_t destFrame, const AudioBufferList *bufferList, size_t srcFrame, size_t frameCount)
+	{
+		for(UInt32 bufferIndex = 0; bufferIndex < BufferCount<Traits>(bufferList); ++bufferIndex)
+			memcpy(buffers[bufferIndex] + Traits::FrameCountToByteCount(destFrame), (const uint8_t *)bufferList->mBuffers[bufferIndex].mData + Traits::FrameCountToByteCount(srcFrame), Traits::FrameCountToByteCount(frameCount));
+	}
+
+	template <typename Traits>
+	void Fetch(const SFB::Audio::AudioFormat& /*format*/, AudioBufferList *bufferList, size_t destFrame, const uint8_t * const *buffers, size_t srcFrame, size_t frameCount)
+	{
+		for(UInt32 bufferIndex = 0; bufferIndex < BufferCount<Traits>(bufferList); ++bufferIndex)
+			memcpy((uint8_t *)bufferList->mBuffers[bufferIndex].mData + Traits::FrameCountToByteCount(destFrame), buffers[bufferIndex] + Traits::FrameCountToByteCount(srcFrame), Traits::FrameCountToByteCount(frameCount));
+	}
+
+	template <typename Traits>
+	void FillSilence(const SFB::Audio::AudioFormat& /*format*/, AudioBufferList *bufferList, size_t frameOffset, size_t frameCount)
+	{
+		// Zero is silence for all PCM sample types
+		for(UInt32 bufferIndex = 0; bufferIndex < BufferCount<Traits>(bufferList); ++bufferIndex)
+			memset((uint8_t *)bufferList->mBuffers[bufferIndex].mData + Traits::FrameCountToByteCount(frameOffset), 0, Traits::FrameCountToByteCount(frameCount));
+	}
+
+	/*! Return the factor converting samples of type \c T to [-1, 1) */
+	template <typename T>
+	constexpr float SampleScale()
+	{
+		return std::is_floating_point<T>::value ? 1.f : 1.f / (float)(UINT64_C(1) << (8 * sizeof(T) - 1));
+	}
+
+	// The sample conversions are performed by the kernels selected for the host
+	inline void ConvertSamplesToFloat(const SFB::Audio::SampleKernels& kernels, const float *input, UInt32 stride, float *output, UInt32 count)
+	{
+		kernels.Copy(input, stride, output, 1, count);
+	}
+
+	inline void ConvertSamplesToFloat(const SFB::Audio::SampleKernels& kernels, const int16_t *input, UInt32 stride, float *output, UInt32 count)
+	{
+		kernels.ConvertInt16ToFloat(input, stride, output, 1, count, SampleScale<int16_t>());
+	}
+
+	inline void ConvertSamplesToFloat(const SFB::Audio::SampleKernels& kernels, const int32_t *input, UInt32 stride, float *output, UInt32 count)
+	{
+		kernels.ConvertInt32ToFloat(input, stride, output, 1, count, SampleScale<int32_t>());
+	}
+
+	template <typename Traits>
+	void ConvertToFloat(const SFB::Audio::AudioFormat& format, const AudioBufferList *bufferList, size_t frameOffset, float * const *outputs, size_t frameCount)
+	{
+		using T = typename Traits::SampleType;
+		const UInt32 channelCount = 0 != Traits::kChannelCount ? Traits::kChannelCount : format.mChannelsPerFrame;
+		const UInt32 stride = Traits::kIsInterleaved ? Traits::kChannelCount : 1;
+		const auto& kernels = SFB::Audio::SampleKernels::Get();
+
+		for(UInt32 channel = 0; channel < channelCount; ++channel) {
+			const T *input = Traits::kIsInterleaved
+				? (const T *)bufferList->mBuffers[0].mData + (frameOffset * stride) + channel
+				: (const T *)bufferList->mBuffers[channel].mData + frameOffset;
+			ConvertSamplesToFloat(kernels, input, stride, outputs[channel], (UInt32)frameCount);
+		}
+	}
+
+	template <typename T, bool Interleaved, UInt32 ChannelCount>
+	constexpr SFB::Audio::FormatKernels MakeKernels(const char *name)
+	{
+		using Traits = SFB::Audio::PCMFormatTraits<T, Interleaved, ChannelCount>;
+		return {
+			FrameCountToByteCount<Traits>,
+			Store<Traits>,
+			Fetch<Traits>,
+			FillSilence<Traits>,
+			ConvertToFloat<Traits>,
+			name
+		};
+	}
+
+	// ========================================
+	// General routines
+
+	size_t GeneralFrameCountToByteCount(const SFB::Audio::AudioFormat& format, size_t frameCount)
+	{
+		return format.FrameCountToByteCount(frameCount);
+	}
+
+	void GeneralStore(const SFB::Audio::AudioFormat& format, uint8_t * const *buffers, size_t destFrame, const AudioBufferList *bufferList, size_t srcFrame, size_t frameCount)
+	{
+		for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
+			memcpy(buffers[bufferIndex] + format.FrameCountToByteCount(destFrame), (const uint8_t *)bufferList->mBuffers[bufferIndex].mData + format.FrameCountToByteCount(srcFrame), format.FrameCountToByteCount(frameCount));
+	}
+
+	void GeneralFetch(const SFB::Audio::AudioFormat& format, AudioBufferList *bufferList, size_t destFrame, const uint8_t * const *buffers, size_t srcFrame, size_t frameCount)
+	{
+		for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
+			memcpy((uint8_t *)bufferList->mBuffers[bufferIndex].mData + format.FrameCountToByteCount(destFrame), buffers[bufferIndex] + format.FrameCountToByteCount(srcFrame), format.FrameCountToByteCount(frameCount));
+	}
+
+	void GeneralFillSilence(const SFB::Audio::AudioFormat& format, AudioBufferList *bufferList, size_t frameOffset, size_t frameCount)
+	{
+		for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
+			memset((uint8_t *)bufferList->mBuffers[bufferIndex].mData + format.FrameCountToByteCount(frameOffset), format.IsDSD() ? 0xF : 0, format.FrameCountToByteCount(frameCount));
+	}
+
+	const SFB::Audio::FormatKernels sGeneralKernels = {
+		GeneralFrameCountToByteCount,
+		GeneralStore,
+		GeneralFetch,
+		GeneralFillSilence,
+		nullptr,
+		"General"
+	};
+
+	// ========================================
+	// The specialized formats, in the order they are matched
+	struct SpecializedKernels {
+		bool (*mMatches)(const AudioStreamBasicDescription& format);
+		SFB::Audio::FormatKernels mKernels;
+	};
+
+#define SPECIALIZED_KERNELS(T, interleaved, channelCount, name) \
+	{ SFB::Audio::PCMFormatTraits<T, interleaved, channelCount>::Matches, MakeKernels<T, interleaved, channelCount>(name) }
+
+	const SpecializedKernels sSpecializedKernels [] = {
+		SPECIALIZED_KERNELS(float, false, 2, "Float32, 2 ch, non-interleaved"),
+		SPECIALIZED_KERNELS(float, false, 1, "Float32, 1 ch"),
+		SPECIALIZED_KERNELS(float, false, 0, "Float32, non-interleaved"),
+		SPECIALIZED_KERNELS(float, true, 2, "Float32, 2 ch, interleaved"),
+		SPECIALIZED_KERNELS(int16_t, true, 2, "Int16, 2 ch, interleaved"),
+		SPECIALIZED_KERNELS(int16_t, false, 0, "Int16, non-interleaved"),
+		SPECIALIZED_KERNELS(int32_t, true, 2, "Int32, 2 ch, interleaved"),
+		SPECIALIZED_KERNELS(int32_t, false, 0, "Int32, non-interleaved"),
+	};
+
+#undef SPECIALIZED_KERNELS
+
+}
+
+const SFB::Audio::FormatKernels& SFB::Audio::FormatKernels::GetForFormat(const AudioFormat& format)
+{
+	// Select the sample kernels used by the conversion routines before they are called
+	SampleKernels::Get();
+
+	for(const auto& specializedKernels : sSpecializedKernels) {
+		if(specializedKernels.mMatches(format))
+			return specializedKernels.mKernels;
+	}
+
+	return sGeneralKernels;
+}
+
+const SFB::Audio::FormatKernels& SFB::Audio::FormatKernels::GetGeneral()
+{
+	return sGeneralKernels;
+}
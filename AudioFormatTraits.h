@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "AudioFormat.h"
+
+/*! @file AudioFormatTraits.h @brief Compile-time descriptions of common formats and routines specialized for them */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A compile-time description of a native-endian, packed PCM format
+		 * @tparam T The sample type: \c float, \c int16_t, or \c int32_t
+		 * @tparam Interleaved Whether the channels are interleaved in one buffer
+		 * @tparam ChannelCount The number of channels, or \c 0 for any number of non-interleaved channels
+		 */
+		template <typename T, bool Interleaved, UInt32 ChannelCount>
+		struct PCMFormatTraits
+		{
+			static_assert(std::is_same<T, float>::value || std::is_same<T, int16_t>::value || std::is_same<T, int32_t>::value, "Unsupported sample type");
+			static_assert(!Interleaved || 0 < ChannelCount, "Interleaved formats require a channel count");
+
+			/*! @brief The sample type */
+			using SampleType = T;
+
+			/*! @brief Whether the channels are interleaved */
+			static constexpr bool kIsInterleaved = Interleaved;
+
+			/*! @brief The number of channels, or \c 0 if any number of channels */
+			static constexpr UInt32 kChannelCount = ChannelCount;
+
+			/*! @brief The number of buffers, or \c 0 if one per channel for any number of channels */
+			static constexpr UInt32 kBufferCount = Interleaved ? 1 : ChannelCount;
+
+			/*! @brief The number of bytes per frame in each buffer */
+			static constexpr UInt32 kBytesPerFrame = (Interleaved ? ChannelCount : 1) * sizeof(T);
+
+			/*! @brief Convert a frame count to byte count */
+			static constexpr size_t FrameCountToByteCount(size_t frameCount)		{ return frameCount * kBytesPerFrame; }
+
+			/*! @brief Convert a byte count to frame count */
+			static constexpr size_t ByteCountToFrameCount(size_t byteCount)			{ return byteCount / kBytesPerFrame; }
+
+			/*! @brief Query whether \c format is described by these traits */
+			static constexpr bool Matches(const AudioStreamBasicDescription& format)
+			{
+				return kAudioFormatLinearPCM == format.mFormatID
+					&& 8 * sizeof(T) == format.mBitsPerChannel
+					&& kBytesPerFrame == format.mBytesPerFrame
+					&& (0 == ChannelCount || ChannelCount == format.mChannelsPerFrame)
+					&& std::is_floating_point<T>::value == (0 != (kAudioFormatFlagIsFloat & format.mFormatFlags))
+					&& !Interleaved == (0 != (kAudioFormatFlagIsNonInterleaved & format.mFormatFlags))
+					&& kAudioFormatFlagsNativeEndian == (kAudioFormatFlagIsBigEndian & format.mFormatFlags);
+			}
+		};
+
+		/*!
+		 * @brief A table of routines specialized for one format
+		 *
+		 * The routines for common formats are instantiated from \c PCMFormatTraits, so their byte counts and loops
+		 * over buffers are resolved at compile time.  Other formats use routines that consult the \c AudioFormat
+		 * passed to them.  A table is looked up once, when the format is established, so hot loops don't branch
+		 * on the format.  The routines resolve only the layout of the buffers; samples are converted by the
+		 * \c SampleKernels selected for the host.
+		 *
+		 * Frame offsets and counts are in frames of the format.
+		 */
+		struct FormatKernels
+		{
+			// ========================================
+			/*! @name Routine types */
+			//@{
+
+			/*! @brief Convert a frame count to byte count */
+			using FrameCountToByteCountFunction = size_t (*)(const AudioFormat& format, size_t frameCount);
+
+			/*! @brief Copy audio from \c bufferList to the channel buffers \c buffers */
+			using StoreFunction = void (*)(const AudioFormat& format, uint8_t * const *buffers, size_t destFrame, const AudioBufferList *bufferList, size_t srcFrame, size_t frameCount);
+
+			/*! @brief Copy audio from the channel buffers \c buffers to \c bufferList */
+			using FetchFunction = void (*)(const AudioFormat& format, AudioBufferList *bufferList, size_t destFrame, const uint8_t * const *buffers, size_t srcFrame, size_t frameCount);
+
+			/*! @brief Fill frames of \c bufferList with silence */
+			using FillSilenceFunction = void (*)(const AudioFormat& format, AudioBufferList *bufferList, size_t frameOffset, size_t frameCount);
+
+			/*! @brief Convert frames of \c bufferList to one 32-bit float buffer per channel in [-1, 1) */
+			using ConvertToFloatFunction = void (*)(const AudioFormat& format, const AudioBufferList *bufferList, size_t frameOffset, float * const *outputs, size_t frameCount);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Routines */
+			//@{
+
+			FrameCountToByteCountFunction		FrameCountToByteCount;		/*!< @brief Frame to byte conversion */
+			StoreFunction						Store;						/*!< @brief Ring buffer writing */
+			FetchFunction						Fetch;						/*!< @brief Ring buffer reading */
+			FillSilenceFunction					FillSilence;				/*!< @brief Silence */
+			ConvertToFloatFunction				ConvertToFloat;				/*!< @brief Conversion to float, or \c nullptr if not supported */
+
+			/*! @brief A description of the format the routines are specialized for */
+			const char							*mName;
+
+			//@}
+
+
+			// ========================================
+			/*! @name Lookup */
+			//@{
+
+			/*!
+			 * @brief Get the routines for a format
+			 * @note This method is real-time safe after its first call
+			 * @param format The format
+			 * @return The routines specialized for \c format if it is common, or general routines otherwise
+			 */
+			static const FormatKernels& GetForFormat(const AudioFormat& format);
+
+			/*! @brief Get the general routines, which support any format */
+			static const FormatKernels& GetGeneral();
+
+			//@}
+		};
+
+	}
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <mach/mach_time.h>
+
+#include "AudioLevelMeter.h"
+#include "SampleKernels.h"
+
+// The number of frames interpolated at a time for true-peak measurement
+#define TRUE_PEAK_CHUNK_SIZE_FRAMES 256
+
+// The oversampling factor for true-peak measurement
+#define TRUE_PEAK_OVERSAMPLING_FACTOR 4
+
+// A flag marking the published levels as unread in mMiddle
+#define LEVELS_UNREAD_FLAG 0x4
+
+namespace {
+
+	using SFB::Audio::LevelMeter;
+
+	// ========================================
+	// Interpolation filters for the oversampled phases between input samples
+	// Phase 0 is the input sample itself so it isn't included
+	struct TruePeakFilters
+	{
+		TruePeakFilters()
+		{
+			const double halfLength = LevelMeter::kTruePeakFilterLength / 2.;
+
+			for(UInt32 phase = 0; phase < TRUE_PEAK_OVERSAMPLING_FACTOR - 1; ++phase) {
+				double fraction = (phase + 1) / (double)TRUE_PEAK_OVERSAMPLING_FACTOR;
+				double sum = 0;
+
+				// Tap i is applied to the input sample i - (halfLength - 1) - fraction samples from the interpolated position
+				for(UInt32 i = 0; i < LevelMeter::kTruePeakFilterLength; ++i) {
+					double x = i - (halfLength - 1) - fraction;
+					double sinc = 0 == x ? 1 : std::sin(M_PI * x) / (M_PI * x);
+					double window = 0.5 * (1 + std::cos(M_PI * x / halfLength));
+					mCoefficients[phase][i] = (float)(sinc * window);
+					sum += mCoefficients[phase][i];
+				}
+
+				// Normalize for unity gain at DC
+				for(UInt32 i = 0; i < LevelMeter::kTruePeakFilterLength; ++i)
+					mCoefficients[phase][i] = (float)(mCoefficients[phase][i] / sum);
+			}
+		}
+
+		float mCoefficients [TRUE_PEAK_OVERSAMPLING_FACTOR - 1][LevelMeter::kTruePeakFilterLength];
+	};
+
+	const TruePeakFilters& GetTruePeakFilters()
+	{
+		static TruePeakFilters sFilters;
+		return sFilters;
+	}
+
+	bool IsMeterableFormat(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && format.IsNativeEndian();
+	}
+
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::LevelMeter::LevelMeter(double integrationTime)
+	: mIntegrationTime(std::max(integrationTime, 0.001)), mResetPending(true), mSampleRate(0), mChannelCount(0), mIntegrationFrames(0), mFramesIntegrated(0), mMiddle(1), mBack(2), mFront(0)
+{
+	memset(mLevels, 0, sizeof(mLevels));
+
+	// Compute the filters and select the kernels now instead of on the rendering thread
+	GetTruePeakFilters();
+	SampleKernels::Get();
+}
+
+#pragma mark Metering
+
+void SFB::Audio::LevelMeter::Process(const AudioBufferList *bufferList, UInt32 frameCount, const AudioFormat& format)
+{
+	if(!bufferList || 0 == frameCount || !IsMeterableFormat(format))
+		return;
+
+	if(mResetPending.exchange(false) || format.mSampleRate != mSampleRate || std::min(format.mChannelsPerFrame, (UInt32)kMaximumChannelCount) != mChannelCount)
+		PerformReset(format);
+
+	const auto& filters = GetTruePeakFilters();
+	const auto& kernels = SampleKernels::Get();
+	bool interleaved = format.IsInterleaved();
+	UInt32 stride = interleaved ? format.mChannelsPerFrame : 1;
+
+	UInt32 framesProcessed = 0;
+	while(framesProcessed < frameCount) {
+		// Segments end at integration period boundaries
+		UInt32 segmentFrames = std::min(frameCount - framesProcessed, mIntegrationFrames - mFramesIntegrated);
+
+		for(UInt32 channel = 0; channel < mChannelCount; ++channel) {
+			const float *samples = nullptr;
+			if(interleaved)
+				samples = (const float *)bufferList->mBuffers[0].mData + channel;
+			else if(channel < bufferList->mNumberBuffers)
+				samples = (const float *)bufferList->mBuffers[channel].mData;
+			else
+				break;
+
+			samples += framesProcessed * stride;
+
+			// Each chunk is measured contiguously after the trailing samples of the previous chunk, which precede it
+			// for interpolation
+			float peak = 0;
+			float truePeak = 0;
+			float buffer [kTruePeakFilterLength - 1 + TRUE_PEAK_CHUNK_SIZE_FRAMES];
+			float interpolated [TRUE_PEAK_CHUNK_SIZE_FRAMES];
+			float *chunk = buffer + kTruePeakFilterLength - 1;
+
+			memcpy(buffer, mHistory[channel], sizeof(mHistory[channel]));
+
+			for(UInt32 chunkStart = 0; chunkStart < segmentFrames; chunkStart += TRUE_PEAK_CHUNK_SIZE_FRAMES) {
+				UInt32 chunkFrames = std::min((UInt32)TRUE_PEAK_CHUNK_SIZE_FRAMES, segmentFrames - chunkStart);
+				kernels.Copy(samples + chunkStart * stride, stride, chunk, 1, chunkFrames);
+
+				peak = std::max(peak, kernels.MaximumMagnitude(chunk, chunkFrames));
+				mSumOfSquares[channel] += kernels.SumOfSquares(chunk, chunkFrames);
+
+				for(UInt32 phase = 0; phase < TRUE_PEAK_OVERSAMPLING_FACTOR - 1; ++phase) {
+					kernels.Filter(buffer, 1, filters.mCoefficients[phase], kTruePeakFilterLength, interpolated, chunkFrames);
+					truePeak = std::max(truePeak, kernels.MaximumMagnitude(interpolated, chunkFrames));
+				}
+
+				memmove(buffer, buffer + chunkFrames, sizeof(mHistory[channel]));
+			}
+
+			memcpy(mHistory[channel], buffer, sizeof(mHistory[channel]));
+			mPeak[channel] = std::max(mPeak[channel], peak);
+			mTruePeak[channel] = std::max(mTruePeak[channel], std::max(truePeak, peak));
+		}
+
+		framesProcessed += segmentFrames;
+		mFramesIntegrated += segmentFrames;
+
+		if(mFramesIntegrated == mIntegrationFrames)
+			Publish();
+	}
+}
+
+bool SFB::Audio::LevelMeter::GetLevels(Levels& levels) const
+{
+	std::lock_guard<std::mutex> lock(mReaderMutex);
+
+	// Exchange the front buffer for the published levels if they are newer
+	if(LEVELS_UNREAD_FLAG & mMiddle.load())
+		mFront = mMiddle.exchange(mFront) & ~LEVELS_UNREAD_FLAG;
+
+	if(0 == mLevels[mFront].mHostTime)
+		return false;
+
+	levels = mLevels[mFront];
+	return true;
+}
+
+#pragma mark Internals
+
+void SFB::Audio::LevelMeter::PerformReset(const AudioFormat& format)
+{
+	mSampleRate = format.mSampleRate;
+	mChannelCount = std::min(format.mChannelsPerFrame, (UInt32)kMaximumChannelCount);
+	mIntegrationFrames = std::max((UInt32)std::lround(mIntegrationTime * mSampleRate), 1u);
+	mFramesIntegrated = 0;
+
+	memset(mPeak, 0, sizeof(mPeak));
+	memset(mSumOfSquares, 0, sizeof(mSumOfSquares));
+	memset(mTruePeak, 0, sizeof(mTruePeak));
+	memset(mHistory, 0, sizeof(mHistory));
+}
+
+void SFB::Audio::LevelMeter::Publish()
+{
+	auto& levels = mLevels[mBack];
+
+	levels.mChannelCount = mChannelCount;
+	for(UInt32 channel = 0; channel < mChannelCount; ++channel) {
+		levels.mPeak[channel] = mPeak[channel];
+		levels.mRMS[channel] = (float)std::sqrt(mSumOfSquares[channel] / mFramesIntegrated);
+		levels.mTruePeak[channel] = mTruePeak[channel];
+	}
+	levels.mHostTime = mach_absolute_time();
+
+	// Publish the back buffer and reuse the previously published one
+	mBack = mMiddle.exchange(mBack | LEVELS_UNREAD_FLAG) & ~LEVELS_UNREAD_FLAG;
+
+	mFramesIntegrated = 0;
+	memset(mPeak, 0, sizeof(mPeak));
+	memset(mSumOfSquares, 0, sizeof(mSumOfSquares));
+	memset(mTruePeak, 0, sizeof(mTruePeak));
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <CoreAudio/CoreAudioTypes.h>
+#include <atomic>
+#include <mutex>
+
+#include "AudioFormat.h"
+
+/*! @file AudioLevelMeter.h @brief Audio level metering */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A peak, RMS, and true-peak level meter
+		 *
+		 * Levels are measured on the rendering thread without allocating or locking and published every
+		 * integration period to a triple buffer, from which the most recent levels may be read on any thread.
+		 *
+		 * True-peak levels are estimated by oversampling four times using windowed sinc interpolation.
+		 * @note Only 32-bit floating point PCM is metered. Channels beyond \c kMaximumChannelCount are ignored.
+		 */
+		class LevelMeter
+		{
+		public:
+
+			/*! @brief The maximum number of channels metered */
+			static const UInt32 kMaximumChannelCount = 16;
+
+			/*! @brief The number of taps in each true-peak interpolation filter phase */
+			static const UInt32 kTruePeakFilterLength = 16;
+
+			/*! @brief Levels for an integration period, as linear amplitudes */
+			struct Levels {
+				UInt32		mChannelCount;							/*!< The number of valid channels */
+				float		mPeak [kMaximumChannelCount];			/*!< The largest sample magnitude */
+				float		mRMS [kMaximumChannelCount];			/*!< The root mean square of the samples */
+				float		mTruePeak [kMaximumChannelCount];		/*!< The largest interpolated sample magnitude */
+				uint64_t	mHostTime;								/*!< The host time at which the levels were measured */
+			};
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*!
+			 * @brief Create a new \c LevelMeter
+			 * @param integrationTime The period over which levels are measured, in seconds
+			 */
+			explicit LevelMeter(double integrationTime = 0.05);
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			LevelMeter(const LevelMeter& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			LevelMeter& operator=(const LevelMeter& rhs) = delete;
+
+			/*! @endcond */
+
+			//@}
+
+
+			// ========================================
+			/*! @name Metering */
+			//@{
+
+			/*!
+			 * @brief Measure the levels of audio
+			 * @note This method is safe to call from the real-time rendering thread
+			 * @param bufferList The audio to measure
+			 * @param frameCount The number of frames in \c bufferList
+			 * @param format The format of the audio in \c bufferList
+			 */
+			void Process(const AudioBufferList *bufferList, UInt32 frameCount, const AudioFormat& format);
+
+			/*!
+			 * @brief Discard the levels and interpolation history
+			 * @note The reset is performed by the next call to \c Process()
+			 */
+			inline void Reset()										{ mResetPending.store(true); }
+
+			/*!
+			 * @brief Get the most recently published levels
+			 * @note This method may be called from any thread
+			 * @param levels A \c Levels struct to receive the levels
+			 * @return \c true if levels have been published, \c false otherwise
+			 */
+			bool GetLevels(Levels& levels) const;
+
+			//@}
+
+		private:
+
+			void PerformReset(const AudioFormat& format);
+			void Publish();
+
+			double					mIntegrationTime;		/*!< The integration period in seconds */
+			std::atomic_bool		mResetPending;			/*!< Whether the meter should be reset */
+
+			// Rendering thread state
+			Float64					mSampleRate;			/*!< The sample rate of the metered audio */
+			UInt32					mChannelCount;			/*!< The number of metered channels */
+			UInt32					mIntegrationFrames;		/*!< Frames per integration period */
+			UInt32					mFramesIntegrated;		/*!< Frames measured in the current period */
+			float					mPeak [kMaximumChannelCount];
+			double					mSumOfSquares [kMaximumChannelCount];
+			float					mTruePeak [kMaximumChannelCount];
+			float					mHistory [kMaximumChannelCount][kTruePeakFilterLength - 1];		/*!< Trailing samples for interpolation */
+
+			// Triple buffer
+			Levels					mLevels [3];
+			mutable std::atomic<uint8_t>	mMiddle;				/*!< The index of the published levels and whether they are unread */
+			uint8_t					mBack;					/*!< The index written by the rendering thread */
+			mutable uint8_t			mFront;					/*!< The index read by consumers */
+			mutable std::mutex		mReaderMutex;			/*!< Serializes consumers */
+		};
+
+	}
+}
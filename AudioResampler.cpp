@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <new>
+#include <thread>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <dispatch/dispatch.h>
+
+#include "AudioResampler.h"
+#include "AudioBufferList.h"
+#include "AudioDecoder.h"
+#include "CFErrorUtilities.h"
+#include "Logger.h"
+#include "ParallelDecoder.h"
+#include "SampleKernels.h"
+
+// The largest supported interpolation factor; larger factors require prohibitively many filters
+#define MAX_PHASES 4096
+
+// The longest supported filter, reached when downsampling by large factors
+#define MAX_TAPS 4096
+
+// The minimum number of frames rendered by each thread
+#define MIN_FRAMES_PER_THREAD 4096u
+
+// The number of frames delivered per call to the handler by ResampleURL()
+#define RESAMPLE_URL_CHUNK_FRAMES 16384u
+
+namespace {
+
+	// Filter parameters for each quality
+	struct FilterParameters
+	{
+		UInt32 mTaps;			// Filter length when upsampling
+		double mPassband;		// Fraction of the Nyquist frequency passed
+		double mBeta;			// Kaiser window shape
+	};
+
+	FilterParameters GetFilterParameters(SFB::Audio::Resampler::Quality quality)
+	{
+		switch(quality) {
+			case SFB::Audio::Resampler::Quality::Low:		return { 16, 0.85, 6 };
+			case SFB::Audio::Resampler::Quality::Medium:	return { 32, 0.90, 8 };
+			case SFB::Audio::Resampler::Quality::High:		return { 64, 0.94, 10 };
+			case SFB::Audio::Resampler::Quality::Mastering:	return { 128, 0.97, 13 };
+		}
+
+		return { 64, 0.94, 10 };
+	}
+
+	// The zeroth order modified Bessel function of the first kind
+	double BesselI0(double x)
+	{
+		double sum = 1;
+		double term = 1;
+		for(int k = 1; k < 64; ++k) {
+			double t = x / (2 * k);
+			term *= t * t;
+			sum += term;
+			if(term < sum * 1e-12)
+				break;
+		}
+		return sum;
+	}
+
+	SInt64 GreatestCommonDivisor(SInt64 a, SInt64 b)
+	{
+		while(0 != b) {
+			SInt64 t = a % b;
+			a = b;
+			b = t;
+		}
+		return a;
+	}
+
+	bool IsFloatNonInterleaved(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && !format.IsInterleaved() && format.IsNativeEndian();
+	}
+
+	SFB::Audio::AudioFormat FloatNonInterleavedFormat(Float64 sampleRate, UInt32 channelCount)
+	{
+		SFB::Audio::AudioFormat format;
+
+		format.mFormatID			= kAudioFormatLinearPCM;
+		format.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+
+		format.mSampleRate			= sampleRate;
+		format.mChannelsPerFrame	= channelCount;
+		format.mBitsPerChannel		= 32;
+
+		format.mBytesPerPacket		= format.mBitsPerChannel / 8;
+		format.mFramesPerPacket		= 1;
+		format.mBytesPerFrame		= format.mBytesPerPacket * format.mFramesPerPacket;
+
+		format.mReserved			= 0;
+
+		return format;
+	}
+
+}
+
+#pragma mark Offline Resampling
+
+bool SFB::Audio::Resampler::ResampleURL(CFURLRef url, Float64 sampleRate, const AudioHandler& handler, Quality quality, size_t threadCount, CFErrorRef *error)
+{
+	if(nullptr == url || !handler) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Resampler", "ResampleURL() called with invalid parameters");
+		return false;
+	}
+
+	// The decoder's format determines the conversion
+	AudioFormat decoderFormat;
+	{
+		auto decoder = Decoder::CreateForURL(url, error);
+		if(!decoder || (!decoder->IsOpen() && !decoder->Open(error)))
+			return false;
+		decoderFormat = decoder->GetFormat();
+	}
+
+	Resampler resampler;
+	if(!decoderFormat.IsPCM() || !resampler.Configure(decoderFormat.mSampleRate, sampleRate, decoderFormat.mChannelsPerFrame, quality)) {
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be resampled."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Sample rate conversion not supported"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("Only PCM audio at integral sample rates may be resampled."), ""));
+
+			*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::FileFormatNotSupportedError, description, url, failureReason, recoverySuggestion);
+		}
+
+		return false;
+	}
+
+	resampler.SetThreadCount(threadCount);
+
+	// Other PCM formats are converted to float without resampling
+	AudioFormat inputFormat = FloatNonInterleavedFormat(decoderFormat.mSampleRate, decoderFormat.mChannelsPerFrame);
+	AudioConverterRef converter = nullptr;
+	if(!IsFloatNonInterleaved(decoderFormat)) {
+		auto result = AudioConverterNew(&decoderFormat, &inputFormat, &converter);
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Resampler", "AudioConverterNew failed: " << result);
+
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainOSStatus, result, nullptr);
+
+			return false;
+		}
+	}
+
+	BufferList inputBuffer;
+	BufferList outputBuffer;
+	if(!outputBuffer.Allocate(FloatNonInterleavedFormat(sampleRate, decoderFormat.mChannelsPerFrame), RESAMPLE_URL_CHUNK_FRAMES)) {
+		if(converter)
+			AudioConverterDispose(converter);
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
+		return false;
+	}
+
+	bool keepResampling = true;
+
+	// Deliver all output that can be rendered from the input so far
+	auto deliver = [&]() {
+		while(keepResampling) {
+			outputBuffer.Reset();
+			UInt32 framesRendered = resampler.Render(outputBuffer, 0, RESAMPLE_URL_CHUNK_FRAMES);
+			if(0 == framesRendered)
+				break;
+			keepResampling = handler(outputBuffer, framesRendered);
+		}
+		return keepResampling;
+	};
+
+	bool succeeded = ParallelDecoder::DecodeURL(url, [&](const AudioBufferList *bufferList, UInt32 frameCount) {
+		if(converter) {
+			if(inputBuffer.GetCapacityFrames() < frameCount && !inputBuffer.Allocate(inputFormat, frameCount)) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Resampler", "Unable to allocate memory");
+				return false;
+			}
+
+			inputBuffer.Reset();
+			auto result = AudioConverterConvertComplexBuffer(converter, frameCount, bufferList, inputBuffer);
+			if(noErr != result) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Resampler", "AudioConverterConvertComplexBuffer failed: " << result);
+				return false;
+			}
+
+			bufferList = inputBuffer;
+		}
+
+		if(!resampler.AppendInput(bufferList, frameCount))
+			return false;
+
+		return deliver();
+	}, threadCount, ParallelDecoder::DefaultSegmentFrames, nullptr, error);
+
+	if(succeeded && keepResampling) {
+		resampler.Finish();
+		deliver();
+	}
+
+	if(converter) {
+		auto result = AudioConverterDispose(converter);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Resampler", "AudioConverterDispose failed: " << result);
+	}
+
+	return succeeded;
+}
+
+#pragma mark Creation
+
+SFB::Audio::Resampler::Resampler()
+	: mChannelCount(0), mTaps(0), mInterpolation(1), mDecimation(1), mThreadCount(1), mInputStart(0), mInputFrames(0), mOutputFrame(0), mFinished(false)
+{}
+
+#pragma mark Configuration
+
+bool SFB::Audio::Resampler::Configure(Float64 inputSampleRate, Float64 outputSampleRate, UInt32 channelCount, Quality quality)
+{
+	mTaps = 0;
+
+	if(0 >= inputSampleRate || 0 >= outputSampleRate || std::floor(inputSampleRate) != inputSampleRate || std::floor(outputSampleRate) != outputSampleRate || 0 == channelCount) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Resampler", "Unsupported conversion from " << inputSampleRate << " Hz to " << outputSampleRate << " Hz");
+		return false;
+	}
+
+	SInt64 inputRate = (SInt64)inputSampleRate;
+	SInt64 outputRate = (SInt64)outputSampleRate;
+	SInt64 gcd = GreatestCommonDivisor(inputRate, outputRate);
+
+	SInt64 interpolation = outputRate / gcd;
+	SInt64 decimation = inputRate / gcd;
+
+	if(MAX_PHASES < interpolation) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Resampler", "Conversion from " << inputSampleRate << " Hz to " << outputSampleRate << " Hz requires " << interpolation << " phases");
+		return false;
+	}
+
+	auto parameters = GetFilterParameters(quality);
+
+	// When downsampling the cutoff moves to the output's Nyquist frequency and the filter lengthens to keep the transition band
+	double ratio = std::min(1., (double)interpolation / decimation);
+	double cutoff = ratio * parameters.mPassband;
+
+	UInt32 taps = parameters.mTaps;
+	if(1 > ratio)
+		taps = (UInt32)std::ceil(taps / ratio);
+	taps = std::min((UInt32)MAX_TAPS, (taps + 1) & ~1u);
+
+	std::vector<float> coefficients;
+	try {
+		coefficients.resize((size_t)interpolation * taps);
+	}
+
+	catch(const std::bad_alloc&) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Resampler", "Unable to allocate memory");
+		return false;
+	}
+
+	// Phase p's coefficient k weights the input frame (k - half + 1 - p / L) frames from the output frame's position
+	const double half = taps / 2;
+	const double i0Beta = BesselI0(parameters.mBeta);
+
+	for(SInt64 p = 0; p < interpolation; ++p) {
+		float *filter = coefficients.data() + (size_t)p * taps;
+		double sum = 0;
+
+		for(UInt32 k = 0; k < taps; ++k) {
+			double d = (k - half + 1) - (double)p / interpolation;
+			double x = d / half;
+
+			double h = 0;
+			if(1 > std::fabs(x)) {
+				double sinc = 0 == d ? 1 : std::sin(M_PI * cutoff * d) / (M_PI * cutoff * d);
+				h = cutoff * sinc * BesselI0(parameters.mBeta * std::sqrt(1 - (x * x))) / i0Beta;
+			}
+
+			filter[k] = (float)h;
+			sum += h;
+		}
+
+		// Normalize each phase for unity gain at DC
+		if(0 != sum)
+			SampleKernels::Get().Scale(filter, filter, taps, (float)(1 / sum));
+	}
+
+	try {
+		mInput.assign(channelCount, std::vector<float>());
+	}
+
+	catch(const std::bad_alloc&) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Resampler", "Unable to allocate memory");
+		return false;
+	}
+
+	mChannelCount = channelCount;
+	mTaps = taps;
+	mInterpolation = interpolation;
+	mDecimation = decimation;
+	mCoefficients.swap(coefficients);
+
+	Reset();
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Resampler", "Resampling " << inputSampleRate << " Hz to " << outputSampleRate << " Hz using " << interpolation << " phases of " << taps << " taps");
+
+	return true;
+}
+
+SInt64 SFB::Audio::Resampler::GetOutputFrameCount(SInt64 inputFrameCount) const
+{
+	if(0 >= inputFrameCount)
+		return 0;
+
+	return ((inputFrameCount * mInterpolation) + mDecimation - 1) / mDecimation;
+}
+
+#pragma mark Resampling
+
+bool SFB::Audio::Resampler::AppendInput(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(!IsConfigured() || mFinished || nullptr == bufferList || bufferList->mNumberBuffers != mChannelCount) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Resampler", "AppendInput() called with invalid parameters");
+		return false;
+	}
+
+	try {
+		for(UInt32 channel = 0; channel < mChannelCount; ++channel) {
+			auto samples = static_cast<const float *>(bufferList->mBuffers[channel].mData);
+			mInput[channel].insert(mInput[channel].end(), samples, samples + frameCount);
+		}
+	}
+
+	catch(const std::bad_alloc&) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Resampler", "Unable to allocate memory");
+		return false;
+	}
+
+	mInputFrames += frameCount;
+
+	return true;
+}
+
+void SFB::Audio::Resampler::Finish()
+{
+	if(!IsConfigured() || mFinished)
+		return;
+
+	// Input past the end is silence
+	for(auto& samples : mInput)
+		samples.insert(samples.end(), mTaps / 2, 0.f);
+
+	mFinished = true;
+}
+
+UInt32 SFB::Audio::Resampler::Render(AudioBufferList *bufferList, UInt32 frameOffset, UInt32 frameCount)
+{
+	if(!IsConfigured() || nullptr == bufferList || bufferList->mNumberBuffers != mChannelCount) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Resampler", "Render() called with invalid parameters");
+		return 0;
+	}
+
+	// Until the end of the input output frames are available once their filters are fully covered
+	SInt64 availableFrames = GetOutputFrameCount(mFinished ? mInputFrames : mInputFrames - (mTaps / 2)) - mOutputFrame;
+	frameCount = (UInt32)std::max((SInt64)0, std::min((SInt64)frameCount, availableFrames));
+	if(0 == frameCount)
+		return 0;
+
+	float *output [mChannelCount];
+	for(UInt32 channel = 0; channel < mChannelCount; ++channel) {
+		output[channel] = static_cast<float *>(bufferList->mBuffers[channel].mData) + frameOffset;
+		bufferList->mBuffers[channel].mDataByteSize = (UInt32)((frameOffset + frameCount) * sizeof(float));
+	}
+
+	// Output frames are independent, so large requests are divided between threads
+	size_t threadCount = 0 == mThreadCount ? std::max(1u, std::thread::hardware_concurrency()) : mThreadCount;
+	size_t chunkCount = std::min(threadCount, (size_t)(frameCount / MIN_FRAMES_PER_THREAD));
+
+	if(1 < chunkCount) {
+		UInt32 chunkFrames = (UInt32)((frameCount + chunkCount - 1) / chunkCount);
+		float * const *channels = output;
+		SInt64 firstFrame = mOutputFrame;
+
+		dispatch_apply(chunkCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^(size_t i) {
+			UInt32 offset = (UInt32)i * chunkFrames;
+			UInt32 count = std::min(chunkFrames, frameCount - offset);
+
+			float *chunk [mChannelCount];
+			for(UInt32 channel = 0; channel < mChannelCount; ++channel)
+				chunk[channel] = channels[channel] + offset;
+
+			RenderFrames(chunk, firstFrame + offset, count);
+		});
+	}
+	else
+		RenderFrames(output, mOutputFrame, frameCount);
+
+	mOutputFrame += frameCount;
+
+	TrimInput();
+
+	return frameCount;
+}
+
+bool SFB::Audio::Resampler::IsFinished() const
+{
+	return mFinished && mOutputFrame >= GetOutputFrameCount(mInputFrames);
+}
+
+void SFB::Audio::Resampler::Reset()
+{
+	// Input before the start is silence
+	for(auto& samples : mInput)
+		samples.assign(IsConfigured() ? (mTaps / 2) - 1 : 0, 0.f);
+
+	mInputStart = 1 - (SInt64)(mTaps / 2);
+	mInputFrames = 0;
+	mOutputFrame = 0;
+	mFinished = false;
+}
+
+void SFB::Audio::Resampler::RenderFrames(float * const *output, SInt64 firstFrame, UInt32 frameCount) const
+{
+	const SInt64 firstTap = 1 - (SInt64)(mTaps / 2);
+	const auto dotProduct = SampleKernels::Get().DotProduct;
+
+	for(UInt32 channel = 0; channel < mChannelCount; ++channel) {
+		const float *input = mInput[channel].data();
+		float *samples = output[channel];
+
+		// Output frame n is centered on input frame floor(n * M / L) at phase (n * M) mod L
+		SInt64 position = (firstFrame * mDecimation) / mInterpolation;
+		SInt64 phase = (firstFrame * mDecimation) % mInterpolation;
+
+		for(UInt32 i = 0; i < frameCount; ++i) {
+			samples[i] = dotProduct(input + (position + firstTap - mInputStart), mCoefficients.data() + (size_t)phase * mTaps, mTaps);
+
+			phase += mDecimation;
+			position += phase / mInterpolation;
+			phase %= mInterpolation;
+		}
+	}
+}
+
+void SFB::Audio::Resampler::TrimInput()
+{
+	SInt64 firstNeeded = ((mOutputFrame * mDecimation) / mInterpolation) + 1 - (SInt64)(mTaps / 2);
+	if(firstNeeded <= mInputStart)
+		return;
+
+	size_t discard = (size_t)(firstNeeded - mInputStart);
+	for(auto& samples : mInput)
+		samples.erase(samples.begin(), samples.begin() + (ptrdiff_t)std::min(discard, samples.size()));
+
+	mInputStart = firstNeeded;
+}
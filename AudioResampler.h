@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <CoreAudio/CoreAudioTypes.h>
+#include <CoreFoundation/CoreFoundation.h>
+
+/*! @file AudioResampler.h @brief High-quality sample rate conversion */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A polyphase windowed-sinc sample rate converter
+		 *
+		 * The conversion ratio is reduced to \c L/M and one Kaiser-windowed sinc filter is computed for each of the \c L
+		 * phases, so each output sample is a single vectorized dot product over the input.  Output frame \c n is centered
+		 * on input frame <tt>n * M / L</tt> and depends only on that position, so the output has no delay and any range
+		 * of output frames may be computed independently of the others.  \c Render() takes advantage of this to divide
+		 * large requests between threads, producing output identical to single-threaded conversion.
+		 * @note Only non-interleaved 32-bit floating point PCM at integral sample rates is resampled
+		 */
+		class Resampler
+		{
+		public:
+
+			/*! @brief The quality of sample rate conversion, trading speed for passband width and stopband attenuation */
+			enum class Quality {
+				Low,				/*!< 16-tap filter, suitable for previews */
+				Medium,				/*!< 32-tap filter */
+				High,				/*!< 64-tap filter; the default */
+				Mastering			/*!< 128-tap filter */
+			};
+
+			/*!
+			 * @brief A block called with resampled audio, in order
+			 * @param bufferList The resampled audio
+			 * @param frameCount The number of valid frames in \c bufferList
+			 * @return \c true to continue resampling, \c false to stop
+			 */
+			using AudioHandler = std::function<bool(const AudioBufferList *bufferList, UInt32 frameCount)>;
+
+
+			// ========================================
+			/*! @name Offline Resampling */
+			//@{
+
+			/*!
+			 * @brief Decode and resample \c url, delivering the audio to \c handler in order
+			 *
+			 * The URL is decoded using a \c ParallelDecoder and each decoded segment is resampled using \c threadCount threads.
+			 * @note \c handler is called on the calling thread with non-interleaved 32-bit floating point PCM
+			 * @param url The URL to resample
+			 * @param sampleRate The desired sample rate
+			 * @param handler The block receiving resampled audio
+			 * @param quality The conversion quality
+			 * @param threadCount The number of threads, or \c 0 for one thread per processor core
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			static bool ResampleURL(CFURLRef url, Float64 sampleRate, const AudioHandler& handler, Quality quality = Quality::High, size_t threadCount = 0, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Create a new, unconfigured \c Resampler */
+			Resampler();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			Resampler(const Resampler& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			Resampler& operator=(const Resampler& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			// ========================================
+			/*! @name Configuration */
+			//@{
+
+			/*!
+			 * @brief Compute the filters for a conversion and reset the resampler
+			 * @param inputSampleRate The sample rate of the input
+			 * @param outputSampleRate The sample rate of the output
+			 * @param channelCount The number of channels
+			 * @param quality The conversion quality
+			 * @return \c true on success, \c false if the sample rates aren't supported
+			 */
+			bool Configure(Float64 inputSampleRate, Float64 outputSampleRate, UInt32 channelCount, Quality quality = Quality::High);
+
+			/*! @brief Query whether this resampler is configured */
+			inline bool IsConfigured() const							{ return 0 != mTaps; }
+
+			/*! @brief Get the number of channels resampled */
+			inline UInt32 GetChannelCount() const						{ return mChannelCount; }
+
+			/*! @brief Get the number of filter taps, in input frames */
+			inline UInt32 GetTapCount() const							{ return mTaps; }
+
+			/*!
+			 * @brief Get the number of output frames produced from \c inputFrameCount input frames
+			 * @param inputFrameCount The number of input frames
+			 * @return The number of output frames
+			 */
+			SInt64 GetOutputFrameCount(SInt64 inputFrameCount) const;
+
+			/*!
+			 * @brief Set the number of threads used to render large blocks
+			 * @param threadCount The number of threads, or \c 0 for one thread per processor core
+			 */
+			inline void SetThreadCount(size_t threadCount)				{ mThreadCount = threadCount; }
+
+			//@}
+
+
+			// ========================================
+			/*! @name Resampling */
+			//@{
+
+			/*!
+			 * @brief Append audio to the input
+			 * @param bufferList The audio, which must be non-interleaved 32-bit floating point PCM
+			 * @param frameCount The number of frames in \c bufferList
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool AppendInput(const AudioBufferList *bufferList, UInt32 frameCount);
+
+			/*! @brief Mark the end of the input so the final frames may be rendered */
+			void Finish();
+
+			/*!
+			 * @brief Render resampled audio for the input appended so far
+			 * @param bufferList A buffer to receive the audio, which must be non-interleaved 32-bit floating point PCM
+			 * @param frameOffset The offset in frames into \c bufferList at which to begin writing
+			 * @param frameCount The maximum number of frames to render
+			 * @return The number of frames rendered
+			 */
+			UInt32 Render(AudioBufferList *bufferList, UInt32 frameOffset, UInt32 frameCount);
+
+			/*! @brief Query whether all output has been rendered following \c Finish() */
+			bool IsFinished() const;
+
+			/*! @brief Discard all input so the next frame appended begins a new stream */
+			void Reset();
+
+			//@}
+
+		private:
+
+			// Render output frames [firstFrame, firstFrame + frameCount) into the channel buffers
+			void RenderFrames(float * const *output, SInt64 firstFrame, UInt32 frameCount) const;
+
+			// Discard input frames no longer needed to render the next output frame
+			void TrimInput();
+
+			// Configuration
+			UInt32								mChannelCount;
+			UInt32								mTaps;				// Filter length in input frames, always even
+			SInt64								mInterpolation;		// L
+			SInt64								mDecimation;		// M
+			std::vector<float>					mCoefficients;		// mInterpolation filters of mTaps coefficients
+			size_t								mThreadCount;
+
+			// Stream state
+			std::vector<std::vector<float>>		mInput;				// One vector per channel
+			SInt64								mInputStart;		// The input frame at mInput[c][0]
+			SInt64								mInputFrames;		// The number of frames appended
+			SInt64								mOutputFrame;		// The next frame to render
+			bool								mFinished;
+		};
+
+	}
+}
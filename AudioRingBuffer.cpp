@@ -4,38 +4,84 @@
  */
 
 #include "AudioRingBuffer.h"
+#include "MirroredMemory.h"
+#include "Signposts.h"
 
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <algorithm>
 
+#include <sys/mman.h>
+#include <mach/mach.h>
+
+#include <Accelerate/Accelerate.h>
+
+#include "Logger.h"
+
+// The capacity of the staging buffers used for in-place access to compact storage
+#define STAGING_CAPACITY_FRAMES 8192
+
 namespace {
 
-	/*!
-	 * Copy non-interleaved audio from \c bufferList to \c buffers
-	 * @param buffers The destination buffers
-	 * @param destOffset The byte offset in \c buffers to begin writing
-	 * @param bufferList The source buffers
-	 * @param srcOffset The byte offset in \c bufferList to begin reading
-	 * @param byteCount The number of bytes per non-interleaved buffer to read and write
-	 */
-	inline void StoreABL(uint8_t **buffers, size_t destOffset, const AudioBufferList *bufferList, size_t srcOffset, size_t byteCount)
+	// Lock memory so the real-time thread never faults on it; if that fails the pages are at least faulted in now
+	bool LockMemory(void *address, size_t byteCount)
 	{
-		for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
-			memcpy(buffers[bufferIndex] + destOffset, (uint8_t *)bufferList->mBuffers[bufferIndex].mData + srcOffset, byteCount);
+		if(0 == mlock(address, byteCount))
+			return true;
+
+		LOGGER_NOTICE("org.sbooth.AudioEngine.RingBuffer", "mlock failed: " << strerror(errno));
+
+		auto bytes = static_cast<volatile uint8_t *>(address);
+		for(size_t offset = 0; offset < byteCount; offset += vm_page_size)
+			bytes[offset] = bytes[offset];
+
+		return false;
+	}
+
+	/*! Return the number of bytes per channel per frame stored in \c storageFormat */
+	inline size_t StorageFormatBytesPerFrame(SFB::Audio::RingBuffer::StorageFormat storageFormat, const SFB::Audio::AudioFormat& format)
+	{
+		switch(storageFormat) {
+			case SFB::Audio::RingBuffer::StorageFormat::Int16:		return sizeof(int16_t);
+			case SFB::Audio::RingBuffer::StorageFormat::Int24:		return sizeof(vDSP_int24);
+			case SFB::Audio::RingBuffer::StorageFormat::Float16:	return sizeof(uint16_t);
+			default:												return format.mBytesPerFrame;
+		}
+	}
+
+	/*! Convert 32-bit float samples to integers of the specified precision, clipping, using \c scratch for intermediate values */
+	template <typename T, void (*Fix)(const float *, vDSP_Stride, T *, vDSP_Stride, vDSP_Length)>
+	inline void ConvertFloatToInteger(const float *input, T *output, size_t frameCount, float scale, float *scratch)
+	{
+		float minimum = -scale, maximum = scale - 1;
+		vDSP_vsmul(input, 1, &scale, scratch, 1, frameCount);
+		vDSP_vclip(scratch, 1, &minimum, &maximum, scratch, 1, frameCount);
+		Fix(scratch, 1, output, 1, frameCount);
+	}
+
+	/*! Convert integers of the specified precision to 32-bit float samples */
+	template <typename T, void (*Float)(const T *, vDSP_Stride, float *, vDSP_Stride, vDSP_Length)>
+	inline void ConvertIntegerToFloat(const T *input, float *output, size_t frameCount, float scale)
+	{
+		float reciprocal = 1 / scale;
+		Float(input, 1, output, 1, frameCount);
+		vDSP_vsmul(output, 1, &reciprocal, output, 1, frameCount);
 	}
 
 	/*!
-	 * Copy non-interleaved audio from \c buffers to \c bufferList
-	 * @param bufferList The destination buffers
-	 * @param destOffset The byte offset in \c bufferList to begin writing
-	 * @param buffers The source buffers
-	 * @param srcOffset The byte offset in \c bufferList to begin reading
-	 * @param byteCount The number of bytes per non-interleaved buffer to read and write
+	 * Point the non-interleaved buffers in \c bufferList at a region of \c buffers
+	 * @param bufferList The buffer list to set
+	 * @param buffers The channel buffers
+	 * @param offset The byte offset in \c buffers of the region
+	 * @param byteCount The number of bytes per non-interleaved buffer in the region
 	 */
-	inline void FetchABL(AudioBufferList *bufferList, size_t destOffset, const uint8_t **buffers, size_t srcOffset, size_t byteCount)
+	inline void SetABL(AudioBufferList *bufferList, uint8_t **buffers, size_t offset, size_t byteCount)
 	{
-		for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
-			memcpy((uint8_t *)bufferList->mBuffers[bufferIndex].mData + destOffset, buffers[bufferIndex] + srcOffset, byteCount);
+		for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex) {
+			bufferList->mBuffers[bufferIndex].mData = buffers[bufferIndex] + offset;
+			bufferList->mBuffers[bufferIndex].mDataByteSize = (UInt32)byteCount;
+		}
 	}
 
 	/*!
@@ -54,13 +100,45 @@ namespace {
 		return 1 << (32 - __builtin_clz(x - 1));
 	}
 
+	/*! The bits of an additional reader's cursor holding the read pointer; the remaining bits count resets */
+	const size_t kAdditionalReaderPointerMask = 0xFFFFFFFF;
+
+	/*! Return an additional reader's cursor for the read pointer \c 0 in the generation following \c cursor */
+	inline size_t NextAdditionalReaderGeneration(size_t cursor)
+	{
+		return (cursor | kAdditionalReaderPointerMask) + 1;
+	}
+
+	/*! Return the number of frames available for reading given the write and read pointers */
+	inline size_t FramesAvailableToRead(size_t writePointer, size_t readPointer, size_t capacityFrames, size_t capacityFramesMask)
+	{
+		if(writePointer > readPointer)
+			return writePointer - readPointer;
+		else
+			return (writePointer - readPointer + capacityFrames) & capacityFramesMask;
+	}
+
+	/*! Return the number of frames available for writing given the write and read pointers */
+	inline size_t FramesAvailableToWrite(size_t writePointer, size_t readPointer, size_t capacityFrames, size_t capacityFramesMask)
+	{
+		if(writePointer > readPointer)
+			return ((readPointer - writePointer + capacityFrames) & capacityFramesMask) - 1;
+		else if(writePointer < readPointer)
+			return (readPointer - writePointer) - 1;
+		else
+			return capacityFrames - 1;
+	}
+
 }
 
 #pragma mark Creation and Destruction
 
 SFB::Audio::RingBuffer::RingBuffer()
-	: mBuffers(nullptr), mCapacityFrames(0), mCapacityFramesMask(0), mWritePointer(0), mReadPointer(0)
-{}
+	: mStorageFormat(StorageFormat::Native), mStorageBytesPerFrame(0), mFormatKernels(&FormatKernels::GetGeneral()), mBuffers(nullptr), mWriteVector{nullptr, nullptr}, mReadVector{nullptr, nullptr}, mCapacityFrames(0), mCapacityFramesMask(0), mMirrored(false), mStagingBuffer(nullptr), mStagingCapacityFrames(0), mLockMemory(false), mAllocationSize(0), mLockedByteCount(0), mAdditionalReaderMask(0), mWritePointer(0), mCachedReadPointer(0), mReadPointer(0), mCachedWritePointer(0)
+{
+	for(auto& reader : mAdditionalReaders)
+		reader.mReadPointer.store(0);
+}
 
 SFB::Audio::RingBuffer::~RingBuffer()
 {
@@ -69,7 +147,7 @@ SFB::Audio::RingBuffer::~RingBuffer()
 
 #pragma mark Buffer Management
 
-bool SFB::Audio::RingBuffer::Allocate(const AudioFormat& format, size_t capacityFrames)
+bool SFB::Audio::RingBuffer::Allocate(const AudioFormat& format, size_t capacityFrames, bool mirrored, StorageFormat storageFormat)
 {
 	// Only non-interleaved formats are supported
 	if(format.IsInterleaved())
@@ -77,79 +155,182 @@ bool SFB::Audio::RingBuffer::Allocate(const AudioFormat& format, size_t capacity
 
 	Deallocate();
 
+	// Compact storage holds 32-bit float samples
+	if(!(kAudioFormatLinearPCM == format.mFormatID && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && format.IsNativeEndian()))
+		storageFormat = StorageFormat::Native;
+
+	mStorageFormat = storageFormat;
+	mStorageBytesPerFrame = StorageFormatBytesPerFrame(storageFormat, format);
+
 	// Round up to the next power of two
 	capacityFrames = NextPowerOfTwo((uint32_t)capacityFrames);
 
+	// Mirrored memory is allocated in whole pages
+	if(mirrored) {
+		while(0 != StorageByteCount(capacityFrames) % GetMirroredMemoryGranularity())
+			capacityFrames *= 2;
+	}
+
 	mFormat = format;
+	mFormatKernels = &FormatKernels::GetForFormat(format);
 
 	mCapacityFrames = capacityFrames;
 	mCapacityFramesMask = capacityFrames - 1;
 
-	size_t capacityBytes = format.FrameCountToByteCount(capacityFrames);
+	size_t capacityBytes = StorageByteCount(capacityFrames);
+
+	// In-place access to compact storage uses staging buffers in the buffer's format
+	if(StorageFormat::Native != storageFormat) {
+		mStagingCapacityFrames = std::min(capacityFrames - 1, (size_t)STAGING_CAPACITY_FRAMES);
+		mStagingBuffer = (float *)calloc(2 * format.mChannelsPerFrame * mStagingCapacityFrames, sizeof(float));
+		if(nullptr == mStagingBuffer) {
+			mCapacityFrames = 0;
+			mCapacityFramesMask = 0;
+			mStagingCapacityFrames = 0;
+			return false;
+		}
+	}
+
+	// The buffer lists making up the read and write vectors
+	size_t bufferListSize = offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * format.mChannelsPerFrame);
 
-	// One memory allocation holds everything- first the pointers followed by the deinterleaved channels
-	size_t allocationSize = (capacityBytes + sizeof(uint8_t *)) * format.mChannelsPerFrame;
+	// One memory allocation holds everything- first the pointers, then the vector buffer lists, followed by the deinterleaved channels
+	// Mirrored channels are mapped separately
+	size_t allocationSize = ((mirrored ? 0 : capacityBytes) + sizeof(uint8_t *)) * format.mChannelsPerFrame + (4 * bufferListSize);
 	uint8_t *memoryChunk = (uint8_t *)malloc(allocationSize);
-	if(nullptr == memoryChunk)
+	if(nullptr == memoryChunk) {
+		free(mStagingBuffer);
+		mStagingBuffer = nullptr;
+		mStagingCapacityFrames = 0;
+		mCapacityFrames = 0;
+		mCapacityFramesMask = 0;
 		return false;
+	}
 
 	// Zero the entire allocation
 	memset(memoryChunk, 0, allocationSize);
+	mAllocationSize = allocationSize;
 
 	// Assign the pointers and channel buffers
 	mBuffers = (uint8_t **)memoryChunk;
 	memoryChunk += format.mChannelsPerFrame * sizeof(uint8_t *);
+
+	for(auto bufferList : { &mWriteVector[0], &mWriteVector[1], &mReadVector[0], &mReadVector[1] }) {
+		*bufferList = (AudioBufferList *)memoryChunk;
+		(*bufferList)->mNumberBuffers = format.mChannelsPerFrame;
+		for(UInt32 i = 0; i < format.mChannelsPerFrame; ++i)
+			(*bufferList)->mBuffers[i].mNumberChannels = 1;
+		memoryChunk += bufferListSize;
+	}
+
+	mMirrored = mirrored;
+
 	for(UInt32 i = 0; i < format.mChannelsPerFrame; ++i) {
-		mBuffers[i] = memoryChunk;
-		memoryChunk += capacityBytes;
+		if(mirrored) {
+			mBuffers[i] = (uint8_t *)AllocateMirroredMemory(capacityBytes);
+			if(nullptr == mBuffers[i]) {
+				Deallocate();
+				return false;
+			}
+		}
+		else {
+			mBuffers[i] = memoryChunk;
+			memoryChunk += capacityBytes;
+		}
 	}
 
-	mReadPointer = 0;
-	mWritePointer = 0;
+	// Both mappings of mirrored memory are locked so neither faults
+	if(mLockMemory) {
+		if(LockMemory(mBuffers, mAllocationSize))
+			mLockedByteCount += mAllocationSize;
+
+		if(mirrored) {
+			for(UInt32 i = 0; i < format.mChannelsPerFrame; ++i) {
+				if(LockMemory(mBuffers[i], 2 * capacityBytes))
+					mLockedByteCount += capacityBytes;
+			}
+		}
+
+		if(mStagingBuffer) {
+			size_t stagingBytes = 2 * format.mChannelsPerFrame * mStagingCapacityFrames * sizeof(float);
+			if(LockMemory(mStagingBuffer, stagingBytes))
+				mLockedByteCount += stagingBytes;
+		}
+	}
+
+	mReadPointer.store(0);
+	mCachedReadPointer = 0;
+	mWritePointer.store(0);
+	mCachedWritePointer = 0;
+
+	// An additional reader's generation changes so a read in progress isn't committed
+	for(auto& reader : mAdditionalReaders)
+		reader.mReadPointer.store(NextAdditionalReaderGeneration(reader.mReadPointer.load()));
 
 	return true;
 }
 
 void SFB::Audio::RingBuffer::Deallocate()
 {
+	// Heap memory remains locked when freed so it is unlocked first; unmapping mirrored memory unlocks it
+	bool locked = 0 != mLockedByteCount;
+	mLockedByteCount = 0;
+
+	if(mStagingBuffer) {
+		if(locked)
+			munlock(mStagingBuffer, 2 * mFormat.mChannelsPerFrame * mStagingCapacityFrames * sizeof(float));
+		free(mStagingBuffer);
+		mStagingBuffer = nullptr;
+		mStagingCapacityFrames = 0;
+	}
+
 	if(mBuffers) {
+		if(mMirrored) {
+			for(UInt32 i = 0; i < mFormat.mChannelsPerFrame; ++i)
+				DeallocateMirroredMemory(mBuffers[i], StorageByteCount(mCapacityFrames));
+		}
+
+		if(locked)
+			munlock(mBuffers, mAllocationSize);
+
 		free(mBuffers);
 		mBuffers = nullptr;
+		mAllocationSize = 0;
+		mMirrored = false;
+
+		mCapacityFrames = 0;
+		mCapacityFramesMask = 0;
+
+		mWriteVector[0] = mWriteVector[1] = nullptr;
+		mReadVector[0] = mReadVector[1] = nullptr;
 	}
 }
 
 
 void SFB::Audio::RingBuffer::Reset()
 {
-	mReadPointer = 0;
-	mWritePointer = 0;
+	mReadPointer.store(0);
+	mCachedReadPointer = 0;
+	mWritePointer.store(0);
+	mCachedWritePointer = 0;
+
+	// An additional reader's generation changes so a read in progress isn't committed
+	for(auto& reader : mAdditionalReaders)
+		reader.mReadPointer.store(NextAdditionalReaderGeneration(reader.mReadPointer.load()));
 
 	for(UInt32 i = 0; i < mFormat.mChannelsPerFrame; ++i)
-		memset(mBuffers[i], 0, mFormat.FrameCountToByteCount(mCapacityFrames));
+		memset(mBuffers[i], 0, StorageByteCount(mCapacityFrames));
 }
 
 size_t SFB::Audio::RingBuffer::GetFramesAvailableToRead() const
 {
-	size_t w = mWritePointer;
-	size_t r = mReadPointer;
-
-	if(w > r)
-		return w - r;
-	else
-		return (w - r + mCapacityFrames) & mCapacityFramesMask;
+	return FramesAvailableToRead(mWritePointer.load(std::memory_order_acquire), mReadPointer.load(std::memory_order_acquire), mCapacityFrames, mCapacityFramesMask);
 }
 
 size_t SFB::Audio::RingBuffer::GetFramesAvailableToWrite() const
 {
-	size_t w = mWritePointer;
-	size_t r = mReadPointer;
-
-	if(w > r)
-		return ((r - w + mCapacityFrames) & mCapacityFramesMask) - 1;
-	else if(w < r)
-		return (r - w) - 1;
-	else
-		return mCapacityFrames - 1;
+	size_t writePointer = mWritePointer.load(std::memory_order_acquire);
+	return FramesAvailableToWrite(writePointer, LoadSlowestReadPointer(writePointer), mCapacityFrames, mCapacityFramesMask);
 }
 
 size_t SFB::Audio::RingBuffer::ReadAudio(AudioBufferList *bufferList, size_t frameCount)
@@ -157,16 +338,26 @@ size_t SFB::Audio::RingBuffer::ReadAudio(AudioBufferList *bufferList, size_t fra
 	if(0 == frameCount)
 		return 0;
 
-	size_t framesAvailable = GetFramesAvailableToRead();
+	// Only the reader stores mReadPointer
+	size_t readPointer = mReadPointer.load(std::memory_order_relaxed);
+
+	// The cached write pointer is refreshed only if it doesn't indicate enough audio
+	size_t framesAvailable = FramesAvailableToRead(mCachedWritePointer, readPointer, mCapacityFrames, mCapacityFramesMask);
+	if(framesAvailable < frameCount) {
+		mCachedWritePointer = mWritePointer.load(std::memory_order_acquire);
+		framesAvailable = FramesAvailableToRead(mCachedWritePointer, readPointer, mCapacityFrames, mCapacityFramesMask);
+	}
+
 	if(0 == framesAvailable)
 		return 0;
 
 	size_t framesToRead = std::min(framesAvailable, frameCount);
-	size_t cnt2 = mReadPointer + framesToRead;
+	size_t cnt2 = readPointer + framesToRead;
 
 	size_t n1, n2;
-	if(cnt2 > mCapacityFrames) {
-		n1 = mCapacityFrames - mReadPointer;
+	// A mirrored buffer never needs to be split
+	if(cnt2 > mCapacityFrames && !mMirrored) {
+		n1 = mCapacityFrames - readPointer;
 		n2 = cnt2 & mCapacityFramesMask;
 	}
 	else {
@@ -174,17 +365,25 @@ size_t SFB::Audio::RingBuffer::ReadAudio(AudioBufferList *bufferList, size_t fra
 		n2 = 0;
 	}
 
-	FetchABL(bufferList, 0, (const uint8_t **)mBuffers, mFormat.FrameCountToByteCount(mReadPointer), mFormat.FrameCountToByteCount(n1));
-	mReadPointer = (mReadPointer + n1) & mCapacityFramesMask;
+	if(StorageFormat::Native != mStorageFormat) {
+		FetchFrames(bufferList, 0, readPointer, n1);
+
+		if(n2)
+			FetchFrames(bufferList, n1, 0, n2);
+	}
+	else {
+		mFormatKernels->Fetch(mFormat, bufferList, 0, mBuffers, readPointer, n1);
 
-	if(n2) {
-		FetchABL(bufferList, mFormat.FrameCountToByteCount(n1), (const uint8_t **)mBuffers, mFormat.FrameCountToByteCount(mReadPointer), mFormat.FrameCountToByteCount(n2));
-		mReadPointer = (mReadPointer + n2) & mCapacityFramesMask;
+		if(n2)
+			mFormatKernels->Fetch(mFormat, bufferList, n1, mBuffers, 0, n2);
 	}
 
+	// Release the space to the writer only after the audio has been copied
+	mReadPointer.store((readPointer + framesToRead) & mCapacityFramesMask, std::memory_order_release);
+
 	// Set the buffer sizes
 	for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
-		bufferList->mBuffers[bufferIndex].mDataByteSize = (UInt32)mFormat.FrameCountToByteCount(framesToRead);
+		bufferList->mBuffers[bufferIndex].mDataByteSize = (UInt32)mFormatKernels->FrameCountToByteCount(mFormat, framesToRead);
 
 	return framesToRead;
 }
@@ -194,16 +393,30 @@ size_t SFB::Audio::RingBuffer::WriteAudio(const AudioBufferList *bufferList, siz
 	if(0 == frameCount)
 		return 0;
 
-	size_t framesAvailable = GetFramesAvailableToWrite();
-	if(0 == framesAvailable)
+	SFB_SIGNPOST_INTERVAL_BEGIN("RingBuffer::WriteAudio", this, "%zu frames", frameCount);
+
+	// Only the writer stores mWritePointer
+	size_t writePointer = mWritePointer.load(std::memory_order_relaxed);
+
+	// The cached read pointer is refreshed only if it doesn't indicate enough space
+	size_t framesAvailable = FramesAvailableToWrite(writePointer, mCachedReadPointer, mCapacityFrames, mCapacityFramesMask);
+	if(framesAvailable < frameCount) {
+		mCachedReadPointer = LoadSlowestReadPointer(writePointer);
+		framesAvailable = FramesAvailableToWrite(writePointer, mCachedReadPointer, mCapacityFrames, mCapacityFramesMask);
+	}
+
+	if(0 == framesAvailable) {
+		SFB_SIGNPOST_INTERVAL_END("RingBuffer::WriteAudio", this, "0 frames written");
 		return 0;
+	}
 
 	size_t framesToWrite = std::min(framesAvailable, frameCount);
-	size_t cnt2 = mWritePointer + framesToWrite;
+	size_t cnt2 = writePointer + framesToWrite;
 
 	size_t n1, n2;
-	if(cnt2 > mCapacityFrames) {
-		n1 = mCapacityFrames - mWritePointer;
+	// A mirrored buffer never needs to be split
+	if(cnt2 > mCapacityFrames && !mMirrored) {
+		n1 = mCapacityFrames - writePointer;
 		n2 = cnt2 & mCapacityFramesMask;
 	}
 	else {
@@ -211,13 +424,316 @@ size_t SFB::Audio::RingBuffer::WriteAudio(const AudioBufferList *bufferList, siz
 		n2 = 0;
 	}
 
-	StoreABL(mBuffers, mFormat.FrameCountToByteCount(mWritePointer), bufferList, 0, mFormat.FrameCountToByteCount(n1));
-	mWritePointer = (mWritePointer + n1) & mCapacityFramesMask;
+	if(StorageFormat::Native != mStorageFormat) {
+		StoreFrames(bufferList, 0, writePointer, n1);
 
-	if(n2) {
-		StoreABL(mBuffers, mFormat.FrameCountToByteCount(mWritePointer), bufferList, mFormat.FrameCountToByteCount(n1), mFormat.FrameCountToByteCount(n2));
-		mWritePointer = (mWritePointer + n2) & mCapacityFramesMask;
+		if(n2)
+			StoreFrames(bufferList, n1, 0, n2);
 	}
+	else {
+		mFormatKernels->Store(mFormat, mBuffers, writePointer, bufferList, 0, n1);
 
+		if(n2)
+			mFormatKernels->Store(mFormat, mBuffers, 0, bufferList, n1, n2);
+	}
+
+	// Publish the audio to the reader only after it has been copied
+	mWritePointer.store((writePointer + framesToWrite) & mCapacityFramesMask, std::memory_order_release);
+
+	SFB_SIGNPOST_INTERVAL_END("RingBuffer::WriteAudio", this, "%zu frames written", framesToWrite);
 	return framesToWrite;
 }
+
+SFB::Audio::RingBuffer::BufferPair SFB::Audio::RingBuffer::GetReadVector()
+{
+	size_t readPointer = mReadPointer.load(std::memory_order_relaxed);
+	mCachedWritePointer = mWritePointer.load(std::memory_order_acquire);
+
+	size_t framesAvailable = FramesAvailableToRead(mCachedWritePointer, readPointer, mCapacityFrames, mCapacityFramesMask);
+	if(0 == framesAvailable)
+		return {};
+
+	// Compact storage is expanded into the read staging buffer
+	if(StorageFormat::Native != mStorageFormat) {
+		framesAvailable = std::min(framesAvailable, mStagingCapacityFrames);
+
+		for(UInt32 i = 0; i < mFormat.mChannelsPerFrame; ++i) {
+			mReadVector[0]->mBuffers[i].mData = mStagingBuffer + ((mFormat.mChannelsPerFrame + i) * mStagingCapacityFrames);
+			mReadVector[0]->mBuffers[i].mDataByteSize = (UInt32)mFormatKernels->FrameCountToByteCount(mFormat, framesAvailable);
+		}
+
+		size_t cnt2 = readPointer + framesAvailable;
+		if(cnt2 > mCapacityFrames && !mMirrored) {
+			size_t n1 = mCapacityFrames - readPointer;
+			FetchFrames(mReadVector[0], 0, readPointer, n1);
+			FetchFrames(mReadVector[0], n1, 0, cnt2 & mCapacityFramesMask);
+		}
+		else
+			FetchFrames(mReadVector[0], 0, readPointer, framesAvailable);
+
+		return { { mReadVector[0], framesAvailable }, {} };
+	}
+
+	size_t cnt2 = readPointer + framesAvailable;
+
+	if(cnt2 > mCapacityFrames && !mMirrored) {
+		size_t n1 = mCapacityFrames - readPointer;
+		size_t n2 = cnt2 & mCapacityFramesMask;
+
+		SetABL(mReadVector[0], mBuffers, mFormatKernels->FrameCountToByteCount(mFormat, readPointer), mFormatKernels->FrameCountToByteCount(mFormat, n1));
+		SetABL(mReadVector[1], mBuffers, 0, mFormatKernels->FrameCountToByteCount(mFormat, n2));
+
+		return { { mReadVector[0], n1 }, { mReadVector[1], n2 } };
+	}
+	else {
+		SetABL(mReadVector[0], mBuffers, mFormatKernels->FrameCountToByteCount(mFormat, readPointer), mFormatKernels->FrameCountToByteCount(mFormat, framesAvailable));
+
+		return { { mReadVector[0], framesAvailable }, {} };
+	}
+}
+
+SFB::Audio::RingBuffer::BufferPair SFB::Audio::RingBuffer::GetWriteVector()
+{
+	size_t writePointer = mWritePointer.load(std::memory_order_relaxed);
+	mCachedReadPointer = LoadSlowestReadPointer(writePointer);
+
+	size_t framesAvailable = FramesAvailableToWrite(writePointer, mCachedReadPointer, mCapacityFrames, mCapacityFramesMask);
+	if(0 == framesAvailable)
+		return {};
+
+	// Audio for compact storage is written to the write staging buffer and stored by WriteAdvance()
+	if(StorageFormat::Native != mStorageFormat) {
+		framesAvailable = std::min(framesAvailable, mStagingCapacityFrames);
+
+		for(UInt32 i = 0; i < mFormat.mChannelsPerFrame; ++i) {
+			mWriteVector[0]->mBuffers[i].mData = mStagingBuffer + (i * mStagingCapacityFrames);
+			mWriteVector[0]->mBuffers[i].mDataByteSize = (UInt32)mFormatKernels->FrameCountToByteCount(mFormat, framesAvailable);
+		}
+
+		return { { mWriteVector[0], framesAvailable }, {} };
+	}
+
+	size_t cnt2 = writePointer + framesAvailable;
+
+	if(cnt2 > mCapacityFrames && !mMirrored) {
+		size_t n1 = mCapacityFrames - writePointer;
+		size_t n2 = cnt2 & mCapacityFramesMask;
+
+		SetABL(mWriteVector[0], mBuffers, mFormatKernels->FrameCountToByteCount(mFormat, writePointer), mFormatKernels->FrameCountToByteCount(mFormat, n1));
+		SetABL(mWriteVector[1], mBuffers, 0, mFormatKernels->FrameCountToByteCount(mFormat, n2));
+
+		return { { mWriteVector[0], n1 }, { mWriteVector[1], n2 } };
+	}
+	else {
+		SetABL(mWriteVector[0], mBuffers, mFormatKernels->FrameCountToByteCount(mFormat, writePointer), mFormatKernels->FrameCountToByteCount(mFormat, framesAvailable));
+
+		return { { mWriteVector[0], framesAvailable }, {} };
+	}
+}
+
+void SFB::Audio::RingBuffer::ReadAdvance(size_t frameCount)
+{
+	mReadPointer.store((mReadPointer.load(std::memory_order_relaxed) + frameCount) & mCapacityFramesMask, std::memory_order_release);
+}
+
+void SFB::Audio::RingBuffer::WriteAdvance(size_t frameCount)
+{
+	size_t writePointer = mWritePointer.load(std::memory_order_relaxed);
+
+	// Store the staged audio before publishing it
+	if(StorageFormat::Native != mStorageFormat && 0 != frameCount) {
+		frameCount = std::min(frameCount, mStagingCapacityFrames);
+
+		size_t cnt2 = writePointer + frameCount;
+		if(cnt2 > mCapacityFrames && !mMirrored) {
+			size_t n1 = mCapacityFrames - writePointer;
+			StoreFrames(mWriteVector[0], 0, writePointer, n1);
+			StoreFrames(mWriteVector[0], n1, 0, cnt2 & mCapacityFramesMask);
+		}
+		else
+			StoreFrames(mWriteVector[0], 0, writePointer, frameCount);
+	}
+
+	mWritePointer.store((writePointer + frameCount) & mCapacityFramesMask, std::memory_order_release);
+}
+
+#pragma mark Additional Readers
+
+void SFB::Audio::RingBuffer::SetAdditionalReaderEnabled(size_t reader, bool enabled)
+{
+	if(kMaximumAdditionalReaders <= reader)
+		return;
+
+	// The writer refreshes its cached read pointer when it next needs space
+	if(!enabled) {
+		mAdditionalReaderMask.fetch_and(~(1u << reader), std::memory_order_release);
+		return;
+	}
+
+	auto& cursor = mAdditionalReaders[reader].mReadPointer;
+	cursor.store(NextAdditionalReaderGeneration(cursor.load(std::memory_order_relaxed)) | mReadPointer.load(std::memory_order_acquire), std::memory_order_relaxed);
+	mAdditionalReaderMask.fetch_or(1u << reader, std::memory_order_release);
+
+	mCachedReadPointer = LoadSlowestReadPointer(mWritePointer.load(std::memory_order_relaxed));
+}
+
+bool SFB::Audio::RingBuffer::IsAdditionalReaderEnabled(size_t reader) const
+{
+	return kMaximumAdditionalReaders > reader && ((1u << reader) & mAdditionalReaderMask.load(std::memory_order_acquire));
+}
+
+size_t SFB::Audio::RingBuffer::GetFramesAvailableToRead(size_t reader) const
+{
+	if(!IsAdditionalReaderEnabled(reader))
+		return 0;
+
+	size_t readPointer = mAdditionalReaders[reader].mReadPointer.load(std::memory_order_acquire) & kAdditionalReaderPointerMask;
+	return FramesAvailableToRead(mWritePointer.load(std::memory_order_acquire), readPointer, mCapacityFrames, mCapacityFramesMask);
+}
+
+size_t SFB::Audio::RingBuffer::ReadAudio(size_t reader, AudioBufferList *bufferList, size_t frameOffset, size_t frameCount)
+{
+	if(0 == frameCount || !IsAdditionalReaderEnabled(reader))
+		return 0;
+
+	auto& cursor = mAdditionalReaders[reader].mReadPointer;
+	size_t cursorValue = cursor.load(std::memory_order_acquire);
+	size_t readPointer = cursorValue & kAdditionalReaderPointerMask;
+
+	size_t framesAvailable = FramesAvailableToRead(mWritePointer.load(std::memory_order_acquire), readPointer, mCapacityFrames, mCapacityFramesMask);
+	if(0 == framesAvailable)
+		return 0;
+
+	size_t framesToRead = std::min(framesAvailable, frameCount);
+	size_t cnt2 = readPointer + framesToRead;
+
+	size_t n1, n2;
+	if(cnt2 > mCapacityFrames && !mMirrored) {
+		n1 = mCapacityFrames - readPointer;
+		n2 = cnt2 & mCapacityFramesMask;
+	}
+	else {
+		n1 = framesToRead;
+		n2 = 0;
+	}
+
+	if(StorageFormat::Native != mStorageFormat) {
+		FetchFrames(bufferList, frameOffset, readPointer, n1);
+
+		if(n2)
+			FetchFrames(bufferList, frameOffset + n1, 0, n2);
+	}
+	else {
+		mFormatKernels->Fetch(mFormat, bufferList, frameOffset, mBuffers, readPointer, n1);
+
+		if(n2)
+			mFormatKernels->Fetch(mFormat, bufferList, frameOffset + n1, mBuffers, 0, n2);
+	}
+
+	// If the writer reset the cursor while the audio was copied the audio is discarded
+	size_t nextCursorValue = (cursorValue & ~kAdditionalReaderPointerMask) | ((readPointer + framesToRead) & mCapacityFramesMask);
+	if(!cursor.compare_exchange_strong(cursorValue, nextCursorValue, std::memory_order_release, std::memory_order_relaxed))
+		return 0;
+
+	return framesToRead;
+}
+
+size_t SFB::Audio::RingBuffer::LoadSlowestReadPointer(size_t writePointer) const
+{
+	size_t readPointer = mReadPointer.load(std::memory_order_acquire);
+
+	auto mask = mAdditionalReaderMask.load(std::memory_order_acquire);
+	if(0 == mask)
+		return readPointer;
+
+	size_t framesAvailable = FramesAvailableToWrite(writePointer, readPointer, mCapacityFrames, mCapacityFramesMask);
+	for(size_t reader = 0; reader < kMaximumAdditionalReaders; ++reader) {
+		if(!((1u << reader) & mask))
+			continue;
+
+		size_t additionalReadPointer = mAdditionalReaders[reader].mReadPointer.load(std::memory_order_acquire) & kAdditionalReaderPointerMask;
+		size_t additionalFramesAvailable = FramesAvailableToWrite(writePointer, additionalReadPointer, mCapacityFrames, mCapacityFramesMask);
+		if(additionalFramesAvailable < framesAvailable) {
+			framesAvailable = additionalFramesAvailable;
+			readPointer = additionalReadPointer;
+		}
+	}
+
+	return readPointer;
+}
+
+#pragma mark Compact Storage
+
+void SFB::Audio::RingBuffer::StoreFrames(const AudioBufferList *bufferList, size_t srcOffset, size_t destFrame, size_t frameCount)
+{
+	// Called by the writer, which owns the write staging buffer used as scratch space
+	// Staged audio is converted in place since it is no longer needed
+	bool staged = bufferList == mWriteVector[0];
+
+	for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex) {
+		const float *input = (const float *)bufferList->mBuffers[bufferIndex].mData + srcOffset;
+		uint8_t *output = mBuffers[bufferIndex] + StorageByteCount(destFrame);
+		float *scratch = staged ? (float *)input : mStagingBuffer + (bufferIndex * mStagingCapacityFrames);
+
+		size_t framesRemaining = frameCount;
+		while(0 < framesRemaining) {
+			size_t framesToConvert = std::min(framesRemaining, mStagingCapacityFrames);
+
+			switch(mStorageFormat) {
+				case StorageFormat::Int16:
+					ConvertFloatToInteger<int16_t, vDSP_vfixr16>(input, (int16_t *)output, framesToConvert, 1u << 15, scratch);
+					break;
+
+				case StorageFormat::Int24:
+					ConvertFloatToInteger<vDSP_int24, vDSP_vfixr24>(input, (vDSP_int24 *)output, framesToConvert, 1u << 23, scratch);
+					break;
+
+				case StorageFormat::Float16:
+				{
+					vImage_Buffer src = { (void *)input, 1, framesToConvert, framesToConvert * sizeof(float) };
+					vImage_Buffer dest = { output, 1, framesToConvert, framesToConvert * sizeof(uint16_t) };
+					vImageConvert_PlanarFtoPlanar16F(&src, &dest, kvImageDoNotTile);
+					break;
+				}
+
+				case StorageFormat::Native:
+					break;
+			}
+
+			input += framesToConvert;
+			output += StorageByteCount(framesToConvert);
+			if(staged)
+				scratch += framesToConvert;
+			framesRemaining -= framesToConvert;
+		}
+	}
+}
+
+void SFB::Audio::RingBuffer::FetchFrames(AudioBufferList *bufferList, size_t destOffset, size_t srcFrame, size_t frameCount) const
+{
+	for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex) {
+		const uint8_t *input = mBuffers[bufferIndex] + StorageByteCount(srcFrame);
+		float *output = (float *)bufferList->mBuffers[bufferIndex].mData + destOffset;
+
+		switch(mStorageFormat) {
+			case StorageFormat::Int16:
+				ConvertIntegerToFloat<int16_t, vDSP_vflt16>((const int16_t *)input, output, frameCount, 1u << 15);
+				break;
+
+			case StorageFormat::Int24:
+				ConvertIntegerToFloat<vDSP_int24, vDSP_vflt24>((const vDSP_int24 *)input, output, frameCount, 1u << 23);
+				break;
+
+			case StorageFormat::Float16:
+			{
+				vImage_Buffer src = { (void *)input, 1, frameCount, frameCount * sizeof(uint16_t) };
+				vImage_Buffer dest = { output, 1, frameCount, frameCount * sizeof(float) };
+				vImageConvert_Planar16FtoPlanarF(&src, &dest, kvImageDoNotTile);
+				break;
+			}
+
+			case StorageFormat::Native:
+				break;
+		}
+	}
+}
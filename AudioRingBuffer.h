@@ -7,8 +7,10 @@
 
 #include <CoreAudio/CoreAudioTypes.h>
 #include <memory>
+#include <atomic>
 
 #include "AudioFormat.h"
+#include "AudioFormatTraits.h"
 
 /*! @file AudioRingBuffer.h @brief An audio ring buffer */
 
@@ -26,6 +28,16 @@ namespace SFB {
 		 *
 		 * The read and write routines are based on JACK's ringbuffer implementation
 		 * but are modified for non-interleaved audio.
+		 *
+		 * The read and write pointers are atomic and kept on separate cache lines.  The reader and writer
+		 * each keep a cached copy of the other's pointer, which is refreshed only when it indicates
+		 * insufficient audio or space, so in the common case neither side touches the other's cache line.
+		 *
+		 * Up to \c kMaximumAdditionalReaders additional readers may read the same audio using independent cursors,
+		 * each from its own thread.  The space available to the writer is limited by the reader furthest behind.
+		 *
+		 * 32-bit float audio may be stored in a compact representation, which is converted when written and expanded
+		 * when read.  The in-place read and write vectors then refer to 32-bit float staging buffers of limited capacity.
 		 */
 		class RingBuffer
 		{
@@ -37,6 +49,17 @@ namespace SFB {
 			/*! @brief A \c std::unique_ptr for \c RingBuffer objects */
 			using unique_ptr = std::unique_ptr<RingBuffer>;
 
+			/*! @brief The representation of the samples held by a \c RingBuffer */
+			enum class StorageFormat {
+				Native,		/*!< Samples are stored in the buffer's format */
+				Int16,		/*!< 32-bit float samples are stored as 16-bit integers, exactly for 16-bit sources */
+				Int24,		/*!< 32-bit float samples are stored as packed 24-bit integers, exactly for sources of up to 24 bits */
+				Float16		/*!< 32-bit float samples are stored as 16-bit floats with 11 bits of precision */
+			};
+
+			/*! @brief The maximum number of additional readers */
+			static const size_t kMaximumAdditionalReaders = 4;
+
 			/*!
 			 * @brief Create a new \c RingBuffer
 			 * @note Allocate() must be called before the object may be used.
@@ -65,13 +88,23 @@ namespace SFB {
 
 			/*!
 			 * @brief Allocate space for audio data.
-			 * @note Only interleaved formats are supported.
+			 *
+			 * If \c mirrored is \c true each channel buffer's memory is mapped twice consecutively, so reads and writes
+			 * never split at the end of the buffer and the read and write vectors each consist of a single region.
+			 * The capacity of a mirrored buffer is rounded up so each channel buffer occupies whole virtual memory pages.
+			 *
+			 * A compact \c storageFormat reduces the memory holding the audio to one half or three quarters.  Samples are
+			 * rounded to the storage precision and integer storage clips samples outside [-1, 1).
+			 * @note Only non-interleaved formats are supported.
+			 * @note Compact storage is supported only for native-endian 32-bit float formats and is ignored for others.
 			 * @note This method is not thread safe.
 			 * @param format The format of the audio that will be written to and read from this buffer.
 			 * @param capacityFrames The desired capacity, in frames
+			 * @param mirrored Whether to allocate mirrored memory
+			 * @param storageFormat The representation of the stored samples
 			 * @return \c true on success, \c false on error
 			 */
-			bool Allocate(const AudioFormat& format, size_t capacityFrames);
+			bool Allocate(const AudioFormat& format, size_t capacityFrames, bool mirrored = false, StorageFormat storageFormat = StorageFormat::Native);
 
 			/*!
 			 * @brief Free the resources used by this \c RingBuffer
@@ -90,13 +123,50 @@ namespace SFB {
 			/*! @brief Get the capacity of this RingBuffer in frames */
 			inline size_t GetCapacityFrames() const						{ return mCapacityFrames; }
 
+			/*! @brief Determine whether this \c RingBuffer's memory is mirrored */
+			inline bool IsMirrored() const								{ return mMirrored; }
+
 			/*! @brief Get the format of this \c BufferList */
 			inline const AudioFormat& GetFormat() const					{ return mFormat; }
 
-			/*! @brief  Get the number of frames available for reading */
+			/*! @brief Get the routines specialized for this \c RingBuffer's format */
+			inline const FormatKernels& GetFormatKernels() const		{ return *mFormatKernels; }
+
+			/*! @brief Get the representation of the samples held by this \c RingBuffer */
+			inline StorageFormat GetStorageFormat() const				{ return mStorageFormat; }
+
+			/*! @brief Get the number of bytes of memory holding audio */
+			inline size_t GetStorageByteCount() const					{ return mFormat.mChannelsPerFrame * StorageByteCount(mCapacityFrames); }
+
+
+			/*! @brief Query whether memory is locked into physical memory when allocated */
+			inline bool IsMemoryLocked() const							{ return mLockMemory; }
+
+			/*!
+			 * @brief Set whether memory is locked into physical memory using \c mlock() when allocated
+			 *
+			 * Locked memory is faulted in when allocated and can't be paged out or compressed, so the real-time
+			 * thread never takes a page fault touching it.  If the memory can't be locked, for example because
+			 * \c RLIMIT_MEMLOCK would be exceeded, it is faulted in but may later be paged out.
+			 * @note The setting takes effect when the buffer is next allocated
+			 * @note This method is not thread safe.
+			 * @param locked Whether memory should be locked
+			 */
+			inline void SetMemoryLocked(bool locked)					{ mLockMemory = locked; }
+
+			/*! @brief Get the number of bytes of memory locked by this \c RingBuffer */
+			inline size_t GetLockedByteCount() const					{ return mLockedByteCount; }
+
+			/*!
+			 * @brief  Get the number of frames available for reading
+			 * @note This method is safe to call from any thread
+			 */
 			size_t GetFramesAvailableToRead() const;
 
-			/*! @brief Get the free space available for writing in frames */
+			/*!
+			 * @brief Get the free space available for writing in frames
+			 * @note This method is safe to call from any thread
+			 */
 			size_t GetFramesAvailableToWrite() const;
 
 			//@}
@@ -124,17 +194,154 @@ namespace SFB {
 
 			//@}
 
+
+			// ========================================
+			/*! @name Reading and writing audio in place */
+			//@{
+
+			/*! @brief A struct wrapping a region of the \c RingBuffer's channel buffers */
+			struct Buffer {
+				AudioBufferList	*mBufferList;		/*!< The channel buffers for the region, or \c nullptr if the region is empty */
+				size_t			mFrameCapacity;		/*!< The capacity of the region in frames */
+
+				/*! @brief Construct an empty Buffer */
+				Buffer()
+					: Buffer(nullptr, 0) {}
+
+				/*!
+				 * @brief Construct a Buffer for the specified channel buffers and capacity
+				 * @param bufferList The channel buffers for the region
+				 * @param frameCapacity The capacity of the region in frames
+				 */
+				Buffer(AudioBufferList *bufferList, size_t frameCapacity)
+					: mBufferList(bufferList), mFrameCapacity(frameCapacity) {}
+			};
+
+			/*! @brief A pair of \c Buffer objects */
+			using BufferPair = std::pair<Buffer, Buffer>;
+
+			/*!
+			 * @brief Retrieve the read vector containing the current readable audio
+			 * @note This method may only be called from the reader thread and the returned \c AudioBufferList objects
+			 * are valid until the next call
+			 * @note With compact storage the read vector is a staging buffer holding a copy of the expanded audio
+			 */
+			BufferPair GetReadVector();
+
+			/*!
+			 * @brief Retrieve the write vector containing the current writeable space
+			 *
+			 * Audio may be decoded or converted directly into the returned buffers and committed using \c WriteAdvance()
+			 * @note This method may only be called from the writer thread and the returned \c AudioBufferList objects
+			 * are valid until the next call
+			 * @note With compact storage the write vector is a staging buffer whose audio is stored by \c WriteAdvance()
+			 */
+			BufferPair GetWriteVector();
+
+			/*! @brief Advance the read pointer by the specified number of frames */
+			void ReadAdvance(size_t frameCount);
+
+			/*! @brief Advance the write pointer by the specified number of frames */
+			void WriteAdvance(size_t frameCount);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Additional readers */
+			//@{
+
+			/*!
+			 * @brief Enable or disable an additional reader
+			 *
+			 * An enabled reader's cursor begins at the current read position, and the reader remains enabled
+			 * when the \c RingBuffer is reallocated or reset.
+			 * @note Enabling a reader is not thread safe with respect to the writer, but disabling a reader is
+			 * @param reader The index of the reader, less than \c kMaximumAdditionalReaders
+			 * @param enabled Whether the reader is enabled
+			 */
+			void SetAdditionalReaderEnabled(size_t reader, bool enabled);
+
+			/*! @brief Query whether an additional reader is enabled */
+			bool IsAdditionalReaderEnabled(size_t reader) const;
+
+			/*!
+			 * @brief Get the number of frames available to an additional reader
+			 * @note This method is safe to call from any thread
+			 * @param reader The index of the reader
+			 * @return The number of frames available, or \c 0 if the reader isn't enabled
+			 */
+			size_t GetFramesAvailableToRead(size_t reader) const;
+
+			/*!
+			 * @brief Read audio for an additional reader, advancing its cursor
+			 * @note Unlike \c ReadAudio(), the sizes of the buffers in \c bufferList are not modified.  This method
+			 * may be called while the writer resets the \c RingBuffer, in which case nothing is read.
+			 * @param reader The index of the reader
+			 * @param bufferList An \c AudioBufferList to receive the audio
+			 * @param frameOffset The offset in frames into \c bufferList at which to begin writing
+			 * @param frameCount The desired number of frames to read
+			 * @return The number of frames actually read
+			 */
+			size_t ReadAudio(size_t reader, AudioBufferList *bufferList, size_t frameOffset, size_t frameCount);
+
+			//@}
+
 		private:
 
+			// The number of bytes per channel holding frameCount frames
+			inline size_t StorageByteCount(size_t frameCount) const		{ return frameCount * mStorageBytesPerFrame; }
+
+			// The read pointer of the reader furthest behind writePointer
+			size_t LoadSlowestReadPointer(size_t writePointer) const;
+
+			// Convert frames to and from compact storage
+			void StoreFrames(const AudioBufferList *bufferList, size_t srcOffset, size_t destFrame, size_t frameCount);
+			void FetchFrames(AudioBufferList *bufferList, size_t destOffset, size_t srcFrame, size_t frameCount) const;
+
 			AudioFormat			mFormat;				// The format of the audio
+			StorageFormat		mStorageFormat;			// The representation of the stored samples
+			size_t				mStorageBytesPerFrame;	// Bytes per channel per stored frame
+			const FormatKernels	*mFormatKernels;		// The routines specialized for mFormat
 
 			unsigned char		**mBuffers;				// The channel pointers and buffers, allocated in one chunk of memory
 
+			AudioBufferList		*mWriteVector [2];		// The buffer lists returned by GetWriteVector(), in the same chunk of memory
+			AudioBufferList		*mReadVector [2];		// The buffer lists returned by GetReadVector(), in the same chunk of memory
+
 			size_t				mCapacityFrames;		// Frame capacity per channel
 			size_t				mCapacityFramesMask;
+			bool				mMirrored;				// Whether each channel buffer is mapped twice consecutively
+
+			float				*mStagingBuffer;		// Write then read staging buffers for compact storage, one per channel each
+			size_t				mStagingCapacityFrames;
+
+			bool				mLockMemory;			// Whether memory is locked when allocated
+			size_t				mAllocationSize;		// The size of the chunk of memory holding mBuffers
+			size_t				mLockedByteCount;		// Bytes locked by mlock(), counting mirrored memory once
+
+			std::atomic_uint	mAdditionalReaderMask;	// The enabled additional readers
+
+			// The padding keeps the writer's and reader's state on separate cache lines
+			char				mWriterPadding [64];
+
+			std::atomic_size_t	mWritePointer;			// In frames; stored only by the writer
+			size_t				mCachedReadPointer;		// The writer's copy of mReadPointer
+
+			char				mReaderPadding [64];
+
+			std::atomic_size_t	mReadPointer;			// In frames; stored only by the reader
+			size_t				mCachedWritePointer;	// The reader's copy of mWritePointer
+
+			char				mTrailingPadding [64];
+
+			// Additional readers don't cache the write pointer since it may be reset while they read
+			struct AdditionalReader {
+				std::atomic_size_t	mReadPointer;		// In frames in the low 32 bits, with a count of resets above; stored by the reader or the writer when resetting
+				char				mPadding [64 - sizeof(std::atomic_size_t)];
+			};
 
-			volatile size_t		mWritePointer;			// In frames
-			volatile size_t		mReadPointer;
+			AdditionalReader	mAdditionalReaders [kMaximumAdditionalReaders];
 		};
 
 	}
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <mach/mach_time.h>
+
+#include "AudioSpectrumAnalyzer.h"
+#include "Logger.h"
+
+// The number of frames each channel's ring buffer holds, at least twice the FFT size
+#define RING_BUFFER_CAPACITY_FRAMES 32768
+
+// The default and allowed number of spectra computed per second
+#define DEFAULT_UPDATE_RATE 30
+#define MINIMUM_UPDATE_RATE 1
+#define MAXIMUM_UPDATE_RATE 120
+
+// The lowest band edge in Hz
+#define MINIMUM_BAND_FREQUENCY 20
+
+// The magnitude reported for silence and empty bands in dBFS
+#define MINIMUM_MAGNITUDE_DB -120.f
+
+// A flag marking the published spectrum as unread in mMiddle
+#define SPECTRUM_UNREAD_FLAG 0x4
+
+namespace {
+
+	bool IsAnalyzableFormat(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && format.IsNativeEndian();
+	}
+
+	// Copy frameCount samples with the specified stride into the ring buffer, returning the number copied
+	size_t WriteStrided(SFB::RingBuffer& ringBuffer, const float *samples, vDSP_Stride stride, size_t frameCount)
+	{
+		frameCount = std::min(frameCount, ringBuffer.GetBytesAvailableToWrite() / sizeof(float));
+		if(0 == frameCount)
+			return 0;
+
+		auto writeVector = ringBuffer.GetWriteVector();
+		size_t firstFrames = std::min(frameCount, writeVector.first.mBufferCapacity / sizeof(float));
+		cblas_scopy((int)firstFrames, samples, (int)stride, (float *)writeVector.first.mBuffer, 1);
+		if(firstFrames < frameCount)
+			cblas_scopy((int)(frameCount - firstFrames), samples + firstFrames * stride, (int)stride, (float *)writeVector.second.mBuffer, 1);
+
+		ringBuffer.WriteAdvance(frameCount * sizeof(float));
+		return frameCount;
+	}
+
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::SpectrumAnalyzer::SpectrumAnalyzer(UInt32 fftSize, UInt32 bandCount)
+	: mFFTSize(256), mLog2FFTSize(8), mBandCount(std::min(std::max(bandCount, 1u), kMaximumBandCount)), mUpdateRate(DEFAULT_UPDATE_RATE), mSampleRate(0), mChannelCount(0), mFormatGeneration(0), mQueue(nullptr), mTimer(nullptr), mFFTSetup(nullptr), mAnalyzedFormatGeneration(0), mBandSampleRate(0), mMiddle(1), mBack(2), mFront(0)
+{
+	// Round the FFT size up to a supported power of two
+	while(mFFTSize < fftSize && mFFTSize < 16384) {
+		mFFTSize *= 2;
+		++mLog2FFTSize;
+	}
+
+	mFFTSetup = vDSP_create_fftsetup(mLog2FFTSize, kFFTRadix2);
+	if(!mFFTSetup)
+		LOGGER_ERR("org.sbooth.AudioEngine.SpectrumAnalyzer", "vDSP_create_fftsetup failed");
+
+	// The ring buffers are allocated once so the rendering thread never races an allocation
+	for(UInt32 channel = 0; channel < kMaximumChannelCount; ++channel) {
+		if(!mRingBuffers[channel].Allocate(std::max((size_t)RING_BUFFER_CAPACITY_FRAMES, 2 * (size_t)mFFTSize) * sizeof(float)))
+			LOGGER_ERR("org.sbooth.AudioEngine.SpectrumAnalyzer", "Unable to allocate ring buffer");
+		mSamples[channel].assign(mFFTSize, 0);
+	}
+
+	mWindow.resize(mFFTSize);
+	vDSP_hann_window(mWindow.data(), mFFTSize, vDSP_HANN_DENORM);
+
+	mReal.resize(mFFTSize / 2);
+	mImaginary.resize(mFFTSize / 2);
+	mPower.resize(mFFTSize);
+
+	memset(mSpectra, 0, sizeof(mSpectra));
+	memset(mFrequencies, 0, sizeof(mFrequencies));
+	memset(mMagnitudes, 0, sizeof(mMagnitudes));
+
+	mQueue = dispatch_queue_create("org.sbooth.AudioEngine.SpectrumAnalyzer", dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+	if(!mQueue)
+		LOGGER_ERR("org.sbooth.AudioEngine.SpectrumAnalyzer", "dispatch_queue_create failed");
+}
+
+SFB::Audio::SpectrumAnalyzer::~SpectrumAnalyzer()
+{
+	Stop();
+
+	if(mQueue)
+		dispatch_release(mQueue);
+
+	if(mFFTSetup)
+		vDSP_destroy_fftsetup(mFFTSetup);
+}
+
+#pragma mark Analysis
+
+bool SFB::Audio::SpectrumAnalyzer::SetUpdateRate(double updateRate)
+{
+	if(MINIMUM_UPDATE_RATE > updateRate || MAXIMUM_UPDATE_RATE < updateRate)
+		return false;
+
+	mUpdateRate.store(updateRate);
+
+	if(mTimer)
+		StartTimer();
+
+	return true;
+}
+
+void SFB::Audio::SpectrumAnalyzer::Start()
+{
+	if(nullptr == mQueue || nullptr == mFFTSetup || mTimer)
+		return;
+
+	mTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, mQueue);
+	if(!mTimer) {
+		LOGGER_ERR("org.sbooth.AudioEngine.SpectrumAnalyzer", "dispatch_source_create failed");
+		return;
+	}
+
+	dispatch_source_set_event_handler(mTimer, ^{
+		Analyze();
+	});
+
+	StartTimer();
+	dispatch_resume(mTimer);
+}
+
+void SFB::Audio::SpectrumAnalyzer::Stop()
+{
+	if(nullptr == mTimer)
+		return;
+
+	dispatch_source_cancel(mTimer);
+	dispatch_release(mTimer);
+	mTimer = nullptr;
+
+	// Audio copied before analysis stopped is stale when it resumes
+	dispatch_sync(mQueue, ^{
+		for(UInt32 channel = 0; channel < kMaximumChannelCount; ++channel) {
+			mRingBuffers[channel].ReadAdvance(mRingBuffers[channel].GetBytesAvailableToRead());
+			std::fill(mSamples[channel].begin(), mSamples[channel].end(), 0.f);
+		}
+	});
+}
+
+void SFB::Audio::SpectrumAnalyzer::Process(const AudioBufferList *bufferList, UInt32 frameCount, const AudioFormat& format)
+{
+	if(!bufferList || 0 == frameCount || !IsAnalyzableFormat(format))
+		return;
+
+	UInt32 channelCount = std::min(format.mChannelsPerFrame, (UInt32)kMaximumChannelCount);
+	if(format.mSampleRate != mSampleRate.load(std::memory_order_relaxed) || channelCount != mChannelCount.load(std::memory_order_relaxed)) {
+		mSampleRate.store(format.mSampleRate, std::memory_order_relaxed);
+		mChannelCount.store(channelCount, std::memory_order_relaxed);
+		mFormatGeneration.fetch_add(1, std::memory_order_release);
+	}
+
+	// The channels are kept in step since each ring buffer is written and read by the same amounts
+	if(format.IsInterleaved()) {
+		const float *samples = (const float *)bufferList->mBuffers[0].mData;
+		for(UInt32 channel = 0; channel < channelCount; ++channel)
+			WriteStrided(mRingBuffers[channel], samples + channel, format.mChannelsPerFrame, frameCount);
+	}
+	else {
+		for(UInt32 channel = 0; channel < channelCount && channel < bufferList->mNumberBuffers; ++channel) {
+			auto& ringBuffer = mRingBuffers[channel];
+			size_t frames = std::min((size_t)frameCount, ringBuffer.GetBytesAvailableToWrite() / sizeof(float));
+			ringBuffer.Write(bufferList->mBuffers[channel].mData, frames * sizeof(float));
+		}
+	}
+}
+
+bool SFB::Audio::SpectrumAnalyzer::GetSpectrum(Spectrum& spectrum) const
+{
+	std::lock_guard<std::mutex> lock(mReaderMutex);
+
+	// Exchange the front buffer for the published spectrum if it is newer
+	if(SPECTRUM_UNREAD_FLAG & mMiddle.load())
+		mFront = mMiddle.exchange(mFront) & ~SPECTRUM_UNREAD_FLAG;
+
+	if(0 == mSpectra[mFront].mHostTime)
+		return false;
+
+	spectrum = mSpectra[mFront];
+	return true;
+}
+
+#pragma mark Internals
+
+void SFB::Audio::SpectrumAnalyzer::StartTimer()
+{
+	auto interval = (uint64_t)(NSEC_PER_SEC / mUpdateRate.load());
+	dispatch_source_set_timer(mTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+}
+
+void SFB::Audio::SpectrumAnalyzer::Analyze()
+{
+	auto formatGeneration = mFormatGeneration.load(std::memory_order_acquire);
+	UInt32 channelCount = mChannelCount.load(std::memory_order_relaxed);
+	Float64 sampleRate = mSampleRate.load(std::memory_order_relaxed);
+
+	// Discard audio in the previous format
+	if(formatGeneration != mAnalyzedFormatGeneration) {
+		for(UInt32 channel = 0; channel < kMaximumChannelCount; ++channel) {
+			mRingBuffers[channel].ReadAdvance(mRingBuffers[channel].GetBytesAvailableToRead());
+			std::fill(mSamples[channel].begin(), mSamples[channel].end(), 0.f);
+		}
+		mAnalyzedFormatGeneration = formatGeneration;
+		return;
+	}
+
+	if(0 == channelCount || 0 >= sampleRate)
+		return;
+
+	// Nothing has been rendered since the last spectrum
+	size_t framesAvailable = mRingBuffers[0].GetBytesAvailableToRead() / sizeof(float);
+	if(0 == framesAvailable)
+		return;
+
+	if(sampleRate != mBandSampleRate)
+		ConfigureBands(sampleRate);
+
+	DSPSplitComplex splitComplex = { mReal.data(), mImaginary.data() };
+	const vDSP_Length halfFFTSize = mFFTSize / 2;
+
+	// The power spectrum is scaled so a full-scale sine wave measures 0 dBFS
+	const float scale = 4.f / ((float)mFFTSize * (float)mFFTSize);
+
+	for(UInt32 channel = 0; channel < channelCount; ++channel) {
+		auto& ringBuffer = mRingBuffers[channel];
+		auto& samples = mSamples[channel];
+
+		// Keep the most recent mFFTSize samples
+		size_t frames = std::min(framesAvailable, ringBuffer.GetBytesAvailableToRead() / sizeof(float));
+		if(frames >= mFFTSize) {
+			ringBuffer.ReadAdvance((frames - mFFTSize) * sizeof(float));
+			ringBuffer.Read(samples.data(), mFFTSize * sizeof(float));
+		}
+		else {
+			std::move(samples.begin() + (ptrdiff_t)frames, samples.end(), samples.begin());
+			ringBuffer.Read(samples.data() + (mFFTSize - frames), frames * sizeof(float));
+		}
+
+		vDSP_vmul(samples.data(), 1, mWindow.data(), 1, mPower.data(), 1, mFFTSize);
+		vDSP_ctoz((const DSPComplex *)mPower.data(), 2, &splitComplex, 1, halfFFTSize);
+		vDSP_fft_zrip(mFFTSetup, &splitComplex, 1, mLog2FFTSize, FFT_FORWARD);
+
+		// The Nyquist component is packed into the imaginary part of the DC bin
+		mImaginary[0] = 0;
+		vDSP_zvmags(&splitComplex, 1, mPower.data(), 1, halfFFTSize);
+		vDSP_vsmul(mPower.data(), 1, &scale, mPower.data(), 1, halfFFTSize);
+
+		for(UInt32 band = 0; band < mBandCount; ++band) {
+			UInt32 start = mBandEdges[band];
+			UInt32 end = mBandEdges[band + 1];
+
+			float power = 0;
+			if(start < end)
+				vDSP_maxv(mPower.data() + start, 1, &power, end - start);
+
+			mMagnitudes[channel][band] = 0 < power ? std::max(10.f * std::log10(power), MINIMUM_MAGNITUDE_DB) : MINIMUM_MAGNITUDE_DB;
+		}
+	}
+
+	Publish(channelCount, sampleRate);
+}
+
+void SFB::Audio::SpectrumAnalyzer::ConfigureBands(Float64 sampleRate)
+{
+	mBandSampleRate = sampleRate;
+
+	const UInt32 binCount = mFFTSize / 2;
+	const double binWidth = sampleRate / mFFTSize;
+	const double minimumFrequency = std::max((double)MINIMUM_BAND_FREQUENCY, binWidth);
+	const double ratio = (sampleRate / 2) / minimumFrequency;
+
+	// Bands are spaced logarithmically from MINIMUM_BAND_FREQUENCY to the Nyquist frequency with at least one bin each
+	mBandEdges.resize(mBandCount + 1);
+	mBandEdges[0] = std::max((UInt32)std::lround(minimumFrequency / binWidth), 1u);
+	for(UInt32 band = 1; band <= mBandCount; ++band) {
+		double edge = minimumFrequency * std::pow(ratio, band / (double)mBandCount);
+		UInt32 bin = (UInt32)std::lround(edge / binWidth);
+		mBandEdges[band] = std::min(std::max(bin, mBandEdges[band - 1] + 1), binCount);
+	}
+
+	for(UInt32 band = 0; band < mBandCount; ++band)
+		mFrequencies[band] = (float)(std::sqrt((double)mBandEdges[band] * std::max(mBandEdges[band + 1], mBandEdges[band] + 1)) * binWidth);
+}
+
+void SFB::Audio::SpectrumAnalyzer::Publish(UInt32 channelCount, Float64 sampleRate)
+{
+	auto& spectrum = mSpectra[mBack];
+
+	spectrum.mChannelCount = channelCount;
+	spectrum.mBandCount = mBandCount;
+	spectrum.mSampleRate = sampleRate;
+	memcpy(spectrum.mFrequencies, mFrequencies, sizeof(mFrequencies));
+	for(UInt32 channel = 0; channel < channelCount; ++channel)
+		memcpy(spectrum.mMagnitudes[channel], mMagnitudes[channel], mBandCount * sizeof(float));
+	spectrum.mHostTime = mach_absolute_time();
+
+	// Publish the back buffer and reuse the previously published one
+	mBack = mMiddle.exchange(mBack | SPECTRUM_UNREAD_FLAG) & ~SPECTRUM_UNREAD_FLAG;
+}
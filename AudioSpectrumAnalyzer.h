@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <CoreAudio/CoreAudioTypes.h>
+#include <Accelerate/Accelerate.h>
+#include <dispatch/dispatch.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "AudioFormat.h"
+#include "RingBuffer.h"
+
+/*! @file AudioSpectrumAnalyzer.h @brief Audio spectrum analysis */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A spectrum analyzer computing band magnitudes off the rendering thread
+		 *
+		 * The rendering thread only copies audio into a lock-free ring buffer per channel.  A background thread
+		 * computes Hann-windowed FFTs of the most recent audio at the update rate, groups the bins into
+		 * logarithmically spaced bands, and publishes the band magnitudes to a triple buffer, from which the
+		 * most recent spectrum may be read on any thread.  The cost of analysis is independent of the number
+		 * of consumers.
+		 * @note Only 32-bit floating point PCM is analyzed. Channels beyond \c kMaximumChannelCount are ignored.
+		 */
+		class SpectrumAnalyzer
+		{
+		public:
+
+			/*! @brief The maximum number of channels analyzed */
+			static const UInt32 kMaximumChannelCount = 8;
+
+			/*! @brief The maximum number of bands */
+			static const UInt32 kMaximumBandCount = 64;
+
+			/*! @brief Band magnitudes for the most recent audio */
+			struct Spectrum {
+				UInt32		mChannelCount;								/*!< The number of valid channels */
+				UInt32		mBandCount;									/*!< The number of valid bands */
+				Float64		mSampleRate;								/*!< The sample rate of the analyzed audio */
+				float		mFrequencies [kMaximumBandCount];			/*!< The center frequency of each band in Hz */
+				float		mMagnitudes [kMaximumChannelCount][kMaximumBandCount];	/*!< The magnitude of each band in dBFS */
+				uint64_t	mHostTime;									/*!< The host time at which the spectrum was computed */
+			};
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*!
+			 * @brief Create a new \c SpectrumAnalyzer
+			 * @param fftSize The number of frames in each FFT, a power of two between 256 and 16384
+			 * @param bandCount The number of bands, at most \c kMaximumBandCount
+			 */
+			explicit SpectrumAnalyzer(UInt32 fftSize = 2048, UInt32 bandCount = 32);
+
+			/*! @brief Destroy this \c SpectrumAnalyzer */
+			~SpectrumAnalyzer();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			SpectrumAnalyzer(const SpectrumAnalyzer& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			SpectrumAnalyzer& operator=(const SpectrumAnalyzer& rhs) = delete;
+
+			/*! @endcond */
+
+			//@}
+
+
+			// ========================================
+			/*! @name Analysis */
+			//@{
+
+			/*! @brief Get the number of frames in each FFT */
+			inline UInt32 GetFFTSize() const						{ return mFFTSize; }
+
+			/*! @brief Get the number of bands */
+			inline UInt32 GetBandCount() const						{ return mBandCount; }
+
+			/*! @brief Get the number of spectra computed per second */
+			inline double GetUpdateRate() const						{ return mUpdateRate.load(); }
+
+			/*!
+			 * @brief Set the number of spectra computed per second
+			 * @param updateRate The update rate in Hz, between 1 and 120
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetUpdateRate(double updateRate);
+
+			/*! @brief Start computing spectra on the background thread */
+			void Start();
+
+			/*! @brief Stop computing spectra and discard the buffered audio */
+			void Stop();
+
+			/*!
+			 * @brief Copy audio for analysis
+			 * @note This method is safe to call from the real-time rendering thread
+			 * @param bufferList The audio to analyze
+			 * @param frameCount The number of frames in \c bufferList
+			 * @param format The format of the audio in \c bufferList
+			 */
+			void Process(const AudioBufferList *bufferList, UInt32 frameCount, const AudioFormat& format);
+
+			/*!
+			 * @brief Get the most recently published spectrum
+			 * @note This method may be called from any thread
+			 * @param spectrum A \c Spectrum struct to receive the spectrum
+			 * @return \c true if a spectrum has been published, \c false otherwise
+			 */
+			bool GetSpectrum(Spectrum& spectrum) const;
+
+			//@}
+
+		private:
+
+			void StartTimer();
+			void Analyze();
+			void ConfigureBands(Float64 sampleRate);
+			void Publish(UInt32 channelCount, Float64 sampleRate);
+
+			UInt32					mFFTSize;				/*!< The number of frames in each FFT */
+			vDSP_Length				mLog2FFTSize;			/*!< The base 2 logarithm of \c mFFTSize */
+			UInt32					mBandCount;				/*!< The number of bands */
+			std::atomic<double>		mUpdateRate;			/*!< The number of spectra computed per second */
+
+			// Rendering thread state
+			RingBuffer				mRingBuffers [kMaximumChannelCount];	/*!< Audio awaiting analysis */
+			std::atomic<Float64>	mSampleRate;			/*!< The sample rate of the audio in the ring buffers */
+			std::atomic_uint		mChannelCount;			/*!< The number of channels in the ring buffers */
+			std::atomic_uint		mFormatGeneration;		/*!< Incremented when the audio's format changes */
+
+			// Analysis thread state
+			dispatch_queue_t		mQueue;					/*!< The queue on which analysis is performed */
+			dispatch_source_t		mTimer;					/*!< The source triggering analysis */
+			FFTSetup				mFFTSetup;
+			unsigned int			mAnalyzedFormatGeneration;
+			Float64					mBandSampleRate;		/*!< The sample rate for which the bands were configured */
+			std::vector<float>		mWindow;				/*!< The Hann window */
+			std::vector<float>		mSamples [kMaximumChannelCount];		/*!< The most recent mFFTSize samples */
+			std::vector<float>		mReal;
+			std::vector<float>		mImaginary;
+			std::vector<float>		mPower;
+			std::vector<UInt32>		mBandEdges;				/*!< The first bin of each band, followed by the end bin */
+			float					mFrequencies [kMaximumBandCount];
+			float					mMagnitudes [kMaximumChannelCount][kMaximumBandCount];
+
+			// Triple buffer
+			Spectrum				mSpectra [3];
+			mutable std::atomic<uint8_t>	mMiddle;				/*!< The index of the published spectrum and whether it is unread */
+			uint8_t					mBack;					/*!< The index written by the analysis thread */
+			mutable uint8_t			mFront;					/*!< The index read by consumers */
+			mutable std::mutex		mReaderMutex;			/*!< Serializes consumers */
+		};
+
+	}
+}
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <Accelerate/Accelerate.h>
+
+#include "AudioTimeStretcher.h"
+#include "Logger.h"
+
+// Frames are twice the hop
+#define HOP_DURATION_SECONDS		0.015
+#define SEARCH_RADIUS_SECONDS		0.006
+#define MINIMUM_HOP_SIZE_FRAMES		64
+
+namespace {
+
+	bool IsProcessableFormat(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && format.IsNativeEndian() && !format.IsInterleaved();
+	}
+
+	inline float * ChannelData(const AudioBufferList *bufferList, UInt32 channel)
+	{
+		return (float *)bufferList->mBuffers[channel].mData;
+	}
+
+}
+
+constexpr double SFB::Audio::TimeStretcher::MinimumRate;
+constexpr double SFB::Audio::TimeStretcher::MaximumRate;
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::TimeStretcher::TimeStretcher()
+	: mMaximumFrameCount(0), mRate(1), mHopSize(0), mSearchRadius(0), mInputFrames(0), mInputStart(0), mPrimed(false), mAnalysisPosition(0), mContinuation(0), mSourcePosition(0), mOutputFrames(0), mOutputSourceFrames(0)
+{}
+
+#pragma mark Configuration
+
+bool SFB::Audio::TimeStretcher::Configure(const AudioFormat& format, UInt32 maximumFrameCount)
+{
+	if(mOutput && format == mFormat && maximumFrameCount == mMaximumFrameCount)
+		return true;
+
+	mInput.Deallocate();
+	mOverlap.Deallocate();
+	mOutput.Deallocate();
+
+	mInputFrames = 0;
+	mOutputFrames = 0;
+	mOutputSourceFrames = 0;
+	ResetPosition();
+
+	if(!IsProcessableFormat(format)) {
+		LOGGER_INFO("org.sbooth.AudioEngine.TimeStretcher", "Unsupported format: " << format);
+		return false;
+	}
+
+	mFormat = format;
+	mMaximumFrameCount = maximumFrameCount;
+
+	mHopSize = std::max((UInt32)MINIMUM_HOP_SIZE_FRAMES, (UInt32)(format.mSampleRate * HOP_DURATION_SECONDS));
+	mSearchRadius = (UInt32)(format.mSampleRate * SEARCH_RADIUS_SECONDS);
+
+	auto frameLength = 2 * mHopSize;
+
+	// Input is retained from the start of the search region preceding the next frame
+	auto inputCapacity = maximumFrameCount + frameLength + mHopSize + (2 * mSearchRadius) + 2;
+
+	// At the minimum rate each hop of output advances half a hop through the input
+	auto outputCapacity = (2 * inputCapacity) + frameLength;
+
+	if(!mInput.Allocate(format, inputCapacity) || !mOverlap.Allocate(format, mHopSize) || !mOutput.Allocate(format, outputCapacity)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.TimeStretcher", "Unable to allocate memory");
+		mInput.Deallocate();
+		mOverlap.Deallocate();
+		mOutput.Deallocate();
+		return false;
+	}
+
+	mWindow.assign(frameLength, 0);
+	vDSP_hann_window(mWindow.data(), frameLength, vDSP_HANN_DENORM);
+
+	mMix.assign((2 * mSearchRadius) + mHopSize, 0);
+	mTemplate.assign(mHopSize, 0);
+	mOnes.assign(mHopSize, 1);
+	mCorrelation.assign((2 * mSearchRadius) + 1, 0);
+	mEnergy.assign((2 * mSearchRadius) + 1, 0);
+
+	LOGGER_DEBUG("org.sbooth.AudioEngine.TimeStretcher", "Hop " << mHopSize << " frames, search radius " << mSearchRadius << " frames");
+
+	return true;
+}
+
+void SFB::Audio::TimeStretcher::SetRate(double rate)
+{
+	mRate.store(std::min(std::max(rate, MinimumRate), MaximumRate));
+}
+
+void SFB::Audio::TimeStretcher::Reset()
+{
+	mInputFrames = 0;
+	mOutputFrames = 0;
+	mOutputSourceFrames = 0;
+	ResetPosition();
+}
+
+#pragma mark Processing
+
+bool SFB::Audio::TimeStretcher::Process(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(!mOutput || 0 != mOutputFrames || frameCount > mMaximumFrameCount || bufferList->mNumberBuffers != mFormat.mChannelsPerFrame)
+		return false;
+
+	if(0 == frameCount)
+		return true;
+
+	for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel)
+		memcpy(ChannelData(mInput, channel) + mInputFrames, bufferList->mBuffers[channel].mData, frameCount * sizeof(float));
+	mInputFrames += frameCount;
+
+	// The first frame follows a virtual frame continuing naturally into the input, so output begins without a fade
+	if(!mPrimed && mHopSize <= mInputFrames) {
+		for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel)
+			vDSP_vmul(ChannelData(mInput, channel), 1, mWindow.data() + mHopSize, 1, ChannelData(mOverlap, channel), 1, mHopSize);
+		mPrimed = true;
+	}
+
+	double rate = mRate.load();
+	while(mPrimed && Step(rate))
+		;
+
+	DiscardInput();
+
+	return true;
+}
+
+void SFB::Audio::TimeStretcher::Flush()
+{
+	if(!mOutput || 0 == mInputFrames) {
+		ResetPosition();
+		return;
+	}
+
+	SInt64 inputEnd = mInputStart + (SInt64)mInputFrames;
+	UInt32 frameCount = 0;
+
+	if(!mPrimed) {
+		for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel)
+			memcpy(ChannelData(mOutput, channel) + mOutputFrames, ChannelData(mInput, channel), mInputFrames * sizeof(float));
+		frameCount = mInputFrames;
+	}
+	else {
+		// The windows of the previous frame's second half and the natural continuation's first half sum to one
+		UInt32 offset = (UInt32)(mContinuation - mInputStart);
+		UInt32 remaining = (UInt32)(inputEnd - mContinuation);
+		UInt32 overlapped = std::min(remaining, mHopSize);
+
+		for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel) {
+			auto input = ChannelData(mInput, channel) + offset;
+			auto output = ChannelData(mOutput, channel) + mOutputFrames;
+			auto overlap = ChannelData(mOverlap, channel);
+
+			vDSP_vma(input, 1, mWindow.data(), 1, overlap, 1, output, 1, overlapped);
+			if(overlapped < mHopSize)
+				memcpy(output + overlapped, overlap + overlapped, (mHopSize - overlapped) * sizeof(float));
+			if(remaining > mHopSize)
+				memcpy(output + mHopSize, input + mHopSize, (remaining - mHopSize) * sizeof(float));
+		}
+
+		frameCount = std::max(remaining, mHopSize);
+	}
+
+	mOutputFrames += frameCount;
+	mOutputSourceFrames += (UInt64)(inputEnd - mSourcePosition);
+
+	ResetPosition();
+}
+
+UInt32 SFB::Audio::TimeStretcher::GetSourceFrameCount(UInt32 frameCount) const
+{
+	frameCount = std::min(frameCount, mOutputFrames);
+	if(0 == frameCount)
+		return 0;
+
+	// Partial reads are attributed proportionally, with the remainder attributed to the final frames
+	if(frameCount == mOutputFrames)
+		return (UInt32)mOutputSourceFrames;
+	return (UInt32)(((UInt64)frameCount * mOutputSourceFrames) / mOutputFrames);
+}
+
+void SFB::Audio::TimeStretcher::ReadAdvance(UInt32 frameCount)
+{
+	frameCount = std::min(frameCount, mOutputFrames);
+	if(0 == frameCount)
+		return;
+
+	mOutputSourceFrames -= GetSourceFrameCount(frameCount);
+	mOutputFrames -= frameCount;
+
+	if(0 != mOutputFrames) {
+		for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel) {
+			auto output = ChannelData(mOutput, channel);
+			memmove(output, output + frameCount, mOutputFrames * sizeof(float));
+		}
+	}
+}
+
+bool SFB::Audio::TimeStretcher::Step(double rate)
+{
+	SInt64 inputEnd = mInputStart + (SInt64)mInputFrames;
+	SInt64 nominal = (SInt64)mAnalysisPosition;
+
+	SInt64 first = std::max(nominal - (SInt64)mSearchRadius, mInputStart);
+	SInt64 last = nominal + (SInt64)mSearchRadius;
+
+	if(last + (SInt64)(2 * mHopSize) > inputEnd || mContinuation + (SInt64)mHopSize > inputEnd)
+		return false;
+
+	if(mOutputFrames + mHopSize > mOutput.GetCapacityFrames())
+		return false;
+
+	// Find the candidate frame whose first half best matches the continuation of the previous frame
+	vDSP_Length candidates = (vDSP_Length)(last - first + 1);
+
+	MixInput(mMix.data(), (UInt32)(first - mInputStart), (UInt32)candidates + mHopSize - 1);
+	MixInput(mTemplate.data(), (UInt32)(mContinuation - mInputStart), mHopSize);
+
+	vDSP_conv(mMix.data(), 1, mTemplate.data(), 1, mCorrelation.data(), 1, candidates, mHopSize);
+
+	// Normalize by the energy of each candidate so loud passages aren't favored
+	vDSP_vsq(mMix.data(), 1, mMix.data(), 1, candidates + mHopSize - 1);
+	vDSP_conv(mMix.data(), 1, mOnes.data(), 1, mEnergy.data(), 1, candidates, mHopSize);
+
+	float epsilon = 1e-9f;
+	int count = (int)candidates;
+	vDSP_vsadd(mEnergy.data(), 1, &epsilon, mEnergy.data(), 1, candidates);
+	vvsqrtf(mEnergy.data(), mEnergy.data(), &count);
+	vDSP_vdiv(mEnergy.data(), 1, mCorrelation.data(), 1, mCorrelation.data(), 1, candidates);
+
+	float maximum = 0;
+	vDSP_Length index = 0;
+	vDSP_maxvi(mCorrelation.data(), 1, &maximum, &index, candidates);
+
+	// The nominal position is preferred when no candidate matches better, as in silence
+	SInt64 chosen = first + (SInt64)index;
+	if(mCorrelation[(size_t)(nominal - first)] >= maximum)
+		chosen = nominal;
+
+	UInt32 offset = (UInt32)(chosen - mInputStart);
+	for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel) {
+		auto input = ChannelData(mInput, channel) + offset;
+		auto output = ChannelData(mOutput, channel) + mOutputFrames;
+		auto overlap = ChannelData(mOverlap, channel);
+
+		vDSP_vma(input, 1, mWindow.data(), 1, overlap, 1, output, 1, mHopSize);
+		vDSP_vmul(input + mHopSize, 1, mWindow.data() + mHopSize, 1, overlap, 1, mHopSize);
+	}
+
+	mOutputFrames += mHopSize;
+	mContinuation = chosen + (SInt64)mHopSize;
+	mAnalysisPosition += mHopSize * rate;
+
+	// The hop is attributed to the source frames the analysis advanced over
+	SInt64 sourcePosition = (SInt64)mAnalysisPosition;
+	mOutputSourceFrames += (UInt64)(sourcePosition - mSourcePosition);
+	mSourcePosition = sourcePosition;
+
+	return true;
+}
+
+void SFB::Audio::TimeStretcher::MixInput(float *destination, UInt32 offset, UInt32 frameCount) const
+{
+	memcpy(destination, ChannelData(mInput, 0) + offset, frameCount * sizeof(float));
+	for(UInt32 channel = 1; channel < mFormat.mChannelsPerFrame; ++channel)
+		vDSP_vadd(destination, 1, ChannelData(mInput, channel) + offset, 1, destination, 1, frameCount);
+}
+
+void SFB::Audio::TimeStretcher::DiscardInput()
+{
+	if(!mPrimed)
+		return;
+
+	SInt64 start = std::min((SInt64)mAnalysisPosition - (SInt64)mSearchRadius, mContinuation);
+	if(start <= mInputStart)
+		return;
+
+	UInt32 frameCount = (UInt32)(start - mInputStart);
+	mInputFrames -= frameCount;
+	mInputStart = start;
+
+	for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel) {
+		auto input = ChannelData(mInput, channel);
+		memmove(input, input + frameCount, mInputFrames * sizeof(float));
+	}
+}
+
+void SFB::Audio::TimeStretcher::ResetPosition()
+{
+	mInputFrames = 0;
+	mInputStart = 0;
+	mPrimed = false;
+	mAnalysisPosition = 0;
+	mContinuation = 0;
+	mSourcePosition = 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <atomic>
+#include <vector>
+
+#include "AudioBufferList.h"
+#include "AudioFormat.h"
+
+/*! @file AudioTimeStretcher.h @brief Tempo changes preserving pitch */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A streaming time stretcher using waveform similarity overlap-add (WSOLA)
+		 *
+		 * Output is assembled from overlapping Hann-windowed frames of the input taken at intervals scaled by the
+		 * rate.  Each frame is positioned within a small search region where it best matches the natural
+		 * continuation of the previous frame, so the tempo changes while the pitch is preserved.
+		 *
+		 * Every frame of output is attributed to the source frames it advanced over, and all source frames are
+		 * attributed once the stretcher is flushed, so the source position of the output is exact.
+		 * @note Only 32-bit floating point non-interleaved PCM is processed.
+		 */
+		class TimeStretcher
+		{
+		public:
+
+			/*! @brief The minimum rate */
+			static constexpr double MinimumRate = 0.5;
+
+			/*! @brief The maximum rate */
+			static constexpr double MaximumRate = 2.0;
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*!
+			 * @brief Create a new \c TimeStretcher
+			 * @note Configure() must be called before the object may be used.
+			 */
+			TimeStretcher();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			TimeStretcher(const TimeStretcher& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			TimeStretcher& operator=(const TimeStretcher& rhs) = delete;
+
+			/*! @endcond */
+
+			//@}
+
+
+			// ========================================
+			/*! @name Configuration */
+			//@{
+
+			/*!
+			 * @brief Prepare to stretch audio
+			 * @note Buffered audio is discarded unless the configuration is unchanged
+			 * @note This method allocates memory
+			 * @param format The format of the audio
+			 * @param maximumFrameCount The maximum number of frames passed to Process()
+			 * @return \c true on success, \c false if \c format can't be processed or memory couldn't be allocated
+			 */
+			bool Configure(const AudioFormat& format, UInt32 maximumFrameCount);
+
+			/*! @brief Query whether this \c TimeStretcher is configured */
+			inline bool IsConfigured() const						{ return (bool)mOutput; }
+
+			/*! @brief Get the rate at which audio is processed */
+			inline double GetRate() const							{ return mRate.load(); }
+
+			/*!
+			 * @brief Set the rate at which audio is processed
+			 * @note This method is safe to call from any thread; the new rate takes effect with the next frame
+			 * @param rate The ratio of the source duration to the output duration, clamped to [MinimumRate, MaximumRate]
+			 */
+			void SetRate(double rate);
+
+			/*! @brief Discard all buffered audio */
+			void Reset();
+
+			//@}
+
+
+			// ========================================
+			/*! @name Processing */
+			//@{
+
+			/*! @brief Query whether this \c TimeStretcher holds no input or output */
+			inline bool IsEmpty() const								{ return 0 == mInputFrames && 0 == mOutputFrames; }
+
+			/*!
+			 * @brief Stretch audio
+			 * @note All output must be read before more audio is processed
+			 * @param bufferList The audio to process
+			 * @param frameCount The number of frames in \c bufferList, which may not exceed the configured maximum
+			 * @return \c true if the audio was processed, \c false otherwise
+			 */
+			bool Process(const AudioBufferList *bufferList, UInt32 frameCount);
+
+			/*!
+			 * @brief Complete the output for the buffered input
+			 *
+			 * The final frame is continued without stretching, so the output matches the input exactly from the
+			 * end of the last stretched frame.  Afterwards all source frames processed are attributed to output.
+			 * @note All output must be read before the stretcher is flushed
+			 */
+			void Flush();
+
+			/*! @brief Get the number of frames of output available */
+			inline UInt32 GetOutputFrameCount() const				{ return mOutputFrames; }
+
+			/*! @brief Get the output, valid until the next call to ReadAdvance(), Process(), or Flush() */
+			inline const AudioBufferList * GetOutput() const		{ return mOutput; }
+
+			/*!
+			 * @brief Get the number of source frames corresponding to output
+			 * @param frameCount The number of frames from the start of the output
+			 * @return The number of source frames, which sum exactly to the source frames processed as all output is removed
+			 */
+			UInt32 GetSourceFrameCount(UInt32 frameCount) const;
+
+			/*!
+			 * @brief Remove output
+			 * @param frameCount The number of frames of output to remove
+			 */
+			void ReadAdvance(UInt32 frameCount);
+
+			//@}
+
+		private:
+
+			// Produce one synthesis hop of output if enough input is buffered
+			bool Step(double rate);
+
+			// Mix the channels of the input starting at offset into destination
+			void MixInput(float *destination, UInt32 offset, UInt32 frameCount) const;
+
+			// Discard input no longer required by the search
+			void DiscardInput();
+
+			// Begin again with the next input
+			void ResetPosition();
+
+			AudioFormat					mFormat;
+			UInt32						mMaximumFrameCount;
+			std::atomic<double>			mRate;
+
+			UInt32						mHopSize;				/*!< The synthesis hop, half the frame length */
+			UInt32						mSearchRadius;			/*!< The maximum offset of a frame from its nominal position */
+			std::vector<float>			mWindow;				/*!< A periodic Hann window whose halves sum to one */
+
+			BufferList					mInput;
+			UInt32						mInputFrames;
+			SInt64						mInputStart;			/*!< The source frame of the first frame in mInput */
+
+			BufferList					mOverlap;				/*!< The windowed second half of the previous frame */
+			bool						mPrimed;				/*!< Whether mOverlap holds audio */
+			double						mAnalysisPosition;		/*!< The nominal source frame of the next frame */
+			SInt64						mContinuation;			/*!< The source frame following the previous frame's first half */
+			SInt64						mSourcePosition;		/*!< The source frame through which output is attributed */
+
+			BufferList					mOutput;
+			UInt32						mOutputFrames;
+			UInt64						mOutputSourceFrames;	/*!< The source frames attributed to the output */
+
+			// Scratch space for the search
+			std::vector<float>			mMix;
+			std::vector<float>			mTemplate;
+			std::vector<float>			mOnes;
+			std::vector<float>			mCorrelation;
+			std::vector<float>			mEnergy;
+		};
+
+	}
+}
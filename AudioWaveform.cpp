@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <Accelerate/Accelerate.h>
+#include <dispatch/dispatch.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "AudioWaveform.h"
+#include "AudioBufferList.h"
+#include "AudioConverter.h"
+#include "AudioDecoder.h"
+#include "CFErrorUtilities.h"
+#include "CFWrapper.h"
+#include "Logger.h"
+
+// The waveform file begins with a header, followed by the offset and size of each level and the levels' points
+#define WAVEFORM_FILE_MAGIC 0x53464257
+#define WAVEFORM_FILE_VERSION 1
+
+// The number of frames decoded between progress callbacks
+#define BUFFER_SIZE_FRAMES 16384
+
+// ========================================
+// Error Codes
+// ========================================
+const CFStringRef SFB::Audio::Waveform::ErrorDomain = CFSTR("org.sbooth.AudioEngine.ErrorDomain.Waveform");
+
+namespace {
+
+	struct FileHeader
+	{
+		uint32_t	mMagic;
+		uint32_t	mVersion;
+		uint32_t	mChannelCount;
+		uint32_t	mLevelCount;
+		double		mSampleRate;
+		int64_t		mFrameCount;
+	};
+
+	struct LevelEntry
+	{
+		uint64_t	mOffset;		// From the start of the file
+		uint64_t	mPointCount;
+	};
+
+	bool WriteBytes(FILE *file, const void *bytes, size_t length)
+	{
+		return 0 == length || 1 == fwrite(bytes, length, 1, file);
+	}
+
+}
+
+#pragma mark Factory Methods
+
+SFB::Audio::Waveform::unique_ptr SFB::Audio::Waveform::CreateForURL(CFURLRef url, ProgressBlock block, CFErrorRef *error)
+{
+	if(nullptr == url)
+		return nullptr;
+
+	auto decoder = Decoder::CreateForURL(url, error);
+	if(!decoder || !decoder->Open(error))
+		return nullptr;
+
+	const AudioFormat& inputFormat = decoder->GetFormat();
+
+	// The audio is summarized at its native sample rate
+	AudioStreamBasicDescription outputFormat = {
+		.mFormatID				= kAudioFormatLinearPCM,
+		.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved,
+		.mReserved				= 0,
+		.mSampleRate			= inputFormat.mSampleRate,
+		.mChannelsPerFrame		= inputFormat.mChannelsPerFrame,
+		.mBitsPerChannel		= 32,
+		.mBytesPerPacket		= 4,
+		.mBytesPerFrame			= 4,
+		.mFramesPerPacket		= 1
+	};
+
+	unique_ptr waveform(new Waveform(outputFormat.mChannelsPerFrame, outputFormat.mSampleRate));
+
+	// Converter takes ownership of decoder
+	Converter converter(std::move(decoder), outputFormat);
+	if(!converter.Open(error))
+		return nullptr;
+
+	BufferList outputBuffer(outputFormat, BUFFER_SIZE_FRAMES);
+
+	for(;;) {
+		UInt32 frameCount = converter.ConvertAudio(outputBuffer, BUFFER_SIZE_FRAMES);
+		if(0 == frameCount)
+			break;
+
+		waveform->AddFrames(outputBuffer, frameCount);
+
+		if(block)
+			block(*waveform);
+	}
+
+	waveform->Finish();
+
+	if(block)
+		block(*waveform);
+
+	return waveform;
+}
+
+bool SFB::Audio::Waveform::CreateForURLs(CFArrayRef urls, ResultBlock block)
+{
+	if(nullptr == urls || nullptr == block)
+		return false;
+
+	size_t count = (size_t)CFArrayGetCount(urls);
+	std::vector<char> succeeded(count, 0);
+	auto succeededData = succeeded.data();
+
+	// Decoding dominates, so each file is decoded on its own worker
+	dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(size_t i) {
+		auto url = (CFURLRef)CFArrayGetValueAtIndex(urls, (CFIndex)i);
+
+		CFErrorRef error = nullptr;
+		auto waveform = CreateForURL(url, nullptr, &error);
+		succeededData[i] = (bool)waveform;
+
+		block(url, waveform, error);
+
+		if(error)
+			CFRelease(error);
+	});
+
+	return std::all_of(succeeded.begin(), succeeded.end(), [](char fileSucceeded) { return fileSucceeded; });
+}
+
+SFB::Audio::Waveform::unique_ptr SFB::Audio::Waveform::CreateFromFile(CFURLRef url, CFErrorRef *error)
+{
+	UInt8 buf [PATH_MAX];
+	if(nullptr == url || !CFURLGetFileSystemRepresentation(url, FALSE, buf, PATH_MAX)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return nullptr;
+	}
+
+	int fd = ::open((const char *)buf, O_RDONLY);
+	if(-1 == fd) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return nullptr;
+	}
+
+	struct stat filestats;
+	if(-1 == fstat(fd, &filestats)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		::close(fd);
+		return nullptr;
+	}
+
+	size_t length = (size_t)filestats.st_size;
+	void *mapping = MAP_FAILED;
+	if(length >= sizeof(FileHeader)) {
+		mapping = mmap(nullptr, length, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+		if(MAP_FAILED == mapping) {
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+			::close(fd);
+			return nullptr;
+		}
+	}
+
+	::close(fd);
+
+	// Validate the header and levels before use
+	auto header = (const FileHeader *)mapping;
+	auto levels = (const LevelEntry *)(header + 1);
+
+	bool valid = MAP_FAILED != mapping && WAVEFORM_FILE_MAGIC == header->mMagic && WAVEFORM_FILE_VERSION == header->mVersion && 0 < header->mChannelCount && kMaximumLevelCount >= header->mLevelCount && sizeof(FileHeader) + header->mLevelCount * sizeof(LevelEntry) <= length;
+
+	for(uint32_t level = 0; valid && level < header->mLevelCount; ++level) {
+		const auto& entry = levels[level];
+		valid = 0 == entry.mOffset % alignof(Point) && entry.mOffset <= length && entry.mPointCount <= (length - entry.mOffset) / (header->mChannelCount * sizeof(Point));
+	}
+
+	if(!valid) {
+		if(MAP_FAILED != mapping)
+			munmap(mapping, length);
+
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid waveform file."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not a waveform file"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file may have been created by a different version or may be damaged."), ""));
+
+			*error = CreateErrorForURL(Waveform::ErrorDomain, Waveform::FileFormatNotRecognizedError, description, url, failureReason, recoverySuggestion);
+		}
+
+		return nullptr;
+	}
+
+	unique_ptr waveform(new Waveform(header->mChannelCount, header->mSampleRate));
+
+	waveform->mFrameCount = header->mFrameCount;
+	waveform->mComplete = true;
+	waveform->mLevelCount = header->mLevelCount;
+	waveform->mMapping = (const uint8_t *)mapping;
+	waveform->mMappingLength = length;
+
+	for(uint32_t level = 0; level < header->mLevelCount; ++level) {
+		waveform->mMappedPoints[level] = (const Point *)(waveform->mMapping + levels[level].mOffset);
+		waveform->mMappedPointCounts[level] = (size_t)levels[level].mPointCount;
+	}
+
+	return waveform;
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::Waveform::Waveform(UInt32 channelCount, Float64 sampleRate)
+	: mChannelCount(channelCount), mSampleRate(sampleRate), mFrameCount(0), mComplete(false), mLevelCount(0), mAccumulators(kMaximumLevelCount * channelCount, Accumulator()), mMapping(nullptr), mMappingLength(0)
+{
+	memset(mMappedPoints, 0, sizeof(mMappedPoints));
+	memset(mMappedPointCounts, 0, sizeof(mMappedPointCounts));
+}
+
+SFB::Audio::Waveform::~Waveform()
+{
+	if(mMapping)
+		munmap((void *)mMapping, mMappingLength);
+}
+
+#pragma mark Persistence
+
+bool SFB::Audio::Waveform::WriteToFile(CFURLRef url, CFErrorRef *error) const
+{
+	UInt8 buf [PATH_MAX];
+	if(nullptr == url || !CFURLGetFileSystemRepresentation(url, FALSE, buf, PATH_MAX)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return false;
+	}
+
+	FileHeader header = { WAVEFORM_FILE_MAGIC, WAVEFORM_FILE_VERSION, mChannelCount, mLevelCount, mSampleRate, mFrameCount };
+
+	LevelEntry levels [kMaximumLevelCount];
+	uint64_t offset = sizeof(FileHeader) + mLevelCount * sizeof(LevelEntry);
+	for(UInt32 level = 0; level < mLevelCount; ++level) {
+		levels[level].mOffset = offset;
+		levels[level].mPointCount = GetPointCount(level);
+		offset += levels[level].mPointCount * mChannelCount * sizeof(Point);
+	}
+
+	// Write a new file and replace the old one
+	std::string path((const char *)buf);
+	std::string temporaryPath = path + ".tmp";
+
+	FILE *file = fopen(temporaryPath.c_str(), "w");
+	if(nullptr == file) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return false;
+	}
+
+	bool result = WriteBytes(file, &header, sizeof(header)) && WriteBytes(file, levels, mLevelCount * sizeof(LevelEntry));
+
+	for(UInt32 level = 0; result && level < mLevelCount; ++level)
+		result = WriteBytes(file, GetPoints(level), (size_t)levels[level].mPointCount * mChannelCount * sizeof(Point));
+
+	if(0 != fclose(file))
+		result = false;
+
+	if(!result || 0 != rename(temporaryPath.c_str(), path.c_str())) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		unlink(temporaryPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+#pragma mark Waveform information
+
+size_t SFB::Audio::Waveform::GetPointCount(UInt32 level) const
+{
+	if(level >= mLevelCount)
+		return 0;
+
+	if(mMapping)
+		return mMappedPointCounts[level];
+
+	return mLevels[level].size() / mChannelCount;
+}
+
+const SFB::Audio::Waveform::Point * SFB::Audio::Waveform::GetPoints(UInt32 level) const
+{
+	if(level >= mLevelCount)
+		return nullptr;
+
+	if(mMapping)
+		return mMappedPoints[level];
+
+	return mLevels[level].data();
+}
+
+#pragma mark Internals
+
+// bufferList contains non-interleaved float samples
+void SFB::Audio::Waveform::AddFrames(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	UInt32 framesProcessed = 0;
+	while(framesProcessed < frameCount) {
+		// Segments end at level 0 point boundaries
+		UInt32 segmentFrames = std::min(frameCount - framesProcessed, kFramesPerPoint - mAccumulators[0].mFrameCount);
+
+		for(UInt32 channel = 0; channel < mChannelCount; ++channel) {
+			const float *samples = (const float *)bufferList->mBuffers[channel].mData + framesProcessed;
+			auto& accumulator = mAccumulators[channel];
+
+			float minimum, maximum, sumOfSquares;
+			vDSP_minv(samples, 1, &minimum, segmentFrames);
+			vDSP_maxv(samples, 1, &maximum, segmentFrames);
+			vDSP_svesq(samples, 1, &sumOfSquares, segmentFrames);
+
+			accumulator.mMinimum = 0 == accumulator.mFrameCount ? minimum : std::min(accumulator.mMinimum, minimum);
+			accumulator.mMaximum = 0 == accumulator.mFrameCount ? maximum : std::max(accumulator.mMaximum, maximum);
+			accumulator.mSumOfSquares += sumOfSquares;
+			accumulator.mFrameCount += segmentFrames;
+		}
+
+		framesProcessed += segmentFrames;
+		mFrameCount += segmentFrames;
+
+		if(kFramesPerPoint == mAccumulators[0].mFrameCount)
+			AddPoint(0);
+	}
+}
+
+// Append the partial point for level and add it to the next level's partial point
+void SFB::Audio::Waveform::AddPoint(UInt32 level)
+{
+	Accumulator *accumulators = mAccumulators.data() + level * mChannelCount;
+	Accumulator *parentAccumulators = level + 1 < kMaximumLevelCount ? accumulators + mChannelCount : nullptr;
+
+	for(UInt32 channel = 0; channel < mChannelCount; ++channel) {
+		auto& accumulator = accumulators[channel];
+		mLevels[level].push_back({ accumulator.mMinimum, accumulator.mMaximum, (float)std::sqrt(accumulator.mSumOfSquares / accumulator.mFrameCount) });
+
+		if(parentAccumulators) {
+			auto& parent = parentAccumulators[channel];
+			parent.mMinimum = 0 == parent.mFrameCount ? accumulator.mMinimum : std::min(parent.mMinimum, accumulator.mMinimum);
+			parent.mMaximum = 0 == parent.mFrameCount ? accumulator.mMaximum : std::max(parent.mMaximum, accumulator.mMaximum);
+			parent.mSumOfSquares += accumulator.mSumOfSquares;
+			parent.mFrameCount += accumulator.mFrameCount;
+		}
+
+		accumulator = Accumulator();
+	}
+
+	mLevelCount = std::max(mLevelCount, level + 1);
+
+	if(parentAccumulators && GetFramesPerPoint(level + 1) == parentAccumulators[0].mFrameCount)
+		AddPoint(level + 1);
+}
+
+// Append the partial points at the end of the audio
+// Levels are added until one summarizes all the audio in a single point
+void SFB::Audio::Waveform::Finish()
+{
+	for(UInt32 level = 0; level < kMaximumLevelCount; ++level) {
+		if(0 != mAccumulators[level * mChannelCount].mFrameCount)
+			AddPoint(level);
+
+		if(GetPointCount(level) <= 1)
+			break;
+	}
+
+	mAccumulators.clear();
+	mComplete = true;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <CoreAudio/CoreAudioTypes.h>
+#include <CoreFoundation/CoreFoundation.h>
+
+/*! @file AudioWaveform.h @brief Waveform summaries for display */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A multi-resolution summary of a file's waveform
+		 *
+		 * A waveform contains the minimum, maximum, and RMS sample values of each channel for successive ranges of
+		 * frames.  Level 0 summarizes \c kFramesPerPoint frames per point and each subsequent level summarizes twice
+		 * as many, so a waveform may be drawn at any zoom level without reading more points than pixels.
+		 *
+		 * Waveforms may be saved to a file which is memory-mapped when loaded.
+		 */
+		class Waveform
+		{
+		public:
+
+			/*! @brief The \c CFErrorRef error domain used by \c Waveform */
+			static const CFStringRef ErrorDomain;
+
+			/*! @brief Possible \c CFErrorRef error codes used by \c Waveform */
+			enum ErrorCode {
+				FileFormatNotRecognizedError		= 0,	/*!< File format not recognized */
+			};
+
+			/*! @brief The number of frames summarized by each point in level 0 */
+			static const UInt32 kFramesPerPoint = 256;
+
+			/*! @brief The maximum number of levels */
+			static const UInt32 kMaximumLevelCount = 16;
+
+			/*! @brief A summary of a channel's samples */
+			struct Point {
+				float	mMinimum;		/*!< The smallest sample value */
+				float	mMaximum;		/*!< The largest sample value */
+				float	mRMS;			/*!< The root mean square of the samples */
+			};
+
+			/*! @brief A \c std::unique_ptr for \c Waveform objects */
+			using unique_ptr = std::unique_ptr<Waveform>;
+
+			/*!
+			 * @brief A block called periodically while a waveform is created
+			 * @note Pointers returned by \c GetPoints() are valid only until the block returns
+			 * @param waveform The waveform, containing the frames summarized so far
+			 */
+			using ProgressBlock = void (^)(const Waveform& waveform);
+
+			/*!
+			 * @brief A block called with a waveform created by \c CreateForURLs()
+			 * @note This block may be called concurrently
+			 * @param url The URL of the file
+			 * @param waveform The file's waveform, or \c nullptr on failure.  Ownership may be taken by moving from \c waveform.
+			 * @param error Error information if the waveform couldn't be created, or \c nullptr.  The error is released when the block returns.
+			 */
+			using ResultBlock = void (^)(CFURLRef url, unique_ptr& waveform, CFErrorRef error);
+
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*!
+			 * @brief Create a waveform by decoding a file
+			 * @param url The URL of the file
+			 * @param block An optional block to be called as the file is decoded
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Waveform, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForURL(CFURLRef url, ProgressBlock block = nullptr, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create waveforms for several files, decoding the files concurrently
+			 * @note This method blocks until all files have been decoded
+			 * @param urls A \c CFArray of \c CFURL objects
+			 * @param block The block to receive each file's waveform
+			 * @return \c true if all waveforms were created, \c false otherwise
+			 */
+			static bool CreateForURLs(CFArrayRef urls, ResultBlock block);
+
+			/*!
+			 * @brief Load a waveform saved using \c WriteToFile()
+			 * @param url The URL of the waveform file
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Waveform, or \c nullptr on failure
+			 */
+			static unique_ptr CreateFromFile(CFURLRef url, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Destroy this \c Waveform */
+			~Waveform();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			Waveform(const Waveform& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			Waveform& operator=(const Waveform& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			// ========================================
+			/*! @name Persistence */
+			//@{
+
+			/*!
+			 * @brief Write the waveform to a file
+			 * @note The file is replaced atomically
+			 * @param url The URL of the waveform file
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool WriteToFile(CFURLRef url, CFErrorRef *error = nullptr) const;
+
+			//@}
+
+
+			// ========================================
+			/*! @name Waveform information */
+			//@{
+
+			/*! @brief Get the number of channels */
+			inline UInt32 GetChannelCount() const					{ return mChannelCount; }
+
+			/*! @brief Get the sample rate of the audio */
+			inline Float64 GetSampleRate() const					{ return mSampleRate; }
+
+			/*! @brief Get the number of frames summarized */
+			inline SInt64 GetFrameCount() const						{ return mFrameCount; }
+
+			/*! @brief Query whether the waveform summarizes the entire file */
+			inline bool IsComplete() const							{ return mComplete; }
+
+			/*! @brief Get the number of levels */
+			inline UInt32 GetLevelCount() const						{ return mLevelCount; }
+
+			/*! @brief Get the number of frames summarized by each point in \c level */
+			inline static UInt32 GetFramesPerPoint(UInt32 level)	{ return kFramesPerPoint << level; }
+
+			/*! @brief Get the number of points in \c level */
+			size_t GetPointCount(UInt32 level) const;
+
+			/*!
+			 * @brief Get the points in \c level
+			 * @note The channels of each point are adjacent, so the point for channel \c c of point \c i is at index <tt>i * GetChannelCount() + c</tt>
+			 * @return The points, or \c nullptr if \c level is invalid
+			 */
+			const Point * GetPoints(UInt32 level) const;
+
+			//@}
+
+		private:
+
+			// A partial point
+			struct Accumulator {
+				float		mMinimum;
+				float		mMaximum;
+				double		mSumOfSquares;
+				UInt32		mFrameCount;
+			};
+
+			Waveform(UInt32 channelCount, Float64 sampleRate);
+
+			void AddFrames(const AudioBufferList *bufferList, UInt32 frameCount);
+			void AddPoint(UInt32 level);
+			void Finish();
+
+			UInt32									mChannelCount;
+			Float64									mSampleRate;
+			SInt64									mFrameCount;
+			bool									mComplete;
+			UInt32									mLevelCount;
+
+			// Waveforms being created
+			std::vector<Point>						mLevels [kMaximumLevelCount];
+			std::vector<Accumulator>				mAccumulators;		// The partial point for each level and channel
+
+			// Waveforms loaded from a file
+			const uint8_t							*mMapping;
+			size_t									mMappingLength;
+			const Point								*mMappedPoints [kMaximumLevelCount];
+			size_t									mMappedPointCounts [kMaximumLevelCount];
+		};
+
+	}
+}
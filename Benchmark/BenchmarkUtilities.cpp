@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cstdio>
+
+#include <mach/mach_time.h>
+
+#include "BenchmarkUtilities.h"
+
+double SFB::Benchmark::ConvertHostTimeToSeconds(uint64_t hostTime)
+{
+	static mach_timebase_info_data_t sTimebaseInfo = {};
+	if(0 == sTimebaseInfo.denom)
+		mach_timebase_info(&sTimebaseInfo);
+
+	return ((double)hostTime * sTimebaseInfo.numer) / sTimebaseInfo.denom / NSEC_PER_SEC;
+}
+
+double SFB::Benchmark::ConvertHostTimeToMicros(uint64_t hostTime)
+{
+	static mach_timebase_info_data_t sTimebaseInfo = {};
+	if(0 == sTimebaseInfo.denom)
+		mach_timebase_info(&sTimebaseInfo);
+
+	return ((double)hostTime * sTimebaseInfo.numer) / sTimebaseInfo.denom / NSEC_PER_USEC;
+}
+
+std::string SFB::Benchmark::ConvertToUTF8(CFStringRef string)
+{
+	if(nullptr == string)
+		return std::string();
+
+	CFIndex length = CFStringGetLength(string);
+	CFIndex bufferSize = CFStringGetMaximumSizeForEncoding(length, kCFStringEncodingUTF8) + 1;
+
+	std::vector<char> buffer((size_t)bufferSize);
+	if(!CFStringGetCString(string, buffer.data(), bufferSize, kCFStringEncodingUTF8))
+		return std::string();
+
+	return std::string(buffer.data());
+}
+
+std::string SFB::Benchmark::GetExtension(CFURLRef url)
+{
+	SFB::CFString extension(CFURLCopyPathExtension(url));
+	if(!extension)
+		return std::string();
+
+	SFB::CFMutableString lowercaseExtension(CFStringCreateMutableCopy(kCFAllocatorDefault, 0, extension));
+	CFStringLowercase(lowercaseExtension, nullptr);
+	return ConvertToUTF8(lowercaseExtension);
+}
+
+std::string SFB::Benchmark::EscapeJSON(const std::string& string)
+{
+	std::string result;
+	result.reserve(string.size());
+
+	for(auto c : string) {
+		switch(c) {
+			case '"':	result += "\\\"";	break;
+			case '\\':	result += "\\\\";	break;
+			case '\n':	result += "\\n";	break;
+			case '\t':	result += "\\t";	break;
+			default:
+				if(0x20 > (unsigned char)c) {
+					char escape [7];
+					snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)c);
+					result += escape;
+				}
+				else
+					result += c;
+				break;
+		}
+	}
+
+	return result;
+}
+
+std::string SFB::Benchmark::GetPath(CFURLRef url)
+{
+	SFB::CFString path(CFURLCopyFileSystemPath(url, kCFURLPOSIXPathStyle));
+	return ConvertToUTF8(path);
+}
+
+std::vector<SFB::CFURL> SFB::Benchmark::CollectFiles(CFURLRef directory, bool (*handlesExtension)(CFStringRef extension))
+{
+	std::vector<SFB::CFURL> urls;
+
+	SFB::CFWrapper<CFURLEnumeratorRef> enumerator(CFURLEnumeratorCreateForDirectoryURL(kCFAllocatorDefault, directory, kCFURLEnumeratorDescendRecursively, nullptr));
+	if(!enumerator)
+		return urls;
+
+	CFURLRef url = nullptr;
+	CFURLEnumeratorResult result;
+	while(kCFURLEnumeratorEnd != (result = CFURLEnumeratorGetNextURL(enumerator, &url, nullptr))) {
+		if(kCFURLEnumeratorSuccess != result)
+			continue;
+
+		SFB::CFString extension(CFURLCopyPathExtension(url));
+		if(extension && handlesExtension(extension))
+			urls.push_back(SFB::CFURL((CFURLRef)CFRetain(url)));
+	}
+
+	std::sort(urls.begin(), urls.end(), [](const SFB::CFURL& a, const SFB::CFURL& b) {
+		return GetPath(a) < GetPath(b);
+	});
+
+	return urls;
+}
+
+double SFB::Benchmark::Percentile(std::vector<double>& values, double p)
+{
+	if(values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, (size_t)(p * (values.size() - 1) + 0.5))];
+}
+
+SFB::Audio::AudioFormat SFB::Benchmark::MakeFormat(Float64 sampleRate, UInt32 channelCount, bool isFloat, bool interleaved)
+{
+	AudioStreamBasicDescription format = {};
+
+	format.mFormatID			= kAudioFormatLinearPCM;
+	format.mFormatFlags			= isFloat ? kAudioFormatFlagsNativeFloatPacked : (kAudioFormatFlagIsSignedInteger | kAudioFormatFlagsNativeEndian | kAudioFormatFlagIsPacked);
+	format.mSampleRate			= sampleRate;
+	format.mChannelsPerFrame	= channelCount;
+	format.mBitsPerChannel		= isFloat ? 32 : 16;
+	format.mFramesPerPacket		= 1;
+
+	UInt32 bytesPerSample = format.mBitsPerChannel / 8;
+	if(interleaved)
+		format.mBytesPerFrame = bytesPerSample * channelCount;
+	else {
+		format.mFormatFlags |= kAudioFormatFlagIsNonInterleaved;
+		format.mBytesPerFrame = bytesPerSample;
+	}
+	format.mBytesPerPacket = format.mBytesPerFrame;
+
+	return SFB::Audio::AudioFormat(format);
+}
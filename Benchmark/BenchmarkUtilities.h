@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// Helpers shared by the benchmark and verification tools, each of which compiles BenchmarkUtilities.cpp
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <SFBAudioEngine/AudioFormat.h>
+#include <SFBAudioEngine/CFWrapper.h>
+
+namespace SFB {
+
+	namespace Benchmark {
+
+		// Convert host time to seconds
+		double ConvertHostTimeToSeconds(uint64_t hostTime);
+
+		// Convert host time to microseconds
+		double ConvertHostTimeToMicros(uint64_t hostTime);
+
+		// Convert a CFString to UTF-8
+		std::string ConvertToUTF8(CFStringRef string);
+
+		// The lowercased path extension of url in UTF-8
+		std::string GetExtension(CFURLRef url);
+
+		// Escape a string for inclusion in JSON output
+		std::string EscapeJSON(const std::string& string);
+
+		// The file system path of url in UTF-8
+		std::string GetPath(CFURLRef url);
+
+		// Recursively collect the URLs of files in directory with extensions handled by handlesExtension, sorted by path
+		std::vector<SFB::CFURL> CollectFiles(CFURLRef directory, bool (*handlesExtension)(CFStringRef extension));
+
+		// The value at percentile p in [0, 1] of values, which are sorted
+		double Percentile(std::vector<double>& values, double p);
+
+		// Create a packed native-endian PCM format of 32-bit float or 16-bit integer samples
+		SFB::Audio::AudioFormat MakeFormat(Float64 sampleRate, UInt32 channelCount, bool isFloat, bool interleaved);
+
+	}
+}
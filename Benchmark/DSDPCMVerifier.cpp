@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// Verifies the length and alignment of DSD to PCM conversion, printing one JSON object per sample rate and filter
+// quality
+// Usage: DSDPCMVerifier [-n bytes]
+//   -n		The number of DSD bytes per channel synthesized (default 45003)
+//
+// A DSD64 file holding a sine wave is synthesized with a delta-sigma modulator and converted to PCM at 352.8 KHz,
+// the reference, and at each lower rate with each filter quality.  Each conversion is verified to produce one frame
+// for each decimation factor's worth of DSD, rounded up, matching its reported total frames; to have no delay
+// relative to the reference, measured from the phase of the fitted sine wave; and to produce identical frames
+// after seeking.  The exit status is failure if any conversion fails verification.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <SFBAudioEngine/AudioBufferList.h>
+#include <SFBAudioEngine/CFWrapper.h>
+#include <SFBAudioEngine/DSDPCMDecoder.h>
+
+#define DEFAULT_BYTE_COUNT 45003
+#define DSD_SAMPLE_RATE 2822400
+#define DSF_BLOCK_SIZE 4096
+#define REFERENCE_SAMPLE_RATE 352800
+#define SINE_FREQUENCY 5000.
+#define SINE_AMPLITUDE 0.4
+#define BUFFER_SIZE_FRAMES 4096
+#define SEEK_FRAME_COUNT 2048
+
+// The largest delay relative to the reference, measured in reference frames, that is considered aligned
+#define MAXIMUM_DELAY 0.05
+
+namespace {
+
+	using SFB::Audio::DSDPCMDecoder;
+
+	// ========================================
+	// Append little-endian values to a byte vector
+	void AppendLE(std::vector<uint8_t>& bytes, uint64_t value, size_t size)
+	{
+		for(size_t i = 0; i < size; ++i)
+			bytes.push_back((uint8_t)(value >> (8 * i)));
+	}
+
+	// ========================================
+	// Synthesize a mono DSF file holding byteCount bytes of a sine wave modulated by a second-order delta-sigma modulator
+	bool WriteDSFFile(const char *path, size_t byteCount)
+	{
+		size_t blockCount = (byteCount + DSF_BLOCK_SIZE - 1) / DSF_BLOCK_SIZE;
+
+		std::vector<uint8_t> file;
+		file.reserve(92 + (blockCount * DSF_BLOCK_SIZE));
+
+		size_t fileSize = 92 + (blockCount * DSF_BLOCK_SIZE);
+		file.insert(file.end(), { 'D', 'S', 'D', ' ' });
+		AppendLE(file, 28, 8);
+		AppendLE(file, fileSize, 8);
+		AppendLE(file, 0, 8);
+
+		file.insert(file.end(), { 'f', 'm', 't', ' ' });
+		AppendLE(file, 52, 8);
+		AppendLE(file, 1, 4);					// Format version
+		AppendLE(file, 0, 4);					// Format ID: DSD raw
+		AppendLE(file, 1, 4);					// Channel type: mono
+		AppendLE(file, 1, 4);					// Channel count
+		AppendLE(file, DSD_SAMPLE_RATE, 4);
+		AppendLE(file, 1, 4);					// Bits per sample: least significant bit first
+		AppendLE(file, 8 * byteCount, 8);		// Sample count
+		AppendLE(file, DSF_BLOCK_SIZE, 4);
+		AppendLE(file, 0, 4);
+
+		file.insert(file.end(), { 'd', 'a', 't', 'a' });
+		AppendLE(file, 12 + (blockCount * DSF_BLOCK_SIZE), 8);
+
+		double integrator1 = 0, integrator2 = 0, feedback = 0;
+		for(size_t i = 0; i < blockCount * DSF_BLOCK_SIZE; ++i) {
+			uint8_t byte = 0;
+			if(i < byteCount) {
+				for(unsigned bit = 0; bit < 8; ++bit) {
+					double x = SINE_AMPLITUDE * sin(2 * M_PI * SINE_FREQUENCY * (double)((8 * i) + bit) / DSD_SAMPLE_RATE);
+					integrator1 += x - feedback;
+					integrator2 += integrator1 - feedback;
+					feedback = 0 <= integrator2 ? 1 : -1;
+					if(0 < feedback)
+						byte |= (uint8_t)(1 << bit);
+				}
+			}
+			file.push_back(byte);
+		}
+
+		FILE *f = fopen(path, "wb");
+		if(nullptr == f)
+			return false;
+
+		bool written = file.size() == fwrite(file.data(), 1, file.size(), f);
+		return 0 == fclose(f) && written;
+	}
+
+	// ========================================
+	// Open the file for conversion at sampleRate
+	SFB::Audio::Decoder::unique_ptr OpenDecoder(CFURLRef url, Float64 sampleRate, DSDPCMDecoder::FilterQuality filterQuality)
+	{
+		auto decoder = DSDPCMDecoder::CreateForURL(url);
+		if(!decoder)
+			return nullptr;
+
+		auto dsdPCMDecoder = static_cast<DSDPCMDecoder *>(decoder.get());
+		dsdPCMDecoder->SetTargetSampleRate(sampleRate);
+		dsdPCMDecoder->SetFilterQuality(filterQuality);
+
+		if(!decoder->Open())
+			return nullptr;
+
+		return decoder;
+	}
+
+	// ========================================
+	// Read up to frameCount frames, or all remaining frames if frameCount is 0
+	std::vector<float> ReadFrames(SFB::Audio::Decoder& decoder, size_t frameCount)
+	{
+		std::vector<float> frames;
+
+		SFB::Audio::BufferList bufferList;
+		if(!bufferList.Allocate(decoder.GetFormat(), BUFFER_SIZE_FRAMES))
+			return frames;
+
+		for(;;) {
+			UInt32 framesRead = decoder.ReadAudio(bufferList, BUFFER_SIZE_FRAMES);
+			if(0 == framesRead)
+				break;
+
+			auto samples = (const float *)bufferList->mBuffers[0].mData;
+			frames.insert(frames.end(), samples, samples + framesRead);
+
+			if(0 != frameCount && frameCount <= frames.size()) {
+				frames.resize(frameCount);
+				break;
+			}
+		}
+
+		return frames;
+	}
+
+	// ========================================
+	// The phase in radians of the sine wave sampled at sampleRate, fitted by least squares
+	// Frames near the ends, where the filters have transients, are excluded from the fit
+	double FitPhase(const std::vector<float>& frames, double sampleRate)
+	{
+		double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0;
+		for(size_t n = 256; n + 256 < frames.size(); ++n) {
+			double s = sin(2 * M_PI * SINE_FREQUENCY * n / sampleRate);
+			double c = cos(2 * M_PI * SINE_FREQUENCY * n / sampleRate);
+			ss += s * s; sc += s * c; cc += c * c;
+			ys += frames[n] * s; yc += frames[n] * c;
+		}
+
+		double determinant = (ss * cc) - (sc * sc);
+		double a = ((ys * cc) - (yc * sc)) / determinant;
+		double b = ((yc * ss) - (ys * sc)) / determinant;
+
+		// a sin(wt) + b cos(wt) = r sin(wt + phi)
+		return atan2(b, a);
+	}
+
+	const char * GetFilterQualityName(DSDPCMDecoder::FilterQuality filterQuality)
+	{
+		switch(filterQuality) {
+			case DSDPCMDecoder::FilterQuality::Low:		return "low";
+			case DSDPCMDecoder::FilterQuality::Medium:	return "medium";
+			case DSDPCMDecoder::FilterQuality::High:	return "high";
+		}
+
+		return "unknown";
+	}
+
+	void PrintUsage(const char *name)
+	{
+		fprintf(stderr, "Usage: %s [-n bytes]\n", name);
+	}
+
+}
+
+int main(int argc, char *argv [])
+{
+	long byteCount = DEFAULT_BYTE_COUNT;
+
+	int ch;
+	while(-1 != (ch = getopt(argc, argv, "n:"))) {
+		switch(ch) {
+			case 'n':
+				byteCount = atol(optarg);
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	// Enough frames remain at 44.1 KHz to fit the phase and seek after the excluded frames
+	if(optind != argc || 8 * 4096 > byteCount || INT32_MAX / 8 < byteCount) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char *temporaryDirectory = getenv("TMPDIR");
+	std::string path = std::string(temporaryDirectory ? temporaryDirectory : "/tmp") + "/DSDPCMVerifier-XXXXXX.dsf";
+	int fd = mkstemps(&path[0], 4);
+	if(-1 == fd) {
+		fprintf(stderr, "Unable to create temporary file\n");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	if(!WriteDSFFile(path.c_str(), (size_t)byteCount)) {
+		fprintf(stderr, "Unable to write %s\n", path.c_str());
+		unlink(path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	SFB::CFURL url(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)path.c_str(), (CFIndex)path.size(), false));
+
+	bool failed = false;
+
+	auto reference = OpenDecoder(url, REFERENCE_SAMPLE_RATE, DSDPCMDecoder::FilterQuality::Medium);
+	auto referenceFrames = reference ? ReadFrames(*reference, 0) : std::vector<float>();
+	if(referenceFrames.empty()) {
+		fprintf(stderr, "Unable to convert %s\n", path.c_str());
+		unlink(path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	double referencePhase = FitPhase(referenceFrames, REFERENCE_SAMPLE_RATE);
+
+	for(Float64 sampleRate : { 352800., 176400., 88200., 44100. }) {
+		for(auto filterQuality : { DSDPCMDecoder::FilterQuality::Low, DSDPCMDecoder::FilterQuality::Medium, DSDPCMDecoder::FilterQuality::High }) {
+			auto decoder = OpenDecoder(url, sampleRate, filterQuality);
+			if(!decoder) {
+				printf("{\"sample_rate\":%.0f,\"filter_quality\":\"%s\",\"passed\":false}\n", sampleRate, GetFilterQualityName(filterQuality));
+				failed = true;
+				continue;
+			}
+
+			auto decimationFactor = (long long)(REFERENCE_SAMPLE_RATE / sampleRate);
+			auto expectedFrames = (byteCount + decimationFactor - 1) / decimationFactor;
+			auto totalFrames = decoder->GetTotalFrames();
+
+			auto frames = ReadFrames(*decoder, 0);
+			auto currentFrame = decoder->GetCurrentFrame();
+
+			// The delay relative to the reference in reference frames
+			double phaseDifference = remainder(referencePhase - FitPhase(frames, sampleRate), 2 * M_PI);
+			double delay = phaseDifference / (2 * M_PI * SINE_FREQUENCY / REFERENCE_SAMPLE_RATE);
+
+			// Frames read after seeking must equal those read sequentially
+			auto seekFrame = (SInt64)frames.size() / 3 + 5;
+			auto seekResult = decoder->SeekToFrame(seekFrame);
+			auto seekCurrentFrame = decoder->GetCurrentFrame();
+			auto seekFrames = ReadFrames(*decoder, SEEK_FRAME_COUNT);
+
+			double seekMaximumError = seekFrames.empty() ? INFINITY : 0;
+			for(size_t i = 0; i < seekFrames.size() && (size_t)seekFrame + i < frames.size(); ++i)
+				seekMaximumError = std::fmax(seekMaximumError, std::fabs(seekFrames[i] - frames[(size_t)seekFrame + i]));
+
+			bool passed = (long long)frames.size() == expectedFrames && totalFrames == expectedFrames && currentFrame == expectedFrames
+				&& MAXIMUM_DELAY >= std::fabs(delay) && seekFrame == seekResult && seekFrame == seekCurrentFrame && 0 == seekMaximumError;
+			if(!passed)
+				failed = true;
+
+			printf("{\"sample_rate\":%.0f,\"filter_quality\":\"%s\",\"frames\":%zu,\"expected_frames\":%lld,\"total_frames\":%lld,\"current_frame\":%lld,\"delay\":%.4f,\"seek_frame\":%lld,\"seek_result\":%lld,\"seek_max_error\":%g,\"passed\":%s}\n",
+				   sampleRate, GetFilterQualityName(filterQuality), frames.size(), expectedFrames, (long long)totalFrames, (long long)currentFrame, delay, (long long)seekFrame, (long long)seekResult, seekMaximumError, passed ? "true" : "false");
+		}
+	}
+
+	unlink(path.c_str());
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
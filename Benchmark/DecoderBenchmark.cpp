@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// Decodes every file in a corpus directory and prints one JSON object per line describing the decoding performance
+// Usage: DecoderBenchmark [-c] [-n iterations] corpus-directory
+//   -c		Convert the decoded audio to non-interleaved 32-bit float using Converter
+//   -n		Decode each file this many times and report the fastest iteration (default 3)
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <mach/mach_time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <SFBAudioEngine/AudioBufferList.h>
+#include <SFBAudioEngine/AudioConverter.h>
+#include <SFBAudioEngine/AudioDecoder.h>
+#include <SFBAudioEngine/CFWrapper.h>
+
+#include "BenchmarkUtilities.h"
+
+#define BUFFER_SIZE_FRAMES 4096
+#define DEFAULT_ITERATION_COUNT 3
+
+// ========================================
+// Allocation counting
+// ========================================
+namespace {
+
+	std::atomic_ullong sAllocationCount(0);
+	std::atomic_ullong sAllocatedBytes(0);
+
+}
+
+// Replacing the global allocation functions here replaces them for the framework as well
+// Allocations made with malloc() by the decoders' libraries are not counted
+void * operator new(size_t size)
+{
+	sAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	sAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+
+	void *ptr = malloc(size ? size : 1);
+	if(nullptr == ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void * operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	free(ptr);
+}
+
+namespace {
+
+	using SFB::Benchmark::ConvertHostTimeToSeconds;
+	using SFB::Benchmark::ConvertToUTF8;
+	using SFB::Benchmark::GetExtension;
+	using SFB::Benchmark::EscapeJSON;
+	using SFB::Benchmark::GetPath;
+	using SFB::Benchmark::CollectFiles;
+
+	struct Measurement
+	{
+		SInt64		mFrameCount;
+		double		mSeconds;
+		uint64_t	mAllocationCount;
+		uint64_t	mAllocatedBytes;
+	};
+
+	// ========================================
+	// The process's peak resident set size in bytes
+	long GetPeakResidentSetSize()
+	{
+		struct rusage usage;
+		if(-1 == getrusage(RUSAGE_SELF, &usage))
+			return -1;
+
+		// ru_maxrss is in bytes on macOS
+		return usage.ru_maxrss;
+	}
+
+	// ========================================
+	// Decode a file, returning false on failure
+	bool DecodeFile(CFURLRef url, bool convert, Measurement& measurement, std::string& formatDescription, Float64& sampleRate, UInt32& channelCount, SFB::CFError& error)
+	{
+		uint64_t allocationCount = sAllocationCount.load();
+		uint64_t allocatedBytes = sAllocatedBytes.load();
+		uint64_t startTime = mach_absolute_time();
+
+		auto decoder = SFB::Audio::Decoder::CreateForURL(url, &error);
+		if(!decoder || !decoder->Open(&error))
+			return false;
+
+		SFB::CFString description(decoder->CreateSourceFormatDescription());
+		formatDescription = ConvertToUTF8(description);
+		sampleRate = decoder->GetFormat().mSampleRate;
+		channelCount = decoder->GetFormat().mChannelsPerFrame;
+
+		SInt64 frameCount = 0;
+
+		if(convert) {
+			AudioStreamBasicDescription outputFormat = {
+				.mFormatID				= kAudioFormatLinearPCM,
+				.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved,
+				.mReserved				= 0,
+				.mSampleRate			= sampleRate,
+				.mChannelsPerFrame		= channelCount,
+				.mBitsPerChannel		= 32,
+				.mBytesPerPacket		= 4,
+				.mBytesPerFrame			= 4,
+				.mFramesPerPacket		= 1
+			};
+
+			// Converter takes ownership of decoder
+			SFB::Audio::Converter converter(std::move(decoder), outputFormat);
+			if(!converter.Open(&error))
+				return false;
+
+			SFB::Audio::BufferList bufferList(outputFormat, BUFFER_SIZE_FRAMES);
+			for(;;) {
+				UInt32 framesConverted = converter.ConvertAudio(bufferList, BUFFER_SIZE_FRAMES);
+				if(0 == framesConverted)
+					break;
+				frameCount += framesConverted;
+			}
+		}
+		else {
+			SFB::Audio::BufferList bufferList(decoder->GetFormat(), BUFFER_SIZE_FRAMES);
+			for(;;) {
+				bufferList.Reset();
+				UInt32 framesRead = decoder->ReadAudio(bufferList, BUFFER_SIZE_FRAMES);
+				if(0 == framesRead)
+					break;
+				frameCount += framesRead;
+			}
+		}
+
+		measurement.mSeconds = ConvertHostTimeToSeconds(mach_absolute_time() - startTime);
+		measurement.mFrameCount = frameCount;
+		measurement.mAllocationCount = sAllocationCount.load() - allocationCount;
+		measurement.mAllocatedBytes = sAllocatedBytes.load() - allocatedBytes;
+
+		return true;
+	}
+
+	void PrintUsage(const char *name)
+	{
+		fprintf(stderr, "Usage: %s [-c] [-n iterations] corpus-directory\n", name);
+	}
+
+}
+
+int main(int argc, char *argv [])
+{
+	bool convert = false;
+	int iterationCount = DEFAULT_ITERATION_COUNT;
+
+	int ch;
+	while(-1 != (ch = getopt(argc, argv, "cn:"))) {
+		switch(ch) {
+			case 'c':
+				convert = true;
+				break;
+			case 'n':
+				iterationCount = atoi(optarg);
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(optind + 1 != argc || 1 > iterationCount) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	SFB::CFURL corpus(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)argv[optind], (CFIndex)strlen(argv[optind]), true));
+	if(!corpus) {
+		fprintf(stderr, "Invalid corpus directory: %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	auto urls = CollectFiles(corpus, SFB::Audio::Decoder::HandlesFilesWithExtension);
+	std::vector<std::string> benchmarkedExtensions;
+	bool failed = false;
+
+	for(const auto& url : urls) {
+		std::string path = GetPath(url);
+		std::string extension = GetExtension(url);
+		benchmarkedExtensions.push_back(extension);
+
+		// The fastest iteration is reported since it is least affected by other system activity
+		Measurement best = {};
+		std::string formatDescription;
+		Float64 sampleRate = 0;
+		UInt32 channelCount = 0;
+		SFB::CFError error;
+		bool succeeded = true;
+
+		for(int iteration = 0; iteration < iterationCount; ++iteration) {
+			Measurement measurement = {};
+			if(!DecodeFile(url, convert, measurement, formatDescription, sampleRate, channelCount, error)) {
+				succeeded = false;
+				break;
+			}
+
+			if(0 == iteration || measurement.mSeconds < best.mSeconds)
+				best = measurement;
+		}
+
+		if(!succeeded) {
+			SFB::CFString description(error ? CFErrorCopyDescription(error) : nullptr);
+			printf("{\"file\":\"%s\",\"extension\":\"%s\",\"status\":\"error\",\"error\":\"%s\"}\n", EscapeJSON(path).c_str(), EscapeJSON(extension).c_str(), EscapeJSON(ConvertToUTF8(description)).c_str());
+			failed = true;
+			continue;
+		}
+
+		double framesPerSecond = 0 < best.mSeconds ? best.mFrameCount / best.mSeconds : 0;
+		double realTimeFactor = 0 < sampleRate ? framesPerSecond / sampleRate : 0;
+
+		printf("{\"file\":\"%s\",\"extension\":\"%s\",\"status\":\"ok\",\"format\":\"%s\",\"converted\":%s,\"sample_rate\":%g,\"channels\":%u,\"frames\":%lld,\"seconds\":%.6f,\"frames_per_second\":%.0f,\"realtime_factor\":%.2f,\"allocations\":%llu,\"allocated_bytes\":%llu,\"peak_rss_bytes\":%ld}\n",
+			   EscapeJSON(path).c_str(), EscapeJSON(extension).c_str(), EscapeJSON(formatDescription).c_str(), convert ? "true" : "false",
+			   sampleRate, channelCount, best.mFrameCount, best.mSeconds, framesPerSecond, realTimeFactor,
+			   best.mAllocationCount, best.mAllocatedBytes, GetPeakResidentSetSize());
+		fflush(stdout);
+	}
+
+	// Report the supported formats without coverage so gaps in the corpus are visible
+	SFB::CFArray supportedExtensions(SFB::Audio::Decoder::CreateSupportedFileExtensions());
+	for(CFIndex i = 0; i < CFArrayGetCount(supportedExtensions); ++i) {
+		auto extension = ConvertToUTF8((CFStringRef)CFArrayGetValueAtIndex(supportedExtensions, i));
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+		if(benchmarkedExtensions.end() == std::find(benchmarkedExtensions.begin(), benchmarkedExtensions.end(), extension))
+			printf("{\"extension\":\"%s\",\"status\":\"no_corpus\"}\n", EscapeJSON(extension).c_str());
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
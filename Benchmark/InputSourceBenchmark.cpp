@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// Measures the open cost, sequential throughput, small-read overhead and random-seek latency of each kind of
+// input source reading one file, and prints one JSON object per input source
+// Usage: InputSourceBenchmark [-b block-sizes] [-n seeks] [-s seed] [-u url] file
+//   -b		A comma-separated list of sequential read sizes in bytes (default 512,4096,65536,1048576)
+//   -n		The number of random seeks (default 200)
+//   -s		The random number seed (default 1)
+//   -u		Also read the file over HTTP from this URL, for example one served by "python3 -m http.server"
+//
+// The file's medium (local disk, network share) is the caller's choice.  The file is read repeatedly, so the
+// results describe warm reads unless the file is larger than the page cache or the cache is purged between runs.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <mach/mach_time.h>
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <SFBAudioEngine/CFWrapper.h>
+#include <SFBAudioEngine/InputSource.h>
+
+#include "BenchmarkUtilities.h"
+
+#define DEFAULT_SEEK_COUNT 200
+#define OPEN_ITERATION_COUNT 5
+#define SEEK_READ_BYTES 4096
+#define MAXIMUM_SMALL_READS (1024 * 1024)
+
+namespace {
+
+	using SFB::Benchmark::ConvertHostTimeToSeconds;
+	using SFB::Benchmark::Percentile;
+
+	// ========================================
+	// The input sources exercised, each created and opened by a function
+	using InputSourceFactory = std::function<SFB::InputSource::unique_ptr()>;
+
+	struct InputSourceKind
+	{
+		std::string				mName;
+		InputSourceFactory		mFactory;
+	};
+
+	SFB::InputSource::unique_ptr Open(SFB::InputSource::unique_ptr inputSource)
+	{
+		if(!inputSource || !inputSource->Open())
+			return nullptr;
+		return inputSource;
+	}
+
+	std::vector<InputSourceKind> GetInputSourceKinds(CFURLRef url, CFURLRef httpURL, const std::vector<uint8_t>& contents)
+	{
+		std::vector<InputSourceKind> kinds;
+
+		kinds.push_back({ "file", [=]() { return Open(SFB::InputSource::CreateForURL(url)); } });
+		kinds.push_back({ "mmap", [=]() { return Open(SFB::InputSource::CreateMemoryMapped(url)); } });
+		kinds.push_back({ "in_memory_file", [=]() { return Open(SFB::InputSource::CreateForURL(url, SFB::InputSource::LoadFilesInMemory)); } });
+		kinds.push_back({ "read_ahead", [=]() { return Open(SFB::InputSource::CreateReadAhead(url)); } });
+		kinds.push_back({ "buffered_file", [=]() { return Open(SFB::InputSource::CreateBuffered(SFB::InputSource::CreateForURL(url))); } });
+
+		// The bytes are borrowed so only the input source's overhead is measured, not loading the file
+		const auto *bytes = contents.data();
+		auto byteCount = (SInt64)contents.size();
+		kinds.push_back({ "memory", [=]() { return Open(SFB::InputSource::CreateWithMemory(bytes, byteCount, false)); } });
+
+		if(httpURL) {
+			kinds.push_back({ "http", [=]() { return Open(SFB::InputSource::CreateForURL(httpURL)); } });
+			kinds.push_back({ "buffered_http", [=]() { return Open(SFB::InputSource::CreateBuffered(SFB::InputSource::CreateForURL(httpURL))); } });
+		}
+
+		return kinds;
+	}
+
+	// ========================================
+	// Measurements
+
+	// The fastest of several creations and opens, in seconds
+	double MeasureOpen(const InputSourceFactory& factory)
+	{
+		double best = -1;
+		for(int i = 0; i < OPEN_ITERATION_COUNT; ++i) {
+			auto startTime = mach_absolute_time();
+			auto inputSource = factory();
+			auto seconds = ConvertHostTimeToSeconds(mach_absolute_time() - startTime);
+			if(!inputSource)
+				return -1;
+			if(0 > best || seconds < best)
+				best = seconds;
+		}
+		return best;
+	}
+
+	// Bytes per second reading from start to end in blocks of blockSize bytes
+	double MeasureSequential(const InputSourceFactory& factory, size_t blockSize)
+	{
+		auto inputSource = factory();
+		if(!inputSource)
+			return -1;
+
+		std::vector<uint8_t> buffer(blockSize);
+		uint64_t byteCount = 0;
+
+		auto startTime = mach_absolute_time();
+		for(;;) {
+			auto bytesRead = inputSource->Read(buffer.data(), (SInt64)blockSize);
+			if(0 >= bytesRead)
+				break;
+			byteCount += (uint64_t)bytesRead;
+		}
+		auto seconds = ConvertHostTimeToSeconds(mach_absolute_time() - startTime);
+
+		return 0 < seconds ? byteCount / seconds : 0;
+	}
+
+	volatile uint32_t sSmallReadSum = 0;
+
+	// Nanoseconds per ReadLE<uint32_t>() reading from the start
+	double MeasureSmallReads(const InputSourceFactory& factory)
+	{
+		auto inputSource = factory();
+		if(!inputSource)
+			return -1;
+
+		size_t readCount = 0;
+		uint32_t sum = 0;
+
+		auto startTime = mach_absolute_time();
+		uint32_t value;
+		while(readCount < MAXIMUM_SMALL_READS && inputSource->ReadLE(value)) {
+			sum += value;
+			++readCount;
+		}
+		auto seconds = ConvertHostTimeToSeconds(mach_absolute_time() - startTime);
+
+		// Keep the reads from being optimized away
+		sSmallReadSum = sum;
+
+		return 0 < readCount ? (seconds * NSEC_PER_SEC) / readCount : -1;
+	}
+
+	// Seconds taken by each seek followed by a read of SEEK_READ_BYTES bytes
+	bool MeasureSeeks(const InputSourceFactory& factory, const std::vector<SInt64>& offsets, std::vector<double>& times)
+	{
+		auto inputSource = factory();
+		if(!inputSource || !inputSource->SupportsSeeking())
+			return false;
+
+		std::vector<uint8_t> buffer(SEEK_READ_BYTES);
+		times.clear();
+
+		for(auto offset : offsets) {
+			auto startTime = mach_absolute_time();
+			if(!inputSource->SeekToOffset(offset) || 0 > inputSource->Read(buffer.data(), SEEK_READ_BYTES))
+				return false;
+			times.push_back(ConvertHostTimeToSeconds(mach_absolute_time() - startTime));
+		}
+
+		return true;
+	}
+
+	// Parse a comma-separated list of sizes
+	std::vector<size_t> ParseSizes(const char *list)
+	{
+		std::vector<size_t> sizes;
+		const char *p = list;
+		while(*p) {
+			char *end = nullptr;
+			auto size = (size_t)strtoull(p, &end, 10);
+			if(end == p)
+				break;
+			if(0 < size)
+				sizes.push_back(size);
+			p = (',' == *end) ? end + 1 : end;
+		}
+		return sizes;
+	}
+
+	void PrintUsage(const char *name)
+	{
+		fprintf(stderr, "Usage: %s [-b block-sizes] [-n seeks] [-s seed] [-u url] file\n", name);
+	}
+
+}
+
+int main(int argc, char *argv [])
+{
+	std::vector<size_t> blockSizes = { 512, 4096, 65536, 1048576 };
+	int seekCount = DEFAULT_SEEK_COUNT;
+	unsigned seed = 1;
+	const char *httpURLString = nullptr;
+
+	int ch;
+	while(-1 != (ch = getopt(argc, argv, "b:n:s:u:"))) {
+		switch(ch) {
+			case 'b':
+				blockSizes = ParseSizes(optarg);
+				break;
+			case 'n':
+				seekCount = atoi(optarg);
+				break;
+			case 's':
+				seed = (unsigned)strtoul(optarg, nullptr, 10);
+				break;
+			case 'u':
+				httpURLString = optarg;
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(optind + 1 != argc || blockSizes.empty() || 0 > seekCount) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char *path = argv[optind];
+	SFB::CFURL url(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)path, (CFIndex)strlen(path), false));
+
+	SFB::CFURL httpURL;
+	if(httpURLString) {
+		httpURL = SFB::CFURL(CFURLCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)httpURLString, (CFIndex)strlen(httpURLString), kCFStringEncodingUTF8, nullptr));
+		if(!httpURL) {
+			fprintf(stderr, "Invalid URL: %s\n", httpURLString);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// The file's contents back the memory input source
+	std::vector<uint8_t> contents;
+	{
+		auto inputSource = SFB::InputSource::CreateForURL(url);
+		if(!inputSource || !inputSource->Open() || 0 >= inputSource->GetLength()) {
+			fprintf(stderr, "Unable to read %s\n", path);
+			return EXIT_FAILURE;
+		}
+
+		contents.resize((size_t)inputSource->GetLength());
+		if((SInt64)contents.size() != inputSource->Read(contents.data(), (SInt64)contents.size())) {
+			fprintf(stderr, "Unable to read %s\n", path);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Every input source seeks to the same offsets
+	std::mt19937 generator(seed);
+	std::uniform_int_distribution<SInt64> distribution(0, std::max((SInt64)contents.size() - SEEK_READ_BYTES, (SInt64)0));
+	std::vector<SInt64> offsets((size_t)seekCount);
+	for(auto& offset : offsets)
+		offset = distribution(generator);
+
+	bool failed = false;
+
+	for(const auto& kind : GetInputSourceKinds(url, httpURL, contents)) {
+		double openTime = MeasureOpen(kind.mFactory);
+		if(0 > openTime) {
+			printf("{\"source\":\"%s\",\"status\":\"error\"}\n", kind.mName.c_str());
+			fflush(stdout);
+			failed = true;
+			continue;
+		}
+
+		printf("{\"source\":\"%s\",\"status\":\"ok\",\"file_bytes\":%zu,\"open_us\":%.1f,\"sequential\":[", kind.mName.c_str(), contents.size(), openTime * 1e6);
+		for(size_t i = 0; i < blockSizes.size(); ++i)
+			printf("%s{\"block_bytes\":%zu,\"mb_per_second\":%.1f}", 0 == i ? "" : ",", blockSizes[i], MeasureSequential(kind.mFactory, blockSizes[i]) / (1024 * 1024));
+		printf("],\"small_read_ns\":%.1f,", MeasureSmallReads(kind.mFactory));
+
+		std::vector<double> times;
+		if(MeasureSeeks(kind.mFactory, offsets, times))
+			printf("\"seeks\":%zu,\"seek_p50_us\":%.1f,\"seek_p99_us\":%.1f,\"seek_max_us\":%.1f}\n",
+				   times.size(), Percentile(times, 0.5) * 1e6, Percentile(times, 0.99) * 1e6, Percentile(times, 1) * 1e6);
+		else
+			printf("\"seeks\":0}\n");
+		fflush(stdout);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
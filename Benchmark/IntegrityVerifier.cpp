@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// Decodes every file in a directory in parallel and verifies it, printing one JSON object per file and a summary
+// Usage: IntegrityVerifier [-j jobs] [-v readers] directory
+//   -j		The number of files decoded at once (default the number of processors)
+//   -v		The number of files read at once from each volume (default all jobs for local volumes and 2 for others)
+//
+// Files with an embedded MD5 signature (FLAC and WavPack) are verified against it.  Other files are verified only
+// to decode completely: without errors opening and to the number of frames in their headers.  Files are scheduled
+// so that no volume has more than the allowed number of readers, keeping spinning and network volumes from
+// thrashing while other volumes are busy.
+//
+// Status is "verified" when the signature matched, "failed" when it didn't, "decoded" when no signature was
+// available and the file decoded completely, and "error" otherwise.  The exit status is failure if any file
+// failed or had an error.
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mach/mach_time.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <SFBAudioEngine/AudioBufferList.h>
+#include <SFBAudioEngine/AudioDecoder.h>
+#include <SFBAudioEngine/CFWrapper.h>
+
+#include "BenchmarkUtilities.h"
+
+#define BUFFER_SIZE_FRAMES 4096
+#define NETWORK_VOLUME_READERS 2
+
+namespace {
+
+	using SFB::Benchmark::ConvertHostTimeToSeconds;
+	using SFB::Benchmark::ConvertToUTF8;
+	using SFB::Benchmark::EscapeJSON;
+	using SFB::Benchmark::GetPath;
+	using SFB::Benchmark::CollectFiles;
+
+	// ========================================
+	// Verification of one file
+	struct Result
+	{
+		const char		*mStatus;
+		std::string		mError;
+		SInt64			mFrameCount;
+		SInt64			mTotalFrames;
+		Float64			mSampleRate;
+		long long		mByteCount;
+		double			mSeconds;
+	};
+
+	Result VerifyFile(CFURLRef url, long long byteCount)
+	{
+		Result result = { "error", std::string(), 0, -1, 0, byteCount, 0 };
+		auto startTime = mach_absolute_time();
+
+		SFB::CFError error;
+		auto decoder = SFB::Audio::Decoder::CreateForURL(url, &error);
+		if(decoder)
+			decoder->SetIntegrityVerificationEnabled(true);
+
+		if(!decoder || !decoder->Open(&error)) {
+			SFB::CFString description(error ? CFErrorCopyDescription(error) : nullptr);
+			result.mError = ConvertToUTF8(description);
+			return result;
+		}
+
+		result.mTotalFrames = decoder->GetTotalFrames();
+		result.mSampleRate = decoder->GetFormat().mSampleRate;
+
+		SFB::Audio::BufferList bufferList(decoder->GetFormat(), BUFFER_SIZE_FRAMES);
+		for(;;) {
+			bufferList.Reset();
+			UInt32 framesRead = decoder->ReadAudio(bufferList, BUFFER_SIZE_FRAMES);
+			if(0 == framesRead)
+				break;
+			result.mFrameCount += framesRead;
+		}
+
+		result.mSeconds = ConvertHostTimeToSeconds(mach_absolute_time() - startTime);
+
+		switch(decoder->GetIntegrityStatus()) {
+			case SFB::Audio::Decoder::IntegrityStatus::Verified:
+				result.mStatus = "verified";
+				break;
+			case SFB::Audio::Decoder::IntegrityStatus::Failed:
+				result.mStatus = "failed";
+				result.mError = "Signature mismatch";
+				break;
+			case SFB::Audio::Decoder::IntegrityStatus::Unverified:
+				// A decoder stopping early indicates an error in the stream
+				if(0 < result.mTotalFrames && result.mFrameCount < result.mTotalFrames)
+					result.mError = "Decoded " + std::to_string(result.mFrameCount) + " of " + std::to_string(result.mTotalFrames) + " frames";
+				else
+					result.mStatus = "decoded";
+				break;
+		}
+
+		return result;
+	}
+
+	// ========================================
+	// Files grouped by volume so the readers of each volume may be limited
+	class Scheduler
+	{
+
+	public:
+
+		Scheduler(const std::vector<SFB::CFURL>& urls, unsigned jobCount, unsigned volumeReaders)
+			: mURLs(urls), mSizes(urls.size(), -1)
+		{
+			for(size_t i = 0; i < urls.size(); ++i) {
+				std::string path = GetPath(urls[i]);
+
+				struct stat s;
+				dev_t device = 0;
+				if(0 == stat(path.c_str(), &s)) {
+					device = s.st_dev;
+					mSizes[i] = (long long)s.st_size;
+				}
+
+				auto volume = std::find_if(mVolumes.begin(), mVolumes.end(), [device](const Volume& v) { return v.mDevice == device; });
+				if(mVolumes.end() == volume) {
+					struct statfs fs;
+					bool isLocal = 0 == statfs(path.c_str(), &fs) && (MNT_LOCAL & fs.f_flags);
+
+					unsigned readers = 0 != volumeReaders ? volumeReaders : (isLocal ? jobCount : NETWORK_VOLUME_READERS);
+					mVolumes.push_back({ device, readers, 0, std::vector<size_t>() });
+					volume = mVolumes.end() - 1;
+				}
+
+				volume->mPending.push_back(i);
+			}
+
+			// Files are taken from the back of each volume's list
+			for(auto& volume : mVolumes)
+				std::reverse(volume.mPending.begin(), volume.mPending.end());
+		}
+
+		// Get the next file, blocking while every volume with pending files is at its limit; returns false when all files are taken
+		bool Take(size_t& index, size_t& volumeIndex)
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			for(;;) {
+				bool pending = false;
+				Volume *best = nullptr;
+				for(auto& volume : mVolumes) {
+					if(volume.mPending.empty())
+						continue;
+					pending = true;
+					if(volume.mActive < volume.mReaders && (nullptr == best || volume.mActive < best->mActive))
+						best = &volume;
+				}
+
+				if(!pending)
+					return false;
+
+				if(best) {
+					index = best->mPending.back();
+					best->mPending.pop_back();
+					++best->mActive;
+					volumeIndex = (size_t)(best - mVolumes.data());
+					return true;
+				}
+
+				mCondition.wait(lock);
+			}
+		}
+
+		void Finish(size_t volumeIndex)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				--mVolumes[volumeIndex].mActive;
+			}
+			mCondition.notify_all();
+		}
+
+		inline CFURLRef GetURL(size_t index) const			{ return mURLs[index]; }
+		inline long long GetSize(size_t index) const		{ return mSizes[index]; }
+
+	private:
+
+		struct Volume
+		{
+			dev_t					mDevice;
+			unsigned				mReaders;
+			unsigned				mActive;
+			std::vector<size_t>		mPending;
+		};
+
+		const std::vector<SFB::CFURL>&	mURLs;
+		std::vector<long long>			mSizes;
+		std::vector<Volume>				mVolumes;
+		std::mutex						mMutex;
+		std::condition_variable			mCondition;
+
+	};
+
+	void PrintUsage(const char *name)
+	{
+		fprintf(stderr, "Usage: %s [-j jobs] [-v readers] directory\n", name);
+	}
+
+}
+
+int main(int argc, char *argv [])
+{
+	unsigned jobCount = std::max(std::thread::hardware_concurrency(), 1u);
+	unsigned volumeReaders = 0;
+
+	int ch;
+	while(-1 != (ch = getopt(argc, argv, "j:v:"))) {
+		switch(ch) {
+			case 'j':
+				jobCount = (unsigned)atoi(optarg);
+				break;
+			case 'v':
+				volumeReaders = (unsigned)atoi(optarg);
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(optind + 1 != argc || 0 == jobCount) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	SFB::CFURL directory(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)argv[optind], (CFIndex)strlen(argv[optind]), true));
+	if(!directory) {
+		fprintf(stderr, "Invalid directory: %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	auto urls = CollectFiles(directory, SFB::Audio::Decoder::HandlesFilesWithExtension);
+	Scheduler scheduler(urls, jobCount, volumeReaders);
+
+	std::mutex outputMutex;
+	size_t verifiedCount = 0, failedCount = 0, decodedCount = 0, errorCount = 0;
+	long long totalBytes = 0;
+	double totalAudioSeconds = 0;
+
+	auto startTime = mach_absolute_time();
+
+	std::vector<std::thread> workers;
+	for(unsigned i = 0; i < std::min((size_t)jobCount, std::max(urls.size(), (size_t)1)); ++i) {
+		workers.emplace_back([&]() {
+			size_t index, volumeIndex;
+			while(scheduler.Take(index, volumeIndex)) {
+				auto result = VerifyFile(scheduler.GetURL(index), scheduler.GetSize(index));
+				scheduler.Finish(volumeIndex);
+
+				std::lock_guard<std::mutex> lock(outputMutex);
+
+				if(0 == strcmp("verified", result.mStatus))		++verifiedCount;
+				else if(0 == strcmp("failed", result.mStatus))	++failedCount;
+				else if(0 == strcmp("decoded", result.mStatus))	++decodedCount;
+				else											++errorCount;
+
+				if(0 < result.mByteCount)
+					totalBytes += result.mByteCount;
+				if(0 < result.mSampleRate)
+					totalAudioSeconds += result.mFrameCount / result.mSampleRate;
+
+				printf("{\"file\":\"%s\",\"status\":\"%s\",", EscapeJSON(GetPath(scheduler.GetURL(index))).c_str(), result.mStatus);
+				if(!result.mError.empty())
+					printf("\"error\":\"%s\",", EscapeJSON(result.mError).c_str());
+				printf("\"frames\":%lld,\"total_frames\":%lld,\"bytes\":%lld,\"seconds\":%.3f,\"mb_per_second\":%.1f}\n",
+					   result.mFrameCount, result.mTotalFrames, result.mByteCount, result.mSeconds,
+					   0 < result.mSeconds && 0 < result.mByteCount ? result.mByteCount / result.mSeconds / (1024 * 1024) : 0);
+				fflush(stdout);
+			}
+		});
+	}
+
+	for(auto& worker : workers)
+		worker.join();
+
+	double seconds = ConvertHostTimeToSeconds(mach_absolute_time() - startTime);
+
+	printf("{\"summary\":true,\"files\":%zu,\"verified\":%zu,\"failed\":%zu,\"decoded\":%zu,\"errors\":%zu,\"jobs\":%u,\"seconds\":%.3f,\"files_per_second\":%.1f,\"mb_per_second\":%.1f,\"realtime_factor\":%.1f}\n",
+		   urls.size(), verifiedCount, failedCount, decodedCount, errorCount, jobCount, seconds,
+		   0 < seconds ? urls.size() / seconds : 0,
+		   0 < seconds ? totalBytes / seconds / (1024 * 1024) : 0,
+		   0 < seconds ? totalAudioSeconds / seconds : 0);
+
+	return (0 == failedCount && 0 == errorCount) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
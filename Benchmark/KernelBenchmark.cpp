@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// Measures the throughput of each sample kernel for each instruction set supported by the host and prints one
+// JSON object per kernel and instruction set
+// Usage: KernelBenchmark [-d seconds] [-n samples]
+//   -d		The duration of each measurement in seconds (default 0.25)
+//   -n		The number of samples processed per call (default 65536)
+//
+// Before it is measured each kernel's output is compared with that of the scalar reference kernel, and a
+// mismatch is reported as a failure.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include <mach/mach_time.h>
+#include <unistd.h>
+
+#include <SFBAudioEngine/SampleKernels.h>
+
+#include "BenchmarkUtilities.h"
+
+#define DEFAULT_DURATION_SECONDS 0.25
+#define DEFAULT_SAMPLE_COUNT 65536
+
+namespace {
+
+	using SFB::Benchmark::ConvertHostTimeToSeconds;
+
+	using SFB::Audio::SampleKernels;
+
+	// The filter used to measure FIR decimation, of the length used by DSD to PCM conversion
+#define FILTER_LENGTH 63
+
+	// Buffers shared by all kernels, with outputs for the reference and measured kernels
+	struct Buffers
+	{
+		explicit Buffers(UInt32 sampleCount)
+			: mSampleCount(sampleCount), mFloatInput(sampleCount), mInt16Input(sampleCount), mInt32Input(sampleCount), mByteInput(3 * sampleCount),
+			  mFilter(FILTER_LENGTH), mTables(SampleKernels::kDSDTableCount * 256), mTranslationState{},
+			  mExpectedFloat(sampleCount), mFloatOutput(sampleCount), mExpectedInteger(sampleCount), mIntegerOutput(sampleCount),
+			  mExpectedBytes(3 * sampleCount), mByteOutput(3 * sampleCount),
+			  mExpectedChannels(2, std::vector<float>(sampleCount / 2)), mChannels(2, std::vector<float>(sampleCount / 2)),
+			  mExpectedByteChannels(2, std::vector<uint8_t>(sampleCount / 2)), mByteChannels(2, std::vector<uint8_t>(sampleCount / 2))
+		{
+			// Include samples outside [-1, 1) so clipping is exercised
+			std::mt19937 engine(1);
+			std::uniform_real_distribution<float> floatDistribution(-1.1f, 1.1f);
+			std::uniform_int_distribution<int> int16Distribution(INT16_MIN, INT16_MAX);
+			std::uniform_int_distribution<int32_t> int32Distribution(INT32_MIN, INT32_MAX);
+			std::uniform_int_distribution<int> byteDistribution(0, UINT8_MAX);
+
+			for(UInt32 i = 0; i < sampleCount; ++i) {
+				mFloatInput[i] = floatDistribution(engine);
+				mInt16Input[i] = (int16_t)int16Distribution(engine);
+				mInt32Input[i] = int32Distribution(engine);
+			}
+
+			for(auto& byte : mByteInput)
+				byte = (uint8_t)byteDistribution(engine);
+
+			for(auto& tap : mFilter)
+				tap = floatDistribution(engine) / FILTER_LENGTH;
+
+			for(auto& coefficient : mTables)
+				coefficient = floatDistribution(engine);
+
+			memset(mTranslationState.mFIFO, 0x69, sizeof(mTranslationState.mFIFO));
+		}
+
+		UInt32								mSampleCount;
+		std::vector<float>					mFloatInput;
+		std::vector<int16_t>				mInt16Input;
+		std::vector<int32_t>				mInt32Input;
+		std::vector<uint8_t>				mByteInput;
+		std::vector<float>					mFilter;
+		std::vector<float>					mTables;
+		SampleKernels::DSDTranslationState	mTranslationState;
+		std::vector<float>					mExpectedFloat;
+		std::vector<float>					mFloatOutput;
+		std::vector<int32_t>				mExpectedInteger;
+		std::vector<int32_t>				mIntegerOutput;
+		std::vector<uint8_t>				mExpectedBytes;
+		std::vector<uint8_t>				mByteOutput;
+		std::vector<std::vector<float>>		mExpectedChannels;
+		std::vector<std::vector<float>>		mChannels;
+		std::vector<std::vector<uint8_t>>	mExpectedByteChannels;
+		std::vector<std::vector<uint8_t>>	mByteChannels;
+	};
+
+	struct Kernel
+	{
+		const char		*mName;
+		size_t			mBytesPerSample;			// Bytes read and written per sample
+		// Run the kernel from a table writing to the measured or expected outputs
+		std::function<void(const SampleKernels& kernels, Buffers& buffers, bool expected)>	mRun;
+		// Compare the measured and expected outputs
+		std::function<bool(const Buffers& buffers)>											mVerify;
+	};
+
+	// Sums accumulated in vector lanes are added in a different order than by the scalar kernels, and
+	// multiplications and additions may be fused when compiled for instruction sets supporting it
+	bool IsClose(float a, float b)
+	{
+		return std::fabs(a - b) <= 1e-4f * std::max(1.f, std::max(std::fabs(a), std::fabs(b)));
+	}
+
+	bool AreClose(const std::vector<float>& a, const std::vector<float>& b)
+	{
+		return std::equal(a.begin(), a.end(), b.begin(), IsClose);
+	}
+
+	std::vector<Kernel> GetKernels()
+	{
+		return {
+			{ "deinterleave", 2 * sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					auto& channels = expected ? buffers.mExpectedChannels : buffers.mChannels;
+					float * const outputs [] = { channels[0].data(), channels[1].data() };
+					kernels.Deinterleave(buffers.mFloatInput.data(), outputs, 2, buffers.mSampleCount / 2);
+				},
+				[](const Buffers& buffers) { return buffers.mChannels == buffers.mExpectedChannels; }
+			},
+			{ "deinterleave_bytes", 2,
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					auto& channels = expected ? buffers.mExpectedByteChannels : buffers.mByteChannels;
+					uint8_t * const outputs [] = { channels[0].data(), channels[1].data() };
+					kernels.DeinterleaveBytes(buffers.mByteInput.data(), outputs, 2, buffers.mSampleCount / 2);
+				},
+				[](const Buffers& buffers) { return buffers.mByteChannels == buffers.mExpectedByteChannels; }
+			},
+			{ "interleave", 2 * sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					const float * const inputs [] = { buffers.mFloatInput.data(), buffers.mFloatInput.data() + buffers.mSampleCount / 2 };
+					kernels.Interleave(inputs, expected ? buffers.mExpectedFloat.data() : buffers.mFloatOutput.data(), 2, buffers.mSampleCount / 2);
+				},
+				[](const Buffers& buffers) { return buffers.mFloatOutput == buffers.mExpectedFloat; }
+			},
+			{ "copy_stride_2", sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					kernels.Copy(buffers.mFloatInput.data(), 2, expected ? buffers.mExpectedFloat.data() : buffers.mFloatOutput.data(), 1, buffers.mSampleCount / 2);
+				},
+				[](const Buffers& buffers) { return buffers.mFloatOutput == buffers.mExpectedFloat; }
+			},
+			{ "scale", 2 * sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					kernels.Scale(buffers.mFloatInput.data(), expected ? buffers.mExpectedFloat.data() : buffers.mFloatOutput.data(), buffers.mSampleCount, 0.708f);
+				},
+				[](const Buffers& buffers) { return buffers.mFloatOutput == buffers.mExpectedFloat; }
+			},
+			// The output is reset before each call so every call produces the same result
+			{ "multiply_add", 3 * sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					auto& output = expected ? buffers.mExpectedFloat : buffers.mFloatOutput;
+					std::copy(buffers.mFloatInput.rbegin(), buffers.mFloatInput.rend(), output.begin());
+					kernels.MultiplyAdd(buffers.mFloatInput.data(), output.data(), buffers.mSampleCount, 0.708f);
+				},
+				[](const Buffers& buffers) { return AreClose(buffers.mFloatOutput, buffers.mExpectedFloat); }
+			},
+			{ "maximum_magnitude", sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					(expected ? buffers.mExpectedFloat : buffers.mFloatOutput)[0] = kernels.MaximumMagnitude(buffers.mFloatInput.data(), buffers.mSampleCount);
+				},
+				[](const Buffers& buffers) { return buffers.mFloatOutput[0] == buffers.mExpectedFloat[0]; }
+			},
+			{ "sum_of_squares", sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					(expected ? buffers.mExpectedFloat : buffers.mFloatOutput)[0] = kernels.SumOfSquares(buffers.mFloatInput.data(), buffers.mSampleCount);
+				},
+				[](const Buffers& buffers) { return IsClose(buffers.mFloatOutput[0], buffers.mExpectedFloat[0]); }
+			},
+			{ "dot_product", 2 * sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					(expected ? buffers.mExpectedFloat : buffers.mFloatOutput)[0] = kernels.DotProduct(buffers.mFloatInput.data(), buffers.mFloatInput.data() + buffers.mSampleCount / 2, buffers.mSampleCount / 2);
+				},
+				[](const Buffers& buffers) { return IsClose(buffers.mFloatOutput[0], buffers.mExpectedFloat[0]); }
+			},
+			// Decimation by 2, as performed by each stage of DSD to PCM conversion
+			{ "filter_decimate_2", sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					UInt32 outputCount = buffers.mSampleCount < FILTER_LENGTH ? 0 : (buffers.mSampleCount - FILTER_LENGTH) / 2 + 1;
+					kernels.Filter(buffers.mFloatInput.data(), 2, buffers.mFilter.data(), FILTER_LENGTH, expected ? buffers.mExpectedFloat.data() : buffers.mFloatOutput.data(), outputCount);
+				},
+				[](const Buffers& buffers) { return AreClose(buffers.mFloatOutput, buffers.mExpectedFloat); }
+			},
+			{ "float_to_int24", sizeof(float) + sizeof(int32_t),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					kernels.ConvertFloatToInteger(buffers.mFloatInput.data(), expected ? buffers.mExpectedInteger.data() : buffers.mIntegerOutput.data(), buffers.mSampleCount, 24);
+				},
+				[](const Buffers& buffers) { return buffers.mIntegerOutput == buffers.mExpectedInteger; }
+			},
+			{ "int16_to_float", sizeof(int16_t) + sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					kernels.ConvertInt16ToFloat(buffers.mInt16Input.data(), 1, expected ? buffers.mExpectedFloat.data() : buffers.mFloatOutput.data(), 1, buffers.mSampleCount, 1.f / (1u << 15));
+				},
+				[](const Buffers& buffers) { return buffers.mFloatOutput == buffers.mExpectedFloat; }
+			},
+			{ "int24_to_float", 3 + sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					kernels.ConvertInt24ToFloat(buffers.mByteInput.data(), 1, expected ? buffers.mExpectedFloat.data() : buffers.mFloatOutput.data(), 1, buffers.mSampleCount, 1.f / (1u << 23));
+				},
+				[](const Buffers& buffers) { return buffers.mFloatOutput == buffers.mExpectedFloat; }
+			},
+			{ "int32_to_float", sizeof(int32_t) + sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					kernels.ConvertInt32ToFloat(buffers.mInt32Input.data(), 1, expected ? buffers.mExpectedFloat.data() : buffers.mFloatOutput.data(), 1, buffers.mSampleCount, 1.f / (1u << 31));
+				},
+				[](const Buffers& buffers) { return buffers.mFloatOutput == buffers.mExpectedFloat; }
+			},
+			{ "pack_int8", sizeof(int32_t) + 1,
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					kernels.PackInt8(buffers.mInt32Input.data(), 1, expected ? buffers.mExpectedBytes.data() : buffers.mByteOutput.data(), buffers.mSampleCount, 4);
+				},
+				[](const Buffers& buffers) { return buffers.mByteOutput == buffers.mExpectedBytes; }
+			},
+			{ "pack_int16", sizeof(int32_t) + sizeof(int16_t),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					kernels.PackInt16(buffers.mInt32Input.data(), 1, expected ? buffers.mExpectedBytes.data() : buffers.mByteOutput.data(), buffers.mSampleCount, 4);
+				},
+				[](const Buffers& buffers) { return buffers.mByteOutput == buffers.mExpectedBytes; }
+			},
+			{ "pack_int24", sizeof(int32_t) + 3,
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					kernels.PackInt24(buffers.mInt32Input.data(), 1, expected ? buffers.mExpectedBytes.data() : buffers.mByteOutput.data(), buffers.mSampleCount, 4);
+				},
+				[](const Buffers& buffers) { return buffers.mByteOutput == buffers.mExpectedBytes; }
+			},
+			{ "pack_int32", 2 * sizeof(int32_t),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					kernels.PackInt32(buffers.mInt32Input.data(), 1, expected ? buffers.mExpectedInteger.data() : buffers.mIntegerOutput.data(), buffers.mSampleCount, 8);
+				},
+				[](const Buffers& buffers) { return buffers.mIntegerOutput == buffers.mExpectedInteger; }
+			},
+			{ "reverse_bits", 2,
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					kernels.ReverseBits(buffers.mByteInput.data(), expected ? buffers.mExpectedBytes.data() : buffers.mByteOutput.data(), buffers.mSampleCount);
+				},
+				[](const Buffers& buffers) { return buffers.mByteOutput == buffers.mExpectedBytes; }
+			},
+			// Each sample is one DSD byte; the DSD is copied into place before each call because packing is performed in place
+			{ "pack_dop", 3,
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					auto& output = expected ? buffers.mExpectedBytes : buffers.mByteOutput;
+					UInt32 frameCount = buffers.mSampleCount / 2;
+					memcpy(output.data() + frameCount, buffers.mByteInput.data(), 2 * frameCount);
+					kernels.PackDoP(output.data(), frameCount, frameCount, 0x05, true);
+				},
+				[](const Buffers& buffers) { return buffers.mByteOutput == buffers.mExpectedBytes; }
+			},
+			// The translation state is reset before each call so every call produces the same result
+			{ "translate_dsd", 1 + sizeof(float),
+				[](const SampleKernels& kernels, Buffers& buffers, bool expected) {
+					auto state = buffers.mTranslationState;
+					kernels.TranslateDSD(buffers.mTables.data(), state, buffers.mByteInput.data(), true, expected ? buffers.mExpectedFloat.data() : buffers.mFloatOutput.data(), buffers.mSampleCount);
+				},
+				[](const Buffers& buffers) { return buffers.mFloatOutput == buffers.mExpectedFloat; }
+			},
+		};
+	}
+
+	void PrintUsage(const char *name)
+	{
+		fprintf(stderr, "Usage: %s [-d seconds] [-n samples]\n", name);
+	}
+
+}
+
+int main(int argc, char *argv [])
+{
+	double duration = DEFAULT_DURATION_SECONDS;
+	long sampleCount = DEFAULT_SAMPLE_COUNT;
+
+	int ch;
+	while(-1 != (ch = getopt(argc, argv, "d:n:"))) {
+		switch(ch) {
+			case 'd':
+				duration = atof(optarg);
+				break;
+			case 'n':
+				sampleCount = atol(optarg);
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	// Deinterleaving and interleaving use stereo frames
+	if(optind != argc || 0 >= duration || 2 > sampleCount || INT32_MAX < sampleCount || 0 != sampleCount % 2) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	Buffers buffers((UInt32)sampleCount);
+	auto kernels = GetKernels();
+	const auto& scalarKernels = SampleKernels::GetScalar();
+
+	bool failed = false;
+
+	for(auto instructionSet : { SampleKernels::InstructionSet::Scalar, SampleKernels::InstructionSet::SSE2, SampleKernels::InstructionSet::AVX2, SampleKernels::InstructionSet::AVX512, SampleKernels::InstructionSet::NEON }) {
+		SampleKernels table;
+		if(!SampleKernels::GetForInstructionSet(instructionSet, table))
+			continue;
+
+		bool selected = SampleKernels::Get().mInstructionSet == instructionSet;
+
+		for(const auto& kernel : kernels) {
+			kernel.mRun(scalarKernels, buffers, true);
+			kernel.mRun(table, buffers, false);
+			bool matches = kernel.mVerify(buffers);
+			if(!matches)
+				failed = true;
+
+			// Repeat the kernel until the duration has elapsed, checking the time every few calls
+			uint64_t calls = 0;
+			uint64_t start = mach_absolute_time();
+			double elapsed = 0;
+			do {
+				for(int i = 0; i < 16; ++i)
+					kernel.mRun(table, buffers, false);
+				calls += 16;
+				elapsed = ConvertHostTimeToSeconds(mach_absolute_time() - start);
+			} while(elapsed < duration);
+
+			double samplesPerSecond = (double)calls * (double)sampleCount / elapsed;
+
+			printf("{\"kernel\":\"%s\",\"instruction_set\":\"%s\",\"selected\":%s,\"matches_scalar\":%s,\"samples\":%ld,\"msamples_per_second\":%.1f,\"gb_per_second\":%.2f}\n",
+				   kernel.mName, SampleKernels::GetInstructionSetName(instructionSet), selected ? "true" : "false", matches ? "true" : "false",
+				   sampleCount, samplesPerSecond / 1e6, samplesPerSecond * kernel.mBytesPerSample / 1e9);
+			fflush(stdout);
+		}
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// Reads and writes the metadata of every file in a corpus directory and prints one JSON object per line for each
+// file and tag variant describing the metadata performance
+// Usage: MetadataBenchmark [-n iterations] [-p picture-bytes] [-t tag-bytes] corpus-directory
+//   -n		Read each file this many times and report the fastest iteration (default 5)
+//   -p		The size of the picture attached to the large_art variant (default 4 MiB)
+//   -t		The size of the comment and lyrics set in the large_tags variant (default 256 KiB)
+//
+// Each file is benchmarked as found and, for formats supporting writing, as copies rewritten by Metadata to
+// contain large tags or a large attached picture.  Reads are timed with attached pictures read and loaded on
+// demand, and the bytes read are counted by an input source wrapping the file.
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <copyfile.h>
+#include <mach/mach_time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <SFBAudioEngine/AttachedPicture.h>
+#include <SFBAudioEngine/AudioMetadata.h>
+#include <SFBAudioEngine/CFWrapper.h>
+#include <SFBAudioEngine/InputSource.h>
+
+#include "BenchmarkUtilities.h"
+
+#define DEFAULT_ITERATION_COUNT 5
+#define DEFAULT_PICTURE_BYTES (4 * 1024 * 1024)
+#define DEFAULT_TAG_BYTES (256 * 1024)
+
+// ========================================
+// Allocation counting
+// ========================================
+namespace {
+
+	std::atomic_ullong sAllocationCount(0);
+	std::atomic_ullong sAllocatedBytes(0);
+
+}
+
+// Replacing the global allocation functions here replaces them for the framework and TagLib as well
+void * operator new(size_t size)
+{
+	sAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	sAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+
+	void *ptr = malloc(size ? size : 1);
+	if(nullptr == ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void * operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	free(ptr);
+}
+
+namespace {
+
+	using SFB::Benchmark::ConvertHostTimeToSeconds;
+	using SFB::Benchmark::ConvertToUTF8;
+	using SFB::Benchmark::GetExtension;
+	using SFB::Benchmark::EscapeJSON;
+	using SFB::Benchmark::GetPath;
+	using SFB::Benchmark::CollectFiles;
+
+	struct Measurement
+	{
+		double		mSeconds;
+		uint64_t	mBytesRead;
+		uint64_t	mAllocationCount;
+		uint64_t	mAllocatedBytes;
+	};
+
+	// ========================================
+	// An input source counting the bytes read from the input source it wraps
+	class CountingInputSource : public SFB::InputSource
+	{
+
+	public:
+
+		explicit CountingInputSource(SFB::InputSource::unique_ptr inputSource)
+			: SFB::InputSource(inputSource->GetURL()), mInputSource(std::move(inputSource)), mBytesRead(0)
+		{}
+
+		inline uint64_t GetBytesRead() const					{ return mBytesRead; }
+
+	private:
+
+		virtual bool _Open(CFErrorRef *error)					{ return mInputSource->IsOpen() || mInputSource->Open(error); }
+		virtual bool _Close(CFErrorRef *error)					{ return mInputSource->Close(error); }
+
+		virtual SInt64 _Read(void *buffer, SInt64 byteCount)
+		{
+			auto bytesRead = mInputSource->Read(buffer, byteCount);
+			if(0 < bytesRead)
+				mBytesRead += (uint64_t)bytesRead;
+			return bytesRead;
+		}
+
+		virtual bool _AtEOF() const								{ return mInputSource->AtEOF(); }
+		virtual SInt64 _GetOffset() const						{ return mInputSource->GetOffset(); }
+		virtual SInt64 _GetLength() const						{ return mInputSource->GetLength(); }
+
+		virtual bool _SupportsSeeking() const					{ return mInputSource->SupportsSeeking(); }
+		virtual bool _SeekToOffset(SInt64 offset)				{ return mInputSource->SeekToOffset(offset); }
+
+		virtual bool _SupportsPositionalReads() const			{ return mInputSource->SupportsPositionalReads(); }
+		virtual SInt64 _PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset)
+		{
+			auto bytesRead = mInputSource->ReadV(vectors, vectorCount, offset);
+			if(0 < bytesRead)
+				mBytesRead += (uint64_t)bytesRead;
+			return bytesRead;
+		}
+
+		SFB::InputSource::unique_ptr	mInputSource;
+		uint64_t						mBytesRead;
+
+	};
+
+	SFB::CFURL CreateURL(const std::string& path, bool isDirectory = false)
+	{
+		return SFB::CFURL(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)path.c_str(), (CFIndex)path.size(), isDirectory));
+	}
+
+	long long GetFileSize(const std::string& path)
+	{
+		struct stat s;
+		if(-1 == stat(path.c_str(), &s))
+			return -1;
+		return (long long)s.st_size;
+	}
+
+	// ========================================
+	// Corpus variants
+
+	// Create a string of length characters
+	SFB::CFString CreateString(size_t length)
+	{
+		std::string string(length, ' ');
+		for(size_t i = 0; i < length; ++i)
+			string[i] = (char)('a' + (i % 26));
+		return SFB::CFString(CFStringCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)string.data(), (CFIndex)string.size(), kCFStringEncodingASCII, false));
+	}
+
+	// Create picture data of byteCount bytes beginning with a JPEG signature
+	SFB::CFData CreatePictureData(size_t byteCount)
+	{
+		std::vector<UInt8> bytes(std::max(byteCount, (size_t)4), 0);
+		const UInt8 signature [] = { 0xFF, 0xD8, 0xFF, 0xE0 };
+		memcpy(bytes.data(), signature, sizeof(signature));
+		for(size_t i = sizeof(signature); i < bytes.size(); ++i)
+			bytes[i] = (UInt8)((i * 2654435761u) >> 24);
+		return SFB::CFData(CFDataCreate(kCFAllocatorDefault, bytes.data(), (CFIndex)bytes.size()));
+	}
+
+	// Copy the file at sourcePath to destinationPath and modify its metadata with block, returning false if the copy can't be written
+	bool CreateVariant(const std::string& sourcePath, const std::string& destinationPath, void (^block)(SFB::Audio::Metadata& metadata))
+	{
+		if(0 != copyfile(sourcePath.c_str(), destinationPath.c_str(), nullptr, COPYFILE_DATA))
+			return false;
+
+		auto url = CreateURL(destinationPath);
+		auto metadata = SFB::Audio::Metadata::CreateMetadataForURL(url);
+		if(!metadata)
+			return false;
+
+		block(*metadata);
+		return metadata->WriteMetadata();
+	}
+
+	// ========================================
+	// Benchmarks
+
+	bool MeasureRead(CFURLRef url, unsigned options, Measurement& measurement, std::string& formatName, SFB::CFError& error)
+	{
+		uint64_t allocationCount = sAllocationCount.load();
+		uint64_t allocatedBytes = sAllocatedBytes.load();
+		uint64_t startTime = mach_absolute_time();
+
+		auto inputSource = SFB::InputSource::CreateForURL(url, 0, &error);
+		if(!inputSource)
+			return false;
+
+		CountingInputSource countingInputSource(std::move(inputSource));
+		auto metadata = SFB::Audio::Metadata::CreateMetadataForInputSource(countingInputSource, options, &error);
+		if(!metadata)
+			return false;
+
+		measurement.mSeconds = ConvertHostTimeToSeconds(mach_absolute_time() - startTime);
+		measurement.mBytesRead = countingInputSource.GetBytesRead();
+		measurement.mAllocationCount = sAllocationCount.load() - allocationCount;
+		measurement.mAllocatedBytes = sAllocatedBytes.load() - allocatedBytes;
+
+		formatName = ConvertToUTF8(metadata->GetFormatName());
+
+		return true;
+	}
+
+	bool MeasureWrite(CFURLRef url, int iteration, Measurement& measurement, SFB::CFError& error)
+	{
+		auto metadata = SFB::Audio::Metadata::CreateMetadataForURL(url, &error);
+		if(!metadata)
+			return false;
+
+		// Alternate the title so each write changes the file
+		SFB::CFString title(CFStringCreateWithFormat(kCFAllocatorDefault, nullptr, CFSTR("MetadataBenchmark %d"), iteration));
+		metadata->SetTitle(title);
+
+		uint64_t allocationCount = sAllocationCount.load();
+		uint64_t allocatedBytes = sAllocatedBytes.load();
+		uint64_t startTime = mach_absolute_time();
+
+		if(!metadata->WriteMetadata(&error))
+			return false;
+
+		measurement.mSeconds = ConvertHostTimeToSeconds(mach_absolute_time() - startTime);
+		measurement.mBytesRead = 0;
+		measurement.mAllocationCount = sAllocationCount.load() - allocationCount;
+		measurement.mAllocatedBytes = sAllocatedBytes.load() - allocatedBytes;
+
+		return true;
+	}
+
+	void PrintMeasurement(const char *name, const Measurement& measurement)
+	{
+		printf("\"%s\":{\"seconds\":%.6f,\"files_per_second\":%.1f,\"bytes_read\":%llu,\"allocations\":%llu,\"allocated_bytes\":%llu}",
+			   name, measurement.mSeconds, 0 < measurement.mSeconds ? 1 / measurement.mSeconds : 0,
+			   measurement.mBytesRead, measurement.mAllocationCount, measurement.mAllocatedBytes);
+	}
+
+	// Benchmark one file, which is written to only if writable is true
+	bool BenchmarkFile(const std::string& path, const std::string& originalPath, const char *variant, bool writable, int iterationCount)
+	{
+		auto url = CreateURL(path);
+		std::string extension = GetExtension(url);
+		std::string formatName;
+		SFB::CFError error;
+
+		// The fastest iteration is reported since it is least affected by other system activity
+		Measurement reads [2] = {};
+		const unsigned readOptions [2] = { SFB::Audio::Metadata::ReadAll, SFB::Audio::Metadata::ReadAll | SFB::Audio::Metadata::LoadAttachedPicturesOnDemand };
+		bool succeeded = true;
+
+		for(int i = 0; i < 2 && succeeded; ++i) {
+			for(int iteration = 0; iteration < iterationCount; ++iteration) {
+				Measurement measurement = {};
+				if(!MeasureRead(url, readOptions[i], measurement, formatName, error)) {
+					succeeded = false;
+					break;
+				}
+
+				if(0 == iteration || measurement.mSeconds < reads[i].mSeconds)
+					reads[i] = measurement;
+			}
+		}
+
+		// Formats not supporting writing are reported without write measurements
+		Measurement write = {};
+		bool wrote = false;
+		if(succeeded && writable) {
+			wrote = true;
+			for(int iteration = 0; iteration < iterationCount; ++iteration) {
+				Measurement measurement = {};
+				SFB::CFError writeError;
+				if(!MeasureWrite(url, iteration, measurement, writeError)) {
+					wrote = false;
+					break;
+				}
+
+				if(0 == iteration || measurement.mSeconds < write.mSeconds)
+					write = measurement;
+			}
+		}
+
+		if(!succeeded) {
+			SFB::CFString description(error ? CFErrorCopyDescription(error) : nullptr);
+			printf("{\"file\":\"%s\",\"extension\":\"%s\",\"variant\":\"%s\",\"status\":\"error\",\"error\":\"%s\"}\n",
+				   EscapeJSON(originalPath).c_str(), EscapeJSON(extension).c_str(), variant, EscapeJSON(ConvertToUTF8(description)).c_str());
+			fflush(stdout);
+			return false;
+		}
+
+		printf("{\"file\":\"%s\",\"extension\":\"%s\",\"variant\":\"%s\",\"status\":\"ok\",\"format\":\"%s\",\"file_bytes\":%lld,",
+			   EscapeJSON(originalPath).c_str(), EscapeJSON(extension).c_str(), variant, EscapeJSON(formatName).c_str(), GetFileSize(path));
+		PrintMeasurement("read", reads[0]);
+		printf(",");
+		PrintMeasurement("read_pictures_on_demand", reads[1]);
+		if(wrote) {
+			printf(",");
+			PrintMeasurement("write", write);
+		}
+		printf("}\n");
+		fflush(stdout);
+
+		return true;
+	}
+
+	void PrintUsage(const char *name)
+	{
+		fprintf(stderr, "Usage: %s [-n iterations] [-p picture-bytes] [-t tag-bytes] corpus-directory\n", name);
+	}
+
+}
+
+int main(int argc, char *argv [])
+{
+	int iterationCount = DEFAULT_ITERATION_COUNT;
+	size_t pictureBytes = DEFAULT_PICTURE_BYTES;
+	size_t tagBytes = DEFAULT_TAG_BYTES;
+
+	int ch;
+	while(-1 != (ch = getopt(argc, argv, "n:p:t:"))) {
+		switch(ch) {
+			case 'n':
+				iterationCount = atoi(optarg);
+				break;
+			case 'p':
+				pictureBytes = (size_t)strtoull(optarg, nullptr, 10);
+				break;
+			case 't':
+				tagBytes = (size_t)strtoull(optarg, nullptr, 10);
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(optind + 1 != argc || 1 > iterationCount) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	auto corpus = CreateURL(argv[optind], true);
+	if(!corpus) {
+		fprintf(stderr, "Invalid corpus directory: %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	// Variants and written copies are created in a temporary directory so the corpus is unchanged
+	char temporaryDirectory [] = "/tmp/MetadataBenchmark.XXXXXX";
+	if(nullptr == mkdtemp(temporaryDirectory)) {
+		fprintf(stderr, "Unable to create temporary directory: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	SFB::CFString comment(CreateString(tagBytes));
+	SFB::CFData pictureData(CreatePictureData(pictureBytes));
+
+	auto urls = CollectFiles(corpus, SFB::Audio::Metadata::HandlesFilesWithExtension);
+	std::vector<std::string> benchmarkedExtensions;
+	bool failed = false;
+	int fileNumber = 0;
+
+	for(const auto& url : urls) {
+		std::string path = GetPath(url);
+		std::string extension = GetExtension(url);
+		benchmarkedExtensions.push_back(extension);
+
+		std::string basePath = std::string(temporaryDirectory) + "/" + std::to_string(fileNumber++);
+
+		// The original is written to only as a copy
+		std::string copyPath = basePath + "." + extension;
+		bool writable = 0 == copyfile(path.c_str(), copyPath.c_str(), nullptr, COPYFILE_DATA);
+		failed |= !BenchmarkFile(writable ? copyPath : path, path, "original", writable, iterationCount);
+
+		std::string largeTagsPath = basePath + "-large_tags." + extension;
+		if(CreateVariant(path, largeTagsPath, ^(SFB::Audio::Metadata& metadata) {
+			metadata.SetComment(comment);
+			metadata.SetLyrics(comment);
+		}))
+			failed |= !BenchmarkFile(largeTagsPath, path, "large_tags", true, iterationCount);
+
+		std::string largeArtPath = basePath + "-large_art." + extension;
+		if(CreateVariant(path, largeArtPath, ^(SFB::Audio::Metadata& metadata) {
+			metadata.RemoveAllAttachedPictures();
+			metadata.AttachPicture(std::make_shared<SFB::Audio::AttachedPicture>(pictureData, SFB::Audio::AttachedPicture::Type::FrontCover));
+		}))
+			failed |= !BenchmarkFile(largeArtPath, path, "large_art", true, iterationCount);
+
+		unlink(copyPath.c_str());
+		unlink(largeTagsPath.c_str());
+		unlink(largeArtPath.c_str());
+	}
+
+	rmdir(temporaryDirectory);
+
+	// Report the supported formats without coverage so gaps in the corpus are visible
+	SFB::CFArray supportedExtensions(SFB::Audio::Metadata::CreateSupportedFileExtensions());
+	for(CFIndex i = 0; i < CFArrayGetCount(supportedExtensions); ++i) {
+		auto extension = ConvertToUTF8((CFStringRef)CFArrayGetValueAtIndex(supportedExtensions, i));
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+		if(benchmarkedExtensions.end() == std::find(benchmarkedExtensions.begin(), benchmarkedExtensions.end(), extension))
+			printf("{\"extension\":\"%s\",\"status\":\"no_corpus\"}\n", EscapeJSON(extension).c_str());
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
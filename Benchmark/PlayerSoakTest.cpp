@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// Plays shuffled playlists on many players at once, each rendering in real time without an audio device, while
+// seeking and skipping at random, and prints one JSON object per report interval describing the process's use of
+// resources and the players' underruns
+// Usage: PlayerSoakTest [-n players] [-d seconds] [-i seconds] [-s seed] [-u underruns] file...
+//   -n		The number of players (default 16)
+//   -d		The duration of the test (default 3600)
+//   -i		The report interval (default 60)
+//   -s		The random number seed (default 1)
+//   -u		Exit with failure if more than this many underruns occur in total (default unlimited)
+//
+// Each report includes the process's CPU time and context switches, the decoding thread wakeups and underruns
+// of all players, and the resident and physical footprint and their growth since the first report.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <libproc.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <SFBAudioEngine/AudioPlayer.h>
+#include <SFBAudioEngine/CFWrapper.h>
+#include <SFBAudioEngine/OfflineOutput.h>
+
+#include "BenchmarkUtilities.h"
+
+#define DEFAULT_PLAYER_COUNT 16
+#define DEFAULT_DURATION_SECONDS 3600
+#define DEFAULT_REPORT_INTERVAL_SECONDS 60
+#define OUTPUT_BUFFER_FRAMES 512
+#define ACTION_INTERVAL_MSEC 250
+
+namespace {
+
+	using SFB::Benchmark::ConvertHostTimeToSeconds;
+
+	// ========================================
+	// The process's resource usage
+	struct ProcessUsage
+	{
+		double		mCPUTime;				// User and system time in seconds
+		uint64_t	mContextSwitches;		// Voluntary and involuntary context switches
+		uint64_t	mInterruptWakeups;		// Wakeups from interrupts, including timers
+		uint64_t	mResidentSize;			// Resident size in bytes
+		uint64_t	mPhysicalFootprint;		// Physical footprint in bytes
+	};
+
+	bool GetProcessUsage(ProcessUsage& usage)
+	{
+		struct rusage rusage;
+		if(-1 == getrusage(RUSAGE_SELF, &rusage))
+			return false;
+
+		usage.mCPUTime = rusage.ru_utime.tv_sec + rusage.ru_utime.tv_usec / 1e6 + rusage.ru_stime.tv_sec + rusage.ru_stime.tv_usec / 1e6;
+		usage.mContextSwitches = (uint64_t)(rusage.ru_nvcsw + rusage.ru_nivcsw);
+
+		rusage_info_v2 info;
+		if(0 != proc_pid_rusage(getpid(), RUSAGE_INFO_V2, (rusage_info_t *)&info))
+			return false;
+
+		usage.mInterruptWakeups = info.ri_interrupt_wkups;
+		usage.mPhysicalFootprint = info.ri_phys_footprint;
+
+		mach_task_basic_info_data_t taskInfo;
+		mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+		if(KERN_SUCCESS != task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&taskInfo, &count))
+			return false;
+
+		usage.mResidentSize = taskInfo.resident_size;
+
+		return true;
+	}
+
+	// ========================================
+	// A player with its shuffled playlist
+	class SoakPlayer
+	{
+
+	public:
+
+		SoakPlayer(const std::vector<SFB::CFURL>& files, unsigned seed)
+			: mFiles(files), mGenerator(seed), mNextFile(0), mEnqueuedCount(0), mDecodingStartedCount(0), mEnqueueFailureCount(0)
+		{
+			std::shuffle(mFiles.begin(), mFiles.end(), mGenerator);
+
+			mPlayer.SetOutput(SFB::Audio::Output::unique_ptr(new SFB::Audio::OfflineOutput(OUTPUT_BUFFER_FRAMES, true)));
+
+			auto decodingStartedCount = &mDecodingStartedCount;
+			mPlayer.SetDecodingStartedBlock(^(const SFB::Audio::Decoder& /*decoder*/) {
+				decodingStartedCount->fetch_add(1);
+			});
+		}
+
+		~SoakPlayer()
+		{
+			mPlayer.SetDecodingStartedBlock(nullptr);
+			mPlayer.Stop();
+		}
+
+		// Keep a track queued behind the one decoding, and occasionally seek or skip
+		void PerformAction()
+		{
+			while(mEnqueuedCount <= mDecodingStartedCount.load() + 1)
+				EnqueueNextFile();
+
+			if(mPlayer.IsStopped()) {
+				mPlayer.Play();
+				return;
+			}
+
+			std::uniform_int_distribution<int> action(0, 99);
+			auto value = action(mGenerator);
+
+			// Seeks test flushing the ring buffer and skips test transitions between formats
+			if(5 > value) {
+				std::uniform_real_distribution<float> position(0, 0.95f);
+				mPlayer.SeekToPosition(position(mGenerator));
+			}
+			else if(7 > value)
+				mPlayer.SkipToNextTrack();
+		}
+
+		inline SFB::Audio::Player::PlaybackStatistics GetPlaybackStatistics() const		{ return mPlayer.GetPlaybackStatistics(); }
+		inline uint64_t GetEnqueueFailureCount() const			{ return mEnqueueFailureCount; }
+
+	private:
+
+		void EnqueueNextFile()
+		{
+			const auto& url = mFiles[mNextFile];
+			if(++mNextFile == mFiles.size()) {
+				mNextFile = 0;
+				std::shuffle(mFiles.begin(), mFiles.end(), mGenerator);
+			}
+
+			// Files that can't be enqueued still advance the count so the loop ends
+			if(!mPlayer.Enqueue(url)) {
+				++mEnqueueFailureCount;
+				mDecodingStartedCount.fetch_add(1);
+			}
+			++mEnqueuedCount;
+		}
+
+		SFB::Audio::Player				mPlayer;
+		std::vector<SFB::CFURL>			mFiles;
+		std::mt19937					mGenerator;
+		size_t							mNextFile;
+		uint64_t						mEnqueuedCount;
+		std::atomic_ullong				mDecodingStartedCount;
+		uint64_t						mEnqueueFailureCount;
+
+	};
+
+	void PrintUsage(const char *name)
+	{
+		fprintf(stderr, "Usage: %s [-n players] [-d seconds] [-i seconds] [-s seed] [-u underruns] file...\n", name);
+	}
+
+}
+
+int main(int argc, char *argv [])
+{
+	int playerCount = DEFAULT_PLAYER_COUNT;
+	double duration = DEFAULT_DURATION_SECONDS;
+	double reportInterval = DEFAULT_REPORT_INTERVAL_SECONDS;
+	unsigned seed = 1;
+	long long maximumUnderruns = -1;
+
+	int ch;
+	while(-1 != (ch = getopt(argc, argv, "n:d:i:s:u:"))) {
+		switch(ch) {
+			case 'n':
+				playerCount = atoi(optarg);
+				break;
+			case 'd':
+				duration = atof(optarg);
+				break;
+			case 'i':
+				reportInterval = atof(optarg);
+				break;
+			case 's':
+				seed = (unsigned)strtoul(optarg, nullptr, 10);
+				break;
+			case 'u':
+				maximumUnderruns = atoll(optarg);
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(optind == argc || 1 > playerCount || 0 >= duration || 0 >= reportInterval) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<SFB::CFURL> files;
+	for(int i = optind; i < argc; ++i)
+		files.push_back(SFB::CFURL(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)argv[i], (CFIndex)strlen(argv[i]), false)));
+
+	std::vector<std::unique_ptr<SoakPlayer>> players;
+	for(int i = 0; i < playerCount; ++i)
+		players.push_back(std::unique_ptr<SoakPlayer>(new SoakPlayer(files, seed + (unsigned)i)));
+
+	ProcessUsage initialUsage = {};
+	if(!GetProcessUsage(initialUsage)) {
+		fprintf(stderr, "Unable to read the process's resource usage\n");
+		return EXIT_FAILURE;
+	}
+
+	auto startTime = mach_absolute_time();
+	double nextReport = reportInterval;
+	ProcessUsage lastUsage = initialUsage;
+	double lastReport = 0;
+	uint64_t lastWakeupCount = 0;
+	uint64_t underrunCount = 0;
+
+	for(;;) {
+		for(auto& player : players)
+			player->PerformAction();
+
+		usleep(ACTION_INTERVAL_MSEC * 1000);
+
+		double elapsed = ConvertHostTimeToSeconds(mach_absolute_time() - startTime);
+		if(elapsed < nextReport && elapsed < duration)
+			continue;
+
+		ProcessUsage usage;
+		if(!GetProcessUsage(usage))
+			continue;
+
+		uint64_t wakeupCount = 0;
+		uint64_t enqueueFailureCount = 0;
+		uint64_t renderCycleCount = 0;
+		underrunCount = 0;
+		for(const auto& player : players) {
+			auto statistics = player->GetPlaybackStatistics();
+			wakeupCount += statistics.mDecoderWakeupCount;
+			underrunCount += statistics.mUnderrunCount;
+			renderCycleCount += statistics.mRenderCycleCount;
+			enqueueFailureCount += player->GetEnqueueFailureCount();
+		}
+
+		double interval = elapsed - lastReport;
+		printf("{\"elapsed_seconds\":%.0f,\"players\":%d,\"cpu_percent\":%.1f,\"context_switches_per_second\":%.0f,\"interrupt_wakeups_per_second\":%.0f,\"decoder_wakeups_per_second\":%.1f,\"render_cycles\":%llu,\"underruns\":%llu,\"enqueue_failures\":%llu,\"resident_bytes\":%llu,\"resident_growth_bytes\":%lld,\"footprint_bytes\":%llu,\"footprint_growth_bytes\":%lld}\n",
+			   elapsed, playerCount,
+			   100 * (usage.mCPUTime - lastUsage.mCPUTime) / interval,
+			   (usage.mContextSwitches - lastUsage.mContextSwitches) / interval,
+			   (usage.mInterruptWakeups - lastUsage.mInterruptWakeups) / interval,
+			   (wakeupCount - lastWakeupCount) / interval,
+			   renderCycleCount, underrunCount, enqueueFailureCount,
+			   usage.mResidentSize, (long long)(usage.mResidentSize - initialUsage.mResidentSize),
+			   usage.mPhysicalFootprint, (long long)(usage.mPhysicalFootprint - initialUsage.mPhysicalFootprint));
+		fflush(stdout);
+
+		lastUsage = usage;
+		lastReport = elapsed;
+		lastWakeupCount = wakeupCount;
+		nextReport += reportInterval;
+
+		if(elapsed >= duration)
+			break;
+	}
+
+	players.clear();
+
+	if(0 <= maximumUnderruns && (uint64_t)maximumUnderruns < underrunCount) {
+		fprintf(stderr, "%llu underruns exceeds the maximum of %lld\n", underrunCount, maximumUnderruns);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
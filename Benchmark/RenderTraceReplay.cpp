@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// Replays the output callback schedule recorded by Player::StartRenderTrace() while playing files, and prints a
+// JSON object comparing the underruns and decoding times of the replay with those of the recording
+// Usage: RenderTraceReplay [-c frames] [-w frames] trace-file audio-file...
+//   -c		The ring buffer capacity (default the recorded capacity)
+//   -w		The ring buffer write chunk size (default the recorded chunk size)
+//
+// The callbacks are replayed at their recorded offsets and sizes; the decoding is performed by this machine's
+// decoders, so the files should be those played when the trace was recorded.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <SFBAudioEngine/AudioPlayer.h>
+#include <SFBAudioEngine/CFWrapper.h>
+#include <SFBAudioEngine/RenderTrace.h>
+#include <SFBAudioEngine/TraceReplayOutput.h>
+
+namespace {
+
+	// Render events in which the ring buffer held fewer frames than were requested
+	struct UnderrunSummary
+	{
+		uint64_t	mCallbackCount;
+		uint64_t	mUnderrunCount;
+	};
+
+	UnderrunSummary SummarizeUnderruns(const std::vector<SFB::Audio::RenderTrace::Event>& events)
+	{
+		UnderrunSummary summary = {};
+		for(const auto& event : events) {
+			if(SFB::Audio::RenderTrace::EventType::Render != event.mType)
+				continue;
+			++summary.mCallbackCount;
+			if(event.mFramesBuffered < event.mFrameCount)
+				++summary.mUnderrunCount;
+		}
+		return summary;
+	}
+
+	// Durations of the recorded decoded chunks, in nanoseconds
+	std::vector<uint32_t> GetDecodeDurations(const std::vector<SFB::Audio::RenderTrace::Event>& events)
+	{
+		std::vector<uint32_t> durations;
+		for(const auto& event : events) {
+			if(SFB::Audio::RenderTrace::EventType::DecodeChunk == event.mType)
+				durations.push_back(event.mDuration);
+		}
+		std::sort(durations.begin(), durations.end());
+		return durations;
+	}
+
+	void PrintUsage(const char *name)
+	{
+		fprintf(stderr, "Usage: %s [-c frames] [-w frames] trace-file audio-file...\n", name);
+	}
+
+}
+
+int main(int argc, char *argv [])
+{
+	uint32_t capacity = 0;
+	uint32_t chunkSize = 0;
+
+	int ch;
+	while(-1 != (ch = getopt(argc, argv, "c:w:"))) {
+		switch(ch) {
+			case 'c':
+				capacity = (uint32_t)strtoul(optarg, nullptr, 10);
+				break;
+			case 'w':
+				chunkSize = (uint32_t)strtoul(optarg, nullptr, 10);
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(2 > argc - optind) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char *traceFile = argv[optind];
+	SFB::CFURL traceURL(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)traceFile, (CFIndex)strlen(traceFile), false));
+
+	SFB::Audio::RenderTrace::Configuration configuration;
+	std::vector<SFB::Audio::RenderTrace::Event> events;
+	if(!SFB::Audio::RenderTrace::ReadFromFile(traceURL, configuration, events)) {
+		fprintf(stderr, "Unable to read %s\n", traceFile);
+		return EXIT_FAILURE;
+	}
+
+	if(0 == capacity)
+		capacity = configuration.mRingBufferCapacity;
+	if(0 == chunkSize)
+		chunkSize = configuration.mRingBufferWriteChunkSize;
+
+	auto output = new SFB::Audio::TraceReplayOutput(configuration, events);
+
+	SFB::Audio::Player player;
+	if(!player.SetOutput(SFB::Audio::Output::unique_ptr(output))) {
+		fprintf(stderr, "Unable to set output\n");
+		return EXIT_FAILURE;
+	}
+
+	if(!player.SetRingBufferCapacity(capacity) || !player.SetRingBufferWriteChunkSize(chunkSize)) {
+		fprintf(stderr, "Invalid ring buffer capacity %u or write chunk size %u\n", capacity, chunkSize);
+		return EXIT_FAILURE;
+	}
+
+	for(int i = optind + 1; i < argc; ++i) {
+		SFB::CFURL url(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)argv[i], (CFIndex)strlen(argv[i]), false));
+		if(!player.Enqueue(url)) {
+			fprintf(stderr, "Unable to enqueue %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(!player.Play()) {
+		fprintf(stderr, "Unable to play\n");
+		return EXIT_FAILURE;
+	}
+
+	// Stop early if the files end first
+	while(!output->WaitUntilFinished(dispatch_time(DISPATCH_TIME_NOW, 100 * NSEC_PER_MSEC)) && !player.IsStopped())
+		;
+
+	auto statistics = player.GetPlaybackStatistics();
+	player.Stop();
+
+	auto recorded = SummarizeUnderruns(events);
+	auto durations = GetDecodeDurations(events);
+
+	printf("{\"ring_buffer_capacity\":%u,\"write_chunk_size\":%u,", capacity, chunkSize);
+	printf("\"recorded\":{\"callbacks\":%llu,\"underruns\":%llu,\"decode_chunks\":%zu,\"decode_p50_us\":%.1f,\"decode_max_us\":%.1f},",
+		   recorded.mCallbackCount, recorded.mUnderrunCount, durations.size(),
+		   durations.empty() ? 0 : durations[durations.size() / 2] / 1000.0,
+		   durations.empty() ? 0 : durations.back() / 1000.0);
+	printf("\"replayed\":{\"callbacks\":%zu,\"underruns\":%llu,\"decode_chunks\":%llu,\"decode_average_us\":%.1f,\"decode_max_us\":%.1f,\"maximum_lateness_us\":%.1f}}\n",
+		   output->GetCallbacksReplayed(), statistics.mUnderrunCount, statistics.mDecodeChunkCount,
+		   statistics.mAverageDecodeChunkTime * 1e6, statistics.mMaximumDecodeChunkTime * 1e6,
+		   output->GetMaximumLateness() / 1000.0);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// Measures the time taken by each render callback and prints one JSON object per configuration
+// Usage: RingBufferBenchmark [-d seconds] [-f file]
+//   -d		The duration of each configuration in seconds (default 1)
+//   -f		Also measure Player::ProvideAudio() while playing file
+//
+// The consumer runs on a time constraint thread paced like an audio device.  For ring buffers a producer thread
+// refills the buffer in chunks as the decoding thread does.  Callback times are reported as percentiles in microseconds.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <dispatch/dispatch.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <SFBAudioEngine/AudioBufferList.h>
+#include <SFBAudioEngine/AudioFormat.h>
+#include <SFBAudioEngine/AudioOutput.h>
+#include <SFBAudioEngine/AudioPlayer.h>
+#include <SFBAudioEngine/AudioRingBuffer.h>
+#include <SFBAudioEngine/CFWrapper.h>
+
+#include "BenchmarkUtilities.h"
+
+#define SAMPLE_RATE 44100
+#define DEFAULT_DURATION_SECONDS 1.
+
+namespace {
+
+	using SFB::Benchmark::ConvertHostTimeToMicros;
+	using SFB::Benchmark::MakeFormat;
+
+	// ========================================
+	// Convert nanoseconds to host time
+	uint64_t ConvertNanosToHostTime(uint64_t nanos)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (nanos * sTimebaseInfo.denom) / sTimebaseInfo.numer;
+	}
+
+	// ========================================
+	// Give the calling thread real-time scheduling for callbacks recurring every period host time units
+	bool SetTimeConstraintPolicy(uint64_t period)
+	{
+		thread_time_constraint_policy_data_t policy = {
+			.period			= (uint32_t)period,
+			.computation	= (uint32_t)(period / 4),
+			.constraint		= (uint32_t)(period / 2),
+			.preemptible	= true
+		};
+
+		kern_return_t result = thread_policy_set(mach_thread_self(), THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t)&policy, THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+		return KERN_SUCCESS == result;
+	}
+
+	// ========================================
+	// Callback durations recorded on the real-time thread without allocating
+	class LatencyRecorder
+	{
+
+	public:
+
+		explicit LatencyRecorder(size_t capacity)
+			: mSamples(capacity, 0), mCount(0), mUnderrunCount(0)
+		{}
+
+		inline void Record(uint64_t duration, bool underrun)
+		{
+			if(mCount < mSamples.size())
+				mSamples[mCount++] = duration;
+			if(underrun)
+				++mUnderrunCount;
+		}
+
+		inline size_t GetCount() const				{ return mCount; }
+		inline bool IsFull() const					{ return mCount == mSamples.size(); }
+		inline uint64_t GetUnderrunCount() const	{ return mUnderrunCount; }
+
+		// Sorts the samples, so call only after recording is finished
+		void PrintPercentiles()
+		{
+			std::sort(mSamples.begin(), mSamples.begin() + (ptrdiff_t)mCount);
+			printf("\"callbacks\":%zu,\"underruns\":%llu,\"p50_us\":%.2f,\"p99_us\":%.2f,\"p999_us\":%.2f,\"max_us\":%.2f",
+				   mCount, mUnderrunCount, Percentile(0.5), Percentile(0.99), Percentile(0.999), Percentile(1));
+		}
+
+	private:
+
+		double Percentile(double p) const
+		{
+			if(0 == mCount)
+				return 0;
+			size_t index = std::min(mCount - 1, (size_t)(p * (mCount - 1) + 0.5));
+			return ConvertHostTimeToMicros(mSamples[index]);
+		}
+
+		std::vector<uint64_t>	mSamples;
+		size_t					mCount;
+		uint64_t				mUnderrunCount;
+
+	};
+
+	// ========================================
+	// Benchmark RingBuffer::ReadAudio() and WriteAudio() with a real-time consumer and a chunked producer
+	bool BenchmarkRingBuffer(const SFB::Audio::AudioFormat& format, size_t capacityFrames, UInt32 writeChunkFrames, UInt32 ioFrames, double duration)
+	{
+		SFB::Audio::RingBuffer ringBuffer;
+		if(!ringBuffer.Allocate(format, capacityFrames))
+			return false;
+
+		SFB::Audio::BufferList producerBuffer(format, writeChunkFrames);
+		SFB::Audio::BufferList consumerBuffer(format, ioFrames);
+		if(!producerBuffer || !consumerBuffer)
+			return false;
+
+		for(UInt32 i = 0; i < producerBuffer->mNumberBuffers; ++i)
+			memset(producerBuffer->mBuffers[i].mData, 0, producerBuffer->mBuffers[i].mDataByteSize);
+
+		uint64_t period = ConvertNanosToHostTime((uint64_t)((ioFrames * (double)NSEC_PER_SEC) / format.mSampleRate));
+		size_t callbackCount = (size_t)(duration * format.mSampleRate / ioFrames) + 1;
+
+		LatencyRecorder recorder(callbackCount);
+		dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+		std::atomic_bool running(true);
+
+		// Fill the buffer before starting, as the player prebuffers before rendering
+		while(ringBuffer.GetFramesAvailableToWrite() >= writeChunkFrames)
+			ringBuffer.WriteAudio(producerBuffer, writeChunkFrames);
+
+		// The producer writes whole chunks when space is available and otherwise waits for the consumer, like the decoding thread
+		std::thread producer([&] {
+			while(running.load()) {
+				if(ringBuffer.GetFramesAvailableToWrite() >= writeChunkFrames)
+					ringBuffer.WriteAudio(producerBuffer, writeChunkFrames);
+				else
+					dispatch_semaphore_wait(semaphore, dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_MSEC));
+			}
+		});
+
+		std::thread consumer([&] {
+			SetTimeConstraintPolicy(period);
+
+			uint64_t deadline = mach_absolute_time();
+			for(size_t i = 0; i < callbackCount; ++i) {
+				deadline += period;
+				mach_wait_until(deadline);
+
+				uint64_t startTime = mach_absolute_time();
+				consumerBuffer.Reset();
+				size_t framesRead = ringBuffer.ReadAudio(consumerBuffer, ioFrames);
+				recorder.Record(mach_absolute_time() - startTime, framesRead < ioFrames);
+
+				dispatch_semaphore_signal(semaphore);
+			}
+		});
+
+		consumer.join();
+		running.store(false);
+		dispatch_semaphore_signal(semaphore);
+		producer.join();
+
+		dispatch_release(semaphore);
+
+		printf("{\"benchmark\":\"ring_buffer\",\"channels\":%u,\"float\":%s,\"interleaved\":%s,\"capacity_frames\":%zu,\"write_chunk_frames\":%u,\"io_frames\":%u,",
+			   format.mChannelsPerFrame, (kAudioFormatFlagIsFloat & format.mFormatFlags) ? "true" : "false", format.IsInterleaved() ? "true" : "false",
+			   capacityFrames, writeChunkFrames, ioFrames);
+		recorder.PrintPercentiles();
+		printf("}\n");
+		fflush(stdout);
+
+		return true;
+	}
+
+	// ========================================
+	// An output pulling audio from its player on a time constraint thread at the rate of an audio device
+	class PacedOutput : public SFB::Audio::Output
+	{
+
+	public:
+
+		PacedOutput(UInt32 ioFrames, size_t callbackCount)
+			: mIOFrames(ioFrames), mRecorder(callbackCount), mIsOpen(false), mIsRunning(false), mFinished(dispatch_semaphore_create(0))
+		{}
+
+		virtual ~PacedOutput()
+		{
+			if(_IsOpen())
+				_Close();
+			dispatch_release(mFinished);
+		}
+
+		// Wait until the recorder is full, returning false on timeout
+		bool WaitUntilFinished(dispatch_time_t timeout)
+		{
+			return 0 == dispatch_semaphore_wait(mFinished, timeout);
+		}
+
+		inline LatencyRecorder& GetRecorder()				{ return mRecorder; }
+
+	private:
+
+		virtual bool _Open()								{ mIsOpen.store(true); return true; }
+		virtual bool _Close()
+		{
+			_Stop();
+			mBufferList.Deallocate();
+			mIsOpen.store(false);
+			return true;
+		}
+
+		virtual bool _Start()
+		{
+			if(!mBufferList || mIsRunning.load())
+				return false;
+
+			mIsRunning.store(true);
+			mRenderThread = std::thread(&PacedOutput::RenderThreadEntry, this);
+			return true;
+		}
+
+		virtual bool _Stop()
+		{
+			mIsRunning.store(false);
+			if(mRenderThread.joinable() && std::this_thread::get_id() != mRenderThread.get_id())
+				mRenderThread.join();
+			return true;
+		}
+
+		virtual bool _RequestStop()							{ mIsRunning.store(false); return true; }
+
+		virtual bool _IsOpen() const						{ return mIsOpen.load(); }
+		virtual bool _IsRunning() const						{ return mIsRunning.load(); }
+
+		virtual bool _Reset()								{ return true; }
+
+		virtual bool _SupportsFormat(const SFB::Audio::AudioFormat& format) const	{ return format.IsPCM(); }
+
+		virtual bool _SetupForDecoder(const SFB::Audio::Decoder& decoder)
+		{
+			const auto& decoderFormat = decoder.GetFormat();
+			if(!decoderFormat.IsPCM())
+				return false;
+
+			bool running = _IsRunning();
+			if(running)
+				_Stop();
+
+			// Render deinterleaved floats like CoreAudioOutput
+			mFormat.mFormatID			= kAudioFormatLinearPCM;
+			mFormat.mFormatFlags		= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+			mFormat.mSampleRate			= decoderFormat.mSampleRate;
+			mFormat.mChannelsPerFrame	= decoderFormat.mChannelsPerFrame;
+			mFormat.mBitsPerChannel		= 32;
+			mFormat.mBytesPerPacket		= sizeof(float);
+			mFormat.mFramesPerPacket	= 1;
+			mFormat.mBytesPerFrame		= sizeof(float);
+			mFormat.mReserved			= 0;
+
+			mChannelLayout = decoder.GetChannelLayout();
+
+			if(!mBufferList.Allocate(mFormat, mIOFrames))
+				return false;
+
+			return running ? _Start() : true;
+		}
+
+		virtual size_t _GetPreferredBufferSize() const		{ return mIOFrames; }
+
+		void RenderThreadEntry()
+		{
+			uint64_t period = ConvertNanosToHostTime((uint64_t)((mIOFrames * (double)NSEC_PER_SEC) / mFormat.mSampleRate));
+			SetTimeConstraintPolicy(period);
+
+			AudioTimeStamp timeStamp = {};
+			timeStamp.mFlags = kAudioTimeStampSampleTimeValid | kAudioTimeStampHostTimeValid;
+			timeStamp.mRateScalar = 1;
+
+			uint64_t deadline = mach_absolute_time();
+			while(mIsRunning.load()) {
+				deadline += period;
+				mach_wait_until(deadline);
+
+				timeStamp.mHostTime = mach_absolute_time();
+
+				bool underrun = mPlayer->GetFramesAvailableToRender() < mIOFrames;
+
+				uint64_t startTime = mach_absolute_time();
+				mBufferList.Reset();
+				mPlayer->ProvideAudio(mBufferList, mIOFrames, &timeStamp);
+				mRecorder.Record(mach_absolute_time() - startTime, underrun);
+
+				timeStamp.mSampleTime += mIOFrames;
+
+				if(mRecorder.IsFull()) {
+					dispatch_semaphore_signal(mFinished);
+					break;
+				}
+			}
+		}
+
+		UInt32						mIOFrames;
+		SFB::Audio::BufferList		mBufferList;
+		LatencyRecorder				mRecorder;
+		std::thread					mRenderThread;
+		std::atomic_bool			mIsOpen;
+		std::atomic_bool			mIsRunning;
+		dispatch_semaphore_t		mFinished;
+
+	};
+
+	// ========================================
+	// Benchmark Player::ProvideAudio() while playing url
+	bool BenchmarkPlayer(CFURLRef url, UInt32 ioFrames, double duration)
+	{
+		// The callback count is estimated at the benchmark sample rate; files at other rates run proportionally longer or shorter
+		size_t callbackCount = (size_t)(duration * SAMPLE_RATE / ioFrames) + 1;
+
+		auto output = new PacedOutput(ioFrames, callbackCount);
+
+		SFB::Audio::Player player;
+		if(!player.SetOutput(SFB::Audio::Output::unique_ptr(output)) || !player.Play(url))
+			return false;
+
+		// Stop early if the file ends first
+		while(!output->WaitUntilFinished(dispatch_time(DISPATCH_TIME_NOW, 100 * NSEC_PER_MSEC)) && !player.IsStopped())
+			;
+		player.Stop();
+
+		printf("{\"benchmark\":\"player\",\"io_frames\":%u,", ioFrames);
+		output->GetRecorder().PrintPercentiles();
+		printf("}\n");
+		fflush(stdout);
+
+		return true;
+	}
+
+	void PrintUsage(const char *name)
+	{
+		fprintf(stderr, "Usage: %s [-d seconds] [-f file]\n", name);
+	}
+
+}
+
+int main(int argc, char *argv [])
+{
+	double duration = DEFAULT_DURATION_SECONDS;
+	const char *file = nullptr;
+
+	int ch;
+	while(-1 != (ch = getopt(argc, argv, "d:f:"))) {
+		switch(ch) {
+			case 'd':
+				duration = atof(optarg);
+				break;
+			case 'f':
+				file = optarg;
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(optind != argc || 0 >= duration) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Ring buffer capacities and write chunk sizes around the player's RING_BUFFER_CAPACITY_FRAMES and RING_BUFFER_WRITE_CHUNK_SIZE_FRAMES
+	const std::pair<size_t, UInt32> ringBufferSizes [] = { { 4096, 1024 }, { 16384, 2048 }, { 65536, 8192 } };
+	const UInt32 channelCounts [] = { 1, 2, 6, 8 };
+	const UInt32 ioSizes [] = { 64, 128, 256, 512, 1024, 2048, 4096 };
+
+	bool failed = false;
+
+	for(auto channelCount : channelCounts) {
+		// The player's ring buffer holds deinterleaved floats; interleaved integers are included for comparison
+		for(auto isFloat : { true, false }) {
+			auto format = MakeFormat(SAMPLE_RATE, channelCount, isFloat, !isFloat);
+
+			for(const auto& ringBufferSize : ringBufferSizes) {
+				for(auto ioFrames : ioSizes) {
+					if(ioFrames > ringBufferSize.first - ringBufferSize.second)
+						continue;
+
+					if(!BenchmarkRingBuffer(format, ringBufferSize.first, ringBufferSize.second, ioFrames, duration)) {
+						fprintf(stderr, "Unable to allocate buffers\n");
+						failed = true;
+					}
+				}
+			}
+		}
+	}
+
+	if(file) {
+		SFB::CFURL url(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)file, (CFIndex)strlen(file), false));
+
+		for(auto ioFrames : ioSizes) {
+			if(!BenchmarkPlayer(url, ioFrames, duration)) {
+				fprintf(stderr, "Unable to play %s\n", file);
+				failed = true;
+				break;
+			}
+		}
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
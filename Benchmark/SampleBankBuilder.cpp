@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// Decodes files into a sample bank for SampleBank::CreateForURL(), and prints one JSON object per clip and a
+// summary, including the time taken to open the bank
+// Usage: SampleBankBuilder [-r rate] [-c channels] [-i] [-s] bank-file file...
+//   -r		The sample rate of the clips (default 48000)
+//   -c		The number of channels in the clips (default 2)
+//   -i		Write interleaved audio (default non-interleaved)
+//   -s		Write 16-bit integer audio (default 32-bit float)
+//
+// Each clip is named for its file without the extension.  The clips should be written in the format of the
+// player's output so no conversion is performed when they are rendered.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <mach/mach_time.h>
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <SFBAudioEngine/AudioFormat.h>
+#include <SFBAudioEngine/CFWrapper.h>
+#include <SFBAudioEngine/ClipCache.h>
+#include <SFBAudioEngine/SampleBank.h>
+
+#include "BenchmarkUtilities.h"
+
+#define DEFAULT_SAMPLE_RATE 48000
+#define DEFAULT_CHANNEL_COUNT 2
+
+namespace {
+
+	using SFB::Benchmark::ConvertHostTimeToSeconds;
+	using SFB::Benchmark::MakeFormat;
+
+	// The file name without its extension
+	CFStringRef CreateClipName(CFURLRef url) CF_RETURNS_RETAINED
+	{
+		SFB::CFURL withoutExtension(CFURLCreateCopyDeletingPathExtension(kCFAllocatorDefault, url));
+		return withoutExtension ? CFURLCopyLastPathComponent(withoutExtension) : nullptr;
+	}
+
+	void PrintUsage(const char *name)
+	{
+		fprintf(stderr, "Usage: %s [-r rate] [-c channels] [-i] [-s] bank-file file...\n", name);
+	}
+
+}
+
+int main(int argc, char *argv [])
+{
+	Float64 sampleRate = DEFAULT_SAMPLE_RATE;
+	int channelCount = DEFAULT_CHANNEL_COUNT;
+	bool interleaved = false;
+	bool isFloat = true;
+
+	int ch;
+	while(-1 != (ch = getopt(argc, argv, "r:c:is"))) {
+		switch(ch) {
+			case 'r':
+				sampleRate = atof(optarg);
+				break;
+			case 'c':
+				channelCount = atoi(optarg);
+				break;
+			case 'i':
+				interleaved = true;
+				break;
+			case 's':
+				isFloat = false;
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(2 > argc - optind || 0 >= sampleRate || 1 > channelCount) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	auto format = MakeFormat(sampleRate, (UInt32)channelCount, isFloat, interleaved);
+
+	const char *bankFile = argv[optind];
+	SFB::CFURL bankURL(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)bankFile, (CFIndex)strlen(bankFile), false));
+
+	std::vector<SFB::Audio::SampleBank::NamedClip> clips;
+	bool failed = false;
+
+	for(int i = optind + 1; i < argc; ++i) {
+		SFB::CFURL url(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)argv[i], (CFIndex)strlen(argv[i]), false));
+
+		auto startTime = mach_absolute_time();
+		auto clip = SFB::Audio::Clip::CreateForURL(url, format);
+		auto seconds = ConvertHostTimeToSeconds(mach_absolute_time() - startTime);
+
+		SFB::CFString name(CreateClipName(url));
+		if(!clip || !name) {
+			printf("{\"file\":\"%s\",\"status\":\"error\"}\n", argv[i]);
+			failed = true;
+			continue;
+		}
+
+		printf("{\"file\":\"%s\",\"status\":\"ok\",\"frames\":%u,\"bytes\":%zu,\"decode_ms\":%.2f}\n", argv[i], clip->GetFrameCount(), clip->GetByteCount(), seconds * 1e3);
+		clips.push_back(SFB::Audio::SampleBank::NamedClip(std::move(name), clip));
+	}
+
+	if(failed || !SFB::Audio::SampleBank::WriteToURL(bankURL, clips)) {
+		fprintf(stderr, "Unable to write %s\n", bankFile);
+		return EXIT_FAILURE;
+	}
+
+	// Opening the bank is the startup cost it replaces decoding with
+	auto startTime = mach_absolute_time();
+	auto sampleBank = SFB::Audio::SampleBank::CreateForURL(bankURL);
+	auto openTime = ConvertHostTimeToSeconds(mach_absolute_time() - startTime);
+
+	if(!sampleBank) {
+		fprintf(stderr, "Unable to open %s\n", bankFile);
+		return EXIT_FAILURE;
+	}
+
+	printf("{\"bank\":\"%s\",\"clips\":%zu,\"bytes\":%zu,\"open_us\":%.1f}\n", bankFile, sampleBank->GetClipCount(), sampleBank->GetByteCount(), openTime * 1e6);
+
+	return EXIT_SUCCESS;
+}
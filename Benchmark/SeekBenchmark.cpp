@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// Measures seek latency and accuracy for every file in a corpus directory and prints one JSON object per
+// file, input source and seek pattern
+// Usage: SeekBenchmark [-n seeks] [-s seed] [-u http-base-url] corpus-directory
+//   -n		The number of seeks per pattern (default 50)
+//   -s		The random number seed (default 1)
+//   -u		Also read each file over HTTP from this URL, which must serve the corpus directory,
+//			for example one started with "python3 -m http.server" in the corpus directory
+//
+// The time to first frame includes the seek and the decoding of the first frames following it.  Accuracy is
+// determined by comparing the decoded frames with those at the same position in a linear decode: a seek is exact
+// if they match, shifted if they match at another position nearby, and inexact otherwise (as is common for lossy formats).
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <mach/mach_time.h>
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <SFBAudioEngine/AudioBufferList.h>
+#include <SFBAudioEngine/AudioDecoder.h>
+#include <SFBAudioEngine/CFWrapper.h>
+#include <SFBAudioEngine/InputSource.h>
+
+#include "BenchmarkUtilities.h"
+
+#define DEFAULT_SEEK_COUNT 50
+#define COMPARISON_FRAMES 256					// The frames following each seek compared with the linear decode
+#define MAXIMUM_SHIFT_FRAMES 2048				// The largest seek error detected
+#define BUFFER_SIZE_FRAMES 4096
+
+namespace {
+
+	using SFB::Benchmark::ConvertHostTimeToMicros;
+	using SFB::Benchmark::EscapeJSON;
+	using SFB::Benchmark::GetPath;
+	using SFB::Benchmark::CollectFiles;
+	using SFB::Benchmark::Percentile;
+
+	// The input sources exercised
+	struct InputSourceType
+	{
+		const char	*mName;
+		int			mFlags;
+	};
+
+	const InputSourceType sInputSourceTypes [] = {
+		{ "file",		0 },
+		{ "mmap",		SFB::InputSource::MemoryMapFiles },
+		{ "memory",		SFB::InputSource::LoadFilesInMemory },
+		{ "buffered",	SFB::InputSource::BufferInput },
+		{ "read_ahead",	SFB::InputSource::ReadFilesAhead },
+	};
+
+	// The frames surrounding a seek target in the linear decode, stored per buffer in the decoder's format
+	struct ReferenceWindow
+	{
+		SInt64								mStartFrame;
+		SInt64								mFrameCount;
+		std::vector<std::vector<uint8_t>>	mBuffers;
+	};
+
+	struct SeekResults
+	{
+		std::vector<double>		mTimes;				// Time to first frame in microseconds
+		size_t					mFailureCount;
+		size_t					mExactCount;
+		size_t					mShiftedCount;
+		size_t					mInexactCount;
+		SInt64					mMaximumShift;
+	};
+
+	// ========================================
+	// Open a decoder for url using an input source created with flags
+	SFB::Audio::Decoder::unique_ptr OpenDecoder(CFURLRef url, int flags)
+	{
+		auto inputSource = SFB::InputSource::CreateForURL(url, flags);
+		if(!inputSource)
+			return nullptr;
+
+		auto decoder = SFB::Audio::Decoder::CreateForInputSource(std::move(inputSource));
+		if(!decoder || !decoder->Open())
+			return nullptr;
+
+		return decoder;
+	}
+
+	// ========================================
+	// Decode the file linearly, saving the frames surrounding each target
+	bool ReadReferenceWindows(CFURLRef url, const std::vector<SInt64>& sortedTargets, std::vector<ReferenceWindow>& windows)
+	{
+		auto decoder = OpenDecoder(url, 0);
+		if(!decoder)
+			return false;
+
+		const auto& format = decoder->GetFormat();
+		SInt64 totalFrames = decoder->GetTotalFrames();
+
+		windows.clear();
+		for(auto target : sortedTargets) {
+			ReferenceWindow window;
+			window.mStartFrame = std::max((SInt64)0, target - MAXIMUM_SHIFT_FRAMES);
+			window.mFrameCount = std::min(totalFrames, target + COMPARISON_FRAMES + MAXIMUM_SHIFT_FRAMES) - window.mStartFrame;
+			window.mBuffers.resize(format.IsInterleaved() ? 1 : format.mChannelsPerFrame);
+			windows.push_back(std::move(window));
+		}
+
+		SFB::Audio::BufferList bufferList(format, BUFFER_SIZE_FRAMES);
+		SInt64 frame = 0;
+
+		for(;;) {
+			bufferList.Reset();
+			UInt32 framesRead = decoder->ReadAudio(bufferList, BUFFER_SIZE_FRAMES);
+			if(0 == framesRead)
+				break;
+
+			// Copy the portions of this chunk overlapping each window
+			for(auto& window : windows) {
+				SInt64 start = std::max(frame, window.mStartFrame + (SInt64)format.ByteCountToFrameCount(window.mBuffers[0].size()));
+				SInt64 end = std::min(frame + framesRead, window.mStartFrame + window.mFrameCount);
+				if(start >= end)
+					continue;
+
+				size_t offset = format.FrameCountToByteCount((size_t)(start - frame));
+				size_t length = format.FrameCountToByteCount((size_t)(end - start));
+				for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+					auto data = static_cast<const uint8_t *>(bufferList->mBuffers[i].mData) + offset;
+					window.mBuffers[i].insert(window.mBuffers[i].end(), data, data + length);
+				}
+			}
+
+			frame += framesRead;
+		}
+
+		return true;
+	}
+
+	// ========================================
+	// Determine the error of a seek to the window's target from the frames decoded after it
+	// Returns false if the frames don't appear in the window
+	bool FindShift(const SFB::Audio::AudioFormat& format, const ReferenceWindow& window, SInt64 target, const AudioBufferList *bufferList, UInt32 frameCount, SInt64& shift)
+	{
+		size_t length = format.FrameCountToByteCount(frameCount);
+		SInt64 windowFrames = (SInt64)format.ByteCountToFrameCount(window.mBuffers[0].size());
+
+		auto matchesAt = [&](SInt64 frame) {
+			if(frame < window.mStartFrame || frame + frameCount > window.mStartFrame + windowFrames)
+				return false;
+
+			size_t offset = format.FrameCountToByteCount((size_t)(frame - window.mStartFrame));
+			for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+				if(memcmp(window.mBuffers[i].data() + offset, bufferList->mBuffers[i].mData, length))
+					return false;
+			}
+			return true;
+		};
+
+		// Search outward from the target so the smallest shift is found
+		for(SInt64 distance = 0; distance <= MAXIMUM_SHIFT_FRAMES; ++distance) {
+			if(matchesAt(target + distance)) {
+				shift = distance;
+				return true;
+			}
+			if(distance && matchesAt(target - distance)) {
+				shift = -distance;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// ========================================
+	// Seek to each target in order
+	SeekResults RunSeeks(SFB::Audio::Decoder& decoder, const std::vector<SInt64>& targets, const std::vector<SInt64>& sortedTargets, const std::vector<ReferenceWindow>& windows)
+	{
+		SeekResults results = {};
+		const auto& format = decoder.GetFormat();
+		SFB::Audio::BufferList bufferList(format, COMPARISON_FRAMES);
+		SFB::Audio::BufferList readBuffer(format, COMPARISON_FRAMES);
+
+		for(auto target : targets) {
+			uint64_t startTime = mach_absolute_time();
+
+			if(-1 == decoder.SeekToFrame(target)) {
+				++results.mFailureCount;
+				continue;
+			}
+
+			// Read the comparison frames, which may require several reads
+			UInt32 framesRead = 0;
+			while(framesRead < COMPARISON_FRAMES) {
+				readBuffer.Reset();
+				UInt32 count = decoder.ReadAudio(readBuffer, COMPARISON_FRAMES - framesRead);
+				if(0 == count)
+					break;
+
+				size_t offset = format.FrameCountToByteCount(framesRead);
+				size_t length = format.FrameCountToByteCount(count);
+				for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+					memcpy(static_cast<uint8_t *>(bufferList->mBuffers[i].mData) + offset, readBuffer->mBuffers[i].mData, length);
+
+				framesRead += count;
+			}
+
+			results.mTimes.push_back(ConvertHostTimeToMicros(mach_absolute_time() - startTime));
+
+			// DSD frames aren't byte addressable so accuracy isn't determined
+			if(!format.IsPCM() || 0 == framesRead)
+				continue;
+
+			auto index = (size_t)(std::lower_bound(sortedTargets.begin(), sortedTargets.end(), target) - sortedTargets.begin());
+
+			SInt64 shift = 0;
+			if(!FindShift(format, windows[index], target, bufferList, framesRead, shift))
+				++results.mInexactCount;
+			else if(0 == shift)
+				++results.mExactCount;
+			else {
+				++results.mShiftedCount;
+				results.mMaximumShift = std::max(results.mMaximumShift, std::abs(shift));
+			}
+		}
+
+		return results;
+	}
+
+	void PrintResults(const std::string& path, const char *source, const char *pattern, SeekResults& results)
+	{
+		printf("{\"file\":\"%s\",\"source\":\"%s\",\"pattern\":\"%s\",\"seeks\":%zu,\"failures\":%zu,\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,\"exact\":%zu,\"shifted\":%zu,\"max_shift_frames\":%lld,\"inexact\":%zu}\n",
+			   EscapeJSON(path).c_str(), source, pattern, results.mTimes.size() + results.mFailureCount, results.mFailureCount,
+			   Percentile(results.mTimes, 0.5), Percentile(results.mTimes, 0.99), Percentile(results.mTimes, 1),
+			   results.mExactCount, results.mShiftedCount, results.mMaximumShift, results.mInexactCount);
+		fflush(stdout);
+	}
+
+	// ========================================
+	// Benchmark random and sequential seeks in the file at url read using the given input source
+	void BenchmarkSeeks(CFURLRef url, const std::string& path, const char *source, int flags, const std::vector<SInt64>& randomTargets, const std::vector<SInt64>& sortedTargets, const std::vector<ReferenceWindow>& windows)
+	{
+		for(auto pattern : { "random", "sequential" }) {
+			// A new decoder ensures no pattern benefits from data cached by another
+			auto decoder = OpenDecoder(url, flags);
+			if(!decoder) {
+				printf("{\"file\":\"%s\",\"source\":\"%s\",\"status\":\"error\"}\n", EscapeJSON(path).c_str(), source);
+				return;
+			}
+
+			auto results = RunSeeks(*decoder, 'r' == pattern[0] ? randomTargets : sortedTargets, sortedTargets, windows);
+			PrintResults(path, source, pattern, results);
+		}
+	}
+
+	void PrintUsage(const char *name)
+	{
+		fprintf(stderr, "Usage: %s [-n seeks] [-s seed] [-u http-base-url] corpus-directory\n", name);
+	}
+
+}
+
+int main(int argc, char *argv [])
+{
+	int seekCount = DEFAULT_SEEK_COUNT;
+	unsigned seed = 1;
+	const char *httpBase = nullptr;
+
+	int ch;
+	while(-1 != (ch = getopt(argc, argv, "n:s:u:"))) {
+		switch(ch) {
+			case 'n':	seekCount = atoi(optarg);				break;
+			case 's':	seed = (unsigned)strtoul(optarg, nullptr, 10);	break;
+			case 'u':	httpBase = optarg;						break;
+			default:
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(optind + 1 != argc || 1 > seekCount) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::string corpusPath(argv[optind]);
+	while(1 < corpusPath.size() && '/' == corpusPath.back())
+		corpusPath.pop_back();
+
+	SFB::CFURL corpus(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)corpusPath.c_str(), (CFIndex)corpusPath.size(), true));
+	SFB::CFURL baseURL(httpBase ? CFURLCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)httpBase, (CFIndex)strlen(httpBase), kCFStringEncodingUTF8, nullptr) : nullptr);
+	if(!corpus || (httpBase && !baseURL)) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937_64 generator(seed);
+
+	for(const auto& url : CollectFiles(corpus, SFB::Audio::Decoder::HandlesFilesWithExtension)) {
+		std::string path = GetPath(url);
+
+		auto decoder = OpenDecoder(url, 0);
+		if(!decoder || !decoder->SupportsSeeking() || COMPARISON_FRAMES >= decoder->GetTotalFrames()) {
+			printf("{\"file\":\"%s\",\"status\":\"not_seekable\"}\n", EscapeJSON(path).c_str());
+			continue;
+		}
+
+		SInt64 totalFrames = decoder->GetTotalFrames();
+		decoder.reset();
+
+		// The random pattern seeks to the sequential pattern's targets in a random order so both use the same reference frames
+		std::uniform_int_distribution<SInt64> distribution(0, totalFrames - COMPARISON_FRAMES - 1);
+		std::vector<SInt64> randomTargets((size_t)seekCount);
+		for(auto& target : randomTargets)
+			target = distribution(generator);
+
+		std::vector<SInt64> sortedTargets(randomTargets);
+		std::sort(sortedTargets.begin(), sortedTargets.end());
+
+		std::vector<ReferenceWindow> windows;
+		if(!ReadReferenceWindows(url, sortedTargets, windows)) {
+			printf("{\"file\":\"%s\",\"status\":\"error\"}\n", EscapeJSON(path).c_str());
+			continue;
+		}
+
+		for(const auto& type : sInputSourceTypes)
+			BenchmarkSeeks(url, path, type.mName, type.mFlags, randomTargets, sortedTargets, windows);
+
+		if(baseURL) {
+			// The file's URL relative to the corpus
+			std::string relativePath = path.substr(corpusPath.size() + 1);
+			SFB::CFString relativeString(CFStringCreateWithCString(kCFAllocatorDefault, relativePath.c_str(), kCFStringEncodingUTF8));
+			SFB::CFString escapedString(CFURLCreateStringByAddingPercentEscapes(kCFAllocatorDefault, relativeString, nullptr, CFSTR("?#;"), kCFStringEncodingUTF8));
+			SFB::CFURL httpURL(CFURLCreateWithString(kCFAllocatorDefault, escapedString, baseURL));
+
+			if(httpURL)
+				BenchmarkSeeks(httpURL, path, "http", 0, randomTargets, sortedTargets, windows);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -303,6 +303,8 @@ namespace SFB {
 	using SecCertificate = CFWrapper<SecCertificateRef>;						/*!< @brief A wrapped \c SecCertificateRef */
 	using SecTransform = CFWrapper<SecTransformRef>;							/*!< @brief A wrapped \c SecTransformRef */
 	using CGImageSource = CFWrapper<CGImageSourceRef>;							/*!< @brief A wrapped \c CGImageSourceRef */
+	using CGImageDestination = CFWrapper<CGImageDestinationRef>;				/*!< @brief A wrapped \c CGImageDestinationRef */
+	using CGImage = CFWrapper<CGImageRef>;										/*!< @brief A wrapped \c CGImageRef */
 #endif
 
 }
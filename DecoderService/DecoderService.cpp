@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+// The decoding service launched by RemoteDecoder, which decodes one file into memory shared with the process
+// that launched it
+// Usage: DecoderService shared-memory-name url
+//
+// The service is not run directly; its path is passed to RemoteDecoder::SetServicePath() and it is launched
+// once for each RemoteDecoder opened.
+
+#include <SFBAudioEngine/RemoteDecoder.h>
+
+int main(int argc, char *argv [])
+{
+	return SFB::Audio::RemoteDecoder::RunService(argc, argv);
+}
@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <pthread.h>
+#include <pthread/qos.h>
+
+#include <Block.h>
+
+#include "AsyncDecoder.h"
+#include "CFWrapper.h"
+#include "Logger.h"
+
+// The input byte rate assumed when it can't be estimated from the input's length
+#define DEFAULT_INPUT_BYTE_RATE (128000 / 8)
+
+#pragma mark Executor
+
+SFB::Audio::AsyncDecoder::Executor::Executor(size_t threadCount)
+	: mStopping(false)
+{
+	if(0 == threadCount)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	try {
+		for(size_t i = 0; i < threadCount; ++i)
+			mThreads.push_back(std::thread(&Executor::WorkerThreadEntry, this));
+	}
+
+	catch(const std::exception& e) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.AsyncDecoder", "Unable to create executor thread: " << e.what());
+
+		// Join any threads that were successfully created
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStopping = true;
+		}
+		mCondition.notify_all();
+		for(auto& thread : mThreads)
+			thread.join();
+
+		throw;
+	}
+}
+
+SFB::Audio::AsyncDecoder::Executor::~Executor()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mCondition.notify_all();
+
+	for(auto& thread : mThreads) {
+		try {
+			thread.join();
+		}
+
+		catch(const std::exception& e) {
+			LOGGER_ERR("org.sbooth.AudioEngine.AsyncDecoder", "Unable to join executor thread: " << e.what());
+		}
+	}
+}
+
+void SFB::Audio::AsyncDecoder::Executor::Submit(AsyncDecoder *decoder)
+{
+	if(decoder->mQueued || decoder->mCancelled)
+		return;
+
+	decoder->mQueued = true;
+	mRunnable.push_back(decoder);
+	mCondition.notify_all();
+}
+
+void SFB::Audio::AsyncDecoder::Executor::Resume(AsyncDecoder *decoder)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if(!decoder->mParked)
+		return;
+
+	decoder->mParked = false;
+	Submit(decoder);
+}
+
+void SFB::Audio::AsyncDecoder::Executor::WorkerThreadEntry()
+{
+	pthread_setname_np("org.sbooth.AudioEngine.AsyncDecoder");
+
+	if(pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0))
+		LOGGER_WARNING("org.sbooth.AudioEngine.AsyncDecoder", "Couldn't set executor thread QoS class");
+
+	for(;;) {
+		AsyncDecoder *decoder = nullptr;
+
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, [this] { return mStopping || !mRunnable.empty(); });
+			if(mStopping)
+				break;
+
+			decoder = mRunnable.front();
+			mRunnable.pop_front();
+
+			decoder->mQueued = false;
+			++decoder->mRunningCount;
+		}
+
+		decoder->PerformRequest();
+
+		// The decoder must not be accessed once mRunningCount is decremented since it may be destroyed
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			--decoder->mRunningCount;
+		}
+		mCondition.notify_all();
+	}
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::AsyncDecoder::AsyncDecoder(Decoder::unique_ptr decoder, Executor& executor)
+	: mDecoder(std::move(decoder)), mExecutor(executor), mRequestType(RequestType::None), mBufferList(nullptr), mFrameCount(0), mFrame(-1), mOpenBlock(nullptr), mReadBlock(nullptr), mSeekBlock(nullptr), mQueued(false), mParked(false), mCancelled(false), mRunningCount(0), mParkCount(0)
+{
+	if(!mDecoder)
+		throw std::runtime_error("mDecoder may not be nullptr");
+}
+
+SFB::Audio::AsyncDecoder::~AsyncDecoder()
+{
+	{
+		std::unique_lock<std::mutex> lock(mExecutor.mMutex);
+		mCancelled = true;
+		mParked = false;
+
+		if(mQueued) {
+			mExecutor.mRunnable.erase(std::remove(mExecutor.mRunnable.begin(), mExecutor.mRunnable.end(), this), mExecutor.mRunnable.end());
+			mQueued = false;
+		}
+
+		// An executor thread may be performing a request
+		mExecutor.mCondition.wait(lock, [this] { return 0 == mRunningCount; });
+	}
+
+	// Once the handler is replaced it is no longer called
+	mDecoder->GetInputSource().SetReadabilityHandler(nullptr);
+
+	if(mOpenBlock)
+		Block_release(mOpenBlock);
+	if(mReadBlock)
+		Block_release(mReadBlock);
+	if(mSeekBlock)
+		Block_release(mSeekBlock);
+}
+
+#pragma mark Requests
+
+bool SFB::Audio::AsyncDecoder::OpenAsync(OpenCompletionBlock block)
+{
+	std::lock_guard<std::mutex> lock(mExecutor.mMutex);
+	if(RequestType::None != mRequestType)
+		return false;
+
+	mRequestType = RequestType::Open;
+	mOpenBlock = block ? Block_copy(block) : nullptr;
+	mExecutor.Submit(this);
+
+	return true;
+}
+
+bool SFB::Audio::AsyncDecoder::ReadAudioAsync(AudioBufferList *bufferList, UInt32 frameCount, ReadCompletionBlock block)
+{
+	if(nullptr == bufferList || 0 == frameCount)
+		return false;
+
+	std::lock_guard<std::mutex> lock(mExecutor.mMutex);
+	if(RequestType::None != mRequestType)
+		return false;
+
+	mRequestType = RequestType::Read;
+	mBufferList = bufferList;
+	mFrameCount = frameCount;
+	mReadBlock = block ? Block_copy(block) : nullptr;
+	mExecutor.Submit(this);
+
+	return true;
+}
+
+bool SFB::Audio::AsyncDecoder::SeekToFrameAsync(SInt64 frame, SeekCompletionBlock block)
+{
+	if(0 > frame)
+		return false;
+
+	std::lock_guard<std::mutex> lock(mExecutor.mMutex);
+	if(RequestType::None != mRequestType)
+		return false;
+
+	mRequestType = RequestType::Seek;
+	mFrame = frame;
+	mSeekBlock = block ? Block_copy(block) : nullptr;
+	mExecutor.Submit(this);
+
+	return true;
+}
+
+bool SFB::Audio::AsyncDecoder::IsBusy() const
+{
+	std::lock_guard<std::mutex> lock(mExecutor.mMutex);
+	return RequestType::None != mRequestType;
+}
+
+void SFB::Audio::AsyncDecoder::PerformRequest()
+{
+	RequestType requestType;
+	{
+		std::lock_guard<std::mutex> lock(mExecutor.mMutex);
+		requestType = mRequestType;
+	}
+
+	switch(requestType) {
+		case RequestType::None:
+			break;
+
+		case RequestType::Open:
+		{
+			SFB::CFError error;
+			bool success = mDecoder->IsOpen() || mDecoder->Open(&error);
+
+			OpenCompletionBlock block;
+			{
+				std::lock_guard<std::mutex> lock(mExecutor.mMutex);
+				block = mOpenBlock;
+				mOpenBlock = nullptr;
+				mRequestType = RequestType::None;
+			}
+
+			// The block may issue the next request
+			if(block) {
+				block(success, error);
+				Block_release(block);
+			}
+			break;
+		}
+
+		case RequestType::Read:
+		{
+			if(ParkIfInputWouldBlock())
+				break;
+
+			UInt32 framesRead = mDecoder->ReadAudio(mBufferList, mFrameCount);
+
+			ReadCompletionBlock block;
+			{
+				std::lock_guard<std::mutex> lock(mExecutor.mMutex);
+				block = mReadBlock;
+				mReadBlock = nullptr;
+				mBufferList = nullptr;
+				mFrameCount = 0;
+				mRequestType = RequestType::None;
+			}
+
+			if(block) {
+				block(framesRead);
+				Block_release(block);
+			}
+			break;
+		}
+
+		case RequestType::Seek:
+		{
+			SInt64 frame = mDecoder->SeekToFrame(mFrame);
+
+			SeekCompletionBlock block;
+			{
+				std::lock_guard<std::mutex> lock(mExecutor.mMutex);
+				block = mSeekBlock;
+				mSeekBlock = nullptr;
+				mFrame = -1;
+				mRequestType = RequestType::None;
+			}
+
+			if(block) {
+				block(frame);
+				Block_release(block);
+			}
+			break;
+		}
+	}
+}
+
+bool SFB::Audio::AsyncDecoder::ParkIfInputWouldBlock()
+{
+	auto& inputSource = mDecoder->GetInputSource();
+
+	// The input needed for the read is estimated from the average bit rate
+	SInt64 inputLength = inputSource.GetLength();
+	SInt64 totalFrames = mDecoder->GetTotalFrames();
+	SInt64 byteCount;
+	if(0 < inputLength && 0 < totalFrames)
+		byteCount = (SInt64)(((double)inputLength / totalFrames) * mFrameCount);
+	else
+		byteCount = (SInt64)((mFrameCount / mDecoder->GetFormat().mSampleRate) * DEFAULT_INPUT_BYTE_RATE);
+	byteCount = std::max(byteCount, (SInt64)1);
+
+	if(!inputSource.WouldBlock(byteCount))
+		return false;
+
+	// mParked is set before the input is checked again so input received meanwhile can't be missed
+	{
+		std::lock_guard<std::mutex> lock(mExecutor.mMutex);
+		mParked = true;
+	}
+
+	Executor *executor = &mExecutor;
+	inputSource.SetReadabilityHandler(^{
+		executor->Resume(this);
+	});
+
+	if(inputSource.WouldBlock(byteCount)) {
+		mParkCount.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// If the handler was called the read has already been queued
+	std::lock_guard<std::mutex> lock(mExecutor.mMutex);
+	if(!mParked)
+		return true;
+
+	mParked = false;
+	return false;
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "AudioDecoder.h"
+
+/*! @file AsyncDecoder.h @brief Asynchronous decoding multiplexed over a few threads */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief An asynchronous interface to a \c Decoder
+		 *
+		 * Requests return immediately and are performed by the threads of an \c AsyncDecoder::Executor, which are
+		 * shared by all decoders using it.  A read whose input would wait for data received asynchronously, such as
+		 * over HTTP, is parked without occupying a thread and resumed when the input's readability handler is
+		 * called, so a few threads may serve many streams.  The wrapped decoder is otherwise used synchronously, with
+		 * input read ahead by its \c InputSource.
+		 *
+		 * Each \c AsyncDecoder performs one request at a time; a request may be issued from the completion block
+		 * of the previous one.  Completion blocks are called on an executor thread.
+		 */
+		class AsyncDecoder
+		{
+
+		public:
+
+			/*! @brief A \c std::unique_ptr for \c AsyncDecoder objects */
+			using unique_ptr = std::unique_ptr<AsyncDecoder>;
+
+			/*!
+			 * @brief A block called when the decoder has been opened
+			 * @param success \c true if the decoder was opened, \c false otherwise
+			 * @param error The reason the decoder couldn't be opened, or \c nullptr
+			 */
+			using OpenCompletionBlock = void (^)(bool success, CFErrorRef error);
+
+			/*!
+			 * @brief A block called when audio has been read
+			 * @param framesRead The number of frames read, or \c 0 at the end of the audio or on error
+			 */
+			using ReadCompletionBlock = void (^)(UInt32 framesRead);
+
+			/*!
+			 * @brief A block called when a seek has completed
+			 * @param frame The frame seeked to, or \c -1 on error
+			 */
+			using SeekCompletionBlock = void (^)(SInt64 frame);
+
+			/*!
+			 * @brief Threads performing the requests of \c AsyncDecoder objects
+			 * @note An \c Executor must outlive all decoders using it
+			 */
+			class Executor
+			{
+
+			public:
+
+				/*!
+				 * @brief Create a new \c Executor
+				 * @param threadCount The number of threads, or \c 0 for one thread per processor core
+				 * @throws std::system_error
+				 */
+				explicit Executor(size_t threadCount = 0);
+
+				/*! @brief Destroy the \c Executor and join its threads */
+				~Executor();
+
+				/*! @cond */
+
+				/*! @internal This class is non-copyable */
+				Executor(const Executor& rhs) = delete;
+
+				/*! @internal This class is non-assignable */
+				Executor& operator=(const Executor& rhs) = delete;
+
+				/*! @endcond */
+
+				/*! @brief Get the number of threads */
+				inline size_t GetThreadCount() const				{ return mThreads.size(); }
+
+			private:
+
+				friend class AsyncDecoder;
+
+				// Queue decoder's request; mMutex must be held
+				void Submit(AsyncDecoder *decoder);
+
+				// Queue a parked decoder's request when its input is received
+				void Resume(AsyncDecoder *decoder);
+
+				// Thread entry point
+				void WorkerThreadEntry();
+
+				std::vector<std::thread>		mThreads;
+				std::deque<AsyncDecoder *>		mRunnable;
+				std::mutex						mMutex;
+				std::condition_variable			mCondition;
+				bool							mStopping;
+			};
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*!
+			 * @brief Create a new \c AsyncDecoder
+			 * @param decoder The decoder, which need not be open
+			 * @param executor The executor performing requests
+			 * @throws std::runtime_error
+			 */
+			AsyncDecoder(Decoder::unique_ptr decoder, Executor& executor);
+
+			/*!
+			 * @brief Destroy this \c AsyncDecoder
+			 * @note Waits for a request in progress; the completion block of a request not yet performed is not called
+			 */
+			~AsyncDecoder();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			AsyncDecoder(const AsyncDecoder& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			AsyncDecoder& operator=(const AsyncDecoder& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			// ========================================
+			/*! @name Requests */
+			//@{
+
+			/*!
+			 * @brief Open the decoder
+			 * @param block The block to call when the decoder has been opened
+			 * @return \c true if the request was issued, \c false if another request is outstanding
+			 */
+			bool OpenAsync(OpenCompletionBlock block);
+
+			/*!
+			 * @brief Decode audio into the specified buffer
+			 * @note \c bufferList must remain valid until \c block is called
+			 * @param bufferList A buffer to receive the decoded audio
+			 * @param frameCount The requested number of audio frames
+			 * @param block The block to call when the audio has been read
+			 * @return \c true if the request was issued, \c false if another request is outstanding
+			 */
+			bool ReadAudioAsync(AudioBufferList *bufferList, UInt32 frameCount, ReadCompletionBlock block);
+
+			/*!
+			 * @brief Seek to the specified frame
+			 * @param frame The frame to seek to
+			 * @param block The block to call when the seek has completed
+			 * @return \c true if the request was issued, \c false if another request is outstanding
+			 */
+			bool SeekToFrameAsync(SInt64 frame, SeekCompletionBlock block);
+
+			/*! @brief Query whether a request is outstanding */
+			bool IsBusy() const;
+
+			/*! @brief Get the number of times a read was parked waiting for input */
+			inline uint64_t GetParkCount() const					{ return mParkCount.load(std::memory_order_relaxed); }
+
+			//@}
+
+
+			/*!
+			 * @brief Get the wrapped decoder
+			 * @note The decoder must not be used while a request is outstanding
+			 */
+			inline Decoder& GetDecoder() const						{ return *mDecoder; }
+
+		private:
+
+			enum class RequestType {
+				None,
+				Open,
+				Read,
+				Seek
+			};
+
+			// Perform the outstanding request on an executor thread
+			void PerformRequest();
+
+			// Park the outstanding read if its input would block, returning true if the read was parked
+			bool ParkIfInputWouldBlock();
+
+			// Data members
+			Decoder::unique_ptr			mDecoder;
+			Executor&					mExecutor;
+
+			// The outstanding request, protected by mExecutor.mMutex
+			RequestType					mRequestType;
+			AudioBufferList				*mBufferList;
+			UInt32						mFrameCount;
+			SInt64						mFrame;
+			OpenCompletionBlock			mOpenBlock;
+			ReadCompletionBlock			mReadBlock;
+			SeekCompletionBlock			mSeekBlock;
+
+			// Scheduling state, protected by mExecutor.mMutex
+			bool						mQueued;
+			bool						mParked;
+			bool						mCancelled;
+			unsigned					mRunningCount;		// Executor threads performing a request
+			std::atomic<uint64_t>		mParkCount;
+		};
+
+	}
+}
@@ -5,10 +5,15 @@
 
 #include <AudioToolbox/AudioFormat.h>
 #include <CoreFoundation/CoreFoundation.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
 
 #include "HTTPInputSource.h"
 #include "AudioDecoder.h"
+#include "DecodedAudioCache.h"
 #include "Logger.h"
+#include "Signposts.h"
 #include "CFWrapper.h"
 #include "CFErrorUtilities.h"
 #include "CreateStringForOSType.h"
@@ -19,33 +24,68 @@
 // ========================================
 const CFStringRef SFB::Audio::Decoder::ErrorDomain = CFSTR("org.sbooth.AudioEngine.ErrorDomain.AudioDecoder");
 
+namespace {
+
+	uint64_t ConvertHostTimeToNanos(uint64_t hostTime)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (hostTime * sTimebaseInfo.numer) / sTimebaseInfo.denom;
+	}
+
+	// Returns the CPU time used by the calling thread in nanoseconds, or 0 on error
+	uint64_t GetThreadCPUTime()
+	{
+		// pthread_mach_thread_np() doesn't add a reference to the port as mach_thread_self() does
+		thread_basic_info_data_t info;
+		mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+		if(KERN_SUCCESS != thread_info(pthread_mach_thread_np(pthread_self()), THREAD_BASIC_INFO, (thread_info_t)&info, &count))
+			return 0;
+
+		return ((uint64_t)info.user_time.seconds + (uint64_t)info.system_time.seconds) * NSEC_PER_SEC + ((uint64_t)info.user_time.microseconds + (uint64_t)info.system_time.microseconds) * NSEC_PER_USEC;
+	}
+
+	// Accumulates the time spent in a scope
+	class DecodingTimer
+	{
+	public:
+		DecodingTimer(std::atomic_ullong& cpuTime, std::atomic_ullong& wallTime)
+			: mCPUTime(cpuTime), mWallTime(wallTime), mCPUStartTime(GetThreadCPUTime()), mWallStartTime(mach_absolute_time())
+		{}
+
+		~DecodingTimer()
+		{
+			mWallTime.fetch_add(mach_absolute_time() - mWallStartTime, std::memory_order_relaxed);
+			auto cpuTime = GetThreadCPUTime();
+			if(cpuTime > mCPUStartTime)
+				mCPUTime.fetch_add(cpuTime - mCPUStartTime, std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic_ullong&		mCPUTime;
+		std::atomic_ullong&		mWallTime;
+		uint64_t				mCPUStartTime;
+		uint64_t				mWallStartTime;
+	};
+
+}
+
 #pragma mark Static Methods
 
 std::atomic_bool SFB::Audio::Decoder::sAutomaticallyOpenDecoders = ATOMIC_VAR_INIT(false);
 std::vector<SFB::Audio::Decoder::SubclassInfo> SFB::Audio::Decoder::sRegisteredSubclasses;
+SFB::FileTypeIndex::Cache SFB::Audio::Decoder::sFileTypeIndex;
 
 CFArrayRef SFB::Audio::Decoder::CreateSupportedFileExtensions()
 {
-	CFMutableArrayRef supportedFileExtensions = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
-
-	for(auto subclassInfo : sRegisteredSubclasses) {
-		SFB::CFArray decoderFileExtensions(subclassInfo.mCreateSupportedFileExtensions());
-		CFArrayAppendArray(supportedFileExtensions, decoderFileExtensions, CFRangeMake(0, CFArrayGetCount(decoderFileExtensions)));
-	}
-
-	return supportedFileExtensions;
+	return CFArrayCreateCopy(kCFAllocatorDefault, sFileTypeIndex.GetIndex(sRegisteredSubclasses)->GetFileExtensions());
 }
 
 CFArrayRef SFB::Audio::Decoder::CreateSupportedMIMETypes()
 {
-	CFMutableArrayRef supportedMIMETypes = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
-
-	for(auto subclassInfo : sRegisteredSubclasses) {
-		SFB::CFArray decoderMIMETypes(subclassInfo.mCreateSupportedMIMETypes());
-		CFArrayAppendArray(supportedMIMETypes, decoderMIMETypes, CFRangeMake(0, CFArrayGetCount(decoderMIMETypes)));
-	}
-
-	return supportedMIMETypes;
+	return CFArrayCreateCopy(kCFAllocatorDefault, sFileTypeIndex.GetIndex(sRegisteredSubclasses)->GetMIMETypes());
 }
 
 bool SFB::Audio::Decoder::HandlesFilesWithExtension(CFStringRef extension)
@@ -53,12 +93,15 @@ bool SFB::Audio::Decoder::HandlesFilesWithExtension(CFStringRef extension)
 	if(nullptr == extension)
 		return false;
 
-	for(auto subclassInfo : sRegisteredSubclasses) {
-		if(subclassInfo.mHandlesFilesWithExtension(extension))
-			return true;
-	}
+	return !sFileTypeIndex.GetIndex(sRegisteredSubclasses)->GetSubclassesForFileExtension(extension).empty();
+}
 
-	return false;
+bool SFB::Audio::Decoder::HandlesFilesWithExtension(const char *extension)
+{
+	if(nullptr == extension)
+		return false;
+
+	return !sFileTypeIndex.GetIndex(sRegisteredSubclasses)->GetSubclassesForFileExtension(extension).empty();
 }
 
 bool SFB::Audio::Decoder::HandlesMIMEType(CFStringRef mimeType)
@@ -66,8 +109,24 @@ bool SFB::Audio::Decoder::HandlesMIMEType(CFStringRef mimeType)
 	if(nullptr == mimeType)
 		return false;
 
+	return !sFileTypeIndex.GetIndex(sRegisteredSubclasses)->GetSubclassesForMIMEType(mimeType).empty();
+}
+
+bool SFB::Audio::Decoder::HandlesMIMEType(const char *mimeType)
+{
+	if(nullptr == mimeType)
+		return false;
+
+	return !sFileTypeIndex.GetIndex(sRegisteredSubclasses)->GetSubclassesForMIMEType(mimeType).empty();
+}
+
+bool SFB::Audio::Decoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header || 0 == length)
+		return false;
+
 	for(auto subclassInfo : sRegisteredSubclasses) {
-		if(subclassInfo.mHandlesMIMEType(mimeType))
+		if(subclassInfo.mHandlesSignature && subclassInfo.mHandlesSignature(header, length))
 			return true;
 	}
 
@@ -81,7 +140,15 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::Decoder::CreateForURL(CFURLRef url,
 
 SFB::Audio::Decoder::unique_ptr SFB::Audio::Decoder::CreateForURL(CFURLRef url, CFStringRef mimeType, CFErrorRef *error)
 {
-	return CreateForInputSource(InputSource::CreateForURL(url, 0, error), mimeType, error);
+	if(!DecodedAudioCache::IsEnabled())
+		return CreateForInputSource(InputSource::CreateForURL(url, 0, error), mimeType, error);
+
+	// Audio that was expensive to decode is read from the cache, and audio not yet cached may be added as it is decoded
+	auto decoder = DecodedAudioCache::CreateForURL(url);
+	if(decoder)
+		return decoder;
+
+	return DecodedAudioCache::CreateCachingDecoder(CreateForInputSource(InputSource::CreateForURL(url, 0, error), mimeType, error));
 }
 
 SFB::Audio::Decoder::unique_ptr SFB::Audio::Decoder::CreateForInputSource(InputSource::unique_ptr inputSource, CFErrorRef *error)
@@ -133,7 +200,39 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::Decoder::CreateForInputSource(InputS
 #endif
 	}
 
-	// If no MIME type was specified, use the extension-based resolvers
+	// Identify the format by content, checking all signatures from a single read
+	// Subclasses recognizing the content are tried first, in priority order
+
+	std::vector<bool> subclassTried(sRegisteredSubclasses.size(), false);
+
+	uint8_t header [SignatureLength];
+	size_t headerLength = inputSource->ReadSignature(header, sizeof(header));
+	if(0 < headerLength) {
+		for(size_t i = 0; i < sRegisteredSubclasses.size(); ++i) {
+			const auto& subclassInfo = sRegisteredSubclasses[i];
+			if(subclassInfo.mHandlesSignature && subclassInfo.mHandlesSignature(header, headerLength)) {
+				subclassTried[i] = true;
+
+				unique_ptr decoder(subclassInfo.mCreateDecoder(std::move(inputSource)));
+				if(!AutomaticallyOpenDecoders())
+					return decoder;
+				else {
+					if(decoder->Open(error))
+						return decoder;
+					// Take back the input source for reuse if opening fails
+					else {
+						inputSource = std::move(decoder->mInputSource);
+						inputSource->SeekToOffset(0);
+
+						if(error && *error)
+							CFRelease(*error), *error = nullptr;
+					}
+				}
+			}
+		}
+	}
+
+	// Fall back to the extension-based resolvers
 
 	CFURLRef inputURL = inputSource->GetURL();
 	if(!inputURL)
@@ -156,8 +255,9 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::Decoder::CreateForInputSource(InputS
 	// and if openDecoder is false the wrong decoder type may be returned, since the file isn't analyzed
 	// until Open() is called
 
-	for(auto subclassInfo : sRegisteredSubclasses) {
-		if(subclassInfo.mHandlesFilesWithExtension(pathExtension)) {
+	for(size_t i = 0; i < sRegisteredSubclasses.size(); ++i) {
+		const auto& subclassInfo = sRegisteredSubclasses[i];
+		if(!subclassTried[i] && subclassInfo.mHandlesFilesWithExtension(pathExtension)) {
 			unique_ptr decoder(subclassInfo.mCreateDecoder(std::move(inputSource)));
 			if(!AutomaticallyOpenDecoders())
 				return decoder;
@@ -174,17 +274,69 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::Decoder::CreateForInputSource(InputS
 	return nullptr;
 }
 
+SFB::Audio::Decoder::unique_ptr SFB::Audio::Decoder::CreateForURL(const std::type_info& decoderType, CFURLRef url, CFErrorRef *error)
+{
+	for(const auto& subclassInfo : sRegisteredSubclasses) {
+		if(*subclassInfo.mTypeInfo == decoderType)
+			return CreateForURLWithFactory(url, subclassInfo.mCreateDecoder, error);
+	}
+
+	LOGGER_ERR("org.sbooth.AudioEngine.Decoder", "No registered decoder of type " << decoderType.name());
+	return nullptr;
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::Decoder::CreateForInputSource(const std::type_info& decoderType, InputSource::unique_ptr inputSource, CFErrorRef *error)
+{
+	for(const auto& subclassInfo : sRegisteredSubclasses) {
+		if(*subclassInfo.mTypeInfo == decoderType)
+			return CreateForInputSourceWithFactory(std::move(inputSource), subclassInfo.mCreateDecoder, error);
+	}
+
+	LOGGER_ERR("org.sbooth.AudioEngine.Decoder", "No registered decoder of type " << decoderType.name());
+	return nullptr;
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::Decoder::CreateForURLWithFactory(CFURLRef url, DecoderFactory createDecoder, CFErrorRef *error)
+{
+	if(!DecodedAudioCache::IsEnabled())
+		return CreateForInputSourceWithFactory(InputSource::CreateForURL(url, 0, error), createDecoder, error);
+
+	auto decoder = DecodedAudioCache::CreateForURL(url);
+	if(decoder)
+		return decoder;
+
+	return DecodedAudioCache::CreateCachingDecoder(CreateForInputSourceWithFactory(InputSource::CreateForURL(url, 0, error), createDecoder, error));
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::Decoder::CreateForInputSourceWithFactory(InputSource::unique_ptr inputSource, DecoderFactory createDecoder, CFErrorRef *error)
+{
+	if(!inputSource)
+		return nullptr;
+
+	if(AutomaticallyOpenDecoders() && !inputSource->IsOpen() && !inputSource->Open(error))
+		return nullptr;
+
+	unique_ptr decoder(createDecoder(std::move(inputSource)));
+	if(!decoder || !AutomaticallyOpenDecoders())
+		return decoder;
+
+	if(!decoder->Open(error))
+		return nullptr;
+
+	return decoder;
+}
+
 #pragma mark Creation and Destruction
 
 SFB::Audio::Decoder::Decoder()
-	: mInputSource(nullptr), mRepresentedObject(nullptr), mRepresentedObjectCleanupBlock(nullptr), mIsOpen(false)
+	: mInputSource(nullptr), mRepresentedObject(nullptr), mRepresentedObjectCleanupBlock(nullptr), mIsOpen(false), mDecodingThreadCount(1), mVerifyIntegrity(false), mCallCount(0), mFramesDecoded(0), mCPUTime(0), mWallTime(0)
 {
 	memset(&mFormat, 0, sizeof(mFormat));
 	memset(&mSourceFormat, 0, sizeof(mSourceFormat));
 }
 
 SFB::Audio::Decoder::Decoder(InputSource::unique_ptr inputSource)
-	: mInputSource(std::move(inputSource)), mRepresentedObject(nullptr), mRepresentedObjectCleanupBlock(nullptr), mIsOpen(false)
+	: mInputSource(std::move(inputSource)), mRepresentedObject(nullptr), mRepresentedObjectCleanupBlock(nullptr), mIsOpen(false), mDecodingThreadCount(1), mVerifyIntegrity(false), mCallCount(0), mFramesDecoded(0), mCPUTime(0), mWallTime(0)
 {
 	assert(nullptr != mInputSource);
 
@@ -261,6 +413,30 @@ bool SFB::Audio::Decoder::Close(CFErrorRef *error)
 	return result;
 }
 
+bool SFB::Audio::Decoder::Reset(InputSource::unique_ptr inputSource, CFErrorRef *error)
+{
+	if(!inputSource) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder", "Reset() called with invalid parameters");
+		return false;
+	}
+
+	if(!SupportsReset()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder", "Reset() called on a Decoder that doesn't support resetting");
+		return false;
+	}
+
+	if(IsOpen() && !Close(error))
+		return false;
+
+	mInputSource = std::move(inputSource);
+
+	memset(&mFormat, 0, sizeof(mFormat));
+	memset(&mSourceFormat, 0, sizeof(mSourceFormat));
+	mChannelLayout = ChannelLayout();
+
+	return Open(error);
+}
+
 CFStringRef SFB::Audio::Decoder::CreateFormatDescription() const
 {
 	if(!IsOpen()) {
@@ -325,7 +501,71 @@ UInt32 SFB::Audio::Decoder::ReadAudio(AudioBufferList *bufferList, UInt32 frameC
 		return 0;
 	}
 
-	return _ReadAudio(bufferList, frameCount);
+	UInt32 framesRead;
+	{
+		DecodingTimer timer(mCPUTime, mWallTime);
+		SFB_SIGNPOST_INTERVAL_BEGIN("Decoder::ReadAudio", this, "%{public}@ %u frames", GetURL(), frameCount);
+		framesRead = _ReadAudio(bufferList, frameCount);
+		SFB_SIGNPOST_INTERVAL_END("Decoder::ReadAudio", this, "%u frames read", framesRead);
+	}
+
+	mCallCount.fetch_add(1, std::memory_order_relaxed);
+	mFramesDecoded.fetch_add(framesRead, std::memory_order_relaxed);
+
+	return framesRead;
+}
+
+bool SFB::Audio::Decoder::PrefersCanonicalFloat() const
+{
+	return kAudioFormatLinearPCM == mPreferredFormat.mFormatID && (kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved) == mPreferredFormat.mFormatFlags && 32 == mPreferredFormat.mBitsPerChannel;
+}
+
+const AudioBufferList * SFB::Audio::Decoder::PeekAudio(UInt32& frameCount)
+{
+	frameCount = 0;
+
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder", "PeekAudio() called on a Decoder that hasn't been opened");
+		return nullptr;
+	}
+
+	if(!_SupportsBorrowedAudio()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder", "PeekAudio() called on a Decoder that doesn't lend its audio");
+		return nullptr;
+	}
+
+	const AudioBufferList *bufferList;
+	{
+		// Frames are counted when consumed
+		DecodingTimer timer(mCPUTime, mWallTime);
+		bufferList = _PeekAudio(frameCount);
+	}
+
+	mCallCount.fetch_add(1, std::memory_order_relaxed);
+
+	if(nullptr == bufferList)
+		frameCount = 0;
+
+	return bufferList;
+}
+
+void SFB::Audio::Decoder::ConsumeAudio(UInt32 frameCount)
+{
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder", "ConsumeAudio() called on a Decoder that hasn't been opened");
+		return;
+	}
+
+	if(!_SupportsBorrowedAudio()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder", "ConsumeAudio() called on a Decoder that doesn't lend its audio");
+		return;
+	}
+
+	if(0 == frameCount)
+		return;
+
+	_ConsumeAudio(frameCount);
+	mFramesDecoded.fetch_add(frameCount, std::memory_order_relaxed);
 }
 
 SInt64 SFB::Audio::Decoder::GetTotalFrames() const
@@ -338,6 +578,16 @@ SInt64 SFB::Audio::Decoder::GetTotalFrames() const
 	return _GetTotalFrames();
 }
 
+bool SFB::Audio::Decoder::IsTotalFramesEstimated() const
+{
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder", "IsTotalFramesEstimated() called on a Decoder that hasn't been opened");
+		return false;
+	}
+
+	return _IsTotalFramesEstimated();
+}
+
 SInt64 SFB::Audio::Decoder::GetCurrentFrame() const
 {
 	if(!IsOpen()) {
@@ -372,3 +622,248 @@ SInt64 SFB::Audio::Decoder::SeekToFrame(SInt64 frame)
 
 	return _SeekToFrame(frame);
 }
+
+SInt64 SFB::Audio::Decoder::SeekToFrameApproximately(SInt64 frame)
+{
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder", "SeekToFrameApproximately() called on a Decoder that hasn't been opened");
+		return -1;
+	}
+
+	if(0 > frame || frame >= GetTotalFrames()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder", "SeekToFrameApproximately() called with invalid parameters");
+		return -1;
+	}
+
+	return _SeekToFrameApproximately(frame);
+}
+
+SFB::Audio::Decoder::SeekCost SFB::Audio::Decoder::GetSeekCost(SInt64 frame) const
+{
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder", "GetSeekCost() called on a Decoder that hasn't been opened");
+		return SeekCostUnsupported;
+	}
+
+	if(!_SupportsSeeking())
+		return SeekCostUnsupported;
+
+	if(0 > frame || frame >= GetTotalFrames()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder", "GetSeekCost() called with invalid parameters");
+		return SeekCostUnsupported;
+	}
+
+	return _GetSeekCost(frame);
+}
+
+size_t SFB::Audio::Decoder::GetStreamCount() const
+{
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder", "GetStreamCount() called on a Decoder that hasn't been opened");
+		return 0;
+	}
+
+	return _GetStreamCount();
+}
+
+size_t SFB::Audio::Decoder::GetCurrentStream() const
+{
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder", "GetCurrentStream() called on a Decoder that hasn't been opened");
+		return 0;
+	}
+
+	return _GetCurrentStream();
+}
+
+bool SFB::Audio::Decoder::SelectStream(size_t stream, CFErrorRef *error)
+{
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder", "SelectStream() called on a Decoder that hasn't been opened");
+		return false;
+	}
+
+	if(stream >= _GetStreamCount()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder", "SelectStream() called with invalid parameters");
+		return false;
+	}
+
+	if(stream == _GetCurrentStream())
+		return true;
+
+	return _SelectStream(stream, error);
+}
+
+#pragma mark Decoding Statistics
+
+SFB::Audio::Decoder::DecodingStatistics SFB::Audio::Decoder::GetDecodingStatistics() const
+{
+	DecodingStatistics statistics;
+
+	statistics.mCallCount = mCallCount.load(std::memory_order_relaxed);
+	statistics.mFramesDecoded = mFramesDecoded.load(std::memory_order_relaxed);
+	statistics.mCPUTime = (CFTimeInterval)mCPUTime.load(std::memory_order_relaxed) / NSEC_PER_SEC;
+	statistics.mWallTime = (CFTimeInterval)ConvertHostTimeToNanos(mWallTime.load(std::memory_order_relaxed)) / NSEC_PER_SEC;
+
+	return statistics;
+}
+
+void SFB::Audio::Decoder::ResetDecodingStatistics()
+{
+	mCallCount.store(0, std::memory_order_relaxed);
+	mFramesDecoded.store(0, std::memory_order_relaxed);
+	mCPUTime.store(0, std::memory_order_relaxed);
+	mWallTime.store(0, std::memory_order_relaxed);
+}
+
+#pragma mark Integrity Verification
+
+bool SFB::Audio::Decoder::SupportsIntegrityVerification() const
+{
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder", "SupportsIntegrityVerification() called on a Decoder that hasn't been opened");
+		return false;
+	}
+
+	return _SupportsIntegrityVerification();
+}
+
+SFB::Audio::Decoder::IntegrityStatus SFB::Audio::Decoder::GetIntegrityStatus() const
+{
+	if(!IsOpen() || !mVerifyIntegrity)
+		return IntegrityStatus::Unverified;
+
+	return _GetIntegrityStatus();
+}
+
+#pragma mark State Snapshots
+
+namespace {
+
+	const char kStateSnapshotMagic [4] = { 'S', 'F', 'B', 's' };
+	const uint32_t kStateSnapshotVersion = 1;
+
+	// The codec state appended by the decoder follows the header
+	struct StateSnapshotHeader
+	{
+		char		mMagic [4];
+		uint32_t	mVersion;
+		uint32_t	mFormatID;
+		uint32_t	mChannelsPerFrame;
+		double		mSampleRate;
+		int64_t		mInputLength;
+		uint64_t	mStream;
+		int64_t		mFrame;
+	};
+
+	// The fields identifying the source, which must match when a snapshot is restored
+	void FillStateSnapshotHeader(StateSnapshotHeader& header, const SFB::Audio::AudioFormat& sourceFormat, SInt64 inputLength, size_t stream, SInt64 frame)
+	{
+		memset(&header, 0, sizeof(header));
+		memcpy(header.mMagic, kStateSnapshotMagic, sizeof(kStateSnapshotMagic));
+		header.mVersion				= kStateSnapshotVersion;
+		header.mFormatID			= sourceFormat.mFormatID;
+		header.mChannelsPerFrame	= sourceFormat.mChannelsPerFrame;
+		header.mSampleRate			= sourceFormat.mSampleRate;
+		header.mInputLength			= inputLength;
+		header.mStream				= stream;
+		header.mFrame				= frame;
+	}
+
+	CFErrorRef CreateStateSnapshotError(CFURLRef url)
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("Playback of the file “%@” can't be resumed."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Invalid state snapshot"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file may have been modified since playback was interrupted."), ""));
+
+		return CreateErrorForURL(SFB::Audio::Decoder::ErrorDomain, SFB::Audio::Decoder::InputOutputError, description, url, failureReason, recoverySuggestion);
+	}
+
+}
+
+CFDataRef SFB::Audio::Decoder::CreateStateSnapshot(SInt64 frame) const
+{
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder", "CreateStateSnapshot() called on a Decoder that hasn't been opened");
+		return nullptr;
+	}
+
+	if(-1 == frame)
+		frame = _GetCurrentFrame();
+
+	if(0 > frame) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder", "CreateStateSnapshot() called with invalid parameters");
+		return nullptr;
+	}
+
+	StateSnapshotHeader header;
+	FillStateSnapshotHeader(header, mSourceFormat, GetInputSource().GetLength(), _GetCurrentStream(), frame);
+
+	SFB::CFMutableData data(CFDataCreateMutable(kCFAllocatorDefault, 0));
+	if(!data)
+		return nullptr;
+
+	CFDataAppendBytes(data, (const UInt8 *)&header, sizeof(header));
+
+	// A snapshot without codec state is still usable, though resuming from it requires a seek
+	if(!_AppendStateSnapshot(frame, data)) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder", "Codec state unavailable for frame " << frame);
+		CFDataSetLength(data, sizeof(header));
+	}
+
+	return data.Relinquish();
+}
+
+bool SFB::Audio::Decoder::RestoreStateSnapshot(CFDataRef snapshot, CFErrorRef *error)
+{
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder", "RestoreStateSnapshot() called on a Decoder that hasn't been opened");
+		return false;
+	}
+
+	if(nullptr == snapshot) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder", "RestoreStateSnapshot() called with invalid parameters");
+		return false;
+	}
+
+	StateSnapshotHeader header, expected;
+	if((CFIndex)sizeof(header) > CFDataGetLength(snapshot)) {
+		if(error)
+			*error = CreateStateSnapshotError(GetURL());
+		return false;
+	}
+
+	memcpy(&header, CFDataGetBytePtr(snapshot), sizeof(header));
+	FillStateSnapshotHeader(expected, mSourceFormat, GetInputSource().GetLength(), (size_t)header.mStream, header.mFrame);
+
+	if(memcmp(&header, &expected, sizeof(header)) || 0 > header.mFrame) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder", "State snapshot doesn't match \"" << GetURL() << "\"");
+		if(error)
+			*error = CreateStateSnapshotError(GetURL());
+		return false;
+	}
+
+	if(header.mStream != _GetCurrentStream() && !SelectStream((size_t)header.mStream, error))
+		return false;
+
+	if(header.mFrame == _GetCurrentFrame())
+		return true;
+
+	if(!_SupportsSeeking() || header.mFrame >= GetTotalFrames()) {
+		if(error)
+			*error = CreateStateSnapshotError(GetURL());
+		return false;
+	}
+
+	const UInt8 *codecState = CFDataGetBytePtr(snapshot) + sizeof(header);
+	CFIndex codecStateLength = CFDataGetLength(snapshot) - (CFIndex)sizeof(header);
+
+	if(header.mFrame != _RestoreStateSnapshot(header.mFrame, codecState, codecStateLength)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder", "Unable to resume decoding at frame " << header.mFrame);
+		if(error)
+			*error = CreateStateSnapshotError(GetURL());
+		return false;
+	}
+
+	return true;
+}
@@ -8,13 +8,17 @@
 #include <CoreFoundation/CoreFoundation.h>
 #include <CoreAudio/CoreAudioTypes.h>
 
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <typeinfo>
+#include <type_traits>
 
 #include "InputSource.h"
 #include "AudioFormat.h"
 #include "AudioChannelLayout.h"
+#include "FileTypeIndex.h"
 
 /*! @file AudioDecoder.h @brief Support for decoding audio to PCM */
 
@@ -45,6 +49,14 @@ namespace SFB {
 				InputOutputError					= 2		/*!< Input/output error */
 			};
 
+			/*! @brief The relative cost of seeking to an audio frame */
+			enum SeekCost {
+				SeekCostUnsupported					= 0,	/*!< Seeking is not supported */
+				SeekCostConstant					= 1,	/*!< The frame's location is computed directly */
+				SeekCostIndexed						= 2,	/*!< The frame is located using an index and a limited amount of decoding */
+				SeekCostSearch						= 3		/*!< The frame is located by searching or scanning the input */
+			};
+
 			// ========================================
 			/*! @name Supported file formats */
 			//@{
@@ -67,9 +79,28 @@ namespace SFB {
 			/*! @brief Test whether a file extension is supported */
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 
+			/*! @brief Test whether a file extension in UTF-8 is supported */
+			static bool HandlesFilesWithExtension(const char *extension);
+
 			/*! @brief Test whether a MIME type is supported */
 			static bool HandlesMIMEType(CFStringRef mimeType);
 
+			/*! @brief Test whether a MIME type in UTF-8 is supported */
+			static bool HandlesMIMEType(const char *mimeType);
+
+			/*! @brief The maximum number of leading bytes examined when identifying a file by its content */
+			static const size_t SignatureLength = 4096;
+
+			/*!
+			 * @brief Test whether a file's leading bytes are recognized
+			 *
+			 * Subclasses identifying files by content (magic numbers) should hide this function.  \c header
+			 * begins after any ID3v2 tag at the start of the file.
+			 * @param header The leading bytes of the file
+			 * @param length The number of valid bytes in \c header, at most \c SignatureLength
+			 */
+			static bool HandlesSignature(const void *header, size_t length);
+
 			//@}
 
 
@@ -101,6 +132,7 @@ namespace SFB {
 
 			/*!
 			 * @brief Create a \c Decoder object for the specified \c InputSource
+			 * @note The file's content takes precedence over the file extension for type resolution when the input source is open and seekable
 			 * @note The decoder will take ownership of the input source on success
 			 * @param inputSource The input source
 			 * @param error An optional pointer to a \c CFErrorRef to receive error information
@@ -110,7 +142,7 @@ namespace SFB {
 
 			/*!
 			 * @brief Create a \c Decoder object for the specified \c InputSource
-			 * @note The MIME type takes precedence over the file extension for type resolution
+			 * @note The MIME type takes precedence over the file's content, which takes precedence over the file extension, for type resolution
 			 * @note The decoder will take ownership of the input source on success
 			 * @param inputSource The input source
 			 * @param mimeType The MIME type of the audio
@@ -119,6 +151,49 @@ namespace SFB {
 			 */
 			static unique_ptr CreateForInputSource(InputSource::unique_ptr inputSource, CFStringRef mimeType, CFErrorRef *error = nullptr);
 
+
+			/*!
+			 * @brief Create a \c T object for the specified URL
+			 * @note No type resolution is performed, so this is faster than \c CreateForURL() when the format is known
+			 * @tparam T The \c Decoder subclass
+			 * @param url The URL
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Decoder object, or \c nullptr on failure
+			 */
+			template <typename T> static unique_ptr CreateForURL(CFURLRef url, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create a \c T object for the specified \c InputSource
+			 * @note No type resolution is performed, so this is faster than \c CreateForInputSource() when the format is known
+			 * @note The decoder will take ownership of the input source on success
+			 * @tparam T The \c Decoder subclass
+			 * @param inputSource The input source
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Decoder object, or \c nullptr on failure
+			 */
+			template <typename T> static unique_ptr CreateForInputSource(InputSource::unique_ptr inputSource, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create a \c Decoder object of the registered subclass \c decoderType for the specified URL
+			 * @note No type resolution is performed, so this is faster than \c CreateForURL() when the format is known
+			 * @param decoderType The \c typeid() of the registered \c Decoder subclass
+			 * @param url The URL
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Decoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForURL(const std::type_info& decoderType, CFURLRef url, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create a \c Decoder object of the registered subclass \c decoderType for the specified \c InputSource
+			 * @note No type resolution is performed, so this is faster than \c CreateForInputSource() when the format is known
+			 * @note The decoder will take ownership of the input source on success
+			 * @param decoderType The \c typeid() of the registered \c Decoder subclass
+			 * @param inputSource The input source
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Decoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForInputSource(const std::type_info& decoderType, InputSource::unique_ptr inputSource, CFErrorRef *error = nullptr);
+
 			//@}
 
 
@@ -224,6 +299,22 @@ namespace SFB {
 			/*! @brief Query the decoder's \c InputSource to determine if it is open */
 			inline bool IsOpen() const									{ return mIsOpen; }
 
+
+			/*! @brief Query whether the decoder can be reset onto a new \c InputSource */
+			inline bool SupportsReset() const							{ return _SupportsReset(); }
+
+			/*!
+			 * @brief Close the decoder and open it for a new \c InputSource
+			 *
+			 * Decoders supporting reset retain their codec resources, such as library decoder handles, across streams
+			 * so they need not be recreated for each file
+			 * @param inputSource The new input source
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 * @see SupportsReset()
+			 */
+			bool Reset(InputSource::unique_ptr inputSource, CFErrorRef *error = nullptr);
+
 			//@}
 
 
@@ -273,9 +364,62 @@ namespace SFB {
 			UInt32 ReadAudio(AudioBufferList *bufferList, UInt32 frameCount);
 
 
+			/*!
+			 * @brief Query whether the decoder lends its decoded audio with \c PeekAudio()
+			 * @note It is not necessary to call \c ReadAudio() when audio is lent: the caller reads the decoder's own buffers, avoiding a copy
+			 */
+			inline bool SupportsBorrowedAudio() const					{ return _SupportsBorrowedAudio(); }
+
+			/*!
+			 * @brief Get a view of the decoder's buffered audio, decoding more if necessary
+			 *
+			 * The view is owned by the decoder and remains valid until the next call to \c PeekAudio(),
+			 * \c ConsumeAudio(), \c ReadAudio(), a seek, or until the decoder is closed.  Frames in the view
+			 * aren't consumed until \c ConsumeAudio() is called, and \c GetCurrentFrame() excludes them.
+			 * @param frameCount Receives the number of frames in the view, or \c 0 at end of stream or on error
+			 * @return A read-only view of the decoder's audio, or \c nullptr if none is available
+			 * @see SupportsBorrowedAudio()
+			 */
+			const AudioBufferList * PeekAudio(UInt32& frameCount);
+
+			/*!
+			 * @brief Consume audio returned by \c PeekAudio()
+			 * @param frameCount The number of frames consumed, which may not exceed those in the view
+			 */
+			void ConsumeAudio(UInt32 frameCount);
+
+
+			/*!
+			 * @brief Query whether reading audio would wait for it to be decoded elsewhere
+			 *
+			 * A reader that mustn't wait, such as a \c DecoderPool thread, checks before reading and parks until the
+			 * readability handler is called, as it does for input that hasn't been received.
+			 * @note Decoders decoding on the calling thread never wait for audio; see \c InputSource::WouldBlock() for their input
+			 * @return \c true if reading would wait, \c false if audio is available or none remains
+			 */
+			inline bool WouldBlock() const								{ return IsOpen() && _WouldBlock(); }
+
+			/*!
+			 * @brief Set the block called when audio decoded elsewhere may be read without waiting
+			 * @note The handler is called on an internal queue and must not call back into this \c Decoder.  Once this
+			 * returns the previous handler is no longer called.
+			 * @param handler The handler, or \c nullptr to remove the current handler
+			 */
+			inline void SetReadabilityHandler(InputSource::ReadabilityHandler handler)	{ _SetReadabilityHandler(handler); }
+
+
 			/*! @brief Get the total number of audio frames */
 			SInt64 GetTotalFrames() const ;
 
+			/*!
+			 * @brief Query whether \c GetTotalFrames() is an estimate
+			 *
+			 * Decoders for which an exact length requires a scan of the stream may return an estimate so opening isn't
+			 * delayed.  The estimate is replaced with the exact length once it is determined, for example by an index
+			 * built in the background, or is known only after all audio has been decoded.
+			 */
+			bool IsTotalFramesEstimated() const;
+
 			/*! @brief Get the current audio frame */
 			SInt64 GetCurrentFrame() const;
 
@@ -293,6 +437,183 @@ namespace SFB {
 			 */
 			SInt64 SeekToFrame(SInt64 frame);
 
+			/*!
+			 * @brief Seek to an audio frame near the specified frame
+			 *
+			 * An approximate seek may land on a nearby page or packet boundary instead of decoding up to \c frame,
+			 * which makes it faster than \c SeekToFrame() for formats requiring pre-roll or a search of the file.
+			 * Decoders not supporting approximate seeks perform an exact seek.
+			 * @param frame The desired audio frame
+			 * @return The current frame after seeking
+			 */
+			SInt64 SeekToFrameApproximately(SInt64 frame);
+
+			/*!
+			 * @brief Get the relative cost of seeking to the specified audio frame
+			 *
+			 * This allows callers to prefer \c SeekToFrameApproximately() or to avoid seeking when an exact seek
+			 * would require a search of the input, which is expensive for network sources.
+			 * @param frame The desired audio frame
+			 * @return The cost of seeking to \c frame
+			 */
+			SeekCost GetSeekCost(SInt64 frame) const;
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name State snapshots
+			 * A state snapshot records a position in the source audio along with any codec state allowing decoding to
+			 * resume there without searching the input, so playback may be resumed quickly after an application is
+			 * relaunched.  Snapshots may be stored and are validated against the source when restored.
+			 */
+			//@{
+
+			/*!
+			 * @brief Create a snapshot for resuming decoding at a frame
+			 * @note The returned data must be released by the caller
+			 * @note Codec state is available only for audio which has been decoded, so \c frame should not be
+			 * greater than the current frame
+			 * @param frame The frame at which decoding resumes, or \c -1 for the current frame
+			 * @return A snapshot, or \c nullptr on error
+			 */
+			CFDataRef CreateStateSnapshot(SInt64 frame = -1) const;
+
+			/*!
+			 * @brief Resume decoding from a snapshot created by \c CreateStateSnapshot()
+			 * @note The decoder must be open.  If the snapshot's codec state can't be used the decoder seeks to the
+			 * snapshot's frame instead.
+			 * @param snapshot The snapshot
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false if the snapshot doesn't match this decoder's source or decoding
+			 * couldn't be resumed
+			 */
+			bool RestoreStateSnapshot(CFDataRef snapshot, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Stream selection */
+			//@{
+
+			/*! @brief Get the number of audio streams in the source, or \c 0 if the decoder hasn't been opened */
+			size_t GetStreamCount() const;
+
+			/*! @brief Get the index of the audio stream being decoded */
+			size_t GetCurrentStream() const;
+
+			/*!
+			 * @brief Decode the specified audio stream from the beginning
+			 * @note The format and channel layout may change, so they should be queried again after selecting a stream
+			 * @param stream The index of the desired audio stream
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SelectStream(size_t stream, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Decoding threads */
+			//@{
+
+			/*! @brief Get the number of threads the codec may use for decoding, or \c 0 for one thread per processor core */
+			inline size_t GetDecodingThreadCount() const				{ return mDecodingThreadCount; }
+
+			/*!
+			 * @brief Set the number of threads the codec may use for decoding
+			 * @note This takes effect when the decoder is opened or a stream is selected, and is ignored by decoders without multithreaded codecs
+			 * @param threadCount The number of decoding threads, or \c 0 for one thread per processor core
+			 */
+			inline void SetDecodingThreadCount(size_t threadCount)		{ mDecodingThreadCount = threadCount; }
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Decoding statistics
+			 * Time is accumulated by \c ReadAudio() and \c PeekAudio() on the calling thread, so the statistics for a
+			 * decoder wrapping another include the time spent in the wrapped decoder
+			 */
+			//@{
+
+			/*! @brief The resources used by a decoder */
+			struct DecodingStatistics {
+				uint64_t		mCallCount;			/*!< The number of calls to \c ReadAudio() and \c PeekAudio() */
+				SInt64			mFramesDecoded;		/*!< The number of frames read or consumed */
+				CFTimeInterval	mCPUTime;			/*!< The thread CPU time spent in the calls */
+				CFTimeInterval	mWallTime;			/*!< The elapsed time spent in the calls */
+			};
+
+			/*!
+			 * @brief Get the resources used since the decoder was created or the statistics were reset
+			 * @note This method is real-time safe and may be called from any thread
+			 */
+			DecodingStatistics GetDecodingStatistics() const;
+
+			/*! @brief Discard the decoding statistics */
+			void ResetDecodingStatistics();
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Format negotiation
+			 * Decoders able to provide audio in more than one sample layout prefer the layout of the preferred format,
+			 * allowing their audio to be rendered without an intermediate conversion
+			 */
+			//@{
+
+			/*! @brief Get the format in which audio is preferably provided, or an empty format if none */
+			inline const AudioFormat& GetPreferredFormat() const		{ return mPreferredFormat; }
+
+			/*!
+			 * @brief Set the format in which audio is preferably provided
+			 * @note This takes effect when the decoder is opened.  Only the sample layout is considered: the format flags and bit depth.
+			 * The sample rate and number of channels are always those of the source audio.
+			 * @param format The preferred format, or an empty format for the decoder's native layout
+			 */
+			inline void SetPreferredFormat(const AudioFormat& format)	{ mPreferredFormat = format; }
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Integrity verification
+			 * Decoders for formats storing a checksum of the audio, such as the MD5 signature of FLAC and WavPack
+			 * files, can compare it with the audio decoded.  The comparison is possible only if every frame is
+			 * decoded in order from the start, without seeking.
+			 */
+			//@{
+
+			/*! @brief The result of comparing the decoded audio with the checksum stored in the file */
+			enum class IntegrityStatus {
+				Unverified		= 0,	/*!< Verification is disabled or unsupported, the file has no checksum, or not all audio has been decoded in order */
+				Verified		= 1,	/*!< The decoded audio matches the checksum */
+				Failed			= 2,	/*!< The decoded audio doesn't match the checksum */
+			};
+
+			/*! @brief Query whether the decoded audio is compared with the file's checksum */
+			inline bool IsIntegrityVerificationEnabled() const			{ return mVerifyIntegrity; }
+
+			/*!
+			 * @brief Set whether the decoded audio is compared with the file's checksum
+			 * @note This takes effect when the decoder is opened.  Verification may make decoding slower.
+			 */
+			inline void SetIntegrityVerificationEnabled(bool enabled)	{ mVerifyIntegrity = enabled; }
+
+			/*! @brief Query whether the decoder can verify this file, which must be open */
+			bool SupportsIntegrityVerification() const;
+
+			/*! @brief Get the result of verification, which is known once all audio has been decoded */
+			IntegrityStatus GetIntegrityStatus() const;
+
 			//@}
 
 		protected:
@@ -304,6 +625,11 @@ namespace SFB {
 
 			AudioFormat						mSourceFormat;		/*!< @brief The native format of the source file */
 
+			AudioFormat						mPreferredFormat;	/*!< @brief The format in which audio is preferably provided, consulted when opening */
+
+			/*! @brief Query whether the preferred format's sample layout is native-endian, non-interleaved 32-bit float */
+			bool PrefersCanonicalFloat() const;
+
 
 			/*! @brief Create a new \c Decoder and initialize \c Decoder::mInputSource to \c nullptr */
 			Decoder();
@@ -328,20 +654,67 @@ namespace SFB {
 			virtual SInt64 _GetTotalFrames() const = 0;
 			virtual SInt64 _GetCurrentFrame() const = 0;
 
+			// Optional support for lengths refined after opening
+			virtual bool _IsTotalFramesEstimated() const				{ return false; }
+
 			// Optional seeking support
 			virtual bool _SupportsSeeking() const						{ return false; }
 			virtual SInt64 _SeekToFrame(SInt64 /*frame*/)				{ return -1; }
+			virtual SInt64 _SeekToFrameApproximately(SInt64 frame)		{ return _SeekToFrame(frame); }
+			virtual SeekCost _GetSeekCost(SInt64 /*frame*/) const		{ return SeekCostSearch; }
+
+			// Optional support for sources containing multiple audio streams
+			virtual size_t _GetStreamCount() const						{ return 1; }
+			virtual size_t _GetCurrentStream() const					{ return 0; }
+			virtual bool _SelectStream(size_t /*stream*/, CFErrorRef */*error*/)	{ return false; }
+
+			// Optional state snapshot support
+			// Subclasses may append codec state allowing _RestoreStateSnapshot() to resume at frame without a search of
+			// the input, which must be validated when restored
+			virtual bool _AppendStateSnapshot(SInt64 /*frame*/, CFMutableDataRef /*data*/) const	{ return true; }
+			virtual SInt64 _RestoreStateSnapshot(SInt64 frame, const UInt8 */*data*/, CFIndex /*length*/)	{ return _SeekToFrame(frame); }
+
+			// Optional reset support
+			// Subclasses supporting reset must retain reusable resources in _Close() and fully reinitialize per-stream state in _Open()
+			virtual bool _SupportsReset() const							{ return false; }
+
+			// Optional borrowed audio support
+			// Subclasses holding decoded audio in their own buffers may lend it; audio lent and not consumed is excluded from _GetCurrentFrame()
+			virtual bool _SupportsBorrowedAudio() const					{ return false; }
+			virtual const AudioBufferList * _PeekAudio(UInt32& frameCount)	{ frameCount = 0; return nullptr; }
+			virtual void _ConsumeAudio(UInt32 /*frameCount*/)			{ }
+
+			// Optional support for audio decoded elsewhere
+			// Subclasses whose audio is decoded by another thread or process report when reading would wait and call the handler once it wouldn't
+			virtual bool _WouldBlock() const							{ return false; }
+			virtual void _SetReadabilityHandler(InputSource::ReadabilityHandler /*handler*/)	{ }
+
+			// Optional integrity verification support
+			// Subclasses supporting verification consult IsIntegrityVerificationEnabled() in _Open() and abandon verification on seeking
+			virtual bool _SupportsIntegrityVerification() const			{ return false; }
+			virtual IntegrityStatus _GetIntegrityStatus() const			{ return IntegrityStatus::Unverified; }
 
 			// Data members
 			void							*mRepresentedObject;
 			RepresentedObjectCleanupBlock	mRepresentedObjectCleanupBlock;
 
 			bool							mIsOpen;
+			size_t							mDecodingThreadCount;
+			bool							mVerifyIntegrity;
+
+			// Decoding statistics, written by the decoding thread
+			std::atomic_ullong				mCallCount;
+			std::atomic_llong				mFramesDecoded;
+			std::atomic_ullong				mCPUTime;			// Nanoseconds
+			std::atomic_ullong				mWallTime;			// Host time
 
 			// ========================================
 			// Controls whether Open() is called for decoders created in the factory methods
 			static std::atomic_bool			sAutomaticallyOpenDecoders;
 
+			// DecoderCache reclaims input sources and registered subclass information
+			friend class DecoderCache;
+
 			// ========================================
 			// Subclass registration support
 			struct SubclassInfo
@@ -351,13 +724,22 @@ namespace SFB {
 
 				bool (*mHandlesFilesWithExtension)(CFStringRef);
 				bool (*mHandlesMIMEType)(CFStringRef);
+				bool (*mHandlesSignature)(const void *, size_t);
 
 				Decoder::unique_ptr (*mCreateDecoder)(InputSource::unique_ptr);
 
+				const std::type_info *mTypeInfo;
+
 				int mPriority;
 			};
 
 			static std::vector <SubclassInfo> sRegisteredSubclasses;
+			static FileTypeIndex::Cache sFileTypeIndex;		// Built from sRegisteredSubclasses on first use
+
+			// Typed factory support, bypassing type resolution
+			using DecoderFactory = Decoder::unique_ptr (*)(InputSource::unique_ptr);
+			static unique_ptr CreateForURLWithFactory(CFURLRef url, DecoderFactory createDecoder, CFErrorRef *error);
+			static unique_ptr CreateForInputSourceWithFactory(InputSource::unique_ptr inputSource, DecoderFactory createDecoder, CFErrorRef *error);
 
 		public:
 
@@ -380,18 +762,33 @@ namespace SFB {
 
 				.mHandlesFilesWithExtension = T::HandlesFilesWithExtension,
 				.mHandlesMIMEType = T::HandlesMIMEType,
+				// Subclasses not hiding HandlesSignature() don't identify files by content
+				.mHandlesSignature = (&T::HandlesSignature != &Decoder::HandlesSignature) ? T::HandlesSignature : nullptr,
 
 				.mCreateDecoder = T::CreateDecoder,
 
+				.mTypeInfo = &typeid(T),
+
 				.mPriority = priority
 			};
 
-			sRegisteredSubclasses.push_back(subclassInfo);
-
-			// Sort subclasses by priority
-			std::sort(sRegisteredSubclasses.begin(), sRegisteredSubclasses.end(), [](const SubclassInfo& a, const SubclassInfo& b) {
-				return a.mPriority > b.mPriority;
+			// Keep subclasses ordered by priority, with equal priorities in registration order
+			auto position = std::upper_bound(sRegisteredSubclasses.begin(), sRegisteredSubclasses.end(), priority, [](int value, const SubclassInfo& subclass) {
+				return value > subclass.mPriority;
 			});
+			sRegisteredSubclasses.insert(position, subclassInfo);
+		}
+
+		template <typename T> Decoder::unique_ptr Decoder::CreateForURL(CFURLRef url, CFErrorRef *error)
+		{
+			static_assert(std::is_base_of<Decoder, T>::value, "T must be a Decoder subclass");
+			return CreateForURLWithFactory(url, T::CreateDecoder, error);
+		}
+
+		template <typename T> Decoder::unique_ptr Decoder::CreateForInputSource(InputSource::unique_ptr inputSource, CFErrorRef *error)
+		{
+			static_assert(std::is_base_of<Decoder, T>::value, "T must be a Decoder subclass");
+			return CreateForInputSourceWithFactory(std::move(inputSource), T::CreateDecoder, error);
 		}
 
 	}
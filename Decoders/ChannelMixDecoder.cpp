@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "ChannelMixDecoder.h"
+#include "CFErrorUtilities.h"
+#include "Logger.h"
+
+// The number of frames mixed per pass
+#define BUFFER_SIZE_FRAMES 4096
+
+namespace {
+
+	bool IsFloatNonInterleaved(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && !format.IsInterleaved() && format.IsNativeEndian();
+	}
+
+}
+
+#pragma mark Factory Methods
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::ChannelMixDecoder::CreateForURL(CFURLRef url, const ChannelLayout& channelLayout, CFErrorRef *error)
+{
+	return CreateForDecoder(Decoder::CreateForURL(url, error), channelLayout, error);
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::ChannelMixDecoder::CreateForDecoder(unique_ptr decoder, const ChannelLayout& channelLayout, CFErrorRef *error)
+{
+#pragma unused(error)
+
+	if(!decoder || !channelLayout)
+		return nullptr;
+
+	return unique_ptr(new ChannelMixDecoder(std::move(decoder), channelLayout));
+}
+
+SFB::Audio::ChannelMixDecoder::ChannelMixDecoder(Decoder::unique_ptr decoder, const ChannelLayout& channelLayout)
+	: mDecoder(std::move(decoder)), mOutputChannelLayout(channelLayout), mConverter(nullptr)
+{
+	assert(nullptr != mDecoder);
+}
+
+SFB::Audio::ChannelMixDecoder::~ChannelMixDecoder()
+{
+	if(IsOpen())
+		Close();
+}
+
+bool SFB::Audio::ChannelMixDecoder::_Open(CFErrorRef *error)
+{
+	if(!mDecoder->IsOpen() && !mDecoder->Open(error))
+		return false;
+
+	const auto& decoderFormat = mDecoder->GetFormat();
+
+	if(!decoderFormat.IsPCM()) {
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a supported PCM file."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not a PCM file"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("Only PCM audio may be mixed."), ""));
+
+			*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::FileFormatNotSupportedError, description, GetURL(), failureReason, recoverySuggestion);
+		}
+
+		return false;
+	}
+
+	// Channels without a layout are assumed to be discrete
+	ChannelLayout inputChannelLayout = mDecoder->GetChannelLayout();
+	if(!inputChannelLayout || inputChannelLayout.GetChannelCount() != decoderFormat.mChannelsPerFrame)
+		inputChannelLayout = ChannelLayout::ChannelLayoutWithTag(kAudioChannelLayoutTag_DiscreteInOrder | decoderFormat.mChannelsPerFrame);
+
+	if(!mMixer.SetLayouts(inputChannelLayout, mOutputChannelLayout)) {
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The channels in the file “%@” could not be mixed."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Channel layout not supported"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's channel layout is not supported."), ""));
+
+			*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::FileFormatNotSupportedError, description, GetURL(), failureReason, recoverySuggestion);
+		}
+
+		return false;
+	}
+
+	// The input to the mixer is non-interleaved float with the decoder's channels
+	AudioFormat bufferFormat;
+
+	bufferFormat.mFormatID			= kAudioFormatLinearPCM;
+	bufferFormat.mFormatFlags		= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+
+	bufferFormat.mSampleRate		= decoderFormat.mSampleRate;
+	bufferFormat.mChannelsPerFrame	= decoderFormat.mChannelsPerFrame;
+	bufferFormat.mBitsPerChannel	= 32;
+
+	bufferFormat.mBytesPerPacket	= bufferFormat.mBitsPerChannel / 8;
+	bufferFormat.mFramesPerPacket	= 1;
+	bufferFormat.mBytesPerFrame		= bufferFormat.mBytesPerPacket * bufferFormat.mFramesPerPacket;
+
+	bufferFormat.mReserved			= 0;
+
+	// Other PCM formats are converted to float without resampling
+	if(!IsFloatNonInterleaved(decoderFormat)) {
+		auto result = AudioConverterNew(&decoderFormat, &bufferFormat, &mConverter);
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.ChannelMix", "AudioConverterNew failed: " << result);
+
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainOSStatus, result, nullptr);
+
+			return false;
+		}
+
+		if(!mDecoderBuffer.Allocate(decoderFormat, BUFFER_SIZE_FRAMES)) {
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
+			return false;
+		}
+	}
+
+	if(!mBuffer.Allocate(bufferFormat, BUFFER_SIZE_FRAMES)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
+		return false;
+	}
+
+	mFormat = bufferFormat;
+	mFormat.mChannelsPerFrame = mMixer.GetOutputChannelCount();
+
+	mChannelLayout = mOutputChannelLayout;
+
+	return true;
+}
+
+bool SFB::Audio::ChannelMixDecoder::_Close(CFErrorRef *error)
+{
+	if(!mDecoder->Close(error))
+		return false;
+
+	if(mConverter) {
+		auto result = AudioConverterDispose(mConverter);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.ChannelMix", "AudioConverterDispose failed: " << result);
+		mConverter = nullptr;
+	}
+
+	mDecoderBuffer.Deallocate();
+	mBuffer.Deallocate();
+
+	return true;
+}
+
+SFB::CFString SFB::Audio::ChannelMixDecoder::_GetSourceFormatDescription() const
+{
+	return CFString(mDecoder->CreateSourceFormatDescription());
+}
+
+#pragma mark Functionality
+
+UInt32 SFB::Audio::ChannelMixDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(bufferList->mNumberBuffers != mFormat.mChannelsPerFrame) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.ChannelMix", "_ReadAudio() called with invalid parameters");
+		return 0;
+	}
+
+	// Reset output buffer data size
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+		bufferList->mBuffers[i].mDataByteSize = 0;
+
+	UInt32 framesRead = 0;
+
+	while(framesRead < frameCount) {
+		UInt32 framesToRead = std::min(frameCount - framesRead, (UInt32)BUFFER_SIZE_FRAMES);
+		UInt32 framesDecoded;
+
+		if(mConverter) {
+			mDecoderBuffer.Reset();
+			framesDecoded = mDecoder->ReadAudio(mDecoderBuffer, framesToRead);
+			if(0 == framesDecoded)
+				break;
+
+			mBuffer.Reset();
+			auto result = AudioConverterConvertComplexBuffer(mConverter, framesDecoded, mDecoderBuffer, mBuffer);
+			if(noErr != result) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.ChannelMix", "AudioConverterConvertComplexBuffer failed: " << result);
+				break;
+			}
+		}
+		else {
+			mBuffer.Reset();
+			framesDecoded = mDecoder->ReadAudio(mBuffer, framesToRead);
+			if(0 == framesDecoded)
+				break;
+		}
+
+		mMixer.Mix(mBuffer, bufferList, framesRead, framesDecoded);
+		framesRead += framesDecoded;
+	}
+
+	return framesRead;
+}
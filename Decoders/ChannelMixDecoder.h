@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include "AudioDecoder.h"
+#include "AudioBufferList.h"
+#include "AudioChannelMixer.h"
+
+/*! @file ChannelMixDecoder.h @brief Support for remapping and downmixing channels */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A wrapper around a Decoder providing its PCM audio in a different channel layout
+		 *
+		 * The audio is provided as non-interleaved 32-bit floating point PCM mixed by a \c ChannelMixer, so the
+		 * result is identical regardless of the output device.  Decoders without a channel layout are assumed
+		 * to provide discrete channels in order.
+		 */
+		class ChannelMixDecoder : public Decoder
+		{
+
+		public:
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*!
+			 * @brief Create a \c ChannelMixDecoder object for the specified URL
+			 * @param url The URL
+			 * @param channelLayout The desired channel layout
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c ChannelMixDecoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForURL(CFURLRef url, const ChannelLayout& channelLayout, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create a \c ChannelMixDecoder object for the specified \c Decoder
+			 * @param decoder The decoder
+			 * @param channelLayout The desired channel layout
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c ChannelMixDecoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForDecoder(unique_ptr decoder, const ChannelLayout& channelLayout, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Destroy this \c ChannelMixDecoder */
+			virtual ~ChannelMixDecoder();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			ChannelMixDecoder(const ChannelMixDecoder& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			ChannelMixDecoder& operator=(const ChannelMixDecoder& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+		private:
+
+			ChannelMixDecoder() = delete;
+			ChannelMixDecoder(Decoder::unique_ptr decoder, const ChannelLayout& channelLayout);
+
+			// Source access
+			inline virtual CFURLRef _GetURL() const					{ return mDecoder->GetURL(); }
+			inline virtual InputSource& _GetInputSource() const		{ return mDecoder->GetInputSource(); }
+
+			// Audio access
+			virtual bool _Open(CFErrorRef *error);
+			virtual bool _Close(CFErrorRef *error);
+
+			// The native format of the source audio
+			virtual SFB::CFString _GetSourceFormatDescription() const;
+
+			// Attempt to read frameCount frames of audio, returning the actual number of frames read
+			virtual UInt32 _ReadAudio(AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Source audio information
+			inline virtual SInt64 _GetTotalFrames() const			{ return mDecoder->GetTotalFrames(); }
+			inline virtual SInt64 _GetCurrentFrame() const			{ return mDecoder->GetCurrentFrame(); }
+			inline virtual bool _IsTotalFramesEstimated() const	{ return mDecoder->IsTotalFramesEstimated(); }
+
+			// Seeking support
+			inline virtual bool _SupportsSeeking() const			{ return mDecoder->SupportsSeeking(); }
+			inline virtual SInt64 _SeekToFrame(SInt64 frame)		{ return mDecoder->SeekToFrame(frame); }
+			inline virtual SeekCost _GetSeekCost(SInt64 frame) const	{ return mDecoder->GetSeekCost(frame); }
+
+			// Data members
+			Decoder::unique_ptr		mDecoder;
+			ChannelLayout			mOutputChannelLayout;
+			ChannelMixer			mMixer;
+			AudioConverterRef		mConverter;			// Converts the decoder's audio to float, if required
+			BufferList				mDecoderBuffer;		// The decoder's audio, if conversion is required
+			BufferList				mBuffer;			// The audio to be mixed
+		};
+
+	}
+}
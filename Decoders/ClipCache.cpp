@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#include "ClipCache.h"
+#include "AudioBufferList.h"
+#include "AudioConverter.h"
+#include "ClipDecoder.h"
+#include "Logger.h"
+
+// The number of frames converted per pass while a clip is decoded
+#define CLIP_DECODE_CHUNK_SIZE_FRAMES 16384
+
+#pragma mark Factory Methods
+
+SFB::Audio::Clip::shared_ptr SFB::Audio::Clip::CreateForURL(CFURLRef url, const AudioFormat& format, CFErrorRef *error)
+{
+	if(nullptr == url)
+		return nullptr;
+
+	return CreateForDecoder(Decoder::CreateForURL(url, error), format, error);
+}
+
+SFB::Audio::Clip::shared_ptr SFB::Audio::Clip::CreateForDecoder(Decoder::unique_ptr decoder, const AudioFormat& format, CFErrorRef *error)
+{
+	if(!decoder)
+		return nullptr;
+
+	if(!format.IsPCM()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Clip", "Clips must contain PCM audio");
+		return nullptr;
+	}
+
+	if(!decoder->IsOpen() && !decoder->Open(error))
+		return nullptr;
+
+	SFB::CFString sourceFormatDescription(decoder->CreateSourceFormatDescription());
+	std::unique_ptr<Clip> clip(new Clip(format, decoder->GetChannelLayout(), decoder->GetURL(), sourceFormatDescription));
+
+	// Avoid reallocation while decoding if the length is known
+	SInt64 totalFrames = decoder->GetTotalFrames();
+	if(0 < totalFrames) {
+		size_t byteCount = format.FrameCountToByteCount((size_t)(totalFrames * format.mSampleRate / decoder->GetFormat().mSampleRate));
+		for(auto& data : clip->mData)
+			data.reserve(byteCount);
+	}
+
+	// Converter takes ownership of decoder
+	Converter converter(std::move(decoder), format, clip->mChannelLayout);
+	if(!converter.SetBlockSize(CLIP_DECODE_CHUNK_SIZE_FRAMES) || !converter.Open(error))
+		return nullptr;
+
+	BufferList outputBuffer(format, CLIP_DECODE_CHUNK_SIZE_FRAMES);
+
+	for(;;) {
+		UInt32 frameCount = converter.ConvertAudio(outputBuffer, CLIP_DECODE_CHUNK_SIZE_FRAMES);
+		if(0 == frameCount)
+			break;
+
+		if(!clip->AppendAudio(outputBuffer, frameCount))
+			return nullptr;
+	}
+
+	if(0 == clip->mFrameCount) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Clip", "No audio decoded for clip");
+		return nullptr;
+	}
+
+	clip->Finish();
+
+	return shared_ptr(clip.release());
+}
+
+#pragma mark Creation
+
+SFB::Audio::Clip::Clip(const AudioFormat& format, const ChannelLayout& channelLayout, CFURLRef url, CFStringRef sourceFormatDescription)
+	: mFormat(format), mChannelLayout(channelLayout), mURL(url ? (CFURLRef)CFRetain(url) : nullptr), mSourceFormatDescription(sourceFormatDescription ? (CFStringRef)CFRetain(sourceFormatDescription) : nullptr), mFrameCount(0), mData(format.IsInterleaved() ? 1 : format.mChannelsPerFrame), mBufferList(nullptr, std::free)
+{}
+
+bool SFB::Audio::Clip::AppendAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(std::numeric_limits<UInt32>::max() / mFormat.mBytesPerFrame - mFrameCount < frameCount) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Clip", "Clip exceeds the maximum size of an AudioBuffer");
+		return false;
+	}
+
+	size_t byteCount = mFormat.FrameCountToByteCount(frameCount);
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+		auto data = static_cast<const uint8_t *>(bufferList->mBuffers[i].mData);
+		mData[i].insert(mData[i].end(), data, data + byteCount);
+	}
+
+	mFrameCount += frameCount;
+
+	return true;
+}
+
+void SFB::Audio::Clip::Finish()
+{
+	for(auto& data : mData)
+		data.shrink_to_fit();
+
+	auto bufferList = static_cast<AudioBufferList *>(std::malloc(offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * mData.size())));
+	if(nullptr == bufferList)
+		throw std::bad_alloc();
+
+	bufferList->mNumberBuffers = (UInt32)mData.size();
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+		bufferList->mBuffers[i].mNumberChannels	= mFormat.IsInterleaved() ? mFormat.mChannelsPerFrame : 1;
+		bufferList->mBuffers[i].mData			= mData[i].data();
+		bufferList->mBuffers[i].mDataByteSize	= (UInt32)mData[i].size();
+	}
+
+	mBufferList.reset(bufferList);
+}
+
+void SFB::Audio::Clip::Attach(std::shared_ptr<const void> storage, const uint8_t *data, size_t bufferStride, UInt32 frameCount)
+{
+	UInt32 bufferCount = (UInt32)mData.size();
+	mData.clear();
+
+	auto bufferList = static_cast<AudioBufferList *>(std::malloc(offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * bufferCount)));
+	if(nullptr == bufferList)
+		throw std::bad_alloc();
+
+	bufferList->mNumberBuffers = bufferCount;
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+		bufferList->mBuffers[i].mNumberChannels	= mFormat.IsInterleaved() ? mFormat.mChannelsPerFrame : 1;
+		bufferList->mBuffers[i].mData			= const_cast<uint8_t *>(data + i * bufferStride);
+		bufferList->mBuffers[i].mDataByteSize	= (UInt32)mFormat.FrameCountToByteCount(frameCount);
+	}
+
+	mStorage = std::move(storage);
+	mFrameCount = frameCount;
+	mBufferList.reset(bufferList);
+}
+
+#pragma mark Cache Creation
+
+SFB::Audio::ClipCache::ClipCache(size_t maximumByteCount)
+	: mMaximumByteCount(maximumByteCount), mByteCount(0)
+{}
+
+#pragma mark Clip access
+
+SFB::Audio::Clip::shared_ptr SFB::Audio::ClipCache::GetClipForURL(CFURLRef url, const AudioFormat& format, CFErrorRef *error)
+{
+	if(nullptr == url)
+		return nullptr;
+
+	auto cachedClip = GetCachedClipForURL(url, format);
+	if(cachedClip)
+		return cachedClip;
+
+	// Decoding is performed without the lock held, so concurrent requests for the same URL may both decode it
+	auto clip = Clip::CreateForURL(url, format, error);
+	if(!clip)
+		return nullptr;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	auto iter = Find(url);
+	if(iter != mEntries.end()) {
+		if((*iter)->GetFormat() == format) {
+			mEntries.splice(mEntries.begin(), mEntries, iter);
+			return *iter;
+		}
+
+		mByteCount -= (*iter)->GetByteCount();
+		mEntries.erase(iter);
+	}
+
+	if(clip->GetByteCount() > mMaximumByteCount) {
+		LOGGER_INFO("org.sbooth.AudioEngine.ClipCache", "Clip of " << clip->GetByteCount() << " bytes is larger than the cache");
+		return clip;
+	}
+
+	mEntries.push_front(clip);
+	mByteCount += clip->GetByteCount();
+
+	Evict();
+
+	return clip;
+}
+
+SFB::Audio::Clip::shared_ptr SFB::Audio::ClipCache::GetCachedClipForURL(CFURLRef url, const AudioFormat& format)
+{
+	if(nullptr == url)
+		return nullptr;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	auto iter = Find(url);
+	if(iter == mEntries.end() || (*iter)->GetFormat() != format)
+		return nullptr;
+
+	// Move the clip to the front of the list
+	mEntries.splice(mEntries.begin(), mEntries, iter);
+	return *iter;
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::ClipCache::CreateDecoderForURL(CFURLRef url, const AudioFormat& format, CFErrorRef *error)
+{
+	auto decoder = ClipDecoder::CreateForClip(GetClipForURL(url, format, error), error);
+	if(decoder && !decoder->Open(error))
+		return nullptr;
+
+	return decoder;
+}
+
+#pragma mark Cache management
+
+size_t SFB::Audio::ClipCache::GetMaximumByteCount() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mMaximumByteCount;
+}
+
+void SFB::Audio::ClipCache::SetMaximumByteCount(size_t maximumByteCount)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mMaximumByteCount = maximumByteCount;
+	Evict();
+}
+
+size_t SFB::Audio::ClipCache::GetByteCount() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mByteCount;
+}
+
+size_t SFB::Audio::ClipCache::GetClipCount() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mEntries.size();
+}
+
+void SFB::Audio::ClipCache::Remove(CFURLRef url)
+{
+	if(nullptr == url)
+		return;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	auto iter = Find(url);
+	if(iter != mEntries.end()) {
+		mByteCount -= (*iter)->GetByteCount();
+		mEntries.erase(iter);
+	}
+}
+
+void SFB::Audio::ClipCache::Purge()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mEntries.clear();
+	mByteCount = 0;
+}
+
+SFB::Audio::ClipCache::EntryList::iterator SFB::Audio::ClipCache::Find(CFURLRef url)
+{
+	for(auto iter = mEntries.begin(); iter != mEntries.end(); ++iter) {
+		CFURLRef clipURL = (*iter)->GetURL();
+		if(clipURL && CFEqual(clipURL, url))
+			return iter;
+	}
+
+	return mEntries.end();
+}
+
+void SFB::Audio::ClipCache::Evict()
+{
+	// Clips referenced only by the cache are removed first since removing them frees memory
+	for(auto iter = mEntries.end(); mByteCount > mMaximumByteCount && iter != mEntries.begin(); ) {
+		--iter;
+		if(1 == iter->use_count()) {
+			mByteCount -= (*iter)->GetByteCount();
+			iter = mEntries.erase(iter);
+		}
+	}
+
+	while(mByteCount > mMaximumByteCount && !mEntries.empty()) {
+		mByteCount -= mEntries.back()->GetByteCount();
+		mEntries.pop_back();
+	}
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "AudioDecoder.h"
+
+/*! @file ClipCache.h @brief Fully decoded audio held in memory */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A file's audio, fully decoded and held in memory
+		 *
+		 * A clip is immutable once created and may be shared by any number of \c ClipDecoder objects,
+		 * so a sound may be triggered repeatedly without decoding it again.
+		 */
+		class Clip
+		{
+
+		public:
+
+			/*! @brief A \c std::shared_ptr for \c Clip objects */
+			using shared_ptr = std::shared_ptr<const Clip>;
+
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*!
+			 * @brief Create a \c Clip by decoding the specified URL
+			 * @param url The URL
+			 * @param format The format of the clip's audio, which must be PCM
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Clip, or \c nullptr on failure
+			 */
+			static shared_ptr CreateForURL(CFURLRef url, const AudioFormat& format, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create a \c Clip containing all of a decoder's audio
+			 * @note The decoder is opened if necessary and destroyed when the audio has been decoded
+			 * @param decoder The decoder
+			 * @param format The format of the clip's audio, which must be PCM
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Clip, or \c nullptr on failure
+			 */
+			static shared_ptr CreateForDecoder(Decoder::unique_ptr decoder, const AudioFormat& format, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			Clip(const Clip& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			Clip& operator=(const Clip& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			// ========================================
+			/*! @name Clip information */
+			//@{
+
+			/*! @brief Get the URL of the file the clip was decoded from, or \c nullptr if unknown */
+			inline CFURLRef GetURL() const									{ return mURL; }
+
+			/*! @brief Get the format of the clip's audio */
+			inline const AudioFormat& GetFormat() const						{ return mFormat; }
+
+			/*! @brief Get the layout of the clip's audio channels, or \c nullptr if not specified */
+			inline const ChannelLayout& GetChannelLayout() const			{ return mChannelLayout; }
+
+			/*! @brief Get a description of the native format of the file the clip was decoded from */
+			inline const SFB::CFString& GetSourceFormatDescription() const	{ return mSourceFormatDescription; }
+
+			/*! @brief Get the number of frames in the clip */
+			inline UInt32 GetFrameCount() const								{ return mFrameCount; }
+
+			/*! @brief Get the number of bytes of audio in the clip */
+			inline size_t GetByteCount() const								{ return mFormat.FrameCountToByteCount(mFrameCount) * (mBufferList ? mBufferList->mNumberBuffers : 0); }
+
+			/*! @brief Get the clip's audio */
+			inline const AudioBufferList * GetBufferList() const			{ return mBufferList.get(); }
+
+			//@}
+
+		private:
+
+			Clip(const AudioFormat& format, const ChannelLayout& channelLayout, CFURLRef url, CFStringRef sourceFormatDescription);
+
+			// Append frameCount frames from bufferList to the clip
+			bool AppendAudio(const AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Point mBufferList at the clip's audio
+			void Finish();
+
+			// Point mBufferList at frameCount frames of audio owned by storage, with buffers bufferStride bytes apart
+			void Attach(std::shared_ptr<const void> storage, const uint8_t *data, size_t bufferStride, UInt32 frameCount);
+
+			// SampleBank creates clips referencing its mapped audio
+			friend class SampleBank;
+
+			AudioFormat												mFormat;
+			ChannelLayout											mChannelLayout;
+			SFB::CFURL												mURL;
+			SFB::CFString											mSourceFormatDescription;
+			UInt32													mFrameCount;
+
+			std::vector<std::vector<uint8_t>>						mData;			// One vector per buffer
+			std::shared_ptr<const void>								mStorage;		// Owns attached audio in place of mData
+			std::unique_ptr<AudioBufferList, void (*)(void *)>		mBufferList;
+		};
+
+
+		/*!
+		 * @brief A cache of clips limited to a specified number of bytes
+		 *
+		 * When the cache exceeds its size the least recently used clips are removed, preferring clips
+		 * not in use by a \c ClipDecoder.  A removed clip's memory is freed when its last user is destroyed.
+		 *
+		 * Clips are keyed by URL; requesting a cached clip in a different format replaces it.
+		 * For playback with a \c Player the clip format should match the player's output format,
+		 * which avoids all conversion when the clip is rendered.
+		 */
+		class ClipCache
+		{
+
+		public:
+
+			/*! @brief A \c std::unique_ptr for \c ClipCache objects */
+			using unique_ptr = std::unique_ptr<ClipCache>;
+
+			/*!
+			 * @brief Create a new \c ClipCache
+			 * @param maximumByteCount The maximum number of bytes of audio to retain
+			 */
+			explicit ClipCache(size_t maximumByteCount);
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			ClipCache(const ClipCache& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			ClipCache& operator=(const ClipCache& rhs) = delete;
+
+			/*! @endcond */
+
+			// ========================================
+			/*! @name Clip access */
+			//@{
+
+			/*!
+			 * @brief Get the clip for the specified URL, decoding and caching it if necessary
+			 * @note Clips larger than the cache are returned but not cached
+			 * @param url The URL
+			 * @param format The format of the clip's audio, which must be PCM
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Clip, or \c nullptr on failure
+			 */
+			Clip::shared_ptr GetClipForURL(CFURLRef url, const AudioFormat& format, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Get the cached clip for the specified URL without decoding
+			 * @param url The URL
+			 * @param format The format of the clip's audio
+			 * @return A \c Clip, or \c nullptr if no matching clip is cached
+			 */
+			Clip::shared_ptr GetCachedClipForURL(CFURLRef url, const AudioFormat& format);
+
+			/*!
+			 * @brief Create an open \c ClipDecoder for the clip for the specified URL
+			 * @param url The URL
+			 * @param format The format of the clip's audio, which must be PCM
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Decoder object, or \c nullptr on failure
+			 * @see GetClipForURL()
+			 */
+			Decoder::unique_ptr CreateDecoderForURL(CFURLRef url, const AudioFormat& format, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Cache management */
+			//@{
+
+			/*! @brief Get the maximum number of bytes of audio retained */
+			size_t GetMaximumByteCount() const;
+
+			/*!
+			 * @brief Set the maximum number of bytes of audio retained
+			 * @note Clips are removed if the cache exceeds the new size
+			 * @param maximumByteCount The maximum number of bytes of audio to retain
+			 */
+			void SetMaximumByteCount(size_t maximumByteCount);
+
+			/*! @brief Get the number of bytes of audio in the cache */
+			size_t GetByteCount() const;
+
+			/*! @brief Get the number of clips in the cache */
+			size_t GetClipCount() const;
+
+			/*!
+			 * @brief Remove the clip for the specified URL
+			 * @param url The URL
+			 */
+			void Remove(CFURLRef url);
+
+			/*! @brief Remove all clips */
+			void Purge();
+
+			//@}
+
+		private:
+
+			using EntryList = std::list<Clip::shared_ptr>;
+
+			// Find the entry for url; must be called with mMutex held
+			EntryList::iterator Find(CFURLRef url);
+
+			// Remove clips until the cache fits in mMaximumByteCount; must be called with mMutex held
+			void Evict();
+
+			// Cached clips, the most recently used first
+			EntryList												mEntries;
+			mutable std::mutex										mMutex;
+			size_t													mMaximumByteCount;
+			size_t													mByteCount;
+		};
+
+	}
+}
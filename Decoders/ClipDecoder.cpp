@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "ClipDecoder.h"
+#include "Logger.h"
+
+#pragma mark Factory Methods
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::ClipDecoder::CreateForClip(Clip::shared_ptr clip, CFErrorRef *error)
+{
+	if(!clip)
+		return nullptr;
+
+	// The input source exposes the clip's first buffer so the player may estimate the input byte rate
+	const AudioBufferList *bufferList = clip->GetBufferList();
+	auto inputSource = InputSource::CreateWithMemory(bufferList->mBuffers[0].mData, bufferList->mBuffers[0].mDataByteSize, false, error);
+	if(!inputSource)
+		return nullptr;
+
+	return unique_ptr(new ClipDecoder(std::move(clip), std::move(inputSource)));
+}
+
+SFB::Audio::ClipDecoder::ClipDecoder(Clip::shared_ptr clip, InputSource::unique_ptr inputSource)
+	: Decoder(std::move(inputSource)), mClip(std::move(clip)), mCurrentFrame(0)
+{
+	if(!mClip)
+		throw std::runtime_error("mClip may not be nullptr");
+}
+
+bool SFB::Audio::ClipDecoder::_Open(CFErrorRef */*error*/)
+{
+	mFormat			= mClip->GetFormat();
+	mSourceFormat	= mClip->GetFormat();
+	mChannelLayout	= mClip->GetChannelLayout();
+	mCurrentFrame	= 0;
+
+	return true;
+}
+
+bool SFB::Audio::ClipDecoder::_Close(CFErrorRef */*error*/)
+{
+	return true;
+}
+
+SFB::CFString SFB::Audio::ClipDecoder::_GetSourceFormatDescription() const
+{
+	return mClip->GetSourceFormatDescription();
+}
+
+#pragma mark Functionality
+
+UInt32 SFB::Audio::ClipDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	const AudioBufferList *clipBufferList = mClip->GetBufferList();
+
+	if(bufferList->mNumberBuffers != clipBufferList->mNumberBuffers) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.Clip", "_ReadAudio() called with invalid parameters");
+		return 0;
+	}
+
+	UInt32 framesToRead = std::min(frameCount, mClip->GetFrameCount() - mCurrentFrame);
+	UInt32 byteOffset = mCurrentFrame * mFormat.mBytesPerFrame;
+	UInt32 byteCount = framesToRead * mFormat.mBytesPerFrame;
+
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+		memcpy(bufferList->mBuffers[i].mData, (const int8_t *)clipBufferList->mBuffers[i].mData + byteOffset, byteCount);
+		bufferList->mBuffers[i].mDataByteSize = byteCount;
+	}
+
+	mCurrentFrame += framesToRead;
+
+	return framesToRead;
+}
+
+SInt64 SFB::Audio::ClipDecoder::_SeekToFrame(SInt64 frame)
+{
+	if(0 > frame || frame > mClip->GetFrameCount())
+		return -1;
+
+	mCurrentFrame = (UInt32)frame;
+	return frame;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include "AudioDecoder.h"
+#include "ClipCache.h"
+
+/*! @file ClipDecoder.h @brief Support for playing clips */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A \c Decoder providing the audio in a \c Clip
+		 *
+		 * Reading copies audio from the clip, so a \c ClipDecoder has no decoding cost and seeks instantly.
+		 * Any number of \c ClipDecoder objects may share a clip, for example as voices played with
+		 * \c Player::PlayVoice() or wrapped in a \c LoopableRegionDecoder.
+		 */
+		class ClipDecoder : public Decoder
+		{
+
+		public:
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*!
+			 * @brief Create a \c ClipDecoder object for the specified \c Clip
+			 * @param clip The clip
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c ClipDecoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForClip(Clip::shared_ptr clip, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Destroy this \c ClipDecoder */
+			virtual ~ClipDecoder() = default;
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			ClipDecoder(const ClipDecoder& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			ClipDecoder& operator=(const ClipDecoder& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			/*! @brief Get the clip providing the audio */
+			inline const Clip::shared_ptr& GetClip() const			{ return mClip; }
+
+		private:
+
+			ClipDecoder() = delete;
+			ClipDecoder(Clip::shared_ptr clip, InputSource::unique_ptr inputSource);
+
+			// Source access
+			inline virtual CFURLRef _GetURL() const					{ return mClip->GetURL(); }
+
+			// Audio access
+			virtual bool _Open(CFErrorRef *error);
+			virtual bool _Close(CFErrorRef *error);
+
+			// The native format of the source audio
+			virtual SFB::CFString _GetSourceFormatDescription() const;
+
+			// Attempt to read frameCount frames of audio, returning the actual number of frames read
+			virtual UInt32 _ReadAudio(AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Source audio information
+			inline virtual SInt64 _GetTotalFrames() const			{ return mClip->GetFrameCount(); }
+			inline virtual SInt64 _GetCurrentFrame() const			{ return mCurrentFrame; }
+
+			// Seeking support
+			inline virtual bool _SupportsSeeking() const			{ return true; }
+			virtual SInt64 _SeekToFrame(SInt64 frame);
+			inline virtual SeekCost _GetSeekCost(SInt64 /*frame*/) const	{ return SeekCostConstant; }
+
+			Clip::shared_ptr		mClip;
+			UInt32					mCurrentFrame;
+		};
+
+	}
+}
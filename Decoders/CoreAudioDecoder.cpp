@@ -3,6 +3,11 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <vector>
+
 #include <CoreFoundation/CoreFoundation.h>
 #if !TARGET_OS_IPHONE
 # include <CoreServices/CoreServices.h>
@@ -16,8 +21,16 @@
 #include "CreateStringForOSType.h"
 #include "Logger.h"
 
+// The number of packets read from the file at a time
+#define PACKET_BUFFER_PACKETS 16
+
+// The number of packets to decode before a seek target if the file doesn't specify a roll distance
+#define DEFAULT_ROLL_DISTANCE_PACKETS 1
+
 namespace {
 
+	std::atomic<SFB::Audio::CoreAudioDecoder::CodecPreference> sDefaultCodecPreference(SFB::Audio::CoreAudioDecoder::CodecPreference::Default);
+
 	void RegisterCoreAudioDecoder() __attribute__ ((constructor));
 	void RegisterCoreAudioDecoder()
 	{
@@ -142,15 +155,48 @@ bool SFB::Audio::CoreAudioDecoder::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::CoreAudioDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	if(12 > length)
+		return false;
+
+	// WAVE, AIFF, AIFF-C, CAF and MPEG-4
+	if(0 == memcmp(bytes, "RIFF", 4) && 0 == memcmp(bytes + 8, "WAVE", 4))
+		return true;
+	else if(0 == memcmp(bytes, "FORM", 4) && (0 == memcmp(bytes + 8, "AIFF", 4) || 0 == memcmp(bytes + 8, "AIFC", 4)))
+		return true;
+	else if(0 == memcmp(bytes, "caff", 4))
+		return true;
+	else if(0 == memcmp(bytes + 4, "ftyp", 4))
+		return true;
+
+	return false;
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::CoreAudioDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new CoreAudioDecoder(std::move(inputSource)));
 }
 
+SFB::Audio::CoreAudioDecoder::CodecPreference SFB::Audio::CoreAudioDecoder::GetDefaultCodecPreference()
+{
+	return sDefaultCodecPreference.load();
+}
+
+void SFB::Audio::CoreAudioDecoder::SetDefaultCodecPreference(CodecPreference codecPreference)
+{
+	sDefaultCodecPreference.store(codecPreference);
+}
+
 #pragma mark Creation and Destruction
 
 SFB::Audio::CoreAudioDecoder::CoreAudioDecoder(InputSource::unique_ptr inputSource)
-	: Decoder(std::move(inputSource)), mAudioFile(nullptr), mExtAudioFile(nullptr)
+	: Decoder(std::move(inputSource)), mAudioFile(nullptr), mExtAudioFile(nullptr), mAudioConverter(nullptr), mPacketBufferPackets(0), mPacketBufferSize(0), mPacketCount(0), mNextPacket(0), mPrimingFrames(0), mValidFrames(-1), mCurrentFrame(0), mFramesToDiscard(0), mCodecPreference(sDefaultCodecPreference.load()), mUsingHardwareCodec(false)
 {}
 
 SFB::Audio::CoreAudioDecoder::~CoreAudioDecoder()
@@ -268,6 +314,14 @@ bool SFB::Audio::CoreAudioDecoder::_Open(CFErrorRef *error)
 		mFormat.mReserved			= 0;
 	}
 
+	// With a codec preference ExtAudioFile uses a software codec, so it doesn't hold a hardware codec needed by packet decoding
+	if(kAudioFormatLinearPCM != mSourceFormat.mFormatID && CodecPreference::Default != mCodecPreference) {
+		UInt32 codecManufacturer = kAppleSoftwareAudioCodecManufacturer;
+		result = ExtAudioFileSetProperty(mExtAudioFile, kExtAudioFileProperty_CodecManufacturer, sizeof(codecManufacturer), &codecManufacturer);
+		if(noErr != result)
+			LOGGER_INFO("org.sbooth.AudioEngine.Decoder.CoreAudio", "ExtAudioFileSetProperty (kExtAudioFileProperty_CodecManufacturer) failed: " << result);
+	}
+
 	result = ExtAudioFileSetProperty(mExtAudioFile, kExtAudioFileProperty_ClientDataFormat, sizeof(mFormat), &mFormat);
 
 	if(noErr != result) {
@@ -364,11 +418,22 @@ bool SFB::Audio::CoreAudioDecoder::_Open(CFErrorRef *error)
 		return false;
 	}
 
+	// Decode compressed audio directly from packets, avoiding ExtAudioFile's buffering and its inaccurate seeking
+	if(kAudioFormatLinearPCM != mSourceFormat.mFormatID && OpenPacketDecoding()) {
+		result = ExtAudioFileDispose(mExtAudioFile);
+		if(noErr != result)
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.CoreAudio", "ExtAudioFileDispose failed: " << result);
+
+		mExtAudioFile = nullptr;
+	}
+
 	return true;
 }
 
 bool SFB::Audio::CoreAudioDecoder::_Close(CFErrorRef */*error*/)
 {
+	ClosePacketDecoding();
+
 	// Close the output file
 	if(mExtAudioFile) {
 		OSStatus result = ExtAudioFileDispose(mExtAudioFile);
@@ -402,11 +467,20 @@ SFB::CFString SFB::Audio::CoreAudioDecoder::_GetSourceFormatDescription() const
 	if(noErr != result)
 		LOGGER_ERR("org.sbooth.AudioEngine.Decoder", "AudioFormatGetProperty (kAudioFormatProperty_FormatName) failed: " << result << "'" << SFB::StringForOSType((OSType)result) << "'");
 
-	return CFString(sourceFormatDescription);
+	SFB::CFString formatName(sourceFormatDescription);
+	if(!formatName || !mAudioConverter || CodecPreference::Default == mCodecPreference)
+		return formatName;
+
+	// Include the class of codec chosen for the preference
+	SFB::CFString format(mUsingHardwareCodec ? CFCopyLocalizedString(CFSTR("%@ (hardware codec)"), "") : CFCopyLocalizedString(CFSTR("%@ (software codec)"), ""));
+	return CFString(CFStringCreateWithFormat(kCFAllocatorDefault, nullptr, format, (CFStringRef)formatName));
 }
 
 UInt32 SFB::Audio::CoreAudioDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
 {
+	if(mAudioConverter)
+		return ReadPacketAudio(bufferList, frameCount);
+
 	OSStatus result = ExtAudioFileRead(mExtAudioFile, &frameCount, bufferList);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.CoreAudio", "ExtAudioFileRead failed: " << result);
@@ -418,6 +492,9 @@ UInt32 SFB::Audio::CoreAudioDecoder::_ReadAudio(AudioBufferList *bufferList, UIn
 
 SInt64 SFB::Audio::CoreAudioDecoder::_GetTotalFrames() const
 {
+	if(mAudioConverter)
+		return mValidFrames;
+
 	SInt64 totalFrames = -1;
 	UInt32 dataSize = sizeof(totalFrames);
 
@@ -430,6 +507,9 @@ SInt64 SFB::Audio::CoreAudioDecoder::_GetTotalFrames() const
 
 SInt64 SFB::Audio::CoreAudioDecoder::_GetCurrentFrame() const
 {
+	if(mAudioConverter)
+		return mCurrentFrame;
+
 	SInt64 currentFrame = -1;
 
 	OSStatus result = ExtAudioFileTell(mExtAudioFile, &currentFrame);
@@ -443,6 +523,9 @@ SInt64 SFB::Audio::CoreAudioDecoder::_GetCurrentFrame() const
 
 SInt64 SFB::Audio::CoreAudioDecoder::_SeekToFrame(SInt64 frame)
 {
+	if(mAudioConverter)
+		return SeekToPacketFrame(frame);
+
 	OSStatus result = ExtAudioFileSeek(mExtAudioFile, frame);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.CoreAudio", "ExtAudioFileSeek failed: " << result);
@@ -451,3 +534,307 @@ SInt64 SFB::Audio::CoreAudioDecoder::_SeekToFrame(SInt64 frame)
 
 	return _GetCurrentFrame();
 }
+
+#pragma mark Packet Decoding
+
+bool SFB::Audio::CoreAudioDecoder::OpenPacketDecoding()
+{
+	// Exact positioning requires a constant number of frames per packet
+	if(0 == mSourceFormat.mFramesPerPacket)
+		return false;
+
+	UInt32 dataSize = sizeof(mPacketCount);
+	OSStatus result = AudioFileGetProperty(mAudioFile, kAudioFilePropertyAudioDataPacketCount, &dataSize, &mPacketCount);
+	if(noErr != result) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioFileGetProperty (kAudioFilePropertyAudioDataPacketCount) failed: " << result);
+		return false;
+	}
+
+	UInt32 maximumPacketSize = 0;
+	dataSize = sizeof(maximumPacketSize);
+	result = AudioFileGetProperty(mAudioFile, kAudioFilePropertyPacketSizeUpperBound, &dataSize, &maximumPacketSize);
+	if(noErr != result || 0 == maximumPacketSize) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioFileGetProperty (kAudioFilePropertyPacketSizeUpperBound) failed: " << result);
+		return false;
+	}
+
+	// The packet table gives the number of encoder delay and padding frames
+	AudioFilePacketTableInfo packetTableInfo;
+	dataSize = sizeof(packetTableInfo);
+	result = AudioFileGetProperty(mAudioFile, kAudioFilePropertyPacketTableInfo, &dataSize, &packetTableInfo);
+	if(noErr == result && 0 < packetTableInfo.mNumberValidFrames) {
+		mPrimingFrames = packetTableInfo.mPrimingFrames;
+		mValidFrames = packetTableInfo.mNumberValidFrames;
+	}
+	else {
+		mPrimingFrames = 0;
+		mValidFrames = mPacketCount * mSourceFormat.mFramesPerPacket;
+	}
+
+	if(!CreateAudioConverter(true))
+		return false;
+
+	mPacketBufferPackets = PACKET_BUFFER_PACKETS;
+	mPacketBufferSize = mPacketBufferPackets * maximumPacketSize;
+	mPacketBuffer = std::unique_ptr<uint8_t []>(new uint8_t [mPacketBufferSize]);
+	mPacketDescriptions = std::unique_ptr<AudioStreamPacketDescription []>(new AudioStreamPacketDescription [mPacketBufferPackets]);
+
+	mNextPacket = 0;
+	mCurrentFrame = 0;
+	mFramesToDiscard = (UInt32)mPrimingFrames;
+
+	return true;
+}
+
+bool SFB::Audio::CoreAudioDecoder::CreateAudioConverter(bool allowHardware)
+{
+	mUsingHardwareCodec = false;
+
+	if(CodecPreference::Default == mCodecPreference) {
+		OSStatus result = AudioConverterNew(&mSourceFormat, &mFormat, &mAudioConverter);
+		if(noErr != result) {
+			LOGGER_INFO("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioConverterNew failed: " << result << "'" << SFB::StringForOSType((OSType)result) << "'");
+			mAudioConverter = nullptr;
+			return false;
+		}
+	}
+	else {
+		// Find the installed decoders for the source format
+		UInt32 dataSize = 0;
+		OSStatus result = AudioFormatGetPropertyInfo(kAudioFormatProperty_Decoders, sizeof(mSourceFormat.mFormatID), &mSourceFormat.mFormatID, &dataSize);
+		if(noErr != result || 0 == dataSize) {
+			LOGGER_INFO("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioFormatGetPropertyInfo (kAudioFormatProperty_Decoders) failed: " << result);
+			return false;
+		}
+
+		std::vector<AudioClassDescription> decoders(dataSize / sizeof(AudioClassDescription));
+		result = AudioFormatGetProperty(kAudioFormatProperty_Decoders, sizeof(mSourceFormat.mFormatID), &mSourceFormat.mFormatID, &dataSize, decoders.data());
+		if(noErr != result) {
+			LOGGER_INFO("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioFormatGetProperty (kAudioFormatProperty_Decoders) failed: " << result);
+			return false;
+		}
+
+		decoders.resize(dataSize / sizeof(AudioClassDescription));
+
+		// Try hardware codecs first if preferred, falling back to software codecs
+		for(auto codecManufacturer : { (UInt32)kAppleHardwareAudioCodecManufacturer, (UInt32)kAppleSoftwareAudioCodecManufacturer }) {
+			bool hardware = kAppleHardwareAudioCodecManufacturer == codecManufacturer;
+			if(hardware && (!allowHardware || CodecPreference::PreferHardware != mCodecPreference))
+				continue;
+
+			std::vector<AudioClassDescription> classDescriptions;
+			std::copy_if(decoders.begin(), decoders.end(), std::back_inserter(classDescriptions), [codecManufacturer](const AudioClassDescription& classDescription) {
+				return codecManufacturer == classDescription.mManufacturer;
+			});
+
+			if(classDescriptions.empty())
+				continue;
+
+			result = AudioConverterNewSpecific(&mSourceFormat, &mFormat, (UInt32)classDescriptions.size(), classDescriptions.data(), &mAudioConverter);
+			if(noErr == result) {
+				mUsingHardwareCodec = hardware;
+				break;
+			}
+
+			// A hardware codec may be in use by another client
+			LOGGER_INFO("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioConverterNewSpecific failed for " << (hardware ? "hardware" : "software") << " codecs: " << result << "'" << SFB::StringForOSType((OSType)result) << "'");
+			mAudioConverter = nullptr;
+		}
+
+		if(!mAudioConverter)
+			return false;
+
+		LOGGER_DEBUG("org.sbooth.AudioEngine.Decoder.CoreAudio", "Using a " << (mUsingHardwareCodec ? "hardware" : "software") << " codec for " << mInputSource->GetURL());
+	}
+
+	// The converter's priming is disabled since priming frames are discarded using the packet table
+	UInt32 primeMethod = kConverterPrimeMethod_None;
+	OSStatus result = AudioConverterSetProperty(mAudioConverter, kAudioConverterPrimeMethod, sizeof(primeMethod), &primeMethod);
+	if(noErr != result)
+		LOGGER_INFO("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioConverterSetProperty (kAudioConverterPrimeMethod) failed: " << result);
+
+	// Pass the magic cookie to the decoder
+	UInt32 dataSize = 0;
+	result = AudioFileGetPropertyInfo(mAudioFile, kAudioFilePropertyMagicCookieData, &dataSize, nullptr);
+	if(noErr == result && 0 < dataSize) {
+		std::unique_ptr<uint8_t []> magicCookie(new uint8_t [dataSize]);
+		result = AudioFileGetProperty(mAudioFile, kAudioFilePropertyMagicCookieData, &dataSize, magicCookie.get());
+		if(noErr == result)
+			result = AudioConverterSetProperty(mAudioConverter, kAudioConverterDecompressionMagicCookie, dataSize, magicCookie.get());
+
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.CoreAudio", "Unable to set the decompression magic cookie: " << result);
+
+			result = AudioConverterDispose(mAudioConverter);
+			if(noErr != result)
+				LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioConverterDispose failed: " << result);
+
+			mAudioConverter = nullptr;
+			mUsingHardwareCodec = false;
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+#if TARGET_OS_IPHONE
+bool SFB::Audio::CoreAudioDecoder::SwitchToSoftwareCodec(SInt64 frame)
+{
+	LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.CoreAudio", "Hardware codec unavailable, switching to a software codec for " << mInputSource->GetURL());
+
+	OSStatus result = AudioConverterDispose(mAudioConverter);
+	if(noErr != result)
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioConverterDispose failed: " << result);
+
+	mAudioConverter = nullptr;
+
+	// The source format still describes compressed audio so the software converter can take over mid-stream
+	if(!CreateAudioConverter(false))
+		return false;
+
+	return -1 != SeekToPacketFrame(frame);
+}
+#endif
+
+void SFB::Audio::CoreAudioDecoder::ClosePacketDecoding()
+{
+	if(mAudioConverter) {
+		OSStatus result = AudioConverterDispose(mAudioConverter);
+		if(noErr != result)
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioConverterDispose failed: " << result);
+
+		mAudioConverter = nullptr;
+	}
+
+	mUsingHardwareCodec = false;
+
+	mPacketBuffer.reset();
+	mPacketDescriptions.reset();
+	mPacketBufferPackets = 0;
+	mPacketBufferSize = 0;
+}
+
+UInt32 SFB::Audio::CoreAudioDecoder::ReadPacketAudio(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	// Padding frames at the end of the audio are not returned
+	frameCount = (UInt32)std::min((SInt64)frameCount, std::max(mValidFrames - mCurrentFrame, (SInt64)0));
+
+	// Allocate an alias to the buffer list, which will contain pointers to the current write position in the output buffer
+	AudioBufferList *bufferListAlias = (AudioBufferList *)alloca(offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * bufferList->mNumberBuffers));
+	bufferListAlias->mNumberBuffers = bufferList->mNumberBuffers;
+
+	UInt32 framesRead = 0;
+	while(framesRead < frameCount) {
+		for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+			bufferListAlias->mBuffers[i].mNumberChannels	= bufferList->mBuffers[i].mNumberChannels;
+			bufferListAlias->mBuffers[i].mData				= (uint8_t *)bufferList->mBuffers[i].mData + (framesRead * mFormat.mBytesPerFrame);
+			bufferListAlias->mBuffers[i].mDataByteSize		= (frameCount - framesRead) * mFormat.mBytesPerFrame;
+		}
+
+		UInt32 framesDecoded = frameCount - framesRead;
+		OSStatus result = AudioConverterFillComplexBuffer(mAudioConverter, FillPackets, this, &framesDecoded, bufferListAlias, nullptr);
+#if TARGET_OS_IPHONE
+		// The hardware codec may be taken by another client, for example after an audio session interruption
+		if(mUsingHardwareCodec && (kAudioConverterErr_HardwareInUse == result || kAudioConverterErr_NoHardwarePermission == result)) {
+			// Repositioning sets the current frame, which is advanced by the frames read when the loop ends
+			SInt64 currentFrame = mCurrentFrame;
+			if(SwitchToSoftwareCodec(currentFrame + framesRead)) {
+				mCurrentFrame = currentFrame;
+				continue;
+			}
+		}
+#endif
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioConverterFillComplexBuffer failed: " << result << "'" << SFB::StringForOSType((OSType)result) << "'");
+			break;
+		}
+
+		if(0 == framesDecoded)
+			break;
+
+		// Discard frames preceding the current position by moving the remaining frames over them
+		UInt32 framesToDiscard = std::min(mFramesToDiscard, framesDecoded);
+		if(0 < framesToDiscard) {
+			for(UInt32 i = 0; i < bufferListAlias->mNumberBuffers; ++i) {
+				auto data = (uint8_t *)bufferListAlias->mBuffers[i].mData;
+				memmove(data, data + (framesToDiscard * mFormat.mBytesPerFrame), (framesDecoded - framesToDiscard) * mFormat.mBytesPerFrame);
+			}
+
+			mFramesToDiscard -= framesToDiscard;
+			framesDecoded -= framesToDiscard;
+		}
+
+		framesRead += framesDecoded;
+	}
+
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+		bufferList->mBuffers[i].mDataByteSize = framesRead * mFormat.mBytesPerFrame;
+
+	mCurrentFrame += framesRead;
+
+	return framesRead;
+}
+
+SInt64 SFB::Audio::CoreAudioDecoder::SeekToPacketFrame(SInt64 frame)
+{
+	SInt64 framesPerPacket = mSourceFormat.mFramesPerPacket;
+	SInt64 packet = (frame + mPrimingFrames) / framesPerPacket;
+
+	// Decoding must begin early enough for the decoder's output to converge by the target packet
+	SInt64 rollDistance = DEFAULT_ROLL_DISTANCE_PACKETS;
+	AudioFilePacketRollDistanceTranslation rollDistanceTranslation = { packet, 0 };
+	UInt32 dataSize = sizeof(rollDistanceTranslation);
+	if(noErr == AudioFileGetProperty(mAudioFile, kAudioFilePropertyPacketToRollDistance, &dataSize, &rollDistanceTranslation))
+		rollDistance = rollDistanceTranslation.mRollDistance;
+
+	SInt64 startingPacket = std::max(packet - rollDistance, (SInt64)0);
+
+	OSStatus result = AudioConverterReset(mAudioConverter);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioConverterReset failed: " << result);
+		return -1;
+	}
+
+	mNextPacket = startingPacket;
+	mFramesToDiscard = (UInt32)(frame + mPrimingFrames - (startingPacket * framesPerPacket));
+	mCurrentFrame = frame;
+
+	return mCurrentFrame;
+}
+
+OSStatus SFB::Audio::CoreAudioDecoder::FillPackets(AudioConverterRef /*inAudioConverter*/, UInt32 *ioNumberDataPackets, AudioBufferList *ioData, AudioStreamPacketDescription **outDataPacketDescription, void *inUserData)
+{
+	assert(nullptr != inUserData);
+
+	auto decoder = static_cast<CoreAudioDecoder *>(inUserData);
+
+	// Zero packets indicates the end of the audio
+	UInt32 packetCount = (UInt32)std::min((SInt64)std::min(*ioNumberDataPackets, decoder->mPacketBufferPackets), decoder->mPacketCount - decoder->mNextPacket);
+	UInt32 byteCount = decoder->mPacketBufferSize;
+
+	if(0 < packetCount) {
+		OSStatus result = AudioFileReadPacketData(decoder->mAudioFile, false, &byteCount, decoder->mPacketDescriptions.get(), decoder->mNextPacket, &packetCount, decoder->mPacketBuffer.get());
+		if(noErr != result && kAudioFileEndOfFileError != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.CoreAudio", "AudioFileReadPacketData failed: " << result);
+			*ioNumberDataPackets = 0;
+			return result;
+		}
+	}
+	else
+		byteCount = 0;
+
+	decoder->mNextPacket += packetCount;
+
+	ioData->mBuffers[0].mData				= decoder->mPacketBuffer.get();
+	ioData->mBuffers[0].mDataByteSize		= byteCount;
+	ioData->mBuffers[0].mNumberChannels		= decoder->mSourceFormat.mChannelsPerFrame;
+
+	if(outDataPacketDescription)
+		*outDataPacketDescription = decoder->mPacketDescriptions.get();
+
+	*ioNumberDataPackets = packetCount;
+
+	return noErr;
+}
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <memory>
+#include <AudioToolbox/AudioConverter.h>
 #include <AudioToolbox/ExtendedAudioFile.h>
 
 #include "AudioDecoder.h"
@@ -28,6 +29,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
@@ -35,6 +37,27 @@ namespace SFB {
 			explicit CoreAudioDecoder(InputSource::unique_ptr inputSource);
 			virtual ~CoreAudioDecoder();
 
+			// ========================================
+			// Codec selection
+
+			// The classes of codec considered when decoding compressed audio
+			enum class CodecPreference {
+				Default,			// Core Audio's default selection
+				PreferHardware,		// A hardware codec if available and not in use, otherwise a software codec
+				SoftwareOnly		// A software codec
+			};
+
+			// The preference used by decoders created after the call (default is CodecPreference::Default)
+			static CodecPreference GetDefaultCodecPreference();
+			static void SetDefaultCodecPreference(CodecPreference codecPreference);
+
+			// The preference takes effect when the decoder is opened
+			inline CodecPreference GetCodecPreference() const							{ return mCodecPreference; }
+			inline void SetCodecPreference(CodecPreference codecPreference)			{ mCodecPreference = codecPreference; }
+
+			// Whether the audio is being decoded by a hardware codec
+			inline bool IsUsingHardwareCodec() const									{ return mUsingHardwareCodec; }
+
 		private:
 
 			// Audio access
@@ -55,9 +78,37 @@ namespace SFB {
 			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
 
+			// Packet decoding, used for compressed formats in place of ExtAudioFile
+			bool OpenPacketDecoding();
+			bool CreateAudioConverter(bool allowHardware);
+#if TARGET_OS_IPHONE
+			bool SwitchToSoftwareCodec(SInt64 frame);
+#endif
+			void ClosePacketDecoding();
+			UInt32 ReadPacketAudio(AudioBufferList *bufferList, UInt32 frameCount);
+			SInt64 SeekToPacketFrame(SInt64 frame);
+
+			// Supply packets to mAudioConverter
+			static OSStatus FillPackets(AudioConverterRef inAudioConverter, UInt32 *ioNumberDataPackets, AudioBufferList *ioData, AudioStreamPacketDescription **outDataPacketDescription, void *inUserData);
+
 			// Data members
 			AudioFileID			mAudioFile;
 			ExtAudioFileRef		mExtAudioFile;
+
+			AudioConverterRef									mAudioConverter;
+			std::unique_ptr<uint8_t []>							mPacketBuffer;
+			std::unique_ptr<AudioStreamPacketDescription []>	mPacketDescriptions;
+			UInt32												mPacketBufferPackets;
+			UInt32												mPacketBufferSize;
+			SInt64												mPacketCount;
+			SInt64												mNextPacket;
+			SInt64												mPrimingFrames;
+			SInt64												mValidFrames;
+			SInt64												mCurrentFrame;
+			UInt32												mFramesToDiscard;
+
+			CodecPreference										mCodecPreference;
+			bool												mUsingHardwareCodec;
 		};
 
 	}
@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+
+#include <strings.h>
+#include <unistd.h>
+
+#include "CueSheet.h"
+#include "CFErrorUtilities.h"
+#include "InputSource.h"
+#include "Logger.h"
+#include "SharedRegionDecoder.h"
+
+// The largest cue sheet that will be parsed
+#define MAX_CUE_SHEET_SIZE (1024 * 1024)
+
+namespace {
+
+	// Extensions tried when a cue sheet names a file that doesn't exist, commonly because the image was compressed after ripping
+	const char * const sImageExtensions [] = { "flac", "ape", "wv", "tta", "wav" };
+
+	// Split a line into whitespace-separated tokens, keeping quoted strings intact
+	std::vector<std::string> Tokenize(const std::string& line)
+	{
+		std::vector<std::string> tokens;
+		size_t i = 0;
+		while(i < line.size()) {
+			if(isspace((unsigned char)line[i])) {
+				++i;
+				continue;
+			}
+
+			if('"' == line[i]) {
+				size_t end = line.find('"', i + 1);
+				if(std::string::npos == end)
+					end = line.size();
+				tokens.push_back(line.substr(i + 1, end - i - 1));
+				i = end + 1;
+			}
+			else {
+				size_t end = i;
+				while(end < line.size() && !isspace((unsigned char)line[end]))
+					++end;
+				tokens.push_back(line.substr(i, end - i));
+				i = end;
+			}
+		}
+
+		return tokens;
+	}
+
+	bool KeywordEquals(const std::string& token, const char *keyword)
+	{
+		return 0 == strcasecmp(token.c_str(), keyword);
+	}
+
+	SFB::CFString CreateString(const std::string& string)
+	{
+		return SFB::CFString(CFStringCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)string.data(), (CFIndex)string.size(), kCFStringEncodingUTF8, false));
+	}
+
+	// Parse an mm:ss:ff position
+	bool ParsePosition(const std::string& token, SInt64& cueFrame)
+	{
+		unsigned minutes, seconds, frames;
+		if(3 != sscanf(token.c_str(), "%u:%u:%u", &minutes, &seconds, &frames) || 60 <= seconds || SFB::Audio::CueSheet::FramesPerSecond <= frames)
+			return false;
+
+		cueFrame = ((SInt64)minutes * 60 + seconds) * SFB::Audio::CueSheet::FramesPerSecond + frames;
+		return true;
+	}
+
+	// Resolve the file named in a cue sheet
+	SFB::CFURL CreateFileURL(std::string name, CFURLRef baseURL)
+	{
+		std::replace(name.begin(), name.end(), '\\', '/');
+
+		SFB::CFString path = CreateString(name);
+		if(!path)
+			return SFB::CFURL();
+
+		SFB::CFURL relativeURL(CFURLCreateWithFileSystemPathRelativeToBase(kCFAllocatorDefault, path, kCFURLPOSIXPathStyle, false, '/' == name[0] ? nullptr : baseURL));
+		if(!relativeURL)
+			return SFB::CFURL();
+
+		SFB::CFURL url(CFURLCopyAbsoluteURL(relativeURL));
+
+		char fileSystemPath [PATH_MAX];
+		if(!url || !CFURLGetFileSystemRepresentation(url, FALSE, (UInt8 *)fileSystemPath, PATH_MAX) || 0 == access(fileSystemPath, F_OK))
+			return url;
+
+		// Try other extensions for the same file
+		SFB::CFURL urlWithoutExtension(CFURLCreateCopyDeletingPathExtension(kCFAllocatorDefault, url));
+		if(!urlWithoutExtension)
+			return url;
+
+		for(auto extension : sImageExtensions) {
+			SFB::CFString extensionString(CFStringCreateWithCString(kCFAllocatorDefault, extension, kCFStringEncodingASCII));
+			SFB::CFURL candidateURL(CFURLCreateCopyAppendingPathExtension(kCFAllocatorDefault, urlWithoutExtension, extensionString));
+			if(candidateURL && CFURLGetFileSystemRepresentation(candidateURL, FALSE, (UInt8 *)fileSystemPath, PATH_MAX) && 0 == access(fileSystemPath, F_OK)) {
+				LOGGER_INFO("org.sbooth.AudioEngine.CueSheet", "Using " << fileSystemPath << " for \"" << name << "\"");
+				return candidateURL;
+			}
+		}
+
+		return url;
+	}
+
+	CFErrorRef CreateInvalidCueSheetError(CFURLRef url) CF_RETURNS_RETAINED
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid cue sheet."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not a cue sheet"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's contents could not be parsed or contain no audio tracks."), ""));
+
+		return CreateErrorForURL(SFB::Audio::Decoder::ErrorDomain, SFB::Audio::Decoder::FileFormatNotRecognizedError, description, url, failureReason, recoverySuggestion);
+	}
+
+}
+
+#pragma mark Factory Methods
+
+SFB::Audio::CueSheet::unique_ptr SFB::Audio::CueSheet::CreateForURL(CFURLRef url, CFErrorRef *error)
+{
+	if(nullptr == url)
+		return nullptr;
+
+	auto inputSource = InputSource::CreateForURL(url, 0, error);
+	if(!inputSource || !inputSource->Open(error))
+		return nullptr;
+
+	SInt64 length = inputSource->GetLength();
+	if(0 >= length || MAX_CUE_SHEET_SIZE < length) {
+		if(error)
+			*error = CreateInvalidCueSheetError(url);
+
+		return nullptr;
+	}
+
+	std::vector<UInt8> bytes((size_t)length);
+	if(length != inputSource->Read(bytes.data(), length)) {
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be read."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file may have been renamed, moved, deleted, or you may not have appropriate permissions."), ""));
+
+			*error = CreateErrorForURL(InputSource::ErrorDomain, InputSource::InputOutputError, description, url, failureReason, recoverySuggestion);
+		}
+
+		return nullptr;
+	}
+
+	SFB::CFData data(CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, bytes.data(), (CFIndex)bytes.size(), kCFAllocatorNull));
+	SFB::CFURL baseURL(CFURLCreateCopyDeletingLastPathComponent(kCFAllocatorDefault, url));
+
+	auto cueSheet = CreateWithData(data, baseURL, error);
+	if(!cueSheet && error && *error) {
+		// Report the cue sheet's URL rather than its directory
+		CFRelease(*error);
+		*error = CreateInvalidCueSheetError(url);
+	}
+
+	return cueSheet;
+}
+
+SFB::Audio::CueSheet::unique_ptr SFB::Audio::CueSheet::CreateWithData(CFDataRef data, CFURLRef baseURL, CFErrorRef *error)
+{
+	if(nullptr == data)
+		return nullptr;
+
+	const UInt8 *bytes = CFDataGetBytePtr(data);
+	CFIndex length = CFDataGetLength(data);
+
+	// Skip a UTF-8 byte order mark
+	if(3 <= length && 0xEF == bytes[0] && 0xBB == bytes[1] && 0xBF == bytes[2]) {
+		bytes += 3;
+		length -= 3;
+	}
+
+	// Cue sheets written by older software are usually in the system code page
+	SFB::CFString contents(CFStringCreateWithBytes(kCFAllocatorDefault, bytes, length, kCFStringEncodingUTF8, false));
+	if(!contents)
+		contents = SFB::CFString(CFStringCreateWithBytes(kCFAllocatorDefault, bytes, length, kCFStringEncodingWindowsLatin1, false));
+
+	unique_ptr cueSheet(new CueSheet());
+	if(!contents || !cueSheet->Parse(contents, baseURL)) {
+		if(error)
+			*error = CreateInvalidCueSheetError(baseURL);
+
+		return nullptr;
+	}
+
+	return cueSheet;
+}
+
+#pragma mark Cue Sheet Information
+
+SInt64 SFB::Audio::CueSheet::AudioFrameForCueFrame(SInt64 cueFrame, Float64 sampleRate)
+{
+	return (SInt64)llround((Float64)cueFrame * sampleRate / FramesPerSecond);
+}
+
+#pragma mark Track Decoding
+
+std::vector<SFB::Audio::Decoder::unique_ptr> SFB::Audio::CueSheet::CreateTrackDecoders(CFErrorRef *error) const
+{
+	std::vector<Decoder::unique_ptr> decoders;
+
+	// Tracks in the same file share a decoder
+	for(size_t first = 0; first < mTracks.size(); ) {
+		size_t last = first;
+		while(last + 1 < mTracks.size() && CFEqual(mTracks[last + 1].mURL, mTracks[first].mURL))
+			++last;
+
+		auto decoder = Decoder::CreateForURL(mTracks[first].mURL, error);
+		if(!decoder || (!decoder->IsOpen() && !decoder->Open(error)))
+			return {};
+
+		Float64 sampleRate = decoder->GetFormat().mSampleRate;
+
+		std::vector<SharedRegionDecoder::Region> regions;
+		for(size_t i = first; i <= last; ++i) {
+			SInt64 startingFrame = AudioFrameForCueFrame(mTracks[i].mIndex01, sampleRate);
+			SInt64 frameCount = i < last ? AudioFrameForCueFrame(mTracks[i + 1].mIndex01, sampleRate) - startingFrame : 0;
+			regions.push_back({ startingFrame, frameCount });
+		}
+
+		auto regionDecoders = SharedRegionDecoder::CreateForDecoderRegions(std::move(decoder), regions, error);
+		if(regionDecoders.empty())
+			return {};
+
+		std::move(regionDecoders.begin(), regionDecoders.end(), std::back_inserter(decoders));
+
+		first = last + 1;
+	}
+
+	return decoders;
+}
+
+#pragma mark Parsing
+
+bool SFB::Audio::CueSheet::Parse(CFStringRef contents, CFURLRef baseURL)
+{
+	CFIndex contentsLength = CFStringGetLength(contents);
+	CFIndex bufferSize = CFStringGetMaximumSizeForEncoding(contentsLength, kCFStringEncodingUTF8) + 1;
+	std::vector<char> buffer((size_t)bufferSize);
+	if(!CFStringGetCString(contents, buffer.data(), bufferSize, kCFStringEncodingUTF8))
+		return false;
+
+	std::string text(buffer.data());
+
+	SFB::CFURL currentFileURL;
+	Track *track = nullptr;
+	bool trackIsAudio = false;
+
+	size_t lineStart = 0;
+	while(lineStart < text.size()) {
+		size_t lineEnd = text.find_first_of("\r\n", lineStart);
+		if(std::string::npos == lineEnd)
+			lineEnd = text.size();
+
+		auto tokens = Tokenize(text.substr(lineStart, lineEnd - lineStart));
+		lineStart = lineEnd + 1;
+
+		if(tokens.empty())
+			continue;
+
+		const std::string& keyword = tokens[0];
+
+		if(KeywordEquals(keyword, "FILE") && 2 <= tokens.size()) {
+			currentFileURL = CreateFileURL(tokens[1], baseURL);
+			track = nullptr;
+		}
+		else if(KeywordEquals(keyword, "TRACK") && 3 <= tokens.size()) {
+			if(!currentFileURL) {
+				LOGGER_WARNING("org.sbooth.AudioEngine.CueSheet", "TRACK before FILE");
+				return false;
+			}
+
+			// Only audio tracks are decoded
+			trackIsAudio = KeywordEquals(tokens[2], "AUDIO");
+			track = nullptr;
+			if(trackIsAudio) {
+				mTracks.push_back({ (UInt32)strtoul(tokens[1].c_str(), nullptr, 10), currentFileURL, -1, -1, SFB::CFString(), SFB::CFString(), SFB::CFString() });
+				track = &mTracks.back();
+			}
+		}
+		else if(KeywordEquals(keyword, "INDEX") && 3 <= tokens.size() && track) {
+			SInt64 cueFrame;
+			if(!ParsePosition(tokens[2], cueFrame)) {
+				LOGGER_WARNING("org.sbooth.AudioEngine.CueSheet", "Invalid INDEX position: " << tokens[2]);
+				return false;
+			}
+
+			unsigned long index = strtoul(tokens[1].c_str(), nullptr, 10);
+			if(0 == index)
+				track->mIndex00 = cueFrame;
+			else if(1 == index)
+				track->mIndex01 = cueFrame;
+		}
+		else if(KeywordEquals(keyword, "TITLE") && 2 <= tokens.size()) {
+			if(track)
+				track->mTitle = CreateString(tokens[1]);
+			else if(mTracks.empty() && !trackIsAudio)
+				mTitle = CreateString(tokens[1]);
+		}
+		else if(KeywordEquals(keyword, "PERFORMER") && 2 <= tokens.size()) {
+			if(track)
+				track->mPerformer = CreateString(tokens[1]);
+			else if(mTracks.empty() && !trackIsAudio)
+				mPerformer = CreateString(tokens[1]);
+		}
+		else if(KeywordEquals(keyword, "ISRC") && 2 <= tokens.size() && track)
+			track->mISRC = CreateString(tokens[1]);
+	}
+
+	// Every track must have a start, and tracks in the same file must be in order
+	for(size_t i = 0; i < mTracks.size(); ++i) {
+		if(-1 == mTracks[i].mIndex01) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.CueSheet", "Track " << mTracks[i].mNumber << " has no INDEX 01");
+			return false;
+		}
+
+		if(0 < i && CFEqual(mTracks[i - 1].mURL, mTracks[i].mURL) && mTracks[i].mIndex01 <= mTracks[i - 1].mIndex01) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.CueSheet", "Track " << mTracks[i].mNumber << " begins before the preceding track");
+			return false;
+		}
+	}
+
+	return !mTracks.empty();
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "AudioDecoder.h"
+#include "CFWrapper.h"
+
+/*! @file CueSheet.h @brief Support for cue sheets describing the tracks of an album image */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief The tracks described by a cue sheet
+		 *
+		 * Each audio track begins at its \c INDEX \c 01 and ends where the following track in the same file
+		 * begins, so any pregap is part of the preceding track.  The last track in a file ends with the file.
+		 */
+		class CueSheet
+		{
+
+		public:
+
+			/*! @brief The number of cue sheet frames (CD sectors) per second */
+			static const SInt64 FramesPerSecond = 75;
+
+			/*! @brief A track in a cue sheet */
+			struct Track
+			{
+				UInt32 mNumber;					/*!< @brief The track number */
+				SFB::CFURL mURL;				/*!< @brief The URL of the file containing the track */
+				SInt64 mIndex00;				/*!< @brief The start of the pregap in cue sheet frames, or \c -1 if none */
+				SInt64 mIndex01;				/*!< @brief The start of the track in cue sheet frames */
+				SFB::CFString mTitle;			/*!< @brief The track's title, or \c nullptr */
+				SFB::CFString mPerformer;		/*!< @brief The track's performer, or \c nullptr */
+				SFB::CFString mISRC;			/*!< @brief The track's ISRC, or \c nullptr */
+			};
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*! @brief A \c std::unique_ptr for \c CueSheet objects */
+			using unique_ptr = std::unique_ptr<CueSheet>;
+
+			/*!
+			 * @brief Create a \c CueSheet by parsing the specified file
+			 * @param url The URL of the cue sheet
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c CueSheet object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForURL(CFURLRef url, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create a \c CueSheet by parsing the specified data
+			 * @param data The contents of the cue sheet, in UTF-8 or Windows Latin 1
+			 * @param baseURL The URL relative to which the cue sheet's files are resolved
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c CueSheet object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateWithData(CFDataRef data, CFURLRef baseURL, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Cue Sheet Information */
+			//@{
+
+			/*! @brief Get the album title, or \c nullptr */
+			inline CFStringRef GetTitle() const							{ return mTitle; }
+
+			/*! @brief Get the album performer, or \c nullptr */
+			inline CFStringRef GetPerformer() const						{ return mPerformer; }
+
+			/*! @brief Get the audio tracks, in order */
+			inline const std::vector<Track>& GetTracks() const			{ return mTracks; }
+
+			/*! @brief Convert a position in cue sheet frames to audio frames at \c sampleRate */
+			static SInt64 AudioFrameForCueFrame(SInt64 cueFrame, Float64 sampleRate);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Track Decoding */
+			//@{
+
+			/*!
+			 * @brief Create a decoder for each track
+			 *
+			 * The tracks in each file share one open \c Decoder, so tracks read in order are decoded sequentially
+			 * without seeking.
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return One decoder per track, in order, or an empty vector on failure
+			 * @see SharedRegionDecoder
+			 */
+			std::vector<Decoder::unique_ptr> CreateTrackDecoders(CFErrorRef *error = nullptr) const;
+
+			//@}
+
+		private:
+
+			CueSheet() = default;
+
+			// Parse the contents of a cue sheet
+			bool Parse(CFStringRef contents, CFURLRef baseURL);
+
+			SFB::CFString		mTitle;
+			SFB::CFString		mPerformer;
+			std::vector<Track>	mTracks;
+		};
+
+	}
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include <dispatch/dispatch.h>
+
+#include "DSDAttenuationDecoder.h"
+#include "CFErrorUtilities.h"
+#include "Logger.h"
+
+// The time taken by a full scale change in level
+#define GAIN_RAMP_SECONDS 0.01
+
+// The magnitude to which the quantization error is limited, allowing recovery from overload
+#define MAX_QUANTIZATION_ERROR 2.f
+
+// Channels are remodulated concurrently when there are at least this many
+#define PARALLEL_MODULATION_CHANNEL_THRESHOLD 3
+
+constexpr float SFB::Audio::DSDAttenuationDecoder::AttenuationStep;
+constexpr float SFB::Audio::DSDAttenuationDecoder::MaximumAttenuation;
+
+// A second-order error feedback sigma-delta modulator with noise transfer function (1 - z^-1)^2
+// The input bits pass through a four tap moving average before scaling, removing the energy near
+// half the sample rate that would otherwise overload the modulator
+struct SFB::Audio::DSDAttenuationDecoder::Modulator
+{
+	Modulator()
+		: mError1(0), mError2(0), mHistory(0)
+	{}
+
+	inline void Reset()
+	{
+		mError1 = mError2 = 0;
+		mHistory = 0;
+	}
+
+	// Remodulate count bytes in place, scaling each by its entry in gains
+	void Process(uint8_t *dsd, size_t count, const float *gains, bool lsbitfirst)
+	{
+		for(size_t i = 0; i < count; ++i) {
+			// The moving average of four bits mapped to +/-1 is (2 * set bits - 4) / 4
+			const float scale = 0.25f * gains[i];
+
+			unsigned in = dsd[i], out = 0;
+			for(unsigned bit = 0; bit < 8; ++bit) {
+				unsigned shift = lsbitfirst ? bit : 7 - bit;
+
+				mHistory = ((mHistory << 1) | ((in >> shift) & 1)) & 0xf;
+				float x = scale * (float)(2 * __builtin_popcount(mHistory) - 4);
+
+				float u = x + (2 * mError1) - mError2;
+				unsigned y = 0 <= u;
+				float e = std::max(-MAX_QUANTIZATION_ERROR, std::min(u - (y ? 1.f : -1.f), MAX_QUANTIZATION_ERROR));
+
+				mError2 = mError1;
+				mError1 = e;
+
+				out |= y << shift;
+			}
+
+			dsd[i] = (uint8_t)out;
+		}
+	}
+
+	float		mError1;
+	float		mError2;
+	unsigned	mHistory;
+};
+
+#pragma mark Factory Methods
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::DSDAttenuationDecoder::CreateForURL(CFURLRef url, CFErrorRef *error)
+{
+	return CreateForInputSource(InputSource::CreateForURL(url, 0, error), error);
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::DSDAttenuationDecoder::CreateForInputSource(InputSource::unique_ptr inputSource, CFErrorRef *error)
+{
+	if(!inputSource)
+		return nullptr;
+
+	return CreateForDecoder(Decoder::CreateForInputSource(std::move(inputSource), error), error);
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::DSDAttenuationDecoder::CreateForDecoder(unique_ptr decoder, CFErrorRef *error)
+{
+#pragma unused(error)
+
+	if(!decoder)
+		return nullptr;
+
+	return unique_ptr(new DSDAttenuationDecoder(std::move(decoder)));
+}
+
+SFB::Audio::DSDAttenuationDecoder::DSDAttenuationDecoder(Decoder::unique_ptr decoder)
+	: mDecoder(std::move(decoder)), mGain(1), mGainStep(1), mLSBitFirst(false), mAttenuation(0), mMuted(false)
+{
+	assert(nullptr != mDecoder);
+}
+
+bool SFB::Audio::DSDAttenuationDecoder::SetAttenuation(float attenuation)
+{
+	if(0 > attenuation || MaximumAttenuation < attenuation) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.DSDAttenuation", "Invalid attenuation: " << attenuation);
+		return false;
+	}
+
+	mAttenuation = AttenuationStep * std::round(attenuation / AttenuationStep);
+	return true;
+}
+
+bool SFB::Audio::DSDAttenuationDecoder::_Open(CFErrorRef *error)
+{
+	if(!mDecoder->IsOpen() && !mDecoder->Open(error))
+		return false;
+
+	const auto& decoderFormat = mDecoder->GetFormat();
+
+	if(!decoderFormat.IsDSD()) {
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid DSD file."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not a DSD file"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
+
+			*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::InputOutputError, description, GetURL(), failureReason, recoverySuggestion);
+		}
+
+		return false;
+	}
+
+	// The output is DSD in the same format
+	mFormat = decoderFormat;
+	mChannelLayout = mDecoder->GetChannelLayout();
+
+	mLSBitFirst = !(kAudioFormatFlagIsBigEndian & decoderFormat.mFormatFlags);
+
+	mModulators.assign(mFormat.mChannelsPerFrame, Modulator());
+	mGainStep = (float)(8 / (GAIN_RAMP_SECONDS * mFormat.mSampleRate));
+	mGain = mMuted ? 0 : std::pow(10.f, -mAttenuation / 20.f);
+
+	return true;
+}
+
+bool SFB::Audio::DSDAttenuationDecoder::_Close(CFErrorRef *error)
+{
+	if(!mDecoder->Close(error))
+		return false;
+
+	mModulators.clear();
+	mGains.clear();
+	mGains.shrink_to_fit();
+
+	return true;
+}
+
+SFB::CFString SFB::Audio::DSDAttenuationDecoder::_GetSourceFormatDescription() const
+{
+	return CFString(mDecoder->CreateSourceFormatDescription());
+}
+
+#pragma mark Functionality
+
+UInt32 SFB::Audio::DSDAttenuationDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	// Only multiples of 8 frames can be read (8 frames equals one byte)
+	if(bufferList->mNumberBuffers != mFormat.mChannelsPerFrame || 0 != frameCount % 8) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.DSDAttenuation", "_ReadAudio() called with invalid parameters");
+		return 0;
+	}
+
+	// The DSD is read directly into the output and remodulated in place
+	UInt32 framesRead = mDecoder->ReadAudio(bufferList, frameCount);
+	if(0 == framesRead)
+		return 0;
+
+	const float targetGain = mMuted ? 0 : std::pow(10.f, -mAttenuation / 20.f);
+
+	// At unity gain the DSD passes through unchanged
+	if(1 == targetGain && 1 == mGain) {
+		for(auto& modulator : mModulators)
+			modulator.Reset();
+		return framesRead;
+	}
+
+	// The gain is ramped toward its target a byte at a time, identically for all channels
+	// NB: Currently DSDIFFDecoder and DSFDecoder only produce non-interleaved output
+	UInt32 byteCount = framesRead / 8;
+	mGains.resize(byteCount);
+	for(UInt32 i = 0; i < byteCount; ++i) {
+		if(mGain < targetGain)
+			mGain = std::min(mGain + mGainStep, targetGain);
+		else if(mGain > targetGain)
+			mGain = std::max(mGain - mGainStep, targetGain);
+		mGains[i] = mGain;
+	}
+
+	// The modulator's feedback loop is serial, but channels are independent
+	auto modulateChannel = ^(size_t i) {
+		mModulators[i].Process((uint8_t *)bufferList->mBuffers[i].mData, byteCount, mGains.data(), mLSBitFirst);
+	};
+
+	if(PARALLEL_MODULATION_CHANNEL_THRESHOLD <= bufferList->mNumberBuffers)
+		dispatch_apply(bufferList->mNumberBuffers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), modulateChannel);
+	else {
+		for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+			modulateChannel(i);
+	}
+
+	return framesRead;
+}
+
+SInt64 SFB::Audio::DSDAttenuationDecoder::_SeekToFrame(SInt64 frame)
+{
+	if(-1 == mDecoder->SeekToFrame(frame))
+		return -1;
+
+	for(auto& modulator : mModulators)
+		modulator.Reset();
+
+	return _GetCurrentFrame();
+}
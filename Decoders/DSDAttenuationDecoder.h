@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "AudioDecoder.h"
+
+/*! @file DSDAttenuationDecoder.h @brief Support for attenuating DSD without conversion to PCM */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A wrapper around a Decoder supporting attenuation and soft muting of DSD
+		 *
+		 * The attenuated signal is requantized to one bit by a second-order sigma-delta modulator, so the output
+		 * remains DSD and may be passed to \c DoPDecoder or a native DSD output.  When no attenuation is
+		 * applied the DSD passes through unchanged.  Changes in level are ramped to avoid clicks.
+		 */
+		class DSDAttenuationDecoder : public Decoder
+		{
+
+		public:
+
+			/*! @brief The attenuation step size, in dB */
+			static constexpr float AttenuationStep = 0.5f;
+
+			/*! @brief The maximum attenuation, in dB */
+			static constexpr float MaximumAttenuation = 90.f;
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*!
+			 * @brief Create a \c DSDAttenuationDecoder object for the specified URL
+			 * @param url The URL
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c DSDAttenuationDecoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForURL(CFURLRef url, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create a \c DSDAttenuationDecoder object for the specified \c InputSource
+			 * @param inputSource The input source
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c DSDAttenuationDecoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForInputSource(InputSource::unique_ptr inputSource, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create a \c DSDAttenuationDecoder object for the specified \c Decoder
+			 * @param decoder The decoder
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c DSDAttenuationDecoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForDecoder(unique_ptr decoder, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Destroy this \c DSDAttenuationDecoder */
+			virtual ~DSDAttenuationDecoder() = default;
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			DSDAttenuationDecoder(const DSDAttenuationDecoder& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			DSDAttenuationDecoder& operator=(const DSDAttenuationDecoder& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			// ========================================
+			/*! @name DSD Level Adjustment */
+			//@{
+
+			/*! @brief Get the attenuation applied to the DSD, in dB (default is 0) */
+			inline float GetAttenuation() const						{ return mAttenuation; }
+
+			/*!
+			 * @brief Set the attenuation applied to the DSD
+			 * @note This may be called while audio is being read.  \c attenuation is rounded to the nearest multiple of
+			 * \c AttenuationStep.
+			 * @param attenuation The desired attenuation in dB, from \c 0 to \c MaximumAttenuation
+			 * @return \c true on success, \c false if \c attenuation is out of range
+			 */
+			bool SetAttenuation(float attenuation);
+
+			/*! @brief Query whether the output is muted */
+			inline bool IsMuted() const								{ return mMuted; }
+
+			/*!
+			 * @brief Mute or unmute the output, ramping the level down or up
+			 * @note This may be called while audio is being read
+			 * @param muted Whether the output should be muted
+			 */
+			inline void SetMuted(bool muted)						{ mMuted = muted; }
+
+			//@}
+
+		private:
+
+			struct Modulator;
+
+			DSDAttenuationDecoder() = delete;
+			explicit DSDAttenuationDecoder(Decoder::unique_ptr decoder);
+
+			// Source access
+			inline virtual CFURLRef _GetURL() const					{ return mDecoder->GetURL(); }
+			inline virtual InputSource& _GetInputSource() const		{ return mDecoder->GetInputSource(); }
+
+			// Audio access
+			virtual bool _Open(CFErrorRef *error);
+			virtual bool _Close(CFErrorRef *error);
+
+			// The native format of the source audio
+			virtual SFB::CFString _GetSourceFormatDescription() const;
+
+			// Attempt to read frameCount frames of audio, returning the actual number of frames read
+			virtual UInt32 _ReadAudio(AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Source audio information
+			inline virtual SInt64 _GetTotalFrames() const			{ return mDecoder->GetTotalFrames(); }
+			inline virtual SInt64 _GetCurrentFrame() const			{ return mDecoder->GetCurrentFrame(); }
+			inline virtual bool _IsTotalFramesEstimated() const	{ return mDecoder->IsTotalFramesEstimated(); }
+
+			// Seeking support
+			inline virtual bool _SupportsSeeking() const			{ return mDecoder->SupportsSeeking(); }
+			virtual SInt64 _SeekToFrame(SInt64 frame);
+			inline virtual SeekCost _GetSeekCost(SInt64 frame) const	{ return mDecoder->GetSeekCost(frame); }
+
+			// Data members
+			Decoder::unique_ptr		mDecoder;
+			std::vector<Modulator>	mModulators;		// The remodulation state for each channel
+			std::vector<float>		mGains;				// The linear gain for each byte being read
+			float					mGain;				// The linear gain currently applied
+			float					mGainStep;			// The largest change in gain per byte
+			bool					mLSBitFirst;
+			std::atomic<float>		mAttenuation;
+			std::atomic_bool		mMuted;
+		};
+
+	}
+}
@@ -5,17 +5,22 @@
 
 #include <CoreFoundation/CoreFoundation.h>
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 #include <map>
 #include <string>
+#include <thread>
 #include <cctype>
 
+#include <dispatch/dispatch.h>
+
 #include "DSDIFFDecoder.h"
 #include "CFErrorUtilities.h"
 #include "Logger.h"
 
-#define BUFFER_CHANNEL_SIZE_BYTES 512u
+#define BUFFER_CHANNEL_SIZE_BYTES 16384u
+#define MAX_DST_WORKERS 16u
 
 namespace {
 
@@ -170,24 +175,17 @@ namespace {
 	struct DSDSoundDataChunk : public DSDIFFChunk
 	{};
 
-	// 'DST ', 'DSTI', 'COMT', 'DIIN', 'MANF' are not handled
+	// 'DST ' in 'FRM8'
+	// The 'FRTE' frame information and the location of each 'DSTF' frame are recorded; 'DSTC' is ignored
+	struct DSTSoundDataChunk : public DSDIFFChunk
+	{
+		uint32_t mNumberFrames;
+		uint16_t mFrameRate;
+		std::vector<std::pair<int64_t, uint32_t>> mFrames;
+	};
+
+	// 'DSTI', 'COMT', 'DIIN', 'MANF' are not handled
 
-//	// 'DST ' in 'FRM8'
-//	class DSTSoundDataChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'FRTE' in 'DST '
-//	class DSTFrameInformationChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'FRTE' in 'DST '
-//	class DSTFrameDataChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'FRTE' in 'DST '
-//	class DSTFrameCRCChunk : public DSDIFFChunk
-//	{};
-//
 //	// 'DSTI' in 'FRM8'
 //	class DSTSoundIndexChunk : public DSDIFFChunk
 //	{};
@@ -523,6 +521,60 @@ namespace {
 		return result;
 	}
 
+	std::shared_ptr<DSTSoundDataChunk> ParseDSTSoundDataChunk(SFB::InputSource& inputSource, const uint32_t chunkID, const uint64_t chunkDataSize)
+	{
+		if('DST ' != chunkID) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.DSDIFF", "Invalid chunk ID for 'DST ' chunk");
+			return nullptr;
+		}
+
+		auto result = std::make_shared<DSTSoundDataChunk>();
+
+		result->mChunkID = chunkID;
+		result->mDataSize = chunkDataSize;
+		result->mDataOffset = inputSource.GetOffset();
+
+		result->mNumberFrames = 0;
+		result->mFrameRate = 0;
+
+		// Parse the local chunks, skipping the frame data
+		auto chunkEndOffset = result->mDataOffset + (SInt64)chunkDataSize;
+		while(inputSource.GetOffset() < chunkEndOffset) {
+
+			uint32_t localChunkID;
+			uint64_t localChunkDataSize;
+
+			if(!ReadChunkIDAndDataSize(inputSource, localChunkID, localChunkDataSize)) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.DSDIFF", "Error reading local chunk in 'DST ' chunk");
+				return nullptr;
+			}
+
+			auto localChunkDataOffset = inputSource.GetOffset();
+
+			switch(localChunkID) {
+				case 'FRTE':
+					if(!inputSource.ReadBE<uint32_t>(result->mNumberFrames) || !inputSource.ReadBE<uint16_t>(result->mFrameRate)) {
+						LOGGER_ERR("org.sbooth.AudioEngine.Decoder.DSDIFF", "Unable to read 'FRTE' chunk");
+						return nullptr;
+					}
+					result->mFrames.reserve(result->mNumberFrames);
+					break;
+
+				case 'DSTF':
+					result->mFrames.push_back(std::make_pair(localChunkDataOffset, (uint32_t)localChunkDataSize));
+					break;
+			}
+
+			// Chunks are padded to an even length, which isn't included in the data size
+			if(!inputSource.SeekToOffset(localChunkDataOffset + (SInt64)((localChunkDataSize + 1) & ~1ull))) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.DSDIFF", "Unable to seek past local chunk in 'DST ' chunk");
+				return nullptr;
+			}
+		}
+
+		return result;
+	}
+
 	std::unique_ptr<FormDSDChunk> ParseFormDSDChunk(SFB::InputSource& inputSource, const uint32_t chunkID, const uint64_t chunkDataSize)
 	{
 		if('FRM8' != chunkID) {
@@ -579,6 +631,14 @@ namespace {
 						break;
 					}
 
+					case 'DST ':
+					{
+						auto chunk = ParseDSTSoundDataChunk(inputSource, localChunkID, localChunkDataSize);
+						if(chunk)
+							result->mLocalChunks[chunk->mChunkID] = chunk;
+						break;
+					}
+
 						// Skip unrecognized or ignored chunks
 					default:
 						inputSource.SeekToOffset(inputSource.GetOffset() + (SInt64)localChunkDataSize);
@@ -615,6 +675,15 @@ namespace {
 
 		return CreateErrorForURL(SFB::Audio::Decoder::ErrorDomain, SFB::Audio::Decoder::InputOutputError, description, url, failureReason, recoverySuggestion);
 	}
+
+	CFErrorRef CreateUnsupportedDSTError(CFURLRef url) CF_RETURNS_RETAINED
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not supported."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Unsupported DST stream"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's channel count or sample rate is not supported for DST decompression."), ""));
+
+		return CreateErrorForURL(SFB::Audio::Decoder::ErrorDomain, SFB::Audio::Decoder::FileFormatNotSupportedError, description, url, failureReason, recoverySuggestion);
+	}
 }
 
 #pragma mark Static Methods
@@ -653,6 +722,15 @@ bool SFB::Audio::DSDIFFDecoder::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::DSDIFFDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+	return 16 <= length && 0 == memcmp(bytes, "FRM8", 4) && 0 == memcmp(bytes + 12, "DSD ", 4);
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::DSDIFFDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new DSDIFFDecoder(std::move(inputSource)));
@@ -661,7 +739,7 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::DSDIFFDecoder::CreateDecoder(InputSo
 #pragma mark Creation and Destruction
 
 SFB::Audio::DSDIFFDecoder::DSDIFFDecoder(InputSource::unique_ptr inputSource)
-	: Decoder(std::move(inputSource)), mTotalFrames(-1), mCurrentFrame(0), mAudioOffset(0)
+	: Decoder(std::move(inputSource)), mTotalFrames(-1), mCurrentFrame(0), mAudioOffset(0), mDSTFrameBytesPerChannel(0), mDSTDecodedFrame(0), mDSTDecodedFrameCount(0)
 {}
 
 SFB::Audio::DSDIFFDecoder::~DSDIFFDecoder()
@@ -733,6 +811,45 @@ bool SFB::Audio::DSDIFFDecoder::_Open(CFErrorRef *error)
 	}
 
 
+	// Each channel byte holds 8 frames, so bytes are deinterleaved as single samples
+	mDeinterleave = SamplePacking::Deinterleaver::ForBytes(mFormat.mChannelsPerFrame);
+
+	auto compressionTypeChunk = std::static_pointer_cast<CompressionTypeChunk>(propertyChunk->mLocalChunks['CMPR']);
+	if(compressionTypeChunk && 'DST ' == compressionTypeChunk->mCompressionType) {
+		auto soundDataChunk = std::static_pointer_cast<DSTSoundDataChunk>(chunks->mLocalChunks['DST ']);
+		if(!soundDataChunk || soundDataChunk->mFrames.empty()) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.DSDIFF", "Missing chunk in file");
+			if(error)
+				*error = CreateInvalidDSDIFFFileError(mInputSource->GetURL());
+
+			return false;
+		}
+
+		if(DSTFrameDecoder::MaximumChannels < mFormat.mChannelsPerFrame || 0 != sampleRateChunk->mSampleRate % (44100 * 64)) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.DSDIFF", "Unsupported DST stream: " << mFormat.mChannelsPerFrame << " channels, " << sampleRateChunk->mSampleRate << " Hz");
+			if(error)
+				*error = CreateUnsupportedDSTError(mInputSource->GetURL());
+
+			return false;
+		}
+
+		mDSTFrames.assign(soundDataChunk->mFrames.begin(), soundDataChunk->mFrames.end());
+		mDSTFrameBytesPerChannel = DSTFrameDecoder::SamplesPerFrame(sampleRateChunk->mSampleRate) / 8;
+		mTotalFrames = (SInt64)mDSTFrames.size() * 8 * mDSTFrameBytesPerChannel;
+
+		// Frames are independent, so a batch of consecutive frames is decoded concurrently
+		UInt32 workerCount = std::max(1u, std::min(std::thread::hardware_concurrency(), MAX_DST_WORKERS));
+		for(UInt32 i = 0; i < workerCount; ++i)
+			mDSTDecoders.push_back(std::unique_ptr<DSTFrameDecoder>(new DSTFrameDecoder(mFormat.mChannelsPerFrame, sampleRateChunk->mSampleRate)));
+		mDSTFrameData.resize(workerCount);
+
+		mBuffer.resize(workerCount * mDSTFrameBytesPerChannel * mFormat.mChannelsPerFrame);
+		mDSTDecodedFrame = 0;
+		mDSTDecodedFrameCount = 0;
+
+		return true;
+	}
+
 	auto soundDataChunk = std::static_pointer_cast<DSDSoundDataChunk>(chunks->mLocalChunks['DSD ']);
 	if(!soundDataChunk) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.DSDIFF", "Missing chunk in file");
@@ -747,11 +864,23 @@ bool SFB::Audio::DSDIFFDecoder::_Open(CFErrorRef *error)
 
 	GetInputSource().SeekToOffset(mAudioOffset);
 
+	mBuffer.resize(BUFFER_CHANNEL_SIZE_BYTES * mFormat.mChannelsPerFrame);
+
 	return true;
 }
 
 bool SFB::Audio::DSDIFFDecoder::_Close(CFErrorRef */*error*/)
 {
+	mBuffer.clear();
+	mBuffer.shrink_to_fit();
+	mDeinterleave = nullptr;
+
+	mDSTFrames.clear();
+	mDSTFrames.shrink_to_fit();
+	mDSTDecoders.clear();
+	mDSTFrameData.clear();
+	mDSTDecodedFrameCount = 0;
+
 	return true;
 }
 
@@ -779,40 +908,36 @@ UInt32 SFB::Audio::DSDIFFDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32
 	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
 		bufferList->mBuffers[i].mDataByteSize = 0;
 
-	for(;;) {
+	if(!mDSTFrames.empty()) {
+		framesRead = ReadDST(bufferList, framesToRead);
+		mCurrentFrame += framesRead;
+		return framesRead;
+	}
+
+	while(framesRead < framesToRead) {
 		// Read interleaved input, grouped as 8 one bit samples per frame (a single channel byte) into
 		// a clustered frame (one channel byte per channel)
 		// From a bit perspective for stereo: LLLLLLLLRRRRRRRRLLLLLLLLRRRRRRRR
-		uint8_t buffer [BUFFER_CHANNEL_SIZE_BYTES * mFormat.mChannelsPerFrame];
-		UInt32 bytesToRead = std::min(BUFFER_CHANNEL_SIZE_BYTES * mFormat.mChannelsPerFrame, (framesToRead / 8) * mFormat.mChannelsPerFrame);
-		auto bytesRead = GetInputSource().Read(buffer, bytesToRead);
+		UInt32 bytesPerChannel = std::min(BUFFER_CHANNEL_SIZE_BYTES, (framesToRead - framesRead) / 8);
+		UInt32 bytesToRead = bytesPerChannel * mFormat.mChannelsPerFrame;
+		const void *bytes = nullptr;
+		auto bytesRead = GetInputSource().BorrowOrRead(bytes, mBuffer.data(), bytesToRead);
 
-		if(bytesRead != bytesToRead) {
+		if(bytesRead != bytesToRead)
 			LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.DSDIFF", "Error reading audio: requested " << bytesToRead << " bytes, got " << bytesRead);
-			break;
-		}
 
-		// Decoding is finished
-		if(0 == bytesRead)
+		// Only complete clustered frames can be deinterleaved
+		UInt32 clusteredFramesRead = 0 < bytesRead ? (UInt32)bytesRead / mFormat.mChannelsPerFrame : 0;
+		if(0 == clusteredFramesRead)
 			break;
 
 		// Deinterleave the clustered frames and copy to output
-		for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
-			uint8_t *dst = (uint8_t *)bufferList->mBuffers[i].mData + bufferList->mBuffers[i].mDataByteSize;
-			for(SInt64 byteIndex = i; byteIndex < bytesRead; byteIndex += mFormat.mChannelsPerFrame)
-				*dst++ = buffer[byteIndex];
-
-			bufferList->mBuffers[i].mNumberChannels	= 1;
-			bufferList->mBuffers[i].mDataByteSize	+= bytesRead / mFormat.mChannelsPerFrame;
-		}
+		mDeinterleave(bytes, bufferList, framesRead / 8, clusteredFramesRead);
 
-		framesRead += (bytesRead / mFormat.mChannelsPerFrame) * 8;
+		framesRead += clusteredFramesRead * 8;
 
-		// All requested frames were read
-		if(framesRead == frameCount)
+		if(bytesRead != bytesToRead)
 			break;
-
-		framesToRead -= framesRead;
 	}
 
 	mCurrentFrame += framesRead;
@@ -825,7 +950,14 @@ SInt64 SFB::Audio::DSDIFFDecoder::_SeekToFrame(SInt64 frame)
 	// Round down to nearest multiple of 8 frames
 	frame = (frame / 8) * 8;
 
-	SInt64 frameOffset = (SInt64)mFormat.FrameCountToByteCount((size_t)frame);
+	// DST frames are located as they are decoded
+	if(!mDSTFrames.empty()) {
+		mCurrentFrame = frame;
+		return _GetCurrentFrame();
+	}
+
+	// The audio is interleaved, with one byte per channel for each 8 frames
+	SInt64 frameOffset = (SInt64)mFormat.FrameCountToByteCount((size_t)frame) * mFormat.mChannelsPerFrame;
 	if(!GetInputSource().SeekToOffset(mAudioOffset + frameOffset)) {
 		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.DSDIFF", "_SeekToFrame() failed for offset: " << mAudioOffset + frameOffset);
 		return -1;
@@ -834,3 +966,82 @@ SInt64 SFB::Audio::DSDIFFDecoder::_SeekToFrame(SInt64 frame)
 	mCurrentFrame = frame;
 	return _GetCurrentFrame();
 }
+
+SFB::Audio::Decoder::SeekCost SFB::Audio::DSDIFFDecoder::_GetSeekCost(SInt64 /*frame*/) const
+{
+	// DST frames are located using the frame table and decoded from the start
+	return mDSTFrames.empty() ? SeekCostConstant : SeekCostIndexed;
+}
+
+UInt32 SFB::Audio::DSDIFFDecoder::ReadDST(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	const UInt32 framesPerDSTFrame = 8 * mDSTFrameBytesPerChannel;
+	const UInt32 bytesPerDSTFrame = mDSTFrameBytesPerChannel * mFormat.mChannelsPerFrame;
+
+	UInt32 framesRead = 0;
+
+	while(framesRead < frameCount) {
+		SInt64 frame = mCurrentFrame + framesRead;
+		SInt64 dstFrame = frame / framesPerDSTFrame;
+
+		if((dstFrame < mDSTDecodedFrame || dstFrame >= mDSTDecodedFrame + mDSTDecodedFrameCount) && !DecodeDSTFrames(dstFrame))
+			break;
+
+		// Deinterleave the clustered frames remaining in this DST frame and copy to output
+		UInt32 byteOffset = (UInt32)(frame % framesPerDSTFrame) / 8;
+		UInt32 clusteredFrames = std::min(mDSTFrameBytesPerChannel - byteOffset, (frameCount - framesRead) / 8);
+		const uint8_t *input = mBuffer.data() + ((size_t)(dstFrame - mDSTDecodedFrame) * bytesPerDSTFrame) + (byteOffset * mFormat.mChannelsPerFrame);
+
+		mDeinterleave(input, bufferList, framesRead / 8, clusteredFrames);
+
+		framesRead += clusteredFrames * 8;
+	}
+
+	return framesRead;
+}
+
+bool SFB::Audio::DSDIFFDecoder::DecodeDSTFrames(SInt64 firstFrame)
+{
+	mDSTDecodedFrameCount = 0;
+
+	if(0 > firstFrame || (SInt64)mDSTFrames.size() <= firstFrame)
+		return false;
+
+	// The compressed frames are read sequentially
+	UInt32 frameCount = (UInt32)std::min((SInt64)mDSTDecoders.size(), (SInt64)mDSTFrames.size() - firstFrame);
+	for(UInt32 i = 0; i < frameCount; ++i) {
+		const auto& frame = mDSTFrames[(size_t)(firstFrame + i)];
+		auto& frameData = mDSTFrameData[i];
+		frameData.resize(frame.second);
+
+		if(!GetInputSource().SeekToOffset(frame.first) || (SInt64)frame.second != GetInputSource().Read(frameData.data(), frame.second)) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.DSDIFF", "Error reading DST frame " << (firstFrame + i));
+			frameCount = i;
+			break;
+		}
+	}
+
+	if(0 == frameCount)
+		return false;
+
+	// The frames are then decoded concurrently, each into its place in the buffer
+	const size_t bytesPerDSTFrame = mDSTFrameBytesPerChannel * mFormat.mChannelsPerFrame;
+	auto decodeFrame = ^(size_t i) {
+		uint8_t *dsd = mBuffer.data() + (i * bytesPerDSTFrame);
+		if(!mDSTDecoders[i]->DecodeFrame(mDSTFrameData[i].data(), mDSTFrameData[i].size(), dsd)) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.DSDIFF", "Error decoding DST frame " << (firstFrame + (SInt64)i));
+			// Substitute DSD silence
+			memset(dsd, 0x69, bytesPerDSTFrame);
+		}
+	};
+
+	if(1 < frameCount)
+		dispatch_apply(frameCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), decodeFrame);
+	else
+		decodeFrame(0);
+
+	mDSTDecodedFrame = firstFrame;
+	mDSTDecodedFrameCount = frameCount;
+
+	return true;
+}
@@ -5,7 +5,12 @@
 
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include "AudioDecoder.h"
+#include "DSTFrameDecoder.h"
+#include "SamplePacking.h"
 
 namespace SFB {
 
@@ -13,6 +18,9 @@ namespace SFB {
 
 		// ========================================
 		// A Decoder subclass supporting DSDIFF (DSD (Direct Stream Digital) Interchange File Format)
+		//
+		// DST compressed sound data is decoded in batches of consecutive frames, one
+		// frame per worker, into a buffer from which the DSD is delivered in order
 		//  See http://www.sonicstudio.com/pdf/dsd/DSDIFF_1.5_Spec.pdf
 		// ========================================
 		class DSDIFFDecoder : public Decoder
@@ -26,6 +34,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
@@ -52,11 +61,32 @@ namespace SFB {
 			// Seeking support
 			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
+			virtual SeekCost _GetSeekCost(SInt64 frame) const;
+
+			// DST support
+			UInt32 ReadDST(AudioBufferList *bufferList, UInt32 frameCount);
+			bool DecodeDSTFrames(SInt64 firstFrame);
 
 			// Data members
 			SInt64		mTotalFrames;
 			SInt64		mCurrentFrame;
 			SInt64		mAudioOffset;
+
+			// Interleaved input awaiting deinterleaving
+			std::vector<uint8_t>			mBuffer;
+			SamplePacking::Deinterleaver	mDeinterleave;
+
+			// DST frame locations as offset and size, empty for uncompressed audio
+			std::vector<std::pair<SInt64, UInt32>>			mDSTFrames;
+			UInt32											mDSTFrameBytesPerChannel;
+
+			// One decoder and compressed frame buffer per worker
+			std::vector<std::unique_ptr<DSTFrameDecoder>>	mDSTDecoders;
+			std::vector<std::vector<uint8_t>>				mDSTFrameData;
+
+			// The DST frames decoded into mBuffer
+			SInt64											mDSTDecodedFrame;
+			UInt32											mDSTDecodedFrameCount;
 		};
 
 	}
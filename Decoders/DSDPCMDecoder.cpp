@@ -5,25 +5,22 @@
 
 #include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstring>
 
-#include <Accelerate/Accelerate.h>
+#include <dispatch/dispatch.h>
 
 #include "DSDPCMDecoder.h"
 #include "CFErrorUtilities.h"
 #include "Logger.h"
+#include "SampleKernels.h"
 
 #define DSD_FRAMES_PER_PCM_FRAME 8
 
-namespace {
+// The smallest channel count for which channels are translated concurrently
+#define PARALLEL_TRANSLATION_CHANNEL_THRESHOLD 3
 
-	// Bit reversal lookup table from http://graphics.stanford.edu/~seander/bithacks.html#BitReverseTable
-	static const uint8_t sBitReverseTable256 [256] =
-	{
-#   define R2(n)     n,     n + 2*64,     n + 1*64,     n + 3*64
-#   define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
-#   define R6(n) R4(n), R4(n + 2*4 ), R4(n + 1*4 ), R4(n + 3*4 )
-		R6(0), R6(2), R6(1), R6(3)
-	};
+namespace {
 
 #pragma mark Begin DSD2PCM
 
@@ -60,13 +57,9 @@ namespace {
 	 */
 
 #define HTAPS    48             /* number of FIR constants */
-#define FIFOSIZE 16             /* must be a power of two */
-#define FIFOMASK (FIFOSIZE-1)   /* bit mask for FIFO offsets */
 #define CTABLES ((HTAPS+7)/8)   /* number of "8 MACs" lookup tables */
 
-#if FIFOSIZE*8 < HTAPS*2
-#  error "FIFOSIZE too small"
-#endif
+	static_assert(CTABLES == SFB::Audio::SampleKernels::kDSDTableCount, "The lookup tables don't match the translation kernel");
 
 	/*
 	 * Properties of this 96-tap lowpass filter when applied on a signal
@@ -83,6 +76,9 @@ namespace {
 	 *
 	 * The coefficient tables ("ctables") take only 6 Kibi Bytes and
 	 * should fit into a modern processor's fast cache.
+	 *
+	 * Each decoder has its own ctables with its linear gain folded in,
+	 * so no separate gain pass is needed after translation.
 	 */
 
 	/*
@@ -139,9 +135,7 @@ namespace {
 		3.130441005359396e-08
 	};
 
-	static float ctables[CTABLES][256];
-
-	void dsd2pcm_precalc()
+	void dsd2pcm_precalc(float *ctables, double gain)
 	{
 		int t, e, m, k;
 		double acc;
@@ -153,26 +147,18 @@ namespace {
 				for (m=0; m<k; ++m) {
 					acc += (((e >> (7-m)) & 1)*2-1) * htaps[t*8+m];
 				}
-				ctables[CTABLES-1-t][e] = (float)acc;
+				ctables[(CTABLES-1-t)*256+e] = (float)(acc * gain);
 			}
 		}
 	}
 
-	struct dsd2pcm_ctx
-	{
-		unsigned char fifo[FIFOSIZE];
-		unsigned fifopos;
-	};
-
 	/**
 	 * resets the internal state for a fresh new stream
 	 */
-	void dsd2pcm_reset(dsd2pcm_ctx *ptr)
+	void dsd2pcm_reset(SFB::Audio::SampleKernels::DSDTranslationState& state)
 	{
-		int i;
-		for (i=0; i<FIFOSIZE; ++i)
-			ptr->fifo[i] = 0x69; /* my favorite silence pattern */
-		ptr->fifopos = 0;
+		memset(state.mFIFO, 0x69, sizeof(state.mFIFO)); /* my favorite silence pattern */
+		state.mFIFOPosition = 0;
 		/* 0x69 = 01101001
 		 * This pattern "on repeat" makes a low energy 352.8 kHz tone
 		 * and a high energy 1.0584 MHz tone which should be filtered
@@ -180,137 +166,99 @@ namespace {
 		 */
 	}
 
-	/**
-	 * initializes a "dsd2pcm engine" for one channel
-	 * (allocates memory)
-	 */
-	dsd2pcm_ctx * dsd2pcm_init()
-	{
-		dsd2pcm_ctx *ptr;
-		ptr = (dsd2pcm_ctx *) malloc(sizeof(dsd2pcm_ctx));
-		if (ptr) dsd2pcm_reset(ptr);
-		return ptr;
-	}
+	/* the translation itself is SampleKernels::TranslateDSD() */
 
-	/**
-	 * deinitializes a "dsd2pcm engine"
-	 * (releases memory, don't forget!)
-	 */
-	void dsd2pcm_destroy(dsd2pcm_ctx *ptr)
-	{
-		free(ptr);
-	}
+#pragma mark End DSD2PCM
 
-	/**
-	 * clones the context and returns a pointer to the
-	 * newly allocated copy
-	 */
-	dsd2pcm_ctx * dsd2pcm_clone(dsd2pcm_ctx *ptr)
-	{
-		dsd2pcm_ctx *p2;
-		p2 = (dsd2pcm_ctx *) malloc(sizeof(dsd2pcm_ctx));
-		if (p2) {
-			memcpy(p2,ptr,sizeof(dsd2pcm_ctx));
-		}
-		return p2;
-	}
+	// Support DSD64, DSD128, DSD256, and DSD512 (64x, 128x, 256x, and 512x a sample rate of 44.1 or 48 KHz)
+	static const std::array<Float64, 8> sSupportedSampleRates = { {2822400, 5644800, 11289600, 22579200, 3072000, 6144000, 12288000, 24576000} };
 
-	/**
-	 * "translates" a stream of octets to a stream of floats
-	 * (8:1 decimation)
-	 * @param ctx -- pointer to abstract context (buffers)
-	 * @param samples -- number of octets/samples to "translate"
-	 * @param src -- pointer to first octet (input)
-	 * @param src_stride -- src pointer increment
-	 * @param lsbitfirst -- bitorder, 0=msb first, 1=lsbfirst
-	 * @param dst -- pointer to first float (output)
-	 * @param dst_stride -- dst pointer increment
-	 */
-	void dsd2pcm_translate(dsd2pcm_ctx *ptr, size_t samples, const unsigned char *src, ptrdiff_t src_stride, int lsbf, float *dst, ptrdiff_t dst_stride)
+	// Design a Blackman-windowed sinc lowpass filter with a cutoff of half the output Nyquist frequency
+	// for decimation by 2; the filter is symmetric so convolution and correlation are equivalent
+	std::vector<float> DesignHalfBandFilter(size_t length)
 	{
-		unsigned ffp;
-		unsigned i;
-		unsigned bite1, bite2;
-		unsigned char* p;
-		double acc;
-		ffp = ptr->fifopos;
-		lsbf = lsbf ? 1 : 0;
-		while (samples-- > 0) {
-			bite1 = *src & 0xFFu;
-			if (lsbf) bite1 = sBitReverseTable256[bite1];
-			ptr->fifo[ffp] = (unsigned char)bite1; src += src_stride;
-			p = ptr->fifo + ((ffp-CTABLES) & FIFOMASK);
-			*p = sBitReverseTable256[*p & 0xFF];
-			acc = 0;
-			for (i=0; i<CTABLES; ++i) {
-				bite1 = ptr->fifo[(ffp              -i) & FIFOMASK] & 0xFF;
-				bite2 = ptr->fifo[(ffp-(CTABLES*2-1)+i) & FIFOMASK] & 0xFF;
-				acc += ctables[i][bite1] + ctables[i][bite2];
-			}
-			*dst = (float)acc; dst += dst_stride;
-			ffp = (ffp + 1) & FIFOMASK;
+		std::vector<float> filter(length);
+
+		double sum = 0;
+		double center = (length - 1) / 2.;
+		for(size_t n = 0; n < length; ++n) {
+			double x = n - center;
+			double sinc = 0 == x ? 1 : sin(M_PI * x / 2) / (M_PI * x / 2);
+			double window = 0.42 - 0.5 * cos(2 * M_PI * n / (length - 1)) + 0.08 * cos(4 * M_PI * n / (length - 1));
+			filter[n] = (float)(sinc * window);
+			sum += filter[n];
 		}
-		ptr->fifopos = ffp;
-	}
-
-#pragma mark End DSD2PCM
 
-	// Support DSD64 (64x the CD sample rate of 44.1 KHz)
-	static const std::array<Float64, 1> sSupportedSampleRates = { {2822400} };
+		// Unity gain at DC
+		for(auto& tap : filter)
+			tap = (float)(tap / sum);
 
-#pragma mark Initialization
-
-	void SetupDSD2PCM() __attribute__ ((constructor));
-	void SetupDSD2PCM()
-	{
-		dsd2pcm_precalc();
+		return filter;
 	}
 
 }
 
-#pragma mark DXD
+#pragma mark Decimator
 
 namespace SFB {
 	namespace Audio {
-		class DSDPCMDecoder::DXD {
+		// Zero-phase decimation by 2 of a single channel
+		// Output sample k is centered on input sample 2k, so the output isn't delayed by the filter: the
+		// history is primed with the half of the filter preceding the first input sample, and Flush()
+		// supplies the half following the last one
+		class DSDPCMDecoder::Decimator {
 		public:
-			DXD()
-				: handle(dsd2pcm_init())
+			// maximumInputCount is the largest count passed to Process()
+			Decimator(const std::vector<float>& filter, UInt32 maximumInputCount)
+				: mFilter(filter), mInput(filter.size() - 1 + std::max(maximumInputCount, GetDelay())), mInputCount(0)
 			{
-				if(nullptr == handle)
-					throw std::bad_alloc();
+				Reset();
 			}
 
-			DXD(DXD const& x)
-				: handle(dsd2pcm_clone(x.handle))
-			{
-				if(nullptr == handle)
-					throw std::bad_alloc();
-			}
+			// The number of input samples preceding and following each output sample's center
+			inline UInt32 GetDelay() const				{ return (UInt32)(mFilter.size() - 1) / 2; }
 
-			~DXD()
+			// Decimate count samples from input to output, which may be the same, returning the number of samples produced
+			UInt32 Process(const float *input, UInt32 count, float *output)
 			{
-				dsd2pcm_destroy(handle);
+				memcpy(mInput.data() + mInputCount, input, count * sizeof(float));
+				mInputCount += count;
+				return Filter(output);
 			}
 
-			friend void Swap(DXD& a, DXD& b)
+			// Produce the samples remaining at the end of the input, returning the number of samples produced
+			UInt32 Flush(float *output)
 			{
-				std::swap(a.handle, b.handle);
+				std::fill_n(mInput.data() + mInputCount, GetDelay(), 0.f);
+				mInputCount += GetDelay();
+				return Filter(output);
 			}
 
-			DXD& operator=(DXD x)
+			void Reset()
 			{
-				Swap(*this, x);
-				return *this;
+				std::fill_n(mInput.data(), GetDelay(), 0.f);
+				mInputCount = GetDelay();
 			}
 
-			void Translate(size_t samples, const unsigned char *src, ptrdiff_t src_stride, bool lsbitfirst, float *dst, ptrdiff_t dst_stride)
+		private:
+			// Filter the buffered input and retain the fewer than filterLength samples not yet consumed
+			UInt32 Filter(float *output)
 			{
-				dsd2pcm_translate(handle, samples, src, src_stride, lsbitfirst, dst, dst_stride);
+				auto filterLength = (UInt32)mFilter.size();
+				if(mInputCount < filterLength)
+					return 0;
+
+				UInt32 outputCount = (mInputCount - filterLength) / 2 + 1;
+				SampleKernels::Get().Filter(mInput.data(), 2, mFilter.data(), filterLength, output, outputCount);
+
+				mInputCount -= 2 * outputCount;
+				memmove(mInput.data(), mInput.data() + (2 * outputCount), mInputCount * sizeof(float));
+				return outputCount;
 			}
 
-		private:
-			dsd2pcm_ctx *handle;
+			std::vector<float> mFilter;
+			std::vector<float> mInput;		// The history followed by the input not yet filtered
+			UInt32 mInputCount;
 		};
 
 	}
@@ -343,7 +291,7 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::DSDPCMDecoder::CreateForDecoder(uniq
 
 // 6 dBFS gain -> powf(10.f, 6.f / 20.f) -> 0x1.fec984p+0 (approximately 1.99526231496888)
 SFB::Audio::DSDPCMDecoder::DSDPCMDecoder(Decoder::unique_ptr decoder)
-	: mDecoder(std::move(decoder)), mLinearGain(0x1.fec984p+0)
+	: mDecoder(std::move(decoder)), mDecimationFactor(1), mSeekPrerollFrames(0), mCurrentFrame(0), mFramesToDiscard(0), mFlushed(false), mFlushedFrames(0), mFlushedFrameOffset(0), mTargetSampleRate(352800), mFilterQuality(FilterQuality::Medium), mLinearGain(0x1.fec984p+0), mTablesGain(0)
 {
 	assert(nullptr != mDecoder);
 }
@@ -381,11 +329,21 @@ bool SFB::Audio::DSDPCMDecoder::_Open(CFErrorRef *error)
 		return false;
 	}
 
+	// Halve the rate of the initial conversion until no further halving reaches the target
+	Float64 sampleRate = decoderFormat.mSampleRate / DSD_FRAMES_PER_PCM_FRAME;
+	UInt32 decimationStages = 0;
+	while(sampleRate / 2 >= mTargetSampleRate) {
+		sampleRate /= 2;
+		++decimationStages;
+	}
+
+	mDecimationFactor = 1u << decimationStages;
+
 	// Generate non-interleaved 32-bit float output
 	mFormat.mFormatID			= kAudioFormatLinearPCM;
 	mFormat.mFormatFlags		= kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked | kAudioFormatFlagIsNonInterleaved;
 
-	mFormat.mSampleRate			= decoderFormat.mSampleRate / DSD_FRAMES_PER_PCM_FRAME;
+	mFormat.mSampleRate			= sampleRate;
 	mFormat.mChannelsPerFrame	= decoderFormat.mChannelsPerFrame;
 	mFormat.mBitsPerChannel		= 32;
 
@@ -410,6 +368,41 @@ bool SFB::Audio::DSDPCMDecoder::_Open(CFErrorRef *error)
 		mBufferList->mBuffers[i].mDataByteSize = 0;
 
 	mContext.resize(mFormat.mChannelsPerFrame);
+	for(auto& context : mContext)
+		dsd2pcm_reset(context);
+
+	mDecimators.clear();
+	mScratch.clear();
+	if(0 < decimationStages) {
+		size_t filterLength = 63;
+		switch(mFilterQuality) {
+			case FilterQuality::Low:		filterLength = 31;		break;
+			case FilterQuality::Medium:		filterLength = 63;		break;
+			case FilterQuality::High:		filterLength = 127;		break;
+		}
+
+		// The scratch buffer holds the PCM translated from one read, which is also the most input a decimator receives
+		auto scratchFrames = (UInt32)mBufferList.GetFormat().FrameCountToByteCount(mBufferList.GetCapacityFrames());
+		auto filter = DesignHalfBandFilter(filterLength);
+		mDecimators.assign(mFormat.mChannelsPerFrame, std::vector<Decimator>(decimationStages, Decimator(filter, scratchFrames)));
+		mScratch.assign(mFormat.mChannelsPerFrame, std::vector<float>(scratchFrames));
+
+		// Output frame n depends on the (filterLength - 1) / 2 frames preceding it at each stage's input rate, which
+		// is less than that many output frames in total, and on the DSD bytes in the translation FIFO
+		mSeekPrerollFrames = (UInt32)(filterLength - 1) / 2 + 1;
+	}
+	else
+		mSeekPrerollFrames = 2 * CTABLES;
+
+	mCurrentFrame = 0;
+	mFramesToDiscard = 0;
+	mFlushed = false;
+	mFlushedFrames = 0;
+	mFlushedFrameOffset = 0;
+
+	mTables.resize(CTABLES * 256);
+	dsd2pcm_precalc(mTables.data(), mLinearGain);
+	mTablesGain = mLinearGain;
 
 	return true;
 }
@@ -421,6 +414,9 @@ bool SFB::Audio::DSDPCMDecoder::_Close(CFErrorRef *error)
 
 	mBufferList.Deallocate();
 	mContext.clear();
+	mDecimators.clear();
+	mScratch.clear();
+	mTables.clear();
 
 	return true;
 }
@@ -441,63 +437,195 @@ UInt32 SFB::Audio::DSDPCMDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32
 	}
 
 	UInt32 framesRead = 0;
-	const float linearGain = mLinearGain;
+
+	// The gain is folded into the lookup tables, which must be rebuilt when it changes
+	if(mTablesGain != mLinearGain) {
+		dsd2pcm_precalc(mTables.data(), mLinearGain);
+		mTablesGain = mLinearGain;
+	}
 
 	// Reset output buffer data size
 	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
 		bufferList->mBuffers[i].mDataByteSize = 0;
 
+	const bool lsbitfirst = !mBufferList.GetFormat().IsBigEndian();
+	const bool parallel = PARALLEL_TRANSLATION_CHANNEL_THRESHOLD <= mBufferList->mNumberBuffers;
+
 	for(;;) {
+		// Deliver the frames flushed from the decimation cascades at the end of the input
+		if(0 < mFlushedFrames) {
+			UInt32 framesToCopy = std::min(mFlushedFrames, frameCount - framesRead);
+			for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+				memcpy((float *)bufferList->mBuffers[i].mData + framesRead, mScratch[i].data() + mFlushedFrameOffset, framesToCopy * sizeof(float));
+
+			mFlushedFrames -= framesToCopy;
+			mFlushedFrameOffset += framesToCopy;
+			framesRead += framesToCopy;
+		}
+
+		// All requested frames were read
+		if(framesRead == frameCount || mFlushed)
+			break;
+
 		// Grab the DSD audio
 		UInt32 framesRemaining 		= frameCount - framesRead;
-		UInt32 dsdFramesRemaining 	= DSD_FRAMES_PER_PCM_FRAME * framesRemaining;
+		UInt32 dsdFramesRemaining 	= DSD_FRAMES_PER_PCM_FRAME * mDecimationFactor * framesRemaining;
 		UInt32 dsdFramesDecoded 	= mDecoder->ReadAudio(mBufferList, std::min(mBufferList.GetCapacityFrames(), dsdFramesRemaining));
-		if(0 == dsdFramesDecoded)
-			break;
 
-		UInt32 framesDecoded 		= dsdFramesDecoded / DSD_FRAMES_PER_PCM_FRAME;
+		UInt32 framesDecoded = 0;
 
-		// Convert to PCM
-		// NB: Currently DSDIFFDecoder and DSFDecoder only produce non-interleaved output
-		for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i) {
-			mContext[i].Translate(framesDecoded,
-								  (const unsigned char *)mBufferList->mBuffers[i].mData + bufferList->mBuffers[i].mDataByteSize, 1,
-								  !mBufferList.GetFormat().IsBigEndian(),
-								  (float *)bufferList->mBuffers[i].mData, 1);
+		// At the end of the input the decimators still hold the input for their last output frames
+		if(0 == dsdFramesDecoded) {
+			mFlushed = true;
+			if(mDecimators.empty())
+				break;
 
-			// Boost signal by 6 dBFS
-			vDSP_vsmul((float *)bufferList->mBuffers[i].mData, 1, &linearGain, (float *)bufferList->mBuffers[i].mData, 1, framesDecoded);
+			for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i)
+				framesDecoded = FlushChannel(i);
 
-			bufferList->mBuffers[i].mDataByteSize += mFormat.FrameCountToByteCount(framesDecoded);
+			mFlushedFrames = framesDecoded;
+			mFlushedFrameOffset = 0;
 		}
+		else {
+			UInt32 dsdBytesDecoded	= (UInt32)mBufferList.GetFormat().FrameCountToByteCount(dsdFramesDecoded);
+			UInt32 byteOffset		= (UInt32)mFormat.FrameCountToByteCount(framesRead);
+
+			// Convert to PCM
+			// NB: Currently DSDIFFDecoder and DSFDecoder only produce non-interleaved output
+			// Channels are independent, so with enough of them each is converted concurrently
+			// Every channel's decimation cascade holds the same amount of input, so the frame counts agree
+			__block UInt32 channelZeroFramesDecoded = 0;
+			auto convertChannel = ^(size_t i) {
+				UInt32 channelFramesDecoded = ConvertChannel((UInt32)i, dsdBytesDecoded, lsbitfirst, (float *)((uint8_t *)bufferList->mBuffers[i].mData + byteOffset));
+				if(0 == i)
+					channelZeroFramesDecoded = channelFramesDecoded;
+			};
+
+			if(parallel)
+				dispatch_apply(mBufferList->mNumberBuffers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), convertChannel);
+			else {
+				for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i)
+					convertChannel(i);
+			}
 
-		framesRead += framesDecoded;
+			framesDecoded = channelZeroFramesDecoded;
+			framesRead += framesDecoded;
+		}
 
-		// All requested frames were read
-		if(framesRead == frameCount)
-			break;
+		// Frames preceding a seek target only provide the filters' history
+		if(0 < mFramesToDiscard) {
+			UInt32 framesToDiscard = std::min(mFramesToDiscard, framesDecoded);
+			for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i) {
+				float *output = mFlushed ? mScratch[i].data() : (float *)bufferList->mBuffers[i].mData + (framesRead - framesDecoded);
+				memmove(output, output + framesToDiscard, (framesDecoded - framesToDiscard) * sizeof(float));
+			}
+
+			mFramesToDiscard -= framesToDiscard;
+			if(mFlushed)
+				mFlushedFrames -= framesToDiscard;
+			else
+				framesRead -= framesToDiscard;
+		}
 	}
 
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+		bufferList->mBuffers[i].mDataByteSize = (UInt32)mFormat.FrameCountToByteCount(framesRead);
+
+	mCurrentFrame += framesRead;
+
 	return framesRead;
 }
 
 SInt64 SFB::Audio::DSDPCMDecoder::_GetTotalFrames() const
 {
-	return mDecoder->GetTotalFrames() / DSD_FRAMES_PER_PCM_FRAME;
+	// A partial output frame is produced from the DSD following the last whole one
+	auto totalFrames = mDecoder->GetTotalFrames();
+	if(-1 == totalFrames)
+		return -1;
+
+	SInt64 dsdFramesPerFrame = DSD_FRAMES_PER_PCM_FRAME * mDecimationFactor;
+	return (totalFrames + dsdFramesPerFrame - 1) / dsdFramesPerFrame;
 }
 
 SInt64 SFB::Audio::DSDPCMDecoder::_GetCurrentFrame() const
 {
-	return mDecoder->GetCurrentFrame() / DSD_FRAMES_PER_PCM_FRAME;
+	return mCurrentFrame;
 }
 
 SInt64 SFB::Audio::DSDPCMDecoder::_SeekToFrame(SInt64 frame)
 {
-	if(-1 == mDecoder->SeekToFrame(DSD_FRAMES_PER_PCM_FRAME * frame))
+	// Decoding begins early enough for the decimators to hold the history preceding frame
+	SInt64 prerollFrames = std::min(frame, (SInt64)mSeekPrerollFrames);
+	SInt64 dsdFramesPerFrame = DSD_FRAMES_PER_PCM_FRAME * mDecimationFactor;
+	SInt64 dsdFrame = mDecoder->SeekToFrame(dsdFramesPerFrame * (frame - prerollFrames));
+	if(-1 == dsdFrame)
+		return -1;
+
+	// Frames are aligned to the decimation factor, so the source must seek exactly to maintain the alignment
+	if(dsdFrame != dsdFramesPerFrame * (frame - prerollFrames)) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.DSDPCM", "Seek to DSD frame " << dsdFramesPerFrame * (frame - prerollFrames) << " reached " << dsdFrame);
 		return -1;
+	}
 
 	for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i)
 		mBufferList->mBuffers[i].mDataByteSize = 0;
 
+	// Input retained from before the seek no longer precedes the current frame
+	for(auto& context : mContext)
+		dsd2pcm_reset(context);
+
+	for(auto& channelDecimators : mDecimators) {
+		for(auto& decimator : channelDecimators)
+			decimator.Reset();
+	}
+
+	mCurrentFrame = frame;
+	mFramesToDiscard = (UInt32)prerollFrames;
+	mFlushed = false;
+	mFlushedFrames = 0;
+	mFlushedFrameOffset = 0;
+
 	return _GetCurrentFrame();
 }
+
+SFB::Audio::Decoder::SeekCost SFB::Audio::DSDPCMDecoder::_GetSeekCost(SInt64 frame) const
+{
+	return mDecoder->GetSeekCost(DSD_FRAMES_PER_PCM_FRAME * mDecimationFactor * frame);
+}
+
+UInt32 SFB::Audio::DSDPCMDecoder::ConvertChannel(UInt32 channel, UInt32 dsdByteCount, bool lsbitfirst, float *output)
+{
+	// Each DSD byte holds 8 frames and is translated to a single PCM frame
+	auto dsd = (const unsigned char *)mBufferList->mBuffers[channel].mData;
+
+	const auto& kernels = SampleKernels::Get();
+
+	if(mDecimators.empty()) {
+		kernels.TranslateDSD(mTables.data(), mContext[channel], dsd, lsbitfirst, output, dsdByteCount);
+		return dsdByteCount;
+	}
+
+	float *pcm = mScratch[channel].data();
+	kernels.TranslateDSD(mTables.data(), mContext[channel], dsd, lsbitfirst, pcm, dsdByteCount);
+
+	UInt32 frameCount = dsdByteCount;
+	for(auto& decimator : mDecimators[channel])
+		frameCount = decimator.Process(pcm, frameCount, pcm);
+
+	memcpy(output, pcm, frameCount * sizeof(float));
+
+	return frameCount;
+}
+
+UInt32 SFB::Audio::DSDPCMDecoder::FlushChannel(UInt32 channel)
+{
+	// Each decimator's tail is decimated by the following stage before that stage's own tail
+	float *pcm = mScratch[channel].data();
+	UInt32 frameCount = 0;
+	for(auto& decimator : mDecimators[channel]) {
+		frameCount = decimator.Process(pcm, frameCount, pcm);
+		frameCount += decimator.Flush(pcm + frameCount);
+	}
+
+	return frameCount;
+}
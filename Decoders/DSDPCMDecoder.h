@@ -9,8 +9,9 @@
 
 #include "AudioDecoder.h"
 #include "AudioBufferList.h"
+#include "SampleKernels.h"
 
-/*! @file DSDPCMDecoder.h @brief Support for decoding DSD64 to PCM */
+/*! @file DSDPCMDecoder.h @brief Support for decoding DSD64, DSD128 and DSD256 to PCM */
 
 /*! @brief \c SFBAudioEngine's encompassing namespace */
 namespace SFB {
@@ -18,7 +19,14 @@ namespace SFB {
 	/*! @brief %Audio functionality */
 	namespace Audio {
 
-		/*! @brief A wrapper around a Decoder supporting DSD64 to PCM conversion */
+		/*!
+		 * @brief A wrapper around a Decoder supporting DSD to PCM conversion
+		 *
+		 * DSD is first decimated by 8 using a lookup table FIR filter, producing PCM at 352.8 KHz for DSD64,
+		 * 705.6 KHz for DSD128, and 1411.2 KHz for DSD256.  Half-band filters then decimate by 2 as many
+		 * times as needed to reach the target sample rate.  The half-band filters are zero-phase, so output frame
+		 * \c n corresponds to the DSD beginning at frame \c n times the decimation factor.
+		 */
 		class DSDPCMDecoder : public Decoder
 		{
 
@@ -88,9 +96,45 @@ namespace SFB {
 
 			//@}
 
+
+			// ========================================
+			/*! @name PCM Sample Rate Conversion */
+			//@{
+
+			/*! @brief The length of the half-band filters used for decimation after the initial conversion to PCM */
+			enum class FilterQuality {
+				Low,		/*!< 31 taps: least CPU usage, with a passband flat to about 30% of the output sample rate */
+				Medium,		/*!< 63 taps: a passband flat to about 40% of the output sample rate */
+				High		/*!< 127 taps: most CPU usage, with a passband flat to about 45% of the output sample rate */
+			};
+
+			/*! @brief Get the target sample rate for the PCM output (default is 352.8 KHz) */
+			inline Float64 GetTargetSampleRate() const				{ return mTargetSampleRate; }
+
+			/*!
+			 * @brief Set the target sample rate for the PCM output
+			 * @note This takes effect when the decoder is opened.  The output sample rate is the lowest rate
+			 * not less than \c sampleRate obtained by halving the DSD sample rate divided by 8, so DSD64, DSD128
+			 * and DSD256 may all be converted to 88.2, 176.4 or 352.8 KHz.
+			 * @param sampleRate The desired sample rate
+			 */
+			inline void SetTargetSampleRate(Float64 sampleRate)		{ mTargetSampleRate = sampleRate; }
+
+			/*! @brief Get the quality of the filters used for decimation (default is \c FilterQuality::Medium) */
+			inline FilterQuality GetFilterQuality() const			{ return mFilterQuality; }
+
+			/*!
+			 * @brief Set the quality of the filters used for decimation
+			 * @note This takes effect when the decoder is opened
+			 * @param filterQuality The desired filter quality
+			 */
+			inline void SetFilterQuality(FilterQuality filterQuality)	{ mFilterQuality = filterQuality; }
+
+			//@}
+
 		private:
 
-			class DXD;
+			class Decimator;
 
 			DSDPCMDecoder() = delete;
 			explicit DSDPCMDecoder(Decoder::unique_ptr decoder);
@@ -116,12 +160,32 @@ namespace SFB {
 			// Seeking support
 			inline virtual bool _SupportsSeeking() const			{ return mDecoder->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
+			virtual SeekCost _GetSeekCost(SInt64 frame) const;
+
+			// Convert the DSD in mBufferList for channel to PCM, returning the number of PCM frames produced
+			UInt32 ConvertChannel(UInt32 channel, UInt32 dsdByteCount, bool lsbitfirst, float *output);
+
+			// Flush the decimation cascade for channel into mScratch, returning the number of PCM frames produced
+			UInt32 FlushChannel(UInt32 channel);
 
 			// Data members
 			Decoder::unique_ptr		mDecoder;
 			BufferList				mBufferList;
-			std::vector<DXD> 		mContext;
+			std::vector<SampleKernels::DSDTranslationState>	mContext;	// The dsd2pcm state for each channel
+			std::vector<std::vector<Decimator>>	mDecimators;	// The decimation cascade for each channel
+			std::vector<std::vector<float>>		mScratch;		// PCM for each channel before decimation
+			UInt32					mDecimationFactor;		// PCM frames at DSD rate / 8 per output frame
+			UInt32					mSeekPrerollFrames;		// Frames decoded before a seek target for the filters' history
+			SInt64					mCurrentFrame;
+			UInt32					mFramesToDiscard;		// Preroll frames not yet discarded
+			bool					mFlushed;				// Whether the decimation cascades were flushed at the end of the input
+			UInt32					mFlushedFrames;			// Flushed frames in mScratch not yet read
+			UInt32					mFlushedFrameOffset;
+			Float64					mTargetSampleRate;
+			FilterQuality			mFilterQuality;
+			std::vector<float>		mTables;			// dsd2pcm lookup tables scaled by mTablesGain
 			float 					mLinearGain;
+			float					mTablesGain;
 		};
 
 	}
@@ -10,6 +10,9 @@
 #include "CFErrorUtilities.h"
 #include "Logger.h"
 
+// The most blocks read from the input source at once
+#define MAX_BLOCKS_PER_READ 8u
+
 namespace {
 
 	void RegisterDSFDecoder() __attribute__ ((constructor));
@@ -32,6 +35,17 @@ namespace {
 		return true;
 	}
 
+	// DSD64 through DSD512, at multiples of 44.1 or 48 KHz
+	bool IsSupportedSampleRate(uint32_t sampleRate)
+	{
+		for(uint32_t multiplier = 64; multiplier <= 512; multiplier *= 2) {
+			if(44100 * multiplier == sampleRate || 48000 * multiplier == sampleRate)
+				return true;
+		}
+
+		return false;
+	}
+
 	CFErrorRef CreateInvalidDSFFileError(CFURLRef url) CF_RETURNS_RETAINED
 	{
 		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid DSF file."), ""));
@@ -79,6 +93,15 @@ bool SFB::Audio::DSFDecoder::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::DSFDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+	return 32 <= length && 0 == memcmp(bytes, "DSD ", 4) && 0 == memcmp(bytes + 28, "fmt ", 4);
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::DSFDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new DSFDecoder(std::move(inputSource)));
@@ -175,14 +198,14 @@ bool SFB::Audio::DSFDecoder::_Open(CFErrorRef *error)
 		return false;
 	}
 
-	if(!GetInputSource().ReadLE<uint32_t>(channelNum) || (1 > channelNum || 6 < channelNum)) {
+	if(!GetInputSource().ReadLE<uint32_t>(channelNum) || 1 > channelNum) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.DSF", "Unexpected channel count in 'fmt ': " << channelNum);
 		if(error)
 			*error = CreateInvalidDSFFileError(mInputSource->GetURL());
 		return false;
 	}
 
-	if(!GetInputSource().ReadLE<uint32_t>(samplingFrequency) || (2822400 != samplingFrequency && 5644800 != samplingFrequency)) {
+	if(!GetInputSource().ReadLE<uint32_t>(samplingFrequency) || !IsSupportedSampleRate(samplingFrequency)) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.DSF", "Unexpected sample rate in 'fmt ': " << samplingFrequency);
 		if(error)
 			*error = CreateInvalidDSFFileError(mInputSource->GetURL());
@@ -267,6 +290,10 @@ bool SFB::Audio::DSFDecoder::_Open(CFErrorRef *error)
 		case 7:		mChannelLayout = ChannelLayout::ChannelLayoutWithTag(kAudioChannelLayoutTag_MPEG_5_1_A);	break;
 	}
 
+	// Files with more channels than their channel type describes are read without a layout
+	if(mChannelLayout && mChannelLayout.GetChannelCount() != channelNum)
+		mChannelLayout = ChannelLayout();
+
 	// Metadata chunk is ignored
 
 	// Allocate buffers
@@ -274,11 +301,22 @@ bool SFB::Audio::DSFDecoder::_Open(CFErrorRef *error)
 	for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i)
 		mBufferList->mBuffers[i].mDataByteSize = 0;
 
+	mBlockBuffer.resize(MAX_BLOCKS_PER_READ * mBlockByteSizePerChannel * mFormat.mChannelsPerFrame);
+	mBlockVectors.resize(MAX_BLOCKS_PER_READ * mFormat.mChannelsPerFrame);
+
 	return true;
 }
 
 bool SFB::Audio::DSFDecoder::_Close(CFErrorRef */*error*/)
 {
+	mBufferList.Deallocate();
+
+	mBlockBuffer.clear();
+	mBlockBuffer.shrink_to_fit();
+
+	mBlockVectors.clear();
+	mBlockVectors.shrink_to_fit();
+
 	return true;
 }
 
@@ -333,6 +371,17 @@ UInt32 SFB::Audio::DSFDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 fr
 		if(framesRead == framesToRead)
 			break;
 
+		// Whole blocks are read in bulk straight into the output, bypassing the internal buffer
+		auto blockSizePerChannelInFrames = (UInt32)mFormat.ByteCountToFrameCount(mBlockByteSizePerChannel);
+		UInt32 blocksRemaining = (framesToRead - framesRead) / blockSizePerChannelInFrames;
+		if(0 < blocksRemaining) {
+			UInt32 blocksRead = ReadBlocks(bufferList, (UInt32)mFormat.FrameCountToByteCount(framesRead), blocksRemaining);
+			framesRead += blocksRead * blockSizePerChannelInFrames;
+			if(0 == blocksRead)
+				break;
+			continue;
+		}
+
 		// Read and deinterleave the next block
 		if(!ReadAndDeinterleaveDSDBlock())
 			break;
@@ -382,9 +431,10 @@ SInt64 SFB::Audio::DSFDecoder::_SeekToFrame(SInt64 frame)
 bool SFB::Audio::DSFDecoder::ReadAndDeinterleaveDSDBlock()
 {
 	auto bufsize = mFormat.mChannelsPerFrame * mBlockByteSizePerChannel;
-	uint8_t buf [bufsize];
 
-	auto bytesRead = GetInputSource().Read(buf, bufsize);
+	const void *bytes = nullptr;
+	auto bytesRead = GetInputSource().BorrowOrRead(bytes, mBlockBuffer.data(), bufsize);
+	auto buf = static_cast<const uint8_t *>(bytes);
 	if(bytesRead != bufsize) {
 		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.DSF", "Error reading audio block: requested " << bufsize << " bytes, got " << bytesRead);
 		return false;
@@ -402,3 +452,50 @@ bool SFB::Audio::DSFDecoder::ReadAndDeinterleaveDSDBlock()
 
 	return true;
 }
+
+UInt32 SFB::Audio::DSFDecoder::ReadBlocks(AudioBufferList *bufferList, UInt32 byteOffset, UInt32 blockCount)
+{
+	auto blockSize = mFormat.mChannelsPerFrame * mBlockByteSizePerChannel;
+	blockCount = std::min(blockCount, MAX_BLOCKS_PER_READ);
+
+	// Each block holds mBlockByteSizePerChannel bytes for the first channel, followed by the same for the next
+	SInt64 bytesRead;
+	if(GetInputSource().SupportsBorrowing()) {
+		// Memory-backed inputs are copied from directly
+		const void *bytes = nullptr;
+		bytesRead = GetInputSource().Borrow(bytes, blockCount * blockSize);
+		auto blocks = static_cast<const uint8_t *>(bytes);
+
+		UInt32 blocksRead = 0 < bytesRead ? (UInt32)(bytesRead / blockSize) : 0;
+		for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+			uint8_t *dst = (uint8_t *)bufferList->mBuffers[i].mData + byteOffset;
+			for(UInt32 block = 0; block < blocksRead; ++block)
+				memcpy(dst + (block * mBlockByteSizePerChannel), blocks + (block * blockSize) + (i * mBlockByteSizePerChannel), mBlockByteSizePerChannel);
+		}
+	}
+	else {
+		// Other inputs scatter the channels of each block directly into the output
+		UInt32 vectorCount = 0;
+		for(UInt32 block = 0; block < blockCount; ++block) {
+			for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+				mBlockVectors[vectorCount].iov_base	= (uint8_t *)bufferList->mBuffers[i].mData + byteOffset + (block * mBlockByteSizePerChannel);
+				mBlockVectors[vectorCount].iov_len	= mBlockByteSizePerChannel;
+				++vectorCount;
+			}
+		}
+
+		bytesRead = GetInputSource().ReadV(mBlockVectors.data(), (int)vectorCount);
+	}
+
+	if(bytesRead != blockCount * blockSize)
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.DSF", "Error reading audio blocks: requested " << blockCount * blockSize << " bytes, got " << bytesRead);
+
+	UInt32 blocksRead = 0 < bytesRead ? (UInt32)(bytesRead / blockSize) : 0;
+
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+		bufferList->mBuffers[i].mNumberChannels	= 1;
+		bufferList->mBuffers[i].mDataByteSize	+= blocksRead * mBlockByteSizePerChannel;
+	}
+
+	return blocksRead;
+}
@@ -5,6 +5,9 @@
 
 #pragma once
 
+#include <vector>
+#include <sys/uio.h>
+
 #include "AudioDecoder.h"
 #include "AudioBufferList.h"
 
@@ -27,6 +30,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
@@ -53,9 +57,13 @@ namespace SFB {
 			// Seeking support
 			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
+			inline virtual SeekCost _GetSeekCost(SInt64 /*frame*/) const	{ return SeekCostConstant; }
 
 			bool ReadAndDeinterleaveDSDBlock();
 
+			// Read up to blockCount whole blocks directly into bufferList at byteOffset, returning the number read
+			UInt32 ReadBlocks(AudioBufferList *bufferList, UInt32 byteOffset, UInt32 blockCount);
+
 			// Data members
 			SInt64		mTotalFrames;
 			SInt64		mCurrentFrame;
@@ -63,6 +71,12 @@ namespace SFB {
 
 			uint32_t	mBlockByteSizePerChannel;
 			BufferList	mBufferList;
+
+			// Blocks as read from the input source, before the channels are separated
+			std::vector<uint8_t>	mBlockBuffer;
+
+			// The destination of each channel of each block for inputs read directly into the output
+			std::vector<struct iovec>	mBlockVectors;
 		};
 
 	}
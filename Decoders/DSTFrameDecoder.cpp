@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "DSTFrameDecoder.h"
+#include "Logger.h"
+
+namespace {
+
+	// Prediction coefficients for the coded filter coefficients and probabilities
+	const int sFilterSetsPredictionCoefficients [3][3] = {
+		{  -8,   0,   0 },
+		{ -16,   8,   0 },
+		{  -9,  -5,   6 },
+	};
+
+	const int sProbabilitiesPredictionCoefficients [3][3] = {
+		{  -8,   0,   0 },
+		{ -16,   8,   0 },
+		{ -24,  24,  -8 },
+	};
+
+	// A big endian bit reader returning zeros past the end of its data
+	class BitReader
+	{
+
+	public:
+
+		BitReader(const uint8_t *data, size_t length)
+			: mData(data), mLength(length), mPosition(0)
+		{}
+
+		inline size_t GetBitsRemaining() const
+		{
+			return mPosition < 8 * mLength ? 8 * mLength - mPosition : 0;
+		}
+
+		inline unsigned GetBit()
+		{
+			size_t byte = mPosition >> 3;
+			unsigned bit = byte < mLength ? (mData[byte] >> (7 - (mPosition & 7))) & 1 : 0;
+			++mPosition;
+			return bit;
+		}
+
+		// Reads up to 25 bits
+		inline unsigned GetBits(unsigned count)
+		{
+			if(0 == count)
+				return 0;
+
+			size_t byte = mPosition >> 3;
+			uint32_t cache = 0;
+			for(size_t i = byte; i < byte + 4; ++i)
+				cache = (cache << 8) | (i < mLength ? mData[i] : 0);
+
+			unsigned value = (cache << (mPosition & 7)) >> (32 - count);
+			mPosition += count;
+			return value;
+		}
+
+		inline int GetSignedBits(unsigned count)
+		{
+			unsigned value = GetBits(count);
+			return (int)(value ^ (1u << (count - 1))) - (int)(1u << (count - 1));
+		}
+
+		// A Rice code with parameter k followed by a sign for nonzero values
+		inline bool GetSignedRice(unsigned k, int& value)
+		{
+			unsigned quotient = 0;
+			while(0 == GetBit()) {
+				if(0 == GetBitsRemaining())
+					return false;
+				++quotient;
+			}
+
+			value = (int)((quotient << k) | GetBits(k));
+			if(value && GetBit())
+				value = -value;
+
+			return true;
+		}
+
+	private:
+
+		const uint8_t	*mData;
+		size_t			mLength;
+		size_t			mPosition;
+
+	};
+
+	// The arithmetic decoder
+	class ArithmeticDecoder
+	{
+
+	public:
+
+		explicit ArithmeticDecoder(BitReader& reader)
+			: mReader(reader), mA(4095), mC(reader.GetBits(12))
+		{}
+
+		// Decode one bit with probability p / 256 of being zero
+		inline unsigned GetBit(unsigned p)
+		{
+			unsigned k = (mA >> 8) | ((mA >> 7) & 1);
+			unsigned q = k * p;
+			unsigned a_q = mA - q;
+
+			unsigned bit = mC < a_q;
+			if(bit)
+				mA = a_q;
+			else {
+				mA = q;
+				mC -= a_q;
+			}
+
+			if(2048 > mA) {
+				unsigned n = 11 - (31 - (unsigned)__builtin_clz(mA));
+				mA <<= n;
+				mC = (mC << n) | mReader.GetBits(n);
+			}
+
+			return bit;
+		}
+
+	private:
+
+		BitReader&	mReader;
+		unsigned	mA;
+		unsigned	mC;
+
+	};
+
+	inline uint8_t ReverseBits(uint8_t b)
+	{
+		b = (uint8_t)(((b & 0xf0) >> 4) | ((b & 0x0f) << 4));
+		b = (uint8_t)(((b & 0xcc) >> 2) | ((b & 0x33) << 2));
+		b = (uint8_t)(((b & 0xaa) >> 1) | ((b & 0x55) << 1));
+		return b;
+	}
+
+	// Read the mapping of channels to table elements
+	bool ReadMap(BitReader& reader, unsigned& elements, unsigned *map, unsigned channels, unsigned maximumElements)
+	{
+		elements = 1;
+		std::fill_n(map, channels, 0);
+
+		// Same mapping for all channels
+		if(reader.GetBit())
+			return true;
+
+		for(unsigned ch = 1; ch < channels; ++ch) {
+			unsigned bits = (31 - (unsigned)__builtin_clz(elements)) + 1;
+			map[ch] = reader.GetBits(bits);
+			if(map[ch] == elements) {
+				if(maximumElements <= ++elements)
+					return false;
+			}
+			else if(map[ch] > elements)
+				return false;
+		}
+
+		return true;
+	}
+}
+
+unsigned SFB::Audio::DSTFrameDecoder::SamplesPerFrame(unsigned sampleRate)
+{
+	// 1/75 second
+	return 588 * (sampleRate / 44100);
+}
+
+SFB::Audio::DSTFrameDecoder::DSTFrameDecoder(unsigned channels, unsigned sampleRate)
+	: mChannels(std::min(channels, MaximumChannels)), mSamplesPerFrame(SamplesPerFrame(sampleRate))
+{}
+
+bool SFB::Audio::DSTFrameDecoder::DecodeFrame(const uint8_t *frame, size_t length, uint8_t *dsd)
+{
+	if(nullptr == frame || 1 >= length || nullptr == dsd)
+		return false;
+
+	size_t frameBytes = (mSamplesPerFrame / 8) * mChannels;
+
+	BitReader reader(frame, length);
+
+	// Uncompressed frames contain the DSD following one byte of header
+	if(!reader.GetBit()) {
+		reader.GetBit();
+		if(reader.GetBits(6)) {
+			LOGGER_NOTICE("org.sbooth.AudioEngine.DSTFrameDecoder", "Invalid stuffing in uncompressed frame");
+			return false;
+		}
+
+		size_t bytesToCopy = std::min(length - 1, frameBytes);
+		memcpy(dsd, frame + 1, bytesToCopy);
+		memset(dsd + bytesToCopy, 0x69, frameBytes - bytesToCopy);
+		return true;
+	}
+
+	// Segmentation: only a single segment per channel is supported, as produced by all known encoders
+	if(!reader.GetBit() || !reader.GetBit() || !reader.GetBit()) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.DSTFrameDecoder", "Segmented frames are not supported");
+		return false;
+	}
+
+	// Mapping
+	unsigned channelFilterSets [MaximumChannels];
+	unsigned channelProbabilities [MaximumChannels];
+
+	bool sameMapping = reader.GetBit();
+	if(!ReadMap(reader, mFilterSets.mElements, channelFilterSets, mChannels, MaximumElements))
+		return false;
+
+	if(sameMapping) {
+		mProbabilities.mElements = mFilterSets.mElements;
+		std::copy_n(channelFilterSets, mChannels, channelProbabilities);
+	}
+	else if(!ReadMap(reader, mProbabilities.mElements, channelProbabilities, mChannels, MaximumElements))
+		return false;
+
+	// Half probability
+	bool halfProbability [MaximumChannels];
+	for(unsigned ch = 0; ch < mChannels; ++ch)
+		halfProbability[ch] = reader.GetBit();
+
+	// Filter coefficient sets and probability tables
+	auto readTable = [&reader](Table& table, const int predictionCoefficients [3][3], unsigned lengthBits, unsigned coefficientBits, bool isSigned, int offset) {
+		for(unsigned i = 0; i < table.mElements; ++i) {
+			table.mLength[i] = reader.GetBits(lengthBits) + 1;
+
+			auto readUncoded = [&](unsigned count) {
+				for(unsigned j = 0; j < count; ++j)
+					table.mCoefficients[i][j] = (isSigned ? reader.GetSignedBits(coefficientBits) : (int)reader.GetBits(coefficientBits)) + offset;
+			};
+
+			if(!reader.GetBit()) {
+				readUncoded(table.mLength[i]);
+				continue;
+			}
+
+			unsigned method = reader.GetBits(2);
+			if(3 == method)
+				return false;
+
+			readUncoded(method + 1);
+
+			unsigned riceParameter = reader.GetBits(3);
+			for(unsigned j = method + 1; j < table.mLength[i]; ++j) {
+				int x = 0;
+				for(unsigned k = 0; k <= method; ++k)
+					x += predictionCoefficients[method][k] * table.mCoefficients[i][j - k - 1];
+
+				int c;
+				if(!reader.GetSignedRice(riceParameter, c))
+					return false;
+
+				if(0 <= x)
+					c -= (x + 4) / 8;
+				else
+					c += (-x + 3) / 8;
+
+				if(!isSigned && (c < offset || c >= offset + (1 << coefficientBits)))
+					return false;
+
+				table.mCoefficients[i][j] = c;
+			}
+		}
+
+		return true;
+	};
+
+	if(!readTable(mFilterSets, sFilterSetsPredictionCoefficients, 7, 9, true, 0) || !readTable(mProbabilities, sProbabilitiesPredictionCoefficients, 6, 7, false, 1)) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.DSTFrameDecoder", "Invalid filter or probability table");
+		return false;
+	}
+
+	// Build the filter lookup tables, each entry the response to one status byte
+	for(unsigned i = 0; i < mFilterSets.mElements; ++i) {
+		int length = (int)mFilterSets.mLength[i];
+		for(int j = 0; j < 16; ++j) {
+			int taps = std::max(0, std::min(length - j * 8, 8));
+			for(int k = 0; k < 256; ++k) {
+				int v = 0;
+				for(int l = 0; l < taps; ++l)
+					v += (((k >> l) & 1) * 2 - 1) * mFilterSets.mCoefficients[i][j * 8 + l];
+				if((int16_t)v != v)
+					return false;
+				mFilters[i][j][k] = (int16_t)v;
+			}
+		}
+	}
+
+	// Arithmetic coded data
+	if(reader.GetBit())
+		return false;
+
+	ArithmeticDecoder decoder(reader);
+
+	// The first bit is defined by the stream and discarded
+	decoder.GetBit((ReverseBits((uint8_t)(mFilterSets.mCoefficients[0][0] & 127)) >> 1) + 1);
+
+	// The 128 previous samples for each channel, in 16 status bytes with the most recent sample in the low bit of the first
+	uint64_t status [MaximumChannels][2];
+	for(unsigned ch = 0; ch < mChannels; ++ch)
+		status[ch][0] = status[ch][1] = 0xaaaaaaaaaaaaaaaaull;
+
+	memset(dsd, 0, frameBytes);
+
+	for(unsigned i = 0; i < mSamplesPerFrame; ++i) {
+		for(unsigned ch = 0; ch < mChannels; ++ch) {
+			const unsigned filterSet = channelFilterSets[ch];
+			const int16_t (*filter)[256] = mFilters[filterSet];
+
+			int sum = 0;
+			for(unsigned j = 0; j < 8; ++j)
+				sum += filter[j][(status[ch][0] >> (8 * j)) & 0xff] + filter[8 + j][(status[ch][1] >> (8 * j)) & 0xff];
+			const int16_t predict = (int16_t)sum;
+
+			unsigned p;
+			if(!halfProbability[ch] || i >= mFilterSets.mLength[filterSet]) {
+				const Table& probabilities = mProbabilities;
+				unsigned element = channelProbabilities[ch];
+				unsigned index = (unsigned)std::abs((int)predict) >> 3;
+				p = (unsigned)probabilities.mCoefficients[element][std::min(index, probabilities.mLength[element] - 1)];
+			}
+			else
+				p = 128;
+
+			unsigned residual = decoder.GetBit(p);
+			unsigned v = ((predict < 0 ? 1u : 0u) ^ residual) & 1;
+			dsd[(i >> 3) * mChannels + ch] |= (uint8_t)(v << (7 - (i & 7)));
+
+			status[ch][1] = (status[ch][1] << 1) | (status[ch][0] >> 63);
+			status[ch][0] = (status[ch][0] << 1) | v;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace SFB {
+
+	namespace Audio {
+
+		// ========================================
+		// A decoder for single frames of DST (Direct Stream Transfer) compressed DSD
+		//
+		// DST frames are independently decodable, so separate instances may decode
+		// different frames of the same stream concurrently
+		//  See ISO/IEC 14496-3 subpart 10
+		// ========================================
+		class DSTFrameDecoder
+		{
+
+		public:
+
+			// The maximum number of channels in a DST stream
+			static const unsigned MaximumChannels = 6;
+
+			// The number of DSD samples per channel in each frame, for a DSD sample rate
+			static unsigned SamplesPerFrame(unsigned sampleRate);
+
+			DSTFrameDecoder(unsigned channels, unsigned sampleRate);
+
+			DSTFrameDecoder(const DSTFrameDecoder& rhs) = delete;
+			DSTFrameDecoder& operator=(const DSTFrameDecoder& rhs) = delete;
+
+			// Decode length bytes of frame into the DSD for one frame, interleaved by channel byte as in DSDIFF
+			// dsd must hold (SamplesPerFrame() / 8) * channels bytes
+			bool DecodeFrame(const uint8_t *frame, size_t length, uint8_t *dsd);
+
+		private:
+
+			static const unsigned MaximumElements = 2 * MaximumChannels;
+
+			// Filter coefficient sets or probability tables
+			struct Table {
+				unsigned mElements;
+				unsigned mLength [MaximumElements];
+				int mCoefficients [MaximumElements][128];
+			};
+
+			unsigned	mChannels;
+			unsigned	mSamplesPerFrame;
+
+			Table		mFilterSets;
+			Table		mProbabilities;
+
+			// Prediction filter responses for each of the 16 status bytes preceding a sample
+			int16_t		mFilters [MaximumElements][16][256];
+		};
+
+	}
+}
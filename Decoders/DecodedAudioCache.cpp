@@ -0,0 +1,771 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <dispatch/dispatch.h>
+#include <mach/mach_time.h>
+
+#include "DecodedAudioCache.h"
+#include "CFWrapper.h"
+#include "Logger.h"
+
+namespace {
+
+	// Decoded audio is cached in the user's cache directory keyed by path and validated by file size and modification time
+	const char kDecodedAudioMagic [4] = { 'S', 'F', 'B', 'p' };
+	const uint32_t kDecodedAudioVersion = 1;
+	const char kDecodedAudioExtension [] = ".pcm";
+
+	// The header is followed by the path, the channel layout, the source format description in UTF-8 and the interleaved audio
+	struct DecodedAudioHeader
+	{
+		char							mMagic [4];
+		uint32_t						mVersion;
+		uint32_t						mPathLength;
+		uint32_t						mChannelLayoutSize;
+		uint32_t						mSourceFormatDescriptionLength;
+		uint32_t						mReserved;
+		int64_t							mFileSize;
+		int64_t							mModificationTime;
+		int64_t							mModificationTimeNanoseconds;
+		int64_t							mFrameCount;
+		AudioStreamBasicDescription		mFormat;
+		AudioStreamBasicDescription		mSourceFormat;
+	};
+
+	std::atomic_bool	sEnabled = ATOMIC_VAR_INIT(false);
+	std::atomic<SInt64>	sCapacity(SFB::Audio::DecodedAudioCache::DefaultCapacity);
+	std::atomic<double>	sMinimumDecodingCost(SFB::Audio::DecodedAudioCache::DefaultMinimumDecodingCost);
+
+	std::atomic<uint64_t>	sHitCount = ATOMIC_VAR_INIT(0);
+	std::atomic<uint64_t>	sMissCount = ATOMIC_VAR_INIT(0);
+	std::atomic<uint64_t>	sStoreCount = ATOMIC_VAR_INIT(0);
+
+	std::mutex			sDirectoryMutex;
+	std::string			sDirectory;			// Empty for the default
+	std::mutex			sTrimMutex;
+
+	// ========================================
+	// Convert host time to nanoseconds
+	uint64_t ConvertHostTimeToNanos(uint64_t hostTime)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (hostTime * sTimebaseInfo.numer) / sTimebaseInfo.denom;
+	}
+
+	// The path and status of the regular file at url
+	bool GetFileStatus(CFURLRef url, std::string& path, struct stat& sb)
+	{
+		char buffer [PATH_MAX];
+		if(!url || !CFURLGetFileSystemRepresentation(url, true, (UInt8 *)buffer, sizeof(buffer)))
+			return false;
+
+		if(0 != stat(buffer, &sb) || !S_ISREG(sb.st_mode))
+			return false;
+
+		path = buffer;
+		return true;
+	}
+
+	std::string DecodedAudioCacheDirectory()
+	{
+		std::lock_guard<std::mutex> lock(sDirectoryMutex);
+
+		if(!sDirectory.empty()) {
+			if(0 != mkdir(sDirectory.c_str(), 0755) && EEXIST != errno)
+				return std::string();
+			return sDirectory;
+		}
+
+		char cacheDirectory [PATH_MAX];
+		size_t length = confstr(_CS_DARWIN_USER_CACHE_DIR, cacheDirectory, sizeof(cacheDirectory));
+		if(0 == length || length > sizeof(cacheDirectory))
+			return std::string();
+
+		std::string directory = std::string(cacheDirectory) + "org.sbooth.AudioEngine";
+		if(0 != mkdir(directory.c_str(), 0755) && EEXIST != errno)
+			return std::string();
+
+		directory += "/DecodedAudio";
+		if(0 != mkdir(directory.c_str(), 0755) && EEXIST != errno)
+			return std::string();
+
+		return directory;
+	}
+
+	std::string DecodedAudioCachePath(const std::string& directory, const std::string& path)
+	{
+		char name [21];
+		snprintf(name, sizeof(name), "%016zx%s", std::hash<std::string>()(path), kDecodedAudioExtension);
+
+		return directory + "/" + name;
+	}
+
+	void FillDecodedAudioHeader(DecodedAudioHeader& header, const std::string& path, const struct stat& sb)
+	{
+		memset(&header, 0, sizeof(header));
+		memcpy(header.mMagic, kDecodedAudioMagic, sizeof(kDecodedAudioMagic));
+		header.mVersion						= kDecodedAudioVersion;
+		header.mPathLength					= (uint32_t)path.size();
+		header.mFileSize					= sb.st_size;
+		header.mModificationTime			= sb.st_mtimespec.tv_sec;
+		header.mModificationTimeNanoseconds	= sb.st_mtimespec.tv_nsec;
+	}
+
+	// Remove the least recently used audio until the cache fits in capacity
+	void TrimDecodedAudioCache(const std::string& directory, SInt64 capacity)
+	{
+		std::lock_guard<std::mutex> lock(sTrimMutex);
+
+		std::unique_ptr<DIR, int(*)(DIR *)> dir(opendir(directory.c_str()), closedir);
+		if(!dir)
+			return;
+
+		struct CacheEntry
+		{
+			std::string		mPath;
+			SInt64			mSize;
+			struct timespec	mLastUsed;
+		};
+
+		std::vector<CacheEntry> entries;
+		SInt64 totalSize = 0;
+
+		const size_t extensionLength = strlen(kDecodedAudioExtension);
+		while(struct dirent *entry = readdir(dir.get())) {
+			size_t nameLength = strlen(entry->d_name);
+			if(nameLength <= extensionLength || strcmp(entry->d_name + nameLength - extensionLength, kDecodedAudioExtension))
+				continue;
+
+			std::string path = directory + "/" + entry->d_name;
+			struct stat sb;
+			if(0 != stat(path.c_str(), &sb) || !S_ISREG(sb.st_mode))
+				continue;
+
+			entries.push_back({ path, sb.st_size, sb.st_mtimespec });
+			totalSize += sb.st_size;
+		}
+
+		if(totalSize <= capacity)
+			return;
+
+		std::sort(entries.begin(), entries.end(), [](const CacheEntry& lhs, const CacheEntry& rhs) {
+			return lhs.mLastUsed.tv_sec < rhs.mLastUsed.tv_sec || (lhs.mLastUsed.tv_sec == rhs.mLastUsed.tv_sec && lhs.mLastUsed.tv_nsec < rhs.mLastUsed.tv_nsec);
+		});
+
+		for(const auto& entry : entries) {
+			if(totalSize <= capacity)
+				break;
+
+			if(0 == unlink(entry.mPath.c_str())) {
+				totalSize -= entry.mSize;
+				LOGGER_DEBUG("org.sbooth.AudioEngine.DecodedAudioCache", "Removed " << entry.mPath << " (" << entry.mSize << " bytes)");
+			}
+		}
+	}
+
+	void ScheduleDecodedAudioCacheTrim(const std::string& directory)
+	{
+		std::string path = directory;
+		SInt64 capacity = sCapacity.load();
+		dispatch_async(dispatch_get_global_queue(QOS_CLASS_BACKGROUND, 0), ^{
+			TrimDecodedAudioCache(path, capacity);
+		});
+	}
+
+#pragma mark CachingDecoder
+
+	// ========================================
+	// A decoder writing the audio read from start to end by another decoder to the cache
+	class CachingDecoder : public SFB::Audio::Decoder
+	{
+
+	public:
+
+		CachingDecoder(unique_ptr decoder, std::string path, const struct stat& sb)
+			: Decoder(), mDecoder(std::move(decoder)), mPath(std::move(path)), mFileStatus(sb), mFile(nullptr, fclose), mCaching(false), mFramesWritten(0), mDecodingTime(0)
+		{}
+
+		virtual ~CachingDecoder()
+		{
+			AbandonCacheFile();
+		}
+
+	private:
+
+		// Source access
+		inline virtual CFURLRef _GetURL() const					{ return mDecoder->GetURL(); }
+		inline virtual SFB::InputSource& _GetInputSource() const	{ return mDecoder->GetInputSource(); }
+
+		// Audio access
+		virtual bool _Open(CFErrorRef *error)
+		{
+			if(!mDecoder->IsOpen() && !mDecoder->Open(error))
+				return false;
+
+			mFormat			= mDecoder->GetFormat();
+			mChannelLayout	= mDecoder->GetChannelLayout();
+			mSourceFormat	= mDecoder->GetSourceFormat();
+
+			// Audio is cached only when read from the first frame, and only if it will fit
+			SInt64 totalFrames = mDecoder->GetTotalFrames();
+			mCaching = mFormat.IsPCM() && 0 == mDecoder->GetCurrentFrame() && (0 >= totalFrames || totalFrames * GetInterleavedBytesPerFrame() <= sCapacity.load());
+			mFramesWritten = 0;
+			mDecodingTime = 0;
+
+			return true;
+		}
+
+		virtual bool _Close(CFErrorRef *error)
+		{
+			AbandonCacheFile();
+			return mDecoder->Close(error);
+		}
+
+		// The native format of the source audio
+		virtual SFB::CFString _GetSourceFormatDescription() const
+		{
+			return SFB::CFString(mDecoder->CreateSourceFormatDescription());
+		}
+
+		// Attempt to read frameCount frames of audio, returning the actual number of frames read
+		virtual UInt32 _ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+		{
+			SInt64 startingFrame = mDecoder->GetCurrentFrame();
+
+			auto readStartTime = mach_absolute_time();
+			UInt32 framesRead = mDecoder->ReadAudio(bufferList, frameCount);
+			mDecodingTime += mach_absolute_time() - readStartTime;
+
+			if(mCaching) {
+				// Audio read following a seek isn't contiguous with the audio already cached
+				if(startingFrame != mFramesWritten)
+					AbandonCacheFile();
+				else if(0 == framesRead)
+					FinishCacheFile();
+				else if((!mFile && !CreateCacheFile()) || !WriteAudio(bufferList, framesRead))
+					AbandonCacheFile();
+			}
+
+			return framesRead;
+		}
+
+		// Source audio information
+		inline virtual SInt64 _GetTotalFrames() const			{ return mDecoder->GetTotalFrames(); }
+		inline virtual SInt64 _GetCurrentFrame() const			{ return mDecoder->GetCurrentFrame(); }
+		inline virtual bool _IsTotalFramesEstimated() const	{ return mDecoder->IsTotalFramesEstimated(); }
+
+		// Seeking support
+		inline virtual bool _SupportsSeeking() const			{ return mDecoder->SupportsSeeking(); }
+
+		virtual SInt64 _SeekToFrame(SInt64 frame)
+		{
+			SInt64 result = mDecoder->SeekToFrame(frame);
+			if(mCaching && result != mFramesWritten)
+				AbandonCacheFile();
+			return result;
+		}
+
+		virtual SInt64 _SeekToFrameApproximately(SInt64 frame)
+		{
+			SInt64 result = mDecoder->SeekToFrameApproximately(frame);
+			if(mCaching && result != mFramesWritten)
+				AbandonCacheFile();
+			return result;
+		}
+
+		inline virtual SeekCost _GetSeekCost(SInt64 frame) const	{ return mDecoder->GetSeekCost(frame); }
+
+		// Stream selection
+		inline virtual size_t _GetStreamCount() const			{ return mDecoder->GetStreamCount(); }
+		inline virtual size_t _GetCurrentStream() const			{ return mDecoder->GetCurrentStream(); }
+
+		virtual bool _SelectStream(size_t stream, CFErrorRef *error)
+		{
+			// The cache holds only the first stream
+			AbandonCacheFile();
+			return mDecoder->SelectStream(stream, error);
+		}
+
+		inline UInt32 GetInterleavedBytesPerFrame() const
+		{
+			return mFormat.IsInterleaved() ? mFormat.mBytesPerFrame : mFormat.mBytesPerFrame * mFormat.mChannelsPerFrame;
+		}
+
+		bool CreateCacheFile()
+		{
+			mDirectory = DecodedAudioCacheDirectory();
+			if(mDirectory.empty())
+				return false;
+
+			mCachePath = DecodedAudioCachePath(mDirectory, mPath);
+
+			// Write to a temporary file and rename it so readers never see partial audio
+			mTemporaryPath = mCachePath + ".XXXXXX";
+			int fd = mkstemp(&mTemporaryPath[0]);
+			if(-1 == fd) {
+				mTemporaryPath.clear();
+				return false;
+			}
+
+			mFile.reset(fdopen(fd, "w"));
+			if(!mFile) {
+				close(fd);
+				return false;
+			}
+
+			SFB::CFString sourceFormatDescription(mDecoder->CreateSourceFormatDescription());
+			std::vector<char> description;
+			if(sourceFormatDescription) {
+				CFIndex length = CFStringGetMaximumSizeForEncoding(CFStringGetLength(sourceFormatDescription), kCFStringEncodingUTF8) + 1;
+				description.resize((size_t)length);
+				if(CFStringGetCString(sourceFormatDescription, description.data(), length, kCFStringEncodingUTF8))
+					description.resize(strlen(description.data()));
+				else
+					description.clear();
+			}
+
+			DecodedAudioHeader header;
+			FillDecodedAudioHeader(header, mPath, mFileStatus);
+			header.mChannelLayoutSize				= mChannelLayout ? (uint32_t)mChannelLayout.GetACLSize() : 0;
+			header.mSourceFormatDescriptionLength	= (uint32_t)description.size();
+			header.mFormat							= mFormat;
+			header.mSourceFormat					= mSourceFormat;
+
+			// The frame count is written when the audio is complete
+			header.mFrameCount						= -1;
+
+			return 1 == fwrite(&header, sizeof(header), 1, mFile.get()) && 1 == fwrite(mPath.data(), mPath.size(), 1, mFile.get()) && (0 == header.mChannelLayoutSize || 1 == fwrite(mChannelLayout.GetACL(), header.mChannelLayoutSize, 1, mFile.get())) && (description.empty() || 1 == fwrite(description.data(), description.size(), 1, mFile.get()));
+		}
+
+		bool WriteAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+		{
+			if(mFormat.IsInterleaved()) {
+				size_t byteCount = frameCount * mFormat.mBytesPerFrame;
+				if(1 != fwrite(bufferList->mBuffers[0].mData, byteCount, 1, mFile.get()))
+					return false;
+			}
+			else {
+				UInt32 bytesPerSample = mFormat.mBytesPerFrame;
+				UInt32 bytesPerFrame = GetInterleavedBytesPerFrame();
+
+				mInterleavedAudio.resize(frameCount * bytesPerFrame);
+				for(UInt32 channel = 0; channel < bufferList->mNumberBuffers; ++channel) {
+					const uint8_t *input = (const uint8_t *)bufferList->mBuffers[channel].mData;
+					uint8_t *output = mInterleavedAudio.data() + (channel * bytesPerSample);
+					for(UInt32 frame = 0; frame < frameCount; ++frame, input += bytesPerSample, output += bytesPerFrame)
+						memcpy(output, input, bytesPerSample);
+				}
+
+				if(1 != fwrite(mInterleavedAudio.data(), mInterleavedAudio.size(), 1, mFile.get()))
+					return false;
+			}
+
+			mFramesWritten += frameCount;
+			return true;
+		}
+
+		void FinishCacheFile()
+		{
+			if(!mFile || 0 == mFramesWritten) {
+				AbandonCacheFile();
+				return;
+			}
+
+			// A decoder returning fewer frames than expected may have failed
+			SInt64 totalFrames = mDecoder->GetTotalFrames();
+			if(0 < totalFrames && totalFrames != mFramesWritten) {
+				LOGGER_DEBUG("org.sbooth.AudioEngine.DecodedAudioCache", "Not caching " << mPath << ": decoded " << mFramesWritten << " of " << totalFrames << " frames");
+				AbandonCacheFile();
+				return;
+			}
+
+			// Audio that is cheap to decode isn't worth the disk space
+			double duration = mFramesWritten / mFormat.mSampleRate;
+			double decodingCost = (ConvertHostTimeToNanos(mDecodingTime) / 1e9) / duration;
+			if(decodingCost < sMinimumDecodingCost.load()) {
+				LOGGER_DEBUG("org.sbooth.AudioEngine.DecodedAudioCache", "Not caching " << mPath << ": decoding cost " << decodingCost);
+				AbandonCacheFile();
+				return;
+			}
+
+			// Only the frame count differs from the header already written
+			int64_t frameCount = mFramesWritten;
+			bool result = 0 == fseeko(mFile.get(), offsetof(DecodedAudioHeader, mFrameCount), SEEK_SET) && 1 == fwrite(&frameCount, sizeof(frameCount), 1, mFile.get());
+			result = 0 == fclose(mFile.release()) && result;
+
+			if(!result || 0 != rename(mTemporaryPath.c_str(), mCachePath.c_str())) {
+				unlink(mTemporaryPath.c_str());
+				mTemporaryPath.clear();
+				mCaching = false;
+				return;
+			}
+
+			mTemporaryPath.clear();
+			mCaching = false;
+
+			sStoreCount.fetch_add(1);
+			LOGGER_INFO("org.sbooth.AudioEngine.DecodedAudioCache", "Cached " << mFramesWritten << " frames decoded from " << mPath << " (decoding cost " << decodingCost << ")");
+
+			ScheduleDecodedAudioCacheTrim(mDirectory);
+		}
+
+		void AbandonCacheFile()
+		{
+			mCaching = false;
+
+			if(mFile)
+				fclose(mFile.release());
+
+			if(!mTemporaryPath.empty()) {
+				unlink(mTemporaryPath.c_str());
+				mTemporaryPath.clear();
+			}
+		}
+
+		unique_ptr								mDecoder;
+		std::string								mPath;
+		struct stat								mFileStatus;
+
+		std::string								mDirectory;
+		std::string								mCachePath;
+		std::string								mTemporaryPath;
+		std::unique_ptr<FILE, int(*)(FILE *)>	mFile;
+		std::vector<uint8_t>					mInterleavedAudio;
+
+		bool									mCaching;
+		SInt64									mFramesWritten;
+		uint64_t								mDecodingTime;		// Host time spent in the wrapped decoder
+	};
+
+#pragma mark CachedDecoder
+
+	// ========================================
+	// A decoder reading cached audio
+	class CachedDecoder : public SFB::Audio::Decoder
+	{
+
+	public:
+
+		CachedDecoder(SFB::InputSource::unique_ptr inputSource, CFURLRef url, const DecodedAudioHeader& header, SFB::Audio::ChannelLayout channelLayout, SFB::CFString sourceFormatDescription, SInt64 dataOffset)
+			: Decoder(std::move(inputSource)), mURL((CFURLRef)CFRetain(url)), mCachedFormat(header.mFormat), mCachedSourceFormat(header.mSourceFormat), mCachedChannelLayout(std::move(channelLayout)), mSourceFormatDescription(std::move(sourceFormatDescription)), mDataOffset(dataOffset), mFrameCount(header.mFrameCount), mCurrentFrame(0)
+		{}
+
+	private:
+
+		// Source access
+		inline virtual CFURLRef _GetURL() const					{ return mURL; }
+
+		// Audio access
+		virtual bool _Open(CFErrorRef */*error*/)
+		{
+			if(!GetInputSource().SeekToOffset(mDataOffset))
+				return false;
+
+			mFormat			= mCachedFormat;
+			mSourceFormat	= mCachedSourceFormat;
+			mChannelLayout	= mCachedChannelLayout;
+			mCurrentFrame	= 0;
+
+			return true;
+		}
+
+		virtual bool _Close(CFErrorRef */*error*/)
+		{
+			return true;
+		}
+
+		// The native format of the source audio
+		virtual SFB::CFString _GetSourceFormatDescription() const
+		{
+			return SFB::CFString(mSourceFormatDescription ? (CFStringRef)CFRetain(mSourceFormatDescription) : nullptr);
+		}
+
+		// Attempt to read frameCount frames of audio, returning the actual number of frames read
+		virtual UInt32 _ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+		{
+			if(bufferList->mNumberBuffers != (mFormat.IsInterleaved() ? 1 : mFormat.mChannelsPerFrame)) {
+				LOGGER_WARNING("org.sbooth.AudioEngine.DecodedAudioCache", "_ReadAudio() called with invalid parameters");
+				return 0;
+			}
+
+			UInt32 framesToRead = (UInt32)std::min((SInt64)frameCount, mFrameCount - mCurrentFrame);
+			UInt32 bytesPerFrame = GetInterleavedBytesPerFrame();
+
+			if(mFormat.IsInterleaved()) {
+				SInt64 bytesRead = GetInputSource().Read(bufferList->mBuffers[0].mData, framesToRead * bytesPerFrame);
+				if(0 > bytesRead)
+					return 0;
+				framesToRead = (UInt32)(bytesRead / bytesPerFrame);
+			}
+			else {
+				mInterleavedAudio.resize(framesToRead * bytesPerFrame);
+				SInt64 bytesRead = GetInputSource().Read(mInterleavedAudio.data(), (SInt64)mInterleavedAudio.size());
+				if(0 > bytesRead)
+					return 0;
+				framesToRead = (UInt32)(bytesRead / bytesPerFrame);
+
+				UInt32 bytesPerSample = mFormat.mBytesPerFrame;
+				for(UInt32 channel = 0; channel < bufferList->mNumberBuffers; ++channel) {
+					const uint8_t *input = mInterleavedAudio.data() + (channel * bytesPerSample);
+					uint8_t *output = (uint8_t *)bufferList->mBuffers[channel].mData;
+					for(UInt32 frame = 0; frame < framesToRead; ++frame, input += bytesPerFrame, output += bytesPerSample)
+						memcpy(output, input, bytesPerSample);
+				}
+			}
+
+			for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+				bufferList->mBuffers[i].mDataByteSize = framesToRead * mFormat.mBytesPerFrame;
+
+			mCurrentFrame += framesToRead;
+
+			return framesToRead;
+		}
+
+		// Source audio information
+		inline virtual SInt64 _GetTotalFrames() const			{ return mFrameCount; }
+		inline virtual SInt64 _GetCurrentFrame() const			{ return mCurrentFrame; }
+
+		// Seeking support
+		inline virtual bool _SupportsSeeking() const			{ return GetInputSource().SupportsSeeking(); }
+
+		virtual SInt64 _SeekToFrame(SInt64 frame)
+		{
+			if(0 > frame || frame > mFrameCount)
+				return -1;
+
+			if(!GetInputSource().SeekToOffset(mDataOffset + frame * GetInterleavedBytesPerFrame()))
+				return -1;
+
+			mCurrentFrame = frame;
+			return frame;
+		}
+
+		inline virtual SeekCost _GetSeekCost(SInt64 /*frame*/) const	{ return SeekCostConstant; }
+
+		inline UInt32 GetInterleavedBytesPerFrame() const
+		{
+			return mFormat.IsInterleaved() ? mFormat.mBytesPerFrame : mFormat.mBytesPerFrame * mFormat.mChannelsPerFrame;
+		}
+
+		SFB::CFURL							mURL;
+		SFB::Audio::AudioFormat				mCachedFormat;
+		SFB::Audio::AudioFormat				mCachedSourceFormat;
+		SFB::Audio::ChannelLayout			mCachedChannelLayout;
+		SFB::CFString						mSourceFormatDescription;
+		SInt64								mDataOffset;
+		SInt64								mFrameCount;
+		SInt64								mCurrentFrame;
+		std::vector<uint8_t>				mInterleavedAudio;
+	};
+
+}
+
+#pragma mark Configuration
+
+bool SFB::Audio::DecodedAudioCache::IsEnabled()
+{
+	return sEnabled.load();
+}
+
+void SFB::Audio::DecodedAudioCache::SetEnabled(bool enabled)
+{
+	sEnabled.store(enabled);
+}
+
+void SFB::Audio::DecodedAudioCache::SetDirectory(CFURLRef url)
+{
+	char buffer [PATH_MAX];
+	if(url && !CFURLGetFileSystemRepresentation(url, true, (UInt8 *)buffer, sizeof(buffer))) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.DecodedAudioCache", "SetDirectory() called with invalid parameters");
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(sDirectoryMutex);
+	sDirectory = url ? buffer : "";
+}
+
+SInt64 SFB::Audio::DecodedAudioCache::GetCapacity()
+{
+	return sCapacity.load();
+}
+
+void SFB::Audio::DecodedAudioCache::SetCapacity(SInt64 capacity)
+{
+	if(0 > capacity) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.DecodedAudioCache", "SetCapacity() called with invalid parameters");
+		return;
+	}
+
+	sCapacity.store(capacity);
+
+	std::string directory = DecodedAudioCacheDirectory();
+	if(!directory.empty())
+		ScheduleDecodedAudioCacheTrim(directory);
+}
+
+double SFB::Audio::DecodedAudioCache::GetMinimumDecodingCost()
+{
+	return sMinimumDecodingCost.load();
+}
+
+void SFB::Audio::DecodedAudioCache::SetMinimumDecodingCost(double cost)
+{
+	if(0 > cost) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.DecodedAudioCache", "SetMinimumDecodingCost() called with invalid parameters");
+		return;
+	}
+
+	sMinimumDecodingCost.store(cost);
+}
+
+#pragma mark Cache management
+
+SFB::Audio::DecodedAudioCache::Statistics SFB::Audio::DecodedAudioCache::GetStatistics()
+{
+	return { sHitCount.load(), sMissCount.load(), sStoreCount.load() };
+}
+
+void SFB::Audio::DecodedAudioCache::Purge()
+{
+	std::string directory = DecodedAudioCacheDirectory();
+	if(directory.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock(sTrimMutex);
+
+	std::unique_ptr<DIR, int(*)(DIR *)> dir(opendir(directory.c_str()), closedir);
+	if(!dir)
+		return;
+
+	// Temporary files being written are removed too; their decoders fail to rename them and discard the audio
+	while(struct dirent *entry = readdir(dir.get())) {
+		if(strstr(entry->d_name, kDecodedAudioExtension))
+			unlink((directory + "/" + entry->d_name).c_str());
+	}
+}
+
+#pragma mark Decoder creation
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::DecodedAudioCache::CreateForURL(CFURLRef url, CFErrorRef *error)
+{
+	std::string path;
+	struct stat sb;
+	if(!GetFileStatus(url, path, sb))
+		return nullptr;
+
+	std::string directory = DecodedAudioCacheDirectory();
+	if(directory.empty())
+		return nullptr;
+
+	std::string cachePath = DecodedAudioCachePath(directory, path);
+
+	std::unique_ptr<FILE, int(*)(FILE *)> file(fopen(cachePath.c_str(), "r"), fclose);
+	if(!file) {
+		sMissCount.fetch_add(1);
+		return nullptr;
+	}
+
+	DecodedAudioHeader expected, header;
+	FillDecodedAudioHeader(expected, path, sb);
+
+	// A file modified since its audio was cached is a miss
+	if(1 != fread(&header, sizeof(header), 1, file.get()) || memcmp(header.mMagic, expected.mMagic, sizeof(header.mMagic)) || header.mVersion != expected.mVersion || header.mPathLength != expected.mPathLength || header.mFileSize != expected.mFileSize || header.mModificationTime != expected.mModificationTime || header.mModificationTimeNanoseconds != expected.mModificationTimeNanoseconds || 0 >= header.mFrameCount) {
+		sMissCount.fetch_add(1);
+		return nullptr;
+	}
+
+	// Guard against hash collisions
+	std::string cachedPath(header.mPathLength, '\0');
+	if(1 != fread(&cachedPath[0], header.mPathLength, 1, file.get()) || cachedPath != path) {
+		sMissCount.fetch_add(1);
+		return nullptr;
+	}
+
+	ChannelLayout channelLayout;
+	if(header.mChannelLayoutSize) {
+		std::vector<uint8_t> layout(header.mChannelLayoutSize);
+		const size_t descriptionsOffset = offsetof(AudioChannelLayout, mChannelDescriptions);
+		if(1 != fread(layout.data(), layout.size(), 1, file.get()) || descriptionsOffset > layout.size() || descriptionsOffset + ((const AudioChannelLayout *)layout.data())->mNumberChannelDescriptions * sizeof(AudioChannelDescription) > layout.size()) {
+			sMissCount.fetch_add(1);
+			return nullptr;
+		}
+		channelLayout = (const AudioChannelLayout *)layout.data();
+	}
+
+	SFB::CFString sourceFormatDescription;
+	if(header.mSourceFormatDescriptionLength) {
+		std::vector<UInt8> description(header.mSourceFormatDescriptionLength);
+		if(1 != fread(description.data(), description.size(), 1, file.get())) {
+			sMissCount.fetch_add(1);
+			return nullptr;
+		}
+		sourceFormatDescription = CFStringCreateWithBytes(kCFAllocatorDefault, description.data(), (CFIndex)description.size(), kCFStringEncodingUTF8, false);
+	}
+
+	SInt64 dataOffset = (SInt64)(sizeof(header) + header.mPathLength + header.mChannelLayoutSize + header.mSourceFormatDescriptionLength);
+	file.reset();
+
+	SFB::CFURL cacheURL(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)cachePath.c_str(), (CFIndex)cachePath.size(), false));
+	if(!cacheURL)
+		return nullptr;
+
+	auto inputSource = InputSource::CreateForURL(cacheURL, InputSource::AutomaticFileInput | InputSource::SequentialAccess, error);
+	if(!inputSource)
+		return nullptr;
+
+	unique_ptr decoder(new CachedDecoder(std::move(inputSource), url, header, std::move(channelLayout), std::move(sourceFormatDescription), dataOffset));
+	if(Decoder::AutomaticallyOpenDecoders() && !decoder->Open(error))
+		return nullptr;
+
+	// The modification time of cached audio records its last use
+	utimes(cachePath.c_str(), nullptr);
+
+	sHitCount.fetch_add(1);
+	LOGGER_DEBUG("org.sbooth.AudioEngine.DecodedAudioCache", "Using cached audio for " << path);
+
+	return decoder;
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::DecodedAudioCache::CreateCachingDecoder(Decoder::unique_ptr decoder)
+{
+	if(!decoder)
+		return nullptr;
+
+	// Only the audio in files may be cached, and only if it is PCM
+	std::string path;
+	struct stat sb;
+	if(!GetFileStatus(decoder->GetURL(), path, sb) || (decoder->IsOpen() && !decoder->GetFormat().IsPCM()))
+		return decoder;
+
+	bool open = decoder->IsOpen();
+	unique_ptr cachingDecoder(new CachingDecoder(std::move(decoder), std::move(path), sb));
+
+	// The wrapped decoder is open so this can't fail
+	if(open)
+		cachingDecoder->Open();
+
+	return cachingDecoder;
+}
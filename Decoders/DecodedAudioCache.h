@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "AudioDecoder.h"
+
+/*! @file DecodedAudioCache.h @brief A disk cache of decoded audio */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A bounded disk cache of audio that was expensive to decode
+		 *
+		 * When the cache is enabled, decoders created by \c Decoder::CreateForURL() for files write their PCM
+		 * output to the cache as they are read from start to end.  If decoding proved expensive relative to the
+		 * duration of the audio, as for Monkey's Audio at high compression levels, WavPack in high modes, or DSD
+		 * converted to PCM, the audio is retained.  Later decoders for the same unmodified file read the cached
+		 * PCM instead, at no decoding cost.
+		 *
+		 * Files are identified by path, device, inode, size and modification time.  The least recently used
+		 * audio is removed when the cache exceeds its capacity.
+		 */
+		class DecodedAudioCache
+		{
+
+		public:
+
+			/*! @brief The default maximum size of the cache, in bytes */
+			static const SInt64 DefaultCapacity = 4LL * 1024 * 1024 * 1024;
+
+			/*! @brief The default minimum ratio of decoding time to audio duration for audio to be cached */
+			static constexpr double DefaultMinimumDecodingCost = 0.02;
+
+			/*! @brief Statistics on the cache's use */
+			struct Statistics {
+				uint64_t mHitCount;			/*!< The number of decoders reading cached audio */
+				uint64_t mMissCount;		/*!< The number of decoders for files not in the cache */
+				uint64_t mStoreCount;		/*!< The number of files whose audio was added to the cache */
+			};
+
+
+			// ========================================
+			/*! @name Configuration */
+			//@{
+
+			/*! @brief Query whether the cache is used by \c Decoder::CreateForURL() */
+			static bool IsEnabled();
+
+			/*! @brief Set whether the cache is used by \c Decoder::CreateForURL() */
+			static void SetEnabled(bool enabled);
+
+			/*!
+			 * @brief Set the directory holding the cache
+			 * @note The directory is created if necessary.  The default is a directory in the user's cache directory.
+			 * @param url The directory, or \c nullptr for the default
+			 */
+			static void SetDirectory(CFURLRef url);
+
+			/*! @brief Get the maximum size of the cache, in bytes */
+			static SInt64 GetCapacity();
+
+			/*! @brief Set the maximum size of the cache, in bytes */
+			static void SetCapacity(SInt64 capacity);
+
+			/*! @brief Get the minimum ratio of decoding time to audio duration for audio to be cached */
+			static double GetMinimumDecodingCost();
+
+			/*!
+			 * @brief Set the minimum ratio of decoding time to audio duration for audio to be cached
+			 * @param cost The ratio, or \c 0 to cache all audio decoded from start to end
+			 */
+			static void SetMinimumDecodingCost(double cost);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Cache management */
+			//@{
+
+			/*! @brief Get statistics on the cache's use */
+			static Statistics GetStatistics();
+
+			/*! @brief Remove all audio from the cache */
+			static void Purge();
+
+			//@}
+
+
+			// ========================================
+			/*! @name Decoder creation */
+			//@{
+
+			/*!
+			 * @brief Create a \c Decoder reading the cached audio for a file
+			 * @note This is called by \c Decoder::CreateForURL() when the cache is enabled
+			 * @param url The file URL
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Decoder, or \c nullptr if the file's audio isn't cached
+			 */
+			static Decoder::unique_ptr CreateForURL(CFURLRef url, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Wrap a decoder so its audio is added to the cache when read from start to end
+			 * @note This is called by \c Decoder::CreateForURL() when the cache is enabled
+			 * @param decoder The decoder, which may be open
+			 * @return The wrapped decoder, or \c decoder if its audio can't be cached
+			 */
+			static Decoder::unique_ptr CreateCachingDecoder(Decoder::unique_ptr decoder);
+
+			//@}
+
+		private:
+
+			DecodedAudioCache() = delete;
+		};
+
+	}
+}
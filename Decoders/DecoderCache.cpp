@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include "DecoderCache.h"
+#include "CFWrapper.h"
+#include "Logger.h"
+
+#pragma mark Creation
+
+SFB::Audio::DecoderCache::DecoderCache(size_t maximumDecodersPerSubclass)
+	: mMaximumDecodersPerSubclass(maximumDecodersPerSubclass)
+{}
+
+#pragma mark Decoder creation
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::DecoderCache::CreateForURL(CFURLRef url, CFErrorRef *error)
+{
+	return CreateForInputSource(InputSource::CreateForURL(url, 0, error), error);
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::DecoderCache::CreateForInputSource(InputSource::unique_ptr inputSource, CFErrorRef *error)
+{
+	if(!inputSource)
+		return nullptr;
+
+	CFURLRef inputURL = inputSource->GetURL();
+	SFB::CFString pathExtension(inputURL ? CFURLCopyPathExtension(inputURL) : nullptr);
+
+	// Try cached decoders in the same order the factory methods try subclasses
+	if(pathExtension) {
+		for(auto subclassInfo : Decoder::sRegisteredSubclasses) {
+			if(!subclassInfo.mHandlesFilesWithExtension(pathExtension))
+				continue;
+
+			Decoder::unique_ptr decoder;
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				auto iter = mDecoders.find(std::type_index(*subclassInfo.mTypeInfo));
+				if(iter == mDecoders.end() || iter->second.empty())
+					continue;
+
+				decoder = std::move(iter->second.back());
+				iter->second.pop_back();
+			}
+
+			if(decoder->Reset(std::move(inputSource)))
+				return decoder;
+
+			// Take back the input source for reuse if opening fails
+			LOGGER_INFO("org.sbooth.AudioEngine.DecoderCache", "Unable to reset cached decoder");
+			inputSource = std::move(decoder->mInputSource);
+			if(!inputSource)
+				return nullptr;
+		}
+	}
+
+	auto decoder = Decoder::CreateForInputSource(std::move(inputSource), error);
+	if(decoder && !decoder->IsOpen() && !decoder->Open(error))
+		return nullptr;
+
+	return decoder;
+}
+
+#pragma mark Cache management
+
+void SFB::Audio::DecoderCache::Recycle(Decoder::unique_ptr decoder)
+{
+	if(!decoder || !decoder->SupportsReset())
+		return;
+
+	if(decoder->IsOpen() && !decoder->Close())
+		return;
+
+	// Release the resources associated with the previous stream
+	decoder->SetRepresentedObject(nullptr);
+	decoder->SetRepresentedObjectCleanupBlock(nullptr);
+	decoder->mInputSource.reset();
+
+	const Decoder& instance = *decoder;
+	std::type_index subclass(typeid(instance));
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	auto& decoders = mDecoders[subclass];
+	if(decoders.size() < mMaximumDecodersPerSubclass)
+		decoders.push_back(std::move(decoder));
+}
+
+size_t SFB::Audio::DecoderCache::GetCachedDecoderCount() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	size_t count = 0;
+	for(const auto& iter : mDecoders)
+		count += iter.second.size();
+	return count;
+}
+
+void SFB::Audio::DecoderCache::Purge()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mDecoders.clear();
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <typeindex>
+#include <vector>
+
+#include "AudioDecoder.h"
+
+/*! @file DecoderCache.h @brief A cache of reusable decoders */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A cache of closed decoders available for reuse
+		 *
+		 * Decoders returned to the cache with \c Recycle() are reset onto new input sources by \c CreateForURL()
+		 * and \c CreateForInputSource(), avoiding the allocation of new codec resources for each file.  This is
+		 * most beneficial for gapless album playback and batch processing of short files.
+		 *
+		 * Only decoders supporting \c Decoder::Reset() are cached; when no cached decoder is suitable
+		 * a new decoder is created using \c Decoder::CreateForInputSource().
+		 * @note Decoders returned by the cache are always open
+		 */
+		class DecoderCache
+		{
+
+		public:
+
+			/*! @brief A \c std::unique_ptr for \c DecoderCache objects */
+			using unique_ptr = std::unique_ptr<DecoderCache>;
+
+			/*!
+			 * @brief Create a new \c DecoderCache
+			 * @param maximumDecodersPerSubclass The maximum number of decoders of each \c Decoder subclass to retain
+			 */
+			explicit DecoderCache(size_t maximumDecodersPerSubclass = 1);
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			DecoderCache(const DecoderCache& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			DecoderCache& operator=(const DecoderCache& rhs) = delete;
+
+			/*! @endcond */
+
+			// ========================================
+			/*! @name Decoder creation */
+			//@{
+
+			/*!
+			 * @brief Create an open \c Decoder for the specified URL, reusing a cached decoder if possible
+			 * @param url The URL
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Decoder object, or \c nullptr on failure
+			 */
+			Decoder::unique_ptr CreateForURL(CFURLRef url, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create an open \c Decoder for the specified \c InputSource, reusing a cached decoder if possible
+			 * @param inputSource The input source
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Decoder object, or \c nullptr on failure
+			 */
+			Decoder::unique_ptr CreateForInputSource(InputSource::unique_ptr inputSource, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Cache management */
+			//@{
+
+			/*!
+			 * @brief Return a decoder to the cache
+			 * @note The decoder is closed and its input source released.  Decoders not supporting reset are destroyed.
+			 * @param decoder The decoder
+			 */
+			void Recycle(Decoder::unique_ptr decoder);
+
+			/*! @brief Get the number of decoders in the cache */
+			size_t GetCachedDecoderCount() const;
+
+			/*! @brief Destroy all cached decoders */
+			void Purge();
+
+			//@}
+
+		private:
+
+			// Cached decoders keyed by subclass
+			std::map<std::type_index, std::vector<Decoder::unique_ptr>>	mDecoders;
+			mutable std::mutex											mMutex;
+			size_t														mMaximumDecodersPerSubclass;
+		};
+
+	}
+}
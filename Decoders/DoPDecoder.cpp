@@ -9,22 +9,14 @@
 #include "DoPDecoder.h"
 #include "CFErrorUtilities.h"
 #include "Logger.h"
+#include "SampleKernels.h"
 
 #define DSD_FRAMES_PER_DOP_FRAME 16
 
 namespace {
-	// Bit reversal lookup table from http://graphics.stanford.edu/~seander/bithacks.html#BitReverseTable
-	static const uint8_t sBitReverseTable256 [256] =
-	{
-#   define R2(n)     n,     n + 2*64,     n + 1*64,     n + 3*64
-#   define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
-#   define R6(n) R4(n), R4(n + 2*4 ), R4(n + 1*4 ), R4(n + 3*4 )
-		R6(0), R6(2), R6(1), R6(3)
-	};
-
-	// Support DSD64, DSD128, and DSD256 (64x, 128x, and 256x the CD sample rate of 44.1 KHz)
-	// as well as the 48.0 KHz variants 6.144 MHz and 12.288 MHz
-	static const std::array<Float64, 5> sSupportedSampleRates = { {2822400, 5644800, 11289600, 6144000, 12288000} };
+	// Support DSD64, DSD128, DSD256, and DSD512 (64x, 128x, 256x, and 512x the CD sample rate of 44.1 KHz)
+	// as well as the 48.0 KHz variants 3.072 MHz, 6.144 MHz, 12.288 MHz, and 24.576 MHz
+	static const std::array<Float64, 8> sSupportedSampleRates = { {2822400, 5644800, 11289600, 22579200, 3072000, 6144000, 12288000, 24576000} };
 }
 
 #pragma mark Factory Methods
@@ -91,15 +83,6 @@ bool SFB::Audio::DoPDecoder::_Open(CFErrorRef *error)
 		return false;
 	}
 
-	if(!mBufferList.Allocate(decoderFormat, 4096)) {
-		LOGGER_CRIT("org.sbooth.AudioEngine.Decoder.DoP", "Unable to allocate memory")
-
-		if(error)
-			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
-
-		return false;
-	}
-
 	// Generate non-interleaved 24-bit big endian output
 	mFormat.mFormatID			= kAudioFormatDoP;
 	mFormat.mFormatFlags		= kAudioFormatFlagIsBigEndian | kAudioFormatFlagIsPacked | kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsNonInterleaved;
@@ -121,12 +104,7 @@ bool SFB::Audio::DoPDecoder::_Open(CFErrorRef *error)
 
 bool SFB::Audio::DoPDecoder::_Close(CFErrorRef *error)
 {
-	if(!mDecoder->Close(error))
-		return false;
-
-	mBufferList.Deallocate();
-
-	return true;
+	return mDecoder->Close(error);
 }
 
 SFB::CFString SFB::Audio::DoPDecoder::_GetSourceFormatDescription() const
@@ -144,47 +122,49 @@ UInt32 SFB::Audio::DoPDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 fr
 		return 0;
 	}
 
-	UInt32 framesRead = 0;
+	// Allocate an alias to the buffer list, which will point to the DSD read position in the output buffer
+	AudioBufferList *bufferListAlias = (AudioBufferList *)alloca(offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * bufferList->mNumberBuffers));
+
+	if(nullptr == bufferListAlias) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.DOP", "Unable to allocate memory");
+		return 0;
+	}
+
+	bufferListAlias->mNumberBuffers = bufferList->mNumberBuffers;
 
 	// Reset output buffer data size
 	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
 		bufferList->mBuffers[i].mDataByteSize = 0;
 
+	UInt32 framesRead = 0;
+
 	for(;;) {
-		// Grab the DSD audio
+		// The DSD audio is read directly into the end of the unused portion of the output buffer
+		// and expanded in place, so no intermediate buffer is needed
+		// NB: Currently DSDIFFDecoder and DSFDecoder only produce non-interleaved output
 		UInt32 framesRemaining = frameCount - framesRead;
-		UInt32 dsdFramesRemaining = DSD_FRAMES_PER_DOP_FRAME * framesRemaining;
-		UInt32 dsdFramesDecoded = mDecoder->ReadAudio(mBufferList, std::min(mBufferList.GetCapacityFrames(), dsdFramesRemaining));
+		UInt32 dsdOffset = mFormat.FrameCountToByteCount(framesRemaining) - (2 * framesRemaining);
+
+		for(UInt32 i = 0; i < bufferListAlias->mNumberBuffers; ++i) {
+			bufferListAlias->mBuffers[i].mData				= (uint8_t *)bufferList->mBuffers[i].mData + bufferList->mBuffers[i].mDataByteSize + dsdOffset;
+			bufferListAlias->mBuffers[i].mDataByteSize		= 2 * framesRemaining;
+			bufferListAlias->mBuffers[i].mNumberChannels	= bufferList->mBuffers[i].mNumberChannels;
+		}
+
+		// Grab the DSD audio
+		UInt32 dsdFramesDecoded = mDecoder->ReadAudio(bufferListAlias, DSD_FRAMES_PER_DOP_FRAME * framesRemaining);
 		if(0 == dsdFramesDecoded)
 			break;
 
 		UInt32 framesDecoded = dsdFramesDecoded / DSD_FRAMES_PER_DOP_FRAME;
 
 		// Convert to DoP
-		// NB: Currently DSDIFFDecoder and DSFDecoder only produce non-interleaved output
-		for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i) {
-			const unsigned char *src = (const unsigned char *)mBufferList->mBuffers[i].mData;
-			unsigned char *dst = (unsigned char *)bufferList->mBuffers[i].mData + bufferList->mBuffers[i].mDataByteSize;
-
-			for(UInt32 j = 0; j < framesDecoded; ++j) {
-				// Insert the DSD marker
-				*dst++ = mMarker;
-
-				// Copy the DSD bits
-				if(mReverseBits) {
-					*dst++ = sBitReverseTable256[*src++];
-					*dst++ = sBitReverseTable256[*src++];
-				}
-				else {
-					*dst++ = *src++;
-					*dst++ = *src++;
-				}
-
-				mMarker = (uint8_t)0x05 == mMarker ? (uint8_t)0xfa : (uint8_t)0x05;
-			}
-
+		uint8_t marker = mMarker;
+		for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+			marker = SampleKernels::Get().PackDoP((uint8_t *)bufferList->mBuffers[i].mData + bufferList->mBuffers[i].mDataByteSize, dsdOffset, framesDecoded, mMarker, mReverseBits);
 			bufferList->mBuffers[i].mDataByteSize += mFormat.FrameCountToByteCount(framesDecoded);
 		}
+		mMarker = marker;
 
 		framesRead += framesDecoded;
 
@@ -211,8 +191,10 @@ SInt64 SFB::Audio::DoPDecoder::_SeekToFrame(SInt64 frame)
 	if(-1 == mDecoder->SeekToFrame(DSD_FRAMES_PER_DOP_FRAME * frame))
 		return -1;
 
-	for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i)
-		mBufferList->mBuffers[i].mDataByteSize = 0;
-
 	return _GetCurrentFrame();
 }
+
+SFB::Audio::Decoder::SeekCost SFB::Audio::DoPDecoder::_GetSeekCost(SInt64 frame) const
+{
+	return mDecoder->GetSeekCost(DSD_FRAMES_PER_DOP_FRAME * frame);
+}
@@ -6,7 +6,6 @@
 #pragma once
 
 #include "AudioDecoder.h"
-#include "AudioBufferList.h"
 
 /*! @file DoPDecoder.h @brief Support for DoP decoding */
 
@@ -102,11 +101,11 @@ namespace SFB {
 			// Seeking support
 			inline virtual bool _SupportsSeeking() const			{ return mDecoder->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
+			virtual SeekCost _GetSeekCost(SInt64 frame) const;
 
 
 			// Data members
 			Decoder::unique_ptr		mDecoder;
-			BufferList				mBufferList;
 			uint8_t					mMarker;
 			bool					mReverseBits;
 		};
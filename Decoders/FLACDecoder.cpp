@@ -3,6 +3,8 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <cstring>
+
 #include <AudioToolbox/AudioFormat.h>
 
 #include <FLAC/metadata.h>
@@ -11,6 +13,7 @@
 #include "CFWrapper.h"
 #include "CFErrorUtilities.h"
 #include "Logger.h"
+#include "SampleKernels.h"
 
 namespace {
 
@@ -155,6 +158,27 @@ bool SFB::Audio::FLACDecoder::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::FLACDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	// Native FLAC
+	if(4 <= length && 0 == memcmp(bytes, "fLaC", 4))
+		return true;
+
+	// Ogg FLAC, identified by the first packet following the page header and segment table
+	if(27 <= length && 0 == memcmp(bytes, "OggS", 4)) {
+		size_t packetOffset = 27 + bytes[26];
+		if(packetOffset + 5 <= length && 0 == memcmp(bytes + packetOffset, "\x7f" "FLAC", 5))
+			return true;
+	}
+
+	return false;
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::FLACDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new FLACDecoder(std::move(inputSource)));
@@ -163,7 +187,7 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::FLACDecoder::CreateDecoder(InputSour
 #pragma mark Creation and Destruction
 
 SFB::Audio::FLACDecoder::FLACDecoder(InputSource::unique_ptr inputSource)
-	: Decoder(std::move(inputSource)), mFLAC(nullptr, nullptr), mCurrentFrame(0)
+	: Decoder(std::move(inputSource)), mFLAC(nullptr, nullptr), mCurrentFrame(0), mDirectBufferList(nullptr), mDirectFrameOffset(0), mDirectFrameCapacity(0), mDirectFramesWritten(0), mVerifying(false), mStreamFinished(false), mIntegrityStatus(IntegrityStatus::Unverified)
 {
 	memset(&mStreamInfo, 0, sizeof(mStreamInfo));
 }
@@ -176,15 +200,20 @@ bool SFB::Audio::FLACDecoder::_Open(CFErrorRef *error)
 	if(!extension)
 		return false;
 
-	// Create FLAC decoder
-	mFLAC = unique_FLAC_ptr(FLAC__stream_decoder_new(), [](FLAC__StreamDecoder *decoder){
-		if(decoder) {
-			if(!FLAC__stream_decoder_finish(decoder))
-				LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.FLAC", "FLAC__stream_decoder_finish failed: " << FLAC__stream_decoder_get_resolved_state_string(decoder));
+	// Create FLAC decoder, reusing the decoder from a previous stream if possible
+	if(mFLAC) {
+		if(FLAC__STREAM_DECODER_UNINITIALIZED != FLAC__stream_decoder_get_state(mFLAC.get()))
+			FLAC__stream_decoder_finish(mFLAC.get());
+	}
+	else
+		mFLAC = unique_FLAC_ptr(FLAC__stream_decoder_new(), [](FLAC__StreamDecoder *decoder){
+			if(decoder) {
+				if(!FLAC__stream_decoder_finish(decoder))
+					LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.FLAC", "FLAC__stream_decoder_finish failed: " << FLAC__stream_decoder_get_resolved_state_string(decoder));
 
-			FLAC__stream_decoder_delete(decoder);
-		}
-	});
+				FLAC__stream_decoder_delete(decoder);
+			}
+		});
 
 	if(!mFLAC) {
 		if(error)
@@ -192,6 +221,14 @@ bool SFB::Audio::FLACDecoder::_Open(CFErrorRef *error)
 		return false;
 	}
 
+	mCurrentFrame = 0;
+
+	// MD5 checking must be enabled before the decoder is initialized
+	mVerifying = IsIntegrityVerificationEnabled();
+	mStreamFinished = false;
+	mIntegrityStatus = IntegrityStatus::Unverified;
+	FLAC__stream_decoder_set_md5_checking(mFLAC.get(), mVerifying);
+
 	// Initialize decoder
 	FLAC__StreamDecoderInitStatus status = FLAC__STREAM_DECODER_INIT_STATUS_ERROR_OPENING_FILE;
 
@@ -293,6 +330,15 @@ bool SFB::Audio::FLACDecoder::_Open(CFErrorRef *error)
 		}
 	}
 
+	// Samples of up to 24 bits are exactly representable as floats, so when float is preferred
+	// they are converted as they are decoded instead of by an AudioConverter
+	if(PrefersCanonicalFloat() && 24 >= mStreamInfo.bits_per_sample) {
+		mFormat.mFormatFlags		= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+		mFormat.mBitsPerChannel		= 8 * sizeof(float);
+		mFormat.mBytesPerPacket		= sizeof(float);
+		mFormat.mBytesPerFrame		= sizeof(float);
+	}
+
 	// Set up the source format
 	mSourceFormat.mFormatID				= 'FLAC';
 
@@ -331,7 +377,10 @@ bool SFB::Audio::FLACDecoder::_Open(CFErrorRef *error)
 
 bool SFB::Audio::FLACDecoder::_Close(CFErrorRef */*error*/)
 {
-	mFLAC.reset();
+	// Finish but retain the FLAC decoder so it may be reused by Reset()
+	if(!FLAC__stream_decoder_finish(mFLAC.get()))
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.FLAC", "FLAC__stream_decoder_finish failed: " << FLAC__stream_decoder_get_resolved_state_string(mFLAC.get()));
+
 	mBufferList.Deallocate();
 	memset(&mStreamInfo, 0, sizeof(mStreamInfo));
 
@@ -387,13 +436,30 @@ UInt32 SFB::Audio::FLACDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 f
 			break;
 
 		// EOS?
-		if(FLAC__STREAM_DECODER_END_OF_STREAM == FLAC__stream_decoder_get_state(mFLAC.get()))
+		if(CheckEndOfStream())
 			break;
 
-		// Grab the next frame
+		// Grab the next frame, decoding directly into bufferList if there is room
+		mDirectBufferList = bufferList;
+		mDirectFrameOffset = framesRead;
+		mDirectFrameCapacity = frameCount - framesRead;
+		mDirectFramesWritten = 0;
+
 		FLAC__bool result = FLAC__stream_decoder_process_single(mFLAC.get());
 		if(!result)
 			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.FLAC", "FLAC__stream_decoder_process_single failed: " << FLAC__stream_decoder_get_resolved_state_string(mFLAC.get()));
+
+		mDirectBufferList = nullptr;
+
+		if(mDirectFramesWritten) {
+			for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+				bufferList->mBuffers[i].mDataByteSize += mDirectFramesWritten * mFormat.mBytesPerFrame;
+
+			framesRead += mDirectFramesWritten;
+
+			if(framesRead == frameCount)
+				break;
+		}
 	}
 
 	mCurrentFrame += framesRead;
@@ -403,6 +469,12 @@ UInt32 SFB::Audio::FLACDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 f
 
 SInt64 SFB::Audio::FLACDecoder::_SeekToFrame(SInt64 frame)
 {
+	// libFLAC stops checking the signature once the stream is seeked
+	mVerifying = false;
+
+	if(mStreamFinished)
+		return -1;
+
 	FLAC__bool result = FLAC__stream_decoder_seek_absolute(mFLAC.get(), (FLAC__uint64)frame);
 
 	// Attempt to re-sync the stream if necessary
@@ -418,6 +490,76 @@ SInt64 SFB::Audio::FLACDecoder::_SeekToFrame(SInt64 frame)
 	return (result ? frame : -1);
 }
 
+const AudioBufferList * SFB::Audio::FLACDecoder::_PeekAudio(UInt32& frameCount)
+{
+	// Decode the next frame into mBufferList once the previous one is consumed
+	while(0 == mBufferList->mBuffers[0].mDataByteSize && !CheckEndOfStream()) {
+		if(!FLAC__stream_decoder_process_single(mFLAC.get())) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.FLAC", "FLAC__stream_decoder_process_single failed: " << FLAC__stream_decoder_get_resolved_state_string(mFLAC.get()));
+			break;
+		}
+	}
+
+	frameCount = (UInt32)(mBufferList->mBuffers[0].mDataByteSize / mFormat.mBytesPerFrame);
+	return mBufferList;
+}
+
+void SFB::Audio::FLACDecoder::_ConsumeAudio(UInt32 frameCount)
+{
+	UInt32 framesInBuffer = (UInt32)(mBufferList->mBuffers[0].mDataByteSize / mFormat.mBytesPerFrame);
+	if(frameCount > framesInBuffer) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.FLAC", "_ConsumeAudio() called with more frames than were lent");
+		frameCount = framesInBuffer;
+	}
+
+	for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i) {
+		// Move remaining data in buffer to beginning
+		if(frameCount != framesInBuffer) {
+			unsigned char *buffer = (unsigned char *)mBufferList->mBuffers[i].mData;
+			memmove(buffer, buffer + (frameCount * mFormat.mBytesPerFrame), (framesInBuffer - frameCount) * mFormat.mBytesPerFrame);
+		}
+
+		mBufferList->mBuffers[i].mDataByteSize -= (UInt32)(frameCount * mFormat.mBytesPerFrame);
+	}
+
+	mCurrentFrame += frameCount;
+}
+
+bool SFB::Audio::FLACDecoder::_SupportsIntegrityVerification() const
+{
+	// A signature of all zeroes means none was computed when encoding
+	for(auto byte : mStreamInfo.md5sum) {
+		if(0 != byte)
+			return true;
+	}
+
+	return false;
+}
+
+bool SFB::Audio::FLACDecoder::CheckEndOfStream()
+{
+	if(mStreamFinished)
+		return true;
+
+	if(FLAC__STREAM_DECODER_END_OF_STREAM != FLAC__stream_decoder_get_state(mFLAC.get()))
+		return false;
+
+	// libFLAC reports a signature mismatch only when the decoder is finished, after which no audio may be read or seeked
+	if(mVerifying && _SupportsIntegrityVerification()) {
+		mVerifying = false;
+		mStreamFinished = true;
+
+		if(FLAC__stream_decoder_finish(mFLAC.get()))
+			mIntegrityStatus = IntegrityStatus::Verified;
+		else {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.FLAC", "MD5 signature mismatch for " << mInputSource->GetURL());
+			mIntegrityStatus = IntegrityStatus::Failed;
+		}
+	}
+
+	return true;
+}
+
 #pragma mark Callbacks
 
 FLAC__StreamDecoderWriteStatus SFB::Audio::FLACDecoder::Write(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[])
@@ -431,81 +573,40 @@ FLAC__StreamDecoderWriteStatus SFB::Audio::FLACDecoder::Write(const FLAC__Stream
 		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
 
 	// FLAC hands us 32-bit signed ints with the samples low-aligned; shift them to high alignment
-	UInt32 shift = (kAudioFormatFlagIsPacked & mFormat.mFormatFlags) ? 0 : (8 * mFormat.mBytesPerFrame) - mFormat.mBitsPerChannel;
+	bool isFloat = kAudioFormatFlagIsFloat & mFormat.mFormatFlags;
+	UInt32 shift = (isFloat || (kAudioFormatFlagIsPacked & mFormat.mFormatFlags)) ? 0 : (8 * mFormat.mBytesPerFrame) - mFormat.mBitsPerChannel;
+	float scale = 1.f / (1u << (mStreamInfo.bits_per_sample - 1));
+
+	// Decode directly into the caller's buffer if the frame fits, avoiding a copy
+	AudioBufferList *bufferList = mBufferList;
+	UInt32 frameOffset = 0;
+	if(mDirectBufferList && frame->header.blocksize <= mDirectFrameCapacity) {
+		bufferList = mDirectBufferList;
+		frameOffset = mDirectFrameOffset;
+		mDirectFramesWritten = frame->header.blocksize;
+	}
 
 	// Convert to native endian samples, high-aligned if necessary
+	const auto& kernels = SampleKernels::Get();
+	auto pack = kernels.PackInt32;
 	switch(mFormat.mBytesPerFrame) {
-		case 1:
-		{
-			for(unsigned channel = 0; channel < frame->header.channels; ++channel) {
-				char *pullBuffer = (char *)mBufferList->mBuffers[channel].mData;
-
-				for(unsigned sample = 0; sample < frame->header.blocksize; ++sample)
-					*pullBuffer++ = (char)(buffer[channel][sample] << shift);
-
-				mBufferList->mBuffers[channel].mNumberChannels		= 1;
-				mBufferList->mBuffers[channel].mDataByteSize		= frame->header.blocksize * sizeof(char);
-			}
-
-			break;
-		}
-
-		case 2:
-		{
-			for(unsigned channel = 0; channel < frame->header.channels; ++channel) {
-				short *pullBuffer = (short *)mBufferList->mBuffers[channel].mData;
-
-				for(unsigned sample = 0; sample < frame->header.blocksize; ++sample)
-					*pullBuffer++ = (short)(buffer[channel][sample] << shift);
-
-				mBufferList->mBuffers[channel].mNumberChannels		= 1;
-				mBufferList->mBuffers[channel].mDataByteSize		= frame->header.blocksize * sizeof(short);
-			}
-
-			break;
-		}
-
-		case 3:
-		{
-			for(unsigned channel = 0; channel < frame->header.channels; ++channel) {
-				unsigned char *pullBuffer = (unsigned char *)mBufferList->mBuffers[channel].mData;
-
-				FLAC__int32 value;
-				for(unsigned sample = 0; sample < frame->header.blocksize; ++sample) {
-					value = buffer[channel][sample] << shift;
-#if __BIG_ENDIAN__
-					*pullBuffer++ = (unsigned char)((value >> 16) & 0xff);
-					*pullBuffer++ = (unsigned char)((value >> 8) & 0xff);
-					*pullBuffer++ = (unsigned char)(value & 0xff);
-#elif __LITTLE_ENDIAN__
-					*pullBuffer++ = (unsigned char)(value & 0xff);
-					*pullBuffer++ = (unsigned char)((value >> 8) & 0xff);
-					*pullBuffer++ = (unsigned char)((value >> 16) & 0xff);
-#else
-#  error Unknown OS byte order
-#endif
-				}
-
-				mBufferList->mBuffers[channel].mNumberChannels		= 1;
-				mBufferList->mBuffers[channel].mDataByteSize		= frame->header.blocksize * 3 * sizeof(unsigned char);
-			}
-
-			break;
-		}
+		case 1:		pack = kernels.PackInt8;		break;
+		case 2:		pack = kernels.PackInt16;		break;
+		case 3:		pack = kernels.PackInt24;		break;
+	}
 
-		case 4:
-		{
-			for(unsigned channel = 0; channel < frame->header.channels; ++channel) {
-				int *pullBuffer = (int *)mBufferList->mBuffers[channel].mData;
+	for(unsigned channel = 0; channel < frame->header.channels; ++channel) {
+		unsigned char *pullBuffer = (unsigned char *)bufferList->mBuffers[channel].mData + (frameOffset * mFormat.mBytesPerFrame);
 
-				for(unsigned sample = 0; sample < frame->header.blocksize; ++sample)
-					*pullBuffer++ = (int)(buffer[channel][sample] << shift);
+		if(isFloat)
+			kernels.ConvertInt32ToFloat(buffer[channel], 1, (float *)pullBuffer, 1, frame->header.blocksize, scale);
+		else
+			pack(buffer[channel], 1, pullBuffer, frame->header.blocksize, shift);
 
-				mBufferList->mBuffers[channel].mNumberChannels		= 1;
-				mBufferList->mBuffers[channel].mDataByteSize		= frame->header.blocksize * sizeof(int);
-			}
-
-			break;
+		// The caller's buffer sizes are updated in _ReadAudio()
+		if(bufferList == mBufferList) {
+			mBufferList->mBuffers[channel].mNumberChannels		= 1;
+			mBufferList->mBuffers[channel].mDataByteSize		= frame->header.blocksize * mFormat.mBytesPerFrame;
 		}
 	}
 
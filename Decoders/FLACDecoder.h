@@ -28,6 +28,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
@@ -54,6 +55,21 @@ namespace SFB {
 			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
 
+			// Reset support
+			inline virtual bool _SupportsReset() const				{ return true; }
+
+			// Decoded FLAC frames are lent from mBufferList
+			inline virtual bool _SupportsBorrowedAudio() const		{ return true; }
+			virtual const AudioBufferList * _PeekAudio(UInt32& frameCount);
+			virtual void _ConsumeAudio(UInt32 frameCount);
+
+			// The MD5 signature in STREAMINFO is verified by libFLAC
+			virtual bool _SupportsIntegrityVerification() const;
+			inline virtual IntegrityStatus _GetIntegrityStatus() const		{ return mIntegrityStatus; }
+
+			// Query whether all audio has been decoded, verifying the signature if requested
+			bool CheckEndOfStream();
+
 			using unique_FLAC_ptr = std::unique_ptr<FLAC__StreamDecoder, void(*)(FLAC__StreamDecoder *)>;
 
 			// Data members
@@ -64,6 +80,17 @@ namespace SFB {
 			// For converting push to pull
 			BufferList							mBufferList;
 
+			// When set, a frame that fits is decoded directly into this buffer instead of mBufferList
+			AudioBufferList						*mDirectBufferList;
+			UInt32								mDirectFrameOffset;
+			UInt32								mDirectFrameCapacity;
+			UInt32								mDirectFramesWritten;
+
+			// Integrity verification
+			bool								mVerifying;				// Whether libFLAC is checking the signature
+			bool								mStreamFinished;		// Whether the decoder was finished to obtain the result
+			IntegrityStatus						mIntegrityStatus;
+
 		public:
 
 			// Callbacks- for internal use only
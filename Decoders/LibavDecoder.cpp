@@ -3,6 +3,12 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+
+#include <dispatch/dispatch.h>
+
 #include "LibavDecoder.h"
 #include "AudioBufferList.h"
 #include "AudioChannelLayout.h"
@@ -20,9 +26,14 @@ extern "C" {
 
 namespace {
 
-#define BUF_SIZE 4096
+#define DEFAULT_IO_BUFFER_SIZE 32768
 #define ERRBUF_SIZE 512
 
+// The maximum number of packets demuxed ahead of the decoder
+#define READ_AHEAD_PACKETS 64
+
+	std::atomic<size_t> sIOBufferSize(DEFAULT_IO_BUFFER_SIZE);
+
 	void RegisterLibavDecoder() __attribute__ ((constructor));
 	void RegisterLibavDecoder()
 	{
@@ -31,12 +42,15 @@ namespace {
 
 	#pragma mark Initialization
 
-	void SetupLibav() __attribute__ ((constructor));
+	// Libav is initialized the first time its formats are needed instead of at launch
 	void SetupLibav()
 	{
-		// Register codecs and disable logging
-		av_register_all();
-		av_log_set_level(AV_LOG_QUIET);
+		static dispatch_once_t onceToken;
+		dispatch_once(&onceToken, ^{
+			// Register codecs and disable logging
+			av_register_all();
+			av_log_set_level(AV_LOG_QUIET);
+		});
 	}
 
 	#pragma mark Callbacks
@@ -87,6 +101,8 @@ namespace {
 
 CFArrayRef SFB::Audio::LibavDecoder::CreateSupportedFileExtensions()
 {
+	SetupLibav();
+
 	CFMutableArrayRef supportedExtensions = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
 
 	// Loop through each input format
@@ -107,6 +123,8 @@ CFArrayRef SFB::Audio::LibavDecoder::CreateSupportedFileExtensions()
 
 CFArrayRef SFB::Audio::LibavDecoder::CreateSupportedMIMETypes()
 {
+	SetupLibav();
+
 	CFMutableArrayRef supportedMIMETypes = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
 
 	// Loop through each input format
@@ -184,17 +202,41 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::LibavDecoder::CreateDecoder(InputSou
 	return unique_ptr(new LibavDecoder(std::move(inputSource)));
 }
 
+size_t SFB::Audio::LibavDecoder::GetIOBufferSize()
+{
+	return sIOBufferSize;
+}
+
+void SFB::Audio::LibavDecoder::SetIOBufferSize(size_t bufferSize)
+{
+	if(0 == bufferSize || INT_MAX < bufferSize) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.AudioDecoder.Libav", "SetIOBufferSize() called with invalid parameters");
+		return;
+	}
+
+	sIOBufferSize = bufferSize;
+}
+
 #pragma mark Creation and Destruction
 
 SFB::Audio::LibavDecoder::LibavDecoder(InputSource::unique_ptr inputSource)
-	: Decoder(std::move(inputSource)), mStreamIndex(-1), mCurrentFrame(0)
-{}
+	: Decoder(std::move(inputSource)), mStreamIndex(-1), mCurrentFrame(0), mReadAheadResult(0), mStopReadAhead(false)
+{
+	SetupLibav();
+}
+
+SFB::Audio::LibavDecoder::~LibavDecoder()
+{
+	if(IsOpen())
+		Close();
+}
 
 #pragma mark Functionality
 
 bool SFB::Audio::LibavDecoder::_Open(CFErrorRef *error)
 {
-	auto ioContext = unique_AVIOContext_ptr(avio_alloc_context((unsigned char *)av_malloc(BUF_SIZE), BUF_SIZE, 0, this, my_read_packet, nullptr, my_seek),
+	int ioBufferSize = (int)sIOBufferSize;
+	auto ioContext = unique_AVIOContext_ptr(avio_alloc_context((unsigned char *)av_malloc((size_t)ioBufferSize), ioBufferSize, 0, this, my_read_packet, nullptr, my_seek),
 											[](AVIOContext *context) { av_free(context); });
 
 	auto formatContext = unique_AVFormatContext_ptr(avformat_alloc_context(),
@@ -242,8 +284,7 @@ bool SFB::Audio::LibavDecoder::_Open(CFErrorRef *error)
     }
 
 	// Use the best audio stream present in the file
-	AVCodec *decoder = nullptr;
-	result = av_find_best_stream(formatContext.get(), AVMEDIA_TYPE_AUDIO, -1, -1, &decoder, 0);
+	result = av_find_best_stream(formatContext.get(), AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
 	if(0 > result) {
 		char errbuf [ERRBUF_SIZE];
 		if(0 == av_strerror(result, errbuf, ERRBUF_SIZE)) {
@@ -263,7 +304,272 @@ bool SFB::Audio::LibavDecoder::_Open(CFErrorRef *error)
 		return false;
 	}
 
-	mStreamIndex = result;
+	// Note the audio streams available for selection
+	mAudioStreams.clear();
+	for(unsigned int i = 0; i < formatContext->nb_streams; ++i) {
+		if(AVMEDIA_TYPE_AUDIO == formatContext->streams[i]->codecpar->codec_type)
+			mAudioStreams.push_back((int)i);
+	}
+
+	mIOContext = std::move(ioContext);
+	mFormatContext = std::move(formatContext);
+
+	if(!OpenStream(result, error)) {
+		mFormatContext.reset();
+		mIOContext.reset();
+		return false;
+	}
+
+	mFrame = unique_AVFrame_ptr(av_frame_alloc(),
+								[](AVFrame *f) { av_frame_free(&f); });
+
+	StartReadAhead();
+
+	return true;
+}
+
+bool SFB::Audio::LibavDecoder::_Close(CFErrorRef */*error*/)
+{
+	StopReadAhead();
+	FreePackets();
+
+	mStreamIndex = -1;
+	mAudioStreams.clear();
+
+	mFrame.reset();
+	mIOContext.reset();
+	mFormatContext.reset();
+
+	mBufferList.Deallocate();
+
+	return true;
+}
+
+SFB::CFString SFB::Audio::LibavDecoder::_GetSourceFormatDescription() const
+{
+	auto codecDescriptor = avcodec_descriptor_get(mFormatContext->streams[mStreamIndex]->codecpar->codec_id);
+
+	return CFString(nullptr,
+					CFSTR("%s, %u channels, %u Hz"),
+					codecDescriptor ? codecDescriptor->long_name : "",
+					mSourceFormat.mChannelsPerFrame,
+					(unsigned int)mSourceFormat.mSampleRate);
+}
+
+SInt64 SFB::Audio::LibavDecoder::_GetTotalFrames() const
+{
+	if(mFormatContext->streams[mStreamIndex]->nb_frames)
+		return mFormatContext->streams[mStreamIndex]->nb_frames;
+
+	return av_rescale(mFormatContext->streams[mStreamIndex]->duration, mFormatContext->streams[mStreamIndex]->time_base.num, mFormatContext->streams[mStreamIndex]->time_base.den) * (SInt64)mFormat.mSampleRate;
+}
+
+UInt32 SFB::Audio::LibavDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	UInt32 framesRead = 0;
+
+	// Reset output buffer data size
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+		bufferList->mBuffers[i].mDataByteSize = 0;
+
+	for(;;) {
+		UInt32 bytesRemaining	= (frameCount - framesRead) * mFormat.mBytesPerFrame;
+		UInt32 bytesToSkip		= bufferList->mBuffers[0].mDataByteSize;
+		UInt32 bytesInBuffer	= mBufferList->mBuffers[0].mDataByteSize;
+
+		UInt32 bytesToCopy		= std::min(bytesInBuffer, bytesRemaining);
+
+		// Copy data from the buffer to output
+		for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i) {
+			unsigned char *buffer = (unsigned char *)bufferList->mBuffers[i].mData;
+			memcpy(buffer + bytesToSkip, mBufferList->mBuffers[i].mData, bytesToCopy);
+			bufferList->mBuffers[i].mDataByteSize += bytesToCopy;
+
+			// Move remaining data in buffer to beginning
+			if(bytesToCopy != bytesInBuffer) {
+				buffer = (unsigned char *)mBufferList->mBuffers[i].mData;
+				memmove(buffer, buffer + bytesToCopy, (bytesInBuffer - bytesToCopy));
+			}
+
+			mBufferList->mBuffers[i].mDataByteSize -= bytesToCopy;
+		}
+
+		framesRead += (bytesToCopy / mFormat.mBytesPerFrame);
+
+		// All requested frames were read
+		if(framesRead == frameCount)
+			break;
+
+		// Take the next packet from the read-ahead queue
+		AVPacket *packet = DequeuePacket();
+		if(nullptr == packet) {
+			// EOF reached
+			if(AVERROR_EOF == mReadAheadResult) {
+				if(CODEC_CAP_DELAY & mCodecContext->codec->capabilities) {
+					// TODO: Flush buffer
+				}
+			}
+			else {
+				char errbuf [ERRBUF_SIZE];
+				if(0 == av_strerror(mReadAheadResult, errbuf, ERRBUF_SIZE)) {
+					LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "av_read_frame failed: " << errbuf);
+				}
+				else
+					LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "av_read_frame failed: " << mReadAheadResult);
+			}
+
+			break;
+		}
+
+		// Send the packet with the compressed data to the decoder
+		int result = avcodec_send_packet(mCodecContext.get(), packet);
+		RecyclePacket(packet);
+		if(0 != result) {
+			char errbuf [ERRBUF_SIZE];
+			if(0 == av_strerror(result, errbuf, ERRBUF_SIZE)) {
+				LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "avcodec_send_packet failed: " << errbuf);
+			}
+			else
+				LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "avcodec_send_packet failed: " << result);
+
+			break;
+		}
+
+		// Read the output frames
+		while(result >= 0) {
+			result = avcodec_receive_frame(mCodecContext.get(), mFrame.get());
+			if(AVERROR(EAGAIN) == result || AVERROR_EOF == result)
+				break;
+
+			// linesize may include padding so the byte count is calculated from the number of samples
+			UInt32 byteCount = (UInt32)mFrame->nb_samples * mFormat.mBytesPerFrame;
+
+			// Planar formats are not interleaved
+			if(av_sample_fmt_is_planar(mCodecContext->sample_fmt)) {
+				for(UInt32 bufferIndex = 0; bufferIndex < mBufferList->mNumberBuffers; ++bufferIndex) {
+					memcpy(mBufferList->mBuffers[bufferIndex].mData, mFrame->extended_data[bufferIndex], byteCount);
+					mBufferList->mBuffers[bufferIndex].mDataByteSize = byteCount;
+					mBufferList->mBuffers[bufferIndex].mNumberChannels = 1;
+				}
+			}
+			else {
+				memcpy(mBufferList->mBuffers[0].mData, mFrame->extended_data[0], byteCount);
+				mBufferList->mBuffers[0].mDataByteSize = byteCount;
+				mBufferList->mBuffers[0].mNumberChannels = mFormat.mChannelsPerFrame;
+			}
+
+		}
+	}
+
+	mCurrentFrame += framesRead;
+
+	return framesRead;
+}
+
+SInt64 SFB::Audio::LibavDecoder::_SeekToFrame(SInt64 frame)
+{
+	// The format context may only be used by one thread at a time
+	StopReadAhead();
+
+	int64_t timestamp = av_rescale(frame / (SInt64)mFormat.mSampleRate, mFormatContext->streams[mStreamIndex]->time_base.den, mFormatContext->streams[mStreamIndex]->time_base.num);
+	int result = av_seek_frame(mFormatContext.get(), mStreamIndex, timestamp, 0);
+	if(0 > result) {
+		char errbuf [ERRBUF_SIZE];
+		if(0 == av_strerror(result, errbuf, ERRBUF_SIZE)) {
+			LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "av_seek_frame failed: " << errbuf);
+		}
+		else
+			LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "av_seek_frame failed: " << result);
+
+		StartReadAhead();
+		return -1;
+	}
+
+	// Discard packets read before the seek
+	while(!mPacketQueue.empty()) {
+		RecyclePacket(mPacketQueue.front());
+		mPacketQueue.pop_front();
+	}
+
+	avcodec_flush_buffers(mCodecContext.get());
+
+	for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i)
+		mBufferList->mBuffers[i].mDataByteSize = 0;
+
+	StartReadAhead();
+
+	mCurrentFrame = frame;
+	return mCurrentFrame;
+}
+
+size_t SFB::Audio::LibavDecoder::_GetCurrentStream() const
+{
+	auto iter = std::find(mAudioStreams.begin(), mAudioStreams.end(), mStreamIndex);
+	return iter != mAudioStreams.end() ? (size_t)(iter - mAudioStreams.begin()) : 0;
+}
+
+bool SFB::Audio::LibavDecoder::_SelectStream(size_t stream, CFErrorRef *error)
+{
+	// The format context may only be used by one thread at a time
+	StopReadAhead();
+
+	int previousStreamIndex = mStreamIndex;
+	if(!OpenStream(mAudioStreams[stream], error)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "Unable to open stream " << stream);
+
+		// Continue decoding the previous stream
+		if(!OpenStream(previousStreamIndex, nullptr)) {
+			mStreamIndex = -1;
+			return false;
+		}
+
+		StartReadAhead();
+		return false;
+	}
+
+	// Decode the new stream from the beginning; the format context and its probed stream information are reused
+	int result = av_seek_frame(mFormatContext.get(), -1, 0, AVSEEK_FLAG_BACKWARD);
+	if(0 > result) {
+		char errbuf [ERRBUF_SIZE];
+		if(0 == av_strerror(result, errbuf, ERRBUF_SIZE)) {
+			LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "av_seek_frame failed: " << errbuf);
+		}
+		else
+			LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "av_seek_frame failed: " << result);
+	}
+
+	// Packets read before the switch belong to the previous stream
+	while(!mPacketQueue.empty()) {
+		RecyclePacket(mPacketQueue.front());
+		mPacketQueue.pop_front();
+	}
+
+	for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i)
+		mBufferList->mBuffers[i].mDataByteSize = 0;
+
+	mCurrentFrame = 0;
+
+	StartReadAhead();
+
+	return true;
+}
+
+bool SFB::Audio::LibavDecoder::OpenStream(int streamIndex, CFErrorRef *error)
+{
+	AVCodec *decoder = avcodec_find_decoder(mFormatContext->streams[streamIndex]->codecpar->codec_id);
+	if(!decoder) {
+		LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "avcodec_find_decoder failed");
+
+		if(nullptr != error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The format of the file “%@” was not recognized."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("File Format Not Recognized"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
+
+			*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::InputOutputError, description, mInputSource->GetURL(), failureReason, recoverySuggestion);
+		}
+
+		return false;
+	}
 
 	auto codecContext = unique_AVCodecContext_ptr(avcodec_alloc_context3(decoder),
 												  [](AVCodecContext *context) { avcodec_free_context(&context); });
@@ -281,7 +587,11 @@ bool SFB::Audio::LibavDecoder::_Open(CFErrorRef *error)
 		return false;
 	}
 
-	result = avcodec_parameters_to_context(codecContext.get(), formatContext->streams[mStreamIndex]->codecpar);
+	int result = avcodec_parameters_to_context(codecContext.get(), mFormatContext->streams[streamIndex]->codecpar);
+
+	// Allow codecs supporting it to decode using multiple threads
+	codecContext->thread_count	= (int)GetDecodingThreadCount();
+	codecContext->thread_type	= FF_THREAD_FRAME | FF_THREAD_SLICE;
 
 	result = avcodec_open2(codecContext.get(), decoder, nullptr);
 	if(0 != result) {
@@ -306,10 +616,10 @@ bool SFB::Audio::LibavDecoder::_Open(CFErrorRef *error)
 	// Generate PCM output
 	mFormat.mFormatID			= kAudioFormatLinearPCM;
 
-	mFormat.mSampleRate			= formatContext->streams[mStreamIndex]->codecpar->sample_rate;
-	mFormat.mChannelsPerFrame	= (UInt32)formatContext->streams[mStreamIndex]->codecpar->channels;
+	mFormat.mSampleRate			= mFormatContext->streams[streamIndex]->codecpar->sample_rate;
+	mFormat.mChannelsPerFrame	= (UInt32)mFormatContext->streams[streamIndex]->codecpar->channels;
 
-	switch(formatContext->streams[mStreamIndex]->codecpar->format) {
+	switch(mFormatContext->streams[streamIndex]->codecpar->format) {
 
 		case AV_SAMPLE_FMT_U8P:
 			mFormat.mFormatFlags		= kAudioFormatFlagIsPacked | kAudioFormatFlagIsNonInterleaved;
@@ -401,13 +711,16 @@ bool SFB::Audio::LibavDecoder::_Open(CFErrorRef *error)
 	// Set up the source format
 	mSourceFormat.mFormatID				= 'LBAV';
 
-	mSourceFormat.mSampleRate			= formatContext->streams[mStreamIndex]->codecpar->sample_rate;;
-	mSourceFormat.mChannelsPerFrame		= (UInt32)formatContext->streams[mStreamIndex]->codecpar->channels;
+	mSourceFormat.mSampleRate			= mFormatContext->streams[streamIndex]->codecpar->sample_rate;;
+	mSourceFormat.mChannelsPerFrame		= (UInt32)mFormatContext->streams[streamIndex]->codecpar->channels;
 
 	mSourceFormat.mFormatFlags			= mFormat.mFormatFlags;
 	mSourceFormat.mBitsPerChannel		= mFormat.mBitsPerChannel;
 
-	switch(formatContext->streams[mStreamIndex]->codecpar->channel_layout) {
+	// A previously selected stream's layout doesn't apply
+	mChannelLayout = ChannelLayout();
+
+	switch(mFormatContext->streams[streamIndex]->codecpar->channel_layout) {
 		case AV_CH_LAYOUT_MONO:
 			mChannelLayout = SFB::Audio::ChannelLayout::Mono;
 			break;
@@ -417,7 +730,7 @@ bool SFB::Audio::LibavDecoder::_Open(CFErrorRef *error)
 			break;
 
 //		default:
-//			mChannelLayout = SFB::Audio::ChannelLayout::ChannelLayoutWithBitmap(formatContext->streams[mStreamIndex]->codecpar->channel_layout);
+//			mChannelLayout = SFB::Audio::ChannelLayout::ChannelLayoutWithBitmap(mFormatContext->streams[streamIndex]->codecpar->channel_layout);
 //			break;
 	}
 
@@ -431,175 +744,118 @@ bool SFB::Audio::LibavDecoder::_Open(CFErrorRef *error)
 		return false;
 	}
 
-	mFrame = unique_AVFrame_ptr(av_frame_alloc(),
-								[](AVFrame *f) { av_frame_free(&f); });
+	// Only packets from the selected stream need to be demuxed
+	for(unsigned int i = 0; i < mFormatContext->nb_streams; ++i)
+		mFormatContext->streams[i]->discard = (int)i == streamIndex ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
 
-	mIOContext = std::move(ioContext);
-	mFormatContext = std::move(formatContext);
+	mStreamIndex = streamIndex;
 	mCodecContext = std::move(codecContext);
 
 	return true;
 }
 
-bool SFB::Audio::LibavDecoder::_Close(CFErrorRef */*error*/)
-{
-	mStreamIndex = -1;
-
-	mFrame.reset();
-	mIOContext.reset();
-	mFormatContext.reset();
-
-	mBufferList.Deallocate();
-
-	return true;
-}
+#pragma mark Packet Read-Ahead
 
-SFB::CFString SFB::Audio::LibavDecoder::_GetSourceFormatDescription() const
+void SFB::Audio::LibavDecoder::StartReadAhead()
 {
-	auto codecDescriptor = avcodec_descriptor_get(mFormatContext->streams[mStreamIndex]->codecpar->codec_id);
+	mReadAheadResult = 0;
+	mStopReadAhead = false;
 
-	return CFString(nullptr,
-					CFSTR("%s, %u channels, %u Hz"),
-					codecDescriptor ? codecDescriptor->long_name : "",
-					mSourceFormat.mChannelsPerFrame,
-					(unsigned int)mSourceFormat.mSampleRate);
+	try {
+		mReadAheadThread = std::thread(&LibavDecoder::ReadPackets, this);
+	}
+
+	catch(const std::system_error& e) {
+		LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "Unable to create read-ahead thread: " << e.what());
+		mReadAheadResult = AVERROR(e.code().value());
+	}
 }
 
-SInt64 SFB::Audio::LibavDecoder::_GetTotalFrames() const
+void SFB::Audio::LibavDecoder::StopReadAhead()
 {
-	if(mFormatContext->streams[mStreamIndex]->nb_frames)
-		return mFormatContext->streams[mStreamIndex]->nb_frames;
+	{
+		std::lock_guard<std::mutex> lock(mReadAheadMutex);
+		mStopReadAhead = true;
+		mReadAheadCondition.notify_all();
+	}
 
-	return av_rescale(mFormatContext->streams[mStreamIndex]->duration, mFormatContext->streams[mStreamIndex]->time_base.num, mFormatContext->streams[mStreamIndex]->time_base.den) * (SInt64)mFormat.mSampleRate;
+	if(mReadAheadThread.joinable())
+		mReadAheadThread.join();
 }
 
-UInt32 SFB::Audio::LibavDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+void SFB::Audio::LibavDecoder::ReadPackets()
 {
-	UInt32 framesRead = 0;
-
-	// Reset output buffer data size
-	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
-		bufferList->mBuffers[i].mDataByteSize = 0;
-
 	for(;;) {
-		UInt32 bytesRemaining	= (frameCount - framesRead) * mFormat.mBytesPerFrame;
-		UInt32 bytesToSkip		= bufferList->mBuffers[0].mDataByteSize;
-		UInt32 bytesInBuffer	= mBufferList->mBuffers[0].mDataByteSize;
+		AVPacket *packet = nullptr;
 
-		UInt32 bytesToCopy		= std::min(bytesInBuffer, bytesRemaining);
-
-		// Copy data from the buffer to output
-		for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i) {
-			unsigned char *buffer = (unsigned char *)bufferList->mBuffers[i].mData;
-			memcpy(buffer + bytesToSkip, mBufferList->mBuffers[i].mData, bytesToCopy);
-			bufferList->mBuffers[i].mDataByteSize += bytesToCopy;
+		{
+			std::unique_lock<std::mutex> lock(mReadAheadMutex);
+			mReadAheadCondition.wait(lock, [this]() { return mStopReadAhead || (size_t)READ_AHEAD_PACKETS > mPacketQueue.size(); });
+			if(mStopReadAhead)
+				return;
 
-			// Move remaining data in buffer to beginning
-			if(bytesToCopy != bytesInBuffer) {
-				buffer = (unsigned char *)mBufferList->mBuffers[i].mData;
-				memmove(buffer, buffer + bytesToCopy, (bytesInBuffer - bytesToCopy));
+			if(!mPacketPool.empty()) {
+				packet = mPacketPool.back();
+				mPacketPool.pop_back();
 			}
-
-			mBufferList->mBuffers[i].mDataByteSize -= bytesToCopy;
 		}
 
-		framesRead += (bytesToCopy / mFormat.mBytesPerFrame);
+		if(nullptr == packet)
+			packet = av_packet_alloc();
 
-		// All requested frames were read
-		if(framesRead == frameCount)
-			break;
+		int result = nullptr != packet ? av_read_frame(mFormatContext.get(), packet) : AVERROR(ENOMEM);
 
-		AVPacket packet;
-		av_init_packet(&packet);
-		packet.data = nullptr;
-		packet.size = 0;
+		std::lock_guard<std::mutex> lock(mReadAheadMutex);
 
-		// Read a single frame from the file
-		int result = av_read_frame(mFormatContext.get(), &packet);
 		if(0 > result) {
-			// EOF reached
-			if(AVERROR_EOF == result) {
-				if(CODEC_CAP_DELAY & mCodecContext->codec->capabilities) {
-					// TODO: Flush buffer
-				}
-			}
-			else {
-				char errbuf [ERRBUF_SIZE];
-				if(0 == av_strerror(result, errbuf, ERRBUF_SIZE)) {
-					LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "av_read_frame failed: " << errbuf);
-				}
-				else
-					LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "av_read_frame failed: " << result);
-			}
-
-			break;
+			if(packet)
+				mPacketPool.push_back(packet);
+			mReadAheadResult = result;
+			mReadAheadCondition.notify_all();
+			return;
 		}
 
-		if(packet.stream_index != mStreamIndex)
+		if(packet->stream_index != mStreamIndex) {
+			av_packet_unref(packet);
+			mPacketPool.push_back(packet);
 			continue;
-
-//		av_frame_unref(mFrame.get());
-
-		// Send the packet with the compressed data to the decoder
-		result = avcodec_send_packet(mCodecContext.get(), &packet);
-		if(0 != result) {
-			char errbuf [ERRBUF_SIZE];
-			if(0 == av_strerror(result, errbuf, ERRBUF_SIZE)) {
-				LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "avcodec_send_packet failed: " << errbuf);
-			}
-			else
-				LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "avcodec_send_packet failed: " << result);
-
-			break;
 		}
 
-		// Read the output frames
-		while(result >= 0) {
-			result = avcodec_receive_frame(mCodecContext.get(), mFrame.get());
-			if(AVERROR(EAGAIN) == result || AVERROR_EOF == result)
-				break;
-
-			// Planar formats are not interleaved
-			if(av_sample_fmt_is_planar(mCodecContext->sample_fmt)) {
-				for(UInt32 bufferIndex = 0; bufferIndex < mBufferList->mNumberBuffers; ++bufferIndex) {
-					memcpy(mBufferList->mBuffers[bufferIndex].mData, mFrame->extended_data[bufferIndex], (size_t)mFrame->linesize[0]);
-					mBufferList->mBuffers[bufferIndex].mDataByteSize = (UInt32)mFrame->linesize[0];
-					mBufferList->mBuffers[bufferIndex].mNumberChannels = 1;
-				}
-			}
-			else {
-				memcpy(mBufferList->mBuffers[0].mData, mFrame->extended_data[0], (size_t)mFrame->linesize[0]);
-				mBufferList->mBuffers[0].mDataByteSize = (UInt32)mFrame->linesize[0];
-				mBufferList->mBuffers[0].mNumberChannels = mFormat.mChannelsPerFrame;
-			}
+		mPacketQueue.push_back(packet);
+		mReadAheadCondition.notify_all();
+	}
+}
 
-		}
+AVPacket * SFB::Audio::LibavDecoder::DequeuePacket()
+{
+	std::unique_lock<std::mutex> lock(mReadAheadMutex);
+	mReadAheadCondition.wait(lock, [this]() { return !mPacketQueue.empty() || 0 != mReadAheadResult; });
 
-		av_packet_unref(&packet);
-	}
+	if(mPacketQueue.empty())
+		return nullptr;
 
-	mCurrentFrame += framesRead;
+	AVPacket *packet = mPacketQueue.front();
+	mPacketQueue.pop_front();
+	mReadAheadCondition.notify_all();
 
-	return framesRead;
+	return packet;
 }
 
-SInt64 SFB::Audio::LibavDecoder::_SeekToFrame(SInt64 frame)
+void SFB::Audio::LibavDecoder::RecyclePacket(AVPacket *packet)
 {
-	int64_t timestamp = av_rescale(frame / (SInt64)mFormat.mSampleRate, mFormatContext->streams[mStreamIndex]->time_base.den, mFormatContext->streams[mStreamIndex]->time_base.num);
-	int result = av_seek_frame(mFormatContext.get(), mStreamIndex, timestamp, 0);
-	if(0 > result) {
-		char errbuf [ERRBUF_SIZE];
-		if(0 == av_strerror(result, errbuf, ERRBUF_SIZE)) {
-			LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "av_seek_frame failed: " << errbuf);
-		}
-		else
-			LOGGER_ERR("org.sbooth.AudioEngine.AudioDecoder.Libav", "av_seek_frame failed: " << result);
+	av_packet_unref(packet);
 
-		return -1;
-	}
+	std::lock_guard<std::mutex> lock(mReadAheadMutex);
+	mPacketPool.push_back(packet);
+}
 
-	avcodec_flush_buffers(mCodecContext.get());
+void SFB::Audio::LibavDecoder::FreePackets()
+{
+	for(auto packet : mPacketQueue)
+		av_packet_free(&packet);
+	mPacketQueue.clear();
 
-	mCurrentFrame = frame;
-	return mCurrentFrame;
+	for(auto packet : mPacketPool)
+		av_packet_free(&packet);
+	mPacketPool.clear();
 }
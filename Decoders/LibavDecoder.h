@@ -5,6 +5,12 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "AudioDecoder.h"
 #include "AudioBufferList.h"
 
@@ -36,8 +42,14 @@ namespace SFB {
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
-			// Creation
+			// The size of the buffer used for I/O by decoders opened subsequently
+			// Larger buffers reduce the number of reads from network volumes and HTTP
+			static size_t GetIOBufferSize();
+			static void SetIOBufferSize(size_t bufferSize);
+
+			// Creation and destruction
 			explicit LibavDecoder(InputSource::unique_ptr inputSource);
+			virtual ~LibavDecoder();
 
 		private:
 
@@ -59,6 +71,22 @@ namespace SFB {
 			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
 
+			// Stream selection
+			inline virtual size_t _GetStreamCount() const			{ return mAudioStreams.size(); }
+			virtual size_t _GetCurrentStream() const;
+			virtual bool _SelectStream(size_t stream, CFErrorRef *error);
+
+			// Set up the codec and formats for decoding the stream at streamIndex in the format context
+			bool OpenStream(int streamIndex, CFErrorRef *error);
+
+			// Packet read-ahead, which demuxes on a separate thread so I/O stalls don't delay decoding
+			void StartReadAhead();
+			void StopReadAhead();
+			void ReadPackets();
+			AVPacket * DequeuePacket();
+			void RecyclePacket(AVPacket *packet);
+			void FreePackets();
+
 			using unique_AVFrame_ptr = std::unique_ptr<AVFrame, std::function<void (AVFrame *)>>;
 			using unique_AVIOContext_ptr = std::unique_ptr<AVIOContext, std::function<void (AVIOContext *)>>;
 			using unique_AVFormatContext_ptr = std::unique_ptr<AVFormatContext, std::function<void (AVFormatContext *)>>;
@@ -71,11 +99,21 @@ namespace SFB {
 			unique_AVCodecContext_ptr 			mCodecContext;
 
 			int 								mStreamIndex;
+			std::vector<int>					mAudioStreams;		// Indexes of the audio streams in the format context
 			SInt64 								mCurrentFrame;
 
 			// For converting push to pull
 			BufferList							mBufferList;
 
+			// Demuxed packets awaiting decoding and unused packets available for reuse
+			std::deque<AVPacket *>				mPacketQueue;
+			std::vector<AVPacket *>				mPacketPool;
+			std::thread							mReadAheadThread;
+			std::mutex							mReadAheadMutex;
+			std::condition_variable				mReadAheadCondition;
+			int									mReadAheadResult;
+			bool								mStopReadAhead;
+
 		};
 
 	}
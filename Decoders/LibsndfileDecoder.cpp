@@ -3,6 +3,8 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <utility>
+
 #include "LibsndfileDecoder.h"
 #include "CFWrapper.h"
 #include "CFErrorUtilities.h"
@@ -71,6 +73,40 @@ namespace {
 		return decoder->GetInputSource().GetOffset();
 	}
 
+	// Swap the byte order of count samples of width bytes in place
+	void SwapBytes(void *samples, size_t count, UInt32 width)
+	{
+		switch(width) {
+			case 2: {
+				auto s = (uint16_t *)samples;
+				for(size_t i = 0; i < count; ++i)
+					s[i] = OSSwapInt16(s[i]);
+				break;
+			}
+
+			case 3: {
+				auto s = (uint8_t *)samples;
+				for(size_t i = 0; i < count; ++i, s += 3)
+					std::swap(s[0], s[2]);
+				break;
+			}
+
+			case 4: {
+				auto s = (uint32_t *)samples;
+				for(size_t i = 0; i < count; ++i)
+					s[i] = OSSwapInt32(s[i]);
+				break;
+			}
+
+			case 8: {
+				auto s = (uint64_t *)samples;
+				for(size_t i = 0; i < count; ++i)
+					s[i] = OSSwapInt64(s[i]);
+				break;
+			}
+		}
+	}
+
 }
 
 #pragma mark Static Methods
@@ -127,6 +163,27 @@ bool SFB::Audio::LibsndfileDecoder::HandlesMIMEType(CFStringRef /*mimeType*/)
 	return false;
 }
 
+bool SFB::Audio::LibsndfileDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	if(12 > length)
+		return false;
+
+	// WAVE, RF64, AIFF, AIFF-C and CAF
+	if((0 == memcmp(bytes, "RIFF", 4) || 0 == memcmp(bytes, "RF64", 4)) && 0 == memcmp(bytes + 8, "WAVE", 4))
+		return true;
+	else if(0 == memcmp(bytes, "FORM", 4) && (0 == memcmp(bytes + 8, "AIFF", 4) || 0 == memcmp(bytes + 8, "AIFC", 4)))
+		return true;
+	else if(0 == memcmp(bytes, "caff", 4))
+		return true;
+
+	return false;
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::LibsndfileDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new LibsndfileDecoder(std::move(inputSource)));
@@ -135,7 +192,7 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::LibsndfileDecoder::CreateDecoder(Inp
 #pragma mark Creation and Destruction
 
 SFB::Audio::LibsndfileDecoder::LibsndfileDecoder(InputSource::unique_ptr inputSource)
-	: Decoder(std::move(inputSource)), mFile(nullptr, nullptr), mReadMethod(ReadMethod::Unknown)
+	: Decoder(std::move(inputSource)), mFile(nullptr, nullptr), mReadMethod(ReadMethod::Unknown), mSwapBytes(false)
 {
 	memset(&mFileInfo, 0, sizeof(SF_INFO));
 }
@@ -274,6 +331,10 @@ bool SFB::Audio::LibsndfileDecoder::_Open(CFErrorRef *error)
 
 	mFormat.mReserved			= 0;
 
+	// Bypass libsndfile's conversion for uncompressed PCM
+	if(SetupRawRead(subFormat))
+		LOGGER_DEBUG("org.sbooth.AudioEngine.Decoder.Libsndfile", "Reading samples without conversion");
+
 	// Set up the source format
 	mSourceFormat.mFormatID				= 'SNDF';
 
@@ -324,6 +385,7 @@ bool SFB::Audio::LibsndfileDecoder::_Close(CFErrorRef */*error*/)
 	mFile.reset();
 	memset(&mFileInfo, 0, sizeof(SF_INFO));
 	mReadMethod = ReadMethod::Unknown;
+	mSwapBytes = false;
 
 	return true;
 }
@@ -354,6 +416,12 @@ UInt32 SFB::Audio::LibsndfileDecoder::_ReadAudio(AudioBufferList *bufferList, UI
 		case ReadMethod::Int:		framesRead = sf_readf_int(mFile.get(), (int *)bufferList->mBuffers[0].mData, frameCount);		break;
 		case ReadMethod::Float:		framesRead = sf_readf_float(mFile.get(), (float *)bufferList->mBuffers[0].mData, frameCount);	break;
 		case ReadMethod::Double:	framesRead = sf_readf_double(mFile.get(), (double *)bufferList->mBuffers[0].mData, frameCount);	break;
+
+		case ReadMethod::Raw:
+			framesRead = sf_read_raw(mFile.get(), bufferList->mBuffers[0].mData, (sf_count_t)frameCount * mFormat.mBytesPerFrame) / mFormat.mBytesPerFrame;
+			if(mSwapBytes)
+				SwapBytes(bufferList->mBuffers[0].mData, (size_t)framesRead * mFormat.mChannelsPerFrame, mFormat.mBytesPerFrame / mFormat.mChannelsPerFrame);
+			break;
 	}
 
 	bufferList->mBuffers[0].mDataByteSize = (UInt32)(framesRead * mFormat.mBytesPerFrame);
@@ -361,3 +429,45 @@ UInt32 SFB::Audio::LibsndfileDecoder::_ReadAudio(AudioBufferList *bufferList, UI
 
 	return (UInt32)framesRead;
 }
+
+bool SFB::Audio::LibsndfileDecoder::SetupRawRead(int subFormat)
+{
+	// Only containers storing fixed-size frames contiguously may be read raw
+	switch(SF_FORMAT_TYPEMASK & mFileInfo.format) {
+		case SF_FORMAT_WAV:
+		case SF_FORMAT_WAVEX:
+		case SF_FORMAT_RF64:
+		case SF_FORMAT_W64:
+		case SF_FORMAT_AIFF:
+		case SF_FORMAT_CAF:
+		case SF_FORMAT_AU:
+		case SF_FORMAT_RAW:
+			break;
+
+		default:
+			return false;
+	}
+
+	// 24-bit samples are delivered packed, as stored, instead of high-aligned in ints
+	switch(subFormat) {
+		case SF_FORMAT_PCM_16:
+		case SF_FORMAT_PCM_32:
+		case SF_FORMAT_FLOAT:
+		case SF_FORMAT_DOUBLE:
+			break;
+
+		case SF_FORMAT_PCM_24:
+			mFormat.mFormatFlags		= kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked;
+			mFormat.mBytesPerPacket		= (mFormat.mBitsPerChannel / 8) * mFormat.mChannelsPerFrame;
+			mFormat.mBytesPerFrame		= mFormat.mBytesPerPacket * mFormat.mFramesPerPacket;
+			break;
+
+		default:
+			return false;
+	}
+
+	mSwapBytes = SF_TRUE == sf_command(mFile.get(), SFC_RAW_DATA_NEEDS_ENDSWAP, nullptr, 0);
+	mReadMethod = ReadMethod::Raw;
+
+	return true;
+}
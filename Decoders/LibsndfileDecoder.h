@@ -26,6 +26,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
@@ -52,6 +53,9 @@ namespace SFB {
 			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
 			inline virtual SInt64 _SeekToFrame(SInt64 frame)		{ return sf_seek(mFile.get(), frame, SEEK_SET); }
 
+			// Set up reading of uncompressed PCM exactly as stored, if possible
+			bool SetupRawRead(int subFormat);
+
 			using unique_SNDFILE_ptr = std::unique_ptr<SNDFILE, int(*)(SNDFILE *)>;
 
 			// Data members
@@ -60,12 +64,14 @@ namespace SFB {
 				Short,
 				Int,
 				Float,
-				Double
+				Double,
+				Raw
 			};
 
 			unique_SNDFILE_ptr	mFile;
 			SF_INFO				mFileInfo;
 			ReadMethod			mReadMethod;
+			bool				mSwapBytes;			// Raw samples must be byte swapped for the host
 		};
 
 	}
@@ -4,6 +4,7 @@
  */
 
 #include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 #include "LoopableRegionDecoder.h"
@@ -75,21 +76,21 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::LoopableRegionDecoder::CreateForDeco
 }
 
 SFB::Audio::LoopableRegionDecoder::LoopableRegionDecoder(Decoder::unique_ptr decoder, SInt64 startingFrame)
-	: mDecoder(std::move(decoder)), mStartingFrame(startingFrame), mFrameCount(0), mRepeatCount(0), mFramesReadInCurrentPass(0), mTotalFramesRead(0), mCompletedPasses(0)
+	: mDecoder(std::move(decoder)), mStartingFrame(startingFrame), mFrameCount(0), mRepeatCount(0), mFramesReadInCurrentPass(0), mTotalFramesRead(0), mCompletedPasses(0), mCacheFrameCount(0), mCachedFrames(0)
 {
 	if(!mDecoder)
 		throw std::runtime_error("mDecoder may not be nullptr");
 }
 
 SFB::Audio::LoopableRegionDecoder::LoopableRegionDecoder(Decoder::unique_ptr decoder, SInt64 startingFrame, UInt32 frameCount)
-	: mDecoder(std::move(decoder)), mStartingFrame(startingFrame), mFrameCount(frameCount), mRepeatCount(0), mFramesReadInCurrentPass(0), mTotalFramesRead(0), mCompletedPasses(0)
+	: mDecoder(std::move(decoder)), mStartingFrame(startingFrame), mFrameCount(frameCount), mRepeatCount(0), mFramesReadInCurrentPass(0), mTotalFramesRead(0), mCompletedPasses(0), mCacheFrameCount(0), mCachedFrames(0)
 {
 	if(!mDecoder)
 		throw std::runtime_error("mDecoder may not be nullptr");
 }
 
 SFB::Audio::LoopableRegionDecoder::LoopableRegionDecoder(Decoder::unique_ptr decoder, SInt64 startingFrame, UInt32 frameCount, UInt32 repeatCount)
-	: mDecoder(std::move(decoder)), mStartingFrame(startingFrame), mFrameCount(frameCount), mRepeatCount(repeatCount), mFramesReadInCurrentPass(0), mTotalFramesRead(0), mCompletedPasses(0)
+	: mDecoder(std::move(decoder)), mStartingFrame(startingFrame), mFrameCount(frameCount), mRepeatCount(repeatCount), mFramesReadInCurrentPass(0), mTotalFramesRead(0), mCompletedPasses(0), mCacheFrameCount(0), mCachedFrames(0)
 {
 	if(!mDecoder)
 		throw std::runtime_error("mDecoder may not be nullptr");
@@ -105,17 +106,41 @@ bool SFB::Audio::LoopableRegionDecoder::_Open(CFErrorRef *error)
 		return false;
 	}
 
+	// The cache is filled during the first pass
+	mCachedFrames = 0;
+	UInt32 cacheFrameCount = std::min(mCacheFrameCount, mFrameCount);
+	if(0 < cacheFrameCount && 0 < mRepeatCount) {
+		if(!mFormat.IsPCM() || !mCache.Allocate(mFormat, cacheFrameCount))
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.LoopableRegion", "Unable to cache " << cacheFrameCount << " frames; the region will be seeked at each loop");
+	}
+
 	return true;
 }
 
 bool SFB::Audio::LoopableRegionDecoder::_Close(CFErrorRef *error)
 {
+	mCache.Deallocate();
+	mCachedFrames = 0;
+
 	if(!mDecoder->Close(error))
 		return false;
 
 	return true;
 }
 
+#pragma mark Loop Caching
+
+bool SFB::Audio::LoopableRegionDecoder::SetCacheFrameCount(UInt32 frameCount)
+{
+	if(IsOpen()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.LoopableRegion", "SetCacheFrameCount() called on a Decoder that is open");
+		return false;
+	}
+
+	mCacheFrameCount = frameCount;
+	return true;
+}
+
 SFB::CFString SFB::Audio::LoopableRegionDecoder::_GetSourceFormatDescription() const
 {
 	return CFString(mDecoder->CreateSourceFormatDescription());
@@ -156,18 +181,49 @@ UInt32 SFB::Audio::LoopableRegionDecoder::_ReadAudio(AudioBufferList *bufferList
 	UInt32 totalFramesRead = 0;
 
 	while(0 < framesRemaining) {
-		UInt32 framesRemainingInCurrentPass	= (UInt32)(mStartingFrame + mFrameCount - mDecoder->GetCurrentFrame());
+		UInt32 framesRemainingInCurrentPass	= mFrameCount - mFramesReadInCurrentPass;
 		UInt32 framesToRead					= std::min(framesRemaining, framesRemainingInCurrentPass);
 
 		// Nothing left to read
 		if(0 == framesToRead)
 			break;
 
-		UInt32 framesRead = mDecoder->ReadAudio(bufferListAlias, framesToRead);
-
-		// A read error occurred
-		if(0 == framesRead)
-			break;
+		UInt32 framesRead = 0;
+
+		// Copy cached audio
+		if(mFramesReadInCurrentPass < mCachedFrames) {
+			framesRead = std::min(framesToRead, mCachedFrames - mFramesReadInCurrentPass);
+			UInt32 byteOffset = mFramesReadInCurrentPass * mFormat.mBytesPerFrame;
+			UInt32 byteCount = framesRead * mFormat.mBytesPerFrame;
+			for(UInt32 i = 0; i < bufferListAlias->mNumberBuffers; ++i) {
+				memcpy(bufferListAlias->mBuffers[i].mData, (const int8_t *)mCache->mBuffers[i].mData + byteOffset, byteCount);
+				bufferListAlias->mBuffers[i].mDataByteSize = byteCount;
+			}
+		}
+		else {
+			// The underlying decoder isn't seeked while cached audio is read
+			SInt64 frame = mStartingFrame + mFramesReadInCurrentPass;
+			if(frame != mDecoder->GetCurrentFrame() && frame != mDecoder->SeekToFrame(frame)) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.LoopableRegion", "Unable to seek to frame " << frame);
+				break;
+			}
+
+			framesRead = mDecoder->ReadAudio(bufferListAlias, framesToRead);
+
+			// A read error occurred
+			if(0 == framesRead)
+				break;
+
+			// Audio from the start of the region is cached as it is decoded
+			if(mCache && mFramesReadInCurrentPass == mCachedFrames && mCachedFrames < mCache.GetCapacityFrames()) {
+				UInt32 framesToCache = std::min(framesRead, mCache.GetCapacityFrames() - mCachedFrames);
+				UInt32 byteOffset = mCachedFrames * mFormat.mBytesPerFrame;
+				UInt32 byteCount = framesToCache * mFormat.mBytesPerFrame;
+				for(UInt32 i = 0; i < bufferListAlias->mNumberBuffers; ++i)
+					memcpy((int8_t *)mCache->mBuffers[i].mData + byteOffset, bufferListAlias->mBuffers[i].mData, byteCount);
+				mCachedFrames += framesToCache;
+			}
+		}
 
 		// Advance the write pointers and update the capacity
 		for(UInt32 i = 0; i < bufferListAlias->mNumberBuffers; ++i) {
@@ -191,8 +247,8 @@ UInt32 SFB::Audio::LoopableRegionDecoder::_ReadAudio(AudioBufferList *bufferList
 			++mCompletedPasses;
 			mFramesReadInCurrentPass = 0;
 
-			// Only seek to the beginning of the region if more passes remain
-			if(mRepeatCount >= mCompletedPasses)
+			// Only seek to the beginning of the region if more passes remain and its start isn't cached
+			if(mRepeatCount >= mCompletedPasses && 0 == mCachedFrames)
 				mDecoder->SeekToFrame(mStartingFrame);
 		}
 	}
@@ -206,11 +262,23 @@ SInt64 SFB::Audio::LoopableRegionDecoder::_SeekToFrame(SInt64 frame)
 	mFramesReadInCurrentPass	= (UInt32)(frame % mFrameCount);
 	mTotalFramesRead			= frame;
 
-	mDecoder->SeekToFrame(mStartingFrame + mFramesReadInCurrentPass);
+	// Cached audio is read without seeking
+	if(mFramesReadInCurrentPass >= mCachedFrames)
+		mDecoder->SeekToFrame(mStartingFrame + mFramesReadInCurrentPass);
 
 	return _GetCurrentFrame();
 }
 
+SFB::Audio::Decoder::SeekCost SFB::Audio::LoopableRegionDecoder::_GetSeekCost(SInt64 frame) const
+{
+	// Cached audio is read without seeking
+	UInt32 framesReadInPass = (UInt32)(frame % mFrameCount);
+	if(framesReadInPass < mCachedFrames)
+		return SeekCostConstant;
+
+	return mDecoder->GetSeekCost(mStartingFrame + framesReadInPass);
+}
+
 bool SFB::Audio::LoopableRegionDecoder::Reset()
 {
 	mFramesReadInCurrentPass	= 0;
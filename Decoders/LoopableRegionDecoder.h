@@ -6,6 +6,7 @@
 #pragma once
 
 #include "AudioDecoder.h"
+#include "AudioBufferList.h"
 
 /*! @file LoopableRegionDecoder.h @brief Support for decoding specific audio regions */
 
@@ -139,6 +140,29 @@ namespace SFB {
 			//@}
 
 
+			// ========================================
+			/*! @name Loop Caching */
+			//@{
+
+			/*! @brief Get the maximum number of frames from the start of the region cached in memory */
+			inline UInt32 GetCacheFrameCount() const				{ return mCacheFrameCount; }
+
+			/*!
+			 * @brief Set the maximum number of frames from the start of the region cached in memory
+			 *
+			 * The audio is cached as it is decoded during the first pass, and later passes copy the cached audio
+			 * instead of seeking the underlying decoder at the loop point.  If the entire region is cached the
+			 * underlying decoder isn't seeked after the first pass; otherwise it is seeked to the first uncached
+			 * frame when the cached audio has been read.
+			 * @note This must be set before the decoder is opened
+			 * @param frameCount The maximum number of frames to cache, or \c 0 to disable caching
+			 * @return \c true on success, \c false if the decoder is open
+			 */
+			bool SetCacheFrameCount(UInt32 frameCount);
+
+			//@}
+
+
 		private:
 
 			// Creation
@@ -168,6 +192,7 @@ namespace SFB {
 			// Seeking support
 			inline virtual bool _SupportsSeeking() const			{ return mDecoder->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
+			virtual SeekCost _GetSeekCost(SInt64 frame) const;
 
 
 			// The starting frame for this audio file region
@@ -200,6 +225,10 @@ namespace SFB {
 			UInt32					mFramesReadInCurrentPass;
 			SInt64					mTotalFramesRead;
 			UInt32					mCompletedPasses;
+
+			UInt32					mCacheFrameCount;
+			BufferList				mCache;				// The first mCachedFrames frames of the region
+			UInt32					mCachedFrames;
 		};
 
 	}
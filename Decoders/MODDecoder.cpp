@@ -103,11 +103,46 @@ bool SFB::Audio::MODDecoder::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::MODDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	// Impulse Tracker, FastTracker 2, Scream Tracker 3 and ProTracker modules
+	if(4 <= length && 0 == memcmp(bytes, "IMPM", 4))
+		return true;
+	else if(17 <= length && 0 == memcmp(bytes, "Extended Module: ", 17))
+		return true;
+	else if(48 <= length && 0 == memcmp(bytes + 44, "SCRM", 4))
+		return true;
+	else if(1084 <= length && 0 == memcmp(bytes + 1080, "M.K.", 4))
+		return true;
+
+	return false;
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::MODDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new MODDecoder(std::move(inputSource)));
 }
 
+int SFB::Audio::MODDecoder::GetResamplingQuality()
+{
+	return dumb_resampling_quality;
+}
+
+void SFB::Audio::MODDecoder::SetResamplingQuality(int quality)
+{
+	if(0 > quality || DUMB_RQ_N_LEVELS <= quality) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.MOD", "SetResamplingQuality() called with invalid parameters");
+		return;
+	}
+
+	dumb_resampling_quality = quality;
+}
+
 #pragma mark Creation and Destruction
 
 SFB::Audio::MODDecoder::MODDecoder(InputSource::unique_ptr inputSource)
@@ -239,19 +274,17 @@ UInt32 SFB::Audio::MODDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 fr
 
 SInt64 SFB::Audio::MODDecoder::_SeekToFrame(SInt64 frame)
 {
-	// DUMB cannot seek backwards, so the decoder must be reset
-	if(frame < mCurrentFrame) {
-		if(!_Close(nullptr) || !mInputSource->SeekToOffset(0) || !_Open(nullptr)) {
-			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.MOD", "Error reseting DUMB decoder");
-			return -1;
-		}
-
-		mCurrentFrame = 0;
+	// Positions are in units of 1/65536 second, so frames and positions are equivalent at DUMB_SAMPLE_RATE
+	// DUMB cannot seek a sigrenderer, but a new sigrenderer started at frame resumes from the checkpoint
+	// preceding it that was recorded when the module was loaded, instead of rendering from the beginning
+	auto sigrenderer = unique_DUH_SIGRENDERER_ptr(duh_start_sigrenderer(duh.get(), 0, DUMB_CHANNELS, (long)frame), duh_end_sigrenderer);
+	if(!sigrenderer) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.MOD", "duh_start_sigrenderer failed for position " << frame);
+		return -1;
 	}
 
-	long framesToSkip = frame - mCurrentFrame;
-	duh_sigrenderer_generate_samples(dsr.get(), 1, 65536.0f / DUMB_SAMPLE_RATE, framesToSkip, nullptr);
-	mCurrentFrame += framesToSkip;
+	dsr = std::move(sigrenderer);
+	mCurrentFrame = frame;
 
 	return mCurrentFrame;
 }
@@ -26,9 +26,16 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
+			// The interpolation used when resampling instruments, one of the DUMB_RQ_* constants
+			// DUMB applies this to all modules, taking effect as notes are started
+			// Lower quality settings reduce CPU usage on low-power devices
+			static int GetResamplingQuality();
+			static void SetResamplingQuality(int quality);
+
 			// Creation
 			explicit MODDecoder(InputSource::unique_ptr inputSource);
 
@@ -49,7 +56,7 @@ namespace SFB {
 			inline virtual SInt64 _GetCurrentFrame() const			{ return mCurrentFrame; }
 
 			// Seeking support
-			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
+			inline virtual bool _SupportsSeeking() const			{ return true; }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
 
 			using unique_DUMBFILE_ptr = std::unique_ptr<DUMBFILE, int(*)(DUMBFILE *)>;
@@ -4,12 +4,17 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
 
-#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
-#include <Accelerate/Accelerate.h>
+#include <dispatch/dispatch.h>
 
 #include "MPEGDecoder.h"
 #include "CFWrapper.h"
@@ -26,39 +31,46 @@ namespace {
 
 #pragma mark Initialization
 
-	void Setupmpg123() __attribute__ ((constructor));
+	bool sInitializedmpg123 = false;
+
+	// mpg123 is initialized the first time a handle is needed instead of at launch
 	void Setupmpg123()
 	{
-		// What happens if this fails?
-		int result = mpg123_init();
-		if(MPG123_OK != result)
-			LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.MPEG", "Unable to initialize mpg123: " << mpg123_plain_strerror(result));
+		static dispatch_once_t onceToken;
+		dispatch_once(&onceToken, ^{
+			// What happens if this fails?
+			int result = mpg123_init();
+			if(MPG123_OK != result)
+				LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.MPEG", "Unable to initialize mpg123: " << mpg123_plain_strerror(result));
+			sInitializedmpg123 = true;
+		});
 	}
 
 	void Teardownmpg123() __attribute__ ((destructor));
 	void Teardownmpg123()
 	{
-		mpg123_exit();
+		if(sInitializedmpg123)
+			mpg123_exit();
 	}
 
 #pragma mark Callbacks
 
+	// The callbacks' data source is the InputSource being decoded
 	ssize_t read_callback(void *dataSource, void *ptr, size_t size)
 	{
 		assert(nullptr != dataSource);
 
-		auto decoder = static_cast<SFB::Audio::MPEGDecoder *>(dataSource);
-		return (ssize_t)decoder->GetInputSource().Read(ptr, (SInt64)size);
+		auto inputSource = static_cast<SFB::InputSource *>(dataSource);
+		return (ssize_t)inputSource->Read(ptr, (SInt64)size);
 	}
 
 	off_t lseek_callback(void *datasource, off_t offset, int whence)
 	{
 		assert(nullptr != datasource);
 
-		auto decoder = static_cast<SFB::Audio::MPEGDecoder *>(datasource);
-		SFB::InputSource& inputSource = decoder->GetInputSource();
+		auto inputSource = static_cast<SFB::InputSource *>(datasource);
 
-		if(!inputSource.SupportsSeeking())
+		if(!inputSource->SupportsSeeking())
 			return -1;
 
 		// Adjust offset as required
@@ -67,21 +79,118 @@ namespace {
 				// offset remains unchanged
 				break;
 			case SEEK_CUR:
-				offset += inputSource.GetOffset();
+				offset += inputSource->GetOffset();
 				break;
 			case SEEK_END:
-				offset += inputSource.GetLength();
+				offset += inputSource->GetLength();
 				break;
 		}
 
-		if(!inputSource.SeekToOffset(offset))
+		if(!inputSource->SeekToOffset(offset))
 			return -1;
 
 		return offset;
 	}
 
+#pragma mark Seek Index
+
+	// The kind of seek index cached by this decoder; positions are MPEG frames as used by mpg123_set_index()
+	const UInt32 kSeekIndexKind = 'MPEG';
+
+	// Scan the entire file at url using a private mpg123 handle
+	bool BuildSeekIndex(CFURLRef url, SFB::Audio::SeekIndex& seekIndex)
+	{
+		auto inputSource = SFB::InputSource::CreateForURL(url);
+		if(!inputSource || !inputSource->Open())
+			return false;
+
+		Setupmpg123();
+
+		std::unique_ptr<mpg123_handle, void(*)(mpg123_handle *)> decoder(mpg123_new(nullptr, nullptr), [](mpg123_handle *mh) {
+			mpg123_close(mh);
+			mpg123_delete(mh);
+		});
+
+		if(!decoder)
+			return false;
+
+		// The parameters must match those used for decoding so frame offsets and gapless lengths agree
+		mpg123_param(decoder.get(), MPG123_FLAGS, MPG123_FORCE_FLOAT | MPG123_SKIP_ID3V2 | MPG123_GAPLESS | MPG123_QUIET, 0);
+		mpg123_param(decoder.get(), MPG123_RESYNC_LIMIT, 2048, 0);
+
+		if(MPG123_OK != mpg123_replace_reader_handle(decoder.get(), read_callback, lseek_callback, nullptr) || MPG123_OK != mpg123_open_handle(decoder.get(), inputSource.get()) || MPG123_OK != mpg123_scan(decoder.get()))
+			return false;
+
+		off_t *indexOffsets = nullptr;
+		off_t step = 0;
+		size_t fill = 0;
+		if(MPG123_OK != mpg123_index(decoder.get(), &indexOffsets, &step, &fill) || 0 == fill)
+			return false;
+
+		SInt64 totalFrames = mpg123_length(decoder.get());
+		if(0 > totalFrames)
+			return false;
+
+		seekIndex = SFB::Audio::SeekIndex(step, std::vector<SInt64>(indexOffsets, indexOffsets + fill), totalFrames);
+
+		return true;
+	}
+
+	// Install seekIndex as the frame index of mh
+	bool SetIndex(mpg123_handle *mh, const SFB::Audio::SeekIndex& seekIndex)
+	{
+		std::vector<off_t> offsets(seekIndex.GetOffsets().begin(), seekIndex.GetOffsets().end());
+		return MPG123_OK == mpg123_set_index(mh, offsets.data(), (off_t)seekIndex.GetStep(), offsets.size());
+	}
+
+	// The frame index recorded in a state snapshot, followed by mFill offsets
+	struct IndexStateSnapshot
+	{
+		uint32_t	mKind;
+		uint32_t	mReserved;
+		int64_t		mTotalFrames;
+		int64_t		mStep;
+		uint64_t	mFill;
+	};
+
+	// The path and status of the regular file at url
+	bool GetFileStatus(CFURLRef url, std::string& path, struct stat& sb)
+	{
+		char buffer [PATH_MAX];
+		if(!url || !CFURLGetFileSystemRepresentation(url, true, (UInt8 *)buffer, sizeof(buffer)))
+			return false;
+
+		if(0 != stat(buffer, &sb) || !S_ISREG(sb.st_mode))
+			return false;
+
+		path = buffer;
+		return true;
+	}
+
+	// Scanning a stream read over the network reads it in its entirety before playback can start
+	bool IsRemoteURL(CFURLRef url)
+	{
+		if(!url)
+			return false;
+
+		SFB::CFString scheme(CFURLCopyScheme(url));
+		return scheme && (kCFCompareEqualTo == CFStringCompare(CFSTR("http"), scheme, kCFCompareCaseInsensitive) || kCFCompareEqualTo == CFStringCompare(CFSTR("https"), scheme, kCFCompareCaseInsensitive));
+	}
+
 }
 
+// ========================================
+// A seek index built in the background
+struct SFB::Audio::MPEGDecoder::PendingSeekIndex
+{
+	PendingSeekIndex()
+		: mReady(false)
+	{}
+
+	SeekIndex			mIndex;
+	std::atomic_bool	mReady;
+};
+
 #pragma mark Static Methods
 
 CFArrayRef SFB::Audio::MPEGDecoder::CreateSupportedFileExtensions()
@@ -118,6 +227,20 @@ bool SFB::Audio::MPEGDecoder::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::MPEGDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	if(4 > length)
+		return false;
+
+	// Frame sync followed by a valid layer, bitrate index and sample rate index
+	return 0xff == bytes[0] && 0xe0 == (bytes[1] & 0xe0) && 0 != (bytes[1] & 0x06) && 0xf0 != (bytes[2] & 0xf0) && 0x0c != (bytes[2] & 0x0c);
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::MPEGDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new MPEGDecoder(std::move(inputSource)));
@@ -126,17 +249,22 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::MPEGDecoder::CreateDecoder(InputSour
 #pragma mark Creation and Destruction
 
 SFB::Audio::MPEGDecoder::MPEGDecoder(InputSource::unique_ptr inputSource)
-	: Decoder(std::move(inputSource)), mDecoder(nullptr), mCurrentFrame(0)
+	: Decoder(std::move(inputSource)), mDecoder(nullptr), mCurrentFrame(0), mTotalFrames(-1)
 {}
 
 #pragma mark Functionality
 
 bool SFB::Audio::MPEGDecoder::_Open(CFErrorRef *error)
 {
-	auto decoder = unique_mpg123_ptr(mpg123_new(nullptr, nullptr), [](mpg123_handle *mh) {
-		mpg123_close(mh);
-		mpg123_delete(mh);
-	});
+	Setupmpg123();
+
+	// Reuse the mpg123 handle from a previous stream if possible
+	auto decoder = std::move(mDecoder);
+	if(!decoder)
+		decoder = unique_mpg123_ptr(mpg123_new(nullptr, nullptr), [](mpg123_handle *mh) {
+			mpg123_close(mh);
+			mpg123_delete(mh);
+		});
 
 	if(!decoder) {
 		if(error) {
@@ -166,7 +294,7 @@ bool SFB::Audio::MPEGDecoder::_Open(CFErrorRef *error)
 		return false;
 	}
 
-	if(MPG123_OK != mpg123_open_handle(decoder.get(), this)) {
+	if(MPG123_OK != mpg123_open_handle(decoder.get(), &GetInputSource())) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid MP3 file."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not an MP3 file"), ""));
@@ -206,6 +334,8 @@ bool SFB::Audio::MPEGDecoder::_Open(CFErrorRef *error)
 
 	mFormat.mReserved			= 0;
 
+	mDeinterleave = SamplePacking::Deinterleaver::ForFloat(mFormat.mChannelsPerFrame);
+
 	size_t bufferSizeBytes = mpg123_outblock(decoder.get());
 	UInt32 framesPerMPEGFrame = (UInt32)(bufferSizeBytes / ((size_t)channels * sizeof(float)));
 
@@ -223,7 +353,35 @@ bool SFB::Audio::MPEGDecoder::_Open(CFErrorRef *error)
 		case 2:		mChannelLayout = ChannelLayout::ChannelLayoutWithTag(kAudioChannelLayoutTag_Stereo);	break;
 	}
 
-	if(MPG123_OK != mpg123_scan(decoder.get())) {
+	mTotalFrames = -1;
+	mSeekIndex.reset();
+
+	// An exact length and frame-accurate seeking require an index of the file's frame offsets
+	// For files use a cached index if one exists or build one in the background; remote streams aren't scanned
+	// and their length is estimated unless given by a Xing or Info header; otherwise scan now
+	std::string path;
+	struct stat sb;
+	if(GetFileStatus(GetURL(), path, sb)) {
+		SeekIndex cachedSeekIndex;
+		if(cachedSeekIndex.Load(GetURL(), kSeekIndexKind) && SetIndex(decoder.get(), cachedSeekIndex))
+			mTotalFrames = cachedSeekIndex.GetTotalFrames();
+		else {
+			auto seekIndex = std::make_shared<PendingSeekIndex>();
+			mSeekIndex = seekIndex;
+
+			SFB::CFURL url((CFURLRef)CFRetain(GetURL()));
+			dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+				if(BuildSeekIndex(url, seekIndex->mIndex)) {
+					if(!seekIndex->mIndex.Save(url, kSeekIndexKind))
+						LOGGER_INFO("org.sbooth.AudioEngine.Decoder.MPEG", "Unable to cache seek index for " << path.c_str());
+					seekIndex->mReady.store(true);
+				}
+				else
+					LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.MPEG", "Unable to build seek index for " << path.c_str());
+			});
+		}
+	}
+	else if(!IsRemoteURL(GetURL()) && MPG123_OK != mpg123_scan(decoder.get())) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid MP3 file."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not an MP3 file"), ""));
@@ -247,14 +405,20 @@ bool SFB::Audio::MPEGDecoder::_Open(CFErrorRef *error)
 		mBufferList->mBuffers[i].mDataByteSize = 0;
 
 	mDecoder = std::move(decoder);
+	mCurrentFrame = 0;
 
 	return true;
 }
 
 bool SFB::Audio::MPEGDecoder::_Close(CFErrorRef */*error*/)
 {
-	mDecoder.reset();
+	mSeekIndex.reset();
+	mTotalFrames = -1;
+
+	// Close but retain the mpg123 handle so it may be reused by Reset()
+	mpg123_close(mDecoder.get());
 	mBufferList.Deallocate();
+	mDeinterleave = nullptr;
 
 	return true;
 }
@@ -348,18 +512,20 @@ UInt32 SFB::Audio::MPEGDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 f
 		// The analyzer error about division by zero may be safely ignored, because mChannelsPerFrame is verified > 0 in Open()
 		UInt32 framesDecoded = (UInt32)(bytesDecoded / (sizeof(float) * mFormat.mChannelsPerFrame));
 
-		// Deinterleave the samples
-		// In my experiments adding zero using Accelerate.framework is faster than looping through the buffer and copying each sample
-		float zero = 0;
-		for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel) {
-			float *inputBuffer = (float *)audioData + channel;
-			float *outputBuffer = (float *)mBufferList->mBuffers[channel].mData;
+		// Deinterleave directly into the output and stash only the frames that don't fit
+		UInt32 framesToOutput = std::min(framesDecoded, frameCount - framesRead);
+		mDeinterleave(audioData, bufferList, framesRead, framesToOutput);
 
-			vDSP_vsadd(inputBuffer, (vDSP_Stride)mFormat.mChannelsPerFrame, &zero, outputBuffer, 1, framesDecoded);
+		framesRead += framesToOutput;
 
-			mBufferList->mBuffers[channel].mNumberChannels	= 1;
-			mBufferList->mBuffers[channel].mDataByteSize	= framesDecoded * sizeof(float);
+		if(framesToOutput < framesDecoded) {
+			UInt32 framesToStash = framesDecoded - framesToOutput;
+			mDeinterleave((const float *)audioData + (framesToOutput * mFormat.mChannelsPerFrame), mBufferList, 0, framesToStash);
 		}
+
+		// All requested frames were read
+		if(framesRead == frameCount)
+			break;
 	}
 
 	mCurrentFrame += framesRead;
@@ -369,14 +535,103 @@ UInt32 SFB::Audio::MPEGDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 f
 
 SInt64 SFB::Audio::MPEGDecoder::_GetTotalFrames() const
 {
+	if(0 <= mTotalFrames)
+		return mTotalFrames;
+
+	if(mSeekIndex && mSeekIndex->mReady.load())
+		return mSeekIndex->mIndex.GetTotalFrames();
+
 	return mpg123_length(mDecoder.get());
 }
 
+bool SFB::Audio::MPEGDecoder::_IsTotalFramesEstimated() const
+{
+	if(0 <= mTotalFrames || (mSeekIndex && mSeekIndex->mReady.load()))
+		return false;
+
+	// mpg123's length is accurate following a scan or if given by a Xing or Info header
+	long accurate = 0;
+	return MPG123_OK != mpg123_getstate(mDecoder.get(), MPG123_ACCURATE, &accurate, nullptr) || 0 == accurate;
+}
+
 SInt64 SFB::Audio::MPEGDecoder::_SeekToFrame(SInt64 frame)
 {
+	AdoptSeekIndex();
+
 	frame = mpg123_seek(mDecoder.get(), frame, SEEK_SET);
-	if(0 <= frame)
+	if(0 <= frame) {
+		// Discard any frames stashed from before the seek
+		for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i)
+			mBufferList->mBuffers[i].mDataByteSize = 0;
+
 		mCurrentFrame = frame;
+	}
 
 	return ((0 <= frame) ? mCurrentFrame : -1);
 }
+
+SFB::Audio::Decoder::SeekCost SFB::Audio::MPEGDecoder::_GetSeekCost(SInt64 /*frame*/) const
+{
+	// Until the background index is adopted mpg123 scans forward from the last frame it has seen
+	if(mSeekIndex)
+		return SeekCostSearch;
+
+	return SeekCostIndexed;
+}
+
+bool SFB::Audio::MPEGDecoder::_AppendStateSnapshot(SInt64 /*frame*/, CFMutableDataRef data) const
+{
+	off_t *indexOffsets = nullptr;
+	off_t step = 0;
+	size_t fill = 0;
+	if(MPG123_OK != mpg123_index(mDecoder.get(), &indexOffsets, &step, &fill) || 0 == fill)
+		return false;
+
+	// The total is recorded only when known exactly, in which case the index covers the whole file
+	IndexStateSnapshot snapshot = { kSeekIndexKind, 0, mTotalFrames, step, fill };
+	CFDataAppendBytes(data, (const UInt8 *)&snapshot, sizeof(snapshot));
+
+	std::vector<int64_t> offsets(indexOffsets, indexOffsets + fill);
+	CFDataAppendBytes(data, (const UInt8 *)offsets.data(), (CFIndex)(offsets.size() * sizeof(int64_t)));
+
+	return true;
+}
+
+SInt64 SFB::Audio::MPEGDecoder::_RestoreStateSnapshot(SInt64 frame, const UInt8 *data, CFIndex length)
+{
+	IndexStateSnapshot snapshot;
+	if((CFIndex)sizeof(snapshot) <= length) {
+		memcpy(&snapshot, data, sizeof(snapshot));
+
+		if(kSeekIndexKind == snapshot.mKind && 0 < snapshot.mStep && 0 < snapshot.mFill && (CFIndex)(sizeof(snapshot) + (snapshot.mFill * sizeof(int64_t))) == length) {
+			std::vector<int64_t> offsets((size_t)snapshot.mFill);
+			memcpy(offsets.data(), data + sizeof(snapshot), offsets.size() * sizeof(int64_t));
+
+			SeekIndex seekIndex(snapshot.mStep, std::vector<SInt64>(offsets.begin(), offsets.end()), snapshot.mTotalFrames);
+			if(SetIndex(mDecoder.get(), seekIndex)) {
+				// A complete index supersedes one being built in the background
+				if(0 <= snapshot.mTotalFrames) {
+					mTotalFrames = snapshot.mTotalFrames;
+					mSeekIndex.reset();
+				}
+			}
+			else
+				LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.MPEG", "mpg123_set_index failed: " << mpg123_strerror(mDecoder.get()));
+		}
+	}
+
+	return _SeekToFrame(frame);
+}
+
+void SFB::Audio::MPEGDecoder::AdoptSeekIndex()
+{
+	if(!mSeekIndex || !mSeekIndex->mReady.load())
+		return;
+
+	if(SetIndex(mDecoder.get(), mSeekIndex->mIndex))
+		mTotalFrames = mSeekIndex->mIndex.GetTotalFrames();
+	else
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.MPEG", "mpg123_set_index failed: " << mpg123_strerror(mDecoder.get()));
+
+	mSeekIndex.reset();
+}
@@ -5,10 +5,14 @@
 
 #pragma once
 
+#include <memory>
+
 #include <mpg123/mpg123.h>
 
 #include "AudioDecoder.h"
 #include "AudioBufferList.h"
+#include "SamplePacking.h"
+#include "SeekIndex.h"
 
 namespace SFB {
 
@@ -28,6 +32,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
@@ -49,17 +54,34 @@ namespace SFB {
 			// Source audio information
 			virtual SInt64 _GetTotalFrames() const;
 			inline virtual SInt64 _GetCurrentFrame() const			{ return mCurrentFrame; }
+			virtual bool _IsTotalFramesEstimated() const;
 
 			// Seeking support
 			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
+			virtual SeekCost _GetSeekCost(SInt64 frame) const;
+
+			// State snapshots record mpg123's frame index, so frames are located without scanning the file
+			virtual bool _AppendStateSnapshot(SInt64 frame, CFMutableDataRef data) const;
+			virtual SInt64 _RestoreStateSnapshot(SInt64 frame, const UInt8 *data, CFIndex length);
+
+			// Reset support
+			inline virtual bool _SupportsReset() const				{ return true; }
 
 			using unique_mpg123_ptr = std::unique_ptr<mpg123_handle, std::function<void (mpg123_handle *)>>;
 
+			// Install a seek index built in the background, if ready
+			void AdoptSeekIndex();
+
+			struct PendingSeekIndex;
+
 			// Data members
-			unique_mpg123_ptr	mDecoder;
-			BufferList			mBufferList;
-			SInt64				mCurrentFrame;
+			unique_mpg123_ptr			mDecoder;
+			BufferList					mBufferList;
+			SamplePacking::Deinterleaver	mDeinterleave;
+			SInt64						mCurrentFrame;
+			SInt64						mTotalFrames;
+			std::shared_ptr<PendingSeekIndex>	mSeekIndex;
 		};
 
 	}
@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "MultiFileDecoder.h"
+#include "CFErrorUtilities.h"
+#include "Logger.h"
+
+// The number of frames converted per pass for stems not providing float
+#define BUFFER_SIZE_FRAMES 4096
+
+namespace {
+
+	bool IsFloatNonInterleaved(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && !format.IsInterleaved() && format.IsNativeEndian();
+	}
+
+	// Non-interleaved 32-bit float with the specified sample rate and channels
+	SFB::Audio::AudioFormat CanonicalFloatFormat(Float64 sampleRate, UInt32 channelCount)
+	{
+		SFB::Audio::AudioFormat format;
+
+		format.mFormatID			= kAudioFormatLinearPCM;
+		format.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+
+		format.mSampleRate			= sampleRate;
+		format.mChannelsPerFrame	= channelCount;
+		format.mBitsPerChannel		= 32;
+
+		format.mBytesPerPacket		= format.mBitsPerChannel / 8;
+		format.mFramesPerPacket		= 1;
+		format.mBytesPerFrame		= format.mBytesPerPacket * format.mFramesPerPacket;
+
+		format.mReserved			= 0;
+
+		return format;
+	}
+
+}
+
+#pragma mark Factory Methods
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::MultiFileDecoder::CreateForURLs(CFArrayRef urls, CFErrorRef *error)
+{
+	if(nullptr == urls || 0 == CFArrayGetCount(urls))
+		return nullptr;
+
+	std::vector<Decoder::unique_ptr> decoders;
+	for(CFIndex i = 0; i < CFArrayGetCount(urls); ++i) {
+		auto decoder = Decoder::CreateForURL((CFURLRef)CFArrayGetValueAtIndex(urls, i), error);
+		if(!decoder)
+			return nullptr;
+		decoders.push_back(std::move(decoder));
+	}
+
+	return CreateForDecoders(std::move(decoders), error);
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::MultiFileDecoder::CreateForDecoders(std::vector<unique_ptr> decoders, CFErrorRef *error)
+{
+#pragma unused(error)
+
+	if(decoders.empty() || std::any_of(decoders.begin(), decoders.end(), [](const unique_ptr& decoder) { return !decoder; }))
+		return nullptr;
+
+	return unique_ptr(new MultiFileDecoder(std::move(decoders)));
+}
+
+SFB::Audio::MultiFileDecoder::MultiFileDecoder(std::vector<Decoder::unique_ptr> decoders)
+	: mQueue(nullptr), mCurrentFrame(0)
+{
+	for(auto& decoder : decoders) {
+		std::unique_ptr<Stem> stem(new Stem);
+		stem->mDecoder = std::move(decoder);
+		stem->mFirstChannel = 0;
+		stem->mConverter = nullptr;
+		stem->mFinished = false;
+		mStems.push_back(std::move(stem));
+	}
+
+	auto attributes = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_CONCURRENT, QOS_CLASS_USER_INITIATED, 0);
+	mQueue = dispatch_queue_create("org.sbooth.AudioEngine.Decoder.MultiFile", attributes);
+}
+
+SFB::Audio::MultiFileDecoder::~MultiFileDecoder()
+{
+	if(IsOpen())
+		Close();
+
+	if(mQueue)
+		dispatch_release(mQueue);
+}
+
+bool SFB::Audio::MultiFileDecoder::_Open(CFErrorRef *error)
+{
+	auto stemCount = mStems.size();
+
+	// The stems are opened concurrently, and asked to provide float so their audio is decoded directly into the combined stream
+	std::vector<CFErrorRef> stemErrors(stemCount, nullptr);
+	auto stemErrorsData = stemErrors.data();
+	dispatch_apply(stemCount, mQueue, ^(size_t i) {
+		auto& decoder = *mStems[i]->mDecoder;
+		if(!decoder.IsOpen()) {
+			decoder.SetPreferredFormat(CanonicalFloatFormat(0, 0));
+			if(!decoder.Open(&stemErrorsData[i]) && nullptr == stemErrorsData[i])
+				stemErrorsData[i] = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EIO, nullptr);
+		}
+	});
+
+	auto failedStem = std::find_if(stemErrors.begin(), stemErrors.end(), [](CFErrorRef stemError) { return nullptr != stemError; });
+	if(failedStem != stemErrors.end()) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.MultiFile", "Unable to open stem " << (failedStem - stemErrors.begin()));
+
+		if(error) {
+			*error = *failedStem;
+			*failedStem = nullptr;
+		}
+
+		for(auto stemError : stemErrors) {
+			if(stemError)
+				CFRelease(stemError);
+		}
+
+		_Close(nullptr);
+		return false;
+	}
+
+	Float64 sampleRate = mStems.front()->mDecoder->GetFormat().mSampleRate;
+	UInt32 channelCount = 0;
+
+	for(auto& stem : mStems) {
+		const auto& decoderFormat = stem->mDecoder->GetFormat();
+
+		if(!decoderFormat.IsPCM() || decoderFormat.mSampleRate != sampleRate) {
+			if(error) {
+				SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” can't be played with the other files."), ""));
+				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Incompatible format"), ""));
+				SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("All files must contain PCM audio at the same sample rate."), ""));
+
+				*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::FileFormatNotSupportedError, description, stem->mDecoder->GetURL(), failureReason, recoverySuggestion);
+			}
+
+			_Close(nullptr);
+			return false;
+		}
+
+		// Other PCM formats are converted to float without resampling
+		if(!IsFloatNonInterleaved(decoderFormat)) {
+			auto stemFormat = CanonicalFloatFormat(sampleRate, decoderFormat.mChannelsPerFrame);
+			auto result = AudioConverterNew(&decoderFormat, &stemFormat, &stem->mConverter);
+			if(noErr != result) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.MultiFile", "AudioConverterNew failed: " << result);
+
+				if(error)
+					*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainOSStatus, result, nullptr);
+
+				_Close(nullptr);
+				return false;
+			}
+
+			if(!stem->mDecoderBuffer.Allocate(decoderFormat, BUFFER_SIZE_FRAMES)) {
+				if(error)
+					*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
+				_Close(nullptr);
+				return false;
+			}
+		}
+
+		stem->mFirstChannel = channelCount;
+		stem->mFinished = false;
+		channelCount += decoderFormat.mChannelsPerFrame;
+	}
+
+	mFormat = CanonicalFloatFormat(sampleRate, channelCount);
+	mChannelLayout = ChannelLayout::ChannelLayoutWithTag(kAudioChannelLayoutTag_DiscreteInOrder | channelCount);
+
+	mSourceFormat = mStems.front()->mDecoder->GetSourceFormat();
+	mSourceFormat.mChannelsPerFrame = channelCount;
+
+	mCurrentFrame = 0;
+
+	return true;
+}
+
+bool SFB::Audio::MultiFileDecoder::_Close(CFErrorRef *error)
+{
+	bool result = true;
+
+	for(auto& stem : mStems) {
+		if(stem->mDecoder->IsOpen() && !stem->mDecoder->Close(error))
+			result = false;
+
+		if(stem->mConverter) {
+			auto status = AudioConverterDispose(stem->mConverter);
+			if(noErr != status)
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.MultiFile", "AudioConverterDispose failed: " << status);
+			stem->mConverter = nullptr;
+		}
+
+		stem->mDecoderBuffer.Deallocate();
+	}
+
+	return result;
+}
+
+SFB::CFString SFB::Audio::MultiFileDecoder::_GetSourceFormatDescription() const
+{
+	SFB::CFString sourceFormatDescription(mStems.front()->mDecoder->CreateSourceFormatDescription());
+	return CFString(nullptr, CFSTR("%lu stems, first %@"), (unsigned long)mStems.size(), (CFStringRef)sourceFormatDescription);
+}
+
+#pragma mark Functionality
+
+UInt32 SFB::Audio::MultiFileDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(bufferList->mNumberBuffers != mFormat.mChannelsPerFrame) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.MultiFile", "_ReadAudio() called with invalid parameters");
+		return 0;
+	}
+
+	auto stemCount = mStems.size();
+	auto framesRead = (UInt32 *)alloca(sizeof(UInt32) * stemCount);
+
+	// Each stem decodes into its own channels
+	dispatch_apply(stemCount, mQueue, ^(size_t i) {
+		framesRead[i] = ReadStem(*mStems[i], bufferList, 0, frameCount);
+	});
+
+	UInt32 framesProvided = *std::max_element(framesRead, framesRead + stemCount);
+
+	// Stems that ended are padded to the longest
+	for(size_t i = 0; i < stemCount; ++i) {
+		if(framesRead[i] == framesProvided)
+			continue;
+
+		const auto& stem = *mStems[i];
+		for(UInt32 channel = 0; channel < stem.mDecoder->GetFormat().mChannelsPerFrame; ++channel)
+			std::memset((float *)bufferList->mBuffers[stem.mFirstChannel + channel].mData + framesRead[i], 0, (framesProvided - framesRead[i]) * sizeof(float));
+	}
+
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+		bufferList->mBuffers[i].mDataByteSize = (UInt32)(framesProvided * sizeof(float));
+
+	mCurrentFrame += framesProvided;
+
+	return framesProvided;
+}
+
+SInt64 SFB::Audio::MultiFileDecoder::_GetTotalFrames() const
+{
+	SInt64 totalFrames = 0;
+	for(const auto& stem : mStems) {
+		auto stemFrames = stem->mDecoder->GetTotalFrames();
+		if(-1 == stemFrames)
+			return -1;
+		totalFrames = std::max(totalFrames, stemFrames);
+	}
+
+	return totalFrames;
+}
+
+bool SFB::Audio::MultiFileDecoder::_SupportsSeeking() const
+{
+	return std::all_of(mStems.begin(), mStems.end(), [](const std::unique_ptr<Stem>& stem) { return stem->mDecoder->SupportsSeeking(); });
+}
+
+SInt64 SFB::Audio::MultiFileDecoder::_SeekToFrame(SInt64 frame)
+{
+	auto stemCount = mStems.size();
+	std::vector<char> seeked(stemCount, false);
+	auto seekedData = seeked.data();
+
+	// All stems are seeked to the same frame; stems ending before it remain silent
+	dispatch_apply(stemCount, mQueue, ^(size_t i) {
+		auto& stem = *mStems[i];
+		auto stemFrames = stem.mDecoder->GetTotalFrames();
+		if(-1 != stemFrames && frame >= stemFrames) {
+			stem.mFinished = true;
+			seekedData[i] = true;
+			return;
+		}
+
+		stem.mFinished = false;
+		seekedData[i] = (frame == stem.mDecoder->SeekToFrame(frame));
+
+		if(stem.mConverter)
+			AudioConverterReset(stem.mConverter);
+	});
+
+	for(size_t i = 0; i < stemCount; ++i) {
+		if(!seeked[i]) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.MultiFile", "Unable to seek stem " << i << " to frame " << frame);
+			return -1;
+		}
+	}
+
+	mCurrentFrame = frame;
+	return mCurrentFrame;
+}
+
+SFB::Audio::Decoder::SeekCost SFB::Audio::MultiFileDecoder::_GetSeekCost(SInt64 frame) const
+{
+	// The cost is that of the most expensive stem
+	SeekCost seekCost = SeekCostConstant;
+	for(const auto& stem : mStems) {
+		auto stemCost = stem->mDecoder->GetSeekCost(frame);
+		if(SeekCostUnsupported == stemCost)
+			return SeekCostUnsupported;
+		seekCost = std::max(seekCost, stemCost);
+	}
+
+	return seekCost;
+}
+
+UInt32 SFB::Audio::MultiFileDecoder::ReadStem(Stem& stem, AudioBufferList *bufferList, UInt32 frameOffset, UInt32 frameCount)
+{
+	UInt32 channelCount = stem.mDecoder->GetFormat().mChannelsPerFrame;
+
+	// An alias to the stem's channels in the combined buffer
+	auto stemBufferList = (AudioBufferList *)alloca(offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * channelCount));
+	stemBufferList->mNumberBuffers = channelCount;
+
+	UInt32 framesRead = 0;
+
+	while(!stem.mFinished && framesRead < frameCount) {
+		UInt32 framesToRead = frameCount - framesRead;
+		if(stem.mConverter)
+			framesToRead = std::min(framesToRead, stem.mDecoderBuffer.GetCapacityFrames());
+
+		for(UInt32 i = 0; i < channelCount; ++i) {
+			stemBufferList->mBuffers[i].mNumberChannels	= 1;
+			stemBufferList->mBuffers[i].mData			= (float *)bufferList->mBuffers[stem.mFirstChannel + i].mData + frameOffset + framesRead;
+			stemBufferList->mBuffers[i].mDataByteSize	= (UInt32)(framesToRead * sizeof(float));
+		}
+
+		UInt32 framesDecoded;
+		if(stem.mConverter) {
+			stem.mDecoderBuffer.Reset();
+			framesDecoded = stem.mDecoder->ReadAudio(stem.mDecoderBuffer, framesToRead);
+			if(0 < framesDecoded) {
+				auto result = AudioConverterConvertComplexBuffer(stem.mConverter, framesDecoded, stem.mDecoderBuffer, stemBufferList);
+				if(noErr != result) {
+					LOGGER_ERR("org.sbooth.AudioEngine.Decoder.MultiFile", "AudioConverterConvertComplexBuffer failed: " << result);
+					framesDecoded = 0;
+				}
+			}
+		}
+		else
+			framesDecoded = stem.mDecoder->ReadAudio(stemBufferList, framesToRead);
+
+		// The stem is silent from the end of its audio
+		if(0 == framesDecoded) {
+			stem.mFinished = true;
+			break;
+		}
+
+		framesRead += framesDecoded;
+	}
+
+	return framesRead;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <dispatch/dispatch.h>
+
+#include "AudioDecoder.h"
+#include "AudioBufferList.h"
+
+/*! @file MultiFileDecoder.h @brief Support for decoding several files in lockstep */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A wrapper around several Decoders providing their audio as a single multichannel stream
+		 *
+		 * Each wrapped decoder, or stem, contributes its channels in order to non-interleaved 32-bit floating point
+		 * PCM with the channels of all stems.  Every read and seek is applied to all stems at the same frame, with
+		 * the stems decoded concurrently, so the stems remain sample-locked through a single ring buffer and output.
+		 * Stems shorter than the longest are padded with silence.
+		 * @note All stems must provide PCM at the same sample rate
+		 */
+		class MultiFileDecoder : public Decoder
+		{
+
+		public:
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*!
+			 * @brief Create a \c MultiFileDecoder object for the specified URLs
+			 * @param urls A \c CFArray of \c CFURL objects, one per stem
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c MultiFileDecoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForURLs(CFArrayRef urls, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create a \c MultiFileDecoder object for the specified \c Decoder objects
+			 * @param decoders The decoders, one per stem
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c MultiFileDecoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForDecoders(std::vector<unique_ptr> decoders, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Destroy this \c MultiFileDecoder */
+			virtual ~MultiFileDecoder();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			MultiFileDecoder(const MultiFileDecoder& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			MultiFileDecoder& operator=(const MultiFileDecoder& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			// ========================================
+			/*! @name Stems */
+			//@{
+
+			/*! @brief Get the number of stems */
+			inline size_t GetStemCount() const						{ return mStems.size(); }
+
+			/*! @brief Get the decoder for a stem */
+			inline const Decoder& GetStemDecoder(size_t stem) const	{ return *mStems[stem]->mDecoder; }
+
+			/*! @brief Get the index of the first channel of a stem in the combined stream */
+			inline UInt32 GetStemFirstChannel(size_t stem) const	{ return mStems[stem]->mFirstChannel; }
+
+			//@}
+
+		private:
+
+			struct Stem {
+				Decoder::unique_ptr		mDecoder;
+				UInt32					mFirstChannel;		// The stem's first channel in the combined stream
+				AudioConverterRef		mConverter;			// Converts the decoder's audio to float, if required
+				BufferList				mDecoderBuffer;		// The decoder's audio, if conversion is required
+				bool					mFinished;			// Whether the stem has no more audio at the current position
+			};
+
+			MultiFileDecoder() = delete;
+			explicit MultiFileDecoder(std::vector<Decoder::unique_ptr> decoders);
+
+			// Source access
+			inline virtual CFURLRef _GetURL() const					{ return mStems.front()->mDecoder->GetURL(); }
+			inline virtual InputSource& _GetInputSource() const		{ return mStems.front()->mDecoder->GetInputSource(); }
+
+			// Audio access
+			virtual bool _Open(CFErrorRef *error);
+			virtual bool _Close(CFErrorRef *error);
+
+			// The native format of the source audio
+			virtual SFB::CFString _GetSourceFormatDescription() const;
+
+			// Attempt to read frameCount frames of audio, returning the actual number of frames read
+			virtual UInt32 _ReadAudio(AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Source audio information
+			virtual SInt64 _GetTotalFrames() const;
+			inline virtual SInt64 _GetCurrentFrame() const			{ return mCurrentFrame; }
+
+			// Seeking support
+			virtual bool _SupportsSeeking() const;
+			virtual SInt64 _SeekToFrame(SInt64 frame);
+			virtual SeekCost _GetSeekCost(SInt64 frame) const;
+
+			// Read up to frameCount frames from a stem into its channels of bufferList at frameOffset
+			UInt32 ReadStem(Stem& stem, AudioBufferList *bufferList, UInt32 frameOffset, UInt32 frameCount);
+
+			// Data members
+			std::vector<std::unique_ptr<Stem>>	mStems;
+			dispatch_queue_t		mQueue;				// The concurrent queue on which stems are decoded
+			SInt64					mCurrentFrame;
+		};
+
+	}
+}
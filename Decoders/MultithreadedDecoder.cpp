@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#include "MultithreadedDecoder.h"
+#include "AudioBufferList.h"
+#include "Logger.h"
+
+namespace {
+
+	// Each thread may decode one segment ahead of the segment being read
+	const size_t kSegmentsPerThread = 2;
+
+	// Point the buffers in view at those of bufferList, offset by frameOffset frames
+	void SetBufferListView(AudioBufferList *view, const AudioBufferList *bufferList, UInt32 bytesPerFrame, UInt32 frameOffset, UInt32 capacityFrames)
+	{
+		view->mNumberBuffers = bufferList->mNumberBuffers;
+		for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+			view->mBuffers[i].mNumberChannels	= bufferList->mBuffers[i].mNumberChannels;
+			view->mBuffers[i].mData				= (uint8_t *)bufferList->mBuffers[i].mData + (frameOffset * bytesPerFrame);
+			view->mBuffers[i].mDataByteSize		= capacityFrames * bytesPerFrame;
+		}
+	}
+
+}
+
+// A decoded segment in the reorder buffer
+struct SFB::Audio::MultithreadedDecoder::Segment
+{
+	Segment(const AudioFormat& format, UInt32 capacityFrames)
+		: mBufferList(format, capacityFrames), mIndex(-1), mFrameCount(0), mReady(false), mBusy(false)
+	{}
+
+	BufferList	mBufferList;
+	SInt64		mIndex;
+	UInt32		mFrameCount;
+	bool		mReady;		// The segment holds the decoded audio for mIndex
+	bool		mBusy;		// A worker is decoding into the segment
+};
+
+#pragma mark Factory Methods
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::MultithreadedDecoder::CreateForURL(CFURLRef url, size_t threadCount, CFErrorRef *error)
+{
+	return CreateForDecoder(Decoder::CreateForURL(url, error), threadCount, DefaultSegmentFrames, error);
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::MultithreadedDecoder::CreateForDecoder(Decoder::unique_ptr decoder, size_t threadCount, UInt32 segmentFrames, CFErrorRef */*error*/)
+{
+	if(!decoder || 0 == segmentFrames)
+		return nullptr;
+
+	return unique_ptr(new MultithreadedDecoder(std::move(decoder), threadCount, segmentFrames));
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::MultithreadedDecoder::MultithreadedDecoder(Decoder::unique_ptr decoder, size_t threadCount, UInt32 segmentFrames)
+	: mDecoder(std::move(decoder)), mThreadCount(threadCount), mSegmentFrames(segmentFrames), mReadDirectly(true), mSegmentCount(0), mNextSegment(0), mNextDelivery(0), mDeliveryOffset(0), mGeneration(0), mStopping(false)
+{
+	if(!mDecoder)
+		throw std::runtime_error("mDecoder may not be nullptr");
+}
+
+SFB::Audio::MultithreadedDecoder::~MultithreadedDecoder()
+{
+	if(IsOpen())
+		Close();
+}
+
+bool SFB::Audio::MultithreadedDecoder::_Open(CFErrorRef *error)
+{
+	if(!mDecoder->IsOpen() && !mDecoder->Open(error))
+		return false;
+
+	mFormat			= mDecoder->GetFormat();
+	mChannelLayout	= mDecoder->GetChannelLayout();
+	mSourceFormat	= mDecoder->GetSourceFormat();
+
+	size_t threadCount = 0 != mThreadCount ? mThreadCount : std::max(1u, std::thread::hardware_concurrency());
+	SInt64 totalFrames = mDecoder->GetTotalFrames();
+
+	// ========================================
+	// Read directly from the decoder if the audio can't be split into accurately seekable segments
+	mReadDirectly = true;
+	if(1 == threadCount || totalFrames <= mSegmentFrames || nullptr == mDecoder->GetURL() || !mDecoder->SupportsSeeking() || !mFormat.IsPCM() || 1 != mFormat.mFramesPerPacket)
+		return true;
+
+	mSegmentCount = (totalFrames + mSegmentFrames - 1) / mSegmentFrames;
+	threadCount = (size_t)std::min((SInt64)threadCount, mSegmentCount);
+
+	// ========================================
+	// Open one decoder for each thread, leaving mDecoder free for use on the calling thread
+	while(mWorkerDecoders.size() < threadCount) {
+		auto decoder = Decoder::CreateForURL(mDecoder->GetURL());
+		if(!decoder || (!decoder->IsOpen() && !decoder->Open()) || decoder->GetFormat() != mFormat || decoder->GetTotalFrames() != totalFrames) {
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.Multithreaded", "Unable to open decoder for thread " << mWorkerDecoders.size());
+			break;
+		}
+		mWorkerDecoders.push_back(std::move(decoder));
+	}
+
+	threadCount = mWorkerDecoders.size();
+	if(2 > threadCount) {
+		mWorkerDecoders.clear();
+		return true;
+	}
+
+	try {
+		for(size_t i = 0; i < std::min((SInt64)(kSegmentsPerThread * threadCount), mSegmentCount); ++i)
+			mSegments.push_back(std::unique_ptr<Segment>(new Segment(mFormat, mSegmentFrames)));
+	}
+
+	catch(const std::bad_alloc&) {
+		mSegments.clear();
+		mWorkerDecoders.clear();
+		mDecoder->Close();
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+		return false;
+	}
+
+	mNextSegment = mNextDelivery = mDecoder->GetCurrentFrame() / mSegmentFrames;
+	mDeliveryOffset = (UInt32)(mDecoder->GetCurrentFrame() % mSegmentFrames);
+	mStopping = false;
+
+	// ========================================
+	// Start the worker threads
+	try {
+		for(auto& decoder : mWorkerDecoders)
+			mThreads.push_back(std::thread(&MultithreadedDecoder::DecodeSegments, this, decoder.get()));
+	}
+
+	catch(const std::system_error& e) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.Multithreaded", "Unable to create decoding thread: " << e.what());
+	}
+
+	if(mThreads.empty()) {
+		mSegments.clear();
+		mWorkerDecoders.clear();
+		return true;
+	}
+
+	mReadDirectly = false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Decoder.Multithreaded", "Decoding " << mSegmentCount << " segments using " << mThreads.size() << " threads");
+
+	return true;
+}
+
+bool SFB::Audio::MultithreadedDecoder::_Close(CFErrorRef *error)
+{
+	StopThreads();
+
+	mSegments.clear();
+	mWorkerDecoders.clear();
+	mReadDirectly = true;
+
+	if(!mDecoder->Close(error))
+		return false;
+
+	return true;
+}
+
+SFB::CFString SFB::Audio::MultithreadedDecoder::_GetSourceFormatDescription() const
+{
+	return CFString(mDecoder->CreateSourceFormatDescription());
+}
+
+#pragma mark Functionality
+
+UInt32 SFB::Audio::MultithreadedDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(mReadDirectly)
+		return mDecoder->ReadAudio(bufferList, frameCount);
+
+	if(bufferList->mNumberBuffers != mSegments[0]->mBufferList->mNumberBuffers) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.Multithreaded", "_ReadAudio() called with invalid parameters");
+		return 0;
+	}
+
+	UInt32 framesRead = 0;
+	while(framesRead < frameCount) {
+		Segment *segment = nullptr;
+
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			if(mNextDelivery >= mSegmentCount)
+				break;
+
+			segment = GetSegment(mNextDelivery);
+			mCondition.wait(lock, [this, segment]() { return mNextDelivery >= mSegmentCount || (segment->mReady && segment->mIndex == mNextDelivery); });
+			if(!segment->mReady || segment->mIndex != mNextDelivery)
+				break;
+
+			// The offset following a seek may lie past the end of a short final segment
+			if(mDeliveryOffset >= segment->mFrameCount) {
+				mSegmentCount = mNextDelivery;
+				break;
+			}
+		}
+
+		// Segments are only invalidated on this thread, so the audio may be copied without holding the lock
+		UInt32 framesToCopy = std::min(frameCount - framesRead, segment->mFrameCount - mDeliveryOffset);
+		for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+			memcpy((uint8_t *)bufferList->mBuffers[i].mData + (framesRead * mFormat.mBytesPerFrame), (const uint8_t *)segment->mBufferList->mBuffers[i].mData + (mDeliveryOffset * mFormat.mBytesPerFrame), framesToCopy * mFormat.mBytesPerFrame);
+
+		framesRead += framesToCopy;
+		mDeliveryOffset += framesToCopy;
+
+		// Release the segment for reuse once it has been read
+		if(mDeliveryOffset == segment->mFrameCount) {
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			// A short segment marks the end of the audio since the frame count may be inexact
+			if(segment->mFrameCount < mSegmentFrames)
+				mSegmentCount = mNextDelivery + 1;
+
+			segment->mReady = false;
+			++mNextDelivery;
+			mDeliveryOffset = 0;
+			mCondition.notify_all();
+		}
+	}
+
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+		bufferList->mBuffers[i].mDataByteSize = framesRead * mFormat.mBytesPerFrame;
+
+	return framesRead;
+}
+
+SInt64 SFB::Audio::MultithreadedDecoder::_GetCurrentFrame() const
+{
+	if(mReadDirectly)
+		return mDecoder->GetCurrentFrame();
+
+	return (mNextDelivery * mSegmentFrames) + mDeliveryOffset;
+}
+
+SInt64 SFB::Audio::MultithreadedDecoder::_SeekToFrame(SInt64 frame)
+{
+	if(mReadDirectly)
+		return mDecoder->SeekToFrame(frame);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	// Segments in progress are discarded when their workers finish
+	++mGeneration;
+	for(auto& segment : mSegments)
+		segment->mReady = false;
+
+	mSegmentCount = (mDecoder->GetTotalFrames() + mSegmentFrames - 1) / mSegmentFrames;
+	mNextSegment = mNextDelivery = frame / mSegmentFrames;
+	mDeliveryOffset = (UInt32)(frame % mSegmentFrames);
+
+	mCondition.notify_all();
+
+	return frame;
+}
+
+void SFB::Audio::MultithreadedDecoder::DecodeSegments(Decoder *decoder)
+{
+	UInt32 numBuffers = mFormat.IsInterleaved() ? 1 : mFormat.mChannelsPerFrame;
+	std::unique_ptr<uint8_t []> viewStorage(new uint8_t [offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * numBuffers)]);
+	auto view = (AudioBufferList *)viewStorage.get();
+
+	for(;;) {
+		SInt64 segmentIndex;
+		Segment *segment;
+		UInt64 generation;
+
+		// ========================================
+		// Claim the next segment once its buffer has been read
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, [this]() {
+				return mStopping || (mNextSegment < mSegmentCount && mNextSegment < mNextDelivery + (SInt64)mSegments.size() && !GetSegment(mNextSegment)->mBusy);
+			});
+
+			if(mStopping)
+				return;
+
+			segmentIndex = mNextSegment++;
+			segment = GetSegment(segmentIndex);
+			segment->mBusy = true;
+			segment->mReady = false;
+			generation = mGeneration;
+		}
+
+		// ========================================
+		// Decode exactly the frames in the segment
+		SInt64 startingFrame = segmentIndex * mSegmentFrames;
+		bool result = decoder->GetCurrentFrame() == startingFrame || decoder->SeekToFrame(startingFrame) == startingFrame;
+		if(!result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Multithreaded", "Unable to seek to frame " << startingFrame);
+
+		UInt32 framesDecoded = 0;
+		while(result && framesDecoded < mSegmentFrames) {
+			SetBufferListView(view, segment->mBufferList, mFormat.mBytesPerFrame, framesDecoded, mSegmentFrames - framesDecoded);
+			UInt32 framesRead = decoder->ReadAudio(view, mSegmentFrames - framesDecoded);
+			if(0 == framesRead)
+				break;
+			framesDecoded += framesRead;
+		}
+
+		// A short segment is only expected at the end of the audio
+		if(result && 0 == framesDecoded) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Multithreaded", "Segment " << segmentIndex << " contains no audio");
+			result = false;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			segment->mBusy = false;
+			if(generation == mGeneration) {
+				if(result) {
+					segment->mIndex = segmentIndex;
+					segment->mFrameCount = framesDecoded;
+					segment->mReady = true;
+				}
+				// Treat the failure as the end of the audio
+				else
+					mSegmentCount = std::min(mSegmentCount, segmentIndex);
+			}
+			mCondition.notify_all();
+		}
+	}
+}
+
+void SFB::Audio::MultithreadedDecoder::StopThreads()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+		mCondition.notify_all();
+	}
+
+	for(auto& thread : mThreads)
+		thread.join();
+
+	mThreads.clear();
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "AudioDecoder.h"
+
+/*! @file MultithreadedDecoder.h @brief Read-ahead decoding using multiple threads */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A wrapper around a Decoder that decodes ahead using multiple threads
+		 *
+		 * The audio is divided into fixed-size segments that are decoded concurrently by worker threads, each using
+		 * its own \c Decoder opened on the same URL, into a reorder buffer from which \c ReadAudio() is served in order.
+		 * This allows CPU-bound formats such as Monkey's Audio at high compression levels and WavPack in high or
+		 * extra modes to be decoded faster than real time on multi-core systems.
+		 *
+		 * Segments should be large in relation to the format's independently decodable blocks, since each segment
+		 * begins with a seek.  The wrapped decoder must be seekable, sample-accurate, and produce PCM with a known
+		 * frame count; otherwise it is read directly on the calling thread.
+		 */
+		class MultithreadedDecoder : public Decoder
+		{
+
+		public:
+
+			/*! @brief The default number of frames in a segment */
+			static const UInt32 DefaultSegmentFrames = 1 << 18;
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*!
+			 * @brief Create a \c MultithreadedDecoder object for the specified URL
+			 * @param url The URL
+			 * @param threadCount The number of decoding threads, or \c 0 for one thread per processor core
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c MultithreadedDecoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForURL(CFURLRef url, size_t threadCount, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create a \c MultithreadedDecoder object for the specified \c Decoder
+			 * @note Additional decoders are opened on the URL of \c decoder
+			 * @param decoder The decoder
+			 * @param threadCount The number of decoding threads, or \c 0 for one thread per processor core
+			 * @param segmentFrames The number of frames in each independently decoded segment
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c MultithreadedDecoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForDecoder(unique_ptr decoder, size_t threadCount = 0, UInt32 segmentFrames = DefaultSegmentFrames, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Destroy this \c MultithreadedDecoder */
+			virtual ~MultithreadedDecoder();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			MultithreadedDecoder(const MultithreadedDecoder& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			MultithreadedDecoder& operator=(const MultithreadedDecoder& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+		private:
+
+			struct Segment;
+
+			// Creation
+			MultithreadedDecoder() = delete;
+			MultithreadedDecoder(Decoder::unique_ptr decoder, size_t threadCount, UInt32 segmentFrames);
+
+			// Source access
+			inline virtual CFURLRef _GetURL() const					{ return mDecoder->GetURL(); }
+			inline virtual InputSource& _GetInputSource() const		{ return mDecoder->GetInputSource(); }
+
+			// Audio access
+			virtual bool _Open(CFErrorRef *error);
+			virtual bool _Close(CFErrorRef *error);
+
+			// The native format of the source audio
+			virtual SFB::CFString _GetSourceFormatDescription() const;
+
+			// Attempt to read frameCount frames of audio, returning the actual number of frames read
+			virtual UInt32 _ReadAudio(AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Source audio information
+			inline virtual SInt64 _GetTotalFrames() const			{ return mDecoder->GetTotalFrames(); }
+			virtual SInt64 _GetCurrentFrame() const;
+			inline virtual bool _IsTotalFramesEstimated() const	{ return mDecoder->IsTotalFramesEstimated(); }
+
+			// Seeking support
+			inline virtual bool _SupportsSeeking() const			{ return mDecoder->SupportsSeeking(); }
+			virtual SInt64 _SeekToFrame(SInt64 frame);
+			inline virtual SeekCost _GetSeekCost(SInt64 frame) const	{ return mDecoder->GetSeekCost(frame); }
+
+			// The segment holding segmentIndex
+			inline Segment * GetSegment(SInt64 segmentIndex) const	{ return mSegments[(size_t)(segmentIndex % (SInt64)mSegments.size())].get(); }
+
+			// Worker thread entry point
+			void DecodeSegments(Decoder *decoder);
+
+			// Stop and join the worker threads
+			void StopThreads();
+
+			// Data members
+			Decoder::unique_ptr						mDecoder;
+			std::vector<Decoder::unique_ptr>		mWorkerDecoders;
+			size_t									mThreadCount;
+			UInt32									mSegmentFrames;
+			bool									mReadDirectly;
+
+			std::vector<std::unique_ptr<Segment>>	mSegments;
+			std::vector<std::thread>				mThreads;
+			std::mutex								mMutex;
+			std::condition_variable					mCondition;
+
+			SInt64									mSegmentCount;
+			SInt64									mNextSegment;		// The next segment to be decoded
+			SInt64									mNextDelivery;		// The segment being read
+			UInt32									mDeliveryOffset;	// The frame offset in the segment being read
+			UInt64									mGeneration;		// Incremented by seeks to invalidate segments in progress
+			bool									mStopping;
+		};
+
+	}
+}
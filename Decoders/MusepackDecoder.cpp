@@ -7,6 +7,8 @@
 #include <Accelerate/Accelerate.h>
 
 #include <algorithm>
+#include <list>
+#include <mutex>
 
 #include "MusepackDecoder.h"
 #include "CFWrapper.h"
@@ -63,6 +65,81 @@ namespace {
 		return decoder->GetInputSource().SupportsSeeking();
 	}
 
+#pragma mark Demuxer Cache
+
+	// libmpcdec builds a seek table as a file without one is decoded, but provides no way to save or restore it.
+	// Instead closed demuxers are retained, keyed by the file's path and validated against its identity and modification
+	// time, so reopening a recently used file doesn't rescan it to seek.
+	const size_t kDemuxerCacheMaximumEntries = 4;
+
+	struct CachedDemuxer
+	{
+		std::string						mPath;
+		dev_t							mDevice;
+		ino_t							mInode;
+		off_t							mSize;
+		struct timespec					mModificationTime;
+		std::unique_ptr<mpc_reader>		mReader;
+		mpc_demux						*mDemux;
+
+		bool Matches(const std::string& path, const struct stat& sb) const
+		{
+			return mPath == path && mDevice == sb.st_dev && mInode == sb.st_ino && mSize == sb.st_size && mModificationTime.tv_sec == sb.st_mtimespec.tv_sec && mModificationTime.tv_nsec == sb.st_mtimespec.tv_nsec;
+		}
+	};
+
+	std::mutex sDemuxerCacheMutex;
+
+	// The cache is never destroyed so decoders with static storage duration may safely outlive it
+	std::list<CachedDemuxer>& DemuxerCache()
+	{
+		static std::list<CachedDemuxer> *sDemuxerCache = new std::list<CachedDemuxer>;
+		return *sDemuxerCache;
+	}
+
+	// Remove and return the cached demuxer for path, or nullptr if none is cached
+	mpc_demux * TakeCachedDemuxer(const std::string& path, const struct stat& sb, std::unique_ptr<mpc_reader>& reader)
+	{
+		std::lock_guard<std::mutex> lock(sDemuxerCacheMutex);
+
+		auto& cache = DemuxerCache();
+		for(auto iter = cache.begin(); iter != cache.end(); ++iter) {
+			if(iter->mPath != path)
+				continue;
+
+			mpc_demux *demux = nullptr;
+			if(iter->Matches(path, sb)) {
+				demux = iter->mDemux;
+				reader = std::move(iter->mReader);
+			}
+			// The file has changed
+			else
+				mpc_demux_exit(iter->mDemux);
+
+			cache.erase(iter);
+			return demux;
+		}
+
+		return nullptr;
+	}
+
+	// Cache demux and the reader it uses
+	void CacheDemuxer(const std::string& path, const struct stat& sb, std::unique_ptr<mpc_reader> reader, mpc_demux *demux)
+	{
+		// The reader isn't used while the demuxer is cached
+		reader->data = nullptr;
+
+		std::lock_guard<std::mutex> lock(sDemuxerCacheMutex);
+
+		auto& cache = DemuxerCache();
+		cache.push_front({ path, sb.st_dev, sb.st_ino, sb.st_size, sb.st_mtimespec, std::move(reader), demux });
+
+		while(cache.size() > kDemuxerCacheMaximumEntries) {
+			mpc_demux_exit(cache.back().mDemux);
+			cache.pop_back();
+		}
+	}
+
 }
 
 #pragma mark Static Methods
@@ -104,6 +181,15 @@ bool SFB::Audio::MusepackDecoder::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::MusepackDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	// SV8 and SV7 streams
+	return (4 <= length && 0 == memcmp(header, "MPCK", 4)) || (3 <= length && 0 == memcmp(header, "MP+", 3));
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::MusepackDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new MusepackDecoder(std::move(inputSource)));
@@ -112,7 +198,7 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::MusepackDecoder::CreateDecoder(Input
 #pragma mark Creation and Destruction
 
 SFB::Audio::MusepackDecoder::MusepackDecoder(InputSource::unique_ptr inputSource)
-	: Decoder(std::move(inputSource)), mDemux(nullptr), mTotalFrames(0), mCurrentFrame(0)
+	: Decoder(std::move(inputSource)), mDemux(nullptr), mFileStatus{}, mDeinterleave(nullptr), mTotalFrames(0), mCurrentFrame(0)
 {}
 
 SFB::Audio::MusepackDecoder::~MusepackDecoder()
@@ -131,14 +217,35 @@ bool SFB::Audio::MusepackDecoder::_Open(CFErrorRef *error)
 	if(!CFURLGetFileSystemRepresentation(mInputSource->GetURL(), FALSE, buf, PATH_MAX))
 		return false;
 
-	mReader.read = read_callback;
-	mReader.seek = seek_callback;
-	mReader.tell = tell_callback;
-	mReader.get_size = get_size_callback;
-	mReader.canseek = canseek_callback;
-	mReader.data = this;
+	// Reuse the demuxer from a previous decoder for the file, which retains the seek table built while decoding
+	mPath = (const char *)buf;
+	if(0 == stat(mPath.c_str(), &mFileStatus)) {
+		mDemux = TakeCachedDemuxer(mPath, mFileStatus, mReader);
+		if(mDemux) {
+			mReader->data = this;
+			if(MPC_STATUS_OK != mpc_demux_seek_sample(mDemux, 0)) {
+				LOGGER_INFO("org.sbooth.AudioEngine.Decoder.Musepack", "Unable to reuse cached demuxer");
+				mpc_demux_exit(mDemux);
+				mDemux = nullptr;
+			}
+		}
+	}
+	else
+		mPath.clear();
+
+	if(!mReader)
+		mReader = std::unique_ptr<mpc_reader>(new mpc_reader);
+
+	mReader->read = read_callback;
+	mReader->seek = seek_callback;
+	mReader->tell = tell_callback;
+	mReader->get_size = get_size_callback;
+	mReader->canseek = canseek_callback;
+	mReader->data = this;
+
+	if(nullptr == mDemux)
+		mDemux = mpc_demux_init(mReader.get());
 
-	mDemux = mpc_demux_init(&mReader);
 	if(nullptr == mDemux) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid Musepack file."), ""));
@@ -148,7 +255,7 @@ bool SFB::Audio::MusepackDecoder::_Open(CFErrorRef *error)
 			*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::InputOutputError, description, mInputSource->GetURL(), failureReason, recoverySuggestion);
 		}
 
-		mpc_reader_exit_stdio(&mReader);
+		mpc_reader_exit_stdio(mReader.get());
 
 		return false;
 	}
@@ -188,6 +295,8 @@ bool SFB::Audio::MusepackDecoder::_Open(CFErrorRef *error)
 		case 4:		mChannelLayout = ChannelLayout::ChannelLayoutWithTag(kAudioChannelLayoutTag_Quadraphonic);	break;
 	}
 
+	mDeinterleave = SamplePacking::Deinterleaver::ForFloat(mFormat.mChannelsPerFrame);
+
 	// Allocate the buffer list
 	if(!mBufferList.Allocate(mFormat, MPC_FRAME_LENGTH)) {
 		if(error)
@@ -195,7 +304,7 @@ bool SFB::Audio::MusepackDecoder::_Open(CFErrorRef *error)
 
 		mpc_demux_exit(mDemux);
 		mDemux = nullptr;
-		mpc_reader_exit_stdio(&mReader);
+		mpc_reader_exit_stdio(mReader.get());
 
 		return false;
 	}
@@ -209,11 +318,16 @@ bool SFB::Audio::MusepackDecoder::_Open(CFErrorRef *error)
 bool SFB::Audio::MusepackDecoder::_Close(CFErrorRef */*error*/)
 {
 	if(mDemux) {
-		mpc_demux_exit(mDemux);
+		if(!mPath.empty())
+			CacheDemuxer(mPath, mFileStatus, std::move(mReader), mDemux);
+		else {
+			mpc_demux_exit(mDemux);
+			mpc_reader_exit_stdio(mReader.get());
+		}
+
 		mDemux = nullptr;
 	}
 
-    mpc_reader_exit_stdio(&mReader);
 	mBufferList.Deallocate();
 
 	return true;
@@ -237,27 +351,18 @@ UInt32 SFB::Audio::MusepackDecoder::_ReadAudio(AudioBufferList *bufferList, UInt
 	MPC_SAMPLE_FORMAT	buffer			[MPC_DECODER_BUFFER_LENGTH];
 	UInt32				framesRead		= 0;
 
-	// Reset output buffer data size
-	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
-		bufferList->mBuffers[i].mDataByteSize = 0;
-
 	for(;;) {
-		UInt32	framesRemaining	= frameCount - framesRead;
-		UInt32	framesToSkip	= (UInt32)(bufferList->mBuffers[0].mDataByteSize / sizeof(float));
+		// Copy audio decoded but not yet returned
 		UInt32	framesInBuffer	= (UInt32)(mBufferList->mBuffers[0].mDataByteSize / sizeof(float));
-		UInt32	framesToCopy	= std::min(framesInBuffer, framesRemaining);
+		UInt32	framesToCopy	= std::min(framesInBuffer, frameCount - framesRead);
 
-		// Copy data from the buffer to output
 		for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i) {
-			float *floatBuffer = (float *)bufferList->mBuffers[i].mData;
-			memcpy(floatBuffer + framesToSkip, mBufferList->mBuffers[i].mData, framesToCopy * sizeof(float));
-			bufferList->mBuffers[i].mDataByteSize += framesToCopy * sizeof(float);
+			float *floatBuffer = (float *)mBufferList->mBuffers[i].mData;
+			memcpy((float *)bufferList->mBuffers[i].mData + framesRead, floatBuffer, framesToCopy * sizeof(float));
 
 			// Move remaining data in buffer to beginning
-			if(framesToCopy != framesInBuffer) {
-				floatBuffer = (float *)mBufferList->mBuffers[i].mData;
+			if(framesToCopy != framesInBuffer)
 				memmove(floatBuffer, floatBuffer + framesToCopy, (framesInBuffer - framesToCopy) * sizeof(float));
-			}
 
 			mBufferList->mBuffers[i].mDataByteSize -= framesToCopy * sizeof(float);
 		}
@@ -293,19 +398,21 @@ UInt32 SFB::Audio::MusepackDecoder::_ReadAudio(AudioBufferList *bufferList, UInt
 
 		vDSP_vclip(inputBuffer, 1, &minValue, &maxValue, inputBuffer, 1, frame.samples * mFormat.mChannelsPerFrame);
 
-		// Deinterleave the normalized samples
-		for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel) {
-			float *floatBuffer = (float *)mBufferList->mBuffers[channel].mData;
-
-			for(UInt32 sample = channel; sample < frame.samples * mFormat.mChannelsPerFrame; sample += mFormat.mChannelsPerFrame)
-				*floatBuffer++ = inputBuffer[sample];
-
-			mBufferList->mBuffers[channel].mNumberChannels	= 1;
-			mBufferList->mBuffers[channel].mDataByteSize	= frame.samples * sizeof(float);
+		// Deinterleave the normalized samples directly into the output if they fit, otherwise into the buffer to be returned by subsequent reads
+		if(frame.samples <= frameCount - framesRead) {
+			mDeinterleave(inputBuffer, bufferList, framesRead, frame.samples);
+			framesRead += frame.samples;
 		}
+		else
+			mDeinterleave(inputBuffer, mBufferList, 0, frame.samples);
 #endif /* MPC_FIXED_POINT */
 	}
 
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+		bufferList->mBuffers[i].mDataByteSize = framesRead * sizeof(float);
+		bufferList->mBuffers[i].mNumberChannels = 1;
+	}
+
 	mCurrentFrame += framesRead;
 
 	return framesRead;
@@ -314,8 +421,13 @@ UInt32 SFB::Audio::MusepackDecoder::_ReadAudio(AudioBufferList *bufferList, UInt
 SInt64 SFB::Audio::MusepackDecoder::_SeekToFrame(SInt64 frame)
 {
 	mpc_status result = mpc_demux_seek_sample(mDemux, (mpc_uint64_t)frame);
-	if(MPC_STATUS_OK == result)
+	if(MPC_STATUS_OK == result) {
+		// Discard audio decoded before the seek
+		for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i)
+			mBufferList->mBuffers[i].mDataByteSize = 0;
+
 		mCurrentFrame = frame;
+	}
 
 	return ((MPC_STATUS_OK == result) ? mCurrentFrame : -1);
 }
@@ -5,10 +5,16 @@
 
 #pragma once
 
+#include <memory>
+#include <string>
+
+#include <sys/stat.h>
+
 #include <mpc/mpcdec.h>
 
 #include "AudioDecoder.h"
 #include "AudioBufferList.h"
+#include "SamplePacking.h"
 
 namespace SFB {
 
@@ -28,6 +34,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
@@ -56,13 +63,18 @@ namespace SFB {
 			virtual SInt64 _SeekToFrame(SInt64 frame);
 
 			// Data members
-			mpc_reader			mReader;
-			mpc_demux			*mDemux;
+			std::unique_ptr<mpc_reader>		mReader;
+			mpc_demux						*mDemux;
+
+			// The file's identity, for reuse of the demuxer and its seek table when the file is opened again
+			std::string						mPath;
+			struct stat						mFileStatus;
 
-			BufferList			mBufferList;
+			BufferList						mBufferList;
+			SamplePacking::Deinterleaver	mDeinterleave;
 
-			SInt64				mTotalFrames;
-			SInt64				mCurrentFrame;
+			SInt64							mTotalFrames;
+			SInt64							mCurrentFrame;
 		};
 
 	}
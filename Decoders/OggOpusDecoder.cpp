@@ -10,8 +10,15 @@
 
 #define OPUS_SAMPLE_RATE 48000
 
+// The decoder must be run for at least 80 ms before its output converges after a seek
+#define OPUS_PREROLL_FRAMES 3840
+#define BUFFER_SIZE_FRAMES 2048
+
 namespace {
 
+	// Identifies the codec state recorded in state snapshots
+	const UInt32 kStateSnapshotKind = 'Opus';
+
 	void RegisterOggOpusDecoder() __attribute__ ((constructor));
 	void RegisterOggOpusDecoder()
 	{
@@ -20,15 +27,6 @@ namespace {
 
 #pragma mark Callbacks
 
-	int read_callback(void *stream, unsigned char *ptr, int nbytes)
-	{
-		assert(nullptr != stream);
-
-		auto decoder = static_cast<SFB::Audio::OggOpusDecoder *>(stream);
-		return (int)decoder->GetInputSource().Read(ptr, nbytes);
-	}
-
-
 	int seek_callback(void *stream, opus_int64 offset, int whence)
 	{
 		assert(nullptr != stream);
@@ -103,6 +101,23 @@ bool SFB::Audio::OggOpusDecoder::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::OggOpusDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	// The identification header is the first packet following the page header and segment table
+	if(27 <= length && 0 == memcmp(bytes, "OggS", 4)) {
+		size_t packetOffset = 27 + bytes[26];
+		if(packetOffset + 8 <= length && 0 == memcmp(bytes + packetOffset, "OpusHead", 8))
+			return true;
+	}
+
+	return false;
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::OggOpusDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new OggOpusDecoder(std::move(inputSource)));
@@ -111,7 +126,7 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::OggOpusDecoder::CreateDecoder(InputS
 #pragma mark Creation and Destruction
 
 SFB::Audio::OggOpusDecoder::OggOpusDecoder(InputSource::unique_ptr inputSource)
-	: Decoder(std::move(inputSource)), mOpusFile(nullptr, nullptr)
+	: Decoder(std::move(inputSource)), mOpusFile(nullptr, nullptr), mDeinterleave(nullptr)
 {}
 
 #pragma mark Functionality
@@ -119,12 +134,13 @@ SFB::Audio::OggOpusDecoder::OggOpusDecoder(InputSource::unique_ptr inputSource)
 bool SFB::Audio::OggOpusDecoder::_Open(CFErrorRef *error)
 {
 	OpusFileCallbacks callbacks = {
-		.read = read_callback,
+		.read = ReadCallback,
 		.seek = seek_callback,
 		.tell = tell_callback,
 		.close = nullptr
 	};
 
+	mPageIndex.Reset();
 	mOpusFile = unique_op_ptr(op_test_callbacks(this, &callbacks, nullptr, 0, nullptr), op_free);
 
 	if(!mOpusFile) {
@@ -146,15 +162,15 @@ bool SFB::Audio::OggOpusDecoder::_Open(CFErrorRef *error)
 
 	const OpusHead *header = op_head(mOpusFile.get(), 0);
 
-	// Output interleaved floating point data
+	// Output non-interleaved floating point data at the native Opus sample rate
 	mFormat.mFormatID			= kAudioFormatLinearPCM;
-	mFormat.mFormatFlags		= kAudioFormatFlagsNativeFloatPacked;
+	mFormat.mFormatFlags		= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
 
 	mFormat.mBitsPerChannel		= 8 * sizeof(float);
 	mFormat.mSampleRate			= OPUS_SAMPLE_RATE;
 	mFormat.mChannelsPerFrame	= (UInt32)header->channel_count;
 
-	mFormat.mBytesPerPacket		= (mFormat.mBitsPerChannel / 8) * mFormat.mChannelsPerFrame;
+	mFormat.mBytesPerPacket		= (mFormat.mBitsPerChannel / 8);
 	mFormat.mFramesPerPacket	= 1;
 	mFormat.mBytesPerFrame		= mFormat.mBytesPerPacket * mFormat.mFramesPerPacket;
 
@@ -192,11 +208,26 @@ bool SFB::Audio::OggOpusDecoder::_Open(CFErrorRef *error)
 			break;
 	}
 
+	// libopusfile produces interleaved samples, which are decoded into mBuffer and deinterleaved into the caller's buffers
+	mDeinterleave = SamplePacking::Deinterleaver::ForFloat(mFormat.mChannelsPerFrame);
+
+	mBuffer = std::unique_ptr<float []>(new float [BUFFER_SIZE_FRAMES * mFormat.mChannelsPerFrame]);
+	if(!mBuffer) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
+		mOpusFile.reset();
+
+		return false;
+	}
+
 	return true;
 }
 
 bool SFB::Audio::OggOpusDecoder::_Close(CFErrorRef */*error*/)
 {
+	mBuffer.reset();
+	mDeinterleave = nullptr;
 	mOpusFile.reset();
 	return true;
 }
@@ -211,17 +242,21 @@ SFB::CFString SFB::Audio::OggOpusDecoder::_GetSourceFormatDescription() const
 
 UInt32 SFB::Audio::OggOpusDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
 {
-	if(bufferList->mBuffers[0].mNumberChannels != mFormat.mChannelsPerFrame) {
+	if(bufferList->mNumberBuffers != mFormat.mChannelsPerFrame) {
 		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.OggOpus", "_ReadAudio() called with invalid parameters");
 		return 0;
 	}
 
-	float		*buffer				= (float *)bufferList->mBuffers[0].mData;
+	// Reset output buffer data size
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+		bufferList->mBuffers[i].mDataByteSize = 0;
+
 	UInt32		framesRemaining		= frameCount;
 	UInt32		totalFramesRead		= 0;
 
 	while(0 < framesRemaining) {
-		int framesRead = op_read_float(mOpusFile.get(), buffer, (int)(framesRemaining * mFormat.mChannelsPerFrame), nullptr);
+		UInt32 framesToRead = std::min(framesRemaining, (UInt32)BUFFER_SIZE_FRAMES);
+		int framesRead = op_read_float(mOpusFile.get(), mBuffer.get(), (int)(framesToRead * mFormat.mChannelsPerFrame), nullptr);
 
 		if(0 > framesRead) {
 			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggOpus", "Ogg Opus decoding error: " << framesRead);
@@ -232,20 +267,25 @@ UInt32 SFB::Audio::OggOpusDecoder::_ReadAudio(AudioBufferList *bufferList, UInt3
 		if(0 == framesRead)
 			break;
 
-		buffer += (UInt32)framesRead * mFormat.mChannelsPerFrame;
+		// Deinterleave the samples following any previously read
+		mDeinterleave(mBuffer.get(), bufferList, totalFramesRead, (UInt32)framesRead);
 
 		totalFramesRead += (UInt32)framesRead;
 		framesRemaining -= (UInt32)framesRead;
 	}
 
-	bufferList->mBuffers[0].mDataByteSize = totalFramesRead * mFormat.mBytesPerFrame;
-	bufferList->mBuffers[0].mNumberChannels = mFormat.mChannelsPerFrame;
-
 	return totalFramesRead;
 }
 
 SInt64 SFB::Audio::OggOpusDecoder::_SeekToFrame(SInt64 frame)
 {
+	// Decoding resumes from an indexed page boundary at least the pre-roll distance before frame, avoiding a bisection search of the file
+	const OpusHead *header = op_head(mOpusFile.get(), -1);
+	SInt64 granulePosition = std::max(frame + (header ? header->pre_skip : 0) - OPUS_PREROLL_FRAMES, (SInt64)0);
+	SInt64 pageGranulePosition, offset;
+	if(mPageIndex.Find(granulePosition, pageGranulePosition, offset) && 0 == op_raw_seek(mOpusFile.get(), offset) && SkipToFrame(frame))
+		return this->GetCurrentFrame();
+
 	if(0 != op_pcm_seek(mOpusFile.get(), frame)) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggOpus", "op_pcm_seek() failed");
 		return -1;
@@ -253,3 +293,67 @@ SInt64 SFB::Audio::OggOpusDecoder::_SeekToFrame(SInt64 frame)
 
 	return this->GetCurrentFrame();
 }
+
+SInt64 SFB::Audio::OggOpusDecoder::_SeekToFrameApproximately(SInt64 frame)
+{
+	// Decoding resumes from the indexed page boundary preceding frame without decoding the pre-roll
+	// libopusfile has no page-granular seek, so unindexed positions require an exact seek
+	const OpusHead *header = op_head(mOpusFile.get(), -1);
+	SInt64 granulePosition = frame + (header ? header->pre_skip : 0);
+	SInt64 pageGranulePosition, offset;
+	if(mPageIndex.Find(granulePosition, pageGranulePosition, offset) && 0 == op_raw_seek(mOpusFile.get(), offset))
+		return this->GetCurrentFrame();
+
+	return _SeekToFrame(frame);
+}
+
+SFB::Audio::Decoder::SeekCost SFB::Audio::OggOpusDecoder::_GetSeekCost(SInt64 frame) const
+{
+	const OpusHead *header = op_head(mOpusFile.get(), -1);
+	SInt64 granulePosition = std::max(frame + (header ? header->pre_skip : 0) - OPUS_PREROLL_FRAMES, (SInt64)0);
+	SInt64 pageGranulePosition, offset;
+	return mPageIndex.Find(granulePosition, pageGranulePosition, offset) ? SeekCostIndexed : SeekCostSearch;
+}
+
+bool SFB::Audio::OggOpusDecoder::_AppendStateSnapshot(SInt64 frame, CFMutableDataRef data) const
+{
+	// The recorded page is at least the pre-roll distance before frame, as for an exact seek
+	const OpusHead *header = op_head(mOpusFile.get(), -1);
+	SInt64 granulePosition = std::max(frame + (header ? header->pre_skip : 0) - OPUS_PREROLL_FRAMES, (SInt64)0);
+	return mPageIndex.AppendStateSnapshot(granulePosition, kStateSnapshotKind, data);
+}
+
+SInt64 SFB::Audio::OggOpusDecoder::_RestoreStateSnapshot(SInt64 frame, const UInt8 *data, CFIndex length)
+{
+	// Decoding resumes from the recorded page boundary, avoiding a bisection search of the file
+	SInt64 pageGranulePosition, offset;
+	if(OggPageIndex::ReadStateSnapshot(data, length, kStateSnapshotKind, pageGranulePosition, offset) && 0 == op_raw_seek(mOpusFile.get(), offset) && SkipToFrame(frame))
+		return this->GetCurrentFrame();
+
+	return _SeekToFrame(frame);
+}
+
+int SFB::Audio::OggOpusDecoder::ReadCallback(void *stream, unsigned char *ptr, int nbytes)
+{
+	assert(nullptr != stream);
+
+	auto decoder = static_cast<OggOpusDecoder *>(stream);
+	SInt64 offset = decoder->GetInputSource().GetOffset();
+	SInt64 bytesRead = decoder->GetInputSource().Read(ptr, nbytes);
+	if(0 < bytesRead)
+		decoder->mPageIndex.Scan(ptr, (size_t)bytesRead, offset);
+	return (int)bytesRead;
+}
+
+bool SFB::Audio::OggOpusDecoder::SkipToFrame(SInt64 frame)
+{
+	SInt64 currentFrame = op_pcm_tell(mOpusFile.get());
+	while(0 <= currentFrame && currentFrame < frame) {
+		int framesRead = op_read_float(mOpusFile.get(), mBuffer.get(), (int)std::min((SInt64)BUFFER_SIZE_FRAMES, frame - currentFrame) * (int)mFormat.mChannelsPerFrame, nullptr);
+		if(0 >= framesRead)
+			return false;
+		currentFrame += framesRead;
+	}
+
+	return currentFrame == frame;
+}
@@ -7,6 +7,8 @@
 
 #include <opus/opusfile.h>
 #include "AudioDecoder.h"
+#include "OggPageIndex.h"
+#include "SamplePacking.h"
 
 namespace SFB {
 
@@ -26,6 +28,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
@@ -51,11 +54,26 @@ namespace SFB {
 			// Seeking support
 			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
+			virtual SInt64 _SeekToFrameApproximately(SInt64 frame);
+			virtual SeekCost _GetSeekCost(SInt64 frame) const;
+
+			// State snapshots record the indexed page from which decoding resumes
+			virtual bool _AppendStateSnapshot(SInt64 frame, CFMutableDataRef data) const;
+			virtual SInt64 _RestoreStateSnapshot(SInt64 frame, const UInt8 *data, CFIndex length);
+
+			// Read from the input source, indexing the pages read
+			static int ReadCallback(void *stream, unsigned char *ptr, int nbytes);
+
+			// Decode and discard audio until frame is reached
+			bool SkipToFrame(SInt64 frame);
 
 			using unique_op_ptr = std::unique_ptr<OggOpusFile, std::function<void(OggOpusFile *)>>;
 
 			// Data members
-			unique_op_ptr		mOpusFile;
+			unique_op_ptr					mOpusFile;
+			OggPageIndex					mPageIndex;
+			std::unique_ptr<float []>		mBuffer;
+			SamplePacking::Deinterleaver	mDeinterleave;
 		};
 
 	}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <cstring>
+
+#include "OggPageIndex.h"
+
+namespace {
+
+	// The page recorded in a decoder state snapshot
+	struct PageStateSnapshot
+	{
+		uint32_t	mKind;
+		uint32_t	mReserved;
+		int64_t		mPageGranulePosition;
+		int64_t		mOffset;
+	};
+
+	// The length of an Ogg page header excluding the segment table
+	const size_t kPageHeaderLength = 27;
+
+	// The largest possible page: a full segment table with 255 byte segments
+	const SInt64 kMaximumPageLength = kPageHeaderLength + 255 + (255 * 255);
+
+	// The page checksum is the CRC-32 of the page with the checksum field zeroed, using the polynomial 0x04c11db7
+	struct CRCTable
+	{
+		CRCTable()
+		{
+			for(UInt32 i = 0; i < 256; ++i) {
+				UInt32 r = i << 24;
+				for(int j = 0; j < 8; ++j)
+					r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : (r << 1);
+				mTable[i] = r;
+			}
+		}
+
+		UInt32 mTable [256];
+	};
+
+	const CRCTable sCRCTable;
+
+	UInt32 PageChecksum(const uint8_t *page, size_t length)
+	{
+		UInt32 crc = 0;
+		for(size_t i = 0; i < length; ++i) {
+			// Bytes 22 - 25 contain the checksum itself
+			uint8_t byte = (22 <= i && 26 > i) ? 0 : page[i];
+			crc = (crc << 8) ^ sCRCTable.mTable[((crc >> 24) & 0xff) ^ byte];
+		}
+		return crc;
+	}
+
+	UInt32 ReadUInt32LE(const uint8_t *bytes)
+	{
+		return (UInt32)bytes[0] | ((UInt32)bytes[1] << 8) | ((UInt32)bytes[2] << 16) | ((UInt32)bytes[3] << 24);
+	}
+
+	SInt64 ReadSInt64LE(const uint8_t *bytes)
+	{
+		return (SInt64)((UInt64)ReadUInt32LE(bytes) | ((UInt64)ReadUInt32LE(bytes + 4) << 32));
+	}
+
+}
+
+SFB::Audio::OggPageIndex::OggPageIndex()
+	: mPendingOffset(0), mPreviousGranulePosition(-1), mSerialNumber(0), mHasSerialNumber(false), mDisabled(false)
+{}
+
+void SFB::Audio::OggPageIndex::Reset()
+{
+	mEntries.clear();
+	mPending.clear();
+	mPendingOffset = 0;
+	mPreviousGranulePosition = -1;
+	mSerialNumber = 0;
+	mHasSerialNumber = false;
+	mDisabled = false;
+}
+
+size_t SFB::Audio::OggPageIndex::ScanPages(const uint8_t *bytes, size_t length, SInt64 offset)
+{
+	size_t position = 0;
+
+	while(position + kPageHeaderLength <= length) {
+		const uint8_t *page = bytes + position;
+
+		if(memcmp(page, "OggS", 4) || 0 != page[4]) {
+			++position;
+			continue;
+		}
+
+		// Incomplete pages are completed by the following read
+		size_t headerLength = kPageHeaderLength + page[26];
+		if(position + headerLength > length)
+			break;
+
+		size_t pageLength = headerLength;
+		for(size_t i = 0; i < page[26]; ++i)
+			pageLength += page[kPageHeaderLength + i];
+
+		if(position + pageLength > length)
+			break;
+
+		if(PageChecksum(page, pageLength) != ReadUInt32LE(page + 22)) {
+			++position;
+			continue;
+		}
+
+		UInt32 serialNumber = ReadUInt32LE(page + 14);
+		if(!mHasSerialNumber) {
+			mSerialNumber = serialNumber;
+			mHasSerialNumber = true;
+		}
+		else if(serialNumber != mSerialNumber) {
+			mEntries.clear();
+			mDisabled = true;
+			return length;
+		}
+
+		// Decoding can't begin cleanly on a page continuing a packet from the previous page
+		SInt64 pageOffset = offset + (SInt64)position;
+		if(page[5] & 0x01) {
+			auto iter = mEntries.find(mPreviousGranulePosition);
+			if(iter != mEntries.end() && iter->second == pageOffset)
+				mEntries.erase(iter);
+		}
+
+		// A granule position of -1 indicates no packets finish on the page
+		SInt64 granulePosition = ReadSInt64LE(page + 6);
+		if(-1 != granulePosition) {
+			// When several pages share a granule position the last one is closest to the following audio
+			SInt64 nextPageOffset = pageOffset + (SInt64)pageLength;
+			auto& entry = mEntries[granulePosition];
+			if(entry < nextPageOffset)
+				entry = nextPageOffset;
+			mPreviousGranulePosition = granulePosition;
+		}
+
+		position += pageLength;
+	}
+
+	return position;
+}
+
+void SFB::Audio::OggPageIndex::Scan(const void *data, size_t length, SInt64 offset)
+{
+	if(mDisabled || nullptr == data || 0 > offset)
+		return;
+
+	auto bytes = (const uint8_t *)data;
+
+	// Pages split across consecutive reads are reassembled from the unscanned tail of the previous read
+	if(!mPending.empty() && mPendingOffset + (SInt64)mPending.size() == offset) {
+		mPending.insert(mPending.end(), bytes, bytes + length);
+		bytes = mPending.data();
+		length = mPending.size();
+		offset = mPendingOffset;
+	}
+
+	size_t position = ScanPages(bytes, length, offset);
+
+	if(mDisabled || position >= length) {
+		mPending.clear();
+		return;
+	}
+
+	std::vector<uint8_t> pending(bytes + position, bytes + length);
+	mPending.swap(pending);
+	mPendingOffset = offset + (SInt64)position;
+}
+
+bool SFB::Audio::OggPageIndex::Find(SInt64 granulePosition, SInt64& pageGranulePosition, SInt64& offset) const
+{
+	if(mDisabled || mEntries.empty())
+		return false;
+
+	auto iter = mEntries.upper_bound(granulePosition);
+	if(iter == mEntries.begin() || iter == mEntries.end())
+		return false;
+
+	// The following indexed page must be adjacent, otherwise the pages in between haven't been read
+	SInt64 nextPageOffset = iter->second;
+	--iter;
+	if(nextPageOffset - iter->second > kMaximumPageLength)
+		return false;
+
+	pageGranulePosition = iter->first;
+	offset = iter->second;
+
+	return true;
+}
+
+bool SFB::Audio::OggPageIndex::AppendStateSnapshot(SInt64 granulePosition, UInt32 kind, CFMutableDataRef data) const
+{
+	SInt64 pageGranulePosition, offset;
+	if(!Find(granulePosition, pageGranulePosition, offset))
+		return false;
+
+	PageStateSnapshot snapshot = { kind, 0, pageGranulePosition, offset };
+	CFDataAppendBytes(data, (const UInt8 *)&snapshot, sizeof(snapshot));
+
+	return true;
+}
+
+bool SFB::Audio::OggPageIndex::ReadStateSnapshot(const UInt8 *data, CFIndex length, UInt32 kind, SInt64& pageGranulePosition, SInt64& offset)
+{
+	PageStateSnapshot snapshot;
+	if((CFIndex)sizeof(snapshot) != length)
+		return false;
+
+	memcpy(&snapshot, data, sizeof(snapshot));
+	if(kind != snapshot.mKind || 0 > snapshot.mPageGranulePosition || 0 > snapshot.mOffset)
+		return false;
+
+	pageGranulePosition = snapshot.mPageGranulePosition;
+	offset = snapshot.mOffset;
+
+	return true;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include <CoreAudio/CoreAudioTypes.h>
+#include <CoreFoundation/CoreFoundation.h>
+
+namespace SFB {
+
+	namespace Audio {
+
+		// ========================================
+		// An index of Ogg page granule positions to byte offsets
+		//
+		// The index is built lazily by scanning the bytes read from an input source for complete,
+		// checksummed Ogg pages.  Decoders may then seek by reading from the page boundary nearest
+		// to the desired granule position instead of bisecting the file.
+		//
+		// Granule positions restart for each link in a chained stream, so the index is limited to a single
+		// logical bitstream and is disabled if pages from a different stream are seen.
+		// ========================================
+		class OggPageIndex
+		{
+
+		public:
+
+			OggPageIndex();
+
+			// Discard all entries
+			void Reset();
+
+			// Index any complete pages in length bytes of data read from the input source starting at offset
+			void Scan(const void *data, size_t length, SInt64 offset);
+
+			// Find the offset from which decoding begins at the largest indexed granule position not greater than granulePosition
+			// Returns false unless the following page is also indexed, since otherwise the region around granulePosition is unexplored
+			bool Find(SInt64 granulePosition, SInt64& pageGranulePosition, SInt64& offset) const;
+
+			// Append the page found for granulePosition to a decoder state snapshot, tagged with kind to identify the codec
+			bool AppendStateSnapshot(SInt64 granulePosition, UInt32 kind, CFMutableDataRef data) const;
+
+			// Read the page appended to a decoder state snapshot by AppendStateSnapshot(), returning false if kind doesn't match
+			static bool ReadStateSnapshot(const UInt8 *data, CFIndex length, UInt32 kind, SInt64& pageGranulePosition, SInt64& offset);
+
+		private:
+
+			// Index the complete pages in bytes, returning the offset of the first byte not consumed
+			size_t ScanPages(const uint8_t *bytes, size_t length, SInt64 offset);
+
+			// Granule position of the end of each page mapped to the offset of the following page
+			std::map<SInt64, SInt64>	mEntries;
+			std::vector<uint8_t>		mPending;
+			SInt64						mPendingOffset;
+			SInt64						mPreviousGranulePosition;
+			UInt32						mSerialNumber;
+			bool						mHasSerialNumber;
+			bool						mDisabled;
+		};
+
+	}
+}
@@ -16,7 +16,16 @@
 #include "Logger.h"
 
 #define MAX_FRAME_SIZE 2000
-#define READ_SIZE_BYTES 4096
+#define READ_SIZE_BYTES 32768
+
+// The number of frames decoded and discarded per pass when seeking
+#define SKIP_BUFFER_SIZE_FRAMES 4096
+
+// Seeks farther ahead than this are located by bisection instead of decoding the intervening audio
+#define SEEK_MAXIMUM_DECODE_SECONDS 10
+
+// Bisection stops when the interval is smaller than this, and the remainder is decoded
+#define SEEK_BISECTION_THRESHOLD_BYTES 8192
 
 namespace {
 
@@ -67,6 +76,23 @@ bool SFB::Audio::OggSpeexDecoder::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::OggSpeexDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	// The identification header is the first packet following the page header and segment table
+	if(27 <= length && 0 == memcmp(bytes, "OggS", 4)) {
+		size_t packetOffset = 27 + bytes[26];
+		if(packetOffset + 8 <= length && 0 == memcmp(bytes + packetOffset, "Speex   ", 8))
+			return true;
+	}
+
+	return false;
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::OggSpeexDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new OggSpeexDecoder(std::move(inputSource)));
@@ -75,7 +101,7 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::OggSpeexDecoder::CreateDecoder(Input
 #pragma mark Creation and Destruction
 
 SFB::Audio::OggSpeexDecoder::OggSpeexDecoder(InputSource::unique_ptr inputSource)
-	: Decoder(std::move(inputSource)), mCurrentFrame(0), mTotalFrames(-1), mSpeexDecoder(nullptr), mSpeexStereoState(nullptr), mSpeexSerialNumber(-1), mSpeexEOSReached(false), mSpeexFramesPerOggPacket(0), mOggPacketCount(0), mExtraSpeexHeaderCount(0)
+	: Decoder(std::move(inputSource)), mCurrentFrame(0), mTotalFrames(-1), mSpeexDecoder(nullptr), mSpeexStereoState(nullptr), mSpeexSerialNumber(-1), mSpeexEOSReached(false), mSpeexFramesPerOggPacket(0), mSpeexFrameSize(0), mOggPacketCount(0), mExtraSpeexHeaderCount(0), mFramesDecoded(0), mPageGranulePosition(-1), mGranulePositionOffset(-1), mAudioOffset(-1)
 {}
 
 SFB::Audio::OggSpeexDecoder::~OggSpeexDecoder()
@@ -88,14 +114,17 @@ SFB::Audio::OggSpeexDecoder::~OggSpeexDecoder()
 
 bool SFB::Audio::OggSpeexDecoder::_Open(CFErrorRef *error)
 {
+	mPageIndex.Reset();
+	mFramesDecoded = 0;
+	mPageGranulePosition = -1;
+	mGranulePositionOffset = -1;
+	mAudioOffset = -1;
+
 	// Initialize Ogg data struct
 	ogg_sync_init(&mOggSyncState);
 
-	// Get the ogg buffer for writing
-	char *data = ogg_sync_buffer(&mOggSyncState, READ_SIZE_BYTES);
-
 	// Read bitstream from input file
-	ssize_t bytesRead = (ssize_t)GetInputSource().Read(data, READ_SIZE_BYTES);
+	ssize_t bytesRead = ReadPageData();
 	if(-1 == bytesRead) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be read."), ""));
@@ -109,23 +138,8 @@ bool SFB::Audio::OggSpeexDecoder::_Open(CFErrorRef *error)
 		return false;
 	}
 
-	// Tell the sync layer how many bytes were written to its internal buffer
-	int result = ogg_sync_wrote(&mOggSyncState, bytesRead);
-	if(-1 == result) {
-		if(error) {
-			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid Ogg file."), ""));
-			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not an Ogg file"), ""));
-			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
-
-			*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::InputOutputError, description, mInputSource->GetURL(), failureReason, recoverySuggestion);
-		}
-
-		ogg_sync_destroy(&mOggSyncState);
-		return false;
-	}
-
 	// Turn the data we wrote into an ogg page
-	result = ogg_sync_pageout(&mOggSyncState, &mOggPage);
+	int result = ogg_sync_pageout(&mOggSyncState, &mOggPage);
 	if(1 != result) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid Ogg file."), ""));
@@ -287,11 +301,13 @@ bool SFB::Audio::OggSpeexDecoder::_Open(CFErrorRef *error)
 	speex_header_free(header);
 	header = nullptr;
 
-	// Allocate the buffer list
-	spx_int32_t speexFrameSize = 0;
-	speex_decoder_ctl(mSpeexDecoder, SPEEX_GET_FRAME_SIZE, &speexFrameSize);
+	// Allocate the buffer list, which holds the frames of a packet that don't fit in the caller's buffer
+	speex_decoder_ctl(mSpeexDecoder, SPEEX_GET_FRAME_SIZE, &mSpeexFrameSize);
+
+	if(2 == mFormat.mChannelsPerFrame)
+		mStereoBuffer = std::unique_ptr<float []>(new float [2 * (size_t)mSpeexFrameSize]);
 
-	if(!mBufferList.Allocate(mFormat, (UInt32)speexFrameSize)) {
+	if(!mBufferList.Allocate(mFormat, (UInt32)(mSpeexFrameSize * mSpeexFramesPerOggPacket))) {
 		if(error)
 			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
 
@@ -314,6 +330,7 @@ bool SFB::Audio::OggSpeexDecoder::_Open(CFErrorRef *error)
 bool SFB::Audio::OggSpeexDecoder::_Close(CFErrorRef */*error*/)
 {
 	mBufferList.Deallocate();
+	mStereoBuffer.reset();
 
 	// Speex cleanup
 	speex_stereo_state_destroy(mSpeexStereoState);
@@ -346,33 +363,9 @@ UInt32 SFB::Audio::OggSpeexDecoder::_ReadAudio(AudioBufferList *bufferList, UInt
 
 	UInt32 framesRead = 0;
 
-	// Reset output buffer data size
-	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
-		bufferList->mBuffers[i].mDataByteSize = 0;
-
 	for(;;) {
-
-		UInt32	framesRemaining	= frameCount - framesRead;
-		UInt32	framesToSkip	= (UInt32)(bufferList->mBuffers[0].mDataByteSize / sizeof(float));
-		UInt32	framesInBuffer	= (UInt32)(mBufferList->mBuffers[0].mDataByteSize / sizeof(float));
-		UInt32	framesToCopy	= std::min(framesInBuffer, framesRemaining);
-
-		// Copy data from the buffer to output
-		for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i) {
-			float *floatBuffer = (float *)bufferList->mBuffers[i].mData;
-			memcpy(floatBuffer + framesToSkip, mBufferList->mBuffers[i].mData, framesToCopy * sizeof(float));
-			bufferList->mBuffers[i].mDataByteSize += framesToCopy * sizeof(float);
-
-			// Move remaining data in buffer to beginning
-			if(framesToCopy != framesInBuffer) {
-				floatBuffer = (float *)mBufferList->mBuffers[i].mData;
-				memmove(floatBuffer, floatBuffer + framesToCopy, (framesInBuffer - framesToCopy) * sizeof(float));
-			}
-
-			mBufferList->mBuffers[i].mDataByteSize -= framesToCopy * sizeof(float);
-		}
-
-		framesRead += framesToCopy;
+		// Return audio decoded but not yet returned
+		framesRead += CopyBufferedAudio(bufferList, framesRead, frameCount - framesRead);
 
 		// All requested frames were read
 		if(framesRead == frameCount)
@@ -382,132 +375,364 @@ UInt32 SFB::Audio::OggSpeexDecoder::_ReadAudio(AudioBufferList *bufferList, UInt
 		if(mSpeexEOSReached)
 			break;
 
-		// Attempt to process the desired number of packets
-		unsigned packetsDesired = 1;
-		while(0 < packetsDesired && !mSpeexEOSReached) {
+		// Grab a packet from the streaming layer
+		ogg_packet oggPacket;
+		int result = ogg_stream_packetout(&mOggStreamState, &oggPacket);
+		if(-1 == result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggSpeex", "Ogg Speex decoding error: Ogg loss of streaming");
+			continue;
+		}
 
-			// Process any packets in the current page
-			while(0 < packetsDesired && !mSpeexEOSReached) {
+		// If result is 0, there is insufficient data to assemble a packet
+		if(0 == result) {
+			if(!ReadPage())
+				mSpeexEOSReached = true;
+			continue;
+		}
 
-				// Grab a packet from the streaming layer
-				ogg_packet oggPacket;
-				int result = ogg_stream_packetout(&mOggStreamState, &oggPacket);
-				if(-1 == result) {
-					LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggSpeex", "Ogg Speex decoding error: Ogg loss of streaming");
-					break;
+		// Ignore the following:
+		//  - Speex comments in packet #2
+		//  - Extra headers (optionally) in packets 3+
+		if(1 != mOggPacketCount && 1 + mExtraSpeexHeaderCount <= mOggPacketCount) {
+			// Detect Speex EOS
+			if(oggPacket.e_o_s)
+				mSpeexEOSReached = true;
+
+			// Copy the Ogg packet to the Speex bitstream
+			speex_bits_read_from(&mSpeexBits, (char *)oggPacket.packet, (int)oggPacket.bytes);
+
+			// Decode each frame in the Speex packet directly into the caller's buffer while it fits
+			// Once a frame doesn't fit the remainder of the packet is decoded into mBufferList
+			for(spx_int32_t i = 0; i < mSpeexFramesPerOggPacket; ++i) {
+				UInt32 framesBuffered = (UInt32)(mBufferList->mBuffers[0].mDataByteSize / sizeof(float));
+				if(0 == framesBuffered && (UInt32)mSpeexFrameSize <= frameCount - framesRead) {
+					if(!DecodeFrame(bufferList, framesRead))
+						break;
+					framesRead += (UInt32)mSpeexFrameSize;
+				}
+				else {
+					if(!DecodeFrame(mBufferList, framesBuffered))
+						break;
+					for(UInt32 j = 0; j < mBufferList->mNumberBuffers; ++j)
+						mBufferList->mBuffers[j].mDataByteSize += (UInt32)mSpeexFrameSize * sizeof(float);
 				}
 
-				// If result is 0, there is insufficient data to assemble a packet
-				if(0 == result)
-					break;
+				mFramesDecoded += mSpeexFrameSize;
+			}
+		}
 
-				// Otherwise, we got a valid packet for processing
-				if(1 == result) {
-					if(5 <= oggPacket.bytes && !memcmp(oggPacket.packet, "Speex", 5))
-						mSpeexSerialNumber = mOggStreamState.serialno;
+		++mOggPacketCount;
+	}
 
-					if(-1 == mSpeexSerialNumber || mOggStreamState.serialno != mSpeexSerialNumber)
-						break;
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+		bufferList->mBuffers[i].mDataByteSize = framesRead * sizeof(float);
+		bufferList->mBuffers[i].mNumberChannels = 1;
+	}
 
-					// Ignore the following:
-					//  - Speex comments in packet #2
-					//  - Extra headers (optionally) in packets 3+
-					if(1 != mOggPacketCount && 1 + mExtraSpeexHeaderCount <= mOggPacketCount) {
-						// Detect Speex EOS
-						if(oggPacket.e_o_s && mOggStreamState.serialno == mSpeexSerialNumber)
-							mSpeexEOSReached = true;
-
-						// SPEEX_GET_FRAME_SIZE is in samples
-						spx_int32_t speexFrameSize;
-						speex_decoder_ctl(mSpeexDecoder, SPEEX_GET_FRAME_SIZE, &speexFrameSize);
-						float buffer [(2 == mFormat.mChannelsPerFrame) ? 2 * speexFrameSize : speexFrameSize];
-
-						// Copy the Ogg packet to the Speex bitstream
-						speex_bits_read_from(&mSpeexBits, (char *)oggPacket.packet, (int)oggPacket.bytes);
-
-						// Decode each frame in the Speex packet
-						for(spx_int32_t i = 0; i < mSpeexFramesPerOggPacket; ++i) {
-
-							result = speex_decode(mSpeexDecoder, &mSpeexBits, buffer);
-
-							// -1 indicates EOS
-							if(-1 == result)
-								break;
-							else if(-2 == result) {
-								LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggSpeex", "Ogg Speex decoding error: possible corrupted stream");
-								break;
-							}
-
-							if(0 > speex_bits_remaining(&mSpeexBits)) {
-								LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggSpeex", "Ogg Speex decoding overflow: possible corrupted stream");
-								break;
-							}
-
-							// Normalize the values
-							float maxSampleValue = 1u << 15;
-							vDSP_vsdiv(buffer, 1, &maxSampleValue, buffer, 1, (vDSP_Length)speexFrameSize);
-
-							// Copy the frames from the decoding buffer to the output buffer, skipping over any frames already decoded
-							framesInBuffer = mBufferList->mBuffers[0].mDataByteSize / sizeof(float);
-							memcpy((float *)mBufferList->mBuffers[0].mData + framesInBuffer, buffer, (size_t)speexFrameSize * sizeof(float));
-							mBufferList->mBuffers[0].mDataByteSize += (size_t)speexFrameSize * sizeof(float);
-
-							// Process stereo channel, if present
-							if(2 == mFormat.mChannelsPerFrame) {
-								speex_decode_stereo(buffer, speexFrameSize, mSpeexStereoState);
-								vDSP_vsdiv(buffer + speexFrameSize, 1, &maxSampleValue, buffer + speexFrameSize, 1, (vDSP_Length)speexFrameSize);
-
-								memcpy((float *)mBufferList->mBuffers[1].mData + framesInBuffer, buffer + speexFrameSize, (size_t)speexFrameSize * sizeof(float));
-								mBufferList->mBuffers[1].mDataByteSize += (size_t)speexFrameSize * sizeof(float);
-							}
-
-							// Packet processing finished
-							--packetsDesired;
-						}
-					}
-
-					++mOggPacketCount;
-				}
+	mCurrentFrame += framesRead;
+
+	if(0 == framesRead && mSpeexEOSReached)
+		mTotalFrames = mCurrentFrame;
+
+	return framesRead;
+}
+
+SInt64 SFB::Audio::OggSpeexDecoder::_SeekToFrame(SInt64 frame)
+{
+	BufferList bufferList;
+	if(!bufferList.Allocate(mFormat, SKIP_BUFFER_SIZE_FRAMES))
+		return -1;
+
+	// The granule position offset is measured once the first audio pages have been decoded
+	while(-1 == mGranulePositionOffset && !mSpeexEOSReached && mCurrentFrame < frame) {
+		bufferList.Reset();
+		if(0 == _ReadAudio(bufferList, (UInt32)std::min((SInt64)SKIP_BUFFER_SIZE_FRAMES, frame - mCurrentFrame)))
+			break;
+	}
+
+	// Files too short for the offset to be measured are assumed to have none
+	SInt64 granulePositionOffset = (-1 == mGranulePositionOffset) ? 0 : mGranulePositionOffset;
+	SInt64 granulePosition = frame - granulePositionOffset;
+
+	// Decoding resumes from the indexed page boundary preceding frame if that is closer than the current position
+	SInt64 pageGranulePosition, offset;
+	if(mPageIndex.Find(granulePosition, pageGranulePosition, offset) && (frame < mCurrentFrame || pageGranulePosition + granulePositionOffset > mCurrentFrame)) {
+		if(!ResumeDecodingAtOffset(offset, pageGranulePosition + granulePositionOffset, pageGranulePosition))
+			return -1;
+	}
+	// Otherwise the page is located by bisection if the frame isn't a short distance ahead
+	else if(frame < mCurrentFrame || frame - mCurrentFrame > (SInt64)(SEEK_MAXIMUM_DECODE_SECONDS * mFormat.mSampleRate)) {
+		SInt64 inputOffset = GetInputSource().GetOffset();
+		SInt64 resumeFrame;
+		if(BisectForGranulePosition(granulePosition, resumeFrame, offset) && (frame < mCurrentFrame || resumeFrame > mCurrentFrame)) {
+			if(!ResumeDecodingAtOffset(offset, resumeFrame, resumeFrame - granulePositionOffset))
+				return -1;
+		}
+		else if(frame < mCurrentFrame) {
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.OggSpeex", "Unable to seek backward to frame " << frame);
+			return -1;
+		}
+		// Continue decoding from the current position
+		else if(!GetInputSource().SeekToOffset(inputOffset)) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggSpeex", "Unable to seek to offset " << inputOffset);
+			return -1;
+		}
+	}
+
+	// Decode and discard the audio preceding frame
+	while(mCurrentFrame < frame) {
+		bufferList.Reset();
+		if(0 == _ReadAudio(bufferList, (UInt32)std::min((SInt64)SKIP_BUFFER_SIZE_FRAMES, frame - mCurrentFrame)))
+			return -1;
+	}
+
+	return mCurrentFrame;
+}
+
+SFB::Audio::Decoder::SeekCost SFB::Audio::OggSpeexDecoder::_GetSeekCost(SInt64 frame) const
+{
+	// Frames a short distance ahead are reached by decoding
+	if(frame >= mCurrentFrame && frame - mCurrentFrame <= (SInt64)(SEEK_MAXIMUM_DECODE_SECONDS * mFormat.mSampleRate))
+		return SeekCostIndexed;
+
+	SInt64 pageGranulePosition, offset;
+	if(-1 != mGranulePositionOffset && mPageIndex.Find(frame - mGranulePositionOffset, pageGranulePosition, offset))
+		return SeekCostIndexed;
+
+	return SeekCostSearch;
+}
+
+bool SFB::Audio::OggSpeexDecoder::ReadPage()
+{
+	for(;;) {
+		while(1 != ogg_sync_pageout(&mOggSyncState, &mOggPage)) {
+			// Read bitstream from input file
+			ssize_t bytesRead = ReadPageData();
+			if(-1 == bytesRead) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggSpeex", "Unable to read from the input file");
+				return false;
 			}
 
-			// Grab a new Ogg page for processing, if necessary
-			if(!mSpeexEOSReached && 0 < packetsDesired) {
-				while(1 != ogg_sync_pageout(&mOggSyncState, &mOggPage)) {
-					// Get the ogg buffer for writing
-					char *data = ogg_sync_buffer(&mOggSyncState, READ_SIZE_BYTES);
+			// No more data available from input file
+			if(0 == bytesRead)
+				return false;
+		}
 
-					// Read bitstream from input file
-					ssize_t bytesRead = (ssize_t)GetInputSource().Read(data, READ_SIZE_BYTES);
-					if(-1 == bytesRead) {
-						LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggSpeex", "Unable to read from the input file");
-						break;
-					}
+		// Pages from other logical streams multiplexed with the Speex stream are skipped
+		// Resetting the stream layer for them would discard Speex packets continued across pages
+		if(ogg_page_serialno(&mOggPage) == mSpeexSerialNumber)
+			break;
+	}
 
-					ogg_sync_wrote(&mOggSyncState, bytesRead);
+	// Granule positions exclude the encoder's lookahead, which isn't trimmed by this decoder.
+	// All packets ending on the previous page have been decoded, so the difference may be measured here.
+	if(-1 == mGranulePositionOffset && 0 < mPageGranulePosition && 1 + mExtraSpeexHeaderCount < mOggPacketCount)
+		mGranulePositionOffset = mFramesDecoded - mPageGranulePosition;
+	mPageGranulePosition = ogg_page_granulepos(&mOggPage);
 
-					// No more data available from input file
-					if(0 == bytesRead)
-						break;
-				}
+	// Get the resultant Ogg page
+	if(0 != ogg_stream_pagein(&mOggStreamState, &mOggPage))
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggSpeex", "Error reading Ogg page");
 
-				// Ensure all Ogg streams are read
-				if(ogg_page_serialno(&mOggPage) != mOggStreamState.serialno)
-					ogg_stream_reset_serialno(&mOggStreamState, ogg_page_serialno(&mOggPage));
+	return true;
+}
 
-				// Get the resultant Ogg page
-				int result = ogg_stream_pagein(&mOggStreamState, &mOggPage);
-				if(0 != result) {
-					LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggSpeex", "Error reading Ogg page");
-					break;
-				}
+bool SFB::Audio::OggSpeexDecoder::DecodeFrame(AudioBufferList *bufferList, UInt32 frameOffset)
+{
+	float *left = (float *)bufferList->mBuffers[0].mData + frameOffset;
+
+	// Mono frames are decoded in place, while stereo frames are expanded in mStereoBuffer and deinterleaved
+	float *buffer = (2 == mFormat.mChannelsPerFrame) ? mStereoBuffer.get() : left;
+
+	int result = speex_decode(mSpeexDecoder, &mSpeexBits, buffer);
+
+	// -1 indicates EOS
+	if(-1 == result)
+		return false;
+	else if(-2 == result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggSpeex", "Ogg Speex decoding error: possible corrupted stream");
+		return false;
+	}
+
+	if(0 > speex_bits_remaining(&mSpeexBits)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggSpeex", "Ogg Speex decoding overflow: possible corrupted stream");
+		return false;
+	}
+
+	// Normalize the values
+	float maxSampleValue = 1u << 15;
+
+	if(2 == mFormat.mChannelsPerFrame) {
+		// The mono frame is expanded in place to interleaved stereo
+		speex_decode_stereo(buffer, mSpeexFrameSize, mSpeexStereoState);
+		vDSP_vsdiv(buffer, 1, &maxSampleValue, buffer, 1, 2 * (vDSP_Length)mSpeexFrameSize);
+
+		DSPSplitComplex output = {
+			.realp = left,
+			.imagp = (float *)bufferList->mBuffers[1].mData + frameOffset
+		};
+
+		vDSP_ctoz((const DSPComplex *)buffer, 2, &output, 1, (vDSP_Length)mSpeexFrameSize);
+	}
+	else
+		vDSP_vsdiv(buffer, 1, &maxSampleValue, buffer, 1, (vDSP_Length)mSpeexFrameSize);
+
+	return true;
+}
+
+UInt32 SFB::Audio::OggSpeexDecoder::CopyBufferedAudio(AudioBufferList *bufferList, UInt32 frameOffset, UInt32 frameCount)
+{
+	UInt32 framesInBuffer = (UInt32)(mBufferList->mBuffers[0].mDataByteSize / sizeof(float));
+	UInt32 framesToCopy = std::min(framesInBuffer, frameCount);
+	if(0 == framesToCopy)
+		return 0;
+
+	for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i) {
+		float *floatBuffer = (float *)mBufferList->mBuffers[i].mData;
+		memcpy((float *)bufferList->mBuffers[i].mData + frameOffset, floatBuffer, framesToCopy * sizeof(float));
+
+		// Move remaining data in buffer to beginning
+		if(framesToCopy != framesInBuffer)
+			memmove(floatBuffer, floatBuffer + framesToCopy, (framesInBuffer - framesToCopy) * sizeof(float));
+
+		mBufferList->mBuffers[i].mDataByteSize -= framesToCopy * sizeof(float);
+	}
+
+	return framesToCopy;
+}
+
+bool SFB::Audio::OggSpeexDecoder::FindPage(SInt64 offset, SInt64 limit, SInt64& pageOffset, SInt64& pageLength, SInt64& granulePosition)
+{
+	if(!GetInputSource().SeekToOffset(offset))
+		return false;
+
+	ogg_sync_state syncState;
+	ogg_sync_init(&syncState);
+
+	// The offset of the first byte in syncState not yet examined
+	SInt64 position = offset;
+	bool found = false;
+
+	while(position < limit) {
+		ogg_page page;
+		long result = ogg_sync_pageseek(&syncState, &page);
+
+		// Bytes skipped while synchronizing
+		if(0 > result)
+			position -= result;
+		else if(0 < result) {
+			if(ogg_page_serialno(&page) == mSpeexSerialNumber && -1 != ogg_page_granulepos(&page)) {
+				pageOffset = position;
+				pageLength = result;
+				granulePosition = ogg_page_granulepos(&page);
+				found = true;
+				break;
 			}
+
+			position += result;
+		}
+		else {
+			char *data = ogg_sync_buffer(&syncState, READ_SIZE_BYTES);
+			SInt64 bytesRead = GetInputSource().Read(data, READ_SIZE_BYTES);
+			if(0 >= bytesRead)
+				break;
+			ogg_sync_wrote(&syncState, (long)bytesRead);
 		}
 	}
 
-	mCurrentFrame += framesRead;
+	ogg_sync_clear(&syncState);
 
-	if(0 == framesRead && mSpeexEOSReached)
-		mTotalFrames = mCurrentFrame;
+	return found;
+}
 
-	return framesRead;
+bool SFB::Audio::OggSpeexDecoder::BisectForGranulePosition(SInt64 granulePosition, SInt64& frame, SInt64& offset)
+{
+	SInt64 length = GetInputSource().GetLength();
+	if(0 >= length)
+		return false;
+
+	SInt64 pageOffset, pageLength, pageGranulePosition;
+
+	// The header pages have a granule position of 0 and precede the first audio page
+	if(-1 == mAudioOffset) {
+		SInt64 headerOffset = 0;
+		for(;;) {
+			if(!FindPage(headerOffset, length, pageOffset, pageLength, pageGranulePosition))
+				return false;
+
+			if(0 < pageGranulePosition) {
+				mAudioOffset = pageOffset;
+				break;
+			}
+
+			headerOffset = pageOffset + pageLength;
+		}
+	}
+
+	// low is always a page boundary from which decoding reaches granulePosition
+	SInt64 low = mAudioOffset;
+	SInt64 high = length;
+	SInt64 lowGranulePosition = -1;
+
+	while(SEEK_BISECTION_THRESHOLD_BYTES < high - low) {
+		SInt64 middle = low + (high - low) / 2;
+		if(!FindPage(middle, high, pageOffset, pageLength, pageGranulePosition) || pageGranulePosition > granulePosition)
+			high = middle;
+		else {
+			low = pageOffset + pageLength;
+			lowGranulePosition = pageGranulePosition;
+		}
+	}
+
+	// Decoding from the first audio page begins with the first frame
+	offset = low;
+	frame = (-1 == lowGranulePosition) ? 0 : lowGranulePosition + ((-1 == mGranulePositionOffset) ? 0 : mGranulePositionOffset);
+
+	return true;
+}
+
+bool SFB::Audio::OggSpeexDecoder::ResumeDecodingAtOffset(SInt64 offset, SInt64 frame, SInt64 pageGranulePosition)
+{
+	if(!GetInputSource().SeekToOffset(offset)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggSpeex", "Unable to seek to offset " << offset);
+		return false;
+	}
+
+	ogg_sync_reset(&mOggSyncState);
+	ogg_stream_reset(&mOggStreamState);
+	speex_bits_reset(&mSpeexBits);
+	speex_decoder_ctl(mSpeexDecoder, SPEEX_RESET_STATE, nullptr);
+
+	for(UInt32 i = 0; i < mBufferList->mNumberBuffers; ++i)
+		mBufferList->mBuffers[i].mDataByteSize = 0;
+
+	// If the granule position offset wasn't measured it has been assumed to be 0, and measuring it after
+	// resuming elsewhere than the first audio page would confirm the assumption, so the assumption is kept
+	if(-1 == mGranulePositionOffset && 0 != frame)
+		mGranulePositionOffset = 0;
+
+	mCurrentFrame = mFramesDecoded = frame;
+	mPageGranulePosition = (0 == frame) ? -1 : pageGranulePosition;
+	mSpeexEOSReached = false;
+
+	return true;
+}
+
+ssize_t SFB::Audio::OggSpeexDecoder::ReadPageData()
+{
+	// Get the ogg buffer for writing
+	char *data = ogg_sync_buffer(&mOggSyncState, READ_SIZE_BYTES);
+
+	SInt64 offset = GetInputSource().GetOffset();
+	ssize_t bytesRead = (ssize_t)GetInputSource().Read(data, READ_SIZE_BYTES);
+	if(-1 == bytesRead)
+		return -1;
+
+	mPageIndex.Scan(data, (size_t)bytesRead, offset);
+
+	// Tell the sync layer how many bytes were written to its internal buffer
+	if(-1 == ogg_sync_wrote(&mOggSyncState, bytesRead))
+		return -1;
+
+	return bytesRead;
 }
@@ -5,12 +5,15 @@
 
 #pragma once
 
+#include <memory>
+
 #include <ogg/ogg.h>
 #include <speex/speex_bits.h>
 #include <speex/speex_stereo.h>
 
 #include "AudioDecoder.h"
 #include "AudioBufferList.h"
+#include "OggPageIndex.h"
 
 namespace SFB {
 
@@ -30,6 +33,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
@@ -53,8 +57,35 @@ namespace SFB {
 			inline virtual SInt64 _GetTotalFrames() const			{ return mTotalFrames; }
 			inline virtual SInt64 _GetCurrentFrame() const			{ return mCurrentFrame; }
 
+			// Seeking support
+			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
+			virtual SInt64 _SeekToFrame(SInt64 frame);
+			virtual SeekCost _GetSeekCost(SInt64 frame) const;
+
+			// Read from the input source into the Ogg sync layer, indexing the pages read
+			ssize_t ReadPageData();
+
+			// Submit the next page of the Speex stream to the stream layer, returning false at the end of input
+			bool ReadPage();
+
+			// Decode a Speex frame into bufferList starting at frameOffset
+			bool DecodeFrame(AudioBufferList *bufferList, UInt32 frameOffset);
+
+			// Move up to frameCount frames of previously decoded audio to bufferList starting at frameOffset
+			UInt32 CopyBufferedAudio(AudioBufferList *bufferList, UInt32 frameOffset, UInt32 frameCount);
+
+			// Find the first Speex page with a granule position starting at or after offset and before limit
+			bool FindPage(SInt64 offset, SInt64 limit, SInt64& pageOffset, SInt64& pageLength, SInt64& granulePosition);
+
+			// Bisect the file for the page boundary from which decoding reaches granulePosition
+			bool BisectForGranulePosition(SInt64 granulePosition, SInt64& frame, SInt64& offset);
+
+			// Discard all decoding state and resume decoding at offset, which begins with frame
+			bool ResumeDecodingAtOffset(SInt64 offset, SInt64 frame, SInt64 pageGranulePosition);
+
 			// Data members
-			BufferList			mBufferList;
+			BufferList			mBufferList;		// Decoded audio not yet returned, holding at most one packet
+			std::unique_ptr<float []> mStereoBuffer;	// Interleaved stereo expanded from a mono frame
 			SInt64				mCurrentFrame;
 			SInt64				mTotalFrames;
 
@@ -69,8 +100,15 @@ namespace SFB {
 			long				mSpeexSerialNumber;
 			bool				mSpeexEOSReached;
 			spx_int32_t			mSpeexFramesPerOggPacket;
+			spx_int32_t			mSpeexFrameSize;
 			UInt32				mOggPacketCount;
 			UInt32				mExtraSpeexHeaderCount;
+
+			OggPageIndex		mPageIndex;
+			SInt64				mFramesDecoded;
+			SInt64				mPageGranulePosition;
+			SInt64				mGranulePositionOffset;
+			SInt64				mAudioOffset;		// The offset of the first audio page, or -1 if unknown
 		};
 
 	}
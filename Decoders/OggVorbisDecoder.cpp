@@ -3,6 +3,9 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <climits>
+#include <cstddef>
+
 #include <AudioToolbox/AudioFormat.h>
 
 #include "OggVorbisDecoder.h"
@@ -10,10 +13,11 @@
 #include "CFErrorUtilities.h"
 #include "Logger.h"
 
-#define BUFFER_SIZE_FRAMES 2048
-
 namespace {
 
+	// Identifies the codec state recorded in state snapshots
+	const UInt32 kStateSnapshotKind = 'OggV';
+
 	void RegisterOggVorbisDecoder() __attribute__ ((constructor));
 	void RegisterOggVorbisDecoder()
 	{
@@ -22,14 +26,6 @@ namespace {
 
 #pragma mark Callbacks
 
-	size_t read_func_callback(void *ptr, size_t size, size_t nmemb, void *datasource)
-	{
-		assert(nullptr != datasource);
-
-		auto decoder = static_cast<SFB::Audio::OggVorbisDecoder *>(datasource);
-		return (size_t)decoder->GetInputSource().Read(ptr, (SInt64)(size * nmemb));
-	}
-
 	int seek_func_callback(void *datasource, ogg_int64_t offset, int whence)
 	{
 		assert(nullptr != datasource);
@@ -104,6 +100,23 @@ bool SFB::Audio::OggVorbisDecoder::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::OggVorbisDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	// The identification header is the first packet following the page header and segment table
+	if(27 <= length && 0 == memcmp(bytes, "OggS", 4)) {
+		size_t packetOffset = 27 + bytes[26];
+		if(packetOffset + 7 <= length && 0 == memcmp(bytes + packetOffset, "\x01" "vorbis", 7))
+			return true;
+	}
+
+	return false;
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::OggVorbisDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new OggVorbisDecoder(std::move(inputSource)));
@@ -112,7 +125,7 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::OggVorbisDecoder::CreateDecoder(Inpu
 #pragma mark Creation and Destruction
 
 SFB::Audio::OggVorbisDecoder::OggVorbisDecoder(InputSource::unique_ptr inputSource)
-	: Decoder(std::move(inputSource))
+	: Decoder(std::move(inputSource)), mLentPCM(nullptr), mLentFrameOffset(0), mLentFrameCount(0)
 {
 	memset(&mVorbisFile, 0, sizeof(mVorbisFile));
 }
@@ -128,12 +141,18 @@ SFB::Audio::OggVorbisDecoder::~OggVorbisDecoder()
 bool SFB::Audio::OggVorbisDecoder::_Open(CFErrorRef *error)
 {
 	ov_callbacks callbacks = {
-		.read_func = read_func_callback,
+		.read_func = ReadCallback,
 		.seek_func = seek_func_callback,
 		.tell_func = tell_func_callback,
 		.close_func = nullptr
 	};
 
+	mPageIndex.Reset();
+
+	mLentPCM = nullptr;
+	mLentFrameOffset = 0;
+	mLentFrameCount = 0;
+
 	if(0 != ov_test_callbacks(this, &mVorbisFile, nullptr, 0, callbacks)) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid Ogg Vorbis file."), ""));
@@ -211,6 +230,8 @@ bool SFB::Audio::OggVorbisDecoder::_Open(CFErrorRef *error)
 			break;
 	}
 
+	mLentBufferListStorage.reset(new uint8_t [offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * mFormat.mChannelsPerFrame)]);
+
 	return true;
 }
 
@@ -219,6 +240,10 @@ bool SFB::Audio::OggVorbisDecoder::_Close(CFErrorRef */*error*/)
 	if(0 != ov_clear(&mVorbisFile))
 		LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.OggVorbis", "ov_clear failed");
 
+	mLentPCM = nullptr;
+	mLentFrameCount = 0;
+	mLentBufferListStorage.reset();
+
 	return true;
 }
 
@@ -248,11 +273,27 @@ UInt32 SFB::Audio::OggVorbisDecoder::_ReadAudio(AudioBufferList *bufferList, UIn
 		bufferList->mBuffers[i].mNumberChannels = 1;
 	}
 
+	// Audio lent by _PeekAudio() and not yet consumed precedes newly decoded audio
+	// The lent block is only replaced by ov_read_float() once it has been copied in full
+	if(0 < mLentFrameCount) {
+		UInt32 framesToCopy = std::min(mLentFrameCount, frameCount);
+		for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel)
+			memcpy(bufferList->mBuffers[channel].mData, mLentPCM[channel] + mLentFrameOffset, framesToCopy * sizeof(float));
+
+		mLentFrameOffset += framesToCopy;
+		mLentFrameCount -= framesToCopy;
+
+		totalFramesRead += framesToCopy;
+		framesRemaining -= framesToCopy;
+	}
+
 	while(0 < framesRemaining) {
 		// Decode a chunk of samples from the file
+		// ov_read_float() returns at most the remainder of the current Vorbis block, so the request isn't capped
+		// and a single call to _ReadAudio() spans as many blocks as frameCount allows
 		long framesRead = ov_read_float(&mVorbisFile,
 										&buffer,
-										std::min(BUFFER_SIZE_FRAMES, (int)framesRemaining),
+										(int)std::min(framesRemaining, (UInt32)INT_MAX),
 										&currentSection);
 
 		if(0 > framesRead) {
@@ -264,22 +305,29 @@ UInt32 SFB::Audio::OggVorbisDecoder::_ReadAudio(AudioBufferList *bufferList, UIn
 		if(0 == framesRead)
 			break;
 
-		// Copy the frames from the decoding buffer to the output buffer
-		for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel) {
-			// Skip over any frames already decoded
+		// Copy the frames directly from the decoder's PCM arrays to the output buffer, following any frames already decoded
+		for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel)
 			memcpy((float *)bufferList->mBuffers[channel].mData + totalFramesRead, buffer[channel], (size_t)framesRead * sizeof(float));
-			bufferList->mBuffers[channel].mDataByteSize += (size_t)framesRead * sizeof(float);
-		}
 
 		totalFramesRead += (UInt32)framesRead;
 		framesRemaining -= (UInt32)framesRead;
 	}
 
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+		bufferList->mBuffers[i].mDataByteSize = totalFramesRead * sizeof(float);
+
 	return totalFramesRead;
 }
 
 SInt64 SFB::Audio::OggVorbisDecoder::_SeekToFrame(SInt64 frame)
 {
+	mLentFrameCount = 0;
+
+	// Decoding resumes from the indexed page boundary preceding frame, avoiding a bisection search of the file
+	SInt64 pageGranulePosition, offset;
+	if(mPageIndex.Find(frame, pageGranulePosition, offset) && 0 == ov_raw_seek(&mVorbisFile, offset) && SkipToFrame(frame))
+		return _GetCurrentFrame();
+
 	if(0 != ov_pcm_seek(&mVorbisFile, frame)) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggVorbis", "Ogg Vorbis seek error");
 		return -1;
@@ -287,3 +335,113 @@ SInt64 SFB::Audio::OggVorbisDecoder::_SeekToFrame(SInt64 frame)
 
 	return _GetCurrentFrame();
 }
+
+SInt64 SFB::Audio::OggVorbisDecoder::_SeekToFrameApproximately(SInt64 frame)
+{
+	mLentFrameCount = 0;
+
+	// Decoding resumes from the page boundary preceding frame without decoding up to it
+	SInt64 pageGranulePosition, offset;
+	if(mPageIndex.Find(frame, pageGranulePosition, offset) && 0 == ov_raw_seek(&mVorbisFile, offset))
+		return _GetCurrentFrame();
+
+	if(0 != ov_pcm_seek_page(&mVorbisFile, frame)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggVorbis", "Ogg Vorbis seek error");
+		return -1;
+	}
+
+	return _GetCurrentFrame();
+}
+
+SFB::Audio::Decoder::SeekCost SFB::Audio::OggVorbisDecoder::_GetSeekCost(SInt64 frame) const
+{
+	SInt64 pageGranulePosition, offset;
+	return mPageIndex.Find(frame, pageGranulePosition, offset) ? SeekCostIndexed : SeekCostSearch;
+}
+
+bool SFB::Audio::OggVorbisDecoder::_AppendStateSnapshot(SInt64 frame, CFMutableDataRef data) const
+{
+	return mPageIndex.AppendStateSnapshot(frame, kStateSnapshotKind, data);
+}
+
+SInt64 SFB::Audio::OggVorbisDecoder::_RestoreStateSnapshot(SInt64 frame, const UInt8 *data, CFIndex length)
+{
+	mLentFrameCount = 0;
+
+	// Decoding resumes from the recorded page boundary, avoiding a bisection search of the file
+	SInt64 pageGranulePosition, offset;
+	if(OggPageIndex::ReadStateSnapshot(data, length, kStateSnapshotKind, pageGranulePosition, offset) && pageGranulePosition <= frame && 0 == ov_raw_seek(&mVorbisFile, offset) && SkipToFrame(frame))
+		return _GetCurrentFrame();
+
+	return _SeekToFrame(frame);
+}
+
+const AudioBufferList * SFB::Audio::OggVorbisDecoder::_PeekAudio(UInt32& frameCount)
+{
+	// Decode the next block once the previous one is consumed
+	if(0 == mLentFrameCount) {
+		int currentSection = 0;
+		long framesRead = ov_read_float(&mVorbisFile, &mLentPCM, INT_MAX, &currentSection);
+
+		if(0 > framesRead) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.OggVorbis", "Ogg Vorbis decoding error");
+			framesRead = 0;
+		}
+
+		mLentFrameOffset = 0;
+		mLentFrameCount = (UInt32)framesRead;
+	}
+
+	frameCount = mLentFrameCount;
+	if(0 == frameCount)
+		return nullptr;
+
+	auto bufferList = (AudioBufferList *)mLentBufferListStorage.get();
+	bufferList->mNumberBuffers = mFormat.mChannelsPerFrame;
+	for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel) {
+		bufferList->mBuffers[channel].mNumberChannels = 1;
+		bufferList->mBuffers[channel].mDataByteSize = mLentFrameCount * sizeof(float);
+		bufferList->mBuffers[channel].mData = mLentPCM[channel] + mLentFrameOffset;
+	}
+
+	return bufferList;
+}
+
+void SFB::Audio::OggVorbisDecoder::_ConsumeAudio(UInt32 frameCount)
+{
+	if(frameCount > mLentFrameCount) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.OggVorbis", "_ConsumeAudio() called with more frames than were lent");
+		frameCount = mLentFrameCount;
+	}
+
+	mLentFrameOffset += frameCount;
+	mLentFrameCount -= frameCount;
+}
+
+size_t SFB::Audio::OggVorbisDecoder::ReadCallback(void *ptr, size_t size, size_t nmemb, void *datasource)
+{
+	assert(nullptr != datasource);
+
+	auto decoder = static_cast<OggVorbisDecoder *>(datasource);
+	SInt64 offset = decoder->GetInputSource().GetOffset();
+	SInt64 bytesRead = decoder->GetInputSource().Read(ptr, (SInt64)(size * nmemb));
+	if(0 < bytesRead)
+		decoder->mPageIndex.Scan(ptr, (size_t)bytesRead, offset);
+	return (size_t)bytesRead;
+}
+
+bool SFB::Audio::OggVorbisDecoder::SkipToFrame(SInt64 frame)
+{
+	float		**buffer			= nullptr;
+	int			currentSection		= 0;
+
+	SInt64 currentFrame = _GetCurrentFrame();
+	while(currentFrame < frame) {
+		long framesRead = ov_read_float(&mVorbisFile, &buffer, (int)std::min((SInt64)INT_MAX, frame - currentFrame), &currentSection);
+		if(0 >= framesRead)
+			return false;
+		currentFrame += framesRead;
+	}
+
+	return currentFrame == frame;
+}
@@ -13,6 +13,7 @@
 #pragma clang diagnostic pop
 
 #import "AudioDecoder.h"
+#import "OggPageIndex.h"
 
 namespace SFB {
 
@@ -32,6 +33,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
@@ -53,14 +55,38 @@ namespace SFB {
 
 			// Source audio information
 			inline virtual SInt64 _GetTotalFrames() const			{ return ov_pcm_total(const_cast<OggVorbis_File *>(&mVorbisFile), -1); }
-			inline virtual SInt64 _GetCurrentFrame() const			{ return ov_pcm_tell(const_cast<OggVorbis_File *>(&mVorbisFile)); }
+			inline virtual SInt64 _GetCurrentFrame() const			{ return ov_pcm_tell(const_cast<OggVorbis_File *>(&mVorbisFile)) - mLentFrameCount; }
 
 			// Seeking support
 			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
+			virtual SInt64 _SeekToFrameApproximately(SInt64 frame);
+			virtual SeekCost _GetSeekCost(SInt64 frame) const;
+
+			// State snapshots record the indexed page from which decoding resumes
+			virtual bool _AppendStateSnapshot(SInt64 frame, CFMutableDataRef data) const;
+			virtual SInt64 _RestoreStateSnapshot(SInt64 frame, const UInt8 *data, CFIndex length);
+
+			// Vorbis blocks are lent from the decoder's PCM arrays
+			inline virtual bool _SupportsBorrowedAudio() const		{ return true; }
+			virtual const AudioBufferList * _PeekAudio(UInt32& frameCount);
+			virtual void _ConsumeAudio(UInt32 frameCount);
+
+			// Read from the input source, indexing the pages read
+			static size_t ReadCallback(void *ptr, size_t size, size_t nmemb, void *datasource);
+
+			// Decode and discard audio until frame is reached
+			bool SkipToFrame(SInt64 frame);
 
 			// Data members
 			OggVorbis_File		mVorbisFile;
+			OggPageIndex		mPageIndex;
+
+			// The block most recently returned by ov_read_float() for _PeekAudio(), valid until the next call
+			float				**mLentPCM;
+			UInt32				mLentFrameOffset;
+			UInt32				mLentFrameCount;
+			std::unique_ptr<uint8_t []>	mLentBufferListStorage;
 		};
 
 	}
@@ -0,0 +1,531 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "PCMFileDecoder.h"
+#include "CFWrapper.h"
+#include "CFErrorUtilities.h"
+#include "Logger.h"
+
+namespace {
+
+	void RegisterPCMFileDecoder() __attribute__ ((constructor));
+	void RegisterPCMFileDecoder()
+	{
+		SFB::Audio::Decoder::RegisterSubclass<SFB::Audio::PCMFileDecoder>();
+	}
+
+	// WAVE format tags
+	const uint16_t kWAVEFormatPCM			= 0x0001;
+	const uint16_t kWAVEFormatIEEEFloat		= 0x0003;
+	const uint16_t kWAVEFormatExtensible	= 0xFFFE;
+
+	CFStringRef sSupportedExtensions [] = { CFSTR("wav"), CFSTR("wave"), CFSTR("rf64"), CFSTR("aif"), CFSTR("aiff"), CFSTR("aifc") };
+	CFStringRef sSupportedMIMETypes [] = { CFSTR("audio/wav"), CFSTR("audio/wave"), CFSTR("audio/x-wav"), CFSTR("audio/aiff"), CFSTR("audio/x-aiff") };
+
+	// Advance past byteCount bytes of input, reading through them if the input source is not seekable
+	bool SkipBytes(SFB::InputSource& inputSource, SInt64 byteCount)
+	{
+		if(inputSource.SupportsSeeking())
+			return inputSource.SeekToOffset(inputSource.GetOffset() + byteCount);
+
+		uint8_t buf [4096];
+		while(0 < byteCount) {
+			auto bytesRead = inputSource.Read(buf, std::min(byteCount, (SInt64)sizeof(buf)));
+			if(0 >= bytesRead)
+				return false;
+			byteCount -= bytesRead;
+		}
+
+		return true;
+	}
+
+	// Convert a big-endian 80-bit IEEE 754 extended precision value, as used for the AIFF sample rate
+	double ConvertFromExtended(const uint8_t *bytes)
+	{
+		int exponent = ((bytes[0] & 0x7f) << 8) | bytes[1];
+
+		uint64_t mantissa = 0;
+		for(int i = 2; i < 10; ++i)
+			mantissa = (mantissa << 8) | bytes[i];
+
+		if(0 == exponent && 0 == mantissa)
+			return 0;
+
+		double value = ldexp((double)mantissa, exponent - 16383 - 63);
+		return (bytes[0] & 0x80) ? -value : value;
+	}
+
+	CFErrorRef CreateInvalidPCMFileError(CFURLRef url) CF_RETURNS_RETAINED
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid WAVE or AIFF file."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not a WAVE or AIFF file"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
+
+		return CreateErrorForURL(SFB::Audio::Decoder::ErrorDomain, SFB::Audio::Decoder::InputOutputError, description, url, failureReason, recoverySuggestion);
+	}
+
+	CFErrorRef CreateUnsupportedPCMFileError(CFURLRef url) CF_RETURNS_RETAINED
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The format of the file “%@” is not supported."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Unsupported file format"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("Only uncompressed integer and floating-point PCM is supported."), ""));
+
+		return CreateErrorForURL(SFB::Audio::Decoder::ErrorDomain, SFB::Audio::Decoder::FileFormatNotSupportedError, description, url, failureReason, recoverySuggestion);
+	}
+
+}
+
+#pragma mark Static Methods
+
+CFArrayRef SFB::Audio::PCMFileDecoder::CreateSupportedFileExtensions()
+{
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)sSupportedExtensions, sizeof(sSupportedExtensions) / sizeof(sSupportedExtensions[0]), &kCFTypeArrayCallBacks);
+}
+
+CFArrayRef SFB::Audio::PCMFileDecoder::CreateSupportedMIMETypes()
+{
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)sSupportedMIMETypes, sizeof(sSupportedMIMETypes) / sizeof(sSupportedMIMETypes[0]), &kCFTypeArrayCallBacks);
+}
+
+bool SFB::Audio::PCMFileDecoder::HandlesFilesWithExtension(CFStringRef extension)
+{
+	if(nullptr == extension)
+		return false;
+
+	for(auto supportedExtension : sSupportedExtensions) {
+		if(kCFCompareEqualTo == CFStringCompare(extension, supportedExtension, kCFCompareCaseInsensitive))
+			return true;
+	}
+
+	return false;
+}
+
+bool SFB::Audio::PCMFileDecoder::HandlesMIMEType(CFStringRef mimeType)
+{
+	if(nullptr == mimeType)
+		return false;
+
+	for(auto supportedMIMEType : sSupportedMIMETypes) {
+		if(kCFCompareEqualTo == CFStringCompare(mimeType, supportedMIMEType, kCFCompareCaseInsensitive))
+			return true;
+	}
+
+	return false;
+}
+
+bool SFB::Audio::PCMFileDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header || 12 > length)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	if((0 == memcmp(bytes, "RIFF", 4) || 0 == memcmp(bytes, "RF64", 4)) && 0 == memcmp(bytes + 8, "WAVE", 4))
+		return true;
+
+	return 0 == memcmp(bytes, "FORM", 4) && (0 == memcmp(bytes + 8, "AIFF", 4) || 0 == memcmp(bytes + 8, "AIFC", 4));
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::PCMFileDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
+{
+	return unique_ptr(new PCMFileDecoder(std::move(inputSource)));
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::PCMFileDecoder::PCMFileDecoder(InputSource::unique_ptr inputSource)
+	: Decoder(std::move(inputSource)), mContainer(Container::Unknown), mTotalFrames(-1), mCurrentFrame(0), mAudioOffset(0)
+{}
+
+SFB::Audio::PCMFileDecoder::~PCMFileDecoder()
+{
+	if(IsOpen())
+		Close();
+}
+
+#pragma mark Functionality
+
+bool SFB::Audio::PCMFileDecoder::_Open(CFErrorRef *error)
+{
+	uint32_t chunkID;
+	if(!GetInputSource().ReadBE<uint32_t>(chunkID)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Unable to read file header");
+		if(error)
+			*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+		return false;
+	}
+
+	bool result = false;
+	switch(chunkID) {
+		case 'RIFF':	mContainer = Container::WAVE;	result = OpenWAVE(error);	break;
+		case 'RF64':	mContainer = Container::RF64;	result = OpenWAVE(error);	break;
+		case 'FORM':	result = OpenAIFF(error);									break;
+
+		default:
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Unknown file type");
+			if(error)
+				*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+			break;
+	}
+
+	if(!result)
+		return false;
+
+	if(mAudioOffset != GetInputSource().GetOffset() && !GetInputSource().SeekToOffset(mAudioOffset)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Unable to seek to audio data at offset " << mAudioOffset);
+		if(error)
+			*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+		return false;
+	}
+
+	mCurrentFrame = 0;
+
+	return true;
+}
+
+bool SFB::Audio::PCMFileDecoder::_Close(CFErrorRef */*error*/)
+{
+	mContainer = Container::Unknown;
+	mTotalFrames = -1;
+	mCurrentFrame = 0;
+	mAudioOffset = 0;
+
+	return true;
+}
+
+SFB::CFString SFB::Audio::PCMFileDecoder::_GetSourceFormatDescription() const
+{
+	const char *containerName = "";
+	switch(mContainer) {
+		case Container::Unknown:	break;
+		case Container::WAVE:		containerName = "WAVE";		break;
+		case Container::RF64:		containerName = "RF64";		break;
+		case Container::AIFF:		containerName = "AIFF";		break;
+		case Container::AIFC:		containerName = "AIFF-C";	break;
+	}
+
+	return CFString(nullptr,
+					CFSTR("%s, %u channels, %u Hz"),
+					containerName,
+					(unsigned int)mSourceFormat.mChannelsPerFrame,
+					(unsigned int)mSourceFormat.mSampleRate);
+}
+
+UInt32 SFB::Audio::PCMFileDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	// The samples are stored interleaved, exactly as delivered
+	UInt32 framesToRead = (UInt32)std::min((SInt64)frameCount, mTotalFrames - mCurrentFrame);
+	SInt64 bytesRead = 0;
+	if(0 < framesToRead)
+		bytesRead = GetInputSource().Read(bufferList->mBuffers[0].mData, (SInt64)mFormat.FrameCountToByteCount(framesToRead));
+
+	UInt32 framesRead = 0 < bytesRead ? (UInt32)mFormat.ByteCountToFrameCount((size_t)bytesRead) : 0;
+
+	// A partial frame at the end of truncated input is discarded
+	bufferList->mBuffers[0].mDataByteSize = (UInt32)mFormat.FrameCountToByteCount(framesRead);
+	bufferList->mBuffers[0].mNumberChannels = mFormat.mChannelsPerFrame;
+
+	mCurrentFrame += framesRead;
+
+	return framesRead;
+}
+
+SInt64 SFB::Audio::PCMFileDecoder::_SeekToFrame(SInt64 frame)
+{
+	SInt64 offset = mAudioOffset + (SInt64)mFormat.FrameCountToByteCount((size_t)frame);
+	if(!GetInputSource().SeekToOffset(offset)) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.PCMFile", "_SeekToFrame() failed for offset: " << offset);
+		return -1;
+	}
+
+	mCurrentFrame = frame;
+
+	return _GetCurrentFrame();
+}
+
+bool SFB::Audio::PCMFileDecoder::OpenWAVE(CFErrorRef *error)
+{
+	uint32_t riffSize, formType;
+	if(!GetInputSource().ReadLE<uint32_t>(riffSize) || !GetInputSource().ReadBE<uint32_t>(formType) || 'WAVE' != formType) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Not a WAVE file");
+		if(error)
+			*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+		return false;
+	}
+
+	bool sawFormat = false;
+	uint16_t formatTag = 0, channelCount = 0, blockAlign = 0, bitsPerSample = 0, validBitsPerSample = 0;
+	uint32_t sampleRate = 0, channelMask = 0;
+
+	// RF64 files store the sizes of chunks larger than 4 GB in the 'ds64' chunk
+	uint64_t dataSize64 = 0;
+	uint64_t dataSize = 0;
+
+	for(;;) {
+		uint32_t chunkID, chunkSize;
+		if(!GetInputSource().ReadBE<uint32_t>(chunkID) || !GetInputSource().ReadLE<uint32_t>(chunkSize)) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Missing 'data' chunk");
+			if(error)
+				*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+			return false;
+		}
+
+		if('ds64' == chunkID) {
+			uint64_t riffSize64;
+			if(24 > chunkSize || !GetInputSource().ReadLE<uint64_t>(riffSize64) || !GetInputSource().ReadLE<uint64_t>(dataSize64) || !SkipBytes(GetInputSource(), chunkSize - 16)) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Invalid 'ds64' chunk");
+				if(error)
+					*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+				return false;
+			}
+		}
+		else if('fmt ' == chunkID) {
+			uint32_t byteRate;
+			if(16 > chunkSize || !GetInputSource().ReadLE<uint16_t>(formatTag) || !GetInputSource().ReadLE<uint16_t>(channelCount) || !GetInputSource().ReadLE<uint32_t>(sampleRate) || !GetInputSource().ReadLE<uint32_t>(byteRate) || !GetInputSource().ReadLE<uint16_t>(blockAlign) || !GetInputSource().ReadLE<uint16_t>(bitsPerSample)) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Invalid 'fmt ' chunk");
+				if(error)
+					*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+				return false;
+			}
+
+			validBitsPerSample = bitsPerSample;
+			SInt64 bytesRemaining = chunkSize - 16;
+
+			// The actual format of WAVE_FORMAT_EXTENSIBLE is given by the first two bytes of the subformat GUID
+			if(kWAVEFormatExtensible == formatTag && 26 <= bytesRemaining) {
+				uint16_t extensionSize, validBits, subFormat;
+				if(!GetInputSource().ReadLE<uint16_t>(extensionSize) || !GetInputSource().ReadLE<uint16_t>(validBits) || !GetInputSource().ReadLE<uint32_t>(channelMask) || !GetInputSource().ReadLE<uint16_t>(subFormat)) {
+					LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Invalid 'fmt ' chunk extension");
+					if(error)
+						*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+					return false;
+				}
+
+				if(validBits)
+					validBitsPerSample = validBits;
+				formatTag = subFormat;
+				bytesRemaining -= 10;
+			}
+
+			if(!SkipBytes(GetInputSource(), bytesRemaining + (chunkSize & 1))) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Invalid 'fmt ' chunk");
+				if(error)
+					*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+				return false;
+			}
+
+			sawFormat = true;
+		}
+		else if('data' == chunkID) {
+			mAudioOffset = GetInputSource().GetOffset();
+			dataSize = (Container::RF64 == mContainer && 0xFFFFFFFF == chunkSize) ? dataSize64 : chunkSize;
+			break;
+		}
+		else if(!SkipBytes(GetInputSource(), (SInt64)chunkSize + (chunkSize & 1))) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Missing 'data' chunk");
+			if(error)
+				*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+			return false;
+		}
+	}
+
+	if(!sawFormat || 0 == channelCount || 0 == sampleRate || 0 == blockAlign || 0 != blockAlign % channelCount) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Missing or invalid 'fmt ' chunk");
+		if(error)
+			*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+		return false;
+	}
+
+	UInt32 bytesPerSample = blockAlign / channelCount;
+
+	AudioFormatFlags formatFlags = 0;
+	if(kWAVEFormatPCM == formatTag && 1 <= bytesPerSample && 4 >= bytesPerSample && validBitsPerSample <= 8 * bytesPerSample)
+		// 8-bit WAVE samples are unsigned
+		formatFlags = 1 == bytesPerSample ? 0 : kAudioFormatFlagIsSignedInteger;
+	else if(kWAVEFormatIEEEFloat == formatTag && (4 == bytesPerSample || 8 == bytesPerSample) && 8 * bytesPerSample == validBitsPerSample)
+		formatFlags = kAudioFormatFlagIsFloat;
+	else {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Unsupported WAVE format " << formatTag << " with " << bitsPerSample << " bits per sample");
+		if(error)
+			*error = CreateUnsupportedPCMFileError(mInputSource->GetURL());
+		return false;
+	}
+
+	SetFormat(channelCount, sampleRate, validBitsPerSample, bytesPerSample, formatFlags);
+
+	// Files still being written may not have a valid data size
+	SInt64 inputLength = GetInputSource().GetLength();
+	if(0 < inputLength && (0 == dataSize || (SInt64)dataSize > inputLength - mAudioOffset))
+		dataSize = (uint64_t)(inputLength - mAudioOffset);
+
+	mTotalFrames = (SInt64)(dataSize / blockAlign);
+
+	// WAVE channel mask bits have the same meaning as Core Audio channel bitmap bits
+	if(channelMask)
+		mChannelLayout = ChannelLayout::ChannelLayoutWithBitmap(channelMask);
+	else if(1 == channelCount)
+		mChannelLayout = ChannelLayout::ChannelLayoutWithTag(kAudioChannelLayoutTag_Mono);
+	else if(2 == channelCount)
+		mChannelLayout = ChannelLayout::ChannelLayoutWithTag(kAudioChannelLayoutTag_Stereo);
+
+	return true;
+}
+
+bool SFB::Audio::PCMFileDecoder::OpenAIFF(CFErrorRef *error)
+{
+	uint32_t formSize, formType;
+	if(!GetInputSource().ReadBE<uint32_t>(formSize) || !GetInputSource().ReadBE<uint32_t>(formType) || ('AIFF' != formType && 'AIFC' != formType)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Not an AIFF file");
+		if(error)
+			*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+		return false;
+	}
+
+	mContainer = 'AIFC' == formType ? Container::AIFC : Container::AIFF;
+
+	bool sawCommon = false, sawSoundData = false;
+	uint16_t channelCount = 0, sampleSize = 0;
+	uint32_t sampleFrameCount = 0, compressionType = 'NONE';
+	Float64 sampleRate = 0;
+	uint64_t dataSize = 0;
+
+	// 'SSND' usually follows 'COMM'; if not, the remainder of the file is searched for 'COMM'
+	while(!sawCommon || !sawSoundData) {
+		uint32_t chunkID, chunkSize;
+		if(!GetInputSource().ReadBE<uint32_t>(chunkID) || !GetInputSource().ReadBE<uint32_t>(chunkSize)) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Missing 'COMM' or 'SSND' chunk");
+			if(error)
+				*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+			return false;
+		}
+
+		if('COMM' == chunkID) {
+			uint8_t extendedSampleRate [10];
+			if(18 > chunkSize || !GetInputSource().ReadBE<uint16_t>(channelCount) || !GetInputSource().ReadBE<uint32_t>(sampleFrameCount) || !GetInputSource().ReadBE<uint16_t>(sampleSize) || 10 != GetInputSource().Read(extendedSampleRate, 10)) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Invalid 'COMM' chunk");
+				if(error)
+					*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+				return false;
+			}
+
+			sampleRate = ConvertFromExtended(extendedSampleRate);
+			SInt64 bytesRemaining = chunkSize - 18;
+
+			if(Container::AIFC == mContainer) {
+				if(4 > bytesRemaining || !GetInputSource().ReadBE<uint32_t>(compressionType)) {
+					LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Invalid 'COMM' chunk");
+					if(error)
+						*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+					return false;
+				}
+				bytesRemaining -= 4;
+			}
+
+			if(!SkipBytes(GetInputSource(), bytesRemaining + (chunkSize & 1))) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Invalid 'COMM' chunk");
+				if(error)
+					*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+				return false;
+			}
+
+			sawCommon = true;
+		}
+		else if('SSND' == chunkID) {
+			uint32_t offset, blockSize;
+			if(8 > chunkSize || !GetInputSource().ReadBE<uint32_t>(offset) || !GetInputSource().ReadBE<uint32_t>(blockSize) || offset > chunkSize - 8) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Invalid 'SSND' chunk");
+				if(error)
+					*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+				return false;
+			}
+
+			mAudioOffset = GetInputSource().GetOffset() + offset;
+			dataSize = chunkSize - 8 - offset;
+			sawSoundData = true;
+
+			if(!sawCommon && !SkipBytes(GetInputSource(), (SInt64)chunkSize - 8 + (chunkSize & 1))) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Missing 'COMM' chunk");
+				if(error)
+					*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+				return false;
+			}
+		}
+		else if(!SkipBytes(GetInputSource(), (SInt64)chunkSize + (chunkSize & 1))) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Missing 'COMM' or 'SSND' chunk");
+			if(error)
+				*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+			return false;
+		}
+	}
+
+	if(0 == channelCount || 0 == sampleSize || 0 >= sampleRate) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Invalid 'COMM' chunk");
+		if(error)
+			*error = CreateInvalidPCMFileError(mInputSource->GetURL());
+		return false;
+	}
+
+	UInt32 bytesPerSample = (sampleSize + 7) / 8;
+
+	// AIFF samples are big-endian signed integers; AIFF-C adds little-endian and floating-point variants
+	AudioFormatFlags formatFlags = 0;
+	if(('NONE' == compressionType || 'twos' == compressionType) && 4 >= bytesPerSample)
+		formatFlags = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsBigEndian;
+	else if('sowt' == compressionType && 4 >= bytesPerSample)
+		formatFlags = kAudioFormatFlagIsSignedInteger;
+	else if(('fl32' == compressionType || 'FL32' == compressionType) && 4 == bytesPerSample)
+		formatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsBigEndian;
+	else if(('fl64' == compressionType || 'FL64' == compressionType) && 8 == bytesPerSample)
+		formatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsBigEndian;
+	else {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.PCMFile", "Unsupported AIFF-C compression type " << compressionType << " with " << sampleSize << " bits per sample");
+		if(error)
+			*error = CreateUnsupportedPCMFileError(mInputSource->GetURL());
+		return false;
+	}
+
+	// Byte order is irrelevant for single byte samples
+	if(1 == bytesPerSample)
+		formatFlags &= ~kAudioFormatFlagIsBigEndian;
+
+	SetFormat(channelCount, sampleRate, sampleSize, bytesPerSample, formatFlags);
+
+	SInt64 inputLength = GetInputSource().GetLength();
+	if(0 < inputLength && (SInt64)dataSize > inputLength - mAudioOffset)
+		dataSize = (uint64_t)(inputLength - mAudioOffset);
+
+	mTotalFrames = std::min((SInt64)sampleFrameCount, (SInt64)(dataSize / mFormat.mBytesPerFrame));
+
+	if(1 == channelCount)
+		mChannelLayout = ChannelLayout::ChannelLayoutWithTag(kAudioChannelLayoutTag_Mono);
+	else if(2 == channelCount)
+		mChannelLayout = ChannelLayout::ChannelLayoutWithTag(kAudioChannelLayoutTag_Stereo);
+
+	return true;
+}
+
+void SFB::Audio::PCMFileDecoder::SetFormat(UInt32 channelsPerFrame, Float64 sampleRate, UInt32 bitsPerChannel, UInt32 bytesPerSample, AudioFormatFlags formatFlags)
+{
+	// Samples are delivered interleaved as stored, so the output and source formats are identical
+	mFormat.mFormatID			= kAudioFormatLinearPCM;
+	mFormat.mFormatFlags		= formatFlags | (8 * bytesPerSample == bitsPerChannel ? kAudioFormatFlagIsPacked : kAudioFormatFlagIsAlignedHigh);
+
+	mFormat.mSampleRate			= sampleRate;
+	mFormat.mChannelsPerFrame	= channelsPerFrame;
+	mFormat.mBitsPerChannel		= bitsPerChannel;
+
+	mFormat.mBytesPerPacket		= bytesPerSample * channelsPerFrame;
+	mFormat.mFramesPerPacket	= 1;
+	mFormat.mBytesPerFrame		= mFormat.mBytesPerPacket * mFormat.mFramesPerPacket;
+
+	mFormat.mReserved			= 0;
+
+	mSourceFormat				= mFormat;
+}
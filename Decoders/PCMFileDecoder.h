@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include "AudioDecoder.h"
+
+namespace SFB {
+
+	namespace Audio {
+
+		// ========================================
+		// A Decoder subclass supporting uncompressed PCM in WAVE, RF64, AIFF and AIFF-C files
+		//
+		// The chunks are parsed directly and samples are read from the input source into the
+		// caller's buffers exactly as stored, so opening is cheap and seeking takes constant time
+		// ========================================
+		class PCMFileDecoder : public Decoder
+		{
+
+		public:
+
+			// Data types handled by this class
+			static CFArrayRef CreateSupportedFileExtensions();
+			static CFArrayRef CreateSupportedMIMETypes();
+
+			static bool HandlesFilesWithExtension(CFStringRef extension);
+			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
+
+			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
+
+			// Creation and destruction
+			explicit PCMFileDecoder(InputSource::unique_ptr inputSource);
+			virtual ~PCMFileDecoder();
+
+		private:
+
+			// Audio access
+			virtual bool _Open(CFErrorRef *error);
+			virtual bool _Close(CFErrorRef *error);
+
+			// The native format of the source audio
+			virtual SFB::CFString _GetSourceFormatDescription() const;
+
+			// Attempt to read frameCount frames of audio, returning the actual number of frames read
+			virtual UInt32 _ReadAudio(AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Source audio information
+			inline virtual SInt64 _GetTotalFrames() const			{ return mTotalFrames; }
+			inline virtual SInt64 _GetCurrentFrame() const			{ return mCurrentFrame; }
+
+			// Seeking support
+			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
+			virtual SInt64 _SeekToFrame(SInt64 frame);
+			inline virtual SeekCost _GetSeekCost(SInt64 /*frame*/) const	{ return SeekCostConstant; }
+
+			// Container parsing
+			bool OpenWAVE(CFErrorRef *error);
+			bool OpenAIFF(CFErrorRef *error);
+
+			// Set up the output format for samples of the given layout
+			void SetFormat(UInt32 channelsPerFrame, Float64 sampleRate, UInt32 bitsPerChannel, UInt32 bytesPerSample, AudioFormatFlags formatFlags);
+
+			enum class Container {
+				Unknown,
+				WAVE,
+				RF64,
+				AIFF,
+				AIFC
+			};
+
+			// Data members
+			Container	mContainer;
+			SInt64		mTotalFrames;
+			SInt64		mCurrentFrame;
+			SInt64		mAudioOffset;
+		};
+
+	}
+}
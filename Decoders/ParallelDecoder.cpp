@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "ParallelDecoder.h"
+#include "AudioBufferList.h"
+#include "AudioDecoder.h"
+#include "CFWrapper.h"
+#include "Logger.h"
+
+namespace {
+
+	// The buffer size used when decoding sequentially
+	const UInt32 kSequentialBufferFrames = 4096;
+
+	// A decoded segment awaiting delivery
+	struct Segment
+	{
+		Segment(const SFB::Audio::AudioFormat& format, UInt32 capacityFrames)
+			: mBufferList(format, capacityFrames), mFrameCount(0), mReady(false)
+		{}
+
+		SFB::Audio::BufferList	mBufferList;
+		UInt32					mFrameCount;
+		bool					mReady;
+	};
+
+	// State shared by the decoding threads and the delivering thread
+	struct DecodingContext
+	{
+		DecodingContext(SInt64 totalFrames, UInt32 segmentFrames)
+			: mTotalFrames(totalFrames), mSegmentFrames(segmentFrames), mSegmentCount((totalFrames + segmentFrames - 1) / segmentFrames), mNextSegment(0), mNextDelivery(0), mStopping(false)
+		{}
+
+		const SInt64							mTotalFrames;
+		const UInt32							mSegmentFrames;
+		const SInt64							mSegmentCount;
+
+		// Segment n is decoded into mSegments[n % mSegments.size()], bounding the memory used
+		std::vector<std::unique_ptr<Segment>>	mSegments;
+
+		std::mutex								mMutex;
+		std::condition_variable					mCondition;
+
+		SInt64									mNextSegment;
+		SInt64									mNextDelivery;
+		bool									mStopping;
+		SFB::CFError							mError;
+	};
+
+	// Stop decoding, recording the first error
+	void Fail(DecodingContext& context, CFErrorRef error)
+	{
+		std::lock_guard<std::mutex> lock(context.mMutex);
+		if(!context.mError)
+			context.mError = error;
+		else if(error)
+			CFRelease(error);
+		context.mStopping = true;
+		context.mCondition.notify_all();
+	}
+
+	// Point the buffers in view at those of bufferList, offset by frameOffset frames
+	void SetBufferListView(AudioBufferList *view, const AudioBufferList *bufferList, UInt32 bytesPerFrame, UInt32 frameOffset, UInt32 capacityFrames)
+	{
+		view->mNumberBuffers = bufferList->mNumberBuffers;
+		for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+			view->mBuffers[i].mNumberChannels	= bufferList->mBuffers[i].mNumberChannels;
+			view->mBuffers[i].mData				= (uint8_t *)bufferList->mBuffers[i].mData + (frameOffset * bytesPerFrame);
+			view->mBuffers[i].mDataByteSize		= capacityFrames * bytesPerFrame;
+		}
+	}
+
+	void DecodeSegments(SFB::Audio::Decoder *decoder, DecodingContext& context)
+	{
+		const auto& format = decoder->GetFormat();
+
+		UInt32 numBuffers = format.IsInterleaved() ? 1 : format.mChannelsPerFrame;
+		std::unique_ptr<uint8_t []> viewStorage(new uint8_t [offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * numBuffers)]);
+		auto view = (AudioBufferList *)viewStorage.get();
+
+		for(;;) {
+			SInt64 segmentIndex;
+			Segment *segment;
+
+			// ========================================
+			// Claim the next segment once its buffer has been delivered
+			{
+				std::unique_lock<std::mutex> lock(context.mMutex);
+				context.mCondition.wait(lock, [&context]() {
+					return context.mStopping || context.mNextSegment >= context.mSegmentCount || context.mNextSegment < context.mNextDelivery + (SInt64)context.mSegments.size();
+				});
+
+				if(context.mStopping || context.mNextSegment >= context.mSegmentCount)
+					return;
+
+				segmentIndex = context.mNextSegment++;
+				segment = context.mSegments[(size_t)(segmentIndex % (SInt64)context.mSegments.size())].get();
+			}
+
+			// ========================================
+			// Decode exactly the frames in the segment
+			SInt64 startingFrame = segmentIndex * context.mSegmentFrames;
+			UInt32 frameCount = (UInt32)std::min((SInt64)context.mSegmentFrames, context.mTotalFrames - startingFrame);
+
+			if(decoder->GetCurrentFrame() != startingFrame && decoder->SeekToFrame(startingFrame) != startingFrame) {
+				LOGGER_ERR("org.sbooth.AudioEngine.ParallelDecoder", "Unable to seek to frame " << startingFrame);
+				Fail(context, CFErrorCreate(kCFAllocatorDefault, SFB::Audio::Decoder::ErrorDomain, SFB::Audio::Decoder::InputOutputError, nullptr));
+				return;
+			}
+
+			UInt32 framesDecoded = 0;
+			while(framesDecoded < frameCount) {
+				SetBufferListView(view, segment->mBufferList, format.mBytesPerFrame, framesDecoded, frameCount - framesDecoded);
+				UInt32 framesRead = decoder->ReadAudio(view, frameCount - framesDecoded);
+				if(0 == framesRead)
+					break;
+				framesDecoded += framesRead;
+			}
+
+			// Tolerate a short final segment since the frame count may be inexact
+			if(framesDecoded != frameCount && segmentIndex != context.mSegmentCount - 1) {
+				LOGGER_ERR("org.sbooth.AudioEngine.ParallelDecoder", "Segment " << segmentIndex << " decoded " << framesDecoded << " of " << frameCount << " frames");
+				Fail(context, CFErrorCreate(kCFAllocatorDefault, SFB::Audio::Decoder::ErrorDomain, SFB::Audio::Decoder::InputOutputError, nullptr));
+				return;
+			}
+
+			for(UInt32 i = 0; i < segment->mBufferList->mNumberBuffers; ++i)
+				segment->mBufferList->mBuffers[i].mDataByteSize = framesDecoded * format.mBytesPerFrame;
+
+			{
+				std::lock_guard<std::mutex> lock(context.mMutex);
+				segment->mFrameCount = framesDecoded;
+				segment->mReady = true;
+				context.mCondition.notify_all();
+			}
+		}
+	}
+
+	bool DecodeSequentially(SFB::Audio::Decoder *decoder, const SFB::Audio::ParallelDecoder::AudioHandler& handler, SInt64& framesDelivered, CFErrorRef *error)
+	{
+		SFB::Audio::BufferList bufferList;
+		if(!bufferList.Allocate(decoder->GetFormat(), kSequentialBufferFrames)) {
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+			return false;
+		}
+
+		for(;;) {
+			bufferList.Reset();
+			UInt32 framesRead = decoder->ReadAudio(bufferList, kSequentialBufferFrames);
+			if(0 == framesRead)
+				break;
+
+			framesDelivered += framesRead;
+			if(!handler(bufferList, framesRead))
+				break;
+		}
+
+		return true;
+	}
+
+}
+
+#pragma mark Decoding
+
+bool SFB::Audio::ParallelDecoder::DecodeURL(CFURLRef url, const AudioHandler& handler, size_t threadCount, UInt32 segmentFrames, Statistics *statistics, CFErrorRef *error)
+{
+	if(nullptr == url || !handler || 0 == segmentFrames) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.ParallelDecoder", "DecodeURL() called with invalid parameters");
+		return false;
+	}
+
+	CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+
+	auto decoder = Decoder::CreateForURL(url, error);
+	if(!decoder)
+		return false;
+
+	if(!decoder->IsOpen() && !decoder->Open(error))
+		return false;
+
+	if(0 == threadCount)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	const auto& format = decoder->GetFormat();
+	SInt64 totalFrames = decoder->GetTotalFrames();
+	SInt64 segmentCount = 0 < totalFrames ? (totalFrames + segmentFrames - 1) / segmentFrames : 0;
+
+	SInt64 framesDelivered = 0;
+	bool result = true;
+
+	// ========================================
+	// Decode sequentially if the audio can't be split into accurately seekable segments
+	if(1 == threadCount || 2 > segmentCount || !decoder->SupportsSeeking() || !format.IsPCM() || 1 != format.mFramesPerPacket) {
+		threadCount = 1;
+		result = DecodeSequentially(decoder.get(), handler, framesDelivered, error);
+	}
+	else {
+		threadCount = (size_t)std::min((SInt64)threadCount, segmentCount);
+
+		// ========================================
+		// Open one decoder per thread
+		std::vector<Decoder::unique_ptr> decoders;
+		decoders.push_back(std::move(decoder));
+		while(decoders.size() < threadCount) {
+			auto threadDecoder = Decoder::CreateForURL(url);
+			if(!threadDecoder || (!threadDecoder->IsOpen() && !threadDecoder->Open()) || threadDecoder->GetFormat() != format || threadDecoder->GetTotalFrames() != totalFrames) {
+				LOGGER_NOTICE("org.sbooth.AudioEngine.ParallelDecoder", "Unable to open decoder for thread " << decoders.size() << "; using " << decoders.size() << " threads");
+				break;
+			}
+			decoders.push_back(std::move(threadDecoder));
+		}
+
+		threadCount = decoders.size();
+
+		// ========================================
+		// Allow each thread to keep one segment in reserve
+		DecodingContext context(totalFrames, segmentFrames);
+		try {
+			for(SInt64 i = 0; i < std::min((SInt64)(2 * threadCount), segmentCount); ++i)
+				context.mSegments.push_back(std::unique_ptr<Segment>(new Segment(format, segmentFrames)));
+		}
+
+		catch(const std::bad_alloc&) {
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+			return false;
+		}
+
+		std::vector<std::thread> threads;
+		try {
+			for(auto& threadDecoder : decoders)
+				threads.push_back(std::thread(DecodeSegments, threadDecoder.get(), std::ref(context)));
+		}
+
+		catch(const std::system_error& e) {
+			LOGGER_ERR("org.sbooth.AudioEngine.ParallelDecoder", "Unable to create decoding thread: " << e.what());
+			Fail(context, CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, e.code().value(), nullptr));
+		}
+
+		// ========================================
+		// Deliver the segments in order
+		for(SInt64 segmentIndex = 0; segmentIndex < segmentCount; ++segmentIndex) {
+			auto segment = context.mSegments[(size_t)(segmentIndex % (SInt64)context.mSegments.size())].get();
+
+			{
+				std::unique_lock<std::mutex> lock(context.mMutex);
+				context.mCondition.wait(lock, [&context, segment]() { return context.mStopping || segment->mReady; });
+				if(!segment->mReady)
+					break;
+			}
+
+			framesDelivered += segment->mFrameCount;
+			bool keepDecoding = handler(segment->mBufferList, segment->mFrameCount);
+
+			{
+				std::lock_guard<std::mutex> lock(context.mMutex);
+				segment->mReady = false;
+				++context.mNextDelivery;
+				if(!keepDecoding)
+					context.mStopping = true;
+				context.mCondition.notify_all();
+			}
+
+			if(!keepDecoding)
+				break;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(context.mMutex);
+			context.mStopping = true;
+			context.mCondition.notify_all();
+		}
+
+		for(auto& thread : threads)
+			thread.join();
+
+		if(context.mError) {
+			if(error)
+				*error = context.mError.Relinquish();
+			result = false;
+		}
+	}
+
+	if(statistics) {
+		statistics->mFramesDecoded		= framesDelivered;
+		statistics->mElapsedTime		= CFAbsoluteTimeGetCurrent() - startTime;
+		statistics->mFramesPerSecond	= 0 < statistics->mElapsedTime ? framesDelivered / statistics->mElapsedTime : 0;
+		statistics->mThreadCount		= threadCount;
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.ParallelDecoder", "Decoded " << framesDelivered << " frames using " << threadCount << " threads in " << (CFAbsoluteTimeGetCurrent() - startTime) << " seconds");
+
+	return result;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <functional>
+
+#include <CoreAudio/CoreAudioTypes.h>
+#include <CoreFoundation/CoreFoundation.h>
+
+/*! @file ParallelDecoder.h @brief Multi-core offline decoding */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief Decodes an entire URL using multiple threads
+		 *
+		 * The URL's frames are divided into fixed-size segments that are decoded concurrently, each thread using
+		 * its own \c Decoder opened on the URL and seeking to the start of every segment it decodes.  Decoded
+		 * segments are delivered in order, so the output is identical to that of a single \c Decoder.
+		 *
+		 * Parallel decoding requires a seekable, sample-accurate decoder producing PCM with a known frame count.
+		 * When these conditions aren't met the URL is decoded sequentially.
+		 */
+		class ParallelDecoder
+		{
+
+		public:
+
+			/*!
+			 * @brief A block called with decoded audio, in order
+			 * @param bufferList The decoded audio, in the decoder's native format
+			 * @param frameCount The number of valid frames in \c bufferList
+			 * @return \c true to continue decoding, \c false to stop
+			 */
+			using AudioHandler = std::function<bool(const AudioBufferList *bufferList, UInt32 frameCount)>;
+
+			/*! @brief Decoding statistics */
+			struct Statistics
+			{
+				SInt64 mFramesDecoded;			/*!< @brief The number of frames delivered to the handler */
+				CFTimeInterval mElapsedTime;	/*!< @brief The wall clock time taken, in seconds */
+				double mFramesPerSecond;		/*!< @brief The decoding throughput */
+				size_t mThreadCount;			/*!< @brief The number of decoding threads used */
+			};
+
+			/*! @brief The default number of frames in a segment */
+			static const UInt32 DefaultSegmentFrames = 1 << 18;
+
+			/*!
+			 * @brief Decode \c url, delivering the audio to \c handler in order
+			 * @note \c handler is called on the calling thread
+			 * @param url The URL to decode
+			 * @param handler The block receiving decoded audio
+			 * @param threadCount The number of decoding threads, or \c 0 for one thread per processor core
+			 * @param segmentFrames The number of frames in each independently decoded segment
+			 * @param statistics An optional pointer to a \c Statistics struct to receive decoding statistics
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			static bool DecodeURL(CFURLRef url, const AudioHandler& handler, size_t threadCount = 0, UInt32 segmentFrames = DefaultSegmentFrames, Statistics *statistics = nullptr, CFErrorRef *error = nullptr);
+
+			/*! @cond */
+
+			/*! @internal This class is not instantiable */
+			ParallelDecoder() = delete;
+
+			/*! @endcond */
+
+		};
+
+	}
+}
@@ -0,0 +1,967 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+
+#include <Block.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "RemoteDecoder.h"
+#include "CFErrorUtilities.h"
+#include "Logger.h"
+
+extern char **environ;
+
+#define REMOTE_DECODER_MAGIC				'SBrd'
+#define REMOTE_DECODER_SLOT_COUNT			8
+#define REMOTE_DECODER_SLOT_BYTES			(64 * 1024)
+#define REMOTE_DECODER_MINIMUM_SLOT_FRAMES	16
+#define REMOTE_DECODER_CHANNEL_LAYOUT_BYTES	1024
+#define REMOTE_DECODER_STRING_BYTES			512
+#define REMOTE_DECODER_TIMEOUT_MSEC			5000
+#define REMOTE_DECODER_SERVICE_POLL_MSEC	250
+#define REMOTE_DECODER_READER_POLL_MSEC		50
+#define REMOTE_DECODER_EXIT_TIMEOUT_MSEC	1000
+
+// The atomics in shared memory must not depend on process-local locks
+static_assert(2 == ATOMIC_BOOL_LOCK_FREE && 2 == ATOMIC_INT_LOCK_FREE && 2 == ATOMIC_LLONG_LOCK_FREE, "Lock-free atomics are required in shared memory");
+
+namespace {
+
+	// The descriptors at which the service receives its end of each pipe
+	const int kServiceDataPipe	= 3;
+	const int kServiceSpacePipe	= 4;
+
+	enum ServiceState : uint32_t {
+		ServiceStarting		= 0,
+		ServiceReady		= 1,
+		ServiceFailed		= 2
+	};
+
+	std::mutex	sServicePathLock;
+	std::string	sServicePath;
+
+	std::atomic_uint sSharedMemoryCounter = ATOMIC_VAR_INIT(0);
+
+	// The size of the shared state, rounded to a page so the slots are page aligned
+	size_t GetSharedStateLength(size_t stateSize)
+	{
+		size_t pageSize = (size_t)getpagesize();
+		return (stateSize + pageSize - 1) & ~(pageSize - 1);
+	}
+
+	// Copy string to buffer as a terminated UTF-8 string
+	void CopyString(CFStringRef string, char *buffer, size_t bufferSize)
+	{
+		buffer[0] = '\0';
+		if(string)
+			CFStringGetCString(string, buffer, (CFIndex)bufferSize, kCFStringEncodingUTF8);
+	}
+
+	CFStringRef CreateString(const char *buffer, size_t bufferSize) CF_RETURNS_RETAINED
+	{
+		size_t length = strnlen(buffer, bufferSize);
+		return 0 < length ? CFStringCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)buffer, (CFIndex)length, kCFStringEncodingUTF8, false) : nullptr;
+	}
+
+	// Write a byte to a non-blocking pipe; a full pipe already holds a wakeup
+	void SignalPipe(int fd)
+	{
+		const char byte = 0;
+		while(-1 == write(fd, &byte, 1) && EINTR == errno)
+			;
+	}
+
+	// Wait for a byte on fd for at most timeout milliseconds
+	// Returns 1 if signalled, 0 on timeout, and -1 if the other end was closed or an error occurred
+	int WaitOnPipe(int fd, int timeout)
+	{
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+		int result;
+		while(-1 == (result = poll(&pfd, 1, timeout)) && EINTR == errno)
+			;
+
+		if(0 == result)
+			return 0;
+		if(-1 == result)
+			return -1;
+
+		if(POLLIN & pfd.revents) {
+			char bytes [64];
+			ssize_t bytesRead = read(fd, bytes, sizeof(bytes));
+			if(0 < bytesRead || (-1 == bytesRead && (EAGAIN == errno || EINTR == errno)))
+				return 1;
+		}
+
+		// End of file or POLLHUP
+		return -1;
+	}
+
+	bool SetDescriptorFlags(int fd, bool closeOnExec, bool nonBlocking)
+	{
+		if(closeOnExec && -1 == fcntl(fd, F_SETFD, FD_CLOEXEC))
+			return false;
+		if(nonBlocking && -1 == fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK))
+			return false;
+#if defined(F_SETNOSIGPIPE)
+		// Writing to a pipe whose reader has exited fails with EPIPE instead of raising SIGPIPE
+		if(nonBlocking)
+			fcntl(fd, F_SETNOSIGPIPE, 1);
+#endif
+		return true;
+	}
+
+	void CloseDescriptor(int& fd)
+	{
+		if(-1 != fd) {
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	CFErrorRef CreateServiceError(CFURLRef url, CFStringRef failureReason)
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be decoded by the decoding service."), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file may be damaged or the decoding service may be missing."), ""));
+
+		return SFB::CreateErrorForURL(SFB::Audio::Decoder::ErrorDomain, SFB::Audio::Decoder::InputOutputError, description, url, failureReason, recoverySuggestion);
+	}
+
+}
+
+// The memory shared by the decoder and its service
+//
+// The slots following the shared state form a single-producer, single-consumer ring: the service
+// decodes into slot mWriteIndex % REMOTE_DECODER_SLOT_COUNT and publishes it by incrementing mWriteIndex,
+// and the decoder lends each slot's audio until it is consumed and mReadIndex is incremented.
+// Once the decoder requests a seek it consumes no slots until the seek completes, so the service may reclaim them.
+// A process about to wait sets its waiting flag and rechecks the indexes; the other process writes to
+// the waiting process's pipe only if it clears the flag, so no wakeup is lost and none is sent needlessly.
+struct SFB::Audio::RemoteDecoder::SharedState
+{
+	uint32_t					mMagic;
+	std::atomic<uint32_t>		mServiceState;
+	std::atomic_bool			mFinished;			// The service has decoded all audio
+	std::atomic_bool			mExitRequested;
+	std::atomic_bool			mReaderWaiting;
+	std::atomic_bool			mWriterWaiting;
+
+	// Set by the service before it is ready
+	AudioStreamBasicDescription	mFormat;
+	AudioStreamBasicDescription	mSourceFormat;
+	bool						mSupportsSeeking;
+	uint32_t					mChannelLayoutSize;
+	alignas(8) uint8_t			mChannelLayout [REMOTE_DECODER_CHANNEL_LAYOUT_BYTES];
+	char						mSourceFormatDescription [REMOTE_DECODER_STRING_BYTES];
+	uint32_t					mSlotFrames;
+	uint32_t					mBufferStride;		// The bytes in each slot per buffer
+
+	// Set by the service when it fails to open the file
+	int64_t						mErrorCode;
+	char						mErrorDomain [REMOTE_DECODER_STRING_BYTES];
+	char						mErrorDescription [REMOTE_DECODER_STRING_BYTES];
+	char						mErrorFailureReason [REMOTE_DECODER_STRING_BYTES];
+	char						mErrorRecoverySuggestion [REMOTE_DECODER_STRING_BYTES];
+
+	// Decoders may refine their length as they decode
+	std::atomic<int64_t>		mTotalFrames;
+
+	std::atomic<uint64_t>		mWriteIndex;		// The number of slots written
+	std::atomic<uint64_t>		mReadIndex;			// The number of slots consumed
+	uint32_t					mSlotFrameCounts [REMOTE_DECODER_SLOT_COUNT];
+
+	// A seek is requested by incrementing mSeekRequest and completes when mSeekCompletion matches it
+	std::atomic<int64_t>		mSeekFrame;
+	std::atomic<uint32_t>		mSeekRequest;
+	std::atomic<uint32_t>		mSeekCompletion;
+	std::atomic<int64_t>		mSeekResult;
+	std::atomic<uint64_t>		mSeekWriteIndex;	// The first slot written after the seek
+
+	SharedState()
+		: mMagic(REMOTE_DECODER_MAGIC), mServiceState(ServiceStarting), mFinished(false), mExitRequested(false), mReaderWaiting(false), mWriterWaiting(false),
+		mFormat(), mSourceFormat(), mSupportsSeeking(false), mChannelLayoutSize(0), mChannelLayout(), mSourceFormatDescription(), mSlotFrames(0), mBufferStride(0),
+		mErrorCode(0), mErrorDomain(), mErrorDescription(), mErrorFailureReason(), mErrorRecoverySuggestion(),
+		mTotalFrames(-1), mWriteIndex(0), mReadIndex(0), mSlotFrameCounts(),
+		mSeekFrame(0), mSeekRequest(0), mSeekCompletion(0), mSeekResult(-1), mSeekWriteIndex(0)
+	{}
+
+	inline uint8_t * GetSlot(uint64_t index)
+	{
+		return (uint8_t *)this + GetSharedStateLength(sizeof(SharedState)) + (index % REMOTE_DECODER_SLOT_COUNT) * REMOTE_DECODER_SLOT_BYTES;
+	}
+};
+
+#pragma mark Service Configuration
+
+std::string SFB::Audio::RemoteDecoder::GetServicePath()
+{
+	std::lock_guard<std::mutex> lock(sServicePathLock);
+	return sServicePath;
+}
+
+void SFB::Audio::RemoteDecoder::SetServicePath(const char *path)
+{
+	std::lock_guard<std::mutex> lock(sServicePathLock);
+	sServicePath = path ? path : "";
+}
+
+#pragma mark Factory Methods
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::RemoteDecoder::CreateForURL(CFURLRef url, CFErrorRef *error)
+{
+	if(nullptr == url)
+		return nullptr;
+
+	// The input source is opened only for the URL and the input byte rate; the service reads the file itself
+	auto inputSource = InputSource::CreateForURL(url, 0, error);
+	if(!inputSource)
+		return nullptr;
+
+	unique_ptr decoder(new RemoteDecoder(std::move(inputSource)));
+
+	if(AutomaticallyOpenDecoders() && !decoder->Open(error))
+		return nullptr;
+
+	return decoder;
+}
+
+SFB::Audio::RemoteDecoder::RemoteDecoder(InputSource::unique_ptr inputSource)
+	: Decoder(std::move(inputSource)), mShared(nullptr), mSharedLength(0), mServicePID(-1), mDataPipe(-1), mSpacePipe(-1), mServiceFailed(false),
+	mTotalFrames(-1), mCurrentFrame(0), mSupportsSeeking(false), mSeekGeneration(0), mSeekPending(false), mSeekFailed(false), mSlotFrameOffset(0),
+	mWatchQueue(nullptr), mWatching(false), mServiceStalled(false), mReadabilityHandler(nullptr), mBorrowedBufferList(nullptr, std::free)
+{}
+
+SFB::Audio::RemoteDecoder::~RemoteDecoder()
+{
+	if(IsOpen())
+		Close();
+
+	_SetReadabilityHandler(nullptr);
+
+	if(mWatchQueue)
+		dispatch_release(mWatchQueue);
+}
+
+#pragma mark Functionality
+
+bool SFB::Audio::RemoteDecoder::_Open(CFErrorRef *error)
+{
+	mServiceFailed = false;
+	mServiceStalled.store(false);
+
+	if(nullptr == mWatchQueue) {
+		mWatchQueue = dispatch_queue_create("org.sbooth.AudioEngine.Decoder.Remote.Watch", DISPATCH_QUEUE_SERIAL);
+		if(nullptr == mWatchQueue) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "dispatch_queue_create failed");
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+			return false;
+		}
+	}
+
+	auto servicePath = GetServicePath();
+	if(servicePath.empty()) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "No decoding service is configured");
+		if(error) {
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("No decoding service"), ""));
+			*error = CreateServiceError(GetURL(), failureReason);
+		}
+		return false;
+	}
+
+	char url [PATH_MAX * 2];
+	if(!CFStringGetCString(CFURLGetString(GetURL()), url, sizeof(url), kCFStringEncodingUTF8)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "The URL is too long to pass to the decoding service");
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENAMETOOLONG, nullptr);
+		return false;
+	}
+
+	// Create the shared memory; its name is removed once the service has mapped it or failed
+	char name [64];
+	snprintf(name, sizeof(name), "/sbrd.%d.%u", getpid(), sSharedMemoryCounter.fetch_add(1));
+
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+	if(-1 == fd) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "shm_open failed: " << strerror(errno));
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return false;
+	}
+
+	mSharedLength = GetSharedStateLength(sizeof(SharedState)) + REMOTE_DECODER_SLOT_COUNT * REMOTE_DECODER_SLOT_BYTES;
+
+	void *memory = MAP_FAILED;
+	if(0 == ftruncate(fd, (off_t)mSharedLength))
+		memory = mmap(nullptr, mSharedLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int mapError = errno;
+	close(fd);
+
+	if(MAP_FAILED == memory) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "Unable to map shared memory: " << strerror(mapError));
+		shm_unlink(name);
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, mapError, nullptr);
+		return false;
+	}
+
+	mShared = new (memory) SharedState;
+
+	// The service writes to the data pipe and reads from the space pipe
+	int dataPipe [2], spacePipe [2];
+	if(-1 == pipe(dataPipe)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "pipe failed: " << strerror(errno));
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		shm_unlink(name);
+		_Close(nullptr);
+		return false;
+	}
+
+	if(-1 == pipe(spacePipe)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "pipe failed: " << strerror(errno));
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		close(dataPipe[0]);
+		close(dataPipe[1]);
+		shm_unlink(name);
+		_Close(nullptr);
+		return false;
+	}
+
+	mDataPipe = dataPipe[0];
+	mSpacePipe = spacePipe[1];
+	SetDescriptorFlags(mDataPipe, true, false);
+	SetDescriptorFlags(mSpacePipe, true, true);
+	SetDescriptorFlags(dataPipe[1], true, true);
+	SetDescriptorFlags(spacePipe[0], true, false);
+
+	posix_spawn_file_actions_t fileActions;
+	posix_spawn_file_actions_init(&fileActions);
+	posix_spawn_file_actions_adddup2(&fileActions, dataPipe[1], kServiceDataPipe);
+	posix_spawn_file_actions_adddup2(&fileActions, spacePipe[0], kServiceSpacePipe);
+
+	posix_spawnattr_t attributes;
+	posix_spawnattr_init(&attributes);
+#if defined(POSIX_SPAWN_CLOEXEC_DEFAULT)
+	// Only the pipes and the standard descriptors are inherited
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_CLOEXEC_DEFAULT);
+	posix_spawn_file_actions_addinherit_np(&fileActions, STDIN_FILENO);
+	posix_spawn_file_actions_addinherit_np(&fileActions, STDOUT_FILENO);
+	posix_spawn_file_actions_addinherit_np(&fileActions, STDERR_FILENO);
+#endif
+
+	char *argv [] = { (char *)servicePath.c_str(), name, url, nullptr };
+	int spawnResult = posix_spawn(&mServicePID, servicePath.c_str(), &fileActions, &attributes, argv, environ);
+
+	posix_spawnattr_destroy(&attributes);
+	posix_spawn_file_actions_destroy(&fileActions);
+	close(dataPipe[1]);
+	close(spacePipe[0]);
+
+	if(0 != spawnResult) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "Unable to launch the decoding service \"" << servicePath << "\": " << strerror(spawnResult));
+		mServicePID = -1;
+		shm_unlink(name);
+		_Close(nullptr);
+		if(error) {
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("The decoding service could not be launched"), ""));
+			*error = CreateServiceError(GetURL(), failureReason);
+		}
+		return false;
+	}
+
+	// Wait for the service to open the file
+	int elapsed = 0;
+	while(ServiceStarting == mShared->mServiceState.load()) {
+		mShared->mReaderWaiting.store(true);
+		if(ServiceStarting == mShared->mServiceState.load() && !WaitForService(elapsed))
+			break;
+		mShared->mReaderWaiting.store(false);
+	}
+
+	shm_unlink(name);
+
+	if(ServiceReady != mShared->mServiceState.load(std::memory_order_acquire)) {
+		if(error) {
+			if(ServiceFailed == mShared->mServiceState.load()) {
+				SFB::CFString domain(CreateString(mShared->mErrorDomain, sizeof(mShared->mErrorDomain)));
+				SFB::CFString description(CreateString(mShared->mErrorDescription, sizeof(mShared->mErrorDescription)));
+				SFB::CFString failureReason(CreateString(mShared->mErrorFailureReason, sizeof(mShared->mErrorFailureReason)));
+				SFB::CFString recoverySuggestion(CreateString(mShared->mErrorRecoverySuggestion, sizeof(mShared->mErrorRecoverySuggestion)));
+				*error = SFB::CreateError(domain ? (CFStringRef)domain : Decoder::ErrorDomain, (CFIndex)mShared->mErrorCode, description, failureReason, recoverySuggestion);
+			}
+			else {
+				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("The decoding service stopped responding or exited"), ""));
+				*error = CreateServiceError(GetURL(), failureReason);
+			}
+		}
+
+		_Close(nullptr);
+		return false;
+	}
+
+	mFormat = mShared->mFormat;
+	mSourceFormat = mShared->mSourceFormat;
+	if(0 < mShared->mChannelLayoutSize)
+		mChannelLayout = reinterpret_cast<const AudioChannelLayout *>(mShared->mChannelLayout);
+
+	mSourceFormatDescription = CreateString(mShared->mSourceFormatDescription, sizeof(mShared->mSourceFormatDescription));
+	mSupportsSeeking = mShared->mSupportsSeeking;
+	mTotalFrames = mShared->mTotalFrames.load();
+	mCurrentFrame = 0;
+	mSlotFrameOffset = 0;
+	mSeekGeneration.store(0);
+	mSeekPending.store(false);
+	mSeekFailed = false;
+
+	UInt32 bufferCount = mFormat.IsInterleaved() ? 1 : mFormat.mChannelsPerFrame;
+	mBorrowedBufferList.reset((AudioBufferList *)std::calloc(1, offsetof(AudioBufferList, mBuffers) + sizeof(AudioBuffer) * bufferCount));
+	if(!mBorrowedBufferList) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+		_Close(nullptr);
+		return false;
+	}
+
+	mBorrowedBufferList->mNumberBuffers = bufferCount;
+	for(UInt32 i = 0; i < bufferCount; ++i)
+		mBorrowedBufferList->mBuffers[i].mNumberChannels = mFormat.IsInterleaved() ? mFormat.mChannelsPerFrame : 1;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Decoder.Remote", "Decoding service " << mServicePID << " opened \"" << GetURL() << "\"");
+
+	return true;
+}
+
+bool SFB::Audio::RemoteDecoder::_Close(CFErrorRef */*error*/)
+{
+	if(-1 != mServicePID) {
+		// The service exits when asked or when the space pipe is closed
+		if(mShared) {
+			mShared->mExitRequested.store(true);
+			SignalService();
+		}
+
+		CloseDescriptor(mSpacePipe);
+
+		// Closing the service's end of the data pipe indicates the service exited
+		if(-1 != mDataPipe) {
+			int result;
+			while(1 == (result = WaitOnPipe(mDataPipe, REMOTE_DECODER_EXIT_TIMEOUT_MSEC)))
+				;
+			if(0 == result)
+				LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.Remote", "Decoding service " << mServicePID << " didn't exit when asked");
+		}
+
+		TerminateService();
+	}
+
+	// The watch ends once the service has exited
+	if(mWatchQueue)
+		dispatch_sync(mWatchQueue, ^{});
+
+	CloseDescriptor(mSpacePipe);
+	CloseDescriptor(mDataPipe);
+
+	if(mShared) {
+		mShared->~SharedState();
+		munmap(mShared, mSharedLength);
+		mShared = nullptr;
+	}
+
+	mBorrowedBufferList.reset();
+
+	return true;
+}
+
+SFB::CFString SFB::Audio::RemoteDecoder::_GetSourceFormatDescription() const
+{
+	return mSourceFormatDescription;
+}
+
+UInt32 SFB::Audio::RemoteDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(bufferList->mNumberBuffers != mBorrowedBufferList->mNumberBuffers) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.Remote", "_ReadAudio() called with invalid parameters");
+		return 0;
+	}
+
+	UInt32 framesRead = 0;
+	while(framesRead < frameCount) {
+		// Return the audio already read rather than wait for the service
+		if(0 < framesRead && _WouldBlock())
+			break;
+
+		UInt32 framesAvailable;
+		auto view = _PeekAudio(framesAvailable);
+		if(!view || 0 == framesAvailable)
+			break;
+
+		UInt32 framesToCopy = std::min(framesAvailable, frameCount - framesRead);
+		for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+			memcpy((uint8_t *)bufferList->mBuffers[i].mData + (framesRead * mFormat.mBytesPerFrame), view->mBuffers[i].mData, framesToCopy * mFormat.mBytesPerFrame);
+
+		_ConsumeAudio(framesToCopy);
+		framesRead += framesToCopy;
+	}
+
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+		bufferList->mBuffers[i].mDataByteSize = framesRead * mFormat.mBytesPerFrame;
+
+	return framesRead;
+}
+
+SInt64 SFB::Audio::RemoteDecoder::_SeekToFrame(SInt64 frame)
+{
+	if(mServiceFailed)
+		return -1;
+
+	// The service seeks while the reader continues; the seek is applied when audio is next read
+	uint32_t generation = mSeekGeneration.load() + 1;
+	mShared->mSeekFrame.store(frame, std::memory_order_relaxed);
+	mSeekGeneration.store(generation);
+	mSeekPending.store(true);
+	mShared->mSeekRequest.store(generation, std::memory_order_release);
+	SignalService();
+
+	mSeekFailed = false;
+	mSlotFrameOffset = 0;
+	mCurrentFrame = frame;
+
+	return frame;
+}
+
+const AudioBufferList * SFB::Audio::RemoteDecoder::_PeekAudio(UInt32& frameCount)
+{
+	frameCount = 0;
+
+	if(mSeekPending.load() && !CompleteSeek())
+		return nullptr;
+
+	if(mSeekFailed)
+		return nullptr;
+
+	// Only this process writes the read index while no seek is pending
+	uint64_t readIndex = mShared->mReadIndex.load(std::memory_order_relaxed);
+
+	int elapsed = 0;
+	while(readIndex == mShared->mWriteIndex.load(std::memory_order_acquire)) {
+		// The service publishes its last slot before finishing
+		if(mShared->mFinished.load(std::memory_order_acquire)) {
+			if(readIndex != mShared->mWriteIndex.load(std::memory_order_acquire))
+				break;
+			mTotalFrames = mShared->mTotalFrames.load(std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		if(mServiceFailed)
+			return nullptr;
+
+		mShared->mReaderWaiting.store(true);
+		if(readIndex == mShared->mWriteIndex.load() && !mShared->mFinished.load() && !WaitForService(elapsed))
+			return nullptr;
+		mShared->mReaderWaiting.store(false);
+	}
+
+	mTotalFrames = mShared->mTotalFrames.load(std::memory_order_relaxed);
+
+	const uint8_t *slot = mShared->GetSlot(readIndex);
+	UInt32 slotFrames = mShared->mSlotFrameCounts[readIndex % REMOTE_DECODER_SLOT_COUNT];
+	UInt32 byteOffset = mSlotFrameOffset * mFormat.mBytesPerFrame;
+	UInt32 byteCount = (slotFrames - mSlotFrameOffset) * mFormat.mBytesPerFrame;
+
+	for(UInt32 i = 0; i < mBorrowedBufferList->mNumberBuffers; ++i) {
+		mBorrowedBufferList->mBuffers[i].mData				= (void *)(slot + (i * mShared->mBufferStride) + byteOffset);
+		mBorrowedBufferList->mBuffers[i].mDataByteSize		= byteCount;
+	}
+
+	frameCount = slotFrames - mSlotFrameOffset;
+	return mBorrowedBufferList.get();
+}
+
+void SFB::Audio::RemoteDecoder::_ConsumeAudio(UInt32 frameCount)
+{
+	if(mSeekPending.load() || mSeekFailed)
+		return;
+
+	uint64_t readIndex = mShared->mReadIndex.load(std::memory_order_relaxed);
+	if(readIndex == mShared->mWriteIndex.load(std::memory_order_acquire))
+		return;
+
+	UInt32 framesInSlot = mShared->mSlotFrameCounts[readIndex % REMOTE_DECODER_SLOT_COUNT] - mSlotFrameOffset;
+	if(frameCount > framesInSlot) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Decoder.Remote", "_ConsumeAudio() called with more frames than were lent");
+		frameCount = framesInSlot;
+	}
+
+	mCurrentFrame += frameCount;
+	mSlotFrameOffset += frameCount;
+
+	// Return the slot to the service once it has been consumed
+	if(frameCount == framesInSlot) {
+		mSlotFrameOffset = 0;
+		mShared->mReadIndex.store(readIndex + 1, std::memory_order_release);
+		SignalService();
+	}
+}
+
+bool SFB::Audio::RemoteDecoder::_WouldBlock() const
+{
+	return !mServiceFailed && !mSeekFailed && IsAudioPending();
+}
+
+void SFB::Audio::RemoteDecoder::_SetReadabilityHandler(InputSource::ReadabilityHandler handler)
+{
+	{
+		std::lock_guard<std::mutex> lock(mReadabilityLock);
+		if(mReadabilityHandler)
+			Block_release(mReadabilityHandler);
+		mReadabilityHandler = handler ? Block_copy(handler) : nullptr;
+	}
+
+	// A watch in progress calls the new handler
+	if(!handler || !IsOpen() || mServiceFailed || mWatching.exchange(true))
+		return;
+
+	// The watch polls the data pipe alongside the reader, so it wakes at intervals in case the reader took its signal
+	// A service that exits or publishes no audio within the timeout is deemed stalled, and the reader detects its failure
+	dispatch_async(mWatchQueue, ^{
+		uint64_t writeIndex = mShared->mWriteIndex.load();
+		int elapsed = 0;
+		for(;;) {
+			mShared->mReaderWaiting.store(true);
+			if(!IsAudioPending() || mShared->mExitRequested.load())
+				break;
+
+			int result = WaitOnPipe(mDataPipe, REMOTE_DECODER_READER_POLL_MSEC);
+			if(-1 == result) {
+				mServiceStalled.store(true);
+				break;
+			}
+
+			if(writeIndex != mShared->mWriteIndex.load()) {
+				writeIndex = mShared->mWriteIndex.load();
+				elapsed = 0;
+			}
+			else if(0 == result && REMOTE_DECODER_TIMEOUT_MSEC <= (elapsed += REMOTE_DECODER_READER_POLL_MSEC)) {
+				mServiceStalled.store(true);
+				break;
+			}
+		}
+
+		mWatching.store(false);
+
+		std::lock_guard<std::mutex> lock(mReadabilityLock);
+		if(mReadabilityHandler)
+			mReadabilityHandler();
+	});
+}
+
+bool SFB::Audio::RemoteDecoder::IsAudioPending() const
+{
+	// A stalled service is reported so the reader detects its failure
+	if(mServiceStalled.load())
+		return false;
+
+	uint64_t readIndex;
+	if(mSeekPending.load()) {
+		if(mSeekGeneration.load() != mShared->mSeekCompletion.load(std::memory_order_acquire))
+			return true;
+		if(-1 == mShared->mSeekResult.load(std::memory_order_relaxed))
+			return false;
+		readIndex = mShared->mSeekWriteIndex.load(std::memory_order_relaxed);
+	}
+	else
+		readIndex = mShared->mReadIndex.load(std::memory_order_relaxed);
+
+	return readIndex == mShared->mWriteIndex.load(std::memory_order_acquire) && !mShared->mFinished.load(std::memory_order_acquire);
+}
+
+bool SFB::Audio::RemoteDecoder::CompleteSeek()
+{
+	uint32_t generation = mSeekGeneration.load();
+
+	int elapsed = 0;
+	while(generation != mShared->mSeekCompletion.load(std::memory_order_acquire)) {
+		mShared->mReaderWaiting.store(true);
+		if(generation != mShared->mSeekCompletion.load() && !WaitForService(elapsed))
+			return false;
+		mShared->mReaderWaiting.store(false);
+	}
+
+	mSeekPending.store(false);
+
+	SInt64 result = mShared->mSeekResult.load(std::memory_order_relaxed);
+	if(-1 == result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "Decoding service " << mServicePID << " was unable to seek to frame " << mCurrentFrame << " in \"" << GetURL() << "\"");
+		mSeekFailed = true;
+		return false;
+	}
+
+	// The service discarded the audio decoded before the seek
+	mSlotFrameOffset = 0;
+	mCurrentFrame = result;
+
+	return true;
+}
+
+bool SFB::Audio::RemoteDecoder::WaitForService(int& elapsed)
+{
+	if(mServiceFailed)
+		return false;
+
+	// The reader waits in intervals since a parked reader's watch may take the service's signal
+	int result = mServiceStalled.load() ? WaitOnPipe(mDataPipe, 0) : WaitOnPipe(mDataPipe, REMOTE_DECODER_READER_POLL_MSEC);
+	if(1 == result)
+		return true;
+
+	if(0 == result && !mServiceStalled.load() && REMOTE_DECODER_TIMEOUT_MSEC > (elapsed += REMOTE_DECODER_READER_POLL_MSEC))
+		return true;
+
+	if(0 == result)
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "Decoding service " << mServicePID << " stopped responding while decoding \"" << GetURL() << "\"");
+	else
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "Decoding service " << mServicePID << " exited while decoding \"" << GetURL() << "\"");
+
+	TerminateService();
+	mServiceFailed = true;
+
+	return false;
+}
+
+void SFB::Audio::RemoteDecoder::SignalService()
+{
+	if(-1 != mSpacePipe && mShared->mWriterWaiting.exchange(false))
+		SignalPipe(mSpacePipe);
+}
+
+void SFB::Audio::RemoteDecoder::TerminateService()
+{
+	if(-1 == mServicePID)
+		return;
+
+	int status = 0;
+	pid_t result;
+	while(-1 == (result = waitpid(mServicePID, &status, WNOHANG)) && EINTR == errno)
+		;
+
+	// A service that hasn't exited is hung
+	if(0 == result) {
+		kill(mServicePID, SIGKILL);
+		while(-1 == (result = waitpid(mServicePID, &status, 0)) && EINTR == errno)
+			;
+	}
+
+	if(mServicePID == result) {
+		if(WIFSIGNALED(status))
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.Remote", "Decoding service " << mServicePID << " terminated by signal " << WTERMSIG(status));
+		else if(WIFEXITED(status) && EXIT_SUCCESS != WEXITSTATUS(status))
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.Remote", "Decoding service " << mServicePID << " exited with status " << WEXITSTATUS(status));
+	}
+
+	mServicePID = -1;
+}
+
+#pragma mark Service
+
+int SFB::Audio::RemoteDecoder::RunService(int argc, char *argv [])
+{
+	if(3 != argc) {
+		fprintf(stderr, "Usage: %s shared-memory-name url\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Writes to the data pipe fail with EPIPE if the decoder has exited
+	signal(SIGPIPE, SIG_IGN);
+
+	int fd = shm_open(argv[1], O_RDWR, 0);
+	if(-1 == fd) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "shm_open failed: " << strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	struct stat s;
+	if(-1 == fstat(fd, &s) || (size_t)s.st_size < GetSharedStateLength(sizeof(SharedState)) + REMOTE_DECODER_SLOT_COUNT * REMOTE_DECODER_SLOT_BYTES) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "Invalid shared memory");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	void *memory = mmap(nullptr, (size_t)s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(MAP_FAILED == memory) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "mmap failed: " << strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	auto shared = (SharedState *)memory;
+	if(REMOTE_DECODER_MAGIC != shared->mMagic) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "Invalid shared memory");
+		return EXIT_FAILURE;
+	}
+
+	auto signalDecoder = [shared]() {
+		if(shared->mReaderWaiting.exchange(false))
+			SignalPipe(kServiceDataPipe);
+	};
+
+	SFB::CFURL url(CFURLCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)argv[2], (CFIndex)strlen(argv[2]), kCFStringEncodingUTF8, nullptr));
+
+	// Decoders are opened below so the error is reported
+	Decoder::SetAutomaticallyOpenDecoders(false);
+
+	SFB::CFError error;
+	auto decoder = Decoder::CreateForURL(url, &error);
+	if(decoder && !decoder->Open(&error))
+		decoder.reset();
+
+	AudioFormat format = decoder ? decoder->GetFormat() : AudioFormat();
+	UInt32 bufferCount = format.IsInterleaved() ? 1 : format.mChannelsPerFrame;
+	if(decoder && (!format.IsPCM() || 0 == format.mBytesPerFrame || 0 == bufferCount)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "Remote decoding requires PCM audio");
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The format of the file “%@” is not supported by the decoding service."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not a PCM format"), ""));
+		error = SFB::CreateErrorForURL(Decoder::ErrorDomain, Decoder::FileFormatNotSupportedError, description, url, failureReason, nullptr);
+		decoder.reset();
+	}
+
+	// Each buffer in a slot starts on a 16-byte boundary
+	UInt32 bufferStride = bufferCount ? (REMOTE_DECODER_SLOT_BYTES / bufferCount) & ~15u : 0;
+	UInt32 slotFrames = format.mBytesPerFrame ? bufferStride / format.mBytesPerFrame : 0;
+	if(decoder && REMOTE_DECODER_MINIMUM_SLOT_FRAMES > slotFrames) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.Remote", "Audio frames are too large for remote decoding");
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The format of the file “%@” is not supported by the decoding service."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Too many channels"), ""));
+		error = SFB::CreateErrorForURL(Decoder::ErrorDomain, Decoder::FileFormatNotSupportedError, description, url, failureReason, nullptr);
+		decoder.reset();
+	}
+
+	ChannelLayout channelLayout = decoder ? decoder->GetChannelLayout() : ChannelLayout();
+	if(decoder && channelLayout && REMOTE_DECODER_CHANNEL_LAYOUT_BYTES < channelLayout.GetACLSize())
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.Remote", "Channel layout too large for the decoder; ignoring");
+
+	if(!decoder) {
+		if(error) {
+			shared->mErrorCode = CFErrorGetCode(error);
+			CopyString(CFErrorGetDomain(error), shared->mErrorDomain, sizeof(shared->mErrorDomain));
+			SFB::CFString description(CFErrorCopyDescription(error));
+			SFB::CFString failureReason(CFErrorCopyFailureReason(error));
+			SFB::CFString recoverySuggestion(CFErrorCopyRecoverySuggestion(error));
+			CopyString(description, shared->mErrorDescription, sizeof(shared->mErrorDescription));
+			CopyString(failureReason, shared->mErrorFailureReason, sizeof(shared->mErrorFailureReason));
+			CopyString(recoverySuggestion, shared->mErrorRecoverySuggestion, sizeof(shared->mErrorRecoverySuggestion));
+		}
+
+		shared->mServiceState.store(ServiceFailed, std::memory_order_release);
+		signalDecoder();
+		return EXIT_FAILURE;
+	}
+
+	shared->mFormat = format;
+	shared->mSourceFormat = decoder->GetSourceFormat();
+	shared->mSupportsSeeking = decoder->SupportsSeeking();
+	if(channelLayout && REMOTE_DECODER_CHANNEL_LAYOUT_BYTES >= channelLayout.GetACLSize()) {
+		shared->mChannelLayoutSize = (uint32_t)channelLayout.GetACLSize();
+		memcpy(shared->mChannelLayout, channelLayout.GetACL(), shared->mChannelLayoutSize);
+	}
+	SFB::CFString sourceFormatDescription(decoder->CreateSourceFormatDescription());
+	CopyString(sourceFormatDescription, shared->mSourceFormatDescription, sizeof(shared->mSourceFormatDescription));
+	shared->mSlotFrames = slotFrames;
+	shared->mBufferStride = bufferStride;
+	shared->mTotalFrames.store(decoder->GetTotalFrames(), std::memory_order_relaxed);
+
+	shared->mServiceState.store(ServiceReady, std::memory_order_release);
+	signalDecoder();
+
+	// The decoder's buffers alias the slots, so the audio is decoded directly into shared memory
+	std::unique_ptr<AudioBufferList, void (*)(void *)> bufferList((AudioBufferList *)std::calloc(1, offsetof(AudioBufferList, mBuffers) + sizeof(AudioBuffer) * bufferCount), std::free);
+	if(!bufferList)
+		return EXIT_FAILURE;
+
+	bufferList->mNumberBuffers = bufferCount;
+	for(UInt32 i = 0; i < bufferCount; ++i)
+		bufferList->mBuffers[i].mNumberChannels = format.IsInterleaved() ? format.mChannelsPerFrame : 1;
+
+	// Only the service writes the write index
+	uint64_t writeIndex = 0;
+	uint32_t seekGeneration = 0;
+
+	for(;;) {
+		if(shared->mExitRequested.load(std::memory_order_acquire))
+			break;
+
+		uint32_t seekRequest = shared->mSeekRequest.load(std::memory_order_acquire);
+		if(seekRequest != seekGeneration) {
+			seekGeneration = seekRequest;
+
+			SInt64 result = decoder->SeekToFrame(shared->mSeekFrame.load(std::memory_order_relaxed));
+			if(-1 != result) {
+				// The slots decoded before the seek are reclaimed so the audio following it can be decoded
+				// while the decoder has yet to observe the seek's completion
+				shared->mReadIndex.store(writeIndex, std::memory_order_relaxed);
+				shared->mSeekWriteIndex.store(writeIndex, std::memory_order_relaxed);
+				shared->mFinished.store(false, std::memory_order_relaxed);
+			}
+
+			shared->mSeekResult.store(result, std::memory_order_relaxed);
+			shared->mSeekCompletion.store(seekRequest, std::memory_order_release);
+			signalDecoder();
+			continue;
+		}
+
+		bool finished = shared->mFinished.load(std::memory_order_relaxed);
+		if(!finished && REMOTE_DECODER_SLOT_COUNT > writeIndex - shared->mReadIndex.load(std::memory_order_acquire)) {
+			uint8_t *slot = shared->GetSlot(writeIndex);
+			for(UInt32 i = 0; i < bufferCount; ++i) {
+				bufferList->mBuffers[i].mData			= slot + (i * bufferStride);
+				bufferList->mBuffers[i].mDataByteSize	= slotFrames * format.mBytesPerFrame;
+			}
+
+			UInt32 framesRead = decoder->ReadAudio(bufferList.get(), slotFrames);
+			shared->mTotalFrames.store(decoder->GetTotalFrames(), std::memory_order_relaxed);
+
+			if(0 == framesRead)
+				shared->mFinished.store(true, std::memory_order_release);
+			else {
+				shared->mSlotFrameCounts[writeIndex % REMOTE_DECODER_SLOT_COUNT] = framesRead;
+				shared->mWriteIndex.store(++writeIndex, std::memory_order_release);
+			}
+
+			signalDecoder();
+			continue;
+		}
+
+		// Wait for space, a seek, or a request to exit
+		shared->mWriterWaiting.store(true);
+		if(!shared->mExitRequested.load() && seekGeneration == shared->mSeekRequest.load() && (finished || REMOTE_DECODER_SLOT_COUNT <= writeIndex - shared->mReadIndex.load())) {
+			// The space pipe is closed when the decoder exits
+			if(-1 == WaitOnPipe(kServiceSpacePipe, REMOTE_DECODER_SERVICE_POLL_MSEC))
+				break;
+		}
+		shared->mWriterWaiting.store(false);
+	}
+
+	decoder->Close();
+
+	return EXIT_SUCCESS;
+}
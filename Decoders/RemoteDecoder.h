@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <dispatch/dispatch.h>
+
+#include "AudioDecoder.h"
+
+/*! @file RemoteDecoder.h @brief Decoding in a separate process */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A \c Decoder whose decoding is performed by a service process
+		 *
+		 * The service opens the file with \c Decoder::CreateForURL() and decodes directly into a ring of buffers in
+		 * memory shared with this process, which lends the audio to its caller without copying it.  A pipe in each
+		 * direction wakes the reader when audio is available and the service when space is available; the pipes also
+		 * reveal the service's exit, so a codec that crashes on a malformed file ends the track instead of the app.
+		 * A service that doesn't respond within the timeout is terminated.
+		 *
+		 * Seeks complete asynchronously, and \c WouldBlock() reports when the service hasn't yet decoded the audio, so
+		 * a reader sharing its thread with others, such as a \c DecoderPool thread, parks until the readability handler
+		 * is called instead of waiting for the service.  \c ReadAudio() returns a short read rather than waiting once some
+		 * audio has been read.
+		 *
+		 * The service is an executable calling \c RemoteDecoder::RunService() from \c main(), set process-wide with
+		 * \c SetServicePath().
+		 * @note Remote decoding is available only on macOS, where the service may be launched
+		 */
+		class RemoteDecoder : public Decoder
+		{
+
+		public:
+
+			// ========================================
+			/*! @name Service Configuration */
+			//@{
+
+			/*! @brief Get the path of the service executable */
+			static std::string GetServicePath();
+
+			/*!
+			 * @brief Set the path of the service executable
+			 * @param path The path of an executable calling \c RunService()
+			 */
+			static void SetServicePath(const char *path);
+
+			/*!
+			 * @brief Run the decoding service
+			 * @note This is the entire implementation of the service executable's \c main()
+			 * @param argc The argument count passed to \c main()
+			 * @param argv The arguments passed to \c main()
+			 * @return The service's exit status
+			 */
+			static int RunService(int argc, char *argv []);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*!
+			 * @brief Create a \c RemoteDecoder object for the specified URL
+			 * @param url The URL
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Decoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForURL(CFURLRef url, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Destroy this \c RemoteDecoder, terminating its service */
+			virtual ~RemoteDecoder();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			RemoteDecoder(const RemoteDecoder& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			RemoteDecoder& operator=(const RemoteDecoder& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			/*! @brief Query whether the service exited or was terminated while decoding */
+			inline bool DidServiceFail() const						{ return mServiceFailed; }
+
+		private:
+
+			RemoteDecoder() = delete;
+			explicit RemoteDecoder(InputSource::unique_ptr inputSource);
+
+			// Audio access
+			virtual bool _Open(CFErrorRef *error);
+			virtual bool _Close(CFErrorRef *error);
+
+			// The native format of the source audio
+			virtual SFB::CFString _GetSourceFormatDescription() const;
+
+			// Attempt to read frameCount frames of audio, returning the actual number of frames read
+			virtual UInt32 _ReadAudio(AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Source audio information
+			inline virtual SInt64 _GetTotalFrames() const			{ return mTotalFrames; }
+			inline virtual SInt64 _GetCurrentFrame() const			{ return mCurrentFrame; }
+
+			// Seeking support
+			// A seek is requested and its completion observed when audio is next read
+			inline virtual bool _SupportsSeeking() const			{ return mSupportsSeeking; }
+			virtual SInt64 _SeekToFrame(SInt64 frame);
+
+			// The service's buffers are lent to the caller
+			inline virtual bool _SupportsBorrowedAudio() const		{ return true; }
+			virtual const AudioBufferList * _PeekAudio(UInt32& frameCount);
+			virtual void _ConsumeAudio(UInt32 frameCount);
+
+			// Audio is decoded by the service
+			virtual bool _WouldBlock() const;
+			virtual void _SetReadabilityHandler(InputSource::ReadabilityHandler handler);
+
+			// Query whether the service has yet to publish the audio to be read next, consulting only atomic state so the watch may call it
+			bool IsAudioPending() const;
+
+			// Apply a completed seek, waiting for it to complete; returns false if the seek or the service failed
+			bool CompleteSeek();
+
+			// Wait briefly for the service to signal, adding the time waited to elapsed
+			// Returns false if the service exited or hasn't signalled within the timeout
+			bool WaitForService(int& elapsed);
+
+			// Wake the service if it is waiting
+			void SignalService();
+
+			// Terminate the service and reap it
+			void TerminateService();
+
+			struct SharedState;
+
+			SharedState						*mShared;			// The memory shared with the service
+			size_t							mSharedLength;
+			pid_t							mServicePID;
+			int								mDataPipe;			// Signalled by the service
+			int								mSpacePipe;			// Signalled by this process
+			bool							mServiceFailed;
+
+			SInt64							mTotalFrames;
+			SInt64							mCurrentFrame;
+			bool							mSupportsSeeking;
+			SFB::CFString					mSourceFormatDescription;
+
+			std::atomic<uint32_t>			mSeekGeneration;
+			std::atomic_bool				mSeekPending;		// A seek hasn't been applied
+			bool							mSeekFailed;		// The position is unknown until the next seek
+			UInt32							mSlotFrameOffset;	// Frames consumed from the current slot
+
+			// Parked readers are woken by a watch on the data pipe
+			dispatch_queue_t				mWatchQueue;
+			std::atomic_bool				mWatching;
+			std::atomic_bool				mServiceStalled;	// The watch saw the service exit or publish no audio within the timeout
+			std::mutex						mReadabilityLock;
+			InputSource::ReadabilityHandler	mReadabilityHandler;
+			std::unique_ptr<AudioBufferList, void (*)(void *)>	mBorrowedBufferList;
+		};
+
+	}
+}
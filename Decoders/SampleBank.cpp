@@ -0,0 +1,395 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SampleBank.h"
+#include "CFErrorUtilities.h"
+#include "ClipDecoder.h"
+#include "Logger.h"
+
+// The file's magic number and version
+#define SAMPLE_BANK_MAGIC 'SBnk'
+#define SAMPLE_BANK_VERSION 1
+
+// The alignment of each clip's audio, a multiple of the cache line size suitable for vector access
+#define SAMPLE_BANK_DATA_ALIGNMENT 64
+
+namespace {
+
+	// ========================================
+	// The file begins with a header followed by the directory, the strings and channel layouts, and then
+	// the clips' audio.  Offsets are from the start of the file and all values use the writer's byte order.
+	struct FileHeader
+	{
+		uint32_t	mMagic;
+		uint32_t	mVersion;
+		uint32_t	mClipCount;
+		uint32_t	mDataAlignment;
+		uint64_t	mDirectoryOffset;
+		uint64_t	mFileLength;
+	};
+
+	struct DirectoryEntry
+	{
+		AudioStreamBasicDescription		mFormat;
+		uint32_t						mFrameCount;
+		uint32_t						mBufferCount;
+		uint32_t						mNameLength;			// Bytes of UTF-8
+		uint32_t						mDescriptionLength;		// Bytes of UTF-8
+		uint32_t						mChannelLayoutLength;	// Bytes, or 0 if none
+		uint32_t						mReserved;
+		uint64_t						mNameOffset;
+		uint64_t						mDescriptionOffset;
+		uint64_t						mChannelLayoutOffset;
+		uint64_t						mDataOffset;			// The first buffer
+		uint64_t						mBufferStride;			// Bytes between buffers
+	};
+
+	inline uint64_t Align(uint64_t offset, uint64_t alignment)
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+
+	std::string GetUTF8String(CFStringRef string)
+	{
+		if(!string)
+			return std::string();
+
+		CFIndex length = CFStringGetLength(string);
+		CFIndex maximumSize = CFStringGetMaximumSizeForEncoding(length, kCFStringEncodingUTF8);
+		std::string result((size_t)maximumSize, '\0');
+
+		CFIndex usedSize = 0;
+		CFStringGetBytes(string, CFRangeMake(0, length), kCFStringEncodingUTF8, 0, false, (UInt8 *)&result[0], maximumSize, &usedSize);
+		result.resize((size_t)usedSize);
+
+		return result;
+	}
+
+	CFStringRef CreateStringFromUTF8(const uint8_t *bytes, size_t length) CF_RETURNS_RETAINED
+	{
+		return CFStringCreateWithBytes(kCFAllocatorDefault, bytes, (CFIndex)length, kCFStringEncodingUTF8, false);
+	}
+
+	CFErrorRef CreateInvalidSampleBankError(CFURLRef url) CF_RETURNS_RETAINED
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid sample bank."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not a sample bank"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's contents are damaged or were written by an incompatible version or machine."), ""));
+
+		return CreateErrorForURL(SFB::Audio::Decoder::ErrorDomain, SFB::Audio::Decoder::FileFormatNotRecognizedError, description, url, failureReason, recoverySuggestion);
+	}
+
+	// Whether length bytes at offset lie within a file of fileLength bytes
+	inline bool IsInFile(uint64_t offset, uint64_t length, uint64_t fileLength)
+	{
+		return offset <= fileLength && length <= fileLength - offset;
+	}
+
+	// The count regions of stride bytes are divided rather than multiplied so the check can't overflow
+	inline bool IsInFile(uint64_t offset, uint64_t stride, uint64_t count, uint64_t fileLength)
+	{
+		return 0 < count && offset <= fileLength && stride <= (fileLength - offset) / count;
+	}
+
+	// Write byteCount zero bytes
+	bool WritePadding(FILE *file, uint64_t byteCount)
+	{
+		static const uint8_t sZeros [SAMPLE_BANK_DATA_ALIGNMENT] = {};
+		while(0 < byteCount) {
+			size_t count = (size_t)std::min(byteCount, (uint64_t)sizeof(sZeros));
+			if(count != fwrite(sZeros, 1, count, file))
+				return false;
+			byteCount -= count;
+		}
+		return true;
+	}
+
+}
+
+#pragma mark Factory Methods
+
+SFB::Audio::SampleBank::unique_ptr SFB::Audio::SampleBank::CreateForURL(CFURLRef url, CFErrorRef *error)
+{
+	if(nullptr == url)
+		return nullptr;
+
+	char path [PATH_MAX];
+	if(!CFURLGetFileSystemRepresentation(url, FALSE, (UInt8 *)path, PATH_MAX)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EIO, nullptr);
+		return nullptr;
+	}
+
+	int fd = ::open(path, O_RDONLY);
+	if(-1 == fd) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return nullptr;
+	}
+
+	struct stat filestats;
+	if(-1 == fstat(fd, &filestats) || !S_ISREG(filestats.st_mode) || (off_t)sizeof(FileHeader) > filestats.st_size) {
+		::close(fd);
+		if(error)
+			*error = CreateInvalidSampleBankError(url);
+		return nullptr;
+	}
+
+	// The whole file is mapped once; the mapping remains valid after the descriptor is closed
+	auto fileLength = (size_t)filestats.st_size;
+	void *mapping = mmap(nullptr, fileLength, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if(MAP_FAILED == mapping) {
+		LOGGER_ERR("org.sbooth.AudioEngine.SampleBank", "mmap failed: " << strerror(errno));
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return nullptr;
+	}
+
+	// Read the audio ahead so the first playback of each clip doesn't fault it in
+	madvise(mapping, fileLength, MADV_WILLNEED);
+
+	// The clips share the mapping and the last one destroyed removes it
+	std::shared_ptr<const void> storage(mapping, [fileLength](const void *address) {
+		munmap(const_cast<void *>(address), fileLength);
+	});
+
+	auto bytes = static_cast<const uint8_t *>(mapping);
+	auto header = reinterpret_cast<const FileHeader *>(bytes);
+
+	if(SAMPLE_BANK_MAGIC != header->mMagic || SAMPLE_BANK_VERSION != header->mVersion || fileLength != header->mFileLength || 0 == header->mDataAlignment ||
+	   !IsInFile(header->mDirectoryOffset, (uint64_t)header->mClipCount * sizeof(DirectoryEntry), fileLength) || 0 != header->mDirectoryOffset % alignof(DirectoryEntry)) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.SampleBank", "Invalid sample bank header");
+		if(error)
+			*error = CreateInvalidSampleBankError(url);
+		return nullptr;
+	}
+
+	unique_ptr sampleBank(new SampleBank(url));
+	sampleBank->mClips.reserve(header->mClipCount);
+
+	auto directory = reinterpret_cast<const DirectoryEntry *>(bytes + header->mDirectoryOffset);
+	for(uint32_t i = 0; i < header->mClipCount; ++i) {
+		const auto& entry = directory[i];
+		AudioFormat format(entry.mFormat);
+
+		// Each buffer's byte count must fit the buffer list's mDataByteSize
+		bool valid = format.IsPCM() && 0 < format.mBytesPerFrame && 0 < entry.mFrameCount &&
+			entry.mBufferCount == (format.IsInterleaved() ? 1 : format.mChannelsPerFrame) &&
+			(uint64_t)format.mBytesPerFrame * entry.mFrameCount <= UINT32_MAX &&
+			(uint64_t)format.mBytesPerFrame * entry.mFrameCount <= entry.mBufferStride &&
+			0 == entry.mDataOffset % header->mDataAlignment &&
+			IsInFile(entry.mDataOffset, entry.mBufferStride, entry.mBufferCount, fileLength) &&
+			IsInFile(entry.mNameOffset, entry.mNameLength, fileLength) &&
+			IsInFile(entry.mDescriptionOffset, entry.mDescriptionLength, fileLength) &&
+			IsInFile(entry.mChannelLayoutOffset, entry.mChannelLayoutLength, fileLength) &&
+			(0 == entry.mChannelLayoutLength || offsetof(AudioChannelLayout, mChannelDescriptions) <= entry.mChannelLayoutLength);
+
+		SFB::CFString name(valid ? CreateStringFromUTF8(bytes + entry.mNameOffset, entry.mNameLength) : nullptr);
+		if(!name || !sampleBank->mIndexes.emplace(std::string((const char *)bytes + entry.mNameOffset, entry.mNameLength), i).second) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.SampleBank", "Invalid sample bank directory entry " << i);
+			if(error)
+				*error = CreateInvalidSampleBankError(url);
+			return nullptr;
+		}
+
+		SFB::CFString description(CreateStringFromUTF8(bytes + entry.mDescriptionOffset, entry.mDescriptionLength));
+
+		ChannelLayout channelLayout;
+		if(0 < entry.mChannelLayoutLength) {
+			// Copy the layout since the mapping's alignment isn't guaranteed to be sufficient
+			std::vector<uint8_t> layout(bytes + entry.mChannelLayoutOffset, bytes + entry.mChannelLayoutOffset + entry.mChannelLayoutLength);
+			auto acl = reinterpret_cast<const AudioChannelLayout *>(layout.data());
+			if(offsetof(AudioChannelLayout, mChannelDescriptions) + (uint64_t)acl->mNumberChannelDescriptions * sizeof(AudioChannelDescription) <= entry.mChannelLayoutLength)
+				channelLayout = acl;
+		}
+
+		std::shared_ptr<Clip> clip(new Clip(format, channelLayout, url, description));
+		clip->Attach(storage, bytes + entry.mDataOffset, (size_t)entry.mBufferStride, entry.mFrameCount);
+
+		sampleBank->mByteCount += clip->GetByteCount();
+		sampleBank->mClips.push_back(NamedClip(std::move(name), std::move(clip)));
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.SampleBank", "Opened sample bank of " << sampleBank->mClips.size() << " clips (" << sampleBank->mByteCount << " bytes)");
+
+	return sampleBank;
+}
+
+bool SFB::Audio::SampleBank::WriteToURL(CFURLRef url, const std::vector<NamedClip>& clips, CFErrorRef *error)
+{
+	if(nullptr == url)
+		return false;
+
+	// Lay out the directory, strings and channel layouts, then the aligned audio
+	struct ClipLayout
+	{
+		DirectoryEntry		mEntry;
+		std::string			mName;
+		std::string			mDescription;
+	};
+
+	std::vector<ClipLayout> layouts;
+	std::set<std::string> names;
+
+	uint64_t offset = sizeof(FileHeader) + clips.size() * sizeof(DirectoryEntry);
+
+	for(const auto& namedClip : clips) {
+		const auto& clip = namedClip.second;
+		if(!clip || !namedClip.first) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.SampleBank", "Sample bank clips must have a name and audio");
+			return false;
+		}
+
+		ClipLayout layout = {};
+		layout.mName = GetUTF8String(namedClip.first);
+		layout.mDescription = GetUTF8String(clip->GetSourceFormatDescription());
+
+		if(!names.insert(layout.mName).second) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.SampleBank", "Duplicate sample bank clip name \"" << (CFStringRef)namedClip.first << "\"");
+			return false;
+		}
+
+		auto& entry = layout.mEntry;
+		entry.mFormat = clip->GetFormat();
+		entry.mFrameCount = clip->GetFrameCount();
+		entry.mBufferCount = clip->GetBufferList()->mNumberBuffers;
+
+		entry.mNameOffset = offset;
+		entry.mNameLength = (uint32_t)layout.mName.size();
+		offset += entry.mNameLength;
+
+		entry.mDescriptionOffset = offset;
+		entry.mDescriptionLength = (uint32_t)layout.mDescription.size();
+		offset += entry.mDescriptionLength;
+
+		entry.mChannelLayoutOffset = offset;
+		entry.mChannelLayoutLength = clip->GetChannelLayout() ? (uint32_t)clip->GetChannelLayout().GetACLSize() : 0;
+		offset += entry.mChannelLayoutLength;
+
+		layouts.push_back(layout);
+	}
+
+	for(auto& layout : layouts) {
+		auto& entry = layout.mEntry;
+		entry.mBufferStride = Align(AudioFormat(entry.mFormat).FrameCountToByteCount(entry.mFrameCount), SAMPLE_BANK_DATA_ALIGNMENT);
+		entry.mDataOffset = Align(offset, SAMPLE_BANK_DATA_ALIGNMENT);
+		if(0 < entry.mBufferCount && entry.mBufferStride > (UINT64_MAX - entry.mDataOffset) / entry.mBufferCount) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.SampleBank", "Sample bank clips are too large");
+			return false;
+		}
+		offset = entry.mDataOffset + entry.mBufferStride * entry.mBufferCount;
+	}
+
+	FileHeader header = {
+		.mMagic				= SAMPLE_BANK_MAGIC,
+		.mVersion			= SAMPLE_BANK_VERSION,
+		.mClipCount			= (uint32_t)clips.size(),
+		.mDataAlignment		= SAMPLE_BANK_DATA_ALIGNMENT,
+		.mDirectoryOffset	= sizeof(FileHeader),
+		.mFileLength		= offset
+	};
+
+	char path [PATH_MAX];
+	if(!CFURLGetFileSystemRepresentation(url, FALSE, (UInt8 *)path, PATH_MAX)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EIO, nullptr);
+		return false;
+	}
+
+	FILE *file = fopen(path, "w");
+	if(!file) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return false;
+	}
+
+	bool result = 1 == fwrite(&header, sizeof(header), 1, file);
+
+	for(size_t i = 0; result && i < layouts.size(); ++i)
+		result = 1 == fwrite(&layouts[i].mEntry, sizeof(DirectoryEntry), 1, file);
+
+	for(size_t i = 0; result && i < layouts.size(); ++i) {
+		const auto& layout = layouts[i];
+		const auto& channelLayout = clips[i].second->GetChannelLayout();
+		result = layout.mName.size() == fwrite(layout.mName.data(), 1, layout.mName.size(), file) &&
+			layout.mDescription.size() == fwrite(layout.mDescription.data(), 1, layout.mDescription.size(), file) &&
+			(0 == layout.mEntry.mChannelLayoutLength || 1 == fwrite(channelLayout.GetACL(), layout.mEntry.mChannelLayoutLength, 1, file));
+	}
+
+	for(size_t i = 0; result && i < layouts.size(); ++i) {
+		const auto& entry = layouts[i].mEntry;
+		const auto bufferList = clips[i].second->GetBufferList();
+
+		result = WritePadding(file, entry.mDataOffset - (uint64_t)ftello(file));
+		for(UInt32 j = 0; result && j < bufferList->mNumberBuffers; ++j) {
+			const auto& buffer = bufferList->mBuffers[j];
+			result = 1 == fwrite(buffer.mData, buffer.mDataByteSize, 1, file) && WritePadding(file, entry.mBufferStride - buffer.mDataByteSize);
+		}
+	}
+
+	int errorCode = result ? 0 : errno;
+	if(0 != fclose(file) && result) {
+		errorCode = errno;
+		result = false;
+	}
+
+	if(!result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.SampleBank", "Unable to write sample bank: " << strerror(errorCode));
+		unlink(path);
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errorCode, nullptr);
+		return false;
+	}
+
+	return true;
+}
+
+#pragma mark Creation
+
+SFB::Audio::SampleBank::SampleBank(CFURLRef url)
+	: mURL(url ? (CFURLRef)CFRetain(url) : nullptr), mByteCount(0)
+{}
+
+#pragma mark Clip access
+
+SFB::Audio::Clip::shared_ptr SFB::Audio::SampleBank::GetClip(CFStringRef name) const
+{
+	auto iter = mIndexes.find(GetUTF8String(name));
+	if(iter == mIndexes.end())
+		return nullptr;
+
+	return mClips[iter->second].second;
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::SampleBank::CreateDecoder(CFStringRef name, CFErrorRef *error) const
+{
+	auto clip = GetClip(name);
+	if(!clip) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.SampleBank", "No clip named \"" << name << "\" in sample bank");
+		return nullptr;
+	}
+
+	auto decoder = ClipDecoder::CreateForClip(clip, error);
+	if(decoder && !decoder->Open(error))
+		return nullptr;
+
+	return decoder;
+}
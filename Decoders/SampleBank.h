@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "AudioDecoder.h"
+#include "ClipCache.h"
+
+/*! @file SampleBank.h @brief Memory-mapped files of decoded clips */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A file of named clips, decoded ahead of time and memory mapped when opened
+		 *
+		 * A sample bank holds each clip's PCM audio, aligned and in the format it was decoded to, followed by
+		 * a directory.  Opening a bank maps the file and reads only the directory; the clips reference the
+		 * mapped audio directly, so no clip is decoded, parsed, or copied into memory.  Clips remain valid
+		 * after the \c SampleBank is destroyed and the mapping is removed when the last clip is destroyed.
+		 *
+		 * For playback with a \c Player the clips should be written in the player's output format,
+		 * which avoids all conversion when they are rendered.
+		 * @note Sample banks use the byte order of the machine that wrote them
+		 */
+		class SampleBank
+		{
+
+		public:
+
+			/*! @brief A \c std::unique_ptr for \c SampleBank objects */
+			using unique_ptr = std::unique_ptr<SampleBank>;
+
+			/*! @brief A named clip */
+			using NamedClip = std::pair<SFB::CFString, Clip::shared_ptr>;
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*!
+			 * @brief Open the sample bank at the specified URL
+			 * @param url The URL of the sample bank
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c SampleBank, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForURL(CFURLRef url, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Write a sample bank containing the specified clips
+			 * @note Clips are written in the format they were decoded to
+			 * @param url The URL of the sample bank to create
+			 * @param clips The clips and their names, which must be unique
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			static bool WriteToURL(CFURLRef url, const std::vector<NamedClip>& clips, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			SampleBank(const SampleBank& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			SampleBank& operator=(const SampleBank& rhs) = delete;
+
+			/*! @endcond */
+
+			//@}
+
+
+			// ========================================
+			/*! @name Clip access */
+			//@{
+
+			/*! @brief Get the URL of the sample bank */
+			inline CFURLRef GetURL() const								{ return mURL; }
+
+			/*! @brief Get the number of clips in the sample bank */
+			inline size_t GetClipCount() const							{ return mClips.size(); }
+
+			/*! @brief Get the name of the clip at \c index, or \c nullptr if \c index is out of range */
+			inline CFStringRef GetClipName(size_t index) const			{ return index < mClips.size() ? (CFStringRef)mClips[index].first : nullptr; }
+
+			/*! @brief Get the clip at \c index, or \c nullptr if \c index is out of range */
+			inline Clip::shared_ptr GetClip(size_t index) const		{ return index < mClips.size() ? mClips[index].second : nullptr; }
+
+			/*! @brief Get the clip with the specified name, or \c nullptr if none */
+			Clip::shared_ptr GetClip(CFStringRef name) const;
+
+			/*!
+			 * @brief Create an open \c ClipDecoder for the clip with the specified name
+			 * @param name The name of the clip
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Decoder object, or \c nullptr on failure
+			 */
+			Decoder::unique_ptr CreateDecoder(CFStringRef name, CFErrorRef *error = nullptr) const;
+
+			/*! @brief Get the number of bytes of audio in the sample bank */
+			inline size_t GetByteCount() const							{ return mByteCount; }
+
+			//@}
+
+		private:
+
+			explicit SampleBank(CFURLRef url);
+
+			SFB::CFURL						mURL;
+			std::vector<NamedClip>			mClips;
+			std::map<std::string, size_t>	mIndexes;		// Clip indexes keyed by UTF-8 name
+			size_t							mByteCount;
+		};
+
+	}
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <CoreAudio/CoreAudioTypes.h>
+
+#include "SampleKernels.h"
+
+namespace SFB {
+
+	namespace Audio {
+
+		// ========================================
+		// Deinterleaving of decoded samples
+		//
+		// Decoders producing interleaved samples select a Deinterleaver once in _Open() for the
+		// stream's sample format and channel count, removing per-chunk format branching; the work
+		// is performed by the SampleKernels selected for the host
+		// ========================================
+		namespace SamplePacking {
+
+			// Deinterleave frames from an interleaved buffer into the non-interleaved buffers of an AudioBufferList
+			class Deinterleaver
+			{
+
+			public:
+
+				// Pass float samples through unchanged
+				static Deinterleaver ForFloat(UInt32 channelCount)
+				{
+					return Deinterleaver(Operation::Float, sizeof(float), channelCount, 0);
+				}
+
+				// Pass bytes, such as DSD, through unchanged
+				static Deinterleaver ForBytes(UInt32 channelCount)
+				{
+					return Deinterleaver(Operation::Bytes, sizeof(uint8_t), channelCount, 0);
+				}
+
+				// Shift low-aligned 32-bit samples holding bytesPerSample bytes to high alignment
+				static Deinterleaver ForAlignHigh(UInt32 bytesPerSample, UInt32 channelCount)
+				{
+					if(1 > bytesPerSample || 4 < bytesPerSample)
+						return nullptr;
+					return Deinterleaver(Operation::AlignHigh, sizeof(int32_t), channelCount, bytesPerSample);
+				}
+
+				// Convert low-aligned 32-bit samples holding bytesPerSample bytes to float in [-1, 1)
+				static Deinterleaver ForNormalize(UInt32 bytesPerSample, UInt32 channelCount)
+				{
+					if(1 > bytesPerSample || 4 < bytesPerSample)
+						return nullptr;
+					return Deinterleaver(Operation::Normalize, sizeof(float), channelCount, bytesPerSample);
+				}
+
+				// An empty deinterleaver
+				Deinterleaver(std::nullptr_t = nullptr)
+					: mOperation(Operation::None), mKernels(nullptr), mOutputSampleSize(0), mChannelCount(0), mShift(0), mScale(0)
+				{}
+
+				// Whether this deinterleaver performs an operation
+				explicit operator bool() const			{ return Operation::None != mOperation; }
+
+				// Deinterleave frameCount frames from input into the buffers of bufferList, starting at frameOffset
+				void operator()(const void *input, AudioBufferList *bufferList, UInt32 frameOffset, UInt32 frameCount)
+				{
+					for(UInt32 channel = 0; channel < mChannelCount; ++channel) {
+						auto output = static_cast<uint8_t *>(bufferList->mBuffers[channel].mData) + ((size_t)frameOffset * mOutputSampleSize);
+						mFloatOutputs[channel] = reinterpret_cast<float *>(output);
+						mByteOutputs[channel] = output;
+
+						bufferList->mBuffers[channel].mNumberChannels	= 1;
+						bufferList->mBuffers[channel].mDataByteSize		= (UInt32)((frameOffset + frameCount) * mOutputSampleSize);
+					}
+
+					switch(mOperation) {
+						case Operation::Float:
+							// Mono requires no deinterleaving
+							if(1 == mChannelCount)
+								memcpy(mFloatOutputs[0], input, frameCount * sizeof(float));
+							else
+								mKernels->Deinterleave(static_cast<const float *>(input), mFloatOutputs.data(), mChannelCount, frameCount);
+							break;
+
+						case Operation::Bytes:
+							if(1 == mChannelCount)
+								memcpy(mByteOutputs[0], input, frameCount);
+							else
+								mKernels->DeinterleaveBytes(static_cast<const uint8_t *>(input), mByteOutputs.data(), mChannelCount, frameCount);
+							break;
+
+						case Operation::AlignHigh:
+							for(UInt32 channel = 0; channel < mChannelCount; ++channel)
+								mKernels->PackInt32(static_cast<const int32_t *>(input) + channel, mChannelCount, mByteOutputs[channel], frameCount, mShift);
+							break;
+
+						case Operation::Normalize:
+							for(UInt32 channel = 0; channel < mChannelCount; ++channel)
+								mKernels->ConvertInt32ToFloat(static_cast<const int32_t *>(input) + channel, mChannelCount, mFloatOutputs[channel], 1, frameCount, mScale);
+							break;
+
+						case Operation::None:
+							break;
+					}
+				}
+
+			private:
+
+				enum class Operation {
+					None,
+					Float,
+					Bytes,
+					AlignHigh,
+					Normalize
+				};
+
+				// The output pointers are allocated here so deinterleaving doesn't allocate
+				// The scale is a power of two so multiplication by it is exact
+				Deinterleaver(Operation operation, UInt32 outputSampleSize, UInt32 channelCount, UInt32 bytesPerSample)
+					: mOperation(operation), mKernels(&SampleKernels::Get()), mOutputSampleSize(outputSampleSize), mChannelCount(channelCount),
+					mShift(bytesPerSample ? 8 * (4 - bytesPerSample) : 0), mScale(bytesPerSample ? 1.f / (float)(1u << ((8 * bytesPerSample) - 1)) : 1.f),
+					mFloatOutputs(channelCount), mByteOutputs(channelCount)
+				{}
+
+				Operation					mOperation;
+				const SampleKernels			*mKernels;
+				UInt32						mOutputSampleSize;
+				UInt32						mChannelCount;
+				UInt32						mShift;
+				float						mScale;
+				std::vector<float *>		mFloatOutputs;
+				std::vector<uint8_t *>		mByteOutputs;
+			};
+
+		}
+
+	}
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "SeekIndex.h"
+
+namespace {
+
+	// Seek indexes are cached in the user's cache directory keyed by path and kind
+	const char kSeekIndexMagic [4] = { 'S', 'F', 'B', 'i' };
+	const uint32_t kSeekIndexVersion = 2;
+
+	struct SeekIndexHeader
+	{
+		char		mMagic [4];
+		uint32_t	mVersion;
+		uint32_t	mKind;
+		uint32_t	mPathLength;
+		int64_t		mFileSize;
+		int64_t		mModificationTime;
+		int64_t		mModificationTimeNanoseconds;
+		int64_t		mTotalFrames;
+		int64_t		mStep;
+		uint64_t	mFill;
+	};
+
+	// The path and status of the regular file at url
+	bool GetFileStatus(CFURLRef url, std::string& path, struct stat& sb)
+	{
+		char buffer [PATH_MAX];
+		if(!url || !CFURLGetFileSystemRepresentation(url, true, (UInt8 *)buffer, sizeof(buffer)))
+			return false;
+
+		if(0 != stat(buffer, &sb) || !S_ISREG(sb.st_mode))
+			return false;
+
+		path = buffer;
+		return true;
+	}
+
+	std::string SeekIndexCachePath(const std::string& path, UInt32 kind)
+	{
+		char cacheDirectory [PATH_MAX];
+		size_t length = confstr(_CS_DARWIN_USER_CACHE_DIR, cacheDirectory, sizeof(cacheDirectory));
+		if(0 == length || length > sizeof(cacheDirectory))
+			return std::string();
+
+		std::string directory = std::string(cacheDirectory) + "org.sbooth.AudioEngine";
+		if(0 != mkdir(directory.c_str(), 0755) && EEXIST != errno)
+			return std::string();
+
+		directory += "/SeekIndex";
+		if(0 != mkdir(directory.c_str(), 0755) && EEXIST != errno)
+			return std::string();
+
+		char name [26];
+		snprintf(name, sizeof(name), "%016zx.%08x", std::hash<std::string>()(path), (unsigned int)kind);
+
+		return directory + "/" + name;
+	}
+
+	void FillSeekIndexHeader(SeekIndexHeader& header, const std::string& path, const struct stat& sb, UInt32 kind)
+	{
+		memset(&header, 0, sizeof(header));
+		memcpy(header.mMagic, kSeekIndexMagic, sizeof(kSeekIndexMagic));
+		header.mVersion						= kSeekIndexVersion;
+		header.mKind						= kind;
+		header.mPathLength					= (uint32_t)path.size();
+		header.mFileSize					= sb.st_size;
+		header.mModificationTime			= sb.st_mtimespec.tv_sec;
+		header.mModificationTimeNanoseconds	= sb.st_mtimespec.tv_nsec;
+	}
+
+}
+
+SFB::Audio::SeekIndex::SeekIndex()
+	: mStep(0), mTotalFrames(-1)
+{}
+
+SFB::Audio::SeekIndex::SeekIndex(SInt64 step, std::vector<SInt64> offsets, SInt64 totalFrames)
+	: mStep(step), mOffsets(std::move(offsets)), mTotalFrames(totalFrames)
+{}
+
+bool SFB::Audio::SeekIndex::Find(SInt64 position, SInt64& pointPosition, SInt64& offset) const
+{
+	if(IsEmpty() || 0 > position)
+		return false;
+
+	SInt64 point = std::min(position / mStep, (SInt64)mOffsets.size() - 1);
+
+	pointPosition = point * mStep;
+	offset = mOffsets[(size_t)point];
+
+	return true;
+}
+
+bool SFB::Audio::SeekIndex::Load(CFURLRef url, UInt32 kind)
+{
+	std::string path;
+	struct stat sb;
+	if(!GetFileStatus(url, path, sb))
+		return false;
+
+	std::string cachePath = SeekIndexCachePath(path, kind);
+	if(cachePath.empty())
+		return false;
+
+	std::unique_ptr<FILE, int(*)(FILE *)> file(fopen(cachePath.c_str(), "r"), fclose);
+	if(!file)
+		return false;
+
+	SeekIndexHeader expected, header;
+	FillSeekIndexHeader(expected, path, sb, kind);
+
+	if(1 != fread(&header, sizeof(header), 1, file.get()))
+		return false;
+
+	if(memcmp(header.mMagic, expected.mMagic, sizeof(header.mMagic)) || header.mVersion != expected.mVersion || header.mKind != expected.mKind || header.mPathLength != expected.mPathLength || header.mFileSize != expected.mFileSize || header.mModificationTime != expected.mModificationTime || header.mModificationTimeNanoseconds != expected.mModificationTimeNanoseconds || 0 >= header.mStep || 0 == header.mFill)
+		return false;
+
+	// Guard against hash collisions
+	std::string cachedPath(header.mPathLength, '\0');
+	if(1 != fread(&cachedPath[0], header.mPathLength, 1, file.get()) || cachedPath != path)
+		return false;
+
+	std::vector<int64_t> cachedOffsets(header.mFill);
+	if(header.mFill != fread(cachedOffsets.data(), sizeof(int64_t), header.mFill, file.get()))
+		return false;
+
+	mStep = header.mStep;
+	mOffsets.assign(cachedOffsets.begin(), cachedOffsets.end());
+	mTotalFrames = header.mTotalFrames;
+
+	return true;
+}
+
+bool SFB::Audio::SeekIndex::Save(CFURLRef url, UInt32 kind) const
+{
+	if(IsEmpty())
+		return false;
+
+	std::string path;
+	struct stat sb;
+	if(!GetFileStatus(url, path, sb))
+		return false;
+
+	std::string cachePath = SeekIndexCachePath(path, kind);
+	if(cachePath.empty())
+		return false;
+
+	SeekIndexHeader header;
+	FillSeekIndexHeader(header, path, sb, kind);
+	header.mTotalFrames	= mTotalFrames;
+	header.mStep		= mStep;
+	header.mFill		= mOffsets.size();
+
+	std::vector<int64_t> cachedOffsets(mOffsets.begin(), mOffsets.end());
+
+	// Write to a temporary file and rename it so readers never see a partial index
+	std::string temporaryPath = cachePath + ".XXXXXX";
+	int fd = mkstemp(&temporaryPath[0]);
+	if(-1 == fd)
+		return false;
+
+	std::unique_ptr<FILE, int(*)(FILE *)> file(fdopen(fd, "w"), fclose);
+	if(!file) {
+		close(fd);
+		unlink(temporaryPath.c_str());
+		return false;
+	}
+
+	bool result = 1 == fwrite(&header, sizeof(header), 1, file.get()) && 1 == fwrite(path.data(), path.size(), 1, file.get()) && cachedOffsets.size() == fwrite(cachedOffsets.data(), sizeof(int64_t), cachedOffsets.size(), file.get());
+	result = 0 == fclose(file.release()) && result;
+
+	if(!result || 0 != rename(temporaryPath.c_str(), cachePath.c_str())) {
+		unlink(temporaryPath.c_str());
+		return false;
+	}
+
+	return true;
+}
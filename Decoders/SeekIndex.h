@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+namespace SFB {
+
+	namespace Audio {
+
+		// ========================================
+		// An index of byte offsets at evenly spaced positions in a stream
+		//
+		// Positions are in units chosen by the decoder building the index (audio frames, codec frames, or granule
+		// positions) so the seek point preceding any position is found in constant time.
+		//
+		// Indexes for regular files may be saved to the user's cache directory and shared by all decoders of a given
+		// kind.  Cached indexes are keyed by path and kind and are validated against the file's size and modification time.
+		// ========================================
+		class SeekIndex
+		{
+
+		public:
+
+			SeekIndex();
+			SeekIndex(SInt64 step, std::vector<SInt64> offsets, SInt64 totalFrames);
+
+			// The distance between seek points
+			inline SInt64 GetStep() const							{ return mStep; }
+
+			// The offset of each seek point, the first of which is at position 0
+			inline const std::vector<SInt64>& GetOffsets() const	{ return mOffsets; }
+
+			// The total number of audio frames in the stream, or -1 if unknown
+			inline SInt64 GetTotalFrames() const					{ return mTotalFrames; }
+
+			inline bool IsEmpty() const								{ return 0 >= mStep || mOffsets.empty(); }
+
+			// Find the seek point at or before position, returning false if the index is empty
+			bool Find(SInt64 position, SInt64& pointPosition, SInt64& offset) const;
+
+			// Replace the index with the one cached for url, returning false if there is no valid cached index
+			bool Load(CFURLRef url, UInt32 kind);
+
+			// Cache the index for url
+			bool Save(CFURLRef url, UInt32 kind) const;
+
+		private:
+
+			SInt64					mStep;
+			std::vector<SInt64>		mOffsets;
+			SInt64					mTotalFrames;
+		};
+
+	}
+}
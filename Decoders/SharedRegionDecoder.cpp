@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+
+#include "SharedRegionDecoder.h"
+#include "CFErrorUtilities.h"
+#include "Logger.h"
+
+#pragma mark Factory Methods
+
+std::vector<SFB::Audio::Decoder::unique_ptr> SFB::Audio::SharedRegionDecoder::CreateForDecoderRegions(Decoder::unique_ptr decoder, const std::vector<Region>& regions, CFErrorRef *error)
+{
+	std::vector<unique_ptr> decoders;
+	if(!decoder)
+		return decoders;
+
+	// The decoder is opened once for all regions
+	if(!decoder->IsOpen() && !decoder->Open(error))
+		return decoders;
+
+	if(!decoder->SupportsSeeking()) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.SharedRegion", "Regions are only supported for seekable decoders");
+
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” does not support seeking."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Seeking not supported"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("Regions may only be decoded from files that support seeking."), ""));
+
+			*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::FileFormatNotSupportedError, description, decoder->GetURL(), failureReason, recoverySuggestion);
+		}
+
+		return decoders;
+	}
+
+	auto sharedDecoder = std::make_shared<SharedDecoder>();
+	sharedDecoder->mDecoder = std::move(decoder);
+
+	SInt64 totalFrames = sharedDecoder->mDecoder->GetTotalFrames();
+	for(auto region : regions) {
+		if(0 > region.mStartingFrame || (0 <= totalFrames && totalFrames < region.mStartingFrame + region.mFrameCount)) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.SharedRegion", "Invalid region: starting frame " << region.mStartingFrame << ", frame count " << region.mFrameCount);
+
+			if(error) {
+				SFB::CFString description(CFCopyLocalizedString(CFSTR("The region could not be decoded from the file “%@”."), ""));
+				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Invalid region"), ""));
+				SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The region extends beyond the end of the file."), ""));
+
+				*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::InputOutputError, description, sharedDecoder->mDecoder->GetURL(), failureReason, recoverySuggestion);
+			}
+
+			decoders.clear();
+			return decoders;
+		}
+
+		// A region without a length extends to the end of the audio
+		if(0 == region.mFrameCount)
+			region.mFrameCount = std::max(totalFrames - region.mStartingFrame, (SInt64)0);
+
+		decoders.push_back(unique_ptr(new SharedRegionDecoder(sharedDecoder, region)));
+	}
+
+	return decoders;
+}
+
+SFB::Audio::SharedRegionDecoder::SharedRegionDecoder(std::shared_ptr<SharedDecoder> sharedDecoder, const Region& region)
+	: mSharedDecoder(sharedDecoder), mRegion(region), mCurrentFrame(0)
+{}
+
+bool SFB::Audio::SharedRegionDecoder::_Open(CFErrorRef */*error*/)
+{
+	std::lock_guard<std::mutex> lock(mSharedDecoder->mMutex);
+
+	mFormat			= mSharedDecoder->mDecoder->GetFormat();
+	mChannelLayout	= mSharedDecoder->mDecoder->GetChannelLayout();
+	mSourceFormat	= mSharedDecoder->mDecoder->GetSourceFormat();
+
+	mCurrentFrame = 0;
+
+	return true;
+}
+
+bool SFB::Audio::SharedRegionDecoder::_Close(CFErrorRef */*error*/)
+{
+	// The shared decoder is closed when the last region is destroyed
+	return true;
+}
+
+SFB::CFString SFB::Audio::SharedRegionDecoder::_GetSourceFormatDescription() const
+{
+	std::lock_guard<std::mutex> lock(mSharedDecoder->mMutex);
+	return CFString(mSharedDecoder->mDecoder->CreateSourceFormatDescription());
+}
+
+#pragma mark Functionality
+
+UInt32 SFB::Audio::SharedRegionDecoder::_ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	UInt32 framesToRead = (UInt32)std::min((SInt64)frameCount, mRegion.mFrameCount - mCurrentFrame);
+	if(0 == framesToRead) {
+		for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+			bufferList->mBuffers[i].mDataByteSize = 0;
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> lock(mSharedDecoder->mMutex);
+	auto& decoder = mSharedDecoder->mDecoder;
+
+	// The decoder is only seeked if another region moved it or this region was seeked
+	SInt64 frame = mRegion.mStartingFrame + mCurrentFrame;
+	if(frame != decoder->GetCurrentFrame() && frame != decoder->SeekToFrame(frame)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.SharedRegion", "Unable to seek to frame " << frame);
+		return 0;
+	}
+
+	UInt32 framesRead = decoder->ReadAudio(bufferList, framesToRead);
+	mCurrentFrame += framesRead;
+
+	return framesRead;
+}
+
+SInt64 SFB::Audio::SharedRegionDecoder::_SeekToFrame(SInt64 frame)
+{
+	// The shared decoder is seeked when audio is next read
+	mCurrentFrame = frame;
+	return mCurrentFrame;
+}
+
+SFB::Audio::Decoder::SeekCost SFB::Audio::SharedRegionDecoder::_GetSeekCost(SInt64 frame) const
+{
+	std::lock_guard<std::mutex> lock(mSharedDecoder->mMutex);
+
+	SInt64 decoderFrame = mRegion.mStartingFrame + frame;
+	if(decoderFrame == mSharedDecoder->mDecoder->GetCurrentFrame())
+		return SeekCostConstant;
+
+	return mSharedDecoder->mDecoder->GetSeekCost(decoderFrame);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "AudioDecoder.h"
+
+/*! @file SharedRegionDecoder.h @brief Support for decoding several regions of one open decoder */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A Decoder providing one region of a Decoder shared with other regions
+		 *
+		 * Regions created together share a single open instance of the underlying decoder, which is seeked only
+		 * when a region is read from a position other than the decoder's current frame.  Consecutive regions read
+		 * in order, such as the tracks of an album image, are therefore decoded sequentially and gaplessly.
+		 * Access to the underlying decoder is serialized so regions may be used from different threads.
+		 */
+		class SharedRegionDecoder : public Decoder
+		{
+
+		public:
+
+			/*! @brief A region of a decoder's audio */
+			struct Region
+			{
+				SInt64 mStartingFrame;		/*!< @brief The first frame of the region */
+				SInt64 mFrameCount;			/*!< @brief The number of frames in the region, or \c 0 for all frames following \c mStartingFrame */
+			};
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*!
+			 * @brief Create \c SharedRegionDecoder objects for regions of the specified \c Decoder
+			 * @param decoder The decoder, which must support seeking
+			 * @param regions The regions to decode
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return One \c SharedRegionDecoder object per region, or an empty vector on failure
+			 */
+			static std::vector<unique_ptr> CreateForDecoderRegions(unique_ptr decoder, const std::vector<Region>& regions, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Destroy this \c SharedRegionDecoder */
+			virtual ~SharedRegionDecoder() = default;
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			SharedRegionDecoder(const SharedRegionDecoder& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			SharedRegionDecoder& operator=(const SharedRegionDecoder& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+		private:
+
+			// The decoder shared by all regions
+			struct SharedDecoder
+			{
+				Decoder::unique_ptr		mDecoder;
+				mutable std::mutex		mMutex;
+			};
+
+			// Creation
+			SharedRegionDecoder() = delete;
+			SharedRegionDecoder(std::shared_ptr<SharedDecoder> sharedDecoder, const Region& region);
+
+			// Source access
+			inline virtual CFURLRef _GetURL() const					{ return mSharedDecoder->mDecoder->GetURL(); }
+			inline virtual InputSource& _GetInputSource() const		{ return mSharedDecoder->mDecoder->GetInputSource(); }
+
+			// Audio access
+			virtual bool _Open(CFErrorRef *error);
+			virtual bool _Close(CFErrorRef *error);
+
+			// The native format of the source audio
+			virtual SFB::CFString _GetSourceFormatDescription() const;
+
+			// Attempt to read frameCount frames of audio, returning the actual number of frames read
+			virtual UInt32 _ReadAudio(AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Source audio information
+			inline virtual SInt64 _GetTotalFrames() const			{ return mRegion.mFrameCount; }
+			inline virtual SInt64 _GetCurrentFrame() const			{ return mCurrentFrame; }
+
+			// Seeking support
+			inline virtual bool _SupportsSeeking() const			{ return true; }
+			virtual SInt64 _SeekToFrame(SInt64 frame);
+			virtual SeekCost _GetSeekCost(SInt64 frame) const;
+
+			// Data members
+			std::shared_ptr<SharedDecoder>	mSharedDecoder;
+			Region							mRegion;
+			SInt64							mCurrentFrame;		// The next frame to read, relative to the start of the region
+		};
+
+	}
+}
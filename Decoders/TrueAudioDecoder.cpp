@@ -3,15 +3,33 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include <dispatch/dispatch.h>
+
 #include "TrueAudioDecoder.h"
 #include "CFWrapper.h"
 #include "CFErrorUtilities.h"
 #include "Logger.h"
 
+// The maximum number of TrueAudio frames decoded concurrently
+#define MAX_FRAME_WORKERS 8u
+
 struct SFB::Audio::TrueAudioDecoder::TTA_io_callback_wrapper
 {
 	TTA_io_callback iocb;
-	SFB::Audio::Decoder *decoder;
+	SFB::InputSource *inputSource;
+};
+
+// A decoder with its own input source, so frames may be decoded concurrently
+struct SFB::Audio::TrueAudioDecoder::FrameWorker
+{
+	InputSource::unique_ptr mInputSource;
+	TTA_io_callback_wrapper mCallbacks;
+	unique_tta_ptr mDecoder;
+	UInt32 mFramesDecoded;
 };
 
 namespace {
@@ -28,13 +46,28 @@ namespace {
 	TTAint32 read_callback(struct _tag_TTA_io_callback *io, TTAuint8 *buffer, TTAuint32 size)
 	{
 		SFB::Audio::TrueAudioDecoder::TTA_io_callback_wrapper *iocb = (SFB::Audio::TrueAudioDecoder::TTA_io_callback_wrapper *)io;
-		return (TTAint32)iocb->decoder->GetInputSource().Read(buffer, size);
+		return (TTAint32)iocb->inputSource->Read(buffer, size);
 	}
 
 	TTAint64 seek_callback(struct _tag_TTA_io_callback *io, TTAint64 offset)
 	{
 		SFB::Audio::TrueAudioDecoder::TTA_io_callback_wrapper *iocb = (SFB::Audio::TrueAudioDecoder::TTA_io_callback_wrapper *)io;
-		return iocb->decoder->GetInputSource().SeekToOffset(offset);
+		return iocb->inputSource->SeekToOffset(offset);
+	}
+
+	// libtta only seeks by seconds; frames are 256/245 seconds long so the second after
+	// the start of a frame always lies within it
+	inline TTAuint32 SecondsForFrame(UInt32 frame)
+	{
+		return (TTAuint32)(((UInt64)frame * 256) / 245 + 1);
+	}
+
+	void InitializeCallbacks(SFB::Audio::TrueAudioDecoder::TTA_io_callback_wrapper& callbacks, SFB::InputSource *inputSource)
+	{
+		callbacks.iocb.read		= read_callback;
+		callbacks.iocb.write	= nullptr;
+		callbacks.iocb.seek		= seek_callback;
+		callbacks.inputSource	= inputSource;
 	}
 
 }
@@ -75,6 +108,14 @@ bool SFB::Audio::TrueAudioDecoder::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::TrueAudioDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	return 4 <= length && 0 == memcmp(header, "TTA1", 4);
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::TrueAudioDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new TrueAudioDecoder(std::move(inputSource)));
@@ -83,18 +124,15 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::TrueAudioDecoder::CreateDecoder(Inpu
 #pragma mark Creation and Destruction
 
 SFB::Audio::TrueAudioDecoder::TrueAudioDecoder(InputSource::unique_ptr inputSource)
-	: Decoder(std::move(inputSource)), mDecoder(nullptr), mCallbacks(nullptr), mCurrentFrame(0), mTotalFrames(0), mFramesToSkip(0)
+	: Decoder(std::move(inputSource)), mDecoder(nullptr), mCallbacks(nullptr), mCurrentFrame(0), mTotalFrames(0), mFramesToSkip(0), mFrameLength(0), mFrameCount(0), mBatchFirstFrame(0), mBatchFrameCount(0), mBatchOffset(0)
 {}
 
 #pragma mark Functionality
 
 bool SFB::Audio::TrueAudioDecoder::_Open(CFErrorRef *error)
 {
-	mCallbacks				= unique_callback_wrapper_ptr(new TTA_io_callback_wrapper);
-	mCallbacks->iocb.read	= read_callback;
-	mCallbacks->iocb.write	= nullptr;
-	mCallbacks->iocb.seek	= seek_callback;
-	mCallbacks->decoder		= this;
+	mCallbacks = unique_callback_wrapper_ptr(new TTA_io_callback_wrapper);
+	InitializeCallbacks(*mCallbacks, mInputSource.get());
 
 	TTA_info streamInfo;
 
@@ -180,11 +218,23 @@ bool SFB::Audio::TrueAudioDecoder::_Open(CFErrorRef *error)
 
 	mTotalFrames = streamInfo.samples;
 
+	// TrueAudio frames are 256/245 seconds long
+	mFrameLength	= (UInt32)((256 * (UInt64)streamInfo.sps) / 245);
+	mFrameCount		= (UInt32)((mTotalFrames + mFrameLength - 1) / mFrameLength);
+	mFramesToSkip	= 0;
+
+	if(1 != GetDecodingThreadCount() && 1 < mFrameCount && mDecoder->seek_allowed && mInputSource->GetURL())
+		CreateFrameWorkers();
+
 	return true;
 }
 
 bool SFB::Audio::TrueAudioDecoder::_Close(CFErrorRef */*error*/)
 {
+	mWorkers.clear();
+	mBatchBuffer.clear();
+	mBatchBuffer.shrink_to_fit();
+
 	mDecoder.reset();
 	mCallbacks.reset();
 
@@ -212,36 +262,30 @@ UInt32 SFB::Audio::TrueAudioDecoder::_ReadAudio(AudioBufferList *bufferList, UIn
 	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
 		bufferList->mBuffers[i].mDataByteSize = 0;
 
+	if(!mWorkers.empty())
+		return ReadBatchedAudio(bufferList, frameCount);
+
 	UInt32 framesRead = 0;
-	bool eos = false;
 
 	try {
-		while(mFramesToSkip && !eos) {
-			if(mFramesToSkip >= frameCount) {
-				framesRead = (UInt32)mDecoder->process_stream((TTAuint8 *)bufferList->mBuffers[0].mData, frameCount);
-				mFramesToSkip -= framesRead;
-			}
-			else {
-				framesRead = (UInt32)mDecoder->process_stream((TTAuint8 *)bufferList->mBuffers[0].mData, mFramesToSkip);
-				mFramesToSkip = 0;
-			}
-
-			if(0 == framesRead)
-				eos = true;
+		// Discard the audio between the start of the current TrueAudio frame and the seek target
+		while(mFramesToSkip) {
+			UInt32 framesToSkip = std::min(mFramesToSkip, frameCount);
+			UInt32 framesSkipped = (UInt32)mDecoder->process_stream((TTAuint8 *)bufferList->mBuffers[0].mData, framesToSkip * mFormat.mBytesPerFrame);
+			if(0 == framesSkipped)
+				return 0;
+
+			mFramesToSkip -= std::min(framesSkipped, mFramesToSkip);
 		}
 
-		if(!eos) {
-			framesRead = (UInt32)mDecoder->process_stream((TTAuint8 *)bufferList->mBuffers[0].mData, frameCount);
-			if(0 == framesRead)
-				eos = true;
-		}
+		framesRead = (UInt32)mDecoder->process_stream((TTAuint8 *)bufferList->mBuffers[0].mData, frameCount * mFormat.mBytesPerFrame);
 	}
 	catch(const tta::tta_exception& e) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.TrueAudio", "True Audio decoding error: " << e.code());
 		return 0;
 	}
 
-	if(eos)
+	if(0 == framesRead)
 		return 0;
 
 	bufferList->mBuffers[0].mDataByteSize = (UInt32)(framesRead * mFormat.mBytesPerFrame);
@@ -253,11 +297,26 @@ UInt32 SFB::Audio::TrueAudioDecoder::_ReadAudio(AudioBufferList *bufferList, UIn
 
 SInt64 SFB::Audio::TrueAudioDecoder::_SeekToFrame(SInt64 frame)
 {
-	TTAuint32 seconds = (TTAuint32)(frame / mSourceFormat.mSampleRate);
-	TTAuint32 frame_start = 0;
+	// The TrueAudio frame containing the target is found directly from the seek table
+	UInt32 ttaFrame = (UInt32)(frame / mFrameLength);
+	if(ttaFrame >= mFrameCount)
+		return -1;
+
+	UInt32 framesToSkip = (UInt32)(frame - ((SInt64)ttaFrame * mFrameLength));
+
+	if(!mWorkers.empty()) {
+		if(!DecodeBatch(ttaFrame) || framesToSkip > mBatchFrameCount)
+			return -1;
+
+		mBatchOffset = framesToSkip;
+		mCurrentFrame = frame;
+
+		return mCurrentFrame;
+	}
 
 	try {
-		mDecoder->set_position(seconds, &frame_start);
+		TTAuint32 frameStart = 0;
+		mDecoder->set_position(SecondsForFrame(ttaFrame), &frameStart);
 	}
 	catch(const tta::tta_exception& e) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.TrueAudio", "True Audio seek error: " << e.code());
@@ -265,9 +324,126 @@ SInt64 SFB::Audio::TrueAudioDecoder::_SeekToFrame(SInt64 frame)
 	}
 
 	mCurrentFrame = frame;
-
-	// We need to skip some samples from start of the frame if required
-	mFramesToSkip = UInt32((seconds - frame_start) * mSourceFormat.mSampleRate + 0.5);
+	mFramesToSkip = framesToSkip;
 
 	return mCurrentFrame;
 }
+
+#pragma mark Parallel Decoding
+
+bool SFB::Audio::TrueAudioDecoder::CreateFrameWorkers()
+{
+	size_t threadCount = GetDecodingThreadCount();
+	if(0 == threadCount)
+		threadCount = std::thread::hardware_concurrency();
+
+	UInt32 workerCount = (UInt32)std::min(std::min(threadCount, (size_t)MAX_FRAME_WORKERS), (size_t)mFrameCount);
+	if(2 > workerCount)
+		return false;
+
+	std::vector<unique_worker_ptr> workers;
+	for(UInt32 i = 0; i < workerCount; ++i) {
+		unique_worker_ptr worker(new FrameWorker);
+		worker->mFramesDecoded = 0;
+
+		worker->mInputSource = InputSource::CreateForURL(mInputSource->GetURL());
+		if(!worker->mInputSource || !worker->mInputSource->Open()) {
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.TrueAudio", "Unable to open input for parallel decoding");
+			return false;
+		}
+
+		InitializeCallbacks(worker->mCallbacks, worker->mInputSource.get());
+
+		try {
+			TTA_info streamInfo;
+			worker->mDecoder = unique_tta_ptr(new tta::tta_decoder((TTA_io_callback *)&worker->mCallbacks));
+			worker->mDecoder->init_get_info(&streamInfo, 0);
+		}
+		catch(const tta::tta_exception& e) {
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Decoder.TrueAudio", "Error creating True Audio decoder for parallel decoding: " << e.code());
+			return false;
+		}
+
+		if(!worker->mDecoder->seek_allowed)
+			return false;
+
+		workers.push_back(std::move(worker));
+	}
+
+	mWorkers = std::move(workers);
+	mBatchBuffer.resize(workerCount * mFrameLength * mFormat.mBytesPerFrame);
+
+	mBatchFirstFrame = 0;
+	mBatchFrameCount = 0;
+	mBatchOffset = 0;
+
+	return true;
+}
+
+UInt32 SFB::Audio::TrueAudioDecoder::ReadBatchedAudio(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	UInt32 framesRead = 0;
+
+	while(framesRead < frameCount) {
+		// Decode the next batch once the current one is consumed
+		if(mBatchOffset == mBatchFrameCount) {
+			UInt32 nextFrame = mBatchFirstFrame + (mBatchFrameCount + mFrameLength - 1) / mFrameLength;
+			if(nextFrame >= mFrameCount || !DecodeBatch(nextFrame))
+				break;
+		}
+
+		UInt32 framesToCopy = std::min(frameCount - framesRead, mBatchFrameCount - mBatchOffset);
+		memcpy((uint8_t *)bufferList->mBuffers[0].mData + (framesRead * mFormat.mBytesPerFrame), mBatchBuffer.data() + (mBatchOffset * mFormat.mBytesPerFrame), framesToCopy * mFormat.mBytesPerFrame);
+
+		mBatchOffset += framesToCopy;
+		framesRead += framesToCopy;
+	}
+
+	bufferList->mBuffers[0].mDataByteSize = (UInt32)(framesRead * mFormat.mBytesPerFrame);
+	bufferList->mBuffers[0].mNumberChannels = mFormat.mChannelsPerFrame;
+
+	mCurrentFrame += framesRead;
+	return framesRead;
+}
+
+bool SFB::Audio::TrueAudioDecoder::DecodeBatch(UInt32 firstFrame)
+{
+	if(firstFrame >= mFrameCount)
+		return false;
+
+	const UInt32 frameCount = std::min((UInt32)mWorkers.size(), mFrameCount - firstFrame);
+	const UInt32 bytesPerTTAFrame = mFrameLength * mFormat.mBytesPerFrame;
+
+	// Each worker positions its own decoder and decodes one frame into its place in the buffer
+	auto decodeFrame = ^(size_t i) {
+		auto& worker = mWorkers[i];
+		worker->mFramesDecoded = 0;
+
+		try {
+			TTAuint32 frameStart = 0;
+			worker->mDecoder->set_position(SecondsForFrame(firstFrame + (UInt32)i), &frameStart);
+			int framesDecoded = worker->mDecoder->process_stream(mBatchBuffer.data() + (i * bytesPerTTAFrame), bytesPerTTAFrame);
+			if(0 < framesDecoded)
+				worker->mFramesDecoded = (UInt32)framesDecoded;
+		}
+		catch(const tta::tta_exception& e) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Decoder.TrueAudio", "True Audio decoding error in frame " << (firstFrame + i) << ": " << e.code());
+		}
+	};
+
+	dispatch_apply(frameCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), decodeFrame);
+
+	// Only the last frame in the stream may be short, so the decoded audio is contiguous up to the first short frame
+	UInt32 batchFrameCount = 0;
+	for(UInt32 i = 0; i < frameCount; ++i) {
+		batchFrameCount += mWorkers[i]->mFramesDecoded;
+		if(mWorkers[i]->mFramesDecoded != mFrameLength)
+			break;
+	}
+
+	mBatchFirstFrame = firstFrame;
+	mBatchFrameCount = batchFrameCount;
+	mBatchOffset = 0;
+
+	return 0 < batchFrameCount;
+}
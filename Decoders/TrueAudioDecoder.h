@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include <tta++/libtta.h>
 #import "AudioDecoder.h"
 
@@ -14,6 +16,9 @@ namespace SFB {
 
 		// ========================================
 		// A Decoder subclass supporting TrueAudio files
+		//
+		// TrueAudio frames are independent, so when the decoding thread count is not 1 and the input is a seekable
+		// URL a batch of consecutive frames is decoded concurrently, each by a separate decoder and input source
 		// ========================================
 		class TrueAudioDecoder : public Decoder
 		{
@@ -26,6 +31,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
@@ -51,15 +57,24 @@ namespace SFB {
 			// Seeking support
 			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
+			inline virtual SeekCost _GetSeekCost(SInt64 /*frame*/) const	{ return SeekCostIndexed; }
 
 		public:
 
 			struct TTA_io_callback_wrapper;
 
+			struct FrameWorker;
+
 		private:
 
 			using unique_tta_ptr = std::unique_ptr<tta::tta_decoder>;
 			using unique_callback_wrapper_ptr = std::unique_ptr<TTA_io_callback_wrapper>;
+			using unique_worker_ptr = std::unique_ptr<FrameWorker>;
+
+			// Parallel decoding
+			bool CreateFrameWorkers();
+			UInt32 ReadBatchedAudio(AudioBufferList *bufferList, UInt32 frameCount);
+			bool DecodeBatch(UInt32 firstFrame);
 
 			// Data members
 			unique_tta_ptr						mDecoder;
@@ -67,6 +82,14 @@ namespace SFB {
 			SInt64								mCurrentFrame;
 			SInt64								mTotalFrames;
 			UInt32								mFramesToSkip;
+			UInt32								mFrameLength;			// Audio frames per TrueAudio frame
+			UInt32								mFrameCount;			// TrueAudio frames in the stream
+
+			std::vector<unique_worker_ptr>		mWorkers;
+			std::vector<uint8_t>				mBatchBuffer;
+			UInt32								mBatchFirstFrame;		// TrueAudio frame at the start of mBatchBuffer
+			UInt32								mBatchFrameCount;		// Audio frames in mBatchBuffer
+			UInt32								mBatchOffset;			// Audio frames consumed from mBatchBuffer
 		};
 
 	}
@@ -147,6 +147,14 @@ bool SFB::Audio::WavPackDecoder::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::WavPackDecoder::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	return 4 <= length && 0 == memcmp(header, "wvpk", 4);
+}
+
 SFB::Audio::Decoder::unique_ptr SFB::Audio::WavPackDecoder::CreateDecoder(InputSource::unique_ptr inputSource)
 {
 	return unique_ptr(new WavPackDecoder(std::move(inputSource)));
@@ -155,9 +163,10 @@ SFB::Audio::Decoder::unique_ptr SFB::Audio::WavPackDecoder::CreateDecoder(InputS
 #pragma mark Creation and Destruction
 
 SFB::Audio::WavPackDecoder::WavPackDecoder(InputSource::unique_ptr inputSource)
-	: Decoder(std::move(inputSource)), mWPC(nullptr, nullptr), mTotalFrames(0), mCurrentFrame(0)
+	: Decoder(std::move(inputSource)), mWPC(nullptr, nullptr), mDeinterleave(nullptr), mTotalFrames(0), mCurrentFrame(0), mHasMD5(false), mVerifying(false), mIntegrityStatus(IntegrityStatus::Unverified)
 {
 	memset(&mStreamReader, 0, sizeof(mStreamReader));
+	memset(mStoredMD5, 0, sizeof(mStoredMD5));
 }
 
 #pragma mark Functionality
@@ -239,6 +248,35 @@ bool SFB::Audio::WavPackDecoder::_Open(CFErrorRef *error)
 		case 4:		mChannelLayout = ChannelLayout::ChannelLayoutWithTag(kAudioChannelLayoutTag_Quadraphonic);	break;
 	}
 
+	// The samples returned are handled differently based on the file's mode, which is fixed for the stream
+	UInt32 bytesPerSample = (UInt32)WavpackGetBytesPerSample(mWPC.get());
+
+	// Floating point files require no special handling other than deinterleaving
+	if(MODE_FLOAT & mode)
+		mDeinterleave = SamplePacking::Deinterleaver::ForFloat(mFormat.mChannelsPerFrame);
+	// Lossless files will be handed off as integers shifted from low to high alignment
+	else if(MODE_LOSSLESS & mode)
+		mDeinterleave = SamplePacking::Deinterleaver::ForAlignHigh(bytesPerSample, mFormat.mChannelsPerFrame);
+	// Convert lossy files to float
+	else
+		mDeinterleave = SamplePacking::Deinterleaver::ForNormalize(bytesPerSample, mFormat.mChannelsPerFrame);
+
+	if(!mDeinterleave) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.WavPack", "Unsupported sample size: " << bytesPerSample);
+
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a supported WavPack file."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Bit depth not supported"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
+
+			*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::FileFormatNotSupportedError, description, mInputSource->GetURL(), failureReason, recoverySuggestion);
+		}
+
+		mWPC.reset();
+
+		return false;
+	}
+
 	mBuffer = std::unique_ptr<int32_t []>(new int32_t [BUFFER_SIZE_FRAMES * mFormat.mChannelsPerFrame]);
 	if(!mBuffer) {
 		if(error)
@@ -247,6 +285,16 @@ bool SFB::Audio::WavPackDecoder::_Open(CFErrorRef *error)
 		return false;
 	}
 
+	// The stored MD5 is of the original samples, which are reproduced only by lossless files
+	// and by floating point files not normalized by OPEN_NORMALIZE
+	mHasMD5 = (MODE_LOSSLESS & mode) && (!(MODE_FLOAT & mode) || 127 == WavpackGetFloatNormExp(mWPC.get())) && WavpackGetMD5Sum(mWPC.get(), mStoredMD5);
+	mVerifying = IsIntegrityVerificationEnabled() && mHasMD5;
+	mIntegrityStatus = IntegrityStatus::Unverified;
+	if(mVerifying) {
+		CC_MD5_Init(&mMD5);
+		mMD5Buffer.resize(BUFFER_SIZE_FRAMES * mFormat.mChannelsPerFrame * bytesPerSample);
+	}
+
 	return true;
 }
 
@@ -255,8 +303,13 @@ bool SFB::Audio::WavPackDecoder::_Close(CFErrorRef */*error*/)
 	memset(&mStreamReader, 0, sizeof(mStreamReader));
 
 	mBuffer.reset();
+	mDeinterleave = nullptr;
 	mWPC.reset();
 
+	mHasMD5 = false;
+	mVerifying = false;
+	mMD5Buffer.clear();
+
 	return true;
 }
 
@@ -288,58 +341,17 @@ UInt32 SFB::Audio::WavPackDecoder::_ReadAudio(AudioBufferList *bufferList, UInt3
 		// Wavpack uses "complete" samples (one sample across all channels), i.e. a Core Audio frame
 		uint32_t samplesRead = WavpackUnpackSamples(mWPC.get(), mBuffer.get(), framesToRead);
 
-		if(0 == samplesRead)
+		if(0 == samplesRead) {
+			if(mVerifying)
+				FinishMD5();
 			break;
-
-		// The samples returned are handled differently based on the file's mode
-		int mode = WavpackGetMode(mWPC.get());
-
-		// Floating point files require no special handling other than deinterleaving
-		if(MODE_FLOAT & mode) {
-			float *inputBuffer = (float *)mBuffer.get();
-
-			// Deinterleave the samples
-			for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel) {
-				float *floatBuffer = (float *)bufferList->mBuffers[channel].mData;
-
-				for(UInt32 sample = channel; sample < samplesRead * mFormat.mChannelsPerFrame; sample += mFormat.mChannelsPerFrame)
-					*floatBuffer++ = inputBuffer[sample];
-
-				bufferList->mBuffers[channel].mNumberChannels	= 1;
-				bufferList->mBuffers[channel].mDataByteSize		= samplesRead * sizeof(float);
-			}
-		}
-		// Lossless files will be handed off as integers
-		else if(MODE_LOSSLESS & mode) {
-			// WavPack hands us 32-bit signed ints with the samples low-aligned; shift them to high alignment
-			UInt32 shift = (UInt32)(8 * (sizeof(int32_t) - (size_t)WavpackGetBytesPerSample(mWPC.get())));
-
-			// Deinterleave the 32-bit samples and shift to high-alignment
-			for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel) {
-				int32_t *shiftedBuffer = (int32_t *)bufferList->mBuffers[channel].mData;
-
-				for(UInt32 sample = channel; sample < samplesRead * mFormat.mChannelsPerFrame; sample += mFormat.mChannelsPerFrame)
-					*shiftedBuffer++ = mBuffer[sample] << shift;
-
-				bufferList->mBuffers[channel].mNumberChannels	= 1;
-				bufferList->mBuffers[channel].mDataByteSize		= samplesRead * sizeof(int32_t);
-			}
 		}
-		// Convert lossy files to float
-		else {
-			float scaleFactor = (1 << ((WavpackGetBytesPerSample(mWPC.get()) * 8) - 1));
 
-			// Deinterleave the 32-bit samples and convert to float
-			for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel) {
-				float *floatBuffer = (float *)bufferList->mBuffers[channel].mData;
+		if(mVerifying)
+			UpdateMD5(samplesRead);
 
-				for(UInt32 sample = channel; sample < samplesRead * mFormat.mChannelsPerFrame; sample += mFormat.mChannelsPerFrame)
-					*floatBuffer++ = mBuffer[sample] / scaleFactor;
-
-				bufferList->mBuffers[channel].mNumberChannels	= 1;
-				bufferList->mBuffers[channel].mDataByteSize		= samplesRead * sizeof(float);
-			}
-		}
+		// Deinterleave the samples following any previously read
+		mDeinterleave(mBuffer.get(), bufferList, totalFramesRead, samplesRead);
 
 		totalFramesRead += samplesRead;
 		framesRemaining -= samplesRead;
@@ -352,9 +364,49 @@ UInt32 SFB::Audio::WavPackDecoder::_ReadAudio(AudioBufferList *bufferList, UInt3
 
 SInt64 SFB::Audio::WavPackDecoder::_SeekToFrame(SInt64 frame)
 {
+	// The MD5 can only be computed over every sample in order
+	mVerifying = false;
+
 	int result = WavpackSeekSample(mWPC.get(), (uint32_t)frame);
 	if(result)
 		mCurrentFrame = frame;
 
 	return (result ? mCurrentFrame : -1);
 }
+
+void SFB::Audio::WavPackDecoder::UpdateMD5(uint32_t sampleCount)
+{
+	// The MD5 is computed over the samples as they are stored in a WAVE file: little-endian integers of the minimum
+	// number of bytes, with 8-bit samples unsigned
+	UInt32 bytesPerSample = (UInt32)WavpackGetBytesPerSample(mWPC.get());
+	size_t count = sampleCount * mFormat.mChannelsPerFrame;
+
+	uint8_t *md5Bytes = mMD5Buffer.data();
+	const int32_t *samples = mBuffer.get();
+	for(size_t i = 0; i < count; ++i) {
+		uint32_t sample = (uint32_t)samples[i];
+		if(1 == bytesPerSample)
+			*md5Bytes++ = (uint8_t)(sample + 128);
+		else {
+			for(UInt32 byte = 0; byte < bytesPerSample; ++byte)
+				*md5Bytes++ = (uint8_t)(sample >> (8 * byte));
+		}
+	}
+
+	CC_MD5_Update(&mMD5, mMD5Buffer.data(), (CC_LONG)(count * bytesPerSample));
+}
+
+void SFB::Audio::WavPackDecoder::FinishMD5()
+{
+	mVerifying = false;
+
+	unsigned char md5 [CC_MD5_DIGEST_LENGTH];
+	CC_MD5_Final(md5, &mMD5);
+
+	if(0 == memcmp(md5, mStoredMD5, sizeof(md5)))
+		mIntegrityStatus = IntegrityStatus::Verified;
+	else {
+		LOGGER_ERR("org.sbooth.AudioEngine.Decoder.WavPack", "MD5 mismatch for " << mInputSource->GetURL());
+		mIntegrityStatus = IntegrityStatus::Failed;
+	}
+}
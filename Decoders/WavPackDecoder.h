@@ -5,8 +5,12 @@
 
 #pragma once
 
+#include <vector>
+
+#include <CommonCrypto/CommonDigest.h>
 #include <wavpack/wavpack.h>
 #import "AudioDecoder.h"
+#include "SamplePacking.h"
 
 namespace SFB {
 
@@ -26,6 +30,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Decoder::unique_ptr CreateDecoder(InputSource::unique_ptr inputSource);
 
@@ -52,6 +57,13 @@ namespace SFB {
 			inline virtual bool _SupportsSeeking() const			{ return mInputSource->SupportsSeeking(); }
 			virtual SInt64 _SeekToFrame(SInt64 frame);
 
+			// The MD5 of the unpacked samples is compared with the stored MD5
+			inline virtual bool _SupportsIntegrityVerification() const		{ return mHasMD5; }
+			inline virtual IntegrityStatus _GetIntegrityStatus() const		{ return mIntegrityStatus; }
+
+			void UpdateMD5(uint32_t sampleCount);
+			void FinishMD5();
+
 			using unique_WavpackContext_ptr = std::unique_ptr<WavpackContext, std::function<WavpackContext *(WavpackContext *)>>;
 
 			// Data members
@@ -59,9 +71,18 @@ namespace SFB {
 			unique_WavpackContext_ptr		mWPC;
 
 			std::unique_ptr<int32_t []>		mBuffer;
+			SamplePacking::Deinterleaver	mDeinterleave;
 
 			SInt64							mTotalFrames;
 			SInt64							mCurrentFrame;
+
+			// Integrity verification
+			bool							mHasMD5;
+			unsigned char					mStoredMD5 [CC_MD5_DIGEST_LENGTH];
+			bool							mVerifying;
+			CC_MD5_CTX						mMD5;
+			std::vector<uint8_t>			mMD5Buffer;
+			IntegrityStatus					mIntegrityStatus;
 		};
 
 	}
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <AudioToolbox/AudioFormat.h>
+
+#include "AudioEncoder.h"
+#include "Logger.h"
+#include "CFErrorUtilities.h"
+#include "CreateStringForOSType.h"
+
+// ========================================
+// Error Codes
+// ========================================
+const CFStringRef SFB::Audio::Encoder::ErrorDomain = CFSTR("org.sbooth.AudioEngine.ErrorDomain.AudioEncoder");
+
+#pragma mark Static Methods
+
+std::vector<SFB::Audio::Encoder::SubclassInfo> SFB::Audio::Encoder::sRegisteredSubclasses;
+
+CFArrayRef SFB::Audio::Encoder::CreateSupportedFileExtensions()
+{
+	CFMutableArrayRef supportedFileExtensions = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+
+	for(auto subclassInfo : sRegisteredSubclasses) {
+		SFB::CFArray encoderFileExtensions(subclassInfo.mCreateSupportedFileExtensions());
+		CFArrayAppendArray(supportedFileExtensions, encoderFileExtensions, CFRangeMake(0, CFArrayGetCount(encoderFileExtensions)));
+	}
+
+	return supportedFileExtensions;
+}
+
+CFArrayRef SFB::Audio::Encoder::CreateSupportedMIMETypes()
+{
+	CFMutableArrayRef supportedMIMETypes = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+
+	for(auto subclassInfo : sRegisteredSubclasses) {
+		SFB::CFArray encoderMIMETypes(subclassInfo.mCreateSupportedMIMETypes());
+		CFArrayAppendArray(supportedMIMETypes, encoderMIMETypes, CFRangeMake(0, CFArrayGetCount(encoderMIMETypes)));
+	}
+
+	return supportedMIMETypes;
+}
+
+bool SFB::Audio::Encoder::HandlesFilesWithExtension(CFStringRef extension)
+{
+	if(nullptr == extension)
+		return false;
+
+	for(auto subclassInfo : sRegisteredSubclasses) {
+		if(subclassInfo.mHandlesFilesWithExtension(extension))
+			return true;
+	}
+
+	return false;
+}
+
+bool SFB::Audio::Encoder::HandlesMIMEType(CFStringRef mimeType)
+{
+	if(nullptr == mimeType)
+		return false;
+
+	for(auto subclassInfo : sRegisteredSubclasses) {
+		if(subclassInfo.mHandlesMIMEType(mimeType))
+			return true;
+	}
+
+	return false;
+}
+
+SFB::Audio::Encoder::unique_ptr SFB::Audio::Encoder::CreateForURL(CFURLRef url, CFErrorRef *error)
+{
+	return CreateForURL(url, nullptr, error);
+}
+
+SFB::Audio::Encoder::unique_ptr SFB::Audio::Encoder::CreateForURL(CFURLRef url, CFStringRef mimeType, CFErrorRef *error)
+{
+	if(nullptr == url)
+		return nullptr;
+
+	// The MIME type takes precedence over the file extension
+	if(mimeType) {
+		for(auto subclassInfo : sRegisteredSubclasses) {
+			if(subclassInfo.mHandlesMIMEType(mimeType))
+				return subclassInfo.mCreateEncoder(url);
+		}
+	}
+
+	SFB::CFString pathExtension(CFURLCopyPathExtension(url));
+	if(pathExtension) {
+		for(auto subclassInfo : sRegisteredSubclasses) {
+			if(subclassInfo.mHandlesFilesWithExtension(pathExtension))
+				return subclassInfo.mCreateEncoder(url);
+		}
+	}
+
+	if(error) {
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The type of the file “%@” could not be determined."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Unknown file type"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may be missing or may not correspond to a supported format."), ""));
+
+		*error = CreateErrorForURL(Encoder::ErrorDomain, Encoder::FileFormatNotRecognizedError, description, url, failureReason, recoverySuggestion);
+	}
+
+	return nullptr;
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::Encoder::Encoder(CFURLRef url)
+	: mURL(url ? (CFURLRef)CFRetain(url) : nullptr), mIsOpen(false), mFramesWritten(0), mBitRate(0), mCompressionLevel(-1), mEncodingThreadCount(1)
+{
+	assert(nullptr != url);
+}
+
+SFB::Audio::Encoder::~Encoder()
+{}
+
+#pragma mark Base Functionality
+
+bool SFB::Audio::Encoder::Open(const AudioFormat& sourceFormat, const ChannelLayout& channelLayout, CFErrorRef *error)
+{
+	if(IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Encoder", "Open() called on an Encoder that is already open");
+		return true;
+	}
+
+	if(!sourceFormat.IsPCM() || 0 == sourceFormat.mChannelsPerFrame || 0 >= sourceFormat.mSampleRate) {
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be created."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Unsupported audio format"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("Only PCM audio may be encoded."), ""));
+
+			*error = CreateErrorForURL(Encoder::ErrorDomain, Encoder::FileFormatNotSupportedError, description, mURL, failureReason, recoverySuggestion);
+		}
+
+		return false;
+	}
+
+	mSourceFormat = sourceFormat;
+	mChannelLayout = channelLayout;
+	mFramesWritten = 0;
+
+	bool result = _Open(error);
+	if(result)
+		mIsOpen = true;
+	return result;
+}
+
+bool SFB::Audio::Encoder::Close(CFErrorRef *error)
+{
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Encoder", "Close() called on an Encoder that hasn't been opened");
+		return true;
+	}
+
+	// The encoder is closed even if finishing the file fails
+	bool result = _Close(error);
+	mIsOpen = false;
+	return result;
+}
+
+CFStringRef SFB::Audio::Encoder::CreateFormatDescription() const
+{
+	if(!IsOpen()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Encoder", "CreateFormatDescription() called on an Encoder that hasn't been opened");
+		return nullptr;
+	}
+
+	CFStringRef		formatDescription		= nullptr;
+	UInt32			specifierSize			= sizeof(formatDescription);
+	OSStatus		result					= AudioFormatGetProperty(kAudioFormatProperty_FormatName,
+																	 sizeof(mFormat),
+																	 &mFormat,
+																	 &specifierSize,
+																	 &formatDescription);
+
+	if(noErr != result)
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder", "AudioFormatGetProperty (kAudioFormatProperty_FormatName) failed: " << result << "'" << SFB::StringForOSType((OSType)result) << "'");
+
+	return formatDescription;
+}
+
+bool SFB::Audio::Encoder::WriteAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(!IsOpen() || nullptr == bufferList) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Encoder", "WriteAudio() called with invalid parameters");
+		return false;
+	}
+
+	if(0 == frameCount)
+		return true;
+
+	if(!_WriteAudio(bufferList, frameCount))
+		return false;
+
+	mFramesWritten += frameCount;
+	return true;
+}
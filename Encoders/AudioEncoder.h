@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreAudio/CoreAudioTypes.h>
+
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <typeinfo>
+
+#include "AudioFormat.h"
+#include "AudioChannelLayout.h"
+#include "CFWrapper.h"
+
+/*! @file AudioEncoder.h @brief Support for encoding PCM audio to files */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief Base class for all audio encoder classes
+		 *
+		 * An \c Encoder writes PCM audio to a file in some format.  When opened with the format of the audio to be
+		 * encoded the encoder chooses the PCM format it accepts, available from \c GetFormat(), and audio in that
+		 * format is supplied using \c WriteAudio().  A \c Converter may be used to produce the required format.
+		 * The file is complete when the encoder is closed.
+		 */
+		class Encoder
+		{
+
+		public:
+
+			/*! @brief The \c CFErrorRef error domain used by \c Encoder and subclasses */
+			static const CFStringRef ErrorDomain;
+
+			/*! @brief Possible \c CFErrorRef error codes used by \c Encoder */
+			enum ErrorCode {
+				FileFormatNotRecognizedError		= 0,	/*!< File format not recognized */
+				FileFormatNotSupportedError			= 1,	/*!< File format not supported */
+				InputOutputError					= 2		/*!< Input/output error */
+			};
+
+			// ========================================
+			/*! @name Supported file formats */
+			//@{
+
+			/*!
+			 * @brief Create an array containing the supported file extensions
+			 * @note The returned array must be released by the caller
+			 * @return An array containing the supported file extensions
+			 */
+			static CFArrayRef CreateSupportedFileExtensions();
+
+			/*!
+			 * @brief Create an array containing the supported MIME types
+			 * @note The returned array must be released by the caller
+			 * @return An array containing the supported MIME types
+			 */
+			static CFArrayRef CreateSupportedMIMETypes();
+
+
+			/*! @brief Test whether a file extension is supported */
+			static bool HandlesFilesWithExtension(CFStringRef extension);
+
+			/*! @brief Test whether a MIME type is supported */
+			static bool HandlesMIMEType(CFStringRef mimeType);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*! @brief A \c std::unique_ptr for \c Encoder objects */
+			using unique_ptr = std::unique_ptr<Encoder>;
+
+			/*!
+			 * @brief Create an \c Encoder object for the specified URL, using the URL's path extension
+			 * @param url The URL of the file to create
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return An \c Encoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForURL(CFURLRef url, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create an \c Encoder object for the specified URL
+			 * @note The MIME type takes precedence over the file extension for type resolution
+			 * @param url The URL of the file to create
+			 * @param mimeType The MIME type of the encoded audio
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return An \c Encoder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForURL(CFURLRef url, CFStringRef mimeType, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Destroy this \c Encoder */
+			virtual ~Encoder();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			Encoder(const Encoder& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			Encoder& operator=(const Encoder& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			// ========================================
+			/*! @name Destination access */
+			//@{
+
+			/*! @brief Get the URL of the file this encoder writes */
+			inline CFURLRef GetURL() const								{ return mURL; }
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Encoder settings
+			 * Settings take effect when the encoder is opened and are ignored by formats to which they don't apply
+			 */
+			//@{
+
+			/*! @brief Get the target bit rate for lossy formats in bits per second, or \c 0 for the format's default */
+			inline UInt32 GetBitRate() const							{ return mBitRate; }
+
+			/*! @brief Set the target bit rate for lossy formats in bits per second, or \c 0 for the format's default */
+			inline void SetBitRate(UInt32 bitRate)						{ mBitRate = bitRate; }
+
+			/*! @brief Get the compression level, or \c -1 for the format's default */
+			inline int GetCompressionLevel() const						{ return mCompressionLevel; }
+
+			/*!
+			 * @brief Set the compression level, or \c -1 for the format's default
+			 *
+			 * Higher levels produce smaller files more slowly.  The range depends on the format, for example \c 0 to \c 8
+			 * for FLAC and \c 0 to \c 10 for Opus; values outside the range are clamped.
+			 */
+			inline void SetCompressionLevel(int compressionLevel)		{ mCompressionLevel = compressionLevel; }
+
+			/*! @brief Get the number of threads the codec may use for encoding, or \c 0 for one thread per processor core */
+			inline size_t GetEncodingThreadCount() const				{ return mEncodingThreadCount; }
+
+			/*!
+			 * @brief Set the number of threads the codec may use for encoding
+			 * @note This is ignored by encoders without multithreaded codecs
+			 * @param threadCount The number of encoding threads, or \c 0 for one thread per processor core
+			 */
+			inline void SetEncodingThreadCount(size_t threadCount)		{ mEncodingThreadCount = threadCount; }
+
+			//@}
+
+
+			// ========================================
+			/*! @name File access */
+			//@{
+
+			/*!
+			 * @brief Create the encoder's file and prepare to encode audio
+			 * @param sourceFormat The format of the audio to be encoded, which must be PCM
+			 * @param channelLayout The layout of the audio's channels, or \c nullptr if not specified
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool Open(const AudioFormat& sourceFormat, const ChannelLayout& channelLayout = nullptr, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Finish encoding and close the encoder's file
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool Close(CFErrorRef *error = nullptr);
+
+			/*! @brief Query whether the encoder is open */
+			inline bool IsOpen() const									{ return mIsOpen; }
+
+			//@}
+
+
+			// ========================================
+			/*! @name Audio access */
+			//@{
+
+			/*! @brief Get the format of the audio being encoded */
+			inline const AudioFormat& GetSourceFormat() const			{ return mSourceFormat; }
+
+			/*! @brief Get the type of PCM data accepted by this encoder */
+			inline const AudioFormat& GetFormat() const					{ return mFormat; }
+
+			/*!
+			 * @brief Create a description of the type of PCM data accepted by this encoder
+			 * @note The returned string must be released by the caller
+			 * @return A description of the type of PCM data accepted by this encoder
+			 */
+			CFStringRef CreateFormatDescription() const;
+
+			/*! @brief Get the layout of the encoder's audio channels, or \c nullptr if not specified */
+			inline const ChannelLayout& GetChannelLayout() const		{ return mChannelLayout; }
+
+
+			/*!
+			 * @brief Encode audio from the specified buffer
+			 * @param bufferList A buffer containing audio in the format returned by \c GetFormat()
+			 * @param frameCount The number of audio frames in \c bufferList
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool WriteAudio(const AudioBufferList *bufferList, UInt32 frameCount);
+
+			/*! @brief Get the number of audio frames encoded */
+			inline SInt64 GetFramesWritten() const						{ return mFramesWritten; }
+
+			//@}
+
+		protected:
+
+			SFB::CFURL						mURL;				/*!< @brief The URL of the file being written */
+
+			AudioFormat						mSourceFormat;		/*!< @brief The format of the audio being encoded */
+			AudioFormat						mFormat;			/*!< @brief The type of PCM data accepted by this encoder */
+			ChannelLayout					mChannelLayout;		/*!< @brief The channel layout for the PCM data, or \c nullptr if unspecified */
+
+			/*! @brief Create a new \c Encoder for the specified URL */
+			explicit Encoder(CFURLRef url);
+
+		private:
+
+			// Subclasses must implement these methods
+			// mSourceFormat and mChannelLayout are set before _Open() is called, which must set mFormat
+			virtual bool _Open(CFErrorRef *error) = 0;
+			virtual bool _Close(CFErrorRef *error) = 0;
+
+			virtual bool _WriteAudio(const AudioBufferList *bufferList, UInt32 frameCount) = 0;
+
+			// Data members
+			bool							mIsOpen;
+			SInt64							mFramesWritten;
+			UInt32							mBitRate;
+			int								mCompressionLevel;
+			size_t							mEncodingThreadCount;
+
+			// ========================================
+			// Subclass registration support
+			struct SubclassInfo
+			{
+				CFArrayRef (*mCreateSupportedFileExtensions)();
+				CFArrayRef (*mCreateSupportedMIMETypes)();
+
+				bool (*mHandlesFilesWithExtension)(CFStringRef);
+				bool (*mHandlesMIMEType)(CFStringRef);
+
+				Encoder::unique_ptr (*mCreateEncoder)(CFURLRef);
+
+				const std::type_info *mTypeInfo;
+
+				int mPriority;
+			};
+
+			static std::vector <SubclassInfo> sRegisteredSubclasses;
+
+		public:
+
+			/*!
+			 * @brief Register an \c Encoder subclass
+			 * @tparam T The subclass name
+			 * @param priority The priority of the subclass
+			 */
+			template <typename T> static void RegisterSubclass(int priority = 0);
+
+		};
+
+		// ========================================
+		// Template implementation
+		template <typename T> void Encoder::RegisterSubclass(int priority)
+		{
+			SubclassInfo subclassInfo = {
+				.mCreateSupportedFileExtensions = T::CreateSupportedFileExtensions,
+				.mCreateSupportedMIMETypes = T::CreateSupportedMIMETypes,
+
+				.mHandlesFilesWithExtension = T::HandlesFilesWithExtension,
+				.mHandlesMIMEType = T::HandlesMIMEType,
+
+				.mCreateEncoder = T::CreateEncoder,
+
+				.mTypeInfo = &typeid(T),
+
+				.mPriority = priority
+			};
+
+			// Keep subclasses ordered by priority, with equal priorities in registration order
+			auto position = std::upper_bound(sRegisteredSubclasses.begin(), sRegisteredSubclasses.end(), priority, [](int value, const SubclassInfo& subclass) {
+				return value > subclass.mPriority;
+			});
+			sRegisteredSubclasses.insert(position, subclassInfo);
+		}
+
+	}
+}
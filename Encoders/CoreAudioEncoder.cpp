@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <cmath>
+
+#include <AudioToolbox/AudioFormat.h>
+
+#include "CoreAudioEncoder.h"
+#include "CFErrorUtilities.h"
+#include "CreateStringForOSType.h"
+#include "Logger.h"
+
+// The highest sample rate supported by the AAC encoder
+#define MAX_AAC_SAMPLE_RATE 48000
+
+namespace {
+
+	void RegisterCoreAudioEncoder() __attribute__ ((constructor));
+	void RegisterCoreAudioEncoder()
+	{
+		SFB::Audio::Encoder::RegisterSubclass<SFB::Audio::CoreAudioEncoder>(-50);
+	}
+
+	// The file and audio formats written for each extension
+	struct FileType
+	{
+		CFStringRef		mExtension;
+		AudioFileTypeID	mFileType;
+		AudioFormatID	mFormatID;
+	};
+
+	const FileType sFileTypes [] = {
+		{ CFSTR("m4a"),		kAudioFileM4AType,			kAudioFormatMPEG4AAC },
+		{ CFSTR("m4b"),		kAudioFileM4BType,			kAudioFormatMPEG4AAC },
+		{ CFSTR("aac"),		kAudioFileAAC_ADTSType,		kAudioFormatMPEG4AAC },
+		{ CFSTR("adts"),	kAudioFileAAC_ADTSType,		kAudioFormatMPEG4AAC },
+		{ CFSTR("caf"),		kAudioFileCAFType,			kAudioFormatMPEG4AAC },
+		{ CFSTR("aif"),		kAudioFileAIFFType,			kAudioFormatLinearPCM },
+		{ CFSTR("aiff"),	kAudioFileAIFFType,			kAudioFormatLinearPCM }
+	};
+
+	CFStringRef sSupportedMIMETypes [] = { CFSTR("audio/mp4"), CFSTR("audio/x-m4a"), CFSTR("audio/aac"), CFSTR("audio/aacp"), CFSTR("audio/x-caf"), CFSTR("audio/aiff"), CFSTR("audio/x-aiff") };
+
+	const FileType * FindFileType(CFStringRef extension)
+	{
+		if(nullptr == extension)
+			return nullptr;
+
+		for(const auto& fileType : sFileTypes) {
+			if(kCFCompareEqualTo == CFStringCompare(extension, fileType.mExtension, kCFCompareCaseInsensitive))
+				return &fileType;
+		}
+
+		return nullptr;
+	}
+
+	CFErrorRef CreateUnsupportedFormatError(CFURLRef url) CF_RETURNS_RETAINED
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be created."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Unsupported file format"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not correspond to a supported format."), ""));
+
+		return CreateErrorForURL(SFB::Audio::Encoder::ErrorDomain, SFB::Audio::Encoder::FileFormatNotSupportedError, description, url, failureReason, recoverySuggestion);
+	}
+
+}
+
+#pragma mark Static Methods
+
+CFArrayRef SFB::Audio::CoreAudioEncoder::CreateSupportedFileExtensions()
+{
+	CFMutableArrayRef supportedExtensions = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+	for(const auto& fileType : sFileTypes)
+		CFArrayAppendValue(supportedExtensions, fileType.mExtension);
+	return supportedExtensions;
+}
+
+CFArrayRef SFB::Audio::CoreAudioEncoder::CreateSupportedMIMETypes()
+{
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)sSupportedMIMETypes, sizeof(sSupportedMIMETypes) / sizeof(sSupportedMIMETypes[0]), &kCFTypeArrayCallBacks);
+}
+
+bool SFB::Audio::CoreAudioEncoder::HandlesFilesWithExtension(CFStringRef extension)
+{
+	return nullptr != FindFileType(extension);
+}
+
+bool SFB::Audio::CoreAudioEncoder::HandlesMIMEType(CFStringRef mimeType)
+{
+	if(nullptr == mimeType)
+		return false;
+
+	for(auto supportedMIMEType : sSupportedMIMETypes) {
+		if(kCFCompareEqualTo == CFStringCompare(mimeType, supportedMIMEType, kCFCompareCaseInsensitive))
+			return true;
+	}
+
+	return false;
+}
+
+SFB::Audio::Encoder::unique_ptr SFB::Audio::CoreAudioEncoder::CreateEncoder(CFURLRef url)
+{
+	return unique_ptr(new CoreAudioEncoder(url));
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::CoreAudioEncoder::CoreAudioEncoder(CFURLRef url)
+	: Encoder(url), mExtAudioFile(nullptr)
+{}
+
+SFB::Audio::CoreAudioEncoder::~CoreAudioEncoder()
+{
+	if(IsOpen())
+		Close();
+}
+
+#pragma mark Functionality
+
+bool SFB::Audio::CoreAudioEncoder::_Open(CFErrorRef *error)
+{
+	// The file type is determined by the path extension
+	SFB::CFString pathExtension(CFURLCopyPathExtension(mURL));
+	const FileType *fileType = FindFileType(pathExtension);
+	if(nullptr == fileType) {
+		if(error)
+			*error = CreateUnsupportedFormatError(mURL);
+
+		return false;
+	}
+
+	// The client format is interleaved float at the source sample rate
+	mFormat.mFormatID			= kAudioFormatLinearPCM;
+	mFormat.mFormatFlags		= kAudioFormatFlagsNativeFloatPacked;
+
+	mFormat.mSampleRate			= mSourceFormat.mSampleRate;
+	mFormat.mChannelsPerFrame	= mSourceFormat.mChannelsPerFrame;
+	mFormat.mBitsPerChannel		= 32;
+
+	mFormat.mBytesPerPacket		= (mFormat.mBitsPerChannel / 8) * mFormat.mChannelsPerFrame;
+	mFormat.mFramesPerPacket	= 1;
+	mFormat.mBytesPerFrame		= mFormat.mBytesPerPacket * mFormat.mFramesPerPacket;
+
+	mFormat.mReserved			= 0;
+
+	AudioStreamBasicDescription fileFormat = {};
+	fileFormat.mFormatID			= fileType->mFormatID;
+	fileFormat.mSampleRate			= mSourceFormat.mSampleRate;
+	fileFormat.mChannelsPerFrame	= mSourceFormat.mChannelsPerFrame;
+
+	if(kAudioFormatLinearPCM == fileType->mFormatID) {
+		// AIFF files contain big-endian integer samples
+		bool isFloat = kAudioFormatFlagIsFloat & mSourceFormat.mFormatFlags;
+		fileFormat.mBitsPerChannel	= isFloat || 24 < mSourceFormat.mBitsPerChannel ? 32 : (16 >= mSourceFormat.mBitsPerChannel ? 16 : 24);
+		fileFormat.mFormatFlags		= kAudioFormatFlagIsBigEndian | kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked;
+		fileFormat.mBytesPerPacket	= (fileFormat.mBitsPerChannel / 8) * fileFormat.mChannelsPerFrame;
+		fileFormat.mFramesPerPacket	= 1;
+		fileFormat.mBytesPerFrame	= fileFormat.mBytesPerPacket;
+	}
+	else {
+		if(MAX_AAC_SAMPLE_RATE < fileFormat.mSampleRate)
+			fileFormat.mSampleRate = 0 == fmod(fileFormat.mSampleRate, 44100) ? 44100 : MAX_AAC_SAMPLE_RATE;
+
+		UInt32 dataSize = sizeof(fileFormat);
+		OSStatus result = AudioFormatGetProperty(kAudioFormatProperty_FormatInfo, 0, nullptr, &dataSize, &fileFormat);
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Encoder.CoreAudio", "AudioFormatGetProperty (kAudioFormatProperty_FormatInfo) failed: " << result << "'" << SFB::StringForOSType((OSType)result) << "'");
+
+			if(error)
+				*error = CreateUnsupportedFormatError(mURL);
+
+			return false;
+		}
+	}
+
+	OSStatus result = ExtAudioFileCreateWithURL(mURL, fileType->mFileType, &fileFormat, mChannelLayout, kAudioFileFlags_EraseFile, &mExtAudioFile);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.CoreAudio", "ExtAudioFileCreateWithURL failed: " << result << "'" << SFB::StringForOSType((OSType)result) << "'");
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainOSStatus, result, nullptr);
+
+		return false;
+	}
+
+	result = ExtAudioFileSetProperty(mExtAudioFile, kExtAudioFileProperty_ClientDataFormat, sizeof(mFormat), &mFormat);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.CoreAudio", "ExtAudioFileSetProperty (kExtAudioFileProperty_ClientDataFormat) failed: " << result);
+
+		ExtAudioFileDispose(mExtAudioFile);
+		mExtAudioFile = nullptr;
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainOSStatus, result, nullptr);
+
+		return false;
+	}
+
+	// The bit rate is set on the underlying converter, which must then be told its configuration changed
+	if(kAudioFormatLinearPCM != fileType->mFormatID && 0 < GetBitRate()) {
+		AudioConverterRef converter = nullptr;
+		UInt32 dataSize = sizeof(converter);
+		result = ExtAudioFileGetProperty(mExtAudioFile, kExtAudioFileProperty_AudioConverter, &dataSize, &converter);
+		if(noErr == result && converter) {
+			UInt32 bitRate = GetBitRate();
+			result = AudioConverterSetProperty(converter, kAudioConverterEncodeBitRate, sizeof(bitRate), &bitRate);
+			if(noErr != result)
+				LOGGER_NOTICE("org.sbooth.AudioEngine.Encoder.CoreAudio", "AudioConverterSetProperty (kAudioConverterEncodeBitRate) failed: " << result);
+
+			CFPropertyListRef converterConfig = nullptr;
+			result = ExtAudioFileSetProperty(mExtAudioFile, kExtAudioFileProperty_ConverterConfig, sizeof(converterConfig), &converterConfig);
+			if(noErr != result)
+				LOGGER_NOTICE("org.sbooth.AudioEngine.Encoder.CoreAudio", "ExtAudioFileSetProperty (kExtAudioFileProperty_ConverterConfig) failed: " << result);
+		}
+	}
+
+	return true;
+}
+
+bool SFB::Audio::CoreAudioEncoder::_Close(CFErrorRef *error)
+{
+	OSStatus result = ExtAudioFileDispose(mExtAudioFile);
+	mExtAudioFile = nullptr;
+
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.CoreAudio", "ExtAudioFileDispose failed: " << result);
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainOSStatus, result, nullptr);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool SFB::Audio::CoreAudioEncoder::_WriteAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	OSStatus result = ExtAudioFileWrite(mExtAudioFile, frameCount, bufferList);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.CoreAudio", "ExtAudioFileWrite failed: " << result);
+		return false;
+	}
+
+	return true;
+}
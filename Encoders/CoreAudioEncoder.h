@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <AudioToolbox/ExtendedAudioFile.h>
+
+#include "AudioEncoder.h"
+
+namespace SFB {
+
+	namespace Audio {
+
+		// ========================================
+		// An Encoder subclass writing AAC in MPEG-4, ADTS and CAF files and PCM in AIFF files using Core Audio
+		//
+		// Audio is accepted as interleaved 32-bit floats at the source sample rate; AAC audio at
+		// sample rates above 48 kHz is resampled by ExtAudioFile
+		// ========================================
+		class CoreAudioEncoder : public Encoder
+		{
+
+		public:
+
+			// Data types handled by this class
+			static CFArrayRef CreateSupportedFileExtensions();
+			static CFArrayRef CreateSupportedMIMETypes();
+
+			static bool HandlesFilesWithExtension(CFStringRef extension);
+			static bool HandlesMIMEType(CFStringRef mimeType);
+
+			static Encoder::unique_ptr CreateEncoder(CFURLRef url);
+
+			// Creation and destruction
+			explicit CoreAudioEncoder(CFURLRef url);
+			virtual ~CoreAudioEncoder();
+
+		private:
+
+			// File access
+			virtual bool _Open(CFErrorRef *error);
+			virtual bool _Close(CFErrorRef *error);
+
+			// Encode frameCount frames of audio
+			virtual bool _WriteAudio(const AudioBufferList *bufferList, UInt32 frameCount);
+
+			ExtAudioFileRef		mExtAudioFile;
+		};
+
+	}
+}
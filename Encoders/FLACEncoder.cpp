@@ -0,0 +1,601 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <thread>
+
+#include <dispatch/dispatch.h>
+
+#include "FLACEncoder.h"
+#include "CFErrorUtilities.h"
+#include "Logger.h"
+
+// The default libFLAC compression level
+#define DEFAULT_COMPRESSION_LEVEL 5
+
+// The largest sample size supported by libFLAC's encoder
+#define MAX_BITS_PER_SAMPLE 24
+
+// The number of blocks in each independently encoded segment
+#define SEGMENT_BLOCKS 64
+
+// The number of segments pending per encoding thread
+#define SEGMENTS_PER_THREAD 2
+
+// The size of the fLaC marker and STREAMINFO block
+#define STREAMINFO_OFFSET 8
+#define STREAMINFO_LENGTH 34
+
+namespace {
+
+	void RegisterFLACEncoder() __attribute__ ((constructor));
+	void RegisterFLACEncoder()
+	{
+		SFB::Audio::Encoder::RegisterSubclass<SFB::Audio::FLACEncoder>();
+	}
+
+	CFStringRef sSupportedExtensions [] = { CFSTR("flac") };
+	CFStringRef sSupportedMIMETypes [] = { CFSTR("audio/flac"), CFSTR("audio/x-flac") };
+
+	CFErrorRef CreateUnsupportedFormatError(CFURLRef url) CF_RETURNS_RETAINED
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be created."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Unsupported audio format"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("FLAC supports up to 8 channels at sample rates up to 655,350 Hz."), ""));
+
+		return CreateErrorForURL(SFB::Audio::Encoder::ErrorDomain, SFB::Audio::Encoder::FileFormatNotSupportedError, description, url, failureReason, recoverySuggestion);
+	}
+
+	CFErrorRef CreateWriteError(CFURLRef url) CF_RETURNS_RETAINED
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be written."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The disk may be full or the file may not be writable."), ""));
+
+		return CreateErrorForURL(SFB::Audio::Encoder::ErrorDomain, SFB::Audio::Encoder::InputOutputError, description, url, failureReason, recoverySuggestion);
+	}
+
+	// CRC-8 (polynomial 0x07) and CRC-16 (polynomial 0x8005) used in FLAC frames
+	struct CRCTables
+	{
+		CRCTables()
+		{
+			for(unsigned i = 0; i < 256; ++i) {
+				uint8_t crc8 = (uint8_t)i;
+				uint16_t crc16 = (uint16_t)(i << 8);
+				for(int bit = 0; bit < 8; ++bit) {
+					crc8 = (uint8_t)((crc8 & 0x80) ? (crc8 << 1) ^ 0x07 : crc8 << 1);
+					crc16 = (uint16_t)((crc16 & 0x8000) ? (crc16 << 1) ^ 0x8005 : crc16 << 1);
+				}
+				mCRC8[i] = crc8;
+				mCRC16[i] = crc16;
+			}
+		}
+
+		uint8_t mCRC8 [256];
+		uint16_t mCRC16 [256];
+	};
+
+	const CRCTables& GetCRCTables()
+	{
+		static const CRCTables sCRCTables;
+		return sCRCTables;
+	}
+
+	// Append a FLAC frame to encodedFrames with its frame number replaced by frameNumber
+	// A frame header's fixed fields are followed by the UTF-8 coded frame number, optional block size and
+	// sample rate fields, and a CRC-8, and the frame ends with a CRC-16 covering the header and subframes
+	bool AppendRenumberedFrame(std::vector<FLAC__byte>& encodedFrames, const FLAC__byte *frame, size_t length, uint32_t frameNumber)
+	{
+		if(7 > length || 0xFF != frame[0] || 0xF8 != frame[1])
+			return false;
+
+		// Determine the length of the existing coded number
+		size_t numberLength = 1;
+		if(0xC0 == (frame[4] & 0xE0))		numberLength = 2;
+		else if(0xE0 == (frame[4] & 0xF0))	numberLength = 3;
+		else if(0xF0 == (frame[4] & 0xF8))	numberLength = 4;
+		else if(0xF8 == (frame[4] & 0xFC))	numberLength = 5;
+		else if(0xFC == (frame[4] & 0xFE))	numberLength = 6;
+
+		size_t optionalLength = 0;
+		unsigned blockSizeCode = frame[2] >> 4;
+		unsigned sampleRateCode = frame[2] & 0x0F;
+		if(6 == blockSizeCode)									optionalLength += 1;
+		else if(7 == blockSizeCode)								optionalLength += 2;
+		if(12 == sampleRateCode)								optionalLength += 1;
+		else if(13 == sampleRateCode || 14 == sampleRateCode)	optionalLength += 2;
+
+		size_t headerLength = 4 + numberLength + optionalLength;
+		if(length < headerLength + 3)
+			return false;
+
+		// Encode the new frame number
+		FLAC__byte number [6];
+		size_t newNumberLength;
+		if(0x80 > frameNumber) {
+			number[0] = (FLAC__byte)frameNumber;
+			newNumberLength = 1;
+		}
+		else {
+			newNumberLength = 2;
+			while(newNumberLength < 6 && frameNumber >= (1u << (5 * newNumberLength + 1)))
+				++newNumberLength;
+
+			for(size_t i = newNumberLength - 1; i > 0; --i) {
+				number[i] = (FLAC__byte)(0x80 | (frameNumber & 0x3F));
+				frameNumber >>= 6;
+			}
+			number[0] = (FLAC__byte)((0xFF << (8 - newNumberLength)) | frameNumber);
+		}
+
+		const CRCTables& tables = GetCRCTables();
+		size_t start = encodedFrames.size();
+
+		encodedFrames.insert(encodedFrames.end(), frame, frame + 4);
+		encodedFrames.insert(encodedFrames.end(), number, number + newNumberLength);
+		encodedFrames.insert(encodedFrames.end(), frame + 4 + numberLength, frame + headerLength);
+
+		uint8_t crc8 = 0;
+		for(size_t i = start; i < encodedFrames.size(); ++i)
+			crc8 = tables.mCRC8[crc8 ^ encodedFrames[i]];
+		encodedFrames.push_back(crc8);
+
+		// Copy the subframes, omitting the original CRC-8 and CRC-16
+		encodedFrames.insert(encodedFrames.end(), frame + headerLength + 1, frame + length - 2);
+
+		uint16_t crc16 = 0;
+		for(size_t i = start; i < encodedFrames.size(); ++i)
+			crc16 = (uint16_t)((crc16 << 8) ^ tables.mCRC16[(crc16 >> 8) ^ encodedFrames[i]]);
+		encodedFrames.push_back((FLAC__byte)(crc16 >> 8));
+		encodedFrames.push_back((FLAC__byte)crc16);
+
+		return true;
+	}
+
+	struct SegmentEncoderContext
+	{
+		std::vector<FLAC__byte>& mEncodedFrames;
+		uint32_t mFrameNumber;
+		unsigned mMinimumFrameSize;
+		unsigned mMaximumFrameSize;
+		bool mResult;
+	};
+
+	FLAC__StreamEncoderWriteStatus SegmentWriteCallback(const FLAC__StreamEncoder */*encoder*/, const FLAC__byte buffer[], size_t bytes, unsigned samples, unsigned /*current_frame*/, void *client_data)
+	{
+		auto context = static_cast<SegmentEncoderContext *>(client_data);
+
+		// The stream marker and metadata are written once for the whole file
+		if(0 == samples)
+			return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+
+		size_t previousSize = context->mEncodedFrames.size();
+		if(!AppendRenumberedFrame(context->mEncodedFrames, buffer, bytes, context->mFrameNumber++)) {
+			context->mResult = false;
+			return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+		}
+
+		unsigned frameSize = (unsigned)(context->mEncodedFrames.size() - previousSize);
+		context->mMinimumFrameSize = std::min(context->mMinimumFrameSize, frameSize);
+		context->mMaximumFrameSize = std::max(context->mMaximumFrameSize, frameSize);
+
+		return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+	}
+
+}
+
+#pragma mark Static Methods
+
+CFArrayRef SFB::Audio::FLACEncoder::CreateSupportedFileExtensions()
+{
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)sSupportedExtensions, sizeof(sSupportedExtensions) / sizeof(sSupportedExtensions[0]), &kCFTypeArrayCallBacks);
+}
+
+CFArrayRef SFB::Audio::FLACEncoder::CreateSupportedMIMETypes()
+{
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)sSupportedMIMETypes, sizeof(sSupportedMIMETypes) / sizeof(sSupportedMIMETypes[0]), &kCFTypeArrayCallBacks);
+}
+
+bool SFB::Audio::FLACEncoder::HandlesFilesWithExtension(CFStringRef extension)
+{
+	if(nullptr == extension)
+		return false;
+
+	for(auto supportedExtension : sSupportedExtensions) {
+		if(kCFCompareEqualTo == CFStringCompare(extension, supportedExtension, kCFCompareCaseInsensitive))
+			return true;
+	}
+
+	return false;
+}
+
+bool SFB::Audio::FLACEncoder::HandlesMIMEType(CFStringRef mimeType)
+{
+	if(nullptr == mimeType)
+		return false;
+
+	for(auto supportedMIMEType : sSupportedMIMETypes) {
+		if(kCFCompareEqualTo == CFStringCompare(mimeType, supportedMIMEType, kCFCompareCaseInsensitive))
+			return true;
+	}
+
+	return false;
+}
+
+SFB::Audio::Encoder::unique_ptr SFB::Audio::FLACEncoder::CreateEncoder(CFURLRef url)
+{
+	return unique_ptr(new FLACEncoder(url));
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::FLACEncoder::FLACEncoder(CFURLRef url)
+	: Encoder(url), mFLAC(nullptr, nullptr), mFile(nullptr, fclose), mThreadCount(1), mCompressionLevel(DEFAULT_COMPRESSION_LEVEL), mBlockSize(0), mSegmentFrames(0), mNextFrameNumber(0), mMinimumFrameSize(0), mMaximumFrameSize(0), mSegmentFailed(false)
+{}
+
+SFB::Audio::FLACEncoder::~FLACEncoder()
+{
+	if(IsOpen())
+		Close();
+}
+
+#pragma mark Functionality
+
+bool SFB::Audio::FLACEncoder::_Open(CFErrorRef *error)
+{
+	if(FLAC__MAX_CHANNELS < mSourceFormat.mChannelsPerFrame || FLAC__MAX_SAMPLE_RATE < mSourceFormat.mSampleRate) {
+		if(error)
+			*error = CreateUnsupportedFormatError(mURL);
+
+		return false;
+	}
+
+	// Floating point audio is encoded with 24 bits per sample
+	UInt32 bitsPerSample = MAX_BITS_PER_SAMPLE;
+	if(!(kAudioFormatFlagIsFloat & mSourceFormat.mFormatFlags))
+		bitsPerSample = std::max((UInt32)FLAC__MIN_BITS_PER_SAMPLE, std::min(mSourceFormat.mBitsPerChannel, (UInt32)MAX_BITS_PER_SAMPLE));
+
+	// libFLAC takes one buffer per channel with the samples in the low bits of each 32-bit integer
+	mFormat.mFormatID			= kAudioFormatLinearPCM;
+	mFormat.mFormatFlags		= kAudioFormatFlagsNativeEndian | kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsNonInterleaved;
+
+	mFormat.mSampleRate			= mSourceFormat.mSampleRate;
+	mFormat.mChannelsPerFrame	= mSourceFormat.mChannelsPerFrame;
+	mFormat.mBitsPerChannel		= bitsPerSample;
+
+	mFormat.mBytesPerPacket		= sizeof(FLAC__int32);
+	mFormat.mFramesPerPacket	= 1;
+	mFormat.mBytesPerFrame		= mFormat.mBytesPerPacket * mFormat.mFramesPerPacket;
+
+	mFormat.mReserved			= 0;
+
+	char path [PATH_MAX];
+	if(!CFURLGetFileSystemRepresentation(mURL, FALSE, (UInt8 *)path, PATH_MAX)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.FLAC", "CFURLGetFileSystemRepresentation failed");
+
+		if(error)
+			*error = CreateWriteError(mURL);
+
+		return false;
+	}
+
+	mCompressionLevel = DEFAULT_COMPRESSION_LEVEL;
+	if(0 <= GetCompressionLevel())
+		mCompressionLevel = (unsigned)std::min(GetCompressionLevel(), 8);
+
+	mThreadCount = GetEncodingThreadCount();
+	if(0 == mThreadCount)
+		mThreadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	if(1 < mThreadCount)
+		return OpenParallel(path, error);
+
+	mFLAC = std::unique_ptr<FLAC__StreamEncoder, void(*)(FLAC__StreamEncoder *)>(FLAC__stream_encoder_new(), FLAC__stream_encoder_delete);
+	if(!mFLAC) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
+		return false;
+	}
+
+	FLAC__stream_encoder_set_channels(mFLAC.get(), mFormat.mChannelsPerFrame);
+	FLAC__stream_encoder_set_bits_per_sample(mFLAC.get(), mFormat.mBitsPerChannel);
+	FLAC__stream_encoder_set_sample_rate(mFLAC.get(), (unsigned)mFormat.mSampleRate);
+	FLAC__stream_encoder_set_compression_level(mFLAC.get(), mCompressionLevel);
+
+	auto status = FLAC__stream_encoder_init_file(mFLAC.get(), path, nullptr, nullptr);
+	if(FLAC__STREAM_ENCODER_INIT_STATUS_OK != status) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.FLAC", "FLAC__stream_encoder_init_file failed: " << FLAC__StreamEncoderInitStatusString[status]);
+
+		mFLAC.reset();
+
+		if(error)
+			*error = FLAC__STREAM_ENCODER_INIT_STATUS_ENCODER_ERROR == status ? CreateWriteError(mURL) : CreateUnsupportedFormatError(mURL);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool SFB::Audio::FLACEncoder::_Close(CFErrorRef *error)
+{
+	bool result;
+	if(mFile)
+		result = CloseParallel();
+	else {
+		result = FLAC__stream_encoder_finish(mFLAC.get());
+		if(!result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Encoder.FLAC", "FLAC__stream_encoder_finish failed: " << FLAC__stream_encoder_get_resolved_state_string(mFLAC.get()));
+
+		mFLAC.reset();
+	}
+
+	if(!result && error)
+		*error = CreateWriteError(mURL);
+
+	return result;
+}
+
+bool SFB::Audio::FLACEncoder::_WriteAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(bufferList->mNumberBuffers != mFormat.mChannelsPerFrame) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Encoder.FLAC", "_WriteAudio() called with invalid parameters");
+		return false;
+	}
+
+	if(mFile)
+		return WriteAudioParallel(bufferList, frameCount);
+
+	const FLAC__int32 *buffers [FLAC__MAX_CHANNELS];
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+		buffers[i] = static_cast<const FLAC__int32 *>(bufferList->mBuffers[i].mData);
+
+	if(!FLAC__stream_encoder_process(mFLAC.get(), buffers, frameCount)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.FLAC", "FLAC__stream_encoder_process failed: " << FLAC__stream_encoder_get_resolved_state_string(mFLAC.get()));
+		return false;
+	}
+
+	return true;
+}
+
+#pragma mark Multithreaded Encoding
+
+bool SFB::Audio::FLACEncoder::OpenParallel(const char *path, CFErrorRef *error)
+{
+	// Segments must consist of whole blocks so every frame but the last has the block size chosen by libFLAC
+	std::unique_ptr<FLAC__StreamEncoder, void(*)(FLAC__StreamEncoder *)> flac(FLAC__stream_encoder_new(), FLAC__stream_encoder_delete);
+	if(!flac) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
+		return false;
+	}
+
+	FLAC__stream_encoder_set_sample_rate(flac.get(), (unsigned)mFormat.mSampleRate);
+	FLAC__stream_encoder_set_compression_level(flac.get(), mCompressionLevel);
+	mBlockSize = FLAC__stream_encoder_get_blocksize(flac.get());
+	mSegmentFrames = SEGMENT_BLOCKS * mBlockSize;
+
+	mFile.reset(fopen(path, "wb"));
+	if(!mFile) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.FLAC", "Unable to create " << path << ": " << strerror(errno));
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+
+		return false;
+	}
+
+	// STREAMINFO is the only metadata block and is completed when the file is closed
+	FLAC__byte header [STREAMINFO_OFFSET + STREAMINFO_LENGTH] = { 'f', 'L', 'a', 'C', 0x80, 0, 0, STREAMINFO_LENGTH };
+	if(1 != fwrite(header, sizeof(header), 1, mFile.get())) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.FLAC", "fwrite failed: " << strerror(errno));
+
+		mFile.reset();
+
+		if(error)
+			*error = CreateWriteError(mURL);
+
+		return false;
+	}
+
+	mCurrentSegment.reset();
+	mPendingSegments.clear();
+	mNextFrameNumber = 0;
+	mMinimumFrameSize = UINT_MAX;
+	mMaximumFrameSize = 0;
+	mSegmentFailed = false;
+
+	CC_MD5_Init(&mMD5);
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Encoder.FLAC", "Encoding using " << mThreadCount << " threads and segments of " << mSegmentFrames << " frames");
+
+	return true;
+}
+
+bool SFB::Audio::FLACEncoder::CloseParallel()
+{
+	bool result = true;
+	if(mCurrentSegment)
+		result = SubmitSegment();
+
+	while(!mPendingSegments.empty()) {
+		if(!WriteSegment())
+			result = false;
+	}
+
+	if(result) {
+		unsigned char md5 [CC_MD5_DIGEST_LENGTH];
+		CC_MD5_Final(md5, &mMD5);
+
+		// An empty stream has no frames
+		if(0 == mMaximumFrameSize)
+			mMinimumFrameSize = 0;
+
+		uint64_t totalSamples = (uint64_t)GetFramesWritten();
+		unsigned sampleRate = (unsigned)mFormat.mSampleRate;
+		unsigned channels = mFormat.mChannelsPerFrame - 1;
+		unsigned bitsPerSample = mFormat.mBitsPerChannel - 1;
+
+		FLAC__byte streamInfo [STREAMINFO_LENGTH] = {
+			(FLAC__byte)(mBlockSize >> 8), (FLAC__byte)mBlockSize,
+			(FLAC__byte)(mBlockSize >> 8), (FLAC__byte)mBlockSize,
+			(FLAC__byte)(mMinimumFrameSize >> 16), (FLAC__byte)(mMinimumFrameSize >> 8), (FLAC__byte)mMinimumFrameSize,
+			(FLAC__byte)(mMaximumFrameSize >> 16), (FLAC__byte)(mMaximumFrameSize >> 8), (FLAC__byte)mMaximumFrameSize,
+			(FLAC__byte)(sampleRate >> 12), (FLAC__byte)(sampleRate >> 4),
+			(FLAC__byte)(((sampleRate & 0x0F) << 4) | (channels << 1) | (bitsPerSample >> 4)),
+			(FLAC__byte)(((bitsPerSample & 0x0F) << 4) | ((totalSamples >> 32) & 0x0F)),
+			(FLAC__byte)(totalSamples >> 24), (FLAC__byte)(totalSamples >> 16), (FLAC__byte)(totalSamples >> 8), (FLAC__byte)totalSamples
+		};
+		memcpy(streamInfo + 18, md5, sizeof(md5));
+
+		result = 0 == fseek(mFile.get(), STREAMINFO_OFFSET, SEEK_SET) && 1 == fwrite(streamInfo, sizeof(streamInfo), 1, mFile.get());
+		if(!result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Encoder.FLAC", "Unable to write STREAMINFO: " << strerror(errno));
+	}
+
+	if(0 != fclose(mFile.release()))
+		result = false;
+
+	return result;
+}
+
+bool SFB::Audio::FLACEncoder::WriteAudioParallel(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(mSegmentFailed)
+		return false;
+
+	// The MD5 is computed over the samples as little-endian integers of the minimum number of bytes
+	UInt32 channels = mFormat.mChannelsPerFrame;
+	UInt32 bytesPerSample = (mFormat.mBitsPerChannel + 7) / 8;
+	mMD5Buffer.resize(frameCount * channels * bytesPerSample);
+	uint8_t *md5Bytes = mMD5Buffer.data();
+	for(UInt32 frame = 0; frame < frameCount; ++frame) {
+		for(UInt32 channel = 0; channel < channels; ++channel) {
+			uint32_t sample = (uint32_t)static_cast<const FLAC__int32 *>(bufferList->mBuffers[channel].mData)[frame];
+			for(UInt32 byte = 0; byte < bytesPerSample; ++byte)
+				*md5Bytes++ = (uint8_t)(sample >> (8 * byte));
+		}
+	}
+	CC_MD5_Update(&mMD5, mMD5Buffer.data(), (CC_LONG)mMD5Buffer.size());
+
+	UInt32 framesProcessed = 0;
+	while(framesProcessed < frameCount) {
+		if(!mCurrentSegment) {
+			mCurrentSegment.reset(new Segment());
+			mCurrentSegment->mSamples.resize((size_t)mSegmentFrames * channels);
+			mCurrentSegment->mFrameCount = 0;
+			mCurrentSegment->mFirstFrameNumber = mNextFrameNumber;
+			mNextFrameNumber += SEGMENT_BLOCKS;
+		}
+
+		UInt32 framesToCopy = std::min(frameCount - framesProcessed, mSegmentFrames - mCurrentSegment->mFrameCount);
+		for(UInt32 channel = 0; channel < channels; ++channel) {
+			const FLAC__int32 *input = static_cast<const FLAC__int32 *>(bufferList->mBuffers[channel].mData) + framesProcessed;
+			std::copy(input, input + framesToCopy, mCurrentSegment->mSamples.begin() + (size_t)channel * mSegmentFrames + mCurrentSegment->mFrameCount);
+		}
+
+		mCurrentSegment->mFrameCount += framesToCopy;
+		framesProcessed += framesToCopy;
+
+		if(mSegmentFrames == mCurrentSegment->mFrameCount && !SubmitSegment())
+			return false;
+	}
+
+	return true;
+}
+
+bool SFB::Audio::FLACEncoder::SubmitSegment()
+{
+	while(SEGMENTS_PER_THREAD * mThreadCount <= mPendingSegments.size()) {
+		if(!WriteSegment())
+			return false;
+	}
+
+	Segment *segment = mCurrentSegment.get();
+	mPendingSegments.push_back(std::move(mCurrentSegment));
+
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		EncodeSegment(*segment);
+		segment->mEncoded.Signal();
+	});
+
+	return true;
+}
+
+bool SFB::Audio::FLACEncoder::WriteSegment()
+{
+	std::unique_ptr<Segment> segment = std::move(mPendingSegments.front());
+	mPendingSegments.pop_front();
+
+	segment->mEncoded.Wait();
+
+	if(mSegmentFailed)
+		return false;
+
+	if(!segment->mResult) {
+		mSegmentFailed = true;
+		return false;
+	}
+
+	if(!segment->mEncodedFrames.empty() && 1 != fwrite(segment->mEncodedFrames.data(), segment->mEncodedFrames.size(), 1, mFile.get())) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.FLAC", "fwrite failed: " << strerror(errno));
+		mSegmentFailed = true;
+		return false;
+	}
+
+	mMinimumFrameSize = std::min(mMinimumFrameSize, segment->mMinimumFrameSize);
+	mMaximumFrameSize = std::max(mMaximumFrameSize, segment->mMaximumFrameSize);
+
+	return true;
+}
+
+void SFB::Audio::FLACEncoder::EncodeSegment(Segment& segment) const
+{
+	segment.mResult = false;
+
+	std::unique_ptr<FLAC__StreamEncoder, void(*)(FLAC__StreamEncoder *)> flac(FLAC__stream_encoder_new(), FLAC__stream_encoder_delete);
+	if(!flac)
+		return;
+
+	FLAC__stream_encoder_set_channels(flac.get(), mFormat.mChannelsPerFrame);
+	FLAC__stream_encoder_set_bits_per_sample(flac.get(), mFormat.mBitsPerChannel);
+	FLAC__stream_encoder_set_sample_rate(flac.get(), (unsigned)mFormat.mSampleRate);
+	FLAC__stream_encoder_set_compression_level(flac.get(), mCompressionLevel);
+	FLAC__stream_encoder_set_blocksize(flac.get(), mBlockSize);
+	FLAC__stream_encoder_set_do_md5(flac.get(), false);
+
+	SegmentEncoderContext context = { segment.mEncodedFrames, segment.mFirstFrameNumber, UINT_MAX, 0, true };
+	segment.mEncodedFrames.reserve(segment.mSamples.size() * sizeof(FLAC__int32) / 2);
+
+	auto status = FLAC__stream_encoder_init_stream(flac.get(), SegmentWriteCallback, nullptr, nullptr, nullptr, &context);
+	if(FLAC__STREAM_ENCODER_INIT_STATUS_OK != status) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.FLAC", "FLAC__stream_encoder_init_stream failed: " << FLAC__StreamEncoderInitStatusString[status]);
+		return;
+	}
+
+	const FLAC__int32 *buffers [FLAC__MAX_CHANNELS];
+	for(UInt32 channel = 0; channel < mFormat.mChannelsPerFrame; ++channel)
+		buffers[channel] = segment.mSamples.data() + (size_t)channel * mSegmentFrames;
+
+	bool result = FLAC__stream_encoder_process(flac.get(), buffers, segment.mFrameCount);
+	if(!result)
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.FLAC", "FLAC__stream_encoder_process failed: " << FLAC__stream_encoder_get_resolved_state_string(flac.get()));
+
+	if(!FLAC__stream_encoder_finish(flac.get()))
+		result = false;
+
+	// The samples are no longer needed
+	std::vector<FLAC__int32>().swap(segment.mSamples);
+
+	segment.mMinimumFrameSize = context.mMinimumFrameSize;
+	segment.mMaximumFrameSize = context.mMaximumFrameSize;
+	segment.mResult = result && context.mResult;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+#include <CommonCrypto/CommonDigest.h>
+#include <FLAC/stream_encoder.h>
+
+#include "AudioEncoder.h"
+#include "Semaphore.h"
+
+namespace SFB {
+
+	namespace Audio {
+
+		// ========================================
+		// An Encoder subclass writing FLAC files using libFLAC
+		//
+		// Audio is accepted as non-interleaved 32-bit integers holding samples of up to 24 bits,
+		// which libFLAC encodes directly from the caller's buffers
+		//
+		// When more than one encoding thread is requested the audio is divided into segments
+		// of whole blocks that are encoded concurrently by independent libFLAC encoders.  The
+		// frames are renumbered as they are written so the file is identical in structure to
+		// one encoded sequentially, and STREAMINFO, including the MD5, is written when closed
+		// ========================================
+		class FLACEncoder : public Encoder
+		{
+
+		public:
+
+			// Data types handled by this class
+			static CFArrayRef CreateSupportedFileExtensions();
+			static CFArrayRef CreateSupportedMIMETypes();
+
+			static bool HandlesFilesWithExtension(CFStringRef extension);
+			static bool HandlesMIMEType(CFStringRef mimeType);
+
+			static Encoder::unique_ptr CreateEncoder(CFURLRef url);
+
+			// Creation and destruction
+			explicit FLACEncoder(CFURLRef url);
+			virtual ~FLACEncoder();
+
+		private:
+
+			// File access
+			virtual bool _Open(CFErrorRef *error);
+			virtual bool _Close(CFErrorRef *error);
+
+			// Encode frameCount frames of audio
+			virtual bool _WriteAudio(const AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Multithreaded encoding
+			struct Segment
+			{
+				std::vector<FLAC__int32>	mSamples;			// The segment's audio, one channel after another
+				UInt32						mFrameCount;
+				UInt32						mFirstFrameNumber;	// The number of the segment's first FLAC frame
+				std::vector<FLAC__byte>		mEncodedFrames;
+				unsigned					mMinimumFrameSize;
+				unsigned					mMaximumFrameSize;
+				bool						mResult;
+				SFB::Semaphore				mEncoded;			// Signaled when encoding completes
+			};
+
+			bool OpenParallel(const char *path, CFErrorRef *error);
+			bool CloseParallel();
+			bool WriteAudioParallel(const AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Submit mCurrentSegment for encoding, waiting for earlier segments if too many are pending
+			bool SubmitSegment();
+
+			// Wait for the oldest pending segment and write its frames
+			bool WriteSegment();
+
+			// Encode segment on the calling thread
+			void EncodeSegment(Segment& segment) const;
+
+			std::unique_ptr<FLAC__StreamEncoder, void(*)(FLAC__StreamEncoder *)>	mFLAC;
+
+			std::unique_ptr<FILE, int(*)(FILE *)>		mFile;
+			size_t										mThreadCount;
+			unsigned									mCompressionLevel;
+			unsigned									mBlockSize;
+			UInt32										mSegmentFrames;
+			std::unique_ptr<Segment>					mCurrentSegment;
+			std::deque<std::unique_ptr<Segment>>		mPendingSegments;
+			UInt32										mNextFrameNumber;
+			unsigned									mMinimumFrameSize;
+			unsigned									mMaximumFrameSize;
+			bool										mSegmentFailed;
+			CC_MD5_CTX									mMD5;
+			std::vector<uint8_t>						mMD5Buffer;
+		};
+
+	}
+}
@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#include "OggOpusEncoder.h"
+#include "CFErrorUtilities.h"
+#include "Logger.h"
+
+#define OPUS_SAMPLE_RATE				48000
+#define OPUS_FRAMES_PER_SECOND			50
+#define OPUS_MAX_PACKET_BYTES			1500
+
+namespace {
+
+	void RegisterOggOpusEncoder() __attribute__ ((constructor));
+	void RegisterOggOpusEncoder()
+	{
+		SFB::Audio::Encoder::RegisterSubclass<SFB::Audio::OggOpusEncoder>();
+	}
+
+	CFStringRef sSupportedExtensions [] = { CFSTR("opus") };
+	CFStringRef sSupportedMIMETypes [] = { CFSTR("audio/opus"), CFSTR("audio/ogg") };
+
+	// The sample rates supported by libopus
+	const opus_int32 sOpusSampleRates [] = { 8000, 12000, 16000, 24000, 48000 };
+
+	void AppendUInt16(std::vector<unsigned char>& data, uint16_t value)
+	{
+		data.push_back((unsigned char)value);
+		data.push_back((unsigned char)(value >> 8));
+	}
+
+	void AppendUInt32(std::vector<unsigned char>& data, uint32_t value)
+	{
+		for(int i = 0; i < 32; i += 8)
+			data.push_back((unsigned char)(value >> i));
+	}
+
+	CFErrorRef CreateWriteError(CFURLRef url) CF_RETURNS_RETAINED
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be written."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The disk may be full or the file may not be writable."), ""));
+
+		return CreateErrorForURL(SFB::Audio::Encoder::ErrorDomain, SFB::Audio::Encoder::InputOutputError, description, url, failureReason, recoverySuggestion);
+	}
+
+}
+
+#pragma mark Static Methods
+
+CFArrayRef SFB::Audio::OggOpusEncoder::CreateSupportedFileExtensions()
+{
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)sSupportedExtensions, sizeof(sSupportedExtensions) / sizeof(sSupportedExtensions[0]), &kCFTypeArrayCallBacks);
+}
+
+CFArrayRef SFB::Audio::OggOpusEncoder::CreateSupportedMIMETypes()
+{
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)sSupportedMIMETypes, sizeof(sSupportedMIMETypes) / sizeof(sSupportedMIMETypes[0]), &kCFTypeArrayCallBacks);
+}
+
+bool SFB::Audio::OggOpusEncoder::HandlesFilesWithExtension(CFStringRef extension)
+{
+	if(nullptr == extension)
+		return false;
+
+	for(auto supportedExtension : sSupportedExtensions) {
+		if(kCFCompareEqualTo == CFStringCompare(extension, supportedExtension, kCFCompareCaseInsensitive))
+			return true;
+	}
+
+	return false;
+}
+
+bool SFB::Audio::OggOpusEncoder::HandlesMIMEType(CFStringRef mimeType)
+{
+	if(nullptr == mimeType)
+		return false;
+
+	for(auto supportedMIMEType : sSupportedMIMETypes) {
+		if(kCFCompareEqualTo == CFStringCompare(mimeType, supportedMIMEType, kCFCompareCaseInsensitive))
+			return true;
+	}
+
+	return false;
+}
+
+SFB::Audio::Encoder::unique_ptr SFB::Audio::OggOpusEncoder::CreateEncoder(CFURLRef url)
+{
+	return unique_ptr(new OggOpusEncoder(url));
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::OggOpusEncoder::OggOpusEncoder(CFURLRef url)
+	: Encoder(url), mFile(nullptr, fclose), mOpus(nullptr, opus_multistream_encoder_destroy), mStreamInitialized(false), mPacketNumber(0), mFrameSize(0), mGranuleScale(1), mLookahead(0), mFramesEncoded(0), mPendingFrameCount(0), mHeldPacketLength(-1), mHeldGranulePosition(0)
+{
+	memset(&mStream, 0, sizeof(mStream));
+}
+
+SFB::Audio::OggOpusEncoder::~OggOpusEncoder()
+{
+	if(IsOpen())
+		Close();
+
+	if(mStreamInitialized)
+		ogg_stream_clear(&mStream);
+}
+
+#pragma mark Functionality
+
+bool SFB::Audio::OggOpusEncoder::_Open(CFErrorRef *error)
+{
+	if(8 < mSourceFormat.mChannelsPerFrame) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.OggOpus", "Unsupported number of channels: " << mSourceFormat.mChannelsPerFrame);
+
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be created."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Unsupported audio format"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("Ogg Opus files may contain at most eight channels."), ""));
+
+			*error = CreateErrorForURL(Encoder::ErrorDomain, Encoder::FileFormatNotSupportedError, description, mURL, failureReason, recoverySuggestion);
+		}
+
+		return false;
+	}
+
+	// Encode at the source sample rate if possible to avoid resampling
+	opus_int32 sampleRate = OPUS_SAMPLE_RATE;
+	for(auto opusSampleRate : sOpusSampleRates) {
+		if((Float64)opusSampleRate == mSourceFormat.mSampleRate)
+			sampleRate = opusSampleRate;
+	}
+
+	mFormat.mFormatID			= kAudioFormatLinearPCM;
+	mFormat.mFormatFlags		= kAudioFormatFlagsNativeFloatPacked;
+
+	mFormat.mSampleRate			= sampleRate;
+	mFormat.mChannelsPerFrame	= mSourceFormat.mChannelsPerFrame;
+	mFormat.mBitsPerChannel		= 8 * sizeof(float);
+
+	mFormat.mBytesPerPacket		= sizeof(float) * mFormat.mChannelsPerFrame;
+	mFormat.mFramesPerPacket	= 1;
+	mFormat.mBytesPerFrame		= mFormat.mBytesPerPacket * mFormat.mFramesPerPacket;
+
+	mFormat.mReserved			= 0;
+
+	int channels = (int)mFormat.mChannelsPerFrame;
+	int mappingFamily = 2 < channels ? 1 : 0;
+	int streams = 0;
+	int coupledStreams = 0;
+	unsigned char mapping [8];
+
+	int result = OPUS_OK;
+	mOpus.reset(opus_multistream_surround_encoder_create(sampleRate, channels, mappingFamily, &streams, &coupledStreams, mapping, OPUS_APPLICATION_AUDIO, &result));
+	if(!mOpus || OPUS_OK != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.OggOpus", "opus_multistream_surround_encoder_create failed: " << opus_strerror(result));
+
+		mOpus.reset();
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
+		return false;
+	}
+
+	if(0 != GetBitRate())
+		opus_multistream_encoder_ctl(mOpus.get(), OPUS_SET_BITRATE((opus_int32)GetBitRate()));
+
+	if(-1 != GetCompressionLevel())
+		opus_multistream_encoder_ctl(mOpus.get(), OPUS_SET_COMPLEXITY(std::min(std::max(GetCompressionLevel(), 0), 10)));
+
+	opus_int32 lookahead = 0;
+	opus_multistream_encoder_ctl(mOpus.get(), OPUS_GET_LOOKAHEAD(&lookahead));
+
+	mFrameSize = (UInt32)sampleRate / OPUS_FRAMES_PER_SECOND;
+	mGranuleScale = OPUS_SAMPLE_RATE / (UInt32)sampleRate;
+	mLookahead = (UInt32)lookahead;
+	mFramesEncoded = 0;
+
+	mPendingFrame.assign(mFrameSize * mFormat.mChannelsPerFrame, 0);
+	mPendingFrameCount = 0;
+
+	mPacket.resize(OPUS_MAX_PACKET_BYTES * (size_t)streams);
+	mHeldPacket.resize(mPacket.size());
+	mHeldPacketLength = -1;
+
+	char path [PATH_MAX];
+	if(!CFURLGetFileSystemRepresentation(mURL, FALSE, (UInt8 *)path, PATH_MAX)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.OggOpus", "CFURLGetFileSystemRepresentation failed");
+
+		mOpus.reset();
+
+		if(error)
+			*error = CreateWriteError(mURL);
+
+		return false;
+	}
+
+	mFile.reset(fopen(path, "wb"));
+	if(!mFile) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.OggOpus", "Unable to create " << path << ": " << strerror(errno));
+
+		mOpus.reset();
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+
+		return false;
+	}
+
+	if(mStreamInitialized)
+		ogg_stream_clear(&mStream);
+	mStreamInitialized = 0 == ogg_stream_init(&mStream, (int)arc4random());
+	mPacketNumber = 0;
+
+	// Identification header (RFC 7845 section 5.1)
+	std::vector<unsigned char> header = { 'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, (unsigned char)channels };
+	AppendUInt16(header, (uint16_t)(mLookahead * mGranuleScale));
+	AppendUInt32(header, (uint32_t)mSourceFormat.mSampleRate);
+	AppendUInt16(header, 0);
+	header.push_back((unsigned char)mappingFamily);
+	if(0 != mappingFamily) {
+		header.push_back((unsigned char)streams);
+		header.push_back((unsigned char)coupledStreams);
+		header.insert(header.end(), mapping, mapping + channels);
+	}
+
+	// Comment header (RFC 7845 section 5.2)
+	const char *vendor = opus_get_version_string();
+	std::vector<unsigned char> tags = { 'O', 'p', 'u', 's', 'T', 'a', 'g', 's' };
+	AppendUInt32(tags, (uint32_t)strlen(vendor));
+	tags.insert(tags.end(), vendor, vendor + strlen(vendor));
+	AppendUInt32(tags, 0);
+
+	// Each header must begin a new page
+	if(!mStreamInitialized || !SubmitPacket(header.data(), (long)header.size(), 0, true, false) || !SubmitPacket(tags.data(), (long)tags.size(), 0, true, false)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.OggOpus", "Unable to write the Ogg Opus headers");
+
+		mFile.reset();
+		mOpus.reset();
+
+		if(error)
+			*error = CreateWriteError(mURL);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool SFB::Audio::OggOpusEncoder::_Close(CFErrorRef *error)
+{
+	bool result = true;
+
+	// Pad the audio with silence until the encoder's delay has been flushed
+	SInt64 requiredFrames = GetFramesWritten() + mLookahead;
+	while(result && mFramesEncoded < requiredFrames) {
+		std::fill(mPendingFrame.begin() + mPendingFrameCount * mFormat.mChannelsPerFrame, mPendingFrame.end(), 0.f);
+		mPendingFrameCount = mFrameSize;
+		result = EncodePendingFrame();
+	}
+
+	// The final granule position trims the padding
+	if(result && -1 != mHeldPacketLength) {
+		ogg_int64_t granulePosition = (ogg_int64_t)(mLookahead + GetFramesWritten()) * mGranuleScale;
+		result = SubmitPacket(mHeldPacket.data(), mHeldPacketLength, granulePosition, true, true);
+		mHeldPacketLength = -1;
+	}
+
+	if(0 != fclose(mFile.release()))
+		result = false;
+
+	mOpus.reset();
+
+	if(!result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.OggOpus", "Unable to finish writing the file");
+
+		if(error)
+			*error = CreateWriteError(mURL);
+	}
+
+	return result;
+}
+
+bool SFB::Audio::OggOpusEncoder::_WriteAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(1 != bufferList->mNumberBuffers) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Encoder.OggOpus", "_WriteAudio() called with invalid parameters");
+		return false;
+	}
+
+	const float *input = (const float *)bufferList->mBuffers[0].mData;
+	UInt32 framesRemaining = frameCount;
+
+	while(0 < framesRemaining) {
+		UInt32 framesToCopy = std::min(framesRemaining, mFrameSize - mPendingFrameCount);
+		size_t samplesToCopy = framesToCopy * mFormat.mChannelsPerFrame;
+
+		std::copy(input, input + samplesToCopy, mPendingFrame.begin() + mPendingFrameCount * mFormat.mChannelsPerFrame);
+		input += samplesToCopy;
+		mPendingFrameCount += framesToCopy;
+		framesRemaining -= framesToCopy;
+
+		if(mFrameSize == mPendingFrameCount && !EncodePendingFrame())
+			return false;
+	}
+
+	return true;
+}
+
+bool SFB::Audio::OggOpusEncoder::EncodePendingFrame()
+{
+	opus_int32 length = opus_multistream_encode_float(mOpus.get(), mPendingFrame.data(), (int)mFrameSize, mPacket.data(), (opus_int32)mPacket.size());
+	if(0 > length) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.OggOpus", "opus_multistream_encode_float failed: " << opus_strerror(length));
+		return false;
+	}
+
+	mPendingFrameCount = 0;
+	mFramesEncoded += mFrameSize;
+
+	if(-1 != mHeldPacketLength && !SubmitPacket(mHeldPacket.data(), mHeldPacketLength, mHeldGranulePosition, false, false))
+		return false;
+
+	std::swap(mPacket, mHeldPacket);
+	mHeldPacketLength = length;
+	mHeldGranulePosition = (ogg_int64_t)mFramesEncoded * mGranuleScale;
+
+	return true;
+}
+
+bool SFB::Audio::OggOpusEncoder::SubmitPacket(const unsigned char *data, long length, ogg_int64_t granulePosition, bool flush, bool endOfStream)
+{
+	ogg_packet packet;
+	packet.packet		= (unsigned char *)data;
+	packet.bytes		= length;
+	packet.b_o_s		= 0 == mPacketNumber;
+	packet.e_o_s		= endOfStream;
+	packet.granulepos	= granulePosition;
+	packet.packetno		= mPacketNumber++;
+
+	if(0 != ogg_stream_packetin(&mStream, &packet)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.OggOpus", "ogg_stream_packetin failed");
+		return false;
+	}
+
+	ogg_page page;
+	while(0 != (flush ? ogg_stream_flush(&mStream, &page) : ogg_stream_pageout(&mStream, &page))) {
+		if(1 != fwrite(page.header, (size_t)page.header_len, 1, mFile.get()) || (0 < page.body_len && 1 != fwrite(page.body, (size_t)page.body_len, 1, mFile.get()))) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Encoder.OggOpus", "fwrite failed: " << strerror(errno));
+			return false;
+		}
+	}
+
+	return true;
+}
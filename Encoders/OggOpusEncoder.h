@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+#include <ogg/ogg.h>
+#include <opus/opus_multistream.h>
+
+#include "AudioEncoder.h"
+
+namespace SFB {
+
+	namespace Audio {
+
+		// ========================================
+		// An Encoder subclass writing Opus audio in an Ogg container
+		//
+		// Audio is encoded in 20 ms packets at the source sample rate if Opus supports it,
+		// otherwise at 48 KHz.  Up to eight channels are supported; audio with more than two
+		// channels uses the Vorbis channel order (mapping family 1)
+		// ========================================
+		class OggOpusEncoder : public Encoder
+		{
+
+		public:
+
+			// Data types handled by this class
+			static CFArrayRef CreateSupportedFileExtensions();
+			static CFArrayRef CreateSupportedMIMETypes();
+
+			static bool HandlesFilesWithExtension(CFStringRef extension);
+			static bool HandlesMIMEType(CFStringRef mimeType);
+
+			static Encoder::unique_ptr CreateEncoder(CFURLRef url);
+
+			// Creation and destruction
+			explicit OggOpusEncoder(CFURLRef url);
+			virtual ~OggOpusEncoder();
+
+		private:
+
+			// File access
+			virtual bool _Open(CFErrorRef *error);
+			virtual bool _Close(CFErrorRef *error);
+
+			// Encode frameCount frames of audio
+			virtual bool _WriteAudio(const AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Encode the pending frame and submit the packet preceding it
+			bool EncodePendingFrame();
+
+			// Submit a packet to the Ogg stream and write any completed pages
+			bool SubmitPacket(const unsigned char *data, long length, ogg_int64_t granulePosition, bool flush, bool endOfStream);
+
+			std::unique_ptr<FILE, int(*)(FILE *)>								mFile;
+			std::unique_ptr<OpusMSEncoder, void(*)(OpusMSEncoder *)>			mOpus;
+			ogg_stream_state													mStream;
+			bool																mStreamInitialized;
+			ogg_int64_t															mPacketNumber;
+
+			UInt32																mFrameSize;			// Frames per packet at the encoding rate
+			UInt32																mGranuleScale;		// The ratio of 48 KHz to the encoding rate
+			UInt32																mLookahead;			// Encoder delay in frames at the encoding rate
+			SInt64																mFramesEncoded;		// Frames submitted to the encoder, including padding
+
+			std::vector<float>													mPendingFrame;		// Interleaved audio for the next packet
+			UInt32																mPendingFrameCount;
+
+			// The most recent packet is held so the final packet can be marked
+			std::vector<unsigned char>											mPacket;
+			std::vector<unsigned char>											mHeldPacket;
+			long																mHeldPacketLength;
+			ogg_int64_t															mHeldGranulePosition;
+		};
+
+	}
+}
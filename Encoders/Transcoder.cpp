@@ -0,0 +1,585 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <thread>
+
+#include <sys/stat.h>
+
+#include <dispatch/dispatch.h>
+
+#include "Transcoder.h"
+#include "AudioBufferList.h"
+#include "AudioConverter.h"
+#include "AudioRingBuffer.h"
+#include "CFErrorUtilities.h"
+#include "Logger.h"
+#include "Semaphore.h"
+
+// The number of frames moved between stages at once
+#define TRANSCODER_CHUNK_FRAMES			4096
+// The capacity of the ring buffers connecting the stages
+#define TRANSCODER_BUFFER_FRAMES		(16 * TRANSCODER_CHUNK_FRAMES)
+// How long a blocked stage waits before checking whether the transcode was cancelled
+#define TRANSCODER_WAIT_NSEC			(10 * NSEC_PER_MSEC)
+// Each job occupies three threads from the shared pool
+#define MAX_CONCURRENT_JOBS				16
+
+namespace {
+
+	// A ring buffer connecting two stages of the pipeline
+	struct Pipe
+	{
+		Pipe() : mFinished(false) {}
+
+		SFB::Audio::RingBuffer	mBuffer;
+		SFB::Semaphore			mReadable;		// Signaled when audio is written or mFinished is set
+		SFB::Semaphore			mWritable;		// Signaled when audio is read
+		std::atomic_bool		mFinished;		// Set when the writer won't write more audio
+	};
+
+	struct TranscodeContext
+	{
+		TranscodeContext() : mCancelled(false) {}
+
+		// Record the first error and stop all stages
+		void Fail(CFErrorRef error)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mErrorMutex);
+				if(!mError && error)
+					mError = SFB::CFError((CFErrorRef)CFRetain(error));
+			}
+
+			mCancelled = true;
+			mDecoded.mWritable.Signal();
+			mDecoded.mReadable.Signal();
+			mConverted.mWritable.Signal();
+			mConverted.mReadable.Signal();
+		}
+
+		Pipe					mDecoded;		// Audio from the decoder
+		Pipe					mConverted;		// Audio in the encoder's format
+		std::atomic_bool		mCancelled;
+
+		std::mutex				mErrorMutex;
+		SFB::CFError			mError;
+	};
+
+	CFErrorRef CreateTranscodeError(CFURLRef url) CF_RETURNS_RETAINED
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be written."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Encoding error"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The disk may be full or the file may not be writable."), ""));
+
+		return CreateErrorForURL(SFB::Audio::Encoder::ErrorDomain, SFB::Audio::Encoder::InputOutputError, description, url, failureReason, recoverySuggestion);
+	}
+
+	// Write frameCount frames to pipe, blocking until space is available; returns false if cancelled
+	bool WriteToPipe(Pipe& pipe, const std::atomic_bool& cancelled, const AudioBufferList *bufferList, UInt32 frameCount)
+	{
+		while(pipe.mBuffer.GetFramesAvailableToWrite() < frameCount) {
+			if(cancelled)
+				return false;
+			pipe.mWritable.TimedWait(dispatch_time(DISPATCH_TIME_NOW, TRANSCODER_WAIT_NSEC));
+		}
+
+		if(cancelled)
+			return false;
+
+		pipe.mBuffer.WriteAudio(bufferList, frameCount);
+		pipe.mReadable.Signal();
+
+		return true;
+	}
+
+	// Read up to frameCount frames from pipe, blocking until audio is available; returns 0 when finished or cancelled
+	UInt32 ReadFromPipe(Pipe& pipe, const std::atomic_bool& cancelled, AudioBufferList *bufferList, UInt32 frameCount)
+	{
+		for(;;) {
+			if(cancelled)
+				return 0;
+
+			// mFinished must be tested before the available frames to avoid missing a final write
+			bool finished = pipe.mFinished;
+			size_t framesAvailable = pipe.mBuffer.GetFramesAvailableToRead();
+			if(0 < framesAvailable) {
+				UInt32 framesRead = (UInt32)pipe.mBuffer.ReadAudio(bufferList, std::min((size_t)frameCount, framesAvailable));
+				pipe.mWritable.Signal();
+				return framesRead;
+			}
+
+			if(finished)
+				return 0;
+
+			pipe.mReadable.TimedWait(dispatch_time(DISPATCH_TIME_NOW, TRANSCODER_WAIT_NSEC));
+		}
+	}
+
+	// A Decoder providing the audio in a Pipe, allowing a Converter to consume another thread's decoded audio
+	class PipeDecoder : public SFB::Audio::Decoder
+	{
+
+	public:
+
+		PipeDecoder(const SFB::Audio::Decoder& decoder, Pipe& pipe, const std::atomic_bool& cancelled)
+			: mDecoder(decoder), mPipe(pipe), mCancelled(cancelled), mTotalFrames(decoder.GetTotalFrames()), mCurrentFrame(0)
+		{}
+
+	private:
+
+		// Source access
+		inline virtual CFURLRef _GetURL() const						{ return mDecoder.GetURL(); }
+		inline virtual SFB::InputSource& _GetInputSource() const	{ return mDecoder.GetInputSource(); }
+
+		// Audio access
+		virtual bool _Open(CFErrorRef */*error*/)
+		{
+			mFormat = mDecoder.GetFormat();
+			mChannelLayout = mDecoder.GetChannelLayout();
+			mSourceFormat = mDecoder.GetSourceFormat();
+			return true;
+		}
+
+		virtual bool _Close(CFErrorRef */*error*/)					{ return true; }
+
+		// The native format of the source audio
+		virtual SFB::CFString _GetSourceFormatDescription() const	{ return SFB::CFString(mDecoder.CreateSourceFormatDescription()); }
+
+		virtual UInt32 _ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+		{
+			UInt32 framesRead = ReadFromPipe(mPipe, mCancelled, bufferList, frameCount);
+			mCurrentFrame += framesRead;
+			return framesRead;
+		}
+
+		// Source audio information
+		inline virtual SInt64 _GetTotalFrames() const				{ return mTotalFrames; }
+		inline virtual SInt64 _GetCurrentFrame() const				{ return mCurrentFrame; }
+
+		const SFB::Audio::Decoder&	mDecoder;
+		Pipe&						mPipe;
+		const std::atomic_bool&		mCancelled;
+		SInt64						mTotalFrames;
+		SInt64						mCurrentFrame;
+	};
+
+	// Stage 1: decode into context.mDecoded
+	void DecodeStage(SFB::Audio::Decoder& decoder, TranscodeContext& context)
+	{
+		SFB::Audio::BufferList buffer(decoder.GetFormat(), TRANSCODER_CHUNK_FRAMES);
+		if(!buffer) {
+			SFB::CFError error(CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr));
+			context.Fail(error);
+			return;
+		}
+
+		while(!context.mCancelled) {
+			buffer.Reset();
+			UInt32 framesRead = decoder.ReadAudio(buffer, TRANSCODER_CHUNK_FRAMES);
+			if(0 == framesRead)
+				break;
+
+			if(!WriteToPipe(context.mDecoded, context.mCancelled, buffer, framesRead))
+				break;
+		}
+
+		context.mDecoded.mFinished = true;
+		context.mDecoded.mReadable.Signal();
+	}
+
+	// Stage 2: convert context.mDecoded to the encoder's format in context.mConverted
+	void ConvertStage(const SFB::Audio::Decoder& decoder, const SFB::Audio::Encoder& encoder, TranscodeContext& context)
+	{
+		SFB::Audio::Decoder::unique_ptr pipeDecoder(new PipeDecoder(decoder, context.mDecoded, context.mCancelled));
+		SFB::Audio::Converter converter(std::move(pipeDecoder), encoder.GetFormat(), encoder.GetChannelLayout());
+
+		SFB::CFError error;
+		if(!converter.Open(&error)) {
+			context.Fail(error);
+			return;
+		}
+
+		converter.SetBlockSize(TRANSCODER_CHUNK_FRAMES);
+
+		SFB::Audio::BufferList buffer(encoder.GetFormat(), TRANSCODER_CHUNK_FRAMES);
+		if(!buffer) {
+			error = SFB::CFError(CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr));
+			context.Fail(error);
+			return;
+		}
+
+		while(!context.mCancelled) {
+			buffer.Reset();
+			UInt32 framesConverted = converter.ConvertAudio(buffer, TRANSCODER_CHUNK_FRAMES);
+			if(0 == framesConverted)
+				break;
+
+			if(!WriteToPipe(context.mConverted, context.mCancelled, buffer, framesConverted))
+				break;
+		}
+
+		converter.Close();
+
+		context.mConverted.mFinished = true;
+		context.mConverted.mReadable.Signal();
+	}
+
+	// Stage 3: encode context.mConverted
+	void EncodeStage(SFB::Audio::Encoder& encoder, TranscodeContext& context)
+	{
+		SFB::Audio::BufferList buffer(encoder.GetFormat(), TRANSCODER_CHUNK_FRAMES);
+		if(!buffer) {
+			SFB::CFError error(CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr));
+			context.Fail(error);
+			return;
+		}
+
+		for(;;) {
+			buffer.Reset();
+			UInt32 framesRead = ReadFromPipe(context.mConverted, context.mCancelled, buffer, TRANSCODER_CHUNK_FRAMES);
+			if(0 == framesRead)
+				break;
+
+			if(!encoder.WriteAudio(buffer, framesRead)) {
+				SFB::CFError error(CreateTranscodeError(encoder.GetURL()));
+				context.Fail(error);
+				break;
+			}
+		}
+	}
+
+}
+
+#pragma mark Synchronous Transcoding
+
+bool SFB::Audio::Transcoder::Transcode(Decoder::unique_ptr decoder, Encoder::unique_ptr encoder, Statistics *statistics, CFErrorRef *error)
+{
+	if(!decoder || !encoder || encoder->IsOpen()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Transcoder", "Transcode() called with invalid parameters");
+		return false;
+	}
+
+	CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+
+	if(!decoder->IsOpen() && !decoder->Open(error))
+		return false;
+
+	if(!decoder->GetFormat().IsPCM()) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Transcoder", "Transcoding is only supported for decoders providing PCM");
+
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The format of the file “%@” is not supported."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("File Format Not Supported"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's format is not supported for transcoding."), ""));
+
+			*error = CreateErrorForURL(Decoder::ErrorDomain, Decoder::FileFormatNotSupportedError, description, decoder->GetURL(), failureReason, recoverySuggestion);
+		}
+
+		return false;
+	}
+
+	if(!encoder->Open(decoder->GetFormat(), decoder->GetChannelLayout(), error))
+		return false;
+
+	TranscodeContext context;
+	if(!context.mDecoded.mBuffer.Allocate(decoder->GetFormat(), TRANSCODER_BUFFER_FRAMES) || !context.mConverted.mBuffer.Allocate(encoder->GetFormat(), TRANSCODER_BUFFER_FRAMES)) {
+		encoder->Close();
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
+		return false;
+	}
+
+	// Decoding and conversion run on the shared thread pool while the calling thread encodes
+	Decoder *decoderPtr = decoder.get();
+	Encoder *encoderPtr = encoder.get();
+	TranscodeContext *contextPtr = &context;
+
+	dispatch_group_t group = dispatch_group_create();
+	dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+
+	dispatch_group_async(group, queue, ^{
+		DecodeStage(*decoderPtr, *contextPtr);
+	});
+
+	dispatch_group_async(group, queue, ^{
+		ConvertStage(*decoderPtr, *encoderPtr, *contextPtr);
+	});
+
+	EncodeStage(*encoder, context);
+
+	dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+	dispatch_release(group);
+
+	SFB::CFError closeError;
+	bool result = !context.mError && !context.mCancelled;
+	if(!encoder->Close(&closeError) && result) {
+		result = false;
+		context.mError = closeError;
+	}
+
+	CFTimeInterval elapsedTime = CFAbsoluteTimeGetCurrent() - startTime;
+	SInt64 framesTranscoded = encoder->GetFramesWritten();
+
+	if(statistics) {
+		statistics->mFramesTranscoded	= framesTranscoded;
+		statistics->mElapsedTime		= elapsedTime;
+		statistics->mFramesPerSecond	= 0 < elapsedTime ? framesTranscoded / elapsedTime : 0;
+		statistics->mRealTimeFactor		= 0 < elapsedTime ? (framesTranscoded / encoder->GetFormat().mSampleRate) / elapsedTime : 0;
+	}
+
+	if(!result) {
+		if(error)
+			*error = context.mError ? (CFErrorRef)CFRetain(context.mError) : CreateTranscodeError(encoder->GetURL());
+
+		return false;
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Transcoder", "Transcoded " << framesTranscoded << " frames in " << elapsedTime << " seconds");
+
+	return true;
+}
+
+bool SFB::Audio::Transcoder::TranscodeURL(CFURLRef inputURL, CFURLRef outputURL, Statistics *statistics, CFErrorRef *error)
+{
+	if(nullptr == inputURL || nullptr == outputURL)
+		return false;
+
+	auto decoder = Decoder::CreateForURL(inputURL, error);
+	if(!decoder)
+		return false;
+
+	auto encoder = Encoder::CreateForURL(outputURL, error);
+	if(!encoder)
+		return false;
+
+	return Transcode(std::move(decoder), std::move(encoder), statistics, error);
+}
+
+bool SFB::Audio::Transcoder::TranscodeCueSheet(const CueSheet& cueSheet, const EncoderFactory& createEncoder, Statistics *statistics, CFErrorRef *error)
+{
+	if(!createEncoder)
+		return false;
+
+	CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+
+	auto decoders = cueSheet.CreateTrackDecoders(error);
+	if(decoders.empty())
+		return false;
+
+	SInt64 framesTranscoded = 0;
+	Float64 secondsTranscoded = 0;
+
+	const auto& tracks = cueSheet.GetTracks();
+	for(size_t i = 0; i < tracks.size(); ++i) {
+		auto encoder = createEncoder(tracks[i]);
+		if(!encoder)
+			continue;
+
+		Statistics trackStatistics;
+		if(!Transcode(std::move(decoders[i]), std::move(encoder), &trackStatistics, error))
+			return false;
+
+		framesTranscoded += trackStatistics.mFramesTranscoded;
+		secondsTranscoded += trackStatistics.mRealTimeFactor * trackStatistics.mElapsedTime;
+	}
+
+	CFTimeInterval elapsedTime = CFAbsoluteTimeGetCurrent() - startTime;
+
+	if(statistics) {
+		statistics->mFramesTranscoded	= framesTranscoded;
+		statistics->mElapsedTime		= elapsedTime;
+		statistics->mFramesPerSecond	= 0 < elapsedTime ? framesTranscoded / elapsedTime : 0;
+		statistics->mRealTimeFactor		= 0 < elapsedTime ? secondsTranscoded / elapsedTime : 0;
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Transcoder", "Transcoded " << tracks.size() << " tracks in " << elapsedTime << " seconds");
+
+	return true;
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::Transcoder::Transcoder(size_t maximumConcurrentJobs, size_t maximumJobsPerDevice)
+	: mMaximumConcurrentJobs(maximumConcurrentJobs), mMaximumJobsPerDevice(maximumJobsPerDevice), mActiveJobs(0), mProgress(), mStartTime(0), mTotalBytes(0), mCompletedBytes(0)
+{
+	if(0 == mMaximumConcurrentJobs)
+		mMaximumConcurrentJobs = std::max(1u, std::thread::hardware_concurrency());
+	mMaximumConcurrentJobs = std::min(mMaximumConcurrentJobs, (size_t)MAX_CONCURRENT_JOBS);
+}
+
+SFB::Audio::Transcoder::~Transcoder()
+{
+	WaitUntilFinished();
+}
+
+#pragma mark Queued Transcoding
+
+void SFB::Audio::Transcoder::SetProgressHandler(const ProgressHandler& handler)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mProgressHandler = handler;
+}
+
+void SFB::Audio::Transcoder::EnqueueTranscode(CFURLRef inputURL, CFURLRef outputURL, const CompletionHandler& handler)
+{
+	if(nullptr == inputURL || nullptr == outputURL) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Transcoder", "EnqueueTranscode() called with invalid parameters");
+		return;
+	}
+
+	std::unique_ptr<Job> job(new Job{ SFB::CFURL((CFURLRef)CFRetain(inputURL)), SFB::CFURL((CFURLRef)CFRetain(outputURL)), handler, 0, 0, nullptr, false, false });
+
+	// Jobs are throttled by the device holding their input; URLs without a local path share a single device
+	char path [PATH_MAX];
+	struct stat filestats;
+	if(CFURLGetFileSystemRepresentation(inputURL, FALSE, (UInt8 *)path, PATH_MAX) && 0 == stat(path, &filestats)) {
+		job->mDevice = filestats.st_dev;
+		job->mSize = filestats.st_size;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	// Progress is measured from the first job queued while idle
+	if(0 == mActiveJobs && mJobs.empty()) {
+		mProgress = {};
+		mStartTime = CFAbsoluteTimeGetCurrent();
+		mTotalBytes = 0;
+		mCompletedBytes = 0;
+	}
+
+	++mProgress.mTotalJobs;
+	mTotalBytes += job->mSize;
+
+	mJobs.push_back(std::move(job));
+	StartJobs();
+}
+
+void SFB::Audio::Transcoder::WaitUntilFinished()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mJobFinished.wait(lock, [this] { return 0 == mActiveJobs && mJobs.empty(); });
+}
+
+void SFB::Audio::Transcoder::StartJobs()
+{
+	// Jobs are started in order, skipping those whose device is busy or whose input is being opened
+	for(auto iter = mJobs.begin(); iter != mJobs.end() && mActiveJobs < mMaximumConcurrentJobs; ) {
+		if((*iter)->mPrefetching || (0 != mMaximumJobsPerDevice && mMaximumJobsPerDevice <= mActiveJobsPerDevice[(*iter)->mDevice])) {
+			++iter;
+			continue;
+		}
+
+		Job *job = iter->release();
+		iter = mJobs.erase(iter);
+
+		++mActiveJobs;
+		++mActiveJobsPerDevice[job->mDevice];
+
+		dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+			// Overlap opening the next job's input with this job's processing
+			PrefetchJob();
+
+			RunJob(*job);
+
+			std::unique_lock<std::mutex> lock(mMutex);
+
+			if(0 == --mActiveJobsPerDevice[job->mDevice])
+				mActiveJobsPerDevice.erase(job->mDevice);
+
+			mCompletedBytes += job->mSize;
+			CFTimeInterval elapsedTime = CFAbsoluteTimeGetCurrent() - mStartTime;
+			mProgress.mElapsedTime = elapsedTime;
+
+			// Estimate the time remaining from the bytes processed if sizes are known, otherwise from the jobs completed
+			if(0 < mCompletedBytes && mCompletedBytes <= mTotalBytes)
+				mProgress.mEstimatedTimeRemaining = elapsedTime * (double)(mTotalBytes - mCompletedBytes) / (double)mCompletedBytes;
+			else if(0 < mProgress.mCompletedJobs)
+				mProgress.mEstimatedTimeRemaining = elapsedTime * (double)(mProgress.mTotalJobs - mProgress.mCompletedJobs) / (double)mProgress.mCompletedJobs;
+			else
+				mProgress.mEstimatedTimeRemaining = -1;
+
+			Progress progress = mProgress;
+			ProgressHandler progressHandler = mProgressHandler;
+
+			delete job;
+
+			// The device is free for other jobs while the progress handler runs
+			StartJobs();
+
+			lock.unlock();
+
+			if(progressHandler)
+				progressHandler(progress);
+
+			// The job remains active until its handlers have run so waiters don't return early
+			lock.lock();
+			--mActiveJobs;
+			StartJobs();
+			mJobFinished.notify_all();
+		});
+	}
+}
+
+void SFB::Audio::Transcoder::PrefetchJob()
+{
+	Job *job = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for(auto& queuedJob : mJobs) {
+			if(!queuedJob->mPrefetched) {
+				job = queuedJob.get();
+				job->mPrefetched = true;
+				job->mPrefetching = true;
+				break;
+			}
+		}
+	}
+
+	if(!job)
+		return;
+
+	// Reading ahead starts when the input source is opened
+	InputSource::unique_ptr inputSource = InputSource::CreateForURL(job->mInputURL, InputSource::ReadFilesAhead);
+	if(inputSource && !inputSource->Open())
+		inputSource.reset();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	job->mInputSource = std::move(inputSource);
+	job->mPrefetching = false;
+	StartJobs();
+}
+
+void SFB::Audio::Transcoder::RunJob(Job& job)
+{
+	Statistics statistics = {};
+	SFB::CFError error;
+	bool result = false;
+
+	Decoder::unique_ptr decoder = job.mInputSource ? Decoder::CreateForInputSource(std::move(job.mInputSource), &error) : Decoder::CreateForURL(job.mInputURL, &error);
+	if(decoder) {
+		Encoder::unique_ptr encoder = Encoder::CreateForURL(job.mOutputURL, &error);
+		if(encoder)
+			result = Transcode(std::move(decoder), std::move(encoder), &statistics, &error);
+	}
+
+	if(!result)
+		LOGGER_ERR("org.sbooth.AudioEngine.Transcoder", "Error transcoding " << job.mInputURL << ": " << error);
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		++mProgress.mCompletedJobs;
+		if(!result)
+			++mProgress.mFailedJobs;
+		mProgress.mFramesTranscoded += statistics.mFramesTranscoded;
+	}
+
+	if(job.mHandler)
+		job.mHandler(job.mInputURL, job.mOutputURL, statistics, result ? nullptr : (CFErrorRef)error);
+}
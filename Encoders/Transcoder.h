@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <sys/types.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "AudioDecoder.h"
+#include "AudioEncoder.h"
+#include "CFWrapper.h"
+#include "CueSheet.h"
+
+/*! @file Transcoder.h @brief Pipelined, multi-core transcoding */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief Transcodes audio from a \c Decoder to an \c Encoder
+		 *
+		 * Transcoding is split into three stages connected by ring buffers: decoding, conversion to the encoder's
+		 * format, and encoding.  Each stage runs on its own thread so a transcode keeps up to three cores busy.
+		 *
+		 * A \c Transcoder object runs many transcodes concurrently.  Jobs are queued and started as others complete,
+		 * with their stages scheduled on the system's shared thread pool.  The number of jobs reading from the same
+		 * storage device is limited so disks aren't saturated, and the input of the next queued job is opened and
+		 * read ahead while earlier jobs are running so I/O overlaps computation.
+		 */
+		class Transcoder
+		{
+
+		public:
+
+			/*! @brief Transcoding statistics */
+			struct Statistics
+			{
+				SInt64 mFramesTranscoded;		/*!< @brief The number of frames encoded */
+				CFTimeInterval mElapsedTime;	/*!< @brief The wall clock time taken, in seconds */
+				double mFramesPerSecond;		/*!< @brief The transcoding throughput */
+				double mRealTimeFactor;			/*!< @brief The duration of the audio divided by the elapsed time */
+			};
+
+			/*!
+			 * @brief A block called when a queued transcode completes
+			 * @param inputURL The URL of the decoded file
+			 * @param outputURL The URL of the encoded file
+			 * @param statistics Transcoding statistics
+			 * @param error \c nullptr on success, otherwise the reason the transcode failed
+			 */
+			using CompletionHandler = std::function<void(CFURLRef inputURL, CFURLRef outputURL, const Statistics& statistics, CFErrorRef error)>;
+
+			/*! @brief The progress of the queued transcodes */
+			struct Progress
+			{
+				size_t mTotalJobs;							/*!< @brief The number of jobs queued since the \c Transcoder was last idle */
+				size_t mCompletedJobs;						/*!< @brief The number of jobs completed, including failures */
+				size_t mFailedJobs;							/*!< @brief The number of jobs that failed */
+				SInt64 mFramesTranscoded;					/*!< @brief The number of frames encoded by completed jobs */
+				CFTimeInterval mElapsedTime;				/*!< @brief The wall clock time since the first job was queued, in seconds */
+				CFTimeInterval mEstimatedTimeRemaining;		/*!< @brief The estimated time until all jobs complete, in seconds, or \c -1 if unknown */
+			};
+
+			/*!
+			 * @brief A block called with the progress of the queued transcodes each time a job completes
+			 * @note The block is called after the job's \c CompletionHandler
+			 */
+			using ProgressHandler = std::function<void(const Progress& progress)>;
+
+			/*! @brief The default maximum number of concurrent jobs reading from a single storage device */
+			static const size_t DefaultMaximumJobsPerDevice = 4;
+
+			// ========================================
+			/*! @name Synchronous transcoding */
+			//@{
+
+			/*!
+			 * @brief Transcode all audio from \c decoder to \c encoder
+			 * @note \c decoder is opened if necessary and \c encoder must not be open
+			 * @param decoder The decoder providing the audio
+			 * @param encoder The encoder receiving the audio
+			 * @param statistics An optional pointer to a \c Statistics struct to receive transcoding statistics
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			static bool Transcode(Decoder::unique_ptr decoder, Encoder::unique_ptr encoder, Statistics *statistics = nullptr, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Transcode \c inputURL to \c outputURL, using \c outputURL's path extension to choose the encoder
+			 * @param inputURL The URL to decode
+			 * @param outputURL The URL to create
+			 * @param statistics An optional pointer to a \c Statistics struct to receive transcoding statistics
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			static bool TranscodeURL(CFURLRef inputURL, CFURLRef outputURL, Statistics *statistics = nullptr, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief A block returning the encoder for a track, or \c nullptr to skip the track
+			 * @param track The track to be encoded
+			 */
+			using EncoderFactory = std::function<Encoder::unique_ptr(const CueSheet::Track& track)>;
+
+			/*!
+			 * @brief Transcode each track in \c cueSheet to the encoder returned by \c createEncoder
+			 *
+			 * The tracks in each file are read in order from a single decoder, so an album image is decoded once,
+			 * sequentially, with every track ending exactly where the next begins.
+			 * @param cueSheet The cue sheet describing the tracks
+			 * @param createEncoder A block returning the encoder for each track
+			 * @param statistics An optional pointer to a \c Statistics struct to receive the combined transcoding statistics
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			static bool TranscodeCueSheet(const CueSheet& cueSheet, const EncoderFactory& createEncoder, Statistics *statistics = nullptr, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*!
+			 * @brief Create a new \c Transcoder
+			 * @param maximumConcurrentJobs The maximum number of transcodes to run at once, or \c 0 for the number of processors
+			 * @param maximumJobsPerDevice The maximum number of transcodes reading from a single storage device at once, or \c 0 for no limit
+			 */
+			explicit Transcoder(size_t maximumConcurrentJobs = 0, size_t maximumJobsPerDevice = DefaultMaximumJobsPerDevice);
+
+			/*! @brief Wait for all queued transcodes to complete and destroy this \c Transcoder */
+			~Transcoder();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			Transcoder(const Transcoder& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			Transcoder& operator=(const Transcoder& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			// ========================================
+			/*! @name Queued transcoding */
+			//@{
+
+			/*! @brief Get the maximum number of transcodes run at once */
+			inline size_t GetMaximumConcurrentJobs() const				{ return mMaximumConcurrentJobs; }
+
+			/*! @brief Get the maximum number of transcodes reading from a single storage device at once, or \c 0 for no limit */
+			inline size_t GetMaximumJobsPerDevice() const				{ return mMaximumJobsPerDevice; }
+
+			/*!
+			 * @brief Set the block called with the progress of the queued transcodes
+			 * @note \c handler is called on an arbitrary thread
+			 */
+			void SetProgressHandler(const ProgressHandler& handler);
+
+			/*!
+			 * @brief Queue a transcode of \c inputURL to \c outputURL
+			 * @note \c handler is called on an arbitrary thread
+			 * @param inputURL The URL to decode
+			 * @param outputURL The URL to create
+			 * @param handler An optional block to call when the transcode completes
+			 */
+			void EnqueueTranscode(CFURLRef inputURL, CFURLRef outputURL, const CompletionHandler& handler = nullptr);
+
+			/*! @brief Block until all queued transcodes have completed */
+			void WaitUntilFinished();
+
+			//@}
+
+		private:
+
+			struct Job
+			{
+				SFB::CFURL mInputURL;
+				SFB::CFURL mOutputURL;
+				CompletionHandler mHandler;
+				dev_t mDevice;							// The storage device containing mInputURL
+				SInt64 mSize;							// The size of mInputURL in bytes, or 0 if unknown
+				InputSource::unique_ptr mInputSource;	// The prefetched input, or nullptr
+				bool mPrefetching;						// True while mInputSource is being opened
+				bool mPrefetched;						// True once prefetching was attempted
+			};
+
+			// Start queued jobs while below the concurrency limits; mMutex must be held
+			void StartJobs();
+
+			// Open and read ahead the input of the first queued job not already prefetched
+			void PrefetchJob();
+
+			// Run job
+			void RunJob(Job& job);
+
+			size_t									mMaximumConcurrentJobs;
+			size_t									mMaximumJobsPerDevice;
+			size_t									mActiveJobs;
+			std::map<dev_t, size_t>					mActiveJobsPerDevice;
+			std::deque<std::unique_ptr<Job>>		mJobs;
+			std::mutex								mMutex;
+			std::condition_variable					mJobFinished;
+
+			// Progress tracking
+			ProgressHandler							mProgressHandler;
+			Progress								mProgress;
+			CFAbsoluteTime							mStartTime;
+			SInt64									mTotalBytes;
+			SInt64									mCompletedBytes;
+		};
+
+	}
+}
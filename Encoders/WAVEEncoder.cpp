@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+#include <AudioToolbox/AudioFormat.h>
+
+#include "WAVEEncoder.h"
+#include "CFErrorUtilities.h"
+#include "Logger.h"
+
+namespace {
+
+	void RegisterWAVEEncoder() __attribute__ ((constructor));
+	void RegisterWAVEEncoder()
+	{
+		SFB::Audio::Encoder::RegisterSubclass<SFB::Audio::WAVEEncoder>();
+	}
+
+	// WAVE format tags
+	const uint16_t kWAVEFormatPCM			= 0x0001;
+	const uint16_t kWAVEFormatIEEEFloat		= 0x0003;
+	const uint16_t kWAVEFormatExtensible	= 0xFFFE;
+
+	// The remainder of the KSDATAFORMAT_SUBTYPE GUIDs following the format tag
+	const uint8_t kWAVESubformatGUIDSuffix [] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+
+	CFStringRef sSupportedExtensions [] = { CFSTR("wav"), CFSTR("wave") };
+	CFStringRef sSupportedMIMETypes [] = { CFSTR("audio/wav"), CFSTR("audio/wave"), CFSTR("audio/x-wav") };
+
+	void AppendUInt16(std::vector<uint8_t>& data, uint16_t value)
+	{
+		data.push_back((uint8_t)value);
+		data.push_back((uint8_t)(value >> 8));
+	}
+
+	void AppendUInt32(std::vector<uint8_t>& data, uint32_t value)
+	{
+		for(int i = 0; i < 32; i += 8)
+			data.push_back((uint8_t)(value >> i));
+	}
+
+	bool WriteUInt32(FILE *file, long offset, uint32_t value)
+	{
+		uint8_t bytes [4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+		return 0 == fseek(file, offset, SEEK_SET) && 1 == fwrite(bytes, sizeof(bytes), 1, file);
+	}
+
+	// Determine the WAVE channel mask, which uses the same bits as a Core Audio channel bitmap
+	uint32_t GetChannelMask(const SFB::Audio::ChannelLayout& channelLayout)
+	{
+		if(!channelLayout)
+			return 0;
+
+		const AudioChannelLayout *layout = channelLayout.GetACL();
+		if(kAudioChannelLayoutTag_UseChannelBitmap == layout->mChannelLayoutTag)
+			return layout->mChannelBitmap;
+
+		if(kAudioChannelLayoutTag_UseChannelDescriptions == layout->mChannelLayoutTag)
+			return 0;
+
+		UInt32 bitmap = 0;
+		UInt32 dataSize = sizeof(bitmap);
+		AudioChannelLayoutTag tag = layout->mChannelLayoutTag;
+		if(noErr != AudioFormatGetProperty(kAudioFormatProperty_BitmapForLayoutTag, sizeof(tag), &tag, &dataSize, &bitmap))
+			return 0;
+
+		return bitmap;
+	}
+
+	CFErrorRef CreateWriteError(CFURLRef url) CF_RETURNS_RETAINED
+	{
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be written."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The disk may be full or the file may not be writable."), ""));
+
+		return CreateErrorForURL(SFB::Audio::Encoder::ErrorDomain, SFB::Audio::Encoder::InputOutputError, description, url, failureReason, recoverySuggestion);
+	}
+
+}
+
+#pragma mark Static Methods
+
+CFArrayRef SFB::Audio::WAVEEncoder::CreateSupportedFileExtensions()
+{
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)sSupportedExtensions, sizeof(sSupportedExtensions) / sizeof(sSupportedExtensions[0]), &kCFTypeArrayCallBacks);
+}
+
+CFArrayRef SFB::Audio::WAVEEncoder::CreateSupportedMIMETypes()
+{
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)sSupportedMIMETypes, sizeof(sSupportedMIMETypes) / sizeof(sSupportedMIMETypes[0]), &kCFTypeArrayCallBacks);
+}
+
+bool SFB::Audio::WAVEEncoder::HandlesFilesWithExtension(CFStringRef extension)
+{
+	if(nullptr == extension)
+		return false;
+
+	for(auto supportedExtension : sSupportedExtensions) {
+		if(kCFCompareEqualTo == CFStringCompare(extension, supportedExtension, kCFCompareCaseInsensitive))
+			return true;
+	}
+
+	return false;
+}
+
+bool SFB::Audio::WAVEEncoder::HandlesMIMEType(CFStringRef mimeType)
+{
+	if(nullptr == mimeType)
+		return false;
+
+	for(auto supportedMIMEType : sSupportedMIMETypes) {
+		if(kCFCompareEqualTo == CFStringCompare(mimeType, supportedMIMEType, kCFCompareCaseInsensitive))
+			return true;
+	}
+
+	return false;
+}
+
+SFB::Audio::Encoder::unique_ptr SFB::Audio::WAVEEncoder::CreateEncoder(CFURLRef url)
+{
+	return unique_ptr(new WAVEEncoder(url));
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::WAVEEncoder::WAVEEncoder(CFURLRef url)
+	: Encoder(url), mFile(nullptr, fclose), mDataSizeOffset(0), mDataSize(0)
+{}
+
+SFB::Audio::WAVEEncoder::~WAVEEncoder()
+{
+	if(IsOpen())
+		Close();
+}
+
+#pragma mark Functionality
+
+bool SFB::Audio::WAVEEncoder::_Open(CFErrorRef *error)
+{
+	// Floating point audio is written as 32-bit floats and integer audio in the smallest container holding its samples
+	bool isFloat = kAudioFormatFlagIsFloat & mSourceFormat.mFormatFlags;
+	UInt32 bitsPerChannel = 32;
+	if(!isFloat) {
+		if(16 >= mSourceFormat.mBitsPerChannel)
+			bitsPerChannel = 16;
+		else if(24 >= mSourceFormat.mBitsPerChannel)
+			bitsPerChannel = 24;
+	}
+
+	// WAVE files are little-endian
+	mFormat.mFormatID			= kAudioFormatLinearPCM;
+	mFormat.mFormatFlags		= (isFloat ? kAudioFormatFlagIsFloat : kAudioFormatFlagIsSignedInteger) | kAudioFormatFlagIsPacked;
+
+	mFormat.mSampleRate			= mSourceFormat.mSampleRate;
+	mFormat.mChannelsPerFrame	= mSourceFormat.mChannelsPerFrame;
+	mFormat.mBitsPerChannel		= bitsPerChannel;
+
+	mFormat.mBytesPerPacket		= (bitsPerChannel / 8) * mFormat.mChannelsPerFrame;
+	mFormat.mFramesPerPacket	= 1;
+	mFormat.mBytesPerFrame		= mFormat.mBytesPerPacket * mFormat.mFramesPerPacket;
+
+	mFormat.mReserved			= 0;
+
+	char path [PATH_MAX];
+	if(!CFURLGetFileSystemRepresentation(mURL, FALSE, (UInt8 *)path, PATH_MAX)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.WAVE", "CFURLGetFileSystemRepresentation failed");
+
+		if(error)
+			*error = CreateWriteError(mURL);
+
+		return false;
+	}
+
+	mFile.reset(fopen(path, "wb"));
+	if(!mFile) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.WAVE", "Unable to create " << path << ": " << strerror(errno));
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+
+		return false;
+	}
+
+	mDataSize = 0;
+
+	if(!WriteHeader()) {
+		mFile.reset();
+
+		if(error)
+			*error = CreateWriteError(mURL);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool SFB::Audio::WAVEEncoder::_Close(CFErrorRef *error)
+{
+	bool result = true;
+
+	// Chunks are padded to an even size
+	if(mDataSize & 1)
+		result = 1 == fwrite("", 1, 1, mFile.get());
+
+	long riffSize = mDataSizeOffset + 4 + (long)((mDataSize + 1) & ~1ull) - 8;
+	if(result)
+		result = WriteUInt32(mFile.get(), 4, (uint32_t)riffSize) && WriteUInt32(mFile.get(), mDataSizeOffset, (uint32_t)mDataSize);
+
+	if(0 != fclose(mFile.release()))
+		result = false;
+
+	if(!result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.WAVE", "Unable to finish writing the file");
+
+		if(error)
+			*error = CreateWriteError(mURL);
+	}
+
+	return result;
+}
+
+bool SFB::Audio::WAVEEncoder::_WriteAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(1 != bufferList->mNumberBuffers) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Encoder.WAVE", "_WriteAudio() called with invalid parameters");
+		return false;
+	}
+
+	size_t byteCount = frameCount * mFormat.mBytesPerFrame;
+
+	// The chunk sizes are 32 bits
+	if(UINT32_MAX - (UInt64)mDataSizeOffset - 4 < mDataSize + byteCount) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.WAVE", "The audio exceeds the maximum size of a WAVE file");
+		return false;
+	}
+
+	if(1 != fwrite(bufferList->mBuffers[0].mData, byteCount, 1, mFile.get())) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Encoder.WAVE", "fwrite failed: " << strerror(errno));
+		return false;
+	}
+
+	mDataSize += byteCount;
+	return true;
+}
+
+bool SFB::Audio::WAVEEncoder::WriteHeader()
+{
+	bool isFloat = kAudioFormatFlagIsFloat & mFormat.mFormatFlags;
+	bool isExtensible = 2 < mFormat.mChannelsPerFrame || 16 < mFormat.mBitsPerChannel;
+	uint16_t formatTag = isFloat ? kWAVEFormatIEEEFloat : kWAVEFormatPCM;
+
+	std::vector<uint8_t> header;
+	header.insert(header.end(), { 'R', 'I', 'F', 'F' });
+	AppendUInt32(header, 0);
+	header.insert(header.end(), { 'W', 'A', 'V', 'E' });
+
+	header.insert(header.end(), { 'f', 'm', 't', ' ' });
+	AppendUInt32(header, isExtensible ? 40 : 16);
+	AppendUInt16(header, isExtensible ? kWAVEFormatExtensible : formatTag);
+	AppendUInt16(header, (uint16_t)mFormat.mChannelsPerFrame);
+	AppendUInt32(header, (uint32_t)mFormat.mSampleRate);
+	AppendUInt32(header, (uint32_t)mFormat.mSampleRate * mFormat.mBytesPerFrame);
+	AppendUInt16(header, (uint16_t)mFormat.mBytesPerFrame);
+	AppendUInt16(header, (uint16_t)mFormat.mBitsPerChannel);
+
+	if(isExtensible) {
+		AppendUInt16(header, 22);
+		AppendUInt16(header, (uint16_t)std::min(mFormat.mBitsPerChannel, mSourceFormat.mBitsPerChannel));
+		AppendUInt32(header, GetChannelMask(mChannelLayout));
+		AppendUInt16(header, formatTag);
+		header.insert(header.end(), std::begin(kWAVESubformatGUIDSuffix), std::end(kWAVESubformatGUIDSuffix));
+	}
+
+	header.insert(header.end(), { 'd', 'a', 't', 'a' });
+	mDataSizeOffset = (long)header.size();
+	AppendUInt32(header, 0);
+
+	return 1 == fwrite(header.data(), header.size(), 1, mFile.get());
+}
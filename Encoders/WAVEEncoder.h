@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <cstdio>
+
+#include "AudioEncoder.h"
+
+namespace SFB {
+
+	namespace Audio {
+
+		// ========================================
+		// An Encoder subclass writing uncompressed PCM to WAVE files
+		//
+		// Integer audio is written with 16, 24 or 32 bits per sample and floating point audio
+		// as 32-bit floats.  WAVE_FORMAT_EXTENSIBLE is used for more than two channels or more
+		// than 16 bits per sample, and the chunk sizes are written when the encoder is closed
+		// ========================================
+		class WAVEEncoder : public Encoder
+		{
+
+		public:
+
+			// Data types handled by this class
+			static CFArrayRef CreateSupportedFileExtensions();
+			static CFArrayRef CreateSupportedMIMETypes();
+
+			static bool HandlesFilesWithExtension(CFStringRef extension);
+			static bool HandlesMIMEType(CFStringRef mimeType);
+
+			static Encoder::unique_ptr CreateEncoder(CFURLRef url);
+
+			// Creation and destruction
+			explicit WAVEEncoder(CFURLRef url);
+			virtual ~WAVEEncoder();
+
+		private:
+
+			// File access
+			virtual bool _Open(CFErrorRef *error);
+			virtual bool _Close(CFErrorRef *error);
+
+			// Encode frameCount frames of audio
+			virtual bool _WriteAudio(const AudioBufferList *bufferList, UInt32 frameCount);
+
+			// Write the RIFF, fmt and data chunk headers
+			bool WriteHeader();
+
+			std::unique_ptr<FILE, int(*)(FILE *)>	mFile;
+			long									mDataSizeOffset;	// The offset of the data chunk's size
+			UInt64									mDataSize;			// The number of bytes of audio written
+		};
+
+	}
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <stdexcept>
+
+#include "Event.h"
+#include "Logger.h"
+
+SFB::Event::Event()
+	: mState(0), mSemaphore(nullptr)
+{
+	mSemaphore = dispatch_semaphore_create(0);
+
+	if(nullptr == mSemaphore) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Event", "dispatch_semaphore_create failed");
+		throw std::runtime_error("Unable to create the semaphore");
+	}
+}
+
+SFB::Event::~Event()
+{
+	dispatch_release(mSemaphore);
+	mSemaphore = nullptr;
+}
+
+bool SFB::Event::Signal()
+{
+	auto state = mState.load(std::memory_order_relaxed);
+	for(;;) {
+		// Signals are coalesced
+		if(1 == state)
+			return false;
+
+		// Release one blocked thread, or become signaled if none are blocked
+		if(mState.compare_exchange_weak(state, 0 > state ? state + 1 : 1, std::memory_order_release, std::memory_order_relaxed))
+			break;
+	}
+
+	if(0 > state) {
+		dispatch_semaphore_signal(mSemaphore);
+		return true;
+	}
+
+	return false;
+}
+
+bool SFB::Event::Wait()
+{
+	return TimedWait(DISPATCH_TIME_FOREVER);
+}
+
+bool SFB::Event::TimedWait(dispatch_time_t duration)
+{
+	// Consume the signal if the event is signaled, otherwise register as a blocked thread
+	if(1 == mState.fetch_sub(1, std::memory_order_acquire))
+		return true;
+
+	if(!dispatch_semaphore_wait(mSemaphore, duration))
+		return true;
+
+	// The wait timed out, so unregister unless a signal already released this thread
+	auto state = mState.load(std::memory_order_relaxed);
+	while(0 > state) {
+		if(mState.compare_exchange_weak(state, state + 1, std::memory_order_relaxed, std::memory_order_relaxed))
+			return false;
+	}
+
+	// A racing Signal() counted this thread as released, so its semaphore signal must be consumed
+	dispatch_semaphore_wait(mSemaphore, DISPATCH_TIME_FOREVER);
+	return true;
+}
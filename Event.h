@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <atomic>
+
+#include <dispatch/dispatch.h>
+
+/*! @file Event.h @brief An auto-reset event with a lock-free fast path */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*!
+	 * @brief An auto-reset event
+	 *
+	 * An event is either signaled or not.  Signaling an event that is already signaled has no effect, so a thread
+	 * signaling repeatedly while the waiting thread is busy causes at most one extra wakeup.  A successful wait
+	 * resets the event.
+	 *
+	 * The event's state is kept in an atomic and the underlying libdispatch semaphore is used only when a thread
+	 * is blocked, so \c Signal() is lock-free and doesn't enter the kernel unless it wakes a thread.  This makes
+	 * \c Signal() safe to call from a real-time thread.
+	 */
+	class Event
+	{
+	public:
+		/*!
+		 * @brief Create a new \c Event that is not signaled
+		 * @throws std::runtime_error
+		 */
+		Event();
+
+		/*! @brief Destroy this \c Event */
+		~Event();
+
+		/*! @cond */
+
+		/*! @internal This class is non-copyable */
+		Event(const Event& rhs) = delete;
+
+		/*! @internal This class is non-assignable */
+		Event& operator=(const Event& rhs) = delete;
+
+		/*! @endcond */
+
+		/*!
+		 * @brief Signal the \c Event, waking a blocked thread if there is one
+		 * @return \c true if a thread was woken, \c false otherwise
+		 */
+		bool Signal();
+
+		/*!
+		 * @brief Block the calling thread until the \c Event is signaled
+		 * @return \c true if successful, \c false if the timeout occurred
+		 */
+		bool Wait();
+
+		/*!
+		 * @brief Block the calling thread until the \c Event is signaled
+		 * @param duration The maximum duration to block
+		 * @return \c true if successful, \c false if the timeout occurred
+		 */
+		bool TimedWait(dispatch_time_t duration);
+
+	private:
+		std::atomic_int			mState;			/*!< \c 1 if signaled, otherwise the negated number of blocked threads */
+		dispatch_semaphore_t	mSemaphore;		/*!< The libdispatch semaphore used to block threads */
+	};
+
+}
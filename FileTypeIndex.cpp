@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "FileTypeIndex.h"
+
+namespace {
+
+	const SFB::FileTypeIndex::subclass_list sNoSubclasses;
+
+	// Convert key to lowercase UTF-8 in buffer, which must hold SFB::FileTypeIndex::MaximumKeyLength + 1 bytes
+	bool CopyLowercaseKey(CFStringRef key, char *buffer)
+	{
+		if(nullptr == key || !CFStringGetCString(key, buffer, SFB::FileTypeIndex::MaximumKeyLength + 1, kCFStringEncodingUTF8))
+			return false;
+
+		for(char *c = buffer; *c; ++c) {
+			if('A' <= *c && 'Z' >= *c)
+				*c += 'a' - 'A';
+		}
+
+		return true;
+	}
+
+	bool CopyLowercaseKey(const char *key, char *buffer)
+	{
+		if(nullptr == key)
+			return false;
+
+		size_t length = strlen(key);
+		if(SFB::FileTypeIndex::MaximumKeyLength < length)
+			return false;
+
+		for(size_t i = 0; i <= length; ++i)
+			buffer[i] = ('A' <= key[i] && 'Z' >= key[i]) ? key[i] + ('a' - 'A') : key[i];
+
+		return true;
+	}
+
+}
+
+SFB::FileTypeIndex::FileTypeIndex()
+	: mFileExtensions(CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks)), mMIMETypes(CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks)), mSubclassCount(0)
+{}
+
+void SFB::FileTypeIndex::AddSubclass(CFArrayRef fileExtensions, CFArrayRef mimeTypes)
+{
+	size_t subclassIndex = mSubclassCount++;
+
+	if(fileExtensions) {
+		CFArrayAppendArray(mFileExtensions, fileExtensions, CFRangeMake(0, CFArrayGetCount(fileExtensions)));
+		AddKeys(mFileExtensionSubclasses, fileExtensions, subclassIndex);
+	}
+
+	if(mimeTypes) {
+		CFArrayAppendArray(mMIMETypes, mimeTypes, CFRangeMake(0, CFArrayGetCount(mimeTypes)));
+		AddKeys(mMIMETypeSubclasses, mimeTypes, subclassIndex);
+	}
+}
+
+const SFB::FileTypeIndex::subclass_list& SFB::FileTypeIndex::GetSubclassesForFileExtension(CFStringRef extension) const
+{
+	return Find(mFileExtensionSubclasses, extension);
+}
+
+const SFB::FileTypeIndex::subclass_list& SFB::FileTypeIndex::GetSubclassesForFileExtension(const char *extension) const
+{
+	return Find(mFileExtensionSubclasses, extension);
+}
+
+const SFB::FileTypeIndex::subclass_list& SFB::FileTypeIndex::GetSubclassesForMIMEType(CFStringRef mimeType) const
+{
+	return Find(mMIMETypeSubclasses, mimeType);
+}
+
+const SFB::FileTypeIndex::subclass_list& SFB::FileTypeIndex::GetSubclassesForMIMEType(const char *mimeType) const
+{
+	return Find(mMIMETypeSubclasses, mimeType);
+}
+
+void SFB::FileTypeIndex::AddKeys(key_map& map, CFArrayRef keys, size_t subclassIndex)
+{
+	char buffer [MaximumKeyLength + 1];
+	for(CFIndex i = 0; i < CFArrayGetCount(keys); ++i) {
+		CFStringRef key = (CFStringRef)CFArrayGetValueAtIndex(keys, i);
+		if(nullptr == key || CFStringGetTypeID() != CFGetTypeID(key) || !CopyLowercaseKey(key, buffer))
+			continue;
+
+		// Subclasses may list a key more than once
+		auto& subclasses = map[buffer];
+		if(subclasses.empty() || subclasses.back() != subclassIndex)
+			subclasses.push_back(subclassIndex);
+	}
+}
+
+const SFB::FileTypeIndex::subclass_list& SFB::FileTypeIndex::Find(const key_map& map, CFStringRef key)
+{
+	char buffer [MaximumKeyLength + 1];
+	if(!CopyLowercaseKey(key, buffer))
+		return sNoSubclasses;
+
+	auto iter = map.find(buffer);
+	return iter == map.end() ? sNoSubclasses : iter->second;
+}
+
+const SFB::FileTypeIndex::subclass_list& SFB::FileTypeIndex::Find(const key_map& map, const char *key)
+{
+	char buffer [MaximumKeyLength + 1];
+	if(!CopyLowercaseKey(key, buffer))
+		return sNoSubclasses;
+
+	auto iter = map.find(buffer);
+	return iter == map.end() ? sNoSubclasses : iter->second;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "CFWrapper.h"
+
+/*! @file FileTypeIndex.h @brief An index of the file extensions and MIME types handled by registered subclasses */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*!
+	 * @brief An index from file extensions and MIME types to the subclasses handling them
+	 *
+	 * Keys are compared ignoring ASCII case.  Lookup keys are converted on the stack, so lookups of keys short
+	 * enough for \c std::string's inline storage, such as file extensions, don't allocate memory.
+	 */
+	class FileTypeIndex
+	{
+
+	public:
+
+		/*! @brief A \c std::shared_ptr for immutable \c FileTypeIndex objects */
+		using shared_ptr = std::shared_ptr<const FileTypeIndex>;
+
+		/*! @brief Indexes into the registered subclasses, in priority order */
+		using subclass_list = std::vector<size_t>;
+
+		/*! @brief The length in bytes of the longest key that may be found */
+		static const size_t MaximumKeyLength = 128;
+
+		/*!
+		 * @brief A lazily built index of a class's registered subclasses
+		 *
+		 * The index is built on first use rather than at registration so subclasses needn't query their
+		 * libraries at launch, and is rebuilt if subclasses are registered afterwards.
+		 */
+		class Cache
+		{
+
+		public:
+
+			/*!
+			 * @brief Get the index for the given subclasses
+			 * @tparam SubclassInfo A type with \c mCreateSupportedFileExtensions and \c mCreateSupportedMIMETypes members
+			 */
+			template <typename SubclassInfo>
+			shared_ptr GetIndex(const std::vector<SubclassInfo>& subclasses)
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+
+				if(!mIndex || mIndex->GetSubclassCount() != subclasses.size()) {
+					auto index = std::make_shared<FileTypeIndex>();
+					for(const auto& subclassInfo : subclasses) {
+						SFB::CFArray fileExtensions(subclassInfo.mCreateSupportedFileExtensions());
+						SFB::CFArray mimeTypes(subclassInfo.mCreateSupportedMIMETypes());
+						index->AddSubclass(fileExtensions, mimeTypes);
+					}
+
+					mIndex = index;
+				}
+
+				return mIndex;
+			}
+
+		private:
+
+			std::mutex		mMutex;
+			shared_ptr		mIndex;
+		};
+
+
+		/*! @brief Create an empty \c FileTypeIndex */
+		FileTypeIndex();
+
+		/*! @cond */
+
+		/*! @internal This class is non-copyable */
+		FileTypeIndex(const FileTypeIndex& rhs) = delete;
+
+		/*! @internal This class is non-assignable */
+		FileTypeIndex& operator=(const FileTypeIndex& rhs) = delete;
+
+		/*! @endcond */
+
+		/*!
+		 * @brief Add the next subclass
+		 * @param fileExtensions The file extensions handled by the subclass
+		 * @param mimeTypes The MIME types handled by the subclass
+		 */
+		void AddSubclass(CFArrayRef fileExtensions, CFArrayRef mimeTypes);
+
+		/*! @brief Get the number of subclasses in the index */
+		inline size_t GetSubclassCount() const									{ return mSubclassCount; }
+
+		/*! @brief Get the subclasses handling a file extension */
+		const subclass_list& GetSubclassesForFileExtension(CFStringRef extension) const;
+
+		/*! @brief Get the subclasses handling a file extension in UTF-8 */
+		const subclass_list& GetSubclassesForFileExtension(const char *extension) const;
+
+		/*! @brief Get the subclasses handling a MIME type */
+		const subclass_list& GetSubclassesForMIMEType(CFStringRef mimeType) const;
+
+		/*! @brief Get the subclasses handling a MIME type in UTF-8 */
+		const subclass_list& GetSubclassesForMIMEType(const char *mimeType) const;
+
+		/*! @brief Get every subclass's file extensions */
+		inline CFArrayRef GetFileExtensions() const								{ return mFileExtensions; }
+
+		/*! @brief Get every subclass's MIME types */
+		inline CFArrayRef GetMIMETypes() const									{ return mMIMETypes; }
+
+	private:
+
+		using key_map = std::unordered_map<std::string, subclass_list>;
+
+		static void AddKeys(key_map& map, CFArrayRef keys, size_t subclassIndex);
+		static const subclass_list& Find(const key_map& map, CFStringRef key);
+		static const subclass_list& Find(const key_map& map, const char *key);
+
+		key_map					mFileExtensionSubclasses;
+		key_map					mMIMETypeSubclasses;
+		SFB::CFMutableArray		mFileExtensions;
+		SFB::CFMutableArray		mMIMETypes;
+		size_t					mSubclassCount;
+	};
+
+}
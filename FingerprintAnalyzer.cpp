@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <Accelerate/Accelerate.h>
+#include <AudioToolbox/AudioFormat.h>
+
+#include "FingerprintAnalyzer.h"
+#include "AudioBufferList.h"
+#include "AudioConverter.h"
+#include "AudioDecoder.h"
+#include "AudioResampler.h"
+#include "Logger.h"
+
+#define ANALYSIS_SAMPLE_RATE		11025.		/* Hz */
+#define FRAME_LENGTH_LOG2			12			/* 4096 samples, about 370 ms */
+#define FRAME_LENGTH				(1u << FRAME_LENGTH_LOG2)
+#define FRAME_HOP					128			/* 31/32 overlap, about 11.6 ms */
+#define BAND_COUNT					33			/* Adjacent bands form the 32 bits of a sub-fingerprint */
+#define LOWEST_FREQUENCY			300.		/* Hz */
+#define HIGHEST_FREQUENCY			2000.		/* Hz */
+#define DEFAULT_MAXIMUM_DURATION	120.		/* seconds */
+#define BUFFER_SIZE_FRAMES			4096
+
+namespace {
+
+	AudioStreamBasicDescription GetAnalysisFormat(Float64 sampleRate, UInt32 channelCount)
+	{
+		AudioStreamBasicDescription format = {
+			.mFormatID				= kAudioFormatLinearPCM,
+			.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved,
+			.mReserved				= 0,
+			.mSampleRate			= sampleRate,
+			.mChannelsPerFrame		= channelCount,
+			.mBitsPerChannel		= 32,
+			.mBytesPerPacket		= 4,
+			.mBytesPerFrame			= 4,
+			.mFramesPerPacket		= 1
+		};
+
+		return format;
+	}
+
+	bool IsAnalysisFormat(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && format.IsNativeEndian() && (1 == format.mChannelsPerFrame || !format.IsInterleaved());
+	}
+
+}
+
+class SFB::Audio::FingerprintAnalyzer::FingerprintAnalyzerPrivate
+{
+public:
+	FFTSetup				fftSetup;
+	std::vector<float>		window;						/* Hann window */
+	std::vector<float>		windowed;
+	std::vector<float>		real;
+	std::vector<float>		imag;
+	std::vector<float>		power;						/* squared magnitude of each FFT bin */
+	UInt32					bandEdges [BAND_COUNT + 1];	/* the first FFT bin of each band */
+	float					previousDifferences [BAND_COUNT - 1];
+	bool					havePreviousFrame;
+
+	AudioConverterRef		converter;					/* converts audio not in the analysis format */
+	BufferList				convertedBuffer;
+	std::vector<float>		mono;						/* the downmixed audio at the decoder's sample rate */
+	std::unique_ptr<Resampler>	resampler;				/* converts audio not at the analysis sample rate */
+	BufferList				resampledBuffer;
+	UInt32					channelCount;
+
+	std::vector<float>		samples;					/* analysis samples not yet consumed by a complete frame */
+	SInt64					samplesAnalyzed;
+	SInt64					maximumSamples;				/* 0 for no limit */
+
+	std::vector<uint32_t>	fingerprint;
+
+	FingerprintAnalyzerPrivate()
+		: fftSetup(nullptr), window(FRAME_LENGTH), windowed(FRAME_LENGTH), real(FRAME_LENGTH / 2), imag(FRAME_LENGTH / 2), power(FRAME_LENGTH / 2), havePreviousFrame(false), converter(nullptr), channelCount(0), samplesAnalyzed(0), maximumSamples(0)
+	{
+		fftSetup = vDSP_create_fftsetup(FRAME_LENGTH_LOG2, kFFTRadix2);
+		if(!fftSetup)
+			LOGGER_ERR("org.sbooth.AudioEngine.FingerprintAnalyzer", "vDSP_create_fftsetup failed");
+
+		vDSP_hann_window(window.data(), FRAME_LENGTH, vDSP_HANN_NORM);
+
+		// The bands are spaced logarithmically, and are at least one bin wide
+		for(UInt32 i = 0; i <= BAND_COUNT; ++i) {
+			double frequency = LOWEST_FREQUENCY * std::pow(HIGHEST_FREQUENCY / LOWEST_FREQUENCY, (double)i / BAND_COUNT);
+			bandEdges[i] = (UInt32)std::lround(frequency * FRAME_LENGTH / ANALYSIS_SAMPLE_RATE);
+			if(0 < i && bandEdges[i] <= bandEdges[i - 1])
+				bandEdges[i] = bandEdges[i - 1] + 1;
+		}
+
+		SetMaximumDuration(DEFAULT_MAXIMUM_DURATION);
+	}
+
+	~FingerprintAnalyzerPrivate()
+	{
+		if(fftSetup)
+			vDSP_destroy_fftsetup(fftSetup);
+		DisposeConverter();
+	}
+
+	void SetMaximumDuration(double maximumDuration)
+	{
+		maximumSamples = 0 < maximumDuration ? (SInt64)std::llround(maximumDuration * ANALYSIS_SAMPLE_RATE) : 0;
+	}
+
+	bool IsFinished() const
+	{
+		return 0 < maximumSamples && samplesAnalyzed >= maximumSamples;
+	}
+
+	void DisposeConverter()
+	{
+		if(converter) {
+			auto result = AudioConverterDispose(converter);
+			if(noErr != result)
+				LOGGER_ERR("org.sbooth.AudioEngine.FingerprintAnalyzer", "AudioConverterDispose failed: " << result);
+			converter = nullptr;
+		}
+
+		convertedBuffer.Deallocate();
+		resampler.reset();
+		resampledBuffer.Deallocate();
+		channelCount = 0;
+	}
+
+	// Prepare to analyze a track in format
+	bool BeginTrack(const AudioFormat& format)
+	{
+		DisposeConverter();
+
+		fingerprint.clear();
+		samples.clear();
+		samplesAnalyzed = 0;
+		havePreviousFrame = false;
+
+		if(!fftSetup || !format.IsPCM() || 0 == format.mChannelsPerFrame || 0 >= format.mSampleRate)
+			return false;
+
+		// Audio in other formats is converted, at the same sample rate, before downmixing
+		if(!IsAnalysisFormat(format)) {
+			auto analysisFormat = GetAnalysisFormat(format.mSampleRate, format.mChannelsPerFrame);
+			auto result = AudioConverterNew(&format, &analysisFormat, &converter);
+			if(noErr != result) {
+				LOGGER_ERR("org.sbooth.AudioEngine.FingerprintAnalyzer", "AudioConverterNew failed: " << result);
+				converter = nullptr;
+				return false;
+			}
+
+			if(!convertedBuffer.Allocate(analysisFormat, BUFFER_SIZE_FRAMES)) {
+				DisposeConverter();
+				return false;
+			}
+		}
+
+		// Only the bands below 2 KHz are used, so the fastest filter is sufficient
+		if(ANALYSIS_SAMPLE_RATE != format.mSampleRate) {
+			resampler.reset(new Resampler);
+			if(!resampler->Configure(format.mSampleRate, ANALYSIS_SAMPLE_RATE, 1, Resampler::Quality::Low) || !resampledBuffer.Allocate(GetAnalysisFormat(ANALYSIS_SAMPLE_RATE, 1), BUFFER_SIZE_FRAMES)) {
+				DisposeConverter();
+				return false;
+			}
+		}
+
+		channelCount = format.mChannelsPerFrame;
+
+		return true;
+	}
+
+	void AnalyzeAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+	{
+		if(0 == channelCount || 0 == frameCount || IsFinished())
+			return;
+
+		if(converter) {
+			if(convertedBuffer.GetCapacityFrames() < frameCount) {
+				AudioFormat analysisFormat = convertedBuffer.GetFormat();
+				if(!convertedBuffer.Allocate(analysisFormat, frameCount))
+					return;
+			}
+
+			for(UInt32 i = 0; i < convertedBuffer->mNumberBuffers; ++i)
+				convertedBuffer->mBuffers[i].mDataByteSize = frameCount * sizeof(float);
+
+			auto result = AudioConverterConvertComplexBuffer(converter, frameCount, bufferList, convertedBuffer);
+			if(noErr != result) {
+				LOGGER_ERR("org.sbooth.AudioEngine.FingerprintAnalyzer", "AudioConverterConvertComplexBuffer failed: " << result);
+				return;
+			}
+
+			bufferList = convertedBuffer;
+		}
+
+		// Downmix to the mean of all channels
+		const float *downmixed = (const float *)bufferList->mBuffers[0].mData;
+		if(1 < channelCount) {
+			if(mono.size() < frameCount)
+				mono.resize(frameCount);
+
+			memcpy(mono.data(), downmixed, frameCount * sizeof(float));
+			for(UInt32 channel = 1; channel < channelCount; ++channel)
+				vDSP_vadd(mono.data(), 1, (const float *)bufferList->mBuffers[channel].mData, 1, mono.data(), 1, frameCount);
+
+			float scale = 1.f / channelCount;
+			vDSP_vsmul(mono.data(), 1, &scale, mono.data(), 1, frameCount);
+
+			downmixed = mono.data();
+		}
+
+		if(!resampler) {
+			AppendSamples(downmixed, frameCount);
+			return;
+		}
+
+		AudioBufferList monoBufferList;
+		monoBufferList.mNumberBuffers = 1;
+		monoBufferList.mBuffers[0].mNumberChannels = 1;
+		monoBufferList.mBuffers[0].mDataByteSize = frameCount * sizeof(float);
+		monoBufferList.mBuffers[0].mData = (void *)downmixed;
+
+		if(resampler->AppendInput(&monoBufferList, frameCount))
+			AppendResampledSamples();
+	}
+
+	void FinishTrack()
+	{
+		if(resampler && !IsFinished()) {
+			resampler->Finish();
+			AppendResampledSamples();
+		}
+
+		// A partial frame at the end of the audio is discarded
+		samples.clear();
+		DisposeConverter();
+	}
+
+	void AppendResampledSamples()
+	{
+		while(!IsFinished()) {
+			resampledBuffer.Reset();
+			UInt32 frameCount = resampler->Render(resampledBuffer, 0, resampledBuffer.GetCapacityFrames());
+			if(0 == frameCount)
+				break;
+
+			AppendSamples((const float *)resampledBuffer->mBuffers[0].mData, frameCount);
+		}
+	}
+
+	// Append samples at the analysis sample rate and compute the sub-fingerprints of each complete frame
+	void AppendSamples(const float *input, UInt32 count)
+	{
+		if(0 < maximumSamples)
+			count = (UInt32)std::min((SInt64)count, maximumSamples - samplesAnalyzed);
+		if(0 == count)
+			return;
+
+		samples.insert(samples.end(), input, input + count);
+		samplesAnalyzed += count;
+
+		size_t position = 0;
+		for(; position + FRAME_LENGTH <= samples.size(); position += FRAME_HOP)
+			AnalyzeFrame(samples.data() + position);
+
+		samples.erase(samples.begin(), samples.begin() + (std::vector<float>::difference_type)position);
+	}
+
+	void AnalyzeFrame(const float *frame)
+	{
+		vDSP_vmul(frame, 1, window.data(), 1, windowed.data(), 1, FRAME_LENGTH);
+
+		// The real FFT operates on the even and odd samples packed as complex values
+		DSPSplitComplex split = { real.data(), imag.data() };
+		vDSP_ctoz((const DSPComplex *)windowed.data(), 2, &split, 1, FRAME_LENGTH / 2);
+		vDSP_fft_zrip(fftSetup, &split, 1, FRAME_LENGTH_LOG2, kFFTDirection_Forward);
+
+		// The bands are well above DC, so the Nyquist value packed in imag[0] is irrelevant
+		vDSP_zvmags(&split, 1, power.data(), 1, FRAME_LENGTH / 2);
+
+		float energies [BAND_COUNT];
+		for(UInt32 band = 0; band < BAND_COUNT; ++band)
+			vDSP_sve(power.data() + bandEdges[band], 1, energies + band, bandEdges[band + 1] - bandEdges[band]);
+
+		float differences [BAND_COUNT - 1];
+		vDSP_vsub(energies + 1, 1, energies, 1, differences, 1, BAND_COUNT - 1);
+
+		if(havePreviousFrame) {
+			uint32_t subfingerprint = 0;
+			for(UInt32 bit = 0; bit < BAND_COUNT - 1; ++bit) {
+				if(differences[bit] - previousDifferences[bit] > 0)
+					subfingerprint |= 1u << bit;
+			}
+
+			fingerprint.push_back(subfingerprint);
+		}
+
+		memcpy(previousDifferences, differences, sizeof(differences));
+		havePreviousFrame = true;
+	}
+};
+
+double SFB::Audio::FingerprintAnalyzer::GetSubfingerprintInterval()
+{
+	return FRAME_HOP / ANALYSIS_SAMPLE_RATE;
+}
+
+double SFB::Audio::FingerprintAnalyzer::GetBitErrorRate(const std::vector<uint32_t>& lhs, const std::vector<uint32_t>& rhs)
+{
+	size_t count = std::min(lhs.size(), rhs.size());
+	if(0 == count)
+		return 1;
+
+	uint64_t differingBits = 0;
+	for(size_t i = 0; i < count; ++i)
+		differingBits += (uint64_t)__builtin_popcount(lhs[i] ^ rhs[i]);
+
+	return (double)differingBits / (32 * count);
+}
+
+SFB::Audio::FingerprintAnalyzer::FingerprintAnalyzer()
+	: priv(new FingerprintAnalyzerPrivate)
+{}
+
+// Empty destructor is required for unique_ptr with an incomplete type
+SFB::Audio::FingerprintAnalyzer::~FingerprintAnalyzer()
+{}
+
+double SFB::Audio::FingerprintAnalyzer::GetMaximumDuration() const
+{
+	return priv->maximumSamples / ANALYSIS_SAMPLE_RATE;
+}
+
+void SFB::Audio::FingerprintAnalyzer::SetMaximumDuration(double maximumDuration)
+{
+	priv->SetMaximumDuration(maximumDuration);
+}
+
+bool SFB::Audio::FingerprintAnalyzer::AnalyzeURL(CFURLRef url, CFErrorRef *error)
+{
+	// Decoding stops once the maximum duration has been analyzed
+	return AnalysisTap::AnalyzeURL(url, { this }, error);
+}
+
+bool SFB::Audio::FingerprintAnalyzer::DecodingStarted(const Decoder& decoder)
+{
+	return priv->BeginTrack(decoder.GetFormat());
+}
+
+void SFB::Audio::FingerprintAnalyzer::AnalyzeAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	priv->AnalyzeAudio(bufferList, frameCount);
+}
+
+bool SFB::Audio::FingerprintAnalyzer::IsFinished() const
+{
+	return priv->IsFinished();
+}
+
+void SFB::Audio::FingerprintAnalyzer::DecodingFinished(const Decoder& decoder, bool complete)
+{
+#pragma unused(decoder)
+#pragma unused(complete)
+
+	priv->FinishTrack();
+}
+
+const std::vector<uint32_t>& SFB::Audio::FingerprintAnalyzer::GetFingerprint() const
+{
+	return priv->fingerprint;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <memory>
+#include <vector>
+
+#include "AudioAnalysisTap.h"
+
+/*! @file FingerprintAnalyzer.h @brief Support for acoustic fingerprint calculation */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A class that calculates acoustic fingerprints
+		 *
+		 * Audio is downmixed to mono and resampled to 11.025 KHz.  Overlapping Hann-windowed frames of 4096 samples,
+		 * one every 128 samples, are transformed and the energies of 33 logarithmically spaced bands between 300 Hz
+		 * and 2 KHz compared.  Each bit of a frame's 32-bit sub-fingerprint is the sign of the change between
+		 * consecutive frames of the difference between adjacent bands' energies, after Haitsma and Kalker.
+		 * @see http://ismir2002.ismir.net/proceedings/02-FP04-2.pdf
+		 *
+		 * Only the beginning of the audio is analyzed unless \c SetMaximumDuration() is called with \c 0.
+		 *
+		 * A \c FingerprintAnalyzer may also be used as an analysis tap, for example with a \c ReplayGainAnalyzer and
+		 * a \c LoudnessAnalyzer in \c AnalysisTap::AnalyzeURL() so a file is decoded only once.
+		 */
+		class FingerprintAnalyzer : public AnalysisTap
+		{
+		public:
+
+			/*! @brief Get the time in seconds between consecutive sub-fingerprints */
+			static double GetSubfingerprintInterval();
+
+			/*!
+			 * @brief Compare two fingerprints
+			 *
+			 * Fingerprints of the same recording typically differ in fewer than 35% of their bits
+			 * @param lhs The first fingerprint
+			 * @param rhs The second fingerprint
+			 * @return The fraction of differing bits in the sub-fingerprints common to both, or \c 1 if there are none
+			 */
+			static double GetBitErrorRate(const std::vector<uint32_t>& lhs, const std::vector<uint32_t>& rhs);
+
+
+			// ========================================
+			/*! @name Creation/Destruction */
+			//@{
+
+			/*! @brief Create a new \c FingerprintAnalyzer */
+			FingerprintAnalyzer();
+
+			/*! @brief Destroy this \c FingerprintAnalyzer */
+			~FingerprintAnalyzer();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			FingerprintAnalyzer(const FingerprintAnalyzer& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			FingerprintAnalyzer& operator=(const FingerprintAnalyzer& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			// ========================================
+			/*! @name Configuration */
+			//@{
+
+			/*! @brief Get the duration of audio analyzed in seconds, or \c 0 for all audio */
+			double GetMaximumDuration() const;
+
+			/*!
+			 * @brief Set the duration of audio analyzed
+			 * @note The default is 120 seconds
+			 * @param maximumDuration The duration in seconds, or \c 0 to analyze all audio
+			 */
+			void SetMaximumDuration(double maximumDuration);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Audio analysis */
+			//@{
+
+			/*!
+			 * @brief Calculate the given URL's fingerprint
+			 * @param url The URL
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, false otherwise
+			 */
+			bool AnalyzeURL(CFURLRef url, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Analysis during decoding */
+			//@{
+
+			/*! @brief Begin analyzing a track using the decoder's format */
+			bool DecodingStarted(const Decoder& decoder) override;
+
+			/*! @brief Analyze audio in the format of the decoder passed to \c DecodingStarted() */
+			void AnalyzeAudio(const AudioBufferList *bufferList, UInt32 frameCount) override;
+
+			/*! @brief Query whether the maximum duration has been analyzed */
+			bool IsFinished() const override;
+
+			/*! @brief Finish analyzing the track so its fingerprint is available */
+			void DecodingFinished(const Decoder& decoder, bool complete) override;
+
+			//@}
+
+
+			// ========================================
+			/*! @name Fingerprint */
+			//@{
+
+			/*! @brief Get the track's fingerprint, one sub-fingerprint per \c GetSubfingerprintInterval() seconds */
+			const std::vector<uint32_t>& GetFingerprint() const;
+
+			//@}
+
+		private:
+			// The fingerprint internal state
+			class FingerprintAnalyzerPrivate;
+			std::unique_ptr<FingerprintAnalyzerPrivate> priv;
+		};
+
+	}
+}
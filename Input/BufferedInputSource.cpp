@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "BufferedInputSource.h"
+#include "Logger.h"
+
+#pragma mark Creation and Destruction
+
+SFB::BufferedInputSource::BufferedInputSource(InputSource::unique_ptr inputSource, SInt64 blockSize)
+	: InputSource(inputSource->GetURL()), mInputSource(std::move(inputSource)), mBlockSize(blockSize), mQueue(nullptr), mOffset(0), mLength(0), mSupportsSeeking(false), mSupportsPositionalReads(false), mInputOffset(0), mEndOffset(-1)
+{
+	assert(0 < mBlockSize);
+
+	for(auto& block : mBlocks) {
+		block.mOffset = -1;
+		block.mLength = 0;
+		block.mPending = false;
+	}
+}
+
+SFB::BufferedInputSource::~BufferedInputSource()
+{
+	if(IsOpen())
+		Close();
+}
+
+bool SFB::BufferedInputSource::_Open(CFErrorRef *error)
+{
+	if(!mInputSource->IsOpen() && !mInputSource->Open(error))
+		return false;
+
+	mQueue = dispatch_queue_create("org.sbooth.AudioEngine.InputSource.Buffered", DISPATCH_QUEUE_SERIAL);
+	if(nullptr == mQueue) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.InputSource", "dispatch_queue_create failed");
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
+		return false;
+	}
+
+	for(auto& block : mBlocks) {
+		block.mData = std::unique_ptr<uint8_t []>(new uint8_t [(size_t)mBlockSize]);
+		block.mOffset = -1;
+		block.mLength = 0;
+		block.mPending = false;
+	}
+
+	mOffset = mInputOffset = mInputSource->GetOffset();
+	mLength = mInputSource->GetLength();
+	mSupportsSeeking = mInputSource->SupportsSeeking();
+	mSupportsPositionalReads = mInputSource->SupportsPositionalReads();
+	mEndOffset = -1;
+
+	return true;
+}
+
+bool SFB::BufferedInputSource::_Close(CFErrorRef *error)
+{
+	// Wait for any read ahead to complete
+	dispatch_sync(mQueue, ^{});
+	dispatch_release(mQueue);
+	mQueue = nullptr;
+
+	for(auto& block : mBlocks) {
+		block.mData.reset();
+		block.mOffset = -1;
+		block.mPending = false;
+	}
+
+	return mInputSource->Close(error);
+}
+
+#pragma mark Functionality
+
+SInt64 SFB::BufferedInputSource::_Read(void *buffer, SInt64 byteCount)
+{
+	auto output = static_cast<uint8_t *>(buffer);
+	SInt64 bytesRead = 0;
+
+	while(bytesRead < byteCount) {
+		SInt64 bytesRemaining = byteCount - bytesRead;
+
+		// Reads of whole blocks not already buffered bypass the blocks
+		if(bytesRemaining >= mBlockSize && 0 == mOffset % mBlockSize) {
+			bool buffered = false;
+			for(const auto& block : mBlocks)
+				buffered |= (block.mOffset == mOffset);
+
+			if(!buffered) {
+				__block SInt64 inputBytesRead;
+				SInt64 inputBytesToRead = (bytesRemaining / mBlockSize) * mBlockSize;
+				dispatch_sync(mQueue, ^{
+					inputBytesRead = ReadFromInput(output + bytesRead, mOffset, inputBytesToRead);
+				});
+
+				if(0 < inputBytesRead) {
+					bytesRead += inputBytesRead;
+					mOffset += inputBytesRead;
+				}
+
+				if(inputBytesRead != inputBytesToRead)
+					break;
+
+				continue;
+			}
+		}
+
+		auto block = GetBlock(mOffset);
+		if(nullptr == block)
+			break;
+
+		SInt64 blockOffset = mOffset - block->mOffset;
+		SInt64 bytesToCopy = std::min(block->mLength - blockOffset, bytesRemaining);
+		if(0 >= bytesToCopy)
+			break;
+
+		memcpy(output + bytesRead, block->mData.get() + blockOffset, (size_t)bytesToCopy);
+		bytesRead += bytesToCopy;
+		mOffset += bytesToCopy;
+	}
+
+	return bytesRead;
+}
+
+bool SFB::BufferedInputSource::_AtEOF() const
+{
+	SInt64 endOffset = mEndOffset;
+	if(-1 != endOffset)
+		return mOffset >= endOffset;
+
+	return 0 < mLength && mOffset >= mLength;
+}
+
+SInt64 SFB::BufferedInputSource::_GetLength() const
+{
+	SInt64 endOffset = mEndOffset;
+	if(0 >= mLength && -1 != endOffset)
+		return endOffset;
+
+	return mLength;
+}
+
+bool SFB::BufferedInputSource::_SeekToOffset(SInt64 offset)
+{
+	if(0 < mLength && offset > mLength)
+		return false;
+
+	// The input is repositioned when the next block is read
+	mOffset = offset;
+	return true;
+}
+
+SFB::BufferedInputSource::Block * SFB::BufferedInputSource::GetBlock(SInt64 offset)
+{
+	SInt64 blockStart = offset - (offset % mBlockSize);
+
+	Block *block = nullptr;
+	for(auto& candidate : mBlocks) {
+		if(candidate.mOffset == blockStart) {
+			WaitForBlock(candidate);
+			block = &candidate;
+			break;
+		}
+	}
+
+	// Read the block synchronously, replacing a block other than one being read ahead
+	if(nullptr == block) {
+		block = mBlocks[0].mPending ? &mBlocks[1] : &mBlocks[0];
+		WaitForBlock(*block);
+
+		block->mOffset = blockStart;
+		dispatch_sync(mQueue, ^{
+			block->mLength = ReadFromInput(block->mData.get(), blockStart, mBlockSize);
+		});
+	}
+
+	if(0 >= block->mLength) {
+		block->mOffset = -1;
+		return nullptr;
+	}
+
+	// Read ahead the following block into the other buffer
+	Block *next = (block == &mBlocks[0]) ? &mBlocks[1] : &mBlocks[0];
+	SInt64 nextStart = blockStart + mBlockSize;
+	SInt64 endOffset = mEndOffset;
+
+	if(!next->mPending && next->mOffset != nextStart && block->mLength == mBlockSize && (-1 == endOffset || nextStart < endOffset) && (0 >= mLength || nextStart < mLength)) {
+		next->mOffset = nextStart;
+		next->mPending = true;
+		dispatch_async(mQueue, ^{
+			next->mLength = ReadFromInput(next->mData.get(), nextStart, mBlockSize);
+		});
+	}
+
+	return block;
+}
+
+void SFB::BufferedInputSource::WaitForBlock(Block& block)
+{
+	if(block.mPending) {
+		dispatch_sync(mQueue, ^{});
+		block.mPending = false;
+	}
+}
+
+SInt64 SFB::BufferedInputSource::_PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset)
+{
+	return mInputSource->ReadV(vectors, vectorCount, offset);
+}
+
+SInt64 SFB::BufferedInputSource::ReadFromInput(void *buffer, SInt64 offset, SInt64 count)
+{
+	if(offset != mInputOffset) {
+		if(!mSupportsSeeking || !mInputSource->SeekToOffset(offset)) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "Unable to reposition input to offset " << offset);
+			return -1;
+		}
+		mInputOffset = offset;
+	}
+
+	auto bytesRead = mInputSource->Read(buffer, count);
+	if(0 < bytesRead)
+		mInputOffset += bytesRead;
+
+	if(bytesRead < count && mInputSource->AtEOF())
+		mEndOffset = offset + std::max(bytesRead, (SInt64)0);
+
+	return bytesRead;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include <dispatch/dispatch.h>
+
+#include "InputSource.h"
+
+namespace SFB {
+
+	// ========================================
+	// InputSource reading another InputSource in blocks
+	//
+	// Small reads are served from one of two blocks while the block following the one being read
+	// is read ahead on a background queue.  Seeks within the buffered blocks require no input.
+	// All access to the wrapped InputSource takes place on the queue, except positional reads which
+	// the wrapped input performs without repositioning.
+	// ========================================
+	class BufferedInputSource : public InputSource
+	{
+
+	public:
+
+		// Creation
+		BufferedInputSource(InputSource::unique_ptr inputSource, SInt64 blockSize);
+		virtual ~BufferedInputSource();
+
+	private:
+
+		struct Block {
+			std::unique_ptr<uint8_t []>	mData;
+			SInt64						mOffset;		// The offset of the block in the input, or -1 if empty
+			SInt64						mLength;		// Valid only when no read is pending
+			bool						mPending;		// A read ahead is in progress
+		};
+
+		// Bytestream access
+		virtual bool _Open(CFErrorRef *error);
+		virtual bool _Close(CFErrorRef *error);
+
+		// Functionality
+		virtual SInt64 _Read(void *buffer, SInt64 byteCount);
+		virtual bool _AtEOF() const;
+
+		inline virtual SInt64 _GetOffset() const				{ return mOffset; }
+		virtual SInt64 _GetLength() const;
+
+		// Seeking support
+		inline virtual bool _SupportsSeeking() const			{ return mSupportsSeeking; }
+		virtual bool _SeekToOffset(SInt64 offset);
+
+		// Positional reads bypass the blocks and are forwarded to the wrapped input
+		inline virtual bool _SupportsPositionalReads() const	{ return mSupportsPositionalReads; }
+		virtual SInt64 _PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset);
+
+		// Return the block holding offset, reading it if necessary, or nullptr on error
+		Block * GetBlock(SInt64 offset);
+
+		// Wait for a pending read ahead into block to complete
+		void WaitForBlock(Block& block);
+
+		// Read count bytes at offset from the wrapped input; must be called on mQueue
+		SInt64 ReadFromInput(void *buffer, SInt64 offset, SInt64 count);
+
+		// Data members
+		InputSource::unique_ptr		mInputSource;
+		SInt64						mBlockSize;
+		Block						mBlocks [2];
+		dispatch_queue_t			mQueue;
+
+		SInt64						mOffset;
+		SInt64						mLength;
+		bool						mSupportsSeeking;
+		bool						mSupportsPositionalReads;
+
+		SInt64						mInputOffset;		// The offset of the wrapped input; accessed on mQueue
+		std::atomic<SInt64>			mEndOffset;			// The offset at which the input ended, or -1 if unknown
+	};
+
+}
@@ -3,10 +3,12 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
 
 #include "FileInputSource.h"
+#include "Logger.h"
 
 #pragma mark Creation and Destruction
 
@@ -54,3 +56,33 @@ bool SFB::FileInputSource::_Close(CFErrorRef *error)
 
 	return true;
 }
+
+SInt64 SFB::FileInputSource::_PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset)
+{
+	// preadv(2) isn't available on all supported systems, so each buffer is read separately.
+	// pread(2) doesn't use or change the file offset, so concurrent reads are safe
+	SInt64 bytesRead = 0;
+	for(int i = 0; i < vectorCount; ++i) {
+		auto buffer = static_cast<int8_t *>(vectors[i].iov_base);
+		size_t bufferBytesRead = 0;
+
+		while(bufferBytesRead < vectors[i].iov_len) {
+			ssize_t result = ::pread(::fileno(mFile.get()), buffer + bufferBytesRead, vectors[i].iov_len - bufferBytesRead, (off_t)(offset + bytesRead));
+			if(-1 == result) {
+				if(EINTR == errno)
+					continue;
+				LOGGER_ERR("org.sbooth.AudioEngine.InputSource.File", "pread failed: " << strerror(errno));
+				return 0 < bytesRead ? bytesRead : -1;
+			}
+
+			// End of file
+			if(0 == result)
+				return bytesRead;
+
+			bufferBytesRead += (size_t)result;
+			bytesRead += result;
+		}
+	}
+
+	return bytesRead;
+}
@@ -38,6 +38,10 @@ namespace SFB {
 		inline virtual bool _SupportsSeeking() const			{ return true; }
 		virtual bool _SeekToOffset(SInt64 offset)				{ return (0 == ::fseeko(mFile.get(), offset, SEEK_SET)); }
 
+		// Positional read support
+		inline virtual bool _SupportsPositionalReads() const	{ return true; }
+		virtual SInt64 _PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset);
+
 		using unique_FILE_ptr = std::unique_ptr<std::FILE, std::function<int(std::FILE *)>>;
 
 		// Data members
@@ -3,9 +3,41 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <Block.h>
+
 #include "HTTPInputSource.h"
 #include "Logger.h"
 
+// The maximum number of bytes read from the stream at once
+#define NETWORK_READ_SIZE (64 * 1024)
+
+// Forward seeks shorter than this read through the open stream rather than issuing a new request
+#define MAX_READ_THROUGH_BYTES (512 * 1024)
+
+// The amount downloaded ahead of the current offset when the consumption rate is unknown
+#define DEFAULT_PREFETCH_BYTES (4 * 1024 * 1024)
+#define MINIMUM_PREFETCH_BYTES (1024 * 1024)
+#define MAXIMUM_PREFETCH_BYTES (64 * 1024 * 1024)
+
+// The duration of input downloaded ahead, extended when the bandwidth is less than twice the consumption rate
+#define PREFETCH_SECONDS 15
+#define CONSTRAINED_PREFETCH_SECONDS 60
+
+// The interval over which the receive rate is sampled
+#define RATE_SAMPLE_SECONDS 0.5
+
+// The maximum time the network thread waits before checking for work
+#define IDLE_WAIT_SECONDS 0.5
+#define STREAM_WAIT_SECONDS 0.05
+
 // ========================================
 // CFNetwork callbacks
 // ========================================
@@ -19,6 +51,13 @@ namespace {
 		inputSource->HandleNetworkEvent(stream, type);
 	}
 
+	// Copy the value of the named header as a C string
+	bool GetHeaderValue(CFDictionaryRef headers, CFStringRef name, char *buf, CFIndex bufsize)
+	{
+		auto value = reinterpret_cast<CFStringRef>(CFDictionaryGetValue(headers, name));
+		return nullptr != value && CFStringGetCString(value, buf, bufsize, kCFStringEncodingASCII);
+	}
+
 }
 
 
@@ -26,33 +65,435 @@ namespace {
 
 
 SFB::HTTPInputSource::HTTPInputSource(CFURLRef url)
-	: InputSource(url), mRequest(nullptr), mReadStream(nullptr), mResponseHeaders(nullptr), mEOSReached(false), mOffset(-1), mDesiredOffset(0)
+	: InputSource(url), mRequest(nullptr), mReadStream(nullptr), mResponseStatusCode(0), mStreamAtEnd(false), mStreamFailed(false), mStreamOffset(0), mStreamEnd(-1), mRangesUnsupported(false), mRateSampleStart(0), mRateSampleBytes(0), mNetworkRunLoop(nullptr), mStopRequested(false), mResponseReceived(false), mNetworkFailed(false), mResponseHeaders(nullptr), mReceiveRate(0), mConsumptionRate(0), mReadAheadDuration(0), mReadabilityHandler(nullptr), mOffset(-1), mLength(-1), mCacheFile(-1)
 {}
 
 bool SFB::HTTPInputSource::_Open(CFErrorRef *error)
 {
-	// Set up the HTTP request
-	mRequest = CFHTTPMessageCreateRequest(kCFAllocatorDefault, CFSTR("GET"), GetURL(), kCFHTTPVersion1_1);
-	if(!mRequest) {
+	// The cache file is unlinked immediately so it is removed when closed
+	const char *tmpdir = getenv("TMPDIR");
+	char path [PATH_MAX];
+	snprintf(path, PATH_MAX, "%s/SFBAudioEngine.HTTP.XXXXXX", tmpdir ? tmpdir : "/tmp");
+
+	mCacheFile = mkstemp(path);
+	if(-1 == mCacheFile) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return false;
+	}
+
+	unlink(path);
+
+	mNetworkBuffer = std::unique_ptr<uint8_t []>(new uint8_t [NETWORK_READ_SIZE]);
+
+	mOffset = 0;
+	mLength = -1;
+	mStopRequested = false;
+	mResponseReceived = false;
+	mNetworkFailed = false;
+	mReceiveRate = 0;
+	mRangesUnsupported = false;
+	mRateSampleStart = 0;
+
+	try {
+		mNetworkThread = std::thread(&HTTPInputSource::NetworkThreadEntry, this);
+	}
+
+	catch(const std::exception& e) {
+		LOGGER_ERR("org.sbooth.AudioEngine.InputSource.HTTP", "Unable to create network thread: " << e.what());
+
+		close(mCacheFile);
+		mCacheFile = -1;
+
 		if(error)
 			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+
 		return false;
 	}
 
+	// The response headers are required to determine the length
+	bool responseReceived;
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mCondition.wait(lock, [this] { return mResponseReceived || mNetworkFailed; });
+		responseReceived = mResponseReceived;
+	}
+
+	if(!responseReceived) {
+		StopNetworkThread();
+
+		close(mCacheFile);
+		mCacheFile = -1;
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EIO, nullptr);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool SFB::HTTPInputSource::_Close(CFErrorRef */*error*/)
+{
+	StopNetworkThread();
+
+	if(-1 != mCacheFile) {
+		close(mCacheFile);
+		mCacheFile = -1;
+	}
+
+	mCachedRanges.clear();
+	mPendingReads.clear();
+	mResponseHeaders = nullptr;
+	mNetworkBuffer.reset();
+
+	_SetReadabilityHandler(nullptr);
+
+	mOffset = -1;
+	mLength = -1;
+
+	return true;
+}
+
+SInt64 SFB::HTTPInputSource::_Read(void *buffer, SInt64 byteCount)
+{
+	auto output = static_cast<uint8_t *>(buffer);
+	SInt64 bytesRead = 0;
+
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	while(bytesRead < byteCount) {
+		SInt64 length = mLength;
+		if(-1 != length && mOffset >= length)
+			break;
+
+		SInt64 cachedEnd = GetCachedRangeEnd(mOffset);
+		if(-1 == cachedEnd) {
+			if(mNetworkFailed) {
+				// The network thread retries once the failure has been reported
+				mNetworkFailed = false;
+				return 0 < bytesRead ? bytesRead : -1;
+			}
+
+			// Wait for the network thread to download the bytes at the current offset
+			WakeNetworkThread();
+			mCondition.wait(lock);
+			continue;
+		}
+
+		ssize_t bytesToRead = (ssize_t)std::min(cachedEnd - mOffset, byteCount - bytesRead);
+		ssize_t cachedBytesRead = pread(mCacheFile, output + bytesRead, (size_t)bytesToRead, mOffset);
+		if(0 >= cachedBytesRead) {
+			LOGGER_ERR("org.sbooth.AudioEngine.InputSource.HTTP", "Error reading cache: " << strerror(errno));
+			return 0 < bytesRead ? bytesRead : -1;
+		}
+
+		bytesRead += cachedBytesRead;
+		mOffset += cachedBytesRead;
+	}
+
+	// The read may have opened space in the prefetch window
+	WakeNetworkThread();
+
+	return bytesRead;
+}
+
+SInt64 SFB::HTTPInputSource::_PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset)
+{
+	SInt64 bytesRead = 0;
+
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	for(int i = 0; i < vectorCount; ++i) {
+		auto output = static_cast<uint8_t *>(vectors[i].iov_base);
+		SInt64 byteCount = (SInt64)vectors[i].iov_len;
+		SInt64 bufferBytesRead = 0;
+
+		while(bufferBytesRead < byteCount) {
+			SInt64 position = offset + bytesRead;
+
+			SInt64 length = mLength;
+			if(-1 != length && position >= length)
+				return bytesRead;
+
+			SInt64 cachedEnd = GetCachedRangeEnd(position);
+			if(-1 == cachedEnd) {
+				if(mNetworkFailed) {
+					mNetworkFailed = false;
+					return 0 < bytesRead ? bytesRead : -1;
+				}
+
+				// Ask the network thread to download the bytes at position once the current offset is satisfied
+				++mPendingReads[position];
+				WakeNetworkThread();
+				mCondition.wait(lock);
+				if(0 == --mPendingReads[position])
+					mPendingReads.erase(position);
+				continue;
+			}
+
+			ssize_t bytesToRead = (ssize_t)std::min(cachedEnd - position, byteCount - bufferBytesRead);
+			ssize_t cachedBytesRead = pread(mCacheFile, output + bufferBytesRead, (size_t)bytesToRead, position);
+			if(0 >= cachedBytesRead) {
+				LOGGER_ERR("org.sbooth.AudioEngine.InputSource.HTTP", "Error reading cache: " << strerror(errno));
+				return 0 < bytesRead ? bytesRead : -1;
+			}
+
+			bufferBytesRead += cachedBytesRead;
+			bytesRead += cachedBytesRead;
+		}
+	}
+
+	return bytesRead;
+}
+
+bool SFB::HTTPInputSource::_AtEOF() const
+{
+	SInt64 length = mLength;
+	return -1 != length && mOffset >= length;
+}
+
+bool SFB::HTTPInputSource::_SeekToOffset(SInt64 offset)
+{
+	SInt64 length = mLength;
+	if(-1 != length && offset > length)
+		return false;
+
+	// The network thread downloads from the new offset if it isn't cached
+	std::lock_guard<std::mutex> lock(mMutex);
+	mOffset = offset;
+	WakeNetworkThread();
+
+	return true;
+}
+
+#pragma mark Buffering
+
+bool SFB::HTTPInputSource::_GetBufferingStatus(BufferingStatus& status) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	SInt64 cachedEnd = GetCachedRangeEnd(mOffset);
+	SInt64 length = mLength;
+
+	status.mBytesAvailable = -1 == cachedEnd ? 0 : cachedEnd - mOffset;
+	status.mReceiveRate = mReceiveRate;
+	status.mComplete = -1 != length && (mOffset >= length || cachedEnd >= length);
+
+	return true;
+}
+
+bool SFB::HTTPInputSource::_GetBufferedRanges(std::vector<std::pair<SInt64, SInt64>>& ranges) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	ranges.assign(mCachedRanges.begin(), mCachedRanges.end());
+	return true;
+}
+
+bool SFB::HTTPInputSource::_WaitForBuffering(SInt64 byteCount, CFTimeInterval timeout)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	// Bytes beyond the prefetch window will not be downloaded until the offset advances
+	byteCount = std::min(byteCount, GetPrefetchWindow());
+
+	auto ready = [&] {
+		SInt64 cachedEnd = GetCachedRangeEnd(mOffset);
+		SInt64 length = mLength;
+		if(mNetworkFailed || (-1 != length && (mOffset >= length || cachedEnd >= length)))
+			return true;
+		return -1 != cachedEnd && cachedEnd - mOffset >= byteCount;
+	};
+
+	WakeNetworkThread();
+	return mCondition.wait_for(lock, std::chrono::duration<double>(timeout), ready);
+}
+
+void SFB::HTTPInputSource::_SetConsumptionRate(double bytesPerSecond)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mConsumptionRate = std::max(0., bytesPerSecond);
+	WakeNetworkThread();
+}
+
+void SFB::HTTPInputSource::_SetReadAheadDuration(CFTimeInterval duration)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mReadAheadDuration = duration;
+	WakeNetworkThread();
+}
+
+bool SFB::HTTPInputSource::_WouldBlock(SInt64 byteCount) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if(mNetworkFailed)
+		return false;
+
+	// Bytes beyond the prefetch window will not be downloaded until the offset advances
+	byteCount = std::min(byteCount, GetPrefetchWindow());
+
+	SInt64 cachedEnd = GetCachedRangeEnd(mOffset);
+	SInt64 length = mLength;
+	if(-1 != length && (mOffset >= length || cachedEnd >= length))
+		return false;
+
+	return -1 == cachedEnd || cachedEnd - mOffset < byteCount;
+}
+
+void SFB::HTTPInputSource::_SetReadabilityHandler(ReadabilityHandler handler)
+{
+	// The handler is called with mMutex held, so it is not called once replaced
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if(mReadabilityHandler)
+		Block_release(mReadabilityHandler);
+	mReadabilityHandler = handler ? Block_copy(handler) : nullptr;
+}
+
+CFStringRef SFB::HTTPInputSource::CopyContentMIMEType() const
+{
+	if(!IsOpen())
+		return nullptr;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	if(!mResponseHeaders)
+		return nullptr;
+
+	return reinterpret_cast<CFStringRef>(CFDictionaryGetValue(mResponseHeaders, CFSTR("Content-Type")));
+}
+
+#pragma mark Network Thread
+
+void SFB::HTTPInputSource::NetworkThreadEntry()
+{
+	pthread_setname_np("org.sbooth.AudioEngine.InputSource.HTTP");
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mNetworkRunLoop = CFRunLoopGetCurrent();
+	}
+
+	for(;;) {
+		SInt64 target = -1;
+
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			if(mStopRequested)
+				break;
+
+			// Download the first uncached byte following the current offset if it is within the prefetch window
+			if(!mNetworkFailed) {
+				SInt64 next = GetCachedRangeEnd(mOffset);
+				if(-1 == next)
+					next = mOffset;
+
+				SInt64 length = mLength;
+				if((-1 == length || next < length) && next - mOffset < GetPrefetchWindow())
+					target = next;
+
+				// Otherwise download the bytes awaited by a positional read
+				for(auto iter = mPendingReads.cbegin(); -1 == target && iter != mPendingReads.cend(); ++iter) {
+					next = GetCachedRangeEnd(iter->first);
+					if(-1 == next)
+						next = iter->first;
+					if(-1 == length || next < length)
+						target = next;
+				}
+			}
+
+			// Wait for the reader to consume input, seek, or report a failure
+			if(-1 == target) {
+				mRateSampleStart = 0;
+				mCondition.wait_for(lock, std::chrono::duration<double>(IDLE_WAIT_SECONDS));
+				continue;
+			}
+		}
+
+		// Reuse the open stream if the target can be reached by reading through it
+		bool positioned = mReadStream && !mStreamFailed && !mStreamAtEnd && mStreamOffset <= target && (-1 == mStreamEnd || target < mStreamEnd) && (mRangesUnsupported || MAX_READ_THROUGH_BYTES >= target - mStreamOffset);
+
+		if((!positioned && !OpenStream(target)) || !ReadAvailableBytes()) {
+			CloseStream();
+
+			std::lock_guard<std::mutex> lock(mMutex);
+			mNetworkFailed = true;
+			NotifyReaders();
+		}
+	}
+
+	CloseStream();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mNetworkRunLoop = nullptr;
+}
+
+void SFB::HTTPInputSource::StopNetworkThread()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopRequested = true;
+		WakeNetworkThread();
+	}
+
+	try {
+		mNetworkThread.join();
+	}
+
+	catch(const std::exception& e) {
+		LOGGER_ERR("org.sbooth.AudioEngine.InputSource.HTTP", "Unable to join network thread: " << e.what());
+	}
+}
+
+void SFB::HTTPInputSource::WakeNetworkThread()
+{
+	mCondition.notify_all();
+	if(mNetworkRunLoop)
+		CFRunLoopStop(mNetworkRunLoop);
+}
+
+void SFB::HTTPInputSource::NotifyReaders()
+{
+	mCondition.notify_all();
+	if(mReadabilityHandler)
+		mReadabilityHandler();
+}
+
+bool SFB::HTTPInputSource::OpenStream(SInt64 offset)
+{
+	CloseStream();
+
+	// Set up the HTTP request
+	mRequest = CFHTTPMessageCreateRequest(kCFAllocatorDefault, CFSTR("GET"), GetURL(), kCFHTTPVersion1_1);
+	if(!mRequest)
+		return false;
+
 	CFHTTPMessageSetHeaderFieldValue(mRequest, CFSTR("User-Agent"), CFSTR("SFBAudioEngine"));
 
-	// Seek support
-	if(0 < mDesiredOffset) {
-		SFB::CFString byteRange(nullptr, CFSTR("bytes=%lld-"), mDesiredOffset);
+	// Request only the bytes preceding the next cached range, allowing the connection to be reused when complete
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		auto next = mCachedRanges.upper_bound(offset);
+		if(next != mCachedRanges.end())
+			mStreamEnd = next->first;
+	}
+
+	if(-1 != mStreamEnd) {
+		SFB::CFString byteRange(nullptr, CFSTR("bytes=%lld-%lld"), offset, mStreamEnd - 1);
+		CFHTTPMessageSetHeaderFieldValue(mRequest, CFSTR("Range"), byteRange);
+	}
+	else if(0 < offset) {
+		SFB::CFString byteRange(nullptr, CFSTR("bytes=%lld-"), offset);
 		CFHTTPMessageSetHeaderFieldValue(mRequest, CFSTR("Range"), byteRange);
 	}
 
 	mReadStream = CFReadStreamCreateForHTTPRequest(kCFAllocatorDefault, mRequest);
-	if(!mReadStream) {
-		if(error)
-			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+	if(!mReadStream)
 		return false;
-	}
+
+	// Subsequent requests reuse the connection instead of performing a new handshake
+	CFReadStreamSetProperty(mReadStream, kCFStreamPropertyHTTPAttemptPersistentConnection, kCFBooleanTrue);
 
     if(CFStringHasPrefix(CFURLGetString(GetURL()), CFSTR("https://"))) {
         CFReadStreamSetProperty(mReadStream, kCFStreamPropertySocketSecurityLevel, kCFStreamSocketSecurityLevelNegotiatedSSL);
@@ -68,98 +509,229 @@ bool SFB::HTTPInputSource::_Open(CFErrorRef *error)
 	};
 
 	CFOptionFlags clientFlags = kCFStreamEventOpenCompleted | kCFStreamEventHasBytesAvailable | kCFStreamEventErrorOccurred | kCFStreamEventEndEncountered;
-    if(!CFReadStreamSetClient(mReadStream, clientFlags, myCFReadStreamClientCallBack, &myContext)) {
-		if(error)
-			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+    if(!CFReadStreamSetClient(mReadStream, clientFlags, myCFReadStreamClientCallBack, &myContext))
 		return false;
-	}
 
+	// The stream is serviced by the network thread's run loop
 	CFReadStreamScheduleWithRunLoop(mReadStream, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
 
-	if(!CFReadStreamOpen(mReadStream)) {
-		if(error)
-			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+	if(!CFReadStreamOpen(mReadStream))
 		return false;
+
+	while(0 == mResponseStatusCode && !mStreamFailed) {
+		CFStreamStatus status = CFReadStreamGetStatus(mReadStream);
+		if(kCFStreamStatusAtEnd == status || kCFStreamStatusClosed == status || kCFStreamStatusError == status)
+			break;
+
+		CFRunLoopRunInMode(kCFRunLoopDefaultMode, IDLE_WAIT_SECONDS, true);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		if(mStopRequested)
+			return false;
 	}
 
-	while(nullptr == mResponseHeaders)
-		CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0, true);
+	if(0 == mResponseStatusCode) {
+		LOGGER_ERR("org.sbooth.AudioEngine.InputSource.HTTP", "No response received for " << GetURL());
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	char buf [128];
+	if(206 == mResponseStatusCode) {
+		long long first, last, total;
+		int fields = 0;
+		if(GetHeaderValue(mResponseHeaders, CFSTR("Content-Range"), buf, sizeof(buf)))
+			fields = sscanf(buf, "bytes %lld-%lld/%lld", &first, &last, &total);
+
+		if(2 > fields) {
+			LOGGER_ERR("org.sbooth.AudioEngine.InputSource.HTTP", "Missing or invalid Content-Range in partial response");
+			return false;
+		}
+
+		mStreamOffset = first;
+		mStreamEnd = last + 1;
+		if(3 == fields)
+			mLength = total;
+	}
+	else if(200 <= mResponseStatusCode && 300 > mResponseStatusCode) {
+		// A server ignoring the range sends the entire resource, so the stream is never repositioned
+		if(0 < offset || -1 != mStreamEnd)
+			mRangesUnsupported = true;
+
+		mStreamOffset = 0;
+		mStreamEnd = -1;
+		if(GetHeaderValue(mResponseHeaders, CFSTR("Content-Length"), buf, sizeof(buf)))
+			mLength = strtoll(buf, nullptr, 10);
+	}
+	else if(416 == mResponseStatusCode) {
+		// The offset is at or beyond the end of the resource
+		mStreamOffset = offset;
+		mStreamAtEnd = true;
+		if(-1 == mLength)
+			mLength = offset;
+	}
+	else {
+		LOGGER_ERR("org.sbooth.AudioEngine.InputSource.HTTP", "HTTP status " << mResponseStatusCode << " for " << GetURL());
+		return false;
+	}
+
+	mResponseReceived = true;
+	NotifyReaders();
 
 	return true;
 }
 
-bool SFB::HTTPInputSource::_Close(CFErrorRef */*error*/)
+void SFB::HTTPInputSource::CloseStream()
 {
+	if(mReadStream) {
+		CFReadStreamSetClient(mReadStream, kCFStreamEventNone, nullptr, nullptr);
+		CFReadStreamUnscheduleFromRunLoop(mReadStream, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
+		CFReadStreamClose(mReadStream);
+	}
+
 	mRequest = nullptr;
 	mReadStream = nullptr;
-	mResponseHeaders = nullptr;
-
-	mOffset = -1;
-	mDesiredOffset = 0;
-
-	return true;
+	mResponseStatusCode = 0;
+	mStreamAtEnd = false;
+	mStreamFailed = false;
+	mStreamOffset = 0;
+	mStreamEnd = -1;
 }
 
-SInt64 SFB::HTTPInputSource::_Read(void *buffer, SInt64 byteCount)
+bool SFB::HTTPInputSource::ReadAvailableBytes()
 {
-	CFStreamStatus status = CFReadStreamGetStatus(mReadStream);
+	if(mStreamAtEnd)
+		return true;
+
+	// Wait for the stream instead of blocking in CFReadStreamRead so the thread remains responsive
+	if(!CFReadStreamHasBytesAvailable(mReadStream)) {
+		CFStreamStatus status = CFReadStreamGetStatus(mReadStream);
+		if(mStreamFailed || kCFStreamStatusError == status || kCFStreamStatusClosed == status)
+			return false;
+
+		if(kCFStreamStatusAtEnd != status) {
+			CFRunLoopRunInMode(kCFRunLoopDefaultMode, STREAM_WAIT_SECONDS, true);
+			return true;
+		}
+	}
 
-	if(kCFStreamStatusAtEnd == status)
-		return 0;
-	else if(kCFStreamStatusNotOpen == status || kCFStreamStatusClosed == status || kCFStreamStatusError == status)
-		return -1;
+	CFIndex bytesToRead = NETWORK_READ_SIZE;
+	if(-1 != mStreamEnd)
+		bytesToRead = (CFIndex)std::min((SInt64)bytesToRead, mStreamEnd - mStreamOffset);
 
-	CFIndex bytesRead = CFReadStreamRead(mReadStream, (UInt8 *)buffer, (CFIndex)byteCount);
+	CFIndex bytesRead = CFReadStreamRead(mReadStream, mNetworkBuffer.get(), bytesToRead);
+	if(0 > bytesRead) {
+		SFB::CFError error(CFReadStreamCopyError(mReadStream));
+		LOGGER_ERR("org.sbooth.AudioEngine.InputSource.HTTP", "Error: " << error);
+		mStreamFailed = true;
+		return false;
+	}
 
-	mOffset += bytesRead;
+	CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
 
-	return bytesRead;
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if(0 == bytesRead) {
+		mStreamAtEnd = true;
+		// A response lacking a length ends with the resource
+		if(-1 == mLength && -1 == mStreamEnd)
+			mLength = mStreamOffset;
+		NotifyReaders();
+		return true;
+	}
+
+	CacheBytes(mNetworkBuffer.get(), bytesRead, mStreamOffset);
+	mStreamOffset += bytesRead;
+
+	// Sample the receive rate only while downloading
+	if(0 == mRateSampleStart) {
+		mRateSampleStart = now;
+		mRateSampleBytes = 0;
+	}
+	else {
+		mRateSampleBytes += bytesRead;
+		CFAbsoluteTime elapsed = now - mRateSampleStart;
+		if(RATE_SAMPLE_SECONDS <= elapsed) {
+			double rate = mRateSampleBytes / elapsed;
+			mReceiveRate = 0 == mReceiveRate ? rate : (0.7 * mReceiveRate) + (0.3 * rate);
+			mRateSampleStart = now;
+			mRateSampleBytes = 0;
+		}
+	}
+
+	NotifyReaders();
+
+	return true;
 }
 
-SInt64 SFB::HTTPInputSource::_GetLength() const
+SInt64 SFB::HTTPInputSource::GetPrefetchWindow() const
 {
-	if(!mResponseHeaders)
-		return -1;
+	if(0 >= mConsumptionRate)
+		return DEFAULT_PREFETCH_BYTES;
 
-	SInt64 contentLength = -1;
+	// With little bandwidth to spare a longer buffer rides out fluctuations
+	double seconds = (0 < mReceiveRate && mReceiveRate < 2 * mConsumptionRate) ? CONSTRAINED_PREFETCH_SECONDS : PREFETCH_SECONDS;
 
-	// FIXME: 64-bit lengths aren't handled correctly
-	CFStringRef contentLengthString = reinterpret_cast<CFStringRef>(CFDictionaryGetValue(mResponseHeaders, CFSTR("Content-Length")));
-	if(contentLengthString)
-		contentLength = CFStringGetIntValue(contentLengthString);
+	// A requested read ahead isn't limited since the downloaded input is held in the cache file rather than in memory
+	if(seconds < mReadAheadDuration)
+		return std::max((SInt64)MINIMUM_PREFETCH_BYTES, (SInt64)(mReadAheadDuration * mConsumptionRate));
 
-	return contentLength;
+	return std::max((SInt64)MINIMUM_PREFETCH_BYTES, std::min((SInt64)(seconds * mConsumptionRate), (SInt64)MAXIMUM_PREFETCH_BYTES));
 }
 
-bool SFB::HTTPInputSource::_SeekToOffset(SInt64 offset)
+void SFB::HTTPInputSource::CacheBytes(const void *bytes, SInt64 byteCount, SInt64 offset)
 {
-	if(!_Close(nullptr))
-		return false;
+	if(byteCount != pwrite(mCacheFile, bytes, (size_t)byteCount, offset)) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource.HTTP", "Error writing cache: " << strerror(errno));
+		return;
+	}
+
+	// Merge the bytes with any adjacent or overlapping range
+	SInt64 start = offset, end = offset + byteCount;
+
+	auto iter = mCachedRanges.upper_bound(start);
+	if(iter != mCachedRanges.begin()) {
+		auto previous = std::prev(iter);
+		if(previous->second >= start) {
+			start = previous->first;
+			end = std::max(end, previous->second);
+			mCachedRanges.erase(previous);
+		}
+	}
+
+	while(iter != mCachedRanges.end() && iter->first <= end) {
+		end = std::max(end, iter->second);
+		iter = mCachedRanges.erase(iter);
+	}
 
-	mDesiredOffset = offset;
-	return _Open(nullptr);
+	mCachedRanges[start] = end;
 }
 
-CFStringRef SFB::HTTPInputSource::CopyContentMIMEType() const
+SInt64 SFB::HTTPInputSource::GetCachedRangeEnd(SInt64 offset) const
 {
-	if(!IsOpen() || !mResponseHeaders)
-		return nullptr;
+	auto iter = mCachedRanges.upper_bound(offset);
+	if(iter == mCachedRanges.begin())
+		return -1;
 
-	return reinterpret_cast<CFStringRef>(CFDictionaryGetValue(mResponseHeaders, CFSTR("Content-Type")));
+	--iter;
+	return offset < iter->second ? iter->second : -1;
 }
 
 void SFB::HTTPInputSource::HandleNetworkEvent(CFReadStreamRef stream, CFStreamEventType type)
 {
 	switch(type) {
 		case kCFStreamEventOpenCompleted:
-			mOffset = mDesiredOffset;
 			break;
 
 		case kCFStreamEventHasBytesAvailable:
-			if(nullptr == mResponseHeaders) {
+		case kCFStreamEventEndEncountered:
+			if(0 == mResponseStatusCode) {
 				SFB::CFType responseHeader(CFReadStreamCopyProperty(stream, kCFStreamPropertyHTTPResponseHeader));
 				if(responseHeader) {
+					std::lock_guard<std::mutex> lock(mMutex);
 					mResponseHeaders = CFHTTPMessageCopyAllHeaderFields((CFHTTPMessageRef)responseHeader.Object());
+					mResponseStatusCode = CFHTTPMessageGetResponseStatusCode((CFHTTPMessageRef)responseHeader.Object());
 				}
 			}
 			break;
@@ -169,11 +741,8 @@ void SFB::HTTPInputSource::HandleNetworkEvent(CFReadStreamRef stream, CFStreamEv
 			SFB::CFError error(CFReadStreamCopyError(stream));
 			if(error)
 				LOGGER_ERR("org.sbooth.AudioEngine.InputSource.HTTP", "Error: " << error);
+			mStreamFailed = true;
 			break;
 		}
-
-		case kCFStreamEventEndEncountered:
-			mEOSReached = true;
-			break;
 	}
 }
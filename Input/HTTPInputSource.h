@@ -5,6 +5,13 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include <CoreFoundation/CoreFoundation.h>
 
 #if TARGET_OS_IPHONE
@@ -17,6 +24,16 @@
 
 namespace SFB {
 
+	// ========================================
+	// InputSource reading a resource over HTTP
+	//
+	// A dedicated network thread downloads the resource ahead of the current offset into a sparse
+	// cache file, so re-reads and seeks to downloaded regions require no network access.  The amount
+	// downloaded ahead grows when the measured bandwidth is close to the rate at which input is consumed.
+	// Seeks to uncached regions are serviced by the network thread, and short forward seeks read through
+	// the open stream instead of issuing a new request.  Positional reads share the cache, so other
+	// readers may use the input concurrently with the reader at the current offset.
+	// ========================================
 	class HTTPInputSource : public InputSource
 	{
 
@@ -33,24 +50,87 @@ namespace SFB {
 
 		// Functionality
 		virtual SInt64 _Read(void *buffer, SInt64 byteCount);
-		inline virtual bool _AtEOF()	const					{ return mEOSReached; }
+		virtual bool _AtEOF() const;
 
 		inline virtual SInt64 _GetOffset() const				{ return mOffset; }
-		virtual SInt64 _GetLength() const;
+		inline virtual SInt64 _GetLength() const				{ return mLength; }
 
 		// Seeking support
 		inline virtual bool _SupportsSeeking() const			{ return true; }
 		virtual bool _SeekToOffset(SInt64 offset);
 
+		// Positional reads are served from the cache, downloading uncached bytes when the current offset needs none
+		inline virtual bool _SupportsPositionalReads() const	{ return true; }
+		virtual SInt64 _PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset);
+
+		// Buffering
+		virtual bool _GetBufferingStatus(BufferingStatus& status) const;
+		virtual bool _GetBufferedRanges(std::vector<std::pair<SInt64, SInt64>>& ranges) const;
+		virtual bool _WaitForBuffering(SInt64 byteCount, CFTimeInterval timeout);
+		virtual void _SetConsumptionRate(double bytesPerSecond);
+		virtual void _SetReadAheadDuration(CFTimeInterval duration);
+		virtual bool _WouldBlock(SInt64 byteCount) const;
+		virtual void _SetReadabilityHandler(ReadabilityHandler handler);
+
 		CFStringRef CopyContentMIMEType() const;
 
-		// Data members
+		// ========================================
+		// Network thread
+		void NetworkThreadEntry();
+		void StopNetworkThread();
+
+		// Interrupt the network thread's wait; mMutex must be held
+		void WakeNetworkThread();
+
+		// Notify readers that input was received or no further input can be received; mMutex must be held
+		void NotifyReaders();
+
+		// Issue a request for the bytes starting at offset, up to the next cached range
+		bool OpenStream(SInt64 offset);
+		void CloseStream();
+
+		// Read the bytes available from the stream into the cache
+		bool ReadAvailableBytes();
+
+		// The number of bytes to download ahead of the current offset; mMutex must be held
+		SInt64 GetPrefetchWindow() const;
+
+		// Cache management; mMutex must be held
+		void CacheBytes(const void *bytes, SInt64 byteCount, SInt64 offset);
+		SInt64 GetCachedRangeEnd(SInt64 offset) const;
+
+		// Data members accessed only by the network thread
 		SFB::CFHTTPMessage				mRequest;
 		SFB::CFReadStream				mReadStream;
+		CFIndex							mResponseStatusCode;
+		bool							mStreamAtEnd;
+		bool							mStreamFailed;
+		SInt64							mStreamOffset;		// The offset of the next byte from the stream
+		SInt64							mStreamEnd;			// The offset at which the requested range ends, or -1
+		bool							mRangesUnsupported;
+		std::unique_ptr<uint8_t []>		mNetworkBuffer;
+		CFAbsoluteTime					mRateSampleStart;
+		SInt64							mRateSampleBytes;
+
+		// Data members shared with the network thread, protected by mMutex
+		mutable std::mutex				mMutex;
+		std::condition_variable			mCondition;
+		std::thread						mNetworkThread;
+		CFRunLoopRef					mNetworkRunLoop;
+		bool							mStopRequested;
+		bool							mResponseReceived;
+		bool							mNetworkFailed;
 		SFB::CFDictionary				mResponseHeaders;
-		bool							mEOSReached;
+		std::map<SInt64, SInt64>		mCachedRanges;		// Start offset to end offset of disjoint cached ranges
+		std::map<SInt64, unsigned>		mPendingReads;		// Uncached offsets awaited by positional reads, with the number of readers
+		double							mReceiveRate;
+		double							mConsumptionRate;
+		CFTimeInterval					mReadAheadDuration;	// 0 for the default prefetch window
+		ReadabilityHandler				mReadabilityHandler;
+
 		SInt64							mOffset;
-		SInt64							mDesiredOffset;
+		std::atomic<SInt64>				mLength;
+		int								mCacheFile;
 
 	public:
 
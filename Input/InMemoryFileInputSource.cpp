@@ -3,10 +3,177 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+
+#include <sys/mman.h>
 
 #include "InMemoryFileInputSource.h"
 
+// The default amount of memory the cache may retain for files not in use
+#define DEFAULT_CACHE_CAPACITY_BYTES (128 * 1024 * 1024)
+
+namespace {
+
+	// ========================================
+	// A least recently used cache of file contents
+	// Buffers are shared by reference counting; an evicted buffer remains valid until its last user releases it
+	class FileCache
+	{
+
+	public:
+
+		using buffer_ptr = std::shared_ptr<const int8_t>;
+
+		FileCache()
+			: mCapacity(DEFAULT_CACHE_CAPACITY_BYTES), mCachedBytes(0), mHitCount(0), mMissCount(0)
+		{}
+
+		FileCache(const FileCache& rhs) = delete;
+		FileCache& operator=(const FileCache& rhs) = delete;
+
+		// Return the cached contents of the file at path if they are current, or nullptr
+		buffer_ptr Find(const std::string& path, const struct stat& filestats)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			auto iter = mIndex.find(path);
+			if(iter == mIndex.end()) {
+				++mMissCount;
+				return nullptr;
+			}
+
+			auto entry = iter->second;
+
+			// A file replaced or modified since it was cached is reloaded
+			if(!entry->Matches(filestats)) {
+				Remove(entry);
+				++mMissCount;
+				return nullptr;
+			}
+
+			mEntries.splice(mEntries.begin(), mEntries, entry);
+			++mHitCount;
+
+			return entry->mBuffer;
+		}
+
+		// Add the contents of the file at path, returning the cached buffer which may have been added by another thread
+		buffer_ptr Insert(const std::string& path, const struct stat& filestats, buffer_ptr buffer)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			auto iter = mIndex.find(path);
+			if(iter != mIndex.end()) {
+				if(iter->second->Matches(filestats))
+					return iter->second->mBuffer;
+				Remove(iter->second);
+			}
+
+			// Files exceeding the capacity are not retained
+			if((size_t)filestats.st_size > mCapacity)
+				return buffer;
+
+			mEntries.push_front({ path, filestats.st_dev, filestats.st_ino, filestats.st_mtimespec, filestats.st_size, buffer });
+			mIndex[path] = mEntries.begin();
+			mCachedBytes += (size_t)filestats.st_size;
+
+			Trim();
+
+			return buffer;
+		}
+
+		void SetCapacity(size_t capacity)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mCapacity = capacity;
+			Trim();
+		}
+
+		SFB::InputSource::FileCacheStatistics GetStatistics() const
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			SFB::InputSource::FileCacheStatistics statistics = {
+				.mCapacity		= mCapacity,
+				.mCachedBytes	= mCachedBytes,
+				.mFileCount		= mEntries.size(),
+				.mHitCount		= mHitCount,
+				.mMissCount		= mMissCount
+			};
+
+			return statistics;
+		}
+
+		void Purge()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mEntries.clear();
+			mIndex.clear();
+			mCachedBytes = 0;
+		}
+
+	private:
+
+		struct Entry
+		{
+			inline bool Matches(const struct stat& filestats) const
+			{
+				return mDevice == filestats.st_dev && mInode == filestats.st_ino && mSize == filestats.st_size && mModificationTime.tv_sec == filestats.st_mtimespec.tv_sec && mModificationTime.tv_nsec == filestats.st_mtimespec.tv_nsec;
+			}
+
+			std::string			mPath;
+			dev_t				mDevice;
+			ino_t				mInode;
+			struct timespec		mModificationTime;
+			off_t				mSize;
+			buffer_ptr			mBuffer;
+		};
+
+		using entry_list = std::list<Entry>;
+
+		// Evict the least recently used files until the cache is within its capacity; mMutex must be held
+		void Trim()
+		{
+			while(mCachedBytes > mCapacity && !mEntries.empty())
+				Remove(std::prev(mEntries.end()));
+		}
+
+		void Remove(entry_list::iterator entry)
+		{
+			mCachedBytes -= (size_t)entry->mSize;
+			mIndex.erase(entry->mPath);
+			mEntries.erase(entry);
+		}
+
+		mutable std::mutex										mMutex;
+		entry_list												mEntries;		// Most recently used first
+		std::unordered_map<std::string, entry_list::iterator>	mIndex;
+		size_t													mCapacity;
+		size_t													mCachedBytes;
+		uint64_t												mHitCount;
+		uint64_t												mMissCount;
+	};
+
+	// The cache is never destroyed so inputs with static storage duration may safely outlive it
+	FileCache& SharedFileCache()
+	{
+		static FileCache *sFileCache = new FileCache;
+		return *sFileCache;
+	}
+
+	// Whether files not in the cache are mapped instead of read
+	std::atomic_bool sLowMemoryMode(false);
+
+}
+
 #pragma mark Creation and Destruction
 
 SFB::InMemoryFileInputSource::InMemoryFileInputSource(CFURLRef url)
@@ -15,6 +182,33 @@ SFB::InMemoryFileInputSource::InMemoryFileInputSource(CFURLRef url)
 	memset(&mFilestats, 0, sizeof(mFilestats));
 }
 
+void SFB::InMemoryFileInputSource::SetCacheCapacity(size_t capacity)
+{
+	SharedFileCache().SetCapacity(capacity);
+}
+
+SFB::InputSource::FileCacheStatistics SFB::InMemoryFileInputSource::GetCacheStatistics()
+{
+	return SharedFileCache().GetStatistics();
+}
+
+void SFB::InMemoryFileInputSource::PurgeCache()
+{
+	SharedFileCache().Purge();
+}
+
+void SFB::InMemoryFileInputSource::SetLowMemoryModeEnabled(bool enabled)
+{
+	sLowMemoryMode = enabled;
+	if(enabled)
+		SharedFileCache().Purge();
+}
+
+bool SFB::InMemoryFileInputSource::IsLowMemoryModeEnabled()
+{
+	return sLowMemoryMode;
+}
+
 bool SFB::InMemoryFileInputSource::_Open(CFErrorRef *error)
 {
 	using unique_FILE_ptr = std::unique_ptr<std::FILE, std::function<int(std::FILE *)>>;
@@ -40,20 +234,41 @@ bool SFB::InMemoryFileInputSource::_Open(CFErrorRef *error)
 		return false;
 	}
 
-	// Perform the allocation
-	mMemory = std::unique_ptr<int8_t []>(new int8_t [mFilestats.st_size]);
-	if(!mMemory) {
-		if(error)
-			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
-		return false;
+	// Use the cached contents if the file hasn't changed
+	std::string path((const char *)buf);
+	mMemory = SharedFileCache().Find(path, mFilestats);
+
+	// Mapped files aren't cached since the purpose of mapping is to let the system reclaim the pages
+	if(!mMemory && sLowMemoryMode && 0 < mFilestats.st_size) {
+		size_t length = (size_t)mFilestats.st_size;
+		void *region = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, ::fileno(file.get()), 0);
+		if(MAP_FAILED == region) {
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+			return false;
+		}
+
+		mMemory = std::shared_ptr<const int8_t>((const int8_t *)region, [length](const int8_t *p) { munmap((void *)p, length); });
 	}
 
-	// Read the file
-	if((size_t)mFilestats.st_size != ::fread(mMemory.get(), 1, (size_t)mFilestats.st_size, file.get())) {
-		if(error)
-			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+	if(!mMemory) {
+		// Perform the allocation
+		auto memory = std::unique_ptr<int8_t []>(new (std::nothrow) int8_t [mFilestats.st_size]);
+		if(!memory) {
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+			return false;
+		}
 
-		return false;
+		// Read the file
+		if((size_t)mFilestats.st_size != ::fread(memory.get(), 1, (size_t)mFilestats.st_size, file.get())) {
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+
+			return false;
+		}
+
+		mMemory = SharedFileCache().Insert(path, mFilestats, std::shared_ptr<const int8_t>(memory.release(), std::default_delete<const int8_t []>()));
 	}
 
 	mCurrentPosition = mMemory.get();
@@ -82,6 +297,40 @@ SInt64 SFB::InMemoryFileInputSource::_Read(void *buffer, SInt64 byteCount)
 	return byteCount;
 }
 
+SInt64 SFB::InMemoryFileInputSource::_Borrow(const void *& bytes, SInt64 byteCount)
+{
+	ptrdiff_t remaining = (mMemory.get() + mFilestats.st_size) - mCurrentPosition;
+
+	if(byteCount > remaining)
+		byteCount = remaining;
+
+	bytes = mCurrentPosition;
+	mCurrentPosition += byteCount;
+	return byteCount;
+}
+
+SInt64 SFB::InMemoryFileInputSource::_PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset)
+{
+	// The bytes are immutable and the current position is untouched, so concurrent reads are safe
+	if(offset > mFilestats.st_size)
+		return -1;
+
+	const int8_t *position = mMemory.get() + offset;
+	SInt64 remaining = mFilestats.st_size - offset;
+
+	SInt64 bytesRead = 0;
+	for(int i = 0; i < vectorCount && 0 < remaining; ++i) {
+		SInt64 byteCount = std::min((SInt64)vectors[i].iov_len, remaining);
+		memcpy(vectors[i].iov_base, position, (size_t)byteCount);
+
+		position += byteCount;
+		remaining -= byteCount;
+		bytesRead += byteCount;
+	}
+
+	return bytesRead;
+}
+
 bool SFB::InMemoryFileInputSource::_SeekToOffset(SInt64 offset)
 {
 	if(offset > mFilestats.st_size)
@@ -14,6 +14,9 @@ namespace SFB {
 
 	// ========================================
 	// InputSource serving bytes from a file fully loaded in RAM
+	//
+	// File contents are held in a process-wide cache with a memory budget, keyed by path, inode and
+	// modification time, so inputs for the same unmodified file share one immutable buffer.
 	// ========================================
 	class InMemoryFileInputSource : public InputSource
 	{
@@ -23,6 +26,13 @@ namespace SFB {
 		// Creation
 		explicit InMemoryFileInputSource(CFURLRef url);
 
+		// Cache management
+		static void SetCacheCapacity(size_t capacity);
+		static FileCacheStatistics GetCacheStatistics();
+		static void PurgeCache();
+		static void SetLowMemoryModeEnabled(bool enabled);
+		static bool IsLowMemoryModeEnabled();
+
 	private:
 
 		// Bytestream access
@@ -42,10 +52,18 @@ namespace SFB {
 		inline virtual bool _SupportsSeeking() const			{ return true; }
 		virtual bool _SeekToOffset(SInt64 offset);
 
+		// Borrowing support
+		inline virtual bool _SupportsBorrowing() const			{ return true; }
+		virtual SInt64 _Borrow(const void *& bytes, SInt64 byteCount);
+
+		// Positional read support
+		inline virtual bool _SupportsPositionalReads() const	{ return true; }
+		virtual SInt64 _PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset);
+
 		// Data members
 		struct stat						mFilestats;
-		std::unique_ptr<int8_t []>		mMemory;
-		int8_t							*mCurrentPosition;
+		std::shared_ptr<const int8_t>	mMemory;
+		const int8_t					*mCurrentPosition;
 	};
 
 }
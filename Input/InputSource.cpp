@@ -9,7 +9,32 @@
 #include "MemoryMappedFileInputSource.h"
 #include "InMemoryFileInputSource.h"
 #include "HTTPInputSource.h"
+#include "ObjectStorageInputSource.h"
+#include "BufferedInputSource.h"
+#include "ReadAheadFileInputSource.h"
 #include "Logger.h"
+#include "Signposts.h"
+
+// Files no larger than this are loaded in memory by AutomaticFileInput
+#define AUTOMATIC_IN_MEMORY_MAXIMUM_BYTES (16 * 1024 * 1024)
+
+namespace {
+
+	const char * GetInputSourceTypeName(SFB::InputSource::InputSourceType type)
+	{
+		switch(type) {
+			case SFB::InputSource::InputSourceType::File:				return "file";
+			case SFB::InputSource::InputSourceType::MemoryMappedFile:	return "memory-mapped file";
+			case SFB::InputSource::InputSourceType::InMemoryFile:		return "in-memory file";
+			case SFB::InputSource::InputSourceType::ReadAheadFile:		return "read-ahead file";
+			case SFB::InputSource::InputSourceType::Buffered:			return "buffered";
+			case SFB::InputSource::InputSourceType::HTTP:				return "HTTP";
+			case SFB::InputSource::InputSourceType::ObjectStorage:		return "object storage";
+			default:													return "other";
+		}
+	}
+
+}
 
 // ========================================
 // Error Codes
@@ -31,19 +56,109 @@ SFB::InputSource::unique_ptr SFB::InputSource::CreateForURL(CFURLRef url, int fl
 		return nullptr;
 	}
 
+	unique_ptr inputSource;
+	InputSourceType type = InputSourceType::Other;
+
 	if(kCFCompareEqualTo == CFStringCompare(CFSTR("file"), scheme, kCFCompareCaseInsensitive)) {
-		if(InputSource::MemoryMapFiles & flags)
-			return unique_ptr(new MemoryMappedFileInputSource(url));
+		if(InputSource::AutomaticFileInput & flags)
+			type = ChooseFileInputSourceType(url, flags);
+		else if(InputSource::MemoryMapFiles & flags)
+			type = InputSourceType::MemoryMappedFile;
 		else if(InputSource::LoadFilesInMemory & flags)
-			return unique_ptr(new InMemoryFileInputSource(url));
+			type = InputSourceType::InMemoryFile;
+		else if(InputSource::ReadFilesAhead & flags)
+			type = InputSourceType::ReadAheadFile;
+		else if(InputSource::BufferInput & flags)
+			type = InputSourceType::Buffered;
 		else
-			return unique_ptr(new FileInputSource(url));
+			type = InputSourceType::File;
+
+		switch(type) {
+			case InputSourceType::MemoryMappedFile:
+				inputSource = CreateMemoryMapped(url, DefaultMemoryMapWindowSize, error);
+				break;
+			case InputSourceType::InMemoryFile:
+				inputSource = unique_ptr(new InMemoryFileInputSource(url));
+				break;
+			case InputSourceType::ReadAheadFile:
+				inputSource = CreateReadAhead(url, DefaultReadAheadWindowSize, error);
+				break;
+			case InputSourceType::Buffered:
+				inputSource = CreateBuffered(unique_ptr(new FileInputSource(url)), DefaultBufferBlockSize, error);
+				break;
+			default:
+				inputSource = unique_ptr(new FileInputSource(url));
+				break;
+		}
+	}
+	else if(ObjectStorageInputSource::HandlesURL(url)) {
+		if(InputSource::BufferInput & flags) {
+			type = InputSourceType::Buffered;
+			inputSource = CreateBuffered(unique_ptr(new ObjectStorageInputSource(url)), DefaultBufferBlockSize, error);
+		}
+		else {
+			type = InputSourceType::ObjectStorage;
+			inputSource = unique_ptr(new ObjectStorageInputSource(url));
+		}
 	}
 	else if(kCFCompareEqualTo == CFStringCompare(CFSTR("http"), scheme, kCFCompareCaseInsensitive)
-            || kCFCompareEqualTo == CFStringCompare(CFSTR("https"), scheme, kCFCompareCaseInsensitive))
-		return unique_ptr(new HTTPInputSource(url));
+            || kCFCompareEqualTo == CFStringCompare(CFSTR("https"), scheme, kCFCompareCaseInsensitive)) {
+		if(InputSource::BufferInput & flags) {
+			type = InputSourceType::Buffered;
+			inputSource = CreateBuffered(unique_ptr(new HTTPInputSource(url)), DefaultBufferBlockSize, error);
+		}
+		else {
+			type = InputSourceType::HTTP;
+			inputSource = unique_ptr(new HTTPInputSource(url));
+		}
+	}
+
+	if(inputSource)
+		inputSource->mType = type;
+
+	return inputSource;
+}
+
+SFB::InputSource::InputSourceType SFB::InputSource::ChooseFileInputSourceType(CFURLRef url, int flags)
+{
+	if(nullptr == url)
+		return InputSourceType::File;
+
+	CFStringRef keys [] = { kCFURLFileSizeKey, kCFURLVolumeIsLocalKey, kCFURLVolumeIsRemovableKey, kCFURLVolumeIsEjectableKey };
+	SFB::CFArray keyArray(CFArrayCreate(kCFAllocatorDefault, (const void **)keys, sizeof(keys) / sizeof(keys[0]), &kCFTypeArrayCallBacks));
+	SFB::CFDictionary values(CFURLCopyResourcePropertiesForKeys(url, keyArray, nullptr));
+	if(!values) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.InputSource", "Unable to determine the attributes of " << url);
+		return InputSourceType::File;
+	}
+
+	SInt64 fileSize = -1;
+	auto fileSizeValue = (CFNumberRef)CFDictionaryGetValue(values, kCFURLFileSizeKey);
+	if(fileSizeValue)
+		CFNumberGetValue(fileSizeValue, kCFNumberSInt64Type, &fileSize);
+
+	// A volume not known to be local is assumed to be a network volume
+	bool local = kCFBooleanTrue == CFDictionaryGetValue(values, kCFURLVolumeIsLocalKey);
+	bool removable = kCFBooleanTrue == CFDictionaryGetValue(values, kCFURLVolumeIsRemovableKey) || kCFBooleanTrue == CFDictionaryGetValue(values, kCFURLVolumeIsEjectableKey);
+
+	// Files that may disappear are never mapped; in low-memory mode files loaded in memory are mapped instead
+	bool detachable = !local || removable;
+
+	InputSourceType type;
+	if(0 <= fileSize && AUTOMATIC_IN_MEMORY_MAXIMUM_BYTES >= fileSize && !(detachable && IsLowMemoryModeEnabled()))
+		type = InputSourceType::InMemoryFile;
+	else if(detachable)
+		type = (RandomAccess & flags) ? InputSourceType::Buffered : InputSourceType::ReadAheadFile;
+	else if(RandomAccess & flags)
+		type = InputSourceType::MemoryMappedFile;
+	else if(SequentialAccess & flags)
+		type = InputSourceType::ReadAheadFile;
+	else
+		type = InputSourceType::File;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.InputSource", "Using " << GetInputSourceTypeName(type) << " input for " << url << " (" << fileSize << " bytes, " << (local ? "local" : "network") << (removable ? ", removable" : "") << ")");
 
-	return nullptr;
+	return type;
 }
 
 SFB::InputSource::unique_ptr SFB::InputSource::CreateWithMemory(const void *bytes, SInt64 byteCount, bool copyBytes, CFErrorRef *error)
@@ -56,14 +171,74 @@ SFB::InputSource::unique_ptr SFB::InputSource::CreateWithMemory(const void *byte
 	return unique_ptr(new MemoryInputSource(bytes, byteCount, copyBytes));
 }
 
+SFB::InputSource::unique_ptr SFB::InputSource::CreateBuffered(unique_ptr inputSource, SInt64 blockSize, CFErrorRef *error)
+{
+	if(!inputSource || nullptr == inputSource->GetURL() || 0 >= blockSize) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return nullptr;
+	}
+
+	return unique_ptr(new BufferedInputSource(std::move(inputSource), blockSize));
+}
+
+SFB::InputSource::unique_ptr SFB::InputSource::CreateMemoryMapped(CFURLRef url, SInt64 windowSize, CFErrorRef *error)
+{
+	if(nullptr == url || 0 >= windowSize) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return nullptr;
+	}
+
+	return unique_ptr(new MemoryMappedFileInputSource(url, windowSize));
+}
+
+SFB::InputSource::unique_ptr SFB::InputSource::CreateReadAhead(CFURLRef url, SInt64 windowSize, CFErrorRef *error)
+{
+	if(nullptr == url || 0 >= windowSize) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return nullptr;
+	}
+
+	return unique_ptr(new ReadAheadFileInputSource(url, windowSize));
+}
+
+#pragma mark File Cache
+
+void SFB::InputSource::SetFileCacheCapacity(size_t capacity)
+{
+	InMemoryFileInputSource::SetCacheCapacity(capacity);
+}
+
+SFB::InputSource::FileCacheStatistics SFB::InputSource::GetFileCacheStatistics()
+{
+	return InMemoryFileInputSource::GetCacheStatistics();
+}
+
+void SFB::InputSource::PurgeFileCache()
+{
+	InMemoryFileInputSource::PurgeCache();
+}
+
+void SFB::InputSource::SetLowMemoryModeEnabled(bool enabled)
+{
+	InMemoryFileInputSource::SetLowMemoryModeEnabled(enabled);
+}
+
+bool SFB::InputSource::IsLowMemoryModeEnabled()
+{
+	return InMemoryFileInputSource::IsLowMemoryModeEnabled();
+}
+
 #pragma mark Creation and Destruction
 
 SFB::InputSource::InputSource()
-	: mURL(nullptr), mIsOpen(false)
+	: mURL(nullptr), mIsOpen(false), mType(InputSourceType::Other)
 {}
 
 SFB::InputSource::InputSource(CFURLRef url)
-	: mURL((CFURLRef)CFRetain(url)), mIsOpen(false)
+	: mURL((CFURLRef)CFRetain(url)), mIsOpen(false), mType(InputSourceType::Other)
 {
 	assert(nullptr != url);
 }
@@ -101,7 +276,110 @@ SInt64 SFB::InputSource::Read(void *buffer, SInt64 byteCount)
 		return -1;
 	}
 
-	return _Read(buffer, byteCount);
+	SFB_SIGNPOST_INTERVAL_BEGIN("InputSource::Read", this, "%{public}@ %lld bytes", GetURL(), byteCount);
+	SInt64 bytesRead = _Read(buffer, byteCount);
+	SFB_SIGNPOST_INTERVAL_END("InputSource::Read", this, "%lld bytes read", bytesRead);
+
+	return bytesRead;
+}
+
+bool SFB::InputSource::SupportsBorrowing() const
+{
+	if(!IsOpen()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "SupportsBorrowing() called on an InputSource that hasn't been opened");
+		return false;
+	}
+
+	return _SupportsBorrowing();
+}
+
+SInt64 SFB::InputSource::Borrow(const void *& bytes, SInt64 byteCount)
+{
+	if(!IsOpen() || 0 > byteCount) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "Borrow() called on an InputSource that hasn't been opened");
+		return -1;
+	}
+
+	if(!_SupportsBorrowing())
+		return -1;
+
+	return _Borrow(bytes, byteCount);
+}
+
+SInt64 SFB::InputSource::BorrowOrRead(const void *& bytes, void *buffer, SInt64 byteCount)
+{
+	if(SupportsBorrowing())
+		return Borrow(bytes, byteCount);
+
+	bytes = buffer;
+	return Read(buffer, byteCount);
+}
+
+SInt64 SFB::InputSource::ReadV(const struct iovec *vectors, int vectorCount, SInt64 offset)
+{
+	if(!IsOpen() || nullptr == vectors || 0 > vectorCount || -1 > offset) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "ReadV() called on an InputSource that hasn't been opened");
+		return -1;
+	}
+
+	if(-1 == offset)
+		return _ReadV(vectors, vectorCount);
+
+	if(_SupportsPositionalReads())
+		return _PositionalReadV(vectors, vectorCount, offset);
+
+	// Emulate a positional read by seeking to the offset and back
+	if(!_SupportsSeeking())
+		return -1;
+
+	SInt64 savedOffset = _GetOffset();
+	if(!_SeekToOffset(offset))
+		return -1;
+
+	SInt64 bytesRead = _ReadV(vectors, vectorCount);
+
+	if(!_SeekToOffset(savedOffset))
+		LOGGER_ERR("org.sbooth.AudioEngine.InputSource", "Unable to restore the offset following ReadV()");
+
+	return bytesRead;
+}
+
+SInt64 SFB::InputSource::ReadAt(SInt64 offset, void *buffer, SInt64 byteCount)
+{
+	if(nullptr == buffer || 0 > byteCount || 0 > offset) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "ReadAt() called with invalid parameters");
+		return -1;
+	}
+
+	struct iovec vector = { buffer, (size_t)byteCount };
+	return ReadV(&vector, 1, offset);
+}
+
+size_t SFB::InputSource::ReadSignature(void *buffer, size_t byteCount)
+{
+	if(nullptr == buffer || !IsOpen())
+		return 0;
+
+	auto bytes = static_cast<uint8_t *>(buffer);
+	SInt64 bytesRead = ReadAt(0, bytes, (SInt64)byteCount);
+
+	// ID3v2 tags have a 10-byte header containing the syncsafe tag size, followed by an optional 10-byte footer
+	if(10 <= bytesRead && 'I' == bytes[0] && 'D' == bytes[1] && '3' == bytes[2] && 0xff != bytes[3] && 0xff != bytes[4] && 0 == ((bytes[6] | bytes[7] | bytes[8] | bytes[9]) & 0x80)) {
+		SInt64 tagSize = 10 + ((bytes[6] << 21) | (bytes[7] << 14) | (bytes[8] << 7) | bytes[9]) + ((bytes[5] & 0x10) ? 10 : 0);
+		bytesRead = ReadAt(tagSize, bytes, (SInt64)byteCount);
+	}
+
+	return 0 < bytesRead ? (size_t)bytesRead : 0;
+}
+
+bool SFB::InputSource::SupportsPositionalReads() const
+{
+	if(!IsOpen()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "SupportsPositionalReads() called on an InputSource that hasn't been opened");
+		return false;
+	}
+
+	return _SupportsPositionalReads();
 }
 
 bool SFB::InputSource::AtEOF() const
@@ -153,3 +431,103 @@ bool SFB::InputSource::SeekToOffset(SInt64 offset)
 
 	return _SeekToOffset(offset);
 }
+
+bool SFB::InputSource::GetStallStatistics(StallStatistics& statistics) const
+{
+	if(!IsOpen()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "GetStallStatistics() called on an InputSource that hasn't been opened");
+		return false;
+	}
+
+	return _GetStallStatistics(statistics);
+}
+
+bool SFB::InputSource::GetBufferingStatus(BufferingStatus& status) const
+{
+	if(!IsOpen()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "GetBufferingStatus() called on an InputSource that hasn't been opened");
+		return false;
+	}
+
+	return _GetBufferingStatus(status);
+}
+
+bool SFB::InputSource::GetBufferedRanges(std::vector<std::pair<SInt64, SInt64>>& ranges) const
+{
+	if(!IsOpen()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "GetBufferedRanges() called on an InputSource that hasn't been opened");
+		return false;
+	}
+
+	return _GetBufferedRanges(ranges);
+}
+
+bool SFB::InputSource::WaitForBuffering(SInt64 byteCount, CFTimeInterval timeout)
+{
+	if(!IsOpen()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "WaitForBuffering() called on an InputSource that hasn't been opened");
+		return false;
+	}
+
+	return _WaitForBuffering(byteCount, timeout);
+}
+
+void SFB::InputSource::SetConsumptionRate(double bytesPerSecond)
+{
+	if(!IsOpen()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "SetConsumptionRate() called on an InputSource that hasn't been opened");
+		return;
+	}
+
+	_SetConsumptionRate(bytesPerSecond);
+}
+
+void SFB::InputSource::SetReadAheadDuration(CFTimeInterval duration)
+{
+	if(!IsOpen()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "SetReadAheadDuration() called on an InputSource that hasn't been opened");
+		return;
+	}
+
+	if(0 > duration) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "SetReadAheadDuration() called with invalid parameters");
+		return;
+	}
+
+	_SetReadAheadDuration(duration);
+}
+
+bool SFB::InputSource::WouldBlock(SInt64 byteCount) const
+{
+	if(!IsOpen()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSource", "WouldBlock() called on an InputSource that hasn't been opened");
+		return false;
+	}
+
+	return _WouldBlock(byteCount);
+}
+
+void SFB::InputSource::SetReadabilityHandler(ReadabilityHandler handler)
+{
+	_SetReadabilityHandler(handler);
+}
+
+#pragma mark Default Implementations
+
+SInt64 SFB::InputSource::_ReadV(const struct iovec *vectors, int vectorCount)
+{
+	SInt64 bytesRead = 0;
+	for(int i = 0; i < vectorCount; ++i) {
+		SInt64 result = _Read(vectors[i].iov_base, (SInt64)vectors[i].iov_len);
+		if(-1 == result)
+			return 0 < bytesRead ? bytesRead : -1;
+
+		bytesRead += result;
+
+		// A short read indicates the end of input
+		if(result < (SInt64)vectors[i].iov_len)
+			break;
+	}
+
+	return bytesRead;
+}
@@ -6,6 +6,9 @@
 #pragma once
 
 #include <memory>
+#include <utility>
+#include <vector>
+#include <sys/uio.h>
 
 #include <CoreFoundation/CoreFoundation.h>
 
@@ -34,9 +37,61 @@ namespace SFB {
 		/*! Flags used in \c InputSource::CreateForURL */
 		enum InputSourceFlags {
 			MemoryMapFiles			= 1 << 0,	/*!< Files should be mapped in memory using \c mmap() */
-			LoadFilesInMemory		= 1 << 1	/*!< Files should be fully loaded in memory */
+			LoadFilesInMemory		= 1 << 1,	/*!< Files should be fully loaded in memory */
+			BufferInput				= 1 << 2,	/*!< Input not held in memory should be read in blocks, with the next block read ahead asynchronously */
+			ReadFilesAhead			= 1 << 3,	/*!< Files should be read asynchronously using dispatch I/O, ahead of the current offset */
+			AutomaticFileInput		= 1 << 4,	/*!< The input for each file should be chosen from its size, its volume and the access pattern, ignoring the other file flags */
+			SequentialAccess		= 1 << 5,	/*!< Input will be read mostly from start to end, as during playback */
+			RandomAccess			= 1 << 6	/*!< Input will be read at scattered offsets, as while scrubbing or seeking often */
 		};
 
+		/*! @brief The kinds of \c InputSource created by \c InputSource::CreateForURL */
+		enum class InputSourceType {
+			Other,				/*!< An input created other than by \c CreateForURL */
+			File,				/*!< A file read with \c fread() */
+			MemoryMappedFile,	/*!< A file mapped in memory */
+			InMemoryFile,		/*!< A file fully loaded in memory */
+			ReadAheadFile,		/*!< A file read ahead using dispatch I/O */
+			Buffered,			/*!< An input read in blocks, with the next block read ahead */
+			HTTP,				/*!< A resource read over HTTP */
+			ObjectStorage		/*!< An object read from object storage with ranged requests */
+		};
+
+		/*! @brief The default block size for buffered input, in bytes */
+		static const SInt64 DefaultBufferBlockSize = 64 * 1024;
+
+		/*! @brief The default size of the window in which memory-mapped files are mapped, in bytes */
+		static const SInt64 DefaultMemoryMapWindowSize = 64 * 1024 * 1024;
+
+		/*! @brief The default amount of a file read ahead of the current offset, in bytes */
+		static const SInt64 DefaultReadAheadWindowSize = 2 * 1024 * 1024;
+
+		/*! @brief Statistics on the time spent waiting for input */
+		struct StallStatistics {
+			UInt64 mStallCount;			/*!< The number of reads that waited for input */
+			double mTotalStallTime;		/*!< The total time spent waiting, in seconds */
+			double mMaximumStallTime;	/*!< The longest single wait, in seconds */
+		};
+
+		/*! @brief Information on the cache used for files loaded in memory */
+		struct FileCacheStatistics {
+			size_t mCapacity;			/*!< The maximum number of bytes retained for files not in use */
+			size_t mCachedBytes;		/*!< The number of bytes of file contents in the cache */
+			size_t mFileCount;			/*!< The number of files in the cache */
+			uint64_t mHitCount;			/*!< The number of files loaded from the cache */
+			uint64_t mMissCount;		/*!< The number of files not found in the cache */
+		};
+
+		/*! @brief The state of input received asynchronously ahead of the current offset */
+		struct BufferingStatus {
+			SInt64 mBytesAvailable;		/*!< The number of bytes following the current offset that can be read without waiting */
+			double mReceiveRate;		/*!< The measured rate at which input is received, in bytes per second, or \c 0 if unknown */
+			bool mComplete;				/*!< Whether all input following the current offset has been received */
+		};
+
+		/*! @brief A block called when input is received asynchronously or no further input can be received */
+		using ReadabilityHandler = void (^)();
+
 
 		// ========================================
 		/*! @name Factory Methods */
@@ -55,6 +110,18 @@ namespace SFB {
 		 */
 		static unique_ptr CreateForURL(CFURLRef url, int flags = 0, CFErrorRef *error = nullptr);
 
+		/*!
+		 * Choose the kind of \c InputSource used for a file with \c AutomaticFileInput
+		 *
+		 * Small files are loaded in memory.  Larger files on local volumes are mapped in memory when read at random
+		 * and read ahead when read sequentially.  Files on network and removable volumes, which may disappear and
+		 * raise \c SIGBUS when mapped, are never mapped.
+		 * @param url The file URL
+		 * @param flags The access pattern flags
+		 * @return The kind of input, or \c InputSourceType::File if the file's attributes can't be determined
+		 */
+		static InputSourceType ChooseFileInputSourceType(CFURLRef url, int flags);
+
 		/*!
 		 * Create a new \c InputSource for the given byte buffer
 		 * @param bytes A pointer to the desired byte buffer
@@ -66,6 +133,77 @@ namespace SFB {
 		 */
 		static unique_ptr CreateWithMemory(const void *bytes, SInt64 byteCount, bool copyBytes = true, CFErrorRef *error = nullptr);
 
+		/*!
+		 * Create a new \c InputSource reading the given \c InputSource in blocks
+		 *
+		 * Small reads are served from memory while the following block is read ahead on a background queue,
+		 * and seeks within the buffered blocks require no input.
+		 * @param inputSource The input source to buffer, which must have a URL
+		 * @param blockSize The size of each block, in bytes
+		 * @param error An optional pointer to a \c CFErrorRef to receive error information
+		 * @return A buffered \c InputSource, or \c nullptr on failure
+		 */
+		static unique_ptr CreateBuffered(unique_ptr inputSource, SInt64 blockSize = DefaultBufferBlockSize, CFErrorRef *error = nullptr);
+
+		/*!
+		 * Create a new \c InputSource reading the given file mapped in memory
+		 *
+		 * Files larger than \c windowSize are mapped one window at a time, bounding the memory used.
+		 * @param url The file URL
+		 * @param windowSize The maximum size of the mapping, in bytes
+		 * @param error An optional pointer to a \c CFErrorRef to receive error information
+		 * @return An \c InputSource for the specified URL, or \c nullptr on failure
+		 */
+		static unique_ptr CreateMemoryMapped(CFURLRef url, SInt64 windowSize = DefaultMemoryMapWindowSize, CFErrorRef *error = nullptr);
+
+		/*!
+		 * Create a new \c InputSource reading the given file asynchronously
+		 *
+		 * The file is read using dispatch I/O in chunks requested ahead of the current offset.  The kernel is
+		 * advised of upcoming reads and the data read is not cached.
+		 * @param url The file URL
+		 * @param windowSize The amount of the file to read ahead of the current offset, in bytes
+		 * @param error An optional pointer to a \c CFErrorRef to receive error information
+		 * @return An \c InputSource for the specified URL, or \c nullptr on failure
+		 */
+		static unique_ptr CreateReadAhead(CFURLRef url, SInt64 windowSize = DefaultReadAheadWindowSize, CFErrorRef *error = nullptr);
+
+		//@}
+
+
+		// ========================================
+		/*!
+		 * @name File Cache
+		 * Files loaded in memory using \c LoadFilesInMemory are held in a process-wide cache so inputs for the
+		 * same file share its contents.  Files are identified by path, inode and modification time, and the least
+		 * recently used are evicted when the capacity is exceeded.
+		 */
+		//@{
+
+		/*!
+		 * @brief Set the maximum number of bytes the file cache retains for files not in use
+		 * @param capacity The capacity in bytes, or \c 0 to disable caching
+		 */
+		static void SetFileCacheCapacity(size_t capacity);
+
+		/*! @brief Get information on the file cache */
+		static FileCacheStatistics GetFileCacheStatistics();
+
+		/*! @brief Remove all files from the file cache */
+		static void PurgeFileCache();
+
+		/*!
+		 * @brief Set whether files requested with \c LoadFilesInMemory are mapped instead of copied
+		 *
+		 * In low-memory mode files not already in the cache are memory mapped, so their pages may be discarded
+		 * by the system, and are not added to the cache.  Enabling low-memory mode purges the cache.
+		 * @param enabled Whether low-memory mode is enabled
+		 */
+		static void SetLowMemoryModeEnabled(bool enabled);
+
+		/*! @brief Query whether low-memory mode is enabled */
+		static bool IsLowMemoryModeEnabled();
+
 		//@}
 
 
@@ -96,6 +234,9 @@ namespace SFB {
 		/*! @brief Get the URL for this \c InputSource */
 		inline CFURLRef GetURL() const							{ return mURL; }
 
+		/*! @brief Get the kind of input chosen by \c CreateForURL() */
+		inline InputSourceType GetType() const					{ return mType; }
+
 		//@}
 
 
@@ -216,6 +357,70 @@ namespace SFB {
 		}
 
 
+		/*! @brief Query whether this \c InputSource can lend its bytes without copying */
+		bool SupportsBorrowing() const;
+
+		/*!
+		 * @brief Borrow bytes from the input without copying
+		 *
+		 * This is supported by inputs holding their bytes in addressable memory, and takes constant time.
+		 * The offset advances past the borrowed bytes as if they had been read.
+		 * @param bytes A pointer to receive the location of the bytes, which remain valid until the next operation on the input
+		 * @param byteCount The maximum number of bytes to borrow
+		 * @return The number of bytes borrowed, or \c -1 if borrowing is not supported
+		 */
+		SInt64 Borrow(const void *& bytes, SInt64 byteCount);
+
+		/*!
+		 * @brief Borrow bytes from the input if supported, otherwise read them into a buffer
+		 * @param bytes A pointer to receive the location of the bytes, either in the input or \c buffer
+		 * @param buffer The destination buffer if borrowing is not supported, holding at least \c byteCount bytes
+		 * @param byteCount The maximum number of bytes to borrow or read
+		 * @return The number of bytes borrowed or read
+		 */
+		SInt64 BorrowOrRead(const void *& bytes, void *buffer, SInt64 byteCount);
+
+
+		/*!
+		 * @brief Read bytes from the input into multiple buffers
+		 *
+		 * The buffers are filled in order, and a buffer is only partially filled if the end of input is reached.
+		 * @param vectors The buffers to receive the bytes
+		 * @param vectorCount The number of elements in \c vectors
+		 * @param offset The offset at which to read, or \c -1 to read at the current offset and advance it
+		 * @note A read at an explicit offset does not change the current offset.  If \c SupportsPositionalReads()
+		 * returns \c true such reads may be performed concurrently from multiple threads; otherwise the input
+		 * is repositioned for the read and must not be used by another thread
+		 * @return The number of bytes read, or \c -1 on error
+		 */
+		SInt64 ReadV(const struct iovec *vectors, int vectorCount, SInt64 offset = -1);
+
+		/*! @brief Query whether this \c InputSource can read at an explicit offset without repositioning */
+		bool SupportsPositionalReads() const;
+
+		/*!
+		 * @brief Read bytes from the input at an explicit offset
+		 *
+		 * The current offset is unchanged, so readers such as an analyzer and a decoder may share one input.
+		 * @param offset The offset at which to read
+		 * @param buffer A buffer to receive the bytes
+		 * @param byteCount The maximum number of bytes to read
+		 * @note This is safe to call concurrently with other reads only if \c SupportsPositionalReads() returns \c true
+		 * @return The number of bytes read, or \c -1 on error
+		 */
+		SInt64 ReadAt(SInt64 offset, void *buffer, SInt64 byteCount);
+
+		/*!
+		 * @brief Read the leading bytes used to identify the format of the input
+		 *
+		 * Any ID3v2 tag at the start of the input is skipped.  The current offset is unchanged.
+		 * @param buffer A buffer to receive the bytes
+		 * @param byteCount The maximum number of bytes to read
+		 * @return The number of bytes read, or \c 0 if the input couldn't be read
+		 */
+		size_t ReadSignature(void *buffer, size_t byteCount);
+
+
 		/*! @brief Determine whether the end of input has been reached */
 		bool AtEOF() const;
 
@@ -237,6 +442,75 @@ namespace SFB {
 		 */
 		bool SeekToOffset(SInt64 offset);
 
+
+		/*!
+		 * @brief Get statistics on the time reads spent waiting for input
+		 * @param statistics A \c StallStatistics to receive the statistics
+		 * @return \c true if statistics are collected by this \c InputSource, \c false otherwise
+		 */
+		bool GetStallStatistics(StallStatistics& statistics) const;
+
+
+		/*!
+		 * @brief Get the state of input received ahead of the current offset
+		 * @param status A \c BufferingStatus to receive the state
+		 * @return \c true if this \c InputSource receives input asynchronously, \c false otherwise
+		 */
+		bool GetBufferingStatus(BufferingStatus& status) const;
+
+		/*!
+		 * @brief Get the byte ranges of the input that have been received
+		 * @param ranges A \c std::vector to receive the disjoint ranges, as pairs of start and end offsets in ascending order
+		 * @return \c true if this \c InputSource receives input asynchronously, \c false otherwise
+		 */
+		bool GetBufferedRanges(std::vector<std::pair<SInt64, SInt64>>& ranges) const;
+
+		/*!
+		 * @brief Wait for input following the current offset to be received
+		 * @note Inputs not received asynchronously return immediately
+		 * @param byteCount The number of bytes to wait for, which may be limited by the amount this \c InputSource reads ahead
+		 * @param timeout The maximum time to wait, in seconds
+		 * @return \c true if the bytes are available or no further input can be received, \c false if the wait timed out
+		 */
+		bool WaitForBuffering(SInt64 byteCount, CFTimeInterval timeout);
+
+		/*!
+		 * @brief Set the rate at which input is expected to be consumed
+		 *
+		 * Inputs received asynchronously use this to determine how far ahead of the current offset to read.
+		 * @param bytesPerSecond The expected consumption rate, in bytes per second
+		 */
+		void SetConsumptionRate(double bytesPerSecond);
+
+		/*!
+		 * @brief Set the duration of input to read ahead of the current offset
+		 *
+		 * Inputs received asynchronously buffer compressed input, which is much smaller than the PCM decoded from it,
+		 * so a long read ahead allows playback to continue through interruptions in receiving input.  The duration is
+		 * converted to bytes using the consumption rate.
+		 * @param duration The duration in seconds, or \c 0 for the input's default
+		 */
+		void SetReadAheadDuration(CFTimeInterval duration);
+
+		/*!
+		 * @brief Query whether reading bytes at the current offset would wait for input to be received
+		 *
+		 * Decoders read their input synchronously, so a reader that mustn't wait checks before decoding and parks
+		 * until its readability handler is called.
+		 * @note Inputs not received asynchronously never block
+		 * @param byteCount The number of bytes to read, which may be limited by the amount this \c InputSource reads ahead
+		 * @return \c true if the read would wait, \c false if the bytes are available or no further input can be received
+		 */
+		bool WouldBlock(SInt64 byteCount) const;
+
+		/*!
+		 * @brief Set the block called when input is received
+		 * @note The handler is called on an internal thread and must not call back into this \c InputSource.  Once this
+		 * returns the previous handler is no longer called.
+		 * @param handler The handler, or \c nullptr to remove the current handler
+		 */
+		void SetReadabilityHandler(ReadabilityHandler handler);
+
 		//@}
 
 	protected:
@@ -261,9 +535,31 @@ namespace SFB {
 		virtual bool _SupportsSeeking() const					{ return false; }
 		virtual bool _SeekToOffset(SInt64 /*offset*/)			{ return false; }
 
+		// Optional borrowing support
+		virtual bool _SupportsBorrowing() const					{ return false; }
+		virtual SInt64 _Borrow(const void *& /*bytes*/, SInt64 /*byteCount*/)	{ return -1; }
+
+		// Optional vectored and positional read support
+		virtual SInt64 _ReadV(const struct iovec *vectors, int vectorCount);
+		virtual bool _SupportsPositionalReads() const			{ return false; }
+		virtual SInt64 _PositionalReadV(const struct iovec */*vectors*/, int /*vectorCount*/, SInt64 /*offset*/)	{ return -1; }
+
+		// Optional statistics
+		virtual bool _GetStallStatistics(StallStatistics& /*statistics*/) const	{ return false; }
+
+		// Optional buffering support
+		virtual bool _GetBufferingStatus(BufferingStatus& /*status*/) const		{ return false; }
+		virtual bool _GetBufferedRanges(std::vector<std::pair<SInt64, SInt64>>& /*ranges*/) const	{ return false; }
+		virtual bool _WaitForBuffering(SInt64 /*byteCount*/, CFTimeInterval /*timeout*/)	{ return true; }
+		virtual void _SetConsumptionRate(double /*bytesPerSecond*/)				{}
+		virtual void _SetReadAheadDuration(CFTimeInterval /*duration*/)			{}
+		virtual bool _WouldBlock(SInt64 /*byteCount*/) const					{ return false; }
+		virtual void _SetReadabilityHandler(ReadabilityHandler /*handler*/)		{}
+
 		// Data members
 		SFB::CFURL mURL;	/*!< @brief The location of the bytes to be read */
 		bool mIsOpen;		/*!< @brief Indicates if input is open */
+		InputSourceType mType;	/*!< @brief The kind of input chosen by \c CreateForURL() */
 
 	};
 
@@ -3,6 +3,8 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 #include "MemoryInputSource.h"
@@ -57,6 +59,40 @@ SInt64 SFB::MemoryInputSource::_Read(void *buffer, SInt64 byteCount)
 	return byteCount;
 }
 
+SInt64 SFB::MemoryInputSource::_Borrow(const void *& bytes, SInt64 byteCount)
+{
+	ptrdiff_t remaining = (mMemory.get() + mByteCount) - mCurrentPosition;
+
+	if(byteCount > remaining)
+		byteCount = remaining;
+
+	bytes = mCurrentPosition;
+	mCurrentPosition += byteCount;
+	return byteCount;
+}
+
+SInt64 SFB::MemoryInputSource::_PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset)
+{
+	// The bytes are immutable and the current position is untouched, so concurrent reads are safe
+	if(offset > mByteCount)
+		return -1;
+
+	const int8_t *position = mMemory.get() + offset;
+	SInt64 remaining = mByteCount - offset;
+
+	SInt64 bytesRead = 0;
+	for(int i = 0; i < vectorCount && 0 < remaining; ++i) {
+		SInt64 byteCount = std::min((SInt64)vectors[i].iov_len, remaining);
+		memcpy(vectors[i].iov_base, position, (size_t)byteCount);
+
+		position += byteCount;
+		remaining -= byteCount;
+		bytesRead += byteCount;
+	}
+
+	return bytesRead;
+}
+
 bool SFB::MemoryInputSource::_SeekToOffset(SInt64 offset)
 {
 	if(offset > mByteCount)
@@ -39,6 +39,14 @@ namespace SFB {
 		inline virtual bool _SupportsSeeking() const			{ return true; }
 		virtual bool _SeekToOffset(SInt64 offset);
 
+		// Borrowing support
+		inline virtual bool _SupportsBorrowing() const			{ return true; }
+		virtual SInt64 _Borrow(const void *& bytes, SInt64 byteCount);
+
+		// Positional read support
+		inline virtual bool _SupportsPositionalReads() const	{ return true; }
+		virtual SInt64 _PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset);
+
 		using unique_mem_ptr = std::unique_ptr<int8_t, void (*)(int8_t *)>;
 
 		// Data members
@@ -3,20 +3,36 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <algorithm>
+#include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
 
 #include "MemoryMappedFileInputSource.h"
+#include "Logger.h"
+
+// Access advice is updated each time the offset advances this far
+#define ADVICE_STRIDE_BYTES (1024 * 1024)
+
+// The amount of the file following the offset the kernel is asked to read ahead
+#define READ_AHEAD_BYTES (2 * ADVICE_STRIDE_BYTES)
 
 #pragma mark Creation and Destruction
 
-SFB::MemoryMappedFileInputSource::MemoryMappedFileInputSource(CFURLRef url)
-	: InputSource(url), mMemory(nullptr), mCurrentPosition(nullptr)
+SFB::MemoryMappedFileInputSource::MemoryMappedFileInputSource(CFURLRef url, SInt64 windowSize)
+	: InputSource(url), mWindowSize(windowSize), mFile(-1), mMapping(nullptr), mMappingOffset(0), mMappingLength(0), mAdvisedOffset(-1), mReleasedLength(0), mOffset(0)
 {
+	assert(0 < mWindowSize);
 	memset(&mFilestats, 0, sizeof(mFilestats));
 }
 
+SFB::MemoryMappedFileInputSource::~MemoryMappedFileInputSource()
+{
+	if(IsOpen())
+		Close();
+}
+
 bool SFB::MemoryMappedFileInputSource::_Open(CFErrorRef *error)
 {
 	UInt8 buf [PATH_MAX];
@@ -27,16 +43,17 @@ bool SFB::MemoryMappedFileInputSource::_Open(CFErrorRef *error)
 		return false;
 	}
 
-	auto file = std::unique_ptr<std::FILE, int (*)(std::FILE *)>(std::fopen((const char *)buf, "r"), std::fclose);
-	if(!file) {
+	mFile = ::open((const char *)buf, O_RDONLY);
+	if(-1 == mFile) {
 		if(error)
 			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
 		return false;
 	}
 
-	if(-1 == fstat(::fileno(file.get()), &mFilestats)) {
+	if(-1 == fstat(mFile, &mFilestats)) {
 		if(error)
 			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		_Close(nullptr);
 		return false;
 	}
 
@@ -44,20 +61,19 @@ bool SFB::MemoryMappedFileInputSource::_Open(CFErrorRef *error)
 	if(!S_ISREG(mFilestats.st_mode)) {
 		if(error)
 			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EBADF, nullptr);
+		_Close(nullptr);
 		return false;
 	}
 
-	// Map the file to memory
-	size_t map_size = (size_t)mFilestats.st_size;
-	mMemory = unique_mappedmem_ptr((int8_t *)mmap(0, map_size, PROT_READ, MAP_FILE | MAP_SHARED, ::fileno(file.get()), 0), std::bind(munmap, std::placeholders::_1, map_size));
-
-	if(MAP_FAILED == mMemory.get()) {
+	// Map the first window so errors are reported when opening
+	if(0 < mFilestats.st_size && !MapRange(0, 0)) {
 		if(error)
 			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		_Close(nullptr);
 		return false;
 	}
 
-	mCurrentPosition = mMemory.get();
+	mOffset = 0;
 
 	return true;
 }
@@ -66,22 +82,62 @@ bool SFB::MemoryMappedFileInputSource::_Close(CFErrorRef *error)
 {
 #pragma unused(error)
 
+	Unmap();
+
+	if(-1 != mFile) {
+		::close(mFile);
+		mFile = -1;
+	}
+
 	memset(&mFilestats, 0, sizeof(mFilestats));
-	mMemory.reset();
-	mCurrentPosition = nullptr;
+	mOffset = 0;
 
 	return true;
 }
 
 SInt64 SFB::MemoryMappedFileInputSource::_Read(void *buffer, SInt64 byteCount)
 {
-	ptrdiff_t remaining = (mMemory.get() + mFilestats.st_size) - mCurrentPosition;
+	byteCount = std::min(byteCount, mFilestats.st_size - mOffset);
+
+	auto output = static_cast<int8_t *>(buffer);
+	SInt64 bytesRead = 0;
 
-	if(byteCount > remaining)
-		byteCount = remaining;
+	// The read is copied a window at a time
+	while(bytesRead < byteCount) {
+		if(!MapRange(mOffset, 1)) {
+			LOGGER_ERR("org.sbooth.AudioEngine.InputSource.MemoryMappedFile", "mmap failed: " << strerror(errno));
+			return 0 < bytesRead ? bytesRead : -1;
+		}
+
+		SInt64 bytesToCopy = std::min(byteCount - bytesRead, mMappingOffset + mMappingLength - mOffset);
+		memcpy(output + bytesRead, mMapping + (mOffset - mMappingOffset), (size_t)bytesToCopy);
+
+		bytesRead += bytesToCopy;
+		mOffset += bytesToCopy;
+	}
+
+	AdviseAccess();
+
+	return bytesRead;
+}
+
+SInt64 SFB::MemoryMappedFileInputSource::_Borrow(const void *& bytes, SInt64 byteCount)
+{
+	byteCount = std::min(byteCount, mFilestats.st_size - mOffset);
+	if(0 >= byteCount)
+		return 0;
+
+	// The borrowed bytes must be contiguous, so the mapping is extended if necessary
+	if(!MapRange(mOffset, byteCount)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.InputSource.MemoryMappedFile", "mmap failed: " << strerror(errno));
+		return -1;
+	}
+
+	bytes = mMapping + (mOffset - mMappingOffset);
+	mOffset += byteCount;
+
+	AdviseAccess();
 
-	memcpy(buffer, mCurrentPosition, (size_t)byteCount);
-	mCurrentPosition += byteCount;
 	return byteCount;
 }
 
@@ -90,6 +146,112 @@ bool SFB::MemoryMappedFileInputSource::_SeekToOffset(SInt64 offset)
 	if(offset > mFilestats.st_size)
 		return false;
 
-	mCurrentPosition = mMemory.get() + offset;
+	// The window is moved by the next read
+	mOffset = offset;
 	return true;
 }
+
+SInt64 SFB::MemoryMappedFileInputSource::_PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset)
+{
+	// preadv(2) isn't available on all supported systems, so each buffer is read separately.
+	// pread(2) doesn't use or change the file offset, so concurrent reads are safe
+	SInt64 bytesRead = 0;
+	for(int i = 0; i < vectorCount; ++i) {
+		auto buffer = static_cast<int8_t *>(vectors[i].iov_base);
+		size_t bufferBytesRead = 0;
+
+		while(bufferBytesRead < vectors[i].iov_len) {
+			ssize_t result = ::pread(mFile, buffer + bufferBytesRead, vectors[i].iov_len - bufferBytesRead, (off_t)(offset + bytesRead));
+			if(-1 == result) {
+				if(EINTR == errno)
+					continue;
+				LOGGER_ERR("org.sbooth.AudioEngine.InputSource.MemoryMappedFile", "pread failed: " << strerror(errno));
+				return 0 < bytesRead ? bytesRead : -1;
+			}
+
+			// End of file
+			if(0 == result)
+				return bytesRead;
+
+			bufferBytesRead += (size_t)result;
+			bytesRead += result;
+		}
+	}
+
+	return bytesRead;
+}
+
+bool SFB::MemoryMappedFileInputSource::MapRange(SInt64 offset, SInt64 byteCount)
+{
+	if(mMapping && offset >= mMappingOffset && offset + byteCount <= mMappingOffset + mMappingLength)
+		return true;
+
+	Unmap();
+
+	static const SInt64 sPageSize = getpagesize();
+
+	// Files no larger than the window are mapped entirely; otherwise a little of the file preceding
+	// offset is retained so short backward seeks don't require a new mapping
+	SInt64 start = 0;
+	if(mFilestats.st_size > mWindowSize) {
+		start = std::max((SInt64)0, offset - (mWindowSize / 8));
+		start -= start % sPageSize;
+	}
+
+	SInt64 length = std::min(std::max(mWindowSize, offset + byteCount - start), mFilestats.st_size - start);
+
+	void *mapping = mmap(nullptr, (size_t)length, PROT_READ, MAP_FILE | MAP_SHARED, mFile, (off_t)start);
+	if(MAP_FAILED == mapping)
+		return false;
+
+	madvise(mapping, (size_t)length, MADV_SEQUENTIAL);
+
+	mMapping = static_cast<int8_t *>(mapping);
+	mMappingOffset = start;
+	mMappingLength = length;
+	mAdvisedOffset = -1;
+	mReleasedLength = 0;
+
+	return true;
+}
+
+void SFB::MemoryMappedFileInputSource::Unmap()
+{
+	if(mMapping) {
+		munmap(mMapping, (size_t)mMappingLength);
+		mMapping = nullptr;
+	}
+
+	mMappingOffset = 0;
+	mMappingLength = 0;
+	mAdvisedOffset = -1;
+	mReleasedLength = 0;
+}
+
+void SFB::MemoryMappedFileInputSource::AdviseAccess()
+{
+	if(!mMapping || (-1 != mAdvisedOffset && mOffset >= mAdvisedOffset && mOffset - mAdvisedOffset < ADVICE_STRIDE_BYTES))
+		return;
+
+	mAdvisedOffset = mOffset;
+
+	static const SInt64 sPageSize = getpagesize();
+	SInt64 position = std::min(mOffset - mMappingOffset, mMappingLength);
+
+	// Request the pages about to be read
+	SInt64 aheadStart = position - (position % sPageSize);
+	SInt64 aheadLength = std::min((SInt64)READ_AHEAD_BYTES, mMappingLength - aheadStart);
+	if(0 < aheadLength)
+		madvise(mMapping + aheadStart, (size_t)aheadLength, MADV_WILLNEED);
+
+	// Release the pages more than a stride behind the offset
+	SInt64 releaseEnd = position - ADVICE_STRIDE_BYTES;
+	releaseEnd -= releaseEnd % sPageSize;
+	if(releaseEnd > mReleasedLength) {
+		madvise(mMapping + mReleasedLength, (size_t)(releaseEnd - mReleasedLength), MADV_DONTNEED);
+		mReleasedLength = releaseEnd;
+	}
+	// A backward seek makes the released pages resident again
+	else if(releaseEnd < mReleasedLength)
+		mReleasedLength = std::max((SInt64)0, releaseEnd);
+}
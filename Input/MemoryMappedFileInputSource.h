@@ -5,7 +5,6 @@
 
 #pragma once
 
-#include <memory>
 #include <sys/stat.h>
 
 #include "InputSource.h"
@@ -14,6 +13,10 @@ namespace SFB {
 
 	// ========================================
 	// InputSource serving bytes from a memory-mapped file
+	//
+	// Files larger than the window size are mapped a window at a time, so the address space and
+	// memory used are bounded regardless of file size.  The kernel is advised to read ahead of the
+	// current offset and to release pages behind it.
 	// ========================================
 	class MemoryMappedFileInputSource : public InputSource
 	{
@@ -21,7 +24,8 @@ namespace SFB {
 	public:
 
 		// Creation
-		explicit MemoryMappedFileInputSource(CFURLRef url);
+		MemoryMappedFileInputSource(CFURLRef url, SInt64 windowSize);
+		virtual ~MemoryMappedFileInputSource();
 
 	private:
 
@@ -31,21 +35,42 @@ namespace SFB {
 
 		// Functionality
 		virtual SInt64 _Read(void *buffer, SInt64 byteCount);
-		virtual bool _AtEOF() const								{ return ((mCurrentPosition - mMemory.get()) == mFilestats.st_size); }
+		virtual bool _AtEOF() const								{ return mOffset == mFilestats.st_size; }
 
-		inline virtual SInt64 _GetOffset() const				{ return (mCurrentPosition - mMemory.get()); }
+		inline virtual SInt64 _GetOffset() const				{ return mOffset; }
 		inline virtual SInt64 _GetLength() const				{ return mFilestats.st_size; }
 
 		// Seeking support
 		inline virtual bool _SupportsSeeking() const			{ return true; }
 		virtual bool _SeekToOffset(SInt64 offset);
 
-		using unique_mappedmem_ptr = std::unique_ptr<int8_t, std::function<int(int8_t *)>>;
+		// Borrowing support
+		inline virtual bool _SupportsBorrowing() const			{ return true; }
+		virtual SInt64 _Borrow(const void *& bytes, SInt64 byteCount);
+
+		// Positional read support
+		inline virtual bool _SupportsPositionalReads() const	{ return true; }
+		virtual SInt64 _PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset);
+
+		// Ensure the bytes [offset, offset + byteCount) are mapped, replacing the current mapping if necessary
+		bool MapRange(SInt64 offset, SInt64 byteCount);
+		void Unmap();
+
+		// Advise the kernel of the access pattern following a read
+		void AdviseAccess();
 
 		// Data members
 		struct stat						mFilestats;
-		unique_mappedmem_ptr			mMemory;
-		int8_t							*mCurrentPosition;
+		SInt64							mWindowSize;
+		int								mFile;
+
+		int8_t							*mMapping;
+		SInt64							mMappingOffset;		// The file offset of the start of the mapping
+		SInt64							mMappingLength;
+		SInt64							mAdvisedOffset;		// The offset at which access was last advised, or -1
+		SInt64							mReleasedLength;	// The length of the mapping released to the kernel
+
+		SInt64							mOffset;
 	};
 
 }
@@ -0,0 +1,606 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+
+#include <Block.h>
+
+#if TARGET_OS_IPHONE
+# include <CFNetwork/CFNetwork.h>
+#else
+# include <CoreServices/CoreServices.h>
+#endif
+
+#include "ObjectStorageInputSource.h"
+#include "Logger.h"
+
+// The size of the chunks requested from the object store
+#define CHUNK_SIZE_BYTES (1024 * 1024)
+
+// The maximum number of concurrent range requests for an input
+#define MAXIMUM_CONCURRENT_REQUESTS 4
+
+// The number of chunks fetched ahead of the current offset
+#define PREFETCH_CHUNK_COUNT 4
+
+// The number of recently used chunks an input retains regardless of the cache
+#define RETAINED_CHUNK_COUNT (2 * PREFETCH_CHUNK_COUNT + 2)
+
+// The default amount of memory the chunk cache may use
+#define DEFAULT_CHUNK_CACHE_CAPACITY_BYTES (64 * 1024 * 1024)
+
+namespace {
+
+	// ========================================
+	// A least recently used cache of object chunks shared by all inputs
+	class ChunkCache
+	{
+
+	public:
+
+		using key_type = std::pair<std::string, SInt64>;
+
+		ChunkCache()
+			: mCapacity(DEFAULT_CHUNK_CACHE_CAPACITY_BYTES), mCachedBytes(0)
+		{}
+
+		ChunkCache(const ChunkCache& rhs) = delete;
+		ChunkCache& operator=(const ChunkCache& rhs) = delete;
+
+		SFB::ObjectStorageInputSource::chunk_ptr Find(const std::string& object, SInt64 index)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			auto iter = mIndex.find(key_type(object, index));
+			if(iter == mIndex.end())
+				return nullptr;
+
+			mEntries.splice(mEntries.begin(), mEntries, iter->second);
+			return iter->second->second;
+		}
+
+		void Insert(const std::string& object, SInt64 index, SFB::ObjectStorageInputSource::chunk_ptr chunk)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			key_type key(object, index);
+			if(mIndex.find(key) != mIndex.end())
+				return;
+
+			mEntries.push_front({ key, chunk });
+			mIndex[key] = mEntries.begin();
+			mCachedBytes += chunk->size();
+
+			Trim();
+		}
+
+		void SetCapacity(size_t capacity)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mCapacity = capacity;
+			Trim();
+		}
+
+		void Purge()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mEntries.clear();
+			mIndex.clear();
+			mCachedBytes = 0;
+		}
+
+	private:
+
+		using entry_list = std::list<std::pair<key_type, SFB::ObjectStorageInputSource::chunk_ptr>>;
+
+		// mMutex must be held
+		void Trim()
+		{
+			while(mCachedBytes > mCapacity && !mEntries.empty()) {
+				auto& entry = mEntries.back();
+				mCachedBytes -= entry.second->size();
+				mIndex.erase(entry.first);
+				mEntries.pop_back();
+			}
+		}
+
+		std::mutex									mMutex;
+		entry_list									mEntries;		// Most recently used first
+		std::map<key_type, entry_list::iterator>	mIndex;
+		size_t										mCapacity;
+		size_t										mCachedBytes;
+	};
+
+	ChunkCache sChunkCache;
+
+	// Copy the value of the named header as a C string
+	bool GetHeaderValue(CFHTTPMessageRef response, CFStringRef name, char *buf, CFIndex bufsize)
+	{
+		SFB::CFString value(CFHTTPMessageCopyHeaderFieldValue(response, name));
+		return value && CFStringGetCString(value, buf, bufsize, kCFStringEncodingASCII);
+	}
+
+	// Fetch byteCount bytes of the object at url starting at offset, blocking the calling thread
+	bool FetchRange(CFURLRef url, SInt64 offset, SInt64 byteCount, std::vector<uint8_t>& bytes, SInt64& objectLength)
+	{
+		SFB::CFHTTPMessage request(CFHTTPMessageCreateRequest(kCFAllocatorDefault, CFSTR("GET"), url, kCFHTTPVersion1_1));
+		if(!request)
+			return false;
+
+		CFHTTPMessageSetHeaderFieldValue(request, CFSTR("User-Agent"), CFSTR("SFBAudioEngine"));
+
+		SFB::CFString byteRange(nullptr, CFSTR("bytes=%lld-%lld"), offset, offset + byteCount - 1);
+		CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Range"), byteRange);
+
+		SFB::CFReadStream stream(CFReadStreamCreateForHTTPRequest(kCFAllocatorDefault, request));
+		if(!stream)
+			return false;
+
+		// Requests for the same object reuse connections instead of performing new handshakes
+		CFReadStreamSetProperty(stream, kCFStreamPropertyHTTPAttemptPersistentConnection, kCFBooleanTrue);
+		CFReadStreamSetProperty(stream, kCFStreamPropertyHTTPShouldAutoredirect, kCFBooleanTrue);
+
+		if(!CFReadStreamOpen(stream)) {
+			SFB::CFError error(CFReadStreamCopyError(stream));
+			LOGGER_ERR("org.sbooth.AudioEngine.InputSource.ObjectStorage", "Error opening stream for " << url << ": " << error);
+			return false;
+		}
+
+		bytes.resize((size_t)byteCount);
+		SInt64 bytesRead = 0;
+		bool validated = false;
+
+		for(;;) {
+			CFIndex result = CFReadStreamRead(stream, bytes.data() + bytesRead, (CFIndex)(byteCount - bytesRead));
+			if(0 > result) {
+				SFB::CFError error(CFReadStreamCopyError(stream));
+				LOGGER_ERR("org.sbooth.AudioEngine.InputSource.ObjectStorage", "Error reading " << url << ": " << error);
+				CFReadStreamClose(stream);
+				return false;
+			}
+
+			// The response header is available once the first bytes have been received
+			if(!validated) {
+				SFB::CFType responseHeader(CFReadStreamCopyProperty(stream, kCFStreamPropertyHTTPResponseHeader));
+				if(!responseHeader) {
+					LOGGER_ERR("org.sbooth.AudioEngine.InputSource.ObjectStorage", "No response received for " << url);
+					CFReadStreamClose(stream);
+					return false;
+				}
+
+				auto response = (CFHTTPMessageRef)responseHeader.Object();
+				CFIndex statusCode = CFHTTPMessageGetResponseStatusCode(response);
+
+				char buf [128];
+				if(206 == statusCode) {
+					long long first, last, total;
+					if(!GetHeaderValue(response, CFSTR("Content-Range"), buf, sizeof(buf)) || 3 != sscanf(buf, "bytes %lld-%lld/%lld", &first, &last, &total) || first != offset) {
+						LOGGER_ERR("org.sbooth.AudioEngine.InputSource.ObjectStorage", "Missing or invalid Content-Range in partial response");
+						CFReadStreamClose(stream);
+						return false;
+					}
+
+					objectLength = total;
+				}
+				// An object store ignoring the range sends the entire object
+				else if(200 == statusCode && 0 == offset) {
+					if(GetHeaderValue(response, CFSTR("Content-Length"), buf, sizeof(buf)))
+						objectLength = strtoll(buf, nullptr, 10);
+				}
+				else {
+					LOGGER_ERR("org.sbooth.AudioEngine.InputSource.ObjectStorage", "HTTP status " << statusCode << " for " << url);
+					CFReadStreamClose(stream);
+					return false;
+				}
+
+				validated = true;
+			}
+
+			bytesRead += result;
+			if(0 == result || bytesRead == byteCount)
+				break;
+		}
+
+		CFReadStreamClose(stream);
+
+		// The final chunk is shorter than requested
+		bytes.resize((size_t)bytesRead);
+		bytes.shrink_to_fit();
+
+		return validated;
+	}
+
+}
+
+#pragma mark Creation and Destruction
+
+bool SFB::ObjectStorageInputSource::HandlesURL(CFURLRef url)
+{
+	if(nullptr == url)
+		return false;
+
+	SFB::CFString scheme(CFURLCopyScheme(url));
+	if(!scheme)
+		return false;
+
+	if(kCFCompareEqualTo == CFStringCompare(CFSTR("s3"), scheme, kCFCompareCaseInsensitive))
+		return true;
+
+	if(kCFCompareEqualTo != CFStringCompare(CFSTR("https"), scheme, kCFCompareCaseInsensitive))
+		return false;
+
+	// Presigned requests carry their signature in the query
+	SFB::CFString query(CFURLCopyQueryString(url, nullptr));
+	if(query && CFStringFind(query, CFSTR("X-Amz-Signature="), 0).location != kCFNotFound)
+		return true;
+
+	SFB::CFString host(CFURLCopyHostName(url));
+	return host && (CFStringHasSuffix(host, CFSTR(".amazonaws.com")) || kCFCompareEqualTo == CFStringCompare(CFSTR("storage.googleapis.com"), host, kCFCompareCaseInsensitive));
+}
+
+SFB::ObjectStorageInputSource::ObjectStorageInputSource(CFURLRef url)
+	: InputSource(url), mRequestURL(nullptr), mChunkSize(CHUNK_SIZE_BYTES), mLastChunk(-1), mReadingBackward(false), mClosing(false), mReadabilityHandler(nullptr), mFetchGroup(nullptr), mOffset(-1), mLength(-1)
+{}
+
+SFB::ObjectStorageInputSource::~ObjectStorageInputSource()
+{
+	if(IsOpen())
+		Close();
+}
+
+void SFB::ObjectStorageInputSource::SetChunkCacheCapacity(size_t capacity)
+{
+	sChunkCache.SetCapacity(capacity);
+}
+
+void SFB::ObjectStorageInputSource::PurgeChunkCache()
+{
+	sChunkCache.Purge();
+}
+
+bool SFB::ObjectStorageInputSource::_Open(CFErrorRef *error)
+{
+	// s3://bucket/key is read from the bucket's virtual-hosted endpoint
+	SFB::CFString scheme(CFURLCopyScheme(GetURL()));
+	if(kCFCompareEqualTo == CFStringCompare(CFSTR("s3"), scheme, kCFCompareCaseInsensitive)) {
+		SFB::CFString bucket(CFURLCopyHostName(GetURL()));
+		SFB::CFString key(CFURLCopyPath(GetURL()));
+		if(!bucket || !key) {
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+			return false;
+		}
+
+		SFB::CFString requestURL(nullptr, CFSTR("https://%@.s3.amazonaws.com%@"), (CFStringRef)bucket, (CFStringRef)key);
+		mRequestURL = CFURLCreateWithString(kCFAllocatorDefault, requestURL, nullptr);
+	}
+	else
+		mRequestURL = (CFURLRef)CFRetain(GetURL());
+
+	if(!mRequestURL) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return false;
+	}
+
+	// Presigned URLs for the same object share cached chunks
+	char buf [2048];
+	if(!CFStringGetCString(CFURLGetString(mRequestURL), buf, sizeof(buf), kCFStringEncodingUTF8)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENAMETOOLONG, nullptr);
+		return false;
+	}
+
+	mCacheKey = buf;
+	auto query = mCacheKey.find('?');
+	if(std::string::npos != query)
+		mCacheKey.erase(query);
+
+	mFetchGroup = dispatch_group_create();
+	if(!mFetchGroup) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+		return false;
+	}
+
+	// The first chunk is always fetched synchronously since it determines the object's length
+	auto bytes = std::make_shared<std::vector<uint8_t>>();
+	SInt64 length = -1;
+	if(!FetchRange(mRequestURL, 0, mChunkSize, *bytes, length) || -1 == length) {
+		dispatch_release(mFetchGroup);
+		mFetchGroup = nullptr;
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EIO, nullptr);
+		return false;
+	}
+
+	sChunkCache.Insert(mCacheKey, 0, bytes);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mChunks[0] = bytes;
+	mLength = length;
+	mOffset = 0;
+	mLastChunk = -1;
+	mReadingBackward = false;
+	mClosing = false;
+
+	FetchChunks(0);
+
+	return true;
+}
+
+bool SFB::ObjectStorageInputSource::_Close(CFErrorRef */*error*/)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mClosing = true;
+	}
+
+	// Fetches in progress complete before the input is torn down
+	if(mFetchGroup) {
+		dispatch_group_wait(mFetchGroup, DISPATCH_TIME_FOREVER);
+		dispatch_release(mFetchGroup);
+		mFetchGroup = nullptr;
+	}
+
+	_SetReadabilityHandler(nullptr);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mChunks.clear();
+	mPendingChunks.clear();
+	mFailedChunks.clear();
+	mRequestURL = nullptr;
+
+	mOffset = -1;
+	mLength = -1;
+
+	return true;
+}
+
+#pragma mark Functionality
+
+SInt64 SFB::ObjectStorageInputSource::_Read(void *buffer, SInt64 byteCount)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	SInt64 bytesRead = ReadBytes(lock, static_cast<uint8_t *>(buffer), byteCount, mOffset);
+	if(0 < bytesRead)
+		mOffset += bytesRead;
+
+	return bytesRead;
+}
+
+SInt64 SFB::ObjectStorageInputSource::_PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset)
+{
+	SInt64 bytesRead = 0;
+
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	for(int i = 0; i < vectorCount; ++i) {
+		SInt64 byteCount = (SInt64)vectors[i].iov_len;
+		SInt64 bufferBytesRead = ReadBytes(lock, static_cast<uint8_t *>(vectors[i].iov_base), byteCount, offset + bytesRead);
+		if(0 > bufferBytesRead)
+			return 0 < bytesRead ? bytesRead : -1;
+
+		bytesRead += bufferBytesRead;
+		if(bufferBytesRead < byteCount)
+			break;
+	}
+
+	return bytesRead;
+}
+
+bool SFB::ObjectStorageInputSource::_AtEOF() const
+{
+	SInt64 length = mLength;
+	return -1 != length && mOffset >= length;
+}
+
+bool SFB::ObjectStorageInputSource::_SeekToOffset(SInt64 offset)
+{
+	if(0 > offset || offset > mLength)
+		return false;
+
+	// Fetching begins at the new offset before it is read
+	std::lock_guard<std::mutex> lock(mMutex);
+	mOffset = offset;
+	if(offset < mLength)
+		FetchChunks(offset / mChunkSize);
+
+	return true;
+}
+
+#pragma mark Buffering
+
+bool SFB::ObjectStorageInputSource::_GetBufferingStatus(BufferingStatus& status) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	SInt64 length = mLength;
+	SInt64 end = mOffset;
+	while(end < length && FindChunk(end / mChunkSize))
+		end = std::min(((end / mChunkSize) + 1) * mChunkSize, length);
+
+	status.mBytesAvailable = end - mOffset;
+	status.mReceiveRate = 0;
+	status.mComplete = end >= length;
+
+	return true;
+}
+
+bool SFB::ObjectStorageInputSource::_WaitForBuffering(SInt64 byteCount, CFTimeInterval timeout)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	// Bytes beyond the prefetch window will not be fetched until the offset advances
+	byteCount = std::min(byteCount, PREFETCH_CHUNK_COUNT * mChunkSize);
+
+	auto ready = [&] {
+		SInt64 end = std::min(mOffset + byteCount, (SInt64)mLength);
+		for(SInt64 index = mOffset / mChunkSize; index * mChunkSize < end; ++index) {
+			if(!FindChunk(index) && !mFailedChunks.count(index))
+				return false;
+		}
+		return true;
+	};
+
+	if(mOffset < mLength)
+		FetchChunks(mOffset / mChunkSize);
+
+	return mCondition.wait_for(lock, std::chrono::duration<double>(timeout), ready);
+}
+
+bool SFB::ObjectStorageInputSource::_WouldBlock(SInt64 byteCount) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	SInt64 end = std::min(mOffset + std::min(byteCount, PREFETCH_CHUNK_COUNT * mChunkSize), (SInt64)mLength);
+	for(SInt64 index = mOffset / mChunkSize; index * mChunkSize < end; ++index) {
+		if(!FindChunk(index) && !mFailedChunks.count(index))
+			return true;
+	}
+
+	return false;
+}
+
+void SFB::ObjectStorageInputSource::_SetReadabilityHandler(ReadabilityHandler handler)
+{
+	// The handler is called with mMutex held, so it is not called once replaced
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if(mReadabilityHandler)
+		Block_release(mReadabilityHandler);
+	mReadabilityHandler = handler ? Block_copy(handler) : nullptr;
+}
+
+#pragma mark Chunk Management
+
+SInt64 SFB::ObjectStorageInputSource::ReadBytes(std::unique_lock<std::mutex>& lock, uint8_t *buffer, SInt64 byteCount, SInt64 offset)
+{
+	SInt64 bytesRead = 0;
+
+	while(bytesRead < byteCount) {
+		SInt64 position = offset + bytesRead;
+		SInt64 length = mLength;
+		if(position >= length)
+			break;
+
+		SInt64 index = position / mChunkSize;
+
+		// A read moving to a lower chunk reverses the direction of prefetching
+		if(index != mLastChunk) {
+			if(-1 != mLastChunk)
+				mReadingBackward = index < mLastChunk;
+			mLastChunk = index;
+			FetchChunks(index);
+		}
+
+		auto chunk = FindChunk(index);
+		if(!chunk) {
+			// A failure is reported once and the chunk is fetched again on the next read
+			if(mFailedChunks.erase(index)) {
+				mLastChunk = -1;
+				return 0 < bytesRead ? bytesRead : -1;
+			}
+
+			FetchChunk(index);
+			if(mPendingChunks.count(index))
+				mCondition.wait(lock);
+			continue;
+		}
+
+		SInt64 chunkOffset = position - (index * mChunkSize);
+		if(chunkOffset >= (SInt64)chunk->size())
+			break;
+
+		SInt64 bytesToCopy = std::min((SInt64)chunk->size() - chunkOffset, byteCount - bytesRead);
+		memcpy(buffer + bytesRead, chunk->data() + chunkOffset, (size_t)bytesToCopy);
+		bytesRead += bytesToCopy;
+	}
+
+	return bytesRead;
+}
+
+SFB::ObjectStorageInputSource::chunk_ptr SFB::ObjectStorageInputSource::FindChunk(SInt64 index) const
+{
+	auto iter = mChunks.find(index);
+	if(iter != mChunks.end())
+		return iter->second;
+
+	return sChunkCache.Find(mCacheKey, index);
+}
+
+void SFB::ObjectStorageInputSource::FetchChunks(SInt64 index)
+{
+	FetchChunk(index);
+
+	// Chunks ahead in the direction of reading are fetched while requests are available
+	for(SInt64 i = 1; i <= PREFETCH_CHUNK_COUNT && (size_t)MAXIMUM_CONCURRENT_REQUESTS > mPendingChunks.size(); ++i) {
+		SInt64 next = mReadingBackward ? index - i : index + i;
+		if(0 > next || next >= GetChunkCount())
+			break;
+		FetchChunk(next);
+	}
+
+	// Chunks far from the current one are released to the cache
+	while((size_t)RETAINED_CHUNK_COUNT < mChunks.size()) {
+		auto first = mChunks.begin(), last = std::prev(mChunks.end());
+		if(index - first->first > last->first - index)
+			mChunks.erase(first);
+		else
+			mChunks.erase(last);
+	}
+}
+
+void SFB::ObjectStorageInputSource::FetchChunk(SInt64 index)
+{
+	if(mClosing || mPendingChunks.count(index) || mChunks.count(index))
+		return;
+
+	// A chunk fetched by another input for the same object is retained without a request
+	auto cached = sChunkCache.Find(mCacheKey, index);
+	if(cached) {
+		mChunks[index] = cached;
+		return;
+	}
+
+	mPendingChunks.insert(index);
+	mFailedChunks.erase(index);
+
+	SInt64 offset = index * mChunkSize;
+	SInt64 byteCount = std::min(mChunkSize, mLength - offset);
+
+	// mRequestURL is released only after the fetch group completes
+	CFURLRef url = mRequestURL;
+	dispatch_group_async(mFetchGroup, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+		auto bytes = std::make_shared<std::vector<uint8_t>>();
+		SInt64 objectLength = -1;
+		bool fetched = FetchRange(url, offset, byteCount, *bytes, objectLength);
+
+		if(fetched)
+			sChunkCache.Insert(mCacheKey, index, bytes);
+		else
+			LOGGER_WARNING("org.sbooth.AudioEngine.InputSource.ObjectStorage", "Unable to fetch chunk " << index << " of " << GetURL());
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mPendingChunks.erase(index);
+
+		if(fetched)
+			mChunks[index] = bytes;
+		else
+			mFailedChunks.insert(index);
+
+		mCondition.notify_all();
+		if(mReadabilityHandler)
+			mReadabilityHandler();
+	});
+}
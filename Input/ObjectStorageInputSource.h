@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <dispatch/dispatch.h>
+
+#include "InputSource.h"
+
+namespace SFB {
+
+	// ========================================
+	// InputSource reading an object from object storage with ranged requests
+	//
+	// The object is divided into fixed-size chunks fetched by several concurrent range requests and held in a
+	// process-wide least recently used cache, so seeks to fetched regions require no network access and other
+	// inputs for the same object share the cached chunks.  Chunks following the current offset in the direction
+	// of reading are fetched ahead.  s3:// URLs are read from the bucket's virtual-hosted endpoint; https:// URLs,
+	// including presigned URLs, are read as given.
+	// ========================================
+	class ObjectStorageInputSource : public InputSource
+	{
+
+	public:
+
+		// Creation
+		explicit ObjectStorageInputSource(CFURLRef url);
+		virtual ~ObjectStorageInputSource();
+
+		// Whether url refers to an object in object storage
+		static bool HandlesURL(CFURLRef url);
+
+		// Cache management
+		static void SetChunkCacheCapacity(size_t capacity);
+		static void PurgeChunkCache();
+
+		using chunk_ptr = std::shared_ptr<const std::vector<uint8_t>>;
+
+	private:
+
+		// Bytestream access
+		virtual bool _Open(CFErrorRef *error);
+		virtual bool _Close(CFErrorRef *error);
+
+		// Functionality
+		virtual SInt64 _Read(void *buffer, SInt64 byteCount);
+		virtual bool _AtEOF() const;
+
+		inline virtual SInt64 _GetOffset() const				{ return mOffset; }
+		inline virtual SInt64 _GetLength() const				{ return mLength; }
+
+		// Seeking support
+		inline virtual bool _SupportsSeeking() const			{ return true; }
+		virtual bool _SeekToOffset(SInt64 offset);
+
+		// Positional reads share the chunks
+		inline virtual bool _SupportsPositionalReads() const	{ return true; }
+		virtual SInt64 _PositionalReadV(const struct iovec *vectors, int vectorCount, SInt64 offset);
+
+		// Buffering
+		virtual bool _GetBufferingStatus(BufferingStatus& status) const;
+		virtual bool _WaitForBuffering(SInt64 byteCount, CFTimeInterval timeout);
+		virtual bool _WouldBlock(SInt64 byteCount) const;
+		virtual void _SetReadabilityHandler(ReadabilityHandler handler);
+
+		// Copy bytes at offset, waiting for chunks to be fetched; mMutex must be held
+		SInt64 ReadBytes(std::unique_lock<std::mutex>& lock, uint8_t *buffer, SInt64 byteCount, SInt64 offset);
+
+		// Return the chunk at index if it has been fetched, or nullptr; mMutex must be held
+		chunk_ptr FindChunk(SInt64 index) const;
+
+		// Fetch the chunk at index and those ahead of it in the direction of reading; mMutex must be held
+		void FetchChunks(SInt64 index);
+		void FetchChunk(SInt64 index);
+
+		// The number of chunks in the object
+		inline SInt64 GetChunkCount() const						{ return (mLength + mChunkSize - 1) / mChunkSize; }
+
+		// Data members
+		SFB::CFURL						mRequestURL;
+		std::string						mCacheKey;			// The object's URL without a query, shared by presigned URLs
+		SInt64							mChunkSize;
+
+		mutable std::mutex				mMutex;
+		std::condition_variable			mCondition;
+		std::map<SInt64, chunk_ptr>		mChunks;			// Recently used chunks, which may have been evicted from the cache
+		std::set<SInt64>				mPendingChunks;		// Chunks being fetched
+		std::set<SInt64>				mFailedChunks;		// Chunks that couldn't be fetched, retried when next read
+		SInt64							mLastChunk;			// The chunk most recently read
+		bool							mReadingBackward;
+		bool							mClosing;
+		ReadabilityHandler				mReadabilityHandler;
+
+		dispatch_group_t				mFetchGroup;		// Outstanding requests
+
+		SInt64							mOffset;
+		std::atomic<SInt64>				mLength;
+	};
+
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ReadAheadFileInputSource.h"
+#include "Logger.h"
+
+// The unit in which the file is read
+#define CHUNK_SIZE (256 * 1024)
+
+#pragma mark Creation and Destruction
+
+SFB::ReadAheadFileInputSource::ReadAheadFileInputSource(CFURLRef url, SInt64 windowSize)
+	: InputSource(url), mWindowChunks(std::max((SInt64)1, windowSize / CHUNK_SIZE)), mChannel(nullptr), mOffset(0), mReadsInProgress(0), mStallStatistics()
+{
+	memset(&mFilestats, 0, sizeof(mFilestats));
+}
+
+SFB::ReadAheadFileInputSource::~ReadAheadFileInputSource()
+{
+	if(IsOpen())
+		Close();
+}
+
+bool SFB::ReadAheadFileInputSource::_Open(CFErrorRef *error)
+{
+	UInt8 buf [PATH_MAX];
+	Boolean success = CFURLGetFileSystemRepresentation(GetURL(), FALSE, buf, PATH_MAX);
+	if(!success) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EIO, nullptr);
+		return false;
+	}
+
+	int fd = ::open((const char *)buf, O_RDONLY);
+	if(-1 == fd) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return false;
+	}
+
+	if(-1 == fstat(fd, &mFilestats)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		::close(fd);
+		return false;
+	}
+
+	// The data is streamed once, so there is no benefit to caching it
+	if(-1 == fcntl(fd, F_NOCACHE, 1))
+		LOGGER_INFO("org.sbooth.AudioEngine.InputSource.ReadAheadFile", "fcntl(F_NOCACHE) failed: " << strerror(errno));
+
+	mChannel = dispatch_io_create(DISPATCH_IO_RANDOM, fd, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(int /*error*/) {
+		::close(fd);
+	});
+
+	if(nullptr == mChannel) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.InputSource.ReadAheadFile", "dispatch_io_create failed");
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+		::close(fd);
+		return false;
+	}
+
+	// Deliver each chunk in one piece
+	dispatch_io_set_low_water(mChannel, SIZE_MAX);
+
+	mOffset = 0;
+	mStallStatistics = StallStatistics();
+
+	return true;
+}
+
+bool SFB::ReadAheadFileInputSource::_Close(CFErrorRef */*error*/)
+{
+	dispatch_io_close(mChannel, DISPATCH_IO_STOP);
+
+	// Outstanding reads complete with ECANCELED
+	std::unique_lock<std::mutex> lock(mMutex);
+	mCondition.wait(lock, [this] { return 0 == mReadsInProgress; });
+
+	for(auto& iter : mChunks) {
+		if(iter.second.mData)
+			dispatch_release(iter.second.mData);
+	}
+	mChunks.clear();
+
+	dispatch_release(mChannel);
+	mChannel = nullptr;
+
+	memset(&mFilestats, 0, sizeof(mFilestats));
+
+	return true;
+}
+
+#pragma mark Functionality
+
+SInt64 SFB::ReadAheadFileInputSource::_Read(void *buffer, SInt64 byteCount)
+{
+	auto output = static_cast<uint8_t *>(buffer);
+	SInt64 bytesRead = 0;
+
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	while(bytesRead < byteCount && mOffset < mFilestats.st_size) {
+		SInt64 chunkIndex = mOffset / CHUNK_SIZE;
+		RequestChunks(chunkIndex);
+
+		auto& chunk = mChunks[chunkIndex];
+		if(!chunk.mComplete) {
+			auto start = std::chrono::steady_clock::now();
+			mCondition.wait(lock, [&chunk] { return chunk.mComplete; });
+			std::chrono::duration<double> stall = std::chrono::steady_clock::now() - start;
+
+			++mStallStatistics.mStallCount;
+			mStallStatistics.mTotalStallTime += stall.count();
+			mStallStatistics.mMaximumStallTime = std::max(mStallStatistics.mMaximumStallTime, stall.count());
+		}
+
+		if(chunk.mError) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.InputSource.ReadAheadFile", "Error reading offset " << chunkIndex * CHUNK_SIZE << ": " << strerror(chunk.mError));
+			// Request the chunk again on the next read
+			if(chunk.mData)
+				dispatch_release(chunk.mData);
+			mChunks.erase(chunkIndex);
+			break;
+		}
+
+		SInt64 chunkOffset = mOffset - (chunkIndex * CHUNK_SIZE);
+		SInt64 bytesToCopy = std::min((SInt64)chunk.mLength - chunkOffset, byteCount - bytesRead);
+		if(0 >= bytesToCopy)
+			break;
+
+		memcpy(output + bytesRead, chunk.mBytes + chunkOffset, (size_t)bytesToCopy);
+		bytesRead += bytesToCopy;
+		mOffset += bytesToCopy;
+	}
+
+	return bytesRead;
+}
+
+bool SFB::ReadAheadFileInputSource::_SeekToOffset(SInt64 offset)
+{
+	if(offset > mFilestats.st_size)
+		return false;
+
+	// The chunks for the new offset are requested by the next read
+	std::lock_guard<std::mutex> lock(mMutex);
+	mOffset = offset;
+	return true;
+}
+
+bool SFB::ReadAheadFileInputSource::_GetStallStatistics(StallStatistics& statistics) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	statistics = mStallStatistics;
+	return true;
+}
+
+void SFB::ReadAheadFileInputSource::RequestChunks(SInt64 chunkIndex)
+{
+	// Discard chunks outside the window, retaining the current chunk's predecessor for small seeks backward
+	for(auto iter = mChunks.begin(); iter != mChunks.end(); ) {
+		if(!iter->second.mComplete || (iter->first >= chunkIndex - 1 && iter->first < chunkIndex + mWindowChunks)) {
+			++iter;
+			continue;
+		}
+		if(iter->second.mData)
+			dispatch_release(iter->second.mData);
+		iter = mChunks.erase(iter);
+	}
+
+	SInt64 chunkCount = (mFilestats.st_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	SInt64 lastChunk = std::min(chunkIndex + mWindowChunks, chunkCount);
+
+	for(SInt64 i = chunkIndex; i < lastChunk; ++i) {
+		if(mChunks.count(i))
+			continue;
+
+		auto& chunk = mChunks[i];
+		chunk.mData = nullptr;
+		chunk.mBytes = nullptr;
+		chunk.mLength = 0;
+		chunk.mError = 0;
+		chunk.mComplete = false;
+
+		off_t offset = (off_t)(i * CHUNK_SIZE);
+		size_t length = (size_t)std::min((SInt64)CHUNK_SIZE, mFilestats.st_size - offset);
+
+		// Advise the kernel of the upcoming read
+		struct radvisory advisory = { offset, (int)length };
+		fcntl(dispatch_io_get_descriptor(mChannel), F_RDADVISE, &advisory);
+
+		++mReadsInProgress;
+
+		__block dispatch_data_t accumulated = dispatch_data_empty;
+		dispatch_io_read(mChannel, offset, length, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(bool done, dispatch_data_t data, int error) {
+			if(data && 0 < dispatch_data_get_size(data)) {
+				dispatch_data_t concatenated = dispatch_data_create_concat(accumulated, data);
+				dispatch_release(accumulated);
+				accumulated = concatenated;
+			}
+
+			if(!done)
+				return;
+
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			auto iter = mChunks.find(i);
+			if(iter != mChunks.end() && !iter->second.mComplete) {
+				auto& request = iter->second;
+
+				const void *bytes = nullptr;
+				size_t size = 0;
+				request.mData = dispatch_data_create_map(accumulated, &bytes, &size);
+				request.mBytes = static_cast<const uint8_t *>(bytes);
+				request.mLength = size;
+				request.mError = error;
+				request.mComplete = true;
+			}
+
+			dispatch_release(accumulated);
+
+			--mReadsInProgress;
+			mCondition.notify_all();
+		});
+	}
+}
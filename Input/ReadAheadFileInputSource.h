@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2017 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+
+#include <dispatch/dispatch.h>
+
+#include "InputSource.h"
+
+namespace SFB {
+
+	// ========================================
+	// InputSource reading a file asynchronously using dispatch I/O
+	//
+	// The file is read in chunks, with a window of chunks following the current offset requested
+	// ahead of time so slow storage stalls the background reads instead of the reading thread.
+	// The kernel is advised of the upcoming reads and asked not to cache the streamed data.
+	// ========================================
+	class ReadAheadFileInputSource : public InputSource
+	{
+
+	public:
+
+		// Creation
+		ReadAheadFileInputSource(CFURLRef url, SInt64 windowSize);
+		virtual ~ReadAheadFileInputSource();
+
+	private:
+
+		struct Chunk {
+			dispatch_data_t		mData;			// The contiguous bytes, once complete
+			const uint8_t		*mBytes;
+			size_t				mLength;
+			int					mError;
+			bool				mComplete;
+		};
+
+		// Bytestream access
+		virtual bool _Open(CFErrorRef *error);
+		virtual bool _Close(CFErrorRef *error);
+
+		// Functionality
+		virtual SInt64 _Read(void *buffer, SInt64 byteCount);
+		inline virtual bool _AtEOF() const						{ return mOffset >= mFilestats.st_size; }
+
+		inline virtual SInt64 _GetOffset() const				{ return mOffset; }
+		inline virtual SInt64 _GetLength() const				{ return mFilestats.st_size; }
+
+		// Seeking support
+		inline virtual bool _SupportsSeeking() const			{ return true; }
+		virtual bool _SeekToOffset(SInt64 offset);
+
+		// Statistics
+		virtual bool _GetStallStatistics(StallStatistics& statistics) const;
+
+		// Request the window of chunks beginning with chunkIndex and discard those behind it; mMutex must be held
+		void RequestChunks(SInt64 chunkIndex);
+
+		// Data members
+		struct stat						mFilestats;
+		SInt64							mWindowChunks;
+		dispatch_io_t					mChannel;
+		SInt64							mOffset;
+
+		mutable std::mutex				mMutex;
+		std::condition_variable			mCondition;
+		std::map<SInt64, Chunk>			mChunks;
+		unsigned						mReadsInProgress;
+		StallStatistics					mStallStatistics;
+	};
+
+}
@@ -8,16 +8,345 @@
 # include <CoreServices/CoreServices.h>
 #endif
 #include <iomanip>
+#include <map>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <asl.h>
+#include <os/log.h>
+#include <dispatch/dispatch.h>
+#include <mach/mach_time.h>
 
 #include "Logger.h"
 #include "CFWrapper.h"
 
 #define BUFFER_LENGTH 512
+#define MESSAGE_QUEUE_CAPACITY			128		// Must be a power of two
+#define MAXIMUM_FACILITY_LEVEL_COUNT	32
+#define FACILITY_LENGTH					64
+#define LOCATION_LENGTH					128
+#define DEFAULT_RATE_LIMIT_MESSAGES_PER_SECOND	10
+#define DEFAULT_RATE_LIMIT_BURST				20
 
-int SFB::Logger::currentLogLevel = err;
+std::atomic_int SFB::Logger::currentLogLevel(err);
+std::atomic_uint SFB::Logger::configurationGeneration(1);
+std::atomic_uint SFB::Logger::facilityLevelCount(0);
 
 namespace {
 
+	// ========================================
+	// Facility levels
+	// Entries are never removed, so a name once published remains valid; a cleared entry has level -1
+	struct FacilityLevel {
+		std::atomic<const char *>	mFacility;
+		std::atomic_int				mLevel;
+	};
+
+	FacilityLevel sFacilityLevels [MAXIMUM_FACILITY_LEVEL_COUNT];
+	std::atomic_uint sFacilityLevelEntryCount(0);
+
+	// Serializes changes to the facility levels
+	dispatch_queue_t GetFacilityLevelQueue()
+	{
+		static dispatch_queue_t sQueue = nullptr;
+		static dispatch_once_t onceToken;
+		dispatch_once(&onceToken, ^{
+			sQueue = dispatch_queue_create("org.sbooth.AudioEngine.Logger.FacilityLevels", DISPATCH_QUEUE_SERIAL);
+		});
+		return sQueue;
+	}
+
+	FacilityLevel * FindFacilityLevel(const char *facility)
+	{
+		unsigned int count = std::min(sFacilityLevelEntryCount.load(std::memory_order_acquire), (unsigned int)MAXIMUM_FACILITY_LEVEL_COUNT);
+		for(unsigned int i = 0; i < count; ++i) {
+			const char *name = sFacilityLevels[i].mFacility.load(std::memory_order_acquire);
+			if(name && 0 == strcmp(name, facility))
+				return &sFacilityLevels[i];
+		}
+		return nullptr;
+	}
+
+	// Returns the level of facility or its longest parent with a level set, or -1 if none is set
+	int FindEffectiveFacilityLevel(const char *facility)
+	{
+		int level = -1;
+		size_t matchLength = 0;
+
+		unsigned int count = std::min(sFacilityLevelEntryCount.load(std::memory_order_acquire), (unsigned int)MAXIMUM_FACILITY_LEVEL_COUNT);
+		for(unsigned int i = 0; i < count; ++i) {
+			const char *name = sFacilityLevels[i].mFacility.load(std::memory_order_acquire);
+			int entryLevel = sFacilityLevels[i].mLevel.load(std::memory_order_relaxed);
+			if(nullptr == name || -1 == entryLevel)
+				continue;
+
+			size_t length = strlen(name);
+			if(length <= matchLength || 0 != strncmp(name, facility, length))
+				continue;
+
+			// A parent facility must end at a component separator
+			if('\0' == facility[length] || '.' == facility[length]) {
+				level = entryLevel;
+				matchLength = length;
+			}
+		}
+
+		return level;
+	}
+
+	// ========================================
+	// Rate limiting using the generic cell rate algorithm
+	// A message is permitted if it arrives no earlier than the burst tolerance before its theoretical arrival time
+	std::atomic_ullong sRateLimitInterval(0);			// Host time between messages
+	std::atomic_ullong sRateLimitBurstTolerance(0);		// Host time
+
+	uint64_t ConvertSecondsToHostTime(double seconds)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (uint64_t)((seconds * NSEC_PER_SEC * sTimebaseInfo.denom) / sTimebaseInfo.numer);
+	}
+
+	// Set the default rate limit when the library is loaded
+	bool sRateLimitInitialized = []{
+		SFB::Logger::SetRateLimit(DEFAULT_RATE_LIMIT_MESSAGES_PER_SECOND, DEFAULT_RATE_LIMIT_BURST);
+		return true;
+	}();
+
+	// ========================================
+	// A queued log message
+	struct Message {
+		SFB::Logger::levels		mLevel;
+		int						mLine;
+		char					mFacility [FACILITY_LENGTH];
+		char					mFunction [LOCATION_LENGTH];
+		char					mFile [LOCATION_LENGTH];
+		char					mMessage [SFB::Logger::kMaximumMessageLength];
+	};
+
+	// Copy at most size - 1 bytes of src to dst; a nullptr src is copied as an empty string
+	void CopyString(char *dst, const char *src, size_t size)
+	{
+		if(nullptr == src)
+			dst[0] = '\0';
+		else
+			strlcpy(dst, src, size);
+	}
+
+	void FillMessage(Message& message, SFB::Logger::levels level, const char *facility, const char *messageText, const char *function, const char *file, int line)
+	{
+		message.mLevel = level;
+		message.mLine = line;
+		CopyString(message.mFacility, facility, sizeof(message.mFacility));
+		CopyString(message.mFunction, function, sizeof(message.mFunction));
+		CopyString(message.mFile, file, sizeof(message.mFile));
+		CopyString(message.mMessage, messageText, sizeof(message.mMessage));
+	}
+
+	// ========================================
+	// A bounded lock-free multiple-producer, single-consumer queue of messages
+	// Each slot's sequence number indicates whether it is free for the producer or ready for the consumer
+	class MessageQueue
+	{
+	public:
+
+		MessageQueue()
+			: mEnqueuePosition(0), mDequeuePosition(0)
+		{
+			for(size_t i = 0; i < MESSAGE_QUEUE_CAPACITY; ++i)
+				mSlots[i].mSequence.store(i, std::memory_order_relaxed);
+		}
+
+		// Returns a message to be filled and passed to Publish() with position, or nullptr if the queue is full
+		Message * Reserve(size_t& position)
+		{
+			position = mEnqueuePosition.load(std::memory_order_relaxed);
+			for(;;) {
+				Slot& slot = mSlots[position & (MESSAGE_QUEUE_CAPACITY - 1)];
+				size_t sequence = slot.mSequence.load(std::memory_order_acquire);
+				intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+				if(0 == difference) {
+					if(mEnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+						return &slot.mMessage;
+				}
+				else if(0 > difference)
+					return nullptr;
+				else
+					position = mEnqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+
+		// Makes the message reserved at position available to the consumer
+		void Publish(size_t position)
+		{
+			mSlots[position & (MESSAGE_QUEUE_CAPACITY - 1)].mSequence.store(position + 1, std::memory_order_release);
+		}
+
+		// Only called from the writer queue
+		Message * Front()
+		{
+			Slot& slot = mSlots[mDequeuePosition & (MESSAGE_QUEUE_CAPACITY - 1)];
+			if(slot.mSequence.load(std::memory_order_acquire) != mDequeuePosition + 1)
+				return nullptr;
+			return &slot.mMessage;
+		}
+
+		void PopFront()
+		{
+			Slot& slot = mSlots[mDequeuePosition & (MESSAGE_QUEUE_CAPACITY - 1)];
+			slot.mSequence.store(mDequeuePosition + MESSAGE_QUEUE_CAPACITY, std::memory_order_release);
+			++mDequeuePosition;
+		}
+
+	private:
+
+		struct Slot {
+			std::atomic_size_t	mSequence;
+			Message				mMessage;
+		};
+
+		Slot					mSlots [MESSAGE_QUEUE_CAPACITY];
+		std::atomic_size_t		mEnqueuePosition;
+		size_t					mDequeuePosition;
+	};
+
+	// ========================================
+	// Writer state
+	MessageQueue *sMessageQueue = nullptr;
+	dispatch_queue_t sWriterQueue = nullptr;
+	dispatch_source_t sWriterSource = nullptr;
+	std::atomic_ullong sDroppedMessageCount(0);
+	std::atomic_bool sStandardErrorEnabled(false);
+
+
+	os_log_type_t GetLogType(SFB::Logger::levels level) API_AVAILABLE(macos(10.12), ios(10.0))
+	{
+		switch(level) {
+			case SFB::Logger::emerg:
+			case SFB::Logger::alert:
+			case SFB::Logger::crit:		return OS_LOG_TYPE_FAULT;
+			case SFB::Logger::err:		return OS_LOG_TYPE_ERROR;
+			case SFB::Logger::info:		return OS_LOG_TYPE_INFO;
+			case SFB::Logger::debug:	return OS_LOG_TYPE_DEBUG;
+			default:					return OS_LOG_TYPE_DEFAULT;
+		}
+	}
+
+	os_log_t GetLog(const char *facility) API_AVAILABLE(macos(10.12), ios(10.0))
+	{
+		if(!facility[0])
+			return OS_LOG_DEFAULT;
+
+		// Messages are usually written on the writer queue, but severe messages are written by the caller
+		static std::map<std::string, os_log_t> sLogs;
+		static dispatch_queue_t sLogsQueue = nullptr;
+		static dispatch_once_t onceToken;
+		dispatch_once(&onceToken, ^{
+			sLogsQueue = dispatch_queue_create("org.sbooth.AudioEngine.Logger.Logs", DISPATCH_QUEUE_SERIAL);
+		});
+
+		__block os_log_t log = nullptr;
+		dispatch_sync(sLogsQueue, ^{
+			auto iter = sLogs.find(facility);
+			if(iter != sLogs.end())
+				log = iter->second;
+			else {
+				log = os_log_create(facility, "default");
+				sLogs[facility] = log;
+			}
+		});
+
+		return log;
+	}
+
+	void WriteMessage(const Message& message)
+	{
+		const char *file = message.mFile[0] ? message.mFile : nullptr;
+		const char *function = message.mFunction[0] ? message.mFunction : nullptr;
+
+		if(__builtin_available(macOS 10.12, iOS 10.0, *)) {
+			os_log_t log = GetLog(message.mFacility);
+			os_log_type_t type = GetLogType(message.mLevel);
+			if(file && -1 != message.mLine)
+				os_log_with_type(log, type, "%{public}s:%d %{public}s: %{public}s", file, message.mLine, function ? function : "", message.mMessage);
+			else
+				os_log_with_type(log, type, "%{public}s", message.mMessage);
+		}
+		else {
+			aslmsg msg = asl_new(ASL_TYPE_MSG);
+
+			if(message.mFacility[0])
+				asl_set(msg, ASL_KEY_FACILITY, message.mFacility);
+
+			if(function)
+				asl_set(msg, "Function", function);
+
+			if(file)
+				asl_set(msg, "File", file);
+
+			if(-1 != message.mLine) {
+				char buf [32];
+				if(snprintf(buf, sizeof(buf), "%d", message.mLine))
+					asl_set(msg, "Line", buf);
+			}
+
+			asl_log(nullptr, msg, message.mLevel, "%s", message.mMessage);
+
+			asl_free(msg);
+		}
+
+		if(sStandardErrorEnabled.load(std::memory_order_relaxed)) {
+			if(file && -1 != message.mLine)
+				fprintf(stderr, "%s %s:%d %s: %s\n", message.mFacility, file, message.mLine, function ? function : "", message.mMessage);
+			else
+				fprintf(stderr, "%s %s\n", message.mFacility, message.mMessage);
+		}
+	}
+
+	// Called on the writer queue when messages have been queued
+	void DrainMessageQueue()
+	{
+		Message *message;
+		while((message = sMessageQueue->Front())) {
+			WriteMessage(*message);
+			sMessageQueue->PopFront();
+		}
+
+		auto dropped = sDroppedMessageCount.exchange(0, std::memory_order_relaxed);
+		if(0 < dropped) {
+			char text [64];
+			snprintf(text, sizeof(text), "%llu log messages dropped", dropped);
+
+			Message notice;
+			FillMessage(notice, SFB::Logger::warning, "org.sbooth.AudioEngine.Logger", text, nullptr, nullptr, -1);
+			WriteMessage(notice);
+		}
+	}
+
+	void StartWriter()
+	{
+		static dispatch_once_t onceToken;
+		dispatch_once(&onceToken, ^{
+			sMessageQueue = new MessageQueue;
+
+			sWriterQueue = dispatch_queue_create("org.sbooth.AudioEngine.Logger", DISPATCH_QUEUE_SERIAL);
+			dispatch_set_target_queue(sWriterQueue, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+
+			// dispatch_source_merge_data() doesn't block or allocate, so it may be called from any thread
+			sWriterSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_OR, 0, 0, sWriterQueue);
+			dispatch_source_set_event_handler(sWriterSource, ^{
+				DrainMessageQueue();
+			});
+			dispatch_resume(sWriterSource);
+
+			// Write any messages remaining at exit
+			atexit([]{ SFB::Logger::Flush(); });
+		});
+	}
+
 	/*! @brief Get the string representation of an \c AudioChannelLayoutTag */
 	const char * GetChannelLayoutTagName(AudioChannelLayoutTag layoutTag)
 	{
@@ -158,31 +487,153 @@ namespace {
 
 }
 
-void SFB::Logger::Log(levels level, const char *facility, const char *message, const char *function, const char *file, int line)
+SFB::Logger::levels SFB::Logger::GetFacilityLevel(const char *facility)
+{
+	if(facility && 0 < facilityLevelCount.load(std::memory_order_relaxed)) {
+		int level = FindEffectiveFacilityLevel(facility);
+		if(-1 != level)
+			return (levels)level;
+	}
+
+	return (levels)currentLogLevel.load(std::memory_order_relaxed);
+}
+
+bool SFB::Logger::SetFacilityLevel(const char *facility, levels level)
+{
+	if(nullptr == facility)
+		return false;
+
+	__block bool result = true;
+	dispatch_sync(GetFacilityLevelQueue(), ^{
+		auto entry = FindFacilityLevel(facility);
+		if(nullptr == entry) {
+			unsigned int index = sFacilityLevelEntryCount.load(std::memory_order_relaxed);
+			if(MAXIMUM_FACILITY_LEVEL_COUNT == index) {
+				result = false;
+				return;
+			}
+
+			entry = &sFacilityLevels[index];
+			entry->mLevel.store(-1, std::memory_order_relaxed);
+			entry->mFacility.store(strdup(facility), std::memory_order_release);
+			sFacilityLevelEntryCount.store(index + 1, std::memory_order_release);
+		}
+
+		if(-1 == entry->mLevel.load(std::memory_order_relaxed))
+			facilityLevelCount.fetch_add(1, std::memory_order_relaxed);
+		entry->mLevel.store(level, std::memory_order_relaxed);
+		configurationGeneration.fetch_add(1, std::memory_order_release);
+	});
+
+	return result;
+}
+
+void SFB::Logger::ClearFacilityLevel(const char *facility)
+{
+	if(nullptr == facility)
+		return;
+
+	dispatch_sync(GetFacilityLevelQueue(), ^{
+		auto entry = FindFacilityLevel(facility);
+		if(entry && -1 != entry->mLevel.exchange(-1, std::memory_order_relaxed)) {
+			facilityLevelCount.fetch_sub(1, std::memory_order_relaxed);
+			configurationGeneration.fetch_add(1, std::memory_order_release);
+		}
+	});
+}
+
+void SFB::Logger::SetRateLimit(double messagesPerSecond, unsigned int burst)
 {
-	if(currentLogLevel < level)
+	if(0 >= messagesPerSecond) {
+		sRateLimitInterval.store(0, std::memory_order_relaxed);
+		sRateLimitBurstTolerance.store(0, std::memory_order_relaxed);
 		return;
+	}
+
+	uint64_t interval = std::max(ConvertSecondsToHostTime(1 / messagesPerSecond), (uint64_t)1);
+	sRateLimitBurstTolerance.store(interval * burst, std::memory_order_relaxed);
+	sRateLimitInterval.store(interval, std::memory_order_relaxed);
+}
+
+void SFB::Logger::CallSite::Resolve(unsigned int generation)
+{
+	// Concurrent resolutions of the same generation store the same level
+	mLevel.store(GetFacilityLevel(mFacility), std::memory_order_relaxed);
+	mGeneration.store(generation, std::memory_order_release);
+}
 
-	aslmsg msg = asl_new(ASL_TYPE_MSG);
+bool SFB::Logger::CallSite::Acquire(unsigned long long& suppressedCount)
+{
+	suppressedCount = 0;
 
-	if(facility)
-		asl_set(msg, ASL_KEY_FACILITY, facility);
+	uint64_t interval = sRateLimitInterval.load(std::memory_order_relaxed);
+	if(0 == interval)
+		return true;
 
-	if(function)
-		asl_set(msg, "Function", function);
+	uint64_t burstTolerance = sRateLimitBurstTolerance.load(std::memory_order_relaxed);
+	uint64_t now = mach_absolute_time();
 
-	if(file)
-		asl_set(msg, "File", file);
+	uint64_t theoreticalArrivalTime = mTheoreticalArrivalTime.load(std::memory_order_relaxed);
+	for(;;) {
+		if(theoreticalArrivalTime > now + burstTolerance) {
+			mSuppressedCount.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
 
-	if(-1 != line) {
-		char buf [32];
-		if(snprintf(buf, sizeof(buf), "%d", line))
-			asl_set(msg, "Line", buf);
+		uint64_t next = std::max(theoreticalArrivalTime, now) + interval;
+		if(mTheoreticalArrivalTime.compare_exchange_weak(theoreticalArrivalTime, next, std::memory_order_relaxed))
+			break;
 	}
 
-	asl_log(nullptr, msg, level, "%s", message);
+	suppressedCount = mSuppressedCount.exchange(0, std::memory_order_relaxed);
+	return true;
+}
+
+void SFB::Logger::Log(levels level, const char *facility, const char *message, const char *function, const char *file, int line)
+{
+	if(!IsEnabled(level, facility) || nullptr == message)
+		return;
 
-	asl_free(msg);
+	// Only the file's name is logged
+	if(file) {
+		const char *lastSeparator = strrchr(file, '/');
+		if(lastSeparator)
+			file = lastSeparator + 1;
+	}
+
+	// Severe messages are written immediately in case the process is about to terminate
+	if(crit >= level) {
+		Message synchronous;
+		FillMessage(synchronous, level, facility, message, function, file, line);
+		WriteMessage(synchronous);
+		return;
+	}
+
+	StartWriter();
+
+	size_t position;
+	Message *queued = sMessageQueue->Reserve(position);
+	if(nullptr == queued)
+		sDroppedMessageCount.fetch_add(1, std::memory_order_relaxed);
+	else {
+		FillMessage(*queued, level, facility, message, function, file, line);
+		sMessageQueue->Publish(position);
+	}
+
+	dispatch_source_merge_data(sWriterSource, 1);
+}
+
+void SFB::Logger::Flush()
+{
+	StartWriter();
+	dispatch_sync(sWriterQueue, ^{
+		DrainMessageQueue();
+	});
+}
+
+void SFB::Logger::SetStandardErrorEnabled(bool enabled)
+{
+	sStandardErrorEnabled.store(enabled, std::memory_order_relaxed);
 }
 
 std::ostream& operator<<(std::ostream& out, CFStringRef s)
@@ -5,138 +5,235 @@
 
 #pragma once
 
-#include <asl.h>
-#include <sstream>
+#include <atomic>
+#include <ostream>
+#include <streambuf>
 
-/*! @file Logger.h @brief A simplified interface to the Apple System Log (ASL) */
+/*! @file Logger.h @brief Asynchronous logging to the unified logging system */
+
+/*! @cond */
+
+// Messages are formatted into a fixed buffer on the caller's stack and written by a background thread
+// The level and rate limit are checked using state cached for each call site before the message is formatted
+#define LOGGER_LOG_(level, facility, message) { \
+	static ::SFB::Logger::CallSite cs_(facility); \
+	unsigned long long suppressed_; \
+	if(cs_.IsEnabled(level) && cs_.Acquire(suppressed_)) { \
+		::SFB::Logger::MessageStream ms_; ms_ << message; \
+		if(0 < suppressed_) \
+			ms_ << " (" << suppressed_ << " similar messages suppressed)"; \
+		::SFB::Logger::Log(level, facility, ms_.c_str(), __PRETTY_FUNCTION__, __FILE__, __LINE__); \
+	} \
+}
+
+/*! @endcond */
 
 /*!
  * @brief Log a message at the \c logger::emerg level
  * @param facility The sender's logging facility, or \c nullptr to use the default
  * @param message The log message
  */
-#define LOGGER_EMERG(facility, message) { \
-	if(::SFB::Logger::currentLogLevel >= ::SFB::Logger::emerg) { \
-		::std::stringstream ss_; ss_ << message; \
-		::SFB::Logger::Log(::SFB::Logger::emerg, facility, ss_.str().c_str(), __PRETTY_FUNCTION__, __FILE__, __LINE__); \
-	} \
-}
+#define LOGGER_EMERG(facility, message) LOGGER_LOG_(::SFB::Logger::emerg, facility, message)
 
 /*!
  * @brief Log a message at the \c logger::alert level
  * @param facility The sender's logging facility, or \c nullptr to use the default
  * @param message The log message
  */
-#define LOGGER_ALERT(facility, message) { \
-	if(::SFB::Logger::currentLogLevel >= ::SFB::Logger::alert) { \
-		::std::stringstream ss_; ss_ << message; \
-		::SFB::Logger::Log(::SFB::Logger::alert, facility, ss_.str().c_str(), __PRETTY_FUNCTION__, __FILE__, __LINE__); \
-	} \
-}
+#define LOGGER_ALERT(facility, message) LOGGER_LOG_(::SFB::Logger::alert, facility, message)
 
 /*!
  * @brief Log a message at the \c logger::crit level
  * @param facility The sender's logging facility, or \c nullptr to use the default
  * @param message The log message
  */
-#define LOGGER_CRIT(facility, message) { \
-	if(::SFB::Logger::currentLogLevel >= ::SFB::Logger::crit) { \
-		::std::stringstream ss_; ss_ << message; \
-		::SFB::Logger::Log(::SFB::Logger::crit, facility, ss_.str().c_str(), __PRETTY_FUNCTION__, __FILE__, __LINE__); \
-	} \
-}
+#define LOGGER_CRIT(facility, message) LOGGER_LOG_(::SFB::Logger::crit, facility, message)
 
 /*!
  * @brief Log a message at the \c logger::err level
  * @param facility The sender's logging facility, or \c nullptr to use the default
  * @param message The log message
  */
-#define LOGGER_ERR(facility, message) { \
-	if(::SFB::Logger::currentLogLevel >= ::SFB::Logger::err) { \
-		::std::stringstream ss_; ss_ << message; \
-		::SFB::Logger::Log(::SFB::Logger::err, facility, ss_.str().c_str(), __PRETTY_FUNCTION__, __FILE__, __LINE__); \
-	} \
-}
+#define LOGGER_ERR(facility, message) LOGGER_LOG_(::SFB::Logger::err, facility, message)
 
 /*!
  * @brief Log a message at the \c logger::warning level
  * @param facility The sender's logging facility, or \c nullptr to use the default
  * @param message The log message
  */
-#define LOGGER_WARNING(facility, message) { \
-	if(::SFB::Logger::currentLogLevel >= ::SFB::Logger::warning) { \
-		::std::stringstream ss_; ss_ << message; \
-		::SFB::Logger::Log(::SFB::Logger::warning, facility, ss_.str().c_str(), __PRETTY_FUNCTION__, __FILE__, __LINE__); \
-	} \
-}
+#define LOGGER_WARNING(facility, message) LOGGER_LOG_(::SFB::Logger::warning, facility, message)
 
 /*!
  * @brief Log a message at the \c logger::notice level
  * @param facility The sender's logging facility, or \c nullptr to use the default
  * @param message The log message
  */
-#define LOGGER_NOTICE(facility, message) { \
-	if(::SFB::Logger::currentLogLevel >= ::SFB::Logger::notice) { \
-		::std::stringstream ss_; ss_ << message; \
-		::SFB::Logger::Log(::SFB::Logger::notice, facility, ss_.str().c_str(), __PRETTY_FUNCTION__, __FILE__, __LINE__); \
-	} \
-}
+#define LOGGER_NOTICE(facility, message) LOGGER_LOG_(::SFB::Logger::notice, facility, message)
 
 /*!
  * @brief Log a message at the \c logger::info level
  * @param facility The sender's logging facility, or \c nullptr to use the default
  * @param message The log message
  */
-#define LOGGER_INFO(facility, message) { \
-	if(::SFB::Logger::currentLogLevel >= ::SFB::Logger::info) { \
-		::std::stringstream ss_; ss_ << message; \
-		::SFB::Logger::Log(::SFB::Logger::info, facility, ss_.str().c_str(), __PRETTY_FUNCTION__, __FILE__, __LINE__); \
-	} \
-}
+#define LOGGER_INFO(facility, message) LOGGER_LOG_(::SFB::Logger::info, facility, message)
 
 /*!
  * @brief Log a message at the \c logger::debug level
  * @param facility The sender's logging facility, or \c nullptr to use the default
  * @param message The log message
  */
-#define LOGGER_DEBUG(facility, message) { \
-	if(::SFB::Logger::currentLogLevel >= ::SFB::Logger::debug) { \
-		::std::stringstream ss_; ss_ << message; \
-		::SFB::Logger::Log(::SFB::Logger::debug, facility, ss_.str().c_str(), __PRETTY_FUNCTION__, __FILE__, __LINE__); \
-	} \
-}
+#define LOGGER_DEBUG(facility, message) LOGGER_LOG_(::SFB::Logger::debug, facility, message)
 
 /*! @brief \c SFBAudioEngine's encompassing namespace */
 namespace SFB {
 
-	/*! @brief The namespace containing all logging functionality */
+	/*!
+	 * @brief The namespace containing all logging functionality
+	 *
+	 * Messages are copied to a lock-free queue and written to the unified logging system (or ASL, when unavailable)
+	 * by a background thread, so logging doesn't block the caller.  Messages at the \c #crit level and above are
+	 * written synchronously.  If the queue is full messages are dropped and the number dropped is logged later.
+	 */
 	namespace Logger {
 
-		/*! @brief The possible logging levels for ASL */
+		/*! @brief The possible logging levels */
 		enum levels {
-			emerg		= ASL_LEVEL_EMERG,		/*!< The emergency log level */
-			alert		= ASL_LEVEL_ALERT,		/*!< The alert log level */
-			crit		= ASL_LEVEL_CRIT,		/*!< The critical log level */
-			err			= ASL_LEVEL_ERR,		/*!< The error log level */
-			warning		= ASL_LEVEL_WARNING,	/*!< The warning log level */
-			notice		= ASL_LEVEL_NOTICE,		/*!< The notice log level */
-			info		= ASL_LEVEL_INFO,		/*!< The information log level */
-			debug		= ASL_LEVEL_DEBUG,		/*!< The debug log level */
+			emerg		= 0,					/*!< The emergency log level */
+			alert		= 1,					/*!< The alert log level */
+			crit		= 2,					/*!< The critical log level */
+			err			= 3,					/*!< The error log level */
+			warning		= 4,					/*!< The warning log level */
+			notice		= 5,					/*!< The notice log level */
+			info		= 6,					/*!< The information log level */
+			debug		= 7,					/*!< The debug log level */
 			disabled	= 33,					/*!< Disable logging */
 		};
 
+		/*! @brief The maximum length of a log message, including the terminating \c NUL; longer messages are truncated */
+		static const size_t kMaximumMessageLength = 1024;
+
 		/*! @brief The log level below which messages are ignored */
-		extern int currentLogLevel;
+		extern std::atomic_int currentLogLevel;
+
+		/*! @cond */
+
+		// Incremented whenever filtering changes so call sites re-resolve their cached levels
+		extern std::atomic_uint configurationGeneration;
+		extern std::atomic_uint facilityLevelCount;
+
+		/*! @endcond */
 
 		/*! @brief Get the log level below which messages are ignored */
-		inline levels	GetCurrentLevel()				{ return (levels)currentLogLevel; }
+		inline levels	GetCurrentLevel()				{ return (levels)currentLogLevel.load(std::memory_order_relaxed); }
 
 		/*! @brief Set the log level below which messages will be ignored */
-		inline void		SetCurrentLevel(levels level)	{ currentLogLevel = level; }
+		inline void		SetCurrentLevel(levels level)	{ currentLogLevel.store(level, std::memory_order_relaxed); configurationGeneration.fetch_add(1, std::memory_order_release); }
+
+
+		/*!
+		 * @name Facility levels
+		 * A facility's level, if set, is used in place of \c currentLogLevel for messages from that facility and
+		 * its subfacilities.  For example, a level for \c org.sbooth.AudioEngine.Decoder also applies to
+		 * \c org.sbooth.AudioEngine.Decoder.FLAC unless that facility has its own level.
+		 */
+		//@{
+
+		/*!
+		 * @brief Get the log level below which messages from \c facility are ignored
+		 * @param facility The logging facility, or \c nullptr for the default
+		 * @return The level of \c facility or its closest parent facility, or \c currentLogLevel if none is set
+		 */
+		levels GetFacilityLevel(const char * _Nullable facility);
+
+		/*!
+		 * @brief Set the log level below which messages from \c facility and its subfacilities will be ignored
+		 * @note At most 32 facility levels may be set
+		 * @param facility The logging facility
+		 * @param level The log level
+		 * @return \c true on success, \c false otherwise
+		 */
+		bool SetFacilityLevel(const char * _Nonnull facility, levels level);
+
+		/*!
+		 * @brief Remove the log level for \c facility so messages are filtered using \c currentLogLevel
+		 * @param facility The logging facility
+		 */
+		void ClearFacilityLevel(const char * _Nonnull facility);
+
+		/*! @brief Query whether messages at \c level from \c facility will be logged */
+		inline bool IsEnabled(levels level, const char * _Nullable facility)
+		{
+			if(0 == facilityLevelCount.load(std::memory_order_relaxed))
+				return currentLogLevel.load(std::memory_order_relaxed) >= level;
+			return GetFacilityLevel(facility) >= level;
+		}
+
+		//@}
+
+
+		/*!
+		 * @name Rate limiting
+		 * Each \c LOGGER_* call site may log a burst of messages, after which messages are limited to a steady rate.
+		 * Messages exceeding the limit are dropped before formatting and the number dropped is appended to the next
+		 * message logged from the call site.
+		 */
+		//@{
+
+		/*!
+		 * @brief Set the rate limit for each call site
+		 * @param messagesPerSecond The sustained number of messages per second, or \c 0 to disable rate limiting
+		 * @param burst The number of messages that may be logged in excess of the sustained rate
+		 */
+		void SetRateLimit(double messagesPerSecond, unsigned int burst);
+
+		//@}
+
+
+		/*! @cond */
+
+		/*! @internal Cached filtering state for a \c LOGGER_* call site, which must use a constant facility */
+		class CallSite
+		{
+		public:
+			// constexpr so call sites are constant-initialized and don't require a guard
+			explicit constexpr CallSite(const char * _Nullable facility)
+				: mFacility(facility), mGeneration(0), mLevel(disabled), mTheoreticalArrivalTime(0), mSuppressedCount(0)
+			{}
+
+			CallSite(const CallSite& rhs) = delete;
+			CallSite& operator=(const CallSite& rhs) = delete;
+
+			// Query whether messages at level will be logged, resolving the facility's level if filtering has changed
+			inline bool IsEnabled(levels level)
+			{
+				unsigned int generation = configurationGeneration.load(std::memory_order_acquire);
+				if(generation != mGeneration.load(std::memory_order_acquire))
+					Resolve(generation);
+				return mLevel.load(std::memory_order_relaxed) >= level;
+			}
+
+			// Returns true if a message may be logged, and the number of messages suppressed since the last one in suppressedCount
+			bool Acquire(unsigned long long& suppressedCount);
+
+		private:
+			void Resolve(unsigned int generation);
+
+			const char * _Nullable		mFacility;
+			std::atomic_uint			mGeneration;
+			std::atomic_int				mLevel;
+			std::atomic_ullong			mTheoreticalArrivalTime;	// Host time
+			std::atomic_ullong			mSuppressedCount;
+		};
+
+		/*! @endcond */
+
+
+		/*! @name Output */
+		//@{
 
 		/*!
 		 * @brief Log a message
-		 * @note If \c level is below \c currentLogLevel nothing is logged.
+		 * @note If \c level is below the level for \c facility nothing is logged.
 		 * @param level The log level of the message
 		 * @param facility The sender's logging facility, or \c nullptr to use the default
 		 * @param message The log message
@@ -146,6 +243,50 @@ namespace SFB {
 		 */
 		void Log(levels level, const char * _Nullable facility, const char * _Nonnull message, const char * _Nullable function = nullptr, const char * _Nullable file = nullptr, int line = -1);
 
+		/*! @brief Block until all queued messages have been written */
+		void Flush();
+
+		/*! @brief Set whether messages are also written to \c stderr */
+		void SetStandardErrorEnabled(bool enabled);
+
+		//@}
+
+
+		/*!
+		 * @brief A \c std::ostream that formats into a fixed-size buffer without allocating
+		 * @note Output beyond \c kMaximumMessageLength - 1 characters is discarded
+		 */
+		class MessageStream : private std::streambuf, public std::ostream
+		{
+		public:
+			/*! @brief Create an empty \c MessageStream */
+			inline MessageStream()
+				: std::ostream(this)
+			{
+				setp(mBuffer, mBuffer + kMaximumMessageLength - 1);
+			}
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			MessageStream(const MessageStream& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			MessageStream& operator=(const MessageStream& rhs) = delete;
+
+			/*! @endcond */
+
+			/*! @brief Get the formatted message */
+			inline const char * _Nonnull c_str()
+			{
+				*pptr() = '\0';
+				return mBuffer;
+			}
+
+		private:
+			char mBuffer [kMaximumMessageLength];
+		};
+
 
 		/*! @name Convenience functions */
 		//@{
@@ -0,0 +1,628 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+#include <Accelerate/Accelerate.h>
+#include <AudioToolbox/AudioFormat.h>
+
+#include "LoudnessAnalyzer.h"
+#include "AudioBufferList.h"
+#include "AudioChannelLayout.h"
+#include "AudioConverter.h"
+#include "AudioDecoder.h"
+#include "CFErrorUtilities.h"
+#include "CFWrapper.h"
+#include "Logger.h"
+
+// ========================================
+// Error Codes
+// ========================================
+const CFStringRef SFB::Audio::LoudnessAnalyzer::ErrorDomain = CFSTR("org.sbooth.AudioEngine.ErrorDomain.LoudnessAnalyzer");
+
+#define REFERENCE_LOUDNESS			-23.			/* LUFS */
+#define ABSOLUTE_GATE				-70.			/* LUFS */
+#define RELATIVE_GATE				-10.			/* LU below the absolute-gated loudness, for integrated loudness */
+#define LRA_RELATIVE_GATE			-20.			/* LU below the absolute-gated loudness, for loudness range */
+#define SUBBLOCKS_PER_BLOCK			4				/* 400 ms gating blocks with 75% overlap */
+#define SUBBLOCKS_PER_SHORT_TERM	30				/* 3 s short-term blocks */
+#define FILTER_SECTIONS				2				/* The K-weighting filter is a shelf followed by a high-pass */
+#define FILTER_DELAY_LENGTH			(2 * FILTER_SECTIONS + 2)
+#define TRUE_PEAK_FILTER_LENGTH		48				/* Taps in each true-peak interpolation filter phase */
+#define BUFFER_SIZE_FRAMES			4096
+
+namespace {
+
+	// ========================================
+	// Calculate the K-weighting filter coefficients for a sample rate
+	// The coefficients given in ITU-R BS.1770 are for 48 KHz only, so the analog prototypes are transformed for other rates
+	void GetKWeightingCoefficients(double sampleRate, double coefficients [5 * FILTER_SECTIONS])
+	{
+		// Stage 1: High shelf modeling the acoustic effect of the head
+		double f0 = 1681.974450955533;
+		double G = 3.999843853973347;
+		double Q = 0.7071752369554196;
+
+		double K = std::tan(M_PI * f0 / sampleRate);
+		double Vh = std::pow(10., G / 20.);
+		double Vb = std::pow(Vh, 0.4996667741545416);
+		double a0 = 1. + K / Q + K * K;
+
+		coefficients[0] = (Vh + Vb * K / Q + K * K) / a0;
+		coefficients[1] = 2. * (K * K - Vh) / a0;
+		coefficients[2] = (Vh - Vb * K / Q + K * K) / a0;
+		coefficients[3] = 2. * (K * K - 1.) / a0;
+		coefficients[4] = (1. - K / Q + K * K) / a0;
+
+		// Stage 2: The revised low-frequency B-weighting (RLB) high-pass
+		f0 = 38.13547087602444;
+		Q = 0.5003270373238773;
+
+		K = std::tan(M_PI * f0 / sampleRate);
+		a0 = 1. + K / Q + K * K;
+
+		coefficients[5] = 1.;
+		coefficients[6] = -2.;
+		coefficients[7] = 1.;
+		coefficients[8] = 2. * (K * K - 1.) / a0;
+		coefficients[9] = (1. - K / Q + K * K) / a0;
+	}
+
+	// ========================================
+	// Get the BS.1770 weight for a channel
+	double GetChannelWeight(AudioChannelLabel label)
+	{
+		switch(label) {
+			case kAudioChannelLabel_LFEScreen:
+			case kAudioChannelLabel_LFE2:
+				return 0.;
+
+			case kAudioChannelLabel_LeftSurround:
+			case kAudioChannelLabel_RightSurround:
+			case kAudioChannelLabel_LeftSurroundDirect:
+			case kAudioChannelLabel_RightSurroundDirect:
+			case kAudioChannelLabel_RearSurroundLeft:
+			case kAudioChannelLabel_RearSurroundRight:
+			case kAudioChannelLabel_CenterSurround:
+				return 1.41;
+
+			default:
+				return 1.;
+		}
+	}
+
+	// ========================================
+	// Get the weight of each channel, using the channel layout if possible
+	std::vector<double> GetChannelWeights(UInt32 channelCount, const SFB::Audio::ChannelLayout& channelLayout)
+	{
+		std::vector<double> weights(channelCount, 1.);
+
+		if(channelLayout && channelLayout.GetChannelCount() == channelCount) {
+			// Expand the layout tag to channel descriptions
+			SFB::Audio::ChannelLayout descriptions = channelLayout;
+			if(kAudioChannelLayoutTag_UseChannelDescriptions != channelLayout->mChannelLayoutTag && kAudioChannelLayoutTag_UseChannelBitmap != channelLayout->mChannelLayoutTag) {
+				AudioChannelLayoutTag layoutTag = channelLayout->mChannelLayoutTag;
+				UInt32 propertySize;
+				if(noErr == AudioFormatGetPropertyInfo(kAudioFormatProperty_ChannelLayoutForTag, sizeof(layoutTag), &layoutTag, &propertySize)) {
+					std::vector<uint8_t> buf(propertySize);
+					if(noErr == AudioFormatGetProperty(kAudioFormatProperty_ChannelLayoutForTag, sizeof(layoutTag), &layoutTag, &propertySize, buf.data()))
+						descriptions = (const AudioChannelLayout *)buf.data();
+				}
+			}
+
+			if(kAudioChannelLayoutTag_UseChannelDescriptions == descriptions->mChannelLayoutTag && descriptions->mNumberChannelDescriptions == channelCount) {
+				for(UInt32 i = 0; i < channelCount; ++i)
+					weights[i] = GetChannelWeight(descriptions->mChannelDescriptions[i].mChannelLabel);
+				return weights;
+			}
+		}
+
+		// Assume the WAVE channel order: L R C LFE Ls Rs (5.1) or L R C LFE Lrs Rrs Ls Rs (7.1)
+		if(6 == channelCount || 8 == channelCount) {
+			weights[3] = 0.;
+			for(UInt32 i = 4; i < channelCount; ++i)
+				weights[i] = 1.41;
+		}
+
+		return weights;
+	}
+
+	// ========================================
+	// Interpolation filters for the phases between input samples, as in LevelMeter
+	std::vector<float> CreateTruePeakFilters(UInt32 oversamplingFactor)
+	{
+		std::vector<float> filters((oversamplingFactor - 1) * TRUE_PEAK_FILTER_LENGTH);
+		const double halfLength = TRUE_PEAK_FILTER_LENGTH / 2.;
+
+		for(UInt32 phase = 0; phase < oversamplingFactor - 1; ++phase) {
+			float *coefficients = filters.data() + phase * TRUE_PEAK_FILTER_LENGTH;
+			double fraction = (phase + 1) / (double)oversamplingFactor;
+			double sum = 0;
+
+			for(UInt32 i = 0; i < TRUE_PEAK_FILTER_LENGTH; ++i) {
+				double x = i - (halfLength - 1) - fraction;
+				double sinc = 0 == x ? 1 : std::sin(M_PI * x) / (M_PI * x);
+				double window = 0.5 * (1 + std::cos(M_PI * x / halfLength));
+				coefficients[i] = (float)(sinc * window);
+				sum += coefficients[i];
+			}
+
+			// Normalize for unity gain at DC
+			for(UInt32 i = 0; i < TRUE_PEAK_FILTER_LENGTH; ++i)
+				coefficients[i] = (float)(coefficients[i] / sum);
+		}
+
+		return filters;
+	}
+
+	inline double PowerToLoudness(double power)
+	{
+		return -0.691 + 10. * std::log10(power);
+	}
+
+	inline double LoudnessToPower(double loudness)
+	{
+		return std::pow(10., (loudness + 0.691) / 10.);
+	}
+
+	// ========================================
+	// The format of the audio passed to the filters
+	AudioStreamBasicDescription GetAnalysisFormat(Float64 sampleRate, UInt32 channelCount)
+	{
+		AudioStreamBasicDescription format = {
+			.mFormatID				= kAudioFormatLinearPCM,
+			.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved,
+			.mReserved				= 0,
+			.mSampleRate			= sampleRate,
+			.mChannelsPerFrame		= channelCount,
+			.mBitsPerChannel		= 32,
+			.mBytesPerPacket		= 4,
+			.mBytesPerFrame			= 4,
+			.mFramesPerPacket		= 1
+		};
+
+		return format;
+	}
+
+	bool IsAnalysisFormat(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && format.IsNativeEndian() && (1 == format.mChannelsPerFrame || !format.IsInterleaved());
+	}
+
+	// ========================================
+	// Get the mean power of the blocks above the absolute gate
+	bool GetAbsoluteGatedPower(const std::vector<double>& blocks, double& power)
+	{
+		const double absoluteThreshold = LoudnessToPower(ABSOLUTE_GATE);
+
+		double sum = 0;
+		size_t count = 0;
+		for(auto block : blocks) {
+			if(block > absoluteThreshold) {
+				sum += block;
+				++count;
+			}
+		}
+
+		if(0 == count)
+			return false;
+
+		power = sum / count;
+		return true;
+	}
+
+	// ========================================
+	// Calculate the gated integrated loudness
+	bool CalculateIntegratedLoudness(const std::vector<double>& blocks, double& loudness)
+	{
+		double power;
+		if(!GetAbsoluteGatedPower(blocks, power))
+			return false;
+
+		const double threshold = std::max(LoudnessToPower(ABSOLUTE_GATE), power * std::pow(10., RELATIVE_GATE / 10.));
+
+		double sum = 0;
+		size_t count = 0;
+		for(auto block : blocks) {
+			if(block > threshold) {
+				sum += block;
+				++count;
+			}
+		}
+
+		if(0 == count)
+			return false;
+
+		loudness = PowerToLoudness(sum / count);
+		return true;
+	}
+
+	// ========================================
+	// Calculate the loudness range as specified by EBU Tech 3342
+	bool CalculateLoudnessRange(const std::vector<double>& shortTermBlocks, double& loudnessRange)
+	{
+		double power;
+		if(!GetAbsoluteGatedPower(shortTermBlocks, power))
+			return false;
+
+		const double threshold = std::max(LoudnessToPower(ABSOLUTE_GATE), power * std::pow(10., LRA_RELATIVE_GATE / 10.));
+
+		std::vector<double> gated;
+		std::copy_if(shortTermBlocks.begin(), shortTermBlocks.end(), std::back_inserter(gated), [threshold](double block) { return block > threshold; });
+
+		if(gated.empty())
+			return false;
+
+		std::sort(gated.begin(), gated.end());
+
+		double low = gated[(size_t)std::lround((gated.size() - 1) * 0.10)];
+		double high = gated[(size_t)std::lround((gated.size() - 1) * 0.95)];
+
+		loudnessRange = PowerToLoudness(high) - PowerToLoudness(low);
+		return true;
+	}
+
+}
+
+// This class exists to hide the internal state from the world
+class SFB::Audio::LoudnessAnalyzer::LoudnessAnalyzerPrivate
+{
+public:
+	vDSP_biquad_Setup		kWeightingFilter;			/* the K-weighting filter as a biquad cascade */
+	std::vector<float>		filterDelays;				/* per-channel filter state */
+	std::vector<double>		channelWeights;
+	std::vector<float>		filtered;
+
+	AudioConverterRef		converter;					/* converts audio not in the analysis format */
+	BufferList				convertedBuffer;
+
+	Float64					sampleRate;
+	UInt32					channelCount;
+	UInt32					subblockFrames;				/* 100 ms of frames */
+	UInt32					subblockFramesAnalyzed;
+	std::vector<double>		subblockChannelPower;		/* per-channel sum of squares for the current sub-block */
+	std::vector<double>		subblockPower;				/* weighted mean square of each complete sub-block */
+
+	UInt32					oversamplingFactor;
+	std::vector<float>		truePeakFilters;
+	std::vector<float>		truePeakHistory;			/* per-channel trailing samples */
+	std::vector<float>		truePeakBuffer;
+	std::vector<float>		interpolated;
+
+	std::vector<double>		trackBlocks;				/* 400 ms gating block powers */
+	std::vector<double>		trackShortTermBlocks;		/* 3 s short-term block powers */
+	float					trackTruePeak;
+
+	std::vector<double>		albumBlocks;
+	std::vector<double>		albumShortTermBlocks;
+	float					albumTruePeak;
+
+	LoudnessAnalyzerPrivate()
+		: kWeightingFilter(nullptr), converter(nullptr), sampleRate(0), channelCount(0), subblockFrames(0), subblockFramesAnalyzed(0), oversamplingFactor(1), trackTruePeak(0), albumTruePeak(0)
+	{}
+
+	~LoudnessAnalyzerPrivate()
+	{
+		if(kWeightingFilter)
+			vDSP_biquad_DestroySetup(kWeightingFilter);
+		DisposeConverter();
+	}
+
+	void DisposeConverter()
+	{
+		if(converter) {
+			auto result = AudioConverterDispose(converter);
+			if(noErr != result)
+				LOGGER_ERR("org.sbooth.AudioEngine.LoudnessAnalyzer", "AudioConverterDispose failed: " << result);
+			converter = nullptr;
+		}
+
+		convertedBuffer.Deallocate();
+	}
+
+	// Prepare to analyze a track in format
+	bool BeginTrack(const AudioFormat& format, const ChannelLayout& channelLayout)
+	{
+		DisposeConverter();
+
+		if(!format.IsPCM() || 0 == format.mChannelsPerFrame || 0 >= format.mSampleRate)
+			return false;
+
+		if(!SetFormat(format.mSampleRate, format.mChannelsPerFrame, channelLayout))
+			return false;
+
+		// Audio in other formats is converted, at the same sample rate, before filtering
+		if(!IsAnalysisFormat(format)) {
+			auto analysisFormat = GetAnalysisFormat(format.mSampleRate, format.mChannelsPerFrame);
+			auto result = AudioConverterNew(&format, &analysisFormat, &converter);
+			if(noErr != result) {
+				LOGGER_ERR("org.sbooth.AudioEngine.LoudnessAnalyzer", "AudioConverterNew failed: " << result);
+				converter = nullptr;
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void AnalyzeAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+	{
+		if(nullptr == kWeightingFilter || 0 == frameCount)
+			return;
+
+		if(converter) {
+			if(convertedBuffer.GetCapacityFrames() < frameCount && !convertedBuffer.Allocate(GetAnalysisFormat(sampleRate, channelCount), frameCount))
+				return;
+
+			for(UInt32 i = 0; i < convertedBuffer->mNumberBuffers; ++i)
+				convertedBuffer->mBuffers[i].mDataByteSize = frameCount * sizeof(float);
+
+			auto result = AudioConverterConvertComplexBuffer(converter, frameCount, bufferList, convertedBuffer);
+			if(noErr != result) {
+				LOGGER_ERR("org.sbooth.AudioEngine.LoudnessAnalyzer", "AudioConverterConvertComplexBuffer failed: " << result);
+				return;
+			}
+
+			bufferList = convertedBuffer;
+		}
+
+		AnalyzeFrames(bufferList, frameCount);
+	}
+
+	bool SetFormat(double rate, UInt32 channels, const ChannelLayout& channelLayout)
+	{
+		double coefficients [5 * FILTER_SECTIONS];
+		GetKWeightingCoefficients(rate, coefficients);
+
+		if(kWeightingFilter)
+			vDSP_biquad_DestroySetup(kWeightingFilter);
+		kWeightingFilter = vDSP_biquad_CreateSetup(coefficients, FILTER_SECTIONS);
+		if(!kWeightingFilter)
+			return false;
+
+		sampleRate = rate;
+		channelCount = channels;
+		filterDelays.assign(channelCount * FILTER_DELAY_LENGTH, 0);
+		channelWeights = GetChannelWeights(channelCount, channelLayout);
+
+		subblockFrames = std::max((UInt32)std::lround(sampleRate / 10.), 1u);
+		subblockFramesAnalyzed = 0;
+		subblockChannelPower.assign(channelCount, 0);
+		subblockPower.clear();
+
+		// BS.1770 requires an oversampled rate of at least 192 KHz
+		oversamplingFactor = sampleRate < 96000 ? 4 : (sampleRate < 192000 ? 2 : 1);
+		truePeakFilters = CreateTruePeakFilters(oversamplingFactor);
+		truePeakHistory.assign(channelCount * (TRUE_PEAK_FILTER_LENGTH - 1), 0);
+
+		trackBlocks.clear();
+		trackShortTermBlocks.clear();
+		trackTruePeak = 0;
+
+		return true;
+	}
+
+	// bufferList contains non-interleaved float samples
+	void AnalyzeFrames(const AudioBufferList *bufferList, UInt32 frameCount)
+	{
+		if(filtered.size() < frameCount) {
+			filtered.resize(frameCount);
+			interpolated.resize(frameCount);
+			truePeakBuffer.resize(TRUE_PEAK_FILTER_LENGTH - 1 + frameCount);
+		}
+
+		UInt32 framesProcessed = 0;
+		while(framesProcessed < frameCount) {
+			// Segments end at sub-block boundaries
+			UInt32 segmentFrames = std::min(frameCount - framesProcessed, subblockFrames - subblockFramesAnalyzed);
+
+			for(UInt32 channel = 0; channel < channelCount; ++channel) {
+				if(0 == channelWeights[channel])
+					continue;
+
+				const float *samples = (const float *)bufferList->mBuffers[channel].mData + framesProcessed;
+				vDSP_biquad(kWeightingFilter, filterDelays.data() + channel * FILTER_DELAY_LENGTH, samples, 1, filtered.data(), 1, segmentFrames);
+
+				float sumOfSquares;
+				vDSP_svesq(filtered.data(), 1, &sumOfSquares, segmentFrames);
+				subblockChannelPower[channel] += sumOfSquares;
+			}
+
+			framesProcessed += segmentFrames;
+			subblockFramesAnalyzed += segmentFrames;
+
+			if(subblockFramesAnalyzed == subblockFrames) {
+				double power = 0;
+				for(UInt32 channel = 0; channel < channelCount; ++channel)
+					power += channelWeights[channel] * subblockChannelPower[channel];
+				subblockPower.push_back(power / subblockFrames);
+
+				std::fill(subblockChannelPower.begin(), subblockChannelPower.end(), 0);
+				subblockFramesAnalyzed = 0;
+			}
+		}
+
+		// True peaks are measured for all channels, including LFE
+		for(UInt32 channel = 0; channel < channelCount; ++channel) {
+			const float *samples = (const float *)bufferList->mBuffers[channel].mData;
+
+			float peak = 0;
+			vDSP_maxmgv(samples, 1, &peak, frameCount);
+
+			if(1 < oversamplingFactor) {
+				// Interpolate between samples, preceded by the trailing samples of the previous buffer
+				float *history = truePeakHistory.data() + channel * (TRUE_PEAK_FILTER_LENGTH - 1);
+				memcpy(truePeakBuffer.data(), history, (TRUE_PEAK_FILTER_LENGTH - 1) * sizeof(float));
+				memcpy(truePeakBuffer.data() + TRUE_PEAK_FILTER_LENGTH - 1, samples, frameCount * sizeof(float));
+
+				for(UInt32 phase = 0; phase < oversamplingFactor - 1; ++phase) {
+					float phasePeak = 0;
+					vDSP_conv(truePeakBuffer.data(), 1, truePeakFilters.data() + phase * TRUE_PEAK_FILTER_LENGTH, 1, interpolated.data(), 1, frameCount, TRUE_PEAK_FILTER_LENGTH);
+					vDSP_maxmgv(interpolated.data(), 1, &phasePeak, frameCount);
+					peak = std::max(peak, phasePeak);
+				}
+
+				memcpy(history, truePeakBuffer.data() + frameCount, (TRUE_PEAK_FILTER_LENGTH - 1) * sizeof(float));
+			}
+
+			trackTruePeak = std::max(trackTruePeak, peak);
+		}
+	}
+
+	// Assemble the sub-blocks into overlapping gating and short-term blocks
+	// A partial sub-block at the end of the track is discarded
+	void FinishTrack()
+	{
+		double sum = 0;
+		for(size_t i = 0; i < subblockPower.size(); ++i) {
+			sum += subblockPower[i];
+			if(i >= SUBBLOCKS_PER_BLOCK)
+				sum -= subblockPower[i - SUBBLOCKS_PER_BLOCK];
+			if(i + 1 >= SUBBLOCKS_PER_BLOCK)
+				trackBlocks.push_back(sum / SUBBLOCKS_PER_BLOCK);
+		}
+
+		sum = 0;
+		for(size_t i = 0; i < subblockPower.size(); ++i) {
+			sum += subblockPower[i];
+			if(i >= SUBBLOCKS_PER_SHORT_TERM)
+				sum -= subblockPower[i - SUBBLOCKS_PER_SHORT_TERM];
+			if(i + 1 >= SUBBLOCKS_PER_SHORT_TERM)
+				trackShortTermBlocks.push_back(sum / SUBBLOCKS_PER_SHORT_TERM);
+		}
+
+		albumBlocks.insert(albumBlocks.end(), trackBlocks.begin(), trackBlocks.end());
+		albumShortTermBlocks.insert(albumShortTermBlocks.end(), trackShortTermBlocks.begin(), trackShortTermBlocks.end());
+		albumTruePeak = std::max(albumTruePeak, trackTruePeak);
+	}
+};
+
+double SFB::Audio::LoudnessAnalyzer::GetReferenceLoudness()
+{
+	return REFERENCE_LOUDNESS;
+}
+
+SFB::Audio::LoudnessAnalyzer::LoudnessAnalyzer()
+	: priv(new LoudnessAnalyzerPrivate)
+{}
+
+// Empty destructor is required for unique_ptr with an incomplete type
+SFB::Audio::LoudnessAnalyzer::~LoudnessAnalyzer()
+{}
+
+bool SFB::Audio::LoudnessAnalyzer::AnalyzeURL(CFURLRef url, CFErrorRef *error)
+{
+	if(nullptr == url)
+		return false;
+
+	auto decoder = Decoder::CreateForURL(url, error);
+	if(!decoder || !decoder->Open(error))
+		return false;
+
+	AudioStreamBasicDescription inputFormat = decoder->GetFormat();
+	ChannelLayout channelLayout = decoder->GetChannelLayout();
+
+	if(0 == inputFormat.mChannelsPerFrame || 0 >= inputFormat.mSampleRate) {
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” does not contain audio in a supported format."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("The file's channel count or sample rate is unknown"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
+
+			*error = CreateErrorForURL(LoudnessAnalyzer::ErrorDomain, LoudnessAnalyzer::FileFormatNotSupportedError, description, url, failureReason, recoverySuggestion);
+		}
+
+		return false;
+	}
+
+	// The audio is analyzed at its native sample rate
+	AudioStreamBasicDescription outputFormat = {
+		.mFormatID				= kAudioFormatLinearPCM,
+		.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved,
+		.mReserved				= 0,
+		.mSampleRate			= inputFormat.mSampleRate,
+		.mChannelsPerFrame		= inputFormat.mChannelsPerFrame,
+		.mBitsPerChannel		= 32,
+		.mBytesPerPacket		= 4,
+		.mBytesPerFrame			= 4,
+		.mFramesPerPacket		= 1
+	};
+
+	if(!priv->BeginTrack(outputFormat, channelLayout))
+		return false;
+
+	// Converter takes ownership of decoder
+	Converter converter(std::move(decoder), outputFormat);
+	if(!converter.Open(error))
+		return false;
+
+	BufferList outputBuffer(outputFormat, BUFFER_SIZE_FRAMES);
+
+	for(;;) {
+		UInt32 frameCount = converter.ConvertAudio(outputBuffer, BUFFER_SIZE_FRAMES);
+		if(0 == frameCount)
+			break;
+
+		priv->AnalyzeAudio(outputBuffer, frameCount);
+	}
+
+	priv->FinishTrack();
+
+	return true;
+}
+
+bool SFB::Audio::LoudnessAnalyzer::DecodingStarted(const Decoder& decoder)
+{
+	return priv->BeginTrack(decoder.GetFormat(), decoder.GetChannelLayout());
+}
+
+void SFB::Audio::LoudnessAnalyzer::AnalyzeAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	priv->AnalyzeAudio(bufferList, frameCount);
+}
+
+void SFB::Audio::LoudnessAnalyzer::DecodingFinished(const Decoder& decoder, bool complete)
+{
+#pragma unused(decoder)
+#pragma unused(complete)
+
+	priv->FinishTrack();
+	priv->DisposeConverter();
+}
+
+bool SFB::Audio::LoudnessAnalyzer::GetTrackLoudness(double& trackLoudness) const
+{
+	return CalculateIntegratedLoudness(priv->trackBlocks, trackLoudness);
+}
+
+bool SFB::Audio::LoudnessAnalyzer::GetTrackLoudnessRange(double& trackLoudnessRange) const
+{
+	return CalculateLoudnessRange(priv->trackShortTermBlocks, trackLoudnessRange);
+}
+
+bool SFB::Audio::LoudnessAnalyzer::GetTrackTruePeak(float& trackTruePeak) const
+{
+	trackTruePeak = priv->trackTruePeak;
+	return true;
+}
+
+bool SFB::Audio::LoudnessAnalyzer::GetAlbumLoudness(double& albumLoudness) const
+{
+	return CalculateIntegratedLoudness(priv->albumBlocks, albumLoudness);
+}
+
+bool SFB::Audio::LoudnessAnalyzer::GetAlbumLoudnessRange(double& albumLoudnessRange) const
+{
+	return CalculateLoudnessRange(priv->albumShortTermBlocks, albumLoudnessRange);
+}
+
+bool SFB::Audio::LoudnessAnalyzer::GetAlbumTruePeak(float& albumTruePeak) const
+{
+	albumTruePeak = priv->albumTruePeak;
+	return true;
+}
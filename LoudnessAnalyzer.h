@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <memory>
+
+#include "AudioAnalysisTap.h"
+
+/*! @file LoudnessAnalyzer.h @brief Support for EBU R 128 loudness calculation */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A class that calculates loudness as specified by EBU R 128 and ITU-R BS.1770
+		 * @see https://tech.ebu.ch/docs/r/r128.pdf
+		 *
+		 * Audio is analyzed at its native sample rate with any number of channels.  Channels are weighted
+		 * using the decoder's channel layout if one is available, otherwise the channel order is assumed to be
+		 * that of WAVE files (L R C LFE Ls Rs ...).
+		 *
+		 * To calculate an album's loudness, create a \c LoudnessAnalyzer and call
+		 * \c LoudnessAnalyzer::AnalyzeURL() for each track.
+		 *
+		 * A \c LoudnessAnalyzer may also be used as a \c Player analysis tap to analyze a track while it is played.
+		 * Subclasses should override \c DecodingFinished() to retrieve the loudness values after calling the base class.
+		 */
+		class LoudnessAnalyzer : public AnalysisTap
+		{
+		public:
+
+			/*! @brief The \c CFErrorRef error domain used by \c LoudnessAnalyzer */
+			static const CFStringRef ErrorDomain;
+
+			/*! @brief Possible \c CFErrorRef error codes used by \c LoudnessAnalyzer */
+			enum ErrorCode {
+				FileFormatNotSupportedError			= 0,	/*!< File format not supported */
+			};
+
+
+			/*! @brief Get the reference loudness in LUFS, defined as -23.0 LUFS */
+			static double GetReferenceLoudness();
+
+
+			// ========================================
+			/*! @name Creation/Destruction */
+			//@{
+
+			/*! @brief Create a new \c LoudnessAnalyzer */
+			LoudnessAnalyzer();
+
+			/*! @brief Destroy this \c LoudnessAnalyzer */
+			~LoudnessAnalyzer();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			LoudnessAnalyzer(const LoudnessAnalyzer& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			LoudnessAnalyzer& operator=(const LoudnessAnalyzer& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			// ========================================
+			/*! @name Audio analysis */
+			//@{
+
+			/*!
+			 * @brief Analyze the given URL's loudness
+			 * @param url The URL
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, false otherwise
+			 */
+			bool AnalyzeURL(CFURLRef url, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Analysis during decoding */
+			//@{
+
+			/*! @brief Begin analyzing a track using the decoder's format */
+			bool DecodingStarted(const Decoder& decoder) override;
+
+			/*! @brief Analyze audio in the format of the decoder passed to \c DecodingStarted() */
+			void AnalyzeAudio(const AudioBufferList *bufferList, UInt32 frameCount) override;
+
+			/*! @brief Finish analyzing the track so its loudness values are available */
+			void DecodingFinished(const Decoder& decoder, bool complete) override;
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Loudness values
+			 * The \c Get() methods return \c true on success, \c false otherwise
+			 */
+			//@{
+
+			/*! @brief Get the track's gated integrated loudness in LUFS */
+			bool GetTrackLoudness(double& trackLoudness) const;
+
+			/*! @brief Get the track's loudness range in LU */
+			bool GetTrackLoudnessRange(double& trackLoudnessRange) const;
+
+			/*! @brief Get the track's true peak value normalized to [-1, 1) */
+			bool GetTrackTruePeak(float& trackTruePeak) const;
+
+
+			/*! @brief Get the album's gated integrated loudness in LUFS */
+			bool GetAlbumLoudness(double& albumLoudness) const;
+
+			/*! @brief Get the album's loudness range in LU */
+			bool GetAlbumLoudnessRange(double& albumLoudnessRange) const;
+
+			/*! @brief Get the album's true peak value normalized to [-1, 1) */
+			bool GetAlbumTruePeak(float& albumTruePeak) const;
+
+			//@}
+
+		private:
+			// The loudness internal state
+			class LoudnessAnalyzerPrivate;
+			std::unique_ptr<LoudnessAnalyzerPrivate> priv;
+		};
+
+	}
+}
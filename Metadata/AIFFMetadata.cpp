@@ -64,6 +64,15 @@ bool SFB::Audio::AIFFMetadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::AIFFMetadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header || 12 > length)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+	return 0 == memcmp(bytes, "FORM", 4) && (0 == memcmp(bytes + 8, "AIFF", 4) || 0 == memcmp(bytes + 8, "AIFC", 4));
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::AIFFMetadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new AIFFMetadata(url));
@@ -79,12 +88,8 @@ SFB::Audio::AIFFMetadata::AIFFMetadata(CFURLRef url)
 
 bool SFB::Audio::AIFFMetadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -96,7 +101,7 @@ bool SFB::Audio::AIFFMetadata::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::RIFF::AIFF::File file(stream.get());
+	TagLib::RIFF::AIFF::File file(stream.get(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid AIFF file."), ""));
@@ -110,6 +115,7 @@ bool SFB::Audio::AIFFMetadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("AIFF"));
+	AddIntToDictionary(mMetadata, kFormatIDKey, (int)kAudioFormatLinearPCM);
 
 	if(file.audioProperties()) {
 		auto properties = file.audioProperties();
@@ -121,8 +127,8 @@ bool SFB::Audio::AIFFMetadata::_ReadMetadata(CFErrorRef *error)
 			AddLongLongToDictionary(mMetadata, kTotalFramesKey, properties->sampleFrames());
 	}
 
-	if(file.tag())
-		AddID3v2TagToDictionary(mMetadata, mPictures, file.tag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.tag())
+		AddID3v2TagToDictionary(mMetadata, mPictures, file.tag(), ShouldReadAttachedPictures());
 
 	return true;
 }
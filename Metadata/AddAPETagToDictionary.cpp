@@ -3,6 +3,8 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <map>
+
 #include <taglib/flacpicture.h>
 
 #include "AddAPETagToDictionary.h"
@@ -10,8 +12,79 @@
 #include "CFWrapper.h"
 #include "Base64Utilities.h"
 #include "CFDictionaryUtilities.h"
+#include "TagLibStringUtilities.h"
+
+namespace {
+
+	using SFB::Audio::Metadata;
+
+	// How an item's value is added to the dictionary
+	enum class FieldType {
+		String,
+		Integer,
+		Boolean,
+		Double
+	};
+
+	struct Field
+	{
+		CFStringRef mKey;
+		FieldType mType;
+	};
+
+	// Items are keyed by their uppercase names, as stored by TagLib, so a single lookup replaces case-insensitive comparisons
+	const std::map<TagLib::String, Field>& GetFields()
+	{
+		static const std::map<TagLib::String, Field> sFields = {
+			{ "ALBUM",							{ Metadata::kAlbumTitleKey,				FieldType::String } },
+			{ "ARTIST",							{ Metadata::kArtistKey,					FieldType::String } },
+			{ "ALBUMARTIST",					{ Metadata::kAlbumArtistKey,			FieldType::String } },
+			{ "COMPOSER",						{ Metadata::kComposerKey,				FieldType::String } },
+			{ "GENRE",							{ Metadata::kGenreKey,					FieldType::String } },
+			{ "DATE",							{ Metadata::kReleaseDateKey,			FieldType::String } },
+			{ "DESCRIPTION",					{ Metadata::kCommentKey,				FieldType::String } },
+			{ "TITLE",							{ Metadata::kTitleKey,					FieldType::String } },
+			{ "TRACKNUMBER",					{ Metadata::kTrackNumberKey,			FieldType::Integer } },
+			{ "TRACKTOTAL",						{ Metadata::kTrackTotalKey,				FieldType::Integer } },
+			{ "COMPILATION",					{ Metadata::kCompilationKey,			FieldType::Boolean } },
+			{ "DISCNUMBER",						{ Metadata::kDiscNumberKey,				FieldType::Integer } },
+			{ "DISCTOTAL",						{ Metadata::kDiscTotalKey,				FieldType::Integer } },
+			{ "LYRICS",							{ Metadata::kLyricsKey,					FieldType::String } },
+			{ "BPM",							{ Metadata::kBPMKey,					FieldType::Integer } },
+			{ "RATING",							{ Metadata::kRatingKey,					FieldType::Integer } },
+			{ "ISRC",							{ Metadata::kISRCKey,					FieldType::String } },
+			{ "MCN",							{ Metadata::kMCNKey,					FieldType::String } },
+			{ "MUSICBRAINZ_ALBUMID",			{ Metadata::kMusicBrainzReleaseIDKey,	FieldType::String } },
+			{ "MUSICBRAINZ_TRACKID",			{ Metadata::kMusicBrainzRecordingIDKey,	FieldType::String } },
+			{ "TITLESORT",						{ Metadata::kTitleSortOrderKey,			FieldType::String } },
+			{ "ALBUMTITLESORT",					{ Metadata::kAlbumTitleSortOrderKey,	FieldType::String } },
+			{ "ARTISTSORT",						{ Metadata::kArtistSortOrderKey,		FieldType::String } },
+			{ "ALBUMARTISTSORT",				{ Metadata::kAlbumArtistSortOrderKey,	FieldType::String } },
+			{ "COMPOSERSORT",					{ Metadata::kComposerSortOrderKey,		FieldType::String } },
+			{ "GROUPING",						{ Metadata::kGroupingKey,				FieldType::String } },
+			{ "REPLAYGAIN_REFERENCE_LOUDNESS",	{ Metadata::kReferenceLoudnessKey,		FieldType::Double } },
+			{ "REPLAYGAIN_TRACK_GAIN",			{ Metadata::kTrackGainKey,				FieldType::Double } },
+			{ "REPLAYGAIN_TRACK_PEAK",			{ Metadata::kTrackPeakKey,				FieldType::Double } },
+			{ "REPLAYGAIN_ALBUM_GAIN",			{ Metadata::kAlbumGainKey,				FieldType::Double } },
+			{ "REPLAYGAIN_ALBUM_PEAK",			{ Metadata::kAlbumPeakKey,				FieldType::Double } },
+		};
+
+		return sFields;
+	}
+
+	void AddFieldToDictionary(CFMutableDictionaryRef dictionary, const Field& field, CFStringRef value)
+	{
+		switch(field.mType) {
+			case FieldType::String:		CFDictionarySetValue(dictionary, field.mKey, value);													break;
+			case FieldType::Integer:	SFB::AddIntToDictionary(dictionary, field.mKey, CFStringGetIntValue(value));							break;
+			case FieldType::Boolean:	CFDictionarySetValue(dictionary, field.mKey, CFStringGetIntValue(value) ? kCFBooleanTrue : kCFBooleanFalse);	break;
+			case FieldType::Double:		SFB::AddDoubleToDictionary(dictionary, field.mKey, CFStringGetDoubleValue(value));						break;
+		}
+	}
 
-bool SFB::Audio::AddAPETagToDictionary(CFMutableDictionaryRef dictionary, std::vector<std::shared_ptr<AttachedPicture>>& attachedPictures, const TagLib::APE::Tag *tag)
+}
+
+bool SFB::Audio::AddAPETagToDictionary(CFMutableDictionaryRef dictionary, std::vector<std::shared_ptr<AttachedPicture>>& attachedPictures, const TagLib::APE::Tag *tag, bool addAttachedPictures)
 {
 	if(nullptr == dictionary || nullptr == tag)
 		return false;
@@ -21,6 +94,7 @@ bool SFB::Audio::AddAPETagToDictionary(CFMutableDictionaryRef dictionary, std::v
 
 	SFB::CFMutableDictionary additionalMetadata(0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
 
+	const auto& fields = GetFields();
 	for(auto iterator : tag->itemListMap()) {
 		auto item = iterator.second;
 
@@ -28,100 +102,24 @@ bool SFB::Audio::AddAPETagToDictionary(CFMutableDictionaryRef dictionary, std::v
 			continue;
 
 		if(TagLib::APE::Item::Text == item.type()) {
-			SFB::CFString key(item.key().toCString(true), kCFStringEncodingUTF8);
-			SFB::CFString value(item.toString().toCString(true), kCFStringEncodingUTF8);
-
-			if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ALBUM"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kAlbumTitleKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ARTIST"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kArtistKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ALBUMARTIST"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kAlbumArtistKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("COMPOSER"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kComposerKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("GENRE"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kGenreKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("DATE"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kReleaseDateKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("DESCRIPTION"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kCommentKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("TITLE"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kTitleKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("TRACKNUMBER"), kCFCompareCaseInsensitive))
-				AddIntToDictionary(dictionary, Metadata::kTrackNumberKey, CFStringGetIntValue(value));
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("TRACKTOTAL"), kCFCompareCaseInsensitive))
-				AddIntToDictionary(dictionary, Metadata::kTrackTotalKey, CFStringGetIntValue(value));
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("COMPILATION"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kCompilationKey, CFStringGetIntValue(value) ? kCFBooleanTrue : kCFBooleanFalse);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("DISCNUMBER"), kCFCompareCaseInsensitive))
-				AddIntToDictionary(dictionary, Metadata::kDiscNumberKey, CFStringGetIntValue(value));
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("DISCTOTAL"), kCFCompareCaseInsensitive))
-				AddIntToDictionary(dictionary, Metadata::kDiscTotalKey, CFStringGetIntValue(value));
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("LYRICS"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kLyricsKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("BPM"), kCFCompareCaseInsensitive))
-				AddIntToDictionary(dictionary, Metadata::kBPMKey, CFStringGetIntValue(value));
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("RATING"), kCFCompareCaseInsensitive))
-				AddIntToDictionary(dictionary, Metadata::kRatingKey, CFStringGetIntValue(value));
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ISRC"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kISRCKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("MCN"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kMCNKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("MUSICBRAINZ_ALBUMID"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kMusicBrainzReleaseIDKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("MUSICBRAINZ_TRACKID"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kMusicBrainzRecordingIDKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("TITLESORT"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kTitleSortOrderKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ALBUMTITLESORT"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kAlbumTitleSortOrderKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ARTISTSORT"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kArtistSortOrderKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ALBUMARTISTSORT"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kAlbumArtistSortOrderKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("COMPOSERSORT"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kComposerSortOrderKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("GROUPING"), kCFCompareCaseInsensitive))
-				CFDictionarySetValue(dictionary, Metadata::kGroupingKey, value);
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("REPLAYGAIN_REFERENCE_LOUDNESS"), kCFCompareCaseInsensitive))
-				AddDoubleToDictionary(dictionary, Metadata::kReferenceLoudnessKey, CFStringGetDoubleValue(value));
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("REPLAYGAIN_TRACK_GAIN"), kCFCompareCaseInsensitive))
-				AddDoubleToDictionary(dictionary, Metadata::kTrackGainKey, CFStringGetDoubleValue(value));
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("REPLAYGAIN_TRACK_PEAK"), kCFCompareCaseInsensitive))
-				AddDoubleToDictionary(dictionary, Metadata::kTrackPeakKey, CFStringGetDoubleValue(value));
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("REPLAYGAIN_ALBUM_GAIN"), kCFCompareCaseInsensitive))
-				AddDoubleToDictionary(dictionary, Metadata::kAlbumGainKey, CFStringGetDoubleValue(value));
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("REPLAYGAIN_ALBUM_PEAK"), kCFCompareCaseInsensitive))
-				AddDoubleToDictionary(dictionary, Metadata::kAlbumPeakKey, CFStringGetDoubleValue(value));
-#if 0
-			else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("METADATA_BLOCK_PICTURE"), kCFCompareCaseInsensitive)) {
-				// Handle embedded pictures
-				for(auto blockIterator : item.values()) {
-					auto encodedBlock = blockIterator.data(TagLib::String::UTF8);
-
-					// Decode the Base-64 encoded data
-					auto decodedBlock = TagLib::DecodeBase64(encodedBlock);
-
-					// Create the picture
-					TagLib::FLAC::Picture picture;
-					picture.parse(decodedBlock);
-
-					SFB::CFData data((const UInt8 *)picture.data().data(), picture.data().size());
-
-					SFB::CFString description = nullptr;
-					if(!picture.description().isNull())
-						description(picture.description().toCString(true), kCFStringEncodingUTF8);
-
-					attachedPictures.push_back(std::make_shared<AttachedPicture>(data, (AttachedPicture::Type)picture.type(), description));
-				}
-			}
-#endif
+			SFB::CFString value(TagLib::CFStringCreateFromString(item.toString()));
+			if(!value)
+				continue;
+
+			auto field = fields.find(iterator.first);
+			if(fields.end() != field)
+				AddFieldToDictionary(dictionary, field->second, value);
 			// Put all unknown tags into the additional metadata
-			else
-				CFDictionarySetValue(additionalMetadata, key, value);
+			else {
+				SFB::CFString key(TagLib::CFStringCreateForFieldName(item.key()));
+				if(key)
+					CFDictionarySetValue(additionalMetadata, key, value);
+			}
 		}
 		else if(TagLib::APE::Item::Binary == item.type()) {
-			SFB::CFString key(item.key().toCString(true), kCFStringEncodingUTF8);
+			// Binary items are only used for pictures
+			if(!addAttachedPictures)
+				continue;
 
 			// From http://www.hydrogenaudio.org/forums/index.php?showtopic=40603&view=findpost&p=504669
 			/*
@@ -133,14 +131,15 @@ bool SFB::Audio::AddAPETagToDictionary(CFMutableDictionaryRef dictionary, std::v
 			 0x00
 			 <cover data> binary
 			 */
-			if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("Cover Art (Front)"), kCFCompareCaseInsensitive) || kCFCompareEqualTo == CFStringCompare(key, CFSTR("Cover Art (Back)"), kCFCompareCaseInsensitive)) {
+			bool frontCover = "COVER ART (FRONT)" == iterator.first;
+			if(frontCover || "COVER ART (BACK)" == iterator.first) {
 				auto binaryData = item.binaryData();
 				size_t pos = binaryData.find('\0');
 				if(TagLib::ByteVector::npos() != pos && 3 < binaryData.size()) {
 					SFB::CFData data((const UInt8 *)binaryData.mid(pos + 1).data(), (CFIndex)(binaryData.size() - pos - 1));
-					SFB::CFString description(TagLib::String(binaryData.mid(0, pos), TagLib::String::UTF8).toCString(true), kCFStringEncodingUTF8);
+					SFB::CFString description(TagLib::CFStringCreateFromString(TagLib::String(binaryData.mid(0, pos), TagLib::String::UTF8)));
 
-					attachedPictures.push_back(std::make_shared<AttachedPicture>(data, kCFCompareEqualTo == CFStringCompare(key, CFSTR("Cover Art (Front)"), kCFCompareCaseInsensitive) ? AttachedPicture::Type::FrontCover : AttachedPicture::Type::BackCover, description));
+					attachedPictures.push_back(std::make_shared<AttachedPicture>(data, frontCover ? AttachedPicture::Type::FrontCover : AttachedPicture::Type::BackCover, description));
 				}
 			}
 		}
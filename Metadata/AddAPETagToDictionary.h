@@ -23,9 +23,10 @@ namespace SFB {
 		 * @param dictionary A \c CFMutableDictionaryRef to receive the metadata
 		 * @param attachedPictures A \c std::vector to receive the attached pictures
 		 * @param properties The tag
+		 * @param addAttachedPictures Whether attached pictures should be added to \c attachedPictures
 		 * @return \c true on success, \c false otherwise
 		 */
-		bool AddAPETagToDictionary(CFMutableDictionaryRef dictionary, std::vector<std::shared_ptr<AttachedPicture>>& attachedPictures, const TagLib::APE::Tag *tag);
+		bool AddAPETagToDictionary(CFMutableDictionaryRef dictionary, std::vector<std::shared_ptr<AttachedPicture>>& attachedPictures, const TagLib::APE::Tag *tag, bool addAttachedPictures = true);
 
 	}
 }
@@ -12,8 +12,8 @@ bool SFB::Audio::AddAudioPropertiesToDictionary(CFMutableDictionaryRef dictionar
 	if(nullptr == dictionary || nullptr == properties)
 		return false;
 
-	if(properties->length())
-		AddIntToDictionary(dictionary, Metadata::kDurationKey, properties->length());
+	if(properties->lengthInMilliseconds())
+		AddDoubleToDictionary(dictionary, Metadata::kDurationKey, properties->lengthInMilliseconds() / 1000.);
 
 	if(properties->channels())
 		AddIntToDictionary(dictionary, Metadata::kChannelsPerFrameKey, properties->channels());
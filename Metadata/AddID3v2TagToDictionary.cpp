@@ -16,7 +16,7 @@
 #include "TagLibStringUtilities.h"
 #include "CFDictionaryUtilities.h"
 
-bool SFB::Audio::AddID3v2TagToDictionary(CFMutableDictionaryRef dictionary, std::vector<std::shared_ptr<AttachedPicture>>& attachedPictures, const TagLib::ID3v2::Tag *tag)
+bool SFB::Audio::AddID3v2TagToDictionary(CFMutableDictionaryRef dictionary, std::vector<std::shared_ptr<AttachedPicture>>& attachedPictures, const TagLib::ID3v2::Tag *tag, bool addAttachedPictures)
 {
 	if(nullptr == dictionary || nullptr == tag)
 		return false;
@@ -132,12 +132,42 @@ bool SFB::Audio::AddID3v2TagToDictionary(CFMutableDictionaryRef dictionary, std:
 	if(!frameList.isEmpty())
 		TagLib::AddStringToCFDictionary(dictionary, Metadata::kISRCKey, frameList.front()->toString());
 
+	// User text frames are examined in a single pass instead of being searched for each description
+	TagLib::ID3v2::UserTextIdentificationFrame *musicBrainzReleaseIDFrame = nullptr;
+	TagLib::ID3v2::UserTextIdentificationFrame *musicBrainzRecordingIDFrame = nullptr;
+	TagLib::ID3v2::UserTextIdentificationFrame *trackGainFrame = nullptr;
+	TagLib::ID3v2::UserTextIdentificationFrame *trackPeakFrame = nullptr;
+	TagLib::ID3v2::UserTextIdentificationFrame *albumGainFrame = nullptr;
+	TagLib::ID3v2::UserTextIdentificationFrame *albumPeakFrame = nullptr;
+
+	for(auto frameIterator : tag->frameListMap()["TXXX"]) {
+		auto frame = dynamic_cast<TagLib::ID3v2::UserTextIdentificationFrame *>(frameIterator);
+		if(!frame || frame->fieldList().isEmpty())
+			continue;
+
+		auto description = frame->description();
+		if(!musicBrainzReleaseIDFrame && "MusicBrainz Album Id" == description)
+			musicBrainzReleaseIDFrame = frame;
+		else if(!musicBrainzRecordingIDFrame && "MusicBrainz Track Id" == description)
+			musicBrainzRecordingIDFrame = frame;
+		// The ReplayGain descriptions are matched regardless of case and have the same length
+		else if(description.size() == TagLib::String("REPLAYGAIN_TRACK_GAIN").size()) {
+			description = description.upper();
+			if(!trackGainFrame && "REPLAYGAIN_TRACK_GAIN" == description)
+				trackGainFrame = frame;
+			else if(!trackPeakFrame && "REPLAYGAIN_TRACK_PEAK" == description)
+				trackPeakFrame = frame;
+			else if(!albumGainFrame && "REPLAYGAIN_ALBUM_GAIN" == description)
+				albumGainFrame = frame;
+			else if(!albumPeakFrame && "REPLAYGAIN_ALBUM_PEAK" == description)
+				albumPeakFrame = frame;
+		}
+	}
+
 	// MusicBrainz
-	auto musicBrainzReleaseIDFrame = TagLib::ID3v2::UserTextIdentificationFrame::find(const_cast<TagLib::ID3v2::Tag *>(tag), "MusicBrainz Album Id");
 	if(musicBrainzReleaseIDFrame)
 		TagLib::AddStringToCFDictionary(dictionary, Metadata::kMusicBrainzReleaseIDKey, musicBrainzReleaseIDFrame->fieldList().back());
 
-	auto musicBrainzRecordingIDFrame = TagLib::ID3v2::UserTextIdentificationFrame::find(const_cast<TagLib::ID3v2::Tag *>(tag), "MusicBrainz Track Id");
 	if(musicBrainzRecordingIDFrame)
 		TagLib::AddStringToCFDictionary(dictionary, Metadata::kMusicBrainzRecordingIDKey, musicBrainzRecordingIDFrame->fieldList().back());
 
@@ -170,15 +200,8 @@ bool SFB::Audio::AddID3v2TagToDictionary(CFMutableDictionaryRef dictionary, std:
 	bool foundReplayGain = false;
 
 	// Preference is TXXX frames, RVA2 frame, then LAME header
-	auto trackGainFrame = TagLib::ID3v2::UserTextIdentificationFrame::find(const_cast<TagLib::ID3v2::Tag *>(tag), "REPLAYGAIN_TRACK_GAIN");
-	auto trackPeakFrame = TagLib::ID3v2::UserTextIdentificationFrame::find(const_cast<TagLib::ID3v2::Tag *>(tag), "REPLAYGAIN_TRACK_PEAK");
-	auto albumGainFrame = TagLib::ID3v2::UserTextIdentificationFrame::find(const_cast<TagLib::ID3v2::Tag *>(tag), "REPLAYGAIN_ALBUM_GAIN");
-	auto albumPeakFrame = TagLib::ID3v2::UserTextIdentificationFrame::find(const_cast<TagLib::ID3v2::Tag *>(tag), "REPLAYGAIN_ALBUM_PEAK");
-
-	if(!trackGainFrame)
-		trackGainFrame = TagLib::ID3v2::UserTextIdentificationFrame::find(const_cast<TagLib::ID3v2::Tag *>(tag), "replaygain_track_gain");
 	if(trackGainFrame) {
-		SFB::CFString str(trackGainFrame->fieldList().back().toCString(true), kCFStringEncodingUTF8);
+		SFB::CFString str(TagLib::CFStringCreateFromString(trackGainFrame->fieldList().back()));
 		double num = CFStringGetDoubleValue(str);
 
 		AddDoubleToDictionary(dictionary, Metadata::kTrackGainKey, num);
@@ -187,19 +210,15 @@ bool SFB::Audio::AddID3v2TagToDictionary(CFMutableDictionaryRef dictionary, std:
 		foundReplayGain = true;
 	}
 
-	if(!trackPeakFrame)
-		trackPeakFrame = TagLib::ID3v2::UserTextIdentificationFrame::find(const_cast<TagLib::ID3v2::Tag *>(tag), "replaygain_track_peak");
 	if(trackPeakFrame) {
-		SFB::CFString str(trackPeakFrame->fieldList().back().toCString(true), kCFStringEncodingUTF8);
+		SFB::CFString str(TagLib::CFStringCreateFromString(trackPeakFrame->fieldList().back()));
 		double num = CFStringGetDoubleValue(str);
 
 		AddDoubleToDictionary(dictionary, Metadata::kTrackPeakKey, num);
 	}
 
-	if(!albumGainFrame)
-		albumGainFrame = TagLib::ID3v2::UserTextIdentificationFrame::find(const_cast<TagLib::ID3v2::Tag *>(tag), "replaygain_album_gain");
 	if(albumGainFrame) {
-		SFB::CFString str(albumGainFrame->fieldList().back().toCString(true), kCFStringEncodingUTF8);
+		SFB::CFString str(TagLib::CFStringCreateFromString(albumGainFrame->fieldList().back()));
 		double num = CFStringGetDoubleValue(str);
 
 		AddDoubleToDictionary(dictionary, Metadata::kAlbumGainKey, num);
@@ -208,10 +227,8 @@ bool SFB::Audio::AddID3v2TagToDictionary(CFMutableDictionaryRef dictionary, std:
 		foundReplayGain = true;
 	}
 
-	if(!albumPeakFrame)
-		albumPeakFrame = TagLib::ID3v2::UserTextIdentificationFrame::find(const_cast<TagLib::ID3v2::Tag *>(tag), "replaygain_album_peak");
 	if(albumPeakFrame) {
-		SFB::CFString str(albumPeakFrame->fieldList().back().toCString(true), kCFStringEncodingUTF8);
+		SFB::CFString str(TagLib::CFStringCreateFromString(albumPeakFrame->fieldList().back()));
 		double num = CFStringGetDoubleValue(str);
 
 		AddDoubleToDictionary(dictionary, Metadata::kAlbumPeakKey, num);
@@ -253,16 +270,18 @@ bool SFB::Audio::AddID3v2TagToDictionary(CFMutableDictionaryRef dictionary, std:
 	}
 
 	// Extract album art if present
-	for(auto it : tag->frameListMap()["APIC"]) {
-		TagLib::ID3v2::AttachedPictureFrame *frame = dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(it);
-		if(frame) {
-			SFB::CFData data((const UInt8 *)frame->picture().data(), (CFIndex)frame->picture().size());
+	if(addAttachedPictures) {
+		for(auto it : tag->frameListMap()["APIC"]) {
+			TagLib::ID3v2::AttachedPictureFrame *frame = dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(it);
+			if(frame) {
+				SFB::CFData data((const UInt8 *)frame->picture().data(), (CFIndex)frame->picture().size());
 
-			SFB::CFString description;
-			if(!frame->description().isEmpty())
-				description = CFString(frame->description().toCString(true), kCFStringEncodingUTF8);
+				SFB::CFString description;
+				if(!frame->description().isEmpty())
+					description = TagLib::CFStringCreateFromString(frame->description());
 
-			attachedPictures.push_back(std::make_shared<AttachedPicture>(data, (AttachedPicture::Type)frame->type(), description));
+				attachedPictures.push_back(std::make_shared<AttachedPicture>(data, (AttachedPicture::Type)frame->type(), description));
+			}
 		}
 	}
 
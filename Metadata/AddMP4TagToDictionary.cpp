@@ -11,7 +11,7 @@
 #include "TagLibStringUtilities.h"
 #include "CFDictionaryUtilities.h"
 
-bool SFB::Audio::AddMP4TagToDictionary(CFMutableDictionaryRef dictionary, std::vector<std::shared_ptr<AttachedPicture>>& attachedPictures, const TagLib::MP4::Tag *tag)
+bool SFB::Audio::AddMP4TagToDictionary(CFMutableDictionaryRef dictionary, std::vector<std::shared_ptr<AttachedPicture>>& attachedPictures, const TagLib::MP4::Tag *tag, bool addAttachedPictures)
 {
 	if(nullptr == dictionary || nullptr == tag)
 		return false;
@@ -78,7 +78,7 @@ bool SFB::Audio::AddMP4TagToDictionary(CFMutableDictionaryRef dictionary, std::v
 	}
 
 	// Album art
-	if(tag->contains("covr")) {
+	if(addAttachedPictures && tag->contains("covr")) {
 		auto art = tag->item("covr").toCoverArtList();
 		for(auto iter : art) {
 			SFB::CFData data((const UInt8 *)iter.data().data(), (CFIndex)iter.data().size());
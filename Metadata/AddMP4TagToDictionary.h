@@ -22,9 +22,10 @@ namespace SFB {
 		 * @brief Add the metadata specified in the \c TagLib::MP4::Tag instance to \c dictionary
 		 * @param dictionary A \c CFMutableDictionaryRef to receive the metadata
 		 * @param properties The tag
+		 * @param addAttachedPictures Whether attached pictures should be added to \c attachedPictures
 		 * @return \c true on success, \c false otherwise
 		 */
-		bool AddMP4TagToDictionary(CFMutableDictionaryRef dictionary, std::vector<std::shared_ptr<AttachedPicture>>& attachedPictures, const TagLib::MP4::Tag *tag);
+		bool AddMP4TagToDictionary(CFMutableDictionaryRef dictionary, std::vector<std::shared_ptr<AttachedPicture>>& attachedPictures, const TagLib::MP4::Tag *tag, bool addAttachedPictures = true);
 
 	}
 }
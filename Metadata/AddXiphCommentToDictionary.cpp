@@ -3,6 +3,10 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <algorithm>
+#include <cstring>
+#include <map>
+
 #include <taglib/flacpicture.h>
 
 #include "AddXiphCommentToDictionary.h"
@@ -10,88 +14,213 @@
 #include "CFWrapper.h"
 #include "Base64Utilities.h"
 #include "CFDictionaryUtilities.h"
+#include "TagLibStringUtilities.h"
+
+namespace {
+
+	using SFB::Audio::Metadata;
+
+	// How a field's value is added to the dictionary
+	enum class FieldType {
+		String,
+		Integer,
+		Boolean,
+		Double
+	};
+
+	struct Field
+	{
+		CFStringRef mKey;
+		FieldType mType;
+	};
+
+	// Fields are keyed by their uppercase names, as stored by TagLib, so a single lookup replaces case-insensitive comparisons
+	const std::map<TagLib::String, Field>& GetFields()
+	{
+		static const std::map<TagLib::String, Field> sFields = {
+			{ "ALBUM",							{ Metadata::kAlbumTitleKey,				FieldType::String } },
+			{ "ARTIST",							{ Metadata::kArtistKey,					FieldType::String } },
+			{ "ALBUMARTIST",					{ Metadata::kAlbumArtistKey,			FieldType::String } },
+			{ "COMPOSER",						{ Metadata::kComposerKey,				FieldType::String } },
+			{ "GENRE",							{ Metadata::kGenreKey,					FieldType::String } },
+			{ "DATE",							{ Metadata::kReleaseDateKey,			FieldType::String } },
+			{ "DESCRIPTION",					{ Metadata::kCommentKey,				FieldType::String } },
+			{ "TITLE",							{ Metadata::kTitleKey,					FieldType::String } },
+			{ "TRACKNUMBER",					{ Metadata::kTrackNumberKey,			FieldType::Integer } },
+			{ "TRACKTOTAL",						{ Metadata::kTrackTotalKey,				FieldType::Integer } },
+			{ "COMPILATION",					{ Metadata::kCompilationKey,			FieldType::Boolean } },
+			{ "DISCNUMBER",						{ Metadata::kDiscNumberKey,				FieldType::Integer } },
+			{ "DISCTOTAL",						{ Metadata::kDiscTotalKey,				FieldType::Integer } },
+			{ "LYRICS",							{ Metadata::kLyricsKey,					FieldType::String } },
+			{ "BPM",							{ Metadata::kBPMKey,					FieldType::Integer } },
+			{ "RATING",							{ Metadata::kRatingKey,					FieldType::Integer } },
+			{ "ISRC",							{ Metadata::kISRCKey,					FieldType::String } },
+			{ "MCN",							{ Metadata::kMCNKey,					FieldType::String } },
+			{ "MUSICBRAINZ_ALBUMID",			{ Metadata::kMusicBrainzReleaseIDKey,	FieldType::String } },
+			{ "MUSICBRAINZ_TRACKID",			{ Metadata::kMusicBrainzRecordingIDKey,	FieldType::String } },
+			{ "TITLESORT",						{ Metadata::kTitleSortOrderKey,			FieldType::String } },
+			{ "ALBUMTITLESORT",					{ Metadata::kAlbumTitleSortOrderKey,	FieldType::String } },
+			{ "ARTISTSORT",						{ Metadata::kArtistSortOrderKey,		FieldType::String } },
+			{ "ALBUMARTISTSORT",				{ Metadata::kAlbumArtistSortOrderKey,	FieldType::String } },
+			{ "COMPOSERSORT",					{ Metadata::kComposerSortOrderKey,		FieldType::String } },
+			{ "GROUPING",						{ Metadata::kGroupingKey,				FieldType::String } },
+			{ "REPLAYGAIN_REFERENCE_LOUDNESS",	{ Metadata::kReferenceLoudnessKey,		FieldType::Double } },
+			{ "REPLAYGAIN_TRACK_GAIN",			{ Metadata::kTrackGainKey,				FieldType::Double } },
+			{ "REPLAYGAIN_TRACK_PEAK",			{ Metadata::kTrackPeakKey,				FieldType::Double } },
+			{ "REPLAYGAIN_ALBUM_GAIN",			{ Metadata::kAlbumGainKey,				FieldType::Double } },
+			{ "REPLAYGAIN_ALBUM_PEAK",			{ Metadata::kAlbumPeakKey,				FieldType::Double } },
+		};
+
+		return sFields;
+	}
+
+	void AddFieldToDictionary(CFMutableDictionaryRef dictionary, const Field& field, CFStringRef value)
+	{
+		switch(field.mType) {
+			case FieldType::String:		CFDictionarySetValue(dictionary, field.mKey, value);													break;
+			case FieldType::Integer:	SFB::AddIntToDictionary(dictionary, field.mKey, CFStringGetIntValue(value));							break;
+			case FieldType::Boolean:	CFDictionarySetValue(dictionary, field.mKey, CFStringGetIntValue(value) ? kCFBooleanTrue : kCFBooleanFalse);	break;
+			case FieldType::Double:		SFB::AddDoubleToDictionary(dictionary, field.mKey, CFStringGetDoubleValue(value));						break;
+		}
+	}
+
+	// Decode length bytes starting at offset from base 64 encoded data without whitespace
+	bool DecodeBase64Range(const TagLib::ByteVector& encoded, size_t offset, size_t length, uint8_t *buffer)
+	{
+		if(0 == length)
+			return true;
+
+		// Every four characters encode three bytes
+		size_t characterOffset = (offset / 3) * 4;
+		size_t skip = offset % 3;
+		size_t decoded = 0;
+
+		if(characterOffset >= encoded.size())
+			return false;
+
+		// Decode the group containing offset separately when offset falls within it
+		if(skip) {
+			uint8_t group [3];
+			size_t groupBytes;
+			if(!SFB::DecodeBase64(encoded.data() + characterOffset, std::min((size_t)4, encoded.size() - characterOffset), group, sizeof(group), groupBytes) || groupBytes <= skip)
+				return false;
+
+			decoded = std::min(groupBytes - skip, length);
+			memcpy(buffer, group + skip, decoded);
+			characterOffset += 4;
+		}
+
+		if(decoded == length)
+			return true;
+
+		if(characterOffset >= encoded.size())
+			return false;
+
+		size_t bytesDecoded;
+		if(!SFB::DecodeBase64(encoded.data() + characterOffset, encoded.size() - characterOffset, buffer + decoded, length - decoded, bytesDecoded))
+			return false;
+
+		return bytesDecoded == length - decoded;
+	}
+
+	// Decode a big-endian 32-bit integer starting at offset from base 64 encoded data
+	bool DecodeBase64UInt32(const TagLib::ByteVector& encoded, size_t offset, uint32_t& value)
+	{
+		uint8_t bytes [4];
+		if(!DecodeBase64Range(encoded, offset, sizeof(bytes), bytes))
+			return false;
+
+		value = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
+		return true;
+	}
 
-bool SFB::Audio::AddXiphCommentToDictionary(CFMutableDictionaryRef dictionary, std::vector<std::shared_ptr<AttachedPicture>>& attachedPictures, const TagLib::Ogg::XiphComment *tag)
+	// Create a picture from a base 64 encoded FLAC picture block, decoding the image data when first requested
+	SFB::Audio::AttachedPicture::shared_ptr CreatePictureWithDeferredData(const TagLib::ByteVector& encodedBlock)
+	{
+		using SFB::Audio::AttachedPicture;
+
+		// Offsets into the picture block are only computable without whitespace
+		auto isWhitespace = [](char c) { return ' ' == c || '\t' == c || '\r' == c || '\n' == c; };
+		if(std::any_of(encodedBlock.begin(), encodedBlock.end(), isWhitespace))
+			return nullptr;
+
+		size_t blockSize = SFB::Base64MaximumDecodedLength(encodedBlock.size());
+
+		// The picture type, MIME type, and description precede the image dimensions, data size, and data
+		uint32_t type, mimeTypeLength, descriptionLength, dataSize;
+		if(!DecodeBase64UInt32(encodedBlock, 0, type) || !DecodeBase64UInt32(encodedBlock, 4, mimeTypeLength))
+			return nullptr;
+
+		size_t offset = 8 + (size_t)mimeTypeLength;
+		if(offset + 4 > blockSize || !DecodeBase64UInt32(encodedBlock, offset, descriptionLength))
+			return nullptr;
+
+		offset += 4;
+		if(offset + descriptionLength + 20 > blockSize)
+			return nullptr;
+
+		TagLib::ByteVector descriptionBytes(descriptionLength, 0);
+		if(!DecodeBase64Range(encodedBlock, offset, descriptionLength, (uint8_t *)descriptionBytes.data()))
+			return nullptr;
+
+		offset += descriptionLength + 16;
+		if(!DecodeBase64UInt32(encodedBlock, offset, dataSize))
+			return nullptr;
+
+		offset += 4;
+		if(offset + dataSize > blockSize)
+			return nullptr;
+
+		SFB::CFString description;
+		if(!descriptionBytes.isEmpty())
+			description = TagLib::CFStringCreateFromString(TagLib::String(descriptionBytes, TagLib::String::UTF8));
+
+		// The loader holds the encoded block, which TagLib shares rather than copies
+		auto loader = [encodedBlock, offset, dataSize]() -> SFB::CFData {
+			SFB::CFMutableData data(CFDataCreateMutable(kCFAllocatorDefault, (CFIndex)dataSize));
+			if(!data)
+				return SFB::CFData();
+
+			CFDataSetLength(data, (CFIndex)dataSize);
+			if(!DecodeBase64Range(encodedBlock, offset, dataSize, CFDataGetMutableBytePtr(data)))
+				return SFB::CFData();
+
+			return SFB::CFData((CFDataRef)data.Relinquish());
+		};
+
+		return std::make_shared<AttachedPicture>(loader, (CFIndex)dataSize, (AttachedPicture::Type)type, description);
+	}
+
+}
+
+bool SFB::Audio::AddXiphCommentToDictionary(CFMutableDictionaryRef dictionary, std::vector<std::shared_ptr<AttachedPicture>>& attachedPictures, const TagLib::Ogg::XiphComment *tag, bool addAttachedPictures)
 {
 	if(nullptr == dictionary || nullptr == tag)
 		return false;
 
 	SFB::CFMutableDictionary additionalMetadata(0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
 
+	const auto& fields = GetFields();
 	for(auto it : tag->fieldListMap()) {
-		// According to the Xiph comment specification keys should only contain a limited subset of ASCII, but UTF-8 is a safer choice
-		SFB::CFString key(it.first.toCString(true), kCFStringEncodingUTF8);
+		if(it.second.isEmpty())
+			continue;
+
+		if("METADATA_BLOCK_PICTURE" == it.first) {
+			// Skipping pictures avoids decoding their Base-64 encoded payloads
+			if(!addAttachedPictures)
+				continue;
 
-		// Vorbis allows multiple comments with the same key, but this isn't supported by AudioMetadata
-		SFB::CFString value(it.second.front().toCString(true), kCFStringEncodingUTF8);
-
-		if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ALBUM"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kAlbumTitleKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ARTIST"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kArtistKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ALBUMARTIST"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kAlbumArtistKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("COMPOSER"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kComposerKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("GENRE"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kGenreKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("DATE"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kReleaseDateKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("DESCRIPTION"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kCommentKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("TITLE"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kTitleKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("TRACKNUMBER"), kCFCompareCaseInsensitive))
-			AddIntToDictionary(dictionary, Metadata::kTrackNumberKey, CFStringGetIntValue(value));
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("TRACKTOTAL"), kCFCompareCaseInsensitive))
-			AddIntToDictionary(dictionary, Metadata::kTrackTotalKey, CFStringGetIntValue(value));
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("COMPILATION"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kCompilationKey, CFStringGetIntValue(value) ? kCFBooleanTrue : kCFBooleanFalse);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("DISCNUMBER"), kCFCompareCaseInsensitive))
-			AddIntToDictionary(dictionary, Metadata::kDiscNumberKey, CFStringGetIntValue(value));
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("DISCTOTAL"), kCFCompareCaseInsensitive))
-			AddIntToDictionary(dictionary, Metadata::kDiscTotalKey, CFStringGetIntValue(value));
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("LYRICS"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kLyricsKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("BPM"), kCFCompareCaseInsensitive))
-			AddIntToDictionary(dictionary, Metadata::kBPMKey, CFStringGetIntValue(value));
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("RATING"), kCFCompareCaseInsensitive))
-			AddIntToDictionary(dictionary, Metadata::kRatingKey, CFStringGetIntValue(value));
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ISRC"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kISRCKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("MCN"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kMCNKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("MUSICBRAINZ_ALBUMID"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kMusicBrainzReleaseIDKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("MUSICBRAINZ_TRACKID"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kMusicBrainzRecordingIDKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("TITLESORT"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kTitleSortOrderKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ALBUMTITLESORT"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kAlbumTitleSortOrderKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ARTISTSORT"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kArtistSortOrderKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("ALBUMARTISTSORT"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kAlbumArtistSortOrderKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("COMPOSERSORT"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kComposerSortOrderKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("GROUPING"), kCFCompareCaseInsensitive))
-			CFDictionarySetValue(dictionary, Metadata::kGroupingKey, value);
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("REPLAYGAIN_REFERENCE_LOUDNESS"), kCFCompareCaseInsensitive))
-			AddDoubleToDictionary(dictionary, Metadata::kReferenceLoudnessKey, CFStringGetDoubleValue(value));
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("REPLAYGAIN_TRACK_GAIN"), kCFCompareCaseInsensitive))
-			AddDoubleToDictionary(dictionary, Metadata::kTrackGainKey, CFStringGetDoubleValue(value));
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("REPLAYGAIN_TRACK_PEAK"), kCFCompareCaseInsensitive))
-			AddDoubleToDictionary(dictionary, Metadata::kTrackPeakKey, CFStringGetDoubleValue(value));
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("REPLAYGAIN_ALBUM_GAIN"), kCFCompareCaseInsensitive))
-			AddDoubleToDictionary(dictionary, Metadata::kAlbumGainKey, CFStringGetDoubleValue(value));
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("REPLAYGAIN_ALBUM_PEAK"), kCFCompareCaseInsensitive))
-			AddDoubleToDictionary(dictionary, Metadata::kAlbumPeakKey, CFStringGetDoubleValue(value));
-		else if(kCFCompareEqualTo == CFStringCompare(key, CFSTR("METADATA_BLOCK_PICTURE"), kCFCompareCaseInsensitive)) {
 			// Handle embedded pictures
 			for(auto blockIterator : it.second) {
 				auto encodedBlock = blockIterator.data(TagLib::String::UTF8);
 
+				// Only the picture's header is decoded now; the image data is decoded when requested
+				auto attachedPicture = CreatePictureWithDeferredData(encodedBlock);
+				if(attachedPicture) {
+					attachedPictures.push_back(attachedPicture);
+					continue;
+				}
+
 				// Decode the Base-64 encoded data
 				auto decodedBlock = TagLib::DecodeBase64(encodedBlock);
 
@@ -103,14 +232,29 @@ bool SFB::Audio::AddXiphCommentToDictionary(CFMutableDictionaryRef dictionary, s
 
 				SFB::CFString description;
 				if(!picture.description().isEmpty())
-					description = SFB::CFString(picture.description().toCString(true), kCFStringEncodingUTF8);
+					description = TagLib::CFStringCreateFromString(picture.description());
 
 				attachedPictures.push_back(std::make_shared<AttachedPicture>(data, (AttachedPicture::Type)picture.type(), description));
 			}
+
+			continue;
 		}
+
+		// Vorbis allows multiple comments with the same key, but this isn't supported by AudioMetadata
+		SFB::CFString value(TagLib::CFStringCreateFromString(it.second.front()));
+		if(!value)
+			continue;
+
+		auto field = fields.find(it.first);
+		if(fields.end() != field)
+			AddFieldToDictionary(dictionary, field->second, value);
 		// Put all unknown tags into the additional metadata
-		else
-			CFDictionarySetValue(additionalMetadata, key, value);
+		else {
+			// According to the Xiph comment specification keys should only contain a limited subset of ASCII
+			SFB::CFString key(TagLib::CFStringCreateForFieldName(it.first));
+			if(key)
+				CFDictionarySetValue(additionalMetadata, key, value);
+		}
 	}
 
 	if(CFDictionaryGetCount(additionalMetadata))
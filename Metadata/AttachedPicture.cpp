@@ -5,6 +5,7 @@
 
 #include "AttachedPicture.h"
 #include "CFDictionaryUtilities.h"
+#include "Logger.h"
 
 // ========================================
 // Key names for the metadata dictionary
@@ -14,7 +15,7 @@ const CFStringRef SFB::Audio::AttachedPicture::kDescriptionKey			= CFSTR("Pictur
 const CFStringRef SFB::Audio::AttachedPicture::kDataKey					= CFSTR("Picture Data");
 
 SFB::Audio::AttachedPicture::AttachedPicture(CFDataRef data, AttachedPicture::Type type, CFStringRef description)
-	: mMetadata(0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks), mChangedMetadata(0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks), mState(ChangeState::Saved)
+	: mMetadata(0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks), mChangedMetadata(0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks), mState(ChangeState::Saved), mDataSize(0)
 {
 	if(data)
 		CFDictionarySetValue(mMetadata, kDataKey, data);
@@ -25,10 +26,19 @@ SFB::Audio::AttachedPicture::AttachedPicture(CFDataRef data, AttachedPicture::Ty
 		CFDictionarySetValue(mMetadata, kDescriptionKey, description);
 }
 
+SFB::Audio::AttachedPicture::AttachedPicture(DataLoader dataLoader, CFIndex dataSize, AttachedPicture::Type type, CFStringRef description)
+	: AttachedPicture(nullptr, type, description)
+{
+	mDataLoader = dataLoader;
+	mDataSize = dataSize;
+}
+
 #pragma mark External Representations
 
 CFDictionaryRef SFB::Audio::AttachedPicture::CreateDictionaryRepresentation() const
 {
+	LoadDataIfNeeded();
+
 	CFMutableDictionaryRef dictionaryRepresentation = CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, mMetadata);
 
 	CFIndex count = CFDictionaryGetCount(mChangedMetadata);
@@ -60,7 +70,7 @@ bool SFB::Audio::AttachedPicture::SetFromDictionaryRepresentation(CFDictionaryRe
 
 	SetValue(kTypeKey, CFDictionaryGetValue(dictionary, kTypeKey));
 	SetValue(kDescriptionKey, CFDictionaryGetValue(dictionary, kDescriptionKey));
-	SetValue(kDataKey, CFDictionaryGetValue(dictionary, kDataKey));
+	SetData((CFDataRef)CFDictionaryGetValue(dictionary, kDataKey));
 
 	return true;
 }
@@ -94,11 +104,31 @@ void SFB::Audio::AttachedPicture::SetDescription(CFStringRef description)
 
 CFDataRef SFB::Audio::AttachedPicture::GetData() const
 {
+	LoadDataIfNeeded();
 	return GetDataValue(kDataKey);
 }
 
+CFIndex SFB::Audio::AttachedPicture::GetDataSize() const
+{
+	if(!IsDataLoaded())
+		return mDataSize;
+
+	CFDataRef data = GetDataValue(kDataKey);
+	return data ? CFDataGetLength(data) : 0;
+}
+
+bool SFB::Audio::AttachedPicture::IsDataLoaded() const
+{
+	std::lock_guard<std::mutex> lock(mDataLoaderMutex);
+	return !mDataLoader || CFDictionaryContainsKey(mChangedMetadata, kDataKey);
+}
+
 void SFB::Audio::AttachedPicture::SetData(CFDataRef data)
 {
+	// Removal is tracked relative to the saved data, which must be present
+	if(nullptr == data)
+		LoadDataIfNeeded();
+
 	SetValue(kDataKey, data);
 }
 
@@ -184,6 +214,12 @@ void SFB::Audio::AttachedPicture::SetValue(CFStringRef key, CFTypeRef value)
 
 void SFB::Audio::AttachedPicture::MergeChangedMetadataIntoMetadata()
 {
+	{
+		std::lock_guard<std::mutex> lock(mDataLoaderMutex);
+		if(CFDictionaryContainsKey(mChangedMetadata, kDataKey))
+			mDataLoader = nullptr;
+	}
+
 	CFIndex count = CFDictionaryGetCount(mChangedMetadata);
 
 	CFTypeRef *keys = (CFTypeRef *)malloc(sizeof(CFTypeRef) * (size_t)count);
@@ -205,3 +241,40 @@ void SFB::Audio::AttachedPicture::MergeChangedMetadataIntoMetadata()
 
 	CFDictionaryRemoveAllValues(mChangedMetadata);
 }
+
+void SFB::Audio::AttachedPicture::LoadDataOnDemand(DataLoader loader)
+{
+	if(!loader)
+		return;
+
+	std::lock_guard<std::mutex> lock(mDataLoaderMutex);
+
+	// A pending loader already knows the size of the data
+	if(!mDataLoader) {
+		CFDataRef data = (CFDataRef)CFDictionaryGetValue(mMetadata, kDataKey);
+		mDataSize = data ? CFDataGetLength(data) : 0;
+		CFDictionaryRemoveValue(mMetadata, kDataKey);
+	}
+
+	mDataLoader = loader;
+}
+
+void SFB::Audio::AttachedPicture::LoadDataIfNeeded() const
+{
+	std::lock_guard<std::mutex> lock(mDataLoaderMutex);
+
+	// Changed data replaces the unloaded data so it is never needed
+	if(!mDataLoader || CFDictionaryContainsKey(mChangedMetadata, kDataKey))
+		return;
+
+	auto data = mDataLoader();
+	mDataLoader = nullptr;
+
+	// The file may have been modified since it was read
+	if(!data || CFDataGetLength(data) != mDataSize) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.AttachedPicture", "Unable to load picture data");
+		return;
+	}
+
+	CFDictionarySetValue(mMetadata, kDataKey, data);
+}
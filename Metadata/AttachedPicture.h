@@ -6,7 +6,9 @@
 #pragma once
 
 #include <CoreFoundation/CoreFoundation.h>
+#include <functional>
 #include <memory>
+#include <mutex>
 
 #include "CFWrapper.h"
 
@@ -22,6 +24,9 @@ namespace SFB {
 		 * @brief A class encapsulating a single attached picture.
 		 *
 		 * Most file formats may have more than one attached picture of each type.
+		 *
+		 * The image data of pictures read using \c Metadata::LoadAttachedPicturesOnDemand is not retained
+		 * and is read from the file when first requested.
 		 */
 		class AttachedPicture
 		{
@@ -66,6 +71,9 @@ namespace SFB {
 			/*! @brief A \c std::shared_ptr for \c AttachedPicture objects */
 			using shared_ptr = std::shared_ptr<AttachedPicture>;
 
+			/*! @brief A function reading image data from the picture's source */
+			using DataLoader = std::function<SFB::CFData()>;
+
 
 			// ========================================
 			/*! @name Creation and Destruction */
@@ -79,6 +87,15 @@ namespace SFB {
 			 */
 			AttachedPicture(CFDataRef data = nullptr, AttachedPicture::Type type = Type::Other, CFStringRef description = nullptr);
 
+			/*!
+			 * @brief Create a new \c AttachedPicture whose image data is read when first requested
+			 * @param dataLoader The function to read the image data
+			 * @param dataSize The size of the image data returned by \c dataLoader
+			 * @param type An optional artwork type
+			 * @param description An optional image description
+			 */
+			AttachedPicture(DataLoader dataLoader, CFIndex dataSize, AttachedPicture::Type type = Type::Other, CFStringRef description = nullptr);
+
 			/*! @cond */
 
 			/*! @internal This class is non-copyable */
@@ -132,9 +149,18 @@ namespace SFB {
 			void SetDescription(CFStringRef description);
 
 
-			/*! @brief Get the image data */
+			/*!
+			 * @brief Get the image data
+			 * @note If the image data is loaded on demand this reads it from the file
+			 */
 			CFDataRef GetData() const;
 
+			/*! @brief Get the size of the image data in bytes without loading it */
+			CFIndex GetDataSize() const;
+
+			/*! @brief Query whether the image data is in memory */
+			bool IsDataLoaded() const;
+
 			/*! @brief Set the image data */
 			void SetData(CFDataRef data);
 
@@ -173,6 +199,13 @@ namespace SFB {
 			/*! @brief Subclasses should call this after a successful save operation */
 			void MergeChangedMetadataIntoMetadata();
 
+			/*!
+			 * @brief Discard the image data and read it using \c loader when next requested
+			 * @param loader The function to read the image data, which must return data of the current size
+			 * @note If image data is already read on demand its size is unchanged
+			 */
+			void LoadDataOnDemand(DataLoader loader);
+
 			/*! @name Type-specific access */
 			//@{
 
@@ -218,6 +251,14 @@ namespace SFB {
 			void SetValue(CFStringRef key, CFTypeRef value);
 
 			//@}
+
+		private:
+
+			void LoadDataIfNeeded() const;
+
+			mutable DataLoader				mDataLoader;		/*!< @brief The function to read unloaded image data */
+			CFIndex							mDataSize;			/*!< @brief The size of unloaded image data */
+			mutable std::mutex				mDataLoaderMutex;	/*!< @brief Serializes loading */
 		};
 
 	}
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <Block.h>
+#include <CommonCrypto/CommonDigest.h>
+
+#include "AttachedPictureThumbnailer.h"
+#include "Logger.h"
+
+namespace {
+
+	const char kThumbnailExtension [] = ".png";
+
+	// Thumbnails are identified by the leading 128 bits of the SHA-256 hash of the image data and the size
+	std::string CreateThumbnailKey(CFDataRef data, size_t maximumPixelSize)
+	{
+		unsigned char digest [CC_SHA256_DIGEST_LENGTH];
+		CC_SHA256(CFDataGetBytePtr(data), (CC_LONG)CFDataGetLength(data), digest);
+
+		char key [32 + 1 + 20 + 1];
+		for(int i = 0; i < 16; ++i)
+			snprintf(key + 2 * i, 3, "%02x", digest[i]);
+		snprintf(key + 32, sizeof(key) - 32, "-%zu", maximumPixelSize);
+
+		return key;
+	}
+
+	CGImageRef CreateThumbnailFromData(CFDataRef data, size_t maximumPixelSize)
+	{
+		SFB::CGImageSource imageSource(CGImageSourceCreateWithData(data, nullptr));
+		if(!imageSource)
+			return nullptr;
+
+		long pixelSize = (long)maximumPixelSize;
+		SFB::CFNumber pixelSizeNumber(kCFNumberLongType, &pixelSize);
+
+		// Decode immediately so the thumbnail is ready to draw when delivered
+		const void *keys [] = { kCGImageSourceCreateThumbnailFromImageAlways, kCGImageSourceCreateThumbnailWithTransform, kCGImageSourceShouldCacheImmediately, kCGImageSourceThumbnailMaxPixelSize };
+		const void *values [] = { kCFBooleanTrue, kCFBooleanTrue, kCFBooleanTrue, (CFNumberRef)pixelSizeNumber };
+		SFB::CFDictionary options(keys, values, 4, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+
+		return CGImageSourceCreateThumbnailAtIndex(imageSource, 0, options);
+	}
+
+	CGImageRef CreateThumbnailFromFile(const std::string& path)
+	{
+		SFB::CFURL url(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)path.c_str(), (CFIndex)path.size(), false));
+		if(!url)
+			return nullptr;
+
+		SFB::CGImageSource imageSource(CGImageSourceCreateWithURL(url, nullptr));
+		if(!imageSource)
+			return nullptr;
+
+		const void *keys [] = { kCGImageSourceShouldCacheImmediately };
+		const void *values [] = { kCFBooleanTrue };
+		SFB::CFDictionary options(keys, values, 1, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+
+		return CGImageSourceCreateImageAtIndex(imageSource, 0, options);
+	}
+
+	// The thumbnail is written to a temporary file and renamed so a partial file is never read
+	bool WriteThumbnailToFile(CGImageRef thumbnail, const std::string& path)
+	{
+		std::string temporaryPath = path + ".tmp";
+
+		SFB::CFURL url(CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)temporaryPath.c_str(), (CFIndex)temporaryPath.size(), false));
+		if(!url)
+			return false;
+
+		SFB::CGImageDestination imageDestination(CGImageDestinationCreateWithURL(url, CFSTR("public.png"), 1, nullptr));
+		if(!imageDestination)
+			return false;
+
+		CGImageDestinationAddImage(imageDestination, thumbnail, nullptr);
+		if(!CGImageDestinationFinalize(imageDestination) || 0 != rename(temporaryPath.c_str(), path.c_str())) {
+			unlink(temporaryPath.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+	std::string DefaultThumbnailDirectory()
+	{
+		char cacheDirectory [PATH_MAX];
+		size_t length = confstr(_CS_DARWIN_USER_CACHE_DIR, cacheDirectory, sizeof(cacheDirectory));
+		if(0 == length || length > sizeof(cacheDirectory))
+			return std::string();
+
+		std::string directory = std::string(cacheDirectory) + "org.sbooth.AudioEngine";
+		if(0 != mkdir(directory.c_str(), 0755) && EEXIST != errno)
+			return std::string();
+
+		return directory + "/Thumbnails";
+	}
+
+	void CompleteRequest(dispatch_queue_t queue, SFB::Audio::AttachedPictureThumbnailer::CompletionBlock block, CGImageRef thumbnail)
+	{
+		if(thumbnail)
+			CGImageRetain(thumbnail);
+
+		dispatch_async(queue, ^{
+			block(thumbnail);
+
+			if(thumbnail)
+				CGImageRelease(thumbnail);
+			Block_release(block);
+			dispatch_release(queue);
+		});
+	}
+
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::AttachedPictureThumbnailer::AttachedPictureThumbnailer(CFURLRef directory, size_t memoryCapacity)
+	: mMemoryCapacity(memoryCapacity)
+{
+	char buf [PATH_MAX];
+	if(directory && CFURLGetFileSystemRepresentation(directory, true, (UInt8 *)buf, sizeof(buf)))
+		mDirectory = buf;
+	else
+		mDirectory = DefaultThumbnailDirectory();
+
+	if(!mDirectory.empty() && 0 != mkdir(mDirectory.c_str(), 0755) && EEXIST != errno) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.AttachedPictureThumbnailer", "Unable to create thumbnail directory " << mDirectory << ": " << strerror(errno));
+		mDirectory.clear();
+	}
+
+	mQueue = dispatch_queue_create("org.sbooth.AudioEngine.AttachedPictureThumbnailer", dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_CONCURRENT, QOS_CLASS_USER_INITIATED, 0));
+	mGroup = dispatch_group_create();
+}
+
+SFB::Audio::AttachedPictureThumbnailer::~AttachedPictureThumbnailer()
+{
+	dispatch_group_wait(mGroup, DISPATCH_TIME_FOREVER);
+
+	dispatch_release(mGroup);
+	dispatch_release(mQueue);
+}
+
+#pragma mark Thumbnails
+
+void SFB::Audio::AttachedPictureThumbnailer::CreateThumbnail(AttachedPicture::shared_ptr picture, size_t maximumPixelSize, dispatch_queue_t queue, CompletionBlock block)
+{
+	if(!picture || 0 == maximumPixelSize || nullptr == queue || nullptr == block)
+		return;
+
+	dispatch_retain(queue);
+	Request request{ queue, Block_copy(block) };
+
+	dispatch_group_async(mGroup, mQueue, ^{
+		// Loading and hashing the image data may require reading the file
+		CFDataRef data = picture->GetData();
+		if(nullptr == data || 0 == CFDataGetLength(data)) {
+			CompleteRequest(request.mQueue, request.mBlock, nullptr);
+			return;
+		}
+
+		ProcessRequest(data, maximumPixelSize, request);
+	});
+}
+
+void SFB::Audio::AttachedPictureThumbnailer::RemoveAllThumbnails()
+{
+	RemoveThumbnailsFromMemory();
+
+	if(mDirectory.empty())
+		return;
+
+	std::unique_ptr<DIR, int(*)(DIR *)> dir(opendir(mDirectory.c_str()), closedir);
+	if(!dir)
+		return;
+
+	const size_t extensionLength = strlen(kThumbnailExtension);
+	while(struct dirent *entry = readdir(dir.get())) {
+		size_t nameLength = strlen(entry->d_name);
+		if(nameLength <= extensionLength || strcmp(entry->d_name + nameLength - extensionLength, kThumbnailExtension))
+			continue;
+
+		std::string path = mDirectory + "/" + entry->d_name;
+		if(0 != unlink(path.c_str()))
+			LOGGER_NOTICE("org.sbooth.AudioEngine.AttachedPictureThumbnailer", "Unable to remove " << path << ": " << strerror(errno));
+	}
+}
+
+#pragma mark Memory Cache
+
+size_t SFB::Audio::AttachedPictureThumbnailer::GetMemoryCapacity() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mMemoryCapacity;
+}
+
+void SFB::Audio::AttachedPictureThumbnailer::SetMemoryCapacity(size_t memoryCapacity)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mMemoryCapacity = memoryCapacity;
+	TrimMemoryCache();
+}
+
+void SFB::Audio::AttachedPictureThumbnailer::RemoveThumbnailsFromMemory()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mThumbnails.clear();
+	mThumbnailIndex.clear();
+}
+
+#pragma mark Internals
+
+void SFB::Audio::AttachedPictureThumbnailer::ProcessRequest(CFDataRef data, size_t maximumPixelSize, Request request)
+{
+	auto key = CreateThumbnailKey(data, maximumPixelSize);
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		auto iter = mThumbnailIndex.find(key);
+		if(iter != std::end(mThumbnailIndex)) {
+			mThumbnails.splice(std::begin(mThumbnails), mThumbnails, iter->second);
+			CompleteRequest(request.mQueue, request.mBlock, iter->second->second);
+			return;
+		}
+
+		// Another request for the same thumbnail will complete this one
+		auto pending = mPendingRequests.find(key);
+		if(pending != std::end(mPendingRequests)) {
+			pending->second.push_back(request);
+			return;
+		}
+
+		mPendingRequests[key].push_back(request);
+	}
+
+	auto path = GetThumbnailPath(key);
+
+	SFB::CGImage thumbnail;
+	if(!path.empty())
+		thumbnail = CreateThumbnailFromFile(path);
+
+	if(!thumbnail) {
+		thumbnail = CreateThumbnailFromData(data, maximumPixelSize);
+		if(!thumbnail)
+			LOGGER_NOTICE("org.sbooth.AudioEngine.AttachedPictureThumbnailer", "Unable to create thumbnail from image data");
+		else if(!path.empty() && !WriteThumbnailToFile(thumbnail, path))
+			LOGGER_NOTICE("org.sbooth.AudioEngine.AttachedPictureThumbnailer", "Unable to write thumbnail to " << path);
+	}
+
+	std::vector<Request> requests;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		if(thumbnail)
+			CacheThumbnail(key, thumbnail);
+
+		auto pending = mPendingRequests.find(key);
+		requests = std::move(pending->second);
+		mPendingRequests.erase(pending);
+	}
+
+	for(const auto& pendingRequest : requests)
+		CompleteRequest(pendingRequest.mQueue, pendingRequest.mBlock, thumbnail);
+}
+
+void SFB::Audio::AttachedPictureThumbnailer::CacheThumbnail(const std::string& key, CGImageRef thumbnail)
+{
+	mThumbnails.emplace_front(key, SFB::CGImage((CGImageRef)CFRetain(thumbnail)));
+	mThumbnailIndex[key] = std::begin(mThumbnails);
+	TrimMemoryCache();
+}
+
+void SFB::Audio::AttachedPictureThumbnailer::TrimMemoryCache()
+{
+	while(mThumbnails.size() > mMemoryCapacity) {
+		mThumbnailIndex.erase(mThumbnails.back().first);
+		mThumbnails.pop_back();
+	}
+}
+
+std::string SFB::Audio::AttachedPictureThumbnailer::GetThumbnailPath(const std::string& key) const
+{
+	if(mDirectory.empty())
+		return std::string();
+	return mDirectory + "/" + key + kThumbnailExtension;
+}
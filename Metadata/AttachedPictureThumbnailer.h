@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <dispatch/dispatch.h>
+#include <ImageIO/ImageIO.h>
+
+#include "AttachedPicture.h"
+#include "CFWrapper.h"
+
+/*! @file AttachedPictureThumbnailer.h @brief Creation and caching of attached picture thumbnails */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief Creates and caches thumbnails of attached pictures
+		 *
+		 * Pictures are decoded and downsampled by ImageIO on a concurrent queue.  Thumbnails are identified by a hash
+		 * of the image data and the requested size, so identical pictures attached to many tracks are decoded once
+		 * and share a single thumbnail.  Simultaneous requests for the same thumbnail are combined.
+		 *
+		 * Thumbnails are kept in memory, with the least recently used removed when the memory capacity is exceeded,
+		 * and on disk as PNG images.
+		 * @note This class is thread safe
+		 */
+		class AttachedPictureThumbnailer
+		{
+		public:
+
+			/*! @brief The default maximum number of thumbnails kept in memory */
+			static const size_t DefaultMemoryCapacity = 512;
+
+			/*!
+			 * @brief A block called with a thumbnail
+			 * @param thumbnail The thumbnail, or \c nullptr if it couldn't be created.  The thumbnail must be retained to be used after the block returns.
+			 */
+			using CompletionBlock = void (^)(CGImageRef thumbnail);
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*!
+			 * @brief Create a new \c AttachedPictureThumbnailer
+			 * @note The directory is created if necessary
+			 * @param directory The directory holding thumbnails on disk, or \c nullptr for a directory in the user's cache directory
+			 * @param memoryCapacity The maximum number of thumbnails kept in memory
+			 */
+			explicit AttachedPictureThumbnailer(CFURLRef directory = nullptr, size_t memoryCapacity = DefaultMemoryCapacity);
+
+			/*! @brief Destroy this \c AttachedPictureThumbnailer after thumbnails being created are complete */
+			~AttachedPictureThumbnailer();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			AttachedPictureThumbnailer(const AttachedPictureThumbnailer& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			AttachedPictureThumbnailer& operator=(const AttachedPictureThumbnailer& rhs) = delete;
+
+			/*! @endcond */
+
+			//@}
+
+
+			// ========================================
+			/*! @name Thumbnails */
+			//@{
+
+			/*!
+			 * @brief Create a thumbnail of a picture asynchronously
+			 * @note The picture's image data is loaded on the thumbnailer's queue if necessary
+			 * @param picture The picture
+			 * @param maximumPixelSize The maximum width and height of the thumbnail in pixels
+			 * @param queue The queue on which to call \c block
+			 * @param block The block to receive the thumbnail
+			 */
+			void CreateThumbnail(AttachedPicture::shared_ptr picture, size_t maximumPixelSize, dispatch_queue_t queue, CompletionBlock block);
+
+			/*! @brief Remove all thumbnails from memory and disk */
+			void RemoveAllThumbnails();
+
+			//@}
+
+
+			// ========================================
+			/*! @name Memory Cache */
+			//@{
+
+			/*! @brief Get the maximum number of thumbnails kept in memory */
+			size_t GetMemoryCapacity() const;
+
+			/*! @brief Set the maximum number of thumbnails kept in memory */
+			void SetMemoryCapacity(size_t memoryCapacity);
+
+			/*! @brief Remove all thumbnails from memory */
+			void RemoveThumbnailsFromMemory();
+
+			//@}
+
+		private:
+
+			/*! @internal A request for a thumbnail being created */
+			struct Request
+			{
+				dispatch_queue_t	mQueue;
+				CompletionBlock		mBlock;
+			};
+
+			// Find, read, or create the thumbnail of data and complete all requests for it
+			void ProcessRequest(CFDataRef data, size_t maximumPixelSize, Request request);
+
+			// Add a thumbnail to the memory cache, removing the least recently used if necessary
+			void CacheThumbnail(const std::string& key, CGImageRef thumbnail);
+
+			// Remove the least recently used thumbnails until the memory cache fits in its capacity
+			void TrimMemoryCache();
+
+			// The path of the thumbnail for key, or an empty string if the directory isn't available
+			std::string GetThumbnailPath(const std::string& key) const;
+
+			using ThumbnailList = std::list<std::pair<std::string, SFB::CGImage>>;
+
+			std::string												mDirectory;			/*!< The directory holding thumbnails */
+			dispatch_queue_t										mQueue;				/*!< The concurrent queue creating thumbnails */
+			dispatch_group_t										mGroup;				/*!< Tracks thumbnails being created */
+
+			size_t													mMemoryCapacity;
+			ThumbnailList											mThumbnails;		/*!< Most recently used first */
+			std::unordered_map<std::string, ThumbnailList::iterator>	mThumbnailIndex;
+			std::unordered_map<std::string, std::vector<Request>>	mPendingRequests;	/*!< Requests for thumbnails being created */
+			mutable std::mutex										mMutex;				/*!< Protects the memory cache and pending requests */
+		};
+
+	}
+}
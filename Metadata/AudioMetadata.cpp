@@ -3,12 +3,23 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
 #include <CoreFoundation/CoreFoundation.h>
+#include <dispatch/dispatch.h>
 #if !TARGET_OS_IPHONE
 # include <CoreServices/CoreServices.h>
 #endif
 
+#include <taglib/tfilestream.h>
+
 #include "AudioMetadata.h"
+#include "AudioMetadataCache.h"
+#include "InputSource.h"
+#include "InputSourceIOStream.h"
+#include "CFDictionaryUtilities.h"
 #include "CFErrorUtilities.h"
 #include "Logger.h"
 
@@ -21,6 +32,7 @@ const CFStringRef SFB::Audio::Metadata::ErrorDomain = CFSTR("org.sbooth.AudioEng
 // Key names for the metadata dictionary
 // ========================================
 const CFStringRef SFB::Audio::Metadata::kFormatNameKey					= CFSTR("Format Name");
+const CFStringRef SFB::Audio::Metadata::kFormatIDKey					= CFSTR("Format ID");
 const CFStringRef SFB::Audio::Metadata::kTotalFramesKey					= CFSTR("Total Frames");
 const CFStringRef SFB::Audio::Metadata::kChannelsPerFrameKey			= CFSTR("Channels Per Frame");
 const CFStringRef SFB::Audio::Metadata::kBitsPerChannelKey				= CFSTR("Bits Per Channel");
@@ -70,29 +82,72 @@ const CFStringRef SFB::Audio::Metadata::kAttachedPicturesKey			= CFSTR("Attached
 #pragma mark Static Methods
 
 std::vector<SFB::Audio::Metadata::SubclassInfo> SFB::Audio::Metadata::sRegisteredSubclasses;
+SFB::FileTypeIndex::Cache SFB::Audio::Metadata::sFileTypeIndex;
 
-CFArrayRef SFB::Audio::Metadata::CreateSupportedFileExtensions()
-{
-	CFMutableArrayRef supportedFileExtensions = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+std::shared_ptr<SFB::Audio::MetadataCache> SFB::Audio::Metadata::sCache;
 
-	for(auto subclassInfo : sRegisteredSubclasses) {
-		SFB::CFArray decoderFileExtensions(subclassInfo.mCreateSupportedFileExtensions());
-		CFArrayAppendArray(supportedFileExtensions, decoderFileExtensions, CFRangeMake(0, CFArrayGetCount(decoderFileExtensions)));
+namespace {
+
+	// ========================================
+	// Key names used only in cache entries
+	const CFStringRef kCacheSubclassIndexKey	= CFSTR("Cache Subclass Index");
+	const CFStringRef kCachePictureDataSizeKey	= CFSTR("Cache Picture Data Size");
+
+	// Read the leading bytes of a file to identify its format
+	size_t ReadSignature(CFURLRef url, uint8_t *buffer, size_t length)
+	{
+		auto inputSource = SFB::InputSource::CreateForURL(url);
+		if(!inputSource || !inputSource->Open())
+			return 0;
+
+		return inputSource->ReadSignature(buffer, length);
 	}
 
-	return supportedFileExtensions;
-}
+	bool GetNumberFromDictionary(CFDictionaryRef d, CFStringRef key, CFNumberType type, void *value)
+	{
+		CFNumberRef number = (CFNumberRef)CFDictionaryGetValue(d, key);
+		if(nullptr == number || CFNumberGetTypeID() != CFGetTypeID(number))
+			return false;
+		return CFNumberGetValue(number, type, value);
+	}
 
-CFArrayRef SFB::Audio::Metadata::CreateSupportedMIMETypes()
-{
-	CFMutableArrayRef supportedMIMETypes = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+	// ========================================
+	// Return the single shared instance of a string equal to string
+	// Shared instances are retained for the life of the process
+	CFStringRef InternString(CFStringRef string)
+	{
+		static CFMutableSetRef sStrings = CFSetCreateMutable(kCFAllocatorDefault, 0, &kCFTypeSetCallBacks);
+		static std::mutex sMutex;
+
+		std::lock_guard<std::mutex> lock(sMutex);
+
+		CFStringRef interned = (CFStringRef)CFSetGetValue(sStrings, string);
+		if(nullptr == interned) {
+			// A mutable string could be changed after being interned
+			SFB::CFString copy(CFStringCreateCopy(kCFAllocatorDefault, string));
+			CFSetAddValue(sStrings, copy);
+			interned = copy;
+		}
 
-	for(auto subclassInfo : sRegisteredSubclasses) {
-		SFB::CFArray decoderMIMETypes(subclassInfo.mCreateSupportedMIMETypes());
-		CFArrayAppendArray(supportedMIMETypes, decoderMIMETypes, CFRangeMake(0, CFArrayGetCount(decoderMIMETypes)));
+		return interned;
+	}
+
+	// Cache entries don't contain image data
+	bool IsCacheable(unsigned options)
+	{
+		return !(SFB::Audio::Metadata::ReadAttachedPictures & options) || (SFB::Audio::Metadata::LoadAttachedPicturesOnDemand & options);
 	}
 
-	return supportedMIMETypes;
+}
+
+CFArrayRef SFB::Audio::Metadata::CreateSupportedFileExtensions()
+{
+	return CFArrayCreateCopy(kCFAllocatorDefault, sFileTypeIndex.GetIndex(sRegisteredSubclasses)->GetFileExtensions());
+}
+
+CFArrayRef SFB::Audio::Metadata::CreateSupportedMIMETypes()
+{
+	return CFArrayCreateCopy(kCFAllocatorDefault, sFileTypeIndex.GetIndex(sRegisteredSubclasses)->GetMIMETypes());
 }
 
 bool SFB::Audio::Metadata::HandlesFilesWithExtension(CFStringRef extension)
@@ -100,12 +155,15 @@ bool SFB::Audio::Metadata::HandlesFilesWithExtension(CFStringRef extension)
 	if(nullptr == extension)
 		return false;
 
-	for(auto subclassInfo : sRegisteredSubclasses) {
-		if(subclassInfo.mHandlesFilesWithExtension(extension))
-			return true;
-	}
+	return !sFileTypeIndex.GetIndex(sRegisteredSubclasses)->GetSubclassesForFileExtension(extension).empty();
+}
 
-	return false;
+bool SFB::Audio::Metadata::HandlesFilesWithExtension(const char *extension)
+{
+	if(nullptr == extension)
+		return false;
+
+	return !sFileTypeIndex.GetIndex(sRegisteredSubclasses)->GetSubclassesForFileExtension(extension).empty();
 }
 
 bool SFB::Audio::Metadata::HandlesMIMEType(CFStringRef mimeType)
@@ -113,8 +171,24 @@ bool SFB::Audio::Metadata::HandlesMIMEType(CFStringRef mimeType)
 	if(nullptr == mimeType)
 		return false;
 
+	return !sFileTypeIndex.GetIndex(sRegisteredSubclasses)->GetSubclassesForMIMEType(mimeType).empty();
+}
+
+bool SFB::Audio::Metadata::HandlesMIMEType(const char *mimeType)
+{
+	if(nullptr == mimeType)
+		return false;
+
+	return !sFileTypeIndex.GetIndex(sRegisteredSubclasses)->GetSubclassesForMIMEType(mimeType).empty();
+}
+
+bool SFB::Audio::Metadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header || 0 == length)
+		return false;
+
 	for(auto subclassInfo : sRegisteredSubclasses) {
-		if(subclassInfo.mHandlesMIMEType(mimeType))
+		if(subclassInfo.mHandlesSignature && subclassInfo.mHandlesSignature(header, length))
 			return true;
 	}
 
@@ -122,6 +196,11 @@ bool SFB::Audio::Metadata::HandlesMIMEType(CFStringRef mimeType)
 }
 
 SFB::Audio::Metadata::unique_ptr SFB::Audio::Metadata::CreateMetadataForURL(CFURLRef url, CFErrorRef *error)
+{
+	return CreateMetadataForURL(url, ReadAll, error);
+}
+
+SFB::Audio::Metadata::unique_ptr SFB::Audio::Metadata::CreateMetadataForURL(CFURLRef url, unsigned options, CFErrorRef *error)
 {
 	if(nullptr == url)
 		return nullptr;
@@ -139,17 +218,68 @@ SFB::Audio::Metadata::unique_ptr SFB::Audio::Metadata::CreateMetadataForURL(CFUR
 	if(kCFCompareEqualTo == CFStringCompare(CFSTR("file"), scheme, kCFCompareCaseInsensitive)) {
 		// Verify the file exists
 		if(CFURLResourceIsReachable(url, error)) {
+			// Some extensions (.oga for example) support multiple audio codecs (Vorbis, FLAC, Speex)
+			// so cache entries record the position of the subclass among those handling the extension
 			SFB::CFString pathExtension(CFURLCopyPathExtension(url));
-			if(pathExtension) {
-				// Some extensions (.oga for example) support multiple audio codecs (Vorbis, FLAC, Speex)
-
-				for(auto subclassInfo : sRegisteredSubclasses) {
-					if(subclassInfo.mHandlesFilesWithExtension(pathExtension)) {
-						unique_ptr metadata(subclassInfo.mCreateMetadata(url));
-						if(metadata->ReadMetadata(error))
-							return metadata;
+			auto candidates = GetSubclassesForFile(pathExtension, nullptr, 0);
+
+			auto cache = IsCacheable(options) ? GetCache() : nullptr;
+			if(cache && !candidates.empty()) {
+				unsigned cachedOptions = 0;
+				SFB::CFDictionary entry(cache->CopyEntry(url, cachedOptions));
+
+				int position = -1;
+				if(entry && (ReadAll & options) == (ReadAll & options & cachedOptions))
+					GetNumberFromDictionary(entry, kCacheSubclassIndexKey, kCFNumberIntType, &position);
+
+				if(0 <= position && (size_t)position < candidates.size()) {
+					unique_ptr metadata(sRegisteredSubclasses[candidates[(size_t)position]].mCreateMetadata(url));
+					if(metadata->RestoreFromCacheRepresentation(entry, options))
+						return metadata;
+				}
+			}
+
+			// Unless the extension identifies a single subclass, identify the format by content from
+			// a single read instead of reading the file with each subclass in turn
+			uint8_t header [SignatureLength];
+			size_t headerLength = 0;
+			auto subclasses = candidates;
+			if(1 != candidates.size()) {
+				headerLength = ReadSignature(url, header, sizeof(header));
+				subclasses = GetSubclassesForFile(pathExtension, header, headerLength);
+			}
+
+			std::vector<bool> subclassTried(sRegisteredSubclasses.size(), false);
+			for(int pass = 0; pass < 2; ++pass) {
+				for(auto i : subclasses) {
+					if(subclassTried[i])
+						continue;
+					subclassTried[i] = true;
+
+					// Report only the error from the last subclass tried
+					if(error && *error)
+						CFRelease(*error), *error = nullptr;
+
+					unique_ptr metadata(sRegisteredSubclasses[i].mCreateMetadata(url));
+					if(metadata->ReadMetadata(options, error)) {
+						auto position = std::find(candidates.begin(), candidates.end(), i);
+						if(cache && candidates.end() != position) {
+							SFB::CFDictionary entry(metadata->CreateCacheRepresentation((size_t)(position - candidates.begin())));
+							cache->SetEntry(url, entry, ReadAll & options);
+						}
+						return metadata;
 					}
 				}
+
+				// The only subclass handling the extension couldn't read the file, so the extension may be wrong
+				if(0 != headerLength || 1 != candidates.size())
+					break;
+
+				headerLength = ReadSignature(url, header, sizeof(header));
+				if(0 == headerLength)
+					break;
+
+				subclasses = GetSubclassesForFile(pathExtension, header, headerLength);
 			}
 		}
 		else {
@@ -168,10 +298,80 @@ SFB::Audio::Metadata::unique_ptr SFB::Audio::Metadata::CreateMetadataForURL(CFUR
 	return nullptr;
 }
 
+SFB::Audio::Metadata::unique_ptr SFB::Audio::Metadata::CreateMetadataForInputSource(InputSource& inputSource, unsigned options, CFErrorRef *error)
+{
+	if(!inputSource.IsOpen() && !inputSource.Open(error))
+		return nullptr;
+
+	CFURLRef url = inputSource.GetURL();
+	if(nullptr == url) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return nullptr;
+	}
+
+	uint8_t header [SignatureLength];
+	size_t headerLength = inputSource.ReadSignature(header, sizeof(header));
+
+	SFB::CFString pathExtension(CFURLCopyPathExtension(url));
+	for(auto i : GetSubclassesForFile(pathExtension, header, headerLength)) {
+		// Report only the error from the last subclass tried
+		if(error && *error)
+			CFRelease(*error), *error = nullptr;
+
+		unique_ptr metadata(sRegisteredSubclasses[i].mCreateMetadata(url));
+
+		metadata->mInputSource = &inputSource;
+		bool result = metadata->ReadMetadata(options, error);
+		metadata->mInputSource = nullptr;
+
+		if(result)
+			return metadata;
+	}
+
+	return nullptr;
+}
+
+bool SFB::Audio::Metadata::ReadAudioPropertiesForURL(CFURLRef url, AudioProperties& properties, CFErrorRef *error)
+{
+	auto metadata = CreateMetadataForURL(url, ReadAudioProperties, error);
+	if(!metadata)
+		return false;
+
+	properties = metadata->GetAudioProperties();
+	return true;
+}
+
+std::vector<size_t> SFB::Audio::Metadata::GetSubclassesForFile(CFStringRef pathExtension, const void *header, size_t headerLength)
+{
+	std::vector<size_t> subclasses;
+	std::vector<bool> subclassAdded(sRegisteredSubclasses.size(), false);
+
+	// Subclasses recognizing the content are tried first, in priority order
+	if(header && 0 < headerLength) {
+		for(size_t i = 0; i < sRegisteredSubclasses.size(); ++i) {
+			const auto& subclassInfo = sRegisteredSubclasses[i];
+			if(subclassInfo.mHandlesSignature && subclassInfo.mHandlesSignature(header, headerLength)) {
+				subclasses.push_back(i);
+				subclassAdded[i] = true;
+			}
+		}
+	}
+
+	if(pathExtension) {
+		for(size_t i = 0; i < sRegisteredSubclasses.size(); ++i) {
+			if(!subclassAdded[i] && sRegisteredSubclasses[i].mHandlesFilesWithExtension(pathExtension))
+				subclasses.push_back(i);
+		}
+	}
+
+	return subclasses;
+}
+
 #pragma mark Creation and Destruction
 
 SFB::Audio::Metadata::Metadata()
-	: mURL(nullptr), mMetadata(0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks), mChangedMetadata(0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks)
+	: mURL(nullptr), mMetadata(0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks), mChangedMetadata(0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks), mReadOptions(ReadAll), mInputSource(nullptr)
 {}
 
 SFB::Audio::Metadata::Metadata(CFURLRef url)
@@ -185,20 +385,140 @@ void SFB::Audio::Metadata::SetURL(CFURLRef URL)
 	mURL = URL ? (CFURLRef)CFRetain(URL) : nullptr;
 }
 
-bool SFB::Audio::Metadata::ReadMetadata(CFErrorRef *error)
+bool SFB::Audio::Metadata::ReadMetadata(unsigned options, CFErrorRef *error)
 {
 	ClearAllMetadata();
-	return _ReadMetadata(error);
+	mReadOptions = options;
+
+	if(!_ReadMetadata(error))
+		return false;
+
+	InternSharedValues();
+
+	if(LoadAttachedPicturesOnDemand & mReadOptions)
+		LoadAttachedPictureDataOnDemand(0);
+
+	return true;
 }
 
-bool SFB::Audio::Metadata::WriteMetadata(CFErrorRef *error)
+bool SFB::Audio::Metadata::ReadAttachedPicturesIfNeeded(CFErrorRef *error)
 {
+	if(ReadAttachedPictures & mReadOptions)
+		return true;
+
+	// Tag values read along with the pictures are discarded in favor of those already read
+	SFB::CFMutableDictionary metadata = std::move(mMetadata);
+	mMetadata = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+
+	auto options = mReadOptions;
+	mReadOptions = ReadAttachedPictures;
+
+	// Pictures attached since reading precede those read from the file
+	auto firstPicture = mPictures.size();
+	bool result = _ReadMetadata(error);
+
+	mMetadata = std::move(metadata);
+	mReadOptions = result ? options | ReadAttachedPictures : options;
+
+	if(result && (LoadAttachedPicturesOnDemand & mReadOptions))
+		LoadAttachedPictureDataOnDemand(firstPicture);
+
+	return result;
+}
+
+bool SFB::Audio::Metadata::WriteMetadata(unsigned options, CFErrorRef *error)
+{
+	if(WriteInPlaceOnly & options) {
+		bool requiresRewrite = true;
+		if(!_RequiresFileRewrite(requiresRewrite, error))
+			return false;
+
+		if(requiresRewrite) {
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Metadata", "Not writing metadata since the file would be rewritten");
+
+			if(error) {
+				SFB::CFString description(CFCopyLocalizedString(CFSTR("The metadata for the file “%@” could not be written in place."), ""));
+				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("The entire file must be rewritten"), ""));
+				SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The metadata is larger than the space available for it in the file."), ""));
+
+				*error = CreateErrorForURL(Metadata::ErrorDomain, Metadata::FileRewriteRequiredError, description, mURL, failureReason, recoverySuggestion);
+			}
+
+			return false;
+		}
+	}
+
 	bool result = _WriteMetadata(error);
-	if(result)
+	if(result) {
 		MergeChangedMetadataIntoMetadata();
+
+		auto cache = GetCache();
+		if(cache)
+			cache->RemoveEntry(mURL);
+	}
 	return result;
 }
 
+bool SFB::Audio::Metadata::RequiresFileRewrite(bool& requiresRewrite, CFErrorRef *error)
+{
+	return _RequiresFileRewrite(requiresRewrite, error);
+}
+
+bool SFB::Audio::Metadata::WriteMetadataConcurrently(const std::vector<Metadata *>& metadata, unsigned options, WriteResultBlock block)
+{
+	std::atomic_bool allSucceeded(true);
+
+	auto objects = metadata.data();
+	auto succeeded = &allSucceeded;
+
+	// Writes mostly wait on the disk so are performed concurrently even when files share a volume
+	dispatch_apply(metadata.size(), dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(size_t i) {
+		CFErrorRef error = nullptr;
+		if(!objects[i]->WriteMetadata(options, &error))
+			succeeded->store(false);
+
+		if(block)
+			block(*objects[i], error);
+
+		if(error)
+			CFRelease(error);
+	});
+
+	return allSucceeded.load();
+}
+
+bool SFB::Audio::Metadata::_RequiresFileRewrite(bool& requiresRewrite, CFErrorRef *error)
+{
+#pragma unused(error)
+
+	requiresRewrite = true;
+	return true;
+}
+
+std::unique_ptr<TagLib::IOStream> SFB::Audio::Metadata::CreateStreamForReading() const
+{
+	if(mInputSource)
+		return std::unique_ptr<TagLib::IOStream>(new InputSourceIOStream(*mInputSource));
+
+	UInt8 buf [PATH_MAX];
+	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
+		return nullptr;
+
+	return std::unique_ptr<TagLib::IOStream>(new TagLib::FileStream((const char *)buf, true));
+}
+
+#pragma mark Caching
+
+void SFB::Audio::Metadata::SetCache(std::shared_ptr<MetadataCache> cache)
+{
+	std::atomic_store(&sCache, cache);
+}
+
+std::shared_ptr<SFB::Audio::MetadataCache> SFB::Audio::Metadata::GetCache()
+{
+	return std::atomic_load(&sCache);
+}
+
 #pragma mark External Representations
 
 CFDictionaryRef SFB::Audio::Metadata::CreateDictionaryRepresentation() const
@@ -442,6 +762,11 @@ CFStringRef SFB::Audio::Metadata::GetFormatName() const
 	return GetStringValue(kFormatNameKey);
 }
 
+CFNumberRef SFB::Audio::Metadata::GetFormatID() const
+{
+	return GetNumberValue(kFormatIDKey);
+}
+
 CFNumberRef SFB::Audio::Metadata::GetTotalFrames() const
 {
 	return GetNumberValue(kTotalFramesKey);
@@ -472,6 +797,43 @@ CFNumberRef SFB::Audio::Metadata::GetBitrate() const
 	return GetNumberValue(kBitrateKey);
 }
 
+SFB::Audio::Metadata::AudioProperties SFB::Audio::Metadata::GetAudioProperties() const
+{
+	AudioProperties properties = {};
+
+	auto number = GetFormatID();
+	if(number)
+		CFNumberGetValue(number, kCFNumberSInt32Type, &properties.mFormat.mFormatID);
+
+	number = GetSampleRate();
+	if(number)
+		CFNumberGetValue(number, kCFNumberDoubleType, &properties.mFormat.mSampleRate);
+
+	number = GetChannelsPerFrame();
+	if(number)
+		CFNumberGetValue(number, kCFNumberSInt32Type, &properties.mFormat.mChannelsPerFrame);
+
+	number = GetBitsPerChannel();
+	if(number)
+		CFNumberGetValue(number, kCFNumberSInt32Type, &properties.mFormat.mBitsPerChannel);
+
+	properties.mTotalFrames = -1;
+	number = GetTotalFrames();
+	if(number)
+		CFNumberGetValue(number, kCFNumberSInt64Type, &properties.mTotalFrames);
+
+	// The duration computed from the total frames is exact
+	if(0 < properties.mTotalFrames && 0 < properties.mFormat.mSampleRate)
+		properties.mDuration = properties.mTotalFrames / properties.mFormat.mSampleRate;
+	else {
+		number = GetDuration();
+		if(number)
+			CFNumberGetValue(number, kCFNumberDoubleType, &properties.mDuration);
+	}
+
+	return properties;
+}
+
 #pragma mark Metadata Access
 
 CFStringRef SFB::Audio::Metadata::GetTitle() const
@@ -973,6 +1335,116 @@ void SFB::Audio::Metadata::ClearAllMetadata()
 	mPictures.clear();
 }
 
+void SFB::Audio::Metadata::LoadAttachedPictureDataOnDemand(size_t firstPicture)
+{
+	if(nullptr == mURL)
+		return;
+
+	SFB::CFURL url((CFURLRef)CFRetain(mURL));
+
+	// Pictures are read in the same order every time, so a picture is identified by its position in the file
+	for(size_t i = firstPicture; i < mPictures.size(); ++i) {
+		size_t index = i - firstPicture;
+		mPictures[i]->LoadDataOnDemand([url, index]() -> SFB::CFData {
+			auto metadata = CreateMetadataForURL(url, ReadAttachedPictures);
+			if(!metadata || index >= metadata->mPictures.size())
+				return SFB::CFData();
+
+			CFDataRef data = metadata->mPictures[index]->GetData();
+			if(nullptr == data)
+				return SFB::CFData();
+
+			return SFB::CFData((CFDataRef)CFRetain(data));
+		});
+	}
+}
+
+void SFB::Audio::Metadata::InternSharedValues()
+{
+	// Values commonly repeated across the tracks of an album or library are shared between objects
+	const CFStringRef keys [] = {
+		kFormatNameKey, kAlbumTitleKey, kArtistKey, kAlbumArtistKey, kGenreKey, kComposerKey, kReleaseDateKey, kMCNKey, kMusicBrainzReleaseIDKey,
+		kAlbumTitleSortOrderKey, kArtistSortOrderKey, kAlbumArtistSortOrderKey, kComposerSortOrderKey, kGroupingKey
+	};
+
+	for(auto key : keys) {
+		CFTypeRef value = CFDictionaryGetValue(mMetadata, key);
+		if(nullptr == value || CFStringGetTypeID() != CFGetTypeID(value))
+			continue;
+
+		CFStringRef interned = InternString((CFStringRef)value);
+		if(interned != value)
+			CFDictionarySetValue(mMetadata, key, interned);
+	}
+}
+
+CFDictionaryRef SFB::Audio::Metadata::CreateCacheRepresentation(size_t subclassIndex) const
+{
+	CFMutableDictionaryRef dictionary = CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, mMetadata);
+
+	AddIntToDictionary(dictionary, kCacheSubclassIndexKey, (int)subclassIndex);
+
+	// Pictures are represented by everything except their image data
+	CFMutableArray pictureArray(0, &kCFTypeArrayCallBacks);
+
+	for(auto picture : mPictures) {
+		CFMutableDictionary pictureRepresentation(CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, picture->mMetadata));
+		CFDictionaryRemoveValue(pictureRepresentation, AttachedPicture::kDataKey);
+		AddLongLongToDictionary(pictureRepresentation, kCachePictureDataSizeKey, (long long)picture->GetDataSize());
+		CFArrayAppendValue(pictureArray, pictureRepresentation);
+	}
+
+	if(0 < CFArrayGetCount(pictureArray))
+		CFDictionarySetValue(dictionary, kAttachedPicturesKey, pictureArray);
+
+	return dictionary;
+}
+
+bool SFB::Audio::Metadata::RestoreFromCacheRepresentation(CFDictionaryRef dictionary, unsigned options)
+{
+	if(nullptr == dictionary)
+		return false;
+
+	ClearAllMetadata();
+
+	mMetadata = CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, dictionary);
+	CFDictionaryRemoveValue(mMetadata, kCacheSubclassIndexKey);
+	CFDictionaryRemoveValue(mMetadata, kAttachedPicturesKey);
+
+	InternSharedValues();
+
+	mReadOptions = options;
+	if(!ShouldReadAttachedPictures())
+		return true;
+
+	mReadOptions |= LoadAttachedPicturesOnDemand;
+
+	CFArrayRef pictureArray = (CFArrayRef)CFDictionaryGetValue(dictionary, kAttachedPicturesKey);
+	if(nullptr == pictureArray)
+		return true;
+
+	std::vector<CFIndex> dataSizes;
+	for(CFIndex i = 0; i < CFArrayGetCount(pictureArray); ++i) {
+		CFDictionaryRef pictureDictionary = (CFDictionaryRef)CFArrayGetValueAtIndex(pictureArray, i);
+
+		auto picture = std::make_shared<AttachedPicture>();
+		picture->mMetadata = CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, pictureDictionary);
+		CFDictionaryRemoveValue(picture->mMetadata, kCachePictureDataSizeKey);
+		mPictures.push_back(picture);
+
+		long long dataSize = 0;
+		GetNumberFromDictionary(pictureDictionary, kCachePictureDataSizeKey, kCFNumberLongLongType, &dataSize);
+		dataSizes.push_back((CFIndex)dataSize);
+	}
+
+	LoadAttachedPictureDataOnDemand(0);
+
+	for(size_t i = 0; i < mPictures.size(); ++i)
+		mPictures[i]->mDataSize = dataSizes[i];
+
+	return true;
+}
+
 void SFB::Audio::Metadata::MergeChangedMetadataIntoMetadata()
 {
 	CFIndex count = CFDictionaryGetCount(mChangedMetadata);
@@ -5,20 +5,32 @@
 
 #pragma once
 
+#include <CoreAudio/CoreAudioTypes.h>
 #include <CoreFoundation/CoreFoundation.h>
 #include <vector>
 
 #include "CFWrapper.h"
 #include "AttachedPicture.h"
+#include "FileTypeIndex.h"
 
 /*! @file AudioMetadata.h @brief Support for metadata reading and writing */
 
+/*! @cond */
+namespace TagLib {
+	class IOStream;
+}
+/*! @endcond */
+
 /*! @brief \c SFBAudioEngine's encompassing namespace */
 namespace SFB {
 
+	class InputSource;
+
 	/*! @brief %Audio functionality */
 	namespace Audio {
 
+		class MetadataCache;
+
 		/*! @brief Base class for all audio metadata reader/writer classes */
 		class Metadata
 		{
@@ -32,13 +44,15 @@ namespace SFB {
 			enum ErrorCode {
 				FileFormatNotRecognizedError		= 0,	/*!< File format not recognized */
 				FileFormatNotSupportedError			= 1,	/*!< File format not supported */
-				InputOutputError					= 2		/*!< Input/output error */
+				InputOutputError					= 2,	/*!< Input/output error */
+				FileRewriteRequiredError			= 3		/*!< Writing requires rewriting the entire file */
 			};
 
 
 			/*! @name Audio property dictionary keys */
 			//@{
 			static const CFStringRef kFormatNameKey;				/*!< @brief The name of the audio format */
+			static const CFStringRef kFormatIDKey;					/*!< @brief The format ID of the audio, as used by \c Decoder (\c CFNumber) */
 			static const CFStringRef kTotalFramesKey;				/*!< @brief The total number of audio frames (\c CFNumber) */
 			static const CFStringRef kChannelsPerFrameKey;			/*!< @brief The number of channels (\c CFNumber) */
 			static const CFStringRef kBitsPerChannelKey;			/*!< @brief The number of bits per channel (\c CFNumber) */
@@ -127,9 +141,28 @@ namespace SFB {
 			/*! @brief Test whether a file extension is supported */
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 
+			/*! @brief Test whether a file extension in UTF-8 is supported */
+			static bool HandlesFilesWithExtension(const char *extension);
+
 			/*! @brief Test whether a MIME type is supported */
 			static bool HandlesMIMEType(CFStringRef mimeType);
 
+			/*! @brief Test whether a MIME type in UTF-8 is supported */
+			static bool HandlesMIMEType(const char *mimeType);
+
+			/*! @brief The maximum number of leading bytes examined when identifying a file by its content */
+			static const size_t SignatureLength = 4096;
+
+			/*!
+			 * @brief Test whether a file's leading bytes are recognized
+			 *
+			 * Subclasses identifying files by content (magic numbers) should hide this function.  \c header
+			 * begins after any ID3v2 tag at the start of the file.
+			 * @param header The leading bytes of the file
+			 * @param length The number of valid bytes in \c header, at most \c SignatureLength
+			 */
+			static bool HandlesSignature(const void *header, size_t length);
+
 			//@}
 
 
@@ -151,6 +184,78 @@ namespace SFB {
 			 */
 			static unique_ptr CreateMetadataForURL(CFURLRef url, CFErrorRef *error = nullptr);
 
+			/*!
+			 * @brief Create a \c Metadata object for the specified URL
+			 * @param url The URL
+			 * @param options A bitmask of \c ReadOptions values specifying what to read
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Metadata object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateMetadataForURL(CFURLRef url, unsigned options, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create a \c Metadata object by reading from an input source
+			 *
+			 * The input is read at explicit offsets so its offset is unchanged, allowing an input used by a
+			 * decoder to be shared. The input's URL determines the format and is used for writing and for
+			 * loading attached pictures on demand. The input isn't retained after reading.
+			 * @param inputSource The input source, which is opened if necessary
+			 * @param options A bitmask of \c ReadOptions values specifying what to read
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Metadata object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateMetadataForInputSource(InputSource& inputSource, unsigned options = ReadAll, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Audio properties */
+			//@{
+
+			/*! @brief The properties of a file's audio */
+			struct AudioProperties {
+				AudioStreamBasicDescription mFormat;	/*!< The format ID, sample rate, channels and bits per channel of the audio; other fields are \c 0 */
+				SInt64 mTotalFrames;					/*!< The total number of audio frames, or \c -1 if unknown */
+				double mDuration;						/*!< The duration in seconds, or \c 0 if unknown */
+			};
+
+			/*!
+			 * @brief Read the audio properties of a file
+			 *
+			 * Only the headers needed for the audio properties are read, avoiding the cost of opening a \c Decoder.
+			 * Entries in the cache set using \c SetCache() are used if present. This function may be called
+			 * concurrently.
+			 * @param url The URL of the file
+			 * @param properties The properties read
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			static bool ReadAudioPropertiesForURL(CFURLRef url, AudioProperties& properties, CFErrorRef *error = nullptr);
+
+			/*! @brief Get the audio properties in the metadata */
+			AudioProperties GetAudioProperties() const;
+
+			//@}
+
+
+			// ========================================
+			/*! @name Caching */
+			//@{
+
+			/*!
+			 * @brief Set the cache consulted by \c CreateMetadataForURL()
+			 *
+			 * Metadata read from files is added to the cache and files whose metadata is in the cache aren't read.
+			 * Reads requesting attached pictures without \c LoadAttachedPicturesOnDemand bypass the cache, since
+			 * the cache doesn't contain image data. Entries are removed when \c WriteMetadata() succeeds.
+			 * @param cache The cache, or \c nullptr to disable caching
+			 */
+			static void SetCache(std::shared_ptr<MetadataCache> cache);
+
+			/*! @brief Get the cache consulted by \c CreateMetadataForURL(), or \c nullptr if none */
+			static std::shared_ptr<MetadataCache> GetCache();
+
 			//@}
 
 
@@ -190,19 +295,93 @@ namespace SFB {
 			/*! @name File access */
 			//@{
 
+			/*! @brief Read option bitmask values used in ReadMetadata() */
+			enum ReadOptions : unsigned {
+				ReadTags				= (1u << 0),	/*!< Tag values */
+				ReadAudioProperties		= (1u << 1),	/*!< Audio properties, which may require examining the audio */
+				ReadAttachedPictures	= (1u << 2),	/*!< Attached pictures */
+				ReadAll					= ReadTags | ReadAudioProperties | ReadAttachedPictures,	/*!< All metadata */
+
+				/*! Attached picture image data is discarded after reading and read from the file when requested */
+				LoadAttachedPicturesOnDemand	= (1u << 3)
+			};
+
 			/*!
 			 * @brief Read the metadata
 			 * @param error An optional pointer to a \c CFErrorRef to receive error information
 			 * @return \c true on success, \c false otherwise
 			 */
-			bool ReadMetadata(CFErrorRef *error = nullptr);
+			inline bool ReadMetadata(CFErrorRef *error = nullptr)			{ return ReadMetadata(ReadAll, error); }
+
+			/*!
+			 * @brief Read the specified metadata
+			 * @note Tag values are always read from tags containing attached pictures when pictures are read
+			 * @param options A bitmask of \c ReadOptions values specifying what to read
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 * @see ReadAttachedPicturesIfNeeded
+			 */
+			bool ReadMetadata(unsigned options, CFErrorRef *error = nullptr);
+
+			/*! @brief Get the read options used when the metadata was last read */
+			inline unsigned GetReadOptions() const						{ return mReadOptions; }
+
+			/*!
+			 * @brief Read the attached pictures if they were skipped by \c ReadMetadata()
+			 * @note Unsaved changes are retained
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool ReadAttachedPicturesIfNeeded(CFErrorRef *error = nullptr);
+
+			/*! @brief Write option bitmask values used in WriteMetadata() */
+			enum WriteOptions : unsigned {
+				WriteInPlaceOnly		= (1u << 0)		/*!< Fail with \c FileRewriteRequiredError instead of rewriting the entire file */
+			};
 
 			/*!
 			 * @brief Write the metadata
 			 * @param error An optional pointer to a \c CFErrorRef to receive error information
 			 * @return \c true on success, \c false otherwise
 			 */
-			bool WriteMetadata(CFErrorRef *error = nullptr);
+			inline bool WriteMetadata(CFErrorRef *error = nullptr)			{ return WriteMetadata(0u, error); }
+
+			/*!
+			 * @brief Write the metadata
+			 * @param options A bitmask of \c WriteOptions values
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool WriteMetadata(unsigned options, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Determine whether writing the metadata would rewrite the entire file
+			 *
+			 * Tags stored before the audio can be rewritten in place only if they fit in the space,
+			 * including padding, occupied by the existing tags. Otherwise the audio must be moved.
+			 * @note Formats unable to determine this always require a rewrite
+			 * @param requiresRewrite A \c bool to receive the result
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool RequiresFileRewrite(bool& requiresRewrite, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief A block called with the result of writing metadata
+			 * @param metadata The \c Metadata object written
+			 * @param error Error information if the metadata couldn't be written, or \c nullptr.  The error is released when the block returns.
+			 */
+			using WriteResultBlock = void (^)(Metadata& metadata, CFErrorRef error);
+
+			/*!
+			 * @brief Write the metadata of several objects concurrently
+			 * @note This method blocks until all objects have been written
+			 * @param metadata The \c Metadata objects to write
+			 * @param options A bitmask of \c WriteOptions values
+			 * @param block An optional block called with the result of each write, which may be called concurrently
+			 * @return \c true if all writes succeeded, \c false otherwise
+			 */
+			static bool WriteMetadataConcurrently(const std::vector<Metadata *>& metadata, unsigned options = 0, WriteResultBlock block = nullptr);
 
 			//@}
 
@@ -302,6 +481,9 @@ namespace SFB {
 			/*! @brief Get the name of the audio format */
 			CFStringRef GetFormatName() const;
 
+			/*! @brief Get the format ID of the audio */
+			CFNumberRef GetFormatID() const;
+
 			/*! @brief Get the total number of audio frames */
 			CFNumberRef GetTotalFrames() const;
 
@@ -637,6 +819,8 @@ namespace SFB {
 
 			picture_vector					mPictures;			/*!< @brief The attached picture information */
 
+			unsigned						mReadOptions;		/*!< @brief The \c ReadOptions subclasses should honor in \c _ReadMetadata() */
+
 
 			/*! @brief Create a new \c Metadata and initialize \c Metadata::mURL to \c nullptr */
 			Metadata();
@@ -645,6 +829,29 @@ namespace SFB {
 			explicit Metadata(CFURLRef url);
 
 
+			/*!
+			 * @brief Create a stream for reading the file
+			 * @note Subclasses should use this stream in \c _ReadMetadata()
+			 * @return A stream reading from the input source being read, or the file at \c mURL if none
+			 */
+			std::unique_ptr<TagLib::IOStream> CreateStreamForReading() const;
+
+
+			/*! @name Read options */
+			//@{
+
+			/*! @brief Query whether \c _ReadMetadata() should read tag values */
+			inline bool ShouldReadTags() const						{ return ReadTags & mReadOptions; }
+
+			/*! @brief Query whether \c _ReadMetadata() should read audio properties */
+			inline bool ShouldReadAudioProperties() const			{ return ReadAudioProperties & mReadOptions; }
+
+			/*! @brief Query whether \c _ReadMetadata() should read attached pictures */
+			inline bool ShouldReadAttachedPictures() const			{ return ReadAttachedPictures & mReadOptions; }
+
+			//@}
+
+
 			/*! @name Type-specific access */
 			//@{
 
@@ -692,10 +899,19 @@ namespace SFB {
 			virtual bool _ReadMetadata(CFErrorRef *error) = 0;
 			virtual bool _WriteMetadata(CFErrorRef *error) = 0;
 
+			// Subclasses able to write in place should override this method
+			virtual bool _RequiresFileRewrite(bool& requiresRewrite, CFErrorRef *error);
+
 			// ========================================
 			//
 			void ClearAllMetadata();
 			void MergeChangedMetadataIntoMetadata();
+			void LoadAttachedPictureDataOnDemand(size_t firstPicture);
+
+			void InternSharedValues();
+
+			CFDictionaryRef CreateCacheRepresentation(size_t subclassIndex) const;
+			bool RestoreFromCacheRepresentation(CFDictionaryRef dictionary, unsigned options);
 
 
 			// ========================================
@@ -707,6 +923,7 @@ namespace SFB {
 
 				bool (*mHandlesFilesWithExtension)(CFStringRef);
 				bool (*mHandlesMIMEType)(CFStringRef);
+				bool (*mHandlesSignature)(const void *, size_t);
 
 				unique_ptr (*mCreateMetadata)(CFURLRef);
 
@@ -714,6 +931,14 @@ namespace SFB {
 			};
 
 			static std::vector <SubclassInfo> sRegisteredSubclasses;
+			static FileTypeIndex::Cache sFileTypeIndex;		// Built from sRegisteredSubclasses on first use
+
+			// Get the indexes in sRegisteredSubclasses of the subclasses recognizing a file's content, followed by any others handling its extension
+			static std::vector<size_t> GetSubclassesForFile(CFStringRef pathExtension, const void *header, size_t headerLength);
+
+			static std::shared_ptr<MetadataCache> sCache;
+
+			InputSource *mInputSource;		// The input read by CreateMetadataForInputSource(), while reading
 
 		public:
 
@@ -736,18 +961,19 @@ namespace SFB {
 
 				.mHandlesFilesWithExtension = T::HandlesFilesWithExtension,
 				.mHandlesMIMEType = T::HandlesMIMEType,
+				// Subclasses not hiding HandlesSignature() don't identify files by content
+				.mHandlesSignature = (&T::HandlesSignature != &Metadata::HandlesSignature) ? T::HandlesSignature : nullptr,
 
 				.mCreateMetadata = T::CreateMetadata,
 
 				.mPriority = priority
 			};
 
-			sRegisteredSubclasses.push_back(subclassInfo);
-
-			// Sort subclasses by priority
-			std::sort(sRegisteredSubclasses.begin(), sRegisteredSubclasses.end(), [](const SubclassInfo& a, const SubclassInfo& b) {
-				return a.mPriority > b.mPriority;
+			// Keep subclasses ordered by priority, with equal priorities in registration order
+			auto position = std::upper_bound(sRegisteredSubclasses.begin(), sRegisteredSubclasses.end(), priority, [](int value, const SubclassInfo& subclass) {
+				return value > subclass.mPriority;
 			});
+			sRegisteredSubclasses.insert(position, subclassInfo);
 		}
 
 	}
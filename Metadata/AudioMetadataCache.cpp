@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "AudioMetadataCache.h"
+#include "Logger.h"
+
+// The cache file begins with a header, followed by the entries sorted by key and their property lists
+#define CACHE_FILE_MAGIC 0x5346424d
+#define CACHE_FILE_VERSION 2
+
+namespace {
+
+	struct FileHeader
+	{
+		uint32_t	mMagic;
+		uint32_t	mVersion;
+		uint64_t	mEntryCount;
+	};
+
+	// ========================================
+	// The identity and modification state of a file
+	struct FileState
+	{
+		uint64_t	mDevice;
+		uint64_t	mInode;
+		int64_t		mSize;
+		int64_t		mModificationTime;
+		int64_t		mModificationTimeNanoseconds;
+	};
+
+	bool GetFileState(CFURLRef url, FileState& state)
+	{
+		UInt8 buf [PATH_MAX];
+		if(nullptr == url || !CFURLGetFileSystemRepresentation(url, FALSE, buf, PATH_MAX))
+			return false;
+
+		struct stat filestats;
+		if(0 != ::stat((const char *)buf, &filestats))
+			return false;
+
+		state.mDevice						= (uint64_t)filestats.st_dev;
+		state.mInode						= (uint64_t)filestats.st_ino;
+		state.mSize							= (int64_t)filestats.st_size;
+		state.mModificationTime				= (int64_t)filestats.st_mtimespec.tv_sec;
+		state.mModificationTimeNanoseconds	= (int64_t)filestats.st_mtimespec.tv_nsec;
+
+		return true;
+	}
+
+	bool IsSameFileState(const FileState& lhs, const FileState& rhs)
+	{
+		return lhs.mDevice == rhs.mDevice && lhs.mInode == rhs.mInode && lhs.mSize == rhs.mSize && lhs.mModificationTime == rhs.mModificationTime && lhs.mModificationTimeNanoseconds == rhs.mModificationTimeNanoseconds;
+	}
+
+	CFDictionaryRef CreateDictionaryFromBytes(const uint8_t *bytes, size_t length)
+	{
+		SFB::CFData data(CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, bytes, (CFIndex)length, kCFAllocatorNull));
+		if(!data)
+			return nullptr;
+
+		CFPropertyListRef propertyList = CFPropertyListCreateWithData(kCFAllocatorDefault, data, kCFPropertyListImmutable, nullptr, nullptr);
+		if(propertyList && CFDictionaryGetTypeID() != CFGetTypeID(propertyList)) {
+			CFRelease(propertyList);
+			return nullptr;
+		}
+
+		return (CFDictionaryRef)propertyList;
+	}
+
+	bool WriteBytes(FILE *file, const void *bytes, size_t length)
+	{
+		return 0 == length || 1 == fwrite(bytes, length, 1, file);
+	}
+
+}
+
+// ========================================
+// An entry in the cache file
+struct SFB::Audio::MetadataCache::FileEntry
+{
+	FileState	mState;
+	uint32_t	mOptions;
+	uint32_t	mReserved;
+	uint64_t	mOffset;		// From the start of the file
+	uint64_t	mLength;
+};
+
+// ========================================
+// An entry added or removed since the cache file was mapped
+struct SFB::Audio::MetadataCache::Entry
+{
+	FileState		mState;
+	unsigned		mOptions;
+	SFB::CFData		mData;			// A binary property list, or nullptr if the entry was removed
+};
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::MetadataCache::MetadataCache(CFURLRef url)
+	: mURL(url ? (CFURLRef)CFRetain(url) : nullptr), mMapping(nullptr), mMappingLength(0), mMappedEntryCount(0), mRemovedAll(false)
+{}
+
+SFB::Audio::MetadataCache::~MetadataCache()
+{
+	Unmap();
+}
+
+#pragma mark Persistence
+
+bool SFB::Audio::MetadataCache::Open(CFErrorRef *error)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Unmap();
+	mEntries.clear();
+	mRemovedAll = false;
+
+	UInt8 buf [PATH_MAX];
+	if(!mURL || !CFURLGetFileSystemRepresentation(mURL, FALSE, buf, PATH_MAX)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return false;
+	}
+
+	int fd = ::open((const char *)buf, O_RDONLY);
+	if(-1 == fd) {
+		if(ENOENT == errno)
+			return true;
+
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return false;
+	}
+
+	struct stat filestats;
+	if(-1 == fstat(fd, &filestats)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		::close(fd);
+		return false;
+	}
+
+	if((size_t)filestats.st_size < sizeof(FileHeader)) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.MetadataCache", "Ignoring truncated cache file");
+		::close(fd);
+		return true;
+	}
+
+	void *mapping = mmap(nullptr, (size_t)filestats.st_size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if(MAP_FAILED == mapping) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return false;
+	}
+
+	auto header = (const FileHeader *)mapping;
+	size_t length = (size_t)filestats.st_size;
+
+	// An unrecognized or damaged cache is discarded and rebuilt
+	if(CACHE_FILE_MAGIC != header->mMagic || CACHE_FILE_VERSION != header->mVersion || header->mEntryCount > (length - sizeof(FileHeader)) / sizeof(FileEntry)) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.MetadataCache", "Ignoring unrecognized cache file");
+		munmap(mapping, length);
+		return true;
+	}
+
+	mMapping = (const uint8_t *)mapping;
+	mMappingLength = length;
+	mMappedEntryCount = header->mEntryCount;
+
+	// Entries are read in no particular order
+	madvise(mapping, length, MADV_RANDOM);
+
+	LOGGER_INFO("org.sbooth.AudioEngine.MetadataCache", "Opened cache containing " << mMappedEntryCount << " entries");
+
+	return true;
+}
+
+bool SFB::Audio::MetadataCache::Save(CFErrorRef *error)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	UInt8 buf [PATH_MAX];
+	if(!mURL || !CFURLGetFileSystemRepresentation(mURL, FALSE, buf, PATH_MAX)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return false;
+	}
+
+	// ========================================
+	// Merge the mapped entries with those added or removed
+	struct SavedEntry {
+		FileEntry		mEntry;
+		const uint8_t	*mBytes;
+	};
+
+	uint64_t mappedEntryCount = mRemovedAll || nullptr == mMapping ? 0 : mMappedEntryCount;
+
+	std::vector<SavedEntry> entries;
+	entries.reserve((size_t)mappedEntryCount + mEntries.size());
+
+	auto mappedEntries = (const FileEntry *)(mMapping + sizeof(FileHeader));
+	auto iter = std::begin(mEntries);
+	for(uint64_t i = 0; i < mappedEntryCount; ++i) {
+		const auto& mappedEntry = mappedEntries[i];
+		EntryKey key(mappedEntry.mState.mDevice, mappedEntry.mState.mInode);
+
+		while(iter != std::end(mEntries) && iter->first < key) {
+			if(iter->second->mData)
+				entries.push_back({{ iter->second->mState, iter->second->mOptions, 0, 0, (uint64_t)CFDataGetLength(iter->second->mData) }, CFDataGetBytePtr(iter->second->mData)});
+			++iter;
+		}
+
+		if(iter != std::end(mEntries) && iter->first == key)
+			continue;
+
+		if(mappedEntry.mOffset + mappedEntry.mLength <= mMappingLength)
+			entries.push_back({{ mappedEntry.mState, mappedEntry.mOptions, 0, 0, mappedEntry.mLength }, mMapping + mappedEntry.mOffset});
+	}
+
+	for(; iter != std::end(mEntries); ++iter) {
+		if(iter->second->mData)
+			entries.push_back({{ iter->second->mState, iter->second->mOptions, 0, 0, (uint64_t)CFDataGetLength(iter->second->mData) }, CFDataGetBytePtr(iter->second->mData)});
+	}
+
+	uint64_t offset = sizeof(FileHeader) + entries.size() * sizeof(FileEntry);
+	for(auto& entry : entries) {
+		entry.mEntry.mOffset = offset;
+		offset += entry.mEntry.mLength;
+	}
+
+	// ========================================
+	// Write a new file and replace the old one, whose mapping remains valid until unmapped
+	std::string path((const char *)buf);
+	std::string temporaryPath = path + ".tmp";
+
+	FILE *file = fopen(temporaryPath.c_str(), "w");
+	if(nullptr == file) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return false;
+	}
+
+	FileHeader header = { CACHE_FILE_MAGIC, CACHE_FILE_VERSION, (uint64_t)entries.size() };
+	bool result = WriteBytes(file, &header, sizeof(header));
+
+	for(auto iter = std::begin(entries); result && iter != std::end(entries); ++iter)
+		result = WriteBytes(file, &iter->mEntry, sizeof(FileEntry));
+
+	for(auto iter = std::begin(entries); result && iter != std::end(entries); ++iter)
+		result = WriteBytes(file, iter->mBytes, (size_t)iter->mEntry.mLength);
+
+	if(0 != fclose(file))
+		result = false;
+
+	if(!result || 0 != rename(temporaryPath.c_str(), path.c_str())) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		unlink(temporaryPath.c_str());
+		return false;
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.MetadataCache", "Saved cache containing " << entries.size() << " entries");
+
+	// Remap the new file
+	Unmap();
+	mEntries.clear();
+	mRemovedAll = false;
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(-1 != fd) {
+		void *mapping = mmap(nullptr, (size_t)offset, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+		::close(fd);
+
+		if(MAP_FAILED != mapping) {
+			mMapping = (const uint8_t *)mapping;
+			mMappingLength = (size_t)offset;
+			mMappedEntryCount = entries.size();
+			madvise(mapping, mMappingLength, MADV_RANDOM);
+		}
+	}
+
+	return true;
+}
+
+bool SFB::Audio::MetadataCache::HasUnsavedChanges() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mRemovedAll || !mEntries.empty();
+}
+
+#pragma mark Entries
+
+CFDictionaryRef SFB::Audio::MetadataCache::CopyEntry(CFURLRef url, unsigned& options) const
+{
+	FileState state;
+	if(!GetFileState(url, state))
+		return nullptr;
+
+	EntryKey key(state.mDevice, state.mInode);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	auto iter = mEntries.find(key);
+	if(iter != std::end(mEntries)) {
+		auto& entry = iter->second;
+		if(!entry->mData || !IsSameFileState(entry->mState, state))
+			return nullptr;
+
+		options = entry->mOptions;
+		return CreateDictionaryFromBytes(CFDataGetBytePtr(entry->mData), (size_t)CFDataGetLength(entry->mData));
+	}
+
+	auto mappedEntry = FindMappedEntry(key);
+	if(nullptr == mappedEntry || !IsSameFileState(mappedEntry->mState, state) || mappedEntry->mOffset + mappedEntry->mLength > mMappingLength)
+		return nullptr;
+
+	options = mappedEntry->mOptions;
+	return CreateDictionaryFromBytes(mMapping + mappedEntry->mOffset, (size_t)mappedEntry->mLength);
+}
+
+void SFB::Audio::MetadataCache::SetEntry(CFURLRef url, CFDictionaryRef entry, unsigned options)
+{
+	if(nullptr == entry)
+		return;
+
+	FileState state;
+	if(!GetFileState(url, state))
+		return;
+
+	EntryKey key(state.mDevice, state.mInode);
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		// Avoid replacing a more complete entry for the same file
+		auto iter = mEntries.find(key);
+		if(iter != std::end(mEntries)) {
+			if(iter->second->mData && IsSameFileState(iter->second->mState, state) && options == (options & iter->second->mOptions))
+				return;
+		}
+		else {
+			auto mappedEntry = FindMappedEntry(key);
+			if(mappedEntry && IsSameFileState(mappedEntry->mState, state) && options == (options & mappedEntry->mOptions))
+				return;
+		}
+	}
+
+	// Encode outside the lock since this is the most expensive part of adding an entry
+	SFB::CFData data(CFPropertyListCreateData(kCFAllocatorDefault, entry, kCFPropertyListBinaryFormat_v1_0, 0, nullptr));
+	if(!data) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.MetadataCache", "Unable to encode cache entry");
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mEntries[key] = std::unique_ptr<Entry>(new Entry{ state, options, std::move(data) });
+}
+
+void SFB::Audio::MetadataCache::RemoveEntry(CFURLRef url)
+{
+	FileState state;
+	if(!GetFileState(url, state))
+		return;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mEntries[EntryKey(state.mDevice, state.mInode)] = std::unique_ptr<Entry>(new Entry{ state, 0, SFB::CFData() });
+}
+
+void SFB::Audio::MetadataCache::RemoveAllEntries()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mEntries.clear();
+	mRemovedAll = true;
+}
+
+#pragma mark Internals
+
+const SFB::Audio::MetadataCache::FileEntry * SFB::Audio::MetadataCache::FindMappedEntry(const EntryKey& key) const
+{
+	if(mRemovedAll || nullptr == mMapping)
+		return nullptr;
+
+	auto first = (const FileEntry *)(mMapping + sizeof(FileHeader));
+	auto last = first + mMappedEntryCount;
+
+	auto match = std::lower_bound(first, last, key, [](const FileEntry& entry, const EntryKey& key) {
+		return EntryKey(entry.mState.mDevice, entry.mState.mInode) < key;
+	});
+
+	if(match == last || match->mState.mDevice != key.first || match->mState.mInode != key.second)
+		return nullptr;
+
+	return match;
+}
+
+void SFB::Audio::MetadataCache::Unmap()
+{
+	if(mMapping) {
+		munmap((void *)mMapping, mMappingLength);
+		mMapping = nullptr;
+	}
+
+	mMappingLength = 0;
+	mMappedEntryCount = 0;
+}
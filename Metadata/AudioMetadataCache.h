@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "CFWrapper.h"
+
+/*! @file AudioMetadataCache.h @brief A persistent cache of metadata */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A persistent cache of metadata read from files
+		 *
+		 * Entries are keyed by a file's device and inode and are valid only while the file's size and modification
+		 * time are unchanged, so a single \c stat determines whether a file must be read again.
+		 *
+		 * The cache file is memory-mapped and entries are decoded only when requested. Entries added or removed
+		 * are kept in memory until \c Save() is called.
+		 * @note This class is thread safe
+		 * @see Metadata::SetCache
+		 */
+		class MetadataCache
+		{
+		public:
+
+			/*! @brief A \c std::shared_ptr for \c MetadataCache objects */
+			using shared_ptr = std::shared_ptr<MetadataCache>;
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*!
+			 * @brief Create a new \c MetadataCache
+			 * @param url The URL of the cache file, which need not exist
+			 */
+			explicit MetadataCache(CFURLRef url);
+
+			/*! @brief Destroy the \c MetadataCache, discarding unsaved entries */
+			~MetadataCache();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			MetadataCache(const MetadataCache& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			MetadataCache& operator=(const MetadataCache& rhs) = delete;
+
+			/*! @endcond */
+
+			//@}
+
+
+			// ========================================
+			/*! @name Persistence */
+			//@{
+
+			/*!
+			 * @brief Map the cache file
+			 * @note A missing cache file is not an error and results in an empty cache
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool Open(CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Write all entries to the cache file
+			 * @note The cache file is replaced atomically
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool Save(CFErrorRef *error = nullptr);
+
+			/*! @brief Query whether entries have been added or removed since the cache was opened or saved */
+			bool HasUnsavedChanges() const;
+
+			//@}
+
+
+			// ========================================
+			/*! @name Entries */
+			//@{
+
+			/*!
+			 * @brief Copy the entry for a file if it is present and current
+			 * @note The returned dictionary must be released by the caller
+			 * @param url The URL of the file
+			 * @param options A \c Metadata::ReadOptions bitmask to receive the metadata the entry contains
+			 * @return The entry, or \c nullptr if none exists or the file has changed
+			 */
+			CFDictionaryRef CopyEntry(CFURLRef url, unsigned& options) const;
+
+			/*!
+			 * @brief Set the entry for a file
+			 * @note A current entry containing at least the metadata specified by \c options is retained
+			 * @param url The URL of the file
+			 * @param entry A property list dictionary
+			 * @param options A \c Metadata::ReadOptions bitmask specifying the metadata \c entry contains
+			 */
+			void SetEntry(CFURLRef url, CFDictionaryRef entry, unsigned options);
+
+			/*!
+			 * @brief Remove the entry for a file
+			 * @param url The URL of the file
+			 */
+			void RemoveEntry(CFURLRef url);
+
+			/*! @brief Remove all entries */
+			void RemoveAllEntries();
+
+			//@}
+
+		private:
+
+			struct FileEntry;
+			struct Entry;
+
+			/*! @internal Entries are keyed by device and inode */
+			using EntryKey = std::pair<uint64_t, uint64_t>;
+
+			const FileEntry * FindMappedEntry(const EntryKey& key) const;
+			void Unmap();
+
+			SFB::CFURL								mURL;				/*!< The URL of the cache file */
+
+			const uint8_t							*mMapping;			/*!< The mapped cache file */
+			size_t									mMappingLength;		/*!< The length of the mapping */
+			uint64_t								mMappedEntryCount;	/*!< The number of entries in the mapping */
+
+			std::map<EntryKey, std::unique_ptr<Entry>>	mEntries;		/*!< Entries added or removed since mapping */
+			bool									mRemovedAll;		/*!< Whether mapped entries were removed */
+			mutable std::mutex						mMutex;				/*!< Protects all members */
+		};
+
+	}
+}
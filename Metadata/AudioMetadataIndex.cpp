@@ -0,0 +1,591 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if __SSE2__
+# include <emmintrin.h>
+#elif __ARM_NEON
+# include <arm_neon.h>
+#endif
+
+#include "AudioMetadataIndex.h"
+#include "CFWrapper.h"
+#include "Logger.h"
+
+// The index file begins with a header, followed by the string offsets, the columns, and the string data
+#define INDEX_FILE_MAGIC 0x53464249
+#define INDEX_FILE_VERSION 1
+
+namespace {
+
+	const uint32_t kStringColumnCount = 7;
+	const uint32_t kNumericColumnCount = 4;
+
+	// The identifier of the empty string, used for rows without a value
+	const uint32_t kNoValue = 0;
+
+	const CFStringCompareFlags kFoldingOptions = kCFCompareCaseInsensitive | kCFCompareDiacriticInsensitive | kCFCompareWidthInsensitive;
+
+	struct FileHeader
+	{
+		uint32_t	mMagic;
+		uint32_t	mVersion;
+		uint32_t	mRowCount;
+		uint32_t	mStringCount;
+		uint32_t	mStringColumnCount;
+		uint32_t	mNumericColumnCount;
+		uint64_t	mStringDataLength;
+	};
+
+	// The offsets of the sections of an index from its start
+	struct Layout
+	{
+		uint64_t	mStringOffsets;
+		uint64_t	mFoldedOffsets;
+		uint64_t	mStringColumns;
+		uint64_t	mNumericColumns;
+		uint64_t	mStringData;
+		uint64_t	mLength;
+	};
+
+	Layout GetLayout(const FileHeader& header)
+	{
+		Layout layout;
+		layout.mStringOffsets	= sizeof(FileHeader);
+		layout.mFoldedOffsets	= layout.mStringOffsets + ((uint64_t)header.mStringCount + 1) * sizeof(uint32_t);
+		layout.mStringColumns	= layout.mFoldedOffsets + ((uint64_t)header.mStringCount + 1) * sizeof(uint32_t);
+		layout.mNumericColumns	= layout.mStringColumns + (uint64_t)header.mRowCount * header.mStringColumnCount * sizeof(uint32_t);
+		layout.mStringData		= layout.mNumericColumns + (uint64_t)header.mRowCount * header.mNumericColumnCount * sizeof(float);
+		layout.mLength			= layout.mStringData + header.mStringDataLength;
+		return layout;
+	}
+
+	// ========================================
+	// String conversion
+	std::string CreateUTF8String(CFStringRef string)
+	{
+		if(nullptr == string)
+			return std::string();
+
+		CFRange range = CFRangeMake(0, CFStringGetLength(string));
+		CFIndex count = 0;
+		CFStringGetBytes(string, range, kCFStringEncodingUTF8, 0, false, nullptr, 0, &count);
+
+		std::string result((size_t)count, '\0');
+		if(count)
+			CFStringGetBytes(string, range, kCFStringEncodingUTF8, 0, false, (UInt8 *)&result[0], count, nullptr);
+
+		return result;
+	}
+
+	std::string CreateFoldedUTF8String(CFStringRef string)
+	{
+		if(nullptr == string)
+			return std::string();
+
+		SFB::CFMutableString folded(CFStringCreateMutableCopy(kCFAllocatorDefault, 0, string));
+		if(!folded)
+			return std::string();
+
+		CFStringFold(folded, kFoldingOptions, nullptr);
+		return CreateUTF8String(folded);
+	}
+
+	float GetFloatValue(CFNumberRef number)
+	{
+		float value = NAN;
+		if(nullptr == number || !CFNumberGetValue(number, kCFNumberFloatType, &value))
+			return NAN;
+		return value;
+	}
+
+	// Release dates are commonly a year optionally followed by a month and day
+	float GetYear(CFStringRef releaseDate)
+	{
+		if(nullptr == releaseDate)
+			return NAN;
+
+		SInt32 year = CFStringGetIntValue(releaseDate);
+		return 0 < year ? (float)year : NAN;
+	}
+
+	// ========================================
+	// Matching
+	bool IsMatch(const char *bytes, size_t length, const std::string& string, SFB::Audio::MetadataIndex::StringMatch match)
+	{
+		switch(match) {
+			case SFB::Audio::MetadataIndex::StringMatch::Equal:		return length == string.size() && 0 == memcmp(bytes, string.data(), length);
+			case SFB::Audio::MetadataIndex::StringMatch::Prefix:	return length >= string.size() && 0 == memcmp(bytes, string.data(), string.size());
+			case SFB::Audio::MetadataIndex::StringMatch::Substring:	return nullptr != memmem(bytes, length, string.data(), string.size());
+		}
+
+		return false;
+	}
+
+	// Clear the elements of selected whose values aren't in [minimum, maximum]
+	void SelectInRange(const float *values, uint32_t count, float minimum, float maximum, uint8_t *selected)
+	{
+		uint32_t i = 0;
+
+#if __SSE2__
+		const __m128 low = _mm_set1_ps(minimum);
+		const __m128 high = _mm_set1_ps(maximum);
+		const __m128i one = _mm_set1_epi8(1);
+
+		for(; i + 16 <= count; i += 16) {
+			__m128i masks [4];
+			for(int j = 0; j < 4; ++j) {
+				const __m128 v = _mm_loadu_ps(values + i + 4 * j);
+				masks[j] = _mm_castps_si128(_mm_and_ps(_mm_cmpge_ps(v, low), _mm_cmple_ps(v, high)));
+			}
+
+			// Narrow the 32-bit masks to bytes
+			const __m128i mask = _mm_packs_epi16(_mm_packs_epi32(masks[0], masks[1]), _mm_packs_epi32(masks[2], masks[3]));
+			const __m128i current = _mm_loadu_si128((const __m128i *)(selected + i));
+			_mm_storeu_si128((__m128i *)(selected + i), _mm_and_si128(current, _mm_and_si128(mask, one)));
+		}
+#elif __ARM_NEON
+		const float32x4_t low = vdupq_n_f32(minimum);
+		const float32x4_t high = vdupq_n_f32(maximum);
+		const uint8x16_t one = vdupq_n_u8(1);
+
+		for(; i + 16 <= count; i += 16) {
+			uint16x8_t halves [2];
+			for(int j = 0; j < 2; ++j) {
+				const float32x4_t a = vld1q_f32(values + i + 8 * j);
+				const float32x4_t b = vld1q_f32(values + i + 8 * j + 4);
+				const uint32x4_t maskA = vandq_u32(vcgeq_f32(a, low), vcleq_f32(a, high));
+				const uint32x4_t maskB = vandq_u32(vcgeq_f32(b, low), vcleq_f32(b, high));
+				halves[j] = vcombine_u16(vmovn_u32(maskA), vmovn_u32(maskB));
+			}
+
+			// Narrow the 16-bit masks to bytes
+			const uint8x16_t mask = vcombine_u8(vmovn_u16(halves[0]), vmovn_u16(halves[1]));
+			vst1q_u8(selected + i, vandq_u8(vld1q_u8(selected + i), vandq_u8(mask, one)));
+		}
+#endif
+
+		// Comparisons with NaN are false, so rows without values are never in range
+		for(; i < count; ++i)
+			selected[i] &= (values[i] >= minimum && values[i] <= maximum);
+	}
+
+	bool WriteBytes(FILE *file, const void *bytes, size_t length)
+	{
+		return 0 == length || 1 == fwrite(bytes, length, 1, file);
+	}
+
+}
+
+#pragma mark Query
+
+SFB::Audio::MetadataIndex::Query& SFB::Audio::MetadataIndex::Query::Matching(StringColumn column, CFStringRef string, StringMatch match)
+{
+	// An empty string matches every row
+	auto folded = CreateFoldedUTF8String(string);
+	if(!folded.empty())
+		mStringConditions.push_back({ { column }, std::move(folded), match });
+	return *this;
+}
+
+SFB::Audio::MetadataIndex::Query& SFB::Audio::MetadataIndex::Query::MatchingAny(CFStringRef string, StringMatch match)
+{
+	auto folded = CreateFoldedUTF8String(string);
+	if(!folded.empty())
+		mStringConditions.push_back({ { StringColumn::Title, StringColumn::Artist, StringColumn::AlbumTitle, StringColumn::AlbumArtist, StringColumn::Composer, StringColumn::Genre }, std::move(folded), match });
+	return *this;
+}
+
+SFB::Audio::MetadataIndex::Query& SFB::Audio::MetadataIndex::Query::InRange(NumericColumn column, double minimum, double maximum)
+{
+	mRangeConditions.push_back({ column, (float)minimum, (float)maximum });
+	return *this;
+}
+
+#pragma mark Builder
+
+SFB::Audio::MetadataIndex::Builder::Builder()
+{
+	InternString(std::string(), std::string());
+}
+
+void SFB::Audio::MetadataIndex::Builder::AddMetadata(const Metadata& metadata)
+{
+	const CFStringRef strings [kStringColumnCount] = {
+		metadata.GetURL() ? CFURLGetString(metadata.GetURL()) : nullptr,
+		metadata.GetTitle(),
+		metadata.GetArtist(),
+		metadata.GetAlbumTitle(),
+		metadata.GetAlbumArtist(),
+		metadata.GetComposer(),
+		metadata.GetGenre()
+	};
+
+	const float values [kNumericColumnCount] = {
+		GetYear(metadata.GetReleaseDate()),
+		GetFloatValue(metadata.GetDuration()),
+		GetFloatValue(metadata.GetSampleRate()),
+		GetFloatValue(metadata.GetTrackNumber())
+	};
+
+	// Convert outside the lock since this is the most expensive part of adding a row
+	std::string utf8 [kStringColumnCount];
+	std::string folded [kStringColumnCount];
+	for(uint32_t i = 0; i < kStringColumnCount; ++i) {
+		utf8[i] = CreateUTF8String(strings[i]);
+		folded[i] = CreateFoldedUTF8String(strings[i]);
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	for(uint32_t i = 0; i < kStringColumnCount; ++i)
+		mStringColumns.push_back(InternString(std::move(utf8[i]), std::move(folded[i])));
+
+	mNumericColumns.insert(std::end(mNumericColumns), std::begin(values), std::end(values));
+}
+
+size_t SFB::Audio::MetadataIndex::Builder::GetRowCount() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mStringColumns.size() / kStringColumnCount;
+}
+
+SFB::Audio::MetadataIndex::unique_ptr SFB::Audio::MetadataIndex::Builder::CreateIndex() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	size_t rowCount = mStringColumns.size() / kStringColumnCount;
+
+	uint64_t stringDataLength = 0;
+	for(size_t i = 0; i < mStrings.size(); ++i)
+		stringDataLength += mStrings[i].size() + mFoldedStrings[i].size();
+
+	// String offsets are 32 bits
+	if(UINT32_MAX < rowCount || UINT32_MAX <= mStrings.size() || UINT32_MAX < stringDataLength) {
+		LOGGER_ERR("org.sbooth.AudioEngine.MetadataIndex", "Too many rows or strings for an index");
+		return nullptr;
+	}
+
+	FileHeader header = { INDEX_FILE_MAGIC, INDEX_FILE_VERSION, (uint32_t)rowCount, (uint32_t)mStrings.size(), kStringColumnCount, kNumericColumnCount, stringDataLength };
+	auto layout = GetLayout(header);
+
+	auto storage = (uint8_t *)malloc((size_t)layout.mLength);
+	if(nullptr == storage) {
+		LOGGER_ERR("org.sbooth.AudioEngine.MetadataIndex", "Unable to allocate memory");
+		return nullptr;
+	}
+
+	memcpy(storage, &header, sizeof(header));
+
+	// All strings precede all folded strings so each is contiguous with the next
+	auto stringOffsets = (uint32_t *)(storage + layout.mStringOffsets);
+	auto foldedOffsets = (uint32_t *)(storage + layout.mFoldedOffsets);
+	auto stringData = (char *)(storage + layout.mStringData);
+
+	uint32_t offset = 0;
+	for(size_t i = 0; i < mStrings.size(); ++i) {
+		stringOffsets[i] = offset;
+		memcpy(stringData + offset, mStrings[i].data(), mStrings[i].size());
+		offset += (uint32_t)mStrings[i].size();
+	}
+	stringOffsets[mStrings.size()] = offset;
+
+	for(size_t i = 0; i < mFoldedStrings.size(); ++i) {
+		foldedOffsets[i] = offset;
+		memcpy(stringData + offset, mFoldedStrings[i].data(), mFoldedStrings[i].size());
+		offset += (uint32_t)mFoldedStrings[i].size();
+	}
+	foldedOffsets[mFoldedStrings.size()] = offset;
+
+	// Rows are accumulated interleaved and stored column after column
+	auto stringColumns = (uint32_t *)(storage + layout.mStringColumns);
+	for(uint32_t column = 0; column < kStringColumnCount; ++column) {
+		for(size_t row = 0; row < rowCount; ++row)
+			stringColumns[column * rowCount + row] = mStringColumns[row * kStringColumnCount + column];
+	}
+
+	auto numericColumns = (float *)(storage + layout.mNumericColumns);
+	for(uint32_t column = 0; column < kNumericColumnCount; ++column) {
+		for(size_t row = 0; row < rowCount; ++row)
+			numericColumns[column * rowCount + row] = mNumericColumns[row * kNumericColumnCount + column];
+	}
+
+	unique_ptr index(new MetadataIndex(storage, (size_t)layout.mLength, false));
+	if(!index->Load())
+		return nullptr;
+
+	return index;
+}
+
+uint32_t SFB::Audio::MetadataIndex::Builder::InternString(std::string&& string, std::string&& foldedString)
+{
+	auto iter = mStringIdentifiers.find(string);
+	if(iter != std::end(mStringIdentifiers))
+		return iter->second;
+
+	uint32_t identifier = (uint32_t)mStrings.size();
+	mStringIdentifiers.emplace(string, identifier);
+	mStrings.push_back(std::move(string));
+	mFoldedStrings.push_back(std::move(foldedString));
+
+	return identifier;
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::MetadataIndex::unique_ptr SFB::Audio::MetadataIndex::CreateWithURL(CFURLRef url, CFErrorRef *error)
+{
+	UInt8 buf [PATH_MAX];
+	if(nullptr == url || !CFURLGetFileSystemRepresentation(url, FALSE, buf, PATH_MAX)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return nullptr;
+	}
+
+	int fd = ::open((const char *)buf, O_RDONLY);
+	if(-1 == fd) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return nullptr;
+	}
+
+	struct stat filestats;
+	if(-1 == fstat(fd, &filestats)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		::close(fd);
+		return nullptr;
+	}
+
+	if((size_t)filestats.st_size < sizeof(FileHeader)) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.MetadataIndex", "Truncated index file");
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EFTYPE, nullptr);
+		::close(fd);
+		return nullptr;
+	}
+
+	void *mapping = mmap(nullptr, (size_t)filestats.st_size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if(MAP_FAILED == mapping) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return nullptr;
+	}
+
+	// Queries scan entire columns
+	madvise(mapping, (size_t)filestats.st_size, MADV_WILLNEED);
+
+	unique_ptr index(new MetadataIndex((const uint8_t *)mapping, (size_t)filestats.st_size, true));
+	if(!index->Load()) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.MetadataIndex", "Unrecognized index file");
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EFTYPE, nullptr);
+		return nullptr;
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.MetadataIndex", "Opened index containing " << index->mRowCount << " rows and " << index->mStringCount << " strings");
+
+	return index;
+}
+
+SFB::Audio::MetadataIndex::MetadataIndex(const uint8_t *storage, size_t length, bool mapped)
+	: mStorage(storage), mLength(length), mMapped(mapped), mRowCount(0), mStringCount(0), mStringOffsets(nullptr), mFoldedOffsets(nullptr), mStringData(nullptr), mStringColumns(nullptr), mNumericColumns(nullptr)
+{}
+
+SFB::Audio::MetadataIndex::~MetadataIndex()
+{
+	if(mMapped)
+		munmap((void *)mStorage, mLength);
+	else
+		free((void *)mStorage);
+}
+
+#pragma mark Persistence
+
+bool SFB::Audio::MetadataIndex::WriteToURL(CFURLRef url, CFErrorRef *error) const
+{
+	UInt8 buf [PATH_MAX];
+	if(nullptr == url || !CFURLGetFileSystemRepresentation(url, FALSE, buf, PATH_MAX)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return false;
+	}
+
+	std::string path((const char *)buf);
+	std::string temporaryPath = path + ".tmp";
+
+	FILE *file = fopen(temporaryPath.c_str(), "w");
+	if(nullptr == file) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return false;
+	}
+
+	bool result = WriteBytes(file, mStorage, mLength);
+
+	if(0 != fclose(file))
+		result = false;
+
+	if(!result || 0 != rename(temporaryPath.c_str(), path.c_str())) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		unlink(temporaryPath.c_str());
+		return false;
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.MetadataIndex", "Wrote index containing " << mRowCount << " rows");
+
+	return true;
+}
+
+#pragma mark Queries
+
+std::vector<uint32_t> SFB::Audio::MetadataIndex::Find(const Query& query) const
+{
+	std::vector<uint8_t> selected(mRowCount, 1);
+
+	for(const auto& condition : query.mRangeConditions)
+		SelectInRange(mNumericColumns + (size_t)condition.mColumn * mRowCount, mRowCount, condition.mMinimum, condition.mMaximum, selected.data());
+
+	if(!query.mStringConditions.empty()) {
+		std::vector<uint8_t> stringMatches(mStringCount);
+		std::vector<uint8_t> rowMatches(mRowCount);
+
+		for(const auto& condition : query.mStringConditions) {
+			// Each distinct string is matched once regardless of the number of rows containing it
+			bool anyMatch = false;
+			for(uint32_t i = 0; i < mStringCount; ++i) {
+				size_t length;
+				auto bytes = GetFoldedStringBytes(i, length);
+				stringMatches[i] = IsMatch(bytes, length, condition.mString, condition.mMatch);
+				anyMatch = anyMatch || stringMatches[i];
+			}
+
+			if(!anyMatch)
+				return {};
+
+			std::fill(std::begin(rowMatches), std::end(rowMatches), 0);
+			for(auto column : condition.mColumns) {
+				const uint32_t *identifiers = mStringColumns + (size_t)column * mRowCount;
+				for(uint32_t row = 0; row < mRowCount; ++row)
+					rowMatches[row] |= stringMatches[identifiers[row]];
+			}
+
+			for(uint32_t row = 0; row < mRowCount; ++row)
+				selected[row] &= rowMatches[row];
+		}
+	}
+
+	std::vector<uint32_t> rows;
+	for(uint32_t row = 0; row < mRowCount; ++row) {
+		if(selected[row])
+			rows.push_back(row);
+	}
+
+	return rows;
+}
+
+CFStringRef SFB::Audio::MetadataIndex::CopyString(uint32_t row, StringColumn column) const
+{
+	if(row >= mRowCount)
+		return nullptr;
+
+	uint32_t identifier = mStringColumns[(size_t)column * mRowCount + row];
+	if(kNoValue == identifier)
+		return nullptr;
+
+	size_t length;
+	auto bytes = GetStringBytes(identifier, length);
+	return CFStringCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)bytes, (CFIndex)length, kCFStringEncodingUTF8, false);
+}
+
+CFURLRef SFB::Audio::MetadataIndex::CopyURL(uint32_t row) const
+{
+	if(row >= mRowCount)
+		return nullptr;
+
+	uint32_t identifier = mStringColumns[(size_t)StringColumn::URL * mRowCount + row];
+	if(kNoValue == identifier)
+		return nullptr;
+
+	size_t length;
+	auto bytes = GetStringBytes(identifier, length);
+	return CFURLCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)bytes, (CFIndex)length, kCFStringEncodingUTF8, nullptr);
+}
+
+double SFB::Audio::MetadataIndex::GetValue(uint32_t row, NumericColumn column) const
+{
+	if(row >= mRowCount)
+		return NAN;
+
+	return mNumericColumns[(size_t)column * mRowCount + row];
+}
+
+#pragma mark Internals
+
+bool SFB::Audio::MetadataIndex::Load()
+{
+	if(nullptr == mStorage || mLength < sizeof(FileHeader))
+		return false;
+
+	auto header = (const FileHeader *)mStorage;
+	if(INDEX_FILE_MAGIC != header->mMagic || INDEX_FILE_VERSION != header->mVersion || kStringColumnCount != header->mStringColumnCount || kNumericColumnCount != header->mNumericColumnCount)
+		return false;
+
+	// The empty string is always present
+	auto layout = GetLayout(*header);
+	if(layout.mLength != mLength || 0 == header->mStringCount)
+		return false;
+
+	mRowCount		= header->mRowCount;
+	mStringCount	= header->mStringCount;
+	mStringOffsets	= (const uint32_t *)(mStorage + layout.mStringOffsets);
+	mFoldedOffsets	= (const uint32_t *)(mStorage + layout.mFoldedOffsets);
+	mStringColumns	= (const uint32_t *)(mStorage + layout.mStringColumns);
+	mNumericColumns	= (const float *)(mStorage + layout.mNumericColumns);
+	mStringData		= (const char *)(mStorage + layout.mStringData);
+
+	// Validate everything queries rely on so a damaged file can't cause reads outside the storage
+	for(uint32_t i = 0; i < mStringCount; ++i) {
+		if(mStringOffsets[i] > mStringOffsets[i + 1] || mFoldedOffsets[i] > mFoldedOffsets[i + 1])
+			return false;
+	}
+
+	if(mStringOffsets[mStringCount] > header->mStringDataLength || mFoldedOffsets[mStringCount] > header->mStringDataLength)
+		return false;
+
+	size_t identifierCount = (size_t)mRowCount * kStringColumnCount;
+	for(size_t i = 0; i < identifierCount; ++i) {
+		if(mStringColumns[i] >= mStringCount)
+			return false;
+	}
+
+	return true;
+}
+
+const char * SFB::Audio::MetadataIndex::GetStringBytes(uint32_t identifier, size_t& length) const
+{
+	length = mStringOffsets[identifier + 1] - mStringOffsets[identifier];
+	return mStringData + mStringOffsets[identifier];
+}
+
+const char * SFB::Audio::MetadataIndex::GetFoldedStringBytes(uint32_t identifier, size_t& length) const
+{
+	length = mFoldedOffsets[identifier + 1] - mFoldedOffsets[identifier];
+	return mStringData + mFoldedOffsets[identifier];
+}
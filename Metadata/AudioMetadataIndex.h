@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "AudioMetadata.h"
+
+/*! @file AudioMetadataIndex.h @brief A columnar index of metadata for fast queries */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief An immutable columnar index of the metadata of many files
+		 *
+		 * Each row of the index holds the well-known metadata of one file.  Strings are stored once in a shared table
+		 * and columns hold indexes into it, so a string condition is evaluated once per distinct string rather than
+		 * once per row.  Numeric columns are stored as arrays of \c float and are scanned using SIMD instructions.
+		 *
+		 * String conditions are case, diacritic, and width insensitive.
+		 *
+		 * An index has the same layout in memory and on disk, so an index read from a file is memory-mapped and
+		 * ready immediately.
+		 * @note This class is thread safe
+		 */
+		class MetadataIndex
+		{
+		public:
+
+			/*! @brief A \c std::unique_ptr for \c MetadataIndex objects */
+			using unique_ptr = std::unique_ptr<MetadataIndex>;
+
+			/*! @brief The string columns */
+			enum class StringColumn {
+				URL				= 0,	/*!< The file's URL */
+				Title			= 1,	/*!< \c Metadata::kTitleKey */
+				Artist			= 2,	/*!< \c Metadata::kArtistKey */
+				AlbumTitle		= 3,	/*!< \c Metadata::kAlbumTitleKey */
+				AlbumArtist		= 4,	/*!< \c Metadata::kAlbumArtistKey */
+				Composer		= 5,	/*!< \c Metadata::kComposerKey */
+				Genre			= 6,	/*!< \c Metadata::kGenreKey */
+			};
+
+			/*! @brief The numeric columns */
+			enum class NumericColumn {
+				Year			= 0,	/*!< The year from \c Metadata::kReleaseDateKey */
+				Duration		= 1,	/*!< \c Metadata::kDurationKey in seconds */
+				SampleRate		= 2,	/*!< \c Metadata::kSampleRateKey in Hz */
+				TrackNumber		= 3,	/*!< \c Metadata::kTrackNumberKey */
+			};
+
+			/*! @brief How a string condition matches */
+			enum class StringMatch {
+				Equal,					/*!< The value equals the string */
+				Prefix,					/*!< The value begins with the string */
+				Substring,				/*!< The value contains the string */
+			};
+
+			// ========================================
+			/*! @brief Conditions selecting rows, all of which must be satisfied */
+			class Query
+			{
+			public:
+
+				/*!
+				 * @brief Require a string column to match a string
+				 * @param column The column to match
+				 * @param string The string to match
+				 * @param match How \c string is matched
+				 * @return This query
+				 */
+				Query& Matching(StringColumn column, CFStringRef string, StringMatch match = StringMatch::Substring);
+
+				/*!
+				 * @brief Require any of the title, artist, album title, album artist, composer, or genre to match a string
+				 * @param string The string to match
+				 * @param match How \c string is matched
+				 * @return This query
+				 */
+				Query& MatchingAny(CFStringRef string, StringMatch match = StringMatch::Substring);
+
+				/*!
+				 * @brief Require a numeric column to be in a closed interval
+				 * @note Rows without a value never match
+				 * @param column The column to match
+				 * @param minimum The smallest matching value
+				 * @param maximum The largest matching value
+				 * @return This query
+				 */
+				Query& InRange(NumericColumn column, double minimum, double maximum);
+
+			private:
+
+				friend class MetadataIndex;
+
+				struct StringCondition {
+					std::vector<StringColumn>	mColumns;	// Any of which may match
+					std::string					mString;	// Folded UTF-8
+					StringMatch					mMatch;
+				};
+
+				struct RangeCondition {
+					NumericColumn				mColumn;
+					float						mMinimum;
+					float						mMaximum;
+				};
+
+				std::vector<StringCondition>	mStringConditions;
+				std::vector<RangeCondition>		mRangeConditions;
+			};
+
+			// ========================================
+			/*!
+			 * @brief Accumulates rows for a new index
+			 * @note \c AddMetadata() may be called concurrently, for example from a \c MetadataScanner::ResultBlock
+			 */
+			class Builder
+			{
+			public:
+
+				/*! @brief Create a new \c Builder */
+				Builder();
+
+				/*! @cond */
+
+				/*! @internal This class is non-copyable */
+				Builder(const Builder& rhs) = delete;
+
+				/*! @internal This class is non-assignable */
+				Builder& operator=(const Builder& rhs) = delete;
+
+				/*! @endcond */
+
+				/*! @brief Add a row for \c metadata */
+				void AddMetadata(const Metadata& metadata);
+
+				/*! @brief Get the number of rows added */
+				size_t GetRowCount() const;
+
+				/*!
+				 * @brief Create an index containing the rows added
+				 * @return A \c MetadataIndex object, or \c nullptr on failure
+				 */
+				unique_ptr CreateIndex() const;
+
+			private:
+
+				// Add a string to the string table if not present and return its identifier
+				uint32_t InternString(std::string&& string, std::string&& foldedString);
+
+				std::vector<std::string>						mStrings;			// UTF-8
+				std::vector<std::string>						mFoldedStrings;		// Folded UTF-8
+				std::unordered_map<std::string, uint32_t>		mStringIdentifiers;
+				std::vector<uint32_t>							mStringColumns;		// Interleaved by row
+				std::vector<float>								mNumericColumns;	// Interleaved by row
+				mutable std::mutex								mMutex;
+			};
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*!
+			 * @brief Create an index by mapping a file written by \c WriteToURL()
+			 * @param url The URL of the file
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c MetadataIndex object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateWithURL(CFURLRef url, CFErrorRef *error = nullptr);
+
+			/*! @brief Destroy the \c MetadataIndex */
+			~MetadataIndex();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			MetadataIndex(const MetadataIndex& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			MetadataIndex& operator=(const MetadataIndex& rhs) = delete;
+
+			/*! @endcond */
+
+			//@}
+
+
+			// ========================================
+			/*! @name Persistence */
+			//@{
+
+			/*!
+			 * @brief Write the index to a file
+			 * @note The file is replaced atomically
+			 * @param url The URL of the file
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool WriteToURL(CFURLRef url, CFErrorRef *error = nullptr) const;
+
+			//@}
+
+
+			// ========================================
+			/*! @name Queries */
+			//@{
+
+			/*! @brief Get the number of rows */
+			inline uint32_t GetRowCount() const						{ return mRowCount; }
+
+			/*!
+			 * @brief Find the rows satisfying a query
+			 * @param query The conditions to satisfy
+			 * @return The matching rows in ascending order
+			 */
+			std::vector<uint32_t> Find(const Query& query) const;
+
+			/*!
+			 * @brief Copy a row's value in a string column
+			 * @note The returned string must be released by the caller
+			 * @param row The row
+			 * @param column The column
+			 * @return The value, or \c nullptr if the row has none
+			 */
+			CFStringRef CopyString(uint32_t row, StringColumn column) const;
+
+			/*!
+			 * @brief Copy a row's URL
+			 * @note The returned URL must be released by the caller
+			 * @param row The row
+			 * @return The URL, or \c nullptr on failure
+			 */
+			CFURLRef CopyURL(uint32_t row) const;
+
+			/*!
+			 * @brief Get a row's value in a numeric column
+			 * @param row The row
+			 * @param column The column
+			 * @return The value, or \c NAN if the row has none
+			 */
+			double GetValue(uint32_t row, NumericColumn column) const;
+
+			//@}
+
+		private:
+
+			// Create an index over storage in the index's layout, which is unmapped or freed on destruction
+			MetadataIndex(const uint8_t *storage, size_t length, bool mapped);
+
+			// Validate the layout of the storage and set the column pointers
+			bool Load();
+
+			// The UTF-8 and folded UTF-8 bytes of a string
+			const char * GetStringBytes(uint32_t identifier, size_t& length) const;
+			const char * GetFoldedStringBytes(uint32_t identifier, size_t& length) const;
+
+			const uint8_t			*mStorage;			/*!< The index in its file layout */
+			size_t					mLength;			/*!< The length of mStorage */
+			bool					mMapped;			/*!< Whether mStorage is mapped */
+
+			uint32_t				mRowCount;
+			uint32_t				mStringCount;
+			const uint32_t			*mStringOffsets;	/*!< mStringCount + 1 offsets into mStringData */
+			const uint32_t			*mFoldedOffsets;	/*!< mStringCount + 1 offsets into mStringData */
+			const char				*mStringData;
+			const uint32_t			*mStringColumns;	/*!< String identifiers, column after column */
+			const float				*mNumericColumns;	/*!< Values, column after column */
+		};
+
+	}
+}
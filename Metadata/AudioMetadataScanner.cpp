@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <thread>
+
+#include <dispatch/dispatch.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
+#include <pthread/qos.h>
+#include <sys/stat.h>
+
+#include "AudioMetadataScanner.h"
+#include "Logger.h"
+
+namespace {
+
+	// ========================================
+	// Convert host time to seconds
+	double ConvertHostTimeToSeconds(uint64_t hostTime)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return ((hostTime * sTimebaseInfo.numer) / sTimebaseInfo.denom) / (double)NSEC_PER_SEC;
+	}
+
+}
+
+// ========================================
+// A file to be scanned and its position on disk
+struct SFB::Audio::MetadataScanner::ScanEntry
+{
+	CFURLRef		mURL;			// Owned by the array passed to Scan()
+	std::string		mDirectory;
+	std::string		mExtension;
+	ino_t			mInode;
+};
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::MetadataScanner::MetadataScanner(size_t threadCount)
+	: mThreadCount(threadCount), mScanning(false), mCancelled(false), mNextEntry(0), mFilesScanned(0), mStatistics(), mScanStartTime(0)
+{
+	// Reading metadata mostly waits on the disk, so more threads than cores keeps more requests outstanding
+	if(0 == mThreadCount)
+		mThreadCount = 2 * std::max(1u, std::thread::hardware_concurrency());
+}
+
+#pragma mark Scanning
+
+bool SFB::Audio::MetadataScanner::Scan(CFArrayRef urls, ResultBlock block, unsigned options)
+{
+	if(nullptr == urls || nullptr == block)
+		return false;
+
+	if(mScanning.exchange(true)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.MetadataScanner", "A scan is already in progress");
+		return false;
+	}
+
+	mCancelled.store(false);
+	mNextEntry.store(0);
+	mFilesScanned.store(0);
+
+	{
+		std::lock_guard<std::mutex> lock(mStatisticsMutex);
+		mStatistics = Statistics();
+		mScanStartTime = mach_absolute_time();
+	}
+
+	// ========================================
+	// Determine the location of each file, which is itself I/O so is performed concurrently
+	CFIndex count = CFArrayGetCount(urls);
+	std::vector<ScanEntry> entries((size_t)count);
+
+	auto entriesData = entries.data();
+	dispatch_apply((size_t)count, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(size_t i) {
+		auto& entry = entriesData[i];
+		entry.mURL = (CFURLRef)CFArrayGetValueAtIndex(urls, (CFIndex)i);
+		entry.mInode = 0;
+
+		UInt8 buf [PATH_MAX];
+		if(!CFURLGetFileSystemRepresentation(entry.mURL, FALSE, buf, PATH_MAX))
+			return;
+
+		std::string path((const char *)buf);
+
+		auto slash = path.find_last_of('/');
+		if(std::string::npos != slash)
+			entry.mDirectory = path.substr(0, slash);
+
+		auto dot = path.find_last_of('.');
+		if(std::string::npos != dot && (std::string::npos == slash || dot > slash)) {
+			entry.mExtension = path.substr(dot + 1);
+			std::transform(entry.mExtension.begin(), entry.mExtension.end(), entry.mExtension.begin(), [](unsigned char c) { return std::tolower(c); });
+		}
+
+		struct stat filestats;
+		if(0 == ::stat((const char *)buf, &filestats))
+			entry.mInode = filestats.st_ino;
+	});
+
+	std::sort(entries.begin(), entries.end(), [](const ScanEntry& lhs, const ScanEntry& rhs) {
+		int result = lhs.mDirectory.compare(rhs.mDirectory);
+		return 0 == result ? lhs.mInode < rhs.mInode : result < 0;
+	});
+
+	// ========================================
+	// Read the files, with each thread taking the next file in order
+	std::vector<std::thread> threads;
+	try {
+		for(size_t i = 0; i < std::min(mThreadCount, entries.size()); ++i)
+			threads.push_back(std::thread(&MetadataScanner::ScanThreadEntry, this, std::cref(entries), block, options));
+	}
+
+	catch(const std::exception& e) {
+		LOGGER_ERR("org.sbooth.AudioEngine.MetadataScanner", "Unable to create scanning thread: " << e.what());
+
+		// Any threads that were created finish the scan
+		if(threads.empty()) {
+			mScanning.store(false);
+			return false;
+		}
+	}
+
+	for(auto& thread : threads)
+		thread.join();
+
+	{
+		std::lock_guard<std::mutex> lock(mStatisticsMutex);
+		mStatistics.mElapsedTime = ConvertHostTimeToSeconds(mach_absolute_time() - mScanStartTime);
+		mStatistics.mThroughput = 0 < mStatistics.mElapsedTime ? mStatistics.mFileCount / mStatistics.mElapsedTime : 0;
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.MetadataScanner", "Scanned " << mFilesScanned.load() << " files in " << GetStatistics().mElapsedTime << " sec");
+
+	mScanning.store(false);
+
+	return !mCancelled.load() && mFilesScanned.load() == entries.size();
+}
+
+SFB::Audio::MetadataScanner::Statistics SFB::Audio::MetadataScanner::GetStatistics() const
+{
+	std::lock_guard<std::mutex> lock(mStatisticsMutex);
+
+	Statistics statistics = mStatistics;
+	if(mScanning.load() && 0 != mScanStartTime) {
+		statistics.mElapsedTime = ConvertHostTimeToSeconds(mach_absolute_time() - mScanStartTime);
+		statistics.mThroughput = 0 < statistics.mElapsedTime ? statistics.mFileCount / statistics.mElapsedTime : 0;
+	}
+
+	return statistics;
+}
+
+#pragma mark Thread Entry Point
+
+void SFB::Audio::MetadataScanner::ScanThreadEntry(const std::vector<ScanEntry>& entries, ResultBlock block, unsigned options)
+{
+	pthread_setname_np("org.sbooth.AudioEngine.MetadataScanner");
+
+	if(pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0))
+		LOGGER_WARNING("org.sbooth.AudioEngine.MetadataScanner", "Couldn't set scanning thread QoS class");
+
+	while(!mCancelled.load()) {
+		auto index = mNextEntry.fetch_add(1);
+		if(index >= entries.size())
+			break;
+
+		const auto& entry = entries[index];
+
+		// CreateMetadataForURL() reads the metadata
+		CFErrorRef error = nullptr;
+		auto start = mach_absolute_time();
+		auto metadata = Metadata::CreateMetadataForURL(entry.mURL, options, &error);
+		double elapsed = ConvertHostTimeToSeconds(mach_absolute_time() - start);
+
+		{
+			std::lock_guard<std::mutex> lock(mStatisticsMutex);
+
+			auto& formatStatistics = mStatistics.mFormatStatistics[entry.mExtension];
+			++formatStatistics.mFileCount;
+			formatStatistics.mTotalTime += elapsed;
+			formatStatistics.mMaximumTime = std::max(formatStatistics.mMaximumTime, elapsed);
+
+			++mStatistics.mFileCount;
+
+			if(!metadata) {
+				++formatStatistics.mFailureCount;
+				++mStatistics.mFailureCount;
+			}
+		}
+
+		block(entry.mURL, metadata, error);
+
+		if(error)
+			CFRelease(error);
+
+		mFilesScanned.fetch_add(1);
+	}
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "AudioMetadata.h"
+
+/*! @file AudioMetadataScanner.h @brief Parallel metadata reading for many files */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief Reads metadata for many files using a pool of threads
+		 *
+		 * Files are ordered by directory and inode before reading so each thread's accesses are close together on disk,
+		 * and are read concurrently so the number of outstanding disk requests scales with the thread count.
+		 */
+		class MetadataScanner
+		{
+		public:
+
+			/*!
+			 * @brief A block called with the result of reading a file's metadata
+			 * @note This block is called on the scanning threads, and may be called concurrently
+			 * @param url The URL of the file
+			 * @param metadata The file's metadata, or \c nullptr on failure.  Ownership may be taken by moving from \c metadata.
+			 * @param error Error information if the metadata couldn't be read, or \c nullptr.  The error is released when the block returns.
+			 */
+			using ResultBlock = void (^)(CFURLRef url, Metadata::unique_ptr& metadata, CFErrorRef error);
+
+			/*! @brief Timing information for files of a single format */
+			struct FormatStatistics {
+				uint64_t	mFileCount;			/*!< The number of files read */
+				uint64_t	mFailureCount;		/*!< The number of files whose metadata couldn't be read */
+				double		mTotalTime;			/*!< The total time spent reading, in seconds */
+				double		mMaximumTime;		/*!< The longest time spent reading a single file, in seconds */
+			};
+
+			/*! @brief Scan statistics */
+			struct Statistics {
+				uint64_t	mFileCount;			/*!< The number of files read */
+				uint64_t	mFailureCount;		/*!< The number of files whose metadata couldn't be read */
+				double		mElapsedTime;		/*!< The duration of the scan, in seconds */
+				double		mThroughput;		/*!< The number of files read per second */
+
+				/*! @brief Statistics keyed by lowercase path extension */
+				std::unordered_map<std::string, FormatStatistics> mFormatStatistics;
+			};
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*!
+			 * @brief Create a new \c MetadataScanner
+			 * @param threadCount The number of files read concurrently, or \c 0 for two per processor core
+			 */
+			explicit MetadataScanner(size_t threadCount = 0);
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			MetadataScanner(const MetadataScanner& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			MetadataScanner& operator=(const MetadataScanner& rhs) = delete;
+
+			/*! @endcond */
+
+			//@}
+
+
+			// ========================================
+			/*! @name Scanning */
+			//@{
+
+			/*!
+			 * @brief Read the metadata for the specified files
+			 * @note This method blocks until all files have been read or the scan is cancelled.  Only one scan may be in progress at a time.
+			 * @param urls A \c CFArray of \c CFURL objects
+			 * @param block The block to receive each file's metadata
+			 * @param options The metadata to read, a combination of \c Metadata::ReadOptions
+			 * @return \c true if all files were scanned, \c false if the scan couldn't be started or was cancelled
+			 */
+			bool Scan(CFArrayRef urls, ResultBlock block, unsigned options = Metadata::ReadAll);
+
+			/*! @brief Stop the current scan after the files being read have finished */
+			inline void Cancel()									{ mCancelled.store(true); }
+
+			/*! @brief Get the number of files read by the current or most recent scan */
+			inline uint64_t GetFilesScanned() const				{ return mFilesScanned.load(); }
+
+			/*! @brief Get the statistics for the current or most recent scan */
+			Statistics GetStatistics() const;
+
+			//@}
+
+			/*! @brief Get the number of files read concurrently */
+			inline size_t GetThreadCount() const					{ return mThreadCount; }
+
+		private:
+
+			struct ScanEntry;
+
+			void ScanThreadEntry(const std::vector<ScanEntry>& entries, ResultBlock block, unsigned options);
+
+			size_t									mThreadCount;
+			std::atomic_bool						mScanning;
+			std::atomic_bool						mCancelled;
+			std::atomic_size_t						mNextEntry;
+			std::atomic_ullong						mFilesScanned;
+
+			Statistics								mStatistics;
+			mutable std::mutex						mStatisticsMutex;
+			uint64_t								mScanStartTime;
+		};
+
+	}
+}
@@ -3,60 +3,293 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
-#include <Security/Security.h>
+#if __SSSE3__
+# include <tmmintrin.h>
+#elif __ARM_NEON
+# include <arm_neon.h>
+#endif
 
 #include "Base64Utilities.h"
-#include "CFWrapper.h"
-#include "Logger.h"
 
-TagLib::ByteVector TagLib::DecodeBase64(const TagLib::ByteVector& input)
-{
-	SFB::CFError error;
-	SFB::SecTransform decoder(SecDecodeTransformCreate(kSecBase64Encoding, &error));
-    if(!decoder) {
-		LOGGER_WARNING("org.sbooth.AudioEngine", "SecDecodeTransformCreate failed: " << error);
-		return {};
+namespace {
+
+	const char sEncodeTable [] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	// Values of sDecodeTable that aren't sextets
+	const uint8_t kInvalid = 0xFF;
+	const uint8_t kWhitespace = 0xFE;
+	const uint8_t kPadding = 0xFD;
+
+	struct DecodeTable
+	{
+		DecodeTable()
+		{
+			for(auto& value : mValues)
+				value = kInvalid;
+			for(uint8_t i = 0; i < 64; ++i)
+				mValues[(uint8_t)sEncodeTable[i]] = i;
+			mValues[(uint8_t)' '] = mValues[(uint8_t)'\t'] = mValues[(uint8_t)'\r'] = mValues[(uint8_t)'\n'] = kWhitespace;
+			mValues[(uint8_t)'='] = kPadding;
+		}
+
+		uint8_t mValues [256];
+	};
+
+	const DecodeTable sDecodeTable;
+
+#if __SSSE3__
+
+	// ========================================
+	// SSSE3 base 64 using the techniques described by Wojciech Muła
+	// See http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html and http://0x80.pl/notesen/2016-01-17-sse-base64-decoding.html
+
+	// Encode 12 bytes from input as 16 characters; 16 bytes are read
+	inline void EncodeBlock(const uint8_t *input, char *output)
+	{
+		__m128i in = _mm_loadu_si128((const __m128i *)input);
+
+		// Arrange each group of three bytes so its sextets can be isolated within 32-bit lanes
+		in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+
+		const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+		const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+		const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+		const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+		const __m128i indices = _mm_or_si128(t1, t3);
+
+		// Translate sextets to characters by adding the offset for each range
+		__m128i reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+		const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+		reduced = _mm_or_si128(reduced, _mm_and_si128(less, _mm_set1_epi8(13)));
+
+		const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+											  '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+		const __m128i result = _mm_add_epi8(_mm_shuffle_epi8(offsets, reduced), indices);
+
+		_mm_storeu_si128((__m128i *)output, result);
 	}
 
-	SFB::CFData sourceData(CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, (const UInt8 *)input.data(), (CFIndex)input.size(), kCFAllocatorNull));
-	if(!sourceData)
-		return {};
+	// Decode 16 characters from input as 12 bytes; 16 bytes are written
+	// Returns false if any character isn't in the base 64 alphabet
+	inline bool DecodeBlock(const char *input, uint8_t *output)
+	{
+		const __m128i in = _mm_loadu_si128((const __m128i *)input);
 
-    if(!SecTransformSetAttribute(decoder, kSecTransformInputAttributeName, sourceData, &error)) {
-		LOGGER_WARNING("org.sbooth.AudioEngine", "SecTransformSetAttribute failed: " << error);
-		return {};
+		// Classify each character by its nibbles; a character is valid if its nibble classes are disjoint
+		const __m128i highNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+		const __m128i lowNibbles = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+
+		const __m128i lowClasses = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+												 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+		const __m128i highClasses = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+												  0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+
+		const __m128i lo = _mm_shuffle_epi8(lowClasses, lowNibbles);
+		const __m128i hi = _mm_shuffle_epi8(highClasses, highNibbles);
+		if(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())))
+			return false;
+
+		// Translate characters to sextets by adding the offset for each range
+		const __m128i isSlash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+		const __m128i offsets = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+		const __m128i values = _mm_add_epi8(in, _mm_shuffle_epi8(offsets, _mm_add_epi8(isSlash, highNibbles)));
+
+		// Pack four sextets into three bytes in each 32-bit lane
+		const __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+		const __m128i groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+		const __m128i result = _mm_shuffle_epi8(groups, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+		_mm_storeu_si128((__m128i *)output, result);
+		return true;
 	}
 
-	SFB::CFData decodedData((CFDataRef)SecTransformExecute(decoder, &error));
-	if(!decodedData)
-		return {};
+	const size_t kEncodeBlockBytes = 12;
+	const size_t kEncodeBlockReadBytes = 16;
+	const size_t kDecodeBlockCharacters = 16;
+	const size_t kDecodeBlockWriteBytes = 16;
+
+#elif __ARM_NEON
+
+	// ========================================
+	// NEON base 64 using structured loads and stores to separate the sextets of each group
+
+	// Encode 48 bytes from input as 64 characters
+	inline void EncodeBlock(const uint8_t *input, char *output)
+	{
+		const uint8x16x3_t in = vld3q_u8(input);
+
+		uint8x16x4_t sextets;
+		sextets.val[0] = vshrq_n_u8(in.val[0], 2);
+		sextets.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), vdupq_n_u8(0x3f));
+		sextets.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), vdupq_n_u8(0x3f));
+		sextets.val[3] = vandq_u8(in.val[2], vdupq_n_u8(0x3f));
+
+		const uint8x16x4_t table = vld1q_u8_x4((const uint8_t *)sEncodeTable);
+
+		uint8x16x4_t result;
+		for(int i = 0; i < 4; ++i)
+			result.val[i] = vqtbl4q_u8(table, sextets.val[i]);
+
+		vst4q_u8((uint8_t *)output, result);
+	}
+
+	// Translate 16 characters to sextets, accumulating invalid characters in invalid
+	inline uint8x16_t DecodeCharacters(uint8x16_t c, uint8x16_t& invalid)
+	{
+		const uint8x16_t upper = vsubq_u8(c, vdupq_n_u8('A'));
+		const uint8x16_t lower = vsubq_u8(c, vdupq_n_u8('a'));
+		const uint8x16_t digit = vsubq_u8(c, vdupq_n_u8('0'));
+
+		const uint8x16_t isUpper = vcltq_u8(upper, vdupq_n_u8(26));
+		const uint8x16_t isLower = vcltq_u8(lower, vdupq_n_u8(26));
+		const uint8x16_t isDigit = vcltq_u8(digit, vdupq_n_u8(10));
+		const uint8x16_t isPlus = vceqq_u8(c, vdupq_n_u8('+'));
+		const uint8x16_t isSlash = vceqq_u8(c, vdupq_n_u8('/'));
+
+		uint8x16_t value = vandq_u8(isUpper, upper);
+		value = vorrq_u8(value, vandq_u8(isLower, vaddq_u8(lower, vdupq_n_u8(26))));
+		value = vorrq_u8(value, vandq_u8(isDigit, vaddq_u8(digit, vdupq_n_u8(52))));
+		value = vorrq_u8(value, vandq_u8(isPlus, vdupq_n_u8(62)));
+		value = vorrq_u8(value, vandq_u8(isSlash, vdupq_n_u8(63)));
+
+		const uint8x16_t valid = vorrq_u8(vorrq_u8(vorrq_u8(isUpper, isLower), vorrq_u8(isDigit, isPlus)), isSlash);
+		invalid = vorrq_u8(invalid, vmvnq_u8(valid));
+
+		return value;
+	}
+
+	// Decode 64 characters from input as 48 bytes
+	// Returns false if any character isn't in the base 64 alphabet
+	inline bool DecodeBlock(const char *input, uint8_t *output)
+	{
+		const uint8x16x4_t in = vld4q_u8((const uint8_t *)input);
+
+		uint8x16_t invalid = vdupq_n_u8(0);
+		const uint8x16_t a = DecodeCharacters(in.val[0], invalid);
+		const uint8x16_t b = DecodeCharacters(in.val[1], invalid);
+		const uint8x16_t c = DecodeCharacters(in.val[2], invalid);
+		const uint8x16_t d = DecodeCharacters(in.val[3], invalid);
+
+		if(vmaxvq_u8(invalid))
+			return false;
+
+		uint8x16x3_t result;
+		result.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+		result.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+		result.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+
+		vst3q_u8(output, result);
+		return true;
+	}
+
+	const size_t kEncodeBlockBytes = 48;
+	const size_t kEncodeBlockReadBytes = 48;
+	const size_t kDecodeBlockCharacters = 64;
+	const size_t kDecodeBlockWriteBytes = 48;
+
+#endif
 
-	return {(const char *)CFDataGetBytePtr((CFDataRef)decodedData), (size_t)CFDataGetLength((CFDataRef)decodedData)};
 }
 
-TagLib::ByteVector TagLib::EncodeBase64(const TagLib::ByteVector& input)
+void SFB::EncodeBase64(const uint8_t *input, size_t length, char *output)
 {
-	SFB::CFError error;
-	SFB::SecTransform encoder(SecEncodeTransformCreate(kSecBase64Encoding, &error));
-    if(!encoder) {
-		LOGGER_WARNING("org.sbooth.AudioEngine", "SecEncodeTransformCreate failed: " << error);
-		return {};
+	size_t i = 0;
+
+#if __SSSE3__ || __ARM_NEON
+	while(length - i >= kEncodeBlockReadBytes) {
+		EncodeBlock(input + i, output);
+		i += kEncodeBlockBytes;
+		output += (kEncodeBlockBytes / 3) * 4;
 	}
+#endif
 
-	SFB::CFData sourceData(CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, (const UInt8 *)input.data(), (CFIndex)input.size(), kCFAllocatorNull));
-	if(!sourceData)
-		return {};
+	for(; length - i >= 3; i += 3) {
+		uint32_t group = ((uint32_t)input[i] << 16) | ((uint32_t)input[i + 1] << 8) | input[i + 2];
+		*output++ = sEncodeTable[(group >> 18) & 0x3f];
+		*output++ = sEncodeTable[(group >> 12) & 0x3f];
+		*output++ = sEncodeTable[(group >> 6) & 0x3f];
+		*output++ = sEncodeTable[group & 0x3f];
+	}
 
-    if(!SecTransformSetAttribute(encoder, kSecTransformInputAttributeName, sourceData, &error)) {
-		LOGGER_WARNING("org.sbooth.AudioEngine", "SecTransformSetAttribute failed: " << error);
-		return {};
+	if(length - i == 2) {
+		uint32_t group = ((uint32_t)input[i] << 16) | ((uint32_t)input[i + 1] << 8);
+		*output++ = sEncodeTable[(group >> 18) & 0x3f];
+		*output++ = sEncodeTable[(group >> 12) & 0x3f];
+		*output++ = sEncodeTable[(group >> 6) & 0x3f];
+		*output++ = '=';
+	}
+	else if(length - i == 1) {
+		uint32_t group = (uint32_t)input[i] << 16;
+		*output++ = sEncodeTable[(group >> 18) & 0x3f];
+		*output++ = sEncodeTable[(group >> 12) & 0x3f];
+		*output++ = '=';
+		*output++ = '=';
 	}
+}
 
-	SFB::CFData encodedData((CFDataRef)SecTransformExecute(encoder, &error));
-	if(!encodedData) {
-		LOGGER_WARNING("org.sbooth.AudioEngine", "SecTransformExecute failed: " << error);
-		return {};
+bool SFB::DecodeBase64(const char *input, size_t length, uint8_t *output, size_t capacity, size_t& bytesDecoded)
+{
+	size_t i = 0;
+	size_t o = 0;
+
+#if __SSSE3__ || __ARM_NEON
+	// Blocks containing whitespace, padding, or invalid characters are handled below
+	while(length - i >= kDecodeBlockCharacters && capacity - o >= kDecodeBlockWriteBytes && DecodeBlock(input + i, output + o)) {
+		i += kDecodeBlockCharacters;
+		o += (kDecodeBlockCharacters / 4) * 3;
+	}
+#endif
+
+	uint32_t group = 0;
+	unsigned sextets = 0;
+	for(; i < length && o < capacity; ++i) {
+		auto value = sDecodeTable.mValues[(uint8_t)input[i]];
+		if(kWhitespace == value)
+			continue;
+		else if(kPadding == value)
+			break;
+		else if(kInvalid == value)
+			return false;
+
+		group = (group << 6) | value;
+		if(4 == ++sextets) {
+			output[o++] = (uint8_t)(group >> 16);
+			if(o < capacity)
+				output[o++] = (uint8_t)(group >> 8);
+			if(o < capacity)
+				output[o++] = (uint8_t)group;
+			group = 0;
+			sextets = 0;
+		}
 	}
 
-	return {(const char *)CFDataGetBytePtr((CFDataRef)encodedData), (size_t)CFDataGetLength((CFDataRef)encodedData)};
+	// A partial group of two or three sextets holds one or two bytes
+	if(2 <= sextets && o < capacity) {
+		group <<= 6 * (4 - sextets);
+		output[o++] = (uint8_t)(group >> 16);
+		if(3 == sextets && o < capacity)
+			output[o++] = (uint8_t)(group >> 8);
+	}
+
+	bytesDecoded = o;
+	return true;
+}
+
+TagLib::ByteVector TagLib::DecodeBase64(const TagLib::ByteVector& input)
+{
+	TagLib::ByteVector output((unsigned int)SFB::Base64MaximumDecodedLength(input.size()), '\0');
+
+	size_t bytesDecoded;
+	if(!SFB::DecodeBase64(input.data(), input.size(), (uint8_t *)output.data(), output.size(), bytesDecoded))
+		return {};
+
+	output.resize((unsigned int)bytesDecoded);
+	return output;
+}
+
+TagLib::ByteVector TagLib::EncodeBase64(const TagLib::ByteVector& input)
+{
+	TagLib::ByteVector output((unsigned int)SFB::Base64EncodedLength(input.size()), '\0');
+	SFB::EncodeBase64((const uint8_t *)input.data(), input.size(), output.data());
+	return output;
 }
@@ -5,10 +5,45 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #include <taglib/tbytevector.h>
 
 /*! @file Base64Utilities.h @brief Base 64 conversion methods */
 
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief Get the number of characters required to encode \c length bytes in base 64, including padding */
+	inline size_t Base64EncodedLength(size_t length)			{ return ((length + 2) / 3) * 4; }
+
+	/*! @brief Get the maximum number of bytes decoded from \c length base 64 characters */
+	inline size_t Base64MaximumDecodedLength(size_t length)	{ return ((length + 3) / 4) * 3; }
+
+	/*!
+	 * @brief Encode bytes in base 64 with padding
+	 * @param input The bytes to encode
+	 * @param length The number of bytes in \c input
+	 * @param output A buffer to receive \c Base64EncodedLength(length) characters
+	 */
+	void EncodeBase64(const uint8_t *input, size_t length, char *output);
+
+	/*!
+	 * @brief Decode base 64 characters
+	 *
+	 * Whitespace is ignored, and decoding stops at padding, at the end of \c input, or when \c output is full.
+	 * @param input The characters to decode
+	 * @param length The number of characters in \c input
+	 * @param output A buffer to receive the decoded bytes
+	 * @param capacity The size of \c output in bytes
+	 * @param bytesDecoded The number of bytes written to \c output
+	 * @return \c true on success, \c false if \c input contains invalid characters
+	 */
+	bool DecodeBase64(const char *input, size_t length, uint8_t *output, size_t capacity, size_t& bytesDecoded);
+
+}
+
 /*! @brief \c Taglib's encompassing namespace */
 namespace TagLib {
 
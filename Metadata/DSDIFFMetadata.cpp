@@ -9,6 +9,7 @@
 #include <taglib/dsdifffile.h>
 
 #include "DSDIFFMetadata.h"
+#include "AudioFormat.h"
 #include "CFWrapper.h"
 #include "CFErrorUtilities.h"
 #include "AddTagToDictionary.h"
@@ -65,6 +66,15 @@ bool SFB::Audio::DSDIFFMetadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::DSDIFFMetadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+	return 16 <= length && 0 == memcmp(bytes, "FRM8", 4) && 0 == memcmp(bytes + 12, "DSD ", 4);
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::DSDIFFMetadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new DSDIFFMetadata(url));
@@ -80,12 +90,8 @@ SFB::Audio::DSDIFFMetadata::DSDIFFMetadata(CFURLRef url)
 
 bool SFB::Audio::DSDIFFMetadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -97,7 +103,7 @@ bool SFB::Audio::DSDIFFMetadata::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::DSDIFF::File file(stream.get());
+	TagLib::DSDIFF::File file(stream.get(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid DSDIFF file."), ""));
@@ -111,6 +117,7 @@ bool SFB::Audio::DSDIFFMetadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("DSD Interchange File"));
+	AddIntToDictionary(mMetadata, kFormatIDKey, (int)kAudioFormatDirectStreamDigital);
 
 	if(file.audioProperties()) {
 		auto properties = file.audioProperties();
@@ -122,11 +129,11 @@ bool SFB::Audio::DSDIFFMetadata::_ReadMetadata(CFErrorRef *error)
 			AddLongLongToDictionary(mMetadata, kTotalFramesKey, properties->sampleCount());
 	}
 
-	if(file.hasDIINTag())
+	if(ShouldReadTags() && file.hasDIINTag())
 		AddTagToDictionary(mMetadata, file.DIINTag());
 
-	if(file.hasID3v2Tag())
-		AddID3v2TagToDictionary(mMetadata, mPictures, file.ID3v2Tag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.hasID3v2Tag())
+		AddID3v2TagToDictionary(mMetadata, mPictures, file.ID3v2Tag(), ShouldReadAttachedPictures());
 
 	return true;
 }
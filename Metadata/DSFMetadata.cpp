@@ -9,6 +9,7 @@
 #include <taglib/dsffile.h>
 
 #include "DSFMetadata.h"
+#include "AudioFormat.h"
 #include "CFWrapper.h"
 #include "CFErrorUtilities.h"
 #include "AddID3v2TagToDictionary.h"
@@ -62,6 +63,15 @@ bool SFB::Audio::DSFMetadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::DSFMetadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+	return 32 <= length && 0 == memcmp(bytes, "DSD ", 4) && 0 == memcmp(bytes + 28, "fmt ", 4);
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::DSFMetadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new DSFMetadata(url));
@@ -77,12 +87,8 @@ SFB::Audio::DSFMetadata::DSFMetadata(CFURLRef url)
 
 bool SFB::Audio::DSFMetadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -94,7 +100,7 @@ bool SFB::Audio::DSFMetadata::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::DSF::File file(stream.get());
+	TagLib::DSF::File file(stream.get(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid DSF file."), ""));
@@ -108,6 +114,7 @@ bool SFB::Audio::DSFMetadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("DSD Stream File"));
+	AddIntToDictionary(mMetadata, kFormatIDKey, (int)kAudioFormatDirectStreamDigital);
 
 	if(file.audioProperties()) {
 		auto properties = file.audioProperties();
@@ -119,8 +126,8 @@ bool SFB::Audio::DSFMetadata::_ReadMetadata(CFErrorRef *error)
 			AddLongLongToDictionary(mMetadata, kTotalFramesKey, properties->sampleCount());
 	}
 
-	if(file.tag())
-		AddID3v2TagToDictionary(mMetadata, mPictures, file.tag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.tag())
+		AddID3v2TagToDictionary(mMetadata, mPictures, file.tag(), ShouldReadAttachedPictures());
 
 	return true;
 }
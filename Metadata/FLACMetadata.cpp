@@ -9,6 +9,8 @@
 #include <taglib/flacfile.h>
 #include <taglib/flacproperties.h>
 #include <taglib/id3v2framefactory.h>
+#include <taglib/id3v2header.h>
+#include <taglib/id3v2tag.h>
 
 #include <ApplicationServices/ApplicationServices.h>
 
@@ -34,6 +36,136 @@ namespace {
 		SFB::Audio::Metadata::RegisterSubclass<SFB::Audio::FLACMetadata>();
 	}
 
+	// ========================================
+	// Open a file for writing its metadata
+	bool OpenFLACFile(CFURLRef url, bool readOnly, std::unique_ptr<TagLib::FileStream>& stream, std::unique_ptr<TagLib::FLAC::File>& file, CFErrorRef *error)
+	{
+		UInt8 buf [PATH_MAX];
+		if(!CFURLGetFileSystemRepresentation(url, false, buf, PATH_MAX))
+			return false;
+
+		stream.reset(new TagLib::FileStream((const char *)buf, readOnly));
+		if(!stream->isOpen()) {
+			if(error) {
+				SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for writing."), ""));
+				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
+				SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file may have been renamed, moved, deleted, or you may not have appropriate permissions."), ""));
+
+				*error = SFB::CreateErrorForURL(SFB::Audio::Metadata::ErrorDomain, SFB::Audio::Metadata::InputOutputError, description, url, failureReason, recoverySuggestion);
+			}
+
+			return false;
+		}
+
+		file.reset(new TagLib::FLAC::File(stream.get(), false, TagLib::AudioProperties::Average, TagLib::ID3v2::FrameFactory::instance()));
+		if(!file->isValid()) {
+			if(error) {
+				SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid FLAC file."), ""));
+				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not a FLAC file"), ""));
+				SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
+
+				*error = SFB::CreateErrorForURL(SFB::Audio::Metadata::ErrorDomain, SFB::Audio::Metadata::InputOutputError, description, url, failureReason, recoverySuggestion);
+			}
+
+			return false;
+		}
+
+		return true;
+	}
+
+	// ========================================
+	// Apply the metadata to a file without saving it
+	void SetFLACFileFromMetadata(const SFB::Audio::Metadata& metadata, TagLib::FLAC::File& file)
+	{
+		// ID3v1 and ID3v2 tags are only written if present, but a Xiph comment is always written
+
+		if(file.ID3v1Tag())
+			SetID3v1TagFromMetadata(metadata, file.ID3v1Tag());
+
+		if(file.ID3v2Tag())
+			SetID3v2TagFromMetadata(metadata, file.ID3v2Tag());
+
+		SetXiphCommentFromMetadata(metadata, file.xiphComment(true), false);
+
+		// Remove existing cover art
+		file.removePictures();
+
+		// Add album art
+		for(auto attachedPicture : metadata.GetAttachedPictures()) {
+
+			SFB::CGImageSource imageSource(CGImageSourceCreateWithData(attachedPicture->GetData(), nullptr));
+			if(!imageSource) {
+				LOGGER_ERR("org.sbooth.AudioEngine.AudioMetadata.FLAC", "Skipping album art (unable to create image)");
+				continue;
+			}
+
+			TagLib::FLAC::Picture *picture = new TagLib::FLAC::Picture;
+			picture->setData(TagLib::ByteVector((const char *)CFDataGetBytePtr(attachedPicture->GetData()), (size_t)CFDataGetLength(attachedPicture->GetData())));
+			picture->setType((TagLib::FLAC::Picture::Type)attachedPicture->GetType());
+			if(attachedPicture->GetDescription())
+				picture->setDescription(TagLib::StringFromCFString(attachedPicture->GetDescription()));
+
+			// Convert the image's UTI into a MIME type
+			SFB::CFString mimeType(UTTypeCopyPreferredTagWithClass(CGImageSourceGetType(imageSource), kUTTagClassMIMEType));
+			if(mimeType)
+				picture->setMimeType(TagLib::StringFromCFString(mimeType));
+
+			// Flesh out the height, width, and depth
+			SFB::CFDictionary imagePropertiesDictionary(CGImageSourceCopyPropertiesAtIndex(imageSource, 0, nullptr));
+			if(imagePropertiesDictionary) {
+				CFNumberRef imageWidth = (CFNumberRef)CFDictionaryGetValue(imagePropertiesDictionary, kCGImagePropertyPixelWidth);
+				CFNumberRef imageHeight = (CFNumberRef)CFDictionaryGetValue(imagePropertiesDictionary, kCGImagePropertyPixelHeight);
+				CFNumberRef imageDepth = (CFNumberRef)CFDictionaryGetValue(imagePropertiesDictionary, kCGImagePropertyDepth);
+
+				int height, width, depth;
+
+				// Ignore numeric conversion errors
+				CFNumberGetValue(imageWidth, kCFNumberIntType, &width);
+				CFNumberGetValue(imageHeight, kCFNumberIntType, &height);
+				CFNumberGetValue(imageDepth, kCFNumberIntType, &depth);
+
+				picture->setHeight(height);
+				picture->setWidth(width);
+				picture->setColorDepth(depth);
+			}
+
+			file.addPicture(picture);
+		}
+	}
+
+	// ========================================
+	// Sum the sizes, including headers, of the metadata blocks TagLib replaces when saving
+	// These are the Vorbis comment, picture, and padding blocks
+	bool GetReplaceableMetadataBlockSize(TagLib::FLAC::File& file, long long& size)
+	{
+		long offset = file.find("fLaC");
+		if(0 > offset)
+			return false;
+
+		offset += 4;
+		size = 0;
+
+		for(;;) {
+			file.seek(offset);
+			auto header = file.readBlock(4);
+			if(4 != header.size())
+				return false;
+
+			bool isLastBlock = 0x80 & header[0];
+			auto blockType = 0x7f & header[0];
+			auto blockLength = header.toUInt(1, 3, true);
+
+			// PADDING, VORBIS_COMMENT, and PICTURE
+			if(1 == blockType || 4 == blockType || 6 == blockType)
+				size += 4 + blockLength;
+
+			offset += 4 + (long)blockLength;
+
+			if(isLastBlock)
+				return true;
+		}
+	}
+
 }
 
 #pragma mark Static Methods
@@ -72,6 +204,14 @@ bool SFB::Audio::FLACMetadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::FLACMetadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	return 4 <= length && 0 == memcmp(header, "fLaC", 4);
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::FLACMetadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new FLACMetadata(url));
@@ -87,12 +227,8 @@ SFB::Audio::FLACMetadata::FLACMetadata(CFURLRef url)
 
 bool SFB::Audio::FLACMetadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -104,7 +240,7 @@ bool SFB::Audio::FLACMetadata::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::FLAC::File file(stream.get(), TagLib::ID3v2::FrameFactory::instance());
+	TagLib::FLAC::File file(stream.get(), TagLib::ID3v2::FrameFactory::instance(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(nullptr != error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid FLAC file."), ""));
@@ -118,6 +254,7 @@ bool SFB::Audio::FLACMetadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("FLAC"));
+	AddIntToDictionary(mMetadata, kFormatIDKey, (int)'FLAC');
 
 	if(file.audioProperties()) {
 		auto properties = file.audioProperties();
@@ -130,24 +267,26 @@ bool SFB::Audio::FLACMetadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	// Add all tags that are present
-	if(file.ID3v1Tag())
+	if(ShouldReadTags() && file.ID3v1Tag())
 		AddID3v1TagToDictionary(mMetadata, file.ID3v1Tag());
 
-	if(file.ID3v2Tag())
-		AddID3v2TagToDictionary(mMetadata, mPictures, file.ID3v2Tag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.ID3v2Tag())
+		AddID3v2TagToDictionary(mMetadata, mPictures, file.ID3v2Tag(), ShouldReadAttachedPictures());
 
-	if(file.xiphComment())
-		AddXiphCommentToDictionary(mMetadata, mPictures, file.xiphComment());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.xiphComment())
+		AddXiphCommentToDictionary(mMetadata, mPictures, file.xiphComment(), ShouldReadAttachedPictures());
 
 	// Add album art
-	for(auto iter : file.pictureList()) {
-		SFB::CFData data((const UInt8 *)iter->data().data(), (CFIndex)iter->data().size());
+	if(ShouldReadAttachedPictures()) {
+		for(auto iter : file.pictureList()) {
+			SFB::CFData data((const UInt8 *)iter->data().data(), (CFIndex)iter->data().size());
 
-		SFB::CFString description;
-		if(!iter->description().isEmpty())
-			description = CFString(iter->description().toCString(true), kCFStringEncodingUTF8);
+			SFB::CFString description;
+			if(!iter->description().isEmpty())
+				description = TagLib::CFStringCreateFromString(iter->description());
 
-		mPictures.push_back(std::make_shared<AttachedPicture>(data, (AttachedPicture::Type)iter->type(), description));
+			mPictures.push_back(std::make_shared<AttachedPicture>(data, (AttachedPicture::Type)iter->type(), description));
+		}
 	}
 
 	return true;
@@ -155,28 +294,17 @@ bool SFB::Audio::FLACMetadata::_ReadMetadata(CFErrorRef *error)
 
 bool SFB::Audio::FLACMetadata::_WriteMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
+	std::unique_ptr<TagLib::FileStream> stream;
+	std::unique_ptr<TagLib::FLAC::File> file;
+	if(!OpenFLACFile(mURL, false, stream, file, error))
 		return false;
 
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf));
-	if(!stream->isOpen()) {
-		if(error) {
-			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for writing."), ""));
-			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
-			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file may have been renamed, moved, deleted, or you may not have appropriate permissions."), ""));
+	SetFLACFileFromMetadata(*this, *file);
 
-			*error = CreateErrorForURL(Metadata::ErrorDomain, Metadata::InputOutputError, description, mURL, failureReason, recoverySuggestion);
-		}
-
-		return false;
-	}
-
-	TagLib::FLAC::File file(stream.get(), false, TagLib::AudioProperties::Average, TagLib::ID3v2::FrameFactory::instance());
-	if(!file.isValid()) {
+	if(!file->save()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid FLAC file."), ""));
-			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not a FLAC file"), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Unable to write metadata"), ""));
 			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
 
 			*error = CreateErrorForURL(Metadata::ErrorDomain, Metadata::InputOutputError, description, mURL, failureReason, recoverySuggestion);
@@ -185,72 +313,34 @@ bool SFB::Audio::FLACMetadata::_WriteMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	// ID3v1 and ID3v2 tags are only written if present, but a Xiph comment is always written
-
-	if(file.ID3v1Tag())
-		SetID3v1TagFromMetadata(*this, file.ID3v1Tag());
-
-	if(file.ID3v2Tag())
-		SetID3v2TagFromMetadata(*this, file.ID3v2Tag());
-
-	SetXiphCommentFromMetadata(*this, file.xiphComment(true), false);
-
-	// Remove existing cover art
-	file.removePictures();
-
-	// Add album art
-	for(auto attachedPicture : GetAttachedPictures()) {
-
-		SFB::CGImageSource imageSource(CGImageSourceCreateWithData(attachedPicture->GetData(), nullptr));
-		if(!imageSource) {
-			LOGGER_ERR("org.sbooth.AudioEngine.AudioMetadata.FLAC", "Skipping album art (unable to create image)");
-			continue;
-		}
+	return true;
+}
 
-		TagLib::FLAC::Picture *picture = new TagLib::FLAC::Picture;
-		picture->setData(TagLib::ByteVector((const char *)CFDataGetBytePtr(attachedPicture->GetData()), (size_t)CFDataGetLength(attachedPicture->GetData())));
-		picture->setType((TagLib::FLAC::Picture::Type)attachedPicture->GetType());
-		if(attachedPicture->GetDescription())
-			picture->setDescription(TagLib::StringFromCFString(attachedPicture->GetDescription()));
-
-		// Convert the image's UTI into a MIME type
-		SFB::CFString mimeType(UTTypeCopyPreferredTagWithClass(CGImageSourceGetType(imageSource), kUTTagClassMIMEType));
-		if(mimeType)
-			picture->setMimeType(TagLib::StringFromCFString(mimeType));
-
-		// Flesh out the height, width, and depth
-		SFB::CFDictionary imagePropertiesDictionary(CGImageSourceCopyPropertiesAtIndex(imageSource, 0, nullptr));
-		if(imagePropertiesDictionary) {
-			CFNumberRef imageWidth = (CFNumberRef)CFDictionaryGetValue(imagePropertiesDictionary, kCGImagePropertyPixelWidth);
-			CFNumberRef imageHeight = (CFNumberRef)CFDictionaryGetValue(imagePropertiesDictionary, kCGImagePropertyPixelHeight);
-			CFNumberRef imageDepth = (CFNumberRef)CFDictionaryGetValue(imagePropertiesDictionary, kCGImagePropertyDepth);
-
-			int height, width, depth;
-
-			// Ignore numeric conversion errors
-			CFNumberGetValue(imageWidth, kCFNumberIntType, &width);
-			CFNumberGetValue(imageHeight, kCFNumberIntType, &height);
-			CFNumberGetValue(imageDepth, kCFNumberIntType, &depth);
-
-			picture->setHeight(height);
-			picture->setWidth(width);
-			picture->setColorDepth(depth);
-		}
+bool SFB::Audio::FLACMetadata::_RequiresFileRewrite(bool& requiresRewrite, CFErrorRef *error)
+{
+	std::unique_ptr<TagLib::FileStream> stream;
+	std::unique_ptr<TagLib::FLAC::File> file;
+	if(!OpenFLACFile(mURL, true, stream, file, error))
+		return false;
 
-		file.addPicture(picture);
+	long long availableSize = 0;
+	if(!GetReplaceableMetadataBlockSize(*file, availableSize)) {
+		requiresRewrite = true;
+		return true;
 	}
 
-	if(!file.save()) {
-		if(error) {
-			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid FLAC file."), ""));
-			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Unable to write metadata"), ""));
-			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
+	// An existing ID3v2 tag is rewritten in place only if it doesn't grow
+	auto ID3v2Tag = file->ID3v2Tag();
+	auto ID3v2TagSize = ID3v2Tag ? ID3v2Tag->header()->completeTagSize() : 0;
 
-			*error = CreateErrorForURL(Metadata::ErrorDomain, Metadata::InputOutputError, description, mURL, failureReason, recoverySuggestion);
-		}
+	SetFLACFileFromMetadata(*this, *file);
 
-		return false;
-	}
+	// TagLib reuses the existing blocks, less a padding block header, if the new blocks fit
+	long long requiredSize = 4 + file->xiphComment()->render(false).size();
+	for(auto picture : file->pictureList())
+		requiredSize += 4 + picture->render().size();
+
+	requiresRewrite = requiredSize + 4 >= availableSize || (ID3v2Tag && ID3v2Tag->render().size() != ID3v2TagSize);
 
 	return true;
 }
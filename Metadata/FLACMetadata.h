@@ -25,6 +25,7 @@ namespace SFB {
 
 			static bool HandlesFilesWithExtension(CFStringRef extension);
 			static bool HandlesMIMEType(CFStringRef mimeType);
+			static bool HandlesSignature(const void *header, size_t length);
 
 			static Metadata::unique_ptr CreateMetadata(CFURLRef url);
 
@@ -36,6 +37,7 @@ namespace SFB {
 			// Functionality
 			virtual bool _ReadMetadata(CFErrorRef *error);
 			virtual bool _WriteMetadata(CFErrorRef *error);
+			virtual bool _RequiresFileRewrite(bool& requiresRewrite, CFErrorRef *error);
 		};
 
 	}
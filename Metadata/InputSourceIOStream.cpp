@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+
+#include "InputSourceIOStream.h"
+#include "Logger.h"
+
+SFB::Audio::InputSourceIOStream::InputSourceIOStream(InputSource& inputSource)
+	: mInputSource(inputSource), mOffset(0)
+{
+	CFURLRef url = mInputSource.GetURL();
+	if(url) {
+		UInt8 buf [PATH_MAX];
+		if(CFURLGetFileSystemRepresentation(url, false, buf, PATH_MAX))
+			mName = (const char *)buf;
+	}
+}
+
+TagLib::FileName SFB::Audio::InputSourceIOStream::name() const
+{
+	return mName.c_str();
+}
+
+TagLib::ByteVector SFB::Audio::InputSourceIOStream::readBlock(unsigned long length)
+{
+	if(0 == length || 0 > mOffset)
+		return TagLib::ByteVector();
+
+	TagLib::ByteVector data((unsigned int)length, 0);
+
+	SInt64 bytesRead = mInputSource.ReadAt(mOffset, data.data(), (SInt64)length);
+	if(0 > bytesRead) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.InputSourceIOStream", "Unable to read from input");
+		return TagLib::ByteVector();
+	}
+
+	data.resize((unsigned int)bytesRead);
+	mOffset += (long)bytesRead;
+
+	return data;
+}
+
+void SFB::Audio::InputSourceIOStream::writeBlock(const TagLib::ByteVector& /*data*/)
+{
+	LOGGER_ERR("org.sbooth.AudioEngine.InputSourceIOStream", "writeBlock() called on a read-only stream");
+}
+
+void SFB::Audio::InputSourceIOStream::insert(const TagLib::ByteVector& /*data*/, unsigned long /*start*/, unsigned long /*replace*/)
+{
+	LOGGER_ERR("org.sbooth.AudioEngine.InputSourceIOStream", "insert() called on a read-only stream");
+}
+
+void SFB::Audio::InputSourceIOStream::removeBlock(unsigned long /*start*/, unsigned long /*length*/)
+{
+	LOGGER_ERR("org.sbooth.AudioEngine.InputSourceIOStream", "removeBlock() called on a read-only stream");
+}
+
+bool SFB::Audio::InputSourceIOStream::readOnly() const
+{
+	return true;
+}
+
+bool SFB::Audio::InputSourceIOStream::isOpen() const
+{
+	return mInputSource.IsOpen();
+}
+
+void SFB::Audio::InputSourceIOStream::seek(long offset, Position p)
+{
+	switch(p) {
+		case Beginning:		mOffset = offset;								break;
+		case Current:		mOffset += offset;								break;
+		case End:			mOffset = (long)mInputSource.GetLength() + offset;	break;
+	}
+}
+
+void SFB::Audio::InputSourceIOStream::clear()
+{}
+
+long SFB::Audio::InputSourceIOStream::tell() const
+{
+	return mOffset;
+}
+
+long SFB::Audio::InputSourceIOStream::length()
+{
+	return (long)mInputSource.GetLength();
+}
+
+void SFB::Audio::InputSourceIOStream::truncate(long /*length*/)
+{
+	LOGGER_ERR("org.sbooth.AudioEngine.InputSourceIOStream", "truncate() called on a read-only stream");
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <string>
+
+#include <taglib/tiostream.h>
+
+#include "InputSource.h"
+
+/*! @file InputSourceIOStream.h @brief A \c TagLib::IOStream reading from an \c InputSource */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A read-only \c TagLib::IOStream reading from an \c InputSource
+		 *
+		 * Reads are performed at this stream's own offset using \c InputSource::ReadAt(), so the input's
+		 * offset is unchanged and the input may be shared with a decoder.
+		 * @note The input must be open and must outlive this stream
+		 */
+		class InputSourceIOStream : public TagLib::IOStream
+		{
+		public:
+
+			/*!
+			 * @brief Create a new \c InputSourceIOStream
+			 * @param inputSource The input to read
+			 */
+			explicit InputSourceIOStream(InputSource& inputSource);
+
+			virtual TagLib::FileName name() const;
+
+			virtual TagLib::ByteVector readBlock(unsigned long length);
+			virtual void writeBlock(const TagLib::ByteVector& data);
+			virtual void insert(const TagLib::ByteVector& data, unsigned long start = 0, unsigned long replace = 0);
+			virtual void removeBlock(unsigned long start = 0, unsigned long length = 0);
+
+			virtual bool readOnly() const;
+			virtual bool isOpen() const;
+
+			virtual void seek(long offset, Position p = Beginning);
+			virtual void clear();
+			virtual long tell() const;
+			virtual long length();
+			virtual void truncate(long length);
+
+		private:
+
+			InputSource&		mInputSource;		/*!< The input */
+			std::string			mName;				/*!< The path or URL of the input */
+			long				mOffset;			/*!< The offset of the next read */
+		};
+
+	}
+}
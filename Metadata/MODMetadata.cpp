@@ -78,6 +78,26 @@ bool SFB::Audio::MODMetadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::MODMetadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	// Impulse Tracker, FastTracker 2, Scream Tracker 3 and ProTracker modules
+	if(4 <= length && 0 == memcmp(bytes, "IMPM", 4))
+		return true;
+	else if(17 <= length && 0 == memcmp(bytes, "Extended Module: ", 17))
+		return true;
+	else if(48 <= length && 0 == memcmp(bytes + 44, "SCRM", 4))
+		return true;
+	else if(1084 <= length && 0 == memcmp(bytes + 1080, "M.K.", 4))
+		return true;
+
+	return false;
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::MODMetadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new MODMetadata(url));
@@ -93,18 +113,14 @@ SFB::Audio::MODMetadata::MODMetadata(CFURLRef url)
 
 bool SFB::Audio::MODMetadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
-		return false;
-
 	SFB::CFString pathExtension(CFURLCopyPathExtension(mURL));
 	if(!pathExtension)
 		return false;
 
 	bool fileIsValid = false;
 	if(kCFCompareEqualTo == CFStringCompare(pathExtension, CFSTR("it"), kCFCompareCaseInsensitive)) {
-		std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-		if(!stream->isOpen()) {
+		auto stream = CreateStreamForReading();
+		if(!stream || !stream->isOpen()) {
 			if(error) {
 				SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -116,21 +132,22 @@ bool SFB::Audio::MODMetadata::_ReadMetadata(CFErrorRef *error)
 			return false;
 		}
 
-		TagLib::IT::File file(stream.get());
+		TagLib::IT::File file(stream.get(), ShouldReadAudioProperties());
 		if(file.isValid()) {
 			fileIsValid = true;
 			CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("MOD (Impulse Tracker)"));
+			AddIntToDictionary(mMetadata, kFormatIDKey, (int)'MOD ');
 
 			if(file.audioProperties())
 				AddAudioPropertiesToDictionary(mMetadata, file.audioProperties());
 
-			if(file.tag())
+			if(ShouldReadTags() && file.tag())
 				AddTagToDictionary(mMetadata, file.tag());
 		}
 	}
 	else if(kCFCompareEqualTo == CFStringCompare(pathExtension, CFSTR("xm"), kCFCompareCaseInsensitive)) {
-		std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-		if(!stream->isOpen()) {
+		auto stream = CreateStreamForReading();
+		if(!stream || !stream->isOpen()) {
 			if(error) {
 				SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -142,21 +159,22 @@ bool SFB::Audio::MODMetadata::_ReadMetadata(CFErrorRef *error)
 			return false;
 		}
 
-		TagLib::XM::File file(stream.get());
+		TagLib::XM::File file(stream.get(), ShouldReadAudioProperties());
 		if(file.isValid()) {
 			fileIsValid = true;
 			CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("MOD (Extended Module)"));
+			AddIntToDictionary(mMetadata, kFormatIDKey, (int)'MOD ');
 
 			if(file.audioProperties())
 				AddAudioPropertiesToDictionary(mMetadata, file.audioProperties());
 
-			if(file.tag())
+			if(ShouldReadTags() && file.tag())
 				AddTagToDictionary(mMetadata, file.tag());
 		}
 	}
 	else if(kCFCompareEqualTo == CFStringCompare(pathExtension, CFSTR("s3m"), kCFCompareCaseInsensitive)) {
-		std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-		if(!stream->isOpen()) {
+		auto stream = CreateStreamForReading();
+		if(!stream || !stream->isOpen()) {
 			if(error) {
 				SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -168,21 +186,22 @@ bool SFB::Audio::MODMetadata::_ReadMetadata(CFErrorRef *error)
 			return false;
 		}
 
-		TagLib::S3M::File file(stream.get());
+		TagLib::S3M::File file(stream.get(), ShouldReadAudioProperties());
 		if(file.isValid()) {
 			fileIsValid = true;
 			CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("MOD (ScreamTracker III)"));
+			AddIntToDictionary(mMetadata, kFormatIDKey, (int)'MOD ');
 
 			if(file.audioProperties())
 				AddAudioPropertiesToDictionary(mMetadata, file.audioProperties());
 
-			if(file.tag())
+			if(ShouldReadTags() && file.tag())
 				AddTagToDictionary(mMetadata, file.tag());
 		}
 	}
 	else if(kCFCompareEqualTo == CFStringCompare(pathExtension, CFSTR("mod"), kCFCompareCaseInsensitive)) {
-		std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-		if(!stream->isOpen()) {
+		auto stream = CreateStreamForReading();
+		if(!stream || !stream->isOpen()) {
 			if(error) {
 				SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -194,15 +213,16 @@ bool SFB::Audio::MODMetadata::_ReadMetadata(CFErrorRef *error)
 			return false;
 		}
 
-		TagLib::Mod::File file(stream.get());
+		TagLib::Mod::File file(stream.get(), ShouldReadAudioProperties());
 		if(file.isValid()) {
 			fileIsValid = true;
 			CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("MOD (Protracker)"));
+			AddIntToDictionary(mMetadata, kFormatIDKey, (int)'MOD ');
 
 			if(file.audioProperties())
 				AddAudioPropertiesToDictionary(mMetadata, file.audioProperties());
 
-			if(file.tag())
+			if(ShouldReadTags() && file.tag())
 				AddTagToDictionary(mMetadata, file.tag());
 		}
 	}
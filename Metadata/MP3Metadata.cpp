@@ -9,6 +9,8 @@
 #include <taglib/mpegfile.h>
 #include <taglib/mpegproperties.h>
 #include <taglib/xingheader.h>
+#include <taglib/id3v2header.h>
+#include <taglib/id3v2tag.h>
 
 #include "MP3Metadata.h"
 #include "CFWrapper.h"
@@ -30,6 +32,60 @@ namespace {
 		SFB::Audio::Metadata::RegisterSubclass<SFB::Audio::MP3Metadata>();
 	}
 
+	// ========================================
+	// Open a file for writing its metadata
+	bool OpenMPEGFile(CFURLRef url, bool readOnly, std::unique_ptr<TagLib::FileStream>& stream, std::unique_ptr<TagLib::MPEG::File>& file, CFErrorRef *error)
+	{
+		UInt8 buf [PATH_MAX];
+		if(!CFURLGetFileSystemRepresentation(url, false, buf, PATH_MAX))
+			return false;
+
+		stream.reset(new TagLib::FileStream((const char *)buf, readOnly));
+		if(!stream->isOpen()) {
+			if(error) {
+				SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for writing."), ""));
+				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
+				SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file may have been renamed, moved, deleted, or you may not have appropriate permissions."), ""));
+
+				*error = SFB::CreateErrorForURL(SFB::Audio::Metadata::ErrorDomain, SFB::Audio::Metadata::InputOutputError, description, url, failureReason, recoverySuggestion);
+			}
+
+			return false;
+		}
+
+		file.reset(new TagLib::MPEG::File(stream.get(), TagLib::ID3v2::FrameFactory::instance(), false));
+		if(!file->isValid()) {
+			if(error) {
+				SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid MPEG file."), ""));
+				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not an MPEG file"), ""));
+				SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
+
+				*error = SFB::CreateErrorForURL(SFB::Audio::Metadata::ErrorDomain, SFB::Audio::Metadata::InputOutputError, description, url, failureReason, recoverySuggestion);
+			}
+
+			return false;
+		}
+
+		return true;
+	}
+
+	// ========================================
+	// Apply the metadata to a file without saving it
+	void SetMPEGFileFromMetadata(const SFB::Audio::Metadata& metadata, TagLib::MPEG::File& file)
+	{
+		// APE and ID3v1 tags are only written if present, but ID3v2 tags are always written
+
+		auto APETag = file.APETag();
+		if(APETag && !APETag->isEmpty())
+			SetAPETagFromMetadata(metadata, APETag);
+
+		auto ID3v1Tag = file.ID3v1Tag();
+		if(ID3v1Tag && !ID3v1Tag->isEmpty())
+			SetID3v1TagFromMetadata(metadata, ID3v1Tag);
+
+		SetID3v2TagFromMetadata(metadata, file.ID3v2Tag(true));
+	}
+
 }
 
 #pragma mark Static Methods
@@ -68,6 +124,17 @@ bool SFB::Audio::MP3Metadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::MP3Metadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header || 4 > length)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	// Frame sync followed by a valid layer, bitrate index and sample rate index
+	return 0xff == bytes[0] && 0xe0 == (bytes[1] & 0xe0) && 0 != (bytes[1] & 0x06) && 0xf0 != (bytes[2] & 0xf0) && 0x0c != (bytes[2] & 0x0c);
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::MP3Metadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new MP3Metadata(url));
@@ -83,12 +150,8 @@ SFB::Audio::MP3Metadata::MP3Metadata(CFURLRef url)
 
 bool SFB::Audio::MP3Metadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -100,7 +163,7 @@ bool SFB::Audio::MP3Metadata::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::MPEG::File file(stream.get(), TagLib::ID3v2::FrameFactory::instance());
+	TagLib::MPEG::File file(stream.get(), TagLib::ID3v2::FrameFactory::instance(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(nullptr != error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid MPEG file."), ""));
@@ -114,6 +177,7 @@ bool SFB::Audio::MP3Metadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("MP3"));
+	AddIntToDictionary(mMetadata, kFormatIDKey, (int)'MPEG');
 
 	if(file.audioProperties()) {
 		auto properties = file.audioProperties();
@@ -146,46 +210,43 @@ bool SFB::Audio::MP3Metadata::_ReadMetadata(CFErrorRef *error)
 		}
 #endif
 
-		if(properties->xingHeader() && properties->xingHeader()->totalFrames())
-			AddIntToDictionary(mMetadata, kTotalFramesKey, (int)properties->xingHeader()->totalFrames());
+		// The Xing header counts MPEG frames, each containing a fixed number of audio frames
+		if(properties->xingHeader() && properties->xingHeader()->totalFrames()) {
+			long long framesPerMPEGFrame = 1152;
+			if(1 == properties->layer())
+				framesPerMPEGFrame = 384;
+			else if(3 == properties->layer() && TagLib::MPEG::Header::Version1 != properties->version())
+				framesPerMPEGFrame = 576;
+
+			AddLongLongToDictionary(mMetadata, kTotalFramesKey, framesPerMPEGFrame * properties->xingHeader()->totalFrames());
+		}
 	}
 
-	if(file.APETag())
-		AddAPETagToDictionary(mMetadata, mPictures, file.APETag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.APETag())
+		AddAPETagToDictionary(mMetadata, mPictures, file.APETag(), ShouldReadAttachedPictures());
 
-	if(file.ID3v1Tag())
+	if(ShouldReadTags() && file.ID3v1Tag())
 		AddID3v1TagToDictionary(mMetadata, file.ID3v1Tag());
 
-	if(file.ID3v2Tag())
-		AddID3v2TagToDictionary(mMetadata, mPictures, file.ID3v2Tag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.ID3v2Tag())
+		AddID3v2TagToDictionary(mMetadata, mPictures, file.ID3v2Tag(), ShouldReadAttachedPictures());
 
 	return true;
 }
 
 bool SFB::Audio::MP3Metadata::_WriteMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
+	std::unique_ptr<TagLib::FileStream> stream;
+	std::unique_ptr<TagLib::MPEG::File> file;
+	if(!OpenMPEGFile(mURL, false, stream, file, error))
 		return false;
 
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf));
-	if(!stream->isOpen()) {
-		if(error) {
-			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for writing."), ""));
-			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
-			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file may have been renamed, moved, deleted, or you may not have appropriate permissions."), ""));
-
-			*error = CreateErrorForURL(Metadata::ErrorDomain, Metadata::InputOutputError, description, mURL, failureReason, recoverySuggestion);
-		}
-
-		return false;
-	}
+	SetMPEGFileFromMetadata(*this, *file);
 
-	TagLib::MPEG::File file(stream.get(), TagLib::ID3v2::FrameFactory::instance(), false);
-	if(!file.isValid()) {
+	if(!file->save()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid MPEG file."), ""));
-			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not an MPEG file"), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Unable to write metadata"), ""));
 			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
 
 			*error = CreateErrorForURL(Metadata::ErrorDomain, Metadata::InputOutputError, description, mURL, failureReason, recoverySuggestion);
@@ -194,29 +255,24 @@ bool SFB::Audio::MP3Metadata::_WriteMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	// APE and ID3v1 tags are only written if present, but ID3v2 tags are always written
-
-	auto APETag = file.APETag();
-	if(APETag && !APETag->isEmpty())
-		SetAPETagFromMetadata(*this, APETag);
+	return true;
+}
 
-	auto ID3v1Tag = file.ID3v1Tag();
-	if(ID3v1Tag && !ID3v1Tag->isEmpty())
-		SetID3v1TagFromMetadata(*this, ID3v1Tag);
+bool SFB::Audio::MP3Metadata::_RequiresFileRewrite(bool& requiresRewrite, CFErrorRef *error)
+{
+	std::unique_ptr<TagLib::FileStream> stream;
+	std::unique_ptr<TagLib::MPEG::File> file;
+	if(!OpenMPEGFile(mURL, true, stream, file, error))
+		return false;
 
-	SetID3v2TagFromMetadata(*this, file.ID3v2Tag(true));
+	// APE and ID3v1 tags follow the audio, but the ID3v2 tag precedes it and
+	// is rewritten in place only if its padding absorbs any growth
+	auto ID3v2Tag = file->ID3v2Tag();
+	auto ID3v2TagSize = ID3v2Tag ? ID3v2Tag->header()->completeTagSize() : 0;
 
-	if(!file.save()) {
-		if(error) {
-			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid MPEG file."), ""));
-			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Unable to write metadata"), ""));
-			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's extension may not match the file's type."), ""));
-
-			*error = CreateErrorForURL(Metadata::ErrorDomain, Metadata::InputOutputError, description, mURL, failureReason, recoverySuggestion);
-		}
+	SetMPEGFileFromMetadata(*this, *file);
 
-		return false;
-	}
+	requiresRewrite = !ID3v2Tag || file->ID3v2Tag()->render().size() != ID3v2TagSize;
 
 	return true;
 }
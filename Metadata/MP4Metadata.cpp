@@ -64,6 +64,15 @@ bool SFB::Audio::MP4Metadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::MP4Metadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+	return 8 <= length && 0 == memcmp(bytes + 4, "ftyp", 4);
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::MP4Metadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new MP4Metadata(url));
@@ -79,12 +88,8 @@ SFB::Audio::MP4Metadata::MP4Metadata(CFURLRef url)
 
 bool SFB::Audio::MP4Metadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, FALSE, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -96,7 +101,7 @@ bool SFB::Audio::MP4Metadata::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::MP4::File file(stream.get());
+	TagLib::MP4::File file(stream.get(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid MPEG-4 file."), ""));
@@ -120,17 +125,19 @@ bool SFB::Audio::MP4Metadata::_ReadMetadata(CFErrorRef *error)
 		switch(properties->codec()) {
 			case TagLib::MP4::AudioProperties::AAC:
 				CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("AAC"));
+				AddIntToDictionary(mMetadata, kFormatIDKey, (int)kAudioFormatMPEG4AAC);
 				break;
 			case TagLib::MP4::AudioProperties::ALAC:
 				CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("Apple Lossless"));
+				AddIntToDictionary(mMetadata, kFormatIDKey, (int)kAudioFormatAppleLossless);
 				break;
 			default:
 				break;
 		}
 	}
 
-	if(file.tag())
-		AddMP4TagToDictionary(mMetadata, mPictures, file.tag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.tag())
+		AddMP4TagToDictionary(mMetadata, mPictures, file.tag(), ShouldReadAttachedPictures());
 
 	return true;
 }
@@ -65,6 +65,14 @@ bool SFB::Audio::MonkeysAudioMetadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::MonkeysAudioMetadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	return 4 <= length && 0 == memcmp(header, "MAC ", 4);
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::MonkeysAudioMetadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new MonkeysAudioMetadata(url));
@@ -80,12 +88,8 @@ SFB::Audio::MonkeysAudioMetadata::MonkeysAudioMetadata(CFURLRef url)
 
 bool SFB::Audio::MonkeysAudioMetadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -97,7 +101,7 @@ bool SFB::Audio::MonkeysAudioMetadata::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::APE::File file(stream.get());
+	TagLib::APE::File file(stream.get(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid Monkey's Audio file."), ""));
@@ -111,6 +115,7 @@ bool SFB::Audio::MonkeysAudioMetadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("Monkey's Audio"));
+	AddIntToDictionary(mMetadata, kFormatIDKey, (int)'APE ');
 
 	if(file.audioProperties()) {
 		auto properties = file.audioProperties();
@@ -122,11 +127,11 @@ bool SFB::Audio::MonkeysAudioMetadata::_ReadMetadata(CFErrorRef *error)
 			AddIntToDictionary(mMetadata, kTotalFramesKey, (int)properties->sampleFrames());
 	}
 
-	if(file.ID3v1Tag())
+	if(ShouldReadTags() && file.ID3v1Tag())
 		AddID3v1TagToDictionary(mMetadata, file.ID3v1Tag());
 
-	if(file.APETag())
-		AddAPETagToDictionary(mMetadata, mPictures, file.APETag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.APETag())
+		AddAPETagToDictionary(mMetadata, mPictures, file.APETag(), ShouldReadAttachedPictures());
 
 	return true;
 }
@@ -64,6 +64,15 @@ bool SFB::Audio::Musepack::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::Musepack::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	// SV8 and SV7 streams
+	return (4 <= length && 0 == memcmp(header, "MPCK", 4)) || (3 <= length && 0 == memcmp(header, "MP+", 3));
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::Musepack::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new Musepack(url));
@@ -79,12 +88,8 @@ SFB::Audio::Musepack::Musepack(CFURLRef url)
 
 bool SFB::Audio::Musepack::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -96,7 +101,7 @@ bool SFB::Audio::Musepack::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::MPC::File file(stream.get());
+	TagLib::MPC::File file(stream.get(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(nullptr != error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid Musepack file."), ""));
@@ -110,6 +115,7 @@ bool SFB::Audio::Musepack::_ReadMetadata(CFErrorRef *error)
 	}
 
 	CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("Musepack"));
+	AddIntToDictionary(mMetadata, kFormatIDKey, (int)'MUSE');
 
 	if(file.audioProperties()) {
 		auto properties = file.audioProperties();
@@ -119,11 +125,11 @@ bool SFB::Audio::Musepack::_ReadMetadata(CFErrorRef *error)
 			AddIntToDictionary(mMetadata, kTotalFramesKey, (int)properties->sampleFrames());
 	}
 
-	if(file.ID3v1Tag())
+	if(ShouldReadTags() && file.ID3v1Tag())
 		AddID3v1TagToDictionary(mMetadata, file.ID3v1Tag());
 
-	if(file.APETag())
-		AddAPETagToDictionary(mMetadata, mPictures, file.APETag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.APETag())
+		AddAPETagToDictionary(mMetadata, mPictures, file.APETag(), ShouldReadAttachedPictures());
 
 	return true;
 }
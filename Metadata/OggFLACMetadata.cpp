@@ -65,6 +65,23 @@ bool SFB::Audio::OggFLACMetadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::OggFLACMetadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	// The identification header is the first packet following the page header and segment table
+	if(27 <= length && 0 == memcmp(bytes, "OggS", 4)) {
+		size_t packetOffset = 27 + bytes[26];
+		if(packetOffset + 5 <= length && 0 == memcmp(bytes + packetOffset, "\x7f" "FLAC", 5))
+			return true;
+	}
+
+	return false;
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::OggFLACMetadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new OggFLACMetadata(url));
@@ -80,12 +97,8 @@ SFB::Audio::OggFLACMetadata::OggFLACMetadata(CFURLRef url)
 
 bool SFB::Audio::OggFLACMetadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -97,7 +110,7 @@ bool SFB::Audio::OggFLACMetadata::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::Ogg::FLAC::File file(stream.get());
+	TagLib::Ogg::FLAC::File file(stream.get(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(nullptr != error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid Ogg file."), ""));
@@ -111,6 +124,7 @@ bool SFB::Audio::OggFLACMetadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("Ogg FLAC"));
+	AddIntToDictionary(mMetadata, kFormatIDKey, (int)'FLAC');
 
 	if(file.audioProperties()) {
 		auto properties = file.audioProperties();
@@ -118,10 +132,12 @@ bool SFB::Audio::OggFLACMetadata::_ReadMetadata(CFErrorRef *error)
 
 		if(properties->sampleWidth())
 			AddIntToDictionary(mMetadata, kBitsPerChannelKey, properties->sampleWidth());
+		if(properties->sampleFrames())
+			AddLongLongToDictionary(mMetadata, kTotalFramesKey, (long long)properties->sampleFrames());
 	}
 
-	if(file.tag())
-		AddXiphCommentToDictionary(mMetadata, mPictures, file.tag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.tag())
+		AddXiphCommentToDictionary(mMetadata, mPictures, file.tag(), ShouldReadAttachedPictures());
 
 	return true;
 }
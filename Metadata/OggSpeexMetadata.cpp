@@ -61,6 +61,23 @@ bool SFB::Audio::OggSpeexMetadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::OggSpeexMetadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	// The identification header is the first packet following the page header and segment table
+	if(27 <= length && 0 == memcmp(bytes, "OggS", 4)) {
+		size_t packetOffset = 27 + bytes[26];
+		if(packetOffset + 8 <= length && 0 == memcmp(bytes + packetOffset, "Speex   ", 8))
+			return true;
+	}
+
+	return false;
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::OggSpeexMetadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new OggSpeexMetadata(url));
@@ -76,12 +93,8 @@ SFB::Audio::OggSpeexMetadata::OggSpeexMetadata(CFURLRef url)
 
 bool SFB::Audio::OggSpeexMetadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -93,7 +106,7 @@ bool SFB::Audio::OggSpeexMetadata::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::Ogg::Speex::File file(stream.get());
+	TagLib::Ogg::Speex::File file(stream.get(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(nullptr != error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid Ogg Speex file."), ""));
@@ -107,12 +120,13 @@ bool SFB::Audio::OggSpeexMetadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("Ogg Speex"));
+	AddIntToDictionary(mMetadata, kFormatIDKey, (int)'SPEE');
 
 	if(file.audioProperties())
 		AddAudioPropertiesToDictionary(mMetadata, file.audioProperties());
 
-	if(file.tag())
-		AddXiphCommentToDictionary(mMetadata, mPictures, file.tag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.tag())
+		AddXiphCommentToDictionary(mMetadata, mPictures, file.tag(), ShouldReadAttachedPictures());
 
 	return true;
 }
@@ -63,6 +63,23 @@ bool SFB::Audio::OggVorbisMetadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::OggVorbisMetadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+
+	// The identification header is the first packet following the page header and segment table
+	if(27 <= length && 0 == memcmp(bytes, "OggS", 4)) {
+		size_t packetOffset = 27 + bytes[26];
+		if(packetOffset + 7 <= length && 0 == memcmp(bytes + packetOffset, "\x01" "vorbis", 7))
+			return true;
+	}
+
+	return false;
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::OggVorbisMetadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new OggVorbisMetadata(url));
@@ -78,12 +95,8 @@ SFB::Audio::OggVorbisMetadata::OggVorbisMetadata(CFURLRef url)
 
 bool SFB::Audio::OggVorbisMetadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -95,7 +108,7 @@ bool SFB::Audio::OggVorbisMetadata::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::Ogg::Vorbis::File file(stream.get());
+	TagLib::Ogg::Vorbis::File file(stream.get(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(nullptr != error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid Ogg Vorbis file."), ""));
@@ -109,12 +122,13 @@ bool SFB::Audio::OggVorbisMetadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("Ogg Vorbis"));
+	AddIntToDictionary(mMetadata, kFormatIDKey, (int)'VORB');
 
 	if(file.audioProperties())
 		AddAudioPropertiesToDictionary(mMetadata, file.audioProperties());
 
-	if(file.tag())
-		AddXiphCommentToDictionary(mMetadata, mPictures, file.tag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.tag())
+		AddXiphCommentToDictionary(mMetadata, mPictures, file.tag(), ShouldReadAttachedPictures());
 
 	return true;
 }
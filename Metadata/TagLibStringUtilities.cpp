@@ -3,10 +3,29 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <map>
+#include <mutex>
+
 #include "TagLibStringUtilities.h"
 #include "CFWrapper.h"
 #include "Logger.h"
 
+// The maximum number of field names retained by CFStringCreateForFieldName()
+#define MAXIMUM_INTERNED_FIELD_NAMES 1024
+
+namespace {
+
+	// TagLib::String holds its characters as wchar_t, which is UTF-32 in the host byte order
+	static_assert(4 == sizeof(wchar_t), "wchar_t is not UTF-32");
+
+#if TARGET_RT_BIG_ENDIAN
+	const CFStringEncoding kWideCharacterEncoding = kCFStringEncodingUTF32BE;
+#else
+	const CFStringEncoding kWideCharacterEncoding = kCFStringEncodingUTF32LE;
+#endif
+
+}
+
 TagLib::String TagLib::StringFromCFString(CFStringRef s)
 {
 	if(nullptr == s)
@@ -34,12 +53,38 @@ TagLib::String TagLib::StringFromCFString(CFStringRef s)
 	return {&buf[0], String::UTF8};
 }
 
-void TagLib::AddStringToCFDictionary(CFMutableDictionaryRef d, CFStringRef key, String value)
+CFStringRef TagLib::CFStringCreateFromString(const String& s)
+{
+	// Converting from the wide characters directly avoids an intermediate UTF-8 copy
+	return CFStringCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)s.toCWString(), (CFIndex)(s.size() * sizeof(wchar_t)), kWideCharacterEncoding, false);
+}
+
+CFStringRef TagLib::CFStringCreateForFieldName(const String& name)
+{
+	static std::map<String, CFStringRef> sFieldNames;
+	static std::mutex sFieldNamesMutex;
+
+	std::lock_guard<std::mutex> lock(sFieldNamesMutex);
+
+	auto iter = sFieldNames.find(name);
+	if(sFieldNames.end() != iter)
+		return (CFStringRef)CFRetain(iter->second);
+
+	auto string = CFStringCreateFromString(name);
+
+	// Names are never removed, so the table is bounded by not adding names once full
+	if(string && MAXIMUM_INTERNED_FIELD_NAMES > sFieldNames.size())
+		sFieldNames[name] = (CFStringRef)CFRetain(string);
+
+	return string;
+}
+
+void TagLib::AddStringToCFDictionary(CFMutableDictionaryRef d, CFStringRef key, const String& value)
 {
 	if(nullptr == d || nullptr == key || value.isEmpty())
 		return;
 
-	SFB::CFString string(value.toCString(true), kCFStringEncodingUTF8);
+	SFB::CFString string(CFStringCreateFromString(value));
 	if(string)
 		CFDictionarySetValue(d, key, string);
 }
@@ -16,6 +16,22 @@ namespace TagLib {
 	/*! @brief Create a \c TagLib::String from the specified Core Foundation string */
 	String StringFromCFString(CFStringRef s);
 
+	/*!
+	 * @brief Create a Core Foundation string from the specified \c TagLib::String
+	 * @note The returned string must be released by the caller
+	 * @return A \c CFString, or \c nullptr on failure
+	 */
+	CFStringRef CFStringCreateFromString(const String& s);
+
+	/*!
+	 * @brief Create a Core Foundation string for a tag field name
+	 *
+	 * Field names are interned, so a name repeated across files is converted only once.
+	 * @note The returned string must be released by the caller
+	 * @return A \c CFString, or \c nullptr on failure
+	 */
+	CFStringRef CFStringCreateForFieldName(const String& name);
+
 	/*!
 	 * @brief Add a key/value pair to the specified dictionary
 	 * @note This method does nothing if \c value is \c TagLib::String::null
@@ -23,6 +39,6 @@ namespace TagLib {
 	 * @param key The key
 	 * @param value The value
 	 */
-	void AddStringToCFDictionary(CFMutableDictionaryRef d, CFStringRef key, String value);
+	void AddStringToCFDictionary(CFMutableDictionaryRef d, CFStringRef key, const String& value);
 
 }
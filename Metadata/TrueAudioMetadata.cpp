@@ -66,6 +66,14 @@ bool SFB::Audio::TrueAudioMetadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::TrueAudioMetadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header)
+		return false;
+
+	return 4 <= length && 0 == memcmp(header, "TTA1", 4);
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::TrueAudioMetadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new TrueAudioMetadata(url));
@@ -81,12 +89,8 @@ SFB::Audio::TrueAudioMetadata::TrueAudioMetadata(CFURLRef url)
 
 bool SFB::Audio::TrueAudioMetadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, FALSE, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -98,7 +102,7 @@ bool SFB::Audio::TrueAudioMetadata::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::TrueAudio::File file(stream.get());
+	TagLib::TrueAudio::File file(stream.get(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(nullptr != error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid True Audio file."), ""));
@@ -112,6 +116,7 @@ bool SFB::Audio::TrueAudioMetadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("True Audio"));
+	AddIntToDictionary(mMetadata, kFormatIDKey, (int)'TTA ');
 
 	if(file.audioProperties()) {
 		auto properties = file.audioProperties();
@@ -124,11 +129,11 @@ bool SFB::Audio::TrueAudioMetadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	// Add all tags that are present
-	if(file.ID3v1Tag())
+	if(ShouldReadTags() && file.ID3v1Tag())
 		AddID3v1TagToDictionary(mMetadata, file.ID3v1Tag());
 
-	if(file.ID3v2Tag())
-		AddID3v2TagToDictionary(mMetadata, mPictures, file.ID3v2Tag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.ID3v2Tag())
+		AddID3v2TagToDictionary(mMetadata, mPictures, file.ID3v2Tag(), ShouldReadAttachedPictures());
 
 	return true;
 }
@@ -66,6 +66,15 @@ bool SFB::Audio::WAVEMetadata::HandlesMIMEType(CFStringRef mimeType)
 	return false;
 }
 
+bool SFB::Audio::WAVEMetadata::HandlesSignature(const void *header, size_t length)
+{
+	if(nullptr == header || 12 > length)
+		return false;
+
+	auto bytes = static_cast<const uint8_t *>(header);
+	return 0 == memcmp(bytes, "RIFF", 4) && 0 == memcmp(bytes + 8, "WAVE", 4);
+}
+
 SFB::Audio::Metadata::unique_ptr SFB::Audio::WAVEMetadata::CreateMetadata(CFURLRef url)
 {
 	return unique_ptr(new WAVEMetadata(url));
@@ -81,12 +90,8 @@ SFB::Audio::WAVEMetadata::WAVEMetadata(CFURLRef url)
 
 bool SFB::Audio::WAVEMetadata::_ReadMetadata(CFErrorRef *error)
 {
-	UInt8 buf [PATH_MAX];
-	if(!CFURLGetFileSystemRepresentation(mURL, false, buf, PATH_MAX))
-		return false;
-
-	std::unique_ptr<TagLib::FileStream> stream(new TagLib::FileStream((const char *)buf, true));
-	if(!stream->isOpen()) {
+	auto stream = CreateStreamForReading();
+	if(!stream || !stream->isOpen()) {
 		if(error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be opened for reading."), ""));
 			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
@@ -98,7 +103,7 @@ bool SFB::Audio::WAVEMetadata::_ReadMetadata(CFErrorRef *error)
 		return false;
 	}
 
-	TagLib::RIFF::WAV::File file(stream.get());
+	TagLib::RIFF::WAV::File file(stream.get(), ShouldReadAudioProperties());
 	if(!file.isValid()) {
 		if(nullptr != error) {
 			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid WAVE file."), ""));
@@ -112,6 +117,7 @@ bool SFB::Audio::WAVEMetadata::_ReadMetadata(CFErrorRef *error)
 	}
 
 	CFDictionarySetValue(mMetadata, kFormatNameKey, CFSTR("WAVE"));
+	AddIntToDictionary(mMetadata, kFormatIDKey, (int)kAudioFormatLinearPCM);
 
 	if(file.audioProperties()) {
 		auto properties = file.audioProperties();
@@ -123,11 +129,11 @@ bool SFB::Audio::WAVEMetadata::_ReadMetadata(CFErrorRef *error)
 			AddIntToDictionary(mMetadata, kTotalFramesKey, (int)properties->sampleFrames());
 	}
 
-	if(file.InfoTag())
+	if(ShouldReadTags() && file.InfoTag())
 		AddTagToDictionary(mMetadata, file.InfoTag());
 
-	if(file.ID3v2Tag())
-		AddID3v2TagToDictionary(mMetadata, mPictures, file.ID3v2Tag());
+	if((ShouldReadTags() || ShouldReadAttachedPictures()) && file.ID3v2Tag())
+		AddID3v2TagToDictionary(mMetadata, mPictures, file.ID3v2Tag(), ShouldReadAttachedPictures());
 
 	return true;
 }
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <mach/mach.h>
+#include <mach/mach_error.h>
+
+#include "MirroredMemory.h"
+#include "Logger.h"
+
+size_t SFB::GetMirroredMemoryGranularity()
+{
+	return vm_page_size;
+}
+
+void * SFB::AllocateMirroredMemory(size_t byteCount)
+{
+	if(0 == byteCount || 0 != byteCount % vm_page_size) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.MirroredMemory", "Mirrored memory size " << byteCount << " is not a multiple of the page size");
+		return nullptr;
+	}
+
+	// Reserve space for both mappings
+	vm_address_t address = 0;
+	kern_return_t result = vm_allocate(mach_task_self(), &address, 2 * byteCount, VM_FLAGS_ANYWHERE);
+	if(KERN_SUCCESS != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.MirroredMemory", "vm_allocate failed: " << mach_error_string(result));
+		return nullptr;
+	}
+
+	// Replace the upper half with a second mapping of the lower half
+	vm_address_t mirrorAddress = address + byteCount;
+	vm_prot_t currentProtection, maximumProtection;
+	result = vm_remap(mach_task_self(), &mirrorAddress, byteCount, 0, VM_FLAGS_FIXED | VM_FLAGS_OVERWRITE, mach_task_self(), address, false, &currentProtection, &maximumProtection, VM_INHERIT_DEFAULT);
+	if(KERN_SUCCESS != result || address + byteCount != mirrorAddress) {
+		LOGGER_ERR("org.sbooth.AudioEngine.MirroredMemory", "vm_remap failed: " << mach_error_string(result));
+
+		if(KERN_SUCCESS == result)
+			vm_deallocate(mach_task_self(), mirrorAddress, byteCount);
+		vm_deallocate(mach_task_self(), address, 2 * byteCount);
+
+		return nullptr;
+	}
+
+	return (void *)address;
+}
+
+void SFB::DeallocateMirroredMemory(void *memory, size_t byteCount)
+{
+	if(nullptr == memory)
+		return;
+
+	kern_return_t result = vm_deallocate(mach_task_self(), (vm_address_t)memory, 2 * byteCount);
+	if(KERN_SUCCESS != result)
+		LOGGER_ERR("org.sbooth.AudioEngine.MirroredMemory", "vm_deallocate failed: " << mach_error_string(result));
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/*! @file MirroredMemory.h @brief Virtual memory mapped twice consecutively */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*!
+	 * @brief Get the granularity of mirrored allocations
+	 * @return The virtual memory page size, in bytes
+	 */
+	size_t GetMirroredMemoryGranularity();
+
+	/*!
+	 * @brief Allocate memory whose pages are mapped twice, back to back
+	 *
+	 * The \c byteCount bytes beginning at the returned address are also visible beginning at
+	 * the returned address plus \c byteCount, so any region of up to \c byteCount bytes
+	 * starting in the first mapping is contiguous.
+	 * @param byteCount The size of the memory, in bytes; must be a multiple of \c GetMirroredMemoryGranularity()
+	 * @return The address of the memory, or \c nullptr on error
+	 */
+	void * AllocateMirroredMemory(size_t byteCount);
+
+	/*!
+	 * @brief Free memory allocated by \c AllocateMirroredMemory()
+	 * @param memory The address of the memory
+	 * @param byteCount The size passed to \c AllocateMirroredMemory()
+	 */
+	void DeallocateMirroredMemory(void *memory, size_t byteCount);
+
+}
@@ -3,6 +3,18 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+#include <atomic>
+#include <mach/mach_time.h>
+#include <libkern/OSByteOrder.h>
+#include <sys/stat.h>
+
+#include <Accelerate/Accelerate.h>
+
 #include "AsioLibWrapper.h"
 
 #include "ASIOOutput.h"
@@ -11,6 +23,20 @@
 #include "AudioBufferList.h"
 #include "Logger.h"
 
+// Adaptive buffer sizing: repeated overloads double the buffer size, and quiet periods halve it
+#define OVERLOAD_THRESHOLD_COUNT		3
+#define OVERLOAD_WINDOW_NSEC			(10 * NSEC_PER_SEC)
+#define QUIET_PERIOD_NSEC				(60 * NSEC_PER_SEC)
+
+// The weight given to each new sample in the time info jitter average
+#define JITTER_SMOOTHING_FACTOR			(1.0 / 16)
+
+// The preferences domain and key holding cached driver capabilities
+#define CAPABILITY_CACHE_APPLICATION_ID	CFSTR("org.sbooth.AudioEngine.ASIO")
+#define CAPABILITY_CACHE_KEY			CFSTR("DriverCapabilities")
+// The library modification date for which cached capabilities were determined
+#define CAPABILITY_CACHE_DATE_KEY		CFSTR("Modification Date")
+
 namespace {
 
 	// ========================================
@@ -29,6 +55,36 @@ namespace {
 		eMessageQueueEventASIOOverload			= 'ovld'
 	};
 
+	// ========================================
+	// Convert a 64-bit ASIO value (ASIOSamples or ASIOTimeStamp) into a double
+	template <typename T>
+	inline double ASIO64ToDouble(const T& value)
+	{
+		return (value.hi * 4294967296.0) + value.lo;
+	}
+
+	// ========================================
+	// Convert nanoseconds to host time
+	uint64_t ConvertNanosToHostTime(uint64_t nanos)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (nanos * sTimebaseInfo.denom) / sTimebaseInfo.numer;
+	}
+
+	// ========================================
+	// Convert host time to nanoseconds
+	uint64_t ConvertHostTimeToNanos(uint64_t hostTime)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (hostTime * sTimebaseInfo.numer) / sTimebaseInfo.denom;
+	}
+
 	// ========================================
 	// Convert ASIOSampleType into an AudioFormat
 	SFB::Audio::AudioFormat AudioFormatForASIOSampleType(ASIOSampleType sampleType)
@@ -181,108 +237,298 @@ namespace {
 		return result;
 	}
 
-	const size_t kUIDLength = 1024;
+#if __LITTLE_ENDIAN__
+	const bool kHostIsBigEndian = false;
+#else
+	const bool kHostIsBigEndian = true;
+#endif
 
 	// ========================================
-	// Information about an ASIO driver
-	struct DriverInfo
+	// Determine whether samples of the specified type are big endian
+	inline bool IsBigEndianSampleType(ASIOSampleType sampleType)
 	{
-		ASIODriverInfo	mDriverInfo;
-		char			mUID [kUIDLength];
+		switch(sampleType) {
+			case ASIOSTInt16MSB:
+			case ASIOSTInt24MSB:
+			case ASIOSTInt32MSB:
+			case ASIOSTFloat32MSB:
+			case ASIOSTFloat64MSB:
+			case ASIOSTInt32MSB16:
+			case ASIOSTInt32MSB18:
+			case ASIOSTInt32MSB20:
+			case ASIOSTInt32MSB24:
+				return true;
 
-		long			mInputChannelCount;
-		long			mOutputChannelCount;
+			default:
+				return false;
+		}
+	}
 
-		long			mMinimumBufferSize;
-		long			mMaximumBufferSize;
-		long			mPreferredBufferSize;
-		long			mBufferGranularity;
+	// The sample type matching the native float format rendered by the player
+	inline bool IsNativeFloat32SampleType(ASIOSampleType sampleType)
+	{
+		return (ASIOSTFloat32LSB == sampleType || ASIOSTFloat32MSB == sampleType) && kHostIsBigEndian == IsBigEndianSampleType(sampleType);
+	}
 
-		ASIOSampleType	mFormat;
-		ASIOSampleRate	mSampleRate;
+	// ========================================
+	// Sample conversion kernels
+	template <typename T>
+	inline void SwapBytes(T *buffer, size_t count);
 
-		bool			mPostOutput;
+	template <>
+	inline void SwapBytes(int16_t *buffer, size_t count)
+	{
+		for(size_t i = 0; i < count; ++i)
+			buffer[i] = (int16_t)OSSwapInt16((uint16_t)buffer[i]);
+	}
 
-		long			mInputLatency;
-		long			mOutputLatency;
+	template <>
+	inline void SwapBytes(int32_t *buffer, size_t count)
+	{
+		for(size_t i = 0; i < count; ++i)
+			buffer[i] = (int32_t)OSSwapInt32((uint32_t)buffer[i]);
+	}
 
-		long			mInputBufferCount;	// becomes number of actual created input buffers
-		long			mOutputBufferCount;	// becomes number of actual created output buffers
+	template <>
+	inline void SwapBytes(uint64_t *buffer, size_t count)
+	{
+		for(size_t i = 0; i < count; ++i)
+			buffer[i] = OSSwapInt64(buffer[i]);
+	}
 
-		ASIOBufferInfo	*mBufferInfo;
-		ASIOChannelInfo	*mChannelInfo;
-		// The above two arrays share the same indexing, as the data in them are linked together
+	// Scale and clip samples in [-1, 1) to signed integers of the specified width in scratch
+	inline void ScaleFloatToInteger(const float *input, float *scratch, size_t count, unsigned bits)
+	{
+		float scale = (float)(1u << (bits - 1));
+		float minimum = -scale;
+		// Floats are spaced 128 apart just below 2^31
+		float maximum = 24 < bits ? scale - 128 : scale - 1;
 
-		SFB::Audio::BufferList mBufferList;
+		vDSP_vsmul(input, 1, &scale, scratch, 1, count);
+		vDSP_vclip(scratch, 1, &minimum, &maximum, scratch, 1, count);
+	}
 
-		// Information from ASIOGetSamplePosition()
-		// data is converted to double floats for easier use, however 64 bit integer can be used, too
-		double			mNanoseconds;
-		double			mSamples;
-		double			mTCSamples;	// time code samples
+	// Convert native float samples to an ASIO sample type, returning false if the sample type isn't supported
+	// scratch must hold 2 * count floats
+	bool ConvertFloatToASIOSampleType(const float *input, void *output, size_t count, ASIOSampleType sampleType, float *scratch)
+	{
+		switch(sampleType) {
+			case ASIOSTInt16LSB:
+			case ASIOSTInt16MSB:
+				ScaleFloatToInteger(input, scratch, count, 16);
+				vDSP_vfixr16(scratch, 1, (short *)output, 1, count);
+				if(kHostIsBigEndian != IsBigEndianSampleType(sampleType))
+					SwapBytes((int16_t *)output, count);
+				return true;
 
-		ASIOTime		mTInfo;			// time info state
-		unsigned long	mSysRefTime;      // system reference time, when bufferSwitch() was called
-	};
+			case ASIOSTInt24LSB:
+			case ASIOSTInt24MSB:
+			{
+				// The integers are built following the scaled samples in scratch and then packed into three bytes
+				ScaleFloatToInteger(input, scratch, count, 24);
+				auto samples = (int *)(scratch + count);
+				vDSP_vfixr32(scratch, 1, samples, 1, count);
+
+				auto bytes = (uint8_t *)output;
+				bool bigEndian = IsBigEndianSampleType(sampleType);
+				for(size_t i = 0; i < count; ++i) {
+					auto sample = (uint32_t)samples[i];
+					bytes[0] = (uint8_t)(bigEndian ? sample >> 16 : sample);
+					bytes[1] = (uint8_t)(sample >> 8);
+					bytes[2] = (uint8_t)(bigEndian ? sample : sample >> 16);
+					bytes += 3;
+				}
+				return true;
+			}
 
-	// ========================================
-	// Callback prototypes
-	void myASIOBufferSwitch(long doubleBufferIndex, ASIOBool directProcess);
-	void myASIOSampleRateDidChange(ASIOSampleRate sRate);
-	long myASIOMessage(long selector, long value, void *message, double *opt);
-	ASIOTime * myASIOBufferSwitchTimeInfo(ASIOTime *params, long doubleBufferIndex, ASIOBool directProcess);
+			case ASIOSTInt32LSB:
+			case ASIOSTInt32MSB:
+			case ASIOSTInt32LSB16:
+			case ASIOSTInt32MSB16:
+			case ASIOSTInt32LSB18:
+			case ASIOSTInt32MSB18:
+			case ASIOSTInt32LSB20:
+			case ASIOSTInt32MSB20:
+			case ASIOSTInt32LSB24:
+			case ASIOSTInt32MSB24:
+			{
+				unsigned bits = 32;
+				switch(sampleType) {
+					case ASIOSTInt32LSB16:	case ASIOSTInt32MSB16:	bits = 16;	break;
+					case ASIOSTInt32LSB18:	case ASIOSTInt32MSB18:	bits = 18;	break;
+					case ASIOSTInt32LSB20:	case ASIOSTInt32MSB20:	bits = 20;	break;
+					case ASIOSTInt32LSB24:	case ASIOSTInt32MSB24:	bits = 24;	break;
+					default:										bits = 32;	break;
+				}
+
+				// Samples narrower than 32 bits are aligned to the least significant bit
+				ScaleFloatToInteger(input, scratch, count, bits);
+				vDSP_vfixr32(scratch, 1, (int *)output, 1, count);
+				if(kHostIsBigEndian != IsBigEndianSampleType(sampleType))
+					SwapBytes((int32_t *)output, count);
+				return true;
+			}
 
-	// ========================================
-	// Sadly ASIO requires global state
-	static SFB::Audio::ASIOOutput *sOutput	= nullptr;
-	static AsioDriver		*sASIO		= nullptr;
-	static DriverInfo		sDriverInfo	= {};
-	static ASIOCallbacks	sCallbacks	= {
-		.bufferSwitch			= myASIOBufferSwitch,
-		.sampleRateDidChange	= myASIOSampleRateDidChange,
-		.asioMessage			= myASIOMessage,
-		.bufferSwitchTimeInfo	= myASIOBufferSwitchTimeInfo
-	};
+			case ASIOSTFloat32LSB:
+			case ASIOSTFloat32MSB:
+				memcpy(output, input, count * sizeof(float));
+				if(!IsNativeFloat32SampleType(sampleType))
+					SwapBytes((int32_t *)output, count);
+				return true;
+
+			case ASIOSTFloat64LSB:
+			case ASIOSTFloat64MSB:
+				vDSP_vspdp(input, 1, (double *)output, 1, count);
+				if(kHostIsBigEndian != IsBigEndianSampleType(sampleType))
+					SwapBytes((uint64_t *)output, count);
+				return true;
+		}
+
+		return false;
+	}
+
+	const size_t kUIDLength = 1024;
 
 	// ========================================
-	// Callbacks
+	// ASIO callbacks carry no context, so each open output is assigned a slot with its own callbacks
+	const size_t kMaximumOutputCount = 8;
+	std::atomic<SFB::Audio::ASIOOutput *> sOutputs [kMaximumOutputCount];
 
-	// Backdoor into myASIOBufferSwitchTimeInfo
-	void myASIOBufferSwitch(long doubleBufferIndex, ASIOBool directProcess)
+	template <size_t N>
+	struct CallbackTrampoline
 	{
-		ASIOTime timeInfo = {};
+		static void BufferSwitch(long doubleBufferIndex, ASIOBool directProcess)
+		{
+#pragma unused(directProcess)
 
-		auto result = sASIO->getSamplePosition(&timeInfo.timeInfo.samplePosition, &timeInfo.timeInfo.systemTime);
-		if(ASE_OK == result)
-			timeInfo.timeInfo.flags = kSystemTimeValid | kSamplePositionValid;
+			auto output = sOutputs[N].load(std::memory_order_acquire);
+			if(output)
+				output->HandleBufferSwitch(doubleBufferIndex, nullptr);
+		}
 
-		myASIOBufferSwitchTimeInfo(&timeInfo, doubleBufferIndex, directProcess);
-	}
+		static void SampleRateDidChange(ASIOSampleRate sRate)
+		{
+			LOGGER_INFO("org.sbooth.AudioEngine.Output.ASIO", "SampleRateDidChange: New sample rate " << sRate);
+		}
 
-	void myASIOSampleRateDidChange(ASIOSampleRate sRate)
-	{
-		LOGGER_INFO("org.sbooth.AudioEngine.Output.ASIO", "myASIOSampleRateDidChange: New sample rate " << sRate);
+		static long Message(long selector, long value, void *message, double *opt)
+		{
+			auto output = sOutputs[N].load(std::memory_order_acquire);
+			if(output)
+				return output->HandleASIOMessage(selector, value, message, opt);
+			return 0;
+		}
+
+		static ASIOTime * BufferSwitchTimeInfo(ASIOTime *params, long doubleBufferIndex, ASIOBool directProcess)
+		{
+#pragma unused(directProcess)
+
+			auto output = sOutputs[N].load(std::memory_order_acquire);
+			if(output)
+				output->HandleBufferSwitch(doubleBufferIndex, params);
+			return nullptr;
+		}
+	};
+
+#define ASIO_CALLBACKS(n) { \
+		.bufferSwitch			= CallbackTrampoline<n>::BufferSwitch, \
+		.sampleRateDidChange	= CallbackTrampoline<n>::SampleRateDidChange, \
+		.asioMessage			= CallbackTrampoline<n>::Message, \
+		.bufferSwitchTimeInfo	= CallbackTrampoline<n>::BufferSwitchTimeInfo \
 	}
 
-	long myASIOMessage(long selector, long value, void *message, double *opt)
+	ASIOCallbacks sCallbacks [kMaximumOutputCount] = {
+		ASIO_CALLBACKS(0), ASIO_CALLBACKS(1), ASIO_CALLBACKS(2), ASIO_CALLBACKS(3),
+		ASIO_CALLBACKS(4), ASIO_CALLBACKS(5), ASIO_CALLBACKS(6), ASIO_CALLBACKS(7)
+	};
+
+#undef ASIO_CALLBACKS
+
+	static_assert(kMaximumOutputCount == sizeof(sCallbacks) / sizeof(sCallbacks[0]), "Each slot requires callbacks");
+
+	// Claim a callback slot for output, returning its index or -1 if none are available
+	long AcquireCallbackSlot(SFB::Audio::ASIOOutput *output)
 	{
-		if(sOutput)
-			return sOutput->HandleASIOMessage(selector, value, message, opt);
-		return 0;
+		for(size_t i = 0; i < kMaximumOutputCount; ++i) {
+			SFB::Audio::ASIOOutput *expected = nullptr;
+			if(sOutputs[i].compare_exchange_strong(expected, output))
+				return (long)i;
+		}
+		return -1;
 	}
 
-	ASIOTime * myASIOBufferSwitchTimeInfo(ASIOTime *params, long doubleBufferIndex, ASIOBool directProcess)
+	void ReleaseCallbackSlot(long slot)
 	{
-#pragma unused(params)
-#pragma unused(directProcess)
-
-		if(sOutput)
-			sOutput->FillASIOBuffer(doubleBufferIndex);
-		return nullptr;
+		if(0 <= slot && kMaximumOutputCount > (size_t)slot)
+			sOutputs[slot].store(nullptr);
 	}
 
 }
 
+// ========================================
+// Information about an ASIO driver
+struct SFB::Audio::ASIOOutput::DriverInfo
+{
+	AsioDriver		*mASIO;
+	void			*mLibraryHandle;
+	long			mCallbackSlot;	// The index in sOutputs and sCallbacks, or -1
+
+	ASIODriverInfo	mDriverInfo;
+	char			mUID [kUIDLength];
+
+	long			mInputChannelCount;
+	long			mOutputChannelCount;
+
+	long			mMinimumBufferSize;
+	long			mMaximumBufferSize;
+	long			mPreferredBufferSize;
+	long			mBufferGranularity;
+	long			mBufferSize;		// The size of the created buffers
+
+	ASIOSampleType	mFormat;
+	ASIOSampleRate	mSampleRate;
+
+	bool			mPostOutput;
+
+	long			mInputLatency;
+	long			mOutputLatency;
+
+	long			mInputBufferCount;	// becomes number of actual created input buffers
+	long			mOutputBufferCount;	// becomes number of actual created output buffers
+
+	ASIOBufferInfo	*mBufferInfo;
+	ASIOChannelInfo	*mChannelInfo;
+	// The above two arrays share the same indexing, as the data in them are linked together
+
+	SFB::Audio::BufferList mBufferList;
+
+	// AudioBufferLists addressing the output buffers for each double buffer index, or nullptr if
+	// the player's audio must be copied from mBufferList
+	AudioBufferList	*mDirectBufferList [2];
+	UInt32			mBufferByteSize;	// The size of each output buffer in bytes
+
+	// AudioBufferLists addressing the input buffers for each double buffer index, or nullptr if no input is captured
+	AudioBufferList	*mInputBufferList [2];
+
+	// PCM is rendered as native floats and converted to the output buffers' sample type
+	ASIOSampleType		mSampleType;
+	bool				mConvertSamples;
+	std::vector<float>	mConversionBuffer;
+
+	// Callback timing, accessed only on the callback thread
+	double			mBufferDuration;		// In nanoseconds
+	double			mLastSystemTime;		// In nanoseconds, or 0
+
+	// Information from ASIOGetSamplePosition()
+	// data is converted to double floats for easier use, however 64 bit integer can be used, too
+	double			mNanoseconds;
+	double			mSamples;
+	double			mTCSamples;	// time code samples
+
+	ASIOTime		mTInfo;			// time info state
+	unsigned long	mSysRefTime;      // system reference time, when bufferSwitch() was called
+};
+
 const CFStringRef SFB::Audio::ASIOOutput::kDriverIDKey					= CFSTR("ID");
 const CFStringRef SFB::Audio::ASIOOutput::kDriverNumberKey				= CFSTR("Number");
 const CFStringRef SFB::Audio::ASIOOutput::kDriverDisplayNameKey			= CFSTR("Display Name");
@@ -290,6 +536,139 @@ const CFStringRef SFB::Audio::ASIOOutput::kDriverCompanyKey				= CFSTR("Company
 const CFStringRef SFB::Audio::ASIOOutput::kDriverFolderKey				= CFSTR("Install Folder");
 const CFStringRef SFB::Audio::ASIOOutput::kDriverArchitecturesKey		= CFSTR("Architectures");
 const CFStringRef SFB::Audio::ASIOOutput::kDriverUIDKey					= CFSTR("UID");
+const CFStringRef SFB::Audio::ASIOOutput::kDriverCapabilitiesKey		= CFSTR("Capabilities");
+
+const CFStringRef SFB::Audio::ASIOOutput::kDriverInputChannelCountKey	= CFSTR("Input Channel Count");
+const CFStringRef SFB::Audio::ASIOOutput::kDriverOutputChannelCountKey	= CFSTR("Output Channel Count");
+const CFStringRef SFB::Audio::ASIOOutput::kDriverSampleRatesKey			= CFSTR("Sample Rates");
+const CFStringRef SFB::Audio::ASIOOutput::kDriverSampleTypeKey			= CFSTR("Sample Type");
+
+namespace {
+
+	// ========================================
+	// Driver capability cache
+
+	// Sample rates probed when a driver's capabilities are determined
+	const double sProbedSampleRates [] = { 44100, 48000, 88200, 96000, 176400, 192000, 352800, 384000 };
+
+	// The cache key for a driver, since a library may provide several drivers
+	SFB::CFString CreateCapabilityCacheKey(const AsioLibInfo& libInfo, const char *libPath)
+	{
+		return SFB::CFString(nullptr, CFSTR("%s#%d"), libPath, libInfo.Number);
+	}
+
+	bool GetLibraryModificationDate(const char *libPath, double& modificationDate)
+	{
+		struct stat fileInfo;
+		if(-1 == stat(libPath, &fileInfo))
+			return false;
+
+		modificationDate = (double)fileInfo.st_mtimespec.tv_sec + ((double)fileInfo.st_mtimespec.tv_nsec / NSEC_PER_SEC);
+		return true;
+	}
+
+	// Returns the cached capabilities of a driver if the library is unchanged since they were determined
+	CFDictionaryRef CopyCachedCapabilities(const AsioLibInfo& libInfo)
+	{
+		char libPath [ASIO_LIB_ID_CAPACITY + ASIO_LIB_FOLDER_CAPACITY];
+		AsioLibWrapper::GetLibPath(libInfo, libPath);
+
+		double modificationDate;
+		if(!GetLibraryModificationDate(libPath, modificationDate))
+			return nullptr;
+
+		SFB::CFDictionary cache((CFDictionaryRef)CFPreferencesCopyAppValue(CAPABILITY_CACHE_KEY, CAPABILITY_CACHE_APPLICATION_ID));
+		if(!cache || CFDictionaryGetTypeID() != CFGetTypeID(cache))
+			return nullptr;
+
+		auto key = CreateCapabilityCacheKey(libInfo, libPath);
+		auto capabilities = (CFDictionaryRef)CFDictionaryGetValue(cache, key);
+		if(!capabilities || CFDictionaryGetTypeID() != CFGetTypeID(capabilities))
+			return nullptr;
+
+		auto cachedDate = (CFNumberRef)CFDictionaryGetValue(capabilities, CAPABILITY_CACHE_DATE_KEY);
+		double cachedModificationDate;
+		if(!cachedDate || !CFNumberGetValue(cachedDate, kCFNumberDoubleType, &cachedModificationDate) || cachedModificationDate != modificationDate)
+			return nullptr;
+
+		return (CFDictionaryRef)CFRetain(capabilities);
+	}
+
+	void StoreCachedCapabilities(const AsioLibInfo& libInfo, CFDictionaryRef capabilities)
+	{
+		char libPath [ASIO_LIB_ID_CAPACITY + ASIO_LIB_FOLDER_CAPACITY];
+		AsioLibWrapper::GetLibPath(libInfo, libPath);
+
+		double modificationDate;
+		if(!GetLibraryModificationDate(libPath, modificationDate))
+			return;
+
+		SFB::CFMutableDictionary entry(CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, capabilities));
+		SFB::CFNumber date(kCFNumberDoubleType, &modificationDate);
+		if(!entry || !date)
+			return;
+		CFDictionarySetValue(entry, CAPABILITY_CACHE_DATE_KEY, date);
+
+		SFB::CFDictionary cache((CFDictionaryRef)CFPreferencesCopyAppValue(CAPABILITY_CACHE_KEY, CAPABILITY_CACHE_APPLICATION_ID));
+		SFB::CFMutableDictionary newCache(cache && CFDictionaryGetTypeID() == CFGetTypeID(cache)
+									  ? CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, cache)
+									  : CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks));
+		if(!newCache)
+			return;
+
+		CFDictionarySetValue(newCache, CreateCapabilityCacheKey(libInfo, libPath), entry);
+
+		CFPreferencesSetAppValue(CAPABILITY_CACHE_KEY, newCache, CAPABILITY_CACHE_APPLICATION_ID);
+		if(!CFPreferencesAppSynchronize(CAPABILITY_CACHE_APPLICATION_ID))
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Output.ASIO", "Unable to save driver capabilities");
+	}
+
+	// Query an initialized driver's capabilities
+	CFDictionaryRef CreateCapabilitiesForDriver(AsioDriverType *driver)
+	{
+		long inputChannelCount, outputChannelCount;
+		if(ASE_OK != driver->getChannels(&inputChannelCount, &outputChannelCount))
+			return nullptr;
+
+		SFB::CFMutableArray sampleRates(0, &kCFTypeArrayCallBacks);
+		if(!sampleRates)
+			return nullptr;
+
+		for(auto sampleRate : sProbedSampleRates) {
+			if(ASE_OK == driver->canSampleRate(sampleRate)) {
+				SFB::CFNumber number(kCFNumberDoubleType, &sampleRate);
+				CFArrayAppendValue(sampleRates, number);
+			}
+		}
+
+		SFB::CFMutableDictionary capabilities(0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+		if(!capabilities)
+			return nullptr;
+
+		SFB::CFNumber inputChannels(kCFNumberLongType, &inputChannelCount);
+		CFDictionarySetValue(capabilities, SFB::Audio::ASIOOutput::kDriverInputChannelCountKey, inputChannels);
+
+		SFB::CFNumber outputChannels(kCFNumberLongType, &outputChannelCount);
+		CFDictionarySetValue(capabilities, SFB::Audio::ASIOOutput::kDriverOutputChannelCountKey, outputChannels);
+
+		CFDictionarySetValue(capabilities, SFB::Audio::ASIOOutput::kDriverSampleRatesKey, sampleRates);
+
+		if(0 < outputChannelCount) {
+			ASIOChannelInfo channelInfo = {
+				.channel = 0,
+				.isInput = ASIOFalse
+			};
+
+			if(ASE_OK == driver->getChannelInfo(&channelInfo)) {
+				SFB::CFNumber sampleType(kCFNumberLongType, &channelInfo.type);
+				CFDictionarySetValue(capabilities, SFB::Audio::ASIOOutput::kDriverSampleTypeKey, sampleType);
+			}
+		}
+
+		return capabilities.Relinquish();
+	}
+
+}
 
 bool SFB::Audio::ASIOOutput::IsAvailable()
 {
@@ -347,12 +726,67 @@ CFArrayRef SFB::Audio::ASIOOutput::CreateAvailableDrivers()
 		else
 			LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to create driver UID");
 
+		SFB::CFDictionary capabilities(CopyCachedCapabilities(buffer[i]));
+		if(capabilities)
+			CFDictionarySetValue(driverDictionary, kDriverCapabilitiesKey, capabilities);
+
 		CFArrayAppendValue(driverInfoArray, driverDictionary);
 	}
 
 	return driverInfoArray.Relinquish();
 }
 
+CFDictionaryRef SFB::Audio::ASIOOutput::CreateDriverCapabilities(CFStringRef driverUID)
+{
+	if(nullptr == driverUID)
+		return nullptr;
+
+	char uid [kUIDLength];
+	if(!CFStringGetCString(driverUID, uid, kUIDLength, kCFStringEncodingUTF8))
+		return nullptr;
+
+	AsioLibInfo libInfo;
+	AsioLibInfo::FromCString(libInfo, uid, '|');
+
+	auto capabilities = CopyCachedCapabilities(libInfo);
+	if(capabilities)
+		return capabilities;
+
+	// Load the driver only long enough to examine it
+	LOGGER_INFO("org.sbooth.AudioEngine.Output.ASIO", "Determining capabilities for driver " << libInfo.DisplayName);
+
+	auto libHandle = AsioLibWrapper::LoadLibHandle(libInfo);
+	if(!libHandle) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to load ASIO library");
+		return nullptr;
+	}
+
+	AsioDriverType *driver = nullptr;
+	if(AsioLibWrapper::CreateInstance(libHandle, libInfo.Number, &driver) || !driver) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to instantiate ASIO driver");
+		AsioLibWrapper::UnloadLibHandle(libHandle);
+		return nullptr;
+	}
+
+	ASIODriverInfo driverInfo = {
+		.asioVersion = 2,
+		.sysRef = nullptr
+	};
+
+	if(driver->init(&driverInfo)) {
+		capabilities = CreateCapabilitiesForDriver(driver);
+		if(capabilities)
+			StoreCachedCapabilities(libInfo, capabilities);
+	}
+	else
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to init ASIO driver: " << driverInfo.errorMessage);
+
+	delete driver;
+	AsioLibWrapper::UnloadLibHandle(libHandle);
+
+	return capabilities;
+}
+
 #pragma mark Creation and Destruction
 
 SFB::Audio::Output::unique_ptr SFB::Audio::ASIOOutput::CreateInstanceForDriverUID(CFStringRef driverUID)
@@ -361,8 +795,13 @@ SFB::Audio::Output::unique_ptr SFB::Audio::ASIOOutput::CreateInstanceForDriverUI
 }
 
 SFB::Audio::ASIOOutput::ASIOOutput()
-	: mEventQueue(new SFB::RingBuffer), mStateChangedBlock(nullptr)
+	: mDriverInfo(new DriverInfo()), mIsRunning(false), mEventQueue(new SFB::RingBuffer), mStateChangedBlock(nullptr), mRequestedBufferSize(0), mOverloadCount(0), mResetRequestCount(0), mCallbackCount(0), mTimeInfoJitter(0), mBufferSizeAdjustmentCount(0), mAdaptiveBufferSizing(false), mOverloadWindowStart(0), mOverloadWindowCount(0), mLastOverloadTime(0), mLastBufferSizeChangeTime(0), mBaseBufferSize(0), mRequestedInputChannelCount(0), mInputCallback(nullptr), mInputCallbackContext(nullptr)
 {
+	for(auto& count : mCallbackLoadHistogram)
+		count.store(0);
+
+	mDriverInfo->mCallbackSlot = -1;
+
 	mEventQueue->Allocate(512);
 
 	// Setup the event dispatch timer
@@ -391,10 +830,12 @@ SFB::Audio::ASIOOutput::ASIOOutput()
 
 				case eMessageQueueEventASIOOverload:
 					LOGGER_INFO("org.sbooth.AudioEngine.Output.ASIO", "ASIO overload");
+					AdaptBufferSizeToOverloads(true);
 					break;
 			}
 		}
 
+		AdaptBufferSizeToOverloads(false);
 
 	});
 
@@ -410,6 +851,10 @@ SFB::Audio::ASIOOutput::ASIOOutput(CFStringRef driverUID)
 
 SFB::Audio::ASIOOutput::~ASIOOutput()
 {
+	// The callback slot must be released before this object is destroyed
+	if(_IsOpen())
+		_Close();
+
 	dispatch_release(mEventQueueTimer);
 }
 
@@ -418,7 +863,7 @@ SFB::Audio::ASIOOutput::~ASIOOutput()
 bool SFB::Audio::ASIOOutput::GetDeviceIOFormat(DeviceIOFormat& deviceIOFormat) const
 {
 	ASIOIoFormat asioFormat;
-	auto result = sASIO->future(kAsioGetIoFormat, &asioFormat);
+	auto result = mDriverInfo->mASIO->future(kAsioGetIoFormat, &asioFormat);
 	if(ASE_SUCCESS != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to get ASIO format: " << result);
 		return false;
@@ -443,7 +888,7 @@ bool SFB::Audio::ASIOOutput::SetDeviceIOFormat(const DeviceIOFormat& deviceIOFor
 		.future			= {0}
 	};
 
-	auto result = sASIO->future(kAsioSetIoFormat, &asioFormat);
+	auto result = mDriverInfo->mASIO->future(kAsioSetIoFormat, &asioFormat);
 	if(ASE_SUCCESS != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to set ASIO format: " << result);
 		return false;
@@ -452,6 +897,41 @@ bool SFB::Audio::ASIOOutput::SetDeviceIOFormat(const DeviceIOFormat& deviceIOFor
 	return true;
 }
 
+SFB::Audio::ASIOOutput::Statistics SFB::Audio::ASIOOutput::GetStatistics() const
+{
+	Statistics statistics = {
+		.mOverloadCount				= mOverloadCount.load(),
+		.mResetRequestCount			= mResetRequestCount.load(),
+		.mCallbackCount				= mCallbackCount.load(),
+		.mCallbackLoadHistogram		= {},
+		.mTimeInfoJitter			= mTimeInfoJitter.load() / NSEC_PER_SEC,
+		.mBufferSizeAdjustmentCount	= mBufferSizeAdjustmentCount.load()
+	};
+
+	for(size_t i = 0; i < kCallbackLoadHistogramBucketCount; ++i)
+		statistics.mCallbackLoadHistogram[i] = mCallbackLoadHistogram[i].load();
+
+	return statistics;
+}
+
+void SFB::Audio::ASIOOutput::ResetStatistics()
+{
+	mOverloadCount.store(0);
+	mResetRequestCount.store(0);
+	mCallbackCount.store(0);
+	for(auto& count : mCallbackLoadHistogram)
+		count.store(0);
+	mTimeInfoJitter.store(0);
+	mBufferSizeAdjustmentCount.store(0);
+}
+
+void SFB::Audio::ASIOOutput::SetAdaptiveBufferSizingEnabled(bool enabled)
+{
+	LOGGER_INFO("org.sbooth.AudioEngine.Output.ASIO", (enabled ? "Enabling" : "Disabling") << " adaptive buffer sizing");
+
+	mAdaptiveBufferSizing.store(enabled);
+}
+
 void SFB::Audio::ASIOOutput::SetStateChangedBlock(dispatch_block_t block)
 {
 	if(mStateChangedBlock) {
@@ -466,7 +946,7 @@ void SFB::Audio::ASIOOutput::SetStateChangedBlock(dispatch_block_t block)
 
 bool SFB::Audio::ASIOOutput::_GetDeviceSampleRate(Float64& sampleRate) const
 {
-	auto result = sASIO->getSampleRate(&sampleRate);
+	auto result = mDriverInfo->mASIO->getSampleRate(&sampleRate);
 	if(ASE_OK != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to get sample rate: " << result);
 		return false;
@@ -477,9 +957,9 @@ bool SFB::Audio::ASIOOutput::_GetDeviceSampleRate(Float64& sampleRate) const
 
 bool SFB::Audio::ASIOOutput::_SetDeviceSampleRate(Float64 sampleRate)
 {
-	auto result = sASIO->canSampleRate(sampleRate);
+	auto result = mDriverInfo->mASIO->canSampleRate(sampleRate);
 	if(ASE_OK == result) {
-		result = sASIO->setSampleRate(sampleRate);
+		result = mDriverInfo->mASIO->setSampleRate(sampleRate);
 		if(ASE_OK != result) {
 			LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to set sample rate: " << result);
 			return false;
@@ -495,81 +975,139 @@ bool SFB::Audio::ASIOOutput::_SetDeviceSampleRate(Float64 sampleRate)
 
 size_t SFB::Audio::ASIOOutput::_GetPreferredBufferSize() const
 {
-	return (size_t)sDriverInfo.mPreferredBufferSize;
+	return (size_t)(mDriverInfo->mBufferSize ?: mDriverInfo->mPreferredBufferSize);
+}
+
+bool SFB::Audio::ASIOOutput::_GetDeviceBufferFrameSize(UInt32& frameSize) const
+{
+	if(0 == mDriverInfo->mBufferSize)
+		return false;
+
+	frameSize = (UInt32)mDriverInfo->mBufferSize;
+	return true;
+}
+
+bool SFB::Audio::ASIOOutput::_GetDeviceBufferFrameSizeRange(UInt32& minimum, UInt32& maximum) const
+{
+	if(0 == mDriverInfo->mMaximumBufferSize)
+		return false;
+
+	minimum = (UInt32)mDriverInfo->mMinimumBufferSize;
+	maximum = (UInt32)mDriverInfo->mMaximumBufferSize;
+	return true;
+}
+
+bool SFB::Audio::ASIOOutput::_SetDeviceBufferFrameSize(UInt32 frameSize)
+{
+	// ASIO buffers are created for each decoder, so the new size is used when the output is next configured
+	mRequestedBufferSize = (long)frameSize;
+	return true;
 }
 
 #pragma mark -
 
 bool SFB::Audio::ASIOOutput::_Open()
 {
-	if(!CFStringGetCString(mDesiredDriverUID, sDriverInfo.mUID, kUIDLength, kCFStringEncodingUTF8))
+	if(!CFStringGetCString(mDesiredDriverUID, mDriverInfo->mUID, kUIDLength, kCFStringEncodingUTF8))
 		return false;
 
 	AsioLibInfo libInfo;
-	AsioLibInfo::FromCString(libInfo, sDriverInfo.mUID, '|');
+	AsioLibInfo::FromCString(libInfo, mDriverInfo->mUID, '|');
 
-	AsioLibWrapper::UnloadLib();
+	mDriverInfo->mCallbackSlot = AcquireCallbackSlot(this);
+	if(-1 == mDriverInfo->mCallbackSlot) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Output.ASIO", "Too many open ASIO outputs (maximum " << kMaximumOutputCount << ")");
+		return false;
+	}
 
-	if(!AsioLibWrapper::LoadLib(libInfo)) {
+	// Each output holds its own reference to the driver's library so several drivers may be used at once
+	mDriverInfo->mLibraryHandle = AsioLibWrapper::LoadLibHandle(libInfo);
+	if(!mDriverInfo->mLibraryHandle) {
 		LOGGER_CRIT("org.sbooth.AudioEngine.Output.ASIO", "Unable to load ASIO library");
+		_Close();
 		return false;
 	}
 
-	if(AsioLibWrapper::CreateInstance(libInfo.Number, &sASIO)) {
+	if(AsioLibWrapper::CreateInstance(mDriverInfo->mLibraryHandle, libInfo.Number, &mDriverInfo->mASIO)) {
 		LOGGER_CRIT("org.sbooth.AudioEngine.Output.ASIO", "Unable to instantiate ASIO driver");
+		mDriverInfo->mASIO = nullptr;
+		_Close();
 		return false;
 	}
 
-	sDriverInfo.mDriverInfo = {
+	mDriverInfo->mDriverInfo = {
 		.asioVersion = 2,
 		.sysRef = nullptr
 	};
 
-	if(!sASIO->init(&sDriverInfo.mDriverInfo)){
-		LOGGER_CRIT("org.sbooth.AudioEngine.Output.ASIO", "Unable to init ASIO driver: " << sDriverInfo.mDriverInfo.errorMessage);
+	if(!mDriverInfo->mASIO->init(&mDriverInfo->mDriverInfo)){
+		LOGGER_CRIT("org.sbooth.AudioEngine.Output.ASIO", "Unable to init ASIO driver: " << mDriverInfo->mDriverInfo.errorMessage);
+		_Close();
 		return false;
 	}
 
 	// Determine whether to post output notifications
-	if(ASE_OK == sASIO->outputReady())
-		sDriverInfo.mPostOutput = true;
+	if(ASE_OK == mDriverInfo->mASIO->outputReady())
+		mDriverInfo->mPostOutput = true;
+
+	// Refresh the cached capabilities while the driver is loaded
+	SFB::CFDictionary cachedCapabilities(CopyCachedCapabilities(libInfo));
+	if(!cachedCapabilities) {
+		SFB::CFDictionary capabilities(CreateCapabilitiesForDriver(mDriverInfo->mASIO));
+		if(capabilities)
+			StoreCachedCapabilities(libInfo, capabilities);
+	}
 
 	return true;
 }
 
 bool SFB::Audio::ASIOOutput::_Close()
 {
-	sASIO->disposeBuffers();
-	delete sASIO;
-	sASIO = nullptr;
+	if(mDriverInfo->mASIO) {
+		mDriverInfo->mASIO->disposeBuffers();
+		delete mDriverInfo->mASIO;
+		mDriverInfo->mASIO = nullptr;
+	}
 
-	sDriverInfo.mInputBufferCount = 0;
-	sDriverInfo.mOutputBufferCount = 0;
+	AsioLibWrapper::UnloadLibHandle(mDriverInfo->mLibraryHandle);
+	mDriverInfo->mLibraryHandle = nullptr;
 
-	if(sDriverInfo.mBufferInfo) {
-		delete [] sDriverInfo.mBufferInfo;
-		sDriverInfo.mBufferInfo = nullptr;
+	ReleaseCallbackSlot(mDriverInfo->mCallbackSlot);
+	mDriverInfo->mCallbackSlot = -1;
+
+	mDriverInfo->mPostOutput = false;
+	mIsRunning.store(false);
+
+	mDriverInfo->mInputBufferCount = 0;
+	mDriverInfo->mOutputBufferCount = 0;
+	mDriverInfo->mBufferSize = 0;
+
+	if(mDriverInfo->mBufferInfo) {
+		delete [] mDriverInfo->mBufferInfo;
+		mDriverInfo->mBufferInfo = nullptr;
 	}
 
-	if(sDriverInfo.mChannelInfo) {
-		delete [] sDriverInfo.mChannelInfo;
-		sDriverInfo.mChannelInfo = nullptr;
+	if(mDriverInfo->mChannelInfo) {
+		delete [] mDriverInfo->mChannelInfo;
+		mDriverInfo->mChannelInfo = nullptr;
 	}
 
-	sDriverInfo.mBufferList.Deallocate();
+	mDriverInfo->mBufferList.Deallocate();
+	FreeDirectBufferLists();
+	FreeInputBufferLists();
 
 	return true;
 }
 
 bool SFB::Audio::ASIOOutput::_Start()
 {
-	auto result = sASIO->start();
+	auto result = mDriverInfo->mASIO->start();
 	if(ASE_OK != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "start() failed: " << result);
 		return false;
 	}
 
-	sOutput = this;
+	mIsRunning.store(true);
 
 	if(mStateChangedBlock)
 		mStateChangedBlock();
@@ -579,13 +1117,13 @@ bool SFB::Audio::ASIOOutput::_Start()
 
 bool SFB::Audio::ASIOOutput::_Stop()
 {
-	auto result = sASIO->stop();
+	auto result = mDriverInfo->mASIO->stop();
 	if(ASE_OK != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "stop() failed: " << result);
 		return false;
 	}
 
-	sOutput = nullptr;
+	mIsRunning.store(false);
 
 	if(mStateChangedBlock)
 		mStateChangedBlock();
@@ -602,12 +1140,12 @@ bool SFB::Audio::ASIOOutput::_RequestStop()
 
 bool SFB::Audio::ASIOOutput::_IsOpen() const
 {
-	return nullptr != sASIO;
+	return nullptr != mDriverInfo->mASIO;
 }
 
 bool SFB::Audio::ASIOOutput::_IsRunning() const
 {
-	return nullptr != sOutput;
+	return mIsRunning.load();
 }
 
 bool SFB::Audio::ASIOOutput::_Reset()
@@ -617,16 +1155,16 @@ bool SFB::Audio::ASIOOutput::_Reset()
 		return false;
 
 	// Clean up
-	sASIO->disposeBuffers();
+	mDriverInfo->mASIO->disposeBuffers();
 
 	// Re-initialize the driver
-	if(!sASIO->init(&sDriverInfo.mDriverInfo)){
-		LOGGER_CRIT("org.sbooth.AudioEngine.ASIOPlayer", "Unable to init ASIO driver: " << sDriverInfo.mDriverInfo.errorMessage);
+	if(!mDriverInfo->mASIO->init(&mDriverInfo->mDriverInfo)){
+		LOGGER_CRIT("org.sbooth.AudioEngine.ASIOPlayer", "Unable to init ASIO driver: " << mDriverInfo->mDriverInfo.errorMessage);
 		return false;
 	}
 
-	if(ASE_OK == sASIO->outputReady())
-		sDriverInfo.mPostOutput = true;
+	if(ASE_OK == mDriverInfo->mASIO->outputReady())
+		mDriverInfo->mPostOutput = true;
 #endif
 	return true;
 }
@@ -649,22 +1187,24 @@ bool SFB::Audio::ASIOOutput::_SetupForDecoder(const Decoder& decoder)
 		return false;
 
 	// Clean up existing state
-	sASIO->disposeBuffers();
+	mDriverInfo->mASIO->disposeBuffers();
 
-	sDriverInfo.mInputBufferCount = 0;
-	sDriverInfo.mOutputBufferCount = 0;
+	mDriverInfo->mInputBufferCount = 0;
+	mDriverInfo->mOutputBufferCount = 0;
 
-	if(sDriverInfo.mBufferInfo) {
-		delete [] sDriverInfo.mBufferInfo;
-		sDriverInfo.mBufferInfo = nullptr;
+	if(mDriverInfo->mBufferInfo) {
+		delete [] mDriverInfo->mBufferInfo;
+		mDriverInfo->mBufferInfo = nullptr;
 	}
 
-	if(sDriverInfo.mChannelInfo) {
-		delete [] sDriverInfo.mChannelInfo;
-		sDriverInfo.mChannelInfo = nullptr;
+	if(mDriverInfo->mChannelInfo) {
+		delete [] mDriverInfo->mChannelInfo;
+		mDriverInfo->mChannelInfo = nullptr;
 	}
 
-	sDriverInfo.mBufferList.Deallocate();
+	mDriverInfo->mBufferList.Deallocate();
+	FreeDirectBufferLists();
+	FreeInputBufferLists();
 
 	// Configure the ASIO driver with the decoder's format
 	ASIOIoFormat asioFormat = {
@@ -672,7 +1212,7 @@ bool SFB::Audio::ASIOOutput::_SetupForDecoder(const Decoder& decoder)
 		.future			= {0}
 	};
 
-	auto result = sASIO->future(kAsioSetIoFormat, &asioFormat);
+	auto result = mDriverInfo->mASIO->future(kAsioSetIoFormat, &asioFormat);
 	if(ASE_SUCCESS != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to set ASIO format: " << result);
 		return false;
@@ -684,35 +1224,35 @@ bool SFB::Audio::ASIOOutput::_SetupForDecoder(const Decoder& decoder)
 
 	// Store the ASIO driver format
 	asioFormat = {};
-	result = sASIO->future(kAsioGetIoFormat, &asioFormat);
+	result = mDriverInfo->mASIO->future(kAsioGetIoFormat, &asioFormat);
 	if(ASE_SUCCESS != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to get ASIO format: " << result);
 		return false;
 	}
 
-	sDriverInfo.mFormat = asioFormat.FormatType;
+	mDriverInfo->mFormat = asioFormat.FormatType;
 //	if(asioFormat.FormatType != format.streamType) {
 //		return false;
 //	}
 
-	if(!GetDeviceSampleRate(sDriverInfo.mSampleRate))
+	if(!GetDeviceSampleRate(mDriverInfo->mSampleRate))
 		return false;
 
 
 	// Query available channels
-	result = sASIO->getChannels(&sDriverInfo.mInputChannelCount, &sDriverInfo.mOutputChannelCount);
+	result = mDriverInfo->mASIO->getChannels(&mDriverInfo->mInputChannelCount, &mDriverInfo->mOutputChannelCount);
 	if(ASE_OK != result) {
 		LOGGER_CRIT("org.sbooth.AudioEngine.Output.ASIO", "Unable to obtain ASIO channel count: " << result);
 		return false;
 	}
 
-//	if(0 == sDriverInfo.mOutputChannelCount) {
+//	if(0 == mDriverInfo->mOutputChannelCount) {
 //		LOGGER_CRIT("org.sbooth.AudioEngine.Output.ASIO", "No available output channels");
 //		return false;
 //	}
 
 	// FIXME: Is there a way to dynamically query the channel layout?
-	switch(sDriverInfo.mOutputChannelCount) {
+	switch(mDriverInfo->mOutputChannelCount) {
 			// exaSound's ASIO drivers support stereo and 8 channel
 		case 2:		mDriverChannelLayout = ChannelLayout::Stereo;														break;
 //		case 8:		mDriverChannelLayout = ChannelLayout::ChannelLayoutWithTag(kAudioChannelLayoutTag_MPEG_7_1_A);		break;
@@ -724,45 +1264,50 @@ bool SFB::Audio::ASIOOutput::_SetupForDecoder(const Decoder& decoder)
 	}
 
 	// Get the preferred buffer size
-	result = sASIO->getBufferSize(&sDriverInfo.mMinimumBufferSize, &sDriverInfo.mMaximumBufferSize, &sDriverInfo.mPreferredBufferSize, &sDriverInfo.mBufferGranularity);
+	result = mDriverInfo->mASIO->getBufferSize(&mDriverInfo->mMinimumBufferSize, &mDriverInfo->mMaximumBufferSize, &mDriverInfo->mPreferredBufferSize, &mDriverInfo->mBufferGranularity);
 	if(ASE_OK != result) {
 		LOGGER_CRIT("org.sbooth.AudioEngine.Output.ASIO", "Unable to obtain ASIO buffer size: " << result);
 		return false;
 	}
 
+	mDriverInfo->mBufferSize = mRequestedBufferSize ? ClosestSupportedBufferSize(mRequestedBufferSize) : mDriverInfo->mPreferredBufferSize;
+	mDriverInfo->mLastSystemTime = 0;
+
 	// Prepare ASIO buffers
 
-	sDriverInfo.mInputBufferCount = std::min(sDriverInfo.mInputChannelCount, 0L);
-	sDriverInfo.mOutputBufferCount = std::min(sDriverInfo.mOutputChannelCount, (long)decoderFormat.mChannelsPerFrame);
+	// Input buffers precede output buffers
+	mDriverInfo->mInputBufferCount = std::min(mDriverInfo->mInputChannelCount, (long)mRequestedInputChannelCount.load());
+	mDriverInfo->mOutputBufferCount = std::min(mDriverInfo->mOutputChannelCount, (long)decoderFormat.mChannelsPerFrame);
 
-	sDriverInfo.mBufferInfo = new ASIOBufferInfo [sDriverInfo.mInputBufferCount + sDriverInfo.mOutputBufferCount];
-	sDriverInfo.mChannelInfo = new ASIOChannelInfo [sDriverInfo.mInputBufferCount + sDriverInfo.mOutputBufferCount];
+	mDriverInfo->mBufferInfo = new ASIOBufferInfo [mDriverInfo->mInputBufferCount + mDriverInfo->mOutputBufferCount];
+	mDriverInfo->mChannelInfo = new ASIOChannelInfo [mDriverInfo->mInputBufferCount + mDriverInfo->mOutputBufferCount];
 
-	for(long channelIndex = 0; channelIndex < sDriverInfo.mInputBufferCount; ++channelIndex) {
-		sDriverInfo.mBufferInfo[channelIndex].isInput = ASIOTrue;
-		sDriverInfo.mBufferInfo[channelIndex].channelNum = channelIndex;
-		sDriverInfo.mBufferInfo[channelIndex].buffers[0] = sDriverInfo.mBufferInfo[channelIndex].buffers[1] = nullptr;
+	for(long channelIndex = 0; channelIndex < mDriverInfo->mInputBufferCount; ++channelIndex) {
+		mDriverInfo->mBufferInfo[channelIndex].isInput = ASIOTrue;
+		mDriverInfo->mBufferInfo[channelIndex].channelNum = channelIndex;
+		mDriverInfo->mBufferInfo[channelIndex].buffers[0] = mDriverInfo->mBufferInfo[channelIndex].buffers[1] = nullptr;
 	}
 
-	for(long channelIndex = sDriverInfo.mInputBufferCount; channelIndex < sDriverInfo.mOutputBufferCount; ++channelIndex) {
-		sDriverInfo.mBufferInfo[channelIndex].isInput = ASIOFalse;
-		sDriverInfo.mBufferInfo[channelIndex].channelNum = channelIndex;
-		sDriverInfo.mBufferInfo[channelIndex].buffers[0] = sDriverInfo.mBufferInfo[channelIndex].buffers[1] = nullptr;
+	for(long channelIndex = 0; channelIndex < mDriverInfo->mOutputBufferCount; ++channelIndex) {
+		auto& bufferInfo = mDriverInfo->mBufferInfo[mDriverInfo->mInputBufferCount + channelIndex];
+		bufferInfo.isInput = ASIOFalse;
+		bufferInfo.channelNum = channelIndex;
+		bufferInfo.buffers[0] = bufferInfo.buffers[1] = nullptr;
 	}
 
 	// Create the buffers
-	result = sASIO->createBuffers(sDriverInfo.mBufferInfo, sDriverInfo.mInputBufferCount + sDriverInfo.mOutputBufferCount, sDriverInfo.mPreferredBufferSize, &sCallbacks);
+	result = mDriverInfo->mASIO->createBuffers(mDriverInfo->mBufferInfo, mDriverInfo->mInputBufferCount + mDriverInfo->mOutputBufferCount, mDriverInfo->mBufferSize, &sCallbacks[mDriverInfo->mCallbackSlot]);
 	if(ASE_OK != result) {
 		LOGGER_CRIT("org.sbooth.AudioEngine.Output.ASIO", "Unable to create ASIO buffers: " << result);
 		return false;
 	}
 
 	// Get the buffer details, sample word length, name, word clock group and activation
-	for(long i = 0; i < sDriverInfo.mInputBufferCount + sDriverInfo.mOutputBufferCount; ++i) {
-		sDriverInfo.mChannelInfo[i].channel = sDriverInfo.mBufferInfo[i].channelNum;
-		sDriverInfo.mChannelInfo[i].isInput = sDriverInfo.mBufferInfo[i].isInput;
+	for(long i = 0; i < mDriverInfo->mInputBufferCount + mDriverInfo->mOutputBufferCount; ++i) {
+		mDriverInfo->mChannelInfo[i].channel = mDriverInfo->mBufferInfo[i].channelNum;
+		mDriverInfo->mChannelInfo[i].isInput = mDriverInfo->mBufferInfo[i].isInput;
 
-		result = sASIO->getChannelInfo(&sDriverInfo.mChannelInfo[i]);
+		result = mDriverInfo->mASIO->getChannelInfo(&mDriverInfo->mChannelInfo[i]);
 		if(ASE_OK != result) {
 			LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to get ASIO channel information: " << result);
 			break;
@@ -774,7 +1319,7 @@ bool SFB::Audio::ASIOOutput::_SetupForDecoder(const Decoder& decoder)
 		// Latencies often are only valid after ASIOCreateBuffers()
 		//  (input latency is the age of the first sample in the currently returned audio block)
 		//  (output latency is the time the first sample in the currently returned audio block requires to get to the output)
-		result = sASIO->getLatencies(&sDriverInfo.mInputLatency, &sDriverInfo.mOutputLatency);
+		result = mDriverInfo->mASIO->getLatencies(&mDriverInfo->mInputLatency, &mDriverInfo->mOutputLatency);
 		if(ASE_OK != result)
 			LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to get ASIO latencies: " << result);
 	}
@@ -782,28 +1327,52 @@ bool SFB::Audio::ASIOOutput::_SetupForDecoder(const Decoder& decoder)
 
 	// Set the format to the first output channel
 	// FIXME: Can each channel have a separate format?
-	for(long i = 0; i < sDriverInfo.mInputBufferCount + sDriverInfo.mOutputBufferCount; ++i) {
-		if(!sDriverInfo.mChannelInfo[i].isInput) {
-			AudioFormat format = AudioFormatForASIOSampleType(sDriverInfo.mChannelInfo[i].type);
-			format.mSampleRate = sDriverInfo.mSampleRate;
+	for(long i = 0; i < mDriverInfo->mInputBufferCount + mDriverInfo->mOutputBufferCount; ++i) {
+		if(!mDriverInfo->mChannelInfo[i].isInput) {
+			mDriverInfo->mSampleType = mDriverInfo->mChannelInfo[i].type;
+
+			AudioFormat format = AudioFormatForASIOSampleType(mDriverInfo->mSampleType);
+			format.mSampleRate = mDriverInfo->mSampleRate;
 			format.mChannelsPerFrame = decoderFormat.mChannelsPerFrame;
 
+			mDriverInfo->mBufferByteSize = (UInt32)format.FrameCountToByteCount((size_t)mDriverInfo->mBufferSize);
+			mDriverInfo->mBufferDuration = 0 < format.mSampleRate ? (mDriverInfo->mBufferSize * NSEC_PER_SEC) / format.mSampleRate : 0;
+
+			// The player is given PCM as native floats regardless of the driver's sample type,
+			// so changing drivers doesn't require a new converter or ring buffer
+			mDriverInfo->mConvertSamples = format.IsPCM() && !IsNativeFloat32SampleType(mDriverInfo->mSampleType);
+			if(mDriverInfo->mConvertSamples) {
+				format.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+				format.mBitsPerChannel		= 32;
+				format.mBytesPerPacket		= sizeof(float);
+				format.mFramesPerPacket		= 1;
+				format.mBytesPerFrame		= sizeof(float);
+
+				mDriverInfo->mConversionBuffer.resize(2 * (size_t)mDriverInfo->mBufferSize);
+			}
+
 			mFormat = format;
 
 			break;
 		}
 	}
 
-	sDriverInfo.mBufferList.Allocate(mFormat, (UInt32)sDriverInfo.mPreferredBufferSize);
+	mDriverInfo->mBufferList.Allocate(mFormat, (UInt32)mDriverInfo->mBufferSize);
 
 	// Set up the channel map
 	mChannelLayout = decoder.GetChannelLayout();
 	if(!mChannelLayout.MapToLayout(mDriverChannelLayout, mChannelMap))
 		mChannelMap.clear();
 
+	if(!CreateDirectBufferLists())
+		LOGGER_INFO("org.sbooth.AudioEngine.Output.ASIO", "Sample type or channel mapping requires copying audio to ASIO buffers");
+
+	if(0 < mDriverInfo->mInputBufferCount && !CreateInputBufferLists())
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.ASIO", "Unable to create input buffer lists");
+
 	// Ensure the ring buffer is large enough
-	if(8 * sDriverInfo.mPreferredBufferSize > mPlayer->GetRingBufferCapacity())
-		mPlayer->SetRingBufferCapacity((uint32_t)(8 * sDriverInfo.mPreferredBufferSize));
+	if(8 * mDriverInfo->mBufferSize > mPlayer->GetRingBufferCapacity())
+		mPlayer->SetRingBufferCapacity((uint32_t)(8 * mDriverInfo->mBufferSize));
 
 	if(running && !_Start())
 		return false;
@@ -813,7 +1382,7 @@ bool SFB::Audio::ASIOOutput::_SetupForDecoder(const Decoder& decoder)
 
 bool SFB::Audio::ASIOOutput::_CreateDeviceUID(CFStringRef& deviceUID) const
 {
-	deviceUID = CFStringCreateWithCString(kCFAllocatorDefault, sDriverInfo.mUID, kCFStringEncodingUTF8);
+	deviceUID = CFStringCreateWithCString(kCFAllocatorDefault, mDriverInfo->mUID, kCFStringEncodingUTF8);
 	if(nullptr == deviceUID)
 		return false;
 
@@ -822,44 +1391,229 @@ bool SFB::Audio::ASIOOutput::_CreateDeviceUID(CFStringRef& deviceUID) const
 
 bool SFB::Audio::ASIOOutput::_SetDeviceUID(CFStringRef deviceUID)
 {
-	if(!CFStringGetCString(deviceUID, sDriverInfo.mUID, kUIDLength, kCFStringEncodingUTF8))
+	if(nullptr == deviceUID)
 		return false;
 
-	if(!_Stop() || !_Close())
+	if(_IsOpen() && (!_Stop() || !_Close()))
 		return false;
 
-	AsioLibInfo libInfo;
-	AsioLibInfo::FromCString(libInfo, sDriverInfo.mUID, '|');
+	mDesiredDriverUID = (CFStringRef)CFRetain(deviceUID);
 
-	AsioLibWrapper::UnloadLib();
+	return _Open();
+}
 
-	if(!AsioLibWrapper::LoadLib(libInfo)) {
-		LOGGER_CRIT("org.sbooth.AudioEngine.Output.ASIO", "Unable to load ASIO library");
-		return false;
+#pragma mark Buffer Management
+
+long SFB::Audio::ASIOOutput::ClosestSupportedBufferSize(long bufferSize) const
+{
+	bufferSize = std::min(std::max(bufferSize, mDriverInfo->mMinimumBufferSize), mDriverInfo->mMaximumBufferSize);
+
+	// A granularity of -1 indicates sizes are powers of two
+	if(-1 == mDriverInfo->mBufferGranularity) {
+		long size = mDriverInfo->mMinimumBufferSize;
+		while(size < bufferSize && (size * 2) <= mDriverInfo->mMaximumBufferSize)
+			size *= 2;
+		return size;
 	}
+	// A granularity of 0 indicates only the preferred size is supported
+	else if(0 == mDriverInfo->mBufferGranularity)
+		return mDriverInfo->mPreferredBufferSize;
 
-	if(AsioLibWrapper::CreateInstance(libInfo.Number, &sASIO)) {
-		LOGGER_CRIT("org.sbooth.AudioEngine.Output.ASIO", "Unable to instantiate ASIO driver");
+	long remainder = (bufferSize - mDriverInfo->mMinimumBufferSize) % mDriverInfo->mBufferGranularity;
+	return bufferSize - remainder;
+}
+
+bool SFB::Audio::ASIOOutput::CreateDirectBufferLists()
+{
+	FreeDirectBufferLists();
+
+	// Converted samples can't be rendered in place
+	const AudioBufferList *scratch = mDriverInfo->mBufferList;
+	const auto& format = mDriverInfo->mBufferList.GetFormat();
+	if(!scratch || format.IsInterleaved() || mDriverInfo->mConvertSamples)
 		return false;
+
+	UInt32 bufferCount = scratch->mNumberBuffers;
+
+	// The index in mBufferInfo of the output buffer receiving each channel, or -1
+	std::vector<long> destinations(bufferCount, -1);
+	for(long bufferIndex = 0, ablIndex = 0; bufferIndex < mDriverInfo->mInputBufferCount + mDriverInfo->mOutputBufferCount; ++bufferIndex) {
+		if(mDriverInfo->mBufferInfo[bufferIndex].isInput)
+			continue;
+
+		SInt32 channel = -1;
+		if(!mChannelMap.empty())
+			channel = (std::vector<SInt32>::size_type)ablIndex < mChannelMap.size() ? mChannelMap[(std::vector<SInt32>::size_type)ablIndex] : -1;
+		else if(ablIndex < bufferCount)
+			channel = (SInt32)ablIndex;
+
+		++ablIndex;
+
+		// Output buffers receiving no audio are never written, so they are silenced once
+		if(-1 == channel || (UInt32)channel >= bufferCount) {
+			for(auto buffer : mDriverInfo->mBufferInfo[bufferIndex].buffers)
+				memset(buffer, format.IsDSD() ? 0xF : 0, mDriverInfo->mBufferByteSize);
+			continue;
+		}
+
+		// A channel sent to more than one output buffer must be copied
+		if(-1 != destinations[(size_t)channel])
+			return false;
+
+		destinations[(size_t)channel] = bufferIndex;
 	}
 
-	sDriverInfo.mDriverInfo = {
-		.asioVersion = 2,
-		.sysRef = nullptr
-	};
+	for(int doubleBufferIndex = 0; doubleBufferIndex < 2; ++doubleBufferIndex) {
+		auto bufferList = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * bufferCount));
+		if(!bufferList) {
+			FreeDirectBufferLists();
+			return false;
+		}
 
-	if(!sASIO->init(&sDriverInfo.mDriverInfo)){
-		LOGGER_CRIT("org.sbooth.AudioEngine.Output.ASIO", "Unable to init ASIO driver: " << sDriverInfo.mDriverInfo.errorMessage);
+		bufferList->mNumberBuffers = bufferCount;
+		for(UInt32 i = 0; i < bufferCount; ++i) {
+			bufferList->mBuffers[i].mNumberChannels = scratch->mBuffers[i].mNumberChannels;
+			bufferList->mBuffers[i].mData = -1 != destinations[i] ? mDriverInfo->mBufferInfo[destinations[i]].buffers[doubleBufferIndex] : scratch->mBuffers[i].mData;
+		}
+
+		mDriverInfo->mDirectBufferList[doubleBufferIndex] = bufferList;
+	}
+
+	return true;
+}
+
+void SFB::Audio::ASIOOutput::FreeDirectBufferLists()
+{
+	for(auto& bufferList : mDriverInfo->mDirectBufferList) {
+		free(bufferList);
+		bufferList = nullptr;
+	}
+}
+
+bool SFB::Audio::ASIOOutput::CreateInputBufferLists()
+{
+	FreeInputBufferLists();
+	mInputFormat = {};
+
+	if(0 == mDriverInfo->mInputBufferCount)
+		return false;
+
+	// The input format is that of the first input channel
+	auto format = AudioFormatForASIOSampleType(mDriverInfo->mChannelInfo[0].type);
+	if(!format.IsPCM()) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Output.ASIO", "Unsupported input sample type: " << mDriverInfo->mChannelInfo[0].type);
 		return false;
 	}
 
-	// Determine whether to post output notifications
-	if(ASE_OK == sASIO->outputReady())
-		sDriverInfo.mPostOutput = true;
+	format.mSampleRate = mDriverInfo->mSampleRate;
+	format.mChannelsPerFrame = (UInt32)mDriverInfo->mInputBufferCount;
+
+	UInt32 bufferCount = (UInt32)mDriverInfo->mInputBufferCount;
+	UInt32 byteSize = (UInt32)format.FrameCountToByteCount((size_t)mDriverInfo->mBufferSize);
+
+	// The lists address the driver's buffers so input is never copied before it is delivered
+	for(int doubleBufferIndex = 0; doubleBufferIndex < 2; ++doubleBufferIndex) {
+		auto bufferList = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * bufferCount));
+		if(!bufferList) {
+			FreeInputBufferLists();
+			return false;
+		}
+
+		bufferList->mNumberBuffers = bufferCount;
+		for(UInt32 i = 0; i < bufferCount; ++i) {
+			bufferList->mBuffers[i].mNumberChannels = 1;
+			bufferList->mBuffers[i].mData = mDriverInfo->mBufferInfo[i].buffers[doubleBufferIndex];
+			bufferList->mBuffers[i].mDataByteSize = byteSize;
+		}
+
+		mDriverInfo->mInputBufferList[doubleBufferIndex] = bufferList;
+	}
+
+	mInputFormat = format;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Output.ASIO", "Capturing input: " << mInputFormat);
 
 	return true;
 }
 
+void SFB::Audio::ASIOOutput::FreeInputBufferLists()
+{
+	for(auto& bufferList : mDriverInfo->mInputBufferList) {
+		free(bufferList);
+		bufferList = nullptr;
+	}
+}
+
+#pragma mark Input
+
+void SFB::Audio::ASIOOutput::SetInputChannelCount(UInt32 channelCount)
+{
+	mRequestedInputChannelCount.store(channelCount);
+}
+
+void SFB::Audio::ASIOOutput::SetInputCallback(InputCallback callback, void *context)
+{
+	// The callback is cleared first so it is never invoked with another callback's context
+	mInputCallback.store(nullptr);
+	mInputCallbackContext.store(context);
+	mInputCallback.store(callback);
+}
+
+void SFB::Audio::ASIOOutput::AdaptBufferSizeToOverloads(bool overload)
+{
+	// Must be called from mEventQueueTimer
+	auto now = ConvertHostTimeToNanos(mach_absolute_time());
+
+	if(overload) {
+		mLastOverloadTime = now;
+
+		if(OVERLOAD_WINDOW_NSEC < now - mOverloadWindowStart) {
+			mOverloadWindowStart = now;
+			mOverloadWindowCount = 0;
+		}
+
+		if(OVERLOAD_THRESHOLD_COUNT > ++mOverloadWindowCount || !mAdaptiveBufferSizing)
+			return;
+
+		mOverloadWindowCount = 0;
+
+		long bufferSize = mRequestedBufferSize ?: mDriverInfo->mBufferSize;
+		if(0 == bufferSize || bufferSize >= mDriverInfo->mMaximumBufferSize)
+			return;
+
+		long newBufferSize = ClosestSupportedBufferSize(2 * bufferSize);
+		if(newBufferSize <= bufferSize)
+			return;
+
+		if(0 == mBaseBufferSize)
+			mBaseBufferSize = bufferSize;
+
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Output.ASIO", "Repeated overloads: requesting buffer size " << newBufferSize << " (was " << bufferSize << ")");
+
+		mRequestedBufferSize = newBufferSize;
+		mLastBufferSizeChangeTime = now;
+		mBufferSizeAdjustmentCount.fetch_add(1);
+
+		// Larger writes keep the ring buffer ahead of the larger reads
+		// The write chunk size is left in place when the buffer size is reduced
+		if(mPlayer && mPlayer->GetRingBufferWriteChunkSize() < (uint32_t)newBufferSize) {
+			if(mPlayer->GetRingBufferCapacity() < 8 * (uint32_t)newBufferSize)
+				mPlayer->SetRingBufferCapacity(8 * (uint32_t)newBufferSize);
+			mPlayer->SetRingBufferWriteChunkSize((uint32_t)newBufferSize);
+		}
+	}
+	// Step back toward the original buffer size once overloads have stopped
+	else if(mAdaptiveBufferSizing && 0 != mBaseBufferSize && mRequestedBufferSize > mBaseBufferSize && QUIET_PERIOD_NSEC < now - std::max(mLastOverloadTime, mLastBufferSizeChangeTime)) {
+		long newBufferSize = std::max(ClosestSupportedBufferSize(mRequestedBufferSize / 2), mBaseBufferSize);
+
+		LOGGER_INFO("org.sbooth.AudioEngine.Output.ASIO", "No recent overloads: requesting buffer size " << newBufferSize << " (was " << mRequestedBufferSize << ")");
+
+		mRequestedBufferSize = newBufferSize;
+		mLastBufferSizeChangeTime = now;
+		mBufferSizeAdjustmentCount.fetch_add(1);
+	}
+}
+
 #pragma mark Callbacks
 
 long SFB::Audio::ASIOOutput::HandleASIOMessage(long selector, long value, void *message, double *opt)
@@ -877,6 +1631,7 @@ long SFB::Audio::ASIOOutput::HandleASIOMessage(long selector, long value, void *
 
 		case kAsioResetRequest:
 		{
+			mResetRequestCount.fetch_add(1);
 			uint32_t event = eMessageQueueEventASIOResetNeeded;
 			mEventQueue->Write(&event, sizeof(event));
 			return 1;
@@ -884,6 +1639,7 @@ long SFB::Audio::ASIOOutput::HandleASIOMessage(long selector, long value, void *
 
 		case kAsioOverload:
 		{
+			mOverloadCount.fetch_add(1);
 			uint32_t event = eMessageQueueEventASIOOverload;
 			mEventQueue->Write(&event, sizeof(event));
 			return 1;
@@ -902,24 +1658,104 @@ long SFB::Audio::ASIOOutput::HandleASIOMessage(long selector, long value, void *
 	return 0;
 }
 
-void SFB::Audio::ASIOOutput::FillASIOBuffer(long doubleBufferIndex)
+void SFB::Audio::ASIOOutput::HandleBufferSwitch(long doubleBufferIndex, const ASIOTime *timeInfo)
+{
+	// Drivers not supporting time info use bufferSwitch(), so the time is requested separately
+	ASIOTime driverTime = {};
+	if(!timeInfo) {
+		auto result = mDriverInfo->mASIO->getSamplePosition(&driverTime.timeInfo.samplePosition, &driverTime.timeInfo.systemTime);
+		if(ASE_OK == result)
+			driverTime.timeInfo.flags = kSystemTimeValid | kSamplePositionValid;
+		timeInfo = &driverTime;
+	}
+
+	auto start = mach_absolute_time();
+	auto startTime = BeginRenderCycle();
+
+	FillASIOBuffer(doubleBufferIndex, timeInfo);
+
+	// Input is delivered in place from the driver's buffers
+	auto inputCallback = mInputCallback.load();
+	auto inputBufferList = mDriverInfo->mInputBufferList[doubleBufferIndex];
+	if(inputCallback && inputBufferList)
+		inputCallback(mInputCallbackContext.load(), inputBufferList, (UInt32)mDriverInfo->mBufferSize);
+
+	if(startTime)
+		EndRenderCycle(startTime, (UInt32)mDriverInfo->mBufferSize, mDriverInfo->mSampleRate);
+
+	double bufferDuration = mDriverInfo->mBufferDuration;
+	if(0 >= bufferDuration)
+		return;
+
+	mCallbackCount.fetch_add(1, std::memory_order_relaxed);
+
+	// Record the callback's duration relative to the buffer duration
+	double load = ConvertHostTimeToNanos(mach_absolute_time() - start) / bufferDuration;
+	size_t bucket = std::min((size_t)(load * kCallbackLoadHistogramBucketCount), kCallbackLoadHistogramBucketCount - 1);
+	mCallbackLoadHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+
+	// Callbacks should be one buffer duration apart
+	if(kSystemTimeValid & timeInfo->timeInfo.flags) {
+		double systemTime = ASIO64ToDouble(timeInfo->timeInfo.systemTime);
+		if(0 != mDriverInfo->mLastSystemTime) {
+			double deviation = std::abs((systemTime - mDriverInfo->mLastSystemTime) - bufferDuration);
+			double jitter = mTimeInfoJitter.load(std::memory_order_relaxed);
+			mTimeInfoJitter.store(jitter + (JITTER_SMOOTHING_FACTOR * (deviation - jitter)), std::memory_order_relaxed);
+		}
+		mDriverInfo->mLastSystemTime = systemTime;
+	}
+}
+
+void SFB::Audio::ASIOOutput::FillASIOBuffer(long doubleBufferIndex, const ASIOTime *timeInfo)
 {
+	// Translate the driver's time info for the player
+	AudioTimeStamp timeStamp = {};
+	if(timeInfo) {
+		if(kSamplePositionValid & timeInfo->timeInfo.flags) {
+			timeStamp.mSampleTime = ASIO64ToDouble(timeInfo->timeInfo.samplePosition);
+			timeStamp.mFlags |= kAudioTimeStampSampleTimeValid;
+		}
+
+		if(kSystemTimeValid & timeInfo->timeInfo.flags) {
+			timeStamp.mHostTime = ConvertNanosToHostTime((uint64_t)ASIO64ToDouble(timeInfo->timeInfo.systemTime));
+			timeStamp.mFlags |= kAudioTimeStampHostTimeValid;
+		}
+	}
+
+	// Render directly into the ASIO buffers if possible
+	auto directBufferList = mDriverInfo->mDirectBufferList[doubleBufferIndex];
+	if(directBufferList) {
+		for(UInt32 i = 0; i < directBufferList->mNumberBuffers; ++i)
+			directBufferList->mBuffers[i].mDataByteSize = mDriverInfo->mBufferByteSize;
+
+		ProvideAudio(directBufferList, (UInt32)mDriverInfo->mBufferSize, timeInfo ? &timeStamp : nullptr);
+
+		if(mDriverInfo->mPostOutput)
+			mDriverInfo->mASIO->outputReady();
+
+		return;
+	}
+
 	// Get audio from the player
-	sDriverInfo.mBufferList.Reset();
-	mPlayer->ProvideAudio(sDriverInfo.mBufferList, sDriverInfo.mBufferList.GetCapacityFrames());
+	mDriverInfo->mBufferList.Reset();
+	ProvideAudio(mDriverInfo->mBufferList, mDriverInfo->mBufferList.GetCapacityFrames(), timeInfo ? &timeStamp : nullptr);
 
 	// Copy the audio, channel mapping as required
-	for(long bufferIndex = 0, ablIndex = 0; bufferIndex < sDriverInfo.mInputBufferCount + sDriverInfo.mOutputBufferCount; ++bufferIndex) {
-		if(!sDriverInfo.mBufferInfo[bufferIndex].isInput) {
+	for(long bufferIndex = 0, ablIndex = 0; bufferIndex < mDriverInfo->mInputBufferCount + mDriverInfo->mOutputBufferCount; ++bufferIndex) {
+		if(!mDriverInfo->mBufferInfo[bufferIndex].isInput) {
 			auto bufIndex = -1;
 			if(!mChannelMap.empty())
 				bufIndex = mChannelMap[(std::vector<SInt32>::size_type)ablIndex];
-			else if(ablIndex < sDriverInfo.mBufferList->mNumberBuffers)
+			else if(ablIndex < mDriverInfo->mBufferList->mNumberBuffers)
 				bufIndex = (SInt32)ablIndex;
 
 			if(-1 != bufIndex) {
-				const AudioBuffer buf = sDriverInfo.mBufferList->mBuffers[bufIndex];
-				memcpy(sDriverInfo.mBufferInfo[bufferIndex].buffers[doubleBufferIndex], buf.mData, buf.mDataByteSize);
+				const AudioBuffer buf = mDriverInfo->mBufferList->mBuffers[bufIndex];
+				void *destination = mDriverInfo->mBufferInfo[bufferIndex].buffers[doubleBufferIndex];
+				if(mDriverInfo->mConvertSamples)
+					ConvertFloatToASIOSampleType((const float *)buf.mData, destination, buf.mDataByteSize / sizeof(float), mDriverInfo->mSampleType, mDriverInfo->mConversionBuffer.data());
+				else
+					memcpy(destination, buf.mData, buf.mDataByteSize);
 			}
 
 			++ablIndex;
@@ -927,6 +1763,6 @@ void SFB::Audio::ASIOOutput::FillASIOBuffer(long doubleBufferIndex)
 	}
 
 	// If the driver supports the ASIOOutputReady() optimization, do it here, all data are in place
-	if(sDriverInfo.mPostOutput)
-		sASIO->outputReady();
+	if(mDriverInfo->mPostOutput)
+		mDriverInfo->mASIO->outputReady();
 }
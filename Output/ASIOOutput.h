@@ -5,9 +5,16 @@
 
 #pragma once
 
+#include <atomic>
+#include <vector>
+
 #include "AudioOutput.h"
 #include "RingBuffer.h"
 
+/*! @cond */
+struct ASIOTime;
+/*! @endcond */
+
 /*! @file ASIOOutput.h @brief ASIO output functionality */
 
 /*! @brief \c SFBAudioEngine's encompassing namespace */
@@ -16,7 +23,11 @@ namespace SFB {
 	/*! @brief %Audio functionality */
 	namespace Audio {
 
-		/*! @brief Output subclass supporting ASIO */
+		/*!
+		 * @brief Output subclass supporting ASIO
+		 *
+		 * Each \c ASIOOutput has its own driver instance, so several may be open at once for different devices
+		 */
 		class ASIOOutput : public Output
 		{
 		public:
@@ -31,6 +42,17 @@ namespace SFB {
 			static const CFStringRef kDriverFolderKey;				/*!< @brief The install folder */
 			static const CFStringRef kDriverArchitecturesKey;		/*!< @brief The supported architectures */
 			static const CFStringRef kDriverUIDKey;					/*!< @brief The driver's UID */
+			static const CFStringRef kDriverCapabilitiesKey;		/*!< @brief The driver's cached capabilities (\c CFDictionary), if known */
+			//@}
+
+
+			// ========================================
+			/*! @name Driver capability dictionary keys */
+			//@{
+			static const CFStringRef kDriverInputChannelCountKey;	/*!< @brief The number of input channels (\c CFNumber) */
+			static const CFStringRef kDriverOutputChannelCountKey;	/*!< @brief The number of output channels (\c CFNumber) */
+			static const CFStringRef kDriverSampleRatesKey;			/*!< @brief The supported common sample rates (\c CFArray of \c CFNumber) */
+			static const CFStringRef kDriverSampleTypeKey;			/*!< @brief The \c ASIOSampleType of the first output channel (\c CFNumber) */
 			//@}
 
 
@@ -41,9 +63,25 @@ namespace SFB {
 			/*! @brief Query whether an ASIO driver is available */
 			static bool IsAvailable();
 
-			/*! @brief Create a list of available ASIO drivers */
+			/*!
+			 * @brief Create a list of available ASIO drivers
+			 *
+			 * Drivers are described by their installed property lists, so no driver is loaded.  The capabilities of
+			 * drivers that have been loaded previously are included from a persistent cache if they are unchanged.
+			 */
 			static CFArrayRef CreateAvailableDrivers();
 
+			/*!
+			 * @brief Create a dictionary describing a driver's capabilities
+			 *
+			 * The capabilities are cached persistently, keyed by the driver's library path and the library's
+			 * modification date, so the driver is only loaded if it has not been examined since it was installed.
+			 * @note The returned dictionary must be released by the caller
+			 * @param driverUID The driver's UID
+			 * @return A dictionary using the driver capability keys, or \c nullptr on failure
+			 */
+			static CFDictionaryRef CreateDriverCapabilities(CFStringRef driverUID);
+
 			/*! @brief Create an \c ASIOOutput for the specified driver */
 			static unique_ptr CreateInstanceForDriverUID(CFStringRef driverUID);
 
@@ -72,6 +110,94 @@ namespace SFB {
 			/*! @brief Get the format in use by the device for IO transactions */
 			bool GetDeviceIOFormat(DeviceIOFormat& deviceIOFormat) const;
 
+
+			// ========================================
+			/*! @name Diagnostics */
+			//@{
+
+			/*! @brief The number of buckets in \c Statistics::mCallbackLoadHistogram */
+			static const size_t kCallbackLoadHistogramBucketCount = 8;
+
+			/*! @brief ASIO driver callback statistics */
+			struct Statistics {
+				uint64_t	mOverloadCount;				/*!< The number of overloads reported by the driver */
+				uint64_t	mResetRequestCount;			/*!< The number of reset requests from the driver */
+				uint64_t	mCallbackCount;				/*!< The number of buffer switch callbacks */
+
+				/*!
+				 * Buffer switch callback counts by the time taken to fill the buffer, as a fraction of
+				 * the buffer duration in equal steps.  The last bucket includes callbacks exceeding the buffer duration.
+				 */
+				uint64_t	mCallbackLoadHistogram [kCallbackLoadHistogramBucketCount];
+
+				double		mTimeInfoJitter;			/*!< The average deviation in seconds of the interval between callbacks from the buffer duration */
+				uint64_t	mBufferSizeAdjustmentCount;	/*!< The number of buffer size changes made by adaptive buffer sizing */
+			};
+
+			/*! @brief Get the driver callback statistics */
+			Statistics GetStatistics() const;
+
+			/*! @brief Reset the driver callback statistics */
+			void ResetStatistics();
+
+
+			/*! @brief Determine whether the buffer size is adapted to driver overloads */
+			inline bool IsAdaptiveBufferSizingEnabled() const		{ return mAdaptiveBufferSizing; }
+
+			/*!
+			 * @brief Enable or disable adaptive buffer sizing
+			 * @note When enabled repeated overloads double the requested buffer size and raise the player's ring buffer
+			 * write chunk size to match, and the buffer size is halved toward its original value after a period without overloads.
+			 * Buffer size changes take effect when the output is next configured for a decoder.
+			 * @param enabled Whether adaptive buffer sizing should be used
+			 */
+			void SetAdaptiveBufferSizingEnabled(bool enabled);
+
+			//@}
+
+
+
+			// ========================================
+			/*!
+			 * @name Input
+			 * Input buffers are created alongside the output buffers when the output is configured for a decoder, and
+			 * each buffer of input is delivered in place from the driver's buffers on the driver's callback thread
+			 * after the output buffer is filled.  A \c Recorder created for the input format and passed as the
+			 * callback's context captures the input to disk.
+			 */
+			//@{
+
+			/*!
+			 * @brief A function receiving input on the driver's callback thread
+			 * @note The function must not block
+			 * @param context The context passed to SetInputCallback()
+			 * @param bufferList The input, valid only for the duration of the call
+			 * @param frameCount The number of frames of input
+			 */
+			using InputCallback = void (*)(void *context, const AudioBufferList *bufferList, UInt32 frameCount);
+
+			/*! @brief Get the number of input channels requested */
+			inline UInt32 GetInputChannelCount() const				{ return mRequestedInputChannelCount.load(); }
+
+			/*!
+			 * @brief Set the number of input channels to capture, starting from the first
+			 * @note This takes effect when the output is next configured for a decoder
+			 * @param channelCount The number of input channels, or \c 0 to capture no input
+			 */
+			void SetInputChannelCount(UInt32 channelCount);
+
+			/*! @brief Get the format of the input, which has no channels unless input is captured */
+			inline const AudioFormat& GetInputFormat() const		{ return mInputFormat; }
+
+			/*!
+			 * @brief Set the function receiving input
+			 * @param callback The function, or \c nullptr to receive no input
+			 * @param context A value passed to \c callback
+			 */
+			void SetInputCallback(InputCallback callback, void *context);
+
+			//@}
+
 		protected:
 
 			/*! @brief Set the format the device should use for IO transactions */
@@ -110,6 +236,23 @@ namespace SFB {
 
 			virtual size_t _GetPreferredBufferSize() const;
 
+			virtual bool _GetDeviceBufferFrameSize(UInt32& frameSize) const;
+			virtual bool _GetDeviceBufferFrameSizeRange(UInt32& minimum, UInt32& maximum) const;
+			virtual bool _SetDeviceBufferFrameSize(UInt32 frameSize);
+
+			void AdaptBufferSizeToOverloads(bool overload);
+
+			long ClosestSupportedBufferSize(long bufferSize) const;
+			bool CreateDirectBufferLists();
+			void FreeDirectBufferLists();
+			bool CreateInputBufferLists();
+			void FreeInputBufferLists();
+
+			struct DriverInfo;
+
+			std::unique_ptr<DriverInfo>				mDriverInfo;			/*!< ASIO driver state */
+			std::atomic_bool						mIsRunning;				/*!< Whether the driver is started */
+
 			SFB::CFString							mDesiredDriverUID;		/*!< Requested ASIO driver UID */
 
 			SFB::RingBuffer::unique_ptr				mEventQueue;			/*!< ASIO event queue */
@@ -120,6 +263,27 @@ namespace SFB {
 			ChannelLayout							mDriverChannelLayout;	/*!< Channel layout for ASIO driver transactions */
 			std::vector<SInt32>						mChannelMap;			/*!< The channel map */
 
+			long									mRequestedBufferSize;	/*!< Requested buffer size in frames, or 0 for the driver's preferred size */
+
+			std::atomic_ullong						mOverloadCount;			/*!< Driver overloads */
+			std::atomic_ullong						mResetRequestCount;		/*!< Driver reset requests */
+			std::atomic_ullong						mCallbackCount;			/*!< Buffer switch callbacks */
+			std::atomic_ullong						mCallbackLoadHistogram [kCallbackLoadHistogramBucketCount];	/*!< Buffer switch callbacks by load */
+			std::atomic<double>						mTimeInfoJitter;		/*!< Average callback interval deviation in nanoseconds */
+			std::atomic_ullong						mBufferSizeAdjustmentCount;	/*!< Adaptive buffer size changes */
+
+			std::atomic_bool						mAdaptiveBufferSizing;	/*!< Whether buffer sizes are adapted to overloads */
+			uint64_t								mOverloadWindowStart;	/*!< The start of the current overload window in nanoseconds */
+			unsigned								mOverloadWindowCount;	/*!< Overloads in the current window */
+			uint64_t								mLastOverloadTime;		/*!< The time of the last overload in nanoseconds */
+			uint64_t								mLastBufferSizeChangeTime;	/*!< The time of the last adaptive buffer size change in nanoseconds */
+			long									mBaseBufferSize;		/*!< The buffer size before adaptation, or 0 */
+
+			std::atomic<UInt32>						mRequestedInputChannelCount;	/*!< Input channels to capture */
+			AudioFormat								mInputFormat;			/*!< The format of the input buffers */
+			std::atomic<InputCallback>				mInputCallback;			/*!< The function receiving input */
+			std::atomic<void *>						mInputCallbackContext;
+
 		public:
 
 			// ========================================
@@ -128,8 +292,11 @@ namespace SFB {
 			/*! @internal ASIO message callback */
 			long HandleASIOMessage(long selector, long value, void *message, double *opt);
 
+			/*! @internal ASIO buffer switch callback */
+			void HandleBufferSwitch(long doubleBufferIndex, const ASIOTime *timeInfo);
+
 			/*! @internal ASIO render callback */
-			void FillASIOBuffer(long doubleBufferIndex);
+			void FillASIOBuffer(long doubleBufferIndex, const ASIOTime *timeInfo);
 
 			/*! @endcond */
 		};
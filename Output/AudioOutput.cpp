@@ -3,14 +3,62 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#include <algorithm>
+
 #include "AudioOutput.h"
+#include "AudioPlayer.h"
 #include "Logger.h"
 
+namespace {
+
+	// ========================================
+	// Convert host time to nanoseconds
+	uint64_t ConvertHostTimeToNanos(uint64_t hostTime)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (hostTime * sTimebaseInfo.numer) / sTimebaseInfo.denom;
+	}
+
+}
+
 SFB::Audio::Output::Output()
-	: mPlayer(nullptr),	mPrepareForFormatBlock(nullptr)
-{}
+	: mPlayer(nullptr), mFanOutIndex(SIZE_MAX), mPrepareForFormatBlock(nullptr), mRenderProfilingEnabled(false), mRenderCycleCount(0), mOverBudgetRenderCycleCount(0), mRenderLoadSum(0), mMaximumRenderLoad(0), mRenderLoadThreshold(0), mPeakRenderLoad(0), mRenderLoadBlock(nullptr), mRenderLoadSource(nullptr)
+{
+	for(auto& count : mRenderLoadHistogram)
+		count.store(0);
+
+	// Threshold notifications are posted from the rendering thread
+	mRenderLoadSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_OR, 0, 0, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+	if(!mRenderLoadSource)
+		LOGGER_ERR("org.sbooth.AudioEngine.Output", "dispatch_source_create failed");
+	else {
+		dispatch_source_set_event_handler(mRenderLoadSource, ^{
+			double load = mPeakRenderLoad.exchange(0);
+			auto block = mRenderLoadBlock;
+			if(block && 0 < load)
+				block(load);
+		});
+
+		dispatch_resume(mRenderLoadSource);
+	}
+}
+
 SFB::Audio::Output::~Output()
 {
+	if(mRenderLoadSource) {
+		dispatch_source_cancel(mRenderLoadSource);
+		dispatch_release(mRenderLoadSource);
+		mRenderLoadSource = nullptr;
+	}
+
+	if(mRenderLoadBlock) {
+		Block_release(mRenderLoadBlock);
+		mRenderLoadBlock = nullptr;
+	}
+
 	if(mPrepareForFormatBlock) {
 		Block_release(mPrepareForFormatBlock);
 		mPrepareForFormatBlock = nullptr;
@@ -137,6 +185,158 @@ bool SFB::Audio::Output::SetDeviceSampleRate(Float64 sampleRate)
 	return _SetDeviceSampleRate(sampleRate);
 }
 
+bool SFB::Audio::Output::GetDeviceBufferFrameSize(UInt32& frameSize) const
+{
+	return _GetDeviceBufferFrameSize(frameSize);
+}
+
+bool SFB::Audio::Output::GetDeviceBufferFrameSizeRange(UInt32& minimum, UInt32& maximum) const
+{
+	return _GetDeviceBufferFrameSizeRange(minimum, maximum);
+}
+
+bool SFB::Audio::Output::SetDeviceBufferFrameSize(UInt32 frameSize)
+{
+	if(0 == frameSize)
+		return false;
+
+	// Constrain the size to the supported range
+	UInt32 minimum, maximum;
+	if(_GetDeviceBufferFrameSizeRange(minimum, maximum))
+		frameSize = std::min(std::max(frameSize, minimum), maximum);
+
+	LOGGER_DEBUG("org.sbooth.AudioEngine.Output", "Setting device buffer frame size to " << frameSize);
+	return _SetDeviceBufferFrameSize(frameSize);
+}
+
+bool SFB::Audio::Output::IsRealTime() const
+{
+	return _IsRealTime();
+}
+
+#if __has_include(<os/workgroup.h>)
+os_workgroup_t SFB::Audio::Output::CopyIOThreadWorkgroup() const
+{
+	if(!_IsOpen())
+		return nullptr;
+	return _CopyIOThreadWorkgroup();
+}
+#endif
+
+bool SFB::Audio::Output::SetTargetLatency(Float64 latency)
+{
+	if(0 >= latency)
+		return false;
+
+	Float64 sampleRate;
+	if(!_GetDeviceSampleRate(sampleRate))
+		sampleRate = mFormat.mSampleRate;
+	if(0 >= sampleRate)
+		return false;
+
+	LOGGER_DEBUG("org.sbooth.AudioEngine.Output", "Setting target latency to " << latency << " sec");
+	return SetDeviceBufferFrameSize((UInt32)std::max(1.0, latency * sampleRate));
+}
+
+bool SFB::Audio::Output::GetOutputLatency(Float64& latency) const
+{
+	if(!_IsOpen())
+		return false;
+	return _GetOutputLatency(latency);
+}
+
+bool SFB::Audio::Output::ProvideAudio(AudioBufferList *bufferList, UInt32 frameCount, const AudioTimeStamp *timeStamp)
+{
+	if(SIZE_MAX != mFanOutIndex)
+		return mPlayer->ProvideFanOutAudio(mFanOutIndex, bufferList, frameCount, timeStamp);
+
+	return mPlayer->ProvideAudio(bufferList, frameCount, timeStamp);
+}
+
+#pragma mark Render Profiling
+
+void SFB::Audio::Output::SetRenderProfilingEnabled(bool enabled)
+{
+	LOGGER_DEBUG("org.sbooth.AudioEngine.Output", (enabled ? "Enabling" : "Disabling") << " render profiling");
+	mRenderProfilingEnabled.store(enabled);
+}
+
+SFB::Audio::Output::RenderProfile SFB::Audio::Output::GetRenderProfile() const
+{
+	auto cycleCount = mRenderCycleCount.load();
+
+	RenderProfile profile = {
+		.mCycleCount		= cycleCount,
+		.mOverBudgetCount	= mOverBudgetRenderCycleCount.load(),
+		.mAverageLoad		= 0 < cycleCount ? mRenderLoadSum.load() / cycleCount : 0,
+		.mMaximumLoad		= mMaximumRenderLoad.load(),
+		.mLoadHistogram		= {}
+	};
+
+	for(size_t i = 0; i < kRenderLoadHistogramBucketCount; ++i)
+		profile.mLoadHistogram[i] = mRenderLoadHistogram[i].load();
+
+	return profile;
+}
+
+void SFB::Audio::Output::ResetRenderProfile()
+{
+	mRenderCycleCount.store(0);
+	mOverBudgetRenderCycleCount.store(0);
+	mRenderLoadSum.store(0);
+	mMaximumRenderLoad.store(0);
+	for(auto& count : mRenderLoadHistogram)
+		count.store(0);
+}
+
+void SFB::Audio::Output::SetRenderLoadThresholdBlock(double threshold, RenderLoadBlock block)
+{
+	// Prevent the rendering thread from posting notifications while the block changes
+	mRenderLoadThreshold.store(0);
+
+	if(mRenderLoadBlock) {
+		Block_release(mRenderLoadBlock);
+		mRenderLoadBlock = nullptr;
+	}
+
+	if(block && 0 < threshold) {
+		mRenderLoadBlock = Block_copy(block);
+		mRenderLoadThreshold.store(threshold);
+	}
+}
+
+void SFB::Audio::Output::EndRenderCycle(uint64_t startTime, UInt32 frameCount, Float64 sampleRate)
+{
+	if(0 == startTime || 0 == frameCount || 0 >= sampleRate)
+		return;
+
+	double budget = (frameCount * NSEC_PER_SEC) / sampleRate;
+	double load = ConvertHostTimeToNanos(mach_absolute_time() - startTime) / budget;
+
+	// Only this thread writes the statistics, so relaxed loads and stores suffice
+	mRenderCycleCount.fetch_add(1, std::memory_order_relaxed);
+	mRenderLoadSum.store(mRenderLoadSum.load(std::memory_order_relaxed) + load, std::memory_order_relaxed);
+	if(load > mMaximumRenderLoad.load(std::memory_order_relaxed))
+		mMaximumRenderLoad.store(load, std::memory_order_relaxed);
+
+	if(1 < load)
+		mOverBudgetRenderCycleCount.fetch_add(1, std::memory_order_relaxed);
+
+	size_t bucket = std::min((size_t)(load * kRenderLoadHistogramBucketCount), kRenderLoadHistogramBucketCount - 1);
+	mRenderLoadHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+
+	// Notify the threshold block; the peak is consumed by the notification handler
+	double threshold = mRenderLoadThreshold.load(std::memory_order_relaxed);
+	if(0 < threshold && load >= threshold && mRenderLoadSource) {
+		double peak = mPeakRenderLoad.load(std::memory_order_relaxed);
+		while(load > peak && !mPeakRenderLoad.compare_exchange_weak(peak, load, std::memory_order_relaxed))
+			;
+		dispatch_source_merge_data(mRenderLoadSource, 1);
+	}
+}
+
+#pragma mark -
+
 size_t SFB::Audio::Output::GetPreferredBufferSize() const
 {
 	return _GetPreferredBufferSize();
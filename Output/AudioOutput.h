@@ -5,9 +5,15 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 
 #include <CoreFoundation/CoreFoundation.h>
+#include <dispatch/dispatch.h>
+#include <mach/mach_time.h>
+#if __has_include(<os/workgroup.h>)
+# include <os/workgroup.h>
+#endif
 
 #include "AudioDecoder.h"
 
@@ -45,6 +51,12 @@ namespace SFB {
 			 */
 			using FormatBlock = void (^)(const AudioFormat& format);
 
+			/*!
+			 * @brief A block called when a render cycle uses at least the threshold fraction of its time budget
+			 * @param load The largest fraction of the budget used since the block was last called
+			 */
+			using RenderLoadBlock = void (^)(double load);
+
 			// ========================================
 			/*! @name Creation and Destruction */
 			// @{
@@ -101,6 +113,75 @@ namespace SFB {
 			//@}
 
 
+			// ========================================
+			/*! @name I/O Buffer Size */
+			//@{
+
+			/*!
+			 * @brief Get the size of the output device's I/O buffer
+			 * @param frameSize A \c UInt32 to receive the buffer size in frames
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool GetDeviceBufferFrameSize(UInt32& frameSize) const;
+
+			/*!
+			 * @brief Get the range of I/O buffer sizes supported by the output device
+			 * @param minimum A \c UInt32 to receive the minimum buffer size in frames
+			 * @param maximum A \c UInt32 to receive the maximum buffer size in frames
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool GetDeviceBufferFrameSizeRange(UInt32& minimum, UInt32& maximum) const;
+
+			/*!
+			 * @brief Set the size of the output device's I/O buffer
+			 * @note The size is constrained to the range supported by the device.
+			 * Smaller buffers reduce latency at the cost of more frequent render cycles and greater power use.
+			 * @param frameSize The desired buffer size in frames
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetDeviceBufferFrameSize(UInt32 frameSize);
+
+			/*!
+			 * @brief Set the output device's I/O buffer size to achieve the specified latency
+			 * @note The buffer size is calculated using the device's sample rate
+			 * @param latency The desired latency in seconds
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetTargetLatency(Float64 latency);
+
+			/*!
+			 * @brief Get the time in seconds from the host time of a render cycle's time stamp until its first frame is presented
+			 * @note This may require querying the device so it shouldn't be called from the rendering thread
+			 * @param latency A \c Float64 to receive the latency
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool GetOutputLatency(Float64& latency) const;
+
+			//@}
+
+
+			// ========================================
+			/*! @name I/O Thread */
+			//@{
+
+			/*!
+			 * @brief Query whether this output renders on a real-time thread paced by a device
+			 * @note Offline outputs render as quickly as possible and the threads feeding them needn't be real-time
+			 */
+			bool IsRealTime() const;
+
+#if __has_include(<os/workgroup.h>)
+			/*!
+			 * @brief Copy the workgroup of the thread on which the output renders
+			 * @note The caller must release the returned workgroup using \c os_release()
+			 * @return The workgroup, or \c nullptr if none is available
+			 */
+			os_workgroup_t _Nullable CopyIOThreadWorkgroup() const API_AVAILABLE(macos(11.0), ios(14.0));
+#endif
+
+			//@}
+
+
 			// ========================================
 			/*! @name Format Information */
 			//@{
@@ -131,6 +212,55 @@ namespace SFB {
 
 			//@}
 
+
+			// ========================================
+			/*! @name Render Profiling */
+			//@{
+
+			/*! @brief The number of buckets in \c RenderProfile::mLoadHistogram */
+			static const size_t kRenderLoadHistogramBucketCount = 10;
+
+			/*!
+			 * @brief Render cycle timing information
+			 *
+			 * A cycle's load is the time spent rendering divided by its budget, the duration of the audio it renders
+			 */
+			struct RenderProfile {
+				uint64_t	mCycleCount;										/*!< The number of render cycles profiled */
+				uint64_t	mOverBudgetCount;									/*!< The number of render cycles exceeding their budget */
+				double		mAverageLoad;										/*!< The average load */
+				double		mMaximumLoad;										/*!< The largest load */
+
+				/*! Render cycle counts by load in equal steps; the last bucket includes cycles exceeding their budget */
+				uint64_t	mLoadHistogram [kRenderLoadHistogramBucketCount];
+			};
+
+			/*! @brief Determine whether render cycles are profiled */
+			inline bool IsRenderProfilingEnabled() const				{ return mRenderProfilingEnabled; }
+
+			/*!
+			 * @brief Enable or disable render cycle profiling
+			 * @note Profiling performs no allocation or locking on the rendering thread
+			 * @param enabled Whether render cycles should be profiled
+			 */
+			void SetRenderProfilingEnabled(bool enabled);
+
+			/*! @brief Get the render cycle timing information collected since profiling was enabled or reset */
+			RenderProfile GetRenderProfile() const;
+
+			/*! @brief Discard the collected render cycle timing information */
+			void ResetRenderProfile();
+
+			/*!
+			 * @brief Set the block called when a render cycle's load reaches a threshold
+			 * @note The block is invoked asynchronously on a global queue, and notifications for consecutive cycles are coalesced
+			 * @param threshold The load at which the block is called, for example \c 0.9
+			 * @param block The block to invoke, or \c nullptr
+			 */
+			void SetRenderLoadThresholdBlock(double threshold, RenderLoadBlock block);
+
+			//@}
+
 		protected:
 
 			// ========================================
@@ -184,6 +314,33 @@ namespace SFB {
 			/*! @brief Create a new \c Output and initialize \c Output::mPlayer to \c nullptr */
 			Output();
 
+
+			/*!
+			 * @brief Render audio provided by the owning player
+			 *
+			 * The player renders its queue for the output it plays, or for one of its fan-out outputs the audio read by
+			 * that output's cursor.
+			 * @note This must be called on the rendering thread
+			 * @param bufferList A buffer to receive the audio
+			 * @param frameCount The requested number of audio frames
+			 * @param timeStamp The output time of the first frame in \c bufferList, or \c nullptr if unknown
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool ProvideAudio(AudioBufferList *bufferList, UInt32 frameCount, const AudioTimeStamp *timeStamp = nullptr);
+
+
+			/*! @brief Begin timing a render cycle, returning the start time or \c 0 if profiling is disabled */
+			inline uint64_t BeginRenderCycle() const					{ return mRenderProfilingEnabled ? mach_absolute_time() : 0; }
+
+			/*!
+			 * @brief Record a render cycle begun with \c BeginRenderCycle()
+			 * @note This must be called on the rendering thread
+			 * @param startTime The value returned by \c BeginRenderCycle()
+			 * @param frameCount The number of frames rendered
+			 * @param sampleRate The sample rate of the rendered audio
+			 */
+			void EndRenderCycle(uint64_t startTime, UInt32 frameCount, Float64 sampleRate);
+
 			AudioFormat			mFormat;			/*!< @brief The required format for audio passed to this \c Output */
 			ChannelLayout		mChannelLayout;		/*!< @brief The required channel layout for audio passed to this \c Output */
 
@@ -191,10 +348,27 @@ namespace SFB {
 
 		private:
 
+			// The player's fan-out output slot for this output, or SIZE_MAX if this is the player's primary output
+			size_t									mFanOutIndex;
+
 			// ========================================
 			// Callbacks
 			FormatBlock								mPrepareForFormatBlock;
 
+			// ========================================
+			// Render profiling; the statistics are written only on the rendering thread
+			std::atomic_bool						mRenderProfilingEnabled;
+			std::atomic_ullong						mRenderCycleCount;
+			std::atomic_ullong						mOverBudgetRenderCycleCount;
+			std::atomic<double>						mRenderLoadSum;
+			std::atomic<double>						mMaximumRenderLoad;
+			std::atomic_ullong						mRenderLoadHistogram [kRenderLoadHistogramBucketCount];
+
+			std::atomic<double>						mRenderLoadThreshold;
+			std::atomic<double>						mPeakRenderLoad;		// The largest load since the threshold block was called
+			RenderLoadBlock							mRenderLoadBlock;
+			dispatch_source_t						mRenderLoadSource;
+
 			// ========================================
 			// Subclasses must implement the following methods
 			virtual bool _Open() = 0;
@@ -222,6 +396,16 @@ namespace SFB {
 			virtual bool _SetDeviceSampleRate(Float64 /*sampleRate*/)			{ return false; }
 
 			virtual size_t _GetPreferredBufferSize() const						{ return 0; }
+
+			virtual bool _GetDeviceBufferFrameSize(UInt32& /*frameSize*/) const							{ return false; }
+			virtual bool _GetDeviceBufferFrameSizeRange(UInt32& /*minimum*/, UInt32& /*maximum*/) const	{ return false; }
+			virtual bool _SetDeviceBufferFrameSize(UInt32 /*frameSize*/)								{ return false; }
+			virtual bool _GetOutputLatency(Float64& /*latency*/) const									{ return false; }
+
+			virtual bool _IsRealTime() const									{ return true; }
+#if __has_include(<os/workgroup.h>)
+			virtual os_workgroup_t _Nullable _CopyIOThreadWorkgroup() const API_AVAILABLE(macos(11.0), ios(14.0))	{ return nullptr; }
+#endif
 		};
 	}
 }
@@ -9,8 +9,27 @@
 #include "Logger.h"
 #include "CreateStringForOSType.h"
 
+// The value of mPendingPreGainRamp when no ramp has been requested
+#define NO_PENDING_RAMP UINT64_MAX
+
 namespace {
 
+	// ========================================
+	// Pack a parameter ramp's target and duration for lock-free transfer to the render thread
+	inline uint64_t PackRamp(Float32 value, UInt32 durationFrames)
+	{
+		uint32_t valueBits;
+		memcpy(&valueBits, &value, sizeof(valueBits));
+		return ((uint64_t)valueBits << 32) | durationFrames;
+	}
+
+	inline void UnpackRamp(uint64_t ramp, Float32& value, UInt32& durationFrames)
+	{
+		uint32_t valueBits = (uint32_t)(ramp >> 32);
+		memcpy(&value, &valueBits, sizeof(value));
+		durationFrames = (UInt32)(ramp & 0xFFFFFFFF);
+	}
+
 	// ========================================
 	// AUGraph input callback
 	OSStatus myAURenderCallback(void							*inRefCon,
@@ -28,12 +47,253 @@ namespace {
 
 }
 
+#if !TARGET_OS_IPHONE
+
+namespace {
+
+	// ========================================
+	// HAL queries for the cached device properties
+
+	bool FetchDeviceHogPID(AudioDeviceID deviceID, pid_t& hogPID)
+	{
+		AudioObjectPropertyAddress propertyAddress = {
+			.mSelector	= kAudioDevicePropertyHogMode,
+			.mScope		= kAudioObjectPropertyScopeGlobal,
+			.mElement	= kAudioObjectPropertyElementMaster
+		};
+
+		hogPID = (pid_t)-1;
+		UInt32 dataSize = sizeof(hogPID);
+
+		auto result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &hogPID);
+		if(kAudioHardwareNoError != result) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyHogMode) failed: " << result);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool FetchDeviceChannelCount(AudioDeviceID deviceID, UInt32& channelCount)
+	{
+		AudioObjectPropertyAddress propertyAddress = {
+			.mSelector	= kAudioDevicePropertyStreamConfiguration,
+			.mScope		= kAudioObjectPropertyScopeOutput,
+			.mElement	= kAudioObjectPropertyElementMaster
+		};
+
+		if(!AudioObjectHasProperty(deviceID, &propertyAddress)) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectHasProperty (kAudioDevicePropertyStreamConfiguration, kAudioObjectPropertyScopeOutput) is false");
+			return false;
+		}
+
+		UInt32 dataSize;
+		auto result = AudioObjectGetPropertyDataSize(deviceID, &propertyAddress, 0, nullptr, &dataSize);
+
+		if(kAudioHardwareNoError != result) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyDataSize (kAudioDevicePropertyStreamConfiguration, kAudioObjectPropertyScopeOutput) failed: " << result);
+			return false;
+		}
+
+		AudioBufferList *bufferList = (AudioBufferList *)malloc(dataSize);
+
+		if(nullptr == bufferList) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "Unable to allocate << " << dataSize << " bytes");
+			return false;
+		}
+
+		result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, bufferList);
+
+		if(kAudioHardwareNoError != result) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyStreamConfiguration, kAudioObjectPropertyScopeOutput) failed: " << result);
+			free(bufferList);
+			bufferList = nullptr;
+			return false;
+		}
+
+		channelCount = 0;
+		for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
+			channelCount += bufferList->mBuffers[bufferIndex].mNumberChannels;
+
+		free(bufferList);
+		bufferList = nullptr;
+		return true;
+	}
+
+	bool FetchDevicePreferredStereoChannels(AudioDeviceID deviceID, std::pair<UInt32, UInt32>& preferredStereoChannels)
+	{
+		AudioObjectPropertyAddress propertyAddress = {
+			.mSelector	= kAudioDevicePropertyPreferredChannelsForStereo,
+			.mScope		= kAudioObjectPropertyScopeOutput,
+			.mElement	= kAudioObjectPropertyElementMaster
+		};
+
+		if(!AudioObjectHasProperty(deviceID, &propertyAddress)) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectHasProperty (kAudioDevicePropertyPreferredChannelsForStereo, kAudioObjectPropertyScopeOutput) failed is false");
+			return false;
+		}
+
+		UInt32 preferredChannels [2];
+		UInt32 dataSize = sizeof(preferredChannels);
+		auto result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &preferredChannels);
+
+		if(kAudioHardwareNoError != result) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyPreferredChannelsForStereo, kAudioObjectPropertyScopeOutput) failed: " << result);
+			return false;
+		}
+
+		preferredStereoChannels.first = preferredChannels[0];
+		preferredStereoChannels.second = preferredChannels[1];
+
+		return true;
+	}
+
+	bool FetchDeviceAvailableNominalSampleRates(AudioDeviceID deviceID, std::vector<AudioValueRange>& nominalSampleRates)
+	{
+		nominalSampleRates.clear();
+
+		AudioObjectPropertyAddress propertyAddress = {
+			.mSelector	= kAudioDevicePropertyAvailableNominalSampleRates,
+			.mScope		= kAudioObjectPropertyScopeGlobal,
+			.mElement	= kAudioObjectPropertyElementMaster
+		};
+
+		if(!AudioObjectHasProperty(deviceID, &propertyAddress)) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectHasProperty (kAudioDevicePropertyAvailableNominalSampleRates, kAudioObjectPropertyScopeOutput) failed is false");
+			return false;
+		}
+
+		UInt32 dataSize = 0;
+		OSStatus result = AudioObjectGetPropertyDataSize(deviceID, &propertyAddress, 0, nullptr, &dataSize);
+		if(kAudioHardwareNoError != result) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyDataSize (kAudioDevicePropertyAvailableNominalSampleRates, kAudioObjectPropertyScopeOutput) failed is false");
+			return false;
+		}
+
+		size_t numberNominalSampleRates = dataSize / sizeof(AudioValueRange);
+		nominalSampleRates.resize(numberNominalSampleRates);
+
+		result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &nominalSampleRates[0]);
+		if(kAudioHardwareNoError != result) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyAvailableNominalSampleRates, kAudioObjectPropertyScopeOutput) failed is false");
+			return false;
+		}
+
+		return true;
+	}
+
+	bool FetchDeviceOutputStreams(AudioDeviceID deviceID, std::vector<AudioStreamID>& streams)
+	{
+		streams.clear();
+
+		AudioObjectPropertyAddress propertyAddress = {
+			.mSelector	= kAudioDevicePropertyStreams,
+			.mScope		= kAudioObjectPropertyScopeOutput,
+			.mElement	= kAudioObjectPropertyElementMaster
+		};
+
+		UInt32 dataSize;
+		OSStatus result = AudioObjectGetPropertyDataSize(deviceID, &propertyAddress, 0, nullptr, &dataSize);
+		if(kAudioHardwareNoError != result) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyDataSize (kAudioDevicePropertyStreams) failed: " << result);
+			return false;
+		}
+
+		auto streamCount = dataSize / sizeof(AudioStreamID);
+		streams.resize(streamCount);
+
+		result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &streams[0]);
+		if(kAudioHardwareNoError != result) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyStreams) failed: " << result);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool FetchDeviceSampleRate(AudioDeviceID deviceID, Float64& sampleRate)
+	{
+		AudioObjectPropertyAddress propertyAddress = {
+			.mSelector	= kAudioDevicePropertyNominalSampleRate,
+			.mScope		= kAudioObjectPropertyScopeGlobal,
+			.mElement	= kAudioObjectPropertyElementMaster
+		};
+
+		UInt32 dataSize = sizeof(sampleRate);
+		auto result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &sampleRate);
+		if(kAudioHardwareNoError != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyNominalSampleRate) failed: " << result);
+			return false;
+		}
+
+		return true;
+	}
+
+	// The device properties cached by CoreAudioOutput
+	const AudioObjectPropertyAddress sCachedDeviceProperties [] = {
+		{ kAudioDevicePropertyHogMode,						kAudioObjectPropertyScopeGlobal,	kAudioObjectPropertyElementMaster },
+		{ kAudioDevicePropertyStreamConfiguration,			kAudioObjectPropertyScopeOutput,	kAudioObjectPropertyElementMaster },
+		{ kAudioDevicePropertyPreferredChannelsForStereo,	kAudioObjectPropertyScopeOutput,	kAudioObjectPropertyElementMaster },
+		{ kAudioDevicePropertyAvailableNominalSampleRates,	kAudioObjectPropertyScopeGlobal,	kAudioObjectPropertyElementMaster },
+		{ kAudioDevicePropertyStreams,						kAudioObjectPropertyScopeOutput,	kAudioObjectPropertyElementMaster },
+		{ kAudioDevicePropertyNominalSampleRate,			kAudioObjectPropertyScopeGlobal,	kAudioObjectPropertyElementMaster },
+	};
+
+}
+
+#endif
+
 SFB::Audio::CoreAudioOutput::CoreAudioOutput()
-	: mAUGraph(nullptr), mMixerNode(-1), mOutputNode(-1), mDefaultMaximumFramesPerSlice(0)
-{}
+	: mAUGraph(nullptr), mMixerNode(-1), mOutputNode(-1), mDefaultMaximumFramesPerSlice(0), mMixerUnit(nullptr), mOutputUnit(nullptr), mPendingPreGainRamp(NO_PENDING_RAMP)
+#if !TARGET_OS_IPHONE
+	, mIntegerModeEnabled(false), mIntegerModeStream(kAudioObjectUnknown), mDevicePropertyQueue(nullptr), mDevicePropertyListener(nullptr), mDevicePropertyChangedBlock(nullptr)
+#endif
+{
+	memset(&mPreGainRamp, 0, sizeof(mPreGainRamp));
+#if !TARGET_OS_IPHONE
+	memset(&mSavedPhysicalFormat, 0, sizeof(mSavedPhysicalFormat));
+	memset(&mSavedVirtualFormat, 0, sizeof(mSavedVirtualFormat));
+
+	mDeviceState.mDeviceID = kAudioDeviceUnknown;
+	ResetDeviceState();
+
+	// Property changes are handled on a serial queue so the client's block is never called concurrently
+	mDevicePropertyQueue = dispatch_queue_create("org.sbooth.AudioEngine.Output.CoreAudio.DeviceProperties", DISPATCH_QUEUE_SERIAL);
+	if(nullptr == mDevicePropertyQueue)
+		LOGGER_CRIT("org.sbooth.AudioEngine.Output.CoreAudio", "dispatch_queue_create failed");
+
+	mDevicePropertyListener = Block_copy(^(UInt32 inNumberAddresses, const AudioObjectPropertyAddress *inAddresses) {
+		HandleDevicePropertyChanges(inNumberAddresses, inAddresses);
+	});
+#endif
+}
 
 SFB::Audio::CoreAudioOutput::~CoreAudioOutput()
-{}
+{
+#if !TARGET_OS_IPHONE
+	{
+		std::lock_guard<std::mutex> lock(mDeviceStateMutex);
+		StopObservingDevice();
+	}
+
+	if(mDevicePropertyQueue) {
+		// Wait for any property changes in progress
+		dispatch_sync(mDevicePropertyQueue, ^{});
+		dispatch_release(mDevicePropertyQueue);
+		mDevicePropertyQueue = nullptr;
+	}
+
+	if(mDevicePropertyListener) {
+		Block_release(mDevicePropertyListener);
+		mDevicePropertyListener = nullptr;
+	}
+
+	if(mDevicePropertyChangedBlock) {
+		Block_release(mDevicePropertyChangedBlock);
+		mDevicePropertyChangedBlock = nullptr;
+	}
+#endif
+}
 
 #pragma mark Player Parameters
 
@@ -49,14 +309,11 @@ bool SFB::Audio::CoreAudioOutput::SetVolume(Float32 volume)
 
 bool SFB::Audio::CoreAudioOutput::GetVolumeForChannel(UInt32 channel, Float32& volume) const
 {
-	AudioUnit au = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	AudioUnit au = mOutputUnit;
+	if(nullptr == au)
 		return false;
-	}
 
-	result = AudioUnitGetParameter(au, kHALOutputParam_Volume, kAudioUnitScope_Global, channel, &volume);
+	auto result = AudioUnitGetParameter(au, kHALOutputParam_Volume, kAudioUnitScope_Global, channel, &volume);
 	if(noErr != result) {
 		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitGetParameter (kHALOutputParam_Volume, kAudioUnitScope_Global, " << channel << ") failed: " << result);
 		return false;
@@ -70,14 +327,11 @@ bool SFB::Audio::CoreAudioOutput::SetVolumeForChannel(UInt32 channel, Float32 vo
 	if(0 > volume || 1 < volume)
 		return false;
 
-	AudioUnit au = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	AudioUnit au = mOutputUnit;
+	if(nullptr == au)
 		return false;
-	}
 
-	result = AudioUnitSetParameter(au, kHALOutputParam_Volume, kAudioUnitScope_Global, channel, volume, 0);
+	auto result = AudioUnitSetParameter(au, kHALOutputParam_Volume, kAudioUnitScope_Global, channel, volume, 0);
 	if(noErr != result) {
 		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitSetParameter (kHALOutputParam_Volume, kAudioUnitScope_Global, " << channel << ") failed: " << result);
 		return false;
@@ -90,14 +344,17 @@ bool SFB::Audio::CoreAudioOutput::SetVolumeForChannel(UInt32 channel, Float32 vo
 
 bool SFB::Audio::CoreAudioOutput::GetPreGain(Float32& preGain) const
 {
-	AudioUnit au = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mMixerNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
-		return false;
+	// Without a mixer the signal is unattenuated
+	if(-1 == mMixerNode) {
+		preGain = 1;
+		return true;
 	}
 
-	result = AudioUnitGetParameter(au, kMultiChannelMixerParam_Volume, kAudioUnitScope_Input, 0, &preGain);
+	AudioUnit au = mMixerUnit;
+	if(nullptr == au)
+		return false;
+
+	auto result = AudioUnitGetParameter(au, kMultiChannelMixerParam_Volume, kAudioUnitScope_Input, 0, &preGain);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitGetParameter (kMultiChannelMixerParam_Volume, kAudioUnitScope_Input) failed: " << result);
 		return false;
@@ -111,36 +368,61 @@ bool SFB::Audio::CoreAudioOutput::SetPreGain(Float32 preGain)
 	if(0 > preGain || 1 < preGain)
 		return false;
 
-	AudioUnit au = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mMixerNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
-		return false;
+	// The mixer is only added to the graph when attenuation is required
+	if(-1 == mMixerNode) {
+		if(1 == preGain)
+			return true;
+
+		if(!AddMixerNode())
+			return false;
 	}
 
-	result = AudioUnitSetParameter(au, kMultiChannelMixerParam_Volume, kAudioUnitScope_Input, 0, preGain, 0);
+	AudioUnit au = mMixerUnit;
+	if(nullptr == au)
+		return false;
+
+	auto result = AudioUnitSetParameter(au, kMultiChannelMixerParam_Volume, kAudioUnitScope_Input, 0, preGain, 0);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitSetParameter (kMultiChannelMixerParam_Volume, kAudioUnitScope_Input) failed: " << result);
 		return false;
 	}
 
+	// Cancel any ramp in progress
+	mPendingPreGainRamp.store(PackRamp(preGain, 0), std::memory_order_release);
+
 	LOGGER_INFO("org.sbooth.AudioEngine.Output.CoreAudio", "Pregain set to " << preGain);
 
 	return true;
 }
 
+bool SFB::Audio::CoreAudioOutput::RampPreGain(Float32 preGain, Float64 duration)
+{
+	if(0 > preGain || 1 < preGain || 0 > duration)
+		return false;
+
+	UInt32 durationFrames = (UInt32)(duration * mFormat.mSampleRate);
+	if(0 == durationFrames || !IsOpen())
+		return SetPreGain(preGain);
+
+	if(-1 == mMixerNode && !AddMixerNode())
+		return false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Output.CoreAudio", "Ramping pregain to " << preGain << " over " << durationFrames << " frames");
+
+	mPendingPreGainRamp.store(PackRamp(preGain, durationFrames), std::memory_order_release);
+
+	return true;
+}
+
 bool SFB::Audio::CoreAudioOutput::IsPerformingSampleRateConversion() const
 {
-	AudioUnit au = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	AudioUnit au = mOutputUnit;
+	if(nullptr == au)
 		return false;
-	}
 
 	Float64 sampleRate;
 	UInt32 dataSize = sizeof(sampleRate);
-	result = AudioUnitGetProperty(au, kAudioUnitProperty_SampleRate, kAudioUnitScope_Global, 0, &sampleRate, &dataSize);
+	auto result = AudioUnitGetProperty(au, kAudioUnitProperty_SampleRate, kAudioUnitScope_Global, 0, &sampleRate, &dataSize);
 	if(noErr != result) {
 		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitGetProperty (kAudioUnitProperty_SampleRate) failed: " << result);
 		return false;
@@ -151,15 +433,12 @@ bool SFB::Audio::CoreAudioOutput::IsPerformingSampleRateConversion() const
 
 bool SFB::Audio::CoreAudioOutput::GetSampleRateConverterComplexity(UInt32& complexity) const
 {
-	AudioUnit au = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	AudioUnit au = mOutputUnit;
+	if(nullptr == au)
 		return false;
-	}
 
 	UInt32 dataSize = sizeof(complexity);
-	result = AudioUnitGetProperty(au, kAudioUnitProperty_SampleRateConverterComplexity, kAudioUnitScope_Global, 0, &complexity, &dataSize);
+	auto result = AudioUnitGetProperty(au, kAudioUnitProperty_SampleRateConverterComplexity, kAudioUnitScope_Global, 0, &complexity, &dataSize);
 	if(noErr != result) {
 		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitGetProperty (kAudioUnitProperty_SampleRateConverterComplexity) failed: " << result);
 		return false;
@@ -172,14 +451,11 @@ bool SFB::Audio::CoreAudioOutput::SetSampleRateConverterComplexity(UInt32 comple
 {
 	LOGGER_INFO("org.sbooth.AudioEngine.Output.CoreAudio", "Setting sample rate converter complexity to '" << SFB::StringForOSType(complexity) << "'");
 
-	AudioUnit au = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	AudioUnit au = mOutputUnit;
+	if(nullptr == au)
 		return false;
-	}
 
-	result = AudioUnitSetProperty(au, kAudioUnitProperty_SampleRateConverterComplexity, kAudioUnitScope_Global, 0, &complexity, (UInt32)sizeof(complexity));
+	auto result = AudioUnitSetProperty(au, kAudioUnitProperty_SampleRateConverterComplexity, kAudioUnitScope_Global, 0, &complexity, (UInt32)sizeof(complexity));
 	if(noErr != result) {
 		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitSetProperty (kAudioUnitProperty_SampleRateConverterComplexity) failed: " << result);
 		return false;
@@ -190,15 +466,12 @@ bool SFB::Audio::CoreAudioOutput::SetSampleRateConverterComplexity(UInt32 comple
 
 bool SFB::Audio::CoreAudioOutput::GetSampleRateConverterQuality(UInt32& quality) const
 {
-	AudioUnit au = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	AudioUnit au = mOutputUnit;
+	if(nullptr == au)
 		return false;
-	}
 
 	UInt32 dataSize = sizeof(quality);
-	result = AudioUnitGetProperty(au, kAudioUnitProperty_RenderQuality, kAudioUnitScope_Global, 0, &quality, &dataSize);
+	auto result = AudioUnitGetProperty(au, kAudioUnitProperty_RenderQuality, kAudioUnitScope_Global, 0, &quality, &dataSize);
 	if(noErr != result) {
 		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitGetProperty (kAudioUnitProperty_RenderQuality) failed: " << result);
 		return false;
@@ -211,14 +484,11 @@ bool SFB::Audio::CoreAudioOutput::SetSampleRateConverterQuality(UInt32 quality)
 {
 	LOGGER_INFO("org.sbooth.AudioEngine.Output.CoreAudio", "Setting sample rate converter quality to " << quality);
 
-	AudioUnit au = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	AudioUnit au = mOutputUnit;
+	if(nullptr == au)
 		return false;
-	}
 
-	result = AudioUnitSetProperty(au, kAudioUnitProperty_RenderQuality, kAudioUnitScope_Global, 0, &quality, (UInt32)sizeof(quality));
+	auto result = AudioUnitSetProperty(au, kAudioUnitProperty_RenderQuality, kAudioUnitScope_Global, 0, &quality, (UInt32)sizeof(quality));
 	if(noErr != result) {
 		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitSetProperty (kAudioUnitProperty_RenderQuality) failed: " << result);
 		return false;
@@ -238,6 +508,13 @@ bool SFB::Audio::CoreAudioOutput::AddEffect(OSType componentType, OSType subType
 {
 	LOGGER_INFO("org.sbooth.AudioEngine.Output.CoreAudio", "Adding DSP: '" << SFB::StringForOSType(componentType) << "''" << SFB::StringForOSType(subType) << "' '" << SFB::StringForOSType(manufacturer) << "'");
 
+#if !TARGET_OS_IPHONE
+	if(IsRenderingIntegerAudio()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "Effects can't process integer audio");
+		return false;
+	}
+#endif
+
 	// Get the source node for the graph's output node
 	UInt32 numInteractions = 0;
 	auto result = AUGraphCountNodeInteractions(mAUGraph, mOutputNode, &numInteractions);
@@ -264,8 +541,19 @@ bool SFB::Audio::CoreAudioOutput::AddEffect(OSType componentType, OSType subType
 		}
 	}
 
-	// Unable to determine the preceding node, so bail
+	// If the output node has no preceding node it receives audio directly from the render callback
+	bool outputIsHead = false;
 	if(-1 == sourceNode) {
+		for(UInt32 interactionIndex = 0; interactionIndex < numInteractions; ++interactionIndex) {
+			if(kAUNodeInteraction_InputCallback == interactions[interactionIndex].nodeInteractionType) {
+				outputIsHead = true;
+				break;
+			}
+		}
+	}
+
+	// Unable to determine the preceding node, so bail
+	if(-1 == sourceNode && !outputIsHead) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "Unable to determine input node");
 		return false;
 	}
@@ -338,6 +626,22 @@ bool SFB::Audio::CoreAudioOutput::AddEffect(OSType componentType, OSType subType
 //		return false;
 //	}
 
+	// The effect receives the render callback in place of the output node
+	if(outputIsHead) {
+		if(!InsertNodeAtHead(effectNode)) {
+			result = AUGraphRemoveNode(mAUGraph, effectNode);
+			if(noErr != result)
+				LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphRemoveNode failed: " << result);
+
+			return false;
+		}
+
+		if(nullptr != effectUnit1)
+			*effectUnit1 = effectUnit;
+
+		return true;
+	}
+
 	// Insert the effect at the end of the graph, before the output node
 	result = AUGraphDisconnectNodeInput(mAUGraph, mOutputNode, 0);
 
@@ -442,6 +746,7 @@ bool SFB::Audio::CoreAudioOutput::RemoveEffect(AudioUnit effectUnit)
 	}
 
 	AUNode sourceNode = -1, destNode = -1;
+	AURenderCallbackStruct renderCallback = { nullptr, nullptr };
 	for(UInt32 interactionIndex = 0; interactionIndex < numInteractions; ++interactionIndex) {
 		AUNodeInteraction interaction = interactions[interactionIndex];
 
@@ -451,9 +756,12 @@ bool SFB::Audio::CoreAudioOutput::RemoveEffect(AudioUnit effectUnit)
 			else if(effectNode == interaction.nodeInteraction.connection.sourceNode)
 				destNode = interaction.nodeInteraction.connection.destNode;
 		}
+		// The effect at the head of the graph receives the render callback
+		else if(kAUNodeInteraction_InputCallback == interaction.nodeInteractionType && effectNode == interaction.nodeInteraction.inputCallback.destNode)
+			renderCallback = interaction.nodeInteraction.inputCallback.cback;
 	}
 
-	if(-1 == sourceNode || -1 == destNode) {
+	if((-1 == sourceNode && nullptr == renderCallback.inputProc) || -1 == destNode) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "Unable to find the source or destination nodes");
 		return false;
 	}
@@ -476,11 +784,25 @@ bool SFB::Audio::CoreAudioOutput::RemoveEffect(AudioUnit effectUnit)
 		return false;
 	}
 
+	if(effectNode == mMixerNode) {
+		mMixerNode = -1;
+		mMixerUnit = nullptr;
+	}
+
 	// Reconnect the nodes
-	result = AUGraphConnectNodeInput(mAUGraph, sourceNode, 0, destNode, 0);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphConnectNodeInput failed: " << result);
-		return false;
+	if(-1 != sourceNode) {
+		result = AUGraphConnectNodeInput(mAUGraph, sourceNode, 0, destNode, 0);
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphConnectNodeInput failed: " << result);
+			return false;
+		}
+	}
+	else {
+		result = AUGraphSetNodeInputCallback(mAUGraph, destNode, 0, &renderCallback);
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphSetNodeInputCallback failed: " << result);
+			return false;
+		}
 	}
 
 	result = AUGraphUpdate(mAUGraph, nullptr);
@@ -498,27 +820,20 @@ bool SFB::Audio::CoreAudioOutput::RemoveEffect(AudioUnit effectUnit)
 
 bool SFB::Audio::CoreAudioOutput::DeviceIsHogged() const
 {
-	// Is it hogged by us?
-	AudioObjectPropertyAddress propertyAddress = {
-		.mSelector	= kAudioDevicePropertyHogMode,
-		.mScope		= kAudioObjectPropertyScopeGlobal,
-		.mElement	= kAudioObjectPropertyElementMaster
-	};
-
-	pid_t hogPID = (pid_t)-1;
-	UInt32 dataSize = sizeof(hogPID);
+	std::lock_guard<std::mutex> lock(mDeviceStateMutex);
 
 	AudioDeviceID deviceID;
-	if(!GetDeviceID(deviceID))
+	if(!ObserveCurrentDevice(deviceID))
 		return false;
 
-	auto result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &hogPID);
-	if(kAudioHardwareNoError != result) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyHogMode) failed: " << result);
-		return false;
+	if(!mDeviceState.mHasHogPID) {
+		if(!FetchDeviceHogPID(deviceID, mDeviceState.mHogPID))
+			return false;
+		mDeviceState.mHasHogPID = true;
 	}
 
-	return (hogPID == getpid() ? true : false);
+	// Is it hogged by us?
+	return (mDeviceState.mHogPID == getpid() ? true : false);
 }
 
 bool SFB::Audio::CoreAudioOutput::StartHoggingDevice()
@@ -558,6 +873,7 @@ bool SFB::Audio::CoreAudioOutput::StartHoggingDevice()
 	hogPID = getpid();
 
 	result = AudioObjectSetPropertyData(deviceID, &propertyAddress, 0, nullptr, sizeof(hogPID), &hogPID);
+	InvalidateDeviceProperty(kAudioDevicePropertyHogMode);
 	if(kAudioHardwareNoError != result) {
 		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectSetPropertyData (kAudioDevicePropertyHogMode) failed: " << result);
 		return false;
@@ -602,10 +918,15 @@ bool SFB::Audio::CoreAudioOutput::StopHoggingDevice()
 	if(restartIO)
 		_Stop();
 
+	// Integer formats aren't mixable so they can't be retained without hog mode
+	// The graph converts its integer audio to the restored float format until the output is next set up
+	ExitIntegerMode();
+
 	// Release hog mode.
 	hogPID = (pid_t)-1;
 
 	result = AudioObjectSetPropertyData(deviceID, &propertyAddress, 0, nullptr, sizeof(hogPID), &hogPID);
+	InvalidateDeviceProperty(kAudioDevicePropertyHogMode);
 	if(kAudioHardwareNoError != result) {
 		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectSetPropertyData (kAudioDevicePropertyHogMode) failed: " << result);
 		return false;
@@ -758,121 +1079,55 @@ bool SFB::Audio::CoreAudioOutput::SetDeviceVolumeForChannel(UInt32 channel, Floa
 
 bool SFB::Audio::CoreAudioOutput::GetDeviceChannelCount(UInt32& channelCount) const
 {
-	AudioDeviceID deviceID;
-	if(!GetDeviceID(deviceID))
-		return false;
-
-	AudioObjectPropertyAddress propertyAddress = {
-		.mSelector	= kAudioDevicePropertyStreamConfiguration,
-		.mScope		= kAudioObjectPropertyScopeOutput,
-		.mElement	= kAudioObjectPropertyElementMaster
-	};
+	std::lock_guard<std::mutex> lock(mDeviceStateMutex);
 
-	if(!AudioObjectHasProperty(deviceID, &propertyAddress)) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectHasProperty (kAudioDevicePropertyStreamConfiguration, kAudioObjectPropertyScopeOutput) is false");
-		return false;
-	}
-
-	UInt32 dataSize;
-	auto result = AudioObjectGetPropertyDataSize(deviceID, &propertyAddress, 0, nullptr, &dataSize);
-
-	if(kAudioHardwareNoError != result) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyDataSize (kAudioDevicePropertyStreamConfiguration, kAudioObjectPropertyScopeOutput) failed: " << result);
-		return false;
-	}
-
-	AudioBufferList *bufferList = (AudioBufferList *)malloc(dataSize);
-
-	if(nullptr == bufferList) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "Unable to allocate << " << dataSize << " bytes");
+	AudioDeviceID deviceID;
+	if(!ObserveCurrentDevice(deviceID))
 		return false;
-	}
-
-	result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, bufferList);
 
-	if(kAudioHardwareNoError != result) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyStreamConfiguration, kAudioObjectPropertyScopeOutput) failed: " << result);
-		free(bufferList);
-		bufferList = nullptr;
-		return false;
+	if(!mDeviceState.mHasChannelCount) {
+		if(!FetchDeviceChannelCount(deviceID, mDeviceState.mChannelCount))
+			return false;
+		mDeviceState.mHasChannelCount = true;
 	}
 
-	channelCount = 0;
-	for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
-		channelCount += bufferList->mBuffers[bufferIndex].mNumberChannels;
-
-	free(bufferList);
-	bufferList = nullptr;
+	channelCount = mDeviceState.mChannelCount;
 	return true;
 }
 
 bool SFB::Audio::CoreAudioOutput::GetDevicePreferredStereoChannels(std::pair<UInt32, UInt32>& preferredStereoChannels) const
 {
-	AudioDeviceID deviceID;
-	if(!GetDeviceID(deviceID))
-		return false;
+	std::lock_guard<std::mutex> lock(mDeviceStateMutex);
 
-	AudioObjectPropertyAddress propertyAddress = {
-		.mSelector	= kAudioDevicePropertyPreferredChannelsForStereo,
-		.mScope		= kAudioObjectPropertyScopeOutput,
-		.mElement	= kAudioObjectPropertyElementMaster
-	};
-
-	if(!AudioObjectHasProperty(deviceID, &propertyAddress)) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectHasProperty (kAudioDevicePropertyPreferredChannelsForStereo, kAudioObjectPropertyScopeOutput) failed is false");
+	AudioDeviceID deviceID;
+	if(!ObserveCurrentDevice(deviceID))
 		return false;
-	}
-
-	UInt32 preferredChannels [2];
-	UInt32 dataSize = sizeof(preferredChannels);
-	auto result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &preferredChannels);
 
-	if(kAudioHardwareNoError != result) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyPreferredChannelsForStereo, kAudioObjectPropertyScopeOutput) failed: " << result);
-		return false;
+	if(!mDeviceState.mHasPreferredStereoChannels) {
+		if(!FetchDevicePreferredStereoChannels(deviceID, mDeviceState.mPreferredStereoChannels))
+			return false;
+		mDeviceState.mHasPreferredStereoChannels = true;
 	}
 
-	preferredStereoChannels.first = preferredChannels[0];
-	preferredStereoChannels.second = preferredChannels[1];
-
+	preferredStereoChannels = mDeviceState.mPreferredStereoChannels;
 	return true;
 }
 
 bool SFB::Audio::CoreAudioOutput::GetDeviceAvailableNominalSampleRates(std::vector<AudioValueRange>& nominalSampleRates) const
 {
-	nominalSampleRates.clear();
+	std::lock_guard<std::mutex> lock(mDeviceStateMutex);
 
 	AudioDeviceID deviceID;
-	if(!GetDeviceID(deviceID))
+	if(!ObserveCurrentDevice(deviceID))
 		return false;
 
-	AudioObjectPropertyAddress propertyAddress = {
-		.mSelector	= kAudioDevicePropertyAvailableNominalSampleRates,
-		.mScope		= kAudioObjectPropertyScopeGlobal,
-		.mElement	= kAudioObjectPropertyElementMaster
-	};
-
-	if(!AudioObjectHasProperty(deviceID, &propertyAddress)) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectHasProperty (kAudioDevicePropertyAvailableNominalSampleRates, kAudioObjectPropertyScopeOutput) failed is false");
-		return false;
-	}
-
-	UInt32 dataSize = 0;
-	OSStatus result = AudioObjectGetPropertyDataSize(deviceID, &propertyAddress, 0, nullptr, &dataSize);
-	if(kAudioHardwareNoError != result) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyDataSize (kAudioDevicePropertyAvailableNominalSampleRates, kAudioObjectPropertyScopeOutput) failed is false");
-		return false;
-	}
-
-	size_t numberNominalSampleRates = dataSize / sizeof(AudioValueRange);
-	nominalSampleRates.resize(numberNominalSampleRates);
-
-	result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &nominalSampleRates[0]);
-	if(kAudioHardwareNoError != result) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyAvailableNominalSampleRates, kAudioObjectPropertyScopeOutput) failed is false");
-		return false;
+	if(!mDeviceState.mHasNominalSampleRates) {
+		if(!FetchDeviceAvailableNominalSampleRates(deviceID, mDeviceState.mNominalSampleRates))
+			return false;
+		mDeviceState.mHasNominalSampleRates = true;
 	}
 
+	nominalSampleRates = mDeviceState.mNominalSampleRates;
 	return true;
 }
 
@@ -880,16 +1135,13 @@ bool SFB::Audio::CoreAudioOutput::GetDeviceAvailableNominalSampleRates(std::vect
 
 bool SFB::Audio::CoreAudioOutput::GetDeviceID(AudioDeviceID& deviceID) const
 {
-	AudioUnit au = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	AudioUnit au = mOutputUnit;
+	if(nullptr == au)
 		return false;
-	}
 
 	UInt32 dataSize = sizeof(deviceID);
 
-	result = AudioUnitGetProperty(au, kAudioOutputUnitProperty_CurrentDevice, kAudioUnitScope_Global, 0, &deviceID, &dataSize);
+	auto result = AudioUnitGetProperty(au, kAudioOutputUnitProperty_CurrentDevice, kAudioUnitScope_Global, 0, &deviceID, &dataSize);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitGetProperty (kAudioOutputUnitProperty_CurrentDevice) failed: " << result);
 		return false;
@@ -903,23 +1155,34 @@ bool SFB::Audio::CoreAudioOutput::SetDeviceID(AudioDeviceID deviceID)
 	if(kAudioDeviceUnknown == deviceID)
 		return false;
 
-	AudioUnit au = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	AudioUnit au = mOutputUnit;
+	if(nullptr == au)
 		return false;
-	}
 
 	// Update our output AU to use the specified device
-	result = AudioUnitSetProperty(au, kAudioOutputUnitProperty_CurrentDevice, kAudioUnitScope_Global, 0, &deviceID, (UInt32)sizeof(deviceID));
+	auto result = AudioUnitSetProperty(au, kAudioOutputUnitProperty_CurrentDevice, kAudioUnitScope_Global, 0, &deviceID, (UInt32)sizeof(deviceID));
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitSetProperty (kAudioOutputUnitProperty_CurrentDevice) failed: " << result);
 		return false;
 	}
 
+	// Fill the cache for the new device
+	FillDeviceState();
+
 	return true;
 }
 
+void SFB::Audio::CoreAudioOutput::SetDevicePropertyChangedBlock(DevicePropertyChangedBlock block)
+{
+	// The block is only used on mDevicePropertyQueue
+	auto newBlock = block ? Block_copy(block) : nullptr;
+	dispatch_sync(mDevicePropertyQueue, ^{
+		if(mDevicePropertyChangedBlock)
+			Block_release(mDevicePropertyChangedBlock);
+		mDevicePropertyChangedBlock = newBlock;
+	});
+}
+
 bool SFB::Audio::CoreAudioOutput::GetAvailableDataSources(std::vector<UInt32>& dataSources) const
 {
 	dataSources.clear();
@@ -1026,105 +1289,90 @@ bool SFB::Audio::CoreAudioOutput::SetActiveDataSources(const std::vector<UInt32>
 
 bool SFB::Audio::CoreAudioOutput::GetOutputStreams(std::vector<AudioStreamID>& streams) const
 {
-	streams.clear();
+	std::lock_guard<std::mutex> lock(mDeviceStateMutex);
 
-	AudioDeviceID deviceID = kAudioDeviceUnknown;
-	if(!GetDeviceID(deviceID) || kAudioDeviceUnknown == deviceID)
+	AudioDeviceID deviceID;
+	if(!ObserveCurrentDevice(deviceID))
+		return false;
+
+	if(!mDeviceState.mHasOutputStreams) {
+		if(!FetchDeviceOutputStreams(deviceID, mDeviceState.mOutputStreams))
+			return false;
+		mDeviceState.mHasOutputStreams = true;
+	}
+
+	streams = mDeviceState.mOutputStreams;
+	return true;
+}
+
+bool SFB::Audio::CoreAudioOutput::GetOutputStreamVirtualFormat(AudioStreamID streamID, AudioStreamBasicDescription& virtualFormat) const
+{
+	std::vector<AudioStreamID> streams;
+	if(!GetOutputStreams(streams))
+		return false;
+
+	if(std::end(streams) == std::find(std::begin(streams), std::end(streams), streamID)) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "Unknown AudioStreamID: " << std::hex << streamID);
 		return false;
+	}
 
 	AudioObjectPropertyAddress propertyAddress = {
-		.mSelector	= kAudioDevicePropertyStreams,
-		.mScope		= kAudioObjectPropertyScopeOutput,
+		.mSelector	= kAudioStreamPropertyVirtualFormat,
+		.mScope		= kAudioObjectPropertyScopeGlobal,
 		.mElement	= kAudioObjectPropertyElementMaster
 	};
 
-	UInt32 dataSize;
-	OSStatus result = AudioObjectGetPropertyDataSize(deviceID, &propertyAddress, 0, nullptr, &dataSize);
+	UInt32 dataSize = sizeof(virtualFormat);
+
+	OSStatus result = AudioObjectGetPropertyData(streamID,
+												 &propertyAddress,
+												 0,
+												 nullptr,
+												 &dataSize,
+												 &virtualFormat);
+
 	if(kAudioHardwareNoError != result) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyDataSize (kAudioDevicePropertyStreams) failed: " << result);
+		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioStreamPropertyVirtualFormat) failed: " << result);
+		return false;
+	}
+
+	return true;
+}
+
+bool SFB::Audio::CoreAudioOutput::SetOutputStreamVirtualFormat(AudioStreamID streamID, const AudioStreamBasicDescription& virtualFormat)
+{
+	LOGGER_INFO("org.sbooth.AudioEngine.Output.CoreAudio", "Setting stream 0x" << std::hex << streamID << " virtual format to: " << virtualFormat);
+
+	std::vector<AudioStreamID> streams;
+	if(!GetOutputStreams(streams))
+		return false;
+
+	if(std::end(streams) == std::find(std::begin(streams), std::end(streams), streamID)) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "Unknown AudioStreamID: " << std::hex << streamID);
 		return false;
 	}
 
-	auto streamCount = dataSize / sizeof(AudioStreamID);
-	streams.resize(streamCount);
+	AudioObjectPropertyAddress propertyAddress = {
+		.mSelector	= kAudioStreamPropertyVirtualFormat,
+		.mScope		= kAudioObjectPropertyScopeGlobal,
+		.mElement	= kAudioObjectPropertyElementMaster
+	};
+
+	OSStatus result = AudioObjectSetPropertyData(streamID,
+												 &propertyAddress,
+												 0,
+												 nullptr,
+												 sizeof(virtualFormat),
+												 &virtualFormat);
 
-	result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &streams[0]);
 	if(kAudioHardwareNoError != result) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyStreams) failed: " << result);
+		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectSetPropertyData (kAudioStreamPropertyVirtualFormat) failed: " << result);
 		return false;
 	}
 
 	return true;
 }
 
-//bool SFB::Audio::CoreAudioOutput::GetOutputStreamVirtualFormat(AudioStreamID streamID, AudioStreamBasicDescription& virtualFormat) const
-//{
-//	std::vector<AudioStreamID> streams;
-//	if(!GetOutputStreams(streams))
-//		return false;
-//
-//	if(std::end(streams) == std::find(std::begin(streams), std::end(streams), streamID)) {
-//		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "Unknown AudioStreamID: " << std::hex << streamID);
-//		return false;
-//	}
-//
-//	AudioObjectPropertyAddress propertyAddress = {
-//		.mSelector	= kAudioStreamPropertyVirtualFormat,
-//		.mScope		= kAudioObjectPropertyScopeGlobal,
-//		.mElement	= kAudioObjectPropertyElementMaster
-//	};
-//
-//	UInt32 dataSize = sizeof(virtualFormat);
-//
-//	OSStatus result = AudioObjectGetPropertyData(streamID,
-//												 &propertyAddress,
-//												 0,
-//												 nullptr,
-//												 &dataSize,
-//												 &virtualFormat);
-//
-//	if(kAudioHardwareNoError != result) {
-//		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioStreamPropertyVirtualFormat) failed: " << result);
-//		return false;
-//	}
-//
-//	return true;
-//}
-//
-//bool SFB::Audio::CoreAudioOutput::SetOutputStreamVirtualFormat(AudioStreamID streamID, const AudioStreamBasicDescription& virtualFormat)
-//{
-//	LOGGER_INFO("org.sbooth.AudioEngine.Output.CoreAudio", "Setting stream 0x" << std::hex << streamID << " virtual format to: " << virtualFormat);
-//
-//	std::vector<AudioStreamID> streams;
-//	if(!GetOutputStreams(streams))
-//		return false;
-//
-//	if(std::end(streams) == std::find(std::begin(streams), std::end(streams), streamID)) {
-//		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "Unknown AudioStreamID: " << std::hex << streamID);
-//		return false;
-//	}
-//
-//	AudioObjectPropertyAddress propertyAddress = {
-//		.mSelector	= kAudioStreamPropertyVirtualFormat,
-//		.mScope		= kAudioObjectPropertyScopeGlobal,
-//		.mElement	= kAudioObjectPropertyElementMaster
-//	};
-//
-//	OSStatus result = AudioObjectSetPropertyData(streamID,
-//												 &propertyAddress,
-//												 0,
-//												 nullptr,
-//												 sizeof(virtualFormat),
-//												 &virtualFormat);
-//
-//	if(kAudioHardwareNoError != result) {
-//		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectSetPropertyData (kAudioStreamPropertyVirtualFormat) failed: " << result);
-//		return false;
-//	}
-//
-//	return true;
-//}
-
 bool SFB::Audio::CoreAudioOutput::GetOutputStreamPhysicalFormat(AudioStreamID streamID, AudioStreamBasicDescription& physicalFormat) const
 {
 	std::vector<AudioStreamID> streams;
@@ -1193,6 +1441,208 @@ bool SFB::Audio::CoreAudioOutput::SetOutputStreamPhysicalFormat(AudioStreamID st
 	return true;
 }
 
+#pragma mark Device Property Cache
+
+bool SFB::Audio::CoreAudioOutput::ObserveCurrentDevice(AudioDeviceID& deviceID) const
+{
+	// Querying the output unit doesn't involve the HAL
+	if(!GetDeviceID(deviceID) || kAudioDeviceUnknown == deviceID)
+		return false;
+
+	if(deviceID == mDeviceState.mDeviceID)
+		return true;
+
+	StopObservingDevice();
+	ResetDeviceState();
+
+	for(const auto& propertyAddress : sCachedDeviceProperties) {
+		auto result = AudioObjectAddPropertyListenerBlock(deviceID, &propertyAddress, mDevicePropertyQueue, mDevicePropertyListener);
+		if(kAudioHardwareNoError != result)
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectAddPropertyListenerBlock ('" << SFB::StringForOSType(propertyAddress.mSelector) << "') failed: " << result);
+	}
+
+	mDeviceState.mDeviceID = deviceID;
+
+	return true;
+}
+
+void SFB::Audio::CoreAudioOutput::StopObservingDevice() const
+{
+	if(kAudioDeviceUnknown == mDeviceState.mDeviceID)
+		return;
+
+	for(const auto& propertyAddress : sCachedDeviceProperties) {
+		auto result = AudioObjectRemovePropertyListenerBlock(mDeviceState.mDeviceID, &propertyAddress, mDevicePropertyQueue, mDevicePropertyListener);
+		if(kAudioHardwareNoError != result)
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectRemovePropertyListenerBlock ('" << SFB::StringForOSType(propertyAddress.mSelector) << "') failed: " << result);
+	}
+
+	mDeviceState.mDeviceID = kAudioDeviceUnknown;
+}
+
+void SFB::Audio::CoreAudioOutput::ResetDeviceState() const
+{
+	mDeviceState.mHasHogPID = false;
+	mDeviceState.mHasChannelCount = false;
+	mDeviceState.mHasPreferredStereoChannels = false;
+	mDeviceState.mHasNominalSampleRates = false;
+	mDeviceState.mHasOutputStreams = false;
+	mDeviceState.mHasSampleRate = false;
+}
+
+void SFB::Audio::CoreAudioOutput::FillDeviceState() const
+{
+	UInt32 channelCount;
+	std::pair<UInt32, UInt32> preferredStereoChannels;
+	std::vector<AudioValueRange> nominalSampleRates;
+	std::vector<AudioStreamID> streams;
+	Float64 sampleRate;
+
+	DeviceIsHogged();
+	GetDeviceChannelCount(channelCount);
+	GetDevicePreferredStereoChannels(preferredStereoChannels);
+	GetDeviceAvailableNominalSampleRates(nominalSampleRates);
+	GetOutputStreams(streams);
+	_GetDeviceSampleRate(sampleRate);
+}
+
+void SFB::Audio::CoreAudioOutput::InvalidateDeviceProperty(AudioObjectPropertySelector selector) const
+{
+	std::lock_guard<std::mutex> lock(mDeviceStateMutex);
+
+	switch(selector) {
+		case kAudioDevicePropertyHogMode:							mDeviceState.mHasHogPID = false;					break;
+		case kAudioDevicePropertyStreamConfiguration:				mDeviceState.mHasChannelCount = false;				break;
+		case kAudioDevicePropertyPreferredChannelsForStereo:		mDeviceState.mHasPreferredStereoChannels = false;	break;
+		case kAudioDevicePropertyAvailableNominalSampleRates:		mDeviceState.mHasNominalSampleRates = false;		break;
+		case kAudioDevicePropertyStreams:							mDeviceState.mHasOutputStreams = false;				break;
+		case kAudioDevicePropertyNominalSampleRate:					mDeviceState.mHasSampleRate = false;				break;
+		default:													ResetDeviceState();									break;
+	}
+}
+
+void SFB::Audio::CoreAudioOutput::HandleDevicePropertyChanges(UInt32 addressCount, const AudioObjectPropertyAddress *addresses)
+{
+	for(UInt32 i = 0; i < addressCount; ++i) {
+		LOGGER_DEBUG("org.sbooth.AudioEngine.Output.CoreAudio", "Device property changed: '" << SFB::StringForOSType(addresses[i].mSelector) << "'");
+
+		// The value is fetched again when next requested
+		InvalidateDeviceProperty(addresses[i].mSelector);
+
+		if(mDevicePropertyChangedBlock)
+			mDevicePropertyChangedBlock(addresses[i].mSelector);
+	}
+}
+
+#pragma mark Integer Mode
+
+bool SFB::Audio::CoreAudioOutput::FindIntegerPhysicalFormat(const Decoder& decoder, AudioStreamID& streamID, AudioStreamBasicDescription& physicalFormat) const
+{
+	const AudioFormat& decoderFormat = decoder.GetFormat();
+	if(!decoderFormat.IsPCM())
+		return false;
+
+	// Float audio is represented exactly only if it was decoded from integer samples of up to 24 bits
+	// Lossy sources have no bit depth
+	UInt32 bitsPerChannel = decoderFormat.mBitsPerChannel;
+	if(kAudioFormatFlagIsFloat & decoderFormat.mFormatFlags) {
+		const AudioFormat& sourceFormat = decoder.GetSourceFormat();
+		if((kAudioFormatFlagIsFloat & sourceFormat.mFormatFlags) || 24 < sourceFormat.mBitsPerChannel)
+			return false;
+		bitsPerChannel = sourceFormat.mBitsPerChannel;
+	}
+
+	if(0 == bitsPerChannel)
+		return false;
+
+	std::vector<AudioStreamID> streams;
+	if(!GetOutputStreams(streams) || streams.empty())
+		return false;
+
+	AudioObjectPropertyAddress propertyAddress = {
+		.mSelector	= kAudioStreamPropertyAvailablePhysicalFormats,
+		.mScope		= kAudioObjectPropertyScopeGlobal,
+		.mElement	= kAudioObjectPropertyElementMaster
+	};
+
+	UInt32 dataSize;
+	auto result = AudioObjectGetPropertyDataSize(streams[0], &propertyAddress, 0, nullptr, &dataSize);
+	if(kAudioHardwareNoError != result) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyDataSize (kAudioStreamPropertyAvailablePhysicalFormats) failed: " << result);
+		return false;
+	}
+
+	std::vector<AudioStreamRangedDescription> formats(dataSize / sizeof(AudioStreamRangedDescription));
+	if(formats.empty())
+		return false;
+
+	result = AudioObjectGetPropertyData(streams[0], &propertyAddress, 0, nullptr, &dataSize, &formats[0]);
+	if(kAudioHardwareNoError != result) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioStreamPropertyAvailablePhysicalFormats) failed: " << result);
+		return false;
+	}
+
+	// Prefer the narrowest sample width able to hold the audio, and packed samples over padded ones
+	const AudioStreamBasicDescription *match = nullptr;
+	for(const auto& format : formats) {
+		const auto& candidate = format.mFormat;
+
+		if(kAudioFormatLinearPCM != candidate.mFormatID || (kAudioFormatFlagIsFloat & candidate.mFormatFlags) || !(kAudioFormatFlagIsSignedInteger & candidate.mFormatFlags) || (kAudioFormatFlagIsNonInterleaved & candidate.mFormatFlags))
+			continue;
+
+		if(candidate.mChannelsPerFrame != decoderFormat.mChannelsPerFrame || candidate.mBitsPerChannel < bitsPerChannel)
+			continue;
+
+		if(decoderFormat.mSampleRate < format.mSampleRateRange.mMinimum || decoderFormat.mSampleRate > format.mSampleRateRange.mMaximum)
+			continue;
+
+		if(nullptr == match || candidate.mBitsPerChannel < match->mBitsPerChannel || (candidate.mBitsPerChannel == match->mBitsPerChannel && candidate.mBytesPerFrame < match->mBytesPerFrame))
+			match = &candidate;
+	}
+
+	if(nullptr == match)
+		return false;
+
+	streamID = streams[0];
+	physicalFormat = *match;
+	physicalFormat.mSampleRate = decoderFormat.mSampleRate;
+
+	return true;
+}
+
+bool SFB::Audio::CoreAudioOutput::EnterIntegerMode(AudioStreamID streamID, const AudioStreamBasicDescription& physicalFormat)
+{
+	if(mIntegerModeStream != streamID) {
+		ExitIntegerMode();
+
+		if(!GetOutputStreamPhysicalFormat(streamID, mSavedPhysicalFormat) || !GetOutputStreamVirtualFormat(streamID, mSavedVirtualFormat))
+			return false;
+	}
+
+	// The virtual format matches the physical format so the HAL performs no conversion
+	if(!SetOutputStreamPhysicalFormat(streamID, physicalFormat) || !SetOutputStreamVirtualFormat(streamID, physicalFormat)) {
+		mIntegerModeStream = streamID;
+		ExitIntegerMode();
+		return false;
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Output.CoreAudio", "Rendering integer audio: " << physicalFormat);
+	mIntegerModeStream = streamID;
+
+	return true;
+}
+
+void SFB::Audio::CoreAudioOutput::ExitIntegerMode()
+{
+	if(kAudioObjectUnknown == mIntegerModeStream)
+		return;
+
+	if(!SetOutputStreamPhysicalFormat(mIntegerModeStream, mSavedPhysicalFormat) || !SetOutputStreamVirtualFormat(mIntegerModeStream, mSavedVirtualFormat))
+		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "Unable to restore the formats of stream 0x" << std::hex << mIntegerModeStream);
+
+	mIntegerModeStream = kAudioObjectUnknown;
+}
+
 #endif
 
 #pragma mark Advanced AUGraph Functionality
@@ -1277,6 +1727,70 @@ bool SFB::Audio::CoreAudioOutput::GetAUGraphTailTime(Float64& tailTime) const
 	return true;
 }
 
+#if !TARGET_OS_IPHONE
+
+bool SFB::Audio::CoreAudioOutput::GetPresentationLatency(Float64& latency) const
+{
+	latency = 0;
+
+	Float64 graphLatency = 0;
+	if(!GetAUGraphLatency(graphLatency))
+		return false;
+
+	AudioDeviceID deviceID;
+	if(!GetDeviceID(deviceID))
+		return false;
+
+	Float64 sampleRate = 0;
+	if(!_GetDeviceSampleRate(sampleRate) || 0 >= sampleRate)
+		return false;
+
+	// The device's latency, safety offset, and I/O buffer are each expressed in frames
+	AudioObjectPropertySelector selectors [] = { kAudioDevicePropertyLatency, kAudioDevicePropertySafetyOffset, kAudioDevicePropertyBufferFrameSize };
+	UInt32 frameCount = 0;
+	for(auto selector : selectors) {
+		AudioObjectPropertyAddress propertyAddress = {
+			.mSelector	= selector,
+			.mScope		= kAudioObjectPropertyScopeOutput,
+			.mElement	= kAudioObjectPropertyElementMaster
+		};
+
+		UInt32 frames = 0;
+		UInt32 dataSize = sizeof(frames);
+		auto result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &frames);
+		if(kAudioHardwareNoError != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData ('" << SFB::StringForOSType(selector) << "') failed: " << result);
+			return false;
+		}
+
+		frameCount += frames;
+	}
+
+	// Include the latency of the first output stream
+	std::vector<AudioStreamID> streams;
+	if(GetOutputStreams(streams) && !streams.empty()) {
+		AudioObjectPropertyAddress propertyAddress = {
+			.mSelector	= kAudioStreamPropertyLatency,
+			.mScope		= kAudioObjectPropertyScopeGlobal,
+			.mElement	= kAudioObjectPropertyElementMaster
+		};
+
+		UInt32 frames = 0;
+		UInt32 dataSize = sizeof(frames);
+		auto result = AudioObjectGetPropertyData(streams.front(), &propertyAddress, 0, nullptr, &dataSize, &frames);
+		if(kAudioHardwareNoError == result)
+			frameCount += frames;
+		else
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioStreamPropertyLatency) failed: " << result);
+	}
+
+	latency = graphLatency + (frameCount / sampleRate);
+
+	return true;
+}
+
+#endif
+
 bool SFB::Audio::CoreAudioOutput::GetAUGraph(AUGraph& graph) const
 {
 	graph = mAUGraph;
@@ -1286,7 +1800,7 @@ bool SFB::Audio::CoreAudioOutput::GetAUGraph(AUGraph& graph) const
 bool SFB::Audio::CoreAudioOutput::GetAUGraphMixerNode(AUNode& node) const
 {
 	node = mMixerNode;
-	return true;
+	return -1 != mMixerNode;
 }
 
 bool SFB::Audio::CoreAudioOutput::GetAUGraphOutputNode(AUNode& node) const
@@ -1297,99 +1811,203 @@ bool SFB::Audio::CoreAudioOutput::GetAUGraphOutputNode(AUNode& node) const
 
 bool SFB::Audio::CoreAudioOutput::GetAUGraphMixer(AudioUnit& au) const
 {
-	auto result = AUGraphNodeInfo(mAUGraph, mMixerNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	au = mMixerUnit;
+	return nullptr != au;
+}
+
+bool SFB::Audio::CoreAudioOutput::GetAUGraphOutput(AudioUnit& au) const
+{
+	au = mOutputUnit;
+	return nullptr != au;
+}
+
+#pragma mark Device Management
+
+bool SFB::Audio::CoreAudioOutput::_GetDeviceSampleRate(Float64& sampleRate) const
+{
+	std::lock_guard<std::mutex> lock(mDeviceStateMutex);
+
+	AudioDeviceID deviceID;
+	if(!ObserveCurrentDevice(deviceID))
 		return false;
+
+	if(!mDeviceState.mHasSampleRate) {
+		if(!FetchDeviceSampleRate(deviceID, mDeviceState.mSampleRate))
+			return false;
+		mDeviceState.mHasSampleRate = true;
 	}
 
+	sampleRate = mDeviceState.mSampleRate;
 	return true;
 }
 
-bool SFB::Audio::CoreAudioOutput::GetAUGraphOutput(AudioUnit& au) const
+bool SFB::Audio::CoreAudioOutput::_SetDeviceSampleRate(Float64 sampleRate)
 {
-	auto result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	AudioDeviceID deviceID;
+	if(!GetDeviceID(deviceID))
+		return false;
+
+	// Determine if this will actually be a change
+	Float64 currentSampleRate;
+	if(!_GetDeviceSampleRate(currentSampleRate))
+		return false;
+
+	// Nothing to do
+	if(currentSampleRate == sampleRate)
+		return true;
+
+	AudioObjectPropertyAddress propertyAddress = {
+		.mSelector	= kAudioDevicePropertyNominalSampleRate,
+		.mScope		= kAudioObjectPropertyScopeGlobal,
+		.mElement	= kAudioObjectPropertyElementMaster
+	};
+
+	// Set the sample rate
+	auto result = AudioObjectSetPropertyData(deviceID, &propertyAddress, 0, nullptr, sizeof(sampleRate), &sampleRate);
+	InvalidateDeviceProperty(kAudioDevicePropertyNominalSampleRate);
+	if(kAudioHardwareNoError != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectSetPropertyData (kAudioDevicePropertyNominalSampleRate) failed: " << result);
 		return false;
 	}
 
 	return true;
 }
 
-#pragma mark Device Management
+bool SFB::Audio::CoreAudioOutput::_GetDeviceBufferFrameSize(UInt32& frameSize) const
+{
+	AudioDeviceID deviceID;
+	if(!GetDeviceID(deviceID))
+		return false;
+
+	AudioObjectPropertyAddress propertyAddress = {
+		.mSelector	= kAudioDevicePropertyBufferFrameSize,
+		.mScope		= kAudioObjectPropertyScopeOutput,
+		.mElement	= kAudioObjectPropertyElementMaster
+	};
+
+	UInt32 dataSize = sizeof(frameSize);
+	auto result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &frameSize);
+	if(kAudioHardwareNoError != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyBufferFrameSize) failed: " << result);
+		return false;
+	}
+
+	return true;
+}
+
+bool SFB::Audio::CoreAudioOutput::_GetDeviceBufferFrameSizeRange(UInt32& minimum, UInt32& maximum) const
+{
+	AudioDeviceID deviceID;
+	if(!GetDeviceID(deviceID))
+		return false;
+
+	AudioObjectPropertyAddress propertyAddress = {
+		.mSelector	= kAudioDevicePropertyBufferFrameSizeRange,
+		.mScope		= kAudioObjectPropertyScopeOutput,
+		.mElement	= kAudioObjectPropertyElementMaster
+	};
+
+	AudioValueRange range;
+	UInt32 dataSize = sizeof(range);
+	auto result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &range);
+	if(kAudioHardwareNoError != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyBufferFrameSizeRange) failed: " << result);
+		return false;
+	}
+
+	minimum = (UInt32)range.mMinimum;
+	maximum = (UInt32)range.mMaximum;
+
+	// The units in the graph can't render more than their maximum frames per slice in a single cycle
+	UInt32 maximumFramesPerSlice = (UInt32)_GetPreferredBufferSize();
+	if(0 != maximumFramesPerSlice)
+		maximum = std::max(minimum, std::min(maximum, maximumFramesPerSlice));
+
+	return true;
+}
 
-bool SFB::Audio::CoreAudioOutput::_GetDeviceSampleRate(Float64& sampleRate) const
+bool SFB::Audio::CoreAudioOutput::_SetDeviceBufferFrameSize(UInt32 frameSize)
 {
 	AudioDeviceID deviceID;
 	if(!GetDeviceID(deviceID))
 		return false;
 
 	AudioObjectPropertyAddress propertyAddress = {
-		.mSelector	= kAudioDevicePropertyNominalSampleRate,
-		.mScope		= kAudioObjectPropertyScopeGlobal,
+		.mSelector	= kAudioDevicePropertyBufferFrameSize,
+		.mScope		= kAudioObjectPropertyScopeOutput,
 		.mElement	= kAudioObjectPropertyElementMaster
 	};
 
-	UInt32 dataSize = sizeof(sampleRate);
-	auto result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &sampleRate);
+	auto result = AudioObjectSetPropertyData(deviceID, &propertyAddress, 0, nullptr, sizeof(frameSize), &frameSize);
 	if(kAudioHardwareNoError != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyNominalSampleRate) failed: " << result);
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectSetPropertyData (kAudioDevicePropertyBufferFrameSize) failed: " << result);
 		return false;
 	}
 
 	return true;
 }
 
-bool SFB::Audio::CoreAudioOutput::_SetDeviceSampleRate(Float64 sampleRate)
+bool SFB::Audio::CoreAudioOutput::_GetOutputLatency(Float64& latency) const
 {
+	// The time stamp passed to the render callback is the device's output time for the buffer,
+	// which already accounts for the safety offset and I/O buffer
+	latency = 0;
+
+	Float64 graphLatency = 0;
+	if(!GetAUGraphLatency(graphLatency))
+		return false;
+
 	AudioDeviceID deviceID;
 	if(!GetDeviceID(deviceID))
 		return false;
 
-	// Determine if this will actually be a change
+	Float64 sampleRate = 0;
+	if(!_GetDeviceSampleRate(sampleRate) || 0 >= sampleRate)
+		return false;
+
 	AudioObjectPropertyAddress propertyAddress = {
-		.mSelector	= kAudioDevicePropertyNominalSampleRate,
-		.mScope		= kAudioObjectPropertyScopeGlobal,
+		.mSelector	= kAudioDevicePropertyLatency,
+		.mScope		= kAudioObjectPropertyScopeOutput,
 		.mElement	= kAudioObjectPropertyElementMaster
 	};
 
-	Float64 currentSampleRate;
-	UInt32 dataSize = sizeof(currentSampleRate);
-
-	auto result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &currentSampleRate);
+	UInt32 frameCount = 0;
+	UInt32 dataSize = sizeof(frameCount);
+	auto result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &frameCount);
 	if(kAudioHardwareNoError != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyNominalSampleRate) failed: " << result);
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyLatency) failed: " << result);
 		return false;
 	}
 
-	// Nothing to do
-	if(currentSampleRate == sampleRate)
-		return true;
+	// Include the latency of the first output stream
+	std::vector<AudioStreamID> streams;
+	if(GetOutputStreams(streams) && !streams.empty()) {
+		propertyAddress.mSelector	= kAudioStreamPropertyLatency;
+		propertyAddress.mScope		= kAudioObjectPropertyScopeGlobal;
 
-	// Set the sample rate
-	dataSize = sizeof(sampleRate);
-	result = AudioObjectSetPropertyData(deviceID, &propertyAddress, 0, nullptr, sizeof(sampleRate), &sampleRate);
-	if(kAudioHardwareNoError != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectSetPropertyData (kAudioDevicePropertyNominalSampleRate) failed: " << result);
-		return false;
+		UInt32 frames = 0;
+		dataSize = sizeof(frames);
+		result = AudioObjectGetPropertyData(streams.front(), &propertyAddress, 0, nullptr, &dataSize, &frames);
+		if(kAudioHardwareNoError == result)
+			frameCount += frames;
+		else
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioStreamPropertyLatency) failed: " << result);
 	}
 
+	latency = graphLatency + (frameCount / sampleRate);
+
 	return true;
 }
 
 size_t SFB::Audio::CoreAudioOutput::_GetPreferredBufferSize() const
 {
-	AudioUnit au = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	AudioUnit au = mOutputUnit;
+	if(nullptr == au)
 		return 0;
-	}
 
 	UInt32 maxFramesPerSlice = 0;
 	UInt32 dataSize = sizeof(maxFramesPerSlice);
-	result = AudioUnitGetProperty(au, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, 0, &maxFramesPerSlice, &dataSize);
+	auto result = AudioUnitGetProperty(au, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, 0, &maxFramesPerSlice, &dataSize);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitGetProperty (kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global) failed: " << result);
 		return 0;
@@ -1398,6 +2016,44 @@ size_t SFB::Audio::CoreAudioOutput::_GetPreferredBufferSize() const
 	return maxFramesPerSlice;
 }
 
+#if __has_include(<os/workgroup.h>)
+os_workgroup_t SFB::Audio::CoreAudioOutput::_CopyIOThreadWorkgroup() const
+{
+	os_workgroup_t workgroup = nullptr;
+	UInt32 dataSize = sizeof(workgroup);
+
+#if !TARGET_OS_IPHONE
+	AudioDeviceID deviceID;
+	if(!GetDeviceID(deviceID))
+		return nullptr;
+
+	AudioObjectPropertyAddress propertyAddress = {
+		.mSelector	= kAudioDevicePropertyIOThreadOSWorkgroup,
+		.mScope		= kAudioObjectPropertyScopeGlobal,
+		.mElement	= kAudioObjectPropertyElementMaster
+	};
+
+	auto result = AudioObjectGetPropertyData(deviceID, &propertyAddress, 0, nullptr, &dataSize, &workgroup);
+	if(kAudioHardwareNoError != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioObjectGetPropertyData (kAudioDevicePropertyIOThreadOSWorkgroup) failed: " << result);
+		return nullptr;
+	}
+#else
+	AudioUnit au = mOutputUnit;
+	if(nullptr == au)
+		return nullptr;
+
+	auto result = AudioUnitGetProperty(au, kAudioOutputUnitProperty_OSWorkgroup, kAudioUnitScope_Global, 0, &workgroup, &dataSize);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitGetProperty (kAudioOutputUnitProperty_OSWorkgroup, kAudioUnitScope_Global) failed: " << result);
+		return nullptr;
+	}
+#endif
+
+	return workgroup;
+}
+#endif
+
 #pragma mark -
 
 bool SFB::Audio::CoreAudioOutput::_Open()
@@ -1408,29 +2064,10 @@ bool SFB::Audio::CoreAudioOutput::_Open()
 		return false;
 	}
 
-	// The graph will look like:
-	// MultiChannelMixer -> Output
+	// The graph initially contains only the output node, which receives audio directly from the render callback
+	// A mixer for pre-gain and any effects are added when first used
 	AudioComponentDescription desc;
 
-	// Set up the mixer node
-	desc.componentType			= kAudioUnitType_Mixer;
-	desc.componentSubType		= kAudioUnitSubType_MultiChannelMixer;
-	desc.componentManufacturer	= kAudioUnitManufacturer_Apple;
-	desc.componentFlags			= kAudioComponentFlag_SandboxSafe;
-	desc.componentFlagsMask		= 0;
-
-	result = AUGraphAddNode(mAUGraph, &desc, &mMixerNode);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphAddNode failed: " << result);
-
-		result = DisposeAUGraph(mAUGraph);
-		if(noErr != result)
-			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "DisposeAUGraph failed: " << result);
-
-		mAUGraph = nullptr;
-		return false;
-	}
-
 	// Set up the output node
 	desc.componentType			= kAudioUnitType_Output;
 #if TARGET_OS_IPHONE
@@ -1455,21 +2092,9 @@ bool SFB::Audio::CoreAudioOutput::_Open()
 		return false;
 	}
 
-	result = AUGraphConnectNodeInput(mAUGraph, mMixerNode, 0, mOutputNode, 0);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphConnectNodeInput failed: " << result);
-
-		result = DisposeAUGraph(mAUGraph);
-		if(noErr != result)
-			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "DisposeAUGraph failed: " << result);
-
-		mAUGraph = nullptr;
-		return false;
-	}
-
 	// Install the input callback
 	AURenderCallbackStruct cbs = { myAURenderCallback, this };
-	result = AUGraphSetNodeInputCallback(mAUGraph, mMixerNode, 0, &cbs);
+	result = AUGraphSetNodeInputCallback(mAUGraph, mOutputNode, 0, &cbs);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphSetNodeInputCallback failed: " << result);
 
@@ -1494,32 +2119,8 @@ bool SFB::Audio::CoreAudioOutput::_Open()
 		return false;
 	}
 
-	// Set the mixer's volume on the input and output
-	AudioUnit au = nullptr;
-	result = AUGraphNodeInfo(mAUGraph, mMixerNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
-
-		result = DisposeAUGraph(mAUGraph);
-		if(noErr != result)
-			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "DisposeAUGraph failed: " << result);
-
-		mAUGraph = nullptr;
-		return false;
-	}
-
-	result = AudioUnitSetParameter(au, kMultiChannelMixerParam_Volume, kAudioUnitScope_Input, 0, 1.f, 0);
-	if(noErr != result)
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitSetParameter (kMultiChannelMixerParam_Volume, kAudioUnitScope_Input) failed: " << result);
-
-	result = AudioUnitSetParameter(au, kMultiChannelMixerParam_Volume, kAudioUnitScope_Output, 0, 1.f, 0);
-	if(noErr != result)
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitSetParameter (kMultiChannelMixerParam_Volume, kAudioUnitScope_Output) failed: " << result);
-
-#if TARGET_OS_IPHONE
-	// All AudioUnits on iOS except RemoteIO require kAudioUnitProperty_MaximumFramesPerSlice to be 4096
-	// See http://developer.apple.com/library/ios/#documentation/AudioUnit/Reference/AudioUnitPropertiesReference/Reference/reference.html#//apple_ref/c/econst/kAudioUnitProperty_MaximumFramesPerSlice
-	result = AUGraphNodeInfo(mAUGraph, mMixerNode, nullptr, &au);
+	// Resolve the output unit once; the node's unit doesn't change while the graph is open
+	result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &mOutputUnit);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
 
@@ -1528,37 +2129,14 @@ bool SFB::Audio::CoreAudioOutput::_Open()
 			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "DisposeAUGraph failed: " << result);
 
 		mAUGraph = nullptr;
+		mOutputUnit = nullptr;
 		return false;
 	}
 
-	UInt32 framesPerSlice = 4096;
-	result = AudioUnitSetProperty(au, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, 0, &framesPerSlice, (UInt32)sizeof(framesPerSlice));
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitSetProperty (kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global) failed: " << result);
-
-		result = DisposeAUGraph(mAUGraph);
-		if(noErr != result)
-			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "DisposeAUGraph failed: " << result);
-
-		mAUGraph = nullptr;
-		return false;
-	}
-#else
+#if !TARGET_OS_IPHONE
 	// Save the default value of kAudioUnitProperty_MaximumFramesPerSlice for use when performing sample rate conversion
-	result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
-
-		result = DisposeAUGraph(mAUGraph);
-		if(noErr != result)
-			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "DisposeAUGraph failed: " << result);
-
-		mAUGraph = nullptr;
-		return false;
-	}
-
 	UInt32 dataSize = sizeof(mDefaultMaximumFramesPerSlice);
-	result = AudioUnitGetProperty(au, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, 0, &mDefaultMaximumFramesPerSlice, &dataSize);
+	result = AudioUnitGetProperty(mOutputUnit, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, 0, &mDefaultMaximumFramesPerSlice, &dataSize);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitGetProperty (kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global) failed: " << result);
 
@@ -1567,6 +2145,7 @@ bool SFB::Audio::CoreAudioOutput::_Open()
 			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "DisposeAUGraph failed: " << result);
 
 		mAUGraph = nullptr;
+		mOutputUnit = nullptr;
 		return false;
 	}
 #endif
@@ -1581,24 +2160,13 @@ bool SFB::Audio::CoreAudioOutput::_Open()
 			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "DisposeAUGraph failed: " << result);
 
 		mAUGraph = nullptr;
+		mOutputUnit = nullptr;
 		return false;
 	}
 
 	// Store the graph's format
-	result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
-
-		result = DisposeAUGraph(mAUGraph);
-		if(noErr != result)
-			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "DisposeAUGraph failed: " << result);
-
-		mAUGraph = nullptr;
-		return false;
-	}
-
 	UInt32 propertySize = sizeof(mFormat);
-	result = AudioUnitGetProperty(au, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &mFormat, &propertySize);
+	result = AudioUnitGetProperty(mOutputUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &mFormat, &propertySize);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitGetProperty (kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input) failed: " << result);
 
@@ -1607,9 +2175,12 @@ bool SFB::Audio::CoreAudioOutput::_Open()
 			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "DisposeAUGraph failed: " << result);
 
 		mAUGraph = nullptr;
+		mOutputUnit = nullptr;
 		return false;
 	}
 
+	mCanonicalFormat = mFormat;
+
 	return true;
 }
 
@@ -1660,6 +2231,12 @@ bool SFB::Audio::CoreAudioOutput::_Close()
 	mAUGraph = nullptr;
 	mMixerNode = -1;
 	mOutputNode = -1;
+	mMixerUnit = nullptr;
+	mOutputUnit = nullptr;
+
+#if !TARGET_OS_IPHONE
+	ExitIntegerMode();
+#endif
 
 	return true;
 }
@@ -1814,7 +2391,21 @@ bool SFB::Audio::CoreAudioOutput::_SetupForDecoder(const Decoder& decoder)
 		return false;
 	}
 
+#if !TARGET_OS_IPHONE
+	// ========================================
+	// In integer mode the graph renders integer PCM in a physical format of the device, which the HAL passes through
+	// The mixer and effects process only float audio so the graph may contain only the output node
+	AudioStreamID integerModeStream = kAudioObjectUnknown;
+	AudioStreamBasicDescription physicalFormat;
+	UInt32 nodeCount = 0;
+	bool integerMode = mIntegerModeEnabled.load() && -1 == mMixerNode && noErr == AUGraphGetNodeCount(mAUGraph, &nodeCount) && 1 == nodeCount && DeviceIsHogged() && FindIntegerPhysicalFormat(decoder, integerModeStream, physicalFormat) && EnterIntegerMode(integerModeStream, physicalFormat);
+	if(!integerMode)
+		ExitIntegerMode();
+
+	AudioFormat format = integerMode ? AudioFormat(physicalFormat) : mCanonicalFormat;
+#else
 	AudioFormat format = mFormat;
+#endif
 
 	// Even if the format is DoP, treat it as PCM from the AUGraph's perspective
 	format.mFormatID			= kAudioFormatLinearPCM;
@@ -1838,6 +2429,11 @@ bool SFB::Audio::CoreAudioOutput::_SetupForDecoder(const Decoder& decoder)
 		if(wasDoP)
 			mFormat.mFormatID = kAudioFormatDoP;
 
+#if !TARGET_OS_IPHONE
+		// The output unit converts the restored format to the stream's restored float format
+		ExitIntegerMode();
+#endif
+
 		// Do not free connections here, so graph can be rebuilt
 	}
 	else {
@@ -1895,12 +2491,9 @@ bool SFB::Audio::CoreAudioOutput::_SetupForDecoder(const Decoder& decoder)
 	// So if the input and output sample rates on the output device don't match, adjust
 	// kAudioUnitProperty_MaximumFramesPerSlice to ensure enough audio data is passed per render cycle
 	// See http://lists.apple.com/archives/coreaudio-api/2009/Oct/msg00150.html
-	AudioUnit au = nullptr;
-	result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &au);
-	if(noErr != result) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+	AudioUnit au = mOutputUnit;
+	if(nullptr == au)
 		return false;
-	}
 
 	Float64 inputSampleRate = 0;
 	UInt32 dataSize = sizeof(inputSampleRate);
@@ -2152,18 +2745,166 @@ bool SFB::Audio::CoreAudioOutput::SetPropertyOnAUGraphNodes(AudioUnitPropertyID
 	return true;
 }
 
-bool SFB::Audio::CoreAudioOutput::SetOutputUnitChannelMap(const ChannelLayout& channelLayout)
+bool SFB::Audio::CoreAudioOutput::InsertNodeAtHead(AUNode node)
+{
+	// Find the node receiving the render callback
+	UInt32 interactionCount = 0;
+	auto result = AUGraphGetNumberOfInteractions(mAUGraph, &interactionCount);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphGetNumberOfInteractions failed: " << result);
+		return false;
+	}
+
+	AUNode headNode = -1;
+	AURenderCallbackStruct renderCallback = { nullptr, nullptr };
+	for(UInt32 i = 0; i < interactionCount; ++i) {
+		AUNodeInteraction interaction;
+		result = AUGraphGetInteractionInfo(mAUGraph, i, &interaction);
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphGetInteractionInfo failed: " << result);
+			return false;
+		}
+
+		if(kAUNodeInteraction_InputCallback == interaction.nodeInteractionType) {
+			headNode = interaction.nodeInteraction.inputCallback.destNode;
+			renderCallback = interaction.nodeInteraction.inputCallback.cback;
+			break;
+		}
+	}
+
+	if(-1 == headNode) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "Unable to determine the node receiving the render callback");
+		return false;
+	}
+
+	// Move the render callback to node and connect it to the previous head
+	result = AUGraphDisconnectNodeInput(mAUGraph, headNode, 0);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphDisconnectNodeInput failed: " << result);
+		return false;
+	}
+
+	result = AUGraphSetNodeInputCallback(mAUGraph, node, 0, &renderCallback);
+	if(noErr == result)
+		result = AUGraphConnectNodeInput(mAUGraph, node, 0, headNode, 0);
+	if(noErr == result)
+		result = AUGraphUpdate(mAUGraph, nullptr);
+
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "Unable to insert node at the head of the AUGraph: " << result);
+
+		// Restore the previous head
+		AUGraphDisconnectNodeInput(mAUGraph, node, 0);
+		AUGraphDisconnectNodeInput(mAUGraph, headNode, 0);
+		result = AUGraphSetNodeInputCallback(mAUGraph, headNode, 0, &renderCallback);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphSetNodeInputCallback failed: " << result);
+		result = AUGraphUpdate(mAUGraph, nullptr);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphUpdate failed: " << result);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool SFB::Audio::CoreAudioOutput::AddMixerNode()
 {
+	LOGGER_INFO("org.sbooth.AudioEngine.Output.CoreAudio", "Adding mixer to AUGraph");
+
 #if !TARGET_OS_IPHONE
-	AudioUnit outputUnit = nullptr;
-	auto result = AUGraphNodeInfo(mAUGraph, mOutputNode, nullptr, &outputUnit);
+	if(IsRenderingIntegerAudio()) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Output.CoreAudio", "The mixer can't process integer audio");
+		return false;
+	}
+#endif
+
+	AudioComponentDescription desc = {
+		.componentType			= kAudioUnitType_Mixer,
+		.componentSubType		= kAudioUnitSubType_MultiChannelMixer,
+		.componentManufacturer	= kAudioUnitManufacturer_Apple,
+		.componentFlags			= kAudioComponentFlag_SandboxSafe,
+		.componentFlagsMask		= 0
+	};
+
+	AUNode mixerNode = -1;
+	auto result = AUGraphAddNode(mAUGraph, &desc, &mixerNode);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphAddNode failed: " << result);
+		return false;
+	}
+
+	AudioUnit au = nullptr;
+	result = AUGraphNodeInfo(mAUGraph, mixerNode, nullptr, &au);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphNodeInfo failed: " << result);
+
+		result = AUGraphRemoveNode(mAUGraph, mixerNode);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphRemoveNode failed: " << result);
+
+		return false;
+	}
+
+	// The mixer processes the same format and slice size as the rest of the graph
+	AudioStreamBasicDescription format = mFormat;
+	format.mFormatID = kAudioFormatLinearPCM;
+
+	result = AudioUnitSetProperty(au, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &format, sizeof(format));
+	if(noErr == result)
+		result = AudioUnitSetProperty(au, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 0, &format, sizeof(format));
+
+#if TARGET_OS_IPHONE
+	// All AudioUnits on iOS except RemoteIO require kAudioUnitProperty_MaximumFramesPerSlice to be 4096
+	UInt32 framesPerSlice = 4096;
+#else
+	UInt32 framesPerSlice = (UInt32)_GetPreferredBufferSize();
+#endif
+	if(noErr == result && 0 != framesPerSlice)
+		result = AudioUnitSetProperty(au, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, 0, &framesPerSlice, sizeof(framesPerSlice));
+
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "Unable to configure mixer: " << result);
+
+		result = AUGraphRemoveNode(mAUGraph, mixerNode);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphRemoveNode failed: " << result);
+
+		return false;
+	}
+
+	result = AudioUnitSetParameter(au, kMultiChannelMixerParam_Volume, kAudioUnitScope_Input, 0, 1.f, 0);
+	if(noErr != result)
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitSetParameter (kMultiChannelMixerParam_Volume, kAudioUnitScope_Input) failed: " << result);
+
+	result = AudioUnitSetParameter(au, kMultiChannelMixerParam_Volume, kAudioUnitScope_Output, 0, 1.f, 0);
+	if(noErr != result)
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitSetParameter (kMultiChannelMixerParam_Volume, kAudioUnitScope_Output) failed: " << result);
+
+	if(!InsertNodeAtHead(mixerNode)) {
+		result = AUGraphRemoveNode(mAUGraph, mixerNode);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AUGraphRemoveNode failed: " << result);
+
 		return false;
 	}
 
+	mMixerNode = mixerNode;
+	mMixerUnit = au;
+
+	return true;
+}
+
+bool SFB::Audio::CoreAudioOutput::SetOutputUnitChannelMap(const ChannelLayout& channelLayout)
+{
+#if !TARGET_OS_IPHONE
+	AudioUnit outputUnit = mOutputUnit;
+	if(nullptr == outputUnit)
+		return false;
+
 	// Clear the existing channel map
-	result = AudioUnitSetProperty(outputUnit, kAudioOutputUnitProperty_ChannelMap, kAudioUnitScope_Input, 0, nullptr, 0);
+	auto result = AudioUnitSetProperty(outputUnit, kAudioOutputUnitProperty_ChannelMap, kAudioUnitScope_Input, 0, nullptr, 0);
 	if(noErr != result) {
 		LOGGER_ERR("org.sbooth.AudioEngine.Output.CoreAudio", "AudioUnitSetProperty (kAudioOutputUnitProperty_ChannelMap, kAudioUnitScope_Input) failed: " << result);
 		return false;
@@ -2295,9 +3036,53 @@ OSStatus SFB::Audio::CoreAudioOutput::Render(AudioUnitRenderActionFlags		*ioActi
 											 AudioBufferList				*ioData)
 {
 #pragma unused(ioActionFlags)
-#pragma unused(inTimeStamp)
 #pragma unused(inBusNumber)
 
-	mPlayer->ProvideAudio(ioData, inNumberFrames);
+	auto startTime = BeginRenderCycle();
+
+	if(mMixerUnit)
+		SchedulePreGainRamp(inNumberFrames);
+
+	ProvideAudio(ioData, inNumberFrames, inTimeStamp);
+
+	if(startTime)
+		EndRenderCycle(startTime, inNumberFrames, mFormat.mSampleRate);
+
 	return noErr;
 }
+
+void SFB::Audio::CoreAudioOutput::SchedulePreGainRamp(UInt32 frameCount)
+{
+	// Start a newly requested ramp from the current pre-gain
+	auto pendingRamp = mPendingPreGainRamp.exchange(NO_PENDING_RAMP, std::memory_order_acquire);
+	if(NO_PENDING_RAMP != pendingRamp) {
+		Float32 startValue = 1;
+		AudioUnitGetParameter(mMixerUnit, kMultiChannelMixerParam_Volume, kAudioUnitScope_Input, 0, &startValue);
+
+		mPreGainRamp.mStartValue = startValue;
+		UnpackRamp(pendingRamp, mPreGainRamp.mEndValue, mPreGainRamp.mDurationFrames);
+		mPreGainRamp.mElapsedFrames = 0;
+	}
+
+	if(mPreGainRamp.mElapsedFrames >= mPreGainRamp.mDurationFrames)
+		return;
+
+	// A ramp spanning several render cycles is rescheduled for each, offset by the frames already rendered
+	AudioUnitParameterEvent event;
+	event.scope										= kAudioUnitScope_Input;
+	event.element									= 0;
+	event.parameter									= kMultiChannelMixerParam_Volume;
+	event.eventType									= kParameterEvent_Ramped;
+	event.eventValues.ramp.startBufferOffset		= -(SInt32)mPreGainRamp.mElapsedFrames;
+	event.eventValues.ramp.durationInFrames			= mPreGainRamp.mDurationFrames;
+	event.eventValues.ramp.startValue				= mPreGainRamp.mStartValue;
+	event.eventValues.ramp.endValue					= mPreGainRamp.mEndValue;
+
+	AudioUnitScheduleParameters(mMixerUnit, &event, 1);
+
+	mPreGainRamp.mElapsedFrames += frameCount;
+
+	// Leave the parameter at its final value
+	if(mPreGainRamp.mElapsedFrames >= mPreGainRamp.mDurationFrames)
+		AudioUnitSetParameter(mMixerUnit, kMultiChannelMixerParam_Volume, kAudioUnitScope_Input, 0, mPreGainRamp.mEndValue, 0);
+}
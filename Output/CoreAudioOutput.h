@@ -7,6 +7,10 @@
 
 #include "AudioOutput.h"
 
+#include <atomic>
+#include <mutex>
+#include <vector>
+
 #include <CoreAudio/CoreAudioTypes.h>
 #include <AudioToolbox/AudioToolbox.h>
 
@@ -90,11 +94,24 @@ namespace SFB {
 			 *
 			 * This corresponds to the property \c kMultiChannelMixerParam_Volume
 			 * @note The pre-gain is linear and the value will be clamped to the interval [0, 1]
+			 * @note The first pre-gain other than \c 1 adds a mixer to the audio processing graph
 			 * @param preGain The desired pre-gain
 			 * @return \c true on success, \c false otherwise
 			 */
 			bool SetPreGain(Float32 preGain);
 
+			/*!
+			 * @brief Change the audio processing graph pre-gain gradually
+			 *
+			 * The change is scheduled on the render thread with \c AudioUnitScheduleParameters, so it is
+			 * sample-accurate and requires no further calls while it is in progress
+			 * @note A mixer is added to the audio processing graph if necessary
+			 * @param preGain The desired pre-gain in the interval [0, 1]
+			 * @param duration The duration of the change in seconds
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool RampPreGain(Float32 preGain, Float64 duration);
+
 
 			/*! @brief Query whether the output is performing sample rate conversion */
 			bool IsPerformingSampleRateConversion() const;
@@ -210,6 +227,32 @@ namespace SFB {
 			//@}
 
 
+			// ========================================
+			/*!
+			 * @name Integer Mode
+			 * In integer mode integer PCM is rendered in a matching physical format of the device's output stream, which
+			 * the HAL passes to the device without converting it to float, so playback is bit-exact.  Integer mode requires
+			 * the device to be hogged and the audio processing graph to contain only the output node, since the mixer
+			 * and effects process float audio.
+			 */
+			//@{
+
+			/*! @brief Query whether integer mode is enabled */
+			inline bool IntegerModeIsEnabled() const					{ return mIntegerModeEnabled.load(); }
+
+			/*!
+			 * @brief Set whether integer mode is enabled
+			 * @note This takes effect when the output is next set up for a decoder
+			 * @param enabled Whether integer PCM should be rendered in the device's physical format when possible
+			 */
+			inline void SetIntegerModeEnabled(bool enabled)				{ mIntegerModeEnabled.store(enabled); }
+
+			/*! @brief Query whether integer audio is being rendered in the physical format of the device's output stream */
+			inline bool IsRenderingIntegerAudio() const				{ return kAudioObjectUnknown != mIntegerModeStream; }
+
+			//@}
+
+
 			// ========================================
 			/*! @name Device parameters */
 			//@{
@@ -321,6 +364,24 @@ namespace SFB {
 			bool SetDeviceID(AudioDeviceID deviceID);
 
 
+			/*!
+			 * @brief A block called when a property of the output device changes
+			 * @param selector The property that changed
+			 */
+			using DevicePropertyChangedBlock = void (^)(AudioObjectPropertySelector selector);
+
+			/*!
+			 * @brief Set a block to be invoked when a cached property of the output device changes
+			 *
+			 * The hog mode, channel count, preferred stereo channels, available and current nominal sample rates, and
+			 * output streams of the device are cached and kept current by HAL property listeners, so querying them
+			 * doesn't involve the HAL.  The block is invoked on a private serial queue after the cached value is
+			 * discarded.
+			 * @param block The block to invoke, or \c nullptr
+			 */
+			void SetDevicePropertyChangedBlock(DevicePropertyChangedBlock block);
+
+
 			/*!
 			 * @brief Get the available data sources for the current device
 			 *
@@ -370,8 +431,28 @@ namespace SFB {
 			bool GetOutputStreams(std::vector<AudioStreamID>& streams) const;
 
 
-//			bool GetOutputStreamVirtualFormat(AudioStreamID streamID, AudioStreamBasicDescription& virtualFormat) const;
-//			bool SetOutputStreamVirtualFormat(AudioStreamID streamID, const AudioStreamBasicDescription& virtualFormat);
+			/*!
+			 * @brief Get the virtual format for the specified output stream on the current device
+			 *
+			 * This corresponds to the property \c kAudioStreamPropertyVirtualFormat
+			 * @param streamID The output stream ID
+			 * @param virtualFormat An \c AudioStreamBasicDescription to receive the stream's virtual format
+			 * @return \c true on success, \c false otherwise
+			 * @see kAudioStreamPropertyVirtualFormat
+			 */
+			bool GetOutputStreamVirtualFormat(AudioStreamID streamID, AudioStreamBasicDescription& virtualFormat) const;
+
+			/*!
+			 * @brief Set the virtual format for the specified output stream on the current device
+			 *
+			 * This corresponds to the property \c kAudioStreamPropertyVirtualFormat
+			 * @note Formats that aren't mixable, such as integer formats, may only be set while the device is hogged
+			 * @param streamID The output stream ID
+			 * @param virtualFormat The desired virtual format
+			 * @return \c true on success, \c false otherwise
+			 * @see kAudioStreamPropertyVirtualFormat
+			 */
+			bool SetOutputStreamVirtualFormat(AudioStreamID streamID, const AudioStreamBasicDescription& virtualFormat);
 
 
 			/*!
@@ -424,12 +505,27 @@ namespace SFB {
 			 */
 			bool GetAUGraphTailTime(Float64& tailTime) const;
 
+#if !TARGET_OS_IPHONE
+			/*!
+			 * @brief Get the time in seconds from rendering audio until it is presented by the output device
+			 *
+			 * This is the sum of the AUGraph's latency and the device's latency, safety offset, I/O buffer size,
+			 * and output stream latency.  It is lowest when the graph contains only the output node.
+			 * @param latency A \c Float64 to receive the presentation latency
+			 * @return \c true on success, \c false otherwise
+			 * @see GetAUGraphLatency()
+			 */
+			bool GetPresentationLatency(Float64& latency) const;
+#endif
+
 
 			/*!
 			 * @brief Get the \c AUGraph used internally for audio processing
 			 *
-			 * The default AUGraph has two nodes: a mixer (\c kAudioUnitSubType_MultiChannelMixer)
-			 * connected to the output (\c kAudioUnitSubType_HALOutput on macOS, \c kAudioUnitSubType_RemoteIO on iOS)
+			 * The default AUGraph contains only the output node (\c kAudioUnitSubType_HALOutput on macOS,
+			 * \c kAudioUnitSubType_RemoteIO on iOS), which receives rendered audio directly.  A mixer
+			 * (\c kAudioUnitSubType_MultiChannelMixer) is inserted at the head of the graph when pre-gain is first set,
+			 * and effects are inserted before the output node.
 			 *
 			 * @warning The graph may be manipulated but changing the graph's mixer or output node is not supported
 			 *
@@ -443,7 +539,7 @@ namespace SFB {
 			 * @brief Get the mixer \c AUNode for the internal \c AUGraph
 			 *
 			 * @param node An \c AUNode to receive the mixer node
-			 * @return \c true on success, \c false otherwise
+			 * @return \c true on success, \c false if the graph doesn't contain a mixer
 			 */
 			bool GetAUGraphMixerNode(AUNode& node) const;
 
@@ -460,7 +556,7 @@ namespace SFB {
 			 * @brief Get the mixer \c AudioUnit used by the internal \c AUGraph
 			 *
 			 * @param au An \c AudioUnit to receive the mixer unit
-			 * @return \c true on success, \c false otherwise
+			 * @return \c true on success, \c false if the graph doesn't contain a mixer
 			 */
 			bool GetAUGraphMixer(AudioUnit& au) const;
 
@@ -498,22 +594,108 @@ namespace SFB {
 
 			virtual bool _GetDeviceSampleRate(Float64& sampleRate) const;
 			virtual bool _SetDeviceSampleRate(Float64 sampleRate);
+
+			virtual bool _GetDeviceBufferFrameSize(UInt32& frameSize) const;
+			virtual bool _GetDeviceBufferFrameSizeRange(UInt32& minimum, UInt32& maximum) const;
+			virtual bool _SetDeviceBufferFrameSize(UInt32 frameSize);
+			virtual bool _GetOutputLatency(Float64& latency) const;
 #endif
 
 			virtual size_t _GetPreferredBufferSize() const;
 
+#if __has_include(<os/workgroup.h>)
+			virtual os_workgroup_t _Nullable _CopyIOThreadWorkgroup() const API_AVAILABLE(macos(11.0), ios(14.0));
+#endif
+
 			// ========================================
 			// AUGraph Utilities
 			bool SetPropertyOnAUGraphNodes(AudioUnitPropertyID propertyID, const void *propertyData, UInt32 propertyDataSize);
 
+			// Move the render callback to node, connecting node to the node that previously received it
+			bool InsertNodeAtHead(AUNode node);
+			bool AddMixerNode();
+
+			// Schedule the pre-gain ramp in progress for a render cycle; must be called on the render thread
+			void SchedulePreGainRamp(UInt32 frameCount);
+
+			struct ParameterRamp {
+				Float32		mStartValue;
+				Float32		mEndValue;
+				UInt32		mDurationFrames;
+				UInt32		mElapsedFrames;
+			};
+
 			bool SetOutputUnitChannelMap(const ChannelLayout& channelLayout);
 
+#if !TARGET_OS_IPHONE
+			// Integer mode support
+			// Find an integer physical format of the device's first output stream able to represent decoder's audio exactly
+			bool FindIntegerPhysicalFormat(const Decoder& decoder, AudioStreamID& streamID, AudioStreamBasicDescription& physicalFormat) const;
+			// Set the stream's physical and virtual formats to physicalFormat, saving the previous formats
+			bool EnterIntegerMode(AudioStreamID streamID, const AudioStreamBasicDescription& physicalFormat);
+			// Restore the formats saved by EnterIntegerMode()
+			void ExitIntegerMode();
+
+			// Device property cache
+			// ObserveCurrentDevice(), StopObservingDevice(), and ResetDeviceState() require mDeviceStateMutex
+			// Register property listeners on the current device if it isn't already observed
+			bool ObserveCurrentDevice(AudioDeviceID& deviceID) const;
+			void StopObservingDevice() const;
+			void ResetDeviceState() const;
+			// Fetch all cached properties of the current device
+			void FillDeviceState() const;
+			// Discard the cached value of a property so it is fetched when next requested
+			void InvalidateDeviceProperty(AudioObjectPropertySelector selector) const;
+			void HandleDevicePropertyChanges(UInt32 addressCount, const AudioObjectPropertyAddress *addresses);
+
+			struct DeviceState {
+				AudioDeviceID					mDeviceID;						// The observed device, or kAudioDeviceUnknown
+				bool							mHasHogPID;
+				pid_t							mHogPID;
+				bool							mHasChannelCount;
+				UInt32							mChannelCount;
+				bool							mHasPreferredStereoChannels;
+				std::pair<UInt32, UInt32>		mPreferredStereoChannels;
+				bool							mHasNominalSampleRates;
+				std::vector<AudioValueRange>	mNominalSampleRates;
+				bool							mHasOutputStreams;
+				std::vector<AudioStreamID>		mOutputStreams;
+				bool							mHasSampleRate;
+				Float64							mSampleRate;
+			};
+#endif
+
 
 			AUGraph		mAUGraph;
 			AUNode		mMixerNode;
 			AUNode		mOutputNode;
 			UInt32		mDefaultMaximumFramesPerSlice;
 
+			// The graph's float format, used for audio not rendered in integer mode
+			AudioFormat	mCanonicalFormat;
+
+			// The units for mMixerNode and mOutputNode, resolved when the nodes are added
+			AudioUnit	mMixerUnit;
+			AudioUnit	mOutputUnit;
+
+			// A requested pre-gain ramp, packed as the target's bits and the duration in frames
+			std::atomic<uint64_t>	mPendingPreGainRamp;
+			// The pre-gain ramp in progress (render thread only)
+			ParameterRamp			mPreGainRamp;
+
+#if !TARGET_OS_IPHONE
+			std::atomic_bool				mIntegerModeEnabled;
+			AudioStreamID					mIntegerModeStream;				// The stream receiving integer audio, or kAudioObjectUnknown
+			AudioStreamBasicDescription		mSavedPhysicalFormat;			// The stream's formats before integer mode was entered
+			AudioStreamBasicDescription		mSavedVirtualFormat;
+
+			mutable std::mutex					mDeviceStateMutex;
+			mutable DeviceState					mDeviceState;
+			dispatch_queue_t					mDevicePropertyQueue;			// The queue on which property changes are handled
+			AudioObjectPropertyListenerBlock	mDevicePropertyListener;
+			DevicePropertyChangedBlock			mDevicePropertyChangedBlock;	// Only used on mDevicePropertyQueue
+#endif
+
 		public:
 
 			// ========================================
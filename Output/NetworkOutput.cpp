@@ -0,0 +1,525 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <Accelerate/Accelerate.h>
+#include <libkern/OSByteOrder.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+
+#include "NetworkOutput.h"
+#include "AudioPlayer.h"
+#include "Logger.h"
+
+// The size of an RTP header without contributing sources
+#define RTP_HEADER_BYTES						12
+// The largest packet sent, which fits in an Ethernet frame
+#define MAXIMUM_PACKET_BYTES					1472
+// L16 payloads leave room for IP options and tunnels
+#define MAXIMUM_L16_PAYLOAD_BYTES				1200
+#define L16_PACKET_DURATION_SECONDS				0.005
+// Opus packets are 10 ms at 48 kHz
+#define OPUS_SAMPLE_RATE						48000
+#define OPUS_PACKET_FRAMES						480
+// How far rendering may fall behind the host clock before the timeline is resynchronized
+#define RESYNCHRONIZATION_PACKETS				8
+#define SENDER_REPORT_INTERVAL_SECONDS			1.0
+// Seconds between the NTP epoch (1900) and the Unix epoch (1970)
+#define NTP_UNIX_EPOCH_OFFSET					2208988800ULL
+
+namespace {
+
+	// ========================================
+	// Convert host time to nanoseconds
+	uint64_t ConvertHostTimeToNanos(uint64_t hostTime)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (hostTime * sTimebaseInfo.numer) / sTimebaseInfo.denom;
+	}
+
+	// ========================================
+	// Convert nanoseconds to host time
+	uint64_t ConvertNanosToHostTime(uint64_t nanos)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (nanos * sTimebaseInfo.denom) / sTimebaseInfo.numer;
+	}
+
+	// ========================================
+	// Make the calling thread a real-time thread expected to run for computationFraction of every period
+	bool SetTimeConstraintPolicy(uint64_t periodNanos, double computationFraction)
+	{
+		auto period = ConvertNanosToHostTime(periodNanos);
+		thread_time_constraint_policy_data_t timeConstraintPolicy = {
+			.period			= (uint32_t)period,
+			.computation	= (uint32_t)(period * computationFraction),
+			.constraint		= (uint32_t)period,
+			.preemptible	= true
+		};
+
+		kern_return_t error = thread_policy_set(mach_thread_self(),
+												THREAD_TIME_CONSTRAINT_POLICY,
+												(thread_policy_t)&timeConstraintPolicy,
+												THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+
+		if(KERN_SUCCESS != error) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.Network", "Couldn't set thread's time constraint policy: " << mach_error_string(error));
+			return false;
+		}
+
+		return true;
+	}
+
+	inline void WriteBigEndian16(uint8_t *buffer, uint16_t value)
+	{
+		OSWriteBigInt16(buffer, 0, value);
+	}
+
+	inline void WriteBigEndian32(uint8_t *buffer, uint32_t value)
+	{
+		OSWriteBigInt32(buffer, 0, value);
+	}
+
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::NetworkOutput::NetworkOutput(CFStringRef host, uint16_t port, Payload payload)
+	: mPort(port), mPayload(payload), mPlayoutDelay(DefaultPlayoutDelay), mMulticastTimeToLive(1), mOpusBitRate(0), mSocket(-1), mRTPAddress(), mRTCPAddress(), mAddressLength(0), mPacketFrameCount(0), mOpusEncoder(nullptr, opus_encoder_destroy), mSynchronizationSource(0), mSequenceNumber(0), mTimestamp(0), mIsOpen(false), mIsRunning(false), mPacketsSent(0), mPacketsDropped(0), mResynchronizationCount(0), mOctetsSent(0)
+{
+	if(host) {
+		CFIndex size = CFStringGetMaximumSizeForEncoding(CFStringGetLength(host), kCFStringEncodingUTF8) + 1;
+		std::vector<char> buffer((size_t)size);
+		if(CFStringGetCString(host, buffer.data(), size, kCFStringEncodingUTF8))
+			mHost = buffer.data();
+	}
+}
+
+SFB::Audio::NetworkOutput::~NetworkOutput()
+{
+	if(_IsOpen())
+		_Close();
+}
+
+#pragma mark Configuration
+
+void SFB::Audio::NetworkOutput::SetPlayoutDelay(double playoutDelay)
+{
+	mPlayoutDelay.store(std::max(playoutDelay, 0.0));
+}
+
+void SFB::Audio::NetworkOutput::SetMulticastTimeToLive(int timeToLive)
+{
+	mMulticastTimeToLive = std::max(std::min(timeToLive, 255), 1);
+}
+
+void SFB::Audio::NetworkOutput::SetOpusBitRate(int bitRate)
+{
+	mOpusBitRate = std::max(bitRate, 0);
+}
+
+#pragma mark -
+
+bool SFB::Audio::NetworkOutput::_Open()
+{
+	if(mHost.empty()) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.Network", "No destination host");
+		return false;
+	}
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICSERV;
+
+	addrinfo *addresses = nullptr;
+	auto result = getaddrinfo(mHost.c_str(), std::to_string(mPort).c_str(), &hints, &addresses);
+	if(0 != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.Network", "Unable to resolve " << mHost << ": " << gai_strerror(result));
+		return false;
+	}
+
+	std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> addressList(addresses, freeaddrinfo);
+
+	mSocket = socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol);
+	if(-1 == mSocket) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.Network", "Unable to create socket: " << strerror(errno));
+		return false;
+	}
+
+	// The rendering thread never blocks on the network; packets that can't be sent are dropped
+	int flags = fcntl(mSocket, F_GETFL);
+	if(-1 == flags || -1 == fcntl(mSocket, F_SETFL, flags | O_NONBLOCK))
+		LOGGER_WARNING("org.sbooth.AudioEngine.Output.Network", "Unable to make socket non-blocking: " << strerror(errno));
+
+	int noSIGPIPE = 1;
+	setsockopt(mSocket, SOL_SOCKET, SO_NOSIGPIPE, &noSIGPIPE, sizeof(noSIGPIPE));
+
+	std::memcpy(&mRTPAddress, addresses->ai_addr, addresses->ai_addrlen);
+	std::memcpy(&mRTCPAddress, addresses->ai_addr, addresses->ai_addrlen);
+	mAddressLength = addresses->ai_addrlen;
+
+	// RTCP is sent to the port following the RTP port
+	if(AF_INET == addresses->ai_family) {
+		auto address = (sockaddr_in *)&mRTCPAddress;
+		address->sin_port = htons((uint16_t)(mPort + 1));
+
+		if(IN_MULTICAST(ntohl(address->sin_addr.s_addr))) {
+			u_char timeToLive = (u_char)mMulticastTimeToLive;
+			if(-1 == setsockopt(mSocket, IPPROTO_IP, IP_MULTICAST_TTL, &timeToLive, sizeof(timeToLive)))
+				LOGGER_WARNING("org.sbooth.AudioEngine.Output.Network", "Unable to set multicast time to live: " << strerror(errno));
+		}
+	}
+	else if(AF_INET6 == addresses->ai_family) {
+		auto address = (sockaddr_in6 *)&mRTCPAddress;
+		address->sin6_port = htons((uint16_t)(mPort + 1));
+
+		if(IN6_IS_ADDR_MULTICAST(&address->sin6_addr)) {
+			int hops = mMulticastTimeToLive;
+			if(-1 == setsockopt(mSocket, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops)))
+				LOGGER_WARNING("org.sbooth.AudioEngine.Output.Network", "Unable to set multicast hop limit: " << strerror(errno));
+		}
+	}
+
+	// RFC 3550 recommends random initial values
+	mSynchronizationSource = arc4random();
+	mSequenceNumber = (uint16_t)arc4random();
+	mTimestamp = arc4random();
+
+	mPacketsSent.store(0);
+	mPacketsDropped.store(0);
+	mResynchronizationCount.store(0);
+	mOctetsSent = 0;
+
+	mIsOpen.store(true);
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Output.Network", "Streaming to " << mHost << ":" << mPort << " with SSRC " << mSynchronizationSource);
+
+	return true;
+}
+
+bool SFB::Audio::NetworkOutput::_Close()
+{
+	if(_IsRunning())
+		_Stop();
+	else if(mRenderThread.joinable())
+		mRenderThread.join();
+
+	if(-1 != mSocket) {
+		close(mSocket);
+		mSocket = -1;
+	}
+
+	mBufferList.Deallocate();
+	mOpusEncoder.reset();
+	mIsOpen.store(false);
+
+	return true;
+}
+
+bool SFB::Audio::NetworkOutput::_Start()
+{
+	if(!mBufferList) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.Network", "Output not configured for a decoder");
+		return false;
+	}
+
+	// A thread stopped by _RequestStop() may still be exiting
+	if(mRenderThread.joinable())
+		mRenderThread.join();
+
+	mIsRunning.store(true);
+
+	try {
+		mRenderThread = std::thread(&NetworkOutput::RenderThreadEntry, this);
+	}
+	catch(const std::exception& e) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.Network", "Unable to create rendering thread: " << e.what());
+		mIsRunning.store(false);
+		return false;
+	}
+
+	return true;
+}
+
+bool SFB::Audio::NetworkOutput::_Stop()
+{
+	mIsRunning.store(false);
+
+	// A stop from within the player can't wait for its own thread, which is joined when next started or closed
+	if(mRenderThread.joinable() && std::this_thread::get_id() != mRenderThread.get_id())
+		mRenderThread.join();
+
+	return true;
+}
+
+bool SFB::Audio::NetworkOutput::_RequestStop()
+{
+	// The rendering thread exits after its current cycle and is joined when next started or stopped
+	mIsRunning.store(false);
+	return true;
+}
+
+bool SFB::Audio::NetworkOutput::_IsOpen() const
+{
+	return mIsOpen.load();
+}
+
+bool SFB::Audio::NetworkOutput::_IsRunning() const
+{
+	return mIsRunning.load();
+}
+
+bool SFB::Audio::NetworkOutput::_Reset()
+{
+	if(mOpusEncoder)
+		opus_encoder_ctl(mOpusEncoder.get(), OPUS_RESET_STATE);
+	return true;
+}
+
+bool SFB::Audio::NetworkOutput::_SupportsFormat(const AudioFormat& format) const
+{
+	if(Payload::Opus == mPayload)
+		return format.IsPCM() && 2 >= format.mChannelsPerFrame;
+	return format.IsPCM();
+}
+
+bool SFB::Audio::NetworkOutput::_SetupForDecoder(const Decoder& decoder)
+{
+	const auto& decoderFormat = decoder.GetFormat();
+	if(!decoderFormat.IsPCM()) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.Network", "Only PCM audio can be streamed");
+		return false;
+	}
+
+	if(Payload::Opus == mPayload && 2 < decoderFormat.mChannelsPerFrame) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.Network", "Opus payloads support at most two channels");
+		return false;
+	}
+
+	bool running = _IsRunning();
+	if(running && !_Stop())
+		return false;
+
+	// Audio is rendered as deinterleaved native floats and converted as each packet is encoded
+	mFormat.mFormatID			= kAudioFormatLinearPCM;
+	mFormat.mFormatFlags		= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+	mFormat.mSampleRate			= Payload::Opus == mPayload ? OPUS_SAMPLE_RATE : decoderFormat.mSampleRate;
+	mFormat.mChannelsPerFrame	= decoderFormat.mChannelsPerFrame;
+	mFormat.mBitsPerChannel		= 32;
+	mFormat.mBytesPerPacket		= sizeof(float);
+	mFormat.mFramesPerPacket	= 1;
+	mFormat.mBytesPerFrame		= sizeof(float);
+	mFormat.mReserved			= 0;
+
+	mChannelLayout = decoder.GetChannelLayout();
+
+	if(Payload::Opus == mPayload) {
+		mPacketFrameCount = OPUS_PACKET_FRAMES;
+
+		int result = OPUS_OK;
+		mOpusEncoder.reset(opus_encoder_create(OPUS_SAMPLE_RATE, (int)mFormat.mChannelsPerFrame, OPUS_APPLICATION_RESTRICTED_LOWDELAY, &result));
+		if(!mOpusEncoder) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Output.Network", "opus_encoder_create failed: " << opus_strerror(result));
+			return false;
+		}
+
+		if(0 < mOpusBitRate)
+			opus_encoder_ctl(mOpusEncoder.get(), OPUS_SET_BITRATE(mOpusBitRate));
+	}
+	else {
+		auto maximumFrames = MAXIMUM_L16_PAYLOAD_BYTES / (sizeof(int16_t) * mFormat.mChannelsPerFrame);
+		mPacketFrameCount = (UInt32)std::max(std::min((size_t)(mFormat.mSampleRate * L16_PACKET_DURATION_SECONDS), maximumFrames), (size_t)1);
+		mOpusEncoder.reset();
+	}
+
+	if(!mBufferList.Allocate(mFormat, mPacketFrameCount)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.Network", "Unable to allocate memory");
+		return false;
+	}
+
+	mScratch.resize(mPacketFrameCount * mFormat.mChannelsPerFrame);
+	mPacket.resize(MAXIMUM_PACKET_BYTES);
+
+	if(running && !_Start())
+		return false;
+
+	return true;
+}
+
+size_t SFB::Audio::NetworkOutput::_GetPreferredBufferSize() const
+{
+	return mPacketFrameCount;
+}
+
+#pragma mark -
+
+void SFB::Audio::NetworkOutput::RenderThreadEntry()
+{
+	pthread_setname_np("org.sbooth.AudioEngine.Output.Network");
+
+	auto sampleRate = mFormat.mSampleRate;
+	auto packetNanos = (uint64_t)(mPacketFrameCount * NSEC_PER_SEC / sampleRate);
+	SetTimeConstraintPolicy(packetNanos, 0.25);
+
+	auto resynchronizationThreshold = ConvertNanosToHostTime(RESYNCHRONIZATION_PACKETS * packetNanos);
+	auto senderReportInterval = ConvertNanosToHostTime((uint64_t)(SENDER_REPORT_INTERVAL_SECONDS * NSEC_PER_SEC));
+
+	AudioTimeStamp timeStamp = {};
+	timeStamp.mFlags = kAudioTimeStampSampleTimeValid | kAudioTimeStampHostTimeValid;
+	timeStamp.mRateScalar = 1;
+
+	// Packet deadlines are computed from an anchor so rounding doesn't accumulate
+	uint64_t anchorHostTime = mach_absolute_time();
+	uint64_t framesSinceAnchor = 0;
+	uint64_t lastSenderReportHostTime = 0;
+	Float64 sampleTime = 0;
+	bool marker = true;
+
+	while(mIsRunning.load()) {
+		uint64_t deadline = anchorHostTime + ConvertNanosToHostTime((uint64_t)(framesSinceAnchor * NSEC_PER_SEC / sampleRate));
+		mach_wait_until(deadline);
+
+		if(!mIsRunning.load())
+			break;
+
+		// If rendering fell behind, for example while the system was asleep, the timeline restarts now
+		// and receivers learn the new mapping from an immediate sender report
+		auto now = mach_absolute_time();
+		if(now > deadline + resynchronizationThreshold) {
+			anchorHostTime = deadline = now;
+			framesSinceAnchor = 0;
+			lastSenderReportHostTime = 0;
+			marker = true;
+			mResynchronizationCount.fetch_add(1);
+		}
+
+		timeStamp.mSampleTime = sampleTime;
+		timeStamp.mHostTime = deadline;
+
+		mBufferList.Reset();
+
+		auto startTime = BeginRenderCycle();
+		bool result = ProvideAudio(mBufferList, mPacketFrameCount, &timeStamp);
+		EndRenderCycle(startTime, mPacketFrameCount, sampleRate);
+
+		if(0 == lastSenderReportHostTime || deadline - lastSenderReportHostTime >= senderReportInterval) {
+			SendSenderReport(mTimestamp, deadline + ConvertNanosToHostTime((uint64_t)(mPlayoutDelay.load() * NSEC_PER_SEC)));
+			lastSenderReportHostTime = deadline;
+		}
+
+		if(result) {
+			uint8_t *packet = mPacket.data();
+			auto payloadLength = EncodePayload(packet + RTP_HEADER_BYTES, mPacket.size() - RTP_HEADER_BYTES);
+			if(0 < payloadLength) {
+				packet[0] = 0x80;
+				packet[1] = (uint8_t)((marker ? 0x80 : 0) | kRTPPayloadType);
+				WriteBigEndian16(packet + 2, mSequenceNumber);
+				WriteBigEndian32(packet + 4, mTimestamp);
+				WriteBigEndian32(packet + 8, mSynchronizationSource);
+
+				SendPacket(packet, RTP_HEADER_BYTES + payloadLength);
+				mOctetsSent += payloadLength;
+				++mSequenceNumber;
+				marker = false;
+			}
+		}
+
+		// The timestamp advances even when no packet is sent so receivers see the gap
+		mTimestamp += mPacketFrameCount;
+		sampleTime += mPacketFrameCount;
+		framesSinceAnchor += mPacketFrameCount;
+	}
+}
+
+size_t SFB::Audio::NetworkOutput::EncodePayload(uint8_t *payload, size_t capacity)
+{
+	auto channelCount = mFormat.mChannelsPerFrame;
+
+	if(Payload::Opus == mPayload) {
+		for(UInt32 channel = 0; channel < channelCount; ++channel) {
+			const float *input = (const float *)mBufferList->mBuffers[channel].mData;
+			for(UInt32 frame = 0; frame < mPacketFrameCount; ++frame)
+				mScratch[frame * channelCount + channel] = input[frame];
+		}
+
+		auto length = opus_encode_float(mOpusEncoder.get(), mScratch.data(), (int)mPacketFrameCount, payload, (opus_int32)capacity);
+		return 0 < length ? (size_t)length : 0;
+	}
+
+	size_t length = mPacketFrameCount * channelCount * sizeof(int16_t);
+	if(length > capacity)
+		return 0;
+
+	// Clip, scale and interleave each channel, then swap to network byte order
+	const float minimum = -1, maximum = 1, scale = INT16_MAX;
+	auto samples = (int16_t *)payload;
+	for(UInt32 channel = 0; channel < channelCount; ++channel) {
+		const float *input = (const float *)mBufferList->mBuffers[channel].mData;
+		vDSP_vclip(input, 1, &minimum, &maximum, mScratch.data(), 1, mPacketFrameCount);
+		vDSP_vsmul(mScratch.data(), 1, &scale, mScratch.data(), 1, mPacketFrameCount);
+		vDSP_vfixr16(mScratch.data(), 1, samples + channel, channelCount, mPacketFrameCount);
+	}
+
+	for(size_t i = 0; i < mPacketFrameCount * channelCount; ++i)
+		samples[i] = (int16_t)OSSwapHostToBigInt16((uint16_t)samples[i]);
+
+	return length;
+}
+
+void SFB::Audio::NetworkOutput::SendPacket(const uint8_t *packet, size_t length)
+{
+	if(-1 == sendto(mSocket, packet, length, 0, (const sockaddr *)&mRTPAddress, mAddressLength))
+		mPacketsDropped.fetch_add(1);
+	else
+		mPacketsSent.fetch_add(1);
+}
+
+void SFB::Audio::NetworkOutput::SendSenderReport(uint32_t rtpTimestamp, uint64_t playoutHostTime)
+{
+	// Map the playout host time to the wall clock
+	timespec wallClock;
+	clock_gettime(CLOCK_REALTIME, &wallClock);
+	auto now = mach_absolute_time();
+
+	double seconds = wallClock.tv_sec + wallClock.tv_nsec / (double)NSEC_PER_SEC;
+	if(playoutHostTime >= now)
+		seconds += ConvertHostTimeToNanos(playoutHostTime - now) / (double)NSEC_PER_SEC;
+	else
+		seconds -= ConvertHostTimeToNanos(now - playoutHostTime) / (double)NSEC_PER_SEC;
+
+	uint64_t ntpSeconds = (uint64_t)seconds;
+	uint32_t ntpFraction = (uint32_t)((seconds - ntpSeconds) * 4294967296.0);
+
+	// RTCP sender report (RFC 3550 section 6.4.1) without report blocks
+	uint8_t report [28];
+	report[0] = 0x80;
+	report[1] = 200;
+	WriteBigEndian16(report + 2, 6);
+	WriteBigEndian32(report + 4, mSynchronizationSource);
+	WriteBigEndian32(report + 8, (uint32_t)(ntpSeconds + NTP_UNIX_EPOCH_OFFSET));
+	WriteBigEndian32(report + 12, ntpFraction);
+	WriteBigEndian32(report + 16, rtpTimestamp);
+	WriteBigEndian32(report + 20, (uint32_t)mPacketsSent.load());
+	WriteBigEndian32(report + 24, (uint32_t)mOctetsSent);
+
+	sendto(mSocket, report, sizeof(report), 0, (const sockaddr *)&mRTCPAddress, mAddressLength);
+}
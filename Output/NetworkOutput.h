@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <opus/opus.h>
+
+#include "AudioOutput.h"
+#include "AudioBufferList.h"
+
+/*! @file NetworkOutput.h @brief Network output functionality */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief Output subclass streaming audio over RTP
+		 *
+		 * A \c NetworkOutput pulls audio from its player on a dedicated real-time thread paced by the host clock and
+		 * sends each packet as it is rendered, so no audio device or tap on another output is involved.  Packets
+		 * are sent by UDP to a single host, which may be a multicast group so any number of receivers are served
+		 * by one stream.
+		 *
+		 * The RTP timestamp of each packet is its sample time.  RTCP sender reports sent to the following port map
+		 * RTP timestamps to the NTP wall clock time at which the audio should be heard, which is the time it was
+		 * rendered plus the playout delay.  Receivers with synchronized clocks thereby play in step.
+		 */
+		class NetworkOutput : public Output
+		{
+
+		public:
+
+			/*! @brief The encoding of audio in RTP payloads */
+			enum class Payload {
+				L16,		/*!< 16-bit big-endian PCM at the decoder's sample rate (RFC 3551) */
+				Opus		/*!< Opus at 48 kHz, mono or stereo (RFC 7587) */
+			};
+
+			/*! @brief The dynamic RTP payload type of the stream */
+			static const uint8_t kRTPPayloadType = 96;
+
+			/*! @brief The default delay between rendering audio and its playout by receivers, in seconds */
+			static constexpr double DefaultPlayoutDelay = 0.05;
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			// @{
+
+			/*!
+			 * @brief Create a new \c NetworkOutput
+			 * @param host The host name or address, which may be a multicast group
+			 * @param port The UDP port for RTP; RTCP is sent to the following port
+			 * @param payload The encoding of RTP payloads
+			 */
+			NetworkOutput(CFStringRef host, uint16_t port, Payload payload = Payload::L16);
+
+			/*! @brief Destroy this \c NetworkOutput */
+			virtual ~NetworkOutput();
+
+			//@}
+
+
+			// ========================================
+			/*! @name Configuration */
+			//@{
+
+			/*! @brief Get the RTP payload encoding */
+			inline Payload GetPayload() const						{ return mPayload; }
+
+			/*! @brief Get the delay between rendering audio and its playout by receivers, in seconds */
+			inline double GetPlayoutDelay() const					{ return mPlayoutDelay.load(); }
+
+			/*!
+			 * @brief Set the delay between rendering audio and its playout by receivers
+			 * @note The delay should cover network transit and receiver buffering
+			 * @param playoutDelay The delay in seconds
+			 */
+			void SetPlayoutDelay(double playoutDelay);
+
+			/*!
+			 * @brief Set the time to live of multicast packets
+			 * @note This takes effect when the output is next opened
+			 * @param timeToLive The maximum number of hops
+			 */
+			void SetMulticastTimeToLive(int timeToLive);
+
+			/*!
+			 * @brief Set the bit rate of Opus payloads
+			 * @note This takes effect when the output is next set up for a decoder
+			 * @param bitRate The bit rate in bits per second
+			 */
+			void SetOpusBitRate(int bitRate);
+
+			/*! @brief Get the RTP synchronization source identifier of the stream */
+			inline uint32_t GetSynchronizationSource() const		{ return mSynchronizationSource; }
+
+			//@}
+
+
+			// ========================================
+			/*! @name Statistics */
+			//@{
+
+			/*! @brief Get the number of RTP packets sent since the output was opened */
+			inline uint64_t GetPacketsSent() const					{ return mPacketsSent.load(); }
+
+			/*! @brief Get the number of RTP packets dropped because they couldn't be sent immediately */
+			inline uint64_t GetPacketsDropped() const				{ return mPacketsDropped.load(); }
+
+			/*! @brief Get the number of times rendering fell too far behind the host clock and the stream's timeline was resynchronized */
+			inline uint64_t GetResynchronizationCount() const		{ return mResynchronizationCount.load(); }
+
+			//@}
+
+		private:
+
+			virtual bool _Open();
+			virtual bool _Close();
+
+			virtual bool _Start();
+			virtual bool _Stop();
+			virtual bool _RequestStop();
+
+			virtual bool _IsOpen() const;
+			virtual bool _IsRunning() const;
+
+			virtual bool _Reset();
+
+			virtual bool _SupportsFormat(const AudioFormat& format) const;
+
+			virtual bool _SetupForDecoder(const Decoder& decoder);
+
+			virtual size_t _GetPreferredBufferSize() const;
+
+			virtual bool _GetOutputLatency(Float64& latency) const	{ latency = mPlayoutDelay.load(); return true; }
+
+			void RenderThreadEntry();
+
+			size_t EncodePayload(uint8_t *payload, size_t capacity);
+			void SendPacket(const uint8_t *packet, size_t length);
+			void SendSenderReport(uint32_t rtpTimestamp, uint64_t playoutHostTime);
+
+			using opus_encoder_unique_ptr = std::unique_ptr<OpusEncoder, decltype(&opus_encoder_destroy)>;
+
+			std::string								mHost;					/*!< The destination host */
+			uint16_t								mPort;					/*!< The destination RTP port */
+			Payload									mPayload;				/*!< The RTP payload encoding */
+			std::atomic<double>						mPlayoutDelay;			/*!< Seconds between rendering and playout */
+			int										mMulticastTimeToLive;
+			int										mOpusBitRate;
+
+			int										mSocket;				/*!< The UDP socket */
+			sockaddr_storage						mRTPAddress;
+			sockaddr_storage						mRTCPAddress;
+			socklen_t								mAddressLength;
+
+			UInt32									mPacketFrameCount;		/*!< Frames in each packet */
+			BufferList								mBufferList;			/*!< Rendered audio */
+			std::vector<float>						mScratch;				/*!< Audio prepared for encoding */
+			std::vector<uint8_t>					mPacket;				/*!< The packet being sent */
+			opus_encoder_unique_ptr					mOpusEncoder;
+
+			uint32_t								mSynchronizationSource;
+			uint16_t								mSequenceNumber;
+			uint32_t								mTimestamp;				/*!< The RTP timestamp of the next packet */
+
+			std::thread								mRenderThread;			/*!< The rendering thread */
+			std::atomic_bool						mIsOpen;				/*!< Whether the output is open */
+			std::atomic_bool						mIsRunning;				/*!< Whether the rendering thread should run */
+
+			std::atomic_ullong						mPacketsSent;
+			std::atomic_ullong						mPacketsDropped;
+			std::atomic_ullong						mResynchronizationCount;
+			uint64_t								mOctetsSent;			/*!< Payload octets sent, for sender reports */
+		};
+
+	}
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+
+#include <Block.h>
+#include <pthread.h>
+
+#include "OfflineOutput.h"
+#include "AudioPlayer.h"
+#include "Logger.h"
+
+// How long the rendering thread waits for decoded audio when none is available
+#define IDLE_WAIT_NANOSECONDS (NSEC_PER_MSEC)
+
+namespace {
+
+	// ========================================
+	// Convert host time to nanoseconds
+	uint64_t ConvertHostTimeToNanos(uint64_t hostTime)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (hostTime * sTimebaseInfo.numer) / sTimebaseInfo.denom;
+	}
+
+	// ========================================
+	// Convert nanoseconds to host time
+	uint64_t ConvertNanosToHostTime(uint64_t nanos)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (nanos * sTimebaseInfo.denom) / sTimebaseInfo.numer;
+	}
+
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::OfflineOutput::OfflineOutput(UInt32 bufferFrameSize, bool realTime)
+	: mBufferFrameSize(std::max(bufferFrameSize, 1u)), mRealTime(realTime), mIsOpen(false), mIsRunning(false), mRenderBlock(nullptr), mStateChangedBlock(nullptr), mFramesRendered(0), mRenderingTime(0)
+{}
+
+SFB::Audio::OfflineOutput::~OfflineOutput()
+{
+	if(_IsOpen())
+		_Close();
+
+	if(mRenderBlock)
+		Block_release(mRenderBlock);
+
+	if(mStateChangedBlock)
+		Block_release(mStateChangedBlock);
+}
+
+#pragma mark Rendering
+
+void SFB::Audio::OfflineOutput::SetRenderBlock(RenderBlock block)
+{
+	// The block may only be changed while the rendering thread is stopped
+	bool running = _IsRunning();
+	if(running)
+		_Stop();
+
+	if(mRenderBlock) {
+		Block_release(mRenderBlock);
+		mRenderBlock = nullptr;
+	}
+	if(block)
+		mRenderBlock = Block_copy(block);
+
+	if(running)
+		_Start();
+}
+
+void SFB::Audio::OfflineOutput::SetStateChangedBlock(dispatch_block_t block)
+{
+	if(mStateChangedBlock) {
+		Block_release(mStateChangedBlock);
+		mStateChangedBlock = nullptr;
+	}
+	if(block)
+		mStateChangedBlock = Block_copy(block);
+}
+
+#pragma mark Throughput
+
+double SFB::Audio::OfflineOutput::GetThroughput() const
+{
+	uint64_t nanos = ConvertHostTimeToNanos(mRenderingTime.load());
+	if(0 == nanos)
+		return 0;
+
+	return (mFramesRendered.load() * (double)NSEC_PER_SEC) / nanos;
+}
+
+double SFB::Audio::OfflineOutput::GetRealTimeFactor() const
+{
+	if(0 >= mFormat.mSampleRate)
+		return 0;
+
+	return GetThroughput() / mFormat.mSampleRate;
+}
+
+#pragma mark -
+
+bool SFB::Audio::OfflineOutput::_Open()
+{
+	mFramesRendered.store(0);
+	mRenderingTime.store(0);
+	mIsOpen.store(true);
+	return true;
+}
+
+bool SFB::Audio::OfflineOutput::_Close()
+{
+	if(_IsRunning())
+		_Stop();
+	else if(mRenderThread.joinable())
+		mRenderThread.join();
+
+	mBufferList.Deallocate();
+	mIsOpen.store(false);
+
+	return true;
+}
+
+bool SFB::Audio::OfflineOutput::_Start()
+{
+	if(!mBufferList) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.Offline", "Output not configured for a decoder");
+		return false;
+	}
+
+	// A thread stopped by _RequestStop() may still be exiting
+	if(mRenderThread.joinable())
+		mRenderThread.join();
+
+	mIsRunning.store(true);
+
+	try {
+		mRenderThread = std::thread(&OfflineOutput::RenderThreadEntry, this);
+	}
+	catch(const std::exception& e) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.Offline", "Unable to create rendering thread: " << e.what());
+		mIsRunning.store(false);
+		return false;
+	}
+
+	if(mStateChangedBlock)
+		mStateChangedBlock();
+
+	return true;
+}
+
+bool SFB::Audio::OfflineOutput::_Stop()
+{
+	mIsRunning.store(false);
+	mSemaphore.Signal();
+
+	// A stop from within the render block can't wait for its own thread, which is joined when next started or closed
+	if(mRenderThread.joinable() && std::this_thread::get_id() != mRenderThread.get_id())
+		mRenderThread.join();
+
+	if(mStateChangedBlock)
+		mStateChangedBlock();
+
+	return true;
+}
+
+bool SFB::Audio::OfflineOutput::_RequestStop()
+{
+	// The rendering thread exits after its current cycle and is joined when next started or stopped
+	mIsRunning.store(false);
+	mSemaphore.Signal();
+
+	if(mStateChangedBlock)
+		mStateChangedBlock();
+
+	return true;
+}
+
+bool SFB::Audio::OfflineOutput::_IsOpen() const
+{
+	return mIsOpen.load();
+}
+
+bool SFB::Audio::OfflineOutput::_IsRunning() const
+{
+	return mIsRunning.load();
+}
+
+bool SFB::Audio::OfflineOutput::_Reset()
+{
+	return true;
+}
+
+bool SFB::Audio::OfflineOutput::_SupportsFormat(const AudioFormat& format) const
+{
+	return format.IsPCM();
+}
+
+bool SFB::Audio::OfflineOutput::_SetupForDecoder(const Decoder& decoder)
+{
+	const auto& decoderFormat = decoder.GetFormat();
+	if(!decoderFormat.IsPCM()) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.Offline", "Only PCM audio can be rendered offline");
+		return false;
+	}
+
+	bool running = _IsRunning();
+	if(running && !_Stop())
+		return false;
+
+	// Audio is rendered as deinterleaved native floats at the decoder's sample rate
+	mFormat.mFormatID			= kAudioFormatLinearPCM;
+	mFormat.mFormatFlags		= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+	mFormat.mSampleRate			= decoderFormat.mSampleRate;
+	mFormat.mChannelsPerFrame	= decoderFormat.mChannelsPerFrame;
+	mFormat.mBitsPerChannel		= 32;
+	mFormat.mBytesPerPacket		= sizeof(float);
+	mFormat.mFramesPerPacket	= 1;
+	mFormat.mBytesPerFrame		= sizeof(float);
+	mFormat.mReserved			= 0;
+
+	mChannelLayout = decoder.GetChannelLayout();
+
+	if(!mBufferList.Allocate(mFormat, mBufferFrameSize)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.Offline", "Unable to allocate memory");
+		return false;
+	}
+
+	if(running && !_Start())
+		return false;
+
+	return true;
+}
+
+size_t SFB::Audio::OfflineOutput::_GetPreferredBufferSize() const
+{
+	return mBufferFrameSize;
+}
+
+#pragma mark -
+
+void SFB::Audio::OfflineOutput::RenderThreadEntry()
+{
+	pthread_setname_np("org.sbooth.AudioEngine.Output.Offline");
+
+	AudioTimeStamp timeStamp = {};
+	timeStamp.mFlags = kAudioTimeStampSampleTimeValid | kAudioTimeStampHostTimeValid;
+	timeStamp.mRateScalar = 1;
+
+	uint64_t lastTime = mach_absolute_time();
+
+	if(mRealTime) {
+		RealTimeRenderLoop(timeStamp);
+		return;
+	}
+
+	while(mIsRunning.load()) {
+		// Only audio already decoded is rendered, so the output waits for the decoder instead of underrunning
+		auto frameCount = (UInt32)std::min((size_t)mBufferFrameSize, mPlayer->GetFramesAvailableToRender());
+
+		timeStamp.mSampleTime = mFramesRendered.load();
+		timeStamp.mHostTime = mach_absolute_time();
+
+		if(0 == frameCount) {
+			// Process the player's pending actions, such as format changes and stop requests, without consuming audio
+			mBufferList.Reset();
+			ProvideAudio(mBufferList, 0, &timeStamp);
+			mSemaphore.TimedWait(dispatch_time(DISPATCH_TIME_NOW, IDLE_WAIT_NANOSECONDS));
+		}
+		else {
+			mBufferList.Reset();
+
+			auto startTime = BeginRenderCycle();
+			bool result = ProvideAudio(mBufferList, frameCount, &timeStamp);
+			EndRenderCycle(startTime, frameCount, mFormat.mSampleRate);
+
+			if(result) {
+				if(mRenderBlock)
+					mRenderBlock(mBufferList, frameCount);
+				mFramesRendered.fetch_add(frameCount);
+			}
+		}
+
+		auto now = mach_absolute_time();
+		mRenderingTime.fetch_add(now - lastTime);
+		lastTime = now;
+	}
+}
+
+void SFB::Audio::OfflineOutput::RealTimeRenderLoop(AudioTimeStamp& timeStamp)
+{
+	auto period = ConvertNanosToHostTime((uint64_t)((mBufferFrameSize * (double)NSEC_PER_SEC) / mFormat.mSampleRate));
+	auto deadline = mach_absolute_time();
+
+	uint64_t lastTime = deadline;
+
+	while(mIsRunning.load()) {
+		deadline += period;
+
+		// Like a device, a cycle missed entirely is skipped rather than rendered late
+		auto now = mach_absolute_time();
+		if(now > deadline + period)
+			deadline = now;
+		else
+			mach_wait_until(deadline);
+
+		timeStamp.mSampleTime = mFramesRendered.load();
+		timeStamp.mHostTime = mach_absolute_time();
+
+		// The player renders silence and records an underrun if fewer frames are available
+		mBufferList.Reset();
+
+		auto startTime = BeginRenderCycle();
+		bool result = ProvideAudio(mBufferList, mBufferFrameSize, &timeStamp);
+		EndRenderCycle(startTime, mBufferFrameSize, mFormat.mSampleRate);
+
+		if(result) {
+			if(mRenderBlock)
+				mRenderBlock(mBufferList, mBufferFrameSize);
+			mFramesRendered.fetch_add(mBufferFrameSize);
+		}
+
+		now = mach_absolute_time();
+		mRenderingTime.fetch_add(now - lastTime);
+		lastTime = now;
+	}
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "AudioOutput.h"
+#include "AudioBufferList.h"
+#include "Semaphore.h"
+
+/*! @file OfflineOutput.h @brief Offline output functionality */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief Output subclass rendering without an audio device
+		 *
+		 * An \c OfflineOutput pulls audio from its player on a dedicated thread as quickly as it is decoded,
+		 * passing each rendered buffer to a block which may write it to a file or process it further.
+		 * The ring buffer and render events behave as they do for a device, so gapless playback, seeking and
+		 * the player's callbacks are unchanged; only the pacing differs.
+		 *
+		 * An output created with \c realTime set instead renders one buffer per buffer duration whether or not
+		 * audio is available, as a device would, so it can stand in for hardware when testing underruns and
+		 * scheduling without audio devices.
+		 */
+		class OfflineOutput : public Output
+		{
+
+		public:
+
+			/*!
+			 * @brief A block called with each rendered buffer
+			 * @note This block is called on the rendering thread
+			 * @param bufferList The rendered audio
+			 * @param frameCount The number of frames in \c bufferList
+			 */
+			using RenderBlock = void (^)(const AudioBufferList *bufferList, UInt32 frameCount);
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			// @{
+
+			/*!
+			 * @brief Create a new \c OfflineOutput
+			 * @param bufferFrameSize The maximum number of frames rendered in each cycle
+			 * @param realTime Whether to render in real time, as a device would
+			 */
+			explicit OfflineOutput(UInt32 bufferFrameSize = 512, bool realTime = false);
+
+			/*! @brief Destroy this \c OfflineOutput */
+			virtual ~OfflineOutput();
+
+			//@}
+
+
+			// ========================================
+			/*! @name Rendering */
+			//@{
+
+			/*! @brief Set a block to be called with each rendered buffer */
+			void SetRenderBlock(RenderBlock block);
+
+			/*! @brief Set a block to be invoked when the running state changes */
+			void SetStateChangedBlock(dispatch_block_t block);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Throughput */
+			//@{
+
+			/*! @brief Get the number of frames rendered since the output was opened */
+			inline uint64_t GetFramesRendered() const				{ return mFramesRendered.load(); }
+
+			/*! @brief Get the average number of frames rendered per second while running */
+			double GetThroughput() const;
+
+			/*! @brief Get the throughput as a multiple of the audio's sample rate */
+			double GetRealTimeFactor() const;
+
+			//@}
+
+		private:
+
+			virtual bool _Open();
+			virtual bool _Close();
+
+			virtual bool _Start();
+			virtual bool _Stop();
+			virtual bool _RequestStop();
+
+			virtual bool _IsOpen() const;
+			virtual bool _IsRunning() const;
+
+			virtual bool _Reset();
+
+			virtual bool _SupportsFormat(const AudioFormat& format) const;
+
+			virtual bool _SetupForDecoder(const Decoder& decoder);
+
+			virtual size_t _GetPreferredBufferSize() const;
+
+			virtual bool _IsRealTime() const			{ return mRealTime; }
+			virtual bool _GetOutputLatency(Float64& latency) const	{ latency = 0; return true; }
+
+			void RenderThreadEntry();
+			void RealTimeRenderLoop(AudioTimeStamp& timeStamp);
+
+			UInt32									mBufferFrameSize;		/*!< Maximum frames per render cycle */
+			bool									mRealTime;				/*!< Whether rendering is paced in real time */
+			BufferList								mBufferList;			/*!< Rendered audio */
+
+			std::thread								mRenderThread;			/*!< The rendering thread */
+			Semaphore								mSemaphore;				/*!< Paces the rendering thread when no audio is available */
+
+			std::atomic_bool						mIsOpen;				/*!< Whether the output is open */
+			std::atomic_bool						mIsRunning;				/*!< Whether the rendering thread should run */
+
+			RenderBlock								mRenderBlock;			/*!< Block called with rendered audio */
+			dispatch_block_t						mStateChangedBlock;		/*!< Block called when running state changes */
+
+			std::atomic_ullong						mFramesRendered;		/*!< Frames rendered since opening */
+			std::atomic_ullong						mRenderingTime;			/*!< Host time spent running since opening */
+		};
+
+	}
+}
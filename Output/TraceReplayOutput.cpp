@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+
+#include <mach/mach_error.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#include <pthread.h>
+
+#include "TraceReplayOutput.h"
+#include "AudioPlayer.h"
+#include "Logger.h"
+
+namespace {
+
+	// ========================================
+	// Convert host time to nanoseconds
+	uint64_t ConvertHostTimeToNanos(uint64_t hostTime)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (hostTime * sTimebaseInfo.numer) / sTimebaseInfo.denom;
+	}
+
+	// ========================================
+	// Convert nanoseconds to host time
+	uint64_t ConvertNanosToHostTime(uint64_t nanos)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (nanos * sTimebaseInfo.denom) / sTimebaseInfo.numer;
+	}
+
+	// ========================================
+	// Make the calling thread a real-time thread with the rendering thread's period
+	bool SetTimeConstraintPolicy(uint64_t periodNanos)
+	{
+		auto period = ConvertNanosToHostTime(periodNanos);
+		thread_time_constraint_policy_data_t timeConstraintPolicy = {
+			.period			= (uint32_t)period,
+			.computation	= (uint32_t)(period / 4),
+			.constraint		= (uint32_t)period,
+			.preemptible	= true
+		};
+
+		kern_return_t error = thread_policy_set(mach_thread_self(),
+												THREAD_TIME_CONSTRAINT_POLICY,
+												(thread_policy_t)&timeConstraintPolicy,
+												THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+
+		if(KERN_SUCCESS != error) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Output.TraceReplay", "Couldn't set thread's time constraint policy: " << mach_error_string(error));
+			return false;
+		}
+
+		return true;
+	}
+
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::TraceReplayOutput::TraceReplayOutput(const RenderTrace::Configuration& configuration, const std::vector<RenderTrace::Event>& events)
+	: mConfiguration(configuration), mMaximumFrameCount(0), mFinished(nullptr), mIsOpen(false), mIsRunning(false), mNextCallback(0), mMaximumLateness(0)
+{
+	mFinished = dispatch_semaphore_create(0);
+
+	// Offsets are converted using the timebase of the machine that recorded the trace
+	const RenderTrace::Event *first = nullptr;
+	for(const auto& event : events) {
+		if(RenderTrace::EventType::Render != event.mType || 0 == event.mFrameCount)
+			continue;
+
+		if(nullptr == first)
+			first = &event;
+
+		uint64_t offset = ((event.mHostTime - first->mHostTime) * mConfiguration.mTimebaseNumerator) / std::max(mConfiguration.mTimebaseDenominator, 1u);
+		mCallbacks.push_back({ offset, event.mFrameCount });
+		mMaximumFrameCount = std::max(mMaximumFrameCount, event.mFrameCount);
+	}
+}
+
+SFB::Audio::TraceReplayOutput::~TraceReplayOutput()
+{
+	if(_IsOpen())
+		_Close();
+
+	if(mFinished)
+		dispatch_release(mFinished);
+}
+
+#pragma mark Replay
+
+bool SFB::Audio::TraceReplayOutput::WaitUntilFinished(dispatch_time_t timeout)
+{
+	if(0 != dispatch_semaphore_wait(mFinished, timeout))
+		return false;
+
+	// Leave the semaphore signaled for other waiters
+	dispatch_semaphore_signal(mFinished);
+	return true;
+}
+
+#pragma mark -
+
+bool SFB::Audio::TraceReplayOutput::_Open()
+{
+	if(mCallbacks.empty()) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.TraceReplay", "The trace contains no render callbacks");
+		return false;
+	}
+
+	mNextCallback.store(0);
+	mMaximumLateness.store(0);
+	mIsOpen.store(true);
+	return true;
+}
+
+bool SFB::Audio::TraceReplayOutput::_Close()
+{
+	if(_IsRunning())
+		_Stop();
+	else if(mRenderThread.joinable())
+		mRenderThread.join();
+
+	mBufferList.Deallocate();
+	mIsOpen.store(false);
+
+	return true;
+}
+
+bool SFB::Audio::TraceReplayOutput::_Start()
+{
+	if(!mBufferList) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.TraceReplay", "Output not configured for a decoder");
+		return false;
+	}
+
+	if(mRenderThread.joinable())
+		mRenderThread.join();
+
+	if(mCallbacks.size() <= mNextCallback.load())
+		return false;
+
+	mIsRunning.store(true);
+
+	try {
+		mRenderThread = std::thread(&TraceReplayOutput::RenderThreadEntry, this);
+	}
+	catch(const std::exception& e) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.TraceReplay", "Unable to create rendering thread: " << e.what());
+		mIsRunning.store(false);
+		return false;
+	}
+
+	return true;
+}
+
+bool SFB::Audio::TraceReplayOutput::_Stop()
+{
+	mIsRunning.store(false);
+
+	if(mRenderThread.joinable() && std::this_thread::get_id() != mRenderThread.get_id())
+		mRenderThread.join();
+
+	return true;
+}
+
+bool SFB::Audio::TraceReplayOutput::_RequestStop()
+{
+	mIsRunning.store(false);
+	return true;
+}
+
+bool SFB::Audio::TraceReplayOutput::_IsOpen() const
+{
+	return mIsOpen.load();
+}
+
+bool SFB::Audio::TraceReplayOutput::_IsRunning() const
+{
+	return mIsRunning.load();
+}
+
+bool SFB::Audio::TraceReplayOutput::_Reset()
+{
+	return true;
+}
+
+bool SFB::Audio::TraceReplayOutput::_SupportsFormat(const AudioFormat& format) const
+{
+	return format.IsPCM();
+}
+
+bool SFB::Audio::TraceReplayOutput::_SetupForDecoder(const Decoder& decoder)
+{
+	const auto& decoderFormat = decoder.GetFormat();
+	if(!decoderFormat.IsPCM()) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.TraceReplay", "Only PCM audio can be replayed");
+		return false;
+	}
+
+	// The schedule is replayed as recorded, so audio at another rate is consumed faster or slower than it was
+	if(mConfiguration.mSampleRate != decoderFormat.mSampleRate)
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Output.TraceReplay", "Replaying a trace recorded at " << mConfiguration.mSampleRate << " Hz with audio at " << decoderFormat.mSampleRate << " Hz");
+
+	bool running = _IsRunning();
+	if(running && !_Stop())
+		return false;
+
+	// Audio is rendered as deinterleaved native floats at the decoder's sample rate, as by CoreAudioOutput
+	mFormat.mFormatID			= kAudioFormatLinearPCM;
+	mFormat.mFormatFlags		= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+	mFormat.mSampleRate			= decoderFormat.mSampleRate;
+	mFormat.mChannelsPerFrame	= decoderFormat.mChannelsPerFrame;
+	mFormat.mBitsPerChannel		= 32;
+	mFormat.mBytesPerPacket		= sizeof(float);
+	mFormat.mFramesPerPacket	= 1;
+	mFormat.mBytesPerFrame		= sizeof(float);
+	mFormat.mReserved			= 0;
+
+	mChannelLayout = decoder.GetChannelLayout();
+
+	if(!mBufferList.Allocate(mFormat, mMaximumFrameCount)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Output.TraceReplay", "Unable to allocate memory");
+		return false;
+	}
+
+	if(running && !_Start())
+		return false;
+
+	return true;
+}
+
+size_t SFB::Audio::TraceReplayOutput::_GetPreferredBufferSize() const
+{
+	return 0 != mConfiguration.mOutputBufferFrameSize ? mConfiguration.mOutputBufferFrameSize : mMaximumFrameCount;
+}
+
+#pragma mark -
+
+void SFB::Audio::TraceReplayOutput::RenderThreadEntry()
+{
+	pthread_setname_np("org.sbooth.AudioEngine.Output.TraceReplay");
+
+	if(0 < mConfiguration.mSampleRate)
+		SetTimeConstraintPolicy((uint64_t)((_GetPreferredBufferSize() * (double)NSEC_PER_SEC) / mConfiguration.mSampleRate));
+
+	AudioTimeStamp timeStamp = {};
+	timeStamp.mFlags = kAudioTimeStampSampleTimeValid | kAudioTimeStampHostTimeValid;
+	timeStamp.mRateScalar = 1;
+
+	// A replay resumed after stopping continues the schedule from the next callback
+	auto index = mNextCallback.load();
+	auto startTime = mach_absolute_time() - ConvertNanosToHostTime(mCallbacks[index].mOffset);
+
+	while(mIsRunning.load() && index < mCallbacks.size()) {
+		const auto& callback = mCallbacks[index];
+
+		auto deadline = startTime + ConvertNanosToHostTime(callback.mOffset);
+		mach_wait_until(deadline);
+
+		timeStamp.mHostTime = mach_absolute_time();
+
+		if(timeStamp.mHostTime > deadline) {
+			auto lateness = ConvertHostTimeToNanos(timeStamp.mHostTime - deadline);
+			if(lateness > mMaximumLateness.load(std::memory_order_relaxed))
+				mMaximumLateness.store(lateness, std::memory_order_relaxed);
+		}
+
+		mBufferList.Reset();
+
+		auto cycleStartTime = BeginRenderCycle();
+		ProvideAudio(mBufferList, callback.mFrameCount, &timeStamp);
+		EndRenderCycle(cycleStartTime, callback.mFrameCount, mFormat.mSampleRate);
+
+		timeStamp.mSampleTime += callback.mFrameCount;
+		mNextCallback.store(++index);
+	}
+
+	if(mCallbacks.size() <= index) {
+		mIsRunning.store(false);
+		dispatch_semaphore_signal(mFinished);
+	}
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <dispatch/dispatch.h>
+
+#include "AudioOutput.h"
+#include "AudioBufferList.h"
+#include "RenderTrace.h"
+
+/*! @file TraceReplayOutput.h @brief Replay of a recorded render callback schedule */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief Output subclass rendering on the schedule recorded in a render trace
+		 *
+		 * A \c TraceReplayOutput calls its player on a real-time thread at the same offsets from its start, and for
+		 * the same numbers of frames, as the output callbacks recorded in a \c RenderTrace.  The decoding work
+		 * is performed by the player as usual, so the effect of the ring buffer configuration and decoder
+		 * scheduling on underruns may be compared with the recording.  When the schedule is exhausted the
+		 * output stops and signals completion.
+		 */
+		class TraceReplayOutput : public Output
+		{
+
+		public:
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			// @{
+
+			/*!
+			 * @brief Create a new \c TraceReplayOutput
+			 * @param configuration The configuration read from the trace
+			 * @param events The events read from the trace; only \c RenderTrace::EventType::Render events are used
+			 */
+			TraceReplayOutput(const RenderTrace::Configuration& configuration, const std::vector<RenderTrace::Event>& events);
+
+			/*! @brief Destroy this \c TraceReplayOutput */
+			virtual ~TraceReplayOutput();
+
+			//@}
+
+
+			// ========================================
+			/*! @name Replay */
+			//@{
+
+			/*! @brief Get the number of render callbacks in the schedule */
+			inline size_t GetCallbackCount() const					{ return mCallbacks.size(); }
+
+			/*! @brief Get the number of render callbacks replayed */
+			inline size_t GetCallbacksReplayed() const				{ return mNextCallback.load(); }
+
+			/*! @brief Get the largest delay of a callback from its scheduled time, in nanoseconds */
+			inline uint64_t GetMaximumLateness() const				{ return mMaximumLateness.load(); }
+
+			/*!
+			 * @brief Wait until every callback in the schedule has been replayed
+			 * @param timeout The time to wait until
+			 * @return \c true if the schedule was replayed, \c false on timeout
+			 */
+			bool WaitUntilFinished(dispatch_time_t timeout = DISPATCH_TIME_FOREVER);
+
+			//@}
+
+		private:
+
+			virtual bool _Open();
+			virtual bool _Close();
+
+			virtual bool _Start();
+			virtual bool _Stop();
+			virtual bool _RequestStop();
+
+			virtual bool _IsOpen() const;
+			virtual bool _IsRunning() const;
+
+			virtual bool _Reset();
+
+			virtual bool _SupportsFormat(const AudioFormat& format) const;
+
+			virtual bool _SetupForDecoder(const Decoder& decoder);
+
+			virtual size_t _GetPreferredBufferSize() const;
+
+			virtual bool _GetOutputLatency(Float64& latency) const	{ latency = 0; return true; }
+
+			void RenderThreadEntry();
+
+			/*! @brief A recorded render callback */
+			struct Callback {
+				uint64_t	mOffset;		/*!< Nanoseconds from the first callback */
+				UInt32		mFrameCount;	/*!< Frames requested */
+			};
+
+			RenderTrace::Configuration				mConfiguration;			/*!< The recorded configuration */
+			std::vector<Callback>					mCallbacks;				/*!< The recorded schedule */
+			UInt32									mMaximumFrameCount;		/*!< The most frames requested by a callback */
+			BufferList								mBufferList;			/*!< Rendered audio */
+
+			std::thread								mRenderThread;			/*!< The rendering thread */
+			dispatch_semaphore_t					mFinished;				/*!< Signaled when the schedule is exhausted */
+
+			std::atomic_bool						mIsOpen;				/*!< Whether the output is open */
+			std::atomic_bool						mIsRunning;				/*!< Whether the rendering thread should run */
+
+			std::atomic_size_t						mNextCallback;			/*!< The index of the next callback to replay */
+			std::atomic_ullong						mMaximumLateness;		/*!< The largest delay from the schedule in nanoseconds */
+		};
+
+	}
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <limits>
+
+#include <pthread.h>
+#include <pthread/qos.h>
+
+#include "AudioDecoderPool.h"
+#include "AudioPlayer.h"
+#include "Logger.h"
+
+#pragma mark Creation/Destruction
+
+SFB::Audio::DecoderPool::DecoderPool(size_t threadCount)
+	: mStopping(false)
+{
+	if(0 == threadCount)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	try {
+		for(size_t i = 0; i < threadCount; ++i)
+			mThreads.push_back(std::thread(&DecoderPool::WorkerThreadEntry, this));
+	}
+
+	catch(const std::exception& e) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.DecoderPool", "Unable to create decoding thread: " << e.what());
+
+		// Join any threads that were successfully created
+		mStopping.store(true);
+		for(size_t i = 0; i < mThreads.size(); ++i)
+			mSemaphore.Signal();
+		for(auto& thread : mThreads)
+			thread.join();
+
+		throw;
+	}
+}
+
+SFB::Audio::DecoderPool::~DecoderPool()
+{
+	if(!mPlayers.empty())
+		LOGGER_ERR("org.sbooth.AudioEngine.DecoderPool", "DecoderPool destroyed with " << mPlayers.size() << " players still attached");
+
+	mStopping.store(true);
+	for(size_t i = 0; i < mThreads.size(); ++i)
+		mSemaphore.Signal();
+
+	for(auto& thread : mThreads) {
+		try {
+			thread.join();
+		}
+
+		catch(const std::exception& e) {
+			LOGGER_ERR("org.sbooth.AudioEngine.DecoderPool", "Unable to join decoding thread: " << e.what());
+		}
+	}
+}
+
+#pragma mark Player registration
+
+void SFB::Audio::DecoderPool::AddPlayer(Player *player)
+{
+	{
+		std::lock_guard<std::mutex> lock(mPlayersMutex);
+		mPlayers.push_back(player);
+	}
+
+	WakePlayer(player);
+}
+
+void SFB::Audio::DecoderPool::RemovePlayer(Player *player)
+{
+	std::unique_lock<std::mutex> lock(mPlayersMutex);
+	mPlayers.erase(std::remove(mPlayers.begin(), mPlayers.end(), player), mPlayers.end());
+
+	// A decoding thread may be servicing the player
+	mPlayerServiced.wait(lock, [player]() { return !player->mDecoderPoolServicing; });
+}
+
+void SFB::Audio::DecoderPool::WakePlayer(Player *player)
+{
+	player->mDecoderPoolRunnable.store(true);
+	mSemaphore.Signal();
+}
+
+#pragma mark Thread Entry Point
+
+void SFB::Audio::DecoderPool::WorkerThreadEntry()
+{
+	pthread_setname_np("org.sbooth.AudioEngine.DecoderPool");
+
+	// ========================================
+	// Decoding must keep ahead of the rendering threads it supplies
+	if(pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0))
+		LOGGER_WARNING("org.sbooth.AudioEngine.DecoderPool", "Couldn't set decoding thread QoS class");
+
+	while(!mStopping.load()) {
+
+		// ========================================
+		// Choose the runnable player closest to underrun
+		Player *player = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mPlayersMutex);
+
+			CFTimeInterval earliestDeadline = std::numeric_limits<CFTimeInterval>::max();
+			for(auto candidate : mPlayers) {
+				if(candidate->mDecoderPoolServicing || !candidate->mDecoderPoolRunnable.load())
+					continue;
+
+				CFTimeInterval deadline = candidate->GetDecodingDeadline();
+				if(nullptr == player || deadline < earliestDeadline) {
+					player = candidate;
+					earliestDeadline = deadline;
+				}
+			}
+
+			if(player) {
+				player->mDecoderPoolServicing = true;
+				player->mDecoderPoolRunnable.store(false);
+			}
+		}
+
+		// Wait for a player to be woken
+		if(nullptr == player) {
+			mSemaphore.Wait();
+			continue;
+		}
+
+		// ========================================
+		// Perform one unit of decoding work
+		auto status = player->ServiceDecoding();
+
+		// The player may have been woken while being serviced, in which case the wakeup was consumed by a thread that skipped it
+		// The player must not be accessed after mPlayerServiced is notified since it may be destroyed
+		bool runnable = false;
+		{
+			std::lock_guard<std::mutex> lock(mPlayersMutex);
+			player->mDecoderPoolServicing = false;
+
+			if(Player::DecodingStatus::Continue == status)
+				player->mDecoderPoolRunnable.store(true);
+
+			runnable = player->mDecoderPoolRunnable.load();
+			player = nullptr;
+		}
+
+		mPlayerServiced.notify_all();
+
+		if(runnable)
+			mSemaphore.Signal();
+	}
+}
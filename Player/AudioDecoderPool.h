@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+#include "Semaphore.h"
+
+/*! @file AudioDecoderPool.h @brief A pool of decoding threads shared by multiple players */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		class Player;
+
+		/*!
+		 * @brief A pool of decoding threads shared by multiple \c Player objects
+		 *
+		 * By default each \c Player decodes in a dedicated thread.  A \c Player created with a \c DecoderPool
+		 * instead has its decoding performed by the pool's threads, so the number of decoding threads
+		 * is independent of the number of players.
+		 *
+		 * When more players need decoding than there are threads, the player whose ring buffer will
+		 * underrun soonest is serviced first.
+		 *
+		 * @note A \c DecoderPool must outlive all players using it
+		 */
+		class DecoderPool
+		{
+		public:
+			/*! @brief A \c std::unique_ptr for \c DecoderPool objects */
+			using unique_ptr = std::unique_ptr<DecoderPool>;
+
+			/*!
+			 * @brief Create a new \c DecoderPool
+			 * @param threadCount The number of decoding threads, or \c 0 for one thread per processor core
+			 * @throws std::system_error
+			 */
+			explicit DecoderPool(size_t threadCount = 0);
+
+			/*!
+			 * @brief Destroy the \c DecoderPool and join its threads
+			 * @note All players using the pool must be destroyed first
+			 */
+			~DecoderPool();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			DecoderPool(const DecoderPool& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			DecoderPool& operator=(const DecoderPool& rhs) = delete;
+
+			/*! @endcond */
+
+			/*! @brief Get the number of decoding threads in the pool */
+			inline size_t GetThreadCount() const					{ return mThreads.size(); }
+
+		private:
+
+			friend class Player;
+
+			// ========================================
+			// Player registration
+			void AddPlayer(Player *player);
+			void RemovePlayer(Player *player);
+
+			// Mark player as needing service and wake a decoding thread; safe to call from the rendering thread
+			void WakePlayer(Player *player);
+
+			// ========================================
+			// Thread entry point
+			void WorkerThreadEntry();
+
+			// ========================================
+			// Data Members
+			std::vector<std::thread>				mThreads;
+			std::atomic_bool						mStopping;
+
+			std::vector<Player *>					mPlayers;
+			std::mutex								mPlayersMutex;
+			std::condition_variable					mPlayerServiced;
+
+			Semaphore								mSemaphore;
+		};
+
+	}
+}
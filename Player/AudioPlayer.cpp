@@ -8,23 +8,72 @@
 #include <mach/thread_act.h>
 #include <mach/mach_error.h>
 #include <mach/sync_policy.h>
+#include <mach/mach_time.h>
 #include <stdexcept>
 #include <new>
 #include <algorithm>
+#include <cmath>
+#include <climits>
+
+#include <Accelerate/Accelerate.h>
 
 #include "AudioPlayer.h"
+#include "AudioDecoderPool.h"
 #include "CoreAudioOutput.h"
 #include "AudioBufferList.h"
+#include "AudioMetadata.h"
 #include "CFErrorUtilities.h"
 #include "Logger.h"
 #include "CreateStringForOSType.h"
+#include "SampleKernels.h"
+#include "Signposts.h"
+
+#if !TARGET_OS_IPHONE
+# include "RemoteDecoder.h"
+#endif
 
 // ========================================
 // Macros
 // ========================================
 #define RING_BUFFER_CAPACITY_FRAMES				16384
 #define RING_BUFFER_WRITE_CHUNK_SIZE_FRAMES		2048
+#define SCRUB_FILL_CHUNK_COUNT					2
+#define RING_BUFFER_TARGET_DEPTH_SECONDS		0.4
+#define RING_BUFFER_MINIMUM_CAPACITY_FRAMES		4096
+#define RING_BUFFER_MAXIMUM_CAPACITY_FRAMES		(1 << 22)
+#define RING_BUFFER_LOW_MEMORY_CAPACITY_FRAMES	RING_BUFFER_MINIMUM_CAPACITY_FRAMES
+
+// In low-power mode the decoding thread is woken when the ring buffer drains to this fraction of its capacity
+#define LOW_POWER_BUFFER_DURATION_SECONDS		20.0
+#define LOW_POWER_WAKE_FILL_FRACTION			0.25
+
+// Suspended output is resumed once the ring buffer is this full, after this much silence while the device restarts
+#define DEFAULT_OUTPUT_SUSPENSION_DELAY_SECONDS	5.0
+#define OUTPUT_RESUME_FILL_FRACTION				0.5
+#define OUTPUT_RESUME_PREROLL_NSEC				(50 * NSEC_PER_MSEC)
 #define DECODER_THREAD_IMPORTANCE				6
+#define RENDER_EVENT_QUEUE_CAPACITY_EVENTS		128
+#define RATE_SEGMENT_QUEUE_CAPACITY_SEGMENTS	4096
+#define ACTIVE_DECODER_CAPACITY					8
+#define DECODER_PREROLL_FRAMES					4096
+#define RECLAMATION_RETRY_INTERVAL_NSEC			(10 * NSEC_PER_MSEC)
+#define PREBUFFER_WAIT_INTERVAL_SECONDS			0.1
+#define DEFAULT_INPUT_BYTE_RATE					(128000 / 8)
+#define DEFAULT_QUEUE_WARM_UP_COUNT				2
+#define MAXIMUM_QUEUE_WARM_UP_COUNT				16
+#define OUTPUT_BUFFER_ADJUSTMENT_INTERVAL_NSEC	NSEC_PER_SEC
+#define VOICE_RING_BUFFER_CAPACITY_FRAMES		8192
+#define VOICE_WRITE_CHUNK_SIZE_FRAMES			1024
+#define LIMITER_THRESHOLD						0.891f		// -1 dBFS
+#define LIMITER_LOOKAHEAD_SECONDS				0.005
+#define LIMITER_RELEASE_SECONDS					0.1
+#define DECODE_TIME_HISTOGRAM_BASE_NSEC			(250 * NSEC_PER_USEC)
+#define PLAYBACK_SNAPSHOT_MAXIMUM_AGE_NSEC		(100 * NSEC_PER_MSEC)
+#define STATE_SNAPSHOT_TIMEOUT_SECONDS			1
+#define DEFAULT_OFFLINE_DECODING_QOS_CLASS		QOS_CLASS_UTILITY
+#define DECODER_MINIMUM_COMPUTATION_FRACTION	0.1
+#define DECODER_MAXIMUM_COMPUTATION_FRACTION	0.5
+#define MAXIMUM_CONCURRENT_DECODER_CREATIONS	4
 
 namespace {
 
@@ -36,15 +85,6 @@ namespace {
 		::SFB::Logger::SetCurrentLevel(::SFB::Logger::disabled);
 	}
 
-	// Bit reversal lookup table from http://graphics.stanford.edu/~seander/bithacks.html#BitReverseTable
-	static const uint8_t sBitReverseTable256 [256] =
-	{
-#   define R2(n)     n,     n + 2*64,     n + 1*64,     n + 3*64
-#   define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
-#   define R6(n) R4(n), R4(n + 2*4 ), R4(n + 1*4 ), R4(n + 3*4 )
-		R6(0), R6(2), R6(1), R6(3)
-	};
-
 	// ========================================
 	// Enums
 	// ========================================
@@ -56,17 +96,252 @@ namespace {
 		eDecoderStateDataFlagStopDecoding		= 1u << 4
 	};
 
+	// The rendering thread moves a voice from playing to finished; its resources are then released on the voice queue
+	enum eVoiceStates : unsigned int {
+		eVoiceStateFree							= 0,
+		eVoiceStatePreparing					= 1,
+		eVoiceStatePlaying						= 2,
+		eVoiceStateFinished						= 3
+	};
+
+	enum eVoiceFlags : unsigned int {
+		eVoiceFlagDecodingFinished				= 1u << 0,
+		eVoiceFlagStopRequested					= 1u << 1
+	};
+
 	enum eAudioPlayerFlags : unsigned int {
 		eAudioPlayerFlagMuteOutput				= 1u << 0,
 		eAudioPlayerFlagFormatMismatch			= 1u << 1,
 		eAudioPlayerFlagRequestMute				= 1u << 2,
 		eAudioPlayerFlagRingBufferNeedsReset	= 1u << 3,
 		eAudioPlayerFlagStartPlayback			= 1u << 4,
+		eAudioPlayerFlagDecoderNeedsSpace		= 1u << 5,
+
+		eAudioPlayerFlagOutputStopRequested		= 1u << 6,
+		eAudioPlayerFlagScheduledStartPending	= 1u << 7,
+		eAudioPlayerFlagInputStalled			= 1u << 8,
+		eAudioPlayerFlagOutputSuspensionRequested	= 1u << 9,
 
 		eAudioPlayerFlagStopDecoding			= 1u << 10,
-		eAudioPlayerFlagStopCollecting			= 1u << 11
+		eAudioPlayerFlagStopCollecting			= 1u << 11,
+		eAudioPlayerFlagFanOutOutputsChanged	= 1u << 12
+	};
+
+	// ========================================
+	// Events posted by the rendering thread
+	enum eRenderEventTypes : uint32_t {
+		eRenderEventUnderrun					= 'undr',
+		eRenderEventRingBufferReadFailed		= 'rdfl',
+		eRenderEventOutputStopRequested			= 'stop',
+		eRenderEventRenderingFinished			= 'rfin',
+		eRenderEventOutputSuspensionRequested	= 'susp',
+		eRenderEventAllocation					= 'allc'		// mFramesRequested holds the allocation count
+	};
+
+	// A POD record so events can be posted from the rendering thread without allocating or locking
+	struct RenderEvent
+	{
+		uint32_t	mType;				// One of eRenderEventTypes
+		UInt32		mFramesRequested;	// The number of frames requested in the render cycle
+		UInt32		mFramesRendered;	// The number of valid frames rendered in the render cycle
+		uint64_t	mUserBlockTime;		// Host time spent calling blocks in the render cycle
+	};
+
+	// ========================================
+	// Convert host time to nanoseconds
+	uint64_t ConvertHostTimeToNanos(uint64_t hostTime)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (hostTime * sTimebaseInfo.numer) / sTimebaseInfo.denom;
+	}
+
+	// Returns the CPU time used by the calling thread in nanoseconds, or 0 on error
+	uint64_t GetThreadCPUTime()
+	{
+		thread_basic_info_data_t info;
+		mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+		if(KERN_SUCCESS != thread_info(pthread_mach_thread_np(pthread_self()), THREAD_BASIC_INFO, (thread_info_t)&info, &count))
+			return 0;
+
+		return ((uint64_t)info.user_time.seconds + (uint64_t)info.system_time.seconds) * NSEC_PER_SEC + ((uint64_t)info.user_time.microseconds + (uint64_t)info.system_time.microseconds) * NSEC_PER_USEC;
+	}
+
+	// ========================================
+	// Convert nanoseconds to host time
+	uint64_t ConvertNanosToHostTime(uint64_t nanos)
+	{
+		static mach_timebase_info_data_t sTimebaseInfo = {};
+		if(0 == sTimebaseInfo.denom)
+			mach_timebase_info(&sTimebaseInfo);
+
+		return (nanos * sTimebaseInfo.denom) / sTimebaseInfo.numer;
+	}
+
+	// ========================================
+	// Raise a statistic to value if it is larger
+	void StoreMaximum(std::atomic_ullong& maximum, uint64_t value)
+	{
+		auto current = maximum.load(std::memory_order_relaxed);
+		while(value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed))
+			;
+	}
+
+	// ========================================
+	// Bucket i of the decode time histogram holds times less than (DECODE_TIME_HISTOGRAM_BASE_NSEC << i)
+	size_t GetDecodeTimeHistogramBucket(uint64_t nanos)
+	{
+		size_t bucket = 0;
+		while(bucket < SFB::Audio::Player::kDecodeTimeHistogramBucketCount - 1 && nanos >= (DECODE_TIME_HISTOGRAM_BASE_NSEC << bucket))
+			++bucket;
+		return bucket;
+	}
+
+	// ========================================
+	// Return the smallest power of two value greater than or equal to x
+	__attribute__ ((const)) inline size_t NextPowerOfTwo(size_t x)
+	{
+		if(1 >= x)
+			return 1;
+
+		return (size_t)1 << (64 - __builtin_clzll((unsigned long long)x - 1));
+	}
+
+	// ========================================
+	// Estimate the rate at which a decoder consumes its input in bytes per second, assuming a typical bitrate if unknown
+	double EstimateInputByteRate(SInt64 inputLength, SInt64 totalFrames, Float64 sampleRate)
+	{
+		if(0 < inputLength && 0 < totalFrames && 0 < sampleRate)
+			return inputLength / (totalFrames / sampleRate);
+
+		return DEFAULT_INPUT_BYTE_RATE;
+	}
+
+	// ========================================
+	// Add frameCount frames of each channel in source, scaled by the channel's gain, to destination at frameOffset
+	void MixChannels(const AudioBufferList *source, AudioBufferList *destination, size_t frameOffset, size_t frameCount, const float *gains)
+	{
+		for(UInt32 bufferIndex = 0; bufferIndex < destination->mNumberBuffers; ++bufferIndex) {
+			float *output = static_cast<float *>(destination->mBuffers[bufferIndex].mData) + frameOffset;
+			vDSP_vsma(static_cast<const float *>(source->mBuffers[bufferIndex].mData), 1, &gains[bufferIndex], output, 1, output, 1, frameCount);
+		}
+	}
+
+
+	// ========================================
+	// Read a replay gain value, returning NAN if it is absent
+	float GetReplayGainValue(CFNumberRef value)
+	{
+		float result = NAN;
+		if(nullptr == value || !CFNumberGetValue(value, kCFNumberFloatType, &result))
+			return NAN;
+		return result;
+	}
+
+	// ========================================
+	// Scales non-interleaved 32-bit float audio by a constant gain, optionally followed by a peak limiter
+	// The limiter looks ahead only within each buffer so it adds no latency; a peak at the start of a buffer reduces the gain immediately
+	class GainStage
+	{
+
+	public:
+
+		GainStage()
+			: mGain(1), mLimit(false), mAttackStep(1), mReleaseCoefficient(1), mEnvelope(1)
+		{}
+
+		void Reset(float gain, bool limit, Float64 sampleRate)
+		{
+			mGain = gain;
+			mLimit = limit;
+			mEnvelope = 1;
+
+			if(mLimit) {
+				mAttackStep = 1.f / (float)std::max(1., LIMITER_LOOKAHEAD_SECONDS * sampleRate);
+				mReleaseCoefficient = 1.f - (float)std::exp(-1. / (LIMITER_RELEASE_SECONDS * sampleRate));
+			}
+		}
+
+		inline bool IsActive() const
+		{
+			return 1 != mGain || mLimit;
+		}
+
+		void Process(AudioBufferList *bufferList, UInt32 frameCount)
+		{
+			if(0 == frameCount || 0 == bufferList->mNumberBuffers)
+				return;
+
+			if(1 != mGain) {
+				for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex) {
+					float *buffer = static_cast<float *>(bufferList->mBuffers[bufferIndex].mData);
+					vDSP_vsmul(buffer, 1, &mGain, buffer, 1, frameCount);
+				}
+			}
+
+			if(!mLimit)
+				return;
+
+			// This is called on the decoding thread so allocation is permissible
+			if(mEnvelopeBuffer.size() < frameCount)
+				mEnvelopeBuffer.resize(frameCount);
+			float *envelope = mEnvelopeBuffer.data();
+
+			// The channels are limited together using the gain required by the largest magnitude in each frame
+			vDSP_vabs(static_cast<const float *>(bufferList->mBuffers[0].mData), 1, envelope, 1, frameCount);
+			for(UInt32 bufferIndex = 1; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
+				vDSP_vmaxmg(static_cast<const float *>(bufferList->mBuffers[bufferIndex].mData), 1, envelope, 1, envelope, 1, frameCount);
+
+			float threshold = LIMITER_THRESHOLD, zero = 0, one = 1;
+			vDSP_svdiv(&threshold, envelope, 1, envelope, 1, frameCount);
+			vDSP_vclip(envelope, 1, &zero, &one, envelope, 1, frameCount);
+
+			// Working backward, ramp the gain down over the look-ahead period ahead of each peak
+			float gain = 1;
+			for(UInt32 i = frameCount; i-- > 0; ) {
+				gain = std::min(envelope[i], gain + mAttackStep);
+				envelope[i] = gain;
+			}
+
+			// Working forward, recover from each reduction exponentially
+			gain = mEnvelope;
+			for(UInt32 i = 0; i < frameCount; ++i) {
+				gain = std::min(envelope[i], gain + (1 - gain) * mReleaseCoefficient);
+				envelope[i] = gain;
+			}
+			mEnvelope = gain;
+
+			for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex) {
+				float *buffer = static_cast<float *>(bufferList->mBuffers[bufferIndex].mData);
+				vDSP_vmul(buffer, 1, envelope, 1, buffer, 1, frameCount);
+			}
+		}
+
+	private:
+
+		float				mGain;
+		bool				mLimit;
+		float				mAttackStep;			// The gain change per frame while approaching a peak
+		float				mReleaseCoefficient;
+		float				mEnvelope;				// The limiter's gain at the end of the previous buffer
+		std::vector<float>	mEnvelopeBuffer;
+
 	};
 
+	// ========================================
+	// The number of bits of precision of samples in ring buffer storage
+	unsigned GetStoragePrecision(SFB::Audio::RingBuffer::StorageFormat storageFormat)
+	{
+		switch(storageFormat) {
+			case SFB::Audio::RingBuffer::StorageFormat::Int16:		return 16;
+			case SFB::Audio::RingBuffer::StorageFormat::Int24:		return 24;
+			case SFB::Audio::RingBuffer::StorageFormat::Float16:	return 11;
+			default:												return 32;
+		}
+	}
+
 }
 
 
@@ -89,6 +364,7 @@ public:
 
 		// NB: The decoder may return an estimate of the total frames
 		mTotalFrames = mDecoder->GetTotalFrames();
+		mTotalFramesEstimated = mDecoder->IsTotalFramesEstimated();
 	}
 
 	DecoderStateData(const DecoderStateData& rhs) = delete;
@@ -99,10 +375,216 @@ public:
 		return mBufferList.Allocate(mDecoder->GetFormat(), capacityFrames);
 	}
 
+	// Decode audio ahead of time so the first ReadAudio() calls don't touch the decoder
+	bool Preroll(UInt32 frameCount)
+	{
+		// DSD frames aren't byte addressable
+		if(!mDecoder->GetFormat().IsPCM())
+			return true;
+
+		if(!mPrerollBufferList.Allocate(mDecoder->GetFormat(), frameCount))
+			return false;
+
+		ReturnBorrowedAudio();
+
+		mPrerollFrameOffset = 0;
+		mPrerollFramesAvailable = mDecoder->ReadAudio(mPrerollBufferList, frameCount);
+
+		return true;
+	}
+
+	// Read audio into mBufferList, accumulating the time spent reading in mReadTime
 	UInt32 ReadAudio(UInt32 frameCount)
 	{
+		auto readStartTime = mach_absolute_time();
 		mBufferList.Reset();
-		return mDecoder->ReadAudio(mBufferList, std::min(frameCount, mBufferList.GetCapacityFrames()));
+		UInt32 framesRead = ReadAudio(mBufferList, std::min(frameCount, mBufferList.GetCapacityFrames()));
+		mReadTime += mach_absolute_time() - readStartTime;
+		return framesRead;
+	}
+
+	// Borrow up to frameCount frames of the decoder's audio, accumulating the time spent reading in mReadTime
+	// The audio borrowed by the previous call is consumed first, since the converter is done with it once it asks for more
+	// Returns false if the decoder doesn't lend its audio or pre-rolled audio remains, in which case ReadAudio() must be used
+	bool BorrowAudio(const AudioBufferList *& bufferList, UInt32& frameCount)
+	{
+		ReturnBorrowedAudio();
+
+		if(0 < mPrerollFramesAvailable || !mDecoder->SupportsBorrowedAudio())
+			return false;
+
+		auto readStartTime = mach_absolute_time();
+		UInt32 framesAvailable = 0;
+		bufferList = mDecoder->PeekAudio(framesAvailable);
+		mReadTime += mach_absolute_time() - readStartTime;
+
+		frameCount = std::min(frameCount, framesAvailable);
+		mBorrowedFrameCount = frameCount;
+
+		if(mAnalysisTap && 0 < frameCount)
+			mAnalysisTap->AnalyzeAudio(bufferList, frameCount);
+
+		return true;
+	}
+
+	// Consume the audio borrowed by BorrowAudio()
+	void ReturnBorrowedAudio()
+	{
+		if(0 < mBorrowedFrameCount) {
+			mDecoder->ConsumeAudio(mBorrowedFrameCount);
+			mBorrowedFrameCount = 0;
+		}
+	}
+
+	// Read audio into bufferList, which must have space for frameCount frames
+	UInt32 ReadAudio(AudioBufferList *bufferList, UInt32 frameCount)
+	{
+		ReturnBorrowedAudio();
+
+		// Consume any pre-rolled audio first
+		if(0 < mPrerollFramesAvailable) {
+			UInt32 framesToCopy = std::min(frameCount, mPrerollFramesAvailable);
+
+			const AudioFormat& format = mDecoder->GetFormat();
+			size_t byteOffset = format.FrameCountToByteCount(mPrerollFrameOffset);
+			size_t byteCount = format.FrameCountToByteCount(framesToCopy);
+
+			for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex) {
+				memcpy(bufferList->mBuffers[bufferIndex].mData, (int8_t *)mPrerollBufferList->mBuffers[bufferIndex].mData + byteOffset, byteCount);
+				bufferList->mBuffers[bufferIndex].mDataByteSize = (UInt32)byteCount;
+			}
+
+			mPrerollFrameOffset += framesToCopy;
+			mPrerollFramesAvailable -= framesToCopy;
+
+			if(0 == mPrerollFramesAvailable)
+				mPrerollBufferList.Deallocate();
+
+			if(mAnalysisTap)
+				mAnalysisTap->AnalyzeAudio(bufferList, framesToCopy);
+
+			return framesToCopy;
+		}
+
+		UInt32 framesRead = mDecoder->ReadAudio(bufferList, frameCount);
+		if(mAnalysisTap && 0 < framesRead)
+			mAnalysisTap->AnalyzeAudio(bufferList, framesRead);
+
+		return framesRead;
+	}
+
+	// The frame that will next be returned by ReadAudio()
+	SInt64 GetCurrentFrame() const
+	{
+		// Borrowed audio has been handed to the converter but not yet consumed from the decoder
+		SInt64 currentFrame = mDecoder->GetCurrentFrame();
+		return -1 == currentFrame ? -1 : currentFrame + mBorrowedFrameCount - mPrerollFramesAvailable;
+	}
+
+	// The memory held by pre-rolled audio
+	size_t GetPrerollBufferByteCount() const
+	{
+		if(!mPrerollBufferList)
+			return 0;
+
+		return mPrerollBufferList->mNumberBuffers * mPrerollBufferList.GetFormat().FrameCountToByteCount(mPrerollBufferList.GetCapacityFrames());
+	}
+
+	SInt64 SeekToFrame(SInt64 frame, bool approximate = false)
+	{
+		// Pre-rolled audio is invalidated by a seek
+		mPrerollFramesAvailable = 0;
+		mPrerollBufferList.Deallocate();
+
+		// Borrowed audio is discarded by the decoder
+		mBorrowedFrameCount = 0;
+
+		// Audio skipped by a seek isn't analyzed
+		mAnalysisComplete = false;
+
+		return approximate ? mDecoder->SeekToFrameApproximately(frame) : mDecoder->SeekToFrame(frame);
+	}
+
+	// Create a tap for the decoder's audio, discarding any previous analysis
+	void BeginAnalysis(AnalysisTapBlock block)
+	{
+		mAnalysisTap.reset();
+		if(!block)
+			return;
+
+		mAnalysisTap.reset(block(*mDecoder));
+		mAnalysisComplete = 0 == GetCurrentFrame();
+
+		if(mAnalysisTap && !mAnalysisTap->DecodingStarted(*mDecoder))
+			mAnalysisTap.reset();
+	}
+
+	void FinishAnalysis()
+	{
+		if(mAnalysisTap) {
+			mAnalysisTap->DecodingFinished(*mDecoder, mAnalysisComplete);
+			mAnalysisTap.reset();
+		}
+	}
+
+	// Read the decoder's replay gain metadata
+	// This may be called before decoding starts so the file isn't read on the decoding thread
+	void LoadReplayGain()
+	{
+		if(mReplayGainLoaded)
+			return;
+
+		mReplayGainLoaded = true;
+
+		auto metadata = Metadata::CreateMetadataForURL(mDecoder->GetURL());
+		if(!metadata)
+			return;
+
+		mTrackGain = GetReplayGainValue(metadata->GetReplayGainTrackGain());
+		mTrackPeak = GetReplayGainValue(metadata->GetReplayGainTrackPeak());
+		mAlbumGain = GetReplayGainValue(metadata->GetReplayGainAlbumGain());
+		mAlbumPeak = GetReplayGainValue(metadata->GetReplayGainAlbumPeak());
+	}
+
+	// Configure the gain applied by ApplyGain() the first time this is called
+	void ConfigureGain(ReplayGainMode mode, float preamp, bool limit, const AudioFormat& outputFormat)
+	{
+		if(mGainConfigured)
+			return;
+
+		mGainConfigured = true;
+
+		if(ReplayGainMode::Disabled == mode || !outputFormat.IsPCM() || !(kAudioFormatFlagIsFloat & outputFormat.mFormatFlags) || 32 != outputFormat.mBitsPerChannel || outputFormat.IsInterleaved())
+			return;
+
+		LoadReplayGain();
+
+		float gain = ReplayGainMode::Album == mode ? mAlbumGain : mTrackGain;
+		float peak = ReplayGainMode::Album == mode ? mAlbumPeak : mTrackPeak;
+		if(std::isnan(gain)) {
+			gain = ReplayGainMode::Album == mode ? mTrackGain : mAlbumGain;
+			peak = ReplayGainMode::Album == mode ? mTrackPeak : mAlbumPeak;
+		}
+
+		float linearGain = 1;
+		if(!std::isnan(gain)) {
+			linearGain = std::pow(10.f, (gain + preamp) / 20.f);
+
+			// Without the limiter the gain is reduced to prevent clipping
+			if(!limit && 0 < peak && 1 < linearGain * peak)
+				linearGain = 1 / peak;
+		}
+
+		LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Applying gain of " << (20 * std::log10(linearGain)) << " dB to \"" << mDecoder->GetURL() << "\"");
+
+		mGainStage.Reset(linearGain, limit, outputFormat.mSampleRate);
+	}
+
+	// Apply the decoder's gain to audio converted to the output format
+	void ApplyGain(AudioBufferList *bufferList, UInt32 frameCount)
+	{
+		if(mGainStage.IsActive())
+			mGainStage.Process(bufferList, frameCount);
 	}
 
 	std::unique_ptr<Decoder>	mDecoder;
@@ -112,22 +594,100 @@ public:
 	SInt64						mTimeStamp;
 
 	SInt64						mTotalFrames;
+	bool						mTotalFramesEstimated;	// Accessed only by the decoding thread
 
 	std::atomic_llong			mFramesRendered;
 	std::atomic_llong			mFrameToSeek;
 
 	std::atomic_uint			mFlags;
 
+	uint64_t					mReadTime;		// Host time spent in ReadAudio(UInt32), used to separate decoding from conversion
+
+	std::atomic_ullong			mConversionCPUTime;		// Thread CPU time in nanoseconds spent converting, excluding decoding
+	std::atomic_ullong			mConversionWallTime;	// Host time spent converting, excluding decoding
+
+	AllocationTracker::Counter	mAllocations;	// Allocations made while decoding
+
 private:
 
 	DecoderStateData()
-		: mDecoder(nullptr), mTimeStamp(0), mTotalFrames(0), mFramesRendered(0), mFrameToSeek(-1), mFlags(0)
+		: mDecoder(nullptr), mTimeStamp(0), mTotalFrames(0), mTotalFramesEstimated(false), mReadTime(0), mConversionCPUTime(0), mConversionWallTime(0), mFramesRendered(0), mFrameToSeek(-1), mFlags(0), mPrerollFrameOffset(0), mPrerollFramesAvailable(0), mBorrowedFrameCount(0), mAnalysisComplete(false), mReplayGainLoaded(false), mTrackGain(NAN), mTrackPeak(NAN), mAlbumGain(NAN), mAlbumPeak(NAN), mGainConfigured(false)
 	{}
 
+	BufferList					mPrerollBufferList;
+	UInt32						mPrerollFrameOffset;
+	UInt32						mPrerollFramesAvailable;
+
+	UInt32						mBorrowedFrameCount;	// Frames lent by the decoder to the converter
+
+	AnalysisTap::unique_ptr		mAnalysisTap;
+	bool						mAnalysisComplete;
+
+	bool						mReplayGainLoaded;
+	float						mTrackGain;
+	float						mTrackPeak;
+	float						mAlbumGain;
+	float						mAlbumPeak;
+
+	bool						mGainConfigured;
+	GainStage					mGainStage;
+
+};
+
+// ========================================
+// Marks the calling thread as a reader of decoder states for the guard's lifetime
+// A decoder state removed from the timeline is freed only after every guard that could have seen it is destroyed
+class SFB::Audio::Player::DecoderStateEpochGuard
+{
+
+public:
+
+	explicit DecoderStateEpochGuard(const Player& player)
+		: mPlayer(player), mEpoch(0)
+	{
+		// If the epoch advanced before this reader was counted the reader must join the new epoch
+		for(;;) {
+			mEpoch = mPlayer.mReclamationEpoch.load();
+			mPlayer.mEpochReaderCounts[mEpoch & 1].fetch_add(1);
+
+			if(mEpoch == mPlayer.mReclamationEpoch.load())
+				break;
+
+			mPlayer.mEpochReaderCounts[mEpoch & 1].fetch_sub(1);
+		}
+	}
+
+	~DecoderStateEpochGuard()
+	{
+		mPlayer.mEpochReaderCounts[mEpoch & 1].fetch_sub(1);
+	}
+
+	DecoderStateEpochGuard(const DecoderStateEpochGuard& rhs) = delete;
+	DecoderStateEpochGuard& operator=(const DecoderStateEpochGuard& rhs) = delete;
+
+private:
+
+	const Player&	mPlayer;
+	unsigned int	mEpoch;
+
 };
 
 namespace {
 
+	// ========================================
+	// An asynchronous enqueue awaiting its decoder
+	struct PendingEnqueue
+	{
+		SFB::Audio::Player::EnqueueTicket				mTicket;
+		unsigned long long								mGeneration;
+		bool											mPlay;
+		SFB::CFURL										mURL;
+		SFB::Audio::Player::EnqueueCompletionBlock		mBlock;
+		SFB::Audio::Decoder::unique_ptr					mDecoder;
+		SFB::CFError									mError;
+		dispatch_semaphore_t							mCreated;		// Signaled when creation finishes or is skipped
+	};
+
 	// ========================================
 	// Set the calling thread's timesharing and importance
 	bool setThreadPolicy(integer_t importance)
@@ -162,8 +722,100 @@ namespace {
 
 		return true;
 	}
+
+	// ========================================
+	// Make the calling thread a real-time thread expected to run for computationFraction of every period
+	bool setTimeConstraintPolicy(uint64_t periodNanos, double computationFraction)
+	{
+		auto period = ConvertNanosToHostTime(periodNanos);
+		thread_time_constraint_policy_data_t timeConstraintPolicy = {
+			.period			= (uint32_t)period,
+			.computation	= (uint32_t)(period * computationFraction),
+			.constraint		= (uint32_t)period,
+			.preemptible	= true
+		};
+
+		kern_return_t error = thread_policy_set(mach_thread_self(),
+												THREAD_TIME_CONSTRAINT_POLICY,
+												(thread_policy_t)&timeConstraintPolicy,
+												THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+
+		if(KERN_SUCCESS != error) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Couldn't set thread's time constraint policy: " << mach_error_string(error));
+			return false;
+		}
+
+		return true;
+	}
 }
 
+// ========================================
+// The workgroup joined by the decoding thread
+// ========================================
+class SFB::Audio::Player::DecoderThreadScheduling
+{
+
+public:
+
+	DecoderThreadScheduling()
+		: mGeneration(0)
+#if __has_include(<os/workgroup.h>)
+		, mWorkgroup(nullptr)
+#endif
+	{}
+
+	~DecoderThreadScheduling()
+	{
+		LeaveWorkgroup();
+	}
+
+	DecoderThreadScheduling(const DecoderThreadScheduling& rhs) = delete;
+	DecoderThreadScheduling& operator=(const DecoderThreadScheduling& rhs) = delete;
+
+#if __has_include(<os/workgroup.h>)
+	// Join workgroup, taking ownership of it
+	void JoinWorkgroup(os_workgroup_t workgroup) API_AVAILABLE(macos(11.0), ios(14.0))
+	{
+		LeaveWorkgroup();
+
+		if(nullptr == workgroup)
+			return;
+
+		int result = os_workgroup_join(workgroup, &mJoinToken);
+		if(result) {
+			LOGGER_WARNING("org.sbooth.AudioEngine.Player", "os_workgroup_join failed: " << result);
+			os_release(workgroup);
+			return;
+		}
+
+		mWorkgroup = workgroup;
+	}
+#endif
+
+	void LeaveWorkgroup()
+	{
+#if __has_include(<os/workgroup.h>)
+		if(__builtin_available(macOS 11.0, iOS 14.0, *)) {
+			if(mWorkgroup) {
+				os_workgroup_leave(mWorkgroup, &mJoinToken);
+				os_release(mWorkgroup);
+				mWorkgroup = nullptr;
+			}
+		}
+#endif
+	}
+
+	unsigned int				mGeneration;
+
+private:
+
+#if __has_include(<os/workgroup.h>)
+	os_workgroup_t				mWorkgroup;
+	os_workgroup_join_token_s	mJoinToken;
+#endif
+
+};
+
 namespace {
 
 	// ========================================
@@ -182,9 +834,27 @@ namespace {
 		assert(nullptr != ioNumberDataPackets);
 
 		auto decoderStateData = static_cast<SFB::Audio::Player::DecoderStateData *>(inUserData);
-		UInt32 framesRead = decoderStateData->ReadAudio(*ioNumberDataPackets);
 
-		// Point ioData at our decoded audio
+		// Audio lent by the decoder is converted in place, avoiding a copy into mBufferList
+		const AudioBufferList *bufferList = nullptr;
+		UInt32 framesRead = *ioNumberDataPackets;
+		// At end of stream the decoder lends nothing and the audio is read as usual
+		if(decoderStateData->BorrowAudio(bufferList, framesRead) && nullptr != bufferList && 0 < framesRead) {
+			UInt32 byteCount = (UInt32)decoderStateData->mDecoder->GetFormat().FrameCountToByteCount(framesRead);
+			ioData->mNumberBuffers = bufferList->mNumberBuffers;
+			for(UInt32 bufferIndex = 0; bufferIndex < ioData->mNumberBuffers; ++bufferIndex) {
+				ioData->mBuffers[bufferIndex] = bufferList->mBuffers[bufferIndex];
+				ioData->mBuffers[bufferIndex].mDataByteSize = byteCount;
+			}
+
+			*ioNumberDataPackets = framesRead;
+
+			return noErr;
+		}
+
+		framesRead = decoderStateData->ReadAudio(*ioNumberDataPackets);
+
+		// Point ioData at our decoded audio
 		ioData->mNumberBuffers = decoderStateData->mBufferList->mNumberBuffers;
 		for(UInt32 bufferIndex = 0; bufferIndex < decoderStateData->mBufferList->mNumberBuffers; ++bufferIndex)
 			ioData->mBuffers[bufferIndex] = decoderStateData->mBufferList->mBuffers[bufferIndex];
@@ -196,18 +866,231 @@ namespace {
 
 }
 
+// ========================================
+// A voice slot, holding a decoder mixed into the output in addition to the playlist
+// ========================================
+class SFB::Audio::Player::VoiceData
+{
+
+public:
+
+	VoiceData()
+		: mState(eVoiceStateFree), mFlags(0), mID(0), mGain(1), mPan(0), mConverter(nullptr)
+	{}
+
+	~VoiceData()
+	{
+		Release();
+	}
+
+	VoiceData(const VoiceData& rhs) = delete;
+	VoiceData& operator=(const VoiceData& rhs) = delete;
+
+	// Create the converter and ring buffer for rendering decoder in outputFormat
+	bool Prepare(Decoder::unique_ptr decoder, const AudioFormat& outputFormat, bool lockMemory)
+	{
+		AudioFormat decoderFormat = decoder->GetFormat();
+
+		mDecoderState = std::unique_ptr<DecoderStateData>(new DecoderStateData(std::move(decoder)));
+		if(!mDecoderState->AllocateBufferList(VOICE_WRITE_CHUNK_SIZE_FRAMES))
+			return false;
+
+		auto result = AudioConverterNew(&decoderFormat, &outputFormat, &mConverter);
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterNew failed: " << result);
+			mConverter = nullptr;
+			return false;
+		}
+
+		mRingBuffer.SetMemoryLocked(lockMemory);
+		if(!mRingBuffer.Allocate(outputFormat, VOICE_RING_BUFFER_CAPACITY_FRAMES))
+			return false;
+
+		mFlags.store(0);
+
+		return true;
+	}
+
+	// Convert audio into the ring buffer until it is full or the decoder is exhausted
+	void Fill()
+	{
+		while(!(eVoiceFlagDecodingFinished & mFlags.load()) && VOICE_WRITE_CHUNK_SIZE_FRAMES <= mRingBuffer.GetFramesAvailableToWrite()) {
+			// The converter writes directly into the ring buffer
+			auto writeVector = mRingBuffer.GetWriteVector();
+			auto bufferList = writeVector.first.mBufferList;
+
+			UInt32 frameCount = (UInt32)std::min(writeVector.first.mFrameCapacity, (size_t)VOICE_WRITE_CHUNK_SIZE_FRAMES);
+			UInt32 byteCount = (UInt32)mRingBuffer.GetFormat().FrameCountToByteCount(frameCount);
+			for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
+				bufferList->mBuffers[bufferIndex].mDataByteSize = byteCount;
+
+			auto result = AudioConverterFillComplexBuffer(mConverter, myAudioConverterComplexInputDataProc, mDecoderState.get(), &frameCount, bufferList, nullptr);
+			if(noErr != result)
+				LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterFillComplexBuffer failed: " << result);
+
+			if(0 < frameCount)
+				mRingBuffer.WriteAdvance(frameCount);
+
+			if(noErr != result || 0 == frameCount)
+				mFlags.fetch_or(eVoiceFlagDecodingFinished);
+		}
+	}
+
+	void Release()
+	{
+		if(mConverter) {
+			auto result = AudioConverterDispose(mConverter);
+			if(noErr != result)
+				LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterDispose failed: " << result);
+			mConverter = nullptr;
+		}
+
+		mDecoderState.reset();
+		mRingBuffer.Deallocate();
+
+		mFlags.store(0);
+		mID.store(0);
+	}
+
+	std::atomic_uint					mState;
+	std::atomic_uint					mFlags;
+	std::atomic_ullong					mID;
+
+	std::atomic<float>					mGain;
+	std::atomic<float>					mPan;
+
+	RingBuffer							mRingBuffer;
+
+private:
+
+	std::unique_ptr<DecoderStateData>	mDecoderState;
+	AudioConverterRef					mConverter;
+
+};
+
+namespace {
+
+	// Fan-out outputs resample non-interleaved native floats
+	bool IsFanOutFormat(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && format.IsNativeEndian() && !format.IsInterleaved();
+	}
+
+}
+
+// ========================================
+// State for an output rendering the player's ring buffer with an additional cursor
+// Audio is carried across to the output's clock by a ClockBridge so the audio buffered for the output
+// tracks the audio buffered for the player's output as the devices' clocks drift
+class SFB::Audio::Player::FanOutData
+{
+
+public:
+
+	FanOutData()
+		: mActive(false), mRenderingCount(0), mRingBuffer(nullptr), mReader(0)
+	{}
+
+	FanOutData(const FanOutData& rhs) = delete;
+	FanOutData& operator=(const FanOutData& rhs) = delete;
+
+	// Prepare to resample audio in ringBufferFormat for the output; the output must not be rendering
+	bool Configure(const AudioFormat& ringBufferFormat)
+	{
+		const auto& outputFormat = mOutput->GetFormat();
+		if(!IsFanOutFormat(ringBufferFormat) || !IsFanOutFormat(outputFormat) || ringBufferFormat.mChannelsPerFrame != outputFormat.mChannelsPerFrame) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "Fan-out output format " << outputFormat << " isn't compatible with " << ringBufferFormat);
+			return false;
+		}
+
+		return mClockBridge.Configure(ringBufferFormat, outputFormat.mSampleRate);
+	}
+
+	// Prevent rendering and wait for a render cycle in progress to complete
+	void Deactivate()
+	{
+		mActive.store(false);
+		while(0 != mRenderingCount.load())
+			std::this_thread::yield();
+	}
+
+	// Resample audio read by the reader's cursor
+	// outputSampleRate and outputFramesBuffered are the measured sample rate of and the audio buffered for the player's output
+	void Render(RingBuffer& ringBuffer, size_t reader, AudioBufferList *bufferList, UInt32 frameCount, const AudioTimeStamp *timeStamp, Float64 outputSampleRate, size_t outputFramesBuffered)
+	{
+		mRingBuffer = &ringBuffer;
+		mReader = reader;
+		mClockBridge.Render(bufferList, frameCount, timeStamp, outputSampleRate, ringBuffer.GetFramesAvailableToRead(reader), outputFramesBuffered, ReadInput, this);
+		mRingBuffer = nullptr;
+	}
+
+	static void RenderSilence(AudioBufferList *bufferList)
+	{
+		for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+			memset(bufferList->mBuffers[i].mData, 0, bufferList->mBuffers[i].mDataByteSize);
+	}
+
+	Output::unique_ptr					mOutput;
+	std::atomic_bool					mActive;			// Whether the output's cursor is enabled and it may render
+	std::atomic_uint					mRenderingCount;	// Render cycles in progress
+
+private:
+
+	static size_t ReadInput(void *context, AudioBufferList *bufferList, size_t frameOffset, size_t frameCount)
+	{
+		auto fanOut = static_cast<FanOutData *>(context);
+		return fanOut->mRingBuffer->ReadAudio(fanOut->mReader, bufferList, frameOffset, frameCount);
+	}
+
+	ClockBridge							mClockBridge;
+
+	// The cursor being rendered
+	RingBuffer							*mRingBuffer;
+	size_t								mReader;
+
+};
+
 #pragma mark Creation/Destruction
 
 SFB::Audio::Player::Player()
-	: mRingBuffer(new RingBuffer), mRingBufferCapacity(RING_BUFFER_CAPACITY_FRAMES), mRingBufferWriteChunkSize(RING_BUFFER_WRITE_CHUNK_SIZE_FRAMES), mFlags(0), mQueue(nullptr), mFramesDecoded(0), mFramesRendered(0), mOutput(new CoreAudioOutput), mDecoderErrorBlock(nullptr), mFormatMismatchBlock(nullptr), mErrorBlock(nullptr)
+	: Player(nullptr, ACTIVE_DECODER_CAPACITY)
+{}
+
+SFB::Audio::Player::Player(size_t activeDecoderCapacity)
+	: Player(nullptr, activeDecoderCapacity)
+{}
+
+SFB::Audio::Player::Player(DecoderPool& decoderPool)
+	: Player(&decoderPool, ACTIVE_DECODER_CAPACITY)
+{}
+
+SFB::Audio::Player::Player(DecoderPool& decoderPool, size_t activeDecoderCapacity)
+	: Player(&decoderPool, activeDecoderCapacity)
+{}
+
+SFB::Audio::Player::Player(DecoderPool *decoderPool, size_t activeDecoderCapacity)
+	: mRingBuffer(new RingBuffer), mStandbyRingBuffer(new RingBuffer), mRingBufferCapacity(RING_BUFFER_CAPACITY_FRAMES), mRingBufferWriteChunkSize(RING_BUFFER_WRITE_CHUNK_SIZE_FRAMES), mActiveRingBufferWriteChunkSize(RING_BUFFER_WRITE_CHUNK_SIZE_FRAMES), mAdaptiveRingBufferSizing(false), mCompactRingBufferStorage(false), mRingBufferTargetDepth(RING_BUFFER_TARGET_DEPTH_SECONDS), mDecodeLoad(0), mPrebufferTime(0), mInputReadAheadTime(0), mCrossfadeDuration(0), mCrossfadeCurve(CrossfadeCurve::EqualPower), mReplayGainMode(ReplayGainMode::Disabled), mReplayGainPreamp(0), mPeakLimiterEnabled(false), mAutomaticOutputBufferSizing(false), mOutputBufferAdjustmentCount(0), mLastOutputBufferAdjustmentTime(0), mFlags(0), mQueuedDecoderCount(0), mPrerollQueue(nullptr), mPrerolledDecoderState(nullptr), mPrerollInProgress(false), mPrerollGeneration(0), mCancelledDecoderCount(0), mCancelledDecoderCollectorCount(0), mCancelledDecodersReturned(nullptr), mWarmUpQueue(nullptr), mQueueWarmUpCount(DEFAULT_QUEUE_WARM_UP_COUNT), mRemoteDecoding(false), mActiveDecoderCapacity(0), mTimelineHead(0), mTimelineTail(0), mQueue(nullptr), mCommandQueue(nullptr), mSeekCommandGeneration(0), mSeekCompletionPending(false), mPendingSeekCompletion(nullptr), mStateSnapshotRequested(false), mStateSnapshotCreated(nullptr), mStateSnapshot(nullptr), mDecoderCreationQueue(nullptr), mDecoderCreationSemaphore(nullptr), mDecoderCreationGroup(nullptr), mNextEnqueueTicket(1), mEnqueueGeneration(0), mScrubbing(false), mScrubFrame(-1), mSpuriousWakeupCount(0), mOfflineDecodingQoSClass(DEFAULT_OFFLINE_DECODING_QOS_CLASS), mDecoderSchedulingGeneration(0), mRenderEventQueue(new SFB::RingBuffer), mRenderEventSource(nullptr), mRenderUnderrunFrames(0), mRenderUserBlockTime(0), mDroppedRenderEventCount(0), mMemoryPressureSource(nullptr), mLowMemoryMode(false), mMemoryPressureEventCount(0), mRingBufferBytes(0), mStandbyRingBufferBytes(0), mLockedRingBufferBytes(0), mMemoryLocking(false), mLowPowerMode(false), mLowPowerBufferDuration(LOW_POWER_BUFFER_DURATION_SECONDS), mNormalOutputBufferFrameSize(0), mAutomaticOutputSuspension(false), mOutputSuspensionDelay(DEFAULT_OUTPUT_SUSPENSION_DELAY_SECONDS), mOutputSuspended(false), mOutputSuspensionCount(0), mSilentFrameCount(0), mRenderCycleCount(0), mRingBufferFillSum(0), mMinimumRingBufferFill(UINT_MAX), mUnderrunCount(0), mUnderrunFrameCount(0), mDecodeChunkCount(0), mDecodeChunkTime(0), mMaximumDecodeChunkTime(0), mConverterTime(0), mDecoderOpenCount(0), mDecoderOpenTime(0), mMaximumDecoderOpenTime(0), mStartupHostTime(0), mStartupLatency(-1), mLastTrackAllocationCount(0), mDecoderWakeupCount(0), mStatisticsStartHostTime(mach_absolute_time()), mSnapshotSequence(0), mSnapshotCurrentFrame(-1), mSnapshotTotalFrames(-1), mSnapshotSampleRate(0), mSnapshotHostTime(0), mSnapshotAudibleHostTime(0), mOutputLatency(0), mSnapshotURL(nullptr), mSnapshotRepresentedObject(nullptr), mDecoderPool(decoderPool), mDecoderPoolRunnable(false), mDecoderPoolServicing(false), mDecodingState(nullptr), mPendingDecoderState(nullptr), mAudioConverter(nullptr), mDecodingWriteChunkSize(0), mCrossfadeState(nullptr), mCrossfadeConverter(nullptr), mCrossfadeFrameCount(0), mCrossfadeFramesMixed(0), mCrossfadeGeneration(0), mCollector(nullptr), mReclamationEpoch(0), mPendingReclamationCount(0), mScheduledStartHostTime(0), mScheduledStartSampleTime(-1), mFramesDecoded(0), mFramesRendered(0), mVoices(new VoiceData [kMaximumVoiceCount]), mActiveVoiceCount(0), mNextVoiceID(0), mVoiceQueue(nullptr), mVoiceSource(nullptr), mMeteringEnabled(false), mSpectrumAnalysisEnabled(false), mRateSegmentQueue(new SFB::RingBuffer), mRingBufferFramesWritten(0), mRingBufferFramesRead(0), mRenderRateSegment(), mRenderRateSegmentOffset(0), mOutput(new CoreAudioOutput), mFanOutOutputs(new FanOutData [kMaximumFanOutOutputCount]), mFanOutOutputCount(0), mDecoderErrorBlock(nullptr), mFormatMismatchBlock(nullptr), mErrorBlock(nullptr), mAnalysisTapBlock(nullptr)
 {
 	memset(&mDecoderEventBlocks, 0, sizeof(mDecoderEventBlocks));
 	memset(&mRenderEventBlocks, 0, sizeof(mRenderEventBlocks));
 
+	mEpochReaderCounts[0].store(0);
+	mEpochReaderCounts[1].store(0);
+
+	for(auto& count : mDecodeTimeHistogram)
+		count.store(0);
+
 	// ========================================
-	// Initialize the decoder array
-	for(UInt32 bufferIndex = 0; bufferIndex < kActiveDecoderArraySize; ++bufferIndex)
-		mActiveDecoders[bufferIndex].store(nullptr);
+	// Initialize the decoder timeline
+	if(0 == activeDecoderCapacity) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "Invalid active decoder capacity");
+		throw std::runtime_error("Invalid active decoder capacity");
+	}
+
+	mActiveDecoderCapacity = NextPowerOfTwo(activeDecoderCapacity);
+	mActiveDecoders = std::unique_ptr<std::atomic<DecoderStateData *> []>(new std::atomic<DecoderStateData *> [mActiveDecoderCapacity]);
+	for(size_t slotIndex = 0; slotIndex < mActiveDecoderCapacity; ++slotIndex)
+		mActiveDecoders[slotIndex].store(nullptr);
 
 	mQueue = dispatch_queue_create("org.sbooth.AudioEngine.Player", DISPATCH_QUEUE_SERIAL);
 	if(nullptr == mQueue) {
@@ -215,43 +1098,145 @@ SFB::Audio::Player::Player()
 		throw std::runtime_error("Unable to create the dispatch queue");
 	}
 
+	mPrerollQueue = dispatch_queue_create("org.sbooth.AudioEngine.Player.Preroll", DISPATCH_QUEUE_SERIAL);
+	if(nullptr == mPrerollQueue) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "dispatch_queue_create failed");
+		throw std::runtime_error("Unable to create the dispatch queue");
+	}
+
+	dispatch_set_target_queue(mPrerollQueue, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+
+	mCommandQueue = dispatch_queue_create("org.sbooth.AudioEngine.Player.Commands", DISPATCH_QUEUE_SERIAL);
+	if(nullptr == mCommandQueue) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "dispatch_queue_create failed");
+		throw std::runtime_error("Unable to create the dispatch queue");
+	}
+
+	// Decoders for asynchronous enqueues are created a few at a time
+	mDecoderCreationQueue = dispatch_queue_create("org.sbooth.AudioEngine.Player.DecoderCreation", DISPATCH_QUEUE_SERIAL);
+	mDecoderCreationSemaphore = dispatch_semaphore_create(MAXIMUM_CONCURRENT_DECODER_CREATIONS);
+	mDecoderCreationGroup = dispatch_group_create();
+	if(nullptr == mDecoderCreationQueue || nullptr == mDecoderCreationSemaphore || nullptr == mDecoderCreationGroup) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "Unable to create the decoder creation dispatch objects");
+		throw std::runtime_error("Unable to create the dispatch queue");
+	}
+
+	mStateSnapshotCreated = dispatch_semaphore_create(0);
+	if(nullptr == mStateSnapshotCreated) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "dispatch_semaphore_create failed");
+		throw std::runtime_error("Unable to create the dispatch semaphore");
+	}
+
+	mCancelledDecodersReturned = dispatch_semaphore_create(0);
+	if(nullptr == mCancelledDecodersReturned) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "dispatch_semaphore_create failed");
+		throw std::runtime_error("Unable to create the dispatch semaphore");
+	}
+
+	mWarmUpQueue = dispatch_queue_create("org.sbooth.AudioEngine.Player.WarmUp", DISPATCH_QUEUE_SERIAL);
+	if(nullptr == mWarmUpQueue) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "dispatch_queue_create failed");
+		throw std::runtime_error("Unable to create the dispatch queue");
+	}
+
+	dispatch_set_target_queue(mWarmUpQueue, dispatch_get_global_queue(QOS_CLASS_BACKGROUND, 0));
+
 	// ========================================
-	// Launch the decoding thread
-	try {
-		mDecoderThread = std::thread(&Player::DecoderThreadEntry, this);
+	// Set up the render event queue
+	if(!mRenderEventQueue->Allocate(RENDER_EVENT_QUEUE_CAPACITY_EVENTS * sizeof(RenderEvent))) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "Unable to allocate the render event queue");
+		throw std::bad_alloc();
 	}
 
-	catch(const std::exception& e) {
-		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "Unable to create decoder thread: " << e.what());
+	// Set up the rate segment queue
+	if(!mRateSegmentQueue->Allocate(RATE_SEGMENT_QUEUE_CAPACITY_SEGMENTS * sizeof(RateSegment))) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "Unable to allocate the rate segment queue");
+		throw std::bad_alloc();
+	}
 
-		throw;
+	// Events are processed on mQueue so they are serialized with output and ring buffer manipulation
+	mRenderEventSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_OR, 0, 0, mQueue);
+	if(nullptr == mRenderEventSource) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "dispatch_source_create failed");
+		throw std::runtime_error("Unable to create the render event dispatch source");
 	}
 
+	dispatch_source_set_event_handler(mRenderEventSource, ^{
+		ProcessRenderEvents();
+	});
+
+	dispatch_resume(mRenderEventSource);
+
 	// ========================================
-	// Setup the collector
-	mCollector = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_global_queue(QOS_CLASS_BACKGROUND, 0));
-	dispatch_source_set_timer(mCollector, DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC, 1 * NSEC_PER_SEC);
+	// Respond to memory pressure on mQueue so it is serialized with pre-roll and the decoder queue
+	// The player works without the source, so failure isn't fatal
+	mMemoryPressureSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE, 0, DISPATCH_MEMORYPRESSURE_NORMAL | DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL, mQueue);
+	if(nullptr == mMemoryPressureSource)
+		LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Unable to create the memory pressure dispatch source");
+	else {
+		dispatch_source_set_event_handler(mMemoryPressureSource, ^{
+			unsigned long pressure = dispatch_source_get_data(mMemoryPressureSource);
+			mMemoryPressureEventCount.fetch_add(1);
+
+			bool lowMemory = !(DISPATCH_MEMORYPRESSURE_NORMAL & pressure);
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Memory pressure " << (DISPATCH_MEMORYPRESSURE_CRITICAL & pressure ? "critical" : (lowMemory ? "warning" : "normal")));
+
+			ApplyLowMemoryMode(lowMemory);
+		});
 
-	dispatch_source_set_event_handler(mCollector, ^{
-		for(UInt32 bufferIndex = 0; bufferIndex < kActiveDecoderArraySize; ++bufferIndex) {
-			DecoderStateData *decoderState = mActiveDecoders[bufferIndex].load();
+		dispatch_resume(mMemoryPressureSource);
+	}
 
-			if(nullptr == decoderState)
-				continue;
+	// ========================================
+	// Set up voice decoding
+	// Voice ring buffers are small so they are refilled promptly
+	mVoiceQueue = dispatch_queue_create("org.sbooth.AudioEngine.Player.Voices", DISPATCH_QUEUE_SERIAL);
+	if(nullptr == mVoiceQueue) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "dispatch_queue_create failed");
+		throw std::runtime_error("Unable to create the dispatch queue");
+	}
 
-			auto flags = decoderState->mFlags.load();
+	dispatch_set_target_queue(mVoiceQueue, dispatch_get_global_queue(QOS_CLASS_USER_INTERACTIVE, 0));
 
-			if(!(eDecoderStateDataFlagDecodingFinished & flags) || !(eDecoderStateDataFlagRenderingFinished & flags))
-				continue;
+	mVoiceSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_OR, 0, 0, mVoiceQueue);
+	if(nullptr == mVoiceSource) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "dispatch_source_create failed");
+		throw std::runtime_error("Unable to create the voice dispatch source");
+	}
 
-			bool swapSucceeded = mActiveDecoders[bufferIndex].compare_exchange_strong(decoderState, nullptr);
+	dispatch_source_set_event_handler(mVoiceSource, ^{
+		ServiceVoices();
+	});
 
-			if(swapSucceeded) {
-				LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Collecting decoder: \"" << decoderState->mDecoder->GetURL() << "\"");
-				delete decoderState;
-				decoderState = nullptr;
-			}
+	dispatch_resume(mVoiceSource);
+
+	// ========================================
+	// Launch the decoding thread unless decoding is performed by a pool
+	if(nullptr == mDecoderPool) {
+		try {
+			mDecoderThread = std::thread(&Player::DecoderThreadEntry, this);
+		}
+
+		catch(const std::exception& e) {
+			LOGGER_CRIT("org.sbooth.AudioEngine.Player", "Unable to create decoder thread: " << e.what());
+
+			throw;
 		}
+	}
+
+	// ========================================
+	// Setup the collector
+	// Collection is requested when a decoder state finishes and retried while readers prevent reclamation
+	mCollector = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, mQueue);
+	if(nullptr == mCollector) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "dispatch_source_create failed");
+		throw std::runtime_error("Unable to create the collector dispatch source");
+	}
+
+	dispatch_source_set_timer(mCollector, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+
+	dispatch_source_set_event_handler(mCollector, ^{
+		CollectDecoderStates();
 	});
 
 	// Start collecting
@@ -264,41 +1249,130 @@ SFB::Audio::Player::Player()
 		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "OpenOutput() failed");
 		throw std::runtime_error("OpenOutput() failed");
 	}
+
+	// ========================================
+	// Begin servicing from the decoder pool
+	if(mDecoderPool)
+		mDecoderPool->AddPlayer(this);
 }
 
 SFB::Audio::Player::~Player()
 {
+	// Cancel asynchronous enqueues and wait for creations in progress
+	mEnqueueGeneration.fetch_add(1);
+	dispatch_sync(mDecoderCreationQueue, ^{});
+	dispatch_group_wait(mDecoderCreationGroup, DISPATCH_TIME_FOREVER);
+
+	// Perform any outstanding commands
+	dispatch_sync(mCommandQueue, ^{});
+
+	dispatch_release(mDecoderCreationQueue);
+	mDecoderCreationQueue = nullptr;
+	dispatch_release(mDecoderCreationSemaphore);
+	mDecoderCreationSemaphore = nullptr;
+	dispatch_release(mDecoderCreationGroup);
+	mDecoderCreationGroup = nullptr;
+
+	dispatch_release(mStateSnapshotCreated);
+	mStateSnapshotCreated = nullptr;
+
 	Stop();
 
 	// Stop the processing graph and reclaim its resources
 	if(!mOutput->Close())
 		LOGGER_ERR("org.sbooth.AudioEngine.Player", "CloseOutput() failed");
 
-	// End the decoding thread
+	for(size_t i = 0; i < kMaximumFanOutOutputCount; ++i) {
+		if(mFanOutOutputs[i].mOutput)
+			RemoveFanOutOutput(mFanOutOutputs[i].mOutput.get());
+	}
+
+	// Stop servicing voices; their resources are released with mVoices
+	dispatch_source_cancel(mVoiceSource);
+	dispatch_sync(mVoiceQueue, ^{});
+	dispatch_release(mVoiceSource);
+	mVoiceSource = nullptr;
+
+	dispatch_release(mVoiceQueue);
+	mVoiceQueue = nullptr;
+
+	// End decoding
 	mFlags.fetch_or(eAudioPlayerFlagStopDecoding);
-	mDecoderSemaphore.Signal();
 
-	try {
-		mDecoderThread.join();
+	if(mDecoderPool) {
+		// Once removed no pool thread is servicing this player
+		mDecoderPool->RemovePlayer(this);
+
+		EndDecoding();
+
+		delete mPendingDecoderState;
+		mPendingDecoderState = nullptr;
 	}
+	else {
+		mDecoderEvent.Signal();
+
+		try {
+			mDecoderThread.join();
+		}
 
-	catch(const std::exception& e) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to join decoder thread: " << e.what());
+		catch(const std::exception& e) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to join decoder thread: " << e.what());
+		}
 	}
 
-	// Stop collecting
+	if(mMemoryPressureSource)
+		dispatch_source_cancel(mMemoryPressureSource);
+
+	// Stop collecting and wait for a collection in progress to complete
+	dispatch_source_cancel(mCollector);
+	dispatch_sync(mQueue, ^{});
 	dispatch_release(mCollector);
 	mCollector = nullptr;
 
+	if(mMemoryPressureSource) {
+		dispatch_release(mMemoryPressureSource);
+		mMemoryPressureSource = nullptr;
+	}
+
+	dispatch_source_cancel(mRenderEventSource);
+	dispatch_release(mRenderEventSource);
+	mRenderEventSource = nullptr;
+
+	// Wait for any pre-roll or warm-up in progress to complete
+	dispatch_sync(mPrerollQueue, ^{});
+	dispatch_release(mPrerollQueue);
+	mPrerollQueue = nullptr;
+
+	dispatch_sync(mWarmUpQueue, ^{});
+	dispatch_release(mWarmUpQueue);
+	mWarmUpQueue = nullptr;
+
+	dispatch_release(mCancelledDecodersReturned);
+	mCancelledDecodersReturned = nullptr;
+
+	// A seek completion may have been posted by the decoding thread
+	dispatch_sync(mCommandQueue, ^{
+		CompletePendingSeek(false);
+	});
+	dispatch_release(mCommandQueue);
+	mCommandQueue = nullptr;
+
+	delete mPrerolledDecoderState;
+	mPrerolledDecoderState = nullptr;
+
 	dispatch_release(mQueue);
 	mQueue = nullptr;
 
 	// Force any decoders left hanging by the collector to end
-	for(UInt32 bufferIndex = 0; bufferIndex < kActiveDecoderArraySize; ++bufferIndex) {
-		if(nullptr != mActiveDecoders[bufferIndex])
-			delete mActiveDecoders[bufferIndex].exchange(nullptr);
+	for(size_t slotIndex = 0; slotIndex < mActiveDecoderCapacity; ++slotIndex) {
+		if(nullptr != mActiveDecoders[slotIndex])
+			delete mActiveDecoders[slotIndex].exchange(nullptr);
 	}
 
+	for(auto& retiredDecoderState : mRetiredDecoderStates)
+		delete retiredDecoderState.first;
+	mRetiredDecoderStates.clear();
+
 	// Free the block callbacks
 	if(mDecoderEventBlocks[0]) {
 		Block_release(mDecoderEventBlocks[0]);
@@ -316,6 +1390,10 @@ SFB::Audio::Player::~Player()
 		Block_release(mDecoderEventBlocks[3]);
 		mDecoderEventBlocks[3] = nullptr;
 	}
+	if(mDecoderEventBlocks[4]) {
+		Block_release(mDecoderEventBlocks[4]);
+		mDecoderEventBlocks[4] = nullptr;
+	}
 
 	if(mDecoderErrorBlock) {
 		Block_release(mDecoderErrorBlock);
@@ -340,6 +1418,11 @@ SFB::Audio::Player::~Player()
 		Block_release(mErrorBlock);
 		mErrorBlock = nullptr;
 	}
+
+	if(mAnalysisTapBlock) {
+		Block_release(mAnalysisTapBlock);
+		mAnalysisTapBlock = nullptr;
+	}
 }
 
 #pragma mark Playback Control
@@ -349,10 +1432,18 @@ bool SFB::Audio::Player::Play()
 	if(mOutput->IsRunning())
 		return true;
 
+	if(mOutputSuspended.load()) {
+		ResumeSuspendedOutput();
+		return true;
+	}
+
 	// We don't want to start output in the middle of a buffer modification
 	__block bool result = false;
 	dispatch_sync(mQueue, ^{
+		mSilentFrameCount.store(0, std::memory_order_relaxed);
 		result = mOutput->Start();
+		if(result)
+			StartFanOutOutputs();
 	});
 
 	return result;
@@ -360,8 +1451,26 @@ bool SFB::Audio::Player::Play()
 
 bool SFB::Audio::Player::Pause()
 {
-	if(mOutput->IsRunning())
-		return mOutput->Stop();
+	// Suspended output is paused by not resuming it
+	__block bool wasSuspended = false;
+	dispatch_sync(mQueue, ^{
+		wasSuspended = mOutputSuspended.exchange(false);
+	});
+
+	if(wasSuspended)
+		return true;
+
+	if(mOutput->IsRunning()) {
+		bool result = mOutput->Stop();
+		dispatch_sync(mQueue, ^{
+			StopFanOutOutputs();
+		});
+
+		// Wake any thread waiting on the rendering thread, which will no longer run
+		mSemaphore.Signal();
+
+		return result;
+	}
 
 	return true;
 }
@@ -370,16 +1479,25 @@ bool SFB::Audio::Player::Stop()
 {
 	__block bool result = true;
 	dispatch_sync(mQueue, ^{
-		if(mOutput->IsRunning())
+		mOutputSuspended.store(false);
+
+		if(mOutput->IsRunning()) {
 			mOutput->Stop();
+			mSemaphore.Signal();
+		}
 
+		StopFanOutOutputs();
 		StopActiveDecoders();
+		StopVoices();
 
 		if(!mOutput->Reset()) {
 			result = false;
 			return;
 		}
 
+		// Cancel any scheduled start
+		mFlags.fetch_and(~eAudioPlayerFlagScheduledStartPending);
+
 		// Reset the ring buffer
 		mFramesDecoded.store(0);
 		mFramesRendered.store(0);
@@ -392,9 +1510,11 @@ bool SFB::Audio::Player::Stop()
 
 SFB::Audio::Player::PlayerState SFB::Audio::Player::GetPlayerState() const
 {
-	if(mOutput->IsRunning())
+	// Suspended output resumes by itself so the player is still playing
+	if(mOutput->IsRunning() || mOutputSuspended.load())
 		return PlayerState::Playing;
 
+	DecoderStateEpochGuard guard(*this);
 	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
 
 	if(nullptr == currentDecoderState)
@@ -413,22 +1533,20 @@ SFB::Audio::Player::PlayerState SFB::Audio::Player::GetPlayerState() const
 
 CFURLRef SFB::Audio::Player::GetPlayingURL() const
 {
-	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
-
-	if(nullptr == currentDecoderState)
+	PlaybackSnapshot snapshot;
+	if(!GetPlaybackSnapshot(snapshot))
 		return nullptr;
 
-	return currentDecoderState->mDecoder->GetURL();
+	return snapshot.mURL;
 }
 
 void * SFB::Audio::Player::GetPlayingRepresentedObject() const
 {
-	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
-
-	if(nullptr == currentDecoderState)
+	PlaybackSnapshot snapshot;
+	if(!GetPlaybackSnapshot(snapshot))
 		return nullptr;
 
-	return currentDecoderState->mDecoder->GetRepresentedObject();
+	return snapshot.mRepresentedObject;
 }
 
 #pragma mark Block-based callback support
@@ -473,6 +1591,16 @@ void SFB::Audio::Player::SetRenderingFinishedBlock(DecoderEventBlock block)
 		mDecoderEventBlocks[3] = Block_copy(block);
 }
 
+void SFB::Audio::Player::SetTotalFramesRefinedBlock(DecoderEventBlock block)
+{
+	if(mDecoderEventBlocks[4]) {
+		Block_release(mDecoderEventBlocks[4]);
+		mDecoderEventBlocks[4] = nullptr;
+	}
+	if(block)
+		mDecoderEventBlocks[4] = Block_copy(block);
+}
+
 void SFB::Audio::Player::SetOpenDecoderErrorBlock(DecoderErrorBlock block)
 {
 	if(mDecoderErrorBlock) {
@@ -523,6 +1651,16 @@ void SFB::Audio::Player::SetUnsupportedFormatBlock(ErrorBlock block)
 		mErrorBlock = Block_copy(block);
 }
 
+void SFB::Audio::Player::SetAnalysisTapBlock(AnalysisTapBlock block)
+{
+	if(mAnalysisTapBlock) {
+		Block_release(mAnalysisTapBlock);
+		mAnalysisTapBlock = nullptr;
+	}
+	if(block)
+		mAnalysisTapBlock = Block_copy(block);
+}
+
 #pragma mark Playback Properties
 
 bool SFB::Audio::Player::GetCurrentFrame(SInt64& currentFrame) const
@@ -539,6 +1677,7 @@ bool SFB::Audio::Player::GetTotalFrames(SInt64& totalFrames) const
 
 bool SFB::Audio::Player::GetPlaybackPosition(SInt64& currentFrame, SInt64& totalFrames) const
 {
+	DecoderStateEpochGuard guard(*this);
 	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
 
 	if(nullptr == currentDecoderState)
@@ -567,6 +1706,7 @@ bool SFB::Audio::Player::GetTotalTime(CFTimeInterval& totalTime) const
 
 bool SFB::Audio::Player::GetPlaybackTime(CFTimeInterval& currentTime, CFTimeInterval& totalTime) const
 {
+	DecoderStateEpochGuard guard(*this);
 	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
 
 	if(nullptr == currentDecoderState)
@@ -584,57 +1724,174 @@ bool SFB::Audio::Player::GetPlaybackTime(CFTimeInterval& currentTime, CFTimeInte
 	return true;
 }
 
-bool SFB::Audio::Player::GetPlaybackPositionAndTime(SInt64& currentFrame, SInt64& totalFrames, CFTimeInterval& currentTime, CFTimeInterval& totalTime) const
+bool SFB::Audio::Player::GetBufferedInputTime(CFTimeInterval& bufferedTime) const
 {
+	DecoderStateEpochGuard guard(*this);
 	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
 
 	if(nullptr == currentDecoderState)
 		return false;
 
-	SInt64 frameToSeek		= currentDecoderState->mFrameToSeek.load();
-	SInt64 framesRendered	= currentDecoderState->mFramesRendered.load();
+	auto& inputSource = currentDecoderState->mDecoder->GetInputSource();
+
+	InputSource::BufferingStatus status;
+	if(!inputSource.GetBufferingStatus(status))
+		return false;
 
-	currentFrame		= (-1 == frameToSeek ? framesRendered : frameToSeek);
-	totalFrames			= currentDecoderState->mTotalFrames;
-	Float64 sampleRate	= currentDecoderState->mDecoder->GetFormat().mSampleRate;
-	currentTime			= currentFrame / sampleRate;
-	totalTime			= totalFrames / sampleRate;
+	double byteRate = EstimateInputByteRate(inputSource.GetLength(), currentDecoderState->mTotalFrames, currentDecoderState->mDecoder->GetFormat().mSampleRate);
+	bufferedTime = status.mBytesAvailable / byteRate;
 
 	return true;
 }
 
-#pragma mark Seeking
-
-bool SFB::Audio::Player::SeekForward(CFTimeInterval secondsToSkip)
+bool SFB::Audio::Player::GetBufferedAudioTime(CFTimeInterval& bufferedTime) const
 {
-	if(0 > secondsToSkip)
+	Float64 sampleRate = mOutput->GetFormat().mSampleRate;
+	if(0 >= sampleRate)
 		return false;
 
-	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
+	bufferedTime = mRingBuffer->GetFramesAvailableToRead() / sampleRate;
 
-	if(nullptr == currentDecoderState)
+	return true;
+}
+
+bool SFB::Audio::Player::GetPlaybackPositionAndTime(SInt64& currentFrame, SInt64& totalFrames, CFTimeInterval& currentTime, CFTimeInterval& totalTime) const
+{
+	PlaybackSnapshot snapshot;
+	if(!GetPlaybackSnapshot(snapshot))
 		return false;
 
-	SInt64 frameCount		= (SInt64)(secondsToSkip * currentDecoderState->mDecoder->GetFormat().mSampleRate);
+	currentFrame		= snapshot.mCurrentFrame;
+	totalFrames			= snapshot.mTotalFrames;
+	currentTime			= snapshot.GetCurrentTime();
+	totalTime			= snapshot.GetTotalTime();
 
-	SInt64 frameToSeek		= currentDecoderState->mFrameToSeek.load();
-	SInt64 framesRendered	= currentDecoderState->mFramesRendered.load();
+	return true;
+}
 
-	SInt64 currentFrame		= (-1 == frameToSeek ? framesRendered : frameToSeek);
-	SInt64 desiredFrame		= currentFrame + frameCount;
-	SInt64 totalFrames		= currentDecoderState->mTotalFrames;
+#pragma mark Playback Snapshots
 
-	return SeekToFrame(std::min(desiredFrame, totalFrames - 1));
+SInt64 SFB::Audio::Player::PlaybackSnapshot::GetAudibleFrame(uint64_t hostTime) const
+{
+	if(PlayerState::Playing != mPlayerState || 0 >= mSampleRate)
+		return mAudibleFrame;
+
+	// The audible host time is usually in the future since it follows the output's latency
+	double seconds;
+	if(hostTime >= mAudibleHostTime)
+		seconds = ConvertHostTimeToNanos(hostTime - mAudibleHostTime) / (double)NSEC_PER_SEC;
+	else
+		seconds = -(ConvertHostTimeToNanos(mAudibleHostTime - hostTime) / (double)NSEC_PER_SEC);
+
+	SInt64 frame = std::max(mAudibleFrame + (SInt64)(seconds * mSampleRate), (SInt64)0);
+	if(-1 != mTotalFrames)
+		frame = std::min(frame, mTotalFrames);
+
+	return frame;
 }
 
-bool SFB::Audio::Player::SeekBackward(CFTimeInterval secondsToSkip)
+bool SFB::Audio::Player::GetPlaybackSnapshot(PlaybackSnapshot& snapshot) const
 {
-	if(0 > secondsToSkip)
-		return false;
+	// Read the snapshot published by the rendering thread, retrying if it was written concurrently
+	unsigned int sequence;
+	do {
+		sequence = mSnapshotSequence.load(std::memory_order_acquire);
+
+		snapshot.mCurrentFrame			= mSnapshotCurrentFrame.load(std::memory_order_relaxed);
+		snapshot.mTotalFrames			= mSnapshotTotalFrames.load(std::memory_order_relaxed);
+		snapshot.mSampleRate			= mSnapshotSampleRate.load(std::memory_order_relaxed);
+		snapshot.mHostTime				= mSnapshotHostTime.load(std::memory_order_relaxed);
+		snapshot.mAudibleHostTime		= mSnapshotAudibleHostTime.load(std::memory_order_relaxed);
+		snapshot.mURL					= mSnapshotURL.load(std::memory_order_relaxed);
+		snapshot.mRepresentedObject		= mSnapshotRepresentedObject.load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while((sequence & 1) || sequence != mSnapshotSequence.load(std::memory_order_relaxed));
+
+	// A recent snapshot can only have been published while output is running
+	auto now = mach_absolute_time();
+	if(now >= snapshot.mHostTime && PLAYBACK_SNAPSHOT_MAXIMUM_AGE_NSEC > ConvertHostTimeToNanos(now - snapshot.mHostTime)) {
+		snapshot.mPlayerState = PlayerState::Playing;
+		snapshot.mAudibleFrame = snapshot.mCurrentFrame;
+		return 0 < snapshot.mSampleRate;
+	}
+
+	// Otherwise the position isn't changing, so read it from the active decoder
+	snapshot.mPlayerState = GetPlayerState();
+	snapshot.mHostTime = now;
+	snapshot.mAudibleHostTime = now;
 
+	DecoderStateEpochGuard guard(*this);
 	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
 
-	if(nullptr == currentDecoderState)
+	if(nullptr == currentDecoderState) {
+		snapshot.mCurrentFrame			= -1;
+		snapshot.mTotalFrames			= -1;
+		snapshot.mAudibleFrame			= -1;
+		snapshot.mSampleRate			= 0;
+		snapshot.mURL					= nullptr;
+		snapshot.mRepresentedObject		= nullptr;
+		return false;
+	}
+
+	SInt64 frameToSeek		= currentDecoderState->mFrameToSeek.load();
+	SInt64 framesRendered	= currentDecoderState->mFramesRendered.load();
+
+	snapshot.mCurrentFrame			= (-1 == frameToSeek ? framesRendered : frameToSeek);
+	snapshot.mTotalFrames			= currentDecoderState->mTotalFrames;
+	snapshot.mAudibleFrame			= snapshot.mCurrentFrame;
+	snapshot.mSampleRate			= currentDecoderState->mDecoder->GetFormat().mSampleRate;
+	snapshot.mURL					= currentDecoderState->mDecoder->GetURL();
+	snapshot.mRepresentedObject		= currentDecoderState->mDecoder->GetRepresentedObject();
+
+	return true;
+}
+
+bool SFB::Audio::Player::GetAudibleFrame(SInt64& audibleFrame) const
+{
+	PlaybackSnapshot snapshot;
+	if(!GetPlaybackSnapshot(snapshot))
+		return false;
+
+	audibleFrame = snapshot.GetAudibleFrame(mach_absolute_time());
+
+	return true;
+}
+
+#pragma mark Seeking
+
+bool SFB::Audio::Player::SeekForward(CFTimeInterval secondsToSkip)
+{
+	if(0 > secondsToSkip)
+		return false;
+
+	DecoderStateEpochGuard guard(*this);
+	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
+
+	if(nullptr == currentDecoderState)
+		return false;
+
+	SInt64 frameCount		= (SInt64)(secondsToSkip * currentDecoderState->mDecoder->GetFormat().mSampleRate);
+
+	SInt64 frameToSeek		= currentDecoderState->mFrameToSeek.load();
+	SInt64 framesRendered	= currentDecoderState->mFramesRendered.load();
+
+	SInt64 currentFrame		= (-1 == frameToSeek ? framesRendered : frameToSeek);
+	SInt64 desiredFrame		= currentFrame + frameCount;
+	SInt64 totalFrames		= currentDecoderState->mTotalFrames;
+
+	return SeekToFrame(std::min(desiredFrame, totalFrames - 1));
+}
+
+bool SFB::Audio::Player::SeekBackward(CFTimeInterval secondsToSkip)
+{
+	if(0 > secondsToSkip)
+		return false;
+
+	DecoderStateEpochGuard guard(*this);
+	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
+
+	if(nullptr == currentDecoderState)
 		return false;
 
 	SInt64 frameCount		= (SInt64)(secondsToSkip * currentDecoderState->mDecoder->GetFormat().mSampleRate);
@@ -653,6 +1910,7 @@ bool SFB::Audio::Player::SeekToTime(CFTimeInterval timeInSeconds)
 	if(0 > timeInSeconds)
 		return false;
 
+	DecoderStateEpochGuard guard(*this);
 	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
 
 	if(nullptr == currentDecoderState)
@@ -669,6 +1927,7 @@ bool SFB::Audio::Player::SeekToPosition(float position)
 	if(0 > position || 1 < position)
 		return false;
 
+	DecoderStateEpochGuard guard(*this);
 	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
 
 	if(nullptr == currentDecoderState)
@@ -682,6 +1941,7 @@ bool SFB::Audio::Player::SeekToPosition(float position)
 
 bool SFB::Audio::Player::SeekToFrame(SInt64 frame)
 {
+	DecoderStateEpochGuard guard(*this);
 	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
 
 	if(nullptr == currentDecoderState)
@@ -695,17 +1955,21 @@ bool SFB::Audio::Player::SeekToFrame(SInt64 frame)
 
 	currentDecoderState->mFrameToSeek.store(frame);
 
+	if(mScrubbing.load())
+		mScrubFrame.store(frame);
+
 	// Force a flush of the ring buffer to prevent audible seek artifacts
 	if(!mOutput->IsRunning())
 		mFlags.fetch_or(eAudioPlayerFlagRingBufferNeedsReset);
 
-	mDecoderSemaphore.Signal();
+	WakeDecoder();
 
 	return true;
 }
 
 bool SFB::Audio::Player::SupportsSeeking() const
 {
+	DecoderStateEpochGuard guard(*this);
 	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
 
 	if(nullptr == currentDecoderState)
@@ -714,6 +1978,45 @@ bool SFB::Audio::Player::SupportsSeeking() const
 	return currentDecoderState->mDecoder->SupportsSeeking();
 }
 
+CFDataRef SFB::Audio::Player::CreateStateSnapshot()
+{
+	std::lock_guard<std::mutex> lock(mStateSnapshotMutex);
+
+	mStateSnapshot = nullptr;
+	mStateSnapshotRequested.store(true);
+	WakeDecoder();
+
+	// A request the decoding thread hasn't taken is withdrawn when the timeout elapses
+	if(dispatch_semaphore_wait(mStateSnapshotCreated, dispatch_time(DISPATCH_TIME_NOW, STATE_SNAPSHOT_TIMEOUT_SECONDS * NSEC_PER_SEC))) {
+		if(mStateSnapshotRequested.exchange(false)) {
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Timed out waiting for a state snapshot");
+			return nullptr;
+		}
+
+		dispatch_semaphore_wait(mStateSnapshotCreated, DISPATCH_TIME_FOREVER);
+	}
+
+	CFDataRef stateSnapshot = mStateSnapshot;
+	mStateSnapshot = nullptr;
+
+	return stateSnapshot;
+}
+
+void SFB::Audio::Player::SetScrubbing(bool scrubbing)
+{
+	if(scrubbing == mScrubbing.exchange(scrubbing))
+		return;
+
+	LOGGER_DEBUG("org.sbooth.AudioEngine.Player", (scrubbing ? "Beginning" : "Ending") << " scrubbing");
+
+	// Replace the last approximate seek with an exact one
+	SInt64 frame = mScrubFrame.exchange(-1);
+	if(!scrubbing && -1 != frame)
+		SeekToFrame(frame);
+	else
+		WakeDecoder();
+}
+
 #pragma mark Playlist Management
 
 bool SFB::Audio::Player::Play(CFURLRef url)
@@ -721,7 +2024,41 @@ bool SFB::Audio::Player::Play(CFURLRef url)
 	if(nullptr == url)
 		return false;
 
-	auto decoder = Decoder::CreateForURL(url);
+	auto decoder = CreateDecoderForURL(url);
+	return Play(decoder);
+}
+
+bool SFB::Audio::Player::Play(CFURLRef url, CFDataRef stateSnapshot)
+{
+	if(nullptr == url)
+		return false;
+
+	auto decoder = CreateDecoderForURL(url);
+	if(!decoder)
+		return false;
+
+	if(stateSnapshot) {
+		// The decoder is positioned before it is enqueued so decoding begins at the snapshot's frame
+		SFB::CFError error;
+		if(!decoder->IsOpen() && !OpenDecoder(*decoder, &error)) {
+			if(mDecoderErrorBlock)
+				mDecoderErrorBlock(*decoder, error);
+
+			if(error)
+				LOGGER_ERR("org.sbooth.AudioEngine.Player", "Error opening decoder: " << error);
+
+			return false;
+		}
+
+		if(!decoder->RestoreStateSnapshot(stateSnapshot, &error)) {
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Unable to restore state snapshot for \"" << url << "\": " << error);
+
+			// A failed restoration may have moved the decoder
+			if(0 != decoder->GetCurrentFrame() && (!decoder->SupportsSeeking() || 0 != decoder->SeekToFrame(0)))
+				return false;
+		}
+	}
+
 	return Play(decoder);
 }
 
@@ -742,7 +2079,41 @@ bool SFB::Audio::Player::Play(Decoder::unique_ptr& decoder)
 	// Start playback once decoding has begun
 	mFlags.fetch_or(eAudioPlayerFlagStartPlayback);
 
-	mDecoderSemaphore.Signal();
+	WakeDecoder();
+
+	return true;
+}
+
+bool SFB::Audio::Player::PlayAtTime(Decoder::unique_ptr& decoder, const AudioTimeStamp& startTime)
+{
+	if(!decoder)
+		return false;
+
+	if(!(kAudioTimeStampHostTimeValid & startTime.mFlags) && !(kAudioTimeStampSampleTimeValid & startTime.mFlags)) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Player", "PlayAtTime() called with a time stamp lacking both host and sample times");
+		return false;
+	}
+
+	if(!ClearQueuedDecoders())
+		return false;
+
+	if(!Stop())
+		return false;
+
+	// The rendering thread reads the start time only after eAudioPlayerFlagScheduledStartPending is set
+	mScheduledStartHostTime.store(kAudioTimeStampHostTimeValid & startTime.mFlags ? startTime.mHostTime : 0);
+	mScheduledStartSampleTime.store(kAudioTimeStampSampleTimeValid & startTime.mFlags ? startTime.mSampleTime : -1);
+	mFlags.fetch_or(eAudioPlayerFlagScheduledStartPending);
+
+	if(!Enqueue(decoder)) {
+		mFlags.fetch_and(~eAudioPlayerFlagScheduledStartPending);
+		return false;
+	}
+
+	// Start output once decoding has begun so it is running before the start time
+	mFlags.fetch_or(eAudioPlayerFlagStartPlayback);
+
+	WakeDecoder();
 
 	return true;
 }
@@ -752,7 +2123,7 @@ bool SFB::Audio::Player::Enqueue(CFURLRef url)
 	if(nullptr == url)
 		return false;
 
-	auto decoder = Decoder::CreateForURL(url);
+	auto decoder = CreateDecoderForURL(url);
 	return Enqueue(decoder);
 }
 
@@ -777,27 +2148,85 @@ bool SFB::Audio::Player::Enqueue(Decoder::unique_ptr& decoder)
 	//     from underneath them
 	// In practice, the only time I've seen this happen is when using GuardMalloc, presumably because the
 	// normal execution time of Enqueue() isn't sufficient to lead to this condition.
+	auto enqueueHostTime = mach_absolute_time();
 	__block bool result = true;
 	dispatch_sync(mQueue, ^{
 		// If there are no decoders in the queue, set up for playback
-		if(nullptr == GetCurrentDecoderState() && mDecoderQueue.empty()) {
+		if(!HasCurrentDecoderState() && mDecoderQueue.empty()) {
 			if(!SetupOutputAndRingBufferForDecoder(*decoder)) {
 				result = false;
 				return;
 			}
+
+			mStartupHostTime.store(enqueueHostTime, std::memory_order_relaxed);
 		}
 
 		// Take ownership of the decoder and add it to the queue
 		mDecoderQueue.push_back(std::move(decoder));
+		UpdateQueuedDecoderCount();
+
+		WakeDecoder();
+	});
+
+	// If a decoder is active prepare the next one in the background
+	if(result && HasCurrentDecoderState())
+		PrerollNextDecoder();
+
+	if(result)
+		WarmUpQueuedDecoders();
+
+	return result;
+}
+
+bool SFB::Audio::Player::Enqueue(std::vector<Decoder::unique_ptr>& decoders)
+{
+	if(decoders.empty())
+		return false;
+
+	for(const auto& decoder : decoders) {
+		if(!decoder)
+			return false;
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Enqueuing " << decoders.size() << " decoders");
+
+	// See the comments in Enqueue() above regarding the locking
+	auto enqueueHostTime = mach_absolute_time();
+	__block bool result = true;
+	dispatch_sync(mQueue, ^{
+		// If there are no decoders in the queue, set up for playback
+		if(!HasCurrentDecoderState() && mDecoderQueue.empty()) {
+			if(!SetupOutputAndRingBufferForDecoder(*decoders.front())) {
+				result = false;
+				return;
+			}
+
+			mStartupHostTime.store(enqueueHostTime, std::memory_order_relaxed);
+		}
+
+		// Take ownership of the decoders and add them to the queue
+		for(auto& decoder : decoders)
+			mDecoderQueue.push_back(std::move(decoder));
+		UpdateQueuedDecoderCount();
 
-		mDecoderSemaphore.Signal();
+		WakeDecoder();
 	});
 
+	if(result) {
+		decoders.clear();
+
+		if(HasCurrentDecoderState())
+			PrerollNextDecoder();
+
+		WarmUpQueuedDecoders();
+	}
+
 	return result;
 }
 
 bool SFB::Audio::Player::SkipToNextTrack()
 {
+	DecoderStateEpochGuard guard(*this);
 	DecoderStateData *currentDecoderState = GetCurrentDecoderState();
 
 	if(nullptr == currentDecoderState)
@@ -809,8 +2238,7 @@ bool SFB::Audio::Player::SkipToNextTrack()
 		mFlags.fetch_or(eAudioPlayerFlagRequestMute);
 
 		// The rendering thread will clear eAudioPlayerFlagRequestMute when the current render cycle completes
-		while(eAudioPlayerFlagRequestMute & mFlags.load())
-			mSemaphore.TimedWait(dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC / 10));
+		WaitForRenderingThreadToClearFlag(eAudioPlayerFlagRequestMute);
 	}
 	else
 		mFlags.fetch_or(eAudioPlayerFlagMuteOutput);
@@ -818,16 +2246,21 @@ bool SFB::Audio::Player::SkipToNextTrack()
 	currentDecoderState->mFlags.fetch_or(eDecoderStateDataFlagStopDecoding);
 
 	// Signal the decoding thread that decoding should stop (inner loop)
-	mDecoderSemaphore.Signal();
+	WakeDecoder();
 
 	// Wait for decoding to finish or a SIGSEGV could occur if the collector collects an active decoder
-	while(!(eDecoderStateDataFlagDecodingFinished & currentDecoderState->mFlags.load()))
-		mSemaphore.TimedWait(dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC / 10));
+	// The decoding thread signals mSemaphore when it sets eDecoderStateDataFlagDecodingFinished while output is muted
+	while(!(eDecoderStateDataFlagDecodingFinished & currentDecoderState->mFlags.load())) {
+		mSemaphore.Wait();
+		if(!(eDecoderStateDataFlagDecodingFinished & currentDecoderState->mFlags.load()))
+			mSpuriousWakeupCount.fetch_add(1);
+	}
 
 	currentDecoderState->mFlags.fetch_or(eDecoderStateDataFlagRenderingFinished);
+	RequestDecoderStateCollection();
 
 	// Signal the decoding thread to start the next decoder (outer loop)
-	mDecoderSemaphore.Signal();
+	WakeDecoder();
 
 	mFlags.fetch_and(~eAudioPlayerFlagMuteOutput);
 
@@ -836,624 +2269,3192 @@ bool SFB::Audio::Player::SkipToNextTrack()
 
 bool SFB::Audio::Player::ClearQueuedDecoders()
 {
+	// A decoder being pre-rolled or warmed up is destroyed when its open completes rather than waited for
+	std::vector<Decoder::unique_ptr> decoders;
+	return ClearQueuedDecoders(decoders, false);
+}
+
+bool SFB::Audio::Player::ClearQueuedDecoders(std::vector<Decoder::unique_ptr>& decoders)
+{
+	return ClearQueuedDecoders(decoders, true);
+}
+
+bool SFB::Audio::Player::ClearQueuedDecoders(std::vector<Decoder::unique_ptr>& decoders, bool returnDecodersInFlight)
+{
+	// Swap the queue out so the decoders are destroyed (or returned) without holding the lock
+	__block std::deque<Decoder::unique_ptr> queue;
+	__block DecoderStateData *prerolledDecoderState = nullptr;
 	dispatch_sync(mQueue, ^{
-		mDecoderQueue.clear();
+		queue.swap(mDecoderQueue);
+
+		// The pre-rolled decoder is logically at the head of the queue
+		prerolledDecoderState = mPrerolledDecoderState;
+		mPrerolledDecoderState = nullptr;
+
+		// A decoder being pre-rolled, or warmed up in place of a placeholder, is handed back when its open completes
+		mCancelledDecoderCount += (mPrerollInProgress ? 1 : 0) + (size_t)std::count_if(queue.begin(), queue.end(), [](const Decoder::unique_ptr& queuedDecoder) {
+			return !queuedDecoder;
+		});
+		mPrerollInProgress = false;
+		if(returnDecodersInFlight)
+			++mCancelledDecoderCollectorCount;
+
+		// Pre-roll and warm-up in progress stop, and a crossfade into a pre-rolled decoder will be discarded
+		++mPrerollGeneration;
+
+		UpdateQueuedDecoderCount();
 	});
 
-	return true;
+	decoders.reserve(decoders.size() + queue.size() + 1);
+	if(prerolledDecoderState) {
+		decoders.push_back(std::move(prerolledDecoderState->mDecoder));
+		delete prerolledDecoderState;
+	}
+	for(auto& decoder : queue) {
+		if(decoder)
+			decoders.push_back(std::move(decoder));
+	}
+
+	if(!returnDecodersInFlight)
+		return true;
+
+	// Only the opens in progress are waited for
+	for(;;) {
+		__block std::vector<Decoder::unique_ptr> cancelledDecoders;
+		__block bool returned = false;
+		__block bool collectorsWaiting = false;
+		dispatch_sync(mQueue, ^{
+			if(0 < mCancelledDecoderCount)
+				return;
+
+			cancelledDecoders.swap(mCancelledDecoders);
+			--mCancelledDecoderCollectorCount;
+			collectorsWaiting = 0 < mCancelledDecoderCollectorCount;
+			returned = true;
+		});
+
+		if(returned) {
+			// Another caller may have been waiting for the same decoders
+			if(collectorsWaiting)
+				dispatch_semaphore_signal(mCancelledDecodersReturned);
+
+			for(auto& decoder : cancelledDecoders)
+				decoders.push_back(std::move(decoder));
+
+			return true;
+		}
+
+		dispatch_semaphore_wait(mCancelledDecodersReturned, DISPATCH_TIME_FOREVER);
+	}
 }
 
-#pragma mark Ring Buffer Parameters
+#pragma mark Asynchronous Commands
 
-bool SFB::Audio::Player::SetRingBufferCapacity(uint32_t bufferCapacity)
+void SFB::Audio::Player::SeekToFrameAsync(SInt64 frame, CommandCompletionBlock block)
 {
-	if(0 == bufferCapacity || mRingBufferWriteChunkSize > bufferCapacity)
-		return false;
+	auto generation = mSeekCommandGeneration.fetch_add(1) + 1;
+	if(block)
+		block = Block_copy(block);
+
+	dispatch_async(mCommandQueue, ^{
+		// A later seek supersedes this one
+		if(generation != mSeekCommandGeneration.load()) {
+			if(block) {
+				block(false);
+				Block_release(block);
+			}
+			return;
+		}
 
-	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Setting ring buffer capacity to " << bufferCapacity);
+		// This seek also supersedes an earlier seek the decoding thread hasn't yet performed
+		CompletePendingSeek(false);
 
-	mRingBufferCapacity.store(bufferCapacity);
-	return true;
+		if(block) {
+			mPendingSeekCompletion = block;
+			mSeekCompletionPending.store(true);
+		}
+
+		if(!SeekToFrame(frame)) {
+			mSeekCompletionPending.store(false);
+			CompletePendingSeek(false);
+		}
+	});
 }
 
-bool SFB::Audio::Player::SetRingBufferWriteChunkSize(uint32_t chunkSize)
+void SFB::Audio::Player::SkipToNextTrackAsync(CommandCompletionBlock block)
 {
-	if(0 == chunkSize || mRingBufferCapacity < chunkSize)
-		return false;
+	if(block)
+		block = Block_copy(block);
 
-	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Setting ring buffer write chunk size to " << chunkSize);
+	dispatch_async(mCommandQueue, ^{
+		bool result = SkipToNextTrack();
 
-	mRingBufferWriteChunkSize.store(chunkSize);
-	return true;
+		// A seek pending on the skipped decoder won't be performed
+		CompletePendingSeek(false);
+
+		if(block) {
+			block(result);
+			Block_release(block);
+		}
+	});
 }
 
-#pragma mark Thread Entry Points
+void SFB::Audio::Player::StopAsync(CommandCompletionBlock block)
+{
+	if(block)
+		block = Block_copy(block);
 
-void * SFB::Audio::Player::DecoderThreadEntry()
+	dispatch_async(mCommandQueue, ^{
+		bool result = Stop();
+
+		// A seek pending on a stopped decoder won't be performed
+		CompletePendingSeek(false);
+
+		if(block) {
+			block(result);
+			Block_release(block);
+		}
+	});
+}
+
+void SFB::Audio::Player::ClearQueuedDecodersAsync(CommandCompletionBlock block)
 {
-	pthread_setname_np("org.sbooth.AudioEngine.Decoder");
+	// Asynchronous enqueues issued earlier would be cleared
+	mEnqueueGeneration.fetch_add(1);
 
-	// ========================================
-	// Make ourselves a high priority thread
-	if(!setThreadPolicy(DECODER_THREAD_IMPORTANCE))
-		LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Couldn't set decoder thread importance");
+	if(block)
+		block = Block_copy(block);
 
-	int64_t decoderCounter = 0;
+	dispatch_async(mCommandQueue, ^{
+		bool result = ClearQueuedDecoders();
+		if(block) {
+			block(result);
+			Block_release(block);
+		}
+	});
+}
 
-	while(!(eAudioPlayerFlagStopDecoding & mFlags.load())) {
+SFB::Audio::Player::EnqueueTicket SFB::Audio::Player::EnqueueAsync(CFURLRef url, EnqueueCompletionBlock block)
+{
+	return EnqueueURLAsync(url, false, block);
+}
 
-		__block DecoderStateData *decoderState = nullptr;
+SFB::Audio::Player::EnqueueTicket SFB::Audio::Player::PlayAsync(CFURLRef url, EnqueueCompletionBlock block)
+{
+	if(nullptr == url)
+		return 0;
 
-		// ========================================
-		// Lock the queue and remove the head element that contains the next decoder to use
-		__block Decoder::unique_ptr decoder;
-		dispatch_sync(mQueue, ^{
-			if(!mDecoderQueue.empty()) {
-				auto iter = std::begin(mDecoderQueue);
-				decoder = std::move(*iter);
-				mDecoderQueue.erase(iter);
-			}
-		});
+	// Asynchronous enqueues issued earlier would be cleared by the play
+	mEnqueueGeneration.fetch_add(1);
 
-		// ========================================
-		// Open the decoder if necessary
-		if(decoder && !decoder->IsOpen()) {
-			SFB::CFError error;
-			if(!decoder->Open(&error))  {
-				if(mDecoderErrorBlock)
-					mDecoderErrorBlock(*decoder, error);
+	return EnqueueURLAsync(url, true, block);
+}
 
-				if(error)
-					LOGGER_ERR("org.sbooth.AudioEngine.Player", "Error opening decoder: " << error);
+SFB::Audio::Player::EnqueueTicket SFB::Audio::Player::EnqueueURLAsync(CFURLRef url, bool play, EnqueueCompletionBlock block)
+{
+	if(nullptr == url)
+		return 0;
+
+	auto pending = new PendingEnqueue;
+	pending->mTicket = mNextEnqueueTicket.fetch_add(1);
+	pending->mGeneration = mEnqueueGeneration.load();
+	pending->mPlay = play;
+	pending->mURL = (CFURLRef)CFRetain(url);
+	pending->mBlock = block ? Block_copy(block) : nullptr;
+	pending->mCreated = dispatch_semaphore_create(0);
+
+	EnqueueTicket ticket = pending->mTicket;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Enqueuing \"" << url << "\" asynchronously (ticket " << ticket << ")");
+
+	// Waiting on mDecoderCreationSemaphore here instead of in the creation block keeps waiting requests from occupying threads
+	dispatch_async(mDecoderCreationQueue, ^{
+		dispatch_semaphore_wait(mDecoderCreationSemaphore, DISPATCH_TIME_FOREVER);
+		dispatch_group_async(mDecoderCreationGroup, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+			// Creation is skipped for an enqueue cancelled while waiting
+			if(pending->mGeneration == mEnqueueGeneration.load()) {
+				pending->mDecoder = CreateDecoderForURL(pending->mURL, &pending->mError);
+				if(pending->mDecoder && !pending->mDecoder->IsOpen() && !OpenDecoder(*pending->mDecoder, &pending->mError))
+					pending->mDecoder.reset();
 			}
-		}
 
-		// Create the decoder state
-		if(decoder) {
-			if(mOutput->SupportsFormat(decoder->GetFormat())) {
-				decoderState = new DecoderStateData(std::move(decoder));
-				decoderState->mTimeStamp = decoderCounter++;
-			}
-			else {
-				LOGGER_ERR("org.sbooth.AudioEngine.Player", "Format not supported: " << decoder->GetFormat());
+			dispatch_semaphore_signal(mDecoderCreationSemaphore);
+			dispatch_semaphore_signal(pending->mCreated);
+		});
+	});
 
-				if(mErrorBlock) {
-					SFB::CFString description(CFCopyLocalizedString(CFSTR("The format of the file “%@” is not supported."), ""));
-					SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Format not supported"), ""));
-					SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's format is not supported by the selected output device."), ""));
+	// Decoders are handed to the player in the order they were requested
+	dispatch_async(mCommandQueue, ^{
+		dispatch_semaphore_wait(pending->mCreated, DISPATCH_TIME_FOREVER);
 
-					SFB::CFError error(CreateErrorForURL(Decoder::ErrorDomain, Decoder::InputOutputError, description, decoder->GetInputSource().GetURL(), failureReason, recoverySuggestion));
+		bool result = false;
+		if(pending->mDecoder && pending->mGeneration == mEnqueueGeneration.load())
+			result = pending->mPlay ? Play(pending->mDecoder) : Enqueue(pending->mDecoder);
+		else if(!pending->mError)
+			LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Asynchronous enqueue " << pending->mTicket << " cancelled");
 
-					mErrorBlock(error);
-				}
-			}
+		if(pending->mBlock) {
+			pending->mBlock(pending->mTicket, result, pending->mError);
+			Block_release(pending->mBlock);
 		}
 
-		// ========================================
-		// Ensure the decoder's format is compatible with the ring buffer
-		if(decoderState) {
-			const AudioFormat&		outputFormat		= mOutput->GetFormat();
-			const ChannelLayout&	outputChannelLayout	= mOutput->GetChannelLayout();
-			const AudioFormat&		nextFormat			= decoderState->mDecoder->GetFormat();
-			const ChannelLayout&	nextChannelLayout	= decoderState->mDecoder->GetChannelLayout();
+		dispatch_release(pending->mCreated);
+		delete pending;
+	});
+
+	return ticket;
+}
+
+void SFB::Audio::Player::CompletePendingSeek(bool success)
+{
+	// Must be called on mCommandQueue
+
+	if(!mPendingSeekCompletion)
+		return;
+
+	auto block = mPendingSeekCompletion;
+	mPendingSeekCompletion = nullptr;
+
+	block(success);
+	Block_release(block);
+}
+
+#pragma mark Crossfading
+
+bool SFB::Audio::Player::SetCrossfadeDuration(CFTimeInterval duration)
+{
+	if(0 > duration)
+		return false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Setting crossfade duration to " << duration << " sec");
+	mCrossfadeDuration.store(duration);
+
+	return true;
+}
+
+#pragma mark Voices
+
+bool SFB::Audio::Player::PlayVoice(Decoder::unique_ptr& decoder, float gain, float pan, VoiceID *voiceID)
+{
+	if(!decoder)
+		return false;
+
+	SFB::CFError error;
+	if(!decoder->IsOpen() && !OpenDecoder(*decoder, &error)) {
+		if(mDecoderErrorBlock)
+			mDecoderErrorBlock(*decoder, error);
+
+		if(error)
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "Error opening decoder: " << error);
+
+		return false;
+	}
+
+	if(!decoder->GetFormat().IsPCM()) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Voices must be PCM: " << decoder->GetFormat());
+		return false;
+	}
+
+	// Voices are mixed directly into the output's buffers
+	AudioFormat outputFormat = mOutput->GetFormat();
+	if(!outputFormat.IsPCM() || !(kAudioFormatFlagIsFloat & outputFormat.mFormatFlags) || 32 != outputFormat.mBitsPerChannel || outputFormat.IsInterleaved()) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Output format not supported for voices: " << outputFormat);
+		return false;
+	}
+
+	// Claim a free slot
+	VoiceData *voice = nullptr;
+	for(size_t voiceIndex = 0; voiceIndex < kMaximumVoiceCount; ++voiceIndex) {
+		unsigned int expected = eVoiceStateFree;
+		if(mVoices[voiceIndex].mState.compare_exchange_strong(expected, eVoiceStatePreparing)) {
+			voice = &mVoices[voiceIndex];
+			break;
+		}
+	}
+
+	if(nullptr == voice) {
+		LOGGER_WARNING("org.sbooth.AudioEngine.Player", "No free voice slots");
+		return false;
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Playing voice \"" << decoder->GetURL() << "\"");
+
+	if(!voice->Prepare(std::move(decoder), outputFormat, mMemoryLocking.load())) {
+		voice->Release();
+		voice->mState.store(eVoiceStateFree);
+		return false;
+	}
+
+	// Decode the first audio before the voice is visible to the rendering thread
+	voice->Fill();
+
+	voice->mGain.store(gain);
+	voice->mPan.store(std::min(std::max(pan, -1.f), 1.f));
+
+	VoiceID identifier = mNextVoiceID.fetch_add(1) + 1;
+	voice->mID.store(identifier);
+
+	mActiveVoiceCount.fetch_add(1);
+	voice->mState.store(eVoiceStatePlaying);
+
+	if(voiceID)
+		*voiceID = identifier;
+
+	// A paused player remains paused; otherwise output is started for the voice
+	__block bool result = true;
+	dispatch_sync(mQueue, ^{
+		if(!mOutput->IsRunning() && PlayerState::Stopped == GetPlayerState())
+			result = mOutput->Start();
+	});
+
+	return result;
+}
+
+bool SFB::Audio::Player::StopVoice(VoiceID voiceID)
+{
+	__block bool result = false;
+	dispatch_sync(mQueue, ^{
+		auto voice = GetPlayingVoice(voiceID);
+		if(voice) {
+			RequestVoiceStop(*voice);
+			result = true;
+		}
+	});
+
+	dispatch_source_merge_data(mVoiceSource, 1);
+
+	return result;
+}
+
+void SFB::Audio::Player::StopAllVoices()
+{
+	dispatch_sync(mQueue, ^{
+		StopVoices();
+	});
+}
+
+bool SFB::Audio::Player::IsVoicePlaying(VoiceID voiceID) const
+{
+	auto voice = GetPlayingVoice(voiceID);
+	return voice && !(eVoiceFlagStopRequested & voice->mFlags.load());
+}
+
+bool SFB::Audio::Player::SetVoiceGain(VoiceID voiceID, float gain)
+{
+	auto voice = GetPlayingVoice(voiceID);
+	if(!voice)
+		return false;
+
+	voice->mGain.store(gain);
+	return true;
+}
+
+bool SFB::Audio::Player::SetVoicePan(VoiceID voiceID, float pan)
+{
+	auto voice = GetPlayingVoice(voiceID);
+	if(!voice)
+		return false;
+
+	voice->mPan.store(std::min(std::max(pan, -1.f), 1.f));
+	return true;
+}
+
+SFB::Audio::Player::VoiceData * SFB::Audio::Player::GetPlayingVoice(VoiceID voiceID) const
+{
+	if(0 == voiceID)
+		return nullptr;
+
+	for(size_t voiceIndex = 0; voiceIndex < kMaximumVoiceCount; ++voiceIndex) {
+		auto& voice = mVoices[voiceIndex];
+		if(eVoiceStatePlaying == voice.mState.load() && voiceID == voice.mID.load())
+			return &voice;
+	}
+
+	return nullptr;
+}
+
+void SFB::Audio::Player::RequestVoiceStop(VoiceData& voice)
+{
+	// Must be called on mQueue, which serializes starting output
+
+	voice.mFlags.fetch_or(eVoiceFlagStopRequested);
+
+	// Without a rendering thread to finish the voice it is finished here
+	if(!mOutput->IsRunning()) {
+		unsigned int expected = eVoiceStatePlaying;
+		voice.mState.compare_exchange_strong(expected, eVoiceStateFinished);
+	}
+}
+
+void SFB::Audio::Player::StopVoices()
+{
+	// Must be called on mQueue
+
+	for(size_t voiceIndex = 0; voiceIndex < kMaximumVoiceCount; ++voiceIndex) {
+		if(eVoiceStatePlaying == mVoices[voiceIndex].mState.load())
+			RequestVoiceStop(mVoices[voiceIndex]);
+	}
+
+	dispatch_source_merge_data(mVoiceSource, 1);
+}
+
+void SFB::Audio::Player::MixVoices(AudioBufferList *bufferList, UInt32 frameCount)
+{
+	// Called from the real-time rendering thread
+	const auto& outputFormat = mOutput->GetFormat();
+	bool needsService = false;
+
+	for(size_t voiceIndex = 0; voiceIndex < kMaximumVoiceCount; ++voiceIndex) {
+		auto& voice = mVoices[voiceIndex];
+		if(eVoiceStatePlaying != voice.mState.load())
+			continue;
+
+		// The flags are read before the ring buffer so audio written before decoding finished isn't missed
+		auto flags = voice.mFlags.load();
+
+		// A voice converted for a different output format can't be mixed
+		if((eVoiceFlagStopRequested & flags) || voice.mRingBuffer.GetFormat() != outputFormat) {
+			voice.mState.store(eVoiceStateFinished);
+			needsService = true;
+			continue;
+		}
+
+		// Pan stereo output by attenuating the opposite channel so a centered voice is at unity gain
+		float gain = voice.mGain.load();
+		float gains [bufferList->mNumberBuffers];
+		if(2 == bufferList->mNumberBuffers) {
+			float pan = voice.mPan.load();
+			gains[0] = gain * std::min(1.f, 1 - pan);
+			gains[1] = gain * std::min(1.f, 1 + pan);
+		}
+		else
+			std::fill_n(gains, bufferList->mNumberBuffers, gain);
+
+		auto readVector = voice.mRingBuffer.GetReadVector();
+		size_t framesToMix = std::min((size_t)frameCount, readVector.first.mFrameCapacity + readVector.second.mFrameCapacity);
+		size_t firstFrameCount = std::min(framesToMix, readVector.first.mFrameCapacity);
+
+		if(0 < firstFrameCount)
+			MixChannels(readVector.first.mBufferList, bufferList, 0, firstFrameCount, gains);
+		if(firstFrameCount < framesToMix)
+			MixChannels(readVector.second.mBufferList, bufferList, firstFrameCount, framesToMix - firstFrameCount, gains);
+
+		voice.mRingBuffer.ReadAdvance(framesToMix);
+
+		if((eVoiceFlagDecodingFinished & flags) && 0 == voice.mRingBuffer.GetFramesAvailableToRead()) {
+			voice.mState.store(eVoiceStateFinished);
+			needsService = true;
+		}
+		else if(!(eVoiceFlagDecodingFinished & flags) && VOICE_WRITE_CHUNK_SIZE_FRAMES <= voice.mRingBuffer.GetFramesAvailableToWrite())
+			needsService = true;
+	}
+
+	if(needsService)
+		dispatch_source_merge_data(mVoiceSource, 1);
+}
+
+void SFB::Audio::Player::ServiceVoices()
+{
+	// Called on mVoiceQueue
+	bool voiceFinished = false;
+
+	for(size_t voiceIndex = 0; voiceIndex < kMaximumVoiceCount; ++voiceIndex) {
+		auto& voice = mVoices[voiceIndex];
+		switch(voice.mState.load()) {
+			case eVoiceStatePlaying:
+				voice.Fill();
+				break;
+
+			case eVoiceStateFinished:
+				// The rendering thread no longer reads from a finished voice
+				voice.Release();
+				voice.mState.store(eVoiceStateFree);
+				mActiveVoiceCount.fetch_sub(1);
+				voiceFinished = true;
+				break;
+		}
+	}
+
+	if(voiceFinished && 0 == mActiveVoiceCount.load())
+		StopOutputIfIdle();
+}
+
+void SFB::Audio::Player::StopOutputIfIdle()
+{
+	// Output continues to run after the playlist finishes while voices are playing
+	dispatch_async(mQueue, ^{
+		if(mOutput->IsRunning() && mFramesDecoded == mFramesRendered && !HasCurrentDecoderState() && 0 == mActiveVoiceCount.load()) {
+			mOutput->RequestStop();
+			StopFanOutOutputs(true);
+
+			// Wake any thread waiting on the rendering thread, which may no longer run
+			mSemaphore.Signal();
+		}
+	});
+}
+
+#pragma mark Metering
+
+void SFB::Audio::Player::SetMeteringEnabled(bool enabled)
+{
+	// Levels measured before metering was disabled are stale
+	if(enabled && !mMeteringEnabled.load())
+		mLevelMeter.Reset();
+
+	mMeteringEnabled.store(enabled);
+}
+
+#pragma mark Spectrum Analysis
+
+void SFB::Audio::Player::SetSpectrumAnalysisEnabled(bool enabled)
+{
+	if(enabled == mSpectrumAnalysisEnabled.load())
+		return;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", (enabled ? "Enabling" : "Disabling") << " spectrum analysis");
+
+	if(enabled) {
+		mSpectrumAnalyzer.Start();
+		mSpectrumAnalysisEnabled.store(true);
+	}
+	else {
+		mSpectrumAnalysisEnabled.store(false);
+		mSpectrumAnalyzer.Stop();
+	}
+}
+
+#pragma mark DSP Effects
+
+bool SFB::Audio::Player::AddEffect(OSType componentType, OSType subType, OSType manufacturer, UInt32 flags, UInt32 mask, EffectPlacement placement, AudioUnit *effectUnit)
+{
+	if(EffectPlacement::DecodingThread == placement)
+		return mEffectChain.AddEffect(componentType, subType, manufacturer, flags, mask, effectUnit);
+
+	auto output = dynamic_cast<CoreAudioOutput *>(mOutput.get());
+	if(nullptr == output) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Rendering thread effects require a CoreAudioOutput");
+		return false;
+	}
+
+	return output->AddEffect(componentType, subType, manufacturer, flags, mask, effectUnit);
+}
+
+bool SFB::Audio::Player::RemoveEffect(AudioUnit effectUnit)
+{
+	if(mEffectChain.RemoveEffect(effectUnit))
+		return true;
+
+	auto output = dynamic_cast<CoreAudioOutput *>(mOutput.get());
+	return nullptr != output && output->RemoveEffect(effectUnit);
+}
+
+#pragma mark Playback Rate
+
+void SFB::Audio::Player::SetPlaybackRate(double rate)
+{
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Setting playback rate to " << rate);
+	mTimeStretcher.SetRate(rate);
+}
+
+#pragma mark Ring Buffer Parameters
+
+bool SFB::Audio::Player::SetRingBufferCapacity(uint32_t bufferCapacity)
+{
+	if(0 == bufferCapacity || mRingBufferWriteChunkSize > bufferCapacity)
+		return false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Setting ring buffer capacity to " << bufferCapacity);
+
+	mRingBufferCapacity.store(bufferCapacity);
+	return true;
+}
+
+bool SFB::Audio::Player::SetRingBufferWriteChunkSize(uint32_t chunkSize)
+{
+	if(0 == chunkSize || mRingBufferCapacity < chunkSize)
+		return false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Setting ring buffer write chunk size to " << chunkSize);
+
+	mRingBufferWriteChunkSize.store(chunkSize);
+	return true;
+}
+
+void SFB::Audio::Player::SetAdaptiveRingBufferSizingEnabled(bool enabled)
+{
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", (enabled ? "Enabling" : "Disabling") << " adaptive ring buffer sizing");
+
+	mAdaptiveRingBufferSizing.store(enabled);
+}
+
+void SFB::Audio::Player::SetCompactRingBufferStorageEnabled(bool enabled)
+{
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", (enabled ? "Enabling" : "Disabling") << " compact ring buffer storage");
+
+	mCompactRingBufferStorage.store(enabled);
+}
+
+void SFB::Audio::Player::SetAutomaticOutputBufferSizingEnabled(bool enabled)
+{
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", (enabled ? "Enabling" : "Disabling") << " automatic output buffer sizing");
+
+	mAutomaticOutputBufferSizing.store(enabled);
+}
+
+bool SFB::Audio::Player::SetRingBufferTargetDepth(CFTimeInterval targetDepth)
+{
+	if(0 >= targetDepth)
+		return false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Setting ring buffer target depth to " << targetDepth << " sec");
+
+	mRingBufferTargetDepth.store(targetDepth);
+	return true;
+}
+
+bool SFB::Audio::Player::SetQueueWarmUpCount(size_t count)
+{
+	// Each opened decoder holds its input and buffers, so the number is bounded
+	if(MAXIMUM_QUEUE_WARM_UP_COUNT < count)
+		return false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Setting queue warm-up count to " << count);
+
+	mQueueWarmUpCount.store(count);
+	WarmUpQueuedDecoders();
+
+	return true;
+}
+
+void SFB::Audio::Player::SetRemoteDecodingEnabled(bool enabled)
+{
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", (enabled ? "Enabling" : "Disabling") << " remote decoding");
+
+	mRemoteDecoding.store(enabled);
+}
+
+bool SFB::Audio::Player::SetPrebufferTime(CFTimeInterval prebufferTime)
+{
+	if(0 > prebufferTime)
+		return false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Setting prebuffer time to " << prebufferTime << " sec");
+
+	mPrebufferTime.store(prebufferTime);
+	return true;
+}
+
+bool SFB::Audio::Player::SetInputReadAheadTime(CFTimeInterval readAheadTime)
+{
+	if(0 > readAheadTime)
+		return false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Setting input read ahead time to " << readAheadTime << " sec");
+
+	mInputReadAheadTime.store(readAheadTime);
+	return true;
+}
+
+SFB::Audio::Player::RingBufferStatistics SFB::Audio::Player::GetRingBufferStatistics() const
+{
+	RingBufferStatistics statistics = {
+		.mCapacityFrames		= mRingBufferCapacity.load(),
+		.mWriteChunkSizeFrames	= mActiveRingBufferWriteChunkSize.load(),
+		.mTargetDepth			= mRingBufferTargetDepth.load(),
+		.mDecodeLoad			= mDecodeLoad.load(),
+		.mOutputBufferFrameSize	= 0,
+		.mOutputBufferAdjustmentCount	= mOutputBufferAdjustmentCount.load()
+	};
+
+	UInt32 frameSize;
+	if(mOutput->GetDeviceBufferFrameSize(frameSize))
+		statistics.mOutputBufferFrameSize = frameSize;
+
+	return statistics;
+}
+
+#pragma mark Render Tracing
+
+bool SFB::Audio::Player::StartRenderTrace(CFURLRef url, CFErrorRef *error)
+{
+	static mach_timebase_info_data_t sTimebaseInfo = {};
+	if(0 == sTimebaseInfo.denom)
+		mach_timebase_info(&sTimebaseInfo);
+
+	RenderTrace::Configuration configuration = {
+		.mSampleRate				= mOutput->GetFormat().mSampleRate,
+		.mRingBufferCapacity		= (uint32_t)mRingBuffer->GetCapacityFrames(),
+		.mRingBufferWriteChunkSize	= mActiveRingBufferWriteChunkSize.load(),
+		.mOutputBufferFrameSize		= (uint32_t)mOutput->GetPreferredBufferSize(),
+		.mTimebaseNumerator			= sTimebaseInfo.numer,
+		.mTimebaseDenominator		= sTimebaseInfo.denom
+	};
+
+	if(!mRenderTrace.Start(url, configuration, error))
+		return false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Recording render trace to " << url);
+	return true;
+}
+
+void SFB::Audio::Player::StopRenderTrace()
+{
+	mRenderTrace.Stop();
+}
+
+#pragma mark Memory Footprint
+
+void SFB::Audio::Player::SetLowMemoryModeEnabled(bool enabled)
+{
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", (enabled ? "Enabling" : "Disabling") << " low-memory mode");
+
+	dispatch_sync(mQueue, ^{
+		ApplyLowMemoryMode(enabled);
+	});
+}
+
+SFB::Audio::Player::MemoryStatistics SFB::Audio::Player::GetMemoryStatistics() const
+{
+	__block MemoryStatistics statistics = {
+		.mRingBufferBytes			= mRingBufferBytes.load(),
+		.mStandbyRingBufferBytes	= mStandbyRingBufferBytes.load(),
+		.mLockedRingBufferBytes		= mLockedRingBufferBytes.load(),
+		.mPrerollBufferBytes		= 0,
+		.mFileCacheBytes			= InputSource::GetFileCacheStatistics().mCachedBytes,
+		.mHoldsPrerolledDecoder		= false,
+		.mLowMemoryMode				= mLowMemoryMode.load(),
+		.mMemoryPressureEventCount	= mMemoryPressureEventCount.load()
+	};
+
+	dispatch_sync(mQueue, ^{
+		if(mPrerolledDecoderState) {
+			statistics.mHoldsPrerolledDecoder = true;
+			statistics.mPrerollBufferBytes = mPrerolledDecoderState->GetPrerollBufferByteCount();
+		}
+	});
+
+	return statistics;
+}
+
+void SFB::Audio::Player::SetMemoryLockingEnabled(bool enabled)
+{
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", (enabled ? "Enabling" : "Disabling") << " memory locking");
+
+	mMemoryLocking.store(enabled);
+	BufferList::SetPoolMemoryLocked(enabled);
+}
+
+#pragma mark Low-Power Playback
+
+void SFB::Audio::Player::SetLowPowerModeEnabled(bool enabled)
+{
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", (enabled ? "Enabling" : "Disabling") << " low-power mode");
+
+	dispatch_sync(mQueue, ^{
+		mLowPowerMode.store(enabled);
+
+		if(enabled)
+			ApplyLowPowerOutputBufferSize();
+		else if(0 != mNormalOutputBufferFrameSize) {
+			if(!mOutput->SetDeviceBufferFrameSize(mNormalOutputBufferFrameSize))
+				LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Unable to restore output buffer size of " << mNormalOutputBufferFrameSize << " frames");
+			mNormalOutputBufferFrameSize = 0;
+		}
+	});
+
+	mDecoderSchedulingGeneration.fetch_add(1);
+	WakeDecoder();
+}
+
+bool SFB::Audio::Player::SetLowPowerBufferDuration(CFTimeInterval duration)
+{
+	if(0 >= duration)
+		return false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Setting low-power buffer duration to " << duration << " sec");
+
+	mLowPowerBufferDuration.store(duration);
+	return true;
+}
+
+#pragma mark Automatic Output Suspension
+
+void SFB::Audio::Player::SetAutomaticOutputSuspensionEnabled(bool enabled)
+{
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", (enabled ? "Enabling" : "Disabling") << " automatic output suspension");
+
+	mAutomaticOutputSuspension.store(enabled);
+
+	// Output suspended while enabled is no longer expected to stop
+	if(!enabled && mOutputSuspended.load())
+		ResumeSuspendedOutput();
+}
+
+bool SFB::Audio::Player::SetOutputSuspensionDelay(CFTimeInterval delay)
+{
+	if(0 >= delay)
+		return false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Setting output suspension delay to " << delay << " sec");
+
+	mOutputSuspensionDelay.store(delay);
+	return true;
+}
+
+void SFB::Audio::Player::SuspendOutputIfSilent()
+{
+	dispatch_async(mQueue, ^{
+		if(!mAutomaticOutputSuspension.load() || !mOutput->IsRunning() || 0 != mActiveVoiceCount.load() || (eAudioPlayerFlagScheduledStartPending & mFlags.load()))
+			return;
+
+		// mOutputSuspended is set before the ring buffer is checked so audio written meanwhile resumes output
+		mOutputSuspended.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(!(eAudioPlayerFlagMuteOutput & mFlags.load()) && 0 != mRingBuffer->GetFramesAvailableToRead()) {
+			mOutputSuspended.store(false);
+			return;
+		}
+
+		LOGGER_INFO("org.sbooth.AudioEngine.Player", "Suspending output after " << mOutputSuspensionDelay.load() << " sec of silence");
+
+		mOutput->RequestStop();
+		StopFanOutOutputs(true);
+		mOutputSuspensionCount.fetch_add(1, std::memory_order_relaxed);
+
+		// Wake any thread waiting on the rendering thread, which will no longer run
+		mSemaphore.Signal();
+	});
+}
+
+void SFB::Audio::Player::ResumeSuspendedOutput()
+{
+	// We don't want to start output in the middle of a buffer modification
+	dispatch_sync(mQueue, ^{
+		if(!mOutputSuspended.exchange(false) || mOutput->IsRunning())
+			return;
+
+		LOGGER_INFO("org.sbooth.AudioEngine.Player", "Resuming suspended output");
+
+		mSilentFrameCount.store(0, std::memory_order_relaxed);
+
+		// Silence is output while the device restarts so the beginning of the audio isn't clipped
+		if(!(eAudioPlayerFlagScheduledStartPending & mFlags.load())) {
+			mScheduledStartSampleTime.store(-1);
+			mScheduledStartHostTime.store(mach_absolute_time() + ConvertNanosToHostTime(OUTPUT_RESUME_PREROLL_NSEC));
+			mFlags.fetch_or(eAudioPlayerFlagScheduledStartPending);
+		}
+
+		if(!mOutput->Start())
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to resume output");
+		else
+			StartFanOutOutputs();
+	});
+}
+
+SFB::Audio::Player::PlaybackStatistics SFB::Audio::Player::GetPlaybackStatistics() const
+{
+	PlaybackStatistics statistics = {};
+
+	statistics.mRenderCycleCount = mRenderCycleCount.load(std::memory_order_relaxed);
+	if(0 < statistics.mRenderCycleCount) {
+		statistics.mMinimumRingBufferFill = mMinimumRingBufferFill.load(std::memory_order_relaxed);
+		statistics.mAverageRingBufferFill = (double)mRingBufferFillSum.load(std::memory_order_relaxed) / statistics.mRenderCycleCount;
+	}
+	statistics.mUnderrunCount = mUnderrunCount.load(std::memory_order_relaxed);
+	statistics.mUnderrunFrameCount = mUnderrunFrameCount.load(std::memory_order_relaxed);
+
+	statistics.mDecodeChunkCount = mDecodeChunkCount.load(std::memory_order_relaxed);
+	if(0 < statistics.mDecodeChunkCount)
+		statistics.mAverageDecodeChunkTime = (CFTimeInterval)ConvertHostTimeToNanos(mDecodeChunkTime.load(std::memory_order_relaxed)) / NSEC_PER_SEC / statistics.mDecodeChunkCount;
+	statistics.mMaximumDecodeChunkTime = (CFTimeInterval)ConvertHostTimeToNanos(mMaximumDecodeChunkTime.load(std::memory_order_relaxed)) / NSEC_PER_SEC;
+	for(size_t bucket = 0; bucket < kDecodeTimeHistogramBucketCount; ++bucket)
+		statistics.mDecodeTimeHistogram[bucket] = mDecodeTimeHistogram[bucket].load(std::memory_order_relaxed);
+
+	statistics.mConverterTime = (CFTimeInterval)ConvertHostTimeToNanos(mConverterTime.load(std::memory_order_relaxed)) / NSEC_PER_SEC;
+
+	statistics.mDecoderOpenCount = mDecoderOpenCount.load(std::memory_order_relaxed);
+	if(0 < statistics.mDecoderOpenCount)
+		statistics.mAverageDecoderOpenTime = (CFTimeInterval)ConvertHostTimeToNanos(mDecoderOpenTime.load(std::memory_order_relaxed)) / NSEC_PER_SEC / statistics.mDecoderOpenCount;
+	statistics.mMaximumDecoderOpenTime = (CFTimeInterval)ConvertHostTimeToNanos(mMaximumDecoderOpenTime.load(std::memory_order_relaxed)) / NSEC_PER_SEC;
+
+	auto startupLatency = mStartupLatency.load(std::memory_order_relaxed);
+	statistics.mStartupLatency = -1 == startupLatency ? -1 : (CFTimeInterval)ConvertHostTimeToNanos((uint64_t)startupLatency) / NSEC_PER_SEC;
+
+	statistics.mDecoderWakeupCount = mDecoderWakeupCount.load(std::memory_order_relaxed);
+	double minutes = (double)ConvertHostTimeToNanos(mach_absolute_time() - mStatisticsStartHostTime.load(std::memory_order_relaxed)) / NSEC_PER_SEC / 60;
+	if(0 < minutes)
+		statistics.mDecoderWakeupsPerMinute = statistics.mDecoderWakeupCount / minutes;
+
+	statistics.mOutputSuspensionCount = mOutputSuspensionCount.load(std::memory_order_relaxed);
+
+	statistics.mRenderAllocationCount = mRenderAllocations.mAllocationCount.load(std::memory_order_relaxed);
+	statistics.mDecodingAllocationCount = mDecodingAllocations.mAllocationCount.load(std::memory_order_relaxed);
+	statistics.mLastTrackAllocationCount = mLastTrackAllocationCount.load(std::memory_order_relaxed);
+
+	return statistics;
+}
+
+void SFB::Audio::Player::ResetPlaybackStatistics()
+{
+	mRenderCycleCount.store(0, std::memory_order_relaxed);
+	mRingBufferFillSum.store(0, std::memory_order_relaxed);
+	mMinimumRingBufferFill.store(UINT_MAX, std::memory_order_relaxed);
+	mUnderrunCount.store(0, std::memory_order_relaxed);
+	mUnderrunFrameCount.store(0, std::memory_order_relaxed);
+
+	mDecodeChunkCount.store(0, std::memory_order_relaxed);
+	mDecodeChunkTime.store(0, std::memory_order_relaxed);
+	mMaximumDecodeChunkTime.store(0, std::memory_order_relaxed);
+	for(auto& count : mDecodeTimeHistogram)
+		count.store(0, std::memory_order_relaxed);
+
+	mConverterTime.store(0, std::memory_order_relaxed);
+
+	mDecoderOpenCount.store(0, std::memory_order_relaxed);
+	mDecoderOpenTime.store(0, std::memory_order_relaxed);
+	mMaximumDecoderOpenTime.store(0, std::memory_order_relaxed);
+
+	mStartupLatency.store(-1, std::memory_order_relaxed);
+
+	mRenderAllocations.Reset();
+	mDecodingAllocations.Reset();
+	mLastTrackAllocationCount.store(0, std::memory_order_relaxed);
+
+	mDecoderWakeupCount.store(0, std::memory_order_relaxed);
+	mOutputSuspensionCount.store(0, std::memory_order_relaxed);
+	mStatisticsStartHostTime.store(mach_absolute_time(), std::memory_order_relaxed);
+}
+
+bool SFB::Audio::Player::GetDecoderStatistics(const Decoder& decoder, DecoderStatistics& statistics) const
+{
+	DecoderStateEpochGuard guard(*this);
+
+	for(size_t slotIndex = 0; slotIndex < mActiveDecoderCapacity; ++slotIndex) {
+		DecoderStateData *decoderState = mActiveDecoders[slotIndex].load();
+		if(nullptr != decoderState && &decoder == decoderState->mDecoder.get()) {
+			GetDecoderStatistics(*decoderState, statistics);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+#pragma mark Decoding
+
+void * SFB::Audio::Player::DecoderThreadEntry()
+{
+	pthread_setname_np("org.sbooth.AudioEngine.Decoder");
+
+	// ========================================
+	// Make ourselves a high priority thread
+	// The policy is refined once the output is configured for a decoder
+	if(!setThreadPolicy(DECODER_THREAD_IMPORTANCE))
+		LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Couldn't set decoder thread importance");
+
+	DecoderThreadScheduling scheduling;
+
+	while(!(eAudioPlayerFlagStopDecoding & mFlags.load())) {
+		if(scheduling.mGeneration != mDecoderSchedulingGeneration.load())
+			UpdateDecoderThreadScheduling(scheduling);
+
+		// Wait for the audio rendering thread to signal us that it could use more data, or for another thread to wake us
+		if(DecodingStatus::Continue != ServiceDecoding()) {
+			auto waitStartTime = mach_absolute_time();
+			mDecoderEvent.Wait();
+
+			if(mRenderTrace.IsRecording()) {
+				auto now = mach_absolute_time();
+				mRenderTrace.Record(RenderTrace::Thread::Decoding, RenderTrace::EventType::DecoderWakeup, now, 0, mRingBuffer->GetFramesAvailableToRead(), now - waitStartTime);
+			}
+
+			if(!IsDecodingWorkPending())
+				mSpuriousWakeupCount.fetch_add(1);
+		}
+	}
+
+	EndDecoding();
+
+	delete mPendingDecoderState;
+	mPendingDecoderState = nullptr;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Decoding thread terminating");
+
+	return nullptr;
+}
+
+void SFB::Audio::Player::UpdateDecoderThreadScheduling(DecoderThreadScheduling& scheduling)
+{
+	scheduling.mGeneration = mDecoderSchedulingGeneration.load();
+	scheduling.LeaveWorkgroup();
+
+	// In low-power mode the ring buffer is deep enough that decoding needn't be prompt
+	bool lowPower = mLowPowerMode.load();
+	if(!mOutput->IsRealTime() || lowPower) {
+		// Restore timesharing so the QoS class takes effect
+		thread_extended_policy_data_t extendedPolicy = {
+			.timeshare = true
+		};
+		thread_policy_set(mach_thread_self(), THREAD_EXTENDED_POLICY, (thread_policy_t)&extendedPolicy, THREAD_EXTENDED_POLICY_COUNT);
+
+		auto qosClass = lowPower ? QOS_CLASS_BACKGROUND : mOfflineDecodingQoSClass.load();
+		if(pthread_set_qos_class_self_np(qosClass, 0))
+			LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Couldn't set decoding thread QoS class");
+		else
+			LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Decoding thread using QoS class " << qosClass);
+		return;
+	}
+
+	// The decoding thread is woken about once for each chunk consumed by the output
+	Float64 sampleRate = mOutput->GetFormat().mSampleRate;
+	UInt32 writeChunkSize = mActiveRingBufferWriteChunkSize.load();
+	if(0 >= sampleRate || 0 == writeChunkSize)
+		return;
+
+	uint64_t periodNanos = (uint64_t)((writeChunkSize / sampleRate) * NSEC_PER_SEC);
+
+	// Reserve twice the measured decoding load for each period
+	double computationFraction = std::min(std::max(2 * mDecodeLoad.load(), DECODER_MINIMUM_COMPUTATION_FRACTION), DECODER_MAXIMUM_COMPUTATION_FRACTION);
+	if(!setTimeConstraintPolicy(periodNanos, computationFraction))
+		return;
+
+	LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Decoding thread using time constraint policy with period " << periodNanos << " ns, computation " << computationFraction);
+
+#if __has_include(<os/workgroup.h>)
+	if(__builtin_available(macOS 11.0, iOS 14.0, *))
+		scheduling.JoinWorkgroup(mOutput->CopyIOThreadWorkgroup());
+#endif
+}
+
+void SFB::Audio::Player::SetOfflineDecodingQoSClass(qos_class_t qosClass)
+{
+	mOfflineDecodingQoSClass.store(qosClass);
+	mDecoderSchedulingGeneration.fetch_add(1);
+}
+
+SFB::Audio::Player::DecodingStatus SFB::Audio::Player::ServiceDecoding()
+{
+	if(eAudioPlayerFlagStopDecoding & mFlags.load())
+		return DecodingStatus::Idle;
+
+	AllocationTracker::Scope allocationScope(mDecodingAllocations);
+
+	// State snapshots are created here since only the decoding thread may use the decoder
+	if(mStateSnapshotRequested.exchange(false))
+		CreateRequestedStateSnapshot();
+
+	if(nullptr == mDecodingState)
+		return BeginDecoding();
+
+	return ContinueDecoding();
+}
+
+void SFB::Audio::Player::GetDecoderStatistics(const DecoderStateData& decoderState, DecoderStatistics& statistics) const
+{
+	statistics.mDecoding = decoderState.mDecoder->GetDecodingStatistics();
+	statistics.mConversionCPUTime = (CFTimeInterval)decoderState.mConversionCPUTime.load(std::memory_order_relaxed) / NSEC_PER_SEC;
+	statistics.mConversionWallTime = (CFTimeInterval)ConvertHostTimeToNanos(decoderState.mConversionWallTime.load(std::memory_order_relaxed)) / NSEC_PER_SEC;
+
+	Float64 sampleRate = decoderState.mDecoder->GetFormat().mSampleRate;
+	statistics.mDuration = 0 < sampleRate ? statistics.mDecoding.mFramesDecoded / sampleRate : 0;
+	statistics.mRealTimeFactor = 0 < statistics.mDuration ? (statistics.mDecoding.mCPUTime + statistics.mConversionCPUTime) / statistics.mDuration : 0;
+}
+
+void SFB::Audio::Player::CreateRequestedStateSnapshot()
+{
+	// Only the decoder being rendered is snapshotted, at the frame being rendered
+	if(mDecodingState && mDecodingState == GetCurrentDecoderState())
+		mStateSnapshot = mDecodingState->mDecoder->CreateStateSnapshot(mDecodingState->mFramesRendered.load());
+
+	dispatch_semaphore_signal(mStateSnapshotCreated);
+}
+
+bool SFB::Audio::Player::IsDecodingWorkPending() const
+{
+	if((eAudioPlayerFlagStopDecoding | eAudioPlayerFlagRingBufferNeedsReset | eAudioPlayerFlagStartPlayback) & mFlags.load() || mStateSnapshotRequested.load())
+		return true;
+
+	if(mDecodingState) {
+		// A parked decoder is woken when its input is received
+		if(eAudioPlayerFlagInputStalled & mFlags.load())
+			return -1 != mDecodingState->mFrameToSeek.load() || (eDecoderStateDataFlagStopDecoding & mDecodingState->mFlags.load());
+		return mDecodingWriteChunkSize <= mRingBuffer->GetFramesAvailableToWrite() || -1 != mDecodingState->mFrameToSeek.load() || (eDecoderStateDataFlagStopDecoding & mDecodingState->mFlags.load());
+	}
+
+	return nullptr != mPendingDecoderState || 0 < mQueuedDecoderCount.load();
+}
+
+CFTimeInterval SFB::Audio::Player::GetDecodingDeadline() const
+{
+	Float64 sampleRate = mOutput->GetFormat().mSampleRate;
+	if(0 >= sampleRate)
+		return 0;
+
+	return mRingBuffer->GetFramesAvailableToRead() / sampleRate;
+}
+
+SFB::Audio::Player::DecodingStatus SFB::Audio::Player::BeginDecoding()
+{
+	// A decoder state waiting for a free slot in the timeline takes precedence over the queue
+	__block DecoderStateData *decoderState = mPendingDecoderState;
+	mPendingDecoderState = nullptr;
+
+	if(nullptr == decoderState) {
+		// ========================================
+		// Lock the queue and remove the head element that contains the next decoder to use
+		// The lock is only taken if the queue appears non-empty
+		// A pre-rolled decoder is used if available; if a pre-roll is in progress the pre-roll queue will wake this thread when complete
+		__block Decoder::unique_ptr decoder;
+		__block DecoderStateData *prerolledDecoderState = nullptr;
+		if(0 < mQueuedDecoderCount.load()) {
+			dispatch_sync(mQueue, ^{
+				if(mPrerolledDecoderState) {
+					prerolledDecoderState = mPrerolledDecoderState;
+					mPrerolledDecoderState = nullptr;
+				}
+				else if(!mPrerollInProgress && !mDecoderQueue.empty() && mDecoderQueue.front()) {
+					decoder = std::move(mDecoderQueue.front());
+					mDecoderQueue.pop_front();
+				}
+				UpdateQueuedDecoderCount();
+			});
+		}
+
+		bool processedDecoder = decoder || prerolledDecoderState;
+
+		// A pre-rolled decoder state only needs to be checked for format compatibility
+		if(prerolledDecoderState) {
+			if(mOutput->SupportsFormat(prerolledDecoderState->mDecoder->GetFormat()))
+				decoderState = prerolledDecoderState;
+			else {
+				decoder = std::move(prerolledDecoderState->mDecoder);
+				delete prerolledDecoderState;
+			}
+			prerolledDecoderState = nullptr;
+		}
+
+		// ========================================
+		// Open the decoder if necessary
+		if(decoder && !decoder->IsOpen()) {
+			SFB::CFError error;
+			if(!OpenDecoder(*decoder, &error))  {
+				if(mDecoderErrorBlock)
+					mDecoderErrorBlock(*decoder, error);
+
+				if(error)
+					LOGGER_ERR("org.sbooth.AudioEngine.Player", "Error opening decoder: " << error);
+			}
+		}
+
+		// Create the decoder state
+		if(decoder) {
+			if(mOutput->SupportsFormat(decoder->GetFormat())) {
+				decoderState = new DecoderStateData(std::move(decoder));
+			}
+			else {
+				LOGGER_ERR("org.sbooth.AudioEngine.Player", "Format not supported: " << decoder->GetFormat());
+
+				if(mErrorBlock) {
+					SFB::CFString description(CFCopyLocalizedString(CFSTR("The format of the file “%@” is not supported."), ""));
+					SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Format not supported"), ""));
+					SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's format is not supported by the selected output device."), ""));
+
+					SFB::CFError error(CreateErrorForURL(Decoder::ErrorDomain, Decoder::InputOutputError, description, decoder->GetInputSource().GetURL(), failureReason, recoverySuggestion));
+
+					mErrorBlock(error);
+				}
+			}
+		}
+
+		// ========================================
+		// Ensure the decoder's format is compatible with the ring buffer
+		if(decoderState) {
+			const AudioFormat&		outputFormat		= mOutput->GetFormat();
+			const ChannelLayout&	outputChannelLayout	= mOutput->GetChannelLayout();
+			const AudioFormat&		nextFormat			= decoderState->mDecoder->GetFormat();
+			const ChannelLayout&	nextChannelLayout	= decoderState->mDecoder->GetChannelLayout();
 
 			// The two files can be joined seamlessly only if they have the same formats, sample rates, and channel counts
 			bool formatsMatch = true;
 
-			if(nextFormat.mFormatID != outputFormat.mFormatID) {
-				LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Gapless join failed: Output format ('" << StringForOSType(outputFormat.mFormatID) << "') and decoder format ('" << StringForOSType(nextFormat.mFormatID) << "') don't match");
-				formatsMatch = false;
-			}
-			else if(nextFormat.mSampleRate != outputFormat.mSampleRate) {
-				LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Gapless join failed: Output sample rate (" << outputFormat.mSampleRate << " Hz) and decoder sample rate (" << nextFormat.mSampleRate << " Hz) don't match");
-				formatsMatch = false;
+			if(nextFormat.mFormatID != outputFormat.mFormatID) {
+				LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Gapless join failed: Output format ('" << StringForOSType(outputFormat.mFormatID) << "') and decoder format ('" << StringForOSType(nextFormat.mFormatID) << "') don't match");
+				formatsMatch = false;
+			}
+			else if(nextFormat.mSampleRate != outputFormat.mSampleRate) {
+				LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Gapless join failed: Output sample rate (" << outputFormat.mSampleRate << " Hz) and decoder sample rate (" << nextFormat.mSampleRate << " Hz) don't match");
+				formatsMatch = false;
+			}
+			else if(nextFormat.mChannelsPerFrame != outputFormat.mChannelsPerFrame) {
+				LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Gapless join failed: Output channel count (" << outputFormat.mChannelsPerFrame << ") and decoder channel count (" << nextFormat.mChannelsPerFrame << ") don't match");
+				formatsMatch = false;
+			}
+
+			// Compact ring buffer storage would round audio of greater precision
+			if(formatsMatch && GetStoragePrecision(GetRingBufferStorageFormat(*decoderState->mDecoder)) > GetStoragePrecision(mRingBuffer->GetStorageFormat())) {
+				LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Gapless join failed: Decoder precision (" << nextFormat.mBitsPerChannel << " bits) exceeds ring buffer storage precision");
+				formatsMatch = false;
+			}
+
+			// Enqueue the decoder if its channel layout matches the ring buffer's channel layout (so the channel map in the output will remain valid)
+			if(nextChannelLayout != outputChannelLayout) {
+				LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Gapless join failed: Output channel layout (" << outputChannelLayout << ") and decoder channel layout (" << nextChannelLayout << ") don't match");
+				formatsMatch = false;
+			}
+
+			// If the formats don't match, the decoder can't be used with the current ring buffer format
+			if(!formatsMatch) {
+				// Ensure output is muted before performing operations that aren't thread safe
+				if(mOutput->IsRunning()) {
+					// Allocate the next ring buffer while the current decoder finishes rendering
+					// so the swap at the boundary doesn't wait on memory allocation
+					PrepareStandbyRingBuffer(*decoderState->mDecoder);
+
+					mFlags.fetch_or(eAudioPlayerFlagFormatMismatch);
+
+					// Wait for the currently rendering decoder to finish
+					// The rendering thread will clear eAudioPlayerFlagFormatMismatch when the current render cycle completes
+					WaitForRenderingThreadToClearFlag(eAudioPlayerFlagFormatMismatch);
+				}
+
+				if(mFormatMismatchBlock)
+					mFormatMismatchBlock(outputFormat, nextFormat);
+
+				// Adjust the formats
+				dispatch_sync(mQueue, ^{
+					if(!SetupOutputAndRingBufferForDecoder(*decoderState->mDecoder, true)) {
+						delete decoderState;
+						decoderState = nullptr;
+					}
+				});
+
+				// Clear the mute flag that was set in the rendering thread so output will resume
+				mFlags.fetch_and(~eAudioPlayerFlagMuteOutput);
+
+				// Free the previous ring buffer (or an unused standby) now that output has resumed
+				mStandbyRingBuffer->Deallocate();
+				UpdateRingBufferFootprint();
+			}
+		}
+
+		if(nullptr == decoderState)
+			return processedDecoder ? DecodingStatus::Continue : DecodingStatus::Idle;
+	}
+
+	// ========================================
+	// Append the decoder state to the timeline of active decoders
+	// If no slot is free the decoder state is held until the collector frees one, which wakes the decoder
+	if(!AppendDecoderStateToTimeline(decoderState)) {
+		LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Waiting for a free slot in the decoder timeline");
+		mPendingDecoderState = decoderState;
+		return DecodingStatus::Idle;
+	}
+
+	// Prepare the next decoders while this one is decoding
+	PrerollNextDecoder();
+	WarmUpQueuedDecoders();
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Decoding starting for \"" << decoderState->mDecoder->GetURL() << "\"");
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Decoder format: " << decoderState->mDecoder->GetFormat());
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Decoder channel layout: " << decoderState->mDecoder->GetChannelLayout());
+
+//			const AudioFormat& decoderFormat = decoderState->mDecoder->GetFormat();
+	AudioFormat decoderFormat = decoderState->mDecoder->GetFormat();
+
+	// The write chunk size is fixed for the lifetime of the decoder since the buffers are sized for it
+	UInt32 writeChunkSize = mRingBufferWriteChunkSize;
+	if(writeChunkSize != mActiveRingBufferWriteChunkSize.exchange(writeChunkSize))
+		mDecoderSchedulingGeneration.fetch_add(1);
+
+	// Decoded audio is stretched a chunk at a time
+	if(mTimeStretcher.Configure(mOutput->GetFormat(), writeChunkSize) && (mTimeStretchBufferList.GetCapacityFrames() != writeChunkSize || mTimeStretchBufferList.GetFormat() != mOutput->GetFormat())) {
+		if(!mTimeStretchBufferList.Allocate(mOutput->GetFormat(), writeChunkSize))
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to allocate memory for time stretching");
+	}
+
+	// ========================================
+	// Create the AudioConverter which will convert from the decoder's format to the output format (for PCM and DoP output)
+	// Audio already in the output format is read directly into the ring buffer
+	AudioConverterRef audioConverter = nullptr;
+	if((mOutput->GetFormat().IsPCM() || mOutput->GetFormat().IsDoP()) && decoderFormat != mOutput->GetFormat()) {
+		auto outputFormat = mOutput->GetFormat();
+
+		// DoP masquerades as PCM
+		bool decoderIsDoP = decoderFormat.IsDoP();
+		bool outputIsDoP = outputFormat.IsDoP();
+
+		if(decoderIsDoP)
+			decoderFormat.mFormatID = kAudioFormatLinearPCM;
+
+		if(outputIsDoP)
+			outputFormat.mFormatID = kAudioFormatLinearPCM;
+
+		OSStatus result = AudioConverterNew(&decoderFormat, &outputFormat, &audioConverter);
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterNew failed: " << result);
+
+			// If this happens, output will be impossible
+			if(mErrorBlock) {
+				SFB::CFString description(CFCopyLocalizedString(CFSTR("The format of the file “%@” is not supported."), ""));
+				SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Format not supported"), ""));
+				SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's format is not supported by the selected output device."), ""));
+
+				SFB::CFError formatError(CreateErrorForURL(Decoder::ErrorDomain, Decoder::InputOutputError, description, decoderState->mDecoder->GetURL(), failureReason, recoverySuggestion));
+
+				mErrorBlock(formatError);
+			}
+
+			decoderState->mFlags.fetch_or(eDecoderStateDataFlagDecodingFinished | eDecoderStateDataFlagRenderingFinished);
+			decoderState = nullptr;
+
+			RequestDecoderStateCollection();
+
+			return DecodingStatus::Continue;
+		}
+
+		if(decoderIsDoP)
+			decoderFormat.mFormatID = kAudioFormatDoP;
+
+		if(outputIsDoP)
+			outputFormat.mFormatID = kAudioFormatDoP;
+
+		// Handle channel mapping
+//				auto& decoderChannelLayout = decoderState->mDecoder->GetChannelLayout();
+//				if(decoderChannelLayout) {
+//					auto decoderACL = decoderChannelLayout.GetACL();
+//					result = AudioConverterSetProperty(audioConverter, kAudioConverterInputChannelLayout, sizeof(*decoderACL), decoderACL);
+//					if(noErr != result)
+//						LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterSetProperty (kAudioConverterInputChannelLayout) failed: " << result);
+//				}
+//
+//				auto& outputChannelLayout = mOutput->GetChannelLayout();
+//				if(outputChannelLayout) {
+//					auto outputACL = outputChannelLayout.GetACL();
+//					result = AudioConverterSetProperty(audioConverter, kAudioConverterOutputChannelLayout, sizeof(*outputACL), outputACL);
+//					if(noErr != result)
+//						LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterSetProperty (kAudioConverterOutputChannelLayout) failed: " << result);
+//				}
+
+		// ========================================
+		// Determine the size of the buffer list which will serve as the converter's input
+		UInt32 inputBufferSize = writeChunkSize * mOutput->GetFormat().mBytesPerFrame;
+		UInt32 dataSize = sizeof(inputBufferSize);
+		result = AudioConverterGetProperty(audioConverter, kAudioConverterPropertyCalculateInputBufferSize, &dataSize, &inputBufferSize);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterGetProperty (kAudioConverterPropertyCalculateInputBufferSize) failed: " << result);
+
+		// ========================================
+		// Allocate the buffer list which will serve as the transport between the decoder and the converter
+		// The converter's output is written directly to the ring buffer
+		decoderState->AllocateBufferList((UInt32)decoderFormat.ByteCountToFrameCount(inputBufferSize));
+	}
+
+	// Input received asynchronously is read ahead according to the rate at which it is consumed
+	auto& inputSource = decoderState->mDecoder->GetInputSource();
+	inputSource.SetConsumptionRate(EstimateInputByteRate(inputSource.GetLength(), decoderState->mTotalFrames, decoderState->mDecoder->GetFormat().mSampleRate));
+	inputSource.SetReadAheadDuration(mInputReadAheadTime.load());
+
+	mDecodingState = decoderState;
+	mAudioConverter = audioConverter;
+	mDecodingWriteChunkSize = writeChunkSize;
+
+	return DecodingStatus::Continue;
+}
+
+SFB::Audio::Player::DecodingStatus SFB::Audio::Player::ContinueDecoding()
+{
+	DecoderStateData *decoderState = mDecodingState;
+	AudioConverterRef audioConverter = mAudioConverter;
+	UInt32 writeChunkSize = mDecodingWriteChunkSize;
+
+	mFlags.fetch_and(~(eAudioPlayerFlagDecoderNeedsSpace | eAudioPlayerFlagInputStalled));
+
+	// ========================================
+	// Stop decoding if cancelled
+	if(eDecoderStateDataFlagStopDecoding & decoderState->mFlags.load()) {
+		EndDecoding();
+		return DecodingStatus::Continue;
+	}
+
+	// Fan-out outputs added during playback are configured here so no audio is written while their cursors are positioned
+	if(eAudioPlayerFlagFanOutOutputsChanged & mFlags.load()) {
+		dispatch_sync(mQueue, ^{
+			SetupFanOutOutputsForDecoder(*decoderState->mDecoder);
+		});
+	}
+
+	bool finished = false;
+
+	// Fill the ring buffer with as much data as possible
+	for(;;) {
+
+		// Reset the ring buffer if required
+		if(eAudioPlayerFlagRingBufferNeedsReset & mFlags.load()) {
+
+			mFlags.fetch_and(~eAudioPlayerFlagRingBufferNeedsReset);
+
+			// Ensure output is muted before performing operations that aren't thread safe
+			if(mOutput->IsRunning()) {
+				mFlags.fetch_or(eAudioPlayerFlagRequestMute);
+
+				// The rendering thread will clear eAudioPlayerFlagRequestMute when the current render cycle completes
+				WaitForRenderingThreadToClearFlag(eAudioPlayerFlagRequestMute);
+			}
+			else
+				mFlags.fetch_or(eAudioPlayerFlagMuteOutput);
+
+			// Reset the converter to flush any buffers
+			if(audioConverter) {
+				auto result = AudioConverterReset(audioConverter);
+				if(noErr != result)
+					LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterReset failed: " << result);
+			}
+
+			mEffectChain.Reset();
+
+			// Reset() is not thread safe but the rendering thread is outputting silence
+			mRingBuffer->Reset();
+			ResetTimeStretch();
+
+			// Clear the mute flag
+			mFlags.fetch_and(~eAudioPlayerFlagMuteOutput);
+		}
+
+		// Determine how many frames are available in the ring buffer
+		size_t framesAvailableToWrite = mRingBuffer->GetFramesAvailableToWrite();
+
+		// Force writes to the ring buffer to be at least writeChunkSize
+		// While scrubbing only a small amount of audio is decoded ahead so the next seek is heard promptly
+		SInt64 frameToSeek = decoderState->mFrameToSeek.load();
+		if(writeChunkSize <= framesAvailableToWrite && (-1 != frameToSeek || !IsScrubFillLimitReached(writeChunkSize))) {
+			AllocationTracker::Scope trackAllocationScope(decoderState->mAllocations);
+
+			// Seek to the specified frame
+			if(-1 != frameToSeek) {
+				LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Seeking to frame " << frameToSeek);
+
+				// A seek moves away from the end of the decoder, so the next decoder plays normally
+				CancelCrossfade();
+
+				// Ensure output is muted before performing operations that aren't thread safe
+				if(mOutput->IsRunning()) {
+					mFlags.fetch_or(eAudioPlayerFlagRequestMute);
+
+					// The rendering thread will clear eAudioPlayerFlagRequestMute when the current render cycle completes
+					WaitForRenderingThreadToClearFlag(eAudioPlayerFlagRequestMute);
+				}
+				else
+					mFlags.fetch_or(eAudioPlayerFlagMuteOutput);
+
+				bool approximate = mScrubbing.load();
+				SInt64 newFrame = decoderState->SeekToFrame(frameToSeek, approximate);
+
+				if(newFrame != frameToSeek && !approximate)
+					LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Inaccurate seek to frame  " << frameToSeek << ", got frame " << newFrame);
+
+				// Update the seek request unless it was superseded while seeking
+				bool superseded = !decoderState->mFrameToSeek.compare_exchange_strong(frameToSeek, -1);
+
+				// Notify the issuer of an asynchronous seek
+				if(!superseded && mSeekCompletionPending.exchange(false)) {
+					bool success = (-1 != newFrame);
+					dispatch_async(mCommandQueue, ^{
+						CompletePendingSeek(success);
+					});
+				}
+
+				// Update the counters accordingly
+				if(-1 != newFrame) {
+					decoderState->mFramesRendered.store(newFrame);
+					mFramesDecoded.store(newFrame);
+					mFramesRendered.store(newFrame);
+
+					// Reset the converter to flush any buffers
+					if(audioConverter) {
+						auto result = AudioConverterReset(audioConverter);
+						if(noErr != result)
+							LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterReset failed: " << result);
+					}
+
+					// Discard the effects' state for audio preceding the seek
+					mEffectChain.Reset();
+
+					// Reset the ring buffer and output
+					mRingBuffer->Reset();
+					ResetTimeStretch();
+					mOutput->Reset();
+				}
+
+				// Clear the mute flag
+				mFlags.fetch_and(~eAudioPlayerFlagMuteOutput);
+
+				// Perform a superseding seek before decoding from this position
+				if(superseded)
+					continue;
+			}
+
+			// Stretched audio remaining from the previous chunk is written before more is decoded
+			if(!WriteTimeStretcherOutput())
+				break;
+
+			// At the normal rate the stretched audio is completed and decoding continues without stretching
+			bool stretching = mTimeStretcher.IsConfigured() && mTimeStretchBufferList && 1 != mTimeStretcher.GetRate();
+			if(!stretching && !mTimeStretcher.IsEmpty()) {
+				mTimeStretcher.Flush();
+				if(!WriteTimeStretcherOutput())
+					break;
+			}
+
+			SInt64 startingFrameNumber = decoderState->GetCurrentFrame();
+
+			if(-1 == startingFrameNumber) {
+				LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to determine starting frame number");
+				return DecodingStatus::Idle;
+			}
+
+			// If this is the first frame, decoding is just starting
+			if(0 == startingFrameNumber && !(eDecoderStateDataFlagDecodingStarted & decoderState->mFlags.load())) {
+				// Call the decoding started block
+				if(mDecoderEventBlocks[0])
+					mDecoderEventBlocks[0](*decoderState->mDecoder);
+				decoderState->BeginAnalysis(mAnalysisTapBlock);
+				decoderState->mFlags.fetch_or(eDecoderStateDataFlagDecodingStarted);
+			}
+
+			// A length estimated when the decoder was opened is replaced once the decoder determines it exactly
+			if(decoderState->mTotalFramesEstimated && !decoderState->mDecoder->IsTotalFramesEstimated())
+				RefineTotalFrames(*decoderState, decoderState->mDecoder->GetTotalFrames());
+
+			// Rather than wait in the decoder for input that hasn't been received, rendering continues from the ring buffer
+			if(ParkIfInputWouldBlock(*decoderState, writeChunkSize))
+				return DecodingStatus::InputStalled;
+
+			decoderState->ConfigureGain(mReplayGainMode.load(), mReplayGainPreamp.load(), mPeakLimiterEnabled.load(), mOutput->GetFormat());
+
+			// Begin crossfading into the next decoder as the end of this one approaches
+			if(nullptr == mCrossfadeState && 0 < mCrossfadeDuration.load() && -1 != decoderState->mTotalFrames)
+				BeginCrossfade(decoderState->mTotalFrames - startingFrameNumber);
+
+			// Read the input chunk directly into the ring buffer, converting from the decoder's format to the AUGraph's format
+			// The free space may be split into two regions if it wraps around the end of the ring buffer
+			// Audio to be stretched is read into a single region which is stretched into the ring buffer
+			if(stretching)
+				mTimeStretchBufferList.Reset();
+			auto writeVector = stretching ? RingBuffer::BufferPair(RingBuffer::Buffer(mTimeStretchBufferList, writeChunkSize), RingBuffer::Buffer()) : mRingBuffer->GetWriteVector();
+			UInt32 framesDecoded = 0;
+			auto decodeStartTime = mach_absolute_time();
+			SFB_SIGNPOST_INTERVAL_BEGIN("Player::DecodeChunk", decoderState, "%{public}@ frame %lld, %u frames", decoderState->mDecoder->GetURL(), startingFrameNumber, writeChunkSize);
+
+			for(auto& buffer : { writeVector.first, writeVector.second }) {
+				UInt32 framesRequested = (UInt32)std::min(buffer.mFrameCapacity, (size_t)(writeChunkSize - framesDecoded));
+				if(0 == framesRequested)
+					break;
+
+				UInt32 framesRead = framesRequested;
+
+				if(audioConverter) {
+					decoderState->mReadTime = 0;
+					auto decoderCPUStartTime = decoderState->mDecoder->GetDecodingStatistics().mCPUTime;
+					auto convertCPUStartTime = GetThreadCPUTime();
+					auto convertStartTime = mach_absolute_time();
+					auto result = AudioConverterFillComplexBuffer(audioConverter, myAudioConverterComplexInputDataProc, decoderState, &framesRead, buffer.mBufferList, nullptr);
+					if(noErr != result)
+						LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterFillComplexBuffer failed: " << result);
+
+					// The time spent in the converter excluding the decoder
+					auto convertTime = mach_absolute_time() - convertStartTime;
+					if(convertTime > decoderState->mReadTime) {
+						mConverterTime.fetch_add(convertTime - decoderState->mReadTime, std::memory_order_relaxed);
+						decoderState->mConversionWallTime.fetch_add(convertTime - decoderState->mReadTime, std::memory_order_relaxed);
+					}
+
+					auto convertCPUTime = (double)(GetThreadCPUTime() - convertCPUStartTime) - ((decoderState->mDecoder->GetDecodingStatistics().mCPUTime - decoderCPUStartTime) * NSEC_PER_SEC);
+					if(0 < convertCPUTime)
+						decoderState->mConversionCPUTime.fetch_add((uint64_t)convertCPUTime, std::memory_order_relaxed);
+				}
+				else {
+					framesRead = decoderState->ReadAudio(buffer.mBufferList, framesRequested);
+
+					// Bit swap if required
+					auto outputFormat = mOutput->GetFormat();
+					if(outputFormat.IsDSD() && (kAudioFormatFlagIsBigEndian & outputFormat.mFormatFlags) != (kAudioFormatFlagIsBigEndian & decoderState->mDecoder->GetFormat().mFormatFlags)) {
+						const auto& kernels = SampleKernels::Get();
+						for(UInt32 i = 0; i < buffer.mBufferList->mNumberBuffers; ++i) {
+							uint8_t *buf = (uint8_t *)buffer.mBufferList->mBuffers[i].mData;
+							kernels.ReverseBits(buf, buf, (UInt32)outputFormat.FrameCountToByteCount(framesRead));
+						}
+					}
+				}
+
+				framesDecoded += framesRead;
+
+				// Stop at a short read; the remainder of the chunk will be decoded on the next pass
+				if(framesRead < framesRequested)
+					break;
+			}
+
+			// Each decoder's gain is applied before mixing
+			if(0 != framesDecoded) {
+				UInt32 offset = 0;
+				for(auto& buffer : { writeVector.first, writeVector.second }) {
+					UInt32 regionFrames = (UInt32)std::min(buffer.mFrameCapacity, (size_t)(framesDecoded - offset));
+					if(0 == regionFrames)
+						break;
+
+					decoderState->ApplyGain(buffer.mBufferList, regionFrames);
+					offset += regionFrames;
+				}
+			}
+
+			// Mix in the next decoder while crossfading
+			if(mCrossfadeState && 0 != framesDecoded)
+				MixCrossfade(writeVector, framesDecoded);
+
+			// Decoding thread effects process the mixed audio before it is buffered
+			if(0 != framesDecoded && !mEffectChain.IsEmpty()) {
+				UInt32 offset = 0;
+				for(auto& buffer : { writeVector.first, writeVector.second }) {
+					UInt32 regionFrames = (UInt32)std::min(buffer.mFrameCapacity, (size_t)(framesDecoded - offset));
+					if(0 == regionFrames)
+						break;
+
+					mEffectChain.Process(buffer.mBufferList, regionFrames, mOutput->GetFormat());
+					offset += regionFrames;
+				}
+			}
+
+			SFB_SIGNPOST_INTERVAL_END("Player::DecodeChunk", decoderState, "%u frames decoded", framesDecoded);
+
+			// Commit the decoded audio
+			if(0 != framesDecoded) {
+				if(stretching) {
+					if(!mTimeStretcher.Process(mTimeStretchBufferList, framesDecoded))
+						LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to stretch " << framesDecoded << " frames");
+					WriteTimeStretcherOutput();
+				}
+				else {
+					mRingBuffer->WriteAdvance(framesDecoded);
+					mRingBufferFramesWritten += framesDecoded;
+				}
+				mFramesDecoded.fetch_add(framesDecoded);
+
+				auto decodeTime = mach_absolute_time() - decodeStartTime;
+				mDecodeChunkCount.fetch_add(1, std::memory_order_relaxed);
+				mDecodeChunkTime.fetch_add(decodeTime, std::memory_order_relaxed);
+				StoreMaximum(mMaximumDecodeChunkTime, decodeTime);
+				mDecodeTimeHistogram[GetDecodeTimeHistogramBucket(ConvertHostTimeToNanos(decodeTime))].fetch_add(1, std::memory_order_relaxed);
+
+				if(mRenderTrace.IsRecording())
+					mRenderTrace.Record(RenderTrace::Thread::Decoding, RenderTrace::EventType::DecodeChunk, decodeStartTime, framesDecoded, mRingBuffer->GetFramesAvailableToRead(), decodeTime);
+
+				// Track the decoding time relative to the duration of the decoded audio
+				Float64 sampleRate = mOutput->GetFormat().mSampleRate;
+				if(0 < sampleRate) {
+					double elapsed = ConvertHostTimeToNanos(decodeTime);
+					double duration = (framesDecoded / sampleRate) * NSEC_PER_SEC;
+					double load = mDecodeLoad.load();
+					mDecodeLoad.store(0 == load ? elapsed / duration : (0.9 * load) + (0.1 * (elapsed / duration)));
+				}
+			}
+
+			// If no frames were returned, this is the end of stream
+			if(0 == framesDecoded/* && !(eDecoderStateDataFlagDecodingFinished & decoderState->mFlags.load())*/) {
+				// The stretched audio is completed and written before decoding is finished
+				if(!mTimeStretcher.IsEmpty()) {
+					mTimeStretcher.Flush();
+					if(!WriteTimeStretcherOutput())
+						break;
+				}
+
+				LOGGER_INFO("org.sbooth.AudioEngine.Player", "Decoding finished for \"" << decoderState->mDecoder->GetURL() << "\"");
+
+				// Some formats (MP3) may not know the exact number of frames in advance
+				// without processing the entire file, which is a potentially slow operation
+				// Rather than require preprocessing to ensure an accurate frame count, update
+				// it here so EOS is correctly detected in DidRender()
+				if(decoderState->mTotalFramesEstimated)
+					RefineTotalFrames(*decoderState, startingFrameNumber);
+				else
+					decoderState->mTotalFrames = startingFrameNumber;
+
+				// Deliver the analysis before calling the decoding finished block so the results are available to it
+				decoderState->FinishAnalysis();
+
+				if(AllocationTracker::IsInstalled()) {
+					auto allocationCount = decoderState->mAllocations.mAllocationCount.load(std::memory_order_relaxed);
+					mLastTrackAllocationCount.store(allocationCount, std::memory_order_relaxed);
+					LOGGER_INFO("org.sbooth.AudioEngine.Player", allocationCount << " allocations (" << decoderState->mAllocations.mByteCount.load(std::memory_order_relaxed) << " bytes) while decoding \"" << decoderState->mDecoder->GetURL() << "\"");
+				}
+
+				DecoderStatistics statistics;
+				GetDecoderStatistics(*decoderState, statistics);
+				LOGGER_INFO("org.sbooth.AudioEngine.Player", "Decoding \"" << decoderState->mDecoder->GetURL() << "\" used " << (statistics.mDecoding.mCPUTime + statistics.mConversionCPUTime) << " s of CPU time (real-time factor " << statistics.mRealTimeFactor << ")");
+
+				// Call the decoding finished block
+				if(mDecoderEventBlocks[1])
+					mDecoderEventBlocks[1](*decoderState->mDecoder);
+
+				// Decoding is complete; EndDecoding() marks the decoder state as finished
+				finished = true;
+
+				break;
+			}
+		}
+		// Not enough space remains in the ring buffer to write an entire decoded chunk
+		else
+			break;
+	}
+
+	// Start playback
+	if(eAudioPlayerFlagStartPlayback & mFlags.load()) {
+		// Output isn't started until enough input received asynchronously is buffered to avoid an underrun
+		if(!finished && !WaitForPrebuffering(*decoderState))
+			return DecodingStatus::Continue;
+
+		mFlags.fetch_and(~eAudioPlayerFlagStartPlayback);
+
+		if(!mOutput->IsRunning()) {
+			// We don't want to start output in the middle of a buffer modification
+			dispatch_sync(mQueue, ^{
+				if(!mOutput->Start())
+					LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to start output");
+				else
+					StartFanOutOutputs();
+			});
+		}
+	}
+
+	// Suspended output is resumed once enough audio is buffered that it won't immediately underrun
+	// The fence orders the write to the ring buffer before the load of mOutputSuspended, pairing with SuspendOutputIfSilent()
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(mOutputSuspended.load() && !(eAudioPlayerFlagMuteOutput & mFlags.load())) {
+		if(finished || writeChunkSize > mRingBuffer->GetFramesAvailableToWrite() || (size_t)(OUTPUT_RESUME_FILL_FRACTION * mRingBuffer->GetCapacityFrames()) <= mRingBuffer->GetFramesAvailableToRead())
+			ResumeSuspendedOutput();
+	}
+
+	if(finished) {
+		// Decoding continues with the decoder being crossfaded into
+		if(mCrossfadeState)
+			CompleteCrossfade();
+		else
+			EndDecoding();
+		return DecodingStatus::Continue;
+	}
+
+	// Request a wakeup from the rendering thread when there is space for another chunk
+	// eAudioPlayerFlagDecoderNeedsSpace is set before the free space is checked so a read in the rendering thread can't be missed
+	mFlags.fetch_or(eAudioPlayerFlagDecoderNeedsSpace);
+	if(writeChunkSize <= mRingBuffer->GetFramesAvailableToWrite() && (-1 != decoderState->mFrameToSeek.load() || !IsScrubFillLimitReached(writeChunkSize))) {
+		mFlags.fetch_and(~eAudioPlayerFlagDecoderNeedsSpace);
+		return DecodingStatus::Continue;
+	}
+
+	return DecodingStatus::NeedsSpace;
+}
+
+bool SFB::Audio::Player::IsScrubFillLimitReached(UInt32 writeChunkSize) const
+{
+	return mScrubbing.load() && (SCRUB_FILL_CHUNK_COUNT * writeChunkSize) <= mRingBuffer->GetFramesAvailableToRead();
+}
+
+void SFB::Audio::Player::RefineTotalFrames(DecoderStateData& decoderState, SInt64 totalFrames)
+{
+	decoderState.mTotalFramesEstimated = false;
+
+	if(totalFrames != decoderState.mTotalFrames) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Player", "Estimated length of " << decoderState.mTotalFrames << " frames refined to " << totalFrames << " for \"" << decoderState.mDecoder->GetURL() << "\"");
+		decoderState.mTotalFrames = totalFrames;
+	}
+
+	// Call the total frames refined block
+	if(mDecoderEventBlocks[4])
+		mDecoderEventBlocks[4](*decoderState.mDecoder);
+}
+
+bool SFB::Audio::Player::WaitForPrebuffering(DecoderStateData& decoderState)
+{
+	CFTimeInterval prebufferTime = mPrebufferTime.load();
+	if(0 >= prebufferTime)
+		return true;
+
+	auto& inputSource = decoderState.mDecoder->GetInputSource();
+	double byteRate = EstimateInputByteRate(inputSource.GetLength(), decoderState.mTotalFrames, decoderState.mDecoder->GetFormat().mSampleRate);
+
+	// The wait is bounded so requests to stop or seek are serviced promptly
+	return inputSource.WaitForBuffering((SInt64)(prebufferTime * byteRate), PREBUFFER_WAIT_INTERVAL_SECONDS);
+}
+
+bool SFB::Audio::Player::ParkIfInputWouldBlock(DecoderStateData& decoderState, UInt32 writeChunkSize)
+{
+	auto& decoder = *decoderState.mDecoder;
+	auto& inputSource = decoder.GetInputSource();
+
+	// The input needed for a chunk is estimated from the average bit rate
+	Float64 sampleRate = decoder.GetFormat().mSampleRate;
+	double byteRate = EstimateInputByteRate(inputSource.GetLength(), decoderState.mTotalFrames, sampleRate);
+	SInt64 byteCount = std::max((SInt64)((writeChunkSize / sampleRate) * byteRate), (SInt64)1);
+
+	// A decoder whose audio is decoded elsewhere is parked in the same way as one waiting for input
+	if(!inputSource.WouldBlock(byteCount) && !decoder.WouldBlock())
+		return false;
+
+	// eAudioPlayerFlagInputStalled is set before the input is checked again so input received meanwhile can't be missed
+	mFlags.fetch_or(eAudioPlayerFlagInputStalled);
+	InputSource::ReadabilityHandler handler = ^{
+		if(eAudioPlayerFlagInputStalled & mFlags.fetch_and(~eAudioPlayerFlagInputStalled))
+			WakeDecoder();
+	};
+	inputSource.SetReadabilityHandler(handler);
+	decoder.SetReadabilityHandler(handler);
+
+	if(!inputSource.WouldBlock(byteCount) && !decoder.WouldBlock()) {
+		mFlags.fetch_and(~eAudioPlayerFlagInputStalled);
+		return false;
+	}
+
+	LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Input stalled for \"" << decoderState.mDecoder->GetURL() << "\"");
+
+	return true;
+}
+
+void SFB::Audio::Player::EndDecoding()
+{
+	// Set the appropriate flags for collection
+	// The decoder state may be reclaimed once eDecoderStateDataFlagDecodingFinished is set so it must not be accessed afterwards
+	if(mDecodingState) {
+		mDecodingState->mDecoder->GetInputSource().SetReadabilityHandler(nullptr);
+		mDecodingState->mDecoder->SetReadabilityHandler(nullptr);
+		mFlags.fetch_and(~eAudioPlayerFlagInputStalled);
+
+		mDecodingState->mFlags.fetch_or(eDecoderStateDataFlagDecodingFinished);
+		mDecodingState = nullptr;
+
+		// If eAudioPlayerFlagMuteOutput is set SkipToNextTrack() may be waiting for this decoder to finish
+		if(eAudioPlayerFlagMuteOutput & mFlags.load())
+			mSemaphore.Signal();
+
+		RequestDecoderStateCollection();
+	}
+
+	if(mAudioConverter) {
+		auto result = AudioConverterDispose(mAudioConverter);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterDispose failed: " << result);
+		mAudioConverter = nullptr;
+	}
+
+	CancelCrossfade();
+}
+
+bool SFB::Audio::Player::BeginCrossfade(SInt64 framesRemaining)
+{
+	const AudioFormat& outputFormat = mOutput->GetFormat();
+
+	SInt64 crossfadeFrames = (SInt64)(mCrossfadeDuration.load() * outputFormat.mSampleRate);
+	if(0 >= framesRemaining || framesRemaining > crossfadeFrames)
+		return false;
+
+	// The decoders are mixed in the output format
+	// The outgoing decoder may be read without a converter when it provides audio in the output format
+	if(!outputFormat.IsPCM() || !(kAudioFormatFlagIsFloat & outputFormat.mFormatFlags) || 32 != outputFormat.mBitsPerChannel)
+		return false;
+
+	// If the next decoder hasn't been pre-rolled when the crossfade should begin the crossfade is shortened
+	__block DecoderStateData *decoderState = nullptr;
+	__block uint64_t generation = 0;
+	dispatch_sync(mQueue, ^{
+		if(nullptr == mPrerolledDecoderState)
+			return;
+
+		// Only decoders that could be joined gaplessly can be mixed
+		const AudioFormat& nextFormat = mPrerolledDecoderState->mDecoder->GetFormat();
+		if(!nextFormat.IsPCM() || nextFormat.mSampleRate != outputFormat.mSampleRate || nextFormat.mChannelsPerFrame != outputFormat.mChannelsPerFrame || mPrerolledDecoderState->mDecoder->GetChannelLayout() != mOutput->GetChannelLayout())
+			return;
+
+		decoderState = mPrerolledDecoderState;
+		mPrerolledDecoderState = nullptr;
+		generation = mPrerollGeneration;
+
+		UpdateQueuedDecoderCount();
+	});
+
+	if(nullptr == decoderState)
+		return false;
+
+	mCrossfadeState = decoderState;
+	mCrossfadeGeneration = generation;
+
+	AudioFormat decoderFormat = decoderState->mDecoder->GetFormat();
+	auto result = AudioConverterNew(&decoderFormat, &outputFormat, &mCrossfadeConverter);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterNew failed: " << result);
+		mCrossfadeConverter = nullptr;
+		CancelCrossfade();
+		return false;
+	}
+
+	// The incoming decoder is read in chunks the same size as the outgoing decoder
+	UInt32 inputBufferSize = mDecodingWriteChunkSize * outputFormat.mBytesPerFrame;
+	UInt32 dataSize = sizeof(inputBufferSize);
+	result = AudioConverterGetProperty(mCrossfadeConverter, kAudioConverterPropertyCalculateInputBufferSize, &dataSize, &inputBufferSize);
+	if(noErr != result)
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterGetProperty (kAudioConverterPropertyCalculateInputBufferSize) failed: " << result);
+
+	if(!decoderState->AllocateBufferList((UInt32)decoderFormat.ByteCountToFrameCount(inputBufferSize)) || !mCrossfadeBufferList.Allocate(outputFormat, mDecodingWriteChunkSize)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to allocate crossfade buffers");
+		CancelCrossfade();
+		return false;
+	}
+
+	mCrossfadeGains.reset(new float [2 * mDecodingWriteChunkSize]);
+	mCrossfadeFrameCount = framesRemaining;
+	mCrossfadeFramesMixed = 0;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Crossfading into \"" << decoderState->mDecoder->GetURL() << "\" over " << framesRemaining << " frames");
+
+	// Call the decoding started block
+	if(mDecoderEventBlocks[0])
+		mDecoderEventBlocks[0](*decoderState->mDecoder);
+	decoderState->BeginAnalysis(mAnalysisTapBlock);
+	decoderState->ConfigureGain(mReplayGainMode.load(), mReplayGainPreamp.load(), mPeakLimiterEnabled.load(), outputFormat);
+	decoderState->mFlags.fetch_or(eDecoderStateDataFlagDecodingStarted);
+
+	return true;
+}
+
+void SFB::Audio::Player::MixCrossfade(const RingBuffer::BufferPair& writeVector, UInt32 frameCount)
+{
+	UInt32 capacityFrames = mCrossfadeBufferList.GetCapacityFrames();
+	frameCount = std::min(frameCount, capacityFrames);
+
+	// Decode the same number of frames from the incoming decoder; a short read is treated as silence
+	mCrossfadeBufferList.Reset();
+	UInt32 framesRead = frameCount;
+	auto result = AudioConverterFillComplexBuffer(mCrossfadeConverter, myAudioConverterComplexInputDataProc, mCrossfadeState, &framesRead, mCrossfadeBufferList, nullptr);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterFillComplexBuffer failed: " << result);
+		framesRead = 0;
+	}
+
+	mCrossfadeState->ApplyGain(mCrossfadeBufferList, framesRead);
+
+	// ========================================
+	// Calculate the gains for this chunk from its position in the crossfade
+	float *fadeIn = mCrossfadeGains.get();
+	float *fadeOut = fadeIn + capacityFrames;
+
+	float position = (float)mCrossfadeFramesMixed / mCrossfadeFrameCount;
+	float increment = 1.f / mCrossfadeFrameCount;
+	float zero = 0, one = 1, negativeOne = -1;
+
+	// The outgoing decoder's length may have been an estimate
+	vDSP_vramp(&position, &increment, fadeIn, 1, frameCount);
+	vDSP_vclip(fadeIn, 1, &zero, &one, fadeIn, 1, frameCount);
+
+	if(CrossfadeCurve::EqualPower == mCrossfadeCurve.load()) {
+		float quarterTurn = (float)M_PI_2;
+		int count = (int)frameCount;
+		vDSP_vsmul(fadeIn, 1, &quarterTurn, fadeIn, 1, frameCount);
+		vvcosf(fadeOut, fadeIn, &count);
+		vvsinf(fadeIn, fadeIn, &count);
+	}
+	else
+		vDSP_vsmsa(fadeIn, 1, &negativeOne, &one, fadeOut, 1, frameCount);
+
+	// ========================================
+	// Mix the incoming decoder's audio into the ring buffer regions holding the outgoing decoder's audio
+	UInt32 offset = 0;
+	for(auto& buffer : { writeVector.first, writeVector.second }) {
+		UInt32 regionFrames = (UInt32)std::min(buffer.mFrameCapacity, (size_t)(frameCount - offset));
+		if(0 == regionFrames)
+			break;
+
+		UInt32 mixFrames = framesRead > offset ? std::min(regionFrames, framesRead - offset) : 0;
+
+		for(UInt32 bufferIndex = 0; bufferIndex < buffer.mBufferList->mNumberBuffers; ++bufferIndex) {
+			float *output = static_cast<float *>(buffer.mBufferList->mBuffers[bufferIndex].mData);
+			const float *input = static_cast<const float *>(mCrossfadeBufferList->mBuffers[bufferIndex].mData) + offset;
+
+			if(0 < mixFrames)
+				vDSP_vmma(output, 1, fadeOut + offset, 1, input, 1, fadeIn + offset, 1, output, 1, mixFrames);
+
+			// Beyond the end of the incoming decoder's audio the outgoing decoder is only faded
+			if(mixFrames < regionFrames)
+				vDSP_vmul(output + mixFrames, 1, fadeOut + offset + mixFrames, 1, output + mixFrames, 1, regionFrames - mixFrames);
+		}
+
+		offset += regionFrames;
+	}
+
+	mCrossfadeFramesMixed += frameCount;
+}
+
+void SFB::Audio::Player::CompleteCrossfade()
+{
+	// Detach the incoming decoder so EndDecoding() doesn't cancel the crossfade
+	DecoderStateData *decoderState = mCrossfadeState;
+	AudioConverterRef audioConverter = mCrossfadeConverter;
+	mCrossfadeState = nullptr;
+	mCrossfadeConverter = nullptr;
+
+	mCrossfadeBufferList.Deallocate();
+	mCrossfadeGains.reset();
+
+	EndDecoding();
+
+	// The queue may have been cleared while crossfading
+	__block bool discard = false;
+	uint64_t generation = mCrossfadeGeneration;
+	dispatch_sync(mQueue, ^{
+		discard = generation != mPrerollGeneration;
+	});
+
+	// The frames mixed during the crossfade are attributed to the outgoing decoder when rendered
+	decoderState->mFramesRendered.store(decoderState->GetCurrentFrame());
+
+	if(discard || !AppendDecoderStateToTimeline(decoderState)) {
+		auto result = AudioConverterDispose(audioConverter);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterDispose failed: " << result);
+
+		if(discard)
+			delete decoderState;
+		// BeginDecoding() creates a new converter for a decoder state waiting for a timeline slot
+		else {
+			LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Waiting for a free slot in the decoder timeline");
+			mPendingDecoderState = decoderState;
+		}
+
+		return;
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Crossfade complete, decoding continuing for \"" << decoderState->mDecoder->GetURL() << "\"");
+
+	// Prepare the next decoders while this one is decoding
+	PrerollNextDecoder();
+	WarmUpQueuedDecoders();
+
+	auto& inputSource = decoderState->mDecoder->GetInputSource();
+	inputSource.SetConsumptionRate(EstimateInputByteRate(inputSource.GetLength(), decoderState->mTotalFrames, decoderState->mDecoder->GetFormat().mSampleRate));
+	inputSource.SetReadAheadDuration(mInputReadAheadTime.load());
+
+	mDecodingState = decoderState;
+	mAudioConverter = audioConverter;
+}
+
+void SFB::Audio::Player::CancelCrossfade()
+{
+	if(nullptr == mCrossfadeState)
+		return;
+
+	if(mCrossfadeConverter) {
+		auto result = AudioConverterDispose(mCrossfadeConverter);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterDispose failed: " << result);
+		mCrossfadeConverter = nullptr;
+	}
+
+	DecoderStateData *decoderState = mCrossfadeState;
+	mCrossfadeState = nullptr;
+
+	mCrossfadeBufferList.Deallocate();
+	mCrossfadeGains.reset();
+
+	// The incoming decoder is rewound and decoded next unless the queue was cleared
+	__block bool discard = false;
+	uint64_t generation = mCrossfadeGeneration;
+	dispatch_sync(mQueue, ^{
+		discard = generation != mPrerollGeneration;
+	});
+
+	if(!discard && 0 == decoderState->SeekToFrame(0)) {
+		decoderState->mFramesRendered.store(0);
+		decoderState->mFlags.fetch_and(~eDecoderStateDataFlagDecodingStarted);
+		mPendingDecoderState = decoderState;
+		return;
+	}
+
+	if(!discard)
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Unable to rewind \"" << decoderState->mDecoder->GetURL() << "\" after cancelling crossfade");
+
+	delete decoderState;
+}
+
+bool SFB::Audio::Player::WriteTimeStretcherOutput()
+{
+	UInt32 frameCount = mTimeStretcher.GetOutputFrameCount();
+	if(0 == frameCount)
+		return true;
+
+	UInt32 framesToWrite = (UInt32)std::min((size_t)frameCount, mRingBuffer->GetFramesAvailableToWrite());
+	if(0 == framesToWrite)
+		return false;
+
+	// The segment is queued before its frames are written so the rendering thread sees it first
+	if(!EnqueueRateSegment(framesToWrite, mTimeStretcher.GetSourceFrameCount(framesToWrite)))
+		return false;
+
+	mRingBuffer->WriteAudio(mTimeStretcher.GetOutput(), framesToWrite);
+	mRingBufferFramesWritten += framesToWrite;
+	mTimeStretcher.ReadAdvance(framesToWrite);
+
+	return framesToWrite == frameCount;
+}
+
+bool SFB::Audio::Player::EnqueueRateSegment(UInt32 frameCount, UInt32 sourceFrameCount)
+{
+	if(sizeof(RateSegment) > mRateSegmentQueue->GetBytesAvailableToWrite()) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Rate segment queue full");
+		return false;
+	}
+
+	RateSegment segment = {
+		.mStartFrame		= mRingBufferFramesWritten,
+		.mFrameCount		= frameCount,
+		.mSourceFrameCount	= sourceFrameCount
+	};
+
+	mRateSegmentQueue->Write(&segment, sizeof(segment));
+
+	return true;
+}
+
+UInt32 SFB::Audio::Player::ConvertRenderedFramesToSourceFrames(UInt32 frameCount)
+{
+	UInt32 sourceFrameCount = 0;
+
+	while(0 < frameCount) {
+		if(0 == mRenderRateSegment.mFrameCount && sizeof(RateSegment) <= mRateSegmentQueue->GetBytesAvailableToRead()) {
+			mRateSegmentQueue->Read(&mRenderRateSegment, sizeof(RateSegment));
+			mRenderRateSegmentOffset = 0;
+		}
+
+		// Frames preceding the next segment weren't stretched
+		if(0 == mRenderRateSegment.mFrameCount || mRenderRateSegment.mStartFrame > mRingBufferFramesRead) {
+			UInt32 framesNotStretched = frameCount;
+			if(0 != mRenderRateSegment.mFrameCount)
+				framesNotStretched = (UInt32)std::min((UInt64)frameCount, mRenderRateSegment.mStartFrame - mRingBufferFramesRead);
+
+			sourceFrameCount += framesNotStretched;
+			mRingBufferFramesRead += framesNotStretched;
+			frameCount -= framesNotStretched;
+			continue;
+		}
+
+		// The source frames are distributed across the segment so the count is exact at its end
+		UInt32 framesFromSegment = std::min(frameCount, mRenderRateSegment.mFrameCount - mRenderRateSegmentOffset);
+		UInt64 sourceFramesBefore = ((UInt64)mRenderRateSegmentOffset * mRenderRateSegment.mSourceFrameCount) / mRenderRateSegment.mFrameCount;
+		mRenderRateSegmentOffset += framesFromSegment;
+		UInt64 sourceFramesAfter = ((UInt64)mRenderRateSegmentOffset * mRenderRateSegment.mSourceFrameCount) / mRenderRateSegment.mFrameCount;
+
+		sourceFrameCount += (UInt32)(sourceFramesAfter - sourceFramesBefore);
+		mRingBufferFramesRead += framesFromSegment;
+		frameCount -= framesFromSegment;
+
+		if(mRenderRateSegmentOffset == mRenderRateSegment.mFrameCount)
+			mRenderRateSegment.mFrameCount = 0;
+	}
+
+	return sourceFrameCount;
+}
+
+void SFB::Audio::Player::ResetTimeStretch()
+{
+	// This isn't thread safe but is only called while the rendering thread isn't reading the ring buffer
+	mTimeStretcher.Reset();
+	mRateSegmentQueue->Reset();
+	mRingBufferFramesWritten = 0;
+	mRingBufferFramesRead = 0;
+	mRenderRateSegment = RateSegment();
+	mRenderRateSegmentOffset = 0;
+}
+
+void SFB::Audio::Player::WakeDecoder()
+{
+	mDecoderWakeupCount.fetch_add(1, std::memory_order_relaxed);
+
+	if(mDecoderPool)
+		mDecoderPool->WakePlayer(this);
+	else
+		mDecoderEvent.Signal();
+}
+
+#pragma mark Other Utilities
+
+void SFB::Audio::Player::AdaptRingBufferSizeToOutput()
+{
+	Float64 sampleRate = mOutput->GetFormat().mSampleRate;
+	if(0 >= sampleRate)
+		return;
+
+	// Decoders that are slow relative to real time need proportionally more headroom
+	double headroom = std::max(1.0, 4 * mDecodeLoad.load());
+	size_t capacity = (size_t)(mRingBufferTargetDepth.load() * sampleRate * headroom);
+
+	// The output pulls at most its preferred buffer size per render cycle
+	size_t preferredBufferSize = mOutput->GetPreferredBufferSize();
+	capacity = std::max(capacity, 8 * preferredBufferSize);
+	capacity = std::min(std::max(capacity, (size_t)RING_BUFFER_MINIMUM_CAPACITY_FRAMES), (size_t)RING_BUFFER_MAXIMUM_CAPACITY_FRAMES);
+
+	// Write in chunks large enough to amortize decoder overhead but small enough to keep the buffer topped up
+	size_t chunkSize = std::min(std::max(capacity / 8, preferredBufferSize), capacity / 2);
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Adapting ring buffer: capacity " << capacity << " frames, write chunk size " << chunkSize << " frames (decode load " << mDecodeLoad.load() << ")");
+
+	mRingBufferCapacity.store((uint32_t)capacity);
+	mRingBufferWriteChunkSize.store((uint32_t)chunkSize);
+}
+
+void SFB::Audio::Player::EnlargeOutputBufferFollowingUnderrun()
+{
+	// Must be called on mQueue
+
+	// A single starvation usually produces underruns in several consecutive render cycles
+	auto now = mach_absolute_time();
+	if(0 != mLastOutputBufferAdjustmentTime && OUTPUT_BUFFER_ADJUSTMENT_INTERVAL_NSEC > ConvertHostTimeToNanos(now - mLastOutputBufferAdjustmentTime))
+		return;
+
+	UInt32 frameSize, minimum, maximum;
+	if(!mOutput->GetDeviceBufferFrameSize(frameSize) || !mOutput->GetDeviceBufferFrameSizeRange(minimum, maximum) || frameSize >= maximum)
+		return;
+
+	mLastOutputBufferAdjustmentTime = now;
+
+	if(!mOutput->SetDeviceBufferFrameSize(2 * frameSize))
+		return;
+
+	UInt32 newFrameSize;
+	if(!mOutput->GetDeviceBufferFrameSize(newFrameSize))
+		newFrameSize = std::min(2 * frameSize, maximum);
+
+	LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Output buffer enlarged from " << frameSize << " to " << newFrameSize << " frames following underrun");
+
+	mOutputBufferAdjustmentCount.fetch_add(1);
+
+	// The ring buffer must hold several render cycles, and each write should fill at least one
+	// The capacity takes effect when the ring buffer is next allocated
+	uint32_t capacity = std::max(mRingBufferCapacity.load(), std::min(8 * newFrameSize, (uint32_t)RING_BUFFER_MAXIMUM_CAPACITY_FRAMES));
+	mRingBufferCapacity.store(capacity);
+	mRingBufferWriteChunkSize.store(std::max(mRingBufferWriteChunkSize.load(), std::min(newFrameSize, capacity / 2)));
+}
+
+void SFB::Audio::Player::UpdateQueuedDecoderCount()
+{
+	// Must be called on mQueue
+	mQueuedDecoderCount.store(mDecoderQueue.size() + (mPrerolledDecoderState || mPrerollInProgress ? 1 : 0));
+}
+
+void SFB::Audio::Player::ReturnCancelledDecoder(Decoder::unique_ptr& decoder)
+{
+	// Must be called on mQueue
+	// The decoder is left with the caller to be destroyed if no caller is waiting for it
+	--mCancelledDecoderCount;
+	if(0 == mCancelledDecoderCollectorCount)
+		return;
+
+	mCancelledDecoders.push_back(std::move(decoder));
+	if(0 == mCancelledDecoderCount)
+		dispatch_semaphore_signal(mCancelledDecodersReturned);
+}
+
+void SFB::Audio::Player::PrerollNextDecoder()
+{
+	dispatch_async(mPrerollQueue, ^{
+		// Take the decoder at the head of the queue
+		__block Decoder::unique_ptr decoder;
+		__block uint64_t generation = 0;
+		dispatch_sync(mQueue, ^{
+			// A decoder being warmed up is pre-rolled once the warm-up completes
+			if(mLowMemoryMode || mPrerolledDecoderState || mPrerollInProgress || mDecoderQueue.empty() || !mDecoderQueue.front())
+				return;
+
+			decoder = std::move(mDecoderQueue.front());
+			mDecoderQueue.pop_front();
+
+			mPrerollInProgress = true;
+			generation = mPrerollGeneration;
+		});
+
+		if(!decoder)
+			return;
+
+		// Open and pre-roll the decoder
+		// Errors are not reported here; an unopened decoder is returned to the queue and handled normally by the decoding thread
+		__block DecoderStateData *decoderState = nullptr;
+		if(decoder->IsOpen() || OpenDecoder(*decoder)) {
+			LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Pre-rolling \"" << decoder->GetURL() << "\"");
+
+			decoderState = new DecoderStateData(std::move(decoder));
+			if(!decoderState->Preroll(DECODER_PREROLL_FRAMES))
+				LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Unable to pre-roll \"" << decoderState->mDecoder->GetURL() << "\"");
+
+			decoderState->LoadReplayGain();
+		}
+
+		__block bool discard = false;
+		dispatch_sync(mQueue, ^{
+			mPrerollInProgress = false;
+
+			// The queue was cleared while pre-rolling
+			if(generation != mPrerollGeneration) {
+				ReturnCancelledDecoder(decoderState ? decoderState->mDecoder : decoder);
+				discard = true;
 			}
-			else if(nextFormat.mChannelsPerFrame != outputFormat.mChannelsPerFrame) {
-				LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Gapless join failed: Output channel count (" << outputFormat.mChannelsPerFrame << ") and decoder channel count (" << nextFormat.mChannelsPerFrame << ") don't match");
-				formatsMatch = false;
+			// Memory pressure arrived while pre-rolling
+			else if(decoderState && mLowMemoryMode) {
+				decoderState->mDecoder->Close();
+				mDecoderQueue.push_front(std::move(decoderState->mDecoder));
+				discard = true;
 			}
+			else if(decoderState)
+				mPrerolledDecoderState = decoderState;
+			else
+				mDecoderQueue.push_front(std::move(decoder));
 
-			// Enqueue the decoder if its channel layout matches the ring buffer's channel layout (so the channel map in the output will remain valid)
-			if(nextChannelLayout != outputChannelLayout) {
-				LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Gapless join failed: Output channel layout (" << outputChannelLayout << ") and decoder channel layout (" << nextChannelLayout << ") don't match");
-				formatsMatch = false;
-			}
+			UpdateQueuedDecoderCount();
+		});
 
-			// If the formats don't match, the decoder can't be used with the current ring buffer format
-			if(!formatsMatch) {
-				// Ensure output is muted before performing operations that aren't thread safe
-				if(mOutput->IsRunning()) {
-					mFlags.fetch_or(eAudioPlayerFlagFormatMismatch);
+		if(discard)
+			delete decoderState;
 
-					// Wait for the currently rendering decoder to finish
-					// The rendering thread will clear eAudioPlayerFlagFormatMismatch when the current render cycle completes
-					while(eAudioPlayerFlagFormatMismatch & mFlags.load())
-						mSemaphore.TimedWait(dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC / 100));
-				}
+		WakeDecoder();
+	});
+}
 
-				if(mFormatMismatchBlock)
-					mFormatMismatchBlock(outputFormat, nextFormat);
+void SFB::Audio::Player::WarmUpQueuedDecoders()
+{
+	dispatch_async(mWarmUpQueue, ^{
+		// Warm-up stops, before opening another decoder, once the queue is cleared
+		__block uint64_t generation = 0;
+		dispatch_sync(mQueue, ^{
+			generation = mPrerollGeneration;
+		});
 
-				// Adjust the formats
-				dispatch_sync(mQueue, ^{
-					if(!SetupOutputAndRingBufferForDecoder(*decoderState->mDecoder)) {
-						delete decoderState;
-						decoderState = nullptr;
+		for(;;) {
+			// Take the first unopened decoder within the warm-up window, leaving a placeholder at its position
+			__block Decoder::unique_ptr decoder;
+			dispatch_sync(mQueue, ^{
+				if(mLowMemoryMode || generation != mPrerollGeneration)
+					return;
+
+				size_t count = std::min(mDecoderQueue.size(), mQueueWarmUpCount.load());
+				for(size_t i = 0; i < count; ++i) {
+					if(mDecoderQueue[i] && !mDecoderQueue[i]->IsOpen()) {
+						decoder = std::move(mDecoderQueue[i]);
+						break;
 					}
+				}
+			});
+
+			if(!decoder)
+				return;
+
+			// Errors are not reported here; an unopened decoder is handled normally by the decoding thread
+			LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Warming up \"" << decoder->GetURL() << "\"");
+			bool opened = OpenDecoder(*decoder);
+			if(!opened)
+				LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Unable to warm up \"" << decoder->GetURL() << "\"");
+
+			// Return the decoder to its position, or hand it back if the queue was cleared while warming up
+			dispatch_sync(mQueue, ^{
+				if(generation != mPrerollGeneration) {
+					ReturnCancelledDecoder(decoder);
+					return;
+				}
+
+				// Memory pressure arrived while warming up
+				if(mLowMemoryMode)
+					decoder->Close();
+
+				auto placeholder = std::find_if(mDecoderQueue.begin(), mDecoderQueue.end(), [](const Decoder::unique_ptr& queuedDecoder) {
+					return !queuedDecoder;
 				});
+				if(placeholder != mDecoderQueue.end())
+					*placeholder = std::move(decoder);
+			});
 
-				// Clear the mute flag that was set in the rendering thread so output will resume
-				mFlags.fetch_and(~eAudioPlayerFlagMuteOutput);
-			}
+			decoder.reset();
+
+			// The decoding thread or pre-roll may have been waiting for the decoder
+			WakeDecoder();
+			if(HasCurrentDecoderState())
+				PrerollNextDecoder();
+
+			// Warm-up is retried the next time the queue changes
+			if(!opened)
+				return;
 		}
+	});
+}
 
-		// ========================================
-		// Append the decoder state to the list of active decoders
-		if(decoderState) {
-			for(UInt32 bufferIndex = 0; bufferIndex < kActiveDecoderArraySize; ++bufferIndex) {
-				auto current = mActiveDecoders[bufferIndex].load();
+void SFB::Audio::Player::WaitForRenderingThreadToClearFlag(unsigned int flag)
+{
+	while(flag & mFlags.load()) {
+		// If output isn't running the rendering thread won't clear the flag, so perform its actions here
+		if(!mOutput->IsRunning()) {
+			mFlags.fetch_or(eAudioPlayerFlagMuteOutput);
+			mFlags.fetch_and(~flag);
+			break;
+		}
 
-				if(nullptr != current)
-					continue;
+		mSemaphore.Wait();
 
-				if(mActiveDecoders[bufferIndex].compare_exchange_strong(current, decoderState))
-					break;
-				else
-					LOGGER_WARNING("org.sbooth.AudioEngine.Player", "compare_exchange_strong() failed");
-			}
+		if((flag & mFlags.load()) && mOutput->IsRunning())
+			mSpuriousWakeupCount.fetch_add(1);
+	}
+}
+
+SFB::Audio::Player::DecoderStateData * SFB::Audio::Player::GetDecoderStateWithTimeStamp(SInt64 timeStamp) const
+{
+	if(0 > timeStamp || timeStamp >= mTimelineTail.load())
+		return nullptr;
+
+	DecoderStateData *decoderState = mActiveDecoders[(size_t)timeStamp & (mActiveDecoderCapacity - 1)].load();
+
+	// The slot may have been collected and reused
+	if(nullptr == decoderState || decoderState->mTimeStamp != timeStamp)
+		return nullptr;
+
+	return decoderState;
+}
+
+SFB::Audio::Player::DecoderStateData * SFB::Audio::Player::GetCurrentDecoderState() const
+{
+	SInt64 head = mTimelineHead.load();
+	SInt64 tail = mTimelineTail.load();
+
+	// Decoders finish rendering in timeline order, so the head is almost always the current decoder
+	for(SInt64 timeStamp = head; timeStamp < tail; ++timeStamp) {
+		DecoderStateData *decoderState = GetDecoderStateWithTimeStamp(timeStamp);
+
+		if(nullptr == decoderState || (eDecoderStateDataFlagRenderingFinished & decoderState->mFlags.load()))
+			continue;
+
+		AdvanceTimelineHead(head, timeStamp);
+		return decoderState;
+	}
+
+	AdvanceTimelineHead(head, tail);
+	return nullptr;
+}
+
+SFB::Audio::Player::DecoderStateData * SFB::Audio::Player::GetDecoderStateStartingAfterTimeStamp(SInt64 timeStamp) const
+{
+	SInt64 tail = mTimelineTail.load();
+
+	for(SInt64 nextTimeStamp = std::max(timeStamp + 1, mTimelineHead.load()); nextTimeStamp < tail; ++nextTimeStamp) {
+		DecoderStateData *decoderState = GetDecoderStateWithTimeStamp(nextTimeStamp);
+
+		if(nullptr == decoderState || (eDecoderStateDataFlagRenderingFinished & decoderState->mFlags.load()))
+			continue;
+
+		return decoderState;
+	}
+
+	return nullptr;
+}
+
+void SFB::Audio::Player::AdvanceTimelineHead(SInt64 expected, SInt64 timeStamp) const
+{
+	// The head only moves forward; if another thread advanced it further there is nothing to do
+	while(expected < timeStamp && !mTimelineHead.compare_exchange_weak(expected, timeStamp))
+		;
+}
+
+bool SFB::Audio::Player::AppendDecoderStateToTimeline(DecoderStateData *decoderState)
+{
+	// Only the decoding thread appends to the timeline
+	SInt64 timeStamp = mTimelineTail.load();
+	auto& slot = mActiveDecoders[(size_t)timeStamp & (mActiveDecoderCapacity - 1)];
+
+	// If the slot is in use its decoder must finish rendering and be collected first
+	if(nullptr != slot.load())
+		return false;
+
+	decoderState->mTimeStamp = timeStamp;
+	slot.store(decoderState);
+
+	// Publish the decoder state
+	mTimelineTail.store(timeStamp + 1);
+
+	return true;
+}
+
+bool SFB::Audio::Player::HasCurrentDecoderState() const
+{
+	DecoderStateEpochGuard guard(*this);
+	return nullptr != GetCurrentDecoderState();
+}
+
+void SFB::Audio::Player::RequestDecoderStateCollection()
+{
+	// Not safe to call from the rendering thread, which posts eRenderEventRenderingFinished instead
+	dispatch_source_set_timer(mCollector, DISPATCH_TIME_NOW, DISPATCH_TIME_FOREVER, 0);
+}
+
+void SFB::Audio::Player::CollectDecoderStates()
+{
+	// Must be called on mQueue
+	// Retire decoder states that have finished decoding and rendering by removing them from the timeline
+	unsigned int epoch = mReclamationEpoch.load();
+	bool slotFreed = false;
+	for(size_t slotIndex = 0; slotIndex < mActiveDecoderCapacity; ++slotIndex) {
+		DecoderStateData *decoderState = mActiveDecoders[slotIndex].load();
+
+		if(nullptr == decoderState)
+			continue;
+
+		auto flags = decoderState->mFlags.load();
+
+		if(!(eDecoderStateDataFlagDecodingFinished & flags) || !(eDecoderStateDataFlagRenderingFinished & flags))
+			continue;
+
+		if(mActiveDecoders[slotIndex].compare_exchange_strong(decoderState, nullptr)) {
+			mRetiredDecoderStates.push_back(std::make_pair(decoderState, epoch));
+			slotFreed = true;
 		}
+	}
 
-		// ========================================
-		// If a decoder was found at the head of the queue, process it
-		if(decoderState) {
-			LOGGER_INFO("org.sbooth.AudioEngine.Player", "Decoding starting for \"" << decoderState->mDecoder->GetURL() << "\"");
-			LOGGER_INFO("org.sbooth.AudioEngine.Player", "Decoder format: " << decoderState->mDecoder->GetFormat());
-			LOGGER_INFO("org.sbooth.AudioEngine.Player", "Decoder channel layout: " << decoderState->mDecoder->GetChannelLayout());
+	// The decoding thread may be waiting for a free slot in the timeline
+	if(slotFreed)
+		WakeDecoder();
 
-//			const AudioFormat& decoderFormat = decoderState->mDecoder->GetFormat();
-			AudioFormat decoderFormat = decoderState->mDecoder->GetFormat();
+	// Only readers that entered in or before a decoder state's retirement epoch could have seen it
+	// The epoch may advance once no readers remain in the epoch preceding the current one
+	for(int i = 0; i < 2 && !mRetiredDecoderStates.empty(); ++i) {
+		epoch = mReclamationEpoch.load();
+		if(0 != mEpochReaderCounts[(epoch + 1) & 1].load())
+			break;
+		mReclamationEpoch.store(epoch + 1);
+	}
 
-			// ========================================
-			// Create the AudioConverter which will convert from the decoder's format to the output format (for PCM and DoP output)
-			AudioConverterRef audioConverter = nullptr;
-			BufferList bufferList;
-			if(mOutput->GetFormat().IsPCM() || mOutput->GetFormat().IsDoP()) {
-				auto outputFormat = mOutput->GetFormat();
+	// Free decoder states retired two or more epochs ago
+	epoch = mReclamationEpoch.load();
+	auto iter = std::remove_if(mRetiredDecoderStates.begin(), mRetiredDecoderStates.end(), [epoch](const std::pair<DecoderStateData *, unsigned int>& retiredDecoderState) {
+		if(2 > epoch - retiredDecoderState.second)
+			return false;
 
-				// DoP masquerades as PCM
-				bool decoderIsDoP = decoderFormat.IsDoP();
-				bool outputIsDoP = outputFormat.IsDoP();
+		LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Collecting decoder: \"" << retiredDecoderState.first->mDecoder->GetURL() << "\"");
+		delete retiredDecoderState.first;
+		return true;
+	});
+	mRetiredDecoderStates.erase(iter, mRetiredDecoderStates.end());
 
-				if(decoderIsDoP)
-					decoderFormat.mFormatID = kAudioFormatLinearPCM;
+	mPendingReclamationCount.store(mRetiredDecoderStates.size());
 
-				if(outputIsDoP)
-					outputFormat.mFormatID = kAudioFormatLinearPCM;
+	// Try again once the remaining readers have exited
+	if(!mRetiredDecoderStates.empty())
+		dispatch_source_set_timer(mCollector, dispatch_time(DISPATCH_TIME_NOW, RECLAMATION_RETRY_INTERVAL_NSEC), DISPATCH_TIME_FOREVER, RECLAMATION_RETRY_INTERVAL_NSEC / 10);
+}
 
-				OSStatus result = AudioConverterNew(&decoderFormat, &outputFormat, &audioConverter);
-				if(noErr != result) {
-					LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterNew failed: " << result);
+void SFB::Audio::Player::StopActiveDecoders()
+{
+	// The player must be stopped or a SIGSEGV could occur in this method
+	// This must be ensured by the caller!
 
-					// If this happens, output will be impossible
-					if(mErrorBlock) {
-						SFB::CFString description(CFCopyLocalizedString(CFSTR("The format of the file “%@” is not supported."), ""));
-						SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Format not supported"), ""));
-						SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's format is not supported by the selected output device."), ""));
+	DecoderStateEpochGuard guard(*this);
 
-						SFB::CFError formatError(CreateErrorForURL(Decoder::ErrorDomain, Decoder::InputOutputError, description, decoderState->mDecoder->GetURL(), failureReason, recoverySuggestion));
+	// Request that any decoders still actively decoding stop
+	for(size_t slotIndex = 0; slotIndex < mActiveDecoderCapacity; ++slotIndex) {
+		DecoderStateData *decoderState = mActiveDecoders[slotIndex].load();
 
-						mErrorBlock(formatError);
-					}
+		if(nullptr == decoderState)
+			continue;
 
-					decoderState->mFlags.fetch_or(eDecoderStateDataFlagDecodingFinished | eDecoderStateDataFlagRenderingFinished);
-					decoderState = nullptr;
+		decoderState->mFlags.fetch_or(eDecoderStateDataFlagStopDecoding);
+	}
 
-					continue;
-				}
+	WakeDecoder();
 
-				if(decoderIsDoP)
-					decoderFormat.mFormatID = kAudioFormatDoP;
+	for(size_t slotIndex = 0; slotIndex < mActiveDecoderCapacity; ++slotIndex) {
+		DecoderStateData *decoderState = mActiveDecoders[slotIndex].load();
 
-				if(outputIsDoP)
-					outputFormat.mFormatID = kAudioFormatDoP;
+		if(nullptr == decoderState)
+			continue;
 
-				// Handle channel mapping
-//				auto& decoderChannelLayout = decoderState->mDecoder->GetChannelLayout();
-//				if(decoderChannelLayout) {
-//					auto decoderACL = decoderChannelLayout.GetACL();
-//					result = AudioConverterSetProperty(audioConverter, kAudioConverterInputChannelLayout, sizeof(*decoderACL), decoderACL);
-//					if(noErr != result)
-//						LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterSetProperty (kAudioConverterInputChannelLayout) failed: " << result);
-//				}
-//
-//				auto& outputChannelLayout = mOutput->GetChannelLayout();
-//				if(outputChannelLayout) {
-//					auto outputACL = outputChannelLayout.GetACL();
-//					result = AudioConverterSetProperty(audioConverter, kAudioConverterOutputChannelLayout, sizeof(*outputACL), outputACL);
-//					if(noErr != result)
-//						LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterSetProperty (kAudioConverterOutputChannelLayout) failed: " << result);
-//				}
+		decoderState->mFlags.fetch_or(eDecoderStateDataFlagRenderingFinished);
+	}
+
+	RequestDecoderStateCollection();
+}
+
+SFB::Audio::Decoder::unique_ptr SFB::Audio::Player::CreateDecoderForURL(CFURLRef url, CFErrorRef *error) const
+{
+#if !TARGET_OS_IPHONE
+	// Remote decoders don't fall back to decoding in this process, since the file may be the one crashing the service
+	if(mRemoteDecoding.load())
+		return RemoteDecoder::CreateForURL(url, error);
+#endif
+
+	return Decoder::CreateForURL(url, error);
+}
+
+bool SFB::Audio::Player::OpenDecoder(Decoder& decoder, CFErrorRef *error)
+{
+	// Decoders able to provide the output's sample layout do so, avoiding a conversion
+	// Outputs adopt the decoder's sample rate and channel count but retain their sample layout
+	if(mOutput->GetFormat().IsPCM())
+		decoder.SetPreferredFormat(mOutput->GetFormat());
+
+	auto openStartTime = mach_absolute_time();
+	if(!decoder.Open(error))
+		return false;
+
+	auto openTime = mach_absolute_time() - openStartTime;
+	mDecoderOpenCount.fetch_add(1, std::memory_order_relaxed);
+	mDecoderOpenTime.fetch_add(openTime, std::memory_order_relaxed);
+	StoreMaximum(mMaximumDecoderOpenTime, openTime);
+
+	return true;
+}
+
+bool SFB::Audio::Player::SetupOutputAndRingBufferForDecoder(Decoder& decoder, bool useStandbyRingBuffer)
+{
+	// Open the decoder if necessary
+	SFB::CFError error;
+	if(!decoder.IsOpen() && !OpenDecoder(decoder, &error)) {
+		if(mDecoderErrorBlock)
+			mDecoderErrorBlock(decoder, error);
+
+		if(error)
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "Error opening decoder: " << error);
+
+		return false;
+	}
+
+	if(!mOutput->SupportsFormat(decoder.GetFormat())) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Format not supported: " << decoder.GetFormat());
+
+		if(mErrorBlock) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The format of the file “%@” is not supported."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Format not supported"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's format is not supported by the selected output device."), ""));
+
+			SFB::CFError formatError(CreateErrorForURL(Decoder::ErrorDomain, Decoder::InputOutputError, description, decoder.GetInputSource().GetURL(), failureReason, recoverySuggestion));
+
+			mErrorBlock(formatError);
+		}
+
+		return false;
+	}
+
+	// Fan-out outputs can't render while the ring buffer is reallocated
+	SuspendFanOutOutputs();
+
+	// The output's sample rate may change
+	mOutputRateEstimator.Reset();
+
+	// The ring buffer's audio is discarded
+	ResetTimeStretch();
+
+	// Configure the output for decoder
+	if(!mOutput->SetupForDecoder(decoder))
+		return false;
+
+	if(mLowPowerMode)
+		ApplyLowPowerOutputBufferSize();
+
+	UpdateOutputLatency();
+
+	// The sample rate and I/O workgroup may have changed
+	mDecoderSchedulingGeneration.fetch_add(1);
+
+	// The ring buffer is being reallocated so this is the time to resize it
+	if(mAdaptiveRingBufferSizing)
+		AdaptRingBufferSizeToOutput();
+
+	size_t capacity = GetRingBufferAllocationCapacity(mRingBufferCapacity, mOutput->GetFormat().mSampleRate);
+	auto storageFormat = GetRingBufferStorageFormat(decoder);
+
+	// Use the standby ring buffer if it was allocated for the format the output selected
+	if(useStandbyRingBuffer && mStandbyRingBuffer->GetFormat() == mOutput->GetFormat() && mStandbyRingBuffer->GetStorageFormat() == storageFormat && mStandbyRingBuffer->GetCapacityFrames() >= capacity) {
+		LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Using standby ring buffer (" << mStandbyRingBuffer->GetCapacityFrames() << " frames)");
+		std::swap(mRingBuffer, mStandbyRingBuffer);
+		mRingBuffer->Reset();
+		UpdateRingBufferFootprint();
+		SetupFanOutOutputsForDecoder(decoder);
+		return true;
+	}
+
+	// Locked memory large enough for the format is reused rather than unlocked and locked again
+	if(mMemoryLocking && !mLowMemoryMode && 0 != mRingBuffer->GetLockedByteCount() && mRingBuffer->GetFormat() == mOutput->GetFormat() && mRingBuffer->GetStorageFormat() == storageFormat && mRingBuffer->GetCapacityFrames() >= capacity) {
+		mRingBuffer->Reset();
+		SetupFanOutOutputsForDecoder(decoder);
+		return true;
+	}
+
+	// Allocate enough space in the ring buffer for the new format
+	// Mirrored memory allows each decoded chunk to be written in a single pass
+	mRingBuffer->SetMemoryLocked(mMemoryLocking);
+	if(!mRingBuffer->Allocate(mOutput->GetFormat(), capacity, true, storageFormat) && !mRingBuffer->Allocate(mOutput->GetFormat(), capacity, false, storageFormat)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to allocate ring buffer");
+		return false;
+	}
 
-				// ========================================
-				// Allocate the buffer lists which will serve as the transport between the decoder and the ring buffer
-				UInt32 inputBufferSize = mRingBufferWriteChunkSize * mOutput->GetFormat().mBytesPerFrame;
-				UInt32 dataSize = sizeof(inputBufferSize);
-				result = AudioConverterGetProperty(audioConverter, kAudioConverterPropertyCalculateInputBufferSize, &dataSize, &inputBufferSize);
-				if(noErr != result)
-					LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterGetProperty (kAudioConverterPropertyCalculateInputBufferSize) failed: " << result);
+	UpdateRingBufferFootprint();
+	SetupFanOutOutputsForDecoder(decoder);
 
-				// ========================================
-				// Allocate the buffer lists which will serve as the transport between the decoder and the ring buffer
-				decoderState->AllocateBufferList((UInt32)decoderFormat.ByteCountToFrameCount(inputBufferSize));
-				bufferList.Allocate(mOutput->GetFormat(), mRingBufferWriteChunkSize);
-			}
-			else if(mOutput->GetFormat().IsDSD()) {
-				UInt32 preferredSize = (UInt32)mOutput->GetPreferredBufferSize();
-				decoderState->AllocateBufferList(preferredSize ?: 512);
-			}
+	return true;
+}
 
+void SFB::Audio::Player::PrepareStandbyRingBuffer(const Decoder& decoder)
+{
+	// Must be called on the decoding thread
 
-			// ========================================
-			// Decode the audio file in the ring buffer until finished or cancelled
-			while(!(eAudioPlayerFlagStopDecoding & mFlags.load()) && decoderState && !(eDecoderStateDataFlagStopDecoding & decoderState->mFlags.load())) {
+	const AudioFormat& outputFormat = mOutput->GetFormat();
+	const AudioFormat& decoderFormat = decoder.GetFormat();
 
-				// Fill the ring buffer with as much data as possible
-				for(;;) {
+	// The output's format for the decoder can only be predicted when the format type is unchanged
+	// In low-memory mode the swap waits on allocation instead of holding two ring buffers
+	if(mLowMemoryMode || decoderFormat.mFormatID != outputFormat.mFormatID || 0 >= outputFormat.mSampleRate) {
+		mStandbyRingBuffer->Deallocate();
+		UpdateRingBufferFootprint();
+		return;
+	}
 
-					// Reset the ring buffer if required
-					if(eAudioPlayerFlagRingBufferNeedsReset & mFlags.load()) {
+	// Outputs adopt the decoder's sample rate and channel count, keeping the sample format
+	AudioFormat format = outputFormat;
+	format.mSampleRate			= decoderFormat.mSampleRate;
+	format.mChannelsPerFrame	= decoderFormat.mChannelsPerFrame;
 
-						mFlags.fetch_and(~eAudioPlayerFlagRingBufferNeedsReset);
+	// An adapted capacity scales with the sample rate
+	size_t capacity = mRingBufferCapacity;
+	if(mAdaptiveRingBufferSizing)
+		capacity = std::min(std::max((size_t)(capacity * (format.mSampleRate / outputFormat.mSampleRate)), (size_t)RING_BUFFER_MINIMUM_CAPACITY_FRAMES), (size_t)RING_BUFFER_MAXIMUM_CAPACITY_FRAMES);
 
-						// Ensure output is muted before performing operations that aren't thread safe
-						if(mOutput->IsRunning()) {
-							mFlags.fetch_or(eAudioPlayerFlagRequestMute);
+	capacity = GetRingBufferAllocationCapacity(capacity, format.mSampleRate);
 
-							// The rendering thread will clear eAudioPlayerFlagRequestMute when the current render cycle completes
-							while(eAudioPlayerFlagRequestMute & mFlags.load())
-								mSemaphore.TimedWait(dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC / 100));
-						}
-						else
-							mFlags.fetch_or(eAudioPlayerFlagMuteOutput);
-
-						// Reset the converter to flush any buffers
-						if(audioConverter) {
-							auto result = AudioConverterReset(audioConverter);
-							if(noErr != result)
-								LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterReset failed: " << result);
-						}
+	auto storageFormat = GetRingBufferStorageFormat(decoder);
+	if(mStandbyRingBuffer->GetFormat() == format && mStandbyRingBuffer->GetStorageFormat() == storageFormat && mStandbyRingBuffer->GetCapacityFrames() >= capacity)
+		return;
 
-						// Reset() is not thread safe but the rendering thread is outputting silence
-						mRingBuffer->Reset();
+	mStandbyRingBuffer->SetMemoryLocked(mMemoryLocking);
+	if(!mStandbyRingBuffer->Allocate(format, capacity, true, storageFormat) && !mStandbyRingBuffer->Allocate(format, capacity, false, storageFormat))
+		LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Unable to allocate standby ring buffer");
 
-						// Clear the mute flag
-						mFlags.fetch_and(~eAudioPlayerFlagMuteOutput);
-					}
+	UpdateRingBufferFootprint();
+}
 
-					// Determine how many frames are available in the ring buffer
-					size_t framesAvailableToWrite = mRingBuffer->GetFramesAvailableToWrite();
+size_t SFB::Audio::Player::GetRingBufferAllocationCapacity(size_t capacity, Float64 sampleRate) const
+{
+	// In low-power mode the ring buffer holds enough audio for the decoding thread to sleep for long intervals
+	if(mLowPowerMode && 0 < sampleRate)
+		capacity = std::max(capacity, std::min((size_t)(mLowPowerBufferDuration.load() * sampleRate), (size_t)RING_BUFFER_MAXIMUM_CAPACITY_FRAMES));
 
-					// Force writes to the ring buffer to be at least mRingBufferWriteChunkSize
-					if(mRingBufferWriteChunkSize <= framesAvailableToWrite) {
+	// In low-memory mode the ring buffer holds only a couple of write chunks
+	if(mLowMemoryMode)
+		capacity = std::min(capacity, std::max((size_t)RING_BUFFER_LOW_MEMORY_CAPACITY_FRAMES, 2 * (size_t)mRingBufferWriteChunkSize.load()));
 
-						SInt64 frameToSeek = decoderState->mFrameToSeek.load();
+	return capacity;
+}
 
-						// Seek to the specified frame
-						if(-1 != frameToSeek) {
-							LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Seeking to frame " << frameToSeek);
+SFB::Audio::RingBuffer::StorageFormat SFB::Audio::Player::GetRingBufferStorageFormat(const Decoder& decoder) const
+{
+	if(!mCompactRingBufferStorage)
+		return RingBuffer::StorageFormat::Native;
 
-							// Ensure output is muted before performing operations that aren't thread safe
-							if(mOutput->IsRunning()) {
-								mFlags.fetch_or(eAudioPlayerFlagRequestMute);
+	// Integer audio is held exactly by storage of at least its bit depth
+	const AudioFormat& decoderFormat = decoder.GetFormat();
+	if(!decoderFormat.IsPCM() || (kAudioFormatFlagIsFloat & decoderFormat.mFormatFlags) || 0 == decoderFormat.mBitsPerChannel)
+		return RingBuffer::StorageFormat::Native;
 
-								// The rendering thread will clear eAudioPlayerFlagRequestMute when the current render cycle completes
-								while(eAudioPlayerFlagRequestMute & mFlags.load())
-									mSemaphore.TimedWait(dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC / 100));
-							}
-							else
-								mFlags.fetch_or(eAudioPlayerFlagMuteOutput);
+	if(16 >= decoderFormat.mBitsPerChannel)
+		return RingBuffer::StorageFormat::Int16;
+	else if(24 >= decoderFormat.mBitsPerChannel)
+		return RingBuffer::StorageFormat::Int24;
 
-							SInt64 newFrame = decoderState->mDecoder->SeekToFrame(frameToSeek);
+	return RingBuffer::StorageFormat::Native;
+}
 
-							if(newFrame != frameToSeek)
-								LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Inaccurate seek to frame  " << frameToSeek << ", got frame " << newFrame);
+void SFB::Audio::Player::ApplyLowPowerOutputBufferSize()
+{
+	// Must be called on mQueue
+	UInt32 frameSize, minimum, maximum;
+	if(!mOutput->GetDeviceBufferFrameSize(frameSize) || !mOutput->GetDeviceBufferFrameSizeRange(minimum, maximum) || frameSize >= maximum)
+		return;
 
-							// Update the seek request
-							decoderState->mFrameToSeek.store(-1);
+	if(0 == mNormalOutputBufferFrameSize)
+		mNormalOutputBufferFrameSize = frameSize;
 
-							// Update the counters accordingly
-							if(-1 != newFrame) {
-								decoderState->mFramesRendered.store(newFrame);
-								mFramesDecoded.store(newFrame);
-								mFramesRendered.store(newFrame);
+	if(!mOutput->SetDeviceBufferFrameSize(maximum))
+		LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Unable to set output buffer size to " << maximum << " frames");
+	else
+		LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Output buffer enlarged from " << frameSize << " to " << maximum << " frames for low-power mode");
+}
 
-								// Reset the converter to flush any buffers
-								if(audioConverter) {
-									auto result = AudioConverterReset(audioConverter);
-									if(noErr != result)
-										LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterReset failed: " << result);
-								}
+void SFB::Audio::Player::UpdateRingBufferFootprint()
+{
+	// Called wherever the ring buffers are allocated or swapped, which excludes concurrent changes
+	auto byteCount = [](const RingBuffer& ringBuffer) -> size_t {
+		return ringBuffer.GetStorageByteCount();
+	};
 
-								// Reset the ring buffer and output
-								mRingBuffer->Reset();
-								mOutput->Reset();
-							}
+	mRingBufferBytes.store(byteCount(*mRingBuffer));
+	mStandbyRingBufferBytes.store(byteCount(*mStandbyRingBuffer));
+	mLockedRingBufferBytes.store(mRingBuffer->GetLockedByteCount() + mStandbyRingBuffer->GetLockedByteCount());
+}
 
-							// Clear the mute flag
-							mFlags.fetch_and(~eAudioPlayerFlagMuteOutput);
-						}
+void SFB::Audio::Player::ApplyLowMemoryMode(bool enabled)
+{
+	// Must be called on mQueue
+	bool wasEnabled = mLowMemoryMode.exchange(enabled);
+	InputSource::SetLowMemoryModeEnabled(enabled);
+
+	if(!enabled) {
+		// Resume preparing the next decoders
+		if(wasEnabled) {
+			if(HasCurrentDecoderState())
+				PrerollNextDecoder();
+			WarmUpQueuedDecoders();
+		}
 
-						SInt64 startingFrameNumber = decoderState->mDecoder->GetCurrentFrame();
+		return;
+	}
 
-						if(-1 == startingFrameNumber) {
-							LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to determine starting frame number");
-							break;
-						}
+	// Return the pre-rolled decoder to the queue; a closed decoder is reopened at its beginning when needed
+	if(mPrerolledDecoderState) {
+		Decoder::unique_ptr decoder = std::move(mPrerolledDecoderState->mDecoder);
+		delete mPrerolledDecoderState;
+		mPrerolledDecoderState = nullptr;
 
-						// If this is the first frame, decoding is just starting
-						if(0 == startingFrameNumber && !(eDecoderStateDataFlagDecodingStarted & decoderState->mFlags.load())) {
-							// Call the decoding started block
-							if(mDecoderEventBlocks[0])
-								mDecoderEventBlocks[0](*decoderState->mDecoder);
-							decoderState->mFlags.fetch_or(eDecoderStateDataFlagDecodingStarted);
-						}
+		mDecoderQueue.push_front(std::move(decoder));
+	}
 
-						// Read the input chunk, converting from the decoder's format to the AUGraph's format
-						UInt32 framesDecoded = mRingBufferWriteChunkSize;
+	// Close warmed-up decoders, releasing their inputs and buffers
+	for(const auto& decoder : mDecoderQueue) {
+		if(decoder && decoder->IsOpen() && !decoder->Close())
+			LOGGER_NOTICE("org.sbooth.AudioEngine.Player", "Unable to close \"" << decoder->GetURL() << "\"");
+	}
 
-						if(audioConverter) {
-							auto result = AudioConverterFillComplexBuffer(audioConverter, myAudioConverterComplexInputDataProc, decoderState, &framesDecoded, bufferList, nullptr);
-							if(noErr != result)
-								LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterFillComplexBuffer failed: " << result);
-						}
-						else {
-							framesDecoded = decoderState->ReadAudio(framesDecoded);
-
-							// Bit swap if required
-							auto outputFormat = mOutput->GetFormat();
-							if(outputFormat.IsDSD() && (kAudioFormatFlagIsBigEndian & outputFormat.mFormatFlags) != (kAudioFormatFlagIsBigEndian & decoderState->mDecoder->GetFormat().mFormatFlags)) {
-								for(UInt32 i = 0; i < decoderState->mBufferList->mNumberBuffers; ++i) {
-									uint8_t *buf = (uint8_t *)decoderState->mBufferList->mBuffers[i].mData;
-									auto bufsize = decoderState->mBufferList->mBuffers[i].mDataByteSize;
-
-									while(bufsize--) {
-										*buf = sBitReverseTable256[*buf];
-										++buf;
-									}
-								}
-							}
-						}
+	UpdateQueuedDecoderCount();
+}
 
-						// Store the decoded audio
-						if(0 != framesDecoded) {
-							UInt32 framesWritten = (UInt32)mRingBuffer->WriteAudio(audioConverter ? bufferList : decoderState->mBufferList, framesDecoded);
-							if(framesWritten != framesDecoded)
-								LOGGER_ERR("org.sbooth.AudioEngine.Player", "RingBuffer::Store failed");
+SFB::Audio::Output& SFB::Audio::Player::GetOutput() const
+{
+	return *mOutput;
+}
 
-							mFramesDecoded.fetch_add(framesWritten);
-						}
+bool SFB::Audio::Player::SetOutput(Output::unique_ptr output)
+{
+	if(!output)
+		return false;
 
-						// If no frames were returned, this is the end of stream
-						if(0 == framesDecoded/* && !(eDecoderStateDataFlagDecodingFinished & decoderState->mFlags.load())*/) {
-							LOGGER_INFO("org.sbooth.AudioEngine.Player", "Decoding finished for \"" << decoderState->mDecoder->GetURL() << "\"");
+	if(!Stop())
+		return false;
 
-							// Some formats (MP3) may not know the exact number of frames in advance
-							// without processing the entire file, which is a potentially slow operation
-							// Rather than require preprocessing to ensure an accurate frame count, update
-							// it here so EOS is correctly detected in DidRender()
-							decoderState->mTotalFrames = startingFrameNumber;
+	if(!mOutput->Close())
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to close output");
 
-							// Call the decoding finished block
-							if(mDecoderEventBlocks[1])
-								mDecoderEventBlocks[1](*decoderState->mDecoder);
+	if(!output->Open()) {
+		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "Unable to open output");
+		return false;
+	}
 
-							// Decoding is complete
-							decoderState->mFlags.fetch_or(eDecoderStateDataFlagDecodingFinished);
-							decoderState = nullptr;
+	output->SetPlayer(this);
+	mOutput = std::move(output);
 
-							break;
-						}
-					}
-					// Not enough space remains in the ring buffer to write an entire decoded chunk
-					else
-						break;
-				}
+	mDecoderSchedulingGeneration.fetch_add(1);
+	UpdateOutputLatency();
 
-				// Start playback
-				if(eAudioPlayerFlagStartPlayback & mFlags.load()) {
-					mFlags.fetch_and(~eAudioPlayerFlagStartPlayback);
+	return true;
+}
 
-					if(!mOutput->IsRunning()) {
-						// We don't want to start output in the middle of a buffer modification
-						dispatch_sync(mQueue, ^{
-							if(!mOutput->Start())
-								LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to start output");
-						});
-					}
-				}
+#pragma mark Fan-out Outputs
 
-				// Wait for the audio rendering thread to signal us that it could use more data, or for the timeout to happen
-				mDecoderSemaphore.TimedWait(dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC));
-			}
+bool SFB::Audio::Player::AddFanOutOutput(Output::unique_ptr& output)
+{
+	if(!output)
+		return false;
 
-			// ========================================
-			// Clean up
-			// Set the appropriate flags for collection if decoding was stopped early
-			if(decoderState) {
-				decoderState->mFlags.fetch_or(eDecoderStateDataFlagDecodingFinished);
-				decoderState = nullptr;
+	if(!output->Open()) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to open fan-out output");
+		return false;
+	}
 
-				// If eAudioPlayerFlagMuteOutput is set SkipToNextTrack() is waiting for this decoder to finish
-				if(eAudioPlayerFlagMuteOutput & mFlags.load())
-					mSemaphore.Signal();
-			}
+	__block bool result = false;
+	dispatch_sync(mQueue, ^{
+		for(size_t i = 0; i < kMaximumFanOutOutputCount; ++i) {
+			auto& fanOut = mFanOutOutputs[i];
+			if(fanOut.mOutput)
+				continue;
 
-			if(audioConverter) {
-				auto result = AudioConverterDispose(audioConverter);
-				if(noErr != result)
-					LOGGER_ERR("org.sbooth.AudioEngine.Player", "AudioConverterDispose failed: " << result);
-				audioConverter = nullptr;
-			}
+			output->SetPlayer(this);
+			output->mFanOutIndex = i;
+			fanOut.mOutput = std::move(output);
+			mFanOutOutputCount.fetch_add(1);
+
+			result = true;
+			break;
 		}
+	});
 
-		// Wait for another thread to wake us, or for the timeout to happen
-		mDecoderSemaphore.TimedWait(dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC));
+	if(!result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Only " << kMaximumFanOutOutputCount << " fan-out outputs are supported");
+		output->Close();
+		return false;
 	}
 
-	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Decoding thread terminating");
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Added fan-out output");
 
-	return nullptr;
-}
+	// The output is configured for the current decoder by the decoding thread, or for the next decoder when playback begins
+	mFlags.fetch_or(eAudioPlayerFlagFanOutOutputsChanged);
+	WakeDecoder();
 
-#pragma mark Other Utilities
+	return true;
+}
 
-SFB::Audio::Player::DecoderStateData * SFB::Audio::Player::GetCurrentDecoderState() const
+bool SFB::Audio::Player::RemoveFanOutOutput(const Output *output)
 {
-	DecoderStateData *result = nullptr;
-	for(UInt32 bufferIndex = 0; bufferIndex < kActiveDecoderArraySize; ++bufferIndex) {
-		DecoderStateData *decoderState = mActiveDecoders[bufferIndex].load();
+	if(nullptr == output)
+		return false;
 
-		if(nullptr == decoderState)
-			continue;
+	__block Output::unique_ptr removedOutput;
+	dispatch_sync(mQueue, ^{
+		for(size_t i = 0; i < kMaximumFanOutOutputCount; ++i) {
+			auto& fanOut = mFanOutOutputs[i];
+			if(fanOut.mOutput.get() != output)
+				continue;
 
-		if(eDecoderStateDataFlagRenderingFinished & decoderState->mFlags.load())
-			continue;
+			if(fanOut.mOutput->IsRunning())
+				fanOut.mOutput->Stop();
+			fanOut.Deactivate();
 
-		if(nullptr == result)
-			result = decoderState;
-		else if(decoderState->mTimeStamp < result->mTimeStamp)
-			result = decoderState;
-	}
+			// Once disabled the cursor no longer limits decoding
+			mRingBuffer->SetAdditionalReaderEnabled(i, false);
+			mStandbyRingBuffer->SetAdditionalReaderEnabled(i, false);
 
-	return result;
-}
+			removedOutput = std::move(fanOut.mOutput);
+			mFanOutOutputCount.fetch_sub(1);
+			break;
+		}
+	});
 
-SFB::Audio::Player::DecoderStateData * SFB::Audio::Player::GetDecoderStateStartingAfterTimeStamp(SInt64 timeStamp) const
-{
-	DecoderStateData *result = nullptr;
-	for(UInt32 bufferIndex = 0; bufferIndex < kActiveDecoderArraySize; ++bufferIndex) {
-		DecoderStateData *decoderState = mActiveDecoders[bufferIndex].load();
+	if(!removedOutput)
+		return false;
 
-		if(nullptr == decoderState)
-			continue;
+	if(!removedOutput->Close())
+		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to close fan-out output");
 
-		if(eDecoderStateDataFlagRenderingFinished & decoderState->mFlags.load())
+	LOGGER_INFO("org.sbooth.AudioEngine.Player", "Removed fan-out output");
+
+	return true;
+}
+
+void SFB::Audio::Player::SuspendFanOutOutputs()
+{
+	for(size_t i = 0; i < kMaximumFanOutOutputCount; ++i) {
+		auto& fanOut = mFanOutOutputs[i];
+		if(!fanOut.mActive.load())
 			continue;
 
-		if(nullptr == result && decoderState->mTimeStamp > timeStamp)
-			result = decoderState;
-		else if(result && decoderState->mTimeStamp > timeStamp && decoderState->mTimeStamp < result->mTimeStamp)
-			result = decoderState;
+		fanOut.Deactivate();
+		mRingBuffer->SetAdditionalReaderEnabled(i, false);
 	}
-
-	return result;
 }
 
-void SFB::Audio::Player::StopActiveDecoders()
+void SFB::Audio::Player::SetupFanOutOutputsForDecoder(const Decoder& decoder)
 {
-	// The player must be stopped or a SIGSEGV could occur in this method
-	// This must be ensured by the caller!
+	// Must be called on mQueue while the ring buffer isn't written
 
-	// Request that any decoders still actively decoding stop
-	for(UInt32 bufferIndex = 0; bufferIndex < kActiveDecoderArraySize; ++bufferIndex) {
-		DecoderStateData *decoderState = mActiveDecoders[bufferIndex].load();
+	mFlags.fetch_and(~eAudioPlayerFlagFanOutOutputsChanged);
 
-		if(nullptr == decoderState)
+	for(size_t i = 0; i < kMaximumFanOutOutputCount; ++i) {
+		auto& fanOut = mFanOutOutputs[i];
+		if(!fanOut.mOutput) {
+			mRingBuffer->SetAdditionalReaderEnabled(i, false);
 			continue;
+		}
 
-		decoderState->mFlags.fetch_or(eDecoderStateDataFlagStopDecoding);
-	}
+		if(fanOut.mActive.load())
+			continue;
 
-	mDecoderSemaphore.Signal();
+		// The cursor begins at the player's read position so the outputs render the same audio
+		bool configured = fanOut.mOutput->SetupForDecoder(decoder) && fanOut.Configure(mRingBuffer->GetFormat());
+		if(!configured)
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to set up fan-out output for decoder");
+		else if(mOutput->IsRunning() && !fanOut.mOutput->IsRunning() && !fanOut.mOutput->Start()) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to start fan-out output");
+			configured = false;
+		}
 
-	for(UInt32 bufferIndex = 0; bufferIndex < kActiveDecoderArraySize; ++bufferIndex) {
-		DecoderStateData *decoderState = mActiveDecoders[bufferIndex].load();
+		// A cursor that isn't read would stall decoding
+		mRingBuffer->SetAdditionalReaderEnabled(i, configured);
+		fanOut.mActive.store(configured);
+	}
+}
 
-		if(nullptr == decoderState)
+void SFB::Audio::Player::StartFanOutOutputs()
+{
+	for(size_t i = 0; i < kMaximumFanOutOutputCount; ++i) {
+		auto& fanOut = mFanOutOutputs[i];
+		if(fanOut.mActive.load() && !fanOut.mOutput->IsRunning() && !fanOut.mOutput->Start())
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to start fan-out output");
+	}
+}
+
+void SFB::Audio::Player::StopFanOutOutputs(bool requestStop)
+{
+	for(size_t i = 0; i < kMaximumFanOutOutputCount; ++i) {
+		auto& fanOut = mFanOutOutputs[i];
+		if(!fanOut.mOutput || !fanOut.mOutput->IsRunning())
 			continue;
 
-		decoderState->mFlags.fetch_or(eDecoderStateDataFlagRenderingFinished);
+		if(requestStop)
+			fanOut.mOutput->RequestStop();
+		else
+			fanOut.mOutput->Stop();
 	}
 }
 
-bool SFB::Audio::Player::SetupOutputAndRingBufferForDecoder(Decoder& decoder)
+void SFB::Audio::Player::UpdateOutputLatency()
 {
-	// Open the decoder if necessary
-	SFB::CFError error;
-	if(!decoder.IsOpen() && !decoder.Open(&error)) {
-		if(mDecoderErrorBlock)
-			mDecoderErrorBlock(decoder, error);
+	Float64 latency = 0;
+	if(!mOutput->GetOutputLatency(latency))
+		latency = 0;
 
-		if(error)
-			LOGGER_ERR("org.sbooth.AudioEngine.Player", "Error opening decoder: " << error);
+	LOGGER_DEBUG("org.sbooth.AudioEngine.Player", "Output latency " << latency << " sec");
+	mOutputLatency.store(latency, std::memory_order_relaxed);
+}
 
-		return false;
-	}
+bool SFB::Audio::Player::ProvideAudio(AudioBufferList *bufferList, UInt32 frameCount, const AudioTimeStamp *timeStamp)
+{
+	// Nothing in this method may allocate, lock, or log since it is called from the real-time rendering thread
+	// Signposts are safe because they format only integers
+	SFB_SIGNPOST_INTERVAL_BEGIN("Player::ProvideAudio", this, "%u frames, %zu frames buffered", frameCount, mRingBuffer->GetFramesAvailableToRead());
+	bool tracing = mRenderTrace.IsRecording();
+	uint64_t traceStartTime = tracing ? mach_absolute_time() : 0;
+	size_t framesBuffered = tracing ? mRingBuffer->GetFramesAvailableToRead() : 0;
+	auto allocationCount = mRenderAllocations.mAllocationCount.load(std::memory_order_relaxed);
+	bool result;
+	{
+		AllocationTracker::Scope allocationScope(mRenderAllocations);
+		result = RenderScheduledAudio(bufferList, frameCount, timeStamp);
+		PublishPlaybackSnapshot(frameCount, timeStamp);
 
-	if(!mOutput->SupportsFormat(decoder.GetFormat())) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Format not supported: " << decoder.GetFormat());
+		// Fan-out outputs follow the measured clock of the output's device
+		if(0 < mFanOutOutputCount.load())
+			mOutputRateEstimator.Update(timeStamp, frameCount);
 
-		if(mErrorBlock) {
-			SFB::CFString description(CFCopyLocalizedString(CFSTR("The format of the file “%@” is not supported."), ""));
-			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Format not supported"), ""));
-			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file's format is not supported by the selected output device."), ""));
+		// Meter the audio exactly as it will be output
+		if(mMeteringEnabled.load())
+			mLevelMeter.Process(bufferList, frameCount, mOutput->GetFormat());
 
-			SFB::CFError formatError(CreateErrorForURL(Decoder::ErrorDomain, Decoder::InputOutputError, description, decoder.GetInputSource().GetURL(), failureReason, recoverySuggestion));
+		// The spectrum is computed on the analyzer's thread
+		if(mSpectrumAnalysisEnabled.load())
+			mSpectrumAnalyzer.Process(bufferList, frameCount, mOutput->GetFormat());
+	}
 
-			mErrorBlock(formatError);
-		}
+	// Any allocation is a real-time safety violation
+	auto cycleAllocationCount = mRenderAllocations.mAllocationCount.load(std::memory_order_relaxed);
+	if(cycleAllocationCount > allocationCount)
+		PostRenderEvent(eRenderEventAllocation, (UInt32)(cycleAllocationCount - allocationCount), 0, 0);
 
-		return false;
-	}
+	if(tracing)
+		mRenderTrace.Record(RenderTrace::Thread::Rendering, RenderTrace::EventType::Render, traceStartTime, frameCount, framesBuffered, mach_absolute_time() - traceStartTime);
 
-	// Configure the output for decoder
-	if(!mOutput->SetupForDecoder(decoder))
-		return false;
+	SFB_SIGNPOST_INTERVAL_END("Player::ProvideAudio", this, "%{bool}d", result);
+	return result;
+}
 
-	// Allocate enough space in the ring buffer for the new format
-	if(!mRingBuffer->Allocate(mOutput->GetFormat(), mRingBufferCapacity)) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to allocate ring buffer");
+bool SFB::Audio::Player::ProvideFanOutAudio(size_t index, AudioBufferList *bufferList, UInt32 frameCount, const AudioTimeStamp *timeStamp)
+{
+	// Nothing in this method may allocate, lock, or log since it is called from a real-time rendering thread
+	if(kMaximumFanOutOutputCount <= index)
 		return false;
-	}
+
+	auto& fanOut = mFanOutOutputs[index];
+	fanOut.mRenderingCount.fetch_add(1);
+
+	// The output is silent while the player's output is
+	if(fanOut.mActive.load() && !((eAudioPlayerFlagMuteOutput | eAudioPlayerFlagScheduledStartPending) & mFlags.load()))
+		fanOut.Render(*mRingBuffer, index, bufferList, frameCount, timeStamp, mOutputRateEstimator.GetSampleRate(), mRingBuffer->GetFramesAvailableToRead());
+	else
+		FanOutData::RenderSilence(bufferList);
+
+	fanOut.mRenderingCount.fetch_sub(1);
 
 	return true;
 }
 
-SFB::Audio::Output& SFB::Audio::Player::GetOutput() const
+bool SFB::Audio::Player::RenderScheduledAudio(AudioBufferList *bufferList, UInt32 frameCount, const AudioTimeStamp *timeStamp)
 {
-	return *mOutput;
-}
+	if(!(eAudioPlayerFlagScheduledStartPending & mFlags.load()))
+		return RenderAudio(bufferList, frameCount);
 
-bool SFB::Audio::Player::SetOutput(Output::unique_ptr output)
-{
-	if(!output)
-		return false;
+	// ========================================
+	// Determine where the scheduled start falls in this buffer
+	// RenderAudio() outputs silence while the scheduled start is pending
+	SInt64 startOffset = GetScheduledStartOffset(timeStamp);
+	if((SInt64)frameCount <= startOffset)
+		return RenderAudio(bufferList, frameCount);
 
-	if(!Stop())
-		return false;
+	mFlags.fetch_and(~eAudioPlayerFlagScheduledStartPending);
 
-	if(!mOutput->Close())
-		LOGGER_ERR("org.sbooth.AudioEngine.Player", "Unable to close output");
+	// A start time that has passed (or can't be determined) starts immediately
+	if(0 >= startOffset)
+		return RenderAudio(bufferList, frameCount);
 
-	if(!output->Open()) {
-		LOGGER_CRIT("org.sbooth.AudioEngine.Player", "Unable to open output");
-		return false;
+	// ========================================
+	// Output silence up to the start frame and render into the remainder of the buffer
+	// The ring buffer's format is the output's and its routines are specialized for it
+	const auto& outputFormat = mRingBuffer->GetFormat();
+	const auto& formatKernels = mRingBuffer->GetFormatKernels();
+	formatKernels.FillSilence(outputFormat, bufferList, 0, (size_t)startOffset);
+
+	size_t byteCountToSkip = formatKernels.FrameCountToByteCount(outputFormat, (size_t)startOffset);
+	for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex) {
+		bufferList->mBuffers[bufferIndex].mData = (int8_t *)bufferList->mBuffers[bufferIndex].mData + byteCountToSkip;
+		bufferList->mBuffers[bufferIndex].mDataByteSize -= (UInt32)byteCountToSkip;
 	}
 
-	output->SetPlayer(this);
-	mOutput = std::move(output);
+	bool result = RenderAudio(bufferList, frameCount - (UInt32)startOffset);
 
-	return true;
+	for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex) {
+		bufferList->mBuffers[bufferIndex].mData = (int8_t *)bufferList->mBuffers[bufferIndex].mData - byteCountToSkip;
+		bufferList->mBuffers[bufferIndex].mDataByteSize += (UInt32)byteCountToSkip;
+	}
+
+	return result;
+}
+
+SInt64 SFB::Audio::Player::GetScheduledStartOffset(const AudioTimeStamp *timeStamp) const
+{
+	if(nullptr == timeStamp)
+		return 0;
+
+	// Sample times are exact so they are preferred
+	Float64 startSampleTime = mScheduledStartSampleTime.load();
+	if(0 <= startSampleTime && (kAudioTimeStampSampleTimeValid & timeStamp->mFlags))
+		return (SInt64)llround(startSampleTime - timeStamp->mSampleTime);
+
+	uint64_t startHostTime = mScheduledStartHostTime.load();
+	if(0 != startHostTime && (kAudioTimeStampHostTimeValid & timeStamp->mFlags)) {
+		Float64 sampleRate = mOutput->GetFormat().mSampleRate;
+		if(startHostTime >= timeStamp->mHostTime)
+			return (SInt64)llround(ConvertHostTimeToNanos(startHostTime - timeStamp->mHostTime) * sampleRate / NSEC_PER_SEC);
+		else
+			return -(SInt64)llround(ConvertHostTimeToNanos(timeStamp->mHostTime - startHostTime) * sampleRate / NSEC_PER_SEC);
+	}
+
+	return 0;
 }
 
-bool SFB::Audio::Player::ProvideAudio(AudioBufferList *bufferList, UInt32 frameCount)
+bool SFB::Audio::Player::RenderAudio(AudioBufferList *bufferList, UInt32 frameCount)
 {
+	// Called from the real-time rendering thread
+	// Diagnostics are posted to mRenderEventQueue and handled by ProcessRenderEvents()
+	DecoderStateEpochGuard guard(*this);
+	uint64_t userBlockTime = 0;
+
 	// ========================================
 	// Pre-rendering actions
 
 	// Call the pre-render block
-	if(mRenderEventBlocks[0])
+	if(mRenderEventBlocks[0]) {
+		auto start = mach_absolute_time();
 		mRenderEventBlocks[0](bufferList, frameCount);
+		userBlockTime += mach_absolute_time() - start;
+	}
 
 	// Mute output if requested
 	if(eAudioPlayerFlagRequestMute & mFlags.load()) {
@@ -1469,87 +5470,136 @@ bool SFB::Audio::Player::ProvideAudio(AudioBufferList *bufferList, UInt32 frameC
 	size_t framesAvailableToRead = mRingBuffer->GetFramesAvailableToRead();
 
 	// Output silence if muted or the ring buffer is empty
-	auto outputFormat = mOutput->GetFormat();
-	if(eAudioPlayerFlagMuteOutput & mFlags.load() || 0 == framesAvailableToRead) {
-		size_t byteCountToZero = outputFormat.FrameCountToByteCount(frameCount);
-		for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex) {
-			memset(bufferList->mBuffers[bufferIndex].mData, outputFormat.IsDSD() ? 0xF : 0, byteCountToZero);
+	// The ring buffer's format is the output's and its routines are specialized for it
+	const auto& outputFormat = mRingBuffer->GetFormat();
+	const auto& formatKernels = mRingBuffer->GetFormatKernels();
+	if((eAudioPlayerFlagMuteOutput | eAudioPlayerFlagScheduledStartPending) & mFlags.load() || 0 == framesAvailableToRead) {
+		formatKernels.FillSilence(outputFormat, bufferList, 0, frameCount);
+
+		size_t byteCountToZero = formatKernels.FrameCountToByteCount(outputFormat, frameCount);
+		for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex)
 			bufferList->mBuffers[bufferIndex].mDataByteSize = (UInt32)byteCountToZero;
+
+		if(0 < mActiveVoiceCount.load())
+			MixVoices(bufferList, frameCount);
+		// A scheduled start is silent by request and keeps output running
+		else if(!(eAudioPlayerFlagScheduledStartPending & mFlags.load()) && mAutomaticOutputSuspension.load()) {
+			auto silentFrameCount = mSilentFrameCount.fetch_add(frameCount, std::memory_order_relaxed) + frameCount;
+			if(silentFrameCount >= mOutputSuspensionDelay.load() * outputFormat.mSampleRate && !(eAudioPlayerFlagOutputSuspensionRequested & mFlags.fetch_or(eAudioPlayerFlagOutputSuspensionRequested)))
+				PostRenderEvent(eRenderEventOutputSuspensionRequested, frameCount, 0, userBlockTime);
 		}
 
+		mRenderUserBlockTime.fetch_add(userBlockTime);
+
 		return true;
 	}
 
+	mSilentFrameCount.store(0, std::memory_order_relaxed);
+
+	// Statistics are only written by the render thread so the minimum doesn't require a compare-and-swap
+	mRenderCycleCount.fetch_add(1, std::memory_order_relaxed);
+	mRingBufferFillSum.fetch_add(framesAvailableToRead, std::memory_order_relaxed);
+	if(framesAvailableToRead < mMinimumRingBufferFill.load(std::memory_order_relaxed))
+		mMinimumRingBufferFill.store((unsigned int)framesAvailableToRead, std::memory_order_relaxed);
+
 	// Restrict reads to valid decoded audio
 	size_t framesToRead = std::min((UInt32)framesAvailableToRead, frameCount);
 	UInt32 framesRead = (UInt32)mRingBuffer->ReadAudio(bufferList, framesToRead);
 	if(framesRead != framesToRead) {
-		LOGGER_ERR("org.sbooth.AudioEngine.Player", "RingBuffer::ReadAudio failed: Requested " << framesToRead << " frames, got " << framesRead);
+		PostRenderEvent(eRenderEventRingBufferReadFailed, (UInt32)framesToRead, framesRead, userBlockTime);
+		mRenderUserBlockTime.fetch_add(userBlockTime);
 		return false;
 	}
 
-	mFramesRendered.fetch_add(framesRead);
+	// Stretched audio is accounted for in source frames
+	UInt32 sourceFramesRead = ConvertRenderedFramesToSourceFrames(framesRead);
+	mFramesRendered.fetch_add(sourceFramesRead);
 
 	// If the ring buffer didn't contain as many frames as were requested, fill the remainder with silence
 	if(framesRead != frameCount) {
-		LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Insufficient audio in ring buffer: " << framesRead << " frames available, " << frameCount << " requested");
+		mRenderUnderrunFrames.fetch_add(frameCount - framesRead);
+		mUnderrunCount.fetch_add(1, std::memory_order_relaxed);
+		mUnderrunFrameCount.fetch_add(frameCount - framesRead, std::memory_order_relaxed);
 
-		size_t framesOfSilence = frameCount - framesRead;
-		size_t byteCountToSkip = outputFormat.FrameCountToByteCount(framesRead);
-		size_t byteCountToZero = outputFormat.FrameCountToByteCount(framesOfSilence);
-		for(UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; ++bufferIndex) {
-			memset((int8_t *)bufferList->mBuffers[bufferIndex].mData + byteCountToSkip, outputFormat.IsDSD() ? 0xF : 0, byteCountToZero);
-		}
+		formatKernels.FillSilence(outputFormat, bufferList, framesRead, frameCount - framesRead);
+	}
+
+	// If the decoding thread is waiting and there is adequate space in the ring buffer for another chunk, signal it
+	// In low-power mode the decoding thread isn't woken until the ring buffer has drained to its low watermark
+	if(eAudioPlayerFlagDecoderNeedsSpace & mFlags.load()) {
+		size_t framesAvailableToWrite = mRingBuffer->GetFramesAvailableToWrite();
+		size_t wakeFrames = mActiveRingBufferWriteChunkSize;
+		if(mLowPowerMode.load())
+			wakeFrames = std::max(wakeFrames, (size_t)((1 - LOW_POWER_WAKE_FILL_FRACTION) * mRingBuffer->GetCapacityFrames()));
+
+		if(wakeFrames <= framesAvailableToWrite && (eAudioPlayerFlagDecoderNeedsSpace & mFlags.fetch_and(~eAudioPlayerFlagDecoderNeedsSpace)))
+			WakeDecoder();
 	}
 
-	// If there is adequate space in the ring buffer for another chunk, signal the reader thread
-	size_t framesAvailableToWrite = mRingBuffer->GetFramesAvailableToWrite();
-	if(mRingBufferWriteChunkSize <= framesAvailableToWrite)
-		mDecoderSemaphore.Signal();
+	if(0 < mActiveVoiceCount.load())
+		MixVoices(bufferList, frameCount);
 
 
 	// ========================================
 	// Post-rendering actions
 
 	// Call the post-render block
-	if(mRenderEventBlocks[1])
+	if(mRenderEventBlocks[1]) {
+		auto start = mach_absolute_time();
 		mRenderEventBlocks[1](bufferList, frameCount);
+		userBlockTime += mach_absolute_time() - start;
+	}
 
 	// There is nothing more to do if no frames were rendered
-	if(0 == framesRead)
+	if(0 == framesRead) {
+		mRenderUserBlockTime.fetch_add(userBlockTime);
 		return true;
+	}
 
-	// framesRead contains the number of valid frames that were rendered
+	// sourceFramesRead contains the number of source frames that were rendered
 	// However, these could have come from any number of decoders depending on the buffer sizes
 	// So it is necessary to split them up here
 
-	SInt64 framesRemainingToDistribute = framesRead;
+	SInt64 framesRemainingToDistribute = sourceFramesRead;
 	DecoderStateData *decoderState = GetCurrentDecoderState();
 
-	// mActiveDecoders is not an ordered array, so to ensure that callbacks are performed
-	// in the proper order multiple passes are made here
+	// mActiveDecoders is ordered by time stamp, so the decoders are visited in the order their audio was written
 	while(nullptr != decoderState) {
 		SInt64 timeStamp = decoderState->mTimeStamp;
 
-		SInt64 decoderFramesRemaining = (-1 == decoderState->mTotalFrames ? framesRead : decoderState->mTotalFrames - decoderState->mFramesRendered);
-		SInt64 framesFromThisDecoder = std::min(decoderFramesRemaining, (SInt64)framesRead);
+		SInt64 decoderFramesRemaining = (-1 == decoderState->mTotalFrames ? framesRemainingToDistribute : decoderState->mTotalFrames - decoderState->mFramesRendered);
+		SInt64 framesFromThisDecoder = std::min(decoderFramesRemaining, framesRemainingToDistribute);
 
 		if(!(eDecoderStateDataFlagRenderingStarted & decoderState->mFlags.load())) {
 			// Call the rendering started block
-			if(mDecoderEventBlocks[2])
+			if(mDecoderEventBlocks[2]) {
+				auto start = mach_absolute_time();
 				mDecoderEventBlocks[2](*decoderState->mDecoder);
+				userBlockTime += mach_absolute_time() - start;
+			}
 			decoderState->mFlags.fetch_or(eDecoderStateDataFlagRenderingStarted);
+
+			// Only the first decoder rendered after an enqueue on an idle player measures startup latency
+			auto startupHostTime = mStartupHostTime.exchange(0, std::memory_order_relaxed);
+			if(0 != startupHostTime)
+				mStartupLatency.store((long long)(mach_absolute_time() - startupHostTime), std::memory_order_relaxed);
 		}
 
 		decoderState->mFramesRendered.fetch_add(framesFromThisDecoder);
 
 		if((eDecoderStateDataFlagDecodingFinished & decoderState->mFlags.load()) && decoderState->mFramesRendered == decoderState->mTotalFrames/* && !(eDecoderStateDataFlagRenderingFinished & decoderState->mFlags.load())*/) {
 			// Call the rendering finished block
-			if(mDecoderEventBlocks[3])
+			if(mDecoderEventBlocks[3]) {
+				auto start = mach_absolute_time();
 				mDecoderEventBlocks[3](*decoderState->mDecoder);
+				userBlockTime += mach_absolute_time() - start;
+			}
 
 			decoderState->mFlags.fetch_or(eDecoderStateDataFlagRenderingFinished);
 			decoderState = nullptr;
+
+			// The decoder state is reclaimed outside of the rendering thread
+			PostRenderEvent(eRenderEventRenderingFinished, frameCount, framesRead, 0);
 		}
 
 		framesRemainingToDistribute -= framesFromThisDecoder;
@@ -1560,7 +5610,7 @@ bool SFB::Audio::Player::ProvideAudio(AudioBufferList *bufferList, UInt32 frameC
 		decoderState = GetDecoderStateStartingAfterTimeStamp(timeStamp);
 	}
 
-	if(mFramesDecoded == mFramesRendered && nullptr == GetCurrentDecoderState()) {
+	if(mFramesDecoded == mFramesRendered && !HasCurrentDecoderState()) {
 		// Signal the decoding thread that it is safe to manipulate the ring buffer
 		if(eAudioPlayerFlagFormatMismatch & mFlags.load()) {
 			mFlags.fetch_or(eAudioPlayerFlagMuteOutput);
@@ -1568,9 +5618,135 @@ bool SFB::Audio::Player::ProvideAudio(AudioBufferList *bufferList, UInt32 frameC
 			mSemaphore.Signal();
 		}
 		// Calling ASIOStop() from within a callback causes a crash, at least with exaSound's ASIO driver
-		else
-			mOutput->RequestStop();
+		// Output is stopped outside of the rendering thread, and only once per request
+		// Playing voices keep output running; it is stopped when the last voice finishes
+		else if(0 == mActiveVoiceCount.load() && !(eAudioPlayerFlagOutputStopRequested & mFlags.fetch_or(eAudioPlayerFlagOutputStopRequested)))
+			PostRenderEvent(eRenderEventOutputStopRequested, frameCount, framesRead, userBlockTime);
 	}
 
+	if(framesRead != frameCount)
+		PostRenderEvent(eRenderEventUnderrun, frameCount, framesRead, userBlockTime);
+
+	mRenderUserBlockTime.fetch_add(userBlockTime);
+
 	return true;
 }
+
+void SFB::Audio::Player::PostRenderEvent(uint32_t eventType, UInt32 framesRequested, UInt32 framesRendered, uint64_t userBlockTime)
+{
+	RenderEvent event = {
+		.mType				= eventType,
+		.mFramesRequested	= framesRequested,
+		.mFramesRendered	= framesRendered,
+		.mUserBlockTime		= userBlockTime
+	};
+
+	// Partial writes would corrupt the queue
+	if(sizeof(event) > mRenderEventQueue->GetBytesAvailableToWrite()) {
+		mDroppedRenderEventCount.fetch_add(1);
+		return;
+	}
+
+	mRenderEventQueue->Write(&event, sizeof(event));
+	dispatch_source_merge_data(mRenderEventSource, 1);
+}
+
+void SFB::Audio::Player::PublishPlaybackSnapshot(UInt32 frameCount, const AudioTimeStamp *timeStamp)
+{
+	// Must be called from the rendering thread, which is the only writer
+	auto now = mach_absolute_time();
+
+	// The frame following those just rendered becomes audible at the end of the buffer
+	uint64_t audibleHostTime = (nullptr != timeStamp && (kAudioTimeStampHostTimeValid & timeStamp->mFlags)) ? timeStamp->mHostTime : now;
+	Float64 outputSampleRate = mOutput->GetFormat().mSampleRate;
+	if(0 < outputSampleRate)
+		audibleHostTime += ConvertNanosToHostTime((uint64_t)(((frameCount / outputSampleRate) + mOutputLatency.load(std::memory_order_relaxed)) * NSEC_PER_SEC));
+
+	SInt64 currentFrame = -1, totalFrames = -1;
+	Float64 sampleRate = 0;
+	CFURLRef url = nullptr;
+	void *representedObject = nullptr;
+
+	DecoderStateData *decoderState = GetCurrentDecoderState();
+	if(nullptr != decoderState) {
+		SInt64 frameToSeek = decoderState->mFrameToSeek.load();
+		currentFrame		= (-1 == frameToSeek ? decoderState->mFramesRendered.load() : frameToSeek);
+		totalFrames			= decoderState->mTotalFrames;
+		sampleRate			= decoderState->mDecoder->GetFormat().mSampleRate;
+		url					= decoderState->mDecoder->GetURL();
+		representedObject	= decoderState->mDecoder->GetRepresentedObject();
+	}
+
+	auto sequence = mSnapshotSequence.load(std::memory_order_relaxed);
+	mSnapshotSequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	mSnapshotCurrentFrame.store(currentFrame, std::memory_order_relaxed);
+	mSnapshotTotalFrames.store(totalFrames, std::memory_order_relaxed);
+	mSnapshotSampleRate.store(sampleRate, std::memory_order_relaxed);
+	mSnapshotHostTime.store(now, std::memory_order_relaxed);
+	mSnapshotAudibleHostTime.store(audibleHostTime, std::memory_order_relaxed);
+	mSnapshotURL.store(url, std::memory_order_relaxed);
+	mSnapshotRepresentedObject.store(representedObject, std::memory_order_relaxed);
+
+	mSnapshotSequence.store(sequence + 2, std::memory_order_release);
+}
+
+void SFB::Audio::Player::ProcessRenderEvents()
+{
+	while(sizeof(RenderEvent) <= mRenderEventQueue->GetBytesAvailableToRead()) {
+		RenderEvent event;
+		auto bytesRead = mRenderEventQueue->Read(&event, sizeof(event));
+		if(bytesRead != sizeof(event)) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Player", "Error reading event from render event queue");
+			break;
+		}
+
+		switch(event.mType) {
+			case eRenderEventUnderrun:
+				LOGGER_WARNING("org.sbooth.AudioEngine.Player", "Insufficient audio in ring buffer: " << event.mFramesRendered << " frames available, " << event.mFramesRequested << " requested (" << ConvertHostTimeToNanos(event.mUserBlockTime) << " ns in blocks)");
+
+				// Underruns with no decoder active are expected at the end of playback
+				if(mAutomaticOutputBufferSizing && HasCurrentDecoderState())
+					EnlargeOutputBufferFollowingUnderrun();
+				break;
+
+			case eRenderEventRingBufferReadFailed:
+				LOGGER_ERR("org.sbooth.AudioEngine.Player", "RingBuffer::ReadAudio failed: Requested " << event.mFramesRequested << " frames, got " << event.mFramesRendered);
+				break;
+
+			case eRenderEventOutputStopRequested:
+				mFlags.fetch_and(~eAudioPlayerFlagOutputStopRequested);
+
+				// Output may have been restarted with new audio since the request was posted
+				if(mFramesDecoded == mFramesRendered && !HasCurrentDecoderState() && 0 == mActiveVoiceCount.load()) {
+					mOutput->RequestStop();
+					dispatch_async(mQueue, ^{
+						StopFanOutOutputs(true);
+					});
+
+					// Wake any thread waiting on the rendering thread, which may no longer run
+					mSemaphore.Signal();
+				}
+				break;
+
+			case eRenderEventRenderingFinished:
+				CollectDecoderStates();
+				break;
+
+			case eRenderEventOutputSuspensionRequested:
+				mFlags.fetch_and(~eAudioPlayerFlagOutputSuspensionRequested);
+				SuspendOutputIfSilent();
+				break;
+
+			case eRenderEventAllocation:
+				LOGGER_ERR("org.sbooth.AudioEngine.Player", event.mFramesRequested << " heap allocations on the rendering thread");
+				break;
+		}
+	}
+}
+
+uint64_t SFB::Audio::Player::GetRenderUserBlockTime() const
+{
+	return ConvertHostTimeToNanos(mRenderUserBlockTime.load());
+}
@@ -9,16 +9,30 @@
 
 #include <memory>
 #include <atomic>
+#include <mutex>
 #include <thread>
 #include <vector>
+#include <deque>
 #include <utility>
 
 #include <dispatch/dispatch.h>
+#include <pthread/qos.h>
 
+#include "AllocationTracker.h"
+#include "AudioAnalysisTap.h"
 #include "AudioOutput.h"
 #include "AudioDecoder.h"
+#include "AudioBufferList.h"
 #include "AudioRingBuffer.h"
+#include "RingBuffer.h"
 #include "AudioChannelLayout.h"
+#include "AudioClockBridge.h"
+#include "AudioEffectChain.h"
+#include "AudioLevelMeter.h"
+#include "AudioSpectrumAnalyzer.h"
+#include "AudioTimeStretcher.h"
+#include "Event.h"
+#include "RenderTrace.h"
 #include "Semaphore.h"
 
 /*! @file AudioPlayer.h @brief Audio playback functionality */
@@ -29,6 +43,8 @@ namespace SFB {
 	/*! @brief %Audio functionality */
 	namespace Audio {
 
+		class DecoderPool;
+
 		/*!
 		 * @brief The audio player class
 		 *
@@ -39,12 +55,13 @@ namespace SFB {
 		 * For the common case using CoreAudioOutput the audio is stored in the canonical Core Audio format (kAudioFormatFlagsAudioUnitCanonical)-
 		 * deinterleaved, normalized [-1, 1) native floating point data in 32 bits (AKA floats) on Mac OS X and 8.24 fixed point on iOS.
 		 * For ASIOOutput (on exaSound devices) the audio may be stored in either DSD or PCM format.
+		 * Players created with a DecoderPool share the pool's decoding threads instead of each using a dedicated thread.
 		 *
 		 * Rendering occurs in a realtime thread when ProvideAudio() is called by the output.
 		 *
-		 * Since decoding and rendering are distinct operations performed in separate threads, a GCD timer on the background queue is
-		 * used for garbage collection.  This is necessary because state data created in the decoding thread needs to live until
-		 * rendering is complete, which cannot occur until after decoding is complete.
+		 * Since decoding and rendering are distinct operations performed in separate threads, state data created in the decoding thread
+		 * needs to live until rendering is complete, which cannot occur until after decoding is complete.  Finished state data is
+		 * reclaimed using epochs: it is freed as soon as no thread that could have seen it (including the rendering thread) is still using it.
 		 *
 		 * The player supports block-based callbacks for the following events:
 		 *  1. Decoding started
@@ -65,9 +82,6 @@ namespace SFB {
 		 */
 		class Player {
 
-			/*! @brief The length of the array containing active audio decoders */
-			static const size_t kActiveDecoderArraySize = 8;
-
 		public:
 			// ========================================
 			/*! @name Block callback types */
@@ -106,6 +120,30 @@ namespace SFB {
 			 */
 			using ErrorBlock = void (^)(CFErrorRef error);
 
+			/*!
+			 * @brief A block called to create an analysis tap for a \c Decoder
+			 * @param decoder The \c Decoder whose audio may be analyzed
+			 * @return A new \c AnalysisTap owned by the player, or \c nullptr if the decoder's audio should not be analyzed
+			 */
+			using AnalysisTapBlock = AnalysisTap * (^)(const Decoder& decoder);
+
+			/*!
+			 * @brief A block called when an asynchronous command has taken effect
+			 * @param success \c true if the command succeeded, \c false otherwise
+			 */
+			using CommandCompletionBlock = void (^)(bool success);
+
+			/*! @brief A ticket identifying an asynchronous enqueue; \c 0 is never a valid ticket */
+			using EnqueueTicket = uint64_t;
+
+			/*!
+			 * @brief A block called when the decoder for an asynchronous enqueue has been handed to the player
+			 * @param ticket The ticket returned when the URL was enqueued
+			 * @param success \c true if the decoder was enqueued, \c false otherwise
+			 * @param error The error that prevented the decoder from being created or opened, or \c nullptr if the enqueue was cancelled
+			 */
+			using EnqueueCompletionBlock = void (^)(EnqueueTicket ticket, bool success, CFErrorRef error);
+
 			//@}
 
 
@@ -123,6 +161,35 @@ namespace SFB {
 			 */
 			Player();
 
+			/*!
+			 * @brief Create a new \c Player for the default CoreAudioOutput device
+			 * @note The active decoder capacity limits the number of decoders that may be decoding or rendering simultaneously,
+			 * which is relevant when playing many short tracks in succession
+			 * @param activeDecoderCapacity The maximum number of active decoders, rounded up to the next power of two
+			 * @throws std::bad_alloc
+			 * @throws std::runtime_error
+			 */
+			explicit Player(size_t activeDecoderCapacity);
+
+			/*!
+			 * @brief Create a new \c Player for the default CoreAudioOutput device whose decoding is performed by \c decoderPool
+			 * @note \c decoderPool must outlive the \c Player
+			 * @param decoderPool The pool of decoding threads to use instead of a dedicated decoding thread
+			 * @throws std::bad_alloc
+			 * @throws std::runtime_error
+			 */
+			explicit Player(DecoderPool& decoderPool);
+
+			/*!
+			 * @brief Create a new \c Player for the default CoreAudioOutput device whose decoding is performed by \c decoderPool
+			 * @note \c decoderPool must outlive the \c Player
+			 * @param decoderPool The pool of decoding threads to use instead of a dedicated decoding thread
+			 * @param activeDecoderCapacity The maximum number of active decoders, rounded up to the next power of two
+			 * @throws std::bad_alloc
+			 * @throws std::runtime_error
+			 */
+			Player(DecoderPool& decoderPool, size_t activeDecoderCapacity);
+
 			/*! @brief Destroy the \c Player and release all associated resources. */
 			~Player();
 
@@ -251,6 +318,14 @@ namespace SFB {
 			 */
 			void SetRenderingFinishedBlock(DecoderEventBlock block);
 
+			/*!
+			 * @brief Set the block to be invoked when the estimated length of a \c Decoder is replaced with its exact length
+			 * @note The block is invoked from the decoding thread, at the latest when the decoder finishes decoding
+			 * @param block The block to invoke when the length is known
+			 * @see Decoder::IsTotalFramesEstimated()
+			 */
+			void SetTotalFramesRefinedBlock(DecoderEventBlock block);
+
 			/*!
 			 * @brief Set the block to be invoked when a queued \c Decoder fails to open
 			 * @note The block is invoked from the decoding thread
@@ -288,6 +363,16 @@ namespace SFB {
 			 */
 			void SetUnsupportedFormatBlock(ErrorBlock block);
 
+
+			/*!
+			 * @brief Set the block to be invoked to create an analysis tap when a \c Decoder starts decoding
+			 *
+			 * The tap receives the audio as it is decoded for playback, so the audio can be analyzed without being decoded again.
+			 * @note The block is invoked from the decoding thread
+			 * @param block The block to invoke when decoding starts
+			 */
+			void SetAnalysisTapBlock(AnalysisTapBlock block);
+
 			//@}
 
 
@@ -321,6 +406,70 @@ namespace SFB {
 			/*! @brief Get the playback position and time of the active \c Decoder */
 			bool GetPlaybackPositionAndTime(SInt64& currentFrame, SInt64& totalFrames, CFTimeInterval& currentTime, CFTimeInterval& totalTime) const;
 
+
+			/*!
+			 * @brief Get the duration of input following the active \c Decoder's position that has been received
+			 * @note This is supported only for inputs received asynchronously, and is estimated from the input's average bitrate
+			 */
+			bool GetBufferedInputTime(CFTimeInterval& bufferedTime) const;
+
+			/*!
+			 * @brief Get the duration of decoded audio in the ring buffer awaiting rendering
+			 * @note Together with \c GetBufferedInputTime() this gives the depth of both buffering tiers
+			 */
+			bool GetBufferedAudioTime(CFTimeInterval& bufferedTime) const;
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Playback Snapshots
+			 * While audio is being rendered the rendering thread publishes a snapshot of the playback position once per
+			 * render cycle, and reading it requires neither a lock nor a scan of the active decoders.  When no recent
+			 * snapshot exists (because output is paused or stopped) the snapshot is created from the active decoder.
+			 */
+			//@{
+
+			/*! @brief A coherent view of the player and its active \c Decoder */
+			struct PlaybackSnapshot {
+				PlayerState		mPlayerState;			/*!< The player state */
+				SInt64			mCurrentFrame;			/*!< The current frame of the active decoder */
+				SInt64			mTotalFrames;			/*!< The total frames of the active decoder, or \c -1 if unknown */
+				Float64			mSampleRate;			/*!< The sample rate of the active decoder */
+				uint64_t		mHostTime;				/*!< The host time at which \c mCurrentFrame was current */
+				SInt64			mAudibleFrame;			/*!< The frame of the active decoder audible at \c mAudibleHostTime */
+				uint64_t		mAudibleHostTime;		/*!< The host time at which \c mAudibleFrame is audible */
+				CFURLRef		mURL;					/*!< The URL of the active decoder */
+				void			*mRepresentedObject;	/*!< The represented object belonging to the active decoder */
+
+				/*! @brief Get the current time of the active decoder */
+				inline CFTimeInterval GetCurrentTime() const			{ return mCurrentFrame / mSampleRate; }
+
+				/*! @brief Get the total time of the active decoder */
+				inline CFTimeInterval GetTotalTime() const				{ return mTotalFrames / mSampleRate; }
+
+				/*!
+				 * @brief Estimate the frame of the active decoder audible at \c hostTime
+				 *
+				 * While playing the estimate is extrapolated from \c mAudibleFrame, which is derived from the output's time stamp for the
+				 * render cycle and its latency, so it is accurate to within a frame rather than to the size of the output's buffer.
+				 */
+				SInt64 GetAudibleFrame(uint64_t hostTime) const;
+			};
+
+			/*!
+			 * @brief Get a snapshot of the playback position of the active \c Decoder
+			 * @note \c mURL and \c mRepresentedObject are not retained, and have the same lifetime as the values returned by
+			 * \c GetPlayingURL() and \c GetPlayingRepresentedObject()
+			 * @param snapshot A \c PlaybackSnapshot to receive the snapshot
+			 * @return \c true if a \c Decoder is active, \c false otherwise
+			 */
+			bool GetPlaybackSnapshot(PlaybackSnapshot& snapshot) const;
+
+			/*! @brief Get the frame of the active \c Decoder that is currently audible */
+			bool GetAudibleFrame(SInt64& audibleFrame) const;
+
 			//@}
 
 
@@ -349,6 +498,33 @@ namespace SFB {
 			/*! @brief Determine whether the active \c Decoder supports seeking */
 			bool SupportsSeeking() const;
 
+
+			/*!
+			 * @brief Create a state snapshot for resuming playback of the active \c Decoder at the frame being rendered
+			 *
+			 * The snapshot is created by the decoding thread, which this method waits for.
+			 * @note The returned data must be released by the caller
+			 * @return A snapshot, or \c nullptr if the active \c Decoder has finished decoding or the decoding thread
+			 * didn't respond in time
+			 * @see Play(CFURLRef, CFDataRef)
+			 */
+			CFDataRef CreateStateSnapshot();
+
+
+			/*! @brief Query whether the player is scrubbing */
+			inline bool IsScrubbing() const							{ return mScrubbing.load(); }
+
+			/*!
+			 * @brief Begin or end scrubbing
+			 *
+			 * While scrubbing seeks are approximate, landing on a nearby page or packet boundary when the decoder
+			 * supports it, and only a small amount of audio is decoded ahead of the output so each seek is heard
+			 * promptly.  Seeks requested while an earlier seek is being performed supersede it.  When scrubbing
+			 * ends an exact seek is performed to the frame most recently requested.
+			 * @param scrubbing \c true to begin scrubbing, \c false to end it
+			 */
+			void SetScrubbing(bool scrubbing);
+
 			//@}
 
 
@@ -364,6 +540,19 @@ namespace SFB {
 			 */
 			bool Play(CFURLRef url);
 
+			/*!
+			 * @brief Resume playback of a URL from a state snapshot
+			 *
+			 * The decoder is opened and positioned using the codec state in \c stateSnapshot before decoding begins, so
+			 * playback resumes at the snapshot's frame without a search of the input.  If the snapshot doesn't match
+			 * the URL's audio, playback begins at the start.
+			 * @note This will clear any enqueued decoders
+			 * @param url The URL to play
+			 * @param stateSnapshot A snapshot created by \c CreateStateSnapshot() or \c Decoder::CreateStateSnapshot()
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool Play(CFURLRef url, CFDataRef stateSnapshot);
+
 			/*!
 			 * @brief Start playback of a \c Decoder
 			 * @note This will clear any enqueued decoders
@@ -373,6 +562,19 @@ namespace SFB {
 			 */
 			bool Play(Decoder::unique_ptr& decoder);
 
+			/*!
+			 * @brief Start playback of a \c Decoder at a specific time
+			 * @note This will clear any enqueued decoders
+			 * @note The player will take ownership of the decoder on success and may take ownership on failure
+			 * @note Silence is output until the start time, which is located to the frame within the output's buffer.
+			 * If \c startTime has a valid sample time and the output supplies sample times it is used, otherwise the host time is used.
+			 * A start time that has already passed starts playback immediately.
+			 * @param decoder The \c Decoder to play
+			 * @param startTime The output time at which the first frame of \c decoder should be rendered
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool PlayAtTime(Decoder::unique_ptr& decoder, const AudioTimeStamp& startTime);
+
 
 			/*!
 			 * @brief Enqueue a URL for playback
@@ -389,6 +591,14 @@ namespace SFB {
 			 */
 			bool Enqueue(Decoder::unique_ptr& decoder);
 
+			/*!
+			 * @brief Enqueue multiple decoders for playback in a single operation
+			 * @note The player will take ownership of the decoders on success, and \c decoders will be empty
+			 * @param decoders The decoders to enqueue
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool Enqueue(std::vector<Decoder::unique_ptr>& decoders);
+
 
 			/*!
 			 * @brief Skip to the next enqueued decoder
@@ -403,6 +613,373 @@ namespace SFB {
 			 */
 			bool ClearQueuedDecoders();
 
+			/*!
+			 * @brief Clear all queued decoders in a single operation, returning them to the caller
+			 * @note A decoder being opened for pre-roll or warm-up is appended once its open completes; pre-roll and warm-up stop once the queue is cleared
+			 * @param decoders A \c std::vector to which the queued decoders will be appended, in queue order
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool ClearQueuedDecoders(std::vector<Decoder::unique_ptr>& decoders);
+
+
+			/*! @brief Get the number of queued decoders that are opened in advance of playback */
+			inline size_t GetQueueWarmUpCount() const				{ return mQueueWarmUpCount; }
+
+			/*!
+			 * @brief Set the number of queued decoders that are opened in advance of playback
+			 * @note Opening a decoder opens its input, starting any asynchronous download, and reads its headers,
+			 * so tracks on slow or remote storage start promptly.  Decoders are opened one at a time at low priority
+			 * in queue order.  This is in addition to the decoder following the current one, which is always pre-rolled.
+			 * @param count The number of decoders, or \c 0 to open decoders only when needed
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetQueueWarmUpCount(size_t count);
+
+
+			/*! @brief Query whether decoders created by the player decode in a separate process */
+			inline bool IsRemoteDecodingEnabled() const				{ return mRemoteDecoding.load(); }
+
+			/*!
+			 * @brief Enable or disable decoding in a separate process
+			 * @note When enabled the decoders created for URLs by \c Play(), \c Enqueue() and \c EnqueueAsync() are
+			 * \c RemoteDecoder objects, so a codec that crashes or hangs on a malformed file ends the track instead of
+			 * the app.  Decoders passed to the player are unaffected.  The service must be set with
+			 * \c RemoteDecoder::SetServicePath().
+			 * @note Remote decoding is unavailable on iOS, where the setting is ignored
+			 * @param enabled Whether remote decoding is enabled
+			 */
+			void SetRemoteDecodingEnabled(bool enabled);
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Asynchronous Commands
+			 * These methods return immediately and perform the command on a serial queue, so the caller is never blocked
+			 * waiting for the decoding or rendering threads.  Commands are performed in the order they are issued.
+			 * Completion blocks are invoked on the command queue once the command has taken effect.
+			 */
+			//@{
+
+			/*!
+			 * @brief Seek to the specified frame in the active \c Decoder
+			 *
+			 * Seeks are coalesced: a seek that hasn't been performed when a later seek is issued is discarded,
+			 * and its completion block is invoked with \c false.  The completion block of a seek that is performed
+			 * is invoked once the decoder has seeked.
+			 * @param frame The desired frame
+			 * @param block An optional block to invoke when the seek has taken effect
+			 */
+			void SeekToFrameAsync(SInt64 frame, CommandCompletionBlock block = nullptr);
+
+			/*!
+			 * @brief Skip to the next enqueued decoder
+			 * @param block An optional block to invoke when the skip has taken effect
+			 */
+			void SkipToNextTrackAsync(CommandCompletionBlock block = nullptr);
+
+			/*!
+			 * @brief Stop playback
+			 * @param block An optional block to invoke when playback has stopped
+			 */
+			void StopAsync(CommandCompletionBlock block = nullptr);
+
+			/*!
+			 * @brief Clear all queued decoders
+			 * @note Asynchronous enqueues issued before this call are cancelled
+			 * @param block An optional block to invoke when the queue has been cleared
+			 */
+			void ClearQueuedDecodersAsync(CommandCompletionBlock block = nullptr);
+
+			/*!
+			 * @brief Enqueue a URL for playback without waiting for its decoder to be created
+			 *
+			 * Decoders are created and opened concurrently, a few at a time, and handed to the player on the command
+			 * queue in the order the URLs were enqueued, so a playlist may be enqueued from the main thread.
+			 * @param url The URL to enqueue
+			 * @param block An optional block to invoke when the decoder has been enqueued or the enqueue failed
+			 * @return A ticket identifying the enqueue, or \c 0 if \c url is \c nullptr
+			 */
+			EnqueueTicket EnqueueAsync(CFURLRef url, EnqueueCompletionBlock block = nullptr);
+
+			/*!
+			 * @brief Play a URL without waiting for its decoder to be created
+			 * @note Asynchronous enqueues issued before this call are cancelled, and the queue is cleared when the decoder is played
+			 * @param url The URL to play
+			 * @param block An optional block to invoke when playback of the decoder has started or the play failed
+			 * @return A ticket identifying the enqueue, or \c 0 if \c url is \c nullptr
+			 */
+			EnqueueTicket PlayAsync(CFURLRef url, EnqueueCompletionBlock block = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Crossfading
+			 * When enabled the end of each decoder is mixed with the beginning of the next on the decoding thread.
+			 * Only the pre-rolled decoder following the current one is crossfaded into, and only if it can be joined gaplessly.
+			 * @note Crossfading requires a 32-bit floating point PCM output format and a decoder with a known length
+			 */
+			//@{
+
+			/*! @brief The shapes of the gain curves applied while crossfading */
+			enum class CrossfadeCurve {
+				Linear,			/*!< Gains change linearly; the sum of the gains is constant */
+				EqualPower		/*!< Gains follow a quarter sine and cosine; the sum of the powers is constant */
+			};
+
+			/*! @brief Get the duration of crossfades in seconds, or \c 0 if crossfading is disabled */
+			inline CFTimeInterval GetCrossfadeDuration() const		{ return mCrossfadeDuration.load(); }
+
+			/*!
+			 * @brief Set the duration of crossfades
+			 * @note The change takes effect at the next crossfade
+			 * @param duration The desired duration in seconds, or \c 0 to disable crossfading
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetCrossfadeDuration(CFTimeInterval duration);
+
+			/*! @brief Get the gain curve used while crossfading */
+			inline CrossfadeCurve GetCrossfadeCurve() const			{ return mCrossfadeCurve.load(); }
+
+			/*! @brief Set the gain curve used while crossfading */
+			inline void SetCrossfadeCurve(CrossfadeCurve curve)		{ mCrossfadeCurve.store(curve); }
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Replay gain
+			 * When enabled each decoder's audio is scaled by the gain in its replay gain metadata on the decoding thread,
+			 * so gain changes occur exactly at track boundaries regardless of the output.  An optional peak limiter keeps
+			 * the amplified audio below -1 dBFS.
+			 * @note Replay gain requires a 32-bit floating point PCM output format
+			 * @note Changes take effect when the next decoder starts decoding
+			 */
+			//@{
+
+			/*! @brief The replay gain values to apply */
+			enum class ReplayGainMode {
+				Disabled,		/*!< Replay gain is not applied */
+				Track,			/*!< The track gain is applied, or the album gain if the track gain is unavailable */
+				Album			/*!< The album gain is applied, or the track gain if the album gain is unavailable */
+			};
+
+			/*! @brief Get the replay gain values applied */
+			inline ReplayGainMode GetReplayGainMode() const			{ return mReplayGainMode.load(); }
+
+			/*! @brief Set the replay gain values applied */
+			inline void SetReplayGainMode(ReplayGainMode mode)		{ mReplayGainMode.store(mode); }
+
+			/*! @brief Get the gain in dB added to the replay gain of files with replay gain metadata */
+			inline float GetReplayGainPreamp() const				{ return mReplayGainPreamp.load(); }
+
+			/*! @brief Set the gain in dB added to the replay gain of files with replay gain metadata */
+			inline void SetReplayGainPreamp(float preamp)			{ mReplayGainPreamp.store(preamp); }
+
+			/*!
+			 * @brief Query whether the peak limiter is enabled
+			 *
+			 * When the limiter is disabled the gain is instead reduced so the file's replay gain peak doesn't clip
+			 */
+			inline bool IsPeakLimiterEnabled() const				{ return mPeakLimiterEnabled.load(); }
+
+			/*! @brief Enable or disable the peak limiter */
+			inline void SetPeakLimiterEnabled(bool enabled)			{ mPeakLimiterEnabled.store(enabled); }
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Voices
+			 * Voices are decoders mixed into the output in addition to the playlist, for example sound effects.
+			 * Each voice has a small ring buffer; all voices are decoded on one queue and mixed on the rendering thread.
+			 * @note Voices are mixed only when the output's format is non-interleaved 32-bit floating point PCM
+			 */
+			//@{
+
+			/*! @brief A unique identifier for a playing voice */
+			using VoiceID = uint64_t;
+
+			/*! @brief The maximum number of voices that may play simultaneously */
+			static const size_t kMaximumVoiceCount = 256;
+
+			/*!
+			 * @brief Start playing a \c Decoder as a voice
+			 *
+			 * The decoder is converted to the output's sample rate and channel count.  If the player is stopped output is started.
+			 * @note The player will take ownership of the decoder on success and may take ownership on failure
+			 * @param decoder The \c Decoder to play
+			 * @param gain The voice's linear gain
+			 * @param pan The voice's stereo position, from \c -1 (left) to \c 1 (right)
+			 * @param voiceID An optional \c VoiceID to receive the voice's identifier
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool PlayVoice(Decoder::unique_ptr& decoder, float gain = 1, float pan = 0, VoiceID *voiceID = nullptr);
+
+			/*!
+			 * @brief Stop a voice
+			 * @param voiceID The voice's identifier
+			 * @return \c true if the voice was playing, \c false otherwise
+			 */
+			bool StopVoice(VoiceID voiceID);
+
+			/*! @brief Stop all voices */
+			void StopAllVoices();
+
+			/*! @brief Determine whether a voice is playing */
+			bool IsVoicePlaying(VoiceID voiceID) const;
+
+			/*!
+			 * @brief Set a voice's linear gain
+			 * @param voiceID The voice's identifier
+			 * @param gain The desired gain
+			 * @return \c true if the voice was playing, \c false otherwise
+			 */
+			bool SetVoiceGain(VoiceID voiceID, float gain);
+
+			/*!
+			 * @brief Set a voice's stereo position
+			 * @note The position is ignored unless the output has two channels
+			 * @param voiceID The voice's identifier
+			 * @param pan The desired position, from \c -1 (left) to \c 1 (right)
+			 * @return \c true if the voice was playing, \c false otherwise
+			 */
+			bool SetVoicePan(VoiceID voiceID, float pan);
+
+			/*! @brief Get the number of voices playing */
+			inline size_t GetActiveVoiceCount() const		{ return mActiveVoiceCount.load(); }
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Metering
+			 * Levels are measured on the rendering thread as the audio is provided to the output
+			 * and may be polled from any thread without calling blocks on the rendering thread.
+			 */
+			//@{
+
+			/*! @brief Determine whether the output's levels are metered */
+			inline bool IsMeteringEnabled() const					{ return mMeteringEnabled.load(); }
+
+			/*! @brief Enable or disable metering of the output's levels */
+			void SetMeteringEnabled(bool enabled);
+
+			/*!
+			 * @brief Get the most recently measured output levels
+			 * @param levels A \c LevelMeter::Levels struct to receive the levels
+			 * @return \c true if levels are available, \c false otherwise
+			 */
+			inline bool GetMeterLevels(LevelMeter::Levels& levels) const	{ return mLevelMeter.GetLevels(levels); }
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Spectrum Analysis
+			 * The rendering thread copies the audio provided to the output into a ring buffer, and band magnitudes
+			 * are computed from it on a background thread.  The most recent spectrum may be polled from any thread,
+			 * so any number of visualizers share one analysis instead of each running an FFT in a render block.
+			 */
+			//@{
+
+			/*! @brief Determine whether the output's spectrum is analyzed */
+			inline bool IsSpectrumAnalysisEnabled() const			{ return mSpectrumAnalysisEnabled.load(); }
+
+			/*! @brief Enable or disable analysis of the output's spectrum */
+			void SetSpectrumAnalysisEnabled(bool enabled);
+
+			/*! @brief Get the number of spectra computed per second */
+			inline double GetSpectrumUpdateRate() const				{ return mSpectrumAnalyzer.GetUpdateRate(); }
+
+			/*!
+			 * @brief Set the number of spectra computed per second
+			 * @param updateRate The update rate in Hz, between 1 and 120
+			 * @return \c true on success, \c false otherwise
+			 */
+			inline bool SetSpectrumUpdateRate(double updateRate)	{ return mSpectrumAnalyzer.SetUpdateRate(updateRate); }
+
+			/*!
+			 * @brief Get the most recently computed spectrum of the output
+			 * @param spectrum A \c SpectrumAnalyzer::Spectrum struct to receive the spectrum
+			 * @return \c true if a spectrum is available, \c false otherwise
+			 */
+			inline bool GetSpectrum(SpectrumAnalyzer::Spectrum& spectrum) const	{ return mSpectrumAnalyzer.GetSpectrum(spectrum); }
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name DSP Effects
+			 * Effects placed on the decoding thread process audio before it enters the ring buffer, where their
+			 * cost can't cause an underrun.  Effects placed on the rendering thread are hosted by the output and
+			 * respond to parameter changes without the delay of the buffered audio.
+			 */
+			//@{
+
+			/*! @brief Possible effect placements */
+			enum class EffectPlacement {
+				DecodingThread,		/*!< The effect processes audio as it is decoded */
+				RenderingThread		/*!< The effect processes audio as it is rendered by a \c CoreAudioOutput */
+			};
+
+			/*!
+			 * @brief Add a DSP effect
+			 * @note Effects on the decoding thread process only 32-bit floating point non-interleaved audio
+			 * @param componentType The \c AudioComponent type, normally \c kAudioUnitType_Effect
+			 * @param subType The \c AudioComponent subtype
+			 * @param manufacturer The \c AudioComponent manufacturer
+			 * @param flags The \c AudioComponent flags
+			 * @param mask The \c AudioComponent mask
+			 * @param placement Where the effect processes audio
+			 * @param effectUnit An optional pointer to an \c AudioUnit to receive the effect
+			 * @return \c true on success, \c false otherwise
+			 * @see AudioComponentDescription
+			 */
+			bool AddEffect(OSType componentType, OSType subType, OSType manufacturer, UInt32 flags, UInt32 mask, EffectPlacement placement = EffectPlacement::DecodingThread, AudioUnit *effectUnit = nullptr);
+
+			/*!
+			 * @brief Remove the specified DSP effect
+			 * @param effectUnit The \c AudioUnit to remove
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool RemoveEffect(AudioUnit effectUnit);
+
+			/*! @brief Get the sum of the latencies of the effects on the decoding thread in seconds */
+			inline Float64 GetDecodingThreadEffectLatency() const			{ return mEffectChain.GetLatency(); }
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Playback Rate
+			 * The tempo is changed with the pitch preserved on the decoding thread, after decoding thread effects and
+			 * before audio enters the ring buffer, so rendering does no additional work.  The source frames
+			 * corresponding to the buffered audio are tracked so the playback position remains exact.  Unlike a
+			 * Varispeed or TimePitch effect on the rendering thread, the frame accounting is unaffected.
+			 */
+			//@{
+
+			/*! @brief Get the playback rate */
+			inline double GetPlaybackRate() const							{ return mTimeStretcher.GetRate(); }
+
+			/*!
+			 * @brief Set the playback rate
+			 * @note The new rate is heard once the audio already buffered is rendered
+			 * @note The rate applies only to 32-bit floating point non-interleaved output
+			 * @param rate The ratio of the source tempo to the output tempo, clamped to [TimeStretcher::MinimumRate, TimeStretcher::MaximumRate]
+			 */
+			void SetPlaybackRate(double rate);
+
 			//@}
 
 
@@ -424,6 +1001,42 @@ namespace SFB {
 			//@}
 
 
+			// ========================================
+			/*!
+			 * @name Fan-out Outputs
+			 * Fan-out outputs render the same audio as the player's output from a single decode.  Each reads the
+			 * player's ring buffer using its own cursor and resamples the audio to its device's clock with a
+			 * \c ClockBridge, which measures the drift between the devices' clocks so the outputs remain aligned.
+			 * @note Fan-out outputs must accept 32-bit floating point non-interleaved PCM with the channel count of the player's output.
+			 * Voices and rendering thread effects are heard only on the player's output.  A fan-out output that
+			 * stops rendering, for example when its device is removed, stalls decoding until it is removed.
+			 */
+			//@{
+
+			/*! @brief The maximum number of fan-out outputs */
+			static const size_t kMaximumFanOutOutputCount = RingBuffer::kMaximumAdditionalReaders;
+
+			/*!
+			 * @brief Add an output rendering the player's audio
+			 * @note The player takes ownership of the output on success
+			 * @param output The output, which is opened by the player
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool AddFanOutOutput(Output::unique_ptr& output);
+
+			/*!
+			 * @brief Remove a fan-out output
+			 * @param output The output to remove, which is closed and destroyed
+			 * @return \c true on success, \c false if \c output is not a fan-out output of this player
+			 */
+			bool RemoveFanOutOutput(const Output *output);
+
+			/*! @brief Get the number of fan-out outputs */
+			inline size_t GetFanOutOutputCount() const		{ return mFanOutOutputCount.load(); }
+
+			//@}
+
+
 			// ========================================
 			/*! @name Ring Buffer Parameters */
 			//@{
@@ -454,6 +1067,383 @@ namespace SFB {
 			 */
 			bool SetRingBufferWriteChunkSize(uint32_t chunkSize);
 
+
+			/*! @brief Query whether the ring buffer is automatically resized for each output format */
+			inline bool IsAdaptiveRingBufferSizingEnabled() const	{ return mAdaptiveRingBufferSizing; }
+
+			/*!
+			 * @brief Enable or disable adaptive ring buffer sizing
+			 * @note When enabled the ring buffer capacity and write chunk size are chosen to hold the target depth of audio,
+			 * scaled by the observed decoding time and constrained by the output's preferred buffer size.
+			 * Sizes are recalculated when the ring buffer is reallocated, which occurs at track boundaries that aren't gapless.
+			 * @param enabled Whether adaptive sizing should be used
+			 */
+			void SetAdaptiveRingBufferSizingEnabled(bool enabled);
+
+			/*! @brief Get the duration, in seconds, of audio the ring buffer should hold when adaptive sizing is enabled */
+			inline CFTimeInterval GetRingBufferTargetDepth() const	{ return mRingBufferTargetDepth; }
+
+			/*!
+			 * @brief Set the duration of audio the ring buffer should hold when adaptive sizing is enabled
+			 * @param targetDepth The desired depth in seconds
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetRingBufferTargetDepth(CFTimeInterval targetDepth);
+
+
+			/*! @brief Query whether the ring buffer stores audio in a compact representation when possible */
+			inline bool IsCompactRingBufferStorageEnabled() const	{ return mCompactRingBufferStorage; }
+
+			/*!
+			 * @brief Enable or disable compact ring buffer storage
+			 * @note When enabled, 32-bit float output decoded from integer audio of up to 16 or 24 bits is held in the
+			 * ring buffer as 16- or 24-bit integers, halving or quartering its memory.  Audio is stored exactly unless it is
+			 * resampled or has gain applied, in which case it is rounded to the source's precision.  Tracks of greater
+			 * precision than the ring buffer's storage aren't joined gaplessly.  The setting takes effect when the ring buffer
+			 * is next allocated.
+			 * @param enabled Whether compact storage should be used
+			 */
+			void SetCompactRingBufferStorageEnabled(bool enabled);
+
+
+			/*! @brief Determine whether the output's I/O buffer is enlarged automatically when underruns occur */
+			inline bool IsAutomaticOutputBufferSizingEnabled() const	{ return mAutomaticOutputBufferSizing; }
+
+			/*!
+			 * @brief Enable or disable automatic output I/O buffer sizing
+			 * @note When enabled an underrun while decoding doubles the output's I/O buffer size, at most once per second
+			 * and up to the maximum the output supports. The ring buffer write chunk size and capacity are increased to match.
+			 * Request the initial buffer size from the output, for example using \c Output::SetTargetLatency().
+			 * @param enabled Whether automatic sizing should be used
+			 */
+			void SetAutomaticOutputBufferSizingEnabled(bool enabled);
+
+
+			/*! @brief Get the duration, in seconds, of input received asynchronously that is buffered before playback starts */
+			inline CFTimeInterval GetPrebufferTime() const			{ return mPrebufferTime; }
+
+			/*!
+			 * @brief Set the duration of input received asynchronously that is buffered before playback starts
+			 * @note This affects inputs such as those read over HTTP, and the duration is estimated from the input's average bitrate.
+			 * Playback starts without waiting once all input has been received.
+			 * @param prebufferTime The desired duration in seconds, or \c 0 to start playback immediately
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetPrebufferTime(CFTimeInterval prebufferTime);
+
+
+			/*! @brief Get the duration, in seconds, of input received asynchronously that is read ahead of decoding */
+			inline CFTimeInterval GetInputReadAheadTime() const		{ return mInputReadAheadTime; }
+
+			/*!
+			 * @brief Set the duration of input received asynchronously that is read ahead of decoding
+			 * @note Input such as that read over HTTP is buffered before decoding, so minutes of read ahead need a small
+			 * fraction of the memory of an equally long ring buffer and playback continues through network interruptions
+			 * while the ring buffer stays short.  The duration is estimated from the input's average bitrate and takes effect
+			 * for decoders that begin decoding afterward.
+			 * @param readAheadTime The desired duration in seconds, or \c 0 for the input's default
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetInputReadAheadTime(CFTimeInterval readAheadTime);
+
+
+			/*! @brief Ring buffer sizing information */
+			struct RingBufferStatistics {
+				uint32_t		mCapacityFrames;		/*!< The requested ring buffer capacity in frames */
+				uint32_t		mWriteChunkSizeFrames;	/*!< The write chunk size in frames used by the current decoder */
+				CFTimeInterval	mTargetDepth;			/*!< The target depth in seconds for adaptive sizing */
+				double			mDecodeLoad;			/*!< The average ratio of decoding time to audio duration */
+				uint32_t		mOutputBufferFrameSize;	/*!< The output's I/O buffer size in frames, or 0 if unknown */
+				uint64_t		mOutputBufferAdjustmentCount;	/*!< The number of times the output's I/O buffer was enlarged following underruns */
+			};
+
+			/*! @brief Get the current ring buffer sizing information */
+			RingBufferStatistics GetRingBufferStatistics() const;
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Memory Footprint
+			 * The player enters low-memory mode when the system reports memory pressure and leaves it when pressure returns
+			 * to normal.  In low-memory mode a pre-rolled decoder and warmed-up queued decoders are closed, the next decoder
+			 * is neither pre-rolled nor warmed up, no standby ring buffer is allocated, and the ring buffer is reallocated at
+			 * a reduced capacity when the output format next changes.  \c InputSource low-memory mode is also enabled so
+			 * files requested with \c InputSource::LoadFilesInMemory are mapped instead of copied.
+			 * @note \c InputSource low-memory mode is process-wide
+			 */
+			//@{
+
+			/*! @brief Query whether the player is in low-memory mode */
+			inline bool IsLowMemoryModeEnabled() const		{ return mLowMemoryMode.load(); }
+
+			/*!
+			 * @brief Enter or leave low-memory mode
+			 * @note This may be used with notifications such as \c UIApplicationDidReceiveMemoryWarningNotification
+			 * @param enabled Whether low-memory mode is enabled
+			 */
+			void SetLowMemoryModeEnabled(bool enabled);
+
+			/*! @brief Memory held by the player */
+			struct MemoryStatistics {
+				size_t			mRingBufferBytes;			/*!< The size of the ring buffer in bytes */
+				size_t			mStandbyRingBufferBytes;	/*!< The size of the ring buffer allocated for the next format in bytes */
+				size_t			mLockedRingBufferBytes;		/*!< The number of bytes of ring buffer memory locked into physical memory */
+				size_t			mPrerollBufferBytes;		/*!< The size of the pre-rolled decoder's buffer in bytes */
+				size_t			mFileCacheBytes;			/*!< The number of bytes in the process-wide file cache */
+				bool			mHoldsPrerolledDecoder;		/*!< Whether an opened, pre-rolled decoder is held */
+				bool			mLowMemoryMode;				/*!< Whether the player is in low-memory mode */
+				uint64_t		mMemoryPressureEventCount;	/*!< The number of memory pressure notifications received */
+			};
+
+			/*! @brief Get information on the memory held by the player */
+			MemoryStatistics GetMemoryStatistics() const;
+
+
+			/*! @brief Query whether the memory read while rendering is locked into physical memory */
+			inline bool IsMemoryLockingEnabled() const		{ return mMemoryLocking.load(); }
+
+			/*!
+			 * @brief Enable or disable locking the memory read while rendering into physical memory
+			 * @note When enabled the ring buffers, voice ring buffers, and \c BufferList pool memory are locked using
+			 * \c mlock() and faulted in when allocated, so the rendering thread doesn't take page faults and the memory
+			 * isn't paged out or compressed under memory pressure.  A locked ring buffer large enough for the next
+			 * decoder's format is reused rather than reallocated.  The setting takes effect when the memory is next
+			 * allocated, and the locked ring buffer memory is reported by \c GetMemoryStatistics().
+			 * @note \c BufferList pool memory locking is process-wide
+			 * @param enabled Whether memory locking is enabled
+			 */
+			void SetMemoryLockingEnabled(bool enabled);
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Low-Power Playback
+			 * In low-power mode the ring buffer holds \c GetLowPowerBufferDuration() seconds of audio and the decoding thread
+			 * is woken only once the ring buffer has drained to a quarter of its capacity, when it decodes until the ring buffer
+			 * is full.  The output device's I/O buffer is set to its largest size and the decoding thread runs at
+			 * \c QOS_CLASS_BACKGROUND.  The ring buffer capacity takes effect when the output is next configured for a decoder.
+			 * @note Low-memory mode takes precedence over the low-power ring buffer capacity
+			 * @note Threads in a \c DecoderPool service several players, so they keep their QoS class
+			 */
+			//@{
+
+			/*! @brief Query whether the player is in low-power mode */
+			inline bool IsLowPowerModeEnabled() const		{ return mLowPowerMode.load(); }
+
+			/*!
+			 * @brief Enter or leave low-power mode
+			 * @note Leaving low-power mode restores the output's previous I/O buffer size
+			 * @param enabled Whether low-power mode is enabled
+			 */
+			void SetLowPowerModeEnabled(bool enabled);
+
+			/*! @brief Get the duration of audio in seconds the ring buffer holds in low-power mode */
+			inline CFTimeInterval GetLowPowerBufferDuration() const	{ return mLowPowerBufferDuration.load(); }
+
+			/*!
+			 * @brief Set the duration of audio the ring buffer holds in low-power mode
+			 * @note The default is 20 seconds
+			 * @param duration The desired duration in seconds
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetLowPowerBufferDuration(CFTimeInterval duration);
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Automatic Output Suspension
+			 * When automatic output suspension is enabled and the player renders \c GetOutputSuspensionDelay() seconds of
+			 * continuous silence because it is muted or the ring buffer is empty, for example while input stalls, the output
+			 * is stopped so the device can sleep.  The player remains playing while its output is suspended.  Output is
+			 * resumed when half the ring buffer has been refilled, when decoding finishes or when \c Play() is called, and
+			 * a short run of silence is rendered while the device restarts so the audio isn't clipped.
+			 * @note Output is always stopped when paused and when playback finishes
+			 * @note Playing voices keep output running
+			 */
+			//@{
+
+			/*! @brief Query whether output is suspended automatically during silence */
+			inline bool IsAutomaticOutputSuspensionEnabled() const		{ return mAutomaticOutputSuspension.load(); }
+
+			/*!
+			 * @brief Enable or disable automatic output suspension
+			 * @note Disabling automatic output suspension resumes suspended output
+			 * @param enabled Whether output should be suspended automatically
+			 */
+			void SetAutomaticOutputSuspensionEnabled(bool enabled);
+
+			/*! @brief Get the duration of silence in seconds after which output is suspended */
+			inline CFTimeInterval GetOutputSuspensionDelay() const		{ return mOutputSuspensionDelay.load(); }
+
+			/*!
+			 * @brief Set the duration of silence after which output is suspended
+			 * @note The default is 5 seconds
+			 * @param delay The desired duration in seconds
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool SetOutputSuspensionDelay(CFTimeInterval delay);
+
+			/*! @brief Query whether output is currently suspended */
+			inline bool IsOutputSuspended() const						{ return mOutputSuspended.load(); }
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Decoding Thread Scheduling
+			 * When the output renders in real time the player's decoding thread uses a time-constraint policy with a period
+			 * equal to the duration of one ring buffer write chunk, and joins the workgroup of the output's I/O thread
+			 * when available.  For offline outputs the decoding thread instead uses a configurable QoS class.
+			 * @note Threads in a \c DecoderPool service players using different outputs, so they keep their QoS class
+			 * and don't join workgroups.
+			 */
+			//@{
+
+			/*! @brief Get the QoS class used by the decoding thread when the output doesn't render in real time */
+			inline qos_class_t GetOfflineDecodingQoSClass() const	{ return mOfflineDecodingQoSClass.load(); }
+
+			/*! @brief Set the QoS class used by the decoding thread when the output doesn't render in real time */
+			void SetOfflineDecodingQoSClass(qos_class_t qosClass);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Diagnostics */
+			//@{
+
+			/*!
+			 * @brief Get the number of spurious wakeups that have occurred in threads waiting on player events
+			 * @note A wakeup is spurious if the condition being waited on was not satisfied when the waiting thread woke
+			 * @return The number of spurious wakeups since the player was created
+			 */
+			inline uint64_t GetSpuriousWakeupCount() const	{ return mSpuriousWakeupCount.load(); }
+
+			/*! @brief Get the total number of frames of silence output because the ring buffer contained insufficient audio */
+			inline uint64_t GetRenderUnderrunFrameCount() const	{ return mRenderUnderrunFrames.load(); }
+
+			/*! @brief Get the total time, in nanoseconds, spent in blocks called from the rendering thread */
+			uint64_t GetRenderUserBlockTime() const;
+
+			/*! @brief Get the number of diagnostic events discarded because the rendering thread's event queue was full */
+			inline uint64_t GetDroppedRenderEventCount() const	{ return mDroppedRenderEventCount.load(); }
+
+			/*!
+			 * @brief Get the output's render cycle timing information
+			 * @note Render profiling must be enabled on the output with \c Output::SetRenderProfilingEnabled()
+			 */
+			inline Output::RenderProfile GetRenderProfile() const	{ return mOutput->GetRenderProfile(); }
+
+			/*! @brief Get the number of finished decoders waiting for readers to exit before they are freed */
+			inline size_t GetPendingReclamationCount() const	{ return mPendingReclamationCount.load(); }
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Playback Statistics
+			 * Statistics are updated without locking by the decoding and rendering threads and may be read from any thread.
+			 * Because the values are read individually a snapshot may combine values from adjacent render cycles.
+			 */
+			//@{
+
+			/*! @brief The number of buckets in \c PlaybackStatistics::mDecodeTimeHistogram */
+			static const size_t kDecodeTimeHistogramBucketCount = 8;
+
+			/*! @brief Playback timing information */
+			struct PlaybackStatistics {
+				uint64_t		mRenderCycleCount;			/*!< The number of render cycles that read from the ring buffer */
+				uint32_t		mMinimumRingBufferFill;		/*!< The fewest frames in the ring buffer at the start of a render cycle */
+				double			mAverageRingBufferFill;		/*!< The average number of frames in the ring buffer at the start of a render cycle */
+				uint64_t		mUnderrunCount;				/*!< The number of render cycles completed with silence because the ring buffer contained insufficient audio */
+				uint64_t		mUnderrunFrameCount;		/*!< The number of frames of silence rendered because of underruns */
+
+				uint64_t		mDecodeChunkCount;			/*!< The number of chunks decoded into the ring buffer */
+				CFTimeInterval	mAverageDecodeChunkTime;	/*!< The average time taken to decode a chunk */
+				CFTimeInterval	mMaximumDecodeChunkTime;	/*!< The longest time taken to decode a chunk */
+
+				/*! Decoded chunk counts by duration; bucket \c i counts chunks decoded in less than <tt>250 << i</tt> µs and the last bucket the remainder */
+				uint64_t		mDecodeTimeHistogram [kDecodeTimeHistogramBucketCount];
+
+				CFTimeInterval	mConverterTime;				/*!< The total time spent converting decoded audio to the output format, excluding decoding */
+
+				uint64_t		mDecoderOpenCount;			/*!< The number of decoders opened by the player */
+				CFTimeInterval	mAverageDecoderOpenTime;	/*!< The average time taken to open a decoder */
+				CFTimeInterval	mMaximumDecoderOpenTime;	/*!< The longest time taken to open a decoder */
+
+				CFTimeInterval	mStartupLatency;			/*!< The time from the most recent enqueue on an idle player until rendering started, or \c -1 if unknown */
+
+				uint64_t		mDecoderWakeupCount;		/*!< The number of times the decoding thread was woken */
+				double			mDecoderWakeupsPerMinute;	/*!< The average number of decoding thread wakeups per minute */
+
+				uint64_t		mOutputSuspensionCount;		/*!< The number of times output was suspended automatically during silence */
+
+				/*! @name Allocations
+				 * Allocations are counted only while \c SFB::AllocationTracker is installed */
+				//@{
+				uint64_t		mRenderAllocationCount;			/*!< The number of heap allocations made while rendering, each of which is logged as an error */
+				uint64_t		mDecodingAllocationCount;		/*!< The number of heap allocations made while servicing decoding */
+				uint64_t		mLastTrackAllocationCount;		/*!< The number of heap allocations made while decoding the most recently finished track */
+				//@}
+			};
+
+			/*! @brief Get the playback statistics collected since the player was created or the statistics were reset */
+			PlaybackStatistics GetPlaybackStatistics() const;
+
+			/*! @brief Discard the collected playback statistics */
+			void ResetPlaybackStatistics();
+
+			/*! @brief The resources used decoding one \c Decoder's audio */
+			struct DecoderStatistics {
+				Decoder::DecodingStatistics	mDecoding;				/*!< The resources used by the decoder */
+				CFTimeInterval				mConversionCPUTime;		/*!< The thread CPU time spent converting the decoder's audio to the output format */
+				CFTimeInterval				mConversionWallTime;	/*!< The elapsed time spent converting the decoder's audio to the output format */
+				CFTimeInterval				mDuration;				/*!< The duration of the audio decoded */
+				double						mRealTimeFactor;		/*!< The CPU time spent decoding and converting divided by \c mDuration, or \c 0 if unknown */
+			};
+
+			/*!
+			 * @brief Get the resources used decoding a \c Decoder's audio
+			 * @note This method is real-time safe and may be called from the decoder event blocks, including the rendering finished block
+			 * @param decoder The decoder
+			 * @param statistics Receives the statistics
+			 * @return \c true on success, \c false if \c decoder isn't enqueued, decoding or rendering
+			 */
+			bool GetDecoderStatistics(const Decoder& decoder, DecoderStatistics& statistics) const;
+
+			//@}
+
+
+			// ========================================
+			/*!
+			 * @name Render Tracing
+			 * A render trace records the timing of each output callback and decoded chunk so underruns may be
+			 * diagnosed, and so the callback schedule may be replayed by a \c TraceReplayOutput
+			 */
+			//@{
+
+			/*!
+			 * @brief Begin recording a render trace
+			 * @param url The URL of the trace file, which is replaced
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool StartRenderTrace(CFURLRef url, CFErrorRef *error = nullptr);
+
+			/*! @brief Stop recording a render trace */
+			void StopRenderTrace();
+
+			/*! @brief Query whether a render trace is being recorded */
+			inline bool IsRecordingRenderTrace() const			{ return mRenderTrace.IsRecording(); }
+
 			//@}
 
 
@@ -462,63 +1452,391 @@ namespace SFB {
 			/*! @internal This class is exposed so it can be used inside C callbacks */
 			class DecoderStateData;
 
+			/*! @internal A voice slot */
+			class VoiceData;
+
 			/*!
 			 * @internal
 			 * @brief Copy decoded audio into the specified buffer
 			 * @param bufferList A buffer to receive the decoded audio
 			 * @param frameCount The requested number of audio frames
+			 * @param timeStamp The output time of the first frame in \c bufferList, or \c nullptr if unknown
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool ProvideAudio(AudioBufferList *bufferList, UInt32 frameCount, const AudioTimeStamp *timeStamp = nullptr);
+
+			/*!
+			 * @internal
+			 * @brief Get the number of decoded frames ready to be provided to the output
+			 * @note This should only be called from the rendering thread
+			 */
+			inline size_t GetFramesAvailableToRender() const	{ return mRingBuffer->GetFramesAvailableToRead(); }
+
+			/*!
+			 * @internal
+			 * @brief Copy decoded audio into the specified buffer for a fan-out output
+			 * @param index The output's fan-out slot
+			 * @param bufferList A buffer to receive the decoded audio
+			 * @param frameCount The requested number of audio frames
+			 * @param timeStamp The output time of the first frame in \c bufferList, or \c nullptr if unknown
 			 * @return \c true on success, \c false otherwise
 			 */
-			bool ProvideAudio(AudioBufferList *bufferList, UInt32 frameCount);
+			bool ProvideFanOutAudio(size_t index, AudioBufferList *bufferList, UInt32 frameCount, const AudioTimeStamp *timeStamp = nullptr);
 
 			/*! @endcond */
 
 		private:
 
+			friend class DecoderPool;
+
+			// Decoder states may only be accessed by a thread holding a DecoderStateEpochGuard
+			class DecoderStateEpochGuard;
+
+			// A fan-out output and its resampler
+			class FanOutData;
+
+			// The result of performing one unit of decoding work
+			enum class DecodingStatus {
+				Idle,			// Nothing to do until woken
+				NeedsSpace,		// Waiting for the rendering thread to consume audio
+				InputStalled,	// Waiting for the decoder's input to be received
+				Continue		// More work is immediately available
+			};
+
+			Player(DecoderPool *decoderPool, size_t activeDecoderCapacity);
+
 			// ========================================
 			// Thread entry point
 			void * DecoderThreadEntry();
 
+			// The decoding thread's scheduling state
+			class DecoderThreadScheduling;
+			void UpdateDecoderThreadScheduling(DecoderThreadScheduling& scheduling);
+
+			// ========================================
+			// Decoding
+			DecodingStatus ServiceDecoding();
+			DecodingStatus BeginDecoding();
+			DecodingStatus ContinueDecoding();
+			void EndDecoding();
+
+			bool WaitForPrebuffering(DecoderStateData& decoderState);
+			void RefineTotalFrames(DecoderStateData& decoderState, SInt64 totalFrames);
+			bool ParkIfInputWouldBlock(DecoderStateData& decoderState, UInt32 writeChunkSize);
+
+			bool BeginCrossfade(SInt64 framesRemaining);
+			void MixCrossfade(const RingBuffer::BufferPair& writeVector, UInt32 frameCount);
+			void CompleteCrossfade();
+			void CancelCrossfade();
+
+			bool WriteTimeStretcherOutput();
+			bool EnqueueRateSegment(UInt32 frameCount, UInt32 sourceFrameCount);
+			UInt32 ConvertRenderedFramesToSourceFrames(UInt32 frameCount);
+			void ResetTimeStretch();
+
+			void CreateRequestedStateSnapshot();
+			void GetDecoderStatistics(const DecoderStateData& decoderState, DecoderStatistics& statistics) const;
+
+			bool IsDecodingWorkPending() const;
+			CFTimeInterval GetDecodingDeadline() const;
+
+			void WakeDecoder();
+
 			// ========================================
 			// Other Utilities
 			void StopActiveDecoders();
 
+			bool HasCurrentDecoderState() const;
+			DecoderStateData * GetDecoderStateWithTimeStamp(SInt64 timeStamp) const;
 			DecoderStateData * GetCurrentDecoderState() const;
 			DecoderStateData * GetDecoderStateStartingAfterTimeStamp(SInt64 timeStamp) const;
 
-			bool SetupOutputAndRingBufferForDecoder(Decoder& decoder);
+			void AdvanceTimelineHead(SInt64 expected, SInt64 timeStamp) const;
+			bool AppendDecoderStateToTimeline(DecoderStateData *decoderState);
+
+			void RequestDecoderStateCollection();
+			void CollectDecoderStates();
+
+			void AdaptRingBufferSizeToOutput();
+			void EnlargeOutputBufferFollowingUnderrun();
+			void UpdateQueuedDecoderCount();
+			bool ClearQueuedDecoders(std::vector<Decoder::unique_ptr>& decoders, bool returnDecodersInFlight);
+			void ReturnCancelledDecoder(Decoder::unique_ptr& decoder);
+			void PrerollNextDecoder();
+			void WarmUpQueuedDecoders();
+
+			Decoder::unique_ptr CreateDecoderForURL(CFURLRef url, CFErrorRef *error = nullptr) const;
+			bool OpenDecoder(Decoder& decoder, CFErrorRef *error = nullptr);
+			bool SetupOutputAndRingBufferForDecoder(Decoder& decoder, bool useStandbyRingBuffer = false);
+			void PrepareStandbyRingBuffer(const Decoder& decoder);
+
+			// Fan-out outputs are suspended while the ring buffer is reallocated, which happens on mQueue
+			void SuspendFanOutOutputs();
+			void SetupFanOutOutputsForDecoder(const Decoder& decoder);
+			void StartFanOutOutputs();
+			void StopFanOutOutputs(bool requestStop = false);
+			size_t GetRingBufferAllocationCapacity(size_t capacity, Float64 sampleRate) const;
+			RingBuffer::StorageFormat GetRingBufferStorageFormat(const Decoder& decoder) const;
+			void UpdateRingBufferFootprint();
+			void ApplyLowMemoryMode(bool enabled);
+			void ApplyLowPowerOutputBufferSize();
+			void SuspendOutputIfSilent();
+			void ResumeSuspendedOutput();
+
+			void WaitForRenderingThreadToClearFlag(unsigned int flag);
+			void CompletePendingSeek(bool success);
+			EnqueueTicket EnqueueURLAsync(CFURLRef url, bool play, EnqueueCompletionBlock block);
+			bool IsScrubFillLimitReached(UInt32 writeChunkSize) const;
+
+			bool RenderScheduledAudio(AudioBufferList *bufferList, UInt32 frameCount, const AudioTimeStamp *timeStamp);
+			bool RenderAudio(AudioBufferList *bufferList, UInt32 frameCount);
+			SInt64 GetScheduledStartOffset(const AudioTimeStamp *timeStamp) const;
+
+			void PostRenderEvent(uint32_t eventType, UInt32 framesRequested, UInt32 framesRendered, uint64_t userBlockTime);
+			void PublishPlaybackSnapshot(UInt32 frameCount, const AudioTimeStamp *timeStamp);
+			void UpdateOutputLatency();
+			void ProcessRenderEvents();
+
+			VoiceData * GetPlayingVoice(VoiceID voiceID) const;
+			void RequestVoiceStop(VoiceData& voice);
+			void StopVoices();
+			void MixVoices(AudioBufferList *bufferList, UInt32 frameCount);
+			void ServiceVoices();
+			void StopOutputIfIdle();
 
 			// ========================================
 			// Data Members
 			RingBuffer::unique_ptr					mRingBuffer;
+			RingBuffer::unique_ptr					mStandbyRingBuffer;		// Allocated for the next format while the current one plays; decoding thread only
 			std::atomic_uint						mRingBufferCapacity;
 			std::atomic_uint						mRingBufferWriteChunkSize;
+			std::atomic_uint						mActiveRingBufferWriteChunkSize;
+			std::atomic_bool						mAdaptiveRingBufferSizing;
+			std::atomic_bool						mCompactRingBufferStorage;
+			std::atomic<CFTimeInterval>				mRingBufferTargetDepth;
+			std::atomic<double>						mDecodeLoad;
+			std::atomic<CFTimeInterval>				mPrebufferTime;
+			std::atomic<CFTimeInterval>				mInputReadAheadTime;
+
+			std::atomic<CFTimeInterval>				mCrossfadeDuration;
+			std::atomic<CrossfadeCurve>				mCrossfadeCurve;
+
+			std::atomic<ReplayGainMode>				mReplayGainMode;
+			std::atomic<float>						mReplayGainPreamp;
+			std::atomic_bool						mPeakLimiterEnabled;
+
+			std::atomic_bool						mAutomaticOutputBufferSizing;
+			std::atomic_ullong						mOutputBufferAdjustmentCount;
+			uint64_t								mLastOutputBufferAdjustmentTime;	// Host time; accessed only on mQueue
 
 			std::atomic_uint						mFlags;
 
-			std::vector<Decoder::unique_ptr>		mDecoderQueue;
-			std::atomic<DecoderStateData *>			mActiveDecoders [kActiveDecoderArraySize];
+			std::deque<Decoder::unique_ptr>			mDecoderQueue;
+			std::atomic_size_t						mQueuedDecoderCount;
+
+			// The next decoder, opened and pre-rolled on mPrerollQueue (protected by mQueue)
+			dispatch_queue_t						mPrerollQueue;
+			DecoderStateData						*mPrerolledDecoderState;
+			bool									mPrerollInProgress;
+			uint64_t								mPrerollGeneration;
+
+			// Decoders being pre-rolled or warmed up when the queue was cleared, handed back when their open completes (protected by mQueue)
+			std::vector<Decoder::unique_ptr>		mCancelledDecoders;
+			size_t									mCancelledDecoderCount;				// Cancelled decoders still being opened
+			size_t									mCancelledDecoderCollectorCount;	// Callers waiting for them
+			dispatch_semaphore_t					mCancelledDecodersReturned;			// Signaled when the last is handed back to a waiting caller
+
+			// Queued decoders opened on mWarmUpQueue; a decoder being opened is replaced by nullptr in mDecoderQueue
+			dispatch_queue_t						mWarmUpQueue;
+			std::atomic_size_t						mQueueWarmUpCount;
+			std::atomic_bool						mRemoteDecoding;
+
+			// Active decoder states ordered by time stamp, stored at mActiveDecoders[timeStamp & (mActiveDecoderCapacity - 1)]
+			std::unique_ptr<std::atomic<DecoderStateData *> []>	mActiveDecoders;
+			size_t									mActiveDecoderCapacity;
+			mutable std::atomic_llong				mTimelineHead;
+			std::atomic_llong						mTimelineTail;
 
 			dispatch_queue_t						mQueue;
 			Semaphore								mSemaphore;
 
-			std::thread								mDecoderThread;
-			Semaphore								mDecoderSemaphore;
+			// Asynchronous commands
+			dispatch_queue_t						mCommandQueue;
+			std::atomic_ullong						mSeekCommandGeneration;		// Incremented for each asynchronous seek
+			std::atomic_bool						mSeekCompletionPending;		// Set while mPendingSeekCompletion awaits the decoding thread
+			CommandCompletionBlock					mPendingSeekCompletion;		// Only accessed on mCommandQueue
+
+			// State snapshots
+			std::mutex								mStateSnapshotMutex;		// Serializes requests
+			std::atomic_bool						mStateSnapshotRequested;	// Set while a request awaits the decoding thread
+			dispatch_semaphore_t					mStateSnapshotCreated;		// Signaled when the decoding thread handles a request
+			CFDataRef								mStateSnapshot;				// Written by the decoding thread before signaling
+
+			// Asynchronous enqueues
+			dispatch_queue_t						mDecoderCreationQueue;		// Submits creations, waiting on mDecoderCreationSemaphore
+			dispatch_semaphore_t					mDecoderCreationSemaphore;	// Bounds the number of concurrent creations
+			dispatch_group_t						mDecoderCreationGroup;
+			std::atomic_ullong						mNextEnqueueTicket;
+			std::atomic_ullong						mEnqueueGeneration;			// Incremented to cancel asynchronous enqueues
+
+			// Scrubbing
+			std::atomic_bool						mScrubbing;
+			std::atomic_llong						mScrubFrame;				// The frame most recently requested while scrubbing, or -1
+			std::atomic_ullong						mSpuriousWakeupCount;
+
+			std::atomic<qos_class_t>				mOfflineDecodingQoSClass;
+			std::atomic_uint						mDecoderSchedulingGeneration;	// Incremented when the decoding thread's scheduling should be recomputed
+
+			SFB::RingBuffer::unique_ptr				mRenderEventQueue;
+			dispatch_source_t						mRenderEventSource;
+			std::atomic_ullong						mRenderUnderrunFrames;
+			std::atomic_ullong						mRenderUserBlockTime;
+			std::atomic_ullong						mDroppedRenderEventCount;
+
+			// Memory pressure
+			dispatch_source_t						mMemoryPressureSource;
+			std::atomic_bool						mLowMemoryMode;
+			std::atomic_ullong						mMemoryPressureEventCount;
+			std::atomic_size_t						mRingBufferBytes;
+			std::atomic_size_t						mStandbyRingBufferBytes;
+			std::atomic_size_t						mLockedRingBufferBytes;
+			std::atomic_bool						mMemoryLocking;
+
+			// Low-power playback
+			std::atomic_bool						mLowPowerMode;
+			std::atomic<CFTimeInterval>				mLowPowerBufferDuration;
+			UInt32									mNormalOutputBufferFrameSize;	// The I/O buffer size before low-power mode, or 0; accessed only on mQueue
+
+			// Automatic output suspension
+			std::atomic_bool						mAutomaticOutputSuspension;
+			std::atomic<CFTimeInterval>				mOutputSuspensionDelay;
+			std::atomic_bool						mOutputSuspended;
+			std::atomic_ullong						mOutputSuspensionCount;
+			std::atomic_ullong						mSilentFrameCount;				// Written by the rendering thread while output is running
+
+			// Playback statistics, updated with relaxed atomics
+			std::atomic_ullong						mRenderCycleCount;
+			std::atomic_ullong						mRingBufferFillSum;
+			std::atomic_uint						mMinimumRingBufferFill;
+			std::atomic_ullong						mUnderrunCount;
+			std::atomic_ullong						mUnderrunFrameCount;
+			std::atomic_ullong						mDecodeChunkCount;
+			std::atomic_ullong						mDecodeChunkTime;			// Host time
+			std::atomic_ullong						mMaximumDecodeChunkTime;	// Host time
+			std::atomic_ullong						mDecodeTimeHistogram [kDecodeTimeHistogramBucketCount];
+			std::atomic_ullong						mConverterTime;				// Host time
+			std::atomic_ullong						mDecoderOpenCount;
+			std::atomic_ullong						mDecoderOpenTime;			// Host time
+			std::atomic_ullong						mMaximumDecoderOpenTime;	// Host time
+			std::atomic_ullong						mStartupHostTime;			// The host time of an enqueue on an idle player, or 0
+			std::atomic_llong						mStartupLatency;			// Host time, or -1
+			AllocationTracker::Counter				mRenderAllocations;
+			AllocationTracker::Counter				mDecodingAllocations;
+			std::atomic_ullong						mLastTrackAllocationCount;
+			std::atomic_ullong						mDecoderWakeupCount;
+			std::atomic_ullong						mStatisticsStartHostTime;	// The host time the statistics were last reset
+
+			RenderTrace								mRenderTrace;				// Records rendering and decoding timing while enabled
+
+			// Playback snapshot published by the rendering thread, protected by a sequence lock
+			std::atomic_uint						mSnapshotSequence;			// Odd while the snapshot is being written
+			std::atomic_llong						mSnapshotCurrentFrame;
+			std::atomic_llong						mSnapshotTotalFrames;
+			std::atomic<Float64>					mSnapshotSampleRate;		// 0 if no decoder is active
+			std::atomic_ullong						mSnapshotHostTime;
+			std::atomic_ullong						mSnapshotAudibleHostTime;	// The host time at which mSnapshotCurrentFrame is audible
+			std::atomic<Float64>					mOutputLatency;				// Seconds from a render time stamp until audible
+			std::atomic<CFURLRef>					mSnapshotURL;
+			std::atomic<void *>						mSnapshotRepresentedObject;
 
+			std::thread								mDecoderThread;
+			Event									mDecoderEvent;		// Signaled by the rendering thread and WakeDecoder()
+
+			// Decoding may be performed by a pool instead of mDecoderThread
+			DecoderPool								*mDecoderPool;
+			std::atomic_bool						mDecoderPoolRunnable;
+			bool									mDecoderPoolServicing;
+
+			// State for the decoder being decoded, accessed only while decoding is serviced
+			DecoderStateData						*mDecodingState;
+			DecoderStateData						*mPendingDecoderState;
+			AudioConverterRef						mAudioConverter;
+			UInt32									mDecodingWriteChunkSize;
+
+			// The decoder being crossfaded into, accessed only while decoding is serviced
+			DecoderStateData						*mCrossfadeState;
+			AudioConverterRef						mCrossfadeConverter;
+			BufferList								mCrossfadeBufferList;
+			std::unique_ptr<float []>				mCrossfadeGains;
+			SInt64									mCrossfadeFrameCount;
+			SInt64									mCrossfadeFramesMixed;
+			uint64_t								mCrossfadeGeneration;
+
+			// Decoder states removed from the timeline and the epoch in which they were removed (protected by mQueue)
 			dispatch_source_t						mCollector;
+			std::vector<std::pair<DecoderStateData *, unsigned int>>	mRetiredDecoderStates;
+			mutable std::atomic_uint				mReclamationEpoch;
+			mutable std::atomic_uint				mEpochReaderCounts [2];
+			std::atomic_size_t						mPendingReclamationCount;
+
+			// The start time for PlayAtTime(), valid while eAudioPlayerFlagScheduledStartPending is set
+			std::atomic_ullong						mScheduledStartHostTime;
+			std::atomic<Float64>					mScheduledStartSampleTime;
 
 			std::atomic_llong						mFramesDecoded;
 			std::atomic_llong						mFramesRendered;
 
+			// Voice slots are decoded on mVoiceQueue, which the rendering thread signals via mVoiceSource
+			std::unique_ptr<VoiceData []>			mVoices;
+			std::atomic_size_t						mActiveVoiceCount;
+			std::atomic_ullong						mNextVoiceID;
+			dispatch_queue_t						mVoiceQueue;
+			dispatch_source_t						mVoiceSource;
+
+			// ========================================
+			// Metering
+			std::atomic_bool						mMeteringEnabled;
+			LevelMeter								mLevelMeter;
+			std::atomic_bool						mSpectrumAnalysisEnabled;
+			SpectrumAnalyzer						mSpectrumAnalyzer;
+
+			// Effects processed on the decoding thread
+			EffectChain								mEffectChain;
+
+			// ========================================
+			// Playback rate
+			// Each segment maps a run of stretched frames in the ring buffer to the source frames they were stretched from
+			// Frames not contained in a segment weren't stretched
+			struct RateSegment {
+				UInt64								mStartFrame;				// The index of the first frame among all frames written to the ring buffer
+				UInt32								mFrameCount;
+				UInt32								mSourceFrameCount;
+			};
+
+			TimeStretcher							mTimeStretcher;				// Used only by the decoding thread, except the rate
+			BufferList								mTimeStretchBufferList;		// Decoded audio awaiting stretching
+			SFB::RingBuffer::unique_ptr				mRateSegmentQueue;			// Written by the decoding thread and read by the rendering thread
+			UInt64									mRingBufferFramesWritten;	// Used only by the decoding thread
+			UInt64									mRingBufferFramesRead;		// Used only by the rendering thread
+			RateSegment								mRenderRateSegment;			// The segment being rendered, if mFrameCount is nonzero
+			UInt32									mRenderRateSegmentOffset;	// Frames of mRenderRateSegment rendered
+
 			Output::unique_ptr						mOutput;
 
+			// ========================================
+			// Fan-out outputs; the slots are modified only on mQueue
+			std::unique_ptr<FanOutData []>			mFanOutOutputs;
+			std::atomic_size_t						mFanOutOutputCount;
+			ClockBridge::RateEstimator				mOutputRateEstimator;	// The measured clock of mOutput's device
+
 			// ========================================
 			// Callbacks
-			DecoderEventBlock						mDecoderEventBlocks [4];
+			DecoderEventBlock						mDecoderEventBlocks [5];
 			DecoderErrorBlock						mDecoderErrorBlock;
 			RenderEventBlock						mRenderEventBlocks [2];
 			FormatMismatchBlock						mFormatMismatchBlock;
 			ErrorBlock								mErrorBlock;
+			AnalysisTapBlock						mAnalysisTapBlock;
 		};
 
 	}
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <mach/mach_time.h>
+
+#include "RenderTrace.h"
+#include "CFErrorUtilities.h"
+#include "CFWrapper.h"
+#include "Logger.h"
+
+// The number of events each thread may record before they are written
+#define EVENT_BUFFER_CAPACITY_EVENTS	8192
+
+// How often the buffers are written to the trace file while recording
+#define DRAIN_INTERVAL_NSEC				(100 * NSEC_PER_MSEC)
+
+// Trace files begin with 'SFBr' followed by the version
+#define RENDER_TRACE_FILE_MAGIC			0x53464272
+#define RENDER_TRACE_FILE_VERSION		1
+
+const CFStringRef SFB::Audio::RenderTrace::ErrorDomain = CFSTR("org.sbooth.AudioEngine.ErrorDomain.RenderTrace");
+
+namespace {
+
+	struct FileHeader {
+		uint32_t									mMagic;
+		uint32_t									mVersion;
+		SFB::Audio::RenderTrace::Configuration		mConfiguration;
+	};
+
+	static_assert(24 == sizeof(SFB::Audio::RenderTrace::Event), "Unexpected event size");
+
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::RenderTrace::RenderTrace()
+	: mRecording(false), mDroppedEventCount(0), mQueue(nullptr), mTimer(nullptr), mFile(nullptr)
+{
+	mQueue = dispatch_queue_create("org.sbooth.AudioEngine.RenderTrace", DISPATCH_QUEUE_SERIAL);
+}
+
+SFB::Audio::RenderTrace::~RenderTrace()
+{
+	Stop();
+
+	if(mQueue)
+		dispatch_release(mQueue);
+}
+
+#pragma mark Recording
+
+bool SFB::Audio::RenderTrace::Start(CFURLRef url, const Configuration& configuration, CFErrorRef *error)
+{
+	UInt8 buf [PATH_MAX];
+	if(nullptr == url || nullptr == mQueue || !CFURLGetFileSystemRepresentation(url, FALSE, buf, PATH_MAX)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return false;
+	}
+
+	Stop();
+
+	// The buffers are allocated once since a thread may still be recording an event from a previous trace
+	for(auto& buffer : mBuffers) {
+		if(0 == buffer.GetCapacityBytes() && !buffer.Allocate(EVENT_BUFFER_CAPACITY_EVENTS * sizeof(Event))) {
+			if(error)
+				*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, ENOMEM, nullptr);
+			return false;
+		}
+	}
+
+	__block bool result = true;
+	__block int errorCode = 0;
+	dispatch_sync(mQueue, ^{
+		// Discard events recorded after the previous trace stopped
+		for(auto& buffer : mBuffers)
+			buffer.ReadAdvance(buffer.GetBytesAvailableToRead());
+
+		mFile = fopen((const char *)buf, "w");
+		if(nullptr == mFile) {
+			errorCode = errno;
+			result = false;
+			return;
+		}
+
+		FileHeader header = { RENDER_TRACE_FILE_MAGIC, RENDER_TRACE_FILE_VERSION, configuration };
+		if(1 != fwrite(&header, sizeof(header), 1, mFile)) {
+			errorCode = errno;
+			fclose(mFile);
+			mFile = nullptr;
+			result = false;
+		}
+	});
+
+	if(!result) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errorCode, nullptr);
+		return false;
+	}
+
+	mTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, mQueue);
+	if(mTimer) {
+		dispatch_source_set_timer(mTimer, dispatch_time(DISPATCH_TIME_NOW, DRAIN_INTERVAL_NSEC), DRAIN_INTERVAL_NSEC, DRAIN_INTERVAL_NSEC / 10);
+		dispatch_source_set_event_handler(mTimer, ^{
+			Drain();
+		});
+		dispatch_resume(mTimer);
+	}
+
+	mDroppedEventCount.store(0, std::memory_order_relaxed);
+	mRecording.store(true);
+
+	return true;
+}
+
+void SFB::Audio::RenderTrace::Stop()
+{
+	if(nullptr == mQueue)
+		return;
+
+	mRecording.store(false);
+
+	if(mTimer) {
+		dispatch_source_cancel(mTimer);
+		dispatch_release(mTimer);
+		mTimer = nullptr;
+	}
+
+	dispatch_sync(mQueue, ^{
+		if(mFile) {
+			Drain();
+
+			if(0 != fclose(mFile))
+				LOGGER_ERR("org.sbooth.AudioEngine.RenderTrace", "Unable to close trace file: " << strerror(errno));
+			mFile = nullptr;
+
+			auto droppedEventCount = mDroppedEventCount.load(std::memory_order_relaxed);
+			if(0 < droppedEventCount)
+				LOGGER_NOTICE("org.sbooth.AudioEngine.RenderTrace", droppedEventCount << " events dropped");
+		}
+	});
+}
+
+void SFB::Audio::RenderTrace::Record(Thread thread, EventType type, uint64_t hostTime, uint32_t frameCount, size_t framesBuffered, uint64_t duration)
+{
+	if(!mRecording.load(std::memory_order_relaxed))
+		return;
+
+	static mach_timebase_info_data_t sTimebaseInfo = {};
+	if(0 == sTimebaseInfo.denom)
+		mach_timebase_info(&sTimebaseInfo);
+
+	auto nanoseconds = (duration * sTimebaseInfo.numer) / sTimebaseInfo.denom;
+
+	Event event = {
+		hostTime,
+		frameCount,
+		(uint32_t)std::min(framesBuffered, (size_t)UINT32_MAX),
+		(uint32_t)std::min(nanoseconds, (uint64_t)UINT32_MAX),
+		type,
+		thread
+	};
+
+	auto& buffer = mBuffers[(size_t)thread];
+	if(sizeof(event) > buffer.GetBytesAvailableToWrite()) {
+		mDroppedEventCount.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	buffer.Write(&event, sizeof(event));
+}
+
+void SFB::Audio::RenderTrace::Drain()
+{
+	if(nullptr == mFile)
+		return;
+
+	// Events may wrap around the end of a buffer so they are copied out in whole events
+	Event events [256];
+	for(auto& buffer : mBuffers) {
+		size_t eventCount;
+		while(0 < (eventCount = std::min(buffer.GetBytesAvailableToRead() / sizeof(Event), sizeof(events) / sizeof(Event)))) {
+			buffer.Read(events, eventCount * sizeof(Event));
+			if(eventCount != fwrite(events, sizeof(Event), eventCount, mFile)) {
+				LOGGER_ERR("org.sbooth.AudioEngine.RenderTrace", "Unable to write trace file: " << strerror(errno));
+				break;
+			}
+		}
+	}
+}
+
+#pragma mark Reading
+
+bool SFB::Audio::RenderTrace::ReadFromFile(CFURLRef url, Configuration& configuration, std::vector<Event>& events, CFErrorRef *error)
+{
+	UInt8 buf [PATH_MAX];
+	if(nullptr == url || !CFURLGetFileSystemRepresentation(url, FALSE, buf, PATH_MAX)) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, EINVAL, nullptr);
+		return false;
+	}
+
+	FILE *file = fopen((const char *)buf, "r");
+	if(nullptr == file) {
+		if(error)
+			*error = CFErrorCreate(kCFAllocatorDefault, kCFErrorDomainPOSIX, errno, nullptr);
+		return false;
+	}
+
+	FileHeader header;
+	if(1 != fread(&header, sizeof(header), 1, file) || RENDER_TRACE_FILE_MAGIC != header.mMagic || RENDER_TRACE_FILE_VERSION != header.mVersion || 0 == header.mConfiguration.mTimebaseDenominator) {
+		fclose(file);
+
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” is not a valid render trace."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Not a render trace"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The file may have been created by a different version or may be damaged."), ""));
+
+			*error = CreateErrorForURL(RenderTrace::ErrorDomain, RenderTrace::FileFormatNotRecognizedError, description, url, failureReason, recoverySuggestion);
+		}
+
+		return false;
+	}
+
+	configuration = header.mConfiguration;
+
+	events.clear();
+	Event event;
+	while(1 == fread(&event, sizeof(event), 1, file))
+		events.push_back(event);
+
+	fclose(file);
+
+	// Each thread's events are in order but the threads' buffers are written independently
+	std::stable_sort(events.begin(), events.end(), [](const Event& lhs, const Event& rhs) {
+		return lhs.mHostTime < rhs.mHostTime;
+	});
+
+	return true;
+}
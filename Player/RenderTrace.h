@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <vector>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <dispatch/dispatch.h>
+
+#include "RingBuffer.h"
+
+/*! @file RenderTrace.h @brief Capture of the timing of rendering and decoding */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A compact binary log of render cycles and decoding work
+		 *
+		 * Each thread records events without locking into its own buffer, which is periodically written to the
+		 * trace file on a background queue.  Events are dropped and counted if a buffer fills before it is
+		 * written.  Because the buffers are written independently events in a file are ordered by host time
+		 * only within each thread; \c ReadFromFile() merges them.
+		 *
+		 * A trace records the schedule of the output's callbacks so it may be replayed by a \c TraceReplayOutput,
+		 * allowing the effect of changes to the ring buffer and decoder scheduling on underruns to be
+		 * evaluated offline.
+		 */
+		class RenderTrace
+		{
+
+		public:
+
+			/*! @brief The \c CFErrorRef error domain used by \c RenderTrace */
+			static const CFStringRef ErrorDomain;
+
+			/*! @brief Possible \c CFErrorRef error codes used by \c RenderTrace */
+			enum ErrorCode {
+				FileFormatNotRecognizedError		= 0,	/*!< File format not recognized */
+			};
+
+			/*! @brief The threads recording events */
+			enum class Thread : uint16_t {
+				Rendering	= 0,	/*!< The output's real-time rendering thread */
+				Decoding	= 1,	/*!< The thread servicing decoding */
+			};
+
+			/*! @brief Event types */
+			enum class EventType : uint16_t {
+				Render			= 1,	/*!< An output callback: frames requested, frames buffered at its start, and its duration */
+				DecodeChunk		= 2,	/*!< A chunk decoded into the ring buffer: frames decoded, frames buffered after, and its duration */
+				DecoderWakeup	= 3,	/*!< The decoding thread woke: frames buffered when woken and the time it waited */
+			};
+
+			/*! @brief A recorded event */
+			struct Event {
+				uint64_t	mHostTime;			/*!< The host time the event started */
+				uint32_t	mFrameCount;		/*!< Frames requested or decoded */
+				uint32_t	mFramesBuffered;	/*!< Frames in the ring buffer */
+				uint32_t	mDuration;			/*!< The duration of the event in nanoseconds, saturated */
+				EventType	mType;				/*!< The type of event */
+				Thread		mThread;			/*!< The thread recording the event */
+			};
+
+			/*! @brief The player's configuration when recording began */
+			struct Configuration {
+				Float64		mSampleRate;				/*!< The output sample rate */
+				uint32_t	mRingBufferCapacity;		/*!< The ring buffer capacity in frames */
+				uint32_t	mRingBufferWriteChunkSize;	/*!< The ring buffer write chunk size in frames */
+				uint32_t	mOutputBufferFrameSize;		/*!< The output's preferred buffer size in frames */
+				uint32_t	mTimebaseNumerator;			/*!< The numerator converting host time to nanoseconds */
+				uint32_t	mTimebaseDenominator;		/*!< The denominator converting host time to nanoseconds */
+			};
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Create a new \c RenderTrace */
+			RenderTrace();
+
+			/*! @brief Destroy this \c RenderTrace, stopping recording */
+			~RenderTrace();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			RenderTrace(const RenderTrace& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			RenderTrace& operator=(const RenderTrace& rhs) = delete;
+
+			/*! @endcond */
+
+			//@}
+
+
+			// ========================================
+			/*! @name Recording */
+			//@{
+
+			/*!
+			 * @brief Begin recording to a file
+			 * @param url The URL of the trace file, which is replaced
+			 * @param configuration The player's configuration
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool Start(CFURLRef url, const Configuration& configuration, CFErrorRef *error = nullptr);
+
+			/*! @brief Stop recording, writing any buffered events and closing the file */
+			void Stop();
+
+			/*! @brief Query whether events are being recorded */
+			inline bool IsRecording() const					{ return mRecording.load(std::memory_order_relaxed); }
+
+			/*!
+			 * @brief Record an event
+			 * @note This method is real-time safe.  Each thread must be recorded from one thread at a time.
+			 * @param thread The thread recording the event
+			 * @param type The type of event
+			 * @param hostTime The host time the event started
+			 * @param frameCount Frames requested or decoded
+			 * @param framesBuffered Frames in the ring buffer
+			 * @param duration The duration of the event in host time
+			 */
+			void Record(Thread thread, EventType type, uint64_t hostTime, uint32_t frameCount, size_t framesBuffered, uint64_t duration);
+
+			/*! @brief Get the number of events dropped because a buffer was full */
+			inline uint64_t GetDroppedEventCount() const		{ return mDroppedEventCount.load(std::memory_order_relaxed); }
+
+			//@}
+
+
+			// ========================================
+			/*! @name Reading */
+			//@{
+
+			/*!
+			 * @brief Read a trace file
+			 * @param url The URL of the trace file
+			 * @param configuration Receives the player's configuration when recording began
+			 * @param events Receives the events ordered by host time
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			static bool ReadFromFile(CFURLRef url, Configuration& configuration, std::vector<Event>& events, CFErrorRef *error = nullptr);
+
+			//@}
+
+		private:
+
+			// Write buffered events to mFile; must be called on mQueue
+			void Drain();
+
+			RingBuffer					mBuffers [2];			// Events recorded by each thread
+			std::atomic_bool			mRecording;
+			std::atomic_ullong			mDroppedEventCount;
+
+			dispatch_queue_t			mQueue;					// Serializes writing
+			dispatch_source_t			mTimer;					// Drains the buffers while recording
+			FILE						*mFile;					// Accessed only on mQueue
+		};
+
+	}
+}
@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include <pthread.h>
+
+#include "AudioRecorder.h"
+#include "CFErrorUtilities.h"
+#include "CFWrapper.h"
+#include "Logger.h"
+
+// The number of frames written to the encoder at once, a multiple of the page size for common formats
+#define CHUNK_SIZE_FRAMES 32768
+// The default duration of audio the ring buffer holds
+#define DEFAULT_BUFFER_DURATION_SECONDS 2.0
+// The minimum duration of audio the ring buffer holds
+#define MINIMUM_BUFFER_DURATION_SECONDS 0.25
+// The maximum time the writing thread waits for a chunk before writing what is available
+#define WRITER_WAIT_NSEC (100 * NSEC_PER_MSEC)
+
+const CFStringRef SFB::Audio::Recorder::ErrorDomain = CFSTR("org.sbooth.AudioEngine.ErrorDomain.Recorder");
+
+namespace {
+
+	void CreateInputDeviceError(CFErrorRef *error, CFStringRef failureReason)
+	{
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The input device could not be opened."), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The device may be in use or disconnected."), ""));
+
+			*error = SFB::CreateError(SFB::Audio::Recorder::ErrorDomain, SFB::Audio::Recorder::InputDeviceError, description, failureReason, recoverySuggestion);
+		}
+	}
+
+}
+
+#pragma mark Factory Methods
+
+SFB::Audio::Recorder::unique_ptr SFB::Audio::Recorder::CreateForDevice(CFStringRef deviceUID, CFErrorRef *error)
+{
+	AudioObjectID deviceID = kAudioDeviceUnknown;
+
+	if(nullptr == deviceUID) {
+		AudioObjectPropertyAddress propertyAddress = {
+			.mSelector	= kAudioHardwarePropertyDefaultInputDevice,
+			.mScope		= kAudioObjectPropertyScopeGlobal,
+			.mElement	= kAudioObjectPropertyElementMaster
+		};
+
+		UInt32 specifierSize = sizeof(deviceID);
+
+		auto result = AudioObjectGetPropertyData(kAudioObjectSystemObject, &propertyAddress, 0, nullptr, &specifierSize, &deviceID);
+		if(kAudioHardwareNoError != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioObjectGetPropertyData (kAudioHardwarePropertyDefaultInputDevice) failed: " << result);
+	}
+	else {
+		AudioObjectPropertyAddress propertyAddress = {
+			.mSelector	= kAudioHardwarePropertyDeviceForUID,
+			.mScope		= kAudioObjectPropertyScopeGlobal,
+			.mElement	= kAudioObjectPropertyElementMaster
+		};
+
+		AudioValueTranslation translation = {
+			&deviceUID, sizeof(deviceUID),
+			&deviceID, sizeof(deviceID)
+		};
+
+		UInt32 specifierSize = sizeof(translation);
+
+		auto result = AudioObjectGetPropertyData(kAudioObjectSystemObject, &propertyAddress, 0, nullptr, &specifierSize, &translation);
+		if(kAudioHardwareNoError != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioObjectGetPropertyData (kAudioHardwarePropertyDeviceForUID) failed: " << result);
+	}
+
+	if(kAudioDeviceUnknown == deviceID) {
+		CreateInputDeviceError(error, SFB::CFString(CFCopyLocalizedString(CFSTR("The device was not found"), "")));
+		return nullptr;
+	}
+
+	unique_ptr recorder(new Recorder(AudioFormat()));
+	if(!recorder->OpenInputUnit(deviceID, error))
+		return nullptr;
+
+	return recorder;
+}
+
+SFB::Audio::Recorder::unique_ptr SFB::Audio::Recorder::CreateForFormat(const AudioFormat& format, CFErrorRef *error)
+{
+	if(!format.IsPCM() || 0 == format.mChannelsPerFrame || 0 >= format.mSampleRate) {
+		if(error) {
+			SFB::CFString description(CFCopyLocalizedString(CFSTR("The audio format is not supported."), ""));
+			SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Unsupported audio format"), ""));
+			SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("Only PCM audio may be recorded."), ""));
+
+			*error = SFB::CreateError(Recorder::ErrorDomain, Recorder::FormatNotSupportedError, description, failureReason, recoverySuggestion);
+		}
+
+		return nullptr;
+	}
+
+	return unique_ptr(new Recorder(format));
+}
+
+#pragma mark Creation and Destruction
+
+SFB::Audio::Recorder::Recorder(const AudioFormat& format)
+	: mFormat(format), mBufferDuration(DEFAULT_BUFFER_DURATION_SECONDS), mInputUnit(nullptr), mChunkFrames(CHUNK_SIZE_FRAMES), mIsRecording(false), mKeepWriting(false), mWriterWaiting(false), mWriteFailed(false), mFramesCaptured(0), mFramesDropped(0), mFramesWritten(0)
+{}
+
+SFB::Audio::Recorder::~Recorder()
+{
+	if(IsRecording())
+		Stop();
+
+	if(mInputUnit) {
+		auto result = AudioUnitUninitialize(mInputUnit);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioUnitUninitialize failed: " << result);
+
+		result = AudioComponentInstanceDispose(mInputUnit);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioComponentInstanceDispose failed: " << result);
+	}
+}
+
+#pragma mark Recording
+
+bool SFB::Audio::Recorder::Start(Encoder::unique_ptr encoder, CFErrorRef *error)
+{
+	if(IsRecording()) {
+		LOGGER_INFO("org.sbooth.AudioEngine.Recorder", "Start() called on a Recorder that is already recording");
+		return false;
+	}
+
+	if(!encoder)
+		return false;
+
+	if(!encoder->Open(mFormat, nullptr, error))
+		return false;
+
+	// The ring buffer holds several chunks so capture continues while a chunk is written
+	auto capacityFrames = std::max((size_t)std::ceil(mFormat.mSampleRate * mBufferDuration), (size_t)(4 * mChunkFrames));
+	if(!mRingBuffer.Allocate(mFormat, capacityFrames) || !mChunk.Allocate(mFormat, mChunkFrames)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "Unable to allocate buffers");
+		encoder->Close();
+		return false;
+	}
+
+	mEncoder = std::move(encoder);
+
+	mFramesCaptured.store(0);
+	mFramesDropped.store(0);
+	mFramesWritten.store(0);
+	mWriteFailed.store(false);
+
+	mKeepWriting.store(true);
+	mWriterThread = std::thread(&Recorder::WriterThreadEntry, this);
+
+	mIsRecording.store(true);
+
+	if(mInputUnit) {
+		auto result = AudioOutputUnitStart(mInputUnit);
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioOutputUnitStart failed: " << result);
+			Stop();
+			CreateInputDeviceError(error, SFB::CFString(CFCopyLocalizedString(CFSTR("The device could not be started"), "")));
+			return false;
+		}
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Recorder", "Recording " << mFormat << " to " << mEncoder->GetURL());
+
+	return true;
+}
+
+bool SFB::Audio::Recorder::Stop(CFErrorRef *error)
+{
+	if(!IsRecording())
+		return true;
+
+	if(mInputUnit) {
+		auto result = AudioOutputUnitStop(mInputUnit);
+		if(noErr != result)
+			LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioOutputUnitStop failed: " << result);
+	}
+
+	mIsRecording.store(false);
+
+	// The writing thread drains the ring buffer before exiting
+	mKeepWriting.store(false);
+	mSemaphore.Signal();
+	mWriterThread.join();
+
+	bool success = !mWriteFailed.load();
+	if(!success && error) {
+		SFB::CFString description(CFCopyLocalizedString(CFSTR("The file “%@” could not be written."), ""));
+		SFB::CFString failureReason(CFCopyLocalizedString(CFSTR("Input/output error"), ""));
+		SFB::CFString recoverySuggestion(CFCopyLocalizedString(CFSTR("The disk may be full or unavailable."), ""));
+
+		*error = SFB::CreateErrorForURL(Encoder::ErrorDomain, Encoder::InputOutputError, description, mEncoder->GetURL(), failureReason, recoverySuggestion);
+	}
+
+	if(!mEncoder->Close(success ? error : nullptr))
+		success = false;
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Recorder", "Recorded " << mFramesWritten.load() << " frames, " << mFramesDropped.load() << " dropped");
+
+	mEncoder.reset();
+	mRingBuffer.Deallocate();
+	mChunk.Deallocate();
+
+	return success;
+}
+
+void SFB::Audio::Recorder::SetBufferDuration(double bufferDuration)
+{
+	mBufferDuration = std::max(bufferDuration, MINIMUM_BUFFER_DURATION_SECONDS);
+}
+
+#pragma mark Capture
+
+bool SFB::Audio::Recorder::CaptureAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(!mIsRecording.load())
+		return false;
+
+	auto framesToWrite = (UInt32)std::min((size_t)frameCount, mRingBuffer.GetFramesAvailableToWrite());
+	if(framesToWrite)
+		mRingBuffer.WriteAudio(bufferList, framesToWrite);
+
+	mFramesCaptured.fetch_add(framesToWrite);
+	if(framesToWrite < frameCount)
+		mFramesDropped.fetch_add(frameCount - framesToWrite);
+
+	// Wake the writing thread only once a full chunk is available
+	if(mRingBuffer.GetFramesAvailableToRead() >= mChunkFrames && mWriterWaiting.exchange(false))
+		mSemaphore.Signal();
+
+	return framesToWrite == frameCount;
+}
+
+void SFB::Audio::Recorder::CaptureAudioCallback(void *context, const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	auto recorder = static_cast<Recorder *>(context);
+	if(recorder)
+		recorder->CaptureAudio(bufferList, frameCount);
+}
+
+#pragma mark Input Device
+
+bool SFB::Audio::Recorder::OpenInputUnit(AudioObjectID deviceID, CFErrorRef *error)
+{
+	AudioComponentDescription componentDescription = {
+		.componentType			= kAudioUnitType_Output,
+		.componentSubType		= kAudioUnitSubType_HALOutput,
+		.componentManufacturer	= kAudioUnitManufacturer_Apple,
+		.componentFlags			= 0,
+		.componentFlagsMask		= 0
+	};
+
+	auto component = AudioComponentFindNext(nullptr, &componentDescription);
+	if(nullptr == component) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "Unable to find the HAL output unit");
+		CreateInputDeviceError(error, SFB::CFString(CFCopyLocalizedString(CFSTR("The HAL output unit is unavailable"), "")));
+		return false;
+	}
+
+	auto result = AudioComponentInstanceNew(component, &mInputUnit);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioComponentInstanceNew failed: " << result);
+		mInputUnit = nullptr;
+		CreateInputDeviceError(error, SFB::CFString(CFCopyLocalizedString(CFSTR("The HAL output unit could not be created"), "")));
+		return false;
+	}
+
+	// Enable input on element 1 and disable output on element 0
+	UInt32 enableIO = 1;
+	result = AudioUnitSetProperty(mInputUnit, kAudioOutputUnitProperty_EnableIO, kAudioUnitScope_Input, 1, &enableIO, sizeof(enableIO));
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioUnitSetProperty (kAudioOutputUnitProperty_EnableIO) failed: " << result);
+		CreateInputDeviceError(error, SFB::CFString(CFCopyLocalizedString(CFSTR("Input could not be enabled"), "")));
+		return false;
+	}
+
+	enableIO = 0;
+	result = AudioUnitSetProperty(mInputUnit, kAudioOutputUnitProperty_EnableIO, kAudioUnitScope_Output, 0, &enableIO, sizeof(enableIO));
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioUnitSetProperty (kAudioOutputUnitProperty_EnableIO) failed: " << result);
+		CreateInputDeviceError(error, SFB::CFString(CFCopyLocalizedString(CFSTR("Output could not be disabled"), "")));
+		return false;
+	}
+
+	result = AudioUnitSetProperty(mInputUnit, kAudioOutputUnitProperty_CurrentDevice, kAudioUnitScope_Global, 0, &deviceID, sizeof(deviceID));
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioUnitSetProperty (kAudioOutputUnitProperty_CurrentDevice) failed: " << result);
+		CreateInputDeviceError(error, SFB::CFString(CFCopyLocalizedString(CFSTR("The device could not be selected"), "")));
+		return false;
+	}
+
+	// Capture the device's channels and sample rate as 32-bit float non-interleaved
+	AudioStreamBasicDescription deviceFormat;
+	UInt32 dataSize = sizeof(deviceFormat);
+	result = AudioUnitGetProperty(mInputUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 1, &deviceFormat, &dataSize);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioUnitGetProperty (kAudioUnitProperty_StreamFormat) failed: " << result);
+		CreateInputDeviceError(error, SFB::CFString(CFCopyLocalizedString(CFSTR("The device format is unavailable"), "")));
+		return false;
+	}
+
+	mFormat.mFormatID			= kAudioFormatLinearPCM;
+	mFormat.mFormatFlags		= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+
+	mFormat.mSampleRate			= deviceFormat.mSampleRate;
+	mFormat.mChannelsPerFrame	= deviceFormat.mChannelsPerFrame;
+	mFormat.mBitsPerChannel		= 32;
+
+	mFormat.mBytesPerPacket		= 4;
+	mFormat.mFramesPerPacket	= 1;
+	mFormat.mBytesPerFrame		= 4;
+
+	result = AudioUnitSetProperty(mInputUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 1, &mFormat, sizeof(AudioStreamBasicDescription));
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioUnitSetProperty (kAudioUnitProperty_StreamFormat) failed: " << result);
+		CreateInputDeviceError(error, SFB::CFString(CFCopyLocalizedString(CFSTR("The capture format is not supported by the device"), "")));
+		return false;
+	}
+
+	AURenderCallbackStruct callback = {
+		.inputProc			= InputProc,
+		.inputProcRefCon	= this
+	};
+
+	result = AudioUnitSetProperty(mInputUnit, kAudioOutputUnitProperty_SetInputCallback, kAudioUnitScope_Global, 0, &callback, sizeof(callback));
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioUnitSetProperty (kAudioOutputUnitProperty_SetInputCallback) failed: " << result);
+		CreateInputDeviceError(error, SFB::CFString(CFCopyLocalizedString(CFSTR("The input callback could not be set"), "")));
+		return false;
+	}
+
+	result = AudioUnitInitialize(mInputUnit);
+	if(noErr != result) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "AudioUnitInitialize failed: " << result);
+		CreateInputDeviceError(error, SFB::CFString(CFCopyLocalizedString(CFSTR("The HAL output unit could not be initialized"), "")));
+		return false;
+	}
+
+	// The buffer pointers are left null so the AU renders into its own buffers and nothing is copied
+	if(!mInputBufferList.Allocate(mFormat, 1)) {
+		LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "Unable to allocate memory");
+		return false;
+	}
+
+	LOGGER_INFO("org.sbooth.AudioEngine.Recorder", "Capturing input from device 0x" << std::hex << deviceID << std::dec << ": " << mFormat);
+
+	return true;
+}
+
+OSStatus SFB::Audio::Recorder::InputProc(void *inRefCon, AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *inTimeStamp, UInt32 inBusNumber, UInt32 inNumberFrames, AudioBufferList */*ioData*/)
+{
+	auto recorder = static_cast<Recorder *>(inRefCon);
+
+	AudioBufferList *bufferList = recorder->mInputBufferList;
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i) {
+		bufferList->mBuffers[i].mData = nullptr;
+		bufferList->mBuffers[i].mDataByteSize = 0;
+	}
+
+	auto result = AudioUnitRender(recorder->mInputUnit, ioActionFlags, inTimeStamp, inBusNumber, inNumberFrames, bufferList);
+	if(noErr != result)
+		return result;
+
+	recorder->CaptureAudio(bufferList, inNumberFrames);
+
+	return noErr;
+}
+
+#pragma mark Writing
+
+void SFB::Audio::Recorder::WriterThreadEntry()
+{
+	pthread_setname_np("org.sbooth.AudioEngine.Recorder");
+
+	while(mKeepWriting.load()) {
+		if(mRingBuffer.GetFramesAvailableToRead() >= mChunkFrames) {
+			WriteChunk();
+			continue;
+		}
+
+		// Write partial chunks when the wait times out so little audio is lost if the process exits
+		mWriterWaiting.store(true);
+		if(!mSemaphore.TimedWait(dispatch_time(DISPATCH_TIME_NOW, WRITER_WAIT_NSEC)) && mRingBuffer.GetFramesAvailableToRead())
+			WriteChunk();
+		mWriterWaiting.store(false);
+	}
+
+	// Write all remaining audio
+	while(WriteChunk())
+		;
+}
+
+UInt32 SFB::Audio::Recorder::WriteChunk()
+{
+	// Audio continues to be removed after a failure so capture isn't blocked
+	mChunk.Reset();
+	auto framesRead = (UInt32)mRingBuffer.ReadAudio(mChunk, mChunkFrames);
+	if(0 == framesRead)
+		return 0;
+
+	if(!mWriteFailed.load()) {
+		if(mEncoder->WriteAudio(mChunk, framesRead))
+			mFramesWritten.fetch_add(framesRead);
+		else {
+			LOGGER_ERR("org.sbooth.AudioEngine.Recorder", "Error writing audio to " << mEncoder->GetURL());
+			mWriteFailed.store(true);
+		}
+	}
+
+	return framesRead;
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "AudioBufferList.h"
+#include "AudioEncoder.h"
+#include "AudioFormat.h"
+#include "AudioRingBuffer.h"
+#include "Semaphore.h"
+
+/*! @file AudioRecorder.h @brief Capture of audio input to disk */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A class capturing audio input to an \c Encoder
+		 *
+		 * Input is copied into a lock-free ring buffer on the thread delivering it, which never blocks or
+		 * allocates.  A separate writing thread removes audio from the ring buffer in large chunks and passes it to
+		 * the encoder.  Input arriving while the ring buffer is full is dropped and counted.
+		 *
+		 * A \c Recorder created with CreateForDevice() captures input from a Core Audio device.  A \c Recorder
+		 * created with CreateForFormat() captures audio delivered to CaptureAudio(), for example by passing
+		 * CaptureAudioCallback() and the recorder to \c ASIOOutput::SetInputCallback().
+		 */
+		class Recorder
+		{
+		public:
+
+			/*! @brief The \c CFErrorRef error domain used by \c Recorder */
+			static const CFStringRef ErrorDomain;
+
+			/*! @brief Possible \c CFErrorRef error codes used by \c Recorder */
+			enum ErrorCode {
+				InputDeviceError					= 0,	/*!< The input device could not be used */
+				FormatNotSupportedError				= 1,	/*!< The capture format is not supported */
+			};
+
+			/*! @brief A \c std::unique_ptr for \c Recorder objects */
+			using unique_ptr = std::unique_ptr<Recorder>;
+
+			// ========================================
+			/*! @name Factory Methods */
+			//@{
+
+			/*!
+			 * @brief Create a \c Recorder capturing input from a Core Audio device
+			 * @param deviceUID The UID of the device, or \c nullptr for the default input device
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Recorder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForDevice(CFStringRef deviceUID = nullptr, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Create a \c Recorder capturing audio delivered to CaptureAudio()
+			 * @param format The format of the audio, which must be PCM
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return A \c Recorder object, or \c nullptr on failure
+			 */
+			static unique_ptr CreateForFormat(const AudioFormat& format, CFErrorRef *error = nullptr);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Creation and Destruction */
+			//@{
+
+			/*! @brief Destroy this \c Recorder, stopping recording if necessary */
+			~Recorder();
+
+			/*! @cond */
+
+			/*! @internal This class is non-copyable */
+			Recorder(const Recorder& rhs) = delete;
+
+			/*! @internal This class is non-assignable */
+			Recorder& operator=(const Recorder& rhs) = delete;
+
+			/*! @endcond */
+			//@}
+
+
+			// ========================================
+			/*! @name Recording */
+			//@{
+
+			/*! @brief Get the format of the captured audio */
+			inline const AudioFormat& GetFormat() const				{ return mFormat; }
+
+			/*!
+			 * @brief Start recording
+			 * @note The encoder is opened with the format returned by GetFormat()
+			 * @param encoder The encoder receiving the captured audio, which must not be open
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, \c false otherwise
+			 */
+			bool Start(Encoder::unique_ptr encoder, CFErrorRef *error = nullptr);
+
+			/*!
+			 * @brief Stop recording, writing all captured audio and closing the encoder
+			 * @note Audio delivered to CaptureAudio() by another source must be stopped first, for example by
+			 * clearing the \c ASIOOutput input callback
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true if all captured audio was written, \c false otherwise
+			 */
+			bool Stop(CFErrorRef *error = nullptr);
+
+			/*! @brief Query whether audio is being recorded */
+			inline bool IsRecording() const							{ return mIsRecording.load(); }
+
+			/*! @brief Get the duration of audio the ring buffer holds, in seconds */
+			inline double GetBufferDuration() const					{ return mBufferDuration; }
+
+			/*!
+			 * @brief Set the duration of audio the ring buffer holds
+			 * @note This takes effect when recording is next started
+			 * @param bufferDuration The duration in seconds
+			 */
+			void SetBufferDuration(double bufferDuration);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Capture */
+			//@{
+
+			/*!
+			 * @brief Capture audio
+			 * @note This method never blocks or allocates and is safe to call from a real-time thread
+			 * @param bufferList The audio in the format returned by GetFormat()
+			 * @param frameCount The number of frames in \c bufferList
+			 * @return \c true if all frames were captured, \c false if any were dropped or the recorder is stopped
+			 */
+			bool CaptureAudio(const AudioBufferList *bufferList, UInt32 frameCount);
+
+			/*!
+			 * @brief Capture audio using a \c Recorder passed as \c context
+			 * @note The signature matches \c ASIOOutput::InputCallback
+			 */
+			static void CaptureAudioCallback(void *context, const AudioBufferList *bufferList, UInt32 frameCount);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Statistics */
+			//@{
+
+			/*! @brief Get the number of frames captured since recording started */
+			inline UInt64 GetFramesCaptured() const					{ return mFramesCaptured.load(); }
+
+			/*! @brief Get the number of frames dropped because the ring buffer was full since recording started */
+			inline UInt64 GetFramesDropped() const					{ return mFramesDropped.load(); }
+
+			/*! @brief Get the number of frames passed to the encoder since recording started */
+			inline UInt64 GetFramesWritten() const					{ return mFramesWritten.load(); }
+
+			//@}
+
+		private:
+
+			explicit Recorder(const AudioFormat& format);
+
+			// Set up an AUHAL for input from deviceID
+			bool OpenInputUnit(AudioObjectID deviceID, CFErrorRef *error);
+
+			// The AUHAL input callback
+			static OSStatus InputProc(void *inRefCon, AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *inTimeStamp, UInt32 inBusNumber, UInt32 inNumberFrames, AudioBufferList *ioData);
+
+			// Writing thread entry point
+			void WriterThreadEntry();
+
+			// Write up to mChunkFrames frames from the ring buffer to the encoder, returning the number written
+			UInt32 WriteChunk();
+
+			AudioFormat					mFormat;
+			double						mBufferDuration;
+
+			AudioUnit					mInputUnit;			/*!< The AUHAL, or nullptr if audio is delivered to CaptureAudio() */
+			BufferList					mInputBufferList;	/*!< Addresses the AUHAL's buffers for rendering */
+
+			Encoder::unique_ptr			mEncoder;
+			RingBuffer					mRingBuffer;
+			BufferList					mChunk;
+			UInt32						mChunkFrames;
+
+			std::atomic_bool			mIsRecording;
+			std::atomic_bool			mKeepWriting;
+			std::atomic_bool			mWriterWaiting;
+			std::atomic_bool			mWriteFailed;
+			Semaphore					mSemaphore;
+			std::thread					mWriterThread;
+
+			std::atomic_ullong			mFramesCaptured;
+			std::atomic_ullong			mFramesDropped;
+			std::atomic_ullong			mFramesWritten;
+		};
+
+	}
+}
@@ -99,13 +99,17 @@
 #include <algorithm>
 
 #include <Accelerate/Accelerate.h>
+#include <dispatch/dispatch.h>
+#include <simd/simd.h>
 
 #include "ReplayGainAnalyzer.h"
 #include "AudioConverter.h"
 #include "AudioDecoder.h"
 #include "AudioBufferList.h"
+#include "AudioResampler.h"
 #include "CFWrapper.h"
 #include "CFErrorUtilities.h"
+#include "Logger.h"
 
 // ========================================
 // Error Codes
@@ -132,6 +136,8 @@ const CFStringRef SFB::Audio::ReplayGainAnalyzer::ErrorDomain = CFSTR("org.sboot
  */
 #define MAX_SAMPLES_PER_WINDOW		(size_t) (MAX_SAMP_FREQ * RMS_WINDOW_TIME + 1.)		/* max. Samples per Time slice */
 #define PINK_REF					64.82		/* 298640883795 */						/* calibration value */
+#define SAMPLE_SCALE				32768.f		/* the analysis expects samples in the 16-bit range */
+#define BUFFER_SIZE_FRAMES			4096
 
 namespace {
 	/* for each filter:
@@ -185,13 +191,16 @@ namespace {
 		{ 0.94597685600279f, -1.89195371200558f, 0.94597685600279f }
 	};
 
-	void filter(const float *input, float *output, size_t nSamples, const float *a, const float *b, size_t order)
+	// Filter both channels at once, one per vector lane
+	// The order is a template parameter so the inner loop is fully unrolled
+	template <size_t Order>
+	void filter(const simd_float2 *input, simd_float2 *output, size_t nSamples, const float *a, const float *b)
 	{
 		for(size_t i = 0; i < nSamples; ++i) {
-			double y = input[i] * b[0];
-			for(size_t k = 1; k <= order; ++k)
-				y += input[i - k] * b[k] - output[i - k] * a[k];
-			output[i] = (float)y;
+			simd_double2 y = simd_double(input[i]) * b[0];
+			for(size_t k = 1; k <= Order; ++k)
+				y += simd_double(input[i - k]) * b[k] - simd_double(output[i - k]) * a[k];
+			output[i] = simd_float(y);
 		}
 	}
 
@@ -218,25 +227,47 @@ namespace {
 }
 
 // This class exists to hide the internal state from the world
+// Samples are stored as left/right pairs so both channels are filtered together
+namespace {
+
+	// Audio analyzed during decoding is converted to non-interleaved float before resampling and filtering
+	AudioStreamBasicDescription GetAnalysisFormat(Float64 sampleRate, UInt32 channelCount)
+	{
+		AudioStreamBasicDescription format = {
+			.mFormatID				= kAudioFormatLinearPCM,
+			.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved,
+			.mReserved				= 0,
+			.mSampleRate			= sampleRate,
+			.mChannelsPerFrame		= channelCount,
+			.mBitsPerChannel		= 32,
+			.mBytesPerPacket		= 4,
+			.mBytesPerFrame			= 4,
+			.mFramesPerPacket		= 1
+		};
+
+		return format;
+	}
+
+	bool IsAnalysisFormat(const SFB::Audio::AudioFormat& format)
+	{
+		return format.IsPCM() && (kAudioFormatFlagIsFloat & format.mFormatFlags) && 32 == format.mBitsPerChannel && format.IsNativeEndian() && (1 == format.mChannelsPerFrame || !format.IsInterleaved());
+	}
+
+}
+
 class SFB::Audio::ReplayGainAnalyzer::ReplayGainAnalyzerPrivate
 {
 public:
-	float			linprebuf	[MAX_ORDER * 2];
-	float			*linpre;											/* left input samples, with pre-buffer */
-	float			lstepbuf	[MAX_SAMPLES_PER_WINDOW + MAX_ORDER];
-	float			*lstep;												/* left "first step" (i.e. post first filter) samples */
-	float			loutbuf		[MAX_SAMPLES_PER_WINDOW + MAX_ORDER];
-	float			*lout;												/* left "out" (i.e. post second filter) samples */
-	float			rinprebuf	[MAX_ORDER * 2];
-	float			*rinpre;											/* right input samples ... */
-	float			rstepbuf	[MAX_SAMPLES_PER_WINDOW + MAX_ORDER];
-	float			*rstep;
-	float			routbuf		[MAX_SAMPLES_PER_WINDOW + MAX_ORDER];
-	float			*rout;
+	simd_float2		inprebuf	[MAX_ORDER * 2];
+	simd_float2		*inpre;												/* input samples, with pre-buffer */
+	simd_float2		stepbuf		[MAX_SAMPLES_PER_WINDOW + MAX_ORDER];
+	simd_float2		*step;												/* "first step" (i.e. post first filter) samples */
+	simd_float2		outbuf		[MAX_SAMPLES_PER_WINDOW + MAX_ORDER];
+	simd_float2		*out;												/* "out" (i.e. post second filter) samples */
+	float			byule		[YULE_ORDER + 1];						/* Yule-Walk numerator, including the sample scale */
 	unsigned int	sampleWindow;										/* number of samples required to reach number of milliseconds required for RMS window */
 	unsigned long	totsamp;
-	double			lsum;
-	double			rsum;
+	double			sum;
 	int				freqindex;
 	uint32_t		A			[(size_t)(STEPS_per_dB * MAX_dB)];
 	uint32_t		B			[(size_t)(STEPS_per_dB * MAX_dB)];
@@ -244,25 +275,51 @@ public:
 	float			trackPeak;
 	float			albumPeak;
 
+	// State for analysis during decoding
+	UInt32							channelCount;
+	AudioConverterRef				converter;			/* converts audio not in the analysis format */
+	BufferList						convertedBuffer;
+	std::unique_ptr<Resampler>		resampler;			/* converts audio not at a supported sample rate */
+	BufferList						resampledBuffer;
+	std::vector<simd_float2>		frames;				/* interleaved stereo frames for the filters */
+
 	ReplayGainAnalyzerPrivate()
-		: sampleWindow(0), totsamp(0), lsum(0), rsum(0), freqindex(0), trackPeak(0), albumPeak(0)
+		: sampleWindow(0), totsamp(0), sum(0), freqindex(0), trackPeak(0), albumPeak(0), channelCount(0), converter(nullptr)
 	{
-		linpre	= linprebuf + MAX_ORDER;
-		rinpre	= rinprebuf + MAX_ORDER;
-		lstep	= lstepbuf  + MAX_ORDER;
-		rstep	= rstepbuf  + MAX_ORDER;
-		lout	= loutbuf   + MAX_ORDER;
-		rout	= routbuf   + MAX_ORDER;
+		inpre	= inprebuf + MAX_ORDER;
+		step	= stepbuf  + MAX_ORDER;
+		out		= outbuf   + MAX_ORDER;
 
+		memset(byule, 0, sizeof(byule));
 		memset(A, 0, sizeof(A));
 		memset(B, 0, sizeof(B));
 	}
 
+	~ReplayGainAnalyzerPrivate()
+	{
+		DisposeConverter();
+	}
+
+	void DisposeConverter()
+	{
+		if(converter) {
+			auto result = AudioConverterDispose(converter);
+			if(noErr != result)
+				LOGGER_ERR("org.sbooth.AudioEngine.ReplayGainAnalyzer", "AudioConverterDispose failed: " << result);
+			converter = nullptr;
+		}
+
+		convertedBuffer.Deallocate();
+		resampler.reset();
+		resampledBuffer.Deallocate();
+		channelCount = 0;
+	}
+
 	/* zero out initial values */
 	void Zero()
 	{
 		for(int i = 0; i < MAX_ORDER; ++i)
-			linprebuf[i] = lstepbuf[i] = loutbuf[i] = rinprebuf[i] = rstepbuf[i] = routbuf[i] = 0;
+			inprebuf[i] = stepbuf[i] = outbuf[i] = 0;
 	}
 };
 
@@ -361,6 +418,56 @@ int32_t SFB::Audio::ReplayGainAnalyzer::GetBestReplayGainSampleRateForSampleRate
 	return 44100;
 }
 
+bool SFB::Audio::ReplayGainAnalyzer::AnalyzeAlbum(CFArrayRef urls, std::vector<TrackReplayGain>& tracks, float& albumGain, float& albumPeak, CFErrorRef *error)
+{
+	if(nullptr == urls)
+		return false;
+
+	size_t count = (size_t)CFArrayGetCount(urls);
+
+	std::vector<std::unique_ptr<ReplayGainAnalyzer>> analyzers(count);
+	std::vector<TrackReplayGain> results(count);
+	std::vector<CFErrorRef> errors(count, nullptr);
+	std::vector<char> succeeded(count, false);
+
+	auto analyzersData = analyzers.data();
+	auto resultsData = results.data();
+	auto errorsData = errors.data();
+	auto succeededData = succeeded.data();
+
+	// Decoding dominates the analysis, so each track is analyzed on its own worker
+	dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(size_t i) {
+		auto url = (CFURLRef)CFArrayGetValueAtIndex(urls, (CFIndex)i);
+
+		analyzersData[i].reset(new ReplayGainAnalyzer);
+		auto& analyzer = *analyzersData[i];
+		succeededData[i] = analyzer.AnalyzeURL(url, &errorsData[i]) && analyzer.GetTrackGain(resultsData[i].mGain) && analyzer.GetTrackPeak(resultsData[i].mPeak);
+	});
+
+	// Report the error for the first track that couldn't be analyzed
+	bool result = std::all_of(succeeded.begin(), succeeded.end(), [](char trackSucceeded) { return trackSucceeded; });
+	for(auto trackError : errors) {
+		if(trackError) {
+			if(error && !*error)
+				*error = (CFErrorRef)CFRetain(trackError);
+			CFRelease(trackError);
+		}
+	}
+
+	if(!result)
+		return false;
+
+	ReplayGainAnalyzer album;
+	for(const auto& analyzer : analyzers)
+		album.MergeAlbum(*analyzer);
+
+	if(!album.GetAlbumGain(albumGain) || !album.GetAlbumPeak(albumPeak))
+		return false;
+
+	tracks = std::move(results);
+	return true;
+}
+
 SFB::Audio::ReplayGainAnalyzer::ReplayGainAnalyzer()
 	: priv(new ReplayGainAnalyzerPrivate)
 {}
@@ -411,15 +518,16 @@ bool SFB::Audio::ReplayGainAnalyzer::AnalyzeURL(CFURLRef url, CFErrorRef *error)
 		return false;
 	}
 
+	// Interleaved stereo is analyzed without rearranging the samples
 	AudioStreamBasicDescription outputFormat = {
 		.mFormatID				= kAudioFormatLinearPCM,
-		.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved,
+		.mFormatFlags			= kAudioFormatFlagsNativeFloatPacked,
 		.mReserved				= 0,
 		.mSampleRate			= replayGainSampleRate,
 		.mChannelsPerFrame		= inputFormat.mChannelsPerFrame,
 		.mBitsPerChannel		= 32,
-		.mBytesPerPacket		= 4,
-		.mBytesPerFrame			= 4,
+		.mBytesPerPacket		= 4 * inputFormat.mChannelsPerFrame,
+		.mBytesPerFrame			= 4 * inputFormat.mChannelsPerFrame,
 		.mFramesPerPacket		= 1
 	};
 
@@ -436,39 +544,38 @@ bool SFB::Audio::ReplayGainAnalyzer::AnalyzeURL(CFURLRef url, CFErrorRef *error)
 	}
 
 	// Converter takes ownership of decoder
+	// Analysis uses the built-in resampler so results don't depend on the system's sample rate converter
 	Converter converter(std::move(decoder), outputFormat);
-	if(!converter.Open(error))
+	if(!converter.SetSampleRateConverter(Converter::SampleRateConverter::Resampler, Resampler::Quality::High, 0) || !converter.Open(error))
 		return false;
 
-	const UInt32 bufferSizeFrames = 512;
+	const UInt32 bufferSizeFrames = 4096;
 	BufferList outputBuffer(outputFormat, bufferSizeFrames);
 
 	bool isStereo = (2 == outputFormat.mChannelsPerFrame);
 
+	// Mono audio is analyzed as two identical channels
+	std::vector<simd_float2> monoFrames(isStereo ? 0 : bufferSizeFrames);
+
 	for(;;) {
 		UInt32 frameCount = converter.ConvertAudio(outputBuffer, bufferSizeFrames);
 		if(0 == frameCount)
 			break;
 
+		const float *samples = (const float *)outputBuffer->mBuffers[0].mData;
+
 		// Find the peak sample magnitude
-		float lpeak, rpeak;
-		vDSP_maxmgv((const float *)outputBuffer->mBuffers[0].mData, 1, &lpeak, frameCount);
-		if(isStereo) {
-			vDSP_maxmgv((const float *)outputBuffer->mBuffers[1].mData, 1, &rpeak, frameCount);
-			priv->trackPeak = std::max(priv->trackPeak, std::max(lpeak, rpeak));
-		}
-		else
-			priv->trackPeak = std::max(priv->trackPeak, lpeak);
-
-		// The replay gain analyzer expects 16-bit sample size passed as floats
-		const float scale = 1u << 15;
-		vDSP_vsmul((const float *)outputBuffer->mBuffers[0].mData, 1, &scale, (float *)outputBuffer->mBuffers[0].mData, 1, frameCount);
-		if(isStereo) {
-			vDSP_vsmul((const float *)outputBuffer->mBuffers[1].mData, 1, &scale, (float *)outputBuffer->mBuffers[1].mData, 1, frameCount);
-			AnalyzeSamples((const float *)outputBuffer->mBuffers[0].mData, (const float *)outputBuffer->mBuffers[1].mData, frameCount, true);
+		float peak;
+		vDSP_maxmgv(samples, 1, &peak, frameCount * outputFormat.mChannelsPerFrame);
+		priv->trackPeak = std::max(priv->trackPeak, peak);
+
+		if(!isStereo) {
+			cblas_scopy((int)frameCount, samples, 1, (float *)monoFrames.data(), 2);
+			cblas_scopy((int)frameCount, samples, 1, (float *)monoFrames.data() + 1, 2);
+			samples = (const float *)monoFrames.data();
 		}
-		else
-			AnalyzeSamples((const float *)outputBuffer->mBuffers[0].mData, nullptr, frameCount, false);
+
+		AnalyzeSamples(samples, frameCount);
 	}
 
 	priv->albumPeak = std::max(priv->albumPeak, priv->trackPeak);
@@ -476,6 +583,117 @@ bool SFB::Audio::ReplayGainAnalyzer::AnalyzeURL(CFURLRef url, CFErrorRef *error)
 	return true;
 }
 
+void SFB::Audio::ReplayGainAnalyzer::MergeAlbum(const ReplayGainAnalyzer& analyzer)
+{
+	if(&analyzer == this)
+		return;
+
+	for(uint32_t i = 0; i < sizeof(priv->B) / sizeof(*(priv->B)); ++i)
+		priv->B[i] += analyzer.priv->A[i] + analyzer.priv->B[i];
+
+	priv->albumPeak = std::max(priv->albumPeak, std::max(analyzer.priv->albumPeak, analyzer.priv->trackPeak));
+}
+
+bool SFB::Audio::ReplayGainAnalyzer::DecodingStarted(const Decoder& decoder)
+{
+	priv->DisposeConverter();
+
+	const AudioFormat& format = decoder.GetFormat();
+	if(!format.IsPCM() || !(1 == format.mChannelsPerFrame || 2 == format.mChannelsPerFrame)) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.ReplayGainAnalyzer", "Only mono or stereo PCM audio may be analyzed");
+		return false;
+	}
+
+	int32_t decoderSampleRate = (int32_t)format.mSampleRate;
+	if(!EvenMultipleSampleRateIsSupported(decoderSampleRate)) {
+		LOGGER_NOTICE("org.sbooth.AudioEngine.ReplayGainAnalyzer", "Unsupported sample rate: " << format.mSampleRate);
+		return false;
+	}
+
+	int32_t replayGainSampleRate = GetBestReplayGainSampleRateForSampleRate(decoderSampleRate);
+	if(!SetSampleRate(replayGainSampleRate))
+		return false;
+
+	// Audio in other formats is converted, at the same sample rate, before resampling
+	if(!IsAnalysisFormat(format)) {
+		auto analysisFormat = GetAnalysisFormat(format.mSampleRate, format.mChannelsPerFrame);
+		auto result = AudioConverterNew(&format, &analysisFormat, &priv->converter);
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.ReplayGainAnalyzer", "AudioConverterNew failed: " << result);
+			priv->converter = nullptr;
+			return false;
+		}
+
+		if(!priv->convertedBuffer.Allocate(analysisFormat, BUFFER_SIZE_FRAMES)) {
+			priv->DisposeConverter();
+			return false;
+		}
+	}
+
+	// As in AnalyzeURL() the built-in resampler is used so results don't depend on the system's sample rate converter
+	if(replayGainSampleRate != decoderSampleRate) {
+		priv->resampler.reset(new Resampler);
+		if(!priv->resampler->Configure(format.mSampleRate, replayGainSampleRate, format.mChannelsPerFrame, Resampler::Quality::High) || !priv->resampledBuffer.Allocate(GetAnalysisFormat(replayGainSampleRate, format.mChannelsPerFrame), BUFFER_SIZE_FRAMES)) {
+			priv->DisposeConverter();
+			return false;
+		}
+	}
+
+	priv->channelCount = format.mChannelsPerFrame;
+
+	return true;
+}
+
+void SFB::Audio::ReplayGainAnalyzer::AnalyzeAudio(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(0 == priv->channelCount || 0 == frameCount)
+		return;
+
+	if(priv->converter) {
+		if(priv->convertedBuffer.GetCapacityFrames() < frameCount) {
+			AudioFormat analysisFormat = priv->convertedBuffer.GetFormat();
+			if(!priv->convertedBuffer.Allocate(analysisFormat, frameCount))
+				return;
+		}
+
+		for(UInt32 i = 0; i < priv->convertedBuffer->mNumberBuffers; ++i)
+			priv->convertedBuffer->mBuffers[i].mDataByteSize = frameCount * sizeof(float);
+
+		auto result = AudioConverterConvertComplexBuffer(priv->converter, frameCount, bufferList, priv->convertedBuffer);
+		if(noErr != result) {
+			LOGGER_ERR("org.sbooth.AudioEngine.ReplayGainAnalyzer", "AudioConverterConvertComplexBuffer failed: " << result);
+			return;
+		}
+
+		bufferList = priv->convertedBuffer;
+	}
+
+	if(!priv->resampler) {
+		AnalyzeFrames(bufferList, frameCount);
+		return;
+	}
+
+	if(priv->resampler->AppendInput(bufferList, frameCount))
+		AnalyzeResampledFrames();
+}
+
+void SFB::Audio::ReplayGainAnalyzer::DecodingFinished(const Decoder& decoder, bool complete)
+{
+#pragma unused(decoder)
+#pragma unused(complete)
+
+	if(0 == priv->channelCount)
+		return;
+
+	if(priv->resampler) {
+		priv->resampler->Finish();
+		AnalyzeResampledFrames();
+	}
+
+	priv->albumPeak = std::max(priv->albumPeak, priv->trackPeak);
+	priv->DisposeConverter();
+}
+
 bool SFB::Audio::ReplayGainAnalyzer::GetTrackGain(float& trackGain)
 {
 	if(!analyzeResult(priv->A, sizeof(priv->A) / sizeof(*(priv->A)), trackGain))
@@ -489,7 +707,7 @@ bool SFB::Audio::ReplayGainAnalyzer::GetTrackGain(float& trackGain)
 	priv->Zero();
 
 	priv->totsamp	= 0;
-	priv->lsum		= priv->rsum = 0.;
+	priv->sum		= 0.;
 
 	return true;
 }
@@ -532,8 +750,12 @@ bool SFB::Audio::ReplayGainAnalyzer::SetSampleRate(int32_t sampleRate)
 
 	priv->sampleWindow		= (unsigned int) ceil(sampleRate * RMS_WINDOW_TIME);
 
-	priv->lsum				= 0.;
-	priv->rsum				= 0.;
+	// Scaling the first filter's numerator to the 16-bit sample range scales its output, and therefore that of the second filter,
+	// without a separate pass over the samples
+	for(int i = 0; i <= YULE_ORDER; ++i)
+		priv->byule[i] = BYule[priv->freqindex][i] * SAMPLE_SCALE;
+
+	priv->sum				= 0.;
 	priv->totsamp			= 0;
 
 	memset(priv->A, 0, sizeof(priv->A));
@@ -541,55 +763,70 @@ bool SFB::Audio::ReplayGainAnalyzer::SetSampleRate(int32_t sampleRate)
 	return true;
 }
 
-bool SFB::Audio::ReplayGainAnalyzer::AnalyzeSamples(const float *left_samples, const float *right_samples, size_t num_samples, bool stereo)
+void SFB::Audio::ReplayGainAnalyzer::AnalyzeFrames(const AudioBufferList *bufferList, UInt32 frameCount)
+{
+	if(priv->frames.size() < frameCount)
+		priv->frames.resize(frameCount);
+
+	// Mono audio is analyzed as two identical channels
+	for(UInt32 channel = 0; channel < 2; ++channel) {
+		const float *samples = (const float *)bufferList->mBuffers[std::min(channel, priv->channelCount - 1)].mData;
+
+		float peak;
+		vDSP_maxmgv(samples, 1, &peak, frameCount);
+		priv->trackPeak = std::max(priv->trackPeak, peak);
+
+		cblas_scopy((int)frameCount, samples, 1, (float *)priv->frames.data() + channel, 2);
+	}
+
+	AnalyzeSamples((const float *)priv->frames.data(), frameCount);
+}
+
+void SFB::Audio::ReplayGainAnalyzer::AnalyzeResampledFrames()
+{
+	for(;;) {
+		priv->resampledBuffer.Reset();
+		UInt32 frameCount = priv->resampler->Render(priv->resampledBuffer, 0, priv->resampledBuffer.GetCapacityFrames());
+		if(0 == frameCount)
+			break;
+
+		AnalyzeFrames(priv->resampledBuffer, frameCount);
+	}
+}
+
+bool SFB::Audio::ReplayGainAnalyzer::AnalyzeSamples(const float *frames, size_t num_samples)
 {
 	if(0 == num_samples)
 		return true;
 
-	const float *curleft;
-	const float *curright;
+	auto samples = (const simd_float2 *)frames;
+	const simd_float2 *cursamples_ptr;
 
 	long cursamplepos = 0;
 	long batchsamples = (long)num_samples;
 
-	if(!stereo)
-		right_samples = left_samples;
-
-	if(num_samples < MAX_ORDER) {
-		memcpy(priv->linprebuf + MAX_ORDER, left_samples,  num_samples * sizeof(float));
-		memcpy(priv->rinprebuf + MAX_ORDER, right_samples, num_samples * sizeof(float));
-	}
-	else {
-		memcpy(priv->linprebuf + MAX_ORDER, left_samples,  MAX_ORDER   * sizeof(float));
-		memcpy(priv->rinprebuf + MAX_ORDER, right_samples, MAX_ORDER   * sizeof(float));
-	}
+	if(num_samples < MAX_ORDER)
+		memcpy(priv->inprebuf + MAX_ORDER, samples, num_samples * sizeof(simd_float2));
+	else
+		memcpy(priv->inprebuf + MAX_ORDER, samples, MAX_ORDER   * sizeof(simd_float2));
 
 	while(batchsamples > 0) {
 		long cursamples = std::min((long)priv->sampleWindow - (long)priv->totsamp, batchsamples);
 		if(cursamplepos < MAX_ORDER) {
-			curleft  = priv->linpre + cursamplepos;
-			curright = priv->rinpre + cursamplepos;
+			cursamples_ptr = priv->inpre + cursamplepos;
 			if(cursamples > MAX_ORDER - cursamplepos)
 				cursamples = MAX_ORDER - cursamplepos;
 		}
-		else {
-			curleft  = left_samples  + cursamplepos;
-			curright = right_samples + cursamplepos;
-		}
-
-		filter(curleft , priv->lstep + priv->totsamp, (size_t)cursamples, AYule[priv->freqindex], BYule[priv->freqindex], YULE_ORDER);
-		filter(curright, priv->rstep + priv->totsamp, (size_t)cursamples, AYule[priv->freqindex], BYule[priv->freqindex], YULE_ORDER);
+		else
+			cursamples_ptr = samples + cursamplepos;
 
-		filter(priv->lstep + priv->totsamp, priv->lout + priv->totsamp, (size_t)cursamples, AButter[priv->freqindex], BButter[priv->freqindex], BUTTER_ORDER);
-		filter(priv->rstep + priv->totsamp, priv->rout + priv->totsamp, (size_t)cursamples, AButter[priv->freqindex], BButter[priv->freqindex], BUTTER_ORDER);
+		filter<YULE_ORDER>(cursamples_ptr, priv->step + priv->totsamp, (size_t)cursamples, AYule[priv->freqindex], priv->byule);
+		filter<BUTTER_ORDER>(priv->step + priv->totsamp, priv->out + priv->totsamp, (size_t)cursamples, AButter[priv->freqindex], BButter[priv->freqindex]);
 
-		/* Get the squared values */
+		/* Get the squared values of both channels */
 		float sum;
-		vDSP_svesq(priv->lout + priv->totsamp, 1, &sum, (vDSP_Length)cursamples);
-		priv->lsum += sum;
-
-		vDSP_svesq(priv->rout + priv->totsamp, 1, &sum, (vDSP_Length)cursamples);
-		priv->rsum += sum;
+		vDSP_svesq((const float *)(priv->out + priv->totsamp), 1, &sum, (vDSP_Length)(2 * cursamples));
+		priv->sum += sum;
 
 		batchsamples -= cursamples;
 		cursamplepos += cursamples;
@@ -597,7 +834,7 @@ bool SFB::Audio::ReplayGainAnalyzer::AnalyzeSamples(const float *left_samples, c
 
 		/* Get the Root Mean Square (RMS) for this set of samples */
 		if(priv->totsamp == priv->sampleWindow) {
-			double  val  = STEPS_per_dB * 10. * log10((priv->lsum + priv->rsum) / priv->totsamp * 0.5 + 1.e-37);
+			double  val  = STEPS_per_dB * 10. * log10(priv->sum / priv->totsamp * 0.5 + 1.e-37);
 			int     ival = (int) val;
 			if(ival < 0)
 				ival = 0;
@@ -605,12 +842,10 @@ bool SFB::Audio::ReplayGainAnalyzer::AnalyzeSamples(const float *left_samples, c
 				ival = (int)(sizeof(priv->A)/sizeof(*(priv->A))) - 1;
 
 			priv->A [ival]++;
-			priv->lsum = priv->rsum = 0.;
+			priv->sum = 0.;
 
-			memmove(priv->loutbuf , priv->loutbuf  + priv->totsamp, MAX_ORDER * sizeof(float));
-			memmove(priv->routbuf , priv->routbuf  + priv->totsamp, MAX_ORDER * sizeof(float));
-			memmove(priv->lstepbuf, priv->lstepbuf + priv->totsamp, MAX_ORDER * sizeof(float));
-			memmove(priv->rstepbuf, priv->rstepbuf + priv->totsamp, MAX_ORDER * sizeof(float));
+			memmove(priv->outbuf , priv->outbuf  + priv->totsamp, MAX_ORDER * sizeof(simd_float2));
+			memmove(priv->stepbuf, priv->stepbuf + priv->totsamp, MAX_ORDER * sizeof(simd_float2));
 
 			priv->totsamp = 0;
 		}
@@ -621,15 +856,11 @@ bool SFB::Audio::ReplayGainAnalyzer::AnalyzeSamples(const float *left_samples, c
 	}
 
 	if(num_samples < MAX_ORDER) {
-		memmove(priv->linprebuf,                           priv->linprebuf + num_samples, (MAX_ORDER-num_samples) * sizeof(float));
-		memmove(priv->rinprebuf,                           priv->rinprebuf + num_samples, (MAX_ORDER-num_samples) * sizeof(float));
-		memcpy (priv->linprebuf + MAX_ORDER - num_samples, left_samples,                  num_samples             * sizeof(float));
-		memcpy (priv->rinprebuf + MAX_ORDER - num_samples, right_samples,                 num_samples             * sizeof(float));
-	}
-	else {
-		memcpy (priv->linprebuf, left_samples  + num_samples - MAX_ORDER, MAX_ORDER * sizeof(float));
-		memcpy (priv->rinprebuf, right_samples + num_samples - MAX_ORDER, MAX_ORDER * sizeof(float));
+		memmove(priv->inprebuf,                           priv->inprebuf + num_samples, (MAX_ORDER-num_samples) * sizeof(simd_float2));
+		memcpy (priv->inprebuf + MAX_ORDER - num_samples, samples,                      num_samples             * sizeof(simd_float2));
 	}
+	else
+		memcpy (priv->inprebuf, samples + num_samples - MAX_ORDER, MAX_ORDER * sizeof(simd_float2));
 
     return true;
 }
@@ -7,6 +7,9 @@
 
 #include <CoreFoundation/CoreFoundation.h>
 #include <memory>
+#include <vector>
+
+#include "AudioAnalysisTap.h"
 
 /*! @file ReplayGainAnalyzer.h @brief Support for replay gain calculation */
 
@@ -21,9 +24,13 @@ namespace SFB {
 		 * @see http://wiki.hydrogenaudio.org/index.php?title=ReplayGain_specification
 		 *
 		 * To calculate an album's replay gain, create a \c ReplayGainAnalyzer and all
-		 * \c ReplayGainAnalyzer::AnalyzeURL()
+		 * \c ReplayGainAnalyzer::AnalyzeURL(), or analyze the tracks concurrently using
+		 * \c ReplayGainAnalyzer::AnalyzeAlbum()
+		 *
+		 * A \c ReplayGainAnalyzer may also be used as an analysis tap, for example with other taps in
+		 * \c AnalysisTap::AnalyzeURL() so a file is decoded only once.
 		 */
-		class ReplayGainAnalyzer
+		class ReplayGainAnalyzer : public AnalysisTap
 		{
 		public:
 
@@ -60,6 +67,27 @@ namespace SFB {
 			static int32_t GetBestReplayGainSampleRateForSampleRate(int32_t sampleRate);
 
 
+			/*! @brief The replay gain values for a track */
+			struct TrackReplayGain {
+				float mGain;		/*!< The track gain in dB */
+				float mPeak;		/*!< The track peak sample value normalized to [-1, 1) */
+			};
+
+			/*!
+			 * @brief Analyze an album's replay gain, analyzing its tracks concurrently
+			 *
+			 * Each track is analyzed by its own \c ReplayGainAnalyzer and the results are merged, so the album
+			 * gain is identical to that calculated by analyzing the tracks in sequence.
+			 * @param urls A \c CFArray of \c CFURL objects for the album's tracks
+			 * @param tracks A vector to receive the replay gain values for each track, in the order of \c urls
+			 * @param albumGain The album gain in dB
+			 * @param albumPeak The album peak sample value normalized to [-1, 1)
+			 * @param error An optional pointer to a \c CFErrorRef to receive error information
+			 * @return \c true on success, false otherwise
+			 */
+			static bool AnalyzeAlbum(CFArrayRef urls, std::vector<TrackReplayGain>& tracks, float& albumGain, float& albumPeak, CFErrorRef *error = nullptr);
+
+
 			// ========================================
 			/*! @name Creation/Destruction */
 			//@{
@@ -97,6 +125,31 @@ namespace SFB {
 			 */
 			bool AnalyzeURL(CFURLRef url, CFErrorRef *error = nullptr);
 
+			/*!
+			 * @brief Add the audio analyzed by another \c ReplayGainAnalyzer to the album
+			 *
+			 * Loudness histograms are additive, so tracks may be analyzed by separate analyzers and merged.
+			 * @note The other analyzer's current track is included, whether or not its gain has been retrieved
+			 * @param analyzer The analyzer to merge
+			 */
+			void MergeAlbum(const ReplayGainAnalyzer& analyzer);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Analysis during decoding */
+			//@{
+
+			/*! @brief Begin analyzing a track using the decoder's format */
+			bool DecodingStarted(const Decoder& decoder) override;
+
+			/*! @brief Analyze audio in the format of the decoder passed to \c DecodingStarted() */
+			void AnalyzeAudio(const AudioBufferList *bufferList, UInt32 frameCount) override;
+
+			/*! @brief Finish analyzing the track so its replay gain values are available */
+			void DecodingFinished(const Decoder& decoder, bool complete) override;
+
 			//@}
 
 
@@ -125,7 +178,9 @@ namespace SFB {
 
 		private:
 			bool SetSampleRate(int32_t sampleRate);
-			bool AnalyzeSamples(const float *left_samples, const float *right_samples, size_t num_samples, bool stereo);
+			bool AnalyzeSamples(const float *frames, size_t num_samples);		// frames are interleaved stereo
+			void AnalyzeFrames(const AudioBufferList *bufferList, UInt32 frameCount);		// bufferList is non-interleaved float at the analysis sample rate
+			void AnalyzeResampledFrames();
 
 			// The replay gain internal state
 			class ReplayGainAnalyzerPrivate;
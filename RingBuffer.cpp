@@ -4,6 +4,7 @@
  */
 
 #include "RingBuffer.h"
+#include "MirroredMemory.h"
 
 #include <cstdlib>
 #include <algorithm>
@@ -26,12 +27,32 @@ namespace {
 		return 1 << (32 - __builtin_clz(x - 1));
 	}
 
+	/*! Return the number of bytes available for reading given the write and read pointers */
+	inline size_t BytesAvailableToRead(size_t writePointer, size_t readPointer, size_t capacityBytes, size_t capacityBytesMask)
+	{
+		if(writePointer > readPointer)
+			return writePointer - readPointer;
+		else
+			return (writePointer - readPointer + capacityBytes) & capacityBytesMask;
+	}
+
+	/*! Return the number of bytes available for writing given the write and read pointers */
+	inline size_t BytesAvailableToWrite(size_t writePointer, size_t readPointer, size_t capacityBytes, size_t capacityBytesMask)
+	{
+		if(writePointer > readPointer)
+			return ((readPointer - writePointer + capacityBytes) & capacityBytesMask) - 1;
+		else if(writePointer < readPointer)
+			return (readPointer - writePointer) - 1;
+		else
+			return capacityBytes - 1;
+	}
+
 }
 
 #pragma mark Creation and Destruction
 
 SFB::RingBuffer::RingBuffer()
-	: mBuffer(nullptr), mCapacityBytes(0), mCapacityBytesMask(0), mWritePointer(0), mReadPointer(0)
+	: mBuffer(nullptr), mCapacityBytes(0), mCapacityBytesMask(0), mMirrored(false), mWritePointer(0), mCachedReadPointer(0), mReadPointer(0), mCachedWritePointer(0)
 {}
 
 SFB::RingBuffer::~RingBuffer()
@@ -41,26 +62,41 @@ SFB::RingBuffer::~RingBuffer()
 
 #pragma mark Buffer Management
 
-bool SFB::RingBuffer::Allocate(size_t capacityBytes)
+bool SFB::RingBuffer::Allocate(size_t capacityBytes, bool mirrored)
 {
 	Deallocate();
 
 	// Round up to the next power of two
 	capacityBytes = NextPowerOfTwo((uint32_t)capacityBytes);
 
+	// Mirrored memory is allocated in whole pages
+	if(mirrored)
+		capacityBytes = std::max(capacityBytes, GetMirroredMemoryGranularity());
+
 	mCapacityBytes = capacityBytes;
 	mCapacityBytesMask = capacityBytes - 1;
 
-	try {
-		mBuffer = new uint8_t [mCapacityBytes];
+	if(mirrored) {
+		mBuffer = (uint8_t *)AllocateMirroredMemory(mCapacityBytes);
+		if(nullptr == mBuffer)
+			return false;
 	}
+	else {
+		try {
+			mBuffer = new uint8_t [mCapacityBytes];
+		}
 
-	catch(const std::exception& e) {
-		return false;
+		catch(const std::exception& e) {
+			return false;
+		}
 	}
 
-	mReadPointer = 0;
-	mWritePointer = 0;
+	mMirrored = mirrored;
+
+	mReadPointer.store(0);
+	mCachedReadPointer = 0;
+	mWritePointer.store(0);
+	mCachedWritePointer = 0;
 
 	return true;
 }
@@ -68,73 +104,40 @@ bool SFB::RingBuffer::Allocate(size_t capacityBytes)
 void SFB::RingBuffer::Deallocate()
 {
 	if(mBuffer) {
-		delete [] mBuffer;
+		if(mMirrored)
+			DeallocateMirroredMemory(mBuffer, mCapacityBytes);
+		else
+			delete [] mBuffer;
 		mBuffer = nullptr;
+		mMirrored = false;
 	}
 }
 
 
 void SFB::RingBuffer::Reset()
 {
-	mReadPointer = 0;
-	mWritePointer = 0;
+	mReadPointer.store(0);
+	mCachedReadPointer = 0;
+	mWritePointer.store(0);
+	mCachedWritePointer = 0;
 }
 
 size_t SFB::RingBuffer::GetBytesAvailableToRead() const
 {
-	auto w = mWritePointer;
-	auto r = mReadPointer;
-
-	if(w > r)
-		return w - r;
-	else
-		return (w - r + mCapacityBytes) & mCapacityBytesMask;
+	return BytesAvailableToRead(mWritePointer.load(std::memory_order_acquire), mReadPointer.load(std::memory_order_acquire), mCapacityBytes, mCapacityBytesMask);
 }
 
 size_t SFB::RingBuffer::GetBytesAvailableToWrite() const
 {
-	auto w = mWritePointer;
-	auto r = mReadPointer;
-
-	if(w > r)
-		return ((r - w + mCapacityBytes) & mCapacityBytesMask) - 1;
-	else if(w < r)
-		return (r - w) - 1;
-	else
-		return mCapacityBytes - 1;
+	return BytesAvailableToWrite(mWritePointer.load(std::memory_order_acquire), mReadPointer.load(std::memory_order_acquire), mCapacityBytes, mCapacityBytesMask);
 }
 
 size_t SFB::RingBuffer::Read(void *destinationBuffer, size_t byteCount)
 {
-	if(nullptr == destinationBuffer || 0 == byteCount)
-		return 0;
-
-	auto bytesAvailable = GetBytesAvailableToRead();
-	if(0 == bytesAvailable)
-		return 0;
-
-	auto bytesToRead = std::min(bytesAvailable, byteCount);
-	auto cnt2 = mReadPointer + bytesToRead;
-
-	size_t n1, n2;
-	if(cnt2 > mCapacityBytes) {
-		n1 = mCapacityBytes - mReadPointer;
-		n2 = cnt2 & mCapacityBytesMask;
-	}
-	else {
-		n1 = bytesToRead;
-		n2 = 0;
-	}
-
-	memcpy(destinationBuffer, mBuffer + mReadPointer, n1);
-	mReadPointer = (mReadPointer + n1) & mCapacityBytesMask;
-
-	if(n2) {
-		memcpy((uint8_t *)destinationBuffer + n1, mBuffer + mReadPointer, n2);
-		mReadPointer = (mReadPointer + n2) & mCapacityBytesMask;
-	}
-
-	return bytesToRead;
+	auto bytesRead = Peek(destinationBuffer, byteCount);
+	if(bytesRead)
+		ReadAdvance(bytesRead);
+	return bytesRead;
 }
 
 size_t SFB::RingBuffer::Peek(void *destinationBuffer, size_t byteCount) const
@@ -142,18 +145,26 @@ size_t SFB::RingBuffer::Peek(void *destinationBuffer, size_t byteCount) const
 	if(nullptr == destinationBuffer || 0 == byteCount)
 		return 0;
 
-	auto bytesAvailable = GetBytesAvailableToRead();
+	// Only the reader stores mReadPointer
+	auto readPointer = mReadPointer.load(std::memory_order_relaxed);
+
+	// The cached write pointer is refreshed only if it doesn't indicate enough data
+	auto bytesAvailable = BytesAvailableToRead(mCachedWritePointer, readPointer, mCapacityBytes, mCapacityBytesMask);
+	if(bytesAvailable < byteCount) {
+		mCachedWritePointer = mWritePointer.load(std::memory_order_acquire);
+		bytesAvailable = BytesAvailableToRead(mCachedWritePointer, readPointer, mCapacityBytes, mCapacityBytesMask);
+	}
+
 	if(0 == bytesAvailable)
 		return 0;
 
-	auto readPointer = mReadPointer;
-
 	auto bytesToRead = std::min(bytesAvailable, byteCount);
 	auto cnt2 = readPointer + bytesToRead;
 
 	size_t n1, n2;
-	if(cnt2 > mCapacityBytes) {
-		n1 = mCapacityBytes - mReadPointer;
+	// A mirrored buffer never needs to be split
+	if(cnt2 > mCapacityBytes && !mMirrored) {
+		n1 = mCapacityBytes - readPointer;
 		n2 = cnt2 & mCapacityBytesMask;
 	}
 	else {
@@ -162,10 +173,9 @@ size_t SFB::RingBuffer::Peek(void *destinationBuffer, size_t byteCount) const
 	}
 
 	memcpy(destinationBuffer, mBuffer + readPointer, n1);
-	readPointer = (readPointer + n1) & mCapacityBytesMask;
 
 	if(n2)
-		memcpy((uint8_t *)destinationBuffer + n1, mBuffer + readPointer, n2);
+		memcpy((uint8_t *)destinationBuffer + n1, mBuffer, n2);
 
 	return bytesToRead;
 }
@@ -175,16 +185,26 @@ size_t SFB::RingBuffer::Write(const void *sourceBuffer, size_t byteCount)
 	if(nullptr == sourceBuffer || 0 == byteCount)
 		return 0;
 
-	auto bytesAvailable = GetBytesAvailableToWrite();
+	// Only the writer stores mWritePointer
+	auto writePointer = mWritePointer.load(std::memory_order_relaxed);
+
+	// The cached read pointer is refreshed only if it doesn't indicate enough space
+	auto bytesAvailable = BytesAvailableToWrite(writePointer, mCachedReadPointer, mCapacityBytes, mCapacityBytesMask);
+	if(bytesAvailable < byteCount) {
+		mCachedReadPointer = mReadPointer.load(std::memory_order_acquire);
+		bytesAvailable = BytesAvailableToWrite(writePointer, mCachedReadPointer, mCapacityBytes, mCapacityBytesMask);
+	}
+
 	if(0 == bytesAvailable)
 		return 0;
 
 	auto bytesToWrite = std::min(bytesAvailable, byteCount);
-	auto cnt2 = mWritePointer + bytesToWrite;
+	auto cnt2 = writePointer + bytesToWrite;
 
 	size_t n1, n2;
-	if(cnt2 > mCapacityBytes) {
-		n1 = mCapacityBytes - mWritePointer;
+	// A mirrored buffer never needs to be split
+	if(cnt2 > mCapacityBytes && !mMirrored) {
+		n1 = mCapacityBytes - writePointer;
 		n2 = cnt2 & mCapacityBytesMask;
 	}
 	else {
@@ -192,67 +212,51 @@ size_t SFB::RingBuffer::Write(const void *sourceBuffer, size_t byteCount)
 		n2 = 0;
 	}
 
-	memcpy(mBuffer + mWritePointer, sourceBuffer, n1);
-	mWritePointer = (mWritePointer + n1) & mCapacityBytesMask;
+	memcpy(mBuffer + writePointer, sourceBuffer, n1);
 
-	if(n2) {
-		memcpy(mBuffer + mWritePointer, (int8_t *)sourceBuffer + n1, n2);
-		mWritePointer = (mWritePointer + n2) & mCapacityBytesMask;
-	}
+	if(n2)
+		memcpy(mBuffer, (int8_t *)sourceBuffer + n1, n2);
+
+	// Publish the data to the reader only after it has been copied
+	mWritePointer.store((writePointer + bytesToWrite) & mCapacityBytesMask, std::memory_order_release);
 
 	return bytesToWrite;
 }
 
 void SFB::RingBuffer::ReadAdvance(size_t byteCount)
 {
-	mReadPointer = (mReadPointer + byteCount) & mCapacityBytesMask;
+	mReadPointer.store((mReadPointer.load(std::memory_order_relaxed) + byteCount) & mCapacityBytesMask, std::memory_order_release);
 }
 
 void SFB::RingBuffer::WriteAdvance(size_t byteCount)
 {
-	mWritePointer = (mWritePointer + byteCount) & mCapacityBytesMask;;
+	mWritePointer.store((mWritePointer.load(std::memory_order_relaxed) + byteCount) & mCapacityBytesMask, std::memory_order_release);
 }
 
 SFB::RingBuffer::BufferPair SFB::RingBuffer::GetReadVector() const
 {
-	auto w = mWritePointer;
-	auto r = mReadPointer;
-
-	size_t free_cnt;
-	if(w > r)
-		free_cnt = w - r;
-	else
-		free_cnt = (w - r + mCapacityBytes) & mCapacityBytesMask;
+	auto w = mWritePointer.load(std::memory_order_acquire);
+	auto r = mReadPointer.load(std::memory_order_relaxed);
 
+	auto free_cnt = BytesAvailableToRead(w, r, mCapacityBytes, mCapacityBytesMask);
 	auto cnt2 = r + free_cnt;
 
-	if(cnt2 > mCapacityBytes)
-		return { { mBuffer + r, mCapacityBytes - r }, { mBuffer, cnt2 & mCapacityBytes } };
+	if(cnt2 > mCapacityBytes && !mMirrored)
+		return { { mBuffer + r, mCapacityBytes - r }, { mBuffer, cnt2 & mCapacityBytesMask } };
 	else
 		return { { mBuffer + r, free_cnt }, {} };
-
-	return {};
 }
 
 SFB::RingBuffer::BufferPair SFB::RingBuffer::GetWriteVector() const
 {
-	auto w = mWritePointer;
-	auto r = mReadPointer;
-
-	size_t free_cnt;
-	if(w > r)
-		free_cnt = ((r - w + mCapacityBytes) & mCapacityBytesMask) - 1;
-	else if(w < r)
-		free_cnt = (r - w) - 1;
-	else
-		free_cnt = mCapacityBytes - 1;
+	auto w = mWritePointer.load(std::memory_order_relaxed);
+	auto r = mReadPointer.load(std::memory_order_acquire);
 
+	auto free_cnt = BytesAvailableToWrite(w, r, mCapacityBytes, mCapacityBytesMask);
 	auto cnt2 = w + free_cnt;
 
-	if(cnt2 > mCapacityBytes)
-		return { { mBuffer + w, mCapacityBytes - w }, { mBuffer, cnt2 & mCapacityBytes } };
+	if(cnt2 > mCapacityBytes && !mMirrored)
+		return { { mBuffer + w, mCapacityBytes - w }, { mBuffer, cnt2 & mCapacityBytesMask } };
 	else
 		return { { mBuffer + w, free_cnt }, {} };
-
-	return {};
 }
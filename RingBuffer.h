@@ -6,6 +6,7 @@
 #pragma once
 
 #include <memory>
+#include <atomic>
 
 /*! @file RingBuffer.h @brief A generic ring buffer */
 
@@ -19,6 +20,10 @@ namespace SFB {
 	 * and one writer thread (single producer, single consumer model).
 	 *
 	 * The read and write routines are based on JACK's ringbuffer implementation
+	 *
+	 * The read and write pointers are atomic and kept on separate cache lines.  The reader and writer
+	 * each keep a cached copy of the other's pointer, which is refreshed only when it indicates
+	 * insufficient data or space.
 	 */
 	class RingBuffer
 	{
@@ -58,11 +63,16 @@ namespace SFB {
 
 		/*!
 		 * @brief Allocate space for data.
+		 *
+		 * If \c mirrored is \c true the buffer's memory is mapped twice consecutively, so reads and writes never
+		 * split at the end of the buffer and the read and write vectors each consist of a single region.
+		 * The capacity of a mirrored buffer is at least one virtual memory page.
 		 * @note This method is not thread safe.
 		 * @param byteCount The desired capacity, in bytes
+		 * @param mirrored Whether to allocate mirrored memory
 		 * @return \c true on success, \c false on error
 		 */
-		bool Allocate(size_t byteCount);
+		bool Allocate(size_t byteCount, bool mirrored = false);
 
 		/*!
 		 * @brief Free the resources used by this \c RingBuffer
@@ -81,10 +91,19 @@ namespace SFB {
 		/*! @brief Get the capacity of this RingBuffer in bytes */
 		inline size_t GetCapacityBytes() const						{ return mCapacityBytes; }
 
-		/*! @brief  Get the number of bytes available for reading */
+		/*! @brief Determine whether this \c RingBuffer's memory is mirrored */
+		inline bool IsMirrored() const								{ return mMirrored; }
+
+		/*!
+		 * @brief  Get the number of bytes available for reading
+		 * @note This method is safe to call from any thread
+		 */
 		size_t GetBytesAvailableToRead() const;
 
-		/*! @brief Get the free space available for writing in bytes */
+		/*!
+		 * @brief Get the free space available for writing in bytes
+		 * @note This method is safe to call from any thread
+		 */
 		size_t GetBytesAvailableToWrite() const;
 
 		//@}
@@ -161,9 +180,19 @@ namespace SFB {
 
 		size_t				mCapacityBytes;			/*!< The capacity of \c mBuffer in bytes */
 		size_t				mCapacityBytesMask;		/*!< The capacity of \c mBuffer in bytes minus one */
+		bool				mMirrored;				/*!< Whether \c mBuffer is mapped twice consecutively */
+
+		char				mWriterPadding [64];	/*!< Keeps the writer's state on its own cache line */
+
+		std::atomic_size_t	mWritePointer;			/*!< The offset into \c mBuffer of the write location, stored only by the writer */
+		size_t				mCachedReadPointer;		/*!< The writer's copy of \c mReadPointer */
+
+		char				mReaderPadding [64];	/*!< Keeps the reader's state on its own cache line */
+
+		std::atomic_size_t	mReadPointer;			/*!< The offset into \c mBuffer of the read location, stored only by the reader */
+		mutable size_t		mCachedWritePointer;	/*!< The reader's copy of \c mWritePointer */
 
-		volatile size_t		mWritePointer;			/*!< The offset into \c mBuffer of the read location */
-		volatile size_t		mReadPointer;			/*!< The offset into \c mBuffer of the write location */
+		char				mTrailingPadding [64];	/*!< Keeps the reader's state from sharing a cache line with adjacent objects */
 	};
 
 }
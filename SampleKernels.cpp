@@ -0,0 +1,1534 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if __APPLE__
+# include <sys/sysctl.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define SAMPLE_KERNELS_X86 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+# include <arm_neon.h>
+# define SAMPLE_KERNELS_NEON 1
+#endif
+
+#include "SampleKernels.h"
+#include "Logger.h"
+
+// AVX2 and AVX-512 kernels are compiled for their instruction sets individually and used only when detected
+#if SAMPLE_KERNELS_X86
+# define TARGET_AVX2 __attribute__((target("avx2")))
+# define TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+namespace {
+
+	using SFB::Audio::SampleKernels;
+
+	// Bit reversal lookup table from http://graphics.stanford.edu/~seander/bithacks.html#BitReverseTable
+	const uint8_t sBitReverseTable256 [256] =
+	{
+#   define R2(n)     n,     n + 2*64,     n + 1*64,     n + 3*64
+#   define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#   define R6(n) R4(n), R4(n + 2*4 ), R4(n + 1*4 ), R4(n + 3*4 )
+		R6(0), R6(2), R6(1), R6(3)
+#   undef R6
+#   undef R4
+#   undef R2
+	};
+
+	// Read a packed, native-endian 24-bit sample, sign extended
+	inline int32_t ReadInt24(const uint8_t *sample)
+	{
+#if __BIG_ENDIAN__
+		return (int32_t)(((uint32_t)sample[0] << 24) | ((uint32_t)sample[1] << 16) | ((uint32_t)sample[2] << 8)) >> 8;
+#else
+		return (int32_t)(((uint32_t)sample[2] << 24) | ((uint32_t)sample[1] << 16) | ((uint32_t)sample[0] << 8)) >> 8;
+#endif
+	}
+
+	// Shift a sample left without the undefined behavior of shifting negative values
+	inline int32_t ShiftLeft(int32_t sample, UInt32 shift)
+	{
+		return (int32_t)((uint32_t)sample << shift);
+	}
+
+	// ========================================
+	// Scalar reference kernels
+	void DeinterleaveScalar(const float *input, float * const *outputs, UInt32 channelCount, UInt32 frameCount)
+	{
+		for(UInt32 frame = 0; frame < frameCount; ++frame) {
+			for(UInt32 channel = 0; channel < channelCount; ++channel)
+				outputs[channel][frame] = input[frame * channelCount + channel];
+		}
+	}
+
+	void DeinterleaveBytesScalar(const uint8_t *input, uint8_t * const *outputs, UInt32 channelCount, UInt32 frameCount)
+	{
+		for(UInt32 frame = 0; frame < frameCount; ++frame) {
+			for(UInt32 channel = 0; channel < channelCount; ++channel)
+				outputs[channel][frame] = input[frame * channelCount + channel];
+		}
+	}
+
+	void InterleaveScalar(const float * const *inputs, float *output, UInt32 channelCount, UInt32 frameCount)
+	{
+		for(UInt32 frame = 0; frame < frameCount; ++frame) {
+			for(UInt32 channel = 0; channel < channelCount; ++channel)
+				output[frame * channelCount + channel] = inputs[channel][frame];
+		}
+	}
+
+	void CopyScalar(const float *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count)
+	{
+		if(1 == inputStride && 1 == outputStride) {
+			memcpy(output, input, count * sizeof(float));
+			return;
+		}
+
+		for(UInt32 i = 0; i < count; ++i)
+			output[(size_t)i * outputStride] = input[(size_t)i * inputStride];
+	}
+
+	void ScaleScalar(const float *input, float *output, UInt32 count, float gain)
+	{
+		for(UInt32 i = 0; i < count; ++i)
+			output[i] = input[i] * gain;
+	}
+
+	void MultiplyAddScalar(const float *input, float *output, UInt32 count, float gain)
+	{
+		for(UInt32 i = 0; i < count; ++i)
+			output[i] = output[i] + (input[i] * gain);
+	}
+
+	float MaximumMagnitudeScalar(const float *input, UInt32 count)
+	{
+		float maximum = 0;
+		for(UInt32 i = 0; i < count; ++i)
+			maximum = std::max(maximum, std::fabs(input[i]));
+		return maximum;
+	}
+
+	float SumOfSquaresScalar(const float *input, UInt32 count)
+	{
+		float sum = 0;
+		for(UInt32 i = 0; i < count; ++i)
+			sum += input[i] * input[i];
+		return sum;
+	}
+
+	float DotProductScalar(const float *a, const float *b, UInt32 count)
+	{
+		float sum = 0;
+		for(UInt32 i = 0; i < count; ++i)
+			sum += a[i] * b[i];
+		return sum;
+	}
+
+	// Each output is computed before any input it overwrites is read, so filtering may be performed in place
+	template <SampleKernels::DotProductFunction DotProduct>
+	void FilterKernel(const float *input, UInt32 decimationFactor, const float *filter, UInt32 filterLength, float *output, UInt32 outputCount)
+	{
+		for(UInt32 n = 0; n < outputCount; ++n)
+			output[n] = DotProduct(input + (size_t)n * decimationFactor, filter, filterLength);
+	}
+
+	// Rounding is to nearest even, as performed by the vector conversions
+	void ConvertFloatToIntegerScalar(const float *input, int32_t *output, UInt32 count, UInt32 bitsPerSample)
+	{
+		const float scale = (float)(1 << (bitsPerSample - 1));
+		for(UInt32 i = 0; i < count; ++i)
+			output[i] = (int32_t)std::nearbyint(std::min(std::max(input[i] * scale, -scale), scale - 1));
+	}
+
+	void ConvertInt16ToFloatScalar(const int16_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		for(UInt32 i = 0; i < count; ++i)
+			output[(size_t)i * outputStride] = input[(size_t)i * inputStride] * scale;
+	}
+
+	void ConvertInt24ToFloatScalar(const uint8_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		for(UInt32 i = 0; i < count; ++i)
+			output[(size_t)i * outputStride] = ReadInt24(input + 3 * (size_t)i * inputStride) * scale;
+	}
+
+	void ConvertInt32ToFloatScalar(const int32_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		for(UInt32 i = 0; i < count; ++i)
+			output[(size_t)i * outputStride] = input[(size_t)i * inputStride] * scale;
+	}
+
+	void PackInt8Scalar(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		auto samples = static_cast<int8_t *>(output);
+		for(UInt32 i = 0; i < count; ++i)
+			samples[i] = (int8_t)ShiftLeft(input[(size_t)i * inputStride], shift);
+	}
+
+	void PackInt16Scalar(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		auto samples = static_cast<int16_t *>(output);
+		for(UInt32 i = 0; i < count; ++i)
+			samples[i] = (int16_t)ShiftLeft(input[(size_t)i * inputStride], shift);
+	}
+
+	void PackInt24Scalar(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		auto bytes = static_cast<uint8_t *>(output);
+		for(UInt32 i = 0; i < count; ++i) {
+			uint32_t value = (uint32_t)ShiftLeft(input[(size_t)i * inputStride], shift);
+#if __BIG_ENDIAN__
+			bytes[(3 * i)]		= (uint8_t)((value >> 16) & 0xff);
+			bytes[(3 * i) + 1]	= (uint8_t)((value >> 8) & 0xff);
+			bytes[(3 * i) + 2]	= (uint8_t)(value & 0xff);
+#else
+			bytes[(3 * i)]		= (uint8_t)(value & 0xff);
+			bytes[(3 * i) + 1]	= (uint8_t)((value >> 8) & 0xff);
+			bytes[(3 * i) + 2]	= (uint8_t)((value >> 16) & 0xff);
+#endif
+		}
+	}
+
+	void PackInt32Scalar(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		if(1 == inputStride && 0 == shift) {
+			memcpy(output, input, count * sizeof(int32_t));
+			return;
+		}
+
+		auto samples = static_cast<int32_t *>(output);
+		for(UInt32 i = 0; i < count; ++i)
+			samples[i] = ShiftLeft(input[(size_t)i * inputStride], shift);
+	}
+
+	void ReverseBitsScalar(const uint8_t *input, uint8_t *output, UInt32 count)
+	{
+		for(UInt32 i = 0; i < count; ++i)
+			output[i] = sBitReverseTable256[input[i]];
+	}
+
+	uint8_t PackDoPScalar(uint8_t *buffer, UInt32 dsdOffset, UInt32 frameCount, uint8_t marker, bool reverseBits)
+	{
+		const uint8_t *src = buffer + dsdOffset;
+		uint8_t *dst = buffer;
+
+		while(0 < frameCount--) {
+			uint8_t a = *src++;
+			uint8_t b = *src++;
+
+			*dst++ = marker;
+			*dst++ = reverseBits ? sBitReverseTable256[a] : a;
+			*dst++ = reverseBits ? sBitReverseTable256[b] : b;
+
+			marker = (uint8_t)~marker;
+		}
+
+		return marker;
+	}
+
+	// The DSD translation was modified from dsd2pcm_translate() in dsd2pcm.c:
+
+	/*
+
+	 Copyright 2009, 2011 Sebastian Gesemann. All rights reserved.
+
+	 Redistribution and use in source and binary forms, with or without modification, are
+	 permitted provided that the following conditions are met:
+
+	 1. Redistributions of source code must retain the above copyright notice, this list of
+	 conditions and the following disclaimer.
+
+	 2. Redistributions in binary form must reproduce the above copyright notice, this list
+	 of conditions and the following disclaimer in the documentation and/or other materials
+	 provided with the distribution.
+
+	 THIS SOFTWARE IS PROVIDED BY SEBASTIAN GESEMANN ''AS IS'' AND ANY EXPRESS OR IMPLIED
+	 WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+	 FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL SEBASTIAN GESEMANN OR
+	 CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	 CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	 SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+	 ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+	 NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+	 ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+	 The views and conclusions contained in the software and documentation are those of the
+	 authors and should not be interpreted as representing official policies, either expressed
+	 or implied, of Sebastian Gesemann.
+
+	 */
+
+	// The lookups are dependent loads, which vector units don't accelerate, so this kernel is scalar only
+	void TranslateDSDScalar(const float *tables, SampleKernels::DSDTranslationState& state, const uint8_t *input, bool lsbitfirst, float *output, UInt32 count)
+	{
+		const UInt32 tableCount = SampleKernels::kDSDTableCount;
+		const UInt32 fifoMask = sizeof(state.mFIFO) - 1;
+		static_assert(0 == (sizeof(state.mFIFO) & (sizeof(state.mFIFO) - 1)), "The FIFO size must be a power of two");
+		static_assert(sizeof(state.mFIFO) * 8 >= SampleKernels::kDSDTableCount * 16, "The FIFO is too small");
+
+		UInt32 position = state.mFIFOPosition;
+		for(UInt32 n = 0; n < count; ++n) {
+			state.mFIFO[position] = lsbitfirst ? sBitReverseTable256[input[n]] : input[n];
+
+			// The second half of the symmetric filter is applied to bit-reversed bytes
+			uint8_t *byte = state.mFIFO + ((position - tableCount) & fifoMask);
+			*byte = sBitReverseTable256[*byte];
+
+			float sum = 0;
+			for(UInt32 i = 0; i < tableCount; ++i) {
+				uint8_t a = state.mFIFO[(position - i) & fifoMask];
+				uint8_t b = state.mFIFO[(position - (tableCount * 2 - 1) + i) & fifoMask];
+				sum += tables[i * 256 + a] + tables[i * 256 + b];
+			}
+
+			output[n] = sum;
+			position = (position + 1) & fifoMask;
+		}
+
+		state.mFIFOPosition = position;
+	}
+
+#if SAMPLE_KERNELS_X86 && __SSE2__
+
+	// ========================================
+	// SSE2 kernels
+	void DeinterleaveSSE2(const float *input, float * const *outputs, UInt32 channelCount, UInt32 frameCount)
+	{
+		if(2 != channelCount) {
+			DeinterleaveScalar(input, outputs, channelCount, frameCount);
+			return;
+		}
+
+		float *left = outputs[0];
+		float *right = outputs[1];
+
+		UInt32 frame = 0;
+		for(; frame + 4 <= frameCount; frame += 4) {
+			const __m128 a = _mm_loadu_ps(input + 2 * frame);
+			const __m128 b = _mm_loadu_ps(input + 2 * frame + 4);
+			_mm_storeu_ps(left + frame, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(right + frame, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+
+		for(; frame < frameCount; ++frame) {
+			left[frame] = input[2 * frame];
+			right[frame] = input[2 * frame + 1];
+		}
+	}
+
+	void InterleaveSSE2(const float * const *inputs, float *output, UInt32 channelCount, UInt32 frameCount)
+	{
+		if(2 != channelCount) {
+			InterleaveScalar(inputs, output, channelCount, frameCount);
+			return;
+		}
+
+		const float *left = inputs[0];
+		const float *right = inputs[1];
+
+		UInt32 frame = 0;
+		for(; frame + 4 <= frameCount; frame += 4) {
+			const __m128 l = _mm_loadu_ps(left + frame);
+			const __m128 r = _mm_loadu_ps(right + frame);
+			_mm_storeu_ps(output + 2 * frame, _mm_unpacklo_ps(l, r));
+			_mm_storeu_ps(output + 2 * frame + 4, _mm_unpackhi_ps(l, r));
+		}
+
+		for(; frame < frameCount; ++frame) {
+			output[2 * frame] = left[frame];
+			output[2 * frame + 1] = right[frame];
+		}
+	}
+
+	void ScaleSSE2(const float *input, float *output, UInt32 count, float gain)
+	{
+		const __m128 g = _mm_set1_ps(gain);
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			_mm_storeu_ps(output + i, _mm_mul_ps(_mm_loadu_ps(input + i), g));
+
+		ScaleScalar(input + i, output + i, count - i, gain);
+	}
+
+	float MaximumMagnitudeSSE2(const float *input, UInt32 count)
+	{
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		__m128 maximum = _mm_setzero_ps();
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			maximum = _mm_max_ps(maximum, _mm_and_ps(_mm_loadu_ps(input + i), absMask));
+
+		maximum = _mm_max_ps(maximum, _mm_shuffle_ps(maximum, maximum, _MM_SHUFFLE(1, 0, 3, 2)));
+		maximum = _mm_max_ps(maximum, _mm_shuffle_ps(maximum, maximum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+		return std::max(_mm_cvtss_f32(maximum), MaximumMagnitudeScalar(input + i, count - i));
+	}
+
+	void ConvertFloatToIntegerSSE2(const float *input, int32_t *output, UInt32 count, UInt32 bitsPerSample)
+	{
+		const float scale = (float)(1 << (bitsPerSample - 1));
+		const __m128 s = _mm_set1_ps(scale);
+		const __m128 minimum = _mm_set1_ps(-scale);
+		const __m128 maximum = _mm_set1_ps(scale - 1);
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4) {
+			const __m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(input + i), s), minimum), maximum);
+			_mm_storeu_si128((__m128i *)(output + i), _mm_cvtps_epi32(v));
+		}
+
+		ConvertFloatToIntegerScalar(input + i, output + i, count - i, bitsPerSample);
+	}
+
+	void ConvertInt16ToFloatSSE2(const int16_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		if(1 != inputStride || 1 != outputStride) {
+			ConvertInt16ToFloatScalar(input, inputStride, output, outputStride, count, scale);
+			return;
+		}
+
+		const __m128 s = _mm_set1_ps(scale);
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8) {
+			const __m128i v = _mm_loadu_si128((const __m128i *)(input + i));
+			// Sign extend by placing each sample in the high half of a 32-bit lane and shifting
+			const __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+			const __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+			_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(low), s));
+			_mm_storeu_ps(output + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), s));
+		}
+
+		ConvertInt16ToFloatScalar(input + i, 1, output + i, 1, count - i, scale);
+	}
+
+	void DeinterleaveBytesSSE2(const uint8_t *input, uint8_t * const *outputs, UInt32 channelCount, UInt32 frameCount)
+	{
+		if(2 != channelCount) {
+			DeinterleaveBytesScalar(input, outputs, channelCount, frameCount);
+			return;
+		}
+
+		uint8_t *left = outputs[0];
+		uint8_t *right = outputs[1];
+
+		// The even and odd bytes are isolated in 16-bit lanes and packed
+		const __m128i lowMask = _mm_set1_epi16(0x00ff);
+
+		UInt32 frame = 0;
+		for(; frame + 16 <= frameCount; frame += 16) {
+			const __m128i a = _mm_loadu_si128((const __m128i *)(input + 2 * frame));
+			const __m128i b = _mm_loadu_si128((const __m128i *)(input + 2 * frame + 16));
+			_mm_storeu_si128((__m128i *)(left + frame), _mm_packus_epi16(_mm_and_si128(a, lowMask), _mm_and_si128(b, lowMask)));
+			_mm_storeu_si128((__m128i *)(right + frame), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+		}
+
+		for(; frame < frameCount; ++frame) {
+			left[frame] = input[2 * frame];
+			right[frame] = input[2 * frame + 1];
+		}
+	}
+
+	inline float HorizontalSumSSE2(__m128 v)
+	{
+		v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 1)));
+		return _mm_cvtss_f32(v);
+	}
+
+	void MultiplyAddSSE2(const float *input, float *output, UInt32 count, float gain)
+	{
+		const __m128 g = _mm_set1_ps(gain);
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			_mm_storeu_ps(output + i, _mm_add_ps(_mm_loadu_ps(output + i), _mm_mul_ps(_mm_loadu_ps(input + i), g)));
+
+		MultiplyAddScalar(input + i, output + i, count - i, gain);
+	}
+
+	float SumOfSquaresSSE2(const float *input, UInt32 count)
+	{
+		__m128 sum = _mm_setzero_ps();
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4) {
+			const __m128 v = _mm_loadu_ps(input + i);
+			sum = _mm_add_ps(sum, _mm_mul_ps(v, v));
+		}
+
+		return HorizontalSumSSE2(sum) + SumOfSquaresScalar(input + i, count - i);
+	}
+
+	float DotProductSSE2(const float *a, const float *b, UInt32 count)
+	{
+		__m128 sum = _mm_setzero_ps();
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+
+		return HorizontalSumSSE2(sum) + DotProductScalar(a + i, b + i, count - i);
+	}
+
+	void ConvertInt32ToFloatSSE2(const int32_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		if(1 != inputStride || 1 != outputStride) {
+			ConvertInt32ToFloatScalar(input, inputStride, output, outputStride, count, scale);
+			return;
+		}
+
+		const __m128 s = _mm_set1_ps(scale);
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(input + i))), s));
+
+		ConvertInt32ToFloatScalar(input + i, 1, output + i, 1, count - i, scale);
+	}
+
+	// The saturating packs truncate the samples after they are sign extended from the output width
+	void PackInt8SSE2(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		if(1 != inputStride) {
+			PackInt8Scalar(input, inputStride, output, count, shift);
+			return;
+		}
+
+		auto samples = static_cast<int8_t *>(output);
+		const __m128i s = _mm_cvtsi32_si128((int)shift);
+
+		UInt32 i = 0;
+		for(; i + 16 <= count; i += 16) {
+			__m128i v [4];
+			for(int j = 0; j < 4; ++j) {
+				v[j] = _mm_sll_epi32(_mm_loadu_si128((const __m128i *)(input + i + 4 * j)), s);
+				v[j] = _mm_srai_epi32(_mm_slli_epi32(v[j], 24), 24);
+			}
+			_mm_storeu_si128((__m128i *)(samples + i), _mm_packs_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3])));
+		}
+
+		PackInt8Scalar(input + i, 1, samples + i, count - i, shift);
+	}
+
+	void PackInt16SSE2(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		if(1 != inputStride) {
+			PackInt16Scalar(input, inputStride, output, count, shift);
+			return;
+		}
+
+		auto samples = static_cast<int16_t *>(output);
+		const __m128i s = _mm_cvtsi32_si128((int)shift);
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8) {
+			__m128i a = _mm_sll_epi32(_mm_loadu_si128((const __m128i *)(input + i)), s);
+			__m128i b = _mm_sll_epi32(_mm_loadu_si128((const __m128i *)(input + i + 4)), s);
+			a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+			b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+			_mm_storeu_si128((__m128i *)(samples + i), _mm_packs_epi32(a, b));
+		}
+
+		PackInt16Scalar(input + i, 1, samples + i, count - i, shift);
+	}
+
+	void PackInt32SSE2(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		if(1 != inputStride || 0 == shift) {
+			PackInt32Scalar(input, inputStride, output, count, shift);
+			return;
+		}
+
+		auto samples = static_cast<int32_t *>(output);
+		const __m128i s = _mm_cvtsi32_si128((int)shift);
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			_mm_storeu_si128((__m128i *)(samples + i), _mm_sll_epi32(_mm_loadu_si128((const __m128i *)(input + i)), s));
+
+		PackInt32Scalar(input + i, 1, samples + i, count - i, shift);
+	}
+
+#endif
+
+#if SAMPLE_KERNELS_X86
+
+	// ========================================
+	// AVX2 kernels
+	TARGET_AVX2 void DeinterleaveAVX2(const float *input, float * const *outputs, UInt32 channelCount, UInt32 frameCount)
+	{
+		if(2 != channelCount) {
+			DeinterleaveScalar(input, outputs, channelCount, frameCount);
+			return;
+		}
+
+		float *left = outputs[0];
+		float *right = outputs[1];
+
+		UInt32 frame = 0;
+		for(; frame + 8 <= frameCount; frame += 8) {
+			const __m256 a = _mm256_loadu_ps(input + 2 * frame);
+			const __m256 b = _mm256_loadu_ps(input + 2 * frame + 8);
+			// Shuffles are within 128-bit lanes, so the 64-bit halves are reordered afterward
+			const __m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			const __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			_mm256_storeu_ps(left + frame, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(l), _MM_SHUFFLE(3, 1, 2, 0))));
+			_mm256_storeu_ps(right + frame, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), _MM_SHUFFLE(3, 1, 2, 0))));
+		}
+
+		for(; frame < frameCount; ++frame) {
+			left[frame] = input[2 * frame];
+			right[frame] = input[2 * frame + 1];
+		}
+	}
+
+	TARGET_AVX2 void InterleaveAVX2(const float * const *inputs, float *output, UInt32 channelCount, UInt32 frameCount)
+	{
+		if(2 != channelCount) {
+			InterleaveScalar(inputs, output, channelCount, frameCount);
+			return;
+		}
+
+		const float *left = inputs[0];
+		const float *right = inputs[1];
+
+		UInt32 frame = 0;
+		for(; frame + 8 <= frameCount; frame += 8) {
+			const __m256 l = _mm256_loadu_ps(left + frame);
+			const __m256 r = _mm256_loadu_ps(right + frame);
+			const __m256 low = _mm256_unpacklo_ps(l, r);
+			const __m256 high = _mm256_unpackhi_ps(l, r);
+			_mm256_storeu_ps(output + 2 * frame, _mm256_permute2f128_ps(low, high, 0x20));
+			_mm256_storeu_ps(output + 2 * frame + 8, _mm256_permute2f128_ps(low, high, 0x31));
+		}
+
+		for(; frame < frameCount; ++frame) {
+			output[2 * frame] = left[frame];
+			output[2 * frame + 1] = right[frame];
+		}
+	}
+
+	TARGET_AVX2 void ScaleAVX2(const float *input, float *output, UInt32 count, float gain)
+	{
+		const __m256 g = _mm256_set1_ps(gain);
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8)
+			_mm256_storeu_ps(output + i, _mm256_mul_ps(_mm256_loadu_ps(input + i), g));
+
+		ScaleScalar(input + i, output + i, count - i, gain);
+	}
+
+	TARGET_AVX2 float MaximumMagnitudeAVX2(const float *input, UInt32 count)
+	{
+		const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+		__m256 maximum = _mm256_setzero_ps();
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8)
+			maximum = _mm256_max_ps(maximum, _mm256_and_ps(_mm256_loadu_ps(input + i), absMask));
+
+		__m128 m = _mm_max_ps(_mm256_castps256_ps128(maximum), _mm256_extractf128_ps(maximum, 1));
+		m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+		m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+
+		return std::max(_mm_cvtss_f32(m), MaximumMagnitudeScalar(input + i, count - i));
+	}
+
+	TARGET_AVX2 void ConvertFloatToIntegerAVX2(const float *input, int32_t *output, UInt32 count, UInt32 bitsPerSample)
+	{
+		const float scale = (float)(1 << (bitsPerSample - 1));
+		const __m256 s = _mm256_set1_ps(scale);
+		const __m256 minimum = _mm256_set1_ps(-scale);
+		const __m256 maximum = _mm256_set1_ps(scale - 1);
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8) {
+			const __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(input + i), s), minimum), maximum);
+			_mm256_storeu_si256((__m256i *)(output + i), _mm256_cvtps_epi32(v));
+		}
+
+		ConvertFloatToIntegerScalar(input + i, output + i, count - i, bitsPerSample);
+	}
+
+	TARGET_AVX2 void ConvertInt16ToFloatAVX2(const int16_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		if(1 != inputStride || 1 != outputStride) {
+			ConvertInt16ToFloatScalar(input, inputStride, output, outputStride, count, scale);
+			return;
+		}
+
+		const __m256 s = _mm256_set1_ps(scale);
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8) {
+			const __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(input + i)));
+			_mm256_storeu_ps(output + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), s));
+		}
+
+		ConvertInt16ToFloatScalar(input + i, 1, output + i, 1, count - i, scale);
+	}
+
+	TARGET_AVX2 inline float HorizontalSumAVX2(__m256 v)
+	{
+		__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(0, 0, 0, 1)));
+		return _mm_cvtss_f32(sum);
+	}
+
+	TARGET_AVX2 void MultiplyAddAVX2(const float *input, float *output, UInt32 count, float gain)
+	{
+		const __m256 g = _mm256_set1_ps(gain);
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8)
+			_mm256_storeu_ps(output + i, _mm256_add_ps(_mm256_loadu_ps(output + i), _mm256_mul_ps(_mm256_loadu_ps(input + i), g)));
+
+		MultiplyAddScalar(input + i, output + i, count - i, gain);
+	}
+
+	TARGET_AVX2 float SumOfSquaresAVX2(const float *input, UInt32 count)
+	{
+		__m256 sum = _mm256_setzero_ps();
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8) {
+			const __m256 v = _mm256_loadu_ps(input + i);
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(v, v));
+		}
+
+		return HorizontalSumAVX2(sum) + SumOfSquaresScalar(input + i, count - i);
+	}
+
+	TARGET_AVX2 float DotProductAVX2(const float *a, const float *b, UInt32 count)
+	{
+		__m256 sum = _mm256_setzero_ps();
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8)
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+
+		return HorizontalSumAVX2(sum) + DotProductScalar(a + i, b + i, count - i);
+	}
+
+	// Each 128-bit lane holds four samples, which are moved to the high three bytes of 32-bit lanes and shifted to sign extend them
+	TARGET_AVX2 void ConvertInt24ToFloatAVX2(const uint8_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		if(1 != inputStride || 1 != outputStride) {
+			ConvertInt24ToFloatScalar(input, inputStride, output, outputStride, count, scale);
+			return;
+		}
+
+		const __m256i shuffle = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11));
+		const __m256 s = _mm256_set1_ps(scale);
+
+		// The upper lane's load extends 4 bytes past the samples converted
+		UInt32 i = 0;
+		for(; i + 10 <= count; i += 8) {
+			const uint8_t *bytes = input + 3 * i;
+			const __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)bytes)), _mm_loadu_si128((const __m128i *)(bytes + 12)), 1);
+			const __m256i samples = _mm256_srai_epi32(_mm256_shuffle_epi8(v, shuffle), 8);
+			_mm256_storeu_ps(output + i, _mm256_mul_ps(_mm256_cvtepi32_ps(samples), s));
+		}
+
+		ConvertInt24ToFloatScalar(input + 3 * i, 1, output + i, 1, count - i, scale);
+	}
+
+	TARGET_AVX2 void ConvertInt32ToFloatAVX2(const int32_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		if(1 != inputStride || 1 != outputStride) {
+			ConvertInt32ToFloatScalar(input, inputStride, output, outputStride, count, scale);
+			return;
+		}
+
+		const __m256 s = _mm256_set1_ps(scale);
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8)
+			_mm256_storeu_ps(output + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(input + i))), s));
+
+		ConvertInt32ToFloatScalar(input + i, 1, output + i, 1, count - i, scale);
+	}
+
+	TARGET_AVX2 void PackInt16AVX2(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		if(1 != inputStride) {
+			PackInt16Scalar(input, inputStride, output, count, shift);
+			return;
+		}
+
+		auto samples = static_cast<int16_t *>(output);
+		const __m128i s = _mm_cvtsi32_si128((int)shift);
+
+		UInt32 i = 0;
+		for(; i + 16 <= count; i += 16) {
+			__m256i a = _mm256_sll_epi32(_mm256_loadu_si256((const __m256i *)(input + i)), s);
+			__m256i b = _mm256_sll_epi32(_mm256_loadu_si256((const __m256i *)(input + i + 8)), s);
+			a = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+			b = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+			// The pack is within 128-bit lanes, so the 64-bit quarters are reordered afterward
+			_mm256_storeu_si256((__m256i *)(samples + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+		}
+
+		PackInt16Scalar(input + i, 1, samples + i, count - i, shift);
+	}
+
+	// The most significant byte of each sample is dropped with a byte shuffle, available since SSSE3
+	TARGET_AVX2 void PackInt24AVX2(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		if(1 != inputStride) {
+			PackInt24Scalar(input, inputStride, output, count, shift);
+			return;
+		}
+
+		auto bytes = static_cast<uint8_t *>(output);
+		const __m128i s = _mm_cvtsi32_si128((int)shift);
+		const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+		// Each store extends 4 bytes past the samples packed, which are overwritten by the following store
+		UInt32 i = 0;
+		for(; i + 6 <= count; i += 4) {
+			const __m128i v = _mm_sll_epi32(_mm_loadu_si128((const __m128i *)(input + i)), s);
+			_mm_storeu_si128((__m128i *)(bytes + 3 * i), _mm_shuffle_epi8(v, shuffle));
+		}
+
+		PackInt24Scalar(input + i, 1, bytes + 3 * i, count - i, shift);
+	}
+
+	TARGET_AVX2 void PackInt32AVX2(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		if(1 != inputStride || 0 == shift) {
+			PackInt32Scalar(input, inputStride, output, count, shift);
+			return;
+		}
+
+		auto samples = static_cast<int32_t *>(output);
+		const __m128i s = _mm_cvtsi32_si128((int)shift);
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8)
+			_mm256_storeu_si256((__m256i *)(samples + i), _mm256_sll_epi32(_mm256_loadu_si256((const __m256i *)(input + i)), s));
+
+		PackInt32Scalar(input + i, 1, samples + i, count - i, shift);
+	}
+
+	// Bit reversal using a lookup of each nibble
+	TARGET_AVX2 inline __m128i ReverseBits128(__m128i v)
+	{
+		const __m128i nibbleMask	= _mm_set1_epi8(0x0f);
+		const __m128i reverseLow	= _mm_setr_epi8(0x00, (char)0x80, 0x40, (char)0xc0, 0x20, (char)0xa0, 0x60, (char)0xe0, 0x10, (char)0x90, 0x50, (char)0xd0, 0x30, (char)0xb0, 0x70, (char)0xf0);
+		const __m128i reverseHigh	= _mm_setr_epi8(0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf);
+
+		const __m128i low = _mm_and_si128(v, nibbleMask);
+		const __m128i high = _mm_and_si128(_mm_srli_epi16(v, 4), nibbleMask);
+		return _mm_or_si128(_mm_shuffle_epi8(reverseLow, low), _mm_shuffle_epi8(reverseHigh, high));
+	}
+
+	TARGET_AVX2 void ReverseBitsAVX2(const uint8_t *input, uint8_t *output, UInt32 count)
+	{
+		UInt32 i = 0;
+		for(; i + 16 <= count; i += 16)
+			_mm_storeu_si128((__m128i *)(output + i), ReverseBits128(_mm_loadu_si128((const __m128i *)(input + i))));
+
+		ReverseBitsScalar(input + i, output + i, count - i);
+	}
+
+	TARGET_AVX2 uint8_t PackDoPAVX2(uint8_t *buffer, UInt32 dsdOffset, UInt32 frameCount, uint8_t marker, bool reverseBits)
+	{
+		const uint8_t *src = buffer + dsdOffset;
+		uint8_t *dst = buffer;
+		UInt32 framesRemaining = frameCount;
+
+		// The marker alternates each frame, so for an even number of frames the pattern is fixed
+		const uint8_t m0 = marker, m1 = (uint8_t)~marker;
+		const __m128i markersLow	= _mm_setr_epi8((char)m0, 0, 0, (char)m1, 0, 0, (char)m0, 0, 0, (char)m1, 0, 0, (char)m0, 0, 0, (char)m1);
+		const __m128i markersHigh	= _mm_setr_epi8(0, 0, (char)m0, 0, 0, (char)m1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+		// Shuffles distributing the DSD bytes of eight DoP frames across 24 output bytes, leaving room for the markers
+		const __m128i shuffleLow	= _mm_setr_epi8(-1, 0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1);
+		const __m128i shuffleHigh	= _mm_setr_epi8(10, 11, -1, 12, 13, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+
+		while(8 <= framesRemaining) {
+			__m128i dsd = _mm_loadu_si128((const __m128i *)src);
+			if(reverseBits)
+				dsd = ReverseBits128(dsd);
+
+			_mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_shuffle_epi8(dsd, shuffleLow), markersLow));
+			_mm_storel_epi64((__m128i *)(dst + 16), _mm_or_si128(_mm_shuffle_epi8(dsd, shuffleHigh), markersHigh));
+
+			src += 16;
+			dst += 24;
+			framesRemaining -= 8;
+		}
+
+		return PackDoPScalar(dst, (UInt32)(src - dst), framesRemaining, marker, reverseBits);
+	}
+
+	// ========================================
+	// AVX-512 kernels
+	TARGET_AVX512 void ScaleAVX512(const float *input, float *output, UInt32 count, float gain)
+	{
+		const __m512 g = _mm512_set1_ps(gain);
+
+		UInt32 i = 0;
+		for(; i + 16 <= count; i += 16)
+			_mm512_storeu_ps(output + i, _mm512_mul_ps(_mm512_loadu_ps(input + i), g));
+
+		ScaleScalar(input + i, output + i, count - i, gain);
+	}
+
+	TARGET_AVX512 float MaximumMagnitudeAVX512(const float *input, UInt32 count)
+	{
+		__m512 maximum = _mm512_setzero_ps();
+
+		UInt32 i = 0;
+		for(; i + 16 <= count; i += 16)
+			maximum = _mm512_max_ps(maximum, _mm512_abs_ps(_mm512_loadu_ps(input + i)));
+
+		return std::max(_mm512_reduce_max_ps(maximum), MaximumMagnitudeScalar(input + i, count - i));
+	}
+
+	TARGET_AVX512 void ConvertFloatToIntegerAVX512(const float *input, int32_t *output, UInt32 count, UInt32 bitsPerSample)
+	{
+		const float scale = (float)(1 << (bitsPerSample - 1));
+		const __m512 s = _mm512_set1_ps(scale);
+		const __m512 minimum = _mm512_set1_ps(-scale);
+		const __m512 maximum = _mm512_set1_ps(scale - 1);
+
+		UInt32 i = 0;
+		for(; i + 16 <= count; i += 16) {
+			const __m512 v = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(input + i), s), minimum), maximum);
+			_mm512_storeu_si512((void *)(output + i), _mm512_cvtps_epi32(v));
+		}
+
+		ConvertFloatToIntegerScalar(input + i, output + i, count - i, bitsPerSample);
+	}
+
+	TARGET_AVX512 void ConvertInt16ToFloatAVX512(const int16_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		if(1 != inputStride || 1 != outputStride) {
+			ConvertInt16ToFloatScalar(input, inputStride, output, outputStride, count, scale);
+			return;
+		}
+
+		const __m512 s = _mm512_set1_ps(scale);
+
+		UInt32 i = 0;
+		for(; i + 16 <= count; i += 16) {
+			const __m512i v = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)(input + i)));
+			_mm512_storeu_ps(output + i, _mm512_mul_ps(_mm512_cvtepi32_ps(v), s));
+		}
+
+		ConvertInt16ToFloatScalar(input + i, 1, output + i, 1, count - i, scale);
+	}
+
+	TARGET_AVX512 void MultiplyAddAVX512(const float *input, float *output, UInt32 count, float gain)
+	{
+		const __m512 g = _mm512_set1_ps(gain);
+
+		UInt32 i = 0;
+		for(; i + 16 <= count; i += 16)
+			_mm512_storeu_ps(output + i, _mm512_add_ps(_mm512_loadu_ps(output + i), _mm512_mul_ps(_mm512_loadu_ps(input + i), g)));
+
+		MultiplyAddScalar(input + i, output + i, count - i, gain);
+	}
+
+	TARGET_AVX512 float SumOfSquaresAVX512(const float *input, UInt32 count)
+	{
+		__m512 sum = _mm512_setzero_ps();
+
+		UInt32 i = 0;
+		for(; i + 16 <= count; i += 16) {
+			const __m512 v = _mm512_loadu_ps(input + i);
+			sum = _mm512_add_ps(sum, _mm512_mul_ps(v, v));
+		}
+
+		return _mm512_reduce_add_ps(sum) + SumOfSquaresScalar(input + i, count - i);
+	}
+
+	TARGET_AVX512 float DotProductAVX512(const float *a, const float *b, UInt32 count)
+	{
+		__m512 sum = _mm512_setzero_ps();
+
+		UInt32 i = 0;
+		for(; i + 16 <= count; i += 16)
+			sum = _mm512_add_ps(sum, _mm512_mul_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+
+		return _mm512_reduce_add_ps(sum) + DotProductScalar(a + i, b + i, count - i);
+	}
+
+	TARGET_AVX512 void ConvertInt32ToFloatAVX512(const int32_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		if(1 != inputStride || 1 != outputStride) {
+			ConvertInt32ToFloatScalar(input, inputStride, output, outputStride, count, scale);
+			return;
+		}
+
+		const __m512 s = _mm512_set1_ps(scale);
+
+		UInt32 i = 0;
+		for(; i + 16 <= count; i += 16)
+			_mm512_storeu_ps(output + i, _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_loadu_si512((const void *)(input + i))), s));
+
+		ConvertInt32ToFloatScalar(input + i, 1, output + i, 1, count - i, scale);
+	}
+
+	// ========================================
+	// Processor features
+	struct ProcessorFeatures
+	{
+		ProcessorFeatures()
+		{
+#if __APPLE__
+			// The kernel enables AVX-512 state on first use, so CPUID alone doesn't indicate availability
+			mAVX2 = IsSysctlFeatureAvailable("hw.optional.avx2_0");
+			mAVX512 = IsSysctlFeatureAvailable("hw.optional.avx512f");
+#else
+			__builtin_cpu_init();
+			mAVX2 = __builtin_cpu_supports("avx2");
+			mAVX512 = __builtin_cpu_supports("avx512f");
+#endif
+		}
+
+#if __APPLE__
+		static bool IsSysctlFeatureAvailable(const char *name)
+		{
+			int value = 0;
+			size_t size = sizeof(value);
+			return 0 == sysctlbyname(name, &value, &size, nullptr, 0) && 0 != value;
+		}
+#endif
+
+		bool mAVX2;
+		bool mAVX512;
+	};
+
+	const ProcessorFeatures& GetProcessorFeatures()
+	{
+		static const ProcessorFeatures sProcessorFeatures;
+		return sProcessorFeatures;
+	}
+
+#elif SAMPLE_KERNELS_NEON
+
+	// ========================================
+	// NEON kernels
+	void DeinterleaveNEON(const float *input, float * const *outputs, UInt32 channelCount, UInt32 frameCount)
+	{
+		if(2 != channelCount) {
+			DeinterleaveScalar(input, outputs, channelCount, frameCount);
+			return;
+		}
+
+		float *left = outputs[0];
+		float *right = outputs[1];
+
+		UInt32 frame = 0;
+		for(; frame + 4 <= frameCount; frame += 4) {
+			const float32x4x2_t v = vld2q_f32(input + 2 * frame);
+			vst1q_f32(left + frame, v.val[0]);
+			vst1q_f32(right + frame, v.val[1]);
+		}
+
+		for(; frame < frameCount; ++frame) {
+			left[frame] = input[2 * frame];
+			right[frame] = input[2 * frame + 1];
+		}
+	}
+
+	void InterleaveNEON(const float * const *inputs, float *output, UInt32 channelCount, UInt32 frameCount)
+	{
+		if(2 != channelCount) {
+			InterleaveScalar(inputs, output, channelCount, frameCount);
+			return;
+		}
+
+		const float *left = inputs[0];
+		const float *right = inputs[1];
+
+		UInt32 frame = 0;
+		for(; frame + 4 <= frameCount; frame += 4) {
+			float32x4x2_t v;
+			v.val[0] = vld1q_f32(left + frame);
+			v.val[1] = vld1q_f32(right + frame);
+			vst2q_f32(output + 2 * frame, v);
+		}
+
+		for(; frame < frameCount; ++frame) {
+			output[2 * frame] = left[frame];
+			output[2 * frame + 1] = right[frame];
+		}
+	}
+
+	void ScaleNEON(const float *input, float *output, UInt32 count, float gain)
+	{
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			vst1q_f32(output + i, vmulq_n_f32(vld1q_f32(input + i), gain));
+
+		ScaleScalar(input + i, output + i, count - i, gain);
+	}
+
+	float MaximumMagnitudeNEON(const float *input, UInt32 count)
+	{
+		float32x4_t maximum = vdupq_n_f32(0);
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			maximum = vmaxq_f32(maximum, vabsq_f32(vld1q_f32(input + i)));
+
+		return std::max(vmaxvq_f32(maximum), MaximumMagnitudeScalar(input + i, count - i));
+	}
+
+	void ConvertFloatToIntegerNEON(const float *input, int32_t *output, UInt32 count, UInt32 bitsPerSample)
+	{
+		const float scale = (float)(1 << (bitsPerSample - 1));
+		const float32x4_t minimum = vdupq_n_f32(-scale);
+		const float32x4_t maximum = vdupq_n_f32(scale - 1);
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4) {
+			const float32x4_t v = vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(input + i), scale), minimum), maximum);
+			vst1q_s32(output + i, vcvtnq_s32_f32(v));
+		}
+
+		ConvertFloatToIntegerScalar(input + i, output + i, count - i, bitsPerSample);
+	}
+
+	void ConvertInt16ToFloatNEON(const int16_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		if(1 != inputStride || 1 != outputStride) {
+			ConvertInt16ToFloatScalar(input, inputStride, output, outputStride, count, scale);
+			return;
+		}
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8) {
+			const int16x8_t v = vld1q_s16(input + i);
+			vst1q_f32(output + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+			vst1q_f32(output + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+		}
+
+		ConvertInt16ToFloatScalar(input + i, 1, output + i, 1, count - i, scale);
+	}
+
+	void DeinterleaveBytesNEON(const uint8_t *input, uint8_t * const *outputs, UInt32 channelCount, UInt32 frameCount)
+	{
+		if(2 != channelCount) {
+			DeinterleaveBytesScalar(input, outputs, channelCount, frameCount);
+			return;
+		}
+
+		uint8_t *left = outputs[0];
+		uint8_t *right = outputs[1];
+
+		UInt32 frame = 0;
+		for(; frame + 16 <= frameCount; frame += 16) {
+			const uint8x16x2_t v = vld2q_u8(input + 2 * frame);
+			vst1q_u8(left + frame, v.val[0]);
+			vst1q_u8(right + frame, v.val[1]);
+		}
+
+		for(; frame < frameCount; ++frame) {
+			left[frame] = input[2 * frame];
+			right[frame] = input[2 * frame + 1];
+		}
+	}
+
+	void MultiplyAddNEON(const float *input, float *output, UInt32 count, float gain)
+	{
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			vst1q_f32(output + i, vaddq_f32(vld1q_f32(output + i), vmulq_n_f32(vld1q_f32(input + i), gain)));
+
+		MultiplyAddScalar(input + i, output + i, count - i, gain);
+	}
+
+	float SumOfSquaresNEON(const float *input, UInt32 count)
+	{
+		float32x4_t sum = vdupq_n_f32(0);
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4) {
+			const float32x4_t v = vld1q_f32(input + i);
+			sum = vfmaq_f32(sum, v, v);
+		}
+
+		return vaddvq_f32(sum) + SumOfSquaresScalar(input + i, count - i);
+	}
+
+	float DotProductNEON(const float *a, const float *b, UInt32 count)
+	{
+		float32x4_t sum = vdupq_n_f32(0);
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			sum = vfmaq_f32(sum, vld1q_f32(a + i), vld1q_f32(b + i));
+
+		return vaddvq_f32(sum) + DotProductScalar(a + i, b + i, count - i);
+	}
+
+	// Four samples are moved to the high three bytes of 32-bit lanes and shifted to sign extend them
+	void ConvertInt24ToFloatNEON(const uint8_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		if(1 != inputStride || 1 != outputStride) {
+			ConvertInt24ToFloatScalar(input, inputStride, output, outputStride, count, scale);
+			return;
+		}
+
+		static const uint8_t sShuffle [16] = { 0xff, 0, 1, 2, 0xff, 3, 4, 5, 0xff, 6, 7, 8, 0xff, 9, 10, 11 };
+		const uint8x16_t shuffle = vld1q_u8(sShuffle);
+
+		// Each load extends 4 bytes past the samples converted
+		UInt32 i = 0;
+		for(; i + 6 <= count; i += 4) {
+			const int32x4_t samples = vshrq_n_s32(vreinterpretq_s32_u8(vqtbl1q_u8(vld1q_u8(input + 3 * i), shuffle)), 8);
+			vst1q_f32(output + i, vmulq_n_f32(vcvtq_f32_s32(samples), scale));
+		}
+
+		ConvertInt24ToFloatScalar(input + 3 * i, 1, output + i, 1, count - i, scale);
+	}
+
+	void ConvertInt32ToFloatNEON(const int32_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale)
+	{
+		if(1 != inputStride || 1 != outputStride) {
+			ConvertInt32ToFloatScalar(input, inputStride, output, outputStride, count, scale);
+			return;
+		}
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			vst1q_f32(output + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(input + i)), scale));
+
+		ConvertInt32ToFloatScalar(input + i, 1, output + i, 1, count - i, scale);
+	}
+
+	void PackInt8NEON(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		if(1 != inputStride) {
+			PackInt8Scalar(input, inputStride, output, count, shift);
+			return;
+		}
+
+		auto samples = static_cast<int8_t *>(output);
+		const int32x4_t s = vdupq_n_s32((int32_t)shift);
+
+		UInt32 i = 0;
+		for(; i + 8 <= count; i += 8) {
+			const int16x4_t low = vmovn_s32(vshlq_s32(vld1q_s32(input + i), s));
+			const int16x4_t high = vmovn_s32(vshlq_s32(vld1q_s32(input + i + 4), s));
+			vst1_s8(samples + i, vmovn_s16(vcombine_s16(low, high)));
+		}
+
+		PackInt8Scalar(input + i, 1, samples + i, count - i, shift);
+	}
+
+	void PackInt16NEON(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		if(1 != inputStride) {
+			PackInt16Scalar(input, inputStride, output, count, shift);
+			return;
+		}
+
+		auto samples = static_cast<int16_t *>(output);
+		const int32x4_t s = vdupq_n_s32((int32_t)shift);
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			vst1_s16(samples + i, vmovn_s32(vshlq_s32(vld1q_s32(input + i), s)));
+
+		PackInt16Scalar(input + i, 1, samples + i, count - i, shift);
+	}
+
+	// The most significant byte of each sample is dropped with a table lookup
+	void PackInt24NEON(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		if(1 != inputStride) {
+			PackInt24Scalar(input, inputStride, output, count, shift);
+			return;
+		}
+
+		auto bytes = static_cast<uint8_t *>(output);
+		const int32x4_t s = vdupq_n_s32((int32_t)shift);
+		static const uint8_t sShuffle [16] = { 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0xff, 0xff, 0xff, 0xff };
+		const uint8x16_t shuffle = vld1q_u8(sShuffle);
+
+		// Each store extends 4 bytes past the samples packed, which are overwritten by the following store
+		UInt32 i = 0;
+		for(; i + 6 <= count; i += 4) {
+			const uint8x16_t v = vreinterpretq_u8_s32(vshlq_s32(vld1q_s32(input + i), s));
+			vst1q_u8(bytes + 3 * i, vqtbl1q_u8(v, shuffle));
+		}
+
+		PackInt24Scalar(input + i, 1, bytes + 3 * i, count - i, shift);
+	}
+
+	void PackInt32NEON(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift)
+	{
+		if(1 != inputStride || 0 == shift) {
+			PackInt32Scalar(input, inputStride, output, count, shift);
+			return;
+		}
+
+		auto samples = static_cast<int32_t *>(output);
+		const int32x4_t s = vdupq_n_s32((int32_t)shift);
+
+		UInt32 i = 0;
+		for(; i + 4 <= count; i += 4)
+			vst1q_s32(samples + i, vshlq_s32(vld1q_s32(input + i), s));
+
+		PackInt32Scalar(input + i, 1, samples + i, count - i, shift);
+	}
+
+	void ReverseBitsNEON(const uint8_t *input, uint8_t *output, UInt32 count)
+	{
+		UInt32 i = 0;
+		for(; i + 16 <= count; i += 16)
+			vst1q_u8(output + i, vrbitq_u8(vld1q_u8(input + i)));
+
+		ReverseBitsScalar(input + i, output + i, count - i);
+	}
+
+	uint8_t PackDoPNEON(uint8_t *buffer, UInt32 dsdOffset, UInt32 frameCount, uint8_t marker, bool reverseBits)
+	{
+		const uint8_t *src = buffer + dsdOffset;
+		uint8_t *dst = buffer;
+		UInt32 framesRemaining = frameCount;
+
+		// The marker alternates each frame, so for an even number of frames the pattern is fixed
+		const uint8_t m0 = marker, m1 = (uint8_t)~marker;
+		const uint8_t markerBytesLow [16] = { m0, 0, 0, m1, 0, 0, m0, 0, 0, m1, 0, 0, m0, 0, 0, m1 };
+		const uint8_t markerBytesHigh [8] = { 0, 0, m0, 0, 0, m1, 0, 0 };
+		const uint8x16_t markersLow		= vld1q_u8(markerBytesLow);
+		const uint8x8_t markersHigh		= vld1_u8(markerBytesHigh);
+
+		// Shuffles distributing the DSD bytes of eight DoP frames across 24 output bytes, leaving room for the markers
+		static const uint8_t sShuffleLow [16]	= { 0xff, 0, 1, 0xff, 2, 3, 0xff, 4, 5, 0xff, 6, 7, 0xff, 8, 9, 0xff };
+		static const uint8_t sShuffleHigh [16]	= { 10, 11, 0xff, 12, 13, 0xff, 14, 15, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+		const uint8x16_t shuffleLow		= vld1q_u8(sShuffleLow);
+		const uint8x16_t shuffleHigh	= vld1q_u8(sShuffleHigh);
+
+		while(8 <= framesRemaining) {
+			uint8x16_t dsd = vld1q_u8(src);
+			if(reverseBits)
+				dsd = vrbitq_u8(dsd);
+
+			vst1q_u8(dst, vorrq_u8(vqtbl1q_u8(dsd, shuffleLow), markersLow));
+			vst1_u8(dst + 16, vorr_u8(vget_low_u8(vqtbl1q_u8(dsd, shuffleHigh)), markersHigh));
+
+			src += 16;
+			dst += 24;
+			framesRemaining -= 8;
+		}
+
+		return PackDoPScalar(dst, (UInt32)(src - dst), framesRemaining, marker, reverseBits);
+	}
+
+#endif
+
+	SFB::Audio::SampleKernels CreateScalarKernels()
+	{
+		SFB::Audio::SampleKernels kernels;
+
+		kernels.Deinterleave			= DeinterleaveScalar;
+		kernels.DeinterleaveBytes		= DeinterleaveBytesScalar;
+		kernels.Interleave				= InterleaveScalar;
+		kernels.Copy					= CopyScalar;
+		kernels.Scale					= ScaleScalar;
+		kernels.MultiplyAdd				= MultiplyAddScalar;
+		kernels.MaximumMagnitude		= MaximumMagnitudeScalar;
+		kernels.SumOfSquares			= SumOfSquaresScalar;
+		kernels.DotProduct				= DotProductScalar;
+		kernels.Filter					= FilterKernel<DotProductScalar>;
+		kernels.ConvertFloatToInteger	= ConvertFloatToIntegerScalar;
+		kernels.ConvertInt16ToFloat		= ConvertInt16ToFloatScalar;
+		kernels.ConvertInt24ToFloat		= ConvertInt24ToFloatScalar;
+		kernels.ConvertInt32ToFloat		= ConvertInt32ToFloatScalar;
+		kernels.PackInt8				= PackInt8Scalar;
+		kernels.PackInt16				= PackInt16Scalar;
+		kernels.PackInt24				= PackInt24Scalar;
+		kernels.PackInt32				= PackInt32Scalar;
+		kernels.ReverseBits				= ReverseBitsScalar;
+		kernels.PackDoP					= PackDoPScalar;
+		kernels.TranslateDSD			= TranslateDSDScalar;
+		kernels.mInstructionSet			= SFB::Audio::SampleKernels::InstructionSet::Scalar;
+
+		return kernels;
+	}
+
+	// The most capable instruction set available on the host
+	SFB::Audio::SampleKernels::InstructionSet GetBestInstructionSet()
+	{
+		using InstructionSet = SFB::Audio::SampleKernels::InstructionSet;
+
+		for(auto instructionSet : { InstructionSet::NEON, InstructionSet::AVX512, InstructionSet::AVX2, InstructionSet::SSE2 }) {
+			if(SFB::Audio::SampleKernels::IsInstructionSetAvailable(instructionSet))
+				return instructionSet;
+		}
+
+		return InstructionSet::Scalar;
+	}
+
+}
+
+#pragma mark Kernel Selection
+
+const SFB::Audio::SampleKernels& SFB::Audio::SampleKernels::Get()
+{
+	static const SampleKernels sKernels = []() {
+		SampleKernels kernels;
+		if(!GetForInstructionSet(GetBestInstructionSet(), kernels))
+			kernels = GetScalar();
+
+		LOGGER_INFO("org.sbooth.AudioEngine.SampleKernels", "Using " << GetInstructionSetName(kernels.mInstructionSet) << " sample kernels");
+
+		return kernels;
+	}();
+
+	return sKernels;
+}
+
+const SFB::Audio::SampleKernels& SFB::Audio::SampleKernels::GetScalar()
+{
+	static const SampleKernels sKernels = CreateScalarKernels();
+	return sKernels;
+}
+
+bool SFB::Audio::SampleKernels::GetForInstructionSet(InstructionSet instructionSet, SampleKernels& kernels)
+{
+	if(!IsInstructionSetAvailable(instructionSet))
+		return false;
+
+	// Kernels without an implementation for an instruction set use the next less capable one
+	kernels = CreateScalarKernels();
+
+#if SAMPLE_KERNELS_X86
+# if __SSE2__
+	if(InstructionSet::SSE2 <= instructionSet) {
+		kernels.Deinterleave			= DeinterleaveSSE2;
+		kernels.DeinterleaveBytes		= DeinterleaveBytesSSE2;
+		kernels.Interleave				= InterleaveSSE2;
+		kernels.Scale					= ScaleSSE2;
+		kernels.MultiplyAdd				= MultiplyAddSSE2;
+		kernels.MaximumMagnitude		= MaximumMagnitudeSSE2;
+		kernels.SumOfSquares			= SumOfSquaresSSE2;
+		kernels.DotProduct				= DotProductSSE2;
+		kernels.Filter					= FilterKernel<DotProductSSE2>;
+		kernels.ConvertFloatToInteger	= ConvertFloatToIntegerSSE2;
+		kernels.ConvertInt16ToFloat		= ConvertInt16ToFloatSSE2;
+		kernels.ConvertInt32ToFloat		= ConvertInt32ToFloatSSE2;
+		kernels.PackInt8				= PackInt8SSE2;
+		kernels.PackInt16				= PackInt16SSE2;
+		kernels.PackInt32				= PackInt32SSE2;
+	}
+# endif
+
+	if(InstructionSet::AVX2 <= instructionSet) {
+		kernels.Deinterleave			= DeinterleaveAVX2;
+		kernels.Interleave				= InterleaveAVX2;
+		kernels.Scale					= ScaleAVX2;
+		kernels.MultiplyAdd				= MultiplyAddAVX2;
+		kernels.MaximumMagnitude		= MaximumMagnitudeAVX2;
+		kernels.SumOfSquares			= SumOfSquaresAVX2;
+		kernels.DotProduct				= DotProductAVX2;
+		kernels.Filter					= FilterKernel<DotProductAVX2>;
+		kernels.ConvertFloatToInteger	= ConvertFloatToIntegerAVX2;
+		kernels.ConvertInt16ToFloat		= ConvertInt16ToFloatAVX2;
+		kernels.ConvertInt24ToFloat		= ConvertInt24ToFloatAVX2;
+		kernels.ConvertInt32ToFloat		= ConvertInt32ToFloatAVX2;
+		kernels.PackInt16				= PackInt16AVX2;
+		kernels.PackInt24				= PackInt24AVX2;
+		kernels.PackInt32				= PackInt32AVX2;
+		kernels.ReverseBits				= ReverseBitsAVX2;
+		kernels.PackDoP					= PackDoPAVX2;
+	}
+
+	if(InstructionSet::AVX512 <= instructionSet) {
+		kernels.Scale					= ScaleAVX512;
+		kernels.MultiplyAdd				= MultiplyAddAVX512;
+		kernels.MaximumMagnitude		= MaximumMagnitudeAVX512;
+		kernels.SumOfSquares			= SumOfSquaresAVX512;
+		kernels.DotProduct				= DotProductAVX512;
+		kernels.Filter					= FilterKernel<DotProductAVX512>;
+		kernels.ConvertFloatToInteger	= ConvertFloatToIntegerAVX512;
+		kernels.ConvertInt16ToFloat		= ConvertInt16ToFloatAVX512;
+		kernels.ConvertInt32ToFloat		= ConvertInt32ToFloatAVX512;
+	}
+#elif SAMPLE_KERNELS_NEON
+	if(InstructionSet::NEON == instructionSet) {
+		kernels.Deinterleave			= DeinterleaveNEON;
+		kernels.DeinterleaveBytes		= DeinterleaveBytesNEON;
+		kernels.Interleave				= InterleaveNEON;
+		kernels.Scale					= ScaleNEON;
+		kernels.MultiplyAdd				= MultiplyAddNEON;
+		kernels.MaximumMagnitude		= MaximumMagnitudeNEON;
+		kernels.SumOfSquares			= SumOfSquaresNEON;
+		kernels.DotProduct				= DotProductNEON;
+		kernels.Filter					= FilterKernel<DotProductNEON>;
+		kernels.ConvertFloatToInteger	= ConvertFloatToIntegerNEON;
+		kernels.ConvertInt16ToFloat		= ConvertInt16ToFloatNEON;
+		kernels.ConvertInt24ToFloat		= ConvertInt24ToFloatNEON;
+		kernels.ConvertInt32ToFloat		= ConvertInt32ToFloatNEON;
+		kernels.PackInt8				= PackInt8NEON;
+		kernels.PackInt16				= PackInt16NEON;
+		kernels.PackInt24				= PackInt24NEON;
+		kernels.PackInt32				= PackInt32NEON;
+		kernels.ReverseBits				= ReverseBitsNEON;
+		kernels.PackDoP					= PackDoPNEON;
+	}
+#endif
+
+	kernels.mInstructionSet = instructionSet;
+
+	return true;
+}
+
+bool SFB::Audio::SampleKernels::IsInstructionSetAvailable(InstructionSet instructionSet)
+{
+	switch(instructionSet) {
+		case InstructionSet::Scalar:	return true;
+#if SAMPLE_KERNELS_X86
+# if __SSE2__
+		case InstructionSet::SSE2:		return true;
+# else
+		case InstructionSet::SSE2:		return false;
+# endif
+		case InstructionSet::AVX2:		return GetProcessorFeatures().mAVX2;
+		case InstructionSet::AVX512:	return GetProcessorFeatures().mAVX512 && GetProcessorFeatures().mAVX2;
+		case InstructionSet::NEON:		return false;
+#elif SAMPLE_KERNELS_NEON
+		case InstructionSet::NEON:		return true;
+		default:						return false;
+#else
+		default:						return false;
+#endif
+	}
+
+	return false;
+}
+
+const char * SFB::Audio::SampleKernels::GetInstructionSetName(InstructionSet instructionSet)
+{
+	switch(instructionSet) {
+		case InstructionSet::Scalar:	return "scalar";
+		case InstructionSet::SSE2:		return "sse2";
+		case InstructionSet::AVX2:		return "avx2";
+		case InstructionSet::AVX512:	return "avx512";
+		case InstructionSet::NEON:		return "neon";
+	}
+
+	return "unknown";
+}
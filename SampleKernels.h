@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <MacTypes.h>
+
+/*! @file SampleKernels.h @brief Sample processing kernels selected for the host processor */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief %Audio functionality */
+	namespace Audio {
+
+		/*!
+		 * @brief A table of sample processing kernels
+		 *
+		 * Each kernel has a scalar reference implementation and most have implementations using the instruction
+		 * sets of Intel and ARM processors.  The processor's features are detected once, when \c Get() is first
+		 * called, and the fastest available implementation of each kernel is selected.
+		 *
+		 * Kernels read and write unaligned buffers, which may not overlap unless noted.
+		 */
+		struct SampleKernels
+		{
+			/*! @brief Instruction sets, in increasing order of capability within an architecture */
+			enum class InstructionSet {
+				Scalar		= 0,	/*!< Portable C++ */
+				SSE2		= 1,	/*!< SSE2 */
+				AVX2		= 2,	/*!< AVX2 */
+				AVX512		= 3,	/*!< AVX-512 Foundation */
+				NEON		= 4,	/*!< ARM Advanced SIMD */
+			};
+
+			// ========================================
+			/*! @name Kernel types */
+			//@{
+
+			/*! @brief Copy interleaved samples to one buffer per channel */
+			using DeinterleaveFunction = void (*)(const float *input, float * const *outputs, UInt32 channelCount, UInt32 frameCount);
+
+			/*! @brief Copy interleaved bytes to one buffer per channel */
+			using DeinterleaveBytesFunction = void (*)(const uint8_t *input, uint8_t * const *outputs, UInt32 channelCount, UInt32 frameCount);
+
+			/*! @brief Copy one buffer per channel to interleaved samples */
+			using InterleaveFunction = void (*)(const float * const *inputs, float *output, UInt32 channelCount, UInt32 frameCount);
+
+			/*! @brief Copy every \c inputStride'th sample of \c input to every \c outputStride'th sample of \c output */
+			using CopyFunction = void (*)(const float *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count);
+
+			/*! @brief Multiply samples by a gain; \c input and \c output may be the same */
+			using ScaleFunction = void (*)(const float *input, float *output, UInt32 count, float gain);
+
+			/*! @brief Add samples multiplied by a gain to \c output */
+			using MultiplyAddFunction = void (*)(const float *input, float *output, UInt32 count, float gain);
+
+			/*! @brief Return the largest absolute value of the samples, or \c 0 if \c count is \c 0 */
+			using MaximumMagnitudeFunction = float (*)(const float *input, UInt32 count);
+
+			/*! @brief Return the sum of the squares of the samples */
+			using SumOfSquaresFunction = float (*)(const float *input, UInt32 count);
+
+			/*! @brief Return the sum of the products of corresponding samples of \c a and \c b */
+			using DotProductFunction = float (*)(const float *a, const float *b, UInt32 count);
+
+			/*!
+			 * @brief Apply an FIR filter, with \c output[n] the dot product of \c filter and the \c filterLength samples
+			 * of \c input beginning at \c n \c * \c decimationFactor; \c input and \c output may be the same
+			 */
+			using FilterFunction = void (*)(const float *input, UInt32 decimationFactor, const float *filter, UInt32 filterLength, float *output, UInt32 outputCount);
+
+			/*! @brief Convert samples in [-1, 1) to signed integers of \c bitsPerSample bits, in [8, 24], with rounding and clipping */
+			using ConvertFloatToIntegerFunction = void (*)(const float *input, int32_t *output, UInt32 count, UInt32 bitsPerSample);
+
+			/*! @brief Convert signed 16-bit samples to floating point and multiply by \c scale; strides are in samples */
+			using ConvertInt16ToFloatFunction = void (*)(const int16_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale);
+
+			/*! @brief Convert packed, native-endian signed 24-bit samples to floating point and multiply by \c scale; strides are in samples */
+			using ConvertInt24ToFloatFunction = void (*)(const uint8_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale);
+
+			/*! @brief Convert signed 32-bit samples to floating point and multiply by \c scale; strides are in samples */
+			using ConvertInt32ToFloatFunction = void (*)(const int32_t *input, UInt32 inputStride, float *output, UInt32 outputStride, UInt32 count, float scale);
+
+			/*!
+			 * @brief Shift signed 32-bit samples left by \c shift bits and truncate them to packed, native-endian samples of the
+			 * kernel's width; \c inputStride is in samples
+			 */
+			using PackIntegerFunction = void (*)(const int32_t *input, UInt32 inputStride, void *output, UInt32 count, UInt32 shift);
+
+			/*! @brief Reverse the order of the bits in each byte; \c input and \c output may be the same */
+			using ReverseBitsFunction = void (*)(const uint8_t *input, uint8_t *output, UInt32 count);
+
+			/*!
+			 * @brief Pack \c frameCount DoP frames in place, expanding the most significant bit first DSD bytes at
+			 * \c buffer \c + \c dsdOffset into 24-bit samples at \c buffer marked alternately with \c marker and its complement
+			 * @note \c dsdOffset must be at least \c frameCount so the samples don't overtake the DSD bytes not yet read
+			 * @return The marker for the frame following the last one packed
+			 */
+			using PackDoPFunction = uint8_t (*)(uint8_t *buffer, UInt32 dsdOffset, UInt32 frameCount, uint8_t marker, bool reverseBits);
+
+			/*! @brief The number of lookup tables of 256 coefficients used by \c TranslateDSD */
+			static constexpr UInt32 kDSDTableCount = 6;
+
+			/*! @brief The DSD retained between calls to \c TranslateDSD for one channel */
+			struct DSDTranslationState
+			{
+				uint8_t		mFIFO [16];			/*!< @brief The most recent DSD bytes */
+				UInt32		mFIFOPosition;		/*!< @brief The position of the next byte in \c mFIFO */
+			};
+
+			/*!
+			 * @brief Translate DSD bytes to one PCM sample each using the dsd2pcm lookup tables, \c kDSDTableCount tables
+			 * of 256 coefficients
+			 */
+			using TranslateDSDFunction = void (*)(const float *tables, DSDTranslationState& state, const uint8_t *input, bool lsbitfirst, float *output, UInt32 count);
+
+			//@}
+
+
+			// ========================================
+			/*! @name Kernels */
+			//@{
+
+			DeinterleaveFunction				Deinterleave;				/*!< @brief Deinterleaving */
+			DeinterleaveBytesFunction			DeinterleaveBytes;			/*!< @brief Deinterleaving of DSD and 8-bit samples */
+			InterleaveFunction					Interleave;					/*!< @brief Interleaving */
+			CopyFunction						Copy;						/*!< @brief Strided copying */
+			ScaleFunction						Scale;						/*!< @brief Gain */
+			MultiplyAddFunction					MultiplyAdd;				/*!< @brief Mixing */
+			MaximumMagnitudeFunction			MaximumMagnitude;			/*!< @brief Peak level */
+			SumOfSquaresFunction				SumOfSquares;				/*!< @brief Signal energy */
+			DotProductFunction					DotProduct;					/*!< @brief Interpolation */
+			FilterFunction						Filter;						/*!< @brief FIR filtering and decimation */
+			ConvertFloatToIntegerFunction		ConvertFloatToInteger;		/*!< @brief Floating point to integer conversion */
+			ConvertInt16ToFloatFunction			ConvertInt16ToFloat;		/*!< @brief 16-bit integer to floating point conversion */
+			ConvertInt24ToFloatFunction			ConvertInt24ToFloat;		/*!< @brief 24-bit integer to floating point conversion */
+			ConvertInt32ToFloatFunction			ConvertInt32ToFloat;		/*!< @brief 32-bit integer to floating point conversion */
+			PackIntegerFunction					PackInt8;					/*!< @brief Integer packing to 8 bits */
+			PackIntegerFunction					PackInt16;					/*!< @brief Integer packing to 16 bits */
+			PackIntegerFunction					PackInt24;					/*!< @brief Integer packing to 24 bits */
+			PackIntegerFunction					PackInt32;					/*!< @brief Integer alignment in 32 bits */
+			ReverseBitsFunction					ReverseBits;				/*!< @brief DSD bit order conversion */
+			PackDoPFunction						PackDoP;					/*!< @brief DSD over PCM packing */
+			TranslateDSDFunction				TranslateDSD;				/*!< @brief DSD to PCM conversion */
+
+			/*! @brief The most capable instruction set used by the kernels */
+			InstructionSet						mInstructionSet;
+
+			//@}
+
+
+			// ========================================
+			/*! @name Kernel selection */
+			//@{
+
+			/*!
+			 * @brief Get the fastest kernels for the host processor
+			 * @note This method is real-time safe after its first call
+			 */
+			static const SampleKernels& Get();
+
+			/*! @brief Get the scalar reference kernels */
+			static const SampleKernels& GetScalar();
+
+			/*!
+			 * @brief Get the kernels using at most an instruction set
+			 * @note This is intended for testing and benchmarking
+			 * @param instructionSet The instruction set
+			 * @param kernels The kernels
+			 * @return \c true on success, \c false if \c instructionSet isn't supported by the host processor
+			 */
+			static bool GetForInstructionSet(InstructionSet instructionSet, SampleKernels& kernels);
+
+			/*! @brief Query whether the host processor supports an instruction set */
+			static bool IsInstructionSetAvailable(InstructionSet instructionSet);
+
+			/*! @brief Get the name of an instruction set */
+			static const char * GetInstructionSetName(InstructionSet instructionSet);
+
+			//@}
+		};
+
+	}
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include "Signposts.h"
+
+#if SFB_SIGNPOSTS_ENABLED
+
+namespace {
+
+	os_log_t CreateLog()
+	{
+		if(__builtin_available(macOS 10.12, iOS 10.0, *))
+			return os_log_create("org.sbooth.AudioEngine", "Pipeline");
+		return nullptr;
+	}
+
+}
+
+os_log_t SFB::Signposts::log = CreateLog();
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2018 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+/*! @file Signposts.h @brief Signpost intervals for tracing the decoding and rendering pipeline in Instruments */
+
+/*!
+ * @brief Whether signposts are compiled
+ *
+ * Signposts are enabled by default in debug builds and may be enabled in other builds by defining
+ * \c SFB_SIGNPOSTS_ENABLED to \c 1.  When disabled the signpost macros expand to nothing.
+ */
+#ifndef SFB_SIGNPOSTS_ENABLED
+# if DEBUG
+#  define SFB_SIGNPOSTS_ENABLED 1
+# else
+#  define SFB_SIGNPOSTS_ENABLED 0
+# endif
+#endif
+
+#if SFB_SIGNPOSTS_ENABLED && !__has_include(<os/signpost.h>)
+# undef SFB_SIGNPOSTS_ENABLED
+# define SFB_SIGNPOSTS_ENABLED 0
+#endif
+
+#if SFB_SIGNPOSTS_ENABLED
+
+#include <os/signpost.h>
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*! @brief The namespace containing signpost functionality */
+	namespace Signposts {
+
+		/*!
+		 * @brief The log receiving signposts
+		 * @note This is created when the library is loaded so that signposts may be emitted from the real-time thread.
+		 * It is \c nullptr if the unified logging system is unavailable.
+		 */
+		extern os_log_t _Nullable log;
+
+	}
+}
+
+/*!
+ * @brief Begin a signpost interval
+ * @note \c name and \c format must be string literals.  Formatting an object with \c %@ is not real-time safe.
+ * @param name The interval's name
+ * @param object A pointer identifying the interval, which must match the pointer passed to \c SFB_SIGNPOST_INTERVAL_END()
+ * @param format A \c printf-style format string followed by its arguments
+ */
+#define SFB_SIGNPOST_INTERVAL_BEGIN(name, object, format, ...) { \
+	if(__builtin_available(macOS 10.14, iOS 12.0, *)) { \
+		if(::SFB::Signposts::log && os_signpost_enabled(::SFB::Signposts::log)) \
+			os_signpost_interval_begin(::SFB::Signposts::log, os_signpost_id_make_with_pointer(::SFB::Signposts::log, object), name, format, ##__VA_ARGS__); \
+	} \
+}
+
+/*!
+ * @brief End a signpost interval
+ * @note \c name and \c format must be string literals
+ * @param name The interval's name, which must match the name passed to \c SFB_SIGNPOST_INTERVAL_BEGIN()
+ * @param object The pointer identifying the interval
+ * @param format A \c printf-style format string followed by its arguments
+ */
+#define SFB_SIGNPOST_INTERVAL_END(name, object, format, ...) { \
+	if(__builtin_available(macOS 10.14, iOS 12.0, *)) { \
+		if(::SFB::Signposts::log && os_signpost_enabled(::SFB::Signposts::log)) \
+			os_signpost_interval_end(::SFB::Signposts::log, os_signpost_id_make_with_pointer(::SFB::Signposts::log, object), name, format, ##__VA_ARGS__); \
+	} \
+}
+
+#else
+
+#define SFB_SIGNPOST_INTERVAL_BEGIN(name, object, format, ...) {}
+#define SFB_SIGNPOST_INTERVAL_END(name, object, format, ...) {}
+
+#endif
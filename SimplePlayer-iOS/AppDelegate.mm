@@ -36,7 +36,7 @@
 
 - (BOOL)application:(UIApplication *)application didFinishLaunchingWithOptions:(NSDictionary *)launchOptions
 {
-	asl_add_log_file(nullptr, STDERR_FILENO);
+	::SFB::Logger::SetStandardErrorEnabled(true);
 	::SFB::Logger::SetCurrentLevel(::SFB::Logger::debug);
 
 	return YES;
@@ -16,7 +16,7 @@
 {
 #pragma unused(notification)
 	// Enable verbose logging to stderr
-	asl_add_log_file(nullptr, STDERR_FILENO);
+	::SFB::Logger::SetStandardErrorEnabled(true);
 	::SFB::Logger::SetCurrentLevel(::SFB::Logger::debug);
 
 	// Show the player window